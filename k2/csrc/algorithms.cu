@@ -22,6 +22,7 @@
 #include "k2/csrc/algorithms.h"
 #include "k2/csrc/array.h"
 #include "k2/csrc/array_ops.h"
+#include "k2/csrc/cub.h"
 #include "k2/csrc/macros.h"
 #include "k2/csrc/nvtx.h"
 
@@ -52,16 +53,165 @@ inline void ComputeNew2OldHelper(ContextPtr &c, const int32_t *old2new_data,
       });
 }
 
+#ifdef K2_WITH_CUDA
+constexpr int32_t kCompactBlockSize = 256;
+constexpr int32_t kCompactItemsPerThread = 4;
+constexpr int32_t kCompactTileSize =
+    kCompactBlockSize * kCompactItemsPerThread;
+using CompactTileState = cub::ScanTileState<int32_t>;
+
+__global__ void InitCompactTileStateKernel(CompactTileState tile_state,
+                                           int32_t num_tiles) {
+  tile_state.InitializeStatus(num_tiles);
+}
+
+/*
+  Single-pass stream compaction; see CompactKeep().  Each block handles a
+  tile of kCompactTileSize elements (the extra element old_dim included),
+  and gets the number of kept elements before its tile from the preceding
+  tiles by decoupled look-back, so all outputs are written by this kernel.
+ */
+__global__ void CompactKeepKernel(int32_t old_dim, const char *keep_data,
+                                  CompactTileState tile_state,
+                                  int32_t *old2new_data, int32_t *new2old_data,
+                                  const int32_t *payload_src,
+                                  int32_t *payload_dest,
+                                  int32_t payload_words) {
+  using BlockScanT = cub::BlockScan<int32_t, kCompactBlockSize>;
+  using PrefixOpT =
+      cub::TilePrefixCallbackOp<int32_t, cub::Sum, CompactTileState>;
+  __shared__ typename PrefixOpT::TempStorage prefix_storage;
+  __shared__ typename BlockScanT::TempStorage scan_storage;
+
+  int32_t tile_idx = blockIdx.x,
+          begin = tile_idx * kCompactTileSize +
+                  threadIdx.x * kCompactItemsPerThread;
+  int32_t keep[kCompactItemsPerThread], thread_count = 0;
+  for (int32_t k = 0; k < kCompactItemsPerThread; ++k) {
+    int32_t old_idx = begin + k;
+    keep[k] = (old_idx < old_dim ? keep_data[old_idx] : 0);
+    thread_count += keep[k];
+  }
+
+  int32_t new_idx;  // Number of kept elements before `begin`.
+  if (tile_idx == 0) {
+    int32_t tile_count;
+    BlockScanT(scan_storage).ExclusiveSum(thread_count, new_idx, tile_count);
+    if (threadIdx.x == 0 && gridDim.x > 1)
+      tile_state.SetInclusive(0, tile_count);
+  } else {
+    PrefixOpT prefix_op(tile_state, prefix_storage, cub::Sum(), tile_idx);
+    BlockScanT(scan_storage).ExclusiveSum(thread_count, new_idx, prefix_op);
+  }
+
+  for (int32_t k = 0; k < kCompactItemsPerThread; ++k) {
+    int32_t old_idx = begin + k;
+    if (old_idx > old_dim) break;
+    old2new_data[old_idx] = new_idx;
+    if (old_idx == old_dim) {
+      new2old_data[new_idx] = old_dim;
+    } else if (keep[k] > 0) {
+      new2old_data[new_idx] = old_idx;
+      for (int32_t w = 0; w < payload_words; ++w)
+        payload_dest[new_idx * payload_words + w] =
+            payload_src[old_idx * payload_words + w];
+    }
+    new_idx += keep[k];
+  }
+}
+#endif
+
+/*
+  Computes old2new (the exclusive sum of `keep_data`), new2old and, if
+  payload_words > 0, the kept elements of a payload in one pass: on GPU, in
+  one kernel.
+
+     @param [in] c   Context to use
+     @param [in] old_dim  The number of old elements
+     @param [in] keep_data  0 or 1 for each old element
+     @param [out] old2new_data  Array with old_dim + 1 elements
+     @param [out] new2old_data  Array with old_dim + 1 elements (an upper
+                        bound); at exit, element num_new_elems is old_dim.
+     @param [in] payload_src  The payload, if payload_words > 0: old_dim
+                        elements of payload_words int32_t's each.
+     @param [out] payload_dest  The kept elements of the payload are written
+                        here; it must have space for old_dim elements.
+     @param [in] payload_words  The size of each payload element in units of
+                        int32_t, or 0 if there is no payload.
+ */
+void CompactKeep(ContextPtr &c, int32_t old_dim, const char *keep_data,
+                 int32_t *old2new_data, int32_t *new2old_data,
+                 const int32_t *payload_src, int32_t *payload_dest,
+                 int32_t payload_words) {
+  NVTX_RANGE(K2_FUNC);
+  if (c->GetDeviceType() == kCpu) {
+    int32_t new_idx = 0;
+    for (int32_t old_idx = 0; old_idx < old_dim; ++old_idx) {
+      old2new_data[old_idx] = new_idx;
+      if (keep_data[old_idx] > 0) {
+        new2old_data[new_idx] = old_idx;
+        std::copy(payload_src + old_idx * payload_words,
+                  payload_src + (old_idx + 1) * payload_words,
+                  payload_dest + new_idx * payload_words);
+      }
+      new_idx += keep_data[old_idx];
+    }
+    old2new_data[old_dim] = new_idx;
+    new2old_data[new_idx] = old_dim;
+    return;
+  }
+#ifdef K2_WITH_CUDA
+  K2_CHECK_EQ(c->GetDeviceType(), kCuda);
+  cudaStream_t stream = c->GetCudaStream();
+  int32_t num_tiles = NumBlocks(old_dim + 1, kCompactTileSize);
+  CompactTileState tile_state;
+  size_t tile_state_bytes = 0;
+  K2_CUDA_SAFE_CALL(
+      CompactTileState::AllocationSize(num_tiles, tile_state_bytes));
+  RegionPtr tile_state_storage = NewRegion(c, tile_state_bytes);
+  K2_CUDA_SAFE_CALL(tile_state.Init(num_tiles, tile_state_storage->data,
+                                    tile_state_bytes));
+  int32_t num_init_blocks = NumBlocks(num_tiles, kCompactBlockSize);
+  K2_CUDA_SAFE_CALL(InitCompactTileStateKernel<<<num_init_blocks,
+                                                 kCompactBlockSize, 0,
+                                                 stream>>>(tile_state,
+                                                           num_tiles));
+  K2_CUDA_SAFE_CALL(CompactKeepKernel<<<num_tiles, kCompactBlockSize, 0,
+                                        stream>>>(
+      old_dim, keep_data, tile_state, old2new_data, new2old_data,
+      payload_src, payload_dest, payload_words));
+#else
+  K2_LOG(FATAL) << "Unreachable code!";
+#endif
+}
+
 }  // namespace
 
-void Renumbering::ComputeNew2Old() {
+void Renumbering::ComputeNew2Old(const void *payload_src, void *payload_dest,
+                                 int32_t payload_elem_size) {
   NVTX_RANGE(K2_FUNC);
-  if (!old2new_.IsValid()) ComputeOld2New();
-  new2old_ = Array1<int32_t>(keep_.Context(), num_new_elems_ + 1);
-  const int32_t *old2new_data = old2new_.Data();
-  int32_t *new2old_data = new2old_.Data();
-  ComputeNew2OldHelper(keep_.Context(), old2new_data, new2old_data,
-                       keep_.Dim());
+  ContextPtr &c = keep_.Context();
+  int32_t old_dim = keep_.Dim();
+  if (old2new_.IsValid()) {
+    K2_CHECK_EQ(payload_src, nullptr);
+    new2old_ = Array1<int32_t>(c, num_new_elems_ + 1);
+    ComputeNew2OldHelper(c, old2new_.Data(), new2old_.Data(), old_dim);
+    new2old_ = new2old_.Range(0, num_new_elems_);
+    return;
+  }
+  // new2old_ is allocated with the max possible size, so that old2new_,
+  // new2old_ and the payload can be computed together, without first
+  // waiting for the number of kept elements.
+  K2_CHECK_EQ(payload_elem_size % sizeof(int32_t), 0);
+  old2new_ = Array1<int32_t>(c, old_dim + 1);
+  new2old_ = Array1<int32_t>(c, old_dim + 1);
+  CompactKeep(c, old_dim, keep_.Data(), old2new_.Data(), new2old_.Data(),
+              reinterpret_cast<const int32_t *>(payload_src),
+              reinterpret_cast<int32_t *>(payload_dest),
+              payload_elem_size / sizeof(int32_t));
+  num_new_elems_ = old2new_.Back();
+  K2_CHECK_GE(num_new_elems_, 0);
+  K2_CHECK_LE(num_new_elems_, old_dim);
   new2old_ = new2old_.Range(0, num_new_elems_);
 }
 
@@ -159,10 +159,38 @@ class Renumbering {
     return old2new_.Arange(0, old2new_.Dim() - 1);
   }
 
+  /*
+    Returns the kept elements of `src`, i.e. src[New2Old()].  If neither
+    New2Old() nor Old2New() has been computed yet, they are computed in the
+    same pass as the copy (a single kernel on GPU), which saves kernel
+    launches and memory traffic in the usual pattern of pruning an array.
+
+       @param [in] src  Array with src.Dim() == NumOldElems(), on the
+                        same device as this object.
+       @return  Returns an array with Dim() == NumNewElems().  If computed
+                in the same pass, its memory is that of NumOldElems()
+                elements.
+  */
+  template <typename T>
+  Array1<T> Compact(const Array1<T> &src) {
+    NVTX_RANGE(K2_FUNC);
+    K2_CHECK_EQ(src.Dim(), NumOldElems());
+    if (old2new_.IsValid() || sizeof(T) % sizeof(int32_t) != 0)
+      return src[New2Old()];
+    Array1<T> ans(src.Context(), NumOldElems());
+    ComputeNew2Old(src.Data(), ans.Data(), sizeof(T));
+    return ans.Range(0, num_new_elems_);
+  }
+
  private:
   void ComputeOld2New();
-  // ComputeNew2Old() also computes old2new_ if needed.
-  void ComputeNew2Old();
+  // ComputeNew2Old() also computes old2new_ if needed, and, if payload_src
+  // != nullptr (which requires !old2new_.IsValid()), copies the kept
+  // elements of the payload (each of payload_elem_size bytes, a multiple of
+  // 4) to payload_dest.
+  void ComputeNew2Old(const void *payload_src = nullptr,
+                      void *payload_dest = nullptr,
+                      int32_t payload_elem_size = 0);
 
   Array1<char> keep_;  // array of elements to keep; dimension is the
                        // `num_old_elems` provided in the constructor but it
@@ -106,6 +106,54 @@ TEST(AlgorithmsTest, TestRenumbering) {
   }
 }
 
+TEST(AlgorithmsTest, TestRenumberingCompact) {
+  for (auto &c : {GetCpuContext(), GetCudaContext()}) {
+    for (int32_t i = 0; i < 10; i++) {
+      // Sizes of several tiles of the GPU kernel.
+      int32_t num_old_elems = RandInt(0, 5000);
+      std::vector<char> keep_vec(num_old_elems);
+      std::vector<double> payload_vec(num_old_elems);
+      std::vector<int32_t> old2new_ref(num_old_elems + 1, 0), new2old_ref;
+      for (int32_t j = 0; j < num_old_elems; j++) {
+        keep_vec[j] = RandInt(0, 1);
+        payload_vec[j] = j * 0.5;
+        old2new_ref[j + 1] = old2new_ref[j] + keep_vec[j];
+        if (keep_vec[j]) new2old_ref.push_back(j);
+      }
+      Array1<char> keep(c, keep_vec);
+      Array1<double> payload(c, payload_vec);
+
+      // New2Old() and Old2New() in one pass, with and without payload.
+      for (int32_t with_payload = 0; with_payload < 2; with_payload++) {
+        Renumbering r(c, num_old_elems);
+        r.Keep().CopyFrom(keep);
+        Array1<double> kept_payload;
+        if (with_payload) kept_payload = r.Compact(payload);
+        Array1<int32_t> new2old = r.New2Old(true).To(GetCpuContext()),
+                        old2new = r.Old2New(true).To(GetCpuContext());
+        int32_t num_new_elems = static_cast<int32_t>(new2old_ref.size());
+        EXPECT_EQ(r.NumNewElems(), num_new_elems);
+        ASSERT_EQ(new2old.Dim(), num_new_elems + 1);
+        for (int32_t j = 0; j < num_new_elems; j++)
+          EXPECT_EQ(new2old[j], new2old_ref[j]);
+        EXPECT_EQ(new2old[num_new_elems], num_old_elems);
+        ASSERT_EQ(old2new.Dim(), num_old_elems + 1);
+        for (int32_t j = 0; j <= num_old_elems; j++)
+          EXPECT_EQ(old2new[j], old2new_ref[j]);
+        if (with_payload) {
+          kept_payload = kept_payload.To(GetCpuContext());
+          ASSERT_EQ(kept_payload.Dim(), num_new_elems);
+          for (int32_t j = 0; j < num_new_elems; j++)
+            EXPECT_EQ(kept_payload[j], payload_vec[new2old_ref[j]]);
+        }
+        // After New2Old() has been computed, Compact() uses it.
+        Array1<double> kept_payload2 = r.Compact(payload);
+        EXPECT_TRUE(Equal(kept_payload2, payload[r.New2Old()]));
+      }
+    }
+  }
+}
+
 void TestGetNew2OldAndRowIds() {
   for (auto &c : {GetCpuContext(), GetCudaContext()}) {
     for (int32_t i = 0; i < 10; i++) {
@@ -37,6 +37,10 @@
 
 namespace k2 {
 
+// Defined in array_inl.h.
+template <typename T>
+struct Array1Appender;
+
 /*
   Array1 is a 1-dimensional contiguous array (that doesn't support a stride).
   T must be POD data type, e.g. basic type, struct.
@@ -345,6 +349,78 @@ ToType(int64_t, Long)
     dim_ = new_size;
   }
 
+  /*
+    Returns the number of elements this array can be resized to without
+    reallocating, which is Dim() unless this array covers the highest used
+    index in its region (see Resize()).
+   */
+  int32_t Capacity() const {
+    if (region_ == nullptr ||
+        byte_offset_ + ElementSize() * dim_ != region_->bytes_used)
+      return dim_;
+    return static_cast<int32_t>((region_->num_bytes - byte_offset_) /
+                                ElementSize());
+  }
+
+  /*
+    Makes sure that Capacity() >= capacity, reallocating if needed (the size
+    will at least double), without changing Dim().  This array must cover
+    the highest used index in its region, as for Resize().
+   */
+  void Reserve(int32_t capacity) {
+    NVTX_RANGE(K2_FUNC);
+    if (capacity <= Capacity()) return;
+    std::size_t bytes_used = byte_offset_ + ElementSize() * dim_;
+    K2_CHECK_EQ(bytes_used, region_->bytes_used);
+    region_->Extend(byte_offset_ + ElementSize() * capacity);
+    region_->bytes_used = bytes_used;
+  }
+
+  /*
+    Appends the elements of `src` to this array.  As the allocated size at
+    least doubles when it has to grow (see Resize()), building an array with
+    repeated calls to Append() takes time linear in its final size.
+   */
+  void Append(const Array1<T> &src) {
+    NVTX_RANGE(K2_FUNC);
+    int32_t old_dim = dim_, num_elems = src.Dim();
+    Resize(old_dim + num_elems);
+    Range(old_dim, num_elems).CopyFrom(src);
+  }
+
+  /*
+    For appending elements from kernels: returns an appender that writes
+    the elements past Dim(), up to Capacity(), which can be increased with
+    Reserve() beforehand.  Call FinishAppend() when the kernels are done to
+    include the appended elements in Dim().
+
+      @param [out] num_appended  Will be set to an array with one element,
+                     0, that counts the elements appended; to be passed to
+                     FinishAppend().
+   */
+  Array1Appender<T> GetAppender(Array1<int32_t> *num_appended) {
+    NVTX_RANGE(K2_FUNC);
+    *num_appended = Array1<int32_t>(Context(), 1, 0);
+    Array1Appender<T> ans;
+    ans.data = Data() + dim_;
+    ans.capacity = Capacity() - dim_;
+    ans.num_appended = num_appended->Data();
+    return ans;
+  }
+
+  /*
+    Adds the elements appended with the appender returned by GetAppender()
+    to Dim().  Returns the number of elements that did not fit, which is 0
+    unless not enough memory was reserved; in that case the caller may
+    Resize() back, Reserve() more and append again.
+   */
+  int32_t FinishAppend(const Array1<int32_t> &num_appended) {
+    NVTX_RANGE(K2_FUNC);
+    int32_t n = num_appended[0], capacity = Capacity() - dim_;
+    Resize(dim_ + std::min(n, capacity));
+    return std::max(n - capacity, 0);
+  }
+
   ContextPtr &Context() const { return region_->context; }
 
   // Sets the context on this object (Caution: this is not something you'll
@@ -369,7 +445,7 @@ ToType(int64_t, Long)
   T operator[](int32_t i) const {
     static_assert(!std::is_same<T, Any>::value,
                   "generic arrays not supported here");
-    NVTX_RANGE(K2_FUNC);
+    NVTX_RANGE_NO_OP_STATS(K2_FUNC);
     K2_CHECK_GE(i, 0);
     K2_CHECK_LT(i, Dim());
     const T *data = Data() + i;
@@ -383,6 +459,7 @@ ToType(int64_t, Long)
           cudaMemcpy(static_cast<void *>(&ans), static_cast<const void *>(data),
                      ElementSize(), cudaMemcpyDeviceToHost);
       K2_CHECK_CUDA_ERROR(ret);
+      OpStatsSync();
       return ans;
     }
   }
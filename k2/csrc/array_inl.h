@@ -36,6 +36,34 @@
 
 namespace k2 {
 
+/*
+  Lets kernels append elements to an Array1 past its Dim(), in the memory it
+  has reserved (see Array1::GetAppender()).  The order of the appended
+  elements is the order in which the threads got to them, so it is not
+  deterministic on GPU.
+*/
+template <typename T>
+struct Array1Appender {
+  T *data;                // The element at index Dim() of the array
+  int32_t capacity;       // Number of elements that fit at `data`
+  int32_t *num_appended;  // Number of calls to Append() so far
+
+  /* Appends `t`; returns its index relative to `data`, or -1 if there was
+     no room for it (it is still counted in *num_appended). */
+  __host__ __device__ __forceinline__ int32_t Append(const T &t) const {
+#ifdef __CUDA_ARCH__
+    int32_t idx = atomicAdd(num_appended, 1);
+#else
+    int32_t idx = *num_appended;
+    while (!HostAtomicCompareExchange(num_appended, &idx, idx + 1)) {
+    }
+#endif
+    if (idx >= capacity) return -1;
+    data[idx] = t;
+    return idx;
+  }
+};
+
 template <typename T>
 Array1<T> Array1<T>::Clone() const {
   NVTX_RANGE(K2_FUNC);
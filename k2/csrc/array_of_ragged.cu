@@ -18,7 +18,11 @@
  * limitations under the License.
  */
 
+#include <vector>
+
 #include "k2/csrc/array_of_ragged.h"
+#include "k2/csrc/macros.h"
+#include "k2/csrc/ragged_ops.h"
 
 namespace k2 {
 
@@ -27,102 +31,100 @@ Array1OfRaggedShape::Array1OfRaggedShape(RaggedShape *srcs, int32_t num_srcs,
     : num_srcs_(num_srcs), populate_meta_(populate_meta) {
   K2_CHECK_GT(num_srcs, 0);
   K2_CHECK(srcs);
+  std::vector<RaggedShape *> src_ptrs(num_srcs);
+  for (int32_t i = 0; i < num_srcs; ++i) src_ptrs[i] = srcs + i;
+  Init(src_ptrs.data());
+}
 
+Array1OfRaggedShape::Array1OfRaggedShape(RaggedShape **srcs, int32_t num_srcs,
+                                         bool populate_meta)
+    : num_srcs_(num_srcs), populate_meta_(populate_meta) {
+  K2_CHECK_GT(num_srcs, 0);
+  K2_CHECK(srcs);
+  Init(srcs);
+}
+
+void Array1OfRaggedShape::Init(RaggedShape **srcs) {
+  NVTX_RANGE(K2_FUNC);
   // Initialize context and num_axes_.
-  c_ = srcs[0].Context();
-  num_axes_ = srcs[0].NumAxes();
+  c_ = srcs[0]->Context();
+  num_axes_ = srcs[0]->NumAxes();
 
   // Check if they have same num-axes and compatible context.
   for (int32_t i = 1; i < num_srcs_; ++i) {
-    K2_CHECK_EQ(num_axes_, srcs[i].NumAxes());
-    K2_CHECK(c_->IsCompatible(*(srcs[i].Context())));
+    K2_CHECK_EQ(num_axes_, srcs[i]->NumAxes());
+    K2_CHECK(c_->IsCompatible(*(srcs[i]->Context())));
   }
 
-  // Initialize row_splits__, row_ids_ and tot_sizes_.
+  // Initialize row_splits_, row_ids_ and the first two rows of offsets_.
   //
   // Notice: since the Data() function is a __host__ function, it cannot be
   // called on GPU. It limits us to work on CPU so that the row_splits_ and
   // row_ids_ are populated on CPU, although the operator() of Array2 is a
   // __host__ and __device__ function. Bear in mind, we cannot access the
   // GPU data on CPU.
+  //
+  // Only things that are known on the CPU are read here, i.e. the pointers
+  // and the Dim0() of each source; the other tot-sizes are read from the
+  // row_splits by the kernel below, so this loop never waits for the device.
   row_splits_ =
       Array2<const int32_t *>(GetCpuContext(), num_axes_ - 1, num_srcs_);
   row_ids_ = Array2<const int32_t *>(GetCpuContext(), num_axes_ - 1, num_srcs_);
-
-  // Notice: no matter the return value of TotSize() is from 'cached_tot_size'
-  //  or the Back() function (i.e. operator[]) of array1, it it a CPU value.
-  tot_sizes_ = Array1<int32_t>(GetCpuContext(), num_axes_, 0);
+  offsets_ = Array2<int32_t>(GetCpuContext(), num_axes_ + 1, num_srcs_ + 1);
 
   auto row_splits_acc = row_splits_.Accessor(),
        row_ids_acc = row_ids_.Accessor();
-  // Bear in mind, when axis == 0, the TotSize() is row_splits.Dim() - 1.
-  // When 0 < axis < NumAxes(), the TotSize() is row_splits.Back().
-  int32_t *tot_sizes_data = tot_sizes_.Data();
+  auto offsets_acc = offsets_.Accessor();
 
   for (int32_t i = 0; i < num_srcs_; ++i) {
     for (int32_t j = 1; j < num_axes_; ++j) {
-      row_splits_acc(j - 1, i) = srcs[i].RowSplits(j).Data();
-      row_ids_acc(j - 1, i) = srcs[i].RowIds(j).Data();
-      tot_sizes_data[j] += srcs[i].TotSize(j);
+      row_splits_acc(j - 1, i) = srcs[i]->RowSplits(j).Data();
+      row_ids_acc(j - 1, i) = srcs[i]->RowIds(j).Data();
     }
-    tot_sizes_data[0] += srcs[i].TotSize(0);
+    offsets_acc(0, i) = 1;
+    offsets_acc(1, i) = srcs[i]->Dim0();
   }
 
   row_splits_ = row_splits_.To(c_);
   row_ids_ = row_ids_.To(c_);
+  offsets_ = offsets_.To(c_);
+
+  // Fill in offsets_(axis + 1, src) = srcs[src]->TotSize(axis) for
+  // axis > 0, in one kernel for all the sources, and then take the
+  // exclusive-sum of each row.  Row 0 then becomes 0,1,2,...; the other rows
+  // become the meta-row-splits.
+  int32_t num_axes = num_axes_;
+  auto device_row_splits_acc = row_splits_.Accessor();
+  auto device_offsets_acc = offsets_.Accessor();
+  K2_EVAL(
+      c_, num_srcs_, lambda_set_tot_sizes, (int32_t i)->void {
+        int32_t tot_size = device_offsets_acc(1, i);
+        for (int32_t axis = 1; axis < num_axes; ++axis) {
+          tot_size = device_row_splits_acc(axis - 1, i)[tot_size];
+          device_offsets_acc(axis + 1, i) = tot_size;
+        }
+      });
+  ExclusiveSum(offsets_.ColArange(0, num_srcs_), &offsets_, 1);
+  meta_row_splits_ = offsets_.RowArange(1, num_axes_ + 1);
+
+  // The last column of offsets_ holds the tot-sizes; this is the only
+  // device-to-host copy.
+  Array2<int32_t> offsets_cpu = offsets_.To(GetCpuContext());
+  auto offsets_cpu_acc = offsets_cpu.Accessor();
+  tot_sizes_ = Array1<int32_t>(GetCpuContext(), num_axes_);
+  int32_t *tot_sizes_data = tot_sizes_.Data();
+  for (int32_t axis = 0; axis < num_axes_; ++axis)
+    tot_sizes_data[axis] = offsets_cpu_acc(axis + 1, num_srcs_);
 
   if (populate_meta_) {
-    // Initialize meta_row_splits_
-    // We populate this on CPU and transfer to GPU.
-    meta_row_splits_ =
-        Array2<int32_t>(GetCpuContext(), num_axes_, num_srcs_ + 1);
-    offsets_ = Array2<int32_t>(GetCpuContext(), num_axes_ + 1, num_srcs_ + 1);
-
-    auto meta_row_splits_acc = meta_row_splits_.Accessor(),
-         offsets_acc = offsets_.Accessor();
-
-    // Initialize the 1st row of offsets_, which contains 0,1,2,...
-    for (int32_t col = 0; col <= num_srcs_; ++col) {
-      offsets_acc(0, col) = col;
-    }
-    // Initialize the 1st col of meta_row_splits_ and offsets_
-    for (int32_t row = 0; row < num_axes_; ++row) {
-      meta_row_splits_acc(row, 0) = 0;
-      offsets_acc(row + 1, 0) = 0;
-    }
-
-    // The meta_row_splits_ is the cumulative sum of the tot-sizes of the
-    // individual arrays.
-    for (int32_t i = 0; i < num_axes_; ++i) {
-      for (int32_t j = 1; j <= num_srcs_; ++j) {
-        meta_row_splits_acc(i, j) =
-            meta_row_splits_acc(i, j - 1) + srcs[j - 1].TotSize(i);
-        offsets_acc(i + 1, j) = meta_row_splits_acc(i, j);
-      }
-    }
-
     // Initialize meta_row_ids_
     // Elements are in [0, NumSrcs() - 1]
     meta_row_ids_.resize(num_axes_);
-
     for (int32_t axis = 0; axis < num_axes_; ++axis) {
       // The length equals to TotSize(axis)
-      meta_row_ids_.at(axis) = Array1<int32_t>(
-          GetCpuContext(), meta_row_splits_acc(axis, num_srcs_));
-      int32_t *meta_row_ids_data = meta_row_ids_[axis].Data();
-
-      int32_t cur_row_start = meta_row_splits_acc(axis, 0);
-      for (int32_t src = 0; src < num_srcs_; ++src) {
-        int32_t next_row_start = meta_row_splits_acc(axis, src + 1);
-        for (; cur_row_start < next_row_start; ++cur_row_start) {
-          meta_row_ids_data[cur_row_start] = src;
-        }
-      }
-      meta_row_ids_[axis] = meta_row_ids_[axis].To(c_);
+      meta_row_ids_[axis] = Array1<int32_t>(c_, tot_sizes_data[axis]);
+      RowSplitsToRowIds(meta_row_splits_.Row(axis), &meta_row_ids_[axis]);
     }
-
-    meta_row_splits_ = meta_row_splits_.To(c_);
-    offsets_ = offsets_.To(c_);
   }
 }
 
@@ -56,12 +56,15 @@ class Array1OfRaggedShape {
       srcs: pointers to the source shapes, a CPU pointer
       num_srcs: the number of source shapes.  All shapes must have the
                 same NumAxes() and must be on the same device.
-      populate_meta: Whether to populate meta_row_splits_ and meta_row_id_.
-                     meta_row_splits_ and meta_row_id_ are useful at some time,
-                     but it will be impossible for `int32_t` to hold all the
-                     elements of source shapes when num_srcs is large. Users
-                     could decide whether to use them at their need.
-                     Not to use them by default.
+      populate_meta: Whether to populate meta_row_ids_.  meta_row_ids_ are
+                     useful at some time, but they are as large as the
+                     concatenated shape, so users could decide whether to
+                     use them at their need.  Not to use them by default.
+                     (MetaRowSplits() and Offsets() are always available,
+                     they are needed to compute the TotSize()).
+
+   The sources must outlive this object, as it holds pointers to their
+   row_splits and row_ids.
 
    TODO: we'll likely, later, add optional args which dictate which of
    the MetaRowSplits() and MetaRowIds() are to be pre-populated; this should
@@ -72,6 +75,10 @@ class Array1OfRaggedShape {
   Array1OfRaggedShape(RaggedShape *srcs, int32_t num_srcs,
                       bool populate_meta = false);
 
+  // As above, but `srcs` is an array of pointers to the source shapes.
+  Array1OfRaggedShape(RaggedShape **srcs, int32_t num_srcs,
+                      bool populate_meta = false);
+
   int32_t NumSrcs() const { return num_srcs_; }
   int32_t NumAxes() const { return num_axes_; }
 
@@ -124,25 +131,16 @@ class Array1OfRaggedShape {
      Array2 (which contains pointers!) are of course all different, and
      these lengths are currently only available
 
-     Implementation note: we can probably just populate this on CPU and transfer
-     to GPU, this will be faster than invoking an extra kernel in normal cases
-     when the NumSrcs() is small.  [Also: see GetRowInfoMulti()].
+     Implementation note: this is computed on the device from the row_splits
+     of the sources, with one kernel for all of them, so the constructor does
+     not need the TotSize() of each source on the CPU.
    */
-  const Array2<int32_t> &MetaRowSplits() const {
-    K2_CHECK(populate_meta_) << "To use this function, you need to initialize "
-                                "the object with populate_meta equaling true";
-    return meta_row_splits_;
-  }
+  const Array2<int32_t> &MetaRowSplits() const { return meta_row_splits_; }
 
-  // could POSSIBLY add this so this code could be used in functions like
-  // Stack(). would be like MetaRowSplits but with an extra 1st row containing
-  // 0,1,2,... We could perhaps create it with 1 extra initial row so this is
-  // always convenient to output.
-  const Array2<int32_t> &Offsets() const {
-    K2_CHECK(populate_meta_) << "To use this function, you need to initialize "
-                                "the object with populate_meta equaling true";
-    return offsets_;
-  }
+  // Like MetaRowSplits() but with an extra 1st row containing 0,1,2,...;
+  // it is of shape [NumAxes() + 1][NumSrcs() + 1].  This is the `offsets`
+  // used by Stack() and Cat() in ragged_ops.cu.
+  const Array2<int32_t> &Offsets() const { return offsets_; }
 
   /*
     Returns the meta-row-splits for a particular axis, with
@@ -153,8 +151,6 @@ class Array1OfRaggedShape {
     Note: in ragged_opts.cu we refer to this as composed_row_splits
   */
   Array1<int32_t> MetaRowSplits(int32_t axis) {
-    K2_CHECK(populate_meta_) << "To use this function, you need to initialize "
-                                "the object with populate_meta equaling true";
     K2_CHECK_LT(static_cast<uint32_t>(axis), static_cast<uint32_t>(num_axes_));
     return meta_row_splits_.Row(axis);
   }
@@ -197,6 +193,10 @@ class Array1OfRaggedShape {
   }
 
  private:
+  // Does the work of the constructors; num_srcs_ and populate_meta_ must
+  // already be set.
+  void Init(RaggedShape **srcs);
+
   ContextPtr c_;
   int32_t num_srcs_;
   int32_t num_axes_;
@@ -208,7 +208,7 @@ class Array1OfRaggedShape {
   Array1<int32_t> tot_sizes_;           // dim num_axes_, a CPU Array.
 
   Array2<int32_t> meta_row_splits_;  // shape [num_axes_][num_srcs_ + 1]
-  Array2<int32_t> offsets_;          // shape [num_axes_][num_srcs_ + 1]
+  Array2<int32_t> offsets_;          // shape [num_axes_ + 1][num_srcs_ + 1]
   std::vector<Array1<int32_t>> meta_row_ids_;  // dim num_axes_
 };
 
@@ -243,9 +243,11 @@ struct Array1OfRagged {
     K2_CHECK(srcs);
     values = Array1<T *>(GetCpuContext(), num_srcs);
     T **values_data = values.Data();
-    std::vector<RaggedShape> shapes(num_srcs);
+    // Pointers rather than copies, so any row_ids created for `shape` are
+    // kept in (and owned by) the sources.
+    std::vector<RaggedShape *> shapes(num_srcs);
     for (int32_t i = 0; i < num_srcs; ++i) {
-      shapes[i] = srcs[i].shape;
+      shapes[i] = &srcs[i].shape;
       values_data[i] = srcs[i].values.Data();
     }
     shape = Array1OfRaggedShape(shapes.data(), num_srcs, populate_meta);
@@ -18,6 +18,7 @@
 
 #include "gtest/gtest.h"
 #include "k2/csrc/array_of_ragged.h"
+#include "k2/csrc/math.h"
 #include "k2/csrc/ragged.h"
 #include "k2/csrc/ragged_ops.h"
 #include "k2/csrc/ragged_utils.h"
@@ -110,4 +111,46 @@ TEST(Array1OfRagged, Construct) {
   TestArray1OfRaggedConstruct<float>();
 }
 
+template <typename T>
+void TestArray1OfRaggedStackAndCat() {
+  for (auto &c : {GetCpuContext(), GetCudaContext()}) {
+    for (int32_t num_srcs : {1, 2, 5, 300}) {
+      int32_t num_axes = RandInt(2, 4);
+      std::vector<Ragged<T>> raggeds;
+      for (int32_t i = 0; i < num_srcs; ++i) {
+        raggeds.emplace_back(
+            RandomRagged<T>(0 /*min_value*/, 100 /*max_value*/,
+                            num_axes /*min_num_axes*/,
+                            num_axes /*max_num_axes*/,
+                            0 /*min_num_elements*/, 20 /*max_num_elements*/)
+                .To(c));
+      }
+      Array1OfRagged<T> array_of_ragged(raggeds.data(), num_srcs);
+      for (int32_t axis = 0; axis < num_axes; ++axis) {
+        int32_t expected_tot_size = 0;
+        for (int32_t i = 0; i < num_srcs; ++i)
+          expected_tot_size += raggeds[i].TotSize(axis);
+        EXPECT_EQ(array_of_ragged.shape.TotSize(axis), expected_tot_size);
+      }
+
+      Array1<uint32_t> merge_map, expected_merge_map;
+      Ragged<T> ans = Cat(array_of_ragged, &merge_map);
+      Ragged<T> expected =
+          Cat(0, num_srcs, raggeds.data(), &expected_merge_map);
+      EXPECT_TRUE(Equal(ans, expected));
+      EXPECT_TRUE(Equal(merge_map, expected_merge_map));
+
+      ans = Stack(array_of_ragged, &merge_map);
+      expected = Stack(0, num_srcs, raggeds.data(), &expected_merge_map);
+      EXPECT_TRUE(Equal(ans, expected));
+      EXPECT_TRUE(Equal(merge_map, expected_merge_map));
+    }
+  }
+}
+
+TEST(Array1OfRagged, StackAndCat) {
+  TestArray1OfRaggedStackAndCat<int32_t>();
+  TestArray1OfRaggedStackAndCat<float>();
+}
+
 }  // namespace k2
@@ -106,6 +106,36 @@ Array1<int32_t> SpliceRowSplits(int32_t num_arrays,
   return ans;
 }
 
+void GetLastElements(int32_t num_arrays, const Array1<int32_t> **src,
+                     int32_t *dest) {
+  NVTX_RANGE(K2_FUNC);
+  if (num_arrays == 0) return;
+  ContextPtr &c = src[0]->Context();
+  std::vector<const int32_t *> last_elem_ptrs_vec(num_arrays);
+  for (int32_t i = 0; i < num_arrays; i++) {
+    K2_CHECK_GE(src[i]->Dim(), 1);
+    K2_CHECK(c->IsCompatible(*src[i]->Context()));
+    last_elem_ptrs_vec[i] = src[i]->Data() + src[i]->Dim() - 1;
+  }
+  if (c->GetDeviceType() == kCpu || num_arrays == 1) {
+    // For a single array the transfer of the pointers would cost more than it
+    // saves.
+    for (int32_t i = 0; i < num_arrays; i++) dest[i] = src[i]->Back();
+    return;
+  }
+  Array1<const int32_t *> last_elem_ptrs(c, last_elem_ptrs_vec);
+  const int32_t **last_elem_ptrs_data = last_elem_ptrs.Data();
+  Array1<int32_t> last_elems(c, num_arrays);
+  int32_t *last_elems_data = last_elems.Data();
+  K2_EVAL(
+      c, num_arrays, lambda_get_last_elems, (int32_t i)->void {
+        last_elems_data[i] = *(last_elem_ptrs_data[i]);
+      });
+  Array1<int32_t> last_elems_pinned = last_elems.To(GetPinnedContext());
+  const int32_t *last_elems_pinned_data = last_elems_pinned.Data();
+  std::copy(last_elems_pinned_data, last_elems_pinned_data + num_arrays, dest);
+}
+
 Array1<int32_t> CatWithOffsets(const Array1<int32_t> &offsets,
                                const Array1<int32_t> **src) {
   NVTX_RANGE(K2_FUNC);
@@ -218,6 +218,23 @@ Array1<int32_t> CatWithOffsets(const Array1<int32_t> &offsets,
  */
 Array1<int32_t> SpliceRowSplits(int32_t src_size, const Array1<int32_t> **src);
 
+/*
+  Get the last element of each of a number of arrays, i.e. set
+  dest[i] = src[i]->Back() for 0 <= i < num_arrays.  Unlike calling Back() on
+  each array, which does a blocking device-to-host copy each time, this does
+  a fixed number of transfers regardless of `num_arrays` (the result is
+  transferred via pinned memory), so use it when you need several sizes at
+  once, e.g. the TotSize()s of a number of shapes.
+
+      @param [in] num_arrays  Number of arrays in `src`; may be 0.
+      @param [in] src     Array of pointers to arrays, of size `num_arrays`.
+                          All must be non-empty and have compatible contexts.
+      @param [out] dest   Host pointer to `num_arrays` elements, to which the
+                          answer is written.
+ */
+void GetLastElements(int32_t num_arrays, const Array1<int32_t> **src,
+                     int32_t *dest);
+
 /*
   Get the reduction value from the array `src` with a binary operator `Op`,
   initialized with `default_value`. Will be used to implement
@@ -721,6 +738,25 @@ template <typename T>
 Array1<T> Index(const Array1<T> &src, const Array1<int32_t> &indexes,
                 bool allow_minus_one, T default_value);
 
+/*
+  Does `Index(*srcs[j], indexes, true, default_values[j])` for a number of
+  arrays at once, with a single kernel instead of one per array (e.g. for
+  the attributes of an FSA, which are all indexed with the same arc_map).
+     @param [in] num_srcs  The number of arrays to index; may be 0.
+     @param [in] srcs  The arrays to index; must all have the same Dim()
+                       and be on the same device as `indexes`.
+     @param [in] indexes  Indexes into each of the arrays; must satisfy
+                       `-1 <= indexes[i] < srcs[j]->Dim()`.
+     @param [in] default_values  `default_values[j]` is the value of the
+                       output elements of array j with `indexes[i] == -1`.
+     @return  Returns an `Array2<T>` of shape (num_srcs, indexes.Dim()), with
+              `ans[j,i] = (*srcs[j])[indexes[i]]` (or `default_values[j]` if
+              `indexes[i] == -1`).  Its rows are contiguous.
+ */
+template <typename T>
+Array2<T> IndexMany(int32_t num_srcs, const Array1<T> **srcs,
+                    const Array1<int32_t> &indexes, const T *default_values);
+
 /*
   Index src's rows with `indexes` which contains the row indexes.
      @param [in] src   Array whose elements are to be read
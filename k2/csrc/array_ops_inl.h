@@ -122,32 +122,40 @@ __global__ void TransposeKernel(int32_t rows, int32_t cols,
                                 int32_t input_elem_stride0,
                                 int32_t output_elem_stride0, const T *input,
                                 T *output) {
-  // TODO(haowen): here we need to handle different type of T to avoid bank
-  // conflicts, the size of cache now is fine for type size with 32bit (e.g.
-  // int32_t or float).
+  // The padding of one element per row of `cache` avoids bank conflicts when
+  // reading its columns, for element sizes of 1, 2, 4 and 8 bytes.
   __shared__ T cache[kTransTileDim][kTransTileDim + 1];
 
-  // input index, in a coalesced manner.
-  int32_t x = threadIdx.x + blockIdx.x * kTransTileDim;
-  int32_t y = threadIdx.y + blockIdx.y * kTransTileDim;
-
-  for (int32_t i = 0; i < kTransTileDim; i += kTransBlockRows) {
-    if (x < cols && (y + i) < rows) {
-      cache[threadIdx.y + i][threadIdx.x] =
-          input[(y + i) * input_elem_stride0 + x];
+  // blockIdx.y loops over the tiles of rows, as there may be more of them
+  // than the max grid dim of 65535.
+  int32_t num_row_tiles = NumBlocks(rows, kTransTileDim);
+  for (int32_t row_tile = blockIdx.y; row_tile < num_row_tiles;
+       row_tile += gridDim.y) {
+    // input index, in a coalesced manner.
+    int32_t x = threadIdx.x + blockIdx.x * kTransTileDim;
+    int32_t y = threadIdx.y + row_tile * kTransTileDim;
+
+    for (int32_t i = 0; i < kTransTileDim; i += kTransBlockRows) {
+      if (x < cols && (y + i) < rows) {
+        cache[threadIdx.y + i][threadIdx.x] =
+            input[(y + i) * input_elem_stride0 + x];
+      }
     }
-  }
 
-  __syncthreads();
+    __syncthreads();
 
-  // output index, in a coalesced manner
-  x = threadIdx.x + blockIdx.y * kTransTileDim;
-  y = threadIdx.y + blockIdx.x * kTransTileDim;
-  for (int32_t i = 0; i < kTransTileDim; i += kTransBlockRows) {
-    if (x < rows && (y + i) < cols) {
-      output[(y + i) * output_elem_stride0 + x] =
-          cache[threadIdx.x][threadIdx.y + i];
+    // output index, in a coalesced manner
+    x = threadIdx.x + row_tile * kTransTileDim;
+    y = threadIdx.y + blockIdx.x * kTransTileDim;
+    for (int32_t i = 0; i < kTransTileDim; i += kTransBlockRows) {
+      if (x < rows && (y + i) < cols) {
+        output[(y + i) * output_elem_stride0 + x] =
+            cache[threadIdx.x][threadIdx.y + i];
+      }
     }
+
+    // `cache` is overwritten by the next tile.
+    __syncthreads();
   }
 }
 
@@ -244,17 +252,26 @@ void Transpose(ContextPtr &c, const Array2<T> &src, Array2<T> *dest) {
   T *dest_data = dest->Data();
   DeviceType d = c->GetDeviceType();
   if (d == kCpu) {
-    for (int32_t i = 0; i < cols; ++i) {
-      for (int32_t j = 0; j < rows; ++j) {
-        dest_data[i * dest_elem_stride0 + j] =
-            src_data[j * src_elem_stride0 + i];
+    // Go tile by tile so that both the rows of `src` and those of `dest` that
+    // a tile touches stay in cache.
+    const int32_t tile_dim = internal::kTransTileDim;
+    for (int32_t i0 = 0; i0 < cols; i0 += tile_dim) {
+      int32_t i_end = std::min(i0 + tile_dim, cols);
+      for (int32_t j0 = 0; j0 < rows; j0 += tile_dim) {
+        int32_t j_end = std::min(j0 + tile_dim, rows);
+        for (int32_t i = i0; i < i_end; ++i) {
+          for (int32_t j = j0; j < j_end; ++j) {
+            dest_data[i * dest_elem_stride0 + j] =
+                src_data[j * src_elem_stride0 + i];
+          }
+        }
       }
     }
   } else {
     K2_CHECK_EQ(d, kCuda);
     dim3 block_size(internal::kTransTileDim, internal::kTransBlockRows, 1);
     dim3 grid_size(NumBlocks(cols, internal::kTransTileDim),
-                   NumBlocks(rows, internal::kTransTileDim));
+                   std::min(NumBlocks(rows, internal::kTransTileDim), 65535));
     K2_CUDA_SAFE_CALL(
         internal::
             TransposeKernel<<<grid_size, block_size, 0, c->GetCudaStream()>>>(
@@ -862,6 +879,40 @@ Array1<T> Index(const Array1<T> &src, const Array1<int32_t> &indexes,
   return ans;
 }
 
+template <typename T>
+Array2<T> IndexMany(int32_t num_srcs, const Array1<T> **srcs,
+                    const Array1<int32_t> &indexes, const T *default_values) {
+  NVTX_RANGE(K2_FUNC);
+  ContextPtr &c = indexes.Context();
+  int32_t ans_dim = indexes.Dim();
+  Array2<T> ans(c, num_srcs, ans_dim);
+  if (num_srcs == 0 || ans_dim == 0) return ans;
+  int32_t src_dim = srcs[0]->Dim();
+  std::vector<const T *> src_ptrs_vec(num_srcs);
+  for (int32_t j = 0; j < num_srcs; ++j) {
+    K2_CHECK(c->IsCompatible(*srcs[j]->Context()));
+    K2_CHECK_EQ(srcs[j]->Dim(), src_dim);
+    src_ptrs_vec[j] = srcs[j]->Data();
+  }
+  Array1<const T *> src_ptrs(c, src_ptrs_vec);
+  Array1<T> defaults(c, std::vector<T>(default_values,
+                                       default_values + num_srcs));
+  const T **src_ptrs_data = src_ptrs.Data();
+  const T *defaults_data = defaults.Data();
+  const int32_t *index_data = indexes.Data();
+  T *ans_data = ans.Data();
+  // Each index is read once for all arrays; for each array, consecutive
+  // threads write consecutive elements.
+  K2_EVAL(
+      c, ans_dim, lambda_set_values, (int32_t i)->void {
+        int32_t index = index_data[i];
+        for (int32_t j = 0; j < num_srcs; ++j)
+          ans_data[j * ans_dim + i] =
+              (index < 0 ? defaults_data[j] : src_ptrs_data[j][index]);
+      });
+  return ans;
+}
+
 template <typename T>
 Array2<T> IndexRows(const Array2<T> &src, const Array1<int32_t> &indexes,
                     bool allow_minus_one) {
@@ -789,6 +789,25 @@ TEST(OpsTest, CatWithOffsets) {
   }
 }
 
+TEST(OpsTest, GetLastElementsTest) {
+  for (auto &context : {GetCpuContext(), GetCudaContext()}) {
+    for (int32_t num_arrays : {0, 1, 5}) {
+      std::vector<Array1<int32_t>> arrays_vec(num_arrays);
+      std::vector<const Array1<int32_t> *> arrays(num_arrays);
+      std::vector<int32_t> expected(num_arrays);
+      for (int32_t i = 0; i != num_arrays; ++i) {
+        int32_t dim = RandInt(1, 100);
+        arrays_vec[i] = Range<int32_t>(context, dim, i);
+        arrays[i] = &arrays_vec[i];
+        expected[i] = i + dim - 1;
+      }
+      std::vector<int32_t> last_elems(num_arrays);
+      GetLastElements(num_arrays, arrays.data(), last_elems.data());
+      EXPECT_EQ(last_elems, expected);
+    }
+  }
+}
+
 TEST(OpsTest, SpliceRowSplitsTest) {
   ContextPtr cpu = GetCpuContext();  // will be used to copy data
   for (auto &context : {GetCpuContext(), GetCudaContext()}) {
@@ -1565,6 +1584,36 @@ TEST(OpsTest, Array1IndexTest) {
   }
 }
 
+TEST(OpsTest, Array1IndexManyTest) {
+  for (int loop = 0; loop < 2; loop++) {
+    ContextPtr c = (loop == 0 ? GetCpuContext() : GetCudaContext());
+
+    int32_t num_srcs = RandInt(0, 5), src_dim = RandInt(1, 10),
+            ans_dim = RandInt(0, 10);
+    using T = float;
+    std::vector<Array1<T>> srcs;
+    std::vector<const Array1<T> *> src_ptrs;
+    std::vector<T> default_values;
+    srcs.reserve(num_srcs);
+    for (int32_t j = 0; j < num_srcs; j++) {
+      srcs.push_back(RandUniformArray1<T>(c, src_dim, 0, 100));
+      src_ptrs.push_back(&srcs.back());
+      default_values.push_back(-j);
+    }
+    Array1<int32_t> indexes =
+        RandUniformArray1<int32_t>(c, ans_dim, -1, src_dim - 1);
+
+    Array2<T> ans =
+        IndexMany(num_srcs, src_ptrs.data(), indexes, default_values.data());
+    ASSERT_EQ(ans.Dim0(), num_srcs);
+    ASSERT_EQ(ans.Dim1(), ans_dim);
+    for (int32_t j = 0; j < num_srcs; j++) {
+      Array1<T> expected = Index(srcs[j], indexes, true, default_values[j]);
+      ASSERT_TRUE(Equal(ans.Row(j), expected));
+    }
+  }
+}
+
 TEST(OpsTest, InvertPermutationTest) {
   for (int loop = 0; loop < 2; loop++) {
     ContextPtr c = (loop == 0 ? GetCpuContext() : GetCudaContext()),
@@ -685,6 +685,55 @@ TEST(ArrayTest, TestArray2Io) {
   }
 }
 
+TEST(ArrayTest, TestArray1Append) {
+  for (auto &c : {GetCpuContext(), GetCudaContext()}) {
+    Array1<int32_t> a(c, 0);
+    std::vector<int32_t> expected;
+    for (int32_t i = 0; i < 20; i++) {
+      int32_t n = RandInt(0, 10);
+      Array1<int32_t> src = Range(c, n, i * 10);
+      a.Append(src);
+      for (int32_t j = 0; j < n; j++) expected.push_back(i * 10 + j);
+      EXPECT_GE(a.Capacity(), a.Dim());
+    }
+    Array1<int32_t> cpu_a = a.To(GetCpuContext());
+    ASSERT_EQ(cpu_a.Dim(), expected.size());
+    for (int32_t i = 0; i < cpu_a.Dim(); i++)
+      EXPECT_EQ(cpu_a.Data()[i], expected[i]);
+
+    // A view of part of the array can't grow in place.
+    EXPECT_EQ(a.Range(0, a.Dim() / 2).Capacity(), a.Dim() / 2);
+
+    // Append from a kernel: odd numbers below 100.
+    a = Array1<int32_t>(c, 0);
+    a.Reserve(50);
+    EXPECT_GE(a.Capacity(), 50);
+    Array1<int32_t> num_appended;
+    Array1Appender<int32_t> appender = a.GetAppender(&num_appended);
+    K2_EVAL(
+        c, 100, lambda_append_odd, (int32_t i)->void {
+          if (i % 2 == 1) appender.Append(i);
+        });
+    EXPECT_EQ(a.FinishAppend(num_appended), 0);
+    Array1<int32_t> cpu_odd = a.To(GetCpuContext());
+    std::vector<int32_t> odd(cpu_odd.Data(), cpu_odd.Data() + cpu_odd.Dim());
+    std::sort(odd.begin(), odd.end());
+    ASSERT_EQ(odd.size(), 50);
+    for (int32_t i = 0; i < 50; i++) EXPECT_EQ(odd[i], 2 * i + 1);
+
+    // Not enough room.
+    a = Array1<int32_t>(c, 0);
+    int32_t capacity = a.Capacity();
+    appender = a.GetAppender(&num_appended);
+    K2_EVAL(
+        c, capacity + 5, lambda_append_too_many, (int32_t i)->void {
+          appender.Append(i);
+        });
+    EXPECT_EQ(a.FinishAppend(num_appended), 5);
+    EXPECT_EQ(a.Dim(), capacity);
+  }
+}
+
 TEST(ArrayTest, Array1Test) {
   TestArray1<int32_t>();
   TestArray1<double>();
@@ -280,6 +280,44 @@ static BenchmarkStat BenchmarkSizesToMergeMap(int32_t num_src,
   return stat;
 }
 
+/* Benchmark of Transpose() on a [num_frames, num_cols] matrix, e.g. the
+   scores of an utterance in time-major order.  The effective bandwidth is
+   2 * num_frames * num_cols * sizeof(T) bytes (read and written) divided by
+   the time per iteration.
+ */
+template <typename T>
+static BenchmarkStat BenchmarkTranspose(int32_t num_frames, int32_t num_cols,
+                                        DeviceType device_type) {
+  ContextPtr context;
+  if (device_type == kCpu) {
+    context = GetCpuContext();
+  } else {
+    K2_CHECK_EQ(device_type, kCuda);
+    context = GetCudaContext();
+  }
+
+  Array1<T> values = RandUniformArray1<T>(context, num_frames * num_cols,
+                                          -1000, 1000, GetSeed());
+  Array2<T> src(values, num_frames, num_cols),
+      dest(context, num_cols, num_frames);
+
+  BenchmarkStat stat;
+  stat.op_name = "Transpose_" + std::to_string(num_frames) + "_" +
+                 std::to_string(num_cols);
+  int32_t num_iter = 20;
+  stat.num_iter = num_iter;
+  stat.problem_size = num_frames * num_cols;
+  stat.dtype_name = TraitsOf(DtypeOf<T>::dtype).Name();
+  stat.device_type = device_type;
+
+  stat.eplased_per_iter = BenchmarkOp(
+      num_iter, context,
+      (void (*)(ContextPtr &, const Array2<T> &, Array2<T> *))(&Transpose<T>),
+      context, src, &dest);
+  stat.eplased_per_iter *= 1e6;  // from seconds to microseconds
+  return stat;
+}
+
 template <typename T>
 static void RegisterBenchmarkExclusiveSum(DeviceType device_type) {
   std::vector<int32_t> problems_sizes = {100,  500,   1000,  2000,
@@ -348,6 +386,21 @@ static void RegisterBenchmarkSpliceRowSplits(DeviceType device_type) {
   }
 }
 
+template <typename T>
+static void RegisterBenchmarkTranspose(DeviceType device_type) {
+  // problem_sizes here is the number of frames; the number of columns is
+  // that of a typical vocabulary of tokens.
+  std::vector<int32_t> problems_sizes = {100, 1000, 10000, 100000};
+  int32_t num_cols = 500;
+  for (auto s : problems_sizes) {
+    std::string name = GenerateBenchmarkName<T>("Transpose", device_type) +
+                       "_" + std::to_string(s);
+    RegisterBenchmark(name, [s, num_cols, device_type]() -> BenchmarkStat {
+      return BenchmarkTranspose<T>(s, num_cols, device_type);
+    });
+  }
+}
+
 static void RegisterBenchmarkSizesToMergeMap(DeviceType device_type) {
   // problem_sizes here is the `sizes.size()` in
   // SizesToMergeMap(ContextPtr c, const std::vector<int32_t> sizes).
@@ -363,7 +416,7 @@ static void RegisterBenchmarkSizesToMergeMap(DeviceType device_type) {
   }
 }
 
-static void RunArrayOpsBenchmark() {
+static int32_t RunArrayOpsBenchmark() {
   PrintEnvironmentInfo();
 
   RegisterBenchmarkExclusiveSum<int32_t>(kCpu);
@@ -381,6 +434,9 @@ static void RunArrayOpsBenchmark() {
 
   RegisterBenchmarkSizesToMergeMap(kCuda);
 
+  RegisterBenchmarkTranspose<float>(kCpu);
+  RegisterBenchmarkTranspose<float>(kCuda);
+
   // Users can set a regular expression via environment
   // variable `K2_BENCHMARK_FILTER` such that only benchmarks
   // with name matching the pattern are candidates to run.
@@ -388,15 +444,12 @@ static void RunArrayOpsBenchmark() {
   if (filter != nullptr) FilterRegisteredBenchmarks(filter);
 
   std::vector<BenchmarkRun> results = RunBechmarks();
-  std::cout << BenchmarkRun::GetFieldsName() << "\n";
-  for (const auto &r : results) {
-    std::cout << r << "\n";
-  }
+  return ReportBenchmarkResults(results);
 }
 
 }  // namespace k2
 
 int main() {
-  k2::RunArrayOpsBenchmark();
-  return 0;
+  // a nonzero exit status means regressions w.r.t. K2_BENCHMARK_BASELINE
+  return k2::RunArrayOpsBenchmark() == 0 ? 0 : 1;
 }
@@ -15,11 +15,17 @@
  * See the License for the specific language governing permissions and
  * limitations under the License.
  */
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
 #include <ctime>
+#include <fstream>
 #include <iostream>
 #include <regex>  // NOLINT
 #include <sstream>
 #include <string>
+#include <unordered_map>
+#include <vector>
 
 #include "k2/csrc/benchmark/benchmark.h"
 #include "k2/csrc/benchmark/helper_cuda.h"
@@ -60,12 +66,50 @@ std::string DeviceInfo::ToString() const {
   return os.str();
 }
 
+// Return `s` as a quoted JSON string.
+static std::string JsonString(const std::string &s) {
+  std::ostringstream os;
+  os << '"';
+  for (char c : s) {
+    if (c == '"' || c == '\\')
+      os << '\\' << c;
+    else if (c == '\n')
+      os << "\\n";
+    else
+      os << c;
+  }
+  os << '"';
+  return os.str();
+}
+
+std::string DeviceInfo::ToJson() const {
+  std::ostringstream os;
+  os << "{\"device_name\": " << JsonString(device_name)
+     << ", \"compute_capability\": \"" << compute_capability_major << "."
+     << compute_capability_minor << "\""
+     << ", \"gpu_clock_freq_ghz\": " << gpu_clock_freq
+     << ", \"driver_version\": \"" << driver_version_major << "."
+     << driver_version_minor << "\""
+     << ", \"runtime_version\": \"" << runtime_version_major << "."
+     << runtime_version_minor << "\""
+     << ", \"warp_size\": " << warp_size
+     << ", \"l2_cache_size_mb\": " << l2_cache_size
+     << ", \"total_global_mem_gb\": " << total_global_mem
+     << ", \"total_const_mem_kb\": " << total_const_mem
+     << ", \"total_shared_mem_per_block_kb\": " << total_shared_mem_per_block
+     << ", \"total_shared_mem_per_mp_kb\": " << total_shared_mem_per_mp
+     << ", \"ecc_enabled\": " << ecc_enabled
+     << ", \"num_multiprocessors\": " << num_multiprocessors
+     << ", \"num_cuda_cores\": " << num_cuda_cores << "}";
+  return os.str();
+}
+
 std::ostream &operator<<(std::ostream &os, const DeviceInfo &info) {
   return os << info.ToString();
 }
 
 DeviceInfo GetDeviceInfo() {
-  DeviceInfo info;
+  DeviceInfo info{};
 #ifdef K2_WITH_CUDA
   int32_t driver_version;
   K2_CUDA_SAFE_CALL(cudaDriverGetVersion(&driver_version));
@@ -99,21 +143,236 @@ DeviceInfo GetDeviceInfo() {
   return info;
 }
 
+void SetBenchmarkTimes(std::vector<float> times_us, BenchmarkStat *stat) {
+  K2_CHECK(!times_us.empty());
+  std::sort(times_us.begin(), times_us.end());
+  int32_t n = static_cast<int32_t>(times_us.size());
+  // the nearest-rank percentile
+  auto percentile = [&times_us, n](int32_t p) -> float {
+    int32_t rank = (p * n + 99) / 100;  // ceil(p * n / 100)
+    return times_us[std::max(rank, 1) - 1];
+  };
+  double sum = 0;
+  for (float t : times_us) sum += t;
+  double mean = sum / n, sum_sq_diff = 0;
+  for (float t : times_us) sum_sq_diff += (t - mean) * (t - mean);
+
+  stat->num_iter = n;
+  stat->eplased_per_iter = mean;
+  stat->min_us = times_us[0];
+  stat->median_us = percentile(50);
+  stat->p90_us = percentile(90);
+  stat->p99_us = percentile(99);
+  stat->stddev_us = n > 1 ? std::sqrt(sum_sq_diff / (n - 1)) : 0;
+}
+
 std::string BenchmarkRun::GetFieldsName() {
   std::ostringstream os;
-  os << "op_name,dtype,device,problem_size,"
-        "number_of_iterations,elapsed_us_per_iteration";
+  os << "name,op_name,dtype,device,problem_size,"
+        "number_of_iterations,elapsed_us_per_iteration,"
+        "min_us,median_us,p90_us,p99_us,stddev_us,peak_memory_bytes,"
+        "extra_metric";
   return os.str();
 }
 
 std::string BenchmarkRun::ToString() const {
   std::ostringstream os;
-  os << stat.op_name << "," << stat.dtype_name << "," << stat.device_type << ","
-     << stat.problem_size << "," << stat.num_iter << "," << std::fixed
-     << stat.eplased_per_iter;
+  os << name << "," << stat.op_name << "," << stat.dtype_name << ","
+     << stat.device_type << "," << stat.problem_size << "," << stat.num_iter
+     << "," << std::fixed << stat.eplased_per_iter << "," << stat.min_us << ","
+     << stat.median_us << "," << stat.p90_us << "," << stat.p99_us << ","
+     << stat.stddev_us << "," << stat.peak_memory_bytes << ","
+     << stat.extra_metric;
   return os.str();
 }
 
+std::string BenchmarkRun::ToJson() const {
+  std::ostringstream os;
+  os << "{\"name\": " << JsonString(name)
+     << ", \"op_name\": " << JsonString(stat.op_name)
+     << ", \"dtype\": " << JsonString(stat.dtype_name) << ", \"device\": \""
+     << stat.device_type << "\""
+     << ", \"problem_size\": " << stat.problem_size
+     << ", \"number_of_iterations\": " << stat.num_iter
+     << ", \"elapsed_us_per_iteration\": " << std::fixed
+     << stat.eplased_per_iter << ", \"min_us\": " << stat.min_us
+     << ", \"median_us\": " << stat.median_us << ", \"p90_us\": " << stat.p90_us
+     << ", \"p99_us\": " << stat.p99_us << ", \"stddev_us\": " << stat.stddev_us
+     << ", \"peak_memory_bytes\": " << stat.peak_memory_bytes
+     << ", \"extra_metric\": " << stat.extra_metric << "}";
+  return os.str();
+}
+
+std::string BenchmarkRun::Key() const {
+  return name + "@" + std::to_string(stat.problem_size);
+}
+
+void WriteBenchmarkResults(const std::vector<BenchmarkRun> &results,
+                           BenchmarkOutputFormat format, std::ostream &os) {
+  DeviceInfo info = GetDeviceInfo();
+  if (format == BenchmarkOutputFormat::kCsv) {
+    os << info << BenchmarkRun::GetFieldsName() << "\n";
+    for (const auto &r : results) os << r << "\n";
+    return;
+  }
+  K2_CHECK(format == BenchmarkOutputFormat::kJson);
+  os << "{\n\"device_info\": " << info.ToJson() << ",\n\"results\": [";
+  for (std::size_t i = 0; i != results.size(); ++i) {
+    os << (i == 0 ? "\n" : ",\n") << results[i].ToJson();
+  }
+  os << "\n]\n}\n";
+}
+
+static DeviceType DeviceTypeFromString(const std::string &s) {
+  if (s == "kCpu") return kCpu;
+  if (s == "kCuda") return kCuda;
+  K2_LOG(FATAL) << "Unknown device type: " << s;
+  return kUnk;  // unreachable
+}
+
+// Return the value of `field` in a line written by BenchmarkRun::ToJson(),
+// without quotes.  If the line has no such field, return `default_value` if
+// it is not null (for fields that files from older versions do not have);
+// otherwise it is an error.
+static std::string GetJsonField(const std::string &line,
+                                const std::string &field,
+                                const char *default_value = nullptr) {
+  std::regex regex("\"" + field + "\": (\"([^\"]*)\"|[^,}]*)");
+  std::smatch match;
+  if (!std::regex_search(line, match, regex)) {
+    K2_CHECK(default_value != nullptr)
+        << "No field '" << field << "' in: " << line;
+    return default_value;
+  }
+  return match[2].matched ? match[2].str() : match[1].str();
+}
+
+std::vector<BenchmarkRun> ReadBenchmarkResults(const std::string &filename) {
+  std::ifstream is(filename);
+  K2_CHECK(is) << "Failed to open " << filename;
+  std::vector<BenchmarkRun> results;
+  std::string line;
+  while (std::getline(is, line)) {
+    if (line.empty() || line[0] == '#' || line == "{" || line == "]" ||
+        line == "}" || line.compare(0, 5, "name,") == 0 ||
+        line.compare(0, 14, "\"device_info\":") == 0 ||
+        line.compare(0, 10, "\"results\":") == 0)
+      continue;
+    BenchmarkRun run;
+    BenchmarkStat &stat = run.stat;
+    if (line.compare(0, 9, "{\"name\": ") == 0) {
+      // JSON; the line is as written by ToJson(), maybe followed by ','.
+      run.name = GetJsonField(line, "name");
+      stat.op_name = GetJsonField(line, "op_name");
+      stat.dtype_name = GetJsonField(line, "dtype");
+      stat.device_type = DeviceTypeFromString(GetJsonField(line, "device"));
+      stat.problem_size = std::stoi(GetJsonField(line, "problem_size"));
+      stat.num_iter = std::stoi(GetJsonField(line, "number_of_iterations"));
+      stat.eplased_per_iter =
+          std::stof(GetJsonField(line, "elapsed_us_per_iteration"));
+      stat.min_us = std::stof(GetJsonField(line, "min_us", "0"));
+      stat.median_us = std::stof(GetJsonField(line, "median_us", "0"));
+      stat.p90_us = std::stof(GetJsonField(line, "p90_us", "0"));
+      stat.p99_us = std::stof(GetJsonField(line, "p99_us", "0"));
+      stat.stddev_us = std::stof(GetJsonField(line, "stddev_us", "0"));
+      stat.peak_memory_bytes =
+          std::stoll(GetJsonField(line, "peak_memory_bytes", "0"));
+      stat.extra_metric = std::stof(GetJsonField(line, "extra_metric", "0"));
+    } else {
+      std::vector<std::string> fields;
+      std::istringstream ss(line);
+      std::string field;
+      while (std::getline(ss, field, ',')) fields.push_back(field);
+      // Files written before the distribution fields were added have only
+      // the first 7 fields, and before `extra_metric` was added, 13.
+      K2_CHECK(fields.size() == 7 || fields.size() == 13 ||
+               fields.size() == 14)
+          << "Invalid line in " << filename << ": " << line;
+      run.name = fields[0];
+      stat.op_name = fields[1];
+      stat.dtype_name = fields[2];
+      stat.device_type = DeviceTypeFromString(fields[3]);
+      stat.problem_size = std::stoi(fields[4]);
+      stat.num_iter = std::stoi(fields[5]);
+      stat.eplased_per_iter = std::stof(fields[6]);
+      if (fields.size() >= 13) {
+        stat.min_us = std::stof(fields[7]);
+        stat.median_us = std::stof(fields[8]);
+        stat.p90_us = std::stof(fields[9]);
+        stat.p99_us = std::stof(fields[10]);
+        stat.stddev_us = std::stof(fields[11]);
+        stat.peak_memory_bytes = std::stoll(fields[12]);
+      }
+      if (fields.size() == 14) stat.extra_metric = std::stof(fields[13]);
+    }
+    results.push_back(run);
+  }
+  return results;
+}
+
+std::vector<BenchmarkComparison> CompareBenchmarkResults(
+    const std::vector<BenchmarkRun> &baseline,
+    const std::vector<BenchmarkRun> &current, int32_t threshold_percent) {
+  K2_CHECK_GE(threshold_percent, 0);
+  std::unordered_map<std::string, float> baseline_us;
+  for (const auto &r : baseline) baseline_us[r.Key()] = r.stat.eplased_per_iter;
+
+  std::vector<BenchmarkComparison> ans;
+  for (const auto &r : current) {
+    auto iter = baseline_us.find(r.Key());
+    if (iter == baseline_us.end()) continue;
+    BenchmarkComparison c;
+    c.key = r.Key();
+    c.baseline_us = iter->second;
+    c.current_us = r.stat.eplased_per_iter;
+    c.change_percent =
+        c.baseline_us > 0
+            ? static_cast<int32_t>(std::lround(
+                  (c.current_us - c.baseline_us) / c.baseline_us * 100))
+            : 0;
+    c.regressed = c.change_percent > threshold_percent;
+    ans.push_back(c);
+  }
+  return ans;
+}
+
+int32_t ReportBenchmarkResults(const std::vector<BenchmarkRun> &results) {
+  BenchmarkOutputFormat format = BenchmarkOutputFormat::kCsv;
+  const char *format_str = std::getenv("K2_BENCHMARK_OUTPUT_FORMAT");
+  if (format_str != nullptr && std::string(format_str) == "json") {
+    format = BenchmarkOutputFormat::kJson;
+  } else if (format_str != nullptr) {
+    K2_CHECK_EQ(std::string(format_str), "csv")
+        << "K2_BENCHMARK_OUTPUT_FORMAT should be csv or json";
+  }
+  WriteBenchmarkResults(results, format, std::cout);
+
+  const char *baseline = std::getenv("K2_BENCHMARK_BASELINE");
+  if (baseline == nullptr) return 0;
+  const char *threshold_str = std::getenv("K2_BENCHMARK_THRESHOLD");
+  int32_t threshold_percent =
+      threshold_str != nullptr ? std::atoi(threshold_str) : 5;
+
+  std::vector<BenchmarkComparison> comparisons = CompareBenchmarkResults(
+      ReadBenchmarkResults(baseline), results, threshold_percent);
+  // print it to stderr so that stdout contains only the results
+  std::ostringstream os;
+  os << kPrefix << "Comparison with " << baseline
+     << " (threshold: " << threshold_percent << "%)\n";
+  os << "key,baseline_us,current_us,change_percent,status\n";
+  int32_t num_regressions = 0;
+  for (const auto &c : comparisons) {
+    os << c.key << "," << std::fixed << c.baseline_us << "," << c.current_us
+       << "," << c.change_percent << "," << (c.regressed ? "REGRESSED" : "ok")
+       << "\n";
+    num_regressions += c.regressed;
+  }
+  os << kPrefix << num_regressions << " regression(s) in "
+     << comparisons.size() << " compared benchmark(s)\n";
+  std::cerr << os.str();
+  return num_regressions;
+}
+
 std::ostream &operator<<(std::ostream &os, const BenchmarkRun &run) {
   return os << run.ToString();
 }
@@ -186,6 +445,8 @@ void PrintEnvironmentInfo() {
      << "cuda device sync enabled: " << internal::EnableCudaDeviceSync()
      << "\n";
   os << kPrefix << "Checks disabled: " << internal::DisableChecks() << "\n";
+  os << kPrefix << "Validation level: "
+     << static_cast<int32_t>(internal::GetValidationLevel()) << "\n";
   os << kPrefix << "Seed: " << GetSeed() << "\n";
 
   // print it to stderr so that it can be redirected
@@ -19,6 +19,7 @@
 #ifndef K2_CSRC_BENCHMARK_BENCHMARK_H_
 #define K2_CSRC_BENCHMARK_BENCHMARK_H_
 
+#include <algorithm>
 #include <functional>
 #include <memory>
 #include <string>
@@ -26,6 +27,7 @@
 #include <utility>
 #include <vector>
 
+#include "k2/csrc/context.h"
 #include "k2/csrc/dtype.h"
 #include "k2/csrc/log.h"
 #include "k2/csrc/timer.h"
@@ -37,8 +39,10 @@ namespace k2 {
 // each line is prepended with `kPrefix`
 constexpr const char *kPrefix = "# ";
 
-/* Run an op for a given number of iterations.
+/* Run an op for a given number of iterations, after running it
+   `num_warm_up` times untimed.
 
+  @param [in]  num_warm_up  Number of iterations to run before timing.
   @param [in]  num_iter   Number iterations to run.
   @param [in]  context    The context for creating timer.
   @param [in]  op         The operation to be benchmarked.
@@ -47,11 +51,12 @@ constexpr const char *kPrefix = "# ";
   @return Number of elapsed seconds per iteration on average.
  */
 template <typename Op, typename... Args>
-float BenchmarkOp(int32_t num_iter, ContextPtr context, Op &&op,
-                  Args &&... args) {
+float BenchmarkOpWithWarmUp(int32_t num_warm_up, int32_t num_iter,
+                            ContextPtr context, Op &&op, Args &&... args) {
+  K2_CHECK_GE(num_warm_up, 0);
   K2_CHECK_GT(num_iter, 0);
 
-  for (int32_t i = 0; i != 30; ++i) {
+  for (int32_t i = 0; i != num_warm_up; ++i) {
     // warm up
     std::forward<Op>(op)(std::forward<Args>(args)...);
   }
@@ -64,6 +69,18 @@ float BenchmarkOp(int32_t num_iter, ContextPtr context, Op &&op,
   return timer.Elapsed() / num_iter;
 }
 
+/* Run an op for a given number of iterations, with 30 warm-up iterations.
+   See BenchmarkOpWithWarmUp() for the arguments.  For expensive ops (e.g.
+   decoding a long utterance) use BenchmarkOpWithWarmUp() with fewer warm-up
+   iterations.
+ */
+template <typename Op, typename... Args>
+float BenchmarkOp(int32_t num_iter, ContextPtr context, Op &&op,
+                  Args &&... args) {
+  return BenchmarkOpWithWarmUp(30, num_iter, context, std::forward<Op>(op),
+                               std::forward<Args>(args)...);
+}
+
 struct DeviceInfo {
   std::string device_name;
   int32_t compute_capability_major;
@@ -84,6 +101,9 @@ struct DeviceInfo {
   int32_t num_cuda_cores;
 
   std::string ToString() const;
+
+  // Return a JSON object (on one line) containing the fields of this object
+  std::string ToJson() const;
 };
 
 std::ostream &operator<<(std::ostream &os, const DeviceInfo &info);
@@ -97,9 +117,104 @@ struct BenchmarkStat {
   int32_t problem_size;
   std::string dtype_name;  // e.g., int32_t, float
   DeviceType device_type;  // e.g., kCpu, kCuda
+
+  // The following are set only by BenchmarkOpDetailed(); they are 0 for
+  // benchmarks timed with BenchmarkOp(), which times all iterations at once.
+  float min_us = 0;     // microseconds of the fastest iteration
+  float median_us = 0;  // median microseconds per iteration
+  float p90_us = 0;     // 90th percentile of microseconds per iteration
+  float p99_us = 0;     // 99th percentile of microseconds per iteration
+  float stddev_us = 0;  // standard deviation of microseconds per iteration
+  // Highest device memory in use during the timed iterations, minus the
+  // memory in use before them, in bytes.  Always 0 on CPU and with PyTorch.
+  int64_t peak_memory_bytes = 0;
+  // An op-specific number reported along with the times, e.g. the average
+  // number of buckets probed per operation for the hash benchmarks; 0 if the
+  // benchmark does not set it.
+  float extra_metric = 0;
 };
 
-// TODO(fangjun): Implement a reporter for formatted printing.
+/* Set `num_iter`, `eplased_per_iter` and the distribution fields of `stat`
+   from the microseconds each iteration took.  Used by BenchmarkOpDetailed().
+
+   @param [in] times_us  Microseconds of each iteration; must not be empty.
+   @param [out] stat     The stat to set.
+ */
+void SetBenchmarkTimes(std::vector<float> times_us, BenchmarkStat *stat);
+
+/* Like BenchmarkOp(), but times each iteration separately so that the
+   distribution of the times, not only their mean, is known, and chooses the
+   number of iterations: after `min_iter` iterations it stops as soon as the
+   standard error of the mean is at most `max_rel_error` times the mean, or
+   after `max_iter` iterations.  It also measures the peak device memory used
+   by `op` (see CudaMemoryStats).
+
+   Timing an iteration synchronizes the device, so for very fast ops the mean
+   is slightly higher than that of BenchmarkOp().
+
+  @param [in]  num_warm_up  Number of iterations to run before timing.
+  @param [in]  min_iter     Minimum number of timed iterations; must be > 1.
+  @param [in]  max_iter     Maximum number of timed iterations.
+  @param [in]  max_rel_error  E.g. 0.01 to stop once the mean is known to
+                            within about 1% (one standard error).
+  @param [in]  context      The context for creating timer.
+  @param [in]  op           The operation to be benchmarked.
+  @param [in]  args         The arguments for `op`.
+
+  @return Return a stat with `num_iter`, `eplased_per_iter` (in
+          microseconds), the distribution fields and `peak_memory_bytes` set;
+          the caller sets the other fields.
+ */
+template <typename Op, typename... Args>
+BenchmarkStat BenchmarkOpDetailed(int32_t num_warm_up, int32_t min_iter,
+                                  int32_t max_iter, float max_rel_error,
+                                  ContextPtr context, Op &&op,
+                                  Args &&... args) {
+  K2_CHECK_GE(num_warm_up, 0);
+  K2_CHECK_GT(min_iter, 1);
+  K2_CHECK_GE(max_iter, min_iter);
+
+  for (int32_t i = 0; i != num_warm_up; ++i) {
+    // warm up
+    std::forward<Op>(op)(std::forward<Args>(args)...);
+  }
+
+  bool is_cuda = context->GetDeviceType() == kCuda;
+  int32_t gpu_id = is_cuda ? context->GetDeviceId() : -1;
+  int64_t bytes_before = 0;
+  if (is_cuda) {
+    context->Sync();
+    bytes_before = GetCudaMemoryStats(gpu_id).bytes_in_use;
+    ResetPeakCudaMemoryStats(gpu_id);
+  }
+
+  std::vector<float> times_us;
+  double sum = 0, sum_sq = 0;
+  Timer timer(context);
+  for (int32_t i = 1; i <= max_iter; ++i) {
+    timer.Reset();
+    std::forward<Op>(op)(std::forward<Args>(args)...);
+    double t = timer.Elapsed() * 1e6;
+    times_us.push_back(t);
+    sum += t;
+    sum_sq += t * t;
+    if (i >= min_iter) {
+      double mean = sum / i,
+             variance = std::max(0.0, sum_sq / i - mean * mean) / (i - 1);
+      // i.e. standard error of the mean <= max_rel_error * mean
+      if (variance <= max_rel_error * max_rel_error * mean * mean) break;
+    }
+  }
+
+  BenchmarkStat stat;
+  SetBenchmarkTimes(std::move(times_us), &stat);
+  if (is_cuda) {
+    stat.peak_memory_bytes =
+        GetCudaMemoryStats(gpu_id).peak_bytes_in_use - bytes_before;
+  }
+  return stat;
+}
+
 struct BenchmarkRun {
   std::string name;  // name of the benchmark
   BenchmarkStat stat;
@@ -111,10 +226,81 @@ struct BenchmarkRun {
   //
   // Return the field name of CSV format returned by `ToString()`
   static std::string GetFieldsName();
+
+  // Return a JSON object (on one line) containing the same fields as
+  // `ToString()`
+  std::string ToJson() const;
+
+  // Return the key used to match this run with the same run in another
+  // result file, e.g. "ArcSort_float_kCuda@100".  `name` alone is not
+  // unique, as a benchmark is usually registered for several problem sizes
+  // under one name, and `stat.op_name` may contain sizes of random data.
+  std::string Key() const;
 };
 
 std::ostream &operator<<(std::ostream &os, const BenchmarkRun &run);
 
+enum class BenchmarkOutputFormat {
+  kCsv,   // comment lines with the device info, then `GetFieldsName()` and
+          // one line per run
+  kJson,  // {"device_info": {...}, "results": [...]}, one run per line
+};
+
+/* Write benchmark results.
+
+   @param [in] results  The results to write.
+   @param [in] format   The output format.
+   @param [out] os      The stream to write to.  The format is the one
+                        ReadBenchmarkResults() expects.
+ */
+void WriteBenchmarkResults(const std::vector<BenchmarkRun> &results,
+                           BenchmarkOutputFormat format, std::ostream &os);
+
+/* Read benchmark results written by WriteBenchmarkResults(), in either
+   format (it is detected from the content).
+
+   @param [in] filename  The file to read.
+   @return Return the results in the file.
+ */
+std::vector<BenchmarkRun> ReadBenchmarkResults(const std::string &filename);
+
+struct BenchmarkComparison {
+  std::string key;    // BenchmarkRun::Key() of the two runs
+  float baseline_us;  // elapsed microseconds per iteration in the baseline
+  float current_us;   // elapsed microseconds per iteration in current run
+  // Change of the elapsed time relative to the baseline, rounded to an
+  // integer percentage; positive means slower.
+  int32_t change_percent;
+  bool regressed;  // change_percent > threshold_percent
+};
+
+/* Compare benchmark results with a baseline.
+
+   @param [in] baseline  Results of a previous run, e.g., from
+                         ReadBenchmarkResults().
+   @param [in] current   Results of the current run.
+   @param [in] threshold_percent  A run is considered as a regression if it is
+                         slower than in `baseline` by more than this many
+                         percent.
+   @return Return one entry for each run in `current` that is also in
+           `baseline` (matched by BenchmarkRun::Key()), in the order of
+           `current`.  Runs present in only one of them are skipped.
+ */
+std::vector<BenchmarkComparison> CompareBenchmarkResults(
+    const std::vector<BenchmarkRun> &baseline,
+    const std::vector<BenchmarkRun> &current, int32_t threshold_percent);
+
+/* Print results to stdout in the format given by the environment variable
+   `K2_BENCHMARK_OUTPUT_FORMAT` ("csv", the default, or "json").  If the
+   environment variable `K2_BENCHMARK_BASELINE` is set, it is the name of a
+   file written by a previous run, and a comparison with it is printed to
+   stderr, flagging runs that are slower by more than
+   `K2_BENCHMARK_THRESHOLD` percent (default 5).
+
+   @return Return the number of regressions found; 0 if there is no baseline.
+ */
+int32_t ReportBenchmarkResults(const std::vector<BenchmarkRun> &results);
+
 using BenchmarkFunc = std::function<BenchmarkStat()>;
 
 struct BenchmarkInstance {
@@ -0,0 +1,437 @@
+/**
+ * Copyright      2026  Xiaomi Corporation
+ *
+ * See LICENSE for clarification regarding multiple authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <algorithm>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "k2/csrc/array_ops.h"
+#include "k2/csrc/benchmark/benchmark.h"
+#include "k2/csrc/fsa_algo.h"
+#include "k2/csrc/fsa_utils.h"
+#include "k2/csrc/math.h"
+#include "k2/csrc/ragged_ops.h"
+#include "k2/csrc/rnnt_decode.h"
+
+namespace k2 {
+
+static ContextPtr GetContext(DeviceType device_type) {
+  if (device_type == kCpu) return GetCpuContext();
+  K2_CHECK_EQ(device_type, kCuda);
+  return GetCudaContext();
+}
+
+// `seconds` is the elapsed time per iteration.
+static BenchmarkStat CreateStat(const std::string &op_name, int32_t num_iter,
+                                int32_t problem_size, DeviceType device_type,
+                                float seconds) {
+  BenchmarkStat stat;
+  stat.op_name = op_name;
+  stat.num_iter = num_iter;
+  stat.problem_size = problem_size;
+  stat.dtype_name = TraitsOf(DtypeOf<float>::dtype).Name();
+  stat.device_type = device_type;
+  stat.eplased_per_iter = seconds * 1e6;  // from seconds to microseconds
+  return stat;
+}
+
+// Returns `num_fsas` random FSAs on the given device.  `num_arcs` is the mean
+// number of arcs requested from RandomFsa(), which usually generates fewer
+// (the benchmark names contain the actual numbers of states and arcs).  If
+// `acyclic` is true they are also top-sorted.
+static FsaVec GetRandomFsaVec(ContextPtr context, int32_t num_fsas,
+                              int32_t num_arcs, bool acyclic,
+                              int32_t max_symbol = 100) {
+  FsaVec fsas = RandomFsaVec(num_fsas, num_fsas, acyclic, max_symbol,
+                             num_arcs / 2, num_arcs * 3 / 2);
+  return fsas.To(context);
+}
+
+static std::string SizeSuffix(const FsaVec &fsas) {
+  return "_" + std::to_string(fsas.Dim0()) + "_" +
+         std::to_string(fsas.TotSize(1)) + "_" +
+         std::to_string(fsas.TotSize(2));
+}
+
+// Returns a DenseFsaVec with `num_seqs` sequences of exactly `num_frames`
+// frames, over symbols 0..max_symbol (the extra column is for -1).  A larger
+// `scores_scale` gives peakier scores, i.e. more pruning.
+static DenseFsaVec GetRandomDenseFsaVec(ContextPtr context, int32_t num_seqs,
+                                        int32_t num_frames, int32_t max_symbol,
+                                        float scores_scale = 1.0) {
+  int32_t num_symbols = max_symbol + 2;
+  DenseFsaVec dense =
+      RandomDenseFsaVec(num_seqs, num_seqs, num_frames, num_frames,
+                        num_symbols, num_symbols, scores_scale);
+  return dense.To(context);
+}
+
+// Graph ops.  `dim` is the number of FSAs, with num_arcs = 1000.
+
+static BenchmarkStat BenchmarkArcSort(int32_t dim, DeviceType device_type) {
+  ContextPtr context = GetContext(device_type);
+  int32_t num_iter = std::min(100, 10000 / dim);
+  FsaVec fsas = GetRandomFsaVec(context, dim, 1000, false);
+  FsaVec dest;
+  Array1<int32_t> arc_map;
+  float seconds = BenchmarkOp(num_iter, context, [&]() -> void {
+    ArcSort(fsas, &dest, &arc_map);
+  });
+  return CreateStat("ArcSort" + SizeSuffix(fsas), num_iter, dim, device_type,
+                    seconds);
+}
+
+static BenchmarkStat BenchmarkTopSort(int32_t dim, DeviceType device_type) {
+  ContextPtr context = GetContext(device_type);
+  int32_t num_iter = std::min(100, 10000 / dim);
+  FsaVec fsas = GetRandomFsaVec(context, dim, 1000, true);
+  FsaVec dest;
+  Array1<int32_t> arc_map;
+  float seconds = BenchmarkOp(num_iter, context, [&]() -> void {
+    TopSort(fsas, &dest, &arc_map);
+  });
+  return CreateStat("TopSort" + SizeSuffix(fsas), num_iter, dim, device_type,
+                    seconds);
+}
+
+static BenchmarkStat BenchmarkConnect(int32_t dim, DeviceType device_type) {
+  ContextPtr context = GetContext(device_type);
+  int32_t num_iter = std::min(100, 10000 / dim);
+  FsaVec fsas = GetRandomFsaVec(context, dim, 1000, true);
+  FsaVec dest;
+  Array1<int32_t> arc_map;
+  float seconds = BenchmarkOp(num_iter, context, [&]() -> void {
+    Connect(fsas, &dest, &arc_map);
+  });
+  return CreateStat("Connect" + SizeSuffix(fsas), num_iter, dim, device_type,
+                    seconds);
+}
+
+static BenchmarkStat BenchmarkRemoveEpsilon(int32_t dim,
+                                            DeviceType device_type) {
+  ContextPtr context = GetContext(device_type);
+  int32_t num_iter = std::min(20, 2000 / dim);
+  // a small max_symbol so there are plenty of epsilons.
+  FsaVec fsas = GetRandomFsaVec(context, dim, 1000, true, 10);
+  Array1<int32_t> properties;
+  int32_t tot_properties;
+  GetFsaVecBasicProperties(fsas, &properties, &tot_properties);
+  FsaVec dest;
+  Ragged<int32_t> arc_derivs;
+  float seconds = BenchmarkOpWithWarmUp(3, num_iter, context, [&]() -> void {
+    RemoveEpsilon(fsas, tot_properties, &dest, &arc_derivs);
+  });
+  return CreateStat("RemoveEpsilon" + SizeSuffix(fsas), num_iter, dim,
+                    device_type, seconds);
+}
+
+static BenchmarkStat BenchmarkGetForwardScores(int32_t dim,
+                                               DeviceType device_type) {
+  ContextPtr context = GetContext(device_type);
+  int32_t num_iter = std::min(100, 10000 / dim);
+  FsaVec fsas = GetRandomFsaVec(context, dim, 1000, true);
+  Ragged<int32_t> state_batches = GetStateBatches(fsas, true);
+  Array1<int32_t> dest_states = GetDestStates(fsas, true);
+  Ragged<int32_t> incoming_arcs = GetIncomingArcs(fsas, dest_states);
+  Ragged<int32_t> entering_arc_batches =
+      GetEnteringArcIndexBatches(fsas, incoming_arcs, state_batches);
+  bool log_semiring = true;
+  float seconds = BenchmarkOp(num_iter, context, [&]() -> void {
+    GetForwardScores<float>(fsas, state_batches, entering_arc_batches,
+                            log_semiring, nullptr);
+  });
+  return CreateStat("GetForwardScores" + SizeSuffix(fsas), num_iter, dim,
+                    device_type, seconds);
+}
+
+static BenchmarkStat BenchmarkShortestPath(int32_t dim,
+                                           DeviceType device_type) {
+  ContextPtr context = GetContext(device_type);
+  int32_t num_iter = std::min(100, 10000 / dim);
+  FsaVec fsas = GetRandomFsaVec(context, dim, 1000, true);
+  Ragged<int32_t> state_batches = GetStateBatches(fsas, true);
+  Array1<int32_t> dest_states = GetDestStates(fsas, true);
+  Ragged<int32_t> incoming_arcs = GetIncomingArcs(fsas, dest_states);
+  Ragged<int32_t> entering_arc_batches =
+      GetEnteringArcIndexBatches(fsas, incoming_arcs, state_batches);
+  bool log_semiring = false;
+  Array1<int32_t> entering_arcs;
+  GetForwardScores<float>(fsas, state_batches, entering_arc_batches,
+                          log_semiring, &entering_arcs);
+  float seconds = BenchmarkOp(num_iter, context, [&]() -> void {
+    ShortestPath(fsas, entering_arcs);
+  });
+  return CreateStat("ShortestPath" + SizeSuffix(fsas), num_iter, dim,
+                    device_type, seconds);
+}
+
+// Intersection of general FSAs.  `dim` is the number of pairs of FSAs, each
+// with num_arcs = 100.
+static BenchmarkStat BenchmarkIntersect(int32_t dim, DeviceType device_type) {
+  ContextPtr context = GetContext(device_type);
+  int32_t num_iter = std::min(20, 2000 / dim);
+  int32_t max_symbol = 10;
+  FsaVec a_fsas = GetRandomFsaVec(context, dim, 100, true, max_symbol),
+         b_fsas = GetRandomFsaVec(context, dim, 100, true, max_symbol);
+  ArcSort(&a_fsas);
+  ArcSort(&b_fsas);
+  FsaVec out;
+  Array1<int32_t> arc_map_a, arc_map_b;
+  float seconds;
+  if (device_type == kCpu) {
+    bool treat_epsilons_specially = true;
+    seconds = BenchmarkOpWithWarmUp(3, num_iter, context, [&]() -> void {
+      Intersect(a_fsas, -1, b_fsas, -1, treat_epsilons_specially, &out,
+                &arc_map_a, &arc_map_b);
+    });
+  } else {
+    // Intersect() is for CPU only; IntersectDevice() is the GPU version.
+    Array1<int32_t> b_to_a_map = Range<int32_t>(context, dim, 0);
+    bool sorted_match_a = true;
+    seconds = BenchmarkOpWithWarmUp(3, num_iter, context, [&]() -> void {
+      out = IntersectDevice(a_fsas, -1, b_fsas, -1, b_to_a_map, &arc_map_a,
+                            &arc_map_b, sorted_match_a);
+    });
+  }
+  return CreateStat("Intersect" + SizeSuffix(a_fsas), num_iter, dim,
+                    device_type, seconds);
+}
+
+// Intersection with dense FSAs (nnet output).  `dim` is the number of
+// frames; there are 8 sequences.
+
+static BenchmarkStat BenchmarkIntersectDense(int32_t dim,
+                                             DeviceType device_type) {
+  ContextPtr context = GetContext(device_type);
+  int32_t num_iter = 3;
+  int32_t max_symbol = 100, num_seqs = 8;
+  // IntersectDense() is not pruned during the search, so the graphs are
+  // small; there is one per sequence.
+  FsaVec graph = GetRandomFsaVec(context, num_seqs, 200, false, max_symbol);
+  ArcSort(&graph);
+  DenseFsaVec dense = GetRandomDenseFsaVec(context, num_seqs, dim, max_symbol);
+  float output_beam = 8.0;
+  int32_t max_states = 15000000, max_arcs = 1 << 30;
+  FsaVec out;
+  Array1<int32_t> arc_map_a, arc_map_b;
+  float seconds = BenchmarkOpWithWarmUp(1, num_iter, context, [&]() -> void {
+    IntersectDense(graph, dense, nullptr, output_beam, max_states, max_arcs,
+                   &out, &arc_map_a, &arc_map_b);
+  });
+  return CreateStat("IntersectDense" + SizeSuffix(graph) + "_" +
+                        std::to_string(num_seqs),
+                    num_iter, dim, device_type, seconds);
+}
+
+// If `reorder` is true, the states of the graph are renumbered with
+// GetLocalityStateOrder() first.
+static BenchmarkStat BenchmarkIntersectDensePruned(int32_t dim,
+                                                   DeviceType device_type,
+                                                   int32_t num_graph_arcs,
+                                                   bool reorder = false) {
+  ContextPtr context = GetContext(device_type);
+  int32_t num_iter = 3;
+  int32_t max_symbol = 500, num_seqs = 8;
+  // Generated on the device, as RandomFsa() takes minutes for the larger
+  // graphs.  Labels are as from RandomFsa(), i.e. epsilon as likely as any
+  // other symbol.
+  RandomFsaVecOptions opts;
+  opts.min_num_states = opts.max_num_states = num_graph_arcs / 4;
+  opts.min_out_degree = 1;
+  opts.max_out_degree = 7;
+  opts.acyclic = false;
+  opts.max_symbol = max_symbol;
+  opts.epsilon_ratio = 1.0f / (max_symbol + 1);
+  opts.seed = GetSeed();  // 0, i.e. random, unless K2_SEED is set
+  FsaVec graph = RandomFsaVec(context, opts);
+  if (reorder)
+    graph = RenumberFsaVec(graph, GetLocalityStateOrder(graph), nullptr);
+  ArcSort(&graph);
+  // Uniform random scores would hardly be pruned at all, unlike real nnet
+  // output.
+  DenseFsaVec dense =
+      GetRandomDenseFsaVec(context, num_seqs, dim, max_symbol, 10.0);
+  float search_beam = 20.0, output_beam = 8.0;
+  int32_t min_active = 30, max_active = 10000;
+  FsaVec out;
+  Array1<int32_t> arc_map_a, arc_map_b;
+  float seconds = BenchmarkOpWithWarmUp(1, num_iter, context, [&]() -> void {
+    IntersectDensePruned(graph, dense, search_beam, output_beam, min_active,
+                         max_active, &out, &arc_map_a, &arc_map_b);
+  });
+  return CreateStat(std::string(reorder ? "IntersectDensePrunedReordered"
+                                         : "IntersectDensePruned") +
+                        SizeSuffix(graph) + "_" + std::to_string(num_seqs),
+                    num_iter, dim, device_type, seconds);
+}
+
+// Generating a graph with `dim` arcs on average (with a skewed out-degree,
+// like a decoding graph) on the device.
+static BenchmarkStat BenchmarkRandomFsaVec(int32_t dim,
+                                           DeviceType device_type) {
+  ContextPtr context = GetContext(device_type);
+  int32_t num_iter = std::max(1, std::min(100, 100000000 / dim));
+  RandomFsaVecOptions opts;
+  opts.min_num_states = opts.max_num_states = dim / 4;
+  opts.min_out_degree = 1;
+  opts.max_out_degree = 11;
+  opts.degree_skew = 2.0;
+  opts.acyclic = false;
+  opts.max_symbol = 500;
+  FsaVec fsas;
+  float seconds = BenchmarkOp(num_iter, context, [&]() -> void {
+    fsas = RandomFsaVec(context, opts);
+  });
+  return CreateStat("RandomFsaVec" + SizeSuffix(fsas), num_iter, dim,
+                    device_type, seconds);
+}
+
+// One frame of RNN-T decoding: GetContexts() and Advance().  `dim` is the
+// number of streams.  Frames are timed one at a time, as the latency of the
+// slow ones matters for streaming.
+static BenchmarkStat BenchmarkRnntDecodingStreamsAdvance(
+    int32_t dim, DeviceType device_type) {
+  using namespace rnnt_decoding;  // NOLINT
+  ContextPtr context = GetContext(device_type);
+  int32_t min_iter = 100, max_iter = 1000;
+  int32_t vocab_size = 500, decoder_history_len = 2;
+  double beam = 8.0;
+  int32_t max_states = 64, max_contexts = 8;
+  RnntDecodingConfig config(vocab_size, decoder_history_len, beam, max_states,
+                            max_contexts);
+
+  Array1<int32_t> aux_labels;
+  auto graph = std::make_shared<Fsa>(
+      CtcTopo(context, vocab_size - 1, false, &aux_labels));
+  std::vector<std::shared_ptr<RnntDecodingStream>> streams_vec(dim);
+  for (int32_t i = 0; i < dim; ++i) streams_vec[i] = CreateStream(graph);
+  RnntDecodingStreams streams(streams_vec, config);
+
+  // Enough random log-probs for the largest possible number of contexts; each
+  // frame uses a prefix of it.
+  int32_t max_tot_contexts = dim * max_contexts;
+  Array1<float> logprobs_data = RandUniformArray1<float>(
+      context, max_tot_contexts * vocab_size, -10.0, 0.0);
+
+  RaggedShape context_shape;
+  Array2<int32_t> contexts;
+  BenchmarkStat stat = BenchmarkOpDetailed(
+      10, min_iter, max_iter, 0.01, context, [&]() -> void {
+        streams.GetContexts(&context_shape, &contexts);
+        int32_t tot_contexts = context_shape.NumElements();
+        K2_CHECK_LE(tot_contexts, max_tot_contexts);
+        Array1<float> logprobs_flat =
+            logprobs_data.Arange(0, tot_contexts * vocab_size);
+        Array2<float> logprobs(logprobs_flat, tot_contexts, vocab_size);
+        streams.Advance(logprobs);
+      });
+  stat.op_name = "RnntDecodingStreamsAdvance_" + std::to_string(dim) + "_" +
+                 std::to_string(vocab_size);
+  stat.problem_size = dim;
+  stat.dtype_name = TraitsOf(DtypeOf<float>::dtype).Name();
+  stat.device_type = device_type;
+  return stat;
+}
+
+// `func` is a benchmark function like BenchmarkArcSort.
+static void RegisterFsaBenchmark(
+    const std::string &base_name, DeviceType device_type,
+    const std::vector<int32_t> &problem_sizes,
+    BenchmarkStat (*func)(int32_t dim, DeviceType device_type)) {
+  for (auto s : problem_sizes) {
+    std::string name = GenerateBenchmarkName<float>(base_name, device_type);
+    RegisterBenchmark(name, [s, device_type, func]() -> BenchmarkStat {
+      return func(s, device_type);
+    });
+  }
+}
+
+static void RegisterBenchmarkIntersectDensePruned(DeviceType device_type) {
+  // num_graph_arcs of 1000000 is roughly the scale of an HLG graph of a
+  // small-vocabulary system.  The larger graphs take too long on CPU.
+  std::vector<int32_t> num_graph_arcs = {10000};
+  if (device_type == kCuda) {
+    num_graph_arcs.push_back(100000);
+    num_graph_arcs.push_back(1000000);
+  }
+  std::vector<int32_t> num_frames = {100, 1000};
+  for (auto a : num_graph_arcs) {
+    for (auto t : num_frames) {
+      std::string name =
+          GenerateBenchmarkName<float>("IntersectDensePruned", device_type);
+      RegisterBenchmark(name, [t, device_type, a]() -> BenchmarkStat {
+        return BenchmarkIntersectDensePruned(t, device_type, a);
+      });
+    }
+  }
+  // A graph of the size of the largest one above, with its states reordered
+  // for locality; compare it with the last benchmark above.
+  int32_t a = num_graph_arcs.back(), t = num_frames.back();
+  std::string name = GenerateBenchmarkName<float>(
+      "IntersectDensePrunedReordered", device_type);
+  RegisterBenchmark(name, [t, device_type, a]() -> BenchmarkStat {
+    return BenchmarkIntersectDensePruned(t, device_type, a, true);
+  });
+}
+
+static void RegisterBenchmarks(DeviceType device_type) {
+  std::vector<int32_t> num_fsas = {10, 100, 1000};
+  RegisterFsaBenchmark("ArcSort", device_type, num_fsas, &BenchmarkArcSort);
+  RegisterFsaBenchmark("TopSort", device_type, num_fsas, &BenchmarkTopSort);
+  RegisterFsaBenchmark("Connect", device_type, num_fsas, &BenchmarkConnect);
+  RegisterFsaBenchmark("RemoveEpsilon", device_type, {10, 100},
+                       &BenchmarkRemoveEpsilon);
+  RegisterFsaBenchmark("GetForwardScores", device_type, num_fsas,
+                       &BenchmarkGetForwardScores);
+  RegisterFsaBenchmark("ShortestPath", device_type, num_fsas,
+                       &BenchmarkShortestPath);
+  RegisterFsaBenchmark("Intersect", device_type, {10, 100},
+                       &BenchmarkIntersect);
+  RegisterFsaBenchmark("IntersectDense", device_type, {100, 1000},
+                       &BenchmarkIntersectDense);
+  RegisterBenchmarkIntersectDensePruned(device_type);
+  RegisterFsaBenchmark("RandomFsaVec", device_type,
+                       {100000, 1000000, 10000000}, &BenchmarkRandomFsaVec);
+  RegisterFsaBenchmark("RnntDecodingStreamsAdvance", device_type,
+                       {1, 8, 32, 128}, &BenchmarkRnntDecodingStreamsAdvance);
+}
+
+static int32_t RunFsaAlgoBenchmark() {
+  PrintEnvironmentInfo();
+
+  RegisterBenchmarks(kCpu);
+  RegisterBenchmarks(kCuda);
+
+  // Users can set a regular expression via environment
+  // variable `K2_BENCHMARK_FILTER` such that only benchmarks
+  // with name matching the pattern are candidates to run.
+  const char *filter = std::getenv("K2_BENCHMARK_FILTER");
+  if (filter != nullptr) FilterRegisteredBenchmarks(filter);
+
+  std::vector<BenchmarkRun> results = RunBechmarks();
+  return ReportBenchmarkResults(results);
+}
+
+}  // namespace k2
+
+int main() {
+  // a nonzero exit status means regressions w.r.t. K2_BENCHMARK_BASELINE
+  return k2::RunFsaAlgoBenchmark() == 0 ? 0 : 1;
+}
@@ -0,0 +1,233 @@
+/**
+ * Copyright      2026  Xiaomi Corporation
+ *
+ * See LICENSE for clarification regarding multiple authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <algorithm>
+#include <cstdlib>
+#include <numeric>
+#include <random>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+#include "k2/csrc/benchmark/benchmark.h"
+#include "k2/csrc/hash.h"
+#include "k2/csrc/math.h"
+#include "k2/csrc/test_utils.h"
+
+namespace k2 {
+
+/* Return `num_distinct` distinct keys less than 2^31, each repeated
+   `contention` times, in random order.  If `clustered` is false the keys are
+   uniformly distributed; otherwise they come in runs of 256 consecutive
+   numbers, like the ids of the states of a graph reached from the same
+   states, which all start at nearby buckets.
+ */
+static std::vector<uint64_t> GenerateHashKeys(int32_t num_distinct,
+                                              int32_t contention,
+                                              bool clustered) {
+  const int32_t kRunLength = 256;
+  std::mt19937 gen(GetSeed());
+  std::uniform_int_distribution<uint64_t> dist(0, (1u << 31) - kRunLength);
+  std::unordered_set<uint64_t> seen;
+  std::vector<uint64_t> keys;
+  keys.reserve(static_cast<size_t>(num_distinct) * contention);
+  while (static_cast<int32_t>(seen.size()) < num_distinct) {
+    uint64_t start = dist(gen);
+    int32_t run_length = clustered ? kRunLength : 1;
+    for (int32_t i = 0; i != run_length &&
+                        static_cast<int32_t>(seen.size()) < num_distinct;
+         ++i) {
+      if (seen.insert(start + i).second) {
+        for (int32_t j = 0; j != contention; ++j) keys.push_back(start + i);
+      }
+    }
+  }
+  std::shuffle(keys.begin(), keys.end(), gen);
+  return keys;
+}
+
+static void InitHash(ContextPtr c, int32_t num_buckets,
+                     int32_t num_value_bits, Hash *hash) {
+  *hash = Hash(c, num_buckets, 32, num_value_bits);
+}
+
+static void InitHash(ContextPtr c, int32_t num_buckets,
+                     int32_t /*num_value_bits*/, Hash64 *hash) {
+  *hash = Hash64(c, num_buckets);
+}
+
+/* Insert all of `keys` into `hash` (which must be empty), look all of them up,
+   then delete them again so the hash is empty for the next iteration.  This
+   is the pattern of use in IntersectDensePruned, where many arcs may map to
+   the same destination state.
+
+   Not static because it contains device lambdas.
+ */
+template <typename HashT, typename AccessorT>
+void HashInsertFindDelete(HashT &hash, const Array1<uint64_t> &keys,
+                          Array1<char> *success) {
+  ContextPtr c = hash.Context();
+  const uint64_t *keys_data = keys.Data();
+  char *success_data = success->Data();
+  AccessorT acc(hash);
+  K2_EVAL(c, keys.Dim(), lambda_insert, (int32_t i) -> void {
+      success_data[i] = acc.Insert(keys_data[i], i);
+    });
+  K2_EVAL(c, keys.Dim(), lambda_find, (int32_t i) -> void {
+      uint64_t value;
+      bool found = acc.Find(keys_data[i], &value);
+      K2_DCHECK(found);
+    });
+  K2_EVAL(c, keys.Dim(), lambda_delete, (int32_t i) -> void {
+      if (success_data[i]) acc.Delete(keys_data[i]);
+    });
+}
+
+/* Return the average number of buckets probed by Find() for `keys` once they
+   are all in `hash`, which must be empty and is left empty.
+
+   Not static because it contains device lambdas.
+ */
+template <typename HashT, typename AccessorT>
+float HashProbesPerOp(HashT &hash, const Array1<uint64_t> &keys) {
+  ContextPtr c = hash.Context();
+  const uint64_t *keys_data = keys.Data();
+  Array1<char> success(c, keys.Dim());
+  char *success_data = success.Data();
+  Array1<int32_t> num_probes(c, keys.Dim());
+  int32_t *num_probes_data = num_probes.Data();
+  AccessorT acc(hash);
+  K2_EVAL(c, keys.Dim(), lambda_insert, (int32_t i) -> void {
+      success_data[i] = acc.Insert(keys_data[i], i);
+    });
+  K2_EVAL(c, keys.Dim(), lambda_count, (int32_t i) -> void {
+      num_probes_data[i] = acc.NumProbes(keys_data[i]);
+    });
+  K2_EVAL(c, keys.Dim(), lambda_delete, (int32_t i) -> void {
+      if (success_data[i]) acc.Delete(keys_data[i]);
+    });
+  Array1<int32_t> num_probes_cpu = num_probes.To(GetCpuContext());
+  const int32_t *begin = num_probes_cpu.Data();
+  return std::accumulate(begin, begin + keys.Dim(), int64_t(0)) /
+         static_cast<float>(keys.Dim());
+}
+
+/* Time inserting, finding and deleting keys with a hash of `num_buckets`
+   buckets, of which a fraction `load_factor` ends up occupied; see
+   GenerateHashKeys() for `contention` and `clustered`.  For Hash, there are
+   32 key bits; see its constructor for `num_value_bits`.  `extra_metric`
+   of the returned stat is the average number of buckets probed by Find().
+ */
+template <typename HashT, typename AccessorT>
+static BenchmarkStat BenchmarkHash(const std::string &layout,
+                                   int32_t num_buckets, float load_factor,
+                                   int32_t contention, bool clustered,
+                                   DeviceType device_type,
+                                   int32_t num_value_bits = -1) {
+  ContextPtr context;
+  if (device_type == kCpu) {
+    context = GetCpuContext();
+  } else {
+    K2_CHECK_EQ(device_type, kCuda);
+    context = GetCudaContext();
+  }
+
+  HashT hash;
+  InitHash(context, num_buckets, num_value_bits, &hash);
+  Array1<uint64_t> keys(
+      context, GenerateHashKeys(static_cast<int32_t>(num_buckets * load_factor),
+                                contention, clustered));
+  Array1<char> success(context, keys.Dim());
+  int32_t num_iter = std::min(500, 100000000 / keys.Dim());
+
+  BenchmarkStat stat;
+  stat.op_name = "Hash" + layout + (clustered ? "_clustered_" : "_uniform_") +
+                 std::to_string(static_cast<int32_t>(load_factor * 100)) +
+                 "_" + std::to_string(contention);
+  stat.num_iter = num_iter;
+  stat.problem_size = num_buckets;
+  stat.dtype_name = TraitsOf(DtypeOf<int32_t>::dtype).Name();
+  stat.device_type = device_type;
+  stat.eplased_per_iter = BenchmarkOp(num_iter, context, [&]() -> void {
+    HashInsertFindDelete<HashT, AccessorT>(hash, keys, &success);
+  });
+  stat.eplased_per_iter *= 1e6;  // from seconds to microseconds
+  stat.extra_metric = HashProbesPerOp<HashT, AccessorT>(hash, keys);
+  return stat;
+}
+
+template <typename HashT, typename AccessorT>
+static void RegisterBenchmarkHash(const std::string &layout,
+                                  DeviceType device_type,
+                                  int32_t num_value_bits = -1) {
+  std::vector<int32_t> num_buckets = {1 << 16, 1 << 20};
+  std::vector<float> load_factors = {0.25, 0.5, 0.75, 0.9};
+  std::vector<int32_t> contentions = {1, 16};
+  for (auto b : num_buckets) {
+    for (auto f : load_factors) {
+      for (auto n : contentions) {
+        for (bool clustered : {false, true}) {
+          std::string name =
+              GenerateBenchmarkName<int32_t>("Hash" + layout, device_type) +
+              (clustered ? "_clustered_" : "_uniform_") + std::to_string(b) +
+              "_" + std::to_string(static_cast<int32_t>(f * 100)) + "_" +
+              std::to_string(n);
+          RegisterBenchmark(name, [=]() -> BenchmarkStat {
+            return BenchmarkHash<HashT, AccessorT>(
+                layout, b, f, n, clustered, device_type, num_value_bits);
+          });
+        }
+      }
+    }
+  }
+}
+
+static void RegisterBenchmarkHash(DeviceType device_type) {
+  RegisterBenchmarkHash<Hash, Hash::Accessor<32>>("Standard", device_type);
+  RegisterBenchmarkHash<Hash, Hash::BucketedAccessor<32>>("Bucketed",
+                                                          device_type);
+  // The accessors that DispatchAccessor() falls back to when the number of
+  // key bits is not one it was specialized for.
+  RegisterBenchmarkHash<Hash, Hash::GenericAccessor>("Generic", device_type);
+  RegisterBenchmarkHash<Hash, Hash::PackedAccessor>("Packed", device_type,
+                                                    34);
+  RegisterBenchmarkHash<Hash64, Hash64::Accessor>("64", device_type);
+}
+
+static int32_t RunHashBenchmark() {
+  PrintEnvironmentInfo();
+
+  RegisterBenchmarkHash(kCpu);
+  RegisterBenchmarkHash(kCuda);
+
+  // Users can set a regular expression via environment
+  // variable `K2_BENCHMARK_FILTER` such that only benchmarks
+  // with name matching the pattern are candidates to run.
+  const char *filter = std::getenv("K2_BENCHMARK_FILTER");
+  if (filter != nullptr) FilterRegisteredBenchmarks(filter);
+
+  std::vector<BenchmarkRun> results = RunBechmarks();
+  return ReportBenchmarkResults(results);
+}
+
+}  // namespace k2
+
+int main() {
+  // a nonzero exit status means regressions w.r.t. K2_BENCHMARK_BASELINE
+  return k2::RunHashBenchmark() == 0 ? 0 : 1;
+}
@@ -16,11 +16,19 @@
  * limitations under the License.
  */
 
+#include <algorithm>
 #include <cstdlib>
+#include <functional>
+#include <random>
+#include <string>
+#include <vector>
 
+#include "k2/csrc/array_ops.h"
 #include "k2/csrc/benchmark/benchmark.h"
 #include "k2/csrc/fsa_utils.h"
+#include "k2/csrc/math.h"
 #include "k2/csrc/ragged_ops.h"
+#include "k2/csrc/shape_capture.h"
 
 namespace k2 {
 
@@ -103,12 +111,12 @@ static BenchmarkStat BenchmarkSegmentedExclusiveSum(int32_t dim,
                  std::to_string(num_elems);
   stat.num_iter = num_iter;
   stat.problem_size = dim;
-  stat.dtype_name = TraitsOf(DtypeOf<int32_t>::dtype).Name();
+  stat.dtype_name = TraitsOf(DtypeOf<T>::dtype).Name();
   stat.device_type = device_type;
 
   stat.eplased_per_iter = BenchmarkOp(
       num_iter, context,
-      (void (*)(Ragged<T> &, Array1<int32_t> *))(&SegmentedExclusiveSum<T>),
+      (void (*)(Ragged<T> &, Array1<T> *))(&SegmentedExclusiveSum<T>),
       ragged, &dst);
   stat.eplased_per_iter *= 1e6;  // from seconds to microseconds
   return stat;
@@ -119,20 +127,175 @@ static void RegisterBenchmarkSegmentedExclusiveSum(DeviceType device_type) {
   std::vector<int32_t> problems_sizes = {50, 100, 200, 500, 1000, 10000};
   for (auto s : problems_sizes) {
     std::string name =
-        GenerateBenchmarkName<T>("SegmentedExclusiveSum", device_type);
+        GenerateBenchmarkName<T>("SegmentedExclusiveSum", device_type) + "_" +
+        std::to_string(s);
     RegisterBenchmark(name, [s, device_type]() -> BenchmarkStat {
       return BenchmarkSegmentedExclusiveSum<T>(s, device_type);
     });
   }
 }
 
-static void RunRaggedOpsBenchmark() {
+/* `num_rows` rows with `num_rows * 20` elements in total.  If `skewed` is
+   true, all elements are in the middle row and the other rows are empty (like
+   the state->arc shape of a lattice with one huge state); otherwise each row
+   has 20 elements.
+
+   Not static because it contains device lambdas.
+ */
+BenchmarkStat BenchmarkRowSplitsToRowIds(int32_t num_rows, bool skewed,
+                                         DeviceType device_type) {
+  ContextPtr context;
+  if (device_type == kCpu) {
+    context = GetCpuContext();
+  } else {
+    K2_CHECK_EQ(device_type, kCuda);
+    context = GetCudaContext();
+  }
+
+  int32_t num_iter = std::min(100, 10000000 / num_rows);
+  int32_t num_elems = num_rows * 20;
+  Array1<int32_t> row_splits(context, num_rows + 1);
+  int32_t *row_splits_data = row_splits.Data();
+  if (skewed) {
+    int32_t middle_row = num_rows / 2;
+    K2_EVAL(
+        context, num_rows + 1, lambda_set_skewed_row_splits,
+        (int32_t i)->void {
+          row_splits_data[i] = (i <= middle_row ? 0 : num_elems);
+        });
+  } else {
+    K2_EVAL(
+        context, num_rows + 1, lambda_set_row_splits,
+        (int32_t i)->void { row_splits_data[i] = i * 20; });
+  }
+  Array1<int32_t> row_ids(context, num_elems);
+
+  BenchmarkStat stat;
+  stat.op_name = std::string("RowSplitsToRowIds") +
+                 (skewed ? "Skewed_" : "_") + std::to_string(num_rows) +
+                 "_" + std::to_string(num_elems);
+  stat.num_iter = num_iter;
+  stat.problem_size = num_rows;
+  stat.dtype_name = TraitsOf(DtypeOf<int32_t>::dtype).Name();
+  stat.device_type = device_type;
+
+  stat.eplased_per_iter = BenchmarkOp(
+      num_iter, context,
+      (void (*)(const Array1<int32_t> &, Array1<int32_t> *))(
+          &RowSplitsToRowIds),
+      row_splits, &row_ids);
+  stat.eplased_per_iter *= 1e6;  // from seconds to microseconds
+  return stat;
+}
+
+static void RegisterBenchmarkRowSplitsToRowIds(DeviceType device_type) {
+  std::vector<int32_t> problems_sizes = {1000, 10000, 100000, 1000000};
+  for (auto s : problems_sizes) {
+    for (bool skewed : {false, true}) {
+      std::string name = GenerateBenchmarkName<int32_t>(
+          skewed ? "RowSplitsToRowIdsSkewed" : "RowSplitsToRowIds",
+          device_type);
+      RegisterBenchmark(name, [s, skewed, device_type]() -> BenchmarkStat {
+        return BenchmarkRowSplitsToRowIds(s, skewed, device_type);
+      });
+    }
+  }
+}
+
+/* Run the op that `captured` was captured for (see shape_capture.h) on its
+   shape, with random indexes or values of the captured sizes, so the op is
+   timed on a shape from a real run rather than a random one.
+ */
+static BenchmarkStat BenchmarkCapturedShape(const CapturedShape &captured,
+                                            DeviceType device_type) {
+  RaggedShape shape = captured.shape;
+  ContextPtr context = shape.Context();
+  int32_t num_elems = shape.NumElements();
+  int32_t num_iter = std::min(100, 10000000 / std::max(num_elems, 1));
+  std::mt19937 gen(GetSeed());
+  std::function<void()> op;
+  if (captured.op == "Index") {
+    K2_CHECK_EQ(captured.sizes.size(), 2);
+    int32_t axis = captured.sizes[0], tot_size = shape.TotSize(axis),
+            dim = tot_size == 0 ? 0 : captured.sizes[1];
+    std::uniform_int_distribution<int32_t> dist(0, std::max(tot_size - 1, 0));
+    std::vector<int32_t> indexes(dim);
+    for (auto &i : indexes) i = dist(gen);
+    // Indexes along the other axes must not reorder the elements.
+    if (axis != 0) std::sort(indexes.begin(), indexes.end());
+    Array1<int32_t> indexes_array =
+        Array1<int32_t>(GetCpuContext(), indexes).To(context);
+    op = [=]() mutable { Index(shape, axis, indexes_array); };
+  } else if (captured.op == "GetTransposeReordering") {
+    K2_CHECK_EQ(captured.sizes.size(), 1);
+    int32_t num_cols = captured.sizes[0];
+    Ragged<int32_t> src(shape, RandUniformArray1<int32_t>(
+                                   context, num_elems, 0,
+                                   std::max(num_cols - 1, 0), GetSeed()));
+    op = [=]() mutable { GetTransposeReordering(src, num_cols); };
+  } else if (captured.op == "RemoveEmptyLists") {
+    K2_CHECK_EQ(captured.sizes.size(), 1);
+    int32_t axis = captured.sizes[0];
+    op = [=]() mutable { RemoveEmptyLists(shape, axis); };
+  } else {
+    K2_CHECK_EQ(captured.op, "SegmentedReduce");
+    Ragged<float> src(shape, RandUniformArray1<float>(context, num_elems, 0,
+                                                      1, GetSeed()));
+    Array1<float> max_values(context, shape.TotSize(shape.NumAxes() - 2));
+    op = [=]() mutable { MaxPerSublist(src, 0.0f, &max_values); };
+  }
+
+  BenchmarkStat stat;
+  stat.op_name = "Replay" + captured.op + "_" + std::to_string(shape.Dim0()) +
+                 "_" + std::to_string(num_elems);
+  stat.num_iter = num_iter;
+  stat.problem_size = num_elems;
+  stat.dtype_name = TraitsOf(DtypeOf<int32_t>::dtype).Name();
+  stat.device_type = device_type;
+  stat.eplased_per_iter = BenchmarkOp(num_iter, context, op);
+  stat.eplased_per_iter *= 1e6;  // from seconds to microseconds
+  return stat;
+}
+
+/* Register a benchmark for each shape in `filename`, which was written while
+   capturing shapes (see shape_capture.h), e.g. during a real decode.
+ */
+static void RegisterBenchmarkCapturedShapes(const std::string &filename,
+                                            DeviceType device_type) {
+  ContextPtr context =
+      device_type == kCpu ? GetCpuContext() : GetCudaContext();
+  std::vector<CapturedShape> captured = ReadCapturedShapes(filename, context);
+  for (std::size_t i = 0; i != captured.size(); ++i) {
+    std::string name = GenerateBenchmarkName<int32_t>(
+                           "Replay" + captured[i].op, device_type) +
+                       "_" + std::to_string(i);
+    CapturedShape c = captured[i];
+    RegisterBenchmark(name, [c, device_type]() -> BenchmarkStat {
+      return BenchmarkCapturedShape(c, device_type);
+    });
+  }
+}
+
+static int32_t RunRaggedOpsBenchmark() {
   PrintEnvironmentInfo();
 
   RegisterBenchmarkGetTransposeReordering(kCpu);
   RegisterBenchmarkGetTransposeReordering(kCuda);
   RegisterBenchmarkSegmentedExclusiveSum<int32_t>(kCpu);
   RegisterBenchmarkSegmentedExclusiveSum<int32_t>(kCuda);
+  RegisterBenchmarkSegmentedExclusiveSum<float>(kCuda);
+  RegisterBenchmarkSegmentedExclusiveSum<double>(kCuda);
+  RegisterBenchmarkRowSplitsToRowIds(kCpu);
+  RegisterBenchmarkRowSplitsToRowIds(kCuda);
+
+  // Users can set the environment variable `K2_BENCHMARK_SHAPES` to a file
+  // written with K2_SHAPE_CAPTURE set, to also time the ops on the shapes
+  // captured in it.
+  const char *shapes = std::getenv("K2_BENCHMARK_SHAPES");
+  if (shapes != nullptr) {
+    RegisterBenchmarkCapturedShapes(shapes, kCpu);
+    RegisterBenchmarkCapturedShapes(shapes, kCuda);
+  }
 
   // Users can set a regular expression via environment
   // variable `K2_BENCHMARK_FILTER` such that only benchmarks
@@ -141,15 +304,12 @@ static void RunRaggedOpsBenchmark() {
   if (filter != nullptr) FilterRegisteredBenchmarks(filter);
 
   std::vector<BenchmarkRun> results = RunBechmarks();
-  std::cout << BenchmarkRun::GetFieldsName() << "\n";
-  for (const auto &r : results) {
-    std::cout << r << "\n";
-  }
+  return ReportBenchmarkResults(results);
 }
 
 }  // namespace k2
 
 int main() {
-  k2::RunRaggedOpsBenchmark();
-  return 0;
+  // a nonzero exit status means regressions w.r.t. K2_BENCHMARK_BASELINE
+  return k2::RunRaggedOpsBenchmark() == 0 ? 0 : 1;
 }
@@ -75,7 +75,7 @@ static void RegisterBenchmarkIndexAdd1D(DeviceType device_type) {
   }
 }
 
-static void RunTensorOpsBenchmark() {
+static int32_t RunTensorOpsBenchmark() {
   PrintEnvironmentInfo();
 
   RegisterBenchmarkIndexAdd1D<int32_t>(kCpu);
@@ -91,15 +91,12 @@ static void RunTensorOpsBenchmark() {
   if (filter != nullptr) FilterRegisteredBenchmarks(filter);
 
   std::vector<BenchmarkRun> results = RunBechmarks();
-  std::cout << BenchmarkRun::GetFieldsName() << "\n";
-  for (const auto &r : results) {
-    std::cout << r << "\n";
-  }
+  return ReportBenchmarkResults(results);
 }
 
 }  // namespace k2
 
 int main() {
-  k2::RunTensorOpsBenchmark();
-  return 0;
+  // a nonzero exit status means regressions w.r.t. K2_BENCHMARK_BASELINE
+  return k2::RunTensorOpsBenchmark() == 0 ? 0 : 1;
 }
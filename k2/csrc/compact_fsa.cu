@@ -0,0 +1,130 @@
+/**
+ * Copyright      2026  Xiaomi Corporation
+ *
+ * See LICENSE for clarification regarding multiple authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <cmath>
+#include <limits>
+
+#include "k2/csrc/array_ops.h"
+#include "k2/csrc/compact_fsa.h"
+#include "k2/csrc/fsa_utils.h"
+#include "k2/csrc/macros.h"
+
+namespace k2 {
+
+CompactFsaVec::CompactFsaVec(FsaOrVec &fsas, bool quantize /*= false*/)
+    : quantized(quantize) {
+  NVTX_RANGE(K2_FUNC);
+  FsaVec vec = FsaToFsaVec(fsas);
+  shape = vec.shape;
+  ContextPtr &c = vec.Context();
+  int32_t num_arcs = vec.NumElements();
+  const Arc *arcs_data = vec.values.Data();
+
+  if (!quantize) {
+    arcs = Array1<CompactArc>(c, num_arcs);
+    CompactArc *compact_arcs_data = arcs.Data();
+    K2_EVAL(
+        c, num_arcs, lambda_set_compact_arcs, (int32_t i)->void {
+          Arc arc = arcs_data[i];
+          CompactArc ans;
+          ans.dest_offset = arc.dest_state - arc.src_state;
+          ans.label = arc.label;
+          ans.score = arc.score;
+          compact_arcs_data[i] = ans;
+        });
+    return;
+  }
+
+  // Find the range of the finite scores and check the labels.
+  float minus_inf = -std::numeric_limits<float>::infinity();
+  Array1<float> scores(c, num_arcs), neg_scores(c, num_arcs);
+  Array1<int32_t> bad_labels(c, num_arcs);
+  float *scores_data = scores.Data(), *neg_scores_data = neg_scores.Data();
+  int32_t *bad_labels_data = bad_labels.Data();
+  K2_EVAL(
+      c, num_arcs, lambda_get_ranges, (int32_t i)->void {
+        Arc arc = arcs_data[i];
+        bool finite = arc.score > minus_inf;
+        scores_data[i] = arc.score;
+        neg_scores_data[i] = finite ? -arc.score : minus_inf;
+        bad_labels_data[i] = (arc.label < -1 || arc.label > 32767);
+      });
+  Array1<float> max_score(c, 1), neg_min_score(c, 1);
+  Array1<int32_t> any_bad_label(c, 1);
+  Max(scores, minus_inf, &max_score);
+  Max(neg_scores, minus_inf, &neg_min_score);
+  Max(bad_labels, 0, &any_bad_label);
+  K2_CHECK_EQ(any_bad_label[0], 0)
+      << "The labels of quantized FSAs must be in [-1, 32767]";
+  float max_finite_score = max_score[0], min_finite_score = -neg_min_score[0];
+  K2_CHECK(std::isfinite(max_finite_score) || max_finite_score == minus_inf)
+      << "Scores of +infinity or NaN are not supported";
+  if (max_finite_score != minus_inf) {
+    score_offset = min_finite_score;
+    score_step = (max_finite_score - min_finite_score) /
+                 (kQuantizedArcInfScore - 1);
+  }
+
+  quantized_arcs = Array1<QuantizedArc>(c, num_arcs);
+  QuantizedArc *quantized_arcs_data = quantized_arcs.Data();
+  float offset = score_offset, step = score_step;
+  K2_EVAL(
+      c, num_arcs, lambda_set_quantized_arcs, (int32_t i)->void {
+        Arc arc = arcs_data[i];
+        QuantizedArc ans;
+        ans.dest_offset = arc.dest_state - arc.src_state;
+        ans.label = static_cast<int16_t>(arc.label);
+        if (arc.score == minus_inf) {
+          ans.score = kQuantizedArcInfScore;
+        } else {
+          int32_t q = (step == 0.0f
+                           ? 0
+                           : static_cast<int32_t>(
+                                 roundf((arc.score - offset) / step)));
+          q = max(0, min(q, kQuantizedArcInfScore - 1));
+          ans.score = static_cast<uint16_t>(q);
+        }
+        quantized_arcs_data[i] = ans;
+      });
+}
+
+FsaVec CompactFsaVec::ToFsaVec() const {
+  NVTX_RANGE(K2_FUNC);
+  RaggedShape s = shape;
+  ContextPtr &c = s.Context();
+  int32_t num_arcs = s.NumElements();
+  const int32_t *row_ids1_data = s.RowIds(1).Data(),
+                *row_splits1_data = s.RowSplits(1).Data(),
+                *row_ids2_data = s.RowIds(2).Data();
+  CompactArcsAccessor acc(*this);
+  Array1<Arc> arcs(c, num_arcs);
+  Arc *arcs_data = arcs.Data();
+  K2_EVAL(
+      c, num_arcs, lambda_set_arcs, (int32_t arc_idx012)->void {
+        int32_t state_idx01 = row_ids2_data[arc_idx012],
+                fsa_idx0 = row_ids1_data[state_idx01],
+                state_idx1 = state_idx01 - row_splits1_data[fsa_idx0];
+        Arc arc = acc[arc_idx012];
+        arc.src_state = state_idx1;
+        arc.dest_state += state_idx1;
+        arcs_data[arc_idx012] = arc;
+      });
+  return FsaVec(s, arcs);
+}
+
+}  // namespace k2
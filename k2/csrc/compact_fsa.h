@@ -0,0 +1,134 @@
+/**
+ * Copyright      2026  Xiaomi Corporation
+ *
+ * See LICENSE for clarification regarding multiple authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef K2_CSRC_COMPACT_FSA_H_
+#define K2_CSRC_COMPACT_FSA_H_
+
+#include <cstdint>
+#include <limits>
+
+#include "k2/csrc/array.h"
+#include "k2/csrc/fsa.h"
+#include "k2/csrc/ragged.h"
+
+namespace k2 {
+
+/*
+  An arc of a CompactFsaVec: 12 bytes instead of the 16 of Arc.  The source
+  state is not stored, as it is given by the row_ids of the shape, and the
+  destination state is stored relative to it.
+*/
+struct CompactArc {
+  int32_t dest_offset;  // dest_state - src_state
+  int32_t label;
+  float score;
+};
+
+/*
+  An arc of a quantized CompactFsaVec: 8 bytes.  The label must fit in 16
+  bits, and the score is quantized to 16 bits; see CompactFsaVec.
+*/
+struct QuantizedArc {
+  int32_t dest_offset;  // dest_state - src_state
+  int16_t label;
+  uint16_t score;
+};
+
+// The quantized score of arcs whose score is -infinity.
+constexpr uint16_t kQuantizedArcInfScore = 65535;
+
+/*
+  A read-only, compact copy of a decoding graph (an FsaVec), for the pruned
+  intersection, whose speed is mostly bound by the memory traffic of reading
+  the arcs of the graph.  The shape is that of the FsaVec, and the arcs are
+  either CompactArcs, which are exact, or QuantizedArcs, which take half the
+  memory of Arc; see the constructor.  Arc indexes are the same as in the
+  FsaVec, so the arc maps output by the intersection index the original
+  graph (and its attributes).
+*/
+struct CompactFsaVec {
+  RaggedShape shape;  // The shape of the FsaVec, with 3 axes.
+  bool quantized = false;
+  Array1<CompactArc> arcs;              // Set if !quantized.
+  Array1<QuantizedArc> quantized_arcs;  // Set if quantized.
+  // The score of a QuantizedArc with score q != kQuantizedArcInfScore is
+  // score_offset + q * score_step.
+  float score_offset = 0.0f;
+  float score_step = 0.0f;
+
+  CompactFsaVec() = default;
+
+  /*
+    Create a compact copy of `fsas`.
+
+       @param [in] fsas  The FSAs to copy; an FsaVec, or an Fsa which is
+                         treated as an FsaVec with one FSA.
+       @param [in] quantize  If true, store QuantizedArcs: the labels must
+                         be in [-1, 32767], and the finite scores are
+                         rounded to 65535 levels between the lowest and the
+                         highest of them, so each is off by at most half of
+                         score_step; scores of -infinity are kept.  This
+                         changes the results of the search slightly.
+   */
+  explicit CompactFsaVec(FsaOrVec &fsas, bool quantize = false);
+
+  ContextPtr &Context() const { return shape.Context(); }
+  int32_t NumArcs() const { return shape.NumElements(); }
+
+  // Returns the FsaVec this was created from (with the scores rounded, if
+  // quantized).
+  FsaVec ToFsaVec() const;
+};
+
+/*
+  Gives kernels access to the arcs of a CompactFsaVec.  The returned Arc
+  has src_state == 0 and dest_state equal to the offset of the destination
+  state, so only dest_state - src_state is meaningful; this is all the
+  intersection needs to find the destination state.
+*/
+struct CompactArcsAccessor {
+  const CompactArc *arcs;
+  const QuantizedArc *quantized_arcs;
+  float score_offset;
+  float score_step;
+
+  CompactArcsAccessor()
+      : arcs(nullptr), quantized_arcs(nullptr), score_offset(0),
+        score_step(0) {}
+  explicit CompactArcsAccessor(const CompactFsaVec &fsas)
+      : arcs(fsas.quantized ? nullptr : fsas.arcs.Data()),
+        quantized_arcs(fsas.quantized ? fsas.quantized_arcs.Data() : nullptr),
+        score_offset(fsas.score_offset),
+        score_step(fsas.score_step) {}
+
+  __host__ __device__ __forceinline__ Arc operator[](int32_t arc_idx) const {
+    if (arcs != nullptr) {
+      CompactArc arc = arcs[arc_idx];
+      return Arc(0, arc.dest_offset, arc.label, arc.score);
+    }
+    QuantizedArc arc = quantized_arcs[arc_idx];
+    float score = (arc.score == kQuantizedArcInfScore
+                       ? -std::numeric_limits<float>::infinity()
+                       : score_offset + arc.score * score_step);
+    return Arc(0, arc.dest_offset, arc.label, score);
+  }
+};
+
+}  // namespace k2
+
+#endif  // K2_CSRC_COMPACT_FSA_H_
@@ -353,12 +353,12 @@ class Connector {
       riter = c->GetNextBatchBackward(*riter);
   }
 
-  /* Does the main work of connecting and returns the resulting FSAs.
-        @param [out] arc_map  if non-NULL, the map from (arcs in output)
-                     to (corresponding arcs in input) is written to here.
-        @return   Returns the connected FsaVec.
+  /* Marks the states that are both accessible and coaccessible.
+        @return   Returns a Renumbering of the states of fsas_ (as idx01's)
+                  whose Keep() is 1 for the states that are both accessible
+                  and coaccessible, and 0 otherwise.
    */
-  FsaVec Connect(Array1<int32_t> *arc_map) {
+  Renumbering GetConnectedStates() {
     NVTX_RANGE(K2_FUNC);
     Array1<int32_t> dest_states_idx01 = GetDestStates(fsas_, true);
     dest_states_ = Ragged<int32_t>(fsas_.shape, dest_states_idx01);
@@ -371,7 +371,7 @@ class Connector {
     pool->SubmitTask([this]() { BackwardPassStatic(this); });
     pool->WaitAllTasksFinished();
 
-    // Get remaining states and construct row_ids1/row_splits1
+    // Get remaining states
     int32_t num_states = fsas_.shape.TotSize(1);
     const char *accessible_data = accessible_.Data(),
                *coaccessible_data = coaccessible_.Data();
@@ -385,6 +385,20 @@ class Connector {
           else
             states_renumbering_data[state_idx01] = 0;
         });
+    return states_renumbering;
+  }
+
+  /* Does the main work of connecting and returns the resulting FSAs.
+        @param [out] arc_map  if non-NULL, the map from (arcs in output)
+                     to (corresponding arcs in input) is written to here.
+        @return   Returns the connected FsaVec.
+   */
+  FsaVec Connect(Array1<int32_t> *arc_map) {
+    NVTX_RANGE(K2_FUNC);
+    Renumbering states_renumbering = GetConnectedStates();
+    const char *accessible_data = accessible_.Data(),
+               *coaccessible_data = coaccessible_.Data();
+    // Construct row_ids1/row_splits1
     Array1<int32_t> new2old_map_states = states_renumbering.New2Old();
     Array1<int32_t> old2new_map_states = states_renumbering.Old2New();
     Array1<int32_t> new_row_ids1 = fsas_.RowIds(1)[new2old_map_states];
@@ -499,9 +513,15 @@ class Connector {
   Array1<char> coaccessible_;
 };
 
+Renumbering GetConnectedStates(FsaVec &fsas) {
+  NVTX_RANGE(K2_FUNC);
+  Connector connector(fsas);
+  return connector.GetConnectedStates();
+}
+
 void Connect(FsaOrVec &src, FsaOrVec *dest,
              Array1<int32_t> *arc_map /* = nullptr */) {
-  NVTX_RANGE(K2_FUNC);
+  NVTX_RANGE_PAYLOAD(K2_FUNC, kFsaAlgo, src.NumElements());
   K2_CHECK_GE(src.NumAxes(), 2);
   K2_CHECK_LE(src.NumAxes(), 3);
   if (src.NumAxes() == 2) {
@@ -17,8 +17,16 @@
  * limitations under the License.
  */
 
+#include <condition_variable>  // NOLINT
+#include <exception>
+#include <thread>  // NOLINT
+#include <utility>
+
 #include "k2/csrc/context.h"
+#include "k2/csrc/device_guard.h"
 #include "k2/csrc/eval.h"
+#include "k2/csrc/moderngpu_allocator.h"
+#include "k2/csrc/thread_pool.h"
 
 namespace k2 {
 
@@ -39,8 +47,48 @@ void CudaStreamOverride::Pop(cudaStream_t stream) {
     stream_override_ = stack_.back();
 }
 
+CudaStreamOverride &GetCudaStreamOverride() {
+  static thread_local CudaStreamOverride stream_override;
+  return stream_override;
+}
+
+ThreadCudaStream::ThreadCudaStream(ContextPtr c)
+    : c_(c), stream_(static_cast<cudaStream_t>(0x0)) {
+  if (c_->GetDeviceType() != kCuda) return;
+  DeviceGuard guard(c_);
+  auto ret = cudaStreamCreateWithFlags(&stream_, cudaStreamNonBlocking);
+  K2_CHECK_CUDA_ERROR(ret);
+  cudaEvent_t event;
+  ret = cudaEventCreateWithFlags(&event, cudaEventDisableTiming);
+  K2_CHECK_CUDA_ERROR(ret);
+  ret = cudaEventRecord(event, c_->GetCudaStream());
+  K2_CHECK_CUDA_ERROR(ret);
+  ret = cudaStreamWaitEvent(stream_, event, 0);
+  K2_CHECK_CUDA_ERROR(ret);
+  ret = cudaEventDestroy(event);
+  K2_CHECK_CUDA_ERROR(ret);
+  GetCudaStreamOverride().Push(stream_);
+}
+
+ThreadCudaStream::~ThreadCudaStream() {
+  if (stream_ == static_cast<cudaStream_t>(0x0)) return;
+  DeviceGuard guard(c_);
+  GetCudaStreamOverride().Pop(stream_);
+  cudaEvent_t event;
+  auto ret = cudaEventCreateWithFlags(&event, cudaEventDisableTiming);
+  K2_CHECK_CUDA_ERROR(ret);
+  ret = cudaEventRecord(event, stream_);
+  K2_CHECK_CUDA_ERROR(ret);
+  ret = cudaStreamWaitEvent(c_->GetCudaStream(), event, 0);
+  K2_CHECK_CUDA_ERROR(ret);
+  ret = cudaEventDestroy(event);
+  K2_CHECK_CUDA_ERROR(ret);
+  ret = cudaStreamDestroy(stream_);
+  K2_CHECK_CUDA_ERROR(ret);
+}
+
 RegionPtr NewRegion(ContextPtr context, std::size_t num_bytes) {
-  NVTX_RANGE(K2_FUNC);
+  NVTX_RANGE_NO_OP_STATS(K2_FUNC);
   // .. fairly straightforward.  Sets bytes_used to num_bytes, caller can
   // overwrite if needed.
   auto ans = std::make_shared<Region>();
@@ -49,6 +97,7 @@ RegionPtr NewRegion(ContextPtr context, std::size_t num_bytes) {
   // we need add another constructor of Region to allow the caller
   // to provide deleter_context.
   ans->data = context->Allocate(num_bytes, &ans->deleter_context);
+  OpStatsAllocation(ans->data, num_bytes);
   ans->num_bytes = num_bytes;
   ans->bytes_used = num_bytes;
   return ans;
@@ -106,6 +155,132 @@ void ParallelRunnerActive::Finish() {
   c_ = nullptr;
 }
 
+struct BackgroundRunner::State {
+  std::mutex mutex;
+  std::condition_variable cond;
+  // Tasks that no thread has started yet.
+  std::deque<std::function<void()>> pending;
+  // Tasks that have been launched but have not finished yet.
+  int32_t num_unfinished = 0;
+  // The first exception thrown by a task, if any.
+  std::exception_ptr exception;
+
+  // Pop one pending task, if any, and run it.  Returns false if there was
+  // none.
+  bool RunOne() {
+    std::function<void()> f;
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      if (pending.empty()) return false;
+      f = std::move(pending.front());
+      pending.pop_front();
+    }
+    std::exception_ptr e;
+    try {
+      f();
+    } catch (...) {
+      e = std::current_exception();
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    if (e && !exception) exception = e;
+    if (--num_unfinished == 0) cond.notify_all();
+    return true;
+  }
+};
+
+BackgroundRunner::BackgroundRunner(ContextPtr c)
+    : c_(c),
+      parent_stream_(c->GetCudaStream()),
+      state_(std::make_shared<State>()) {}
+
+void BackgroundRunner::Background(std::function<void()> f,
+                                  std::size_t num_work_items /*= 0*/) {
+  NVTX_RANGE(K2_FUNC);
+  cudaStream_t stream = kCudaStreamInvalid;
+  if (c_->GetDeviceType() == kCuda) {
+    // Small tasks stay on the parent stream, so they are ordered with the
+    // work queued there.
+    stream = parent_stream_;
+    if (num_work_items >= 10000) {
+      DeviceGuard guard(c_);
+      auto ret = cudaStreamCreate(&stream);
+      K2_CHECK_CUDA_ERROR(ret);
+      streams_.push_back(stream);
+      // the new stream waits for what has been queued on the parent stream
+      // so far, e.g. the inputs of the task.
+      cudaEvent_t event;
+      ret = cudaEventCreateWithFlags(&event, cudaEventDisableTiming);
+      K2_CHECK_CUDA_ERROR(ret);
+      ret = cudaEventRecord(event, parent_stream_);
+      K2_CHECK_CUDA_ERROR(ret);
+      ret = cudaStreamWaitEvent(stream, event, 0);
+      K2_CHECK_CUDA_ERROR(ret);
+      ret = cudaEventDestroy(event);
+      K2_CHECK_CUDA_ERROR(ret);
+    }
+  }
+
+  ContextPtr c = c_;
+  auto task = [c, stream, f]() {
+    DeviceGuard guard(c);
+    With w(stream);
+    f();
+  };
+  {
+    std::lock_guard<std::mutex> lock(state_->mutex);
+    state_->pending.emplace_back(std::move(task));
+    ++state_->num_unfinished;
+  }
+  // The pool thread runs whichever task is pending when it gets to it, which
+  // may already have been run by Wait(); `state` keeps the queue alive until
+  // then.
+  std::shared_ptr<State> state = state_;
+  GetThreadPool()->SubmitTask([state]() { state->RunOne(); });
+}
+
+void BackgroundRunner::Wait() {
+  NVTX_RANGE(K2_FUNC);
+  // Don't wait for a pool thread to become free; this also means nested
+  // BackgroundRunners can't deadlock the pool.
+  while (state_->RunOne()) {
+  }
+  std::exception_ptr e;
+  {
+    std::unique_lock<std::mutex> lock(state_->mutex);
+    state_->cond.wait(lock, [this]() { return state_->num_unfinished == 0; });
+    std::swap(e, state_->exception);
+  }
+
+  if (!streams_.empty()) {
+    DeviceGuard guard(c_);
+    for (cudaStream_t stream : streams_) {
+      cudaEvent_t event;
+      auto ret = cudaEventCreateWithFlags(&event, cudaEventDisableTiming);
+      K2_CHECK_CUDA_ERROR(ret);
+      ret = cudaEventRecord(event, stream);
+      K2_CHECK_CUDA_ERROR(ret);
+      ret = cudaStreamWaitEvent(parent_stream_, event, 0);
+      K2_CHECK_CUDA_ERROR(ret);
+      ret = cudaEventDestroy(event);
+      K2_CHECK_CUDA_ERROR(ret);
+      ret = cudaStreamDestroy(stream);
+      K2_CHECK_CUDA_ERROR(ret);
+    }
+    streams_.clear();
+  }
+  if (e) std::rethrow_exception(e);
+}
+
+BackgroundRunner::~BackgroundRunner() {
+  try {
+    Wait();
+  } catch (const std::exception &e) {
+    K2_LOG(WARNING) << "Exception in background task: " << e.what();
+  } catch (...) {
+    K2_LOG(WARNING) << "Unknown exception in background task";
+  }
+}
+
 void GetBlockSizesForLambda2(int32_t m, int32_t n, dim3 *block_dim,
                              dim3 *grid_dim, Lambda2KernelType *kernel_type) {
   // Note: 'n' is the 'inner-loop' one, the one which is supposed to vary the
@@ -182,4 +357,26 @@ void Semaphore::Wait(ContextPtr c) {
   }
 }
 
+void PrewarmCuda(int32_t gpu_id /*= -1*/, bool background /*= false*/) {
+  if (background) {
+    std::thread([gpu_id]() { PrewarmCuda(gpu_id, false); }).detach();
+    return;
+  }
+  NVTX_RANGE(K2_FUNC);
+  ContextPtr c = GetCudaContext(gpu_id);
+  if (c->GetDeviceType() != kCuda) return;
+  if (c->GetDeviceId() < 0) {
+    // GetModernGpuAllocator() needs the actual device.
+    K2_CHECK_CUDA_ERROR(cudaGetDevice(&gpu_id));
+    c = GetCudaContext(gpu_id);
+  }
+  DeviceGuard guard(c);
+  // The regions are freed at once; this just sets up the allocators, which
+  // keep the memory for reuse.
+  NewRegion(c, 1);
+  NewRegion(GetPinnedContext(), 1);
+  GetModernGpuAllocator(c);
+  c->Sync();
+}
+
 }  // namespace k2
@@ -39,6 +39,7 @@ typedef SSIZE_T ssize_t;
 
 #include "k2/csrc/log.h"
 #include "k2/csrc/nvtx.h"
+#include "k2/csrc/op_stats.h"
 #include "k2/csrc/semaphore.h"
 
 #ifndef K2_WITH_CUDA
@@ -189,46 +190,72 @@ class Context : public std::enable_shared_from_this<Context> {
 };
 
 /*
-  NOTE: let's leave this for later, this won't be needed initially.
-
-  Used to run a task "in the background" (with a thread pool), for parallelism.
-  This should generally be used together with the GetChild() of the context
-  object so that in case we're using a GPU the GPU stream doesn't cause the
-  tasks to be serialized.
+  Used to run tasks "in the background" (on the thread pool returned by
+  GetThreadPool()), for parallelism.  On CUDA, each task may get its own child
+  stream, so the GPU stream doesn't cause the tasks to be serialized; this is
+  what makes it different from ParallelRunner, which only parallelizes the GPU
+  work of code that runs in one thread.
 
   General usage would be:
      ContextPtr c;  // passed in
-     BackgroundRunner br;
+     BackgroundRunner br(c);
      for (int32_t i = 0; i < N; ++i) {
-        std::function<void()> lambda = [=] () {
-        ContextPtr c_child = c.Child();
-           // do something here, possibly with multiple steps...
-        }
-        br.Background(lambda);
+        br.Background([=] () {
+           // do something here with `c`, possibly with multiple steps...
+        }, num_work_items);
      }
      br.Wait();
 
   This is necessary because if you do something that isn't just a simple
   Eval() but requires, for instance, copying a number back to the CPU,
-  just parallelizing the GPU streams using c.Child() isn't enough because
-  it will synchronize in the loop.
+  just parallelizing the GPU streams isn't enough because it will synchronize
+  in the loop.
  */
 class BackgroundRunner {
  public:
-  // TODO: may at some point add in a "cost estimate" that can help the code
-  // decide whether the overhead of creating a thread is worth it.
-  // Also, there will be a global semaphore that limits the number of threads
-  // that can exist at any one time.
-  void Background(std::function<void()> &f);
-
-  //  Waits for all (CPU) threads launched by Background() on this object since
-  // the last call to Wait(), to terminate.
+  /* Constructor.
+       @param [in] c  The context the tasks will use.  If it is a CUDA context,
+                      the child streams are ordered with respect to the stream
+                      that c->GetCudaStream() returns when this object is
+                      constructed (the "parent stream"): see Background() and
+                      Wait().
+   */
+  explicit BackgroundRunner(ContextPtr c);
+
+  /* Run `f` in a thread of the thread pool, with the device of `c` as the
+     current device.  If `c` is a CUDA context and `num_work_items` is at
+     least 10000 (the threshold of ParallelRunnerActive::NewStream()), `f`
+     runs with `With w(stream)` for a newly created stream that first waits
+     for the work queued so far on the parent stream; otherwise it uses the
+     parent stream.
+
+     If no thread of the pool is free by the time Wait() is called, the task
+     is run by Wait() in the calling thread.  Tasks must not wait for tasks
+     that were launched after them.
+   */
+  void Background(std::function<void()> f, std::size_t num_work_items = 0);
+
+  /* Wait for all tasks launched by Background() on this object since the last
+     call to Wait() to finish, and make the parent stream wait for the work
+     they queued on their streams.  If any of the tasks threw an exception,
+     the first one is re-thrown here.
+   */
   void Wait();
 
+  // Calls Wait().  Exceptions thrown by the tasks are only logged here, so
+  // call Wait() explicitly if you need to handle them.
+  ~BackgroundRunner();
+
+  BackgroundRunner(const BackgroundRunner &) = delete;
+  BackgroundRunner &operator=(const BackgroundRunner &) = delete;
+
  private:
-  // TODO:  My current thinking on this is for Background() to create threads
-  // that Wait() can wait on, and to have the number of threads limited by a
-  // global semaphore.
+  struct State;  // shared with the tasks, defined in context.cu
+
+  ContextPtr c_;
+  cudaStream_t parent_stream_;
+  std::vector<cudaStream_t> streams_;  // child streams created since Wait()
+  std::shared_ptr<State> state_;
 };
 
 template <typename T1, typename T2>
@@ -277,6 +304,10 @@ struct Region : public std::enable_shared_from_this<Region> {
   size_t bytes_used;  // largest number of bytes used/covered by any Array that
                       // points to this Region (this is relevant for things that
                       // behave like resizable vectors).
+  // If non-NULL, the memory was not allocated by `context` (e.g. it came from
+  // another framework via DLPack) and is freed by calling
+  // external_deleter(deleter_context) instead of context->Deallocate().
+  void (*external_deleter)(void *) = nullptr;
 
   // You need template arg to invoke this, e.g. region->GetData<int32_t>();
   // You can also choose to template additionally on the device-type, like
@@ -308,8 +339,10 @@ struct Region : public std::enable_shared_from_this<Region> {
       new_size = i;  // Round up `new_size` to a power of 2.
       void *new_deleter_context;
       void *new_data = context->Allocate(new_size, &new_deleter_context);
+      OpStatsAllocation(new_data, new_size);
       context->CopyDataTo(bytes_used, data, context, new_data);
-      context->Deallocate(data, deleter_context);
+      Free();
+      external_deleter = nullptr;
       data = new_data;
       deleter_context = new_deleter_context;
       num_bytes = new_size;
@@ -317,7 +350,19 @@ struct Region : public std::enable_shared_from_this<Region> {
     bytes_used = new_bytes_used;
   }
 
-  ~Region() { context->Deallocate(data, deleter_context); }
+  ~Region() { Free(); }
+
+ private:
+  void Free() {
+    if (external_deleter != nullptr) {
+      external_deleter(deleter_context);
+    } else {
+      // A non-null deleter_context means that the memory was not allocated
+      // by the context, e.g. it belongs to a torch::Tensor.
+      if (deleter_context == nullptr) OpStatsDeallocation(data);
+      context->Deallocate(data, deleter_context);
+    }
+  }
 };
 
 using RegionPtr = std::shared_ptr<Region>;
@@ -336,6 +381,49 @@ ContextPtr GetCpuContext();
 // CAUTION: If there are no CUDA capable GPUs, it returns a CPU context!
 ContextPtr GetCudaContext(int32_t gpu_id = -1);
 
+// Statistics of the device memory managed by k2's own memory manager, see
+// GetCudaMemoryStats().
+struct CudaMemoryStats {
+  std::size_t bytes_in_use = 0;  // bytes currently allocated by users
+  std::size_t bytes_cached = 0;  // bytes freed by users but not yet
+                                 // returned to the device
+  std::size_t peak_bytes_in_use = 0;
+  int64_t num_allocs = 0;        // number of allocations of nonzero size
+  int64_t num_cache_hits = 0;    // number of allocations served from cached
+                                 // memory (with K2_CUDA_ALLOCATOR=caching)
+  int64_t num_cuda_mallocs = 0;  // number of calls to cudaMalloc()
+};
+
+/* Return statistics of the device memory allocated by the contexts returned
+   by GetCudaContext() on the device `gpu_id` (-1 for the current device).
+
+   Without PyTorch, GetCudaContext() allocates memory through a caching
+   allocator by default; the environment variable `K2_CUDA_ALLOCATOR` selects
+   it:
+     - "caching" (default): freed blocks are kept and reused, in the order of
+       the stream that freed them;
+     - "async": use CUDA's stream-ordered allocator (cudaMallocAsync(), needs
+       CUDA 11.2 or later) with its default memory pool;
+     - "none": call cudaMalloc() and cudaFree() directly, which is useful
+       with cuda-memcheck.
+
+   With PyTorch, memory is managed by PyTorch (use torch.cuda.memory_stats())
+   and the returned stats are all zero.
+ */
+CudaMemoryStats GetCudaMemoryStats(int32_t gpu_id = -1);
+
+/* Reset the `peak_bytes_in_use` of GetCudaMemoryStats(gpu_id) to the current
+   `bytes_in_use`, so that the peak memory of a piece of code can be measured.
+   Does nothing with PyTorch.
+ */
+void ResetPeakCudaMemoryStats(int32_t gpu_id = -1);
+
+/* Release the device memory cached by k2's own memory manager on the device
+   `gpu_id` (-1 for the current device) back to the device.  With PyTorch, it
+   empties PyTorch's cache instead.
+ */
+void EmptyCudaCache(int32_t gpu_id = -1);
+
 /* Returns a (CPU) context that will allocate pinned memory.  (This is CPU
    memory that's pinned for faster GPU memory transfers).  May or may not
    return the same value as ::k2::GetCpuContext()... this is so, for instance,
@@ -345,6 +433,89 @@ ContextPtr GetCudaContext(int32_t gpu_id = -1);
  */
 ContextPtr GetPinnedContext();
 
+// Statistics of the pinned memory allocated by the context returned by
+// GetPinnedContext(); see GetPinnedMemoryStats().  Sizes are those of the
+// size classes that requests are rounded up to.
+struct PinnedMemoryStats {
+  std::size_t bytes_in_use = 0;  // bytes currently allocated by users
+  std::size_t bytes_cached = 0;  // bytes freed by users but kept for reuse
+  std::size_t cache_limit = 0;   // see SetPinnedMemoryCacheLimit()
+  int64_t num_allocs = 0;        // number of allocations of nonzero size
+  int64_t num_cache_hits = 0;    // allocations served from cached memory
+  int64_t num_cache_misses = 0;  // allocations that needed new memory
+  int64_t num_cuda_malloc_hosts = 0;  // successful calls to cudaMallocHost()
+};
+
+// Return statistics of the pinned memory allocator.
+PinnedMemoryStats GetPinnedMemoryStats();
+
+/* Set the maximum number of bytes of freed pinned memory that is kept for
+   reuse (by default there is no limit; 0 disables caching).  If more is
+   cached, free blocks are returned to the system with cudaFreeHost(),
+   which may synchronize.
+ */
+void SetPinnedMemoryCacheLimit(std::size_t num_bytes);
+
+// Return all cached pinned memory that is not in use to the system.
+void EmptyPinnedMemoryCache();
+
+/* k2 initializes CUDA lazily: nothing is done until a CUDA or pinned context
+   is first requested, so CPU-only programs never touch the CUDA runtime.  The
+   first CUDA ops then pay for finding the devices, creating the CUDA context,
+   the allocators and moderngpu's context (see GetInitPhaseStats() in
+   op_stats.h for how long each takes).
+
+   This does all of that up front for the device `gpu_id` (-1 for the current
+   device), e.g. when a service starts, so that its first request does not
+   pay for it.  If `background` is true it is done in a new (detached)
+   thread and this returns at once.  It does nothing more than finding the
+   devices if there is no CUDA capable GPU.
+ */
+void PrewarmCuda(int32_t gpu_id = -1, bool background = false);
+
+// How LargePageCpuContext backs large allocations with huge pages.
+enum class HugePageType {
+  kNone,         // Normal pages.
+  kTransparent,  // Ask for transparent huge pages with madvise().
+  k2MB,          // Explicit 2MB pages (MAP_HUGETLB), which must have been
+                 // reserved, e.g. in /proc/sys/vm/nr_hugepages.
+  k1GB,          // Explicit 1GB pages, likewise.
+};
+
+// Where LargePageCpuContext places large allocations on NUMA machines.
+enum class NumaPolicy {
+  kDefault,     // The policy of the process, normally the node of the thread
+                // that first touches each page.
+  kInterleave,  // Pages are interleaved over all the nodes we may use.
+  kNode,        // All pages on the node LargePageOptions::numa_node.
+};
+
+struct LargePageOptions {
+  HugePageType huge_pages = HugePageType::kTransparent;
+  NumaPolicy numa_policy = NumaPolicy::kDefault;
+  int32_t numa_node = 0;  // Only used if numa_policy == NumaPolicy::kNode.
+  // Allocations smaller than this are done as by GetCpuContext().
+  std::size_t min_bytes = 1 << 21;
+};
+
+/* Returns a CPU context for large, long-lived arrays such as the arcs of a
+   decoding graph, which are read at random, so reading them costs many TLB
+   misses with 4KB pages and remote memory accesses on NUMA machines.
+   Allocations of at least options.min_bytes are mapped separately with
+   huge pages and the NUMA placement of `options`.  This is done on a
+   best-effort basis: if the system can't do it (e.g. no explicit huge pages
+   are reserved, or this is not Linux), a warning is printed once and
+   normal pages are used.
+
+   The context is compatible with GetCpuContext(), so Array1::To() will not
+   copy to it; to move an array, do e.g.
+       Array1<Arc> arcs(GetLargePageCpuContext(), fsas.values.Dim());
+       arcs.CopyFrom(fsas.values);
+       fsas = FsaVec(fsas.shape, arcs);
+ */
+ContextPtr GetLargePageCpuContext(
+    const LargePageOptions &options = LargePageOptions());
+
 /* Return a (CPU) context that will allocate pinned memory if device_type
    is kCuda. It is equivalent to GetCpuContext() if device_type is kCpu.
 
@@ -418,19 +589,51 @@ class CudaStreamOverride {
   std::vector<cudaStream_t> stack_;
 };
 
-static thread_local CudaStreamOverride g_stream_override;
+// Returns the CudaStreamOverride of the calling thread.  It is defined in
+// context.cu so that all translation units share it.
+CudaStreamOverride &GetCudaStreamOverride();
 
 class With {
  public:
   explicit With(cudaStream_t stream) : stream_(stream) {
-    g_stream_override.Push(stream_);
+    GetCudaStreamOverride().Push(stream_);
   }
-  ~With() { g_stream_override.Pop(stream_); }
+  ~With() { GetCudaStreamOverride().Pop(stream_); }
 
  private:
   cudaStream_t stream_;
 };
 
+/*
+  Binds a new CUDA stream to the calling thread while this object exists:
+  the GetCudaStream() of every CUDA context returns it on this thread (unless
+  overridden again by a nested `With`), so that e.g. decoders running in
+  different threads on the same GPU do not serialize on one stream.
+
+  The new stream first waits for the work already queued on the stream of
+  `c`; the destructor makes the stream of `c` wait for the work queued on
+  the new stream, and destroys it.  Does nothing if `c` is a CPU context.
+
+  Must be created and destroyed on the same thread, with objects created
+  inside its scope going out of scope (or being used only via the stream of
+  `c`) after it is destroyed.
+ */
+class ThreadCudaStream {
+ public:
+  explicit ThreadCudaStream(ContextPtr c);
+  ~ThreadCudaStream();
+
+  ThreadCudaStream(const ThreadCudaStream &) = delete;
+  ThreadCudaStream &operator=(const ThreadCudaStream &) = delete;
+
+  // Returns the bound stream (0x0 for a CPU context).
+  cudaStream_t Stream() const { return stream_; }
+
+ private:
+  ContextPtr c_;
+  cudaStream_t stream_;
+};
+
 /*
   Our class Semaphore is a slight extension of std::counting_semaphore that also
   takes care of stream synchronization.  The projected use-case is when two
@@ -496,7 +699,7 @@ class ParallelRunnerActive {
   // with that object alive in the scope where you want the stream to be
   // used.
   //
-  // NOTE: this will also push the stream onto the stack g_stream_override
+  // NOTE: this will also push the stream onto the stack GetCudaStreamOverride()
   // (after popping that of any previous stream that this class generated)
   // so that you won't need to directly pass this into Eval(); the context
   // will call CudaStreamOverride::OverrideStream() and replace it
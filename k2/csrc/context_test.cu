@@ -0,0 +1,100 @@
+/**
+ * Copyright      2026  Xiaomi Corporation
+ *
+ * See LICENSE for clarification regarding multiple authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <thread>  // NOLINT
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "k2/csrc/array_ops.h"
+#include "k2/csrc/context.h"
+#include "k2/csrc/test_utils.h"
+
+namespace k2 {
+
+TEST(ContextTest, With) {
+  ContextPtr c = GetCudaContext();
+  if (c->GetDeviceType() == kCpu) {
+    // No CUDA capable devices are found, skip the test.
+    return;
+  }
+  cudaStream_t stream = c->GetCudaStream();
+  ParallelRunner pr(c);
+  cudaStream_t new_stream = pr.NewStream(100000);
+  {
+    With w(new_stream);
+    EXPECT_EQ(c->GetCudaStream(), new_stream);
+  }
+  EXPECT_EQ(c->GetCudaStream(), stream);
+}
+
+TEST(ContextTest, ThreadCudaStream) {
+  for (auto &c : {GetCpuContext(), GetCudaContext()}) {
+    cudaStream_t stream = c->GetCudaStream();
+    int32_t num_threads = 4;
+    std::vector<cudaStream_t> thread_streams(num_threads);
+    std::vector<std::thread> threads;
+    for (int32_t i = 0; i != num_threads; ++i) {
+      threads.emplace_back([&c, &thread_streams, i]() -> void {
+        ThreadCudaStream s(c);
+        thread_streams[i] = s.Stream();
+        if (c->GetDeviceType() == kCuda) {
+          EXPECT_EQ(c->GetCudaStream(), s.Stream());
+        }
+        // ExclusiveSum() needs one more element in the region of `a`.
+        Array1<int32_t> a = Range(c, 1001 + i, 0).Arange(0, 1000 + i);
+        Array1<int32_t> sum(c, a.Dim() + 1);
+        ExclusiveSum(a, &sum);
+        EXPECT_EQ(sum.Back(), (999 + i) * (1000 + i) / 2);
+      });
+    }
+    for (auto &t : threads) t.join();
+    EXPECT_EQ(c->GetCudaStream(), stream);
+    if (c->GetDeviceType() == kCuda) {
+      for (int32_t i = 1; i != num_threads; ++i)
+        EXPECT_NE(thread_streams[i], thread_streams[0]);
+    }
+  }
+}
+
+TEST(ContextTest, LargePageCpuContext) {
+  for (HugePageType huge_pages :
+       {HugePageType::kNone, HugePageType::kTransparent, HugePageType::k2MB,
+        HugePageType::k1GB}) {
+    for (NumaPolicy numa_policy :
+         {NumaPolicy::kDefault, NumaPolicy::kInterleave, NumaPolicy::kNode}) {
+      LargePageOptions options;
+      options.huge_pages = huge_pages;
+      options.numa_policy = numa_policy;
+      ContextPtr c = GetLargePageCpuContext(options);
+      EXPECT_TRUE(c->IsCompatible(*GetCpuContext()));
+      // The first one is mapped separately, the others are not.
+      for (int32_t n : {3 << 20, 10, 0}) {
+        Array1<int32_t> src = Range(GetCpuContext(), n, 0);
+        Array1<int32_t> a(c, n);
+        a.CopyFrom(src);
+        EXPECT_TRUE(Equal(a, src));
+        EXPECT_TRUE(Equal(a.To(GetCudaContext()), src.To(GetCudaContext())));
+        Array1<int32_t> b(c, n);
+        b.CopyFrom(src.To(GetCudaContext()));
+        EXPECT_TRUE(Equal(b, src));
+      }
+    }
+  }
+}
+
+}  // namespace k2
@@ -0,0 +1,128 @@
+/**
+ * Copyright      2026  Xiaomi Corporation
+ *
+ * See LICENSE for clarification regarding multiple authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <unordered_map>
+#include <vector>
+
+#include "k2/csrc/array_ops.h"
+#include "k2/csrc/ctc_graph_cache.h"
+#include "k2/csrc/fsa_algo.h"
+#include "k2/csrc/macros.h"
+#include "k2/csrc/ragged_ops.h"
+
+namespace k2 {
+
+FsaVec CtcGraphCache::GetGraphs(Ragged<int32_t> &symbols,
+                                Array1<int32_t> *aux_labels /*= nullptr*/) {
+  NVTX_RANGE(K2_FUNC);
+  K2_CHECK_EQ(symbols.NumAxes(), 2);
+  ContextPtr &c = symbols.Context();
+  if (c_ == nullptr) c_ = c;
+  K2_CHECK(c_->IsCompatible(*c))
+      << "The transcripts must always be on the same device";
+  int32_t num_fsas = symbols.Dim0();
+  if (num_fsas == 0) return CtcGraphs(symbols, modified_, aux_labels);
+
+  Array1<int64_t> hashes = ComputeHash<int64_t>(symbols).To(GetCpuContext());
+  const int64_t *hashes_data = hashes.Data();
+
+  // The graph of each transcript; we hold references to them, so evicting
+  // them from the cache while we add the misses does no harm.
+  std::vector<Fsa> graphs(num_fsas);
+  std::vector<Array1<int32_t>> graph_aux_labels(num_fsas);
+  // For transcripts not in the cache: their indexes in , without
+  // repeats, and the index in `miss_fsas` of each transcript's graph (or -1).
+  std::vector<int32_t> miss_fsas, miss_idx(num_fsas, -1);
+  std::unordered_map<int64_t, int32_t> key_to_miss;
+  for (int32_t i = 0; i != num_fsas; ++i) {
+    int64_t key = hashes_data[i];
+    auto iter = entries_.find(key);
+    if (iter != entries_.end()) {
+      Entry &entry = iter->second;
+      graphs[i] = entry.graph;
+      graph_aux_labels[i] = entry.aux_labels;
+      lru_.splice(lru_.begin(), lru_, entry.lru_pos);
+      ++num_hits_;
+      continue;
+    }
+    ++num_misses_;
+    auto ans = key_to_miss.emplace(key, static_cast<int32_t>(miss_fsas.size()));
+    if (ans.second) miss_fsas.push_back(i);
+    miss_idx[i] = ans.first->second;
+  }
+
+  if (!miss_fsas.empty()) {
+    Array1<int32_t> indexes(c, miss_fsas);
+    Ragged<int32_t> miss_symbols = Index(symbols, 0, indexes);
+    Array1<int32_t> miss_aux_labels;
+    FsaVec miss_graphs = CtcGraphs(miss_symbols, modified_, &miss_aux_labels);
+    std::vector<Fsa> new_graphs;
+    std::vector<Array1<int32_t>> arc_maps;
+    Unstack(miss_graphs, 0, &new_graphs, &arc_maps);
+    K2_CHECK_EQ(static_cast<int32_t>(new_graphs.size()), indexes.Dim());
+    std::vector<Array1<int32_t>> new_aux_labels(new_graphs.size());
+    for (size_t j = 0; j != new_graphs.size(); ++j)
+      new_aux_labels[j] = Index(miss_aux_labels, arc_maps[j], false, 0);
+
+    for (int32_t i = 0; i != num_fsas; ++i) {
+      int32_t j = miss_idx[i];
+      if (j < 0) continue;
+      graphs[i] = new_graphs[j];
+      graph_aux_labels[i] = new_aux_labels[j];
+    }
+    for (size_t j = 0; j != new_graphs.size(); ++j)
+      Insert(hashes_data[miss_fsas[j]], new_graphs[j], new_aux_labels[j]);
+  }
+
+  std::vector<Fsa *> graph_ptrs(num_fsas);
+  std::vector<const Array1<int32_t> *> aux_labels_ptrs(num_fsas);
+  for (int32_t i = 0; i != num_fsas; ++i) {
+    graph_ptrs[i] = &graphs[i];
+    aux_labels_ptrs[i] = &graph_aux_labels[i];
+  }
+  if (aux_labels != nullptr)
+    *aux_labels = Cat(c, num_fsas, aux_labels_ptrs.data());
+  return Stack(0, num_fsas, graph_ptrs.data());
+}
+
+void CtcGraphCache::Insert(int64_t key, Fsa &graph,
+                           Array1<int32_t> &aux_labels) {
+  int32_t num_states = graph.Dim0(), num_arcs = graph.NumElements();
+  // arcs, aux_labels, row_ids and row_splits.
+  std::size_t num_bytes =
+      num_arcs * (sizeof(Arc) + 2 * sizeof(int32_t)) +
+      (num_states + 1) * sizeof(int32_t);
+  if (num_bytes > max_bytes_) return;
+  while (num_bytes_ + num_bytes > max_bytes_) {
+    auto iter = entries_.find(lru_.back());
+    num_bytes_ -= iter->second.num_bytes;
+    entries_.erase(iter);
+    lru_.pop_back();
+  }
+  lru_.push_front(key);
+  entries_[key] = Entry{graph, aux_labels, num_bytes, lru_.begin()};
+  num_bytes_ += num_bytes;
+}
+
+void CtcGraphCache::Clear() {
+  entries_.clear();
+  lru_.clear();
+  num_bytes_ = 0;
+}
+
+}  // namespace k2
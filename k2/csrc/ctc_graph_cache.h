@@ -0,0 +1,110 @@
+/**
+ * Copyright      2026  Xiaomi Corporation
+ *
+ * See LICENSE for clarification regarding multiple authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef K2_CSRC_CTC_GRAPH_CACHE_H_
+#define K2_CSRC_CTC_GRAPH_CACHE_H_
+
+#include <cstddef>
+#include <list>
+#include <unordered_map>
+
+#include "k2/csrc/array.h"
+#include "k2/csrc/fsa.h"
+#include "k2/csrc/ragged.h"
+
+namespace k2 {
+
+/*
+  A cache of the CTC graphs of transcripts, for training, where the same
+  transcripts recur across epochs.  Example:
+
+    CtcGraphCache cache(false, 512 << 20);  // standard topology, 512 MB
+    for (...) {  // training steps
+      Array1<int32_t> aux_labels;
+      FsaVec graphs = cache.GetGraphs(symbols, &aux_labels);
+      ...
+    }
+
+  The graphs are kept on the device of the transcripts, keyed by a 64-bit
+  hash of each transcript's token sequence (see ComputeHash()); a collision
+  between two different transcripts, though very unlikely, would return the
+  wrong graph.  When the cached graphs exceed the memory budget, the least
+  recently used ones are evicted.  Not thread-safe.
+*/
+class CtcGraphCache {
+ public:
+  /*
+     @param [in] modified  The type of CTC topology of the graphs; see
+                     CtcGraphs().
+     @param [in] max_bytes  The memory budget: the approximate number of bytes
+                     of device memory the cached graphs may take up.  A graph
+                     larger than this is never cached.
+   */
+  CtcGraphCache(bool modified, std::size_t max_bytes)
+      : modified_(modified), max_bytes_(max_bytes) {}
+
+  /*
+    Returns the same as `CtcGraphs(symbols, modified, aux_labels)`, building
+    only the graphs of the transcripts that are not in the cache (and adding
+    them to it).
+
+      @param [in] symbols  The transcripts, with 2 axes.  Must always be on
+                     the same device.
+      @param [out] aux_labels  If not nullptr, will be set to the olabels of
+                     the graphs.
+      @return  Returns an FsaVec with `ans.Dim0() == symbols.Dim0()`.
+   */
+  FsaVec GetGraphs(Ragged<int32_t> &symbols,
+                   Array1<int32_t> *aux_labels = nullptr);
+
+  // Removes all the cached graphs.
+  void Clear();
+
+  int32_t NumGraphs() const { return static_cast<int32_t>(entries_.size()); }
+  std::size_t NumBytes() const { return num_bytes_; }
+  // The number of transcripts whose graphs were found in the cache, and not,
+  // over all calls to GetGraphs().
+  int64_t NumHits() const { return num_hits_; }
+  int64_t NumMisses() const { return num_misses_; }
+
+ private:
+  struct Entry {
+    Fsa graph;
+    Array1<int32_t> aux_labels;
+    std::size_t num_bytes;
+    std::list<int64_t>::iterator lru_pos;
+  };
+
+  // Adds a graph to the cache, evicting others if needed to stay within the
+  // budget.
+  void Insert(int64_t key, Fsa &graph, Array1<int32_t> &aux_labels);
+
+  bool modified_;
+  std::size_t max_bytes_;
+  std::size_t num_bytes_ = 0;
+  int64_t num_hits_ = 0;
+  int64_t num_misses_ = 0;
+  ContextPtr c_;
+  // Keys of the cached graphs, most recently used first.
+  std::list<int64_t> lru_;
+  std::unordered_map<int64_t, Entry> entries_;
+};
+
+}  // namespace k2
+
+#endif  // K2_CSRC_CTC_GRAPH_CACHE_H_
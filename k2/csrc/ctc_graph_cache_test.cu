@@ -0,0 +1,86 @@
+/**
+ * Copyright      2026  Xiaomi Corporation
+ *
+ * See LICENSE for clarification regarding multiple authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "gtest/gtest.h"
+#include "k2/csrc/array_ops.h"
+#include "k2/csrc/ctc_graph_cache.h"
+#include "k2/csrc/fsa_algo.h"
+#include "k2/csrc/ragged_ops.h"
+#include "k2/csrc/test_utils.h"
+
+namespace k2 {
+
+TEST(CtcGraphCache, CompareWithCtcGraphs) {
+  for (const ContextPtr &c : {GetCpuContext(), GetCudaContext()}) {
+    for (bool modified : {false, true}) {
+      CtcGraphCache cache(modified, 1 << 20);
+      for (const char *str : {"[ [ 1 2 2 3 ] [ 4 ] [ 1 2 2 3 ] ]",
+                              "[ [ 4 ] [ ] [ 5 5 ] [ 1 2 2 3 ] ]", "[ ]"}) {
+        Ragged<int32_t> symbols(c, str);
+        Array1<int32_t> aux_labels, aux_labels_ref;
+        FsaVec graphs = cache.GetGraphs(symbols, &aux_labels);
+        FsaVec graphs_ref = CtcGraphs(symbols, modified, &aux_labels_ref);
+        EXPECT_TRUE(Equal(graphs, graphs_ref));
+        EXPECT_TRUE(Equal(aux_labels, aux_labels_ref));
+      }
+      // The repeated transcript within the first batch is a miss, as its
+      // graph is only cached at the end of the call.
+      EXPECT_EQ(cache.NumMisses(), 5);
+      EXPECT_EQ(cache.NumHits(), 2);
+      EXPECT_EQ(cache.NumGraphs(), 4);
+
+      cache.Clear();
+      EXPECT_EQ(cache.NumGraphs(), 0);
+      EXPECT_EQ(cache.NumBytes(), 0);
+    }
+  }
+}
+
+TEST(CtcGraphCache, Eviction) {
+  for (const ContextPtr &c : {GetCpuContext(), GetCudaContext()}) {
+    Ragged<int32_t> a(c, "[ [ 1 2 3 ] ]"), b(c, "[ [ 4 5 6 ] ]"),
+        ab(c, "[ [ 1 2 3 ] [ 4 5 6 ] ]");
+    // The graphs of `a` and `b` have the same size; make room for only one
+    // of them.
+    CtcGraphCache probe(false, 1 << 20);
+    probe.GetGraphs(a);
+    CtcGraphCache cache(false, probe.NumBytes() + probe.NumBytes() / 2);
+
+    cache.GetGraphs(a);
+    cache.GetGraphs(b);  // evicts `a`
+    EXPECT_EQ(cache.NumGraphs(), 1);
+    EXPECT_LE(cache.NumBytes(), probe.NumBytes() + probe.NumBytes() / 2);
+    cache.GetGraphs(b);
+    EXPECT_EQ(cache.NumHits(), 1);
+    cache.GetGraphs(a);
+    EXPECT_EQ(cache.NumHits(), 1);
+    EXPECT_EQ(cache.NumMisses(), 3);
+
+    // Graphs evicted during a call are still returned correctly.
+    FsaVec graphs = cache.GetGraphs(ab);
+    EXPECT_TRUE(Equal(graphs, CtcGraphs(ab)));
+    EXPECT_EQ(cache.NumGraphs(), 1);
+
+    // Graphs larger than the budget are never cached.
+    CtcGraphCache tiny(false, 1);
+    EXPECT_TRUE(Equal(tiny.GetGraphs(ab), CtcGraphs(ab)));
+    EXPECT_EQ(tiny.NumGraphs(), 0);
+  }
+}
+
+}  // namespace k2
@@ -0,0 +1,312 @@
+/**
+ * Copyright      2026  Xiaomi Corporation
+ *
+ * See LICENSE for clarification regarding multiple authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <limits>
+#include <utility>
+#include <vector>
+
+#include "k2/csrc/array_ops.h"
+#include "k2/csrc/ctc_loss.h"
+#include "k2/csrc/macros.h"
+#include "k2/csrc/ragged_ops.h"
+#include "k2/csrc/utils.h"
+
+namespace k2 {
+
+bool GetBandedFsaVec(FsaVec &fsas, BandedFsaVec *banded) {
+  NVTX_RANGE(K2_FUNC);
+  K2_CHECK_EQ(fsas.NumAxes(), 3);
+  K2_CHECK_NE(banded, nullptr);
+  ContextPtr &c = fsas.Context();
+  int32_t num_states = fsas.TotSize(1), num_arcs = fsas.TotSize(2);
+
+  // For each (state, k), the number of arcs entering it from state - k, and
+  // the label and score of (one of) those arcs.
+  Array1<int32_t> counts(c, num_states * 3, 0),
+      slot_labels(c, num_states * 3, -1);
+  Array1<float> scores(c, num_states * 3,
+                       -std::numeric_limits<float>::infinity());
+  // Set to 0 if `fsas` turns out not to be banded.
+  Array1<int32_t> ok(c, 1, 1);
+  int32_t *counts_data = counts.Data(), *slot_labels_data = slot_labels.Data(),
+          *ok_data = ok.Data();
+  float *scores_data = scores.Data();
+  const Arc *arcs_data = fsas.values.Data();
+  const int32_t *row_ids2_data = fsas.RowIds(2).Data();
+
+  K2_EVAL(
+      c, num_arcs, lambda_set_slots, (int32_t arc_idx012)->void {
+        const Arc &arc = arcs_data[arc_idx012];
+        int32_t k = arc.dest_state - arc.src_state;
+        if (k < 0 || k > 2) {
+          ok_data[0] = 0;
+          return;
+        }
+        // the dest-state is in the same FSA as the src-state.
+        int32_t dest_state_idx01 = row_ids2_data[arc_idx012] + k,
+                slot = dest_state_idx01 * 3 + k;
+        AtomicAdd(counts_data + slot, 1);
+        slot_labels_data[slot] = arc.label;
+        scores_data[slot] = arc.score;
+      });
+
+  Array1<int32_t> labels(c, num_states);
+  int32_t *labels_data = labels.Data();
+  K2_EVAL(
+      c, num_states, lambda_set_labels, (int32_t state_idx01)->void {
+        int32_t label = -1;
+        bool has_label = false;
+        for (int32_t k = 0; k < 3; ++k) {
+          int32_t slot = state_idx01 * 3 + k, count = counts_data[slot];
+          if (count > 1 ||
+              (count == 1 && has_label && slot_labels_data[slot] != label)) {
+            ok_data[0] = 0;
+          } else if (count == 1) {
+            label = slot_labels_data[slot];
+            has_label = true;
+          }
+        }
+        labels_data[state_idx01] = label;
+      });
+
+  if (ok[0] == 0) return false;
+  banded->shape = RemoveAxis(fsas.shape, 2);
+  banded->labels = labels;
+  banded->scores = scores;
+  return true;
+}
+
+/*
+  Returns alpha(t, j), the log-sum of the scores of the paths that end in
+  state j after consuming frames 0..t, given alpha(t - 1, ...) in `prev`
+  (nullptr if t == 0, when the paths start in state 0) and the score
+  `emission` of frame t for the label of state j.
+  `scores` is the BandedFsaVec::scores of this FSA.
+ */
+template <typename FloatType>
+__host__ __device__ __forceinline__ FloatType BandedAlpha(
+    const FloatType *prev, const float *scores, int32_t j, float emission) {
+  FloatType ans = -std::numeric_limits<FloatType>::infinity();
+  for (int32_t k = 0; k <= 2 && k <= j; ++k) {
+    FloatType p;
+    if (prev != nullptr)
+      p = prev[j - k];
+    else  // at t == 0 the paths start in state 0.
+      p = (j == k ? FloatType(0)
+                  : -std::numeric_limits<FloatType>::infinity());
+    ans = LogAdd<FloatType>()(ans, p + scores[j * 3 + k]);
+  }
+  return ans + emission;
+}
+
+/*
+  Returns beta(t, j), the log-sum of the scores of the paths from state j
+  after frame t to the final state (num_states - 1) after the last frame,
+  given beta(t + 1, ...) in `next`.  `labels` and `scores` are those of the
+  BandedFsaVec for this FSA and `dense_scores(t + 1, label + 1)` must return
+  the score of frame t + 1 for `label`.
+ */
+template <typename FloatType, typename ScoresT>
+__host__ __device__ __forceinline__ FloatType BandedBeta(
+    const FloatType *next, const int32_t *labels, const float *scores,
+    int32_t num_states, int32_t j, int32_t next_row,
+    const ScoresT &dense_scores) {
+  FloatType ans = -std::numeric_limits<FloatType>::infinity();
+  for (int32_t k = 0; k <= 2 && j + k < num_states; ++k) {
+    int32_t dest = j + k;
+    ans = LogAdd<FloatType>()(
+        ans, next[dest] + scores[dest * 3 + k] +
+                 dense_scores(next_row, labels[dest] + 1));
+  }
+  return ans;
+}
+
+/*
+  One thread-block per FSA; the threads loop over its states, and the block
+  loops over frames.  `alpha` has (num_rows * num_states) elements for each
+  FSA, starting at alpha_offsets[fsa], and `beta` 2 * num_states, starting
+  at 2 * state_idx0x.  If dense_grad != nullptr it also computes the
+  derivatives (see CtcLossBanded()).
+ */
+template <typename FloatType>
+__global__ void CtcLossBandedKernel(
+    const int32_t *state_row_splits, const int32_t *frame_row_splits,
+    const int32_t *alpha_offsets, const int32_t *labels, const float *scores,
+    DenseFsaVecScores dense_scores, FloatType *alpha, FloatType *beta,
+    FloatType *tot_scores, float *dense_grad, int32_t grad_stride) {
+  int32_t fsa_idx0 = blockIdx.x,
+          state_idx0x = state_row_splits[fsa_idx0],
+          num_states = state_row_splits[fsa_idx0 + 1] - state_idx0x,
+          row_idx0x = frame_row_splits[fsa_idx0],
+          num_rows = frame_row_splits[fsa_idx0 + 1] - row_idx0x;
+  const int32_t *this_labels = labels + state_idx0x;
+  const float *this_scores = scores + state_idx0x * 3;
+  FloatType *this_alpha = alpha + alpha_offsets[fsa_idx0],
+            *this_beta = beta + state_idx0x * 2;
+
+  for (int32_t t = 0; t < num_rows; ++t) {
+    const FloatType *prev =
+        (t == 0 ? nullptr : this_alpha + (t - 1) * num_states);
+    for (int32_t j = threadIdx.x; j < num_states; j += blockDim.x)
+      this_alpha[t * num_states + j] =
+          BandedAlpha(prev, this_scores, j,
+                      dense_scores(row_idx0x + t, this_labels[j] + 1));
+    __syncthreads();
+  }
+  FloatType tot = -std::numeric_limits<FloatType>::infinity();
+  if (num_states > 0)
+    tot = this_alpha[num_rows * num_states - 1];
+  if (threadIdx.x == 0) tot_scores[fsa_idx0] = tot;
+
+  if (dense_grad == nullptr ||
+      tot == -std::numeric_limits<FloatType>::infinity())
+    return;
+
+  for (int32_t t = num_rows - 1; t >= 0; --t) {
+    FloatType *cur = this_beta + (t % 2) * num_states,
+              *next = this_beta + ((t + 1) % 2) * num_states;
+    for (int32_t j = threadIdx.x; j < num_states; j += blockDim.x) {
+      FloatType b;
+      if (t == num_rows - 1)
+        b = (j == num_states - 1
+                 ? FloatType(0)
+                 : -std::numeric_limits<FloatType>::infinity());
+      else
+        b = BandedBeta(next, this_labels, this_scores, num_states, j,
+                       row_idx0x + t + 1, dense_scores);
+      cur[j] = b;
+      FloatType occupation = exp(this_alpha[t * num_states + j] + b - tot);
+      if (occupation > 0)
+        AtomicAdd(dense_grad + (row_idx0x + t) * grad_stride +
+                      this_labels[j] + 1,
+                  static_cast<float>(occupation));
+    }
+    __syncthreads();
+  }
+}
+
+template <typename FloatType>
+void CtcLossBanded(BandedFsaVec &graphs, DenseFsaVec &dense,
+                   Array1<FloatType> *tot_scores,
+                   Array2<float> *dense_grad /*= nullptr*/) {
+  NVTX_RANGE(K2_FUNC);
+  ContextPtr c = GetContext(graphs.shape, dense.shape);
+  int32_t num_fsas = graphs.shape.Dim0();
+  K2_CHECK_EQ(num_fsas, dense.shape.Dim0());
+  K2_CHECK(dense_grad == nullptr ||
+           (!dense.IsSparse() && !dense.IsPadded() && !dense.IsHalf()))
+      << "The derivatives need the dense form of the scores, in float";
+
+  const int32_t *state_row_splits_data = graphs.shape.RowSplits(1).Data(),
+                *frame_row_splits_data = dense.shape.RowSplits(1).Data();
+  // The alpha of the i'th FSA has num_frames(i) * num_states(i) elements.
+  Array1<int32_t> alpha_offsets(c, num_fsas + 1);
+  int32_t *alpha_offsets_data = alpha_offsets.Data();
+  K2_EVAL(
+      c, num_fsas, lambda_set_alpha_sizes, (int32_t fsa_idx0)->void {
+        alpha_offsets_data[fsa_idx0] =
+            (state_row_splits_data[fsa_idx0 + 1] -
+             state_row_splits_data[fsa_idx0]) *
+            (frame_row_splits_data[fsa_idx0 + 1] -
+             frame_row_splits_data[fsa_idx0]);
+      });
+  ExclusiveSum(alpha_offsets, &alpha_offsets);
+
+  int32_t num_states = graphs.shape.NumElements();
+  Array1<FloatType> alpha(c, alpha_offsets.Back()),
+      beta(c, dense_grad != nullptr ? num_states * 2 : 0);
+  *tot_scores = Array1<FloatType>(c, num_fsas);
+  float *dense_grad_data = nullptr;
+  int32_t grad_stride = 0;
+  if (dense_grad != nullptr) {
+    *dense_grad = Array2<float>(c, dense.scores.Dim0(), dense.scores.Dim1(),
+                                0.0f);
+    dense_grad_data = dense_grad->Data();
+    grad_stride = dense_grad->ElemStride0();
+  }
+
+  DenseFsaVecScores dense_scores = DenseFsaVecScoresAccessor(dense);
+  const int32_t *labels_data = graphs.labels.Data();
+  const float *scores_data = graphs.scores.Data();
+  FloatType *alpha_data = alpha.Data(), *beta_data = beta.Data(),
+            *tot_scores_data = tot_scores->Data();
+
+  if (c->GetDeviceType() == kCpu) {
+    for (int32_t fsa_idx0 = 0; fsa_idx0 < num_fsas; ++fsa_idx0) {
+      int32_t state_idx0x = state_row_splits_data[fsa_idx0],
+              num_states = state_row_splits_data[fsa_idx0 + 1] - state_idx0x,
+              row_idx0x = frame_row_splits_data[fsa_idx0],
+              num_rows = frame_row_splits_data[fsa_idx0 + 1] - row_idx0x;
+      const int32_t *this_labels = labels_data + state_idx0x;
+      const float *this_scores = scores_data + state_idx0x * 3;
+      FloatType *this_alpha = alpha_data + alpha_offsets_data[fsa_idx0];
+      for (int32_t t = 0; t < num_rows; ++t) {
+        const FloatType *prev =
+            (t == 0 ? nullptr : this_alpha + (t - 1) * num_states);
+        for (int32_t j = 0; j < num_states; ++j)
+          this_alpha[t * num_states + j] =
+              BandedAlpha(prev, this_scores, j,
+                          dense_scores(row_idx0x + t, this_labels[j] + 1));
+      }
+      FloatType tot = -std::numeric_limits<FloatType>::infinity();
+      if (num_states > 0) tot = this_alpha[num_rows * num_states - 1];
+      tot_scores_data[fsa_idx0] = tot;
+      if (dense_grad == nullptr ||
+          tot == -std::numeric_limits<FloatType>::infinity())
+        continue;
+
+      std::vector<FloatType> cur(num_states), next(num_states);
+      for (int32_t t = num_rows - 1; t >= 0; --t) {
+        for (int32_t j = 0; j < num_states; ++j) {
+          if (t == num_rows - 1)
+            cur[j] = (j == num_states - 1
+                          ? FloatType(0)
+                          : -std::numeric_limits<FloatType>::infinity());
+          else
+            cur[j] = BandedBeta(next.data(), this_labels, this_scores,
+                                num_states, j, row_idx0x + t + 1,
+                                dense_scores);
+          FloatType occupation =
+              exp(this_alpha[t * num_states + j] + cur[j] - tot);
+          dense_grad_data[(row_idx0x + t) * grad_stride + this_labels[j] +
+                          1] += occupation;
+        }
+        std::swap(cur, next);
+      }
+    }
+  } else {
+    K2_CHECK_EQ(c->GetDeviceType(), kCuda);
+    if (num_fsas == 0) return;
+    int32_t block_size = 128;
+    K2_CUDA_SAFE_CALL(
+        CtcLossBandedKernel<FloatType>
+        <<<num_fsas, block_size, 0, c->GetCudaStream()>>>(
+            state_row_splits_data, frame_row_splits_data, alpha_offsets_data,
+            labels_data, scores_data, dense_scores, alpha_data, beta_data,
+            tot_scores_data, dense_grad_data, grad_stride));
+  }
+}
+
+template void CtcLossBanded<float>(BandedFsaVec &graphs, DenseFsaVec &dense,
+                                   Array1<float> *tot_scores,
+                                   Array2<float> *dense_grad);
+template void CtcLossBanded<double>(BandedFsaVec &graphs, DenseFsaVec &dense,
+                                    Array1<double> *tot_scores,
+                                    Array2<float> *dense_grad);
+
+}  // namespace k2
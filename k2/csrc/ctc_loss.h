@@ -0,0 +1,87 @@
+/**
+ * Copyright      2026  Xiaomi Corporation
+ *
+ * See LICENSE for clarification regarding multiple authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef K2_CSRC_CTC_LOSS_H_
+#define K2_CSRC_CTC_LOSS_H_
+
+#include "k2/csrc/array.h"
+#include "k2/csrc/fsa.h"
+#include "k2/csrc/ragged.h"
+
+namespace k2 {
+
+/*
+  An FsaVec is "banded" if every arc goes from a state i to state i, i + 1
+  or i + 2, there is at most one arc for each such pair of states, and all
+  the arcs entering a state have the same label.  The CTC graphs returned by
+  CtcGraphs() (standard or modified) are banded.
+
+  For banded FSAs, GetTotScores() of the result of IntersectDense() with
+  a DenseFsaVec (with no pruning) reduces to the usual CTC alpha/beta
+  recursion over frames and states, which CtcLossBanded() computes directly.
+ */
+struct BandedFsaVec {
+  // The shape of the FsaVec with the arcs axis removed, i.e. with 2 axes,
+  // indexed [fsa][state].
+  RaggedShape shape;
+  // labels[state_idx01] is the label on the arcs entering that state, or -1
+  // if there are none.
+  Array1<int32_t> labels;
+  // scores[state_idx01 * 3 + k] is the score of the arc from state
+  // (state_idx01 - k) to state state_idx01, or -infinity if there is no
+  // such arc.
+  Array1<float> scores;
+};
+
+/*
+  Checks whether `fsas` is banded (see BandedFsaVec).
+
+    @param [in] fsas   The FSAs to check; must have 3 axes.
+    @param [out] banded  If the function returns true, it is set to the
+                       banded representation of `fsas`.
+    @return  Returns true if `fsas` is banded, else false.
+ */
+bool GetBandedFsaVec(FsaVec &fsas, BandedFsaVec *banded);
+
+/*
+  Computes, for banded FSAs, the same total scores as
+  GetTotScores(IntersectDense(graphs, dense, ...), true) with no pruning,
+  and optionally their derivatives w.r.t. the scores of `dense`.
+
+    @param [in] graphs  The graphs, with graphs.shape.Dim0() equal to
+                        dense.shape.Dim0(); the i'th graph is intersected with
+                        the i'th sequence of `dense`.
+    @param [in] dense   The nnet output; may be in the sparse form if
+                        `dense_grad` is nullptr.
+    @param [out] tot_scores  Set to the total log-sum-exp scores, one per
+                        sequence; -infinity if no path survives.
+    @param [out] dense_grad  If not nullptr, set to an array of the same shape
+                        as dense.scores, whose element (r, c) is the derivative
+                        of tot_scores[i] w.r.t. dense.scores(r, c), where i is
+                        the sequence that row r belongs to (i.e. the
+                        occupation probability).  It is zero for the sequences
+                        whose total score is -infinity.
+ */
+template <typename FloatType>
+void CtcLossBanded(BandedFsaVec &graphs, DenseFsaVec &dense,
+                   Array1<FloatType> *tot_scores,
+                   Array2<float> *dense_grad = nullptr);
+
+}  // namespace k2
+
+#endif  // K2_CSRC_CTC_LOSS_H_
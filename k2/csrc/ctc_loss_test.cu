@@ -0,0 +1,141 @@
+/**
+ * Copyright      2026  Xiaomi Corporation
+ *
+ * See LICENSE for clarification regarding multiple authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <gtest/gtest.h>
+
+#include <cmath>
+#include <limits>
+#include <string>
+#include <vector>
+
+#include "k2/csrc/ctc_loss.h"
+#include "k2/csrc/fsa_algo.h"
+#include "k2/csrc/fsa_utils.h"
+#include "k2/csrc/math.h"
+#include "k2/csrc/ragged.h"
+#include "k2/csrc/ragged_ops.h"
+#include "k2/csrc/test_utils.h"
+
+namespace k2 {
+
+// Returns GetTotScores() of the unpruned IntersectDense() of `graphs` and
+// `dense`, on CPU.  IntersectDense() needs the sequences sorted from longest
+// to shortest, so they are done one at a time.
+static Array1<double> ReferenceTotScores(FsaVec &graphs, DenseFsaVec &dense) {
+  int32_t num_fsas = dense.shape.Dim0();
+  Array1<double> ans(GetCpuContext(), num_fsas);
+  for (int32_t i = 0; i < num_fsas; ++i) {
+    Array1<int32_t> indexes(dense.Context(), std::vector<int32_t>(1, i));
+    FsaVec graph = Index(graphs, 0, indexes, nullptr);
+    DenseFsaVec this_dense = dense[indexes];
+    FsaVec lattice;
+    Array1<int32_t> arc_map_a, arc_map_b;
+    IntersectDense(graph, this_dense, nullptr, 1.0e+10, 15000000, 1 << 30,
+                   &lattice, &arc_map_a, &arc_map_b);
+    Ragged<int32_t> state_batches = GetStateBatches(lattice, true);
+    Array1<int32_t> dest_states = GetDestStates(lattice, true);
+    Ragged<int32_t> incoming_arcs = GetIncomingArcs(lattice, dest_states);
+    Ragged<int32_t> entering_arc_batches =
+        GetEnteringArcIndexBatches(lattice, incoming_arcs, state_batches);
+    Array1<double> forward_scores = GetForwardScores<double>(
+        lattice, state_batches, entering_arc_batches, true);
+    ans.Data()[i] = GetTotScores(lattice, forward_scores)[0];
+  }
+  return ans;
+}
+
+TEST(CtcLoss, NotBanded) {
+  for (const ContextPtr &c : {GetCpuContext(), GetCudaContext()}) {
+    // an arc skipping 3 states
+    FsaVec fsas = FsaToFsaVec(FsaFromString(R"(0 3 1 0
+      3 4 -1 0
+      4)").To(c));
+    BandedFsaVec banded;
+    EXPECT_FALSE(GetBandedFsaVec(fsas, &banded));
+
+    // two arcs with different labels entering state 1
+    fsas = FsaToFsaVec(FsaFromString(R"(0 1 1 0
+      0 1 2 0
+      1 2 -1 0
+      2)").To(c));
+    EXPECT_FALSE(GetBandedFsaVec(fsas, &banded));
+  }
+}
+
+TEST(CtcLoss, CompareWithIntersectDense) {
+  for (const ContextPtr &c : {GetCpuContext(), GetCudaContext()}) {
+    for (int32_t iter = 0; iter < 4; ++iter) {
+      int32_t num_fsas = RandInt(1, 5), max_symbol = 6;
+      std::string s = "[";
+      for (int32_t i = 0; i < num_fsas; ++i) {
+        s += " [";
+        for (int32_t n = RandInt(0, 5); n > 0; --n)
+          s += " " + std::to_string(RandInt(1, max_symbol));
+        s += " ]";
+      }
+      s += " ]";
+      Ragged<int32_t> symbols(c, s);
+      bool modified = (iter % 2 == 1);
+      FsaVec graphs = CtcGraphs(symbols, modified);
+
+      DenseFsaVec dense =
+          RandomDenseFsaVec(num_fsas, num_fsas, 0, 12, max_symbol + 1,
+                            max_symbol + 1)
+              .To(c);
+
+      BandedFsaVec banded;
+      ASSERT_TRUE(GetBandedFsaVec(graphs, &banded));
+      Array1<double> tot_scores;
+      Array2<float> dense_grad;
+      CtcLossBanded<double>(banded, dense, &tot_scores, &dense_grad);
+
+      Array1<double> ref = ReferenceTotScores(graphs, dense);
+      tot_scores = tot_scores.To(GetCpuContext());
+      ASSERT_EQ(tot_scores.Dim(), num_fsas);
+      for (int32_t i = 0; i < num_fsas; ++i) {
+        if (std::isinf(ref[i]))
+          EXPECT_EQ(tot_scores[i], ref[i]);
+        else
+          EXPECT_NEAR(tot_scores[i], ref[i], 1.0e-04 * (1 + fabs(ref[i])));
+      }
+
+      // The occupation probabilities of each frame of a sequence with a
+      // finite total score sum to one.
+      Array2<float> grad = dense_grad.To(GetCpuContext());
+      auto grad_acc = grad.Accessor();
+      Array1<int32_t> row_ids = dense.shape.RowIds(1).To(GetCpuContext());
+      for (int32_t r = 0; r < grad.Dim0(); ++r) {
+        double sum = 0;
+        for (int32_t j = 0; j < grad.Dim1(); ++j) sum += grad_acc(r, j);
+        EXPECT_NEAR(sum, std::isinf(ref[row_ids[r]]) ? 0.0 : 1.0, 1.0e-03);
+      }
+
+      Array1<float> tot_scores_float;
+      CtcLossBanded<float>(banded, dense, &tot_scores_float);
+      tot_scores_float = tot_scores_float.To(GetCpuContext());
+      for (int32_t i = 0; i < num_fsas; ++i) {
+        if (std::isinf(ref[i]))
+          EXPECT_EQ(tot_scores_float[i], ref[i]);
+        else
+          EXPECT_NEAR(tot_scores_float[i], ref[i], 1.0e-02);
+      }
+    }
+  }
+}
+
+}  // namespace k2
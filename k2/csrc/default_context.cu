@@ -17,10 +17,17 @@
  * limitations under the License.
  */
 
+#include <algorithm>
 #include <cstdlib>
+#include <cstring>
 #include <mutex>  // NOLINT
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <utility>
 
 #include "k2/csrc/context.h"
+#include "k2/csrc/device_guard.h"
 #include "k2/csrc/log.h"
 #include "k2/csrc/nvtx.h"
 
@@ -28,11 +35,274 @@ namespace k2 {
 
 static constexpr std::size_t kAlignment = 64;
 
+namespace {
+
+enum class CudaAllocatorType {
+  kCaching,  // K2_CUDA_ALLOCATOR=caching (the default)
+  kAsync,    // K2_CUDA_ALLOCATOR=async
+  kNone,     // K2_CUDA_ALLOCATOR=none
+};
+
+static CudaAllocatorType GetCudaAllocatorType() {
+  static CudaAllocatorType type = []() -> CudaAllocatorType {
+    const char *s = std::getenv("K2_CUDA_ALLOCATOR");
+    if (s == nullptr || std::string(s) == "caching")
+      return CudaAllocatorType::kCaching;
+    if (std::string(s) == "async") {
+#if CUDART_VERSION >= 11020
+      return CudaAllocatorType::kAsync;
+#else
+      K2_LOG(WARNING) << "K2_CUDA_ALLOCATOR=async needs CUDA 11.2 or later. "
+                         "Using the caching allocator instead.";
+      return CudaAllocatorType::kCaching;
+#endif
+    }
+    K2_CHECK_EQ(std::string(s), "none")
+        << "K2_CUDA_ALLOCATOR should be caching, async or none";
+    return CudaAllocatorType::kNone;
+  }();
+  return type;
+}
+
+struct CudaBlock {
+  std::size_t size;  // size of this memory block in bytes
+  // Only used by the caching allocator: it is recorded on the stream that
+  // freed this block, and the stream that reuses the block waits on it.
+  cudaEvent_t event;
+};
+
+/* Allocator for device memory of one GPU; see GetCudaMemoryStats() in
+   context.h for the types.
+
+   With the caching allocator, freed blocks are kept and reused for later
+   allocations of similar size (from 1x to 1.25x), much like PinnedAllocator
+   in pinned_context.cu does for pinned memory.  A block is freed "in stream
+   order": the stream that reuses it first waits for all work that was queued
+   on the freeing stream before the Free(), so no device synchronization is
+   needed.  If cudaMalloc() fails, the cached blocks are returned to the
+   device and it is tried again.
+ */
+class CudaAllocator {
+ public:
+  explicit CudaAllocator(int32_t gpu_id)
+      : gpu_id_(gpu_id), type_(GetCudaAllocatorType()) {
+#if CUDART_VERSION >= 11020
+    if (type_ == CudaAllocatorType::kAsync) {
+      K2_CHECK_CUDA_ERROR(cudaDeviceGetDefaultMemPool(&pool_, gpu_id_));
+      // Keep freed memory in the pool instead of returning it at the next
+      // synchronization.
+      uint64_t threshold = UINT64_MAX;
+      K2_CHECK_CUDA_ERROR(cudaMemPoolSetAttribute(
+          pool_, cudaMemPoolAttrReleaseThreshold, &threshold));
+    }
+#endif
+  }
+
+  /* Allocate `size` bytes for use on `stream`; returns nullptr if size is 0.
+     Raises an exception on failure. */
+  void *Malloc(std::size_t size, cudaStream_t stream) {
+    NVTX_RANGE(K2_FUNC);
+    if (size == 0) return nullptr;
+    DeviceGuard guard(gpu_id_);
+    std::lock_guard<std::mutex> lock(mutex_);
+    ++stats_.num_allocs;
+    void *p = nullptr;
+    if (type_ == CudaAllocatorType::kAsync) {
+#if CUDART_VERSION >= 11020
+      K2_CHECK_CUDA_ERROR(cudaMallocAsync(&p, size, stream));
+#endif
+      return p;
+    }
+    if (type_ == CudaAllocatorType::kCaching) {
+      size = RoundUp(size);
+      // search for the smallest block which can hold this allocation
+      auto it = available_.lower_bound({size, nullptr});
+      if (it != available_.end() && it->first <= size + size / 4) {
+        p = it->second;
+        CudaBlock &block = blocks_.at(p);
+        available_.erase(it);
+        K2_CHECK_CUDA_ERROR(cudaStreamWaitEvent(stream, block.event, 0));
+        stats_.bytes_cached -= block.size;
+        ++stats_.num_cache_hits;
+        AddBytesInUse(block.size);
+        return p;
+      }
+    }
+
+    cudaError_t ret = cudaMalloc(&p, size);
+    if (ret == cudaErrorMemoryAllocation &&
+        type_ == CudaAllocatorType::kCaching && !available_.empty()) {
+      (void)cudaGetLastError();  // clear the error
+      FreeCachedBlocks();
+      ret = cudaMalloc(&p, size);
+    }
+    K2_CHECK_CUDA_ERROR(ret);
+    ++stats_.num_cuda_mallocs;
+
+    CudaBlock block{size, nullptr};
+    if (type_ == CudaAllocatorType::kCaching) {
+      K2_CHECK_CUDA_ERROR(
+          cudaEventCreateWithFlags(&block.event, cudaEventDisableTiming));
+    }
+    blocks_.emplace(p, block);
+    AddBytesInUse(size);
+    return p;
+  }
+
+  /* Free memory returned by Malloc(), after the work currently queued on
+     `stream` has finished using it. */
+  void Free(void *ptr, cudaStream_t stream) {
+    NVTX_RANGE(K2_FUNC);
+    if (ptr == nullptr) return;
+    DeviceGuard guard(gpu_id_);
+    if (type_ == CudaAllocatorType::kAsync) {
+#if CUDART_VERSION >= 11020
+      K2_CHECK_CUDA_ERROR(cudaFreeAsync(ptr, stream));
+#endif
+      return;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = blocks_.find(ptr);
+    K2_CHECK(it != blocks_.end())
+        << "The passed pointer is not allocated by Malloc!";
+    CudaBlock &block = it->second;
+    stats_.bytes_in_use -= block.size;
+    if (type_ == CudaAllocatorType::kNone) {
+      K2_CHECK_CUDA_ERROR(cudaFree(ptr));
+      blocks_.erase(it);
+      return;
+    }
+    K2_CHECK_CUDA_ERROR(cudaEventRecord(block.event, stream));
+    available_.insert({block.size, ptr});
+    stats_.bytes_cached += block.size;
+  }
+
+  // Return all cached memory to the device.
+  void EmptyCache() {
+    NVTX_RANGE(K2_FUNC);
+    DeviceGuard guard(gpu_id_);
+#if CUDART_VERSION >= 11020
+    if (type_ == CudaAllocatorType::kAsync) {
+      // memory is released only after the frees have happened on the device
+      K2_CHECK_CUDA_ERROR(cudaDeviceSynchronize());
+      K2_CHECK_CUDA_ERROR(cudaMemPoolTrimTo(pool_, 0));
+      return;
+    }
+#endif
+    std::lock_guard<std::mutex> lock(mutex_);
+    FreeCachedBlocks();
+  }
+
+  CudaMemoryStats GetStats() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    CudaMemoryStats ans = stats_;
+#if CUDART_VERSION >= 11020
+    if (type_ == CudaAllocatorType::kAsync) {
+      uint64_t used = 0, reserved = 0, used_high = 0;
+      K2_CHECK_CUDA_ERROR(cudaMemPoolGetAttribute(
+          pool_, cudaMemPoolAttrUsedMemCurrent, &used));
+      K2_CHECK_CUDA_ERROR(cudaMemPoolGetAttribute(
+          pool_, cudaMemPoolAttrReservedMemCurrent, &reserved));
+      K2_CHECK_CUDA_ERROR(cudaMemPoolGetAttribute(
+          pool_, cudaMemPoolAttrUsedMemHigh, &used_high));
+      ans.bytes_in_use = used;
+      ans.bytes_cached = reserved - used;
+      ans.peak_bytes_in_use = used_high;
+    }
+#endif
+    return ans;
+  }
+
+  void ResetPeakStats() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stats_.peak_bytes_in_use = stats_.bytes_in_use;
+#if CUDART_VERSION >= 11020
+    if (type_ == CudaAllocatorType::kAsync) {
+      // Only 0 may be written; it resets the attribute to the current use.
+      uint64_t zero = 0;
+      K2_CHECK_CUDA_ERROR(cudaMemPoolSetAttribute(
+          pool_, cudaMemPoolAttrUsedMemHigh, &zero));
+    }
+#endif
+  }
+
+ private:
+  // Sizes of blocks of the caching allocator are rounded up to a multiple of
+  // 512 bytes, so that blocks can be reused for slightly different sizes.
+  static std::size_t RoundUp(std::size_t size) {
+    constexpr std::size_t kRound = 512;
+    return (size + kRound - 1) / kRound * kRound;
+  }
+
+  void AddBytesInUse(std::size_t size) {
+    stats_.bytes_in_use += size;
+    stats_.peak_bytes_in_use =
+        std::max(stats_.peak_bytes_in_use, stats_.bytes_in_use);
+  }
+
+  // Free all blocks in `available_`; the caller holds the mutex.
+  void FreeCachedBlocks() {
+    NVTX_RANGE(K2_FUNC);
+    for (const auto &p : available_) {
+      // cudaFree() synchronizes the device, so the event has completed.
+      K2_CHECK_CUDA_ERROR(cudaFree(p.second));
+      K2_CHECK_CUDA_ERROR(cudaEventDestroy(blocks_.at(p.second).event));
+      blocks_.erase(p.second);
+    }
+    available_.clear();
+    stats_.bytes_cached = 0;
+  }
+
+  int32_t gpu_id_;
+  CudaAllocatorType type_;
+#if CUDART_VERSION >= 11020
+  cudaMemPool_t pool_ = nullptr;  // only for kAsync
+#endif
+
+  // All blocks allocated by cudaMalloc() and not yet freed with cudaFree(),
+  // indexed by their address.  Not used for kAsync.
+  std::unordered_map<void *, CudaBlock> blocks_;
+
+  // The free blocks of the caching allocator as (size, address), sorted by
+  // size in increasing order.
+  std::set<std::pair<std::size_t, void *>> available_;
+
+  CudaMemoryStats stats_;
+
+  // to protect `blocks_`, `available_` and `stats_` being accessed from
+  // multiple threads
+  std::mutex mutex_;
+};
+
+/* Return the allocator for the device `gpu_id` (-1 for the current device),
+   creating it if needed. */
+static CudaAllocator *GetCudaAllocator(int32_t gpu_id) {
+  if (gpu_id == -1) K2_CHECK_CUDA_ERROR(cudaGetDevice(&gpu_id));
+  K2_CHECK(gpu_id >= 0 && gpu_id < kMaxNumGpus) << "gpu_id: " << gpu_id;
+  static std::mutex mutex;
+  static CudaAllocator *allocators[kMaxNumGpus] = {nullptr};
+  std::lock_guard<std::mutex> lock(mutex);
+  // they are never freed.
+  if (allocators[gpu_id] == nullptr) {
+    {
+      // The CUDA runtime creates the context of a device on the first call
+      // that needs it; do that here, so that it is timed separately.
+      InitPhaseTimer timer("CudaContext");
+      DeviceGuard guard(gpu_id);
+      K2_CHECK_CUDA_ERROR(cudaFree(nullptr));
+    }
+    InitPhaseTimer timer("CudaAllocator");
+    allocators[gpu_id] = new CudaAllocator(gpu_id);
+  }
+  return allocators[gpu_id];
+}
+
+}  // namespace
+
 // TODO(haowen): most of implementations below should be updated later.
 class CpuContext : public Context {
  public:
   CpuContext() = default;
-  ContextPtr GetCpuContext() override { return shared_from_this(); }
   DeviceType GetDeviceType() const override { return kCpu; }
 
   void *Allocate(std::size_t bytes, void **deleter_context) override {
@@ -52,11 +322,35 @@ class CpuContext : public Context {
   void Deallocate(void *data, void * /*deleter_context*/) override {
     free(data);
   }
+
+  void CopyDataTo(size_t num_bytes, const void *src, ContextPtr dst_context,
+                  void *dst) override {
+    DeviceType device_type = dst_context->GetDeviceType();
+    switch (device_type) {
+      case kCpu:
+        memcpy(dst, src, num_bytes);
+        break;
+      case kCuda: {
+        // CPU -> CUDA
+        DeviceGuard guard(dst_context);
+        ContextPtr pinned_context = GetPinnedContext();
+        auto region = NewRegion(pinned_context, num_bytes);
+        memcpy(region->data, src, num_bytes);
+        pinned_context->CopyDataTo(num_bytes, region->data, dst_context, dst);
+        break;
+      }
+      default:
+        K2_LOG(FATAL) << "Unsupported device type: " << device_type;
+        break;
+    }
+  }
 };
 
 class CudaContext : public Context {
  public:
   explicit CudaContext(int32_t gpu_id) : gpu_id_(gpu_id) {
+    // First, as it creates the CUDA context of the device if needed.
+    allocator_ = GetCudaAllocator(gpu_id_);
     if (gpu_id_ != -1) {
       auto ret = cudaSetDevice(gpu_id_);
       K2_CHECK_CUDA_ERROR(ret);
@@ -66,16 +360,11 @@ class CudaContext : public Context {
     auto ret = cudaStreamCreate(&stream_);
     K2_CHECK_CUDA_ERROR(ret);
   }
-  ContextPtr GetCpuContext() override { return k2::GetCpuContext(); }
   DeviceType GetDeviceType() const override { return kCuda; }
   int32_t GetDeviceId() const override { return gpu_id_; }
 
   void *Allocate(std::size_t bytes, void **deleter_context) override {
-    void *p = nullptr;
-    if (bytes) {
-      auto ret = cudaMalloc(&p, bytes);
-      K2_CHECK_CUDA_ERROR(ret);
-    }
+    void *p = allocator_->Malloc(bytes, GetCudaStream());
     if (deleter_context != nullptr) *deleter_context = nullptr;
     return p;
   }
@@ -85,17 +374,41 @@ class CudaContext : public Context {
   }
 
   void Deallocate(void *data, void * /*deleter_context*/) override {
-    auto ret = cudaFree(data);
-    K2_CHECK_CUDA_ERROR(ret);
+    allocator_->Free(data, GetCudaStream());
   }
 
   cudaStream_t GetCudaStream() const override {
-    return g_stream_override.OverrideStream(stream_);
+    return GetCudaStreamOverride().OverrideStream(stream_);
+  }
+
+  void CopyDataTo(size_t num_bytes, const void *src, ContextPtr dst_context,
+                  void *dst) override {
+    DeviceType device_type = dst_context->GetDeviceType();
+    switch (device_type) {
+      case kCpu: {
+        cudaError_t ret =
+            cudaMemcpy(dst, src, num_bytes, cudaMemcpyDeviceToHost);
+        K2_CHECK_CUDA_ERROR(ret);
+        OpStatsSync();
+        break;
+      }
+      case kCuda: {
+        cudaError_t ret =
+            cudaMemcpyAsync(dst, src, num_bytes, cudaMemcpyDeviceToDevice,
+                            dst_context->GetCudaStream());
+        K2_CHECK_CUDA_ERROR(ret);
+        break;
+      }
+      default:
+        K2_LOG(FATAL) << "Unsupported device type: " << device_type;
+        break;
+    }
   }
 
   void Sync() const override {
     auto ret = cudaStreamSynchronize(stream_);
     K2_CHECK_CUDA_ERROR(ret);
+    OpStatsSync();
   }
 
   ~CudaContext() {
@@ -106,14 +419,16 @@ class CudaContext : public Context {
  private:
   int32_t gpu_id_;
   cudaStream_t stream_;
+  CudaAllocator *allocator_;  // NOT owned here
 };
 
 ContextPtr GetCpuContext() { return std::make_shared<CpuContext>(); }
 
-ContextPtr GetCudaContext(int32_t gpu_id /*= -1*/) {
+static bool HasCuda() {
   static std::once_flag has_cuda_init_flag;
   static bool has_cuda = false;
   std::call_once(has_cuda_init_flag, []() {
+    InitPhaseTimer timer("CudaProbe");
     int n = 0;
     auto ret = cudaGetDeviceCount(&n);
     if (ret == cudaSuccess && n > 0)
@@ -121,10 +436,26 @@ ContextPtr GetCudaContext(int32_t gpu_id /*= -1*/) {
     else
       K2_LOG(WARNING) << "CUDA is not available. Return a CPU context.";
   });
+  return has_cuda;
+}
 
-  if (has_cuda) return std::make_shared<CudaContext>(gpu_id);
+ContextPtr GetCudaContext(int32_t gpu_id /*= -1*/) {
+  if (HasCuda()) return std::make_shared<CudaContext>(gpu_id);
 
   return GetCpuContext();
 }
 
+CudaMemoryStats GetCudaMemoryStats(int32_t gpu_id /*= -1*/) {
+  if (!HasCuda()) return CudaMemoryStats();
+  return GetCudaAllocator(gpu_id)->GetStats();
+}
+
+void ResetPeakCudaMemoryStats(int32_t gpu_id /*= -1*/) {
+  if (HasCuda()) GetCudaAllocator(gpu_id)->ResetPeakStats();
+}
+
+void EmptyCudaCache(int32_t gpu_id /*= -1*/) {
+  if (HasCuda()) GetCudaAllocator(gpu_id)->EmptyCache();
+}
+
 }  // namespace k2
@@ -0,0 +1,1216 @@
+/**
+ * Copyright      2026  Xiaomi Corporation
+ *
+ * See LICENSE for clarification regarding multiple authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <algorithm>
+#include <limits>
+#include <vector>
+
+#include "k2/csrc/array_ops.h"
+#include "k2/csrc/determinize.h"
+#include "k2/csrc/fsa_utils.h"
+#include "k2/csrc/hash.h"
+#include "k2/csrc/macros.h"
+#include "k2/csrc/math.h"
+#include "k2/csrc/ragged_ops.h"
+
+namespace k2 {
+
+namespace determinize_internal {
+
+// An element of the traceback tree; c.f. k2host::MaxTracebackState.
+struct TracebackElem {
+  // the state_idx01 in the input FsaVec.
+  int32_t state_idx01;
+  // The arc_idx012 of the arc that entered this element from `prev`;
+  // -1 for elements corresponding to start-states.
+  int32_t arc_idx012;
+  // Index of the previous element (in DeviceDeterminizer::elems_); -1 for
+  // elements corresponding to start-states.
+  int32_t prev;
+  // The best forward log-prob from the start-state to this element.
+  double forward_prob;
+};
+
+struct ArcInfo {
+  int32_t src_det_state;   // index of the source det-state
+  int32_t dest_det_state;  // index of the dest det-state, or -1 for the
+                           // final-state of the output FSA
+  int32_t label;
+  float score;
+};
+
+/*
+  The functions below compute the hash keys of normalized det-states, as
+  (base_state, symbol sequence).  `a` is the key in the hash and `b` is a
+  secondary hash that we use to detect collisions.  The symbols are processed
+  from the most recent one backwards.  The constants are the same as in
+  k2host::DetState::RepresentationHash().
+*/
+__host__ __device__ __forceinline__ void InitReprHash(int32_t seq_len,
+                                                      uint64_t *a,
+                                                      uint64_t *b) {
+  *a = 17489 * static_cast<uint64_t>(seq_len);
+  *b = static_cast<uint64_t>(seq_len);
+}
+
+__host__ __device__ __forceinline__ void AddSymbolToReprHash(int32_t symbol,
+                                                             uint64_t *a,
+                                                             uint64_t *b) {
+  *a = static_cast<uint64_t>(symbol) + 102299 * *a;
+  *b = static_cast<uint64_t>(symbol) + 102983 * *b;
+}
+
+__host__ __device__ __forceinline__ void FinalizeReprHash(int32_t base_state,
+                                                          uint64_t *a,
+                                                          uint64_t *b) {
+  *a = static_cast<uint64_t>(base_state) + 14051 * *a;
+  *b = static_cast<uint64_t>(base_state) + 14057 * *b;
+  // All-ones is reserved to mean "empty" in class Hash64.
+  if (~*a == 0) *a = 0;
+}
+
+// The value in the hash of det-states that were dropped because of
+// max_states.  They may be created again if reached again (e.g. along the best
+// path, which may reach a det-state later than another path did).
+constexpr uint64_t kPrunedDetState = std::numeric_limits<int32_t>::max();
+
+// The tolerance with which we compare forward-backward scores, to allow for
+// rounding differences.
+constexpr double kBestPathTolerance = 1.0e-03;
+
+}  // namespace determinize_internal
+
+using namespace determinize_internal;  // NOLINT
+
+/*
+   Batched determinization; see the notes in determinize.h.
+
+   How to use this object:
+       Construct it
+       Call Determinize()
+       Call FormatOutput()
+*/
+class DeviceDeterminizer {
+ public:
+  /**
+     @param [in] fsas  An FsaVec (3 axes), must be valid.
+     @param [in] weight_pushing_type  See Determinize() in fsa_algo.h
+     @param [in] beam  If finite, det-states and arcs whose best path is
+                       worse than the best path of their FSA by more than
+                       `beam` are pruned away; see DeterminizePruned() in
+                       fsa_algo.h
+     @param [in] max_states  If > 0, the limit on the number of states of
+                       each output FSA; see DeterminizePruned().
+   */
+  DeviceDeterminizer(FsaVec &fsas,
+                     DeterminizeWeightPushingType weight_pushing_type,
+                     float beam = std::numeric_limits<float>::infinity(),
+                     int32_t max_states = 0)
+      : c_(fsas.Context()),
+        fsas_(fsas),
+        weight_pushing_type_(weight_pushing_type),
+        pruned_(beam != std::numeric_limits<float>::infinity() ||
+                max_states > 0),
+        max_states_(max_states) {
+    NVTX_RANGE(K2_FUNC);
+    // We may want to tune this default hash size eventually.
+    // We will expand the hash as needed.
+    int32_t hash_size = 4 * RoundUpToNearestPowerOfTwo(fsas.TotSize(1)),
+        min_hash_size = 1 << 10;
+    if (hash_size < min_hash_size) hash_size = min_hash_size;
+    repr_to_state_ = Hash64(c_, hash_size);
+    if (pruned_) InitPruning(beam);
+  }
+
+  void Determinize() {
+    NVTX_RANGE(K2_FUNC);
+    FirstIter();
+    Forward();
+    LastIter();
+  }
+
+  /*
+    Creates the output FsaVec; must be called after Determinize().
+      @param [out] arc_derivs  If not nullptr, will be set to the
+                   arc_derivs as documented for Determinize() in
+                   fsa_algo.h
+   */
+  FsaVec FormatOutput(Ragged<int32_t> *arc_derivs) {
+    NVTX_RANGE(K2_FUNC);
+    int32_t num_states = iter_to_state_row_splits_cpu_.back(),
+             num_iters = iter_to_state_row_splits_cpu_.size() - 1,
+              num_fsas = fsas_.Dim0();
+    K2_CHECK_EQ(num_states, states_fsa_idx_.Dim());
+
+    Array1<int32_t> row_splits1(c_, iter_to_state_row_splits_cpu_),
+        row_ids1(c_, num_states);
+    RowSplitsToRowIds(row_splits1, &row_ids1);
+
+    const int32_t *states_fsa_idx_data = states_fsa_idx_.Data();
+    int32_t *row_ids1_data = row_ids1.Data();
+    // Modify row_ids1 so that it maps from det-state to
+    //   iter * num_fsas + fsa_idx0,
+    // and later reorder the rows so that each FSA has all its states together.
+    K2_EVAL(
+        c_, num_states, lambda_modify_row_ids, (int32_t i)->void {
+          row_ids1_data[i] = row_ids1_data[i] * num_fsas +
+                             states_fsa_idx_data[i];
+        });
+
+    Array1<int32_t> row_ids2(row_ids1),
+        row_splits2(c_, num_iters * num_fsas + 1);
+    RowIdsToRowSplits(row_ids2, &row_splits2);
+
+    // `fsaiter_new2old` effectively transposes the iteration and FSA axes.
+    Array1<int32_t> fsaiter_new2old(c_, num_iters * num_fsas);
+    int32_t *fsaiter_new2old_data = fsaiter_new2old.Data();
+    K2_EVAL(
+        c_, num_iters * num_fsas, lambda_set_reordering, (int32_t i)->void {
+          int32_t fsa_idx = i / num_iters, iter_idx = i % num_iters;
+          fsaiter_new2old_data[i] = iter_idx * num_fsas + fsa_idx;
+        });
+
+    int32_t num_arcs = arcs_.Dim();
+    const ArcInfo *arcs_data = arcs_.Data();
+    Array1<int32_t> row_ids3(c_, num_arcs);
+    int32_t *row_ids3_data = row_ids3.Data();
+    K2_EVAL(
+        c_, num_arcs, lambda_set_row_ids3, (int32_t i)->void {
+          row_ids3_data[i] = arcs_data[i].src_det_state;
+        });
+    Array1<int32_t> row_splits3(c_, num_states + 1);
+    RowIdsToRowSplits(row_ids3, &row_splits3);
+
+    RaggedShape layer2 = RaggedShape2(&row_splits2, &row_ids2, -1),
+                layer3 = RaggedShape2(&row_splits3, &row_ids3, -1);
+
+    Array1<int32_t> states_new2old, arcs_new2old;
+    RaggedShape layer2_new =
+                    Index(layer2, 0, fsaiter_new2old, &states_new2old),
+                layer3_new = Index(layer3, 0, states_new2old, &arcs_new2old);
+    RaggedShape layer1_new = RegularRaggedShape(c_, num_fsas, num_iters);
+
+    // We remove axis 1, which represents 'iteration-index'.
+    RaggedShape temp = ComposeRaggedShapes3(layer1_new, layer2_new, layer3_new);
+    RaggedShape ans_shape = RemoveAxis(temp, 1);
+    K2_CHECK_EQ(ans_shape.NumElements(), num_arcs);
+
+    Array1<int32_t> states_old2new = InvertPermutation(states_new2old);
+    Array1<Arc> ans_values(c_, num_arcs);
+    Arc *ans_values_data = ans_values.Data();
+    const int32_t *arcs_new2old_data = arcs_new2old.Data(),
+                  *states_old2new_data = states_old2new.Data(),
+                  *ans_row_ids2_data = ans_shape.RowIds(2).Data(),
+                  *ans_row_ids1_data = ans_shape.RowIds(1).Data(),
+                  *ans_row_splits1_data = ans_shape.RowSplits(1).Data();
+    K2_EVAL(
+        c_, num_arcs, lambda_set_output_arcs, (int32_t new_arc_idx012)->void {
+          ArcInfo info = arcs_data[arcs_new2old_data[new_arc_idx012]];
+          int32_t src_state_idx01 = ans_row_ids2_data[new_arc_idx012],
+                  fsa_idx0 = ans_row_ids1_data[src_state_idx01],
+                  fsa_idx0x = ans_row_splits1_data[fsa_idx0],
+                  dest_state_idx01 =
+                      (info.dest_det_state < 0
+                           ? ans_row_splits1_data[fsa_idx0 + 1] - 1
+                           : states_old2new_data[info.dest_det_state]);
+          Arc arc;
+          arc.src_state = src_state_idx01 - fsa_idx0x;
+          arc.dest_state = dest_state_idx01 - fsa_idx0x;
+          arc.label = info.label;
+          arc.score = info.score;
+          ans_values_data[new_arc_idx012] = arc;
+        });
+
+    if (arc_derivs != nullptr) {
+      Ragged<int32_t> derivs;
+      if (derivs_.empty()) {
+        Array1<int32_t> row_splits(c_, 1, 0);
+        derivs = Ragged<int32_t>(RaggedShape2(&row_splits, nullptr, 0),
+                                 Array1<int32_t>(c_, 0));
+      } else {
+        derivs = Cat(0, static_cast<int32_t>(derivs_.size()), derivs_.data());
+      }
+      K2_CHECK_EQ(derivs.Dim0(), num_arcs);
+      *arc_derivs = Index(derivs, 0, arcs_new2old);
+    }
+    return Ragged<Arc>(ans_shape, ans_values);
+  }
+
+  ~DeviceDeterminizer() {
+    // The hash still contains entries; avoid the check in its destructor.
+    repr_to_state_.Destroy();
+  }
+
+ private:
+  /*
+    Creates one det-state for the start-state of each non-empty FSA.
+   */
+  void FirstIter() {
+    NVTX_RANGE(K2_FUNC);
+    int32_t num_fsas = fsas_.Dim0();
+    int32_t initial_size = std::max<int32_t>(fsas_.TotSize(1), 128);
+    elems_ = Array1<TracebackElem>(c_, initial_size);
+    states_fsa_idx_ = Array1<int32_t>(c_, initial_size);
+    states_check_ = Array1<uint64_t>(c_, initial_size);
+    arcs_ = Array1<ArcInfo>(c_, initial_size);
+    arcs_.Resize(0, true);
+
+    Renumbering renumber_initial_states(c_, num_fsas);
+    char *keep_data = renumber_initial_states.Keep().Data();
+    const int32_t *fsas_row_splits1_data = fsas_.RowSplits(1).Data();
+    K2_EVAL(
+        c_, num_fsas, lambda_set_keep, (int32_t i)->void {
+          keep_data[i] =
+              (char)(fsas_row_splits1_data[i + 1] > fsas_row_splits1_data[i]);
+        });
+    int32_t num_initial_states = renumber_initial_states.NumNewElems();
+    const int32_t *new2old_data = renumber_initial_states.New2Old().Data();
+
+    elems_.Resize(num_initial_states, true);
+    states_fsa_idx_.Resize(num_initial_states, true);
+    states_check_.Resize(num_initial_states, true);
+    frontier_seq_len_ = Array1<int32_t>(c_, num_initial_states, 0);
+    frontier_normalizer_ = Array1<double>(c_, num_initial_states, 0.0);
+
+    TracebackElem *elems_data = elems_.Data();
+    int32_t *states_fsa_idx_data = states_fsa_idx_.Data();
+    uint64_t *states_check_data = states_check_.Data();
+    auto repr_to_state_acc = repr_to_state_.GetAccessor();
+    K2_EVAL(
+        c_, num_initial_states, lambda_set_start_states, (int32_t i)->void {
+          int32_t fsa_idx0 = new2old_data[i],
+                  start_state_idx01 = fsas_row_splits1_data[fsa_idx0];
+          TracebackElem elem;
+          elem.state_idx01 = start_state_idx01;
+          elem.arc_idx012 = -1;
+          elem.prev = -1;
+          elem.forward_prob = 0.0;
+          elems_data[i] = elem;
+          states_fsa_idx_data[i] = fsa_idx0;
+          uint64_t a, b;
+          InitReprHash(0, &a, &b);
+          FinalizeReprHash(start_state_idx01, &a, &b);
+          states_check_data[i] = b;
+          bool inserted = repr_to_state_acc.Insert(a, (uint64_t)i);
+          K2_CHECK(inserted);
+        });
+
+    // Each initial det-state has one element.
+    frontier_ = Ragged<int32_t>(
+        RegularRaggedShape(c_, num_initial_states, 1),
+        Range<int32_t>(c_, num_initial_states, 0));
+    if (max_states_ > 0)
+      states_best_path_pos_ = Array1<int32_t>(c_, num_initial_states, 0);
+
+    iter_to_state_row_splits_cpu_.reserve(128);
+    iter_to_state_row_splits_cpu_.push_back(0);
+    iter_to_state_row_splits_cpu_.push_back(num_initial_states);
+  }
+
+  void Forward() {
+    NVTX_RANGE(K2_FUNC);
+    for (int32_t t = 0;; t++) {
+      K2_CHECK_EQ(t + 2, int32_t(iter_to_state_row_splits_cpu_.size()));
+      int32_t state_begin = iter_to_state_row_splits_cpu_[t],
+              state_end = iter_to_state_row_splits_cpu_[t + 1];
+      if (state_end == state_begin) {
+        // It saves a little processing later to remove the last, empty,
+        // iteration-index.
+        iter_to_state_row_splits_cpu_.pop_back();
+        break;  // Nothing left to process.
+      }
+      ForwardOneIter(state_begin);
+    }
+  }
+
+  /*
+    Processes the det-states in frontier_, which are numbered
+    state_begin, state_begin + 1, ...; it appends the arcs leaving them to
+    arcs_ and derivs_, appends the newly created det-states and sets up
+    frontier_ for the next iteration.
+   */
+  void ForwardOneIter(int32_t state_begin) {
+    NVTX_RANGE(K2_FUNC);
+    int32_t num_frontier_elems = frontier_.NumElements();
+    const int32_t *frontier_elems_data = frontier_.values.Data(),
+                  *fsas_row_splits2_data = fsas_.RowSplits(2).Data(),
+                  *fsas_row_ids2_data = fsas_.RowIds(2).Data();
+    const Arc *fsas_arcs_data = fsas_.values.Data();
+
+    // 1. Expand the arcs leaving the elements of the frontier det-states;
+    //    `cands_shape` is indexed [frontier_state][elem][arc].
+    Array1<int32_t> num_arcs(c_, num_frontier_elems + 1);
+    int32_t *num_arcs_data = num_arcs.Data();
+    {
+      const TracebackElem *elems_data = elems_.Data();
+      K2_EVAL(
+          c_, num_frontier_elems, lambda_set_num_arcs, (int32_t i)->void {
+            int32_t s = elems_data[frontier_elems_data[i]].state_idx01;
+            num_arcs_data[i] =
+                fsas_row_splits2_data[s + 1] - fsas_row_splits2_data[s];
+          });
+    }
+    ExclusiveSum(num_arcs, &num_arcs);
+    RaggedShape elem_to_arc = RaggedShape2(&num_arcs, nullptr, -1),
+                cands_shape = ComposeRaggedShapes(frontier_.shape,
+                                                  elem_to_arc),
+                state_to_cand = RemoveAxis(cands_shape, 1);
+    int32_t num_cands = cands_shape.NumElements();
+
+    // 2. Sort the candidates of each det-state on (label, dest_state).
+    //    label + 1 >= 0 because labels are >= -1, so the keys sort by label
+    //    first.
+    Array1<int32_t> cand_arc_idx012(c_, num_cands);
+    Array1<int64_t> keys(c_, num_cands);
+    int32_t *cand_arc_idx012_data = cand_arc_idx012.Data();
+    int64_t *keys_data = keys.Data();
+    {
+      const TracebackElem *elems_data = elems_.Data();
+      const int32_t *cands_row_ids2_data = cands_shape.RowIds(2).Data(),
+                    *cands_row_splits2_data = cands_shape.RowSplits(2).Data();
+      K2_EVAL(
+          c_, num_cands, lambda_set_keys, (int32_t i)->void {
+            int32_t elem_idx01 = cands_row_ids2_data[i],
+                    arc_idx2 = i - cands_row_splits2_data[elem_idx01],
+                    s = elems_data[frontier_elems_data[elem_idx01]].state_idx01,
+                    arc_idx012 = fsas_row_splits2_data[s] + arc_idx2;
+            Arc arc = fsas_arcs_data[arc_idx012];
+            int32_t dest_state_idx01 = s - arc.src_state + arc.dest_state;
+            cand_arc_idx012_data[i] = arc_idx012;
+            keys_data[i] = (static_cast<int64_t>(arc.label + 1) << 32) |
+                           static_cast<int64_t>(dest_state_idx01);
+          });
+    }
+    Ragged<int64_t> sorted_keys(state_to_cand, keys);
+    Array1<int32_t> order(c_, num_cands);
+    SortSublists<int64_t, LessThan<int64_t>>(&sorted_keys, &order);
+    const int32_t *order_data = order.Data(),
+                  *state_to_cand_row_ids1_data =
+                      state_to_cand.RowIds(1).Data(),
+                  *state_to_cand_row_splits1_data =
+                      state_to_cand.RowSplits(1).Data();
+    const int64_t *sorted_keys_data = sorted_keys.values.Data();
+
+    // 3. Each run of identical (label, dest_state) within a det-state becomes
+    //    a new traceback element; `runs_shape` is indexed [run][cand].
+    Renumbering renumber_runs(c_, num_cands);
+    char *keep_runs_data = renumber_runs.Keep().Data();
+    K2_EVAL(
+        c_, num_cands, lambda_set_keep_runs, (int32_t i)->void {
+          int32_t f = state_to_cand_row_ids1_data[i];
+          keep_runs_data[i] = (char)(i == state_to_cand_row_splits1_data[f] ||
+                                     sorted_keys_data[i] !=
+                                         sorted_keys_data[i - 1]);
+        });
+    int32_t num_runs = renumber_runs.NumNewElems();
+    Array1<int32_t> run_splits = renumber_runs.New2Old(true);
+    RaggedShape runs_shape = RaggedShape2(&run_splits, nullptr, num_cands);
+    const int32_t *run_splits_data = run_splits.Data();
+
+    Array1<double> cand_forward_prob(c_, num_cands);
+    double *cand_forward_prob_data = cand_forward_prob.Data();
+    Array1<int32_t> cand_prev(c_, num_cands);
+    int32_t *cand_prev_data = cand_prev.Data();
+    {
+      const TracebackElem *elems_data = elems_.Data();
+      const int32_t *cands_row_ids2_data = cands_shape.RowIds(2).Data();
+      K2_EVAL(
+          c_, num_cands, lambda_set_cand_forward_prob, (int32_t i)->void {
+            int32_t old_i = order_data[i],
+                    elem = frontier_elems_data[cands_row_ids2_data[old_i]];
+            cand_prev_data[i] = elem;
+            cand_forward_prob_data[i] =
+                elems_data[elem].forward_prob +
+                fsas_arcs_data[cand_arc_idx012_data[old_i]].score;
+          });
+    }
+    Array1<int32_t> best_cand(c_, num_runs);
+    {
+      Ragged<double> forward_probs(runs_shape, cand_forward_prob);
+      ArgMaxPerSublist(forward_probs,
+                       -std::numeric_limits<double>::infinity(), &best_cand);
+    }
+    const int32_t *best_cand_data = best_cand.Data();
+
+    int32_t elems_begin = elems_.Dim();
+    elems_.Resize(elems_begin + num_runs);
+    Array1<double> run_forward_prob(c_, num_runs);
+    double *run_forward_prob_data = run_forward_prob.Data();
+    {
+      TracebackElem *elems_data = elems_.Data();
+      K2_EVAL(
+          c_, num_runs, lambda_set_new_elems, (int32_t r)->void {
+            int32_t i = best_cand_data[r];
+            K2_DCHECK_GE(i, run_splits_data[r]);
+            int32_t arc_idx012 = cand_arc_idx012_data[order_data[i]];
+            Arc arc = fsas_arcs_data[arc_idx012];
+            TracebackElem elem;
+            elem.state_idx01 =
+                fsas_row_ids2_data[arc_idx012] - arc.src_state + arc.dest_state;
+            elem.arc_idx012 = arc_idx012;
+            elem.prev = cand_prev_data[i];
+            elem.forward_prob = cand_forward_prob_data[i];
+            elems_data[elems_begin + r] = elem;
+            run_forward_prob_data[r] = elem.forward_prob;
+          });
+    }
+
+    // 4. Each run of identical labels within a det-state becomes a successor
+    //    det-state (a "group"); `groups_shape` is indexed [group][run].
+    Renumbering renumber_groups(c_, num_runs);
+    char *keep_groups_data = renumber_groups.Keep().Data();
+    K2_EVAL(
+        c_, num_runs, lambda_set_keep_groups, (int32_t r)->void {
+          int32_t i = run_splits_data[r],
+                  f = state_to_cand_row_ids1_data[i];
+          keep_groups_data[r] = (char)(i == state_to_cand_row_splits1_data[f] ||
+                                       (sorted_keys_data[i] >> 32) !=
+                                           (sorted_keys_data[i - 1] >> 32));
+        });
+    int32_t num_groups = renumber_groups.NumNewElems();
+    Array1<int32_t> group_splits = renumber_groups.New2Old(true);
+    RaggedShape groups_shape = RaggedShape2(&group_splits, nullptr, num_runs);
+    const int32_t *group_splits_data = group_splits.Data(),
+                  *groups_row_ids1_data = groups_shape.RowIds(1).Data();
+
+    Array1<int32_t> group_parent(c_, num_groups), group_label(c_, num_groups);
+    int32_t *group_parent_data = group_parent.Data(),
+            *group_label_data = group_label.Data();
+    K2_EVAL(
+        c_, num_groups, lambda_set_group_info, (int32_t g)->void {
+          int32_t i = run_splits_data[group_splits_data[g]];
+          group_parent_data[g] = state_to_cand_row_ids1_data[i];
+          group_label_data[g] =
+              static_cast<int32_t>(sorted_keys_data[i] >> 32) - 1;
+        });
+
+    // 5. Normalize: find the most recent common ancestor of the elements
+    //    of each group.  `new_seq_len` is the number of steps we had to go
+    //    back.  Groups with label -1 have only one element (they all go to
+    //    the final-state of the input FSA), so they converge at once.
+    Array1<int32_t> cur = Range<int32_t>(c_, num_runs, elems_begin),
+                    new_seq_len(c_, num_groups, -1), mrca(c_, num_groups),
+                    not_done(c_, 1);
+    int32_t *cur_data = cur.Data(), *new_seq_len_data = new_seq_len.Data(),
+            *mrca_data = mrca.Data(), *not_done_data = not_done.Data();
+    Array1<int32_t> max_cur(c_, num_groups), min_cur(c_, num_groups);
+    const int32_t *max_cur_data = max_cur.Data(),
+                  *min_cur_data = min_cur.Data();
+    for (int32_t k = 0;; k++) {
+      Ragged<int32_t> cur_ragged(groups_shape, cur);
+      MaxPerSublist(cur_ragged, std::numeric_limits<int32_t>::min(),
+                    &max_cur);
+      MinPerSublist(cur_ragged, std::numeric_limits<int32_t>::max(),
+                    &min_cur);
+      not_done = 0;
+      K2_EVAL(
+          c_, num_groups, lambda_check_converged, (int32_t g)->void {
+            if (new_seq_len_data[g] >= 0) return;
+            if (max_cur_data[g] == min_cur_data[g]) {
+              new_seq_len_data[g] = k;
+              mrca_data[g] = min_cur_data[g];
+            } else {
+              not_done_data[0] = 1;  // benign race: all threads write 1.
+            }
+          });
+      if (not_done[0] == 0) break;
+      const TracebackElem *elems_data = elems_.Data();
+      K2_EVAL(
+          c_, num_runs, lambda_step_back, (int32_t r)->void {
+            if (new_seq_len_data[groups_row_ids1_data[r]] < 0)
+              cur_data[r] = elems_data[cur_data[r]].prev;
+          });
+    }
+
+    // 6. Trace back from the common ancestor to the base element of the
+    //    parent det-state; this gives the weight removed by normalization
+    //    and the arc_derivs.
+    const int32_t *frontier_seq_len_data = frontier_seq_len_.Data();
+    Array1<int32_t> num_derivs(c_, num_groups + 1);
+    int32_t *num_derivs_data = num_derivs.Data();
+    K2_EVAL(
+        c_, num_groups, lambda_set_num_derivs, (int32_t g)->void {
+          num_derivs_data[g] = frontier_seq_len_data[group_parent_data[g]] +
+                               1 - new_seq_len_data[g];
+        });
+    ExclusiveSum(num_derivs, &num_derivs);
+    RaggedShape derivs_shape = RaggedShape2(&num_derivs, nullptr, -1);
+    Array1<int32_t> derivs_values(c_, derivs_shape.NumElements());
+    int32_t *derivs_values_data = derivs_values.Data();
+    Array1<double> removed_weight(c_, num_groups);
+    double *removed_weight_data = removed_weight.Data();
+    Array1<uint64_t> group_key(c_, num_groups), group_check(c_, num_groups);
+    uint64_t *group_key_data = group_key.Data(),
+             *group_check_data = group_check.Data();
+    {
+      const TracebackElem *elems_data = elems_.Data();
+      K2_EVAL(
+          c_, num_groups, lambda_trace_back, (int32_t g)->void {
+            int32_t begin = num_derivs_data[g],
+                    num_steps = num_derivs_data[g + 1] - begin,
+                    t = mrca_data[g];
+            double forward_prob = elems_data[t].forward_prob;
+            for (int32_t n = num_steps - 1; n >= 0; n--) {
+              TracebackElem elem = elems_data[t];
+              derivs_values_data[begin + n] = elem.arc_idx012;
+              t = elem.prev;
+            }
+            removed_weight_data[g] = forward_prob - elems_data[t].forward_prob;
+
+            if (group_label_data[g] == -1) return;  // final-state: no key.
+            // Compute the hash of (base_state, symbol sequence); all
+            // elements have the same symbol sequence, so we use the first.
+            int32_t seq_len = new_seq_len_data[g];
+            uint64_t a, b;
+            InitReprHash(seq_len, &a, &b);
+            t = elems_begin + group_splits_data[g];
+            for (int32_t n = 0; n < seq_len; n++) {
+              TracebackElem elem = elems_data[t];
+              AddSymbolToReprHash(fsas_arcs_data[elem.arc_idx012].label,
+                                  &a, &b);
+              t = elem.prev;
+            }
+            K2_DCHECK_EQ(t, mrca_data[g]);
+            FinalizeReprHash(elems_data[t].state_idx01, &a, &b);
+            group_key_data[g] = a;
+            group_check_data[g] = b;
+          });
+    }
+    Array1<double> normalizer(c_, num_groups, 0.0);
+    if (weight_pushing_type_ != kNoWeightPushing) {
+      Ragged<double> forward_probs(groups_shape, run_forward_prob);
+      if (weight_pushing_type_ == kTropicalWeightPushing)
+        MaxPerSublist(forward_probs, -std::numeric_limits<double>::infinity(),
+                      &normalizer);
+      else
+        LogSumPerSublist(forward_probs,
+                         -std::numeric_limits<double>::infinity(),
+                         &normalizer);
+    }
+    const double *normalizer_data = normalizer.Data();
+
+    // If pruning, work out which groups are within the beam.
+    Array1<double> group_fb;
+    Array1<char> group_in_beam;
+    const char *group_in_beam_data = nullptr;
+    if (pruned_) {
+      group_fb = GetGroupForwardBackwardProbs(groups_shape, elems_begin,
+                                              run_forward_prob, mrca);
+      group_in_beam = Array1<char>(c_, num_groups);
+      char *in_beam_data = group_in_beam.Data();
+      const double *group_fb_data = group_fb.Data(),
+                   *cutoff_data = cutoff_.Data();
+      const int32_t *states_fsa_idx_data = states_fsa_idx_.Data();
+      K2_EVAL(
+          c_, num_groups, lambda_set_in_beam, (int32_t g)->void {
+            int32_t fsa_idx0 =
+                states_fsa_idx_data[state_begin + group_parent_data[g]];
+            in_beam_data[g] = (char)(group_fb_data[g] >= cutoff_data[fsa_idx0]);
+          });
+      group_in_beam_data = in_beam_data;
+    }
+
+    // 7. Look up the det-states in the hash.  The value is temporarily
+    //    num_states + g for the winning group g; we renumber and rewrite it
+    //    below.  existing_state is -1 for winning groups and groups with
+    //    label -1, and -2 for groups that are pruned away.
+    int32_t num_states = states_fsa_idx_.Dim();
+    PossiblyResizeHash(4 * (num_states + num_groups));
+    auto repr_to_state_acc = repr_to_state_.GetAccessor();
+    Renumbering renumber_new_states(c_, num_groups);
+    Array1<int32_t> group_best_path_pos;
+    char *keep_new_states_data = renumber_new_states.Keep().Data();
+    Array1<int32_t> existing_state(c_, num_groups);
+    int32_t *existing_state_data = existing_state.Data();
+    K2_EVAL(
+        c_, num_groups, lambda_insert, (int32_t g)->void {
+          bool in_beam = (group_in_beam_data == nullptr ||
+                          group_in_beam_data[g]);
+          existing_state_data[g] = (in_beam ? -1 : -2);
+          if (group_label_data[g] == -1 || !in_beam) {
+            keep_new_states_data[g] = 0;
+            return;
+          }
+          uint64_t key = group_key_data[g], old_value = 0,
+                   *key_value_location = nullptr;
+          bool inserted = repr_to_state_acc.Insert(
+              key, (uint64_t)(num_states + g), &old_value,
+              &key_value_location);
+          if (!inserted) {
+            // The other thread may not have written the value yet; Find()
+            // waits for it.
+            if (~old_value == 0) repr_to_state_acc.Find(key, &old_value);
+            if (old_value == kPrunedDetState) {
+              // Dropped by LimitNumNewStates(); whoever swaps in its own
+              // value creates it again.
+              old_value = AtomicCAS(
+                  (unsigned long long *)(key_value_location + 1),
+                  kPrunedDetState, (uint64_t)(num_states + g));
+              inserted = (old_value == kPrunedDetState);
+            }
+          }
+          keep_new_states_data[g] = (char)inserted;
+          if (!inserted)
+            existing_state_data[g] = static_cast<int32_t>(old_value);
+        });
+    if (max_states_ > 0)
+      LimitNumNewStates(state_begin, num_states, group_parent, group_label,
+                        group_fb, group_key, existing_state,
+                        &renumber_new_states.Keep(), &group_best_path_pos);
+    int32_t num_new_states = renumber_new_states.NumNewElems();
+    const int32_t *new_states_old2new_data =
+        renumber_new_states.Old2New().Data();
+
+    // If pruning, some groups get no arc: those not within the beam and
+    // those whose det-state was dropped by LimitNumNewStates().
+    int32_t num_new_arcs = num_groups;
+    Renumbering renumber_arcs;
+    const int32_t *arcs_old2new_data = nullptr;
+    if (pruned_) {
+      renumber_arcs.Init(c_, num_groups);
+      char *keep_arcs_data = renumber_arcs.Keep().Data();
+      K2_EVAL(
+          c_, num_groups, lambda_set_keep_arcs, (int32_t g)->void {
+            int32_t existing = existing_state_data[g];
+            bool keep;
+            if (existing == -2)
+              keep = false;
+            else if (existing == -1)
+              keep = (group_label_data[g] == -1 || keep_new_states_data[g]);
+            else if (existing < num_states)
+              keep = true;
+            else
+              keep = keep_new_states_data[existing - num_states];
+            keep_arcs_data[g] = (char)keep;
+          });
+      num_new_arcs = renumber_arcs.NumNewElems();
+      arcs_old2new_data = renumber_arcs.Old2New(true).Data();
+    }
+
+    int32_t src_arcs_begin = arcs_.Dim();
+    arcs_.Resize(src_arcs_begin + num_new_arcs);
+    ArcInfo *arcs_data = arcs_.Data();
+    const uint64_t *states_check_data = states_check_.Data();
+    const double *frontier_normalizer_data = frontier_normalizer_.Data();
+    bool no_weight_pushing = (weight_pushing_type_ == kNoWeightPushing);
+    K2_EVAL(
+        c_, num_groups, lambda_set_arcs, (int32_t g)->void {
+          int32_t arc_idx = g;
+          if (arcs_old2new_data != nullptr) {
+            arc_idx = arcs_old2new_data[g];
+            if (arcs_old2new_data[g + 1] == arc_idx) return;  // pruned away
+          }
+          int32_t dest_det_state = -1, existing = existing_state_data[g];
+          if (group_label_data[g] != -1) {
+            if (existing < 0) {
+              dest_det_state = num_states + new_states_old2new_data[g];
+            } else if (existing < num_states) {
+              dest_det_state = existing;
+              K2_CHECK_EQ(states_check_data[existing], group_check_data[g])
+                  << "Hash collision in determinization";
+            } else {
+              int32_t other_g = existing - num_states;
+              dest_det_state = num_states + new_states_old2new_data[other_g];
+              K2_CHECK_EQ(group_check_data[other_g], group_check_data[g])
+                  << "Hash collision in determinization";
+            }
+          }
+          int32_t f = group_parent_data[g];
+          ArcInfo info;
+          info.src_det_state = state_begin + f;
+          info.dest_det_state = dest_det_state;
+          info.label = group_label_data[g];
+          info.score = static_cast<float>(
+              no_weight_pushing ? removed_weight_data[g]
+                                : normalizer_data[g] -
+                                      frontier_normalizer_data[f]);
+          arcs_data[src_arcs_begin + arc_idx] = info;
+        });
+    Ragged<int32_t> derivs(derivs_shape, derivs_values);
+    if (num_new_arcs != num_groups)
+      derivs = SubsetRagged(derivs, renumber_arcs, 0);
+    derivs_.push_back(derivs);
+
+    // 8. Set up the new det-states and the frontier for the next iteration.
+    const int32_t *new_states_new2old_data =
+        renumber_new_states.New2Old().Data();
+    states_fsa_idx_.Resize(num_states + num_new_states);
+    states_check_.Resize(num_states + num_new_states);
+    Array1<int32_t> next_seq_len(c_, num_new_states);
+    Array1<double> next_normalizer(c_, num_new_states);
+    int32_t *states_fsa_idx_data = states_fsa_idx_.Data(),
+            *next_seq_len_data = next_seq_len.Data();
+    uint64_t *new_states_check_data = states_check_.Data();
+    double *next_normalizer_data = next_normalizer.Data();
+    int32_t *best_path_pos_data = nullptr;
+    const int32_t *group_best_path_pos_data = nullptr;
+    if (max_states_ > 0) {
+      states_best_path_pos_.Resize(num_states + num_new_states);
+      best_path_pos_data = states_best_path_pos_.Data();
+      group_best_path_pos_data = group_best_path_pos.Data();
+    }
+    K2_EVAL(
+        c_, num_new_states, lambda_set_new_states, (int32_t n)->void {
+          int32_t g = new_states_new2old_data[n],
+                  src_det_state = state_begin + group_parent_data[g];
+          states_fsa_idx_data[num_states + n] =
+              states_fsa_idx_data[src_det_state];
+          new_states_check_data[num_states + n] = group_check_data[g];
+          next_seq_len_data[n] = new_seq_len_data[g];
+          next_normalizer_data[n] = normalizer_data[g];
+          if (best_path_pos_data != nullptr)
+            best_path_pos_data[num_states + n] = group_best_path_pos_data[g];
+          uint64_t value = 0, *key_value_location = nullptr;
+          bool found = repr_to_state_acc.Find(group_key_data[g], &value,
+                                              &key_value_location);
+          K2_CHECK(found);
+          repr_to_state_acc.SetValue(key_value_location,
+                                      (uint64_t)(num_states + n));
+        });
+
+    Ragged<int32_t> group_elems(groups_shape,
+                                Range<int32_t>(c_, num_runs, elems_begin));
+    frontier_ = SubsetRagged(group_elems, renumber_new_states, 0);
+    frontier_seq_len_ = next_seq_len;
+    frontier_normalizer_ = next_normalizer;
+    iter_to_state_row_splits_cpu_.push_back(num_states + num_new_states);
+  }
+
+  /*
+    Adds the final-state of each non-empty FSA as a separate iteration.
+   */
+  void LastIter() {
+    NVTX_RANGE(K2_FUNC);
+    int32_t num_fsas = fsas_.Dim0();
+    Renumbering renumber_final_states(c_, num_fsas);
+    char *keep_data = renumber_final_states.Keep().Data();
+    const int32_t *fsas_row_splits1_data = fsas_.RowSplits(1).Data();
+    K2_EVAL(
+        c_, num_fsas, lambda_set_keep, (int32_t i)->void {
+          keep_data[i] =
+              (char)(fsas_row_splits1_data[i + 1] > fsas_row_splits1_data[i]);
+        });
+    Array1<int32_t> &new2old = renumber_final_states.New2Old();
+    int32_t cur_num_states = states_fsa_idx_.Dim(),
+            tot_num_states = cur_num_states + new2old.Dim();
+    states_fsa_idx_.Resize(tot_num_states);
+    Array1<int32_t> dest = states_fsa_idx_.Arange(cur_num_states,
+                                                  tot_num_states);
+    Assign(new2old, &dest);
+    K2_CHECK_EQ(cur_num_states, iter_to_state_row_splits_cpu_.back());
+    iter_to_state_row_splits_cpu_.push_back(tot_num_states);
+  }
+
+  /* Resizes the hash if it has fewer than `min_num_buckets` buckets. */
+  void PossiblyResizeHash(int32_t min_num_buckets) {
+    NVTX_RANGE(K2_FUNC);
+    if (repr_to_state_.NumBuckets() >= min_num_buckets) return;
+    repr_to_state_.Resize(RoundUpToNearestPowerOfTwo(min_num_buckets));
+  }
+
+  /*
+    Sets up the members used for pruning: the forward and backward scores
+    of the input states in the tropical semiring, the initial cutoff_,
+    best_path_labels_, fsa_num_states_ and num_reserved_.  The input must be
+    top-sorted.
+   */
+  void InitPruning(float beam) {
+    NVTX_RANGE(K2_FUNC);
+    Ragged<int32_t> state_batches = GetStateBatches(fsas_, true);
+    Array1<int32_t> dest_states = GetDestStates(fsas_, true);
+    Ragged<int32_t> incoming_arcs = GetIncomingArcs(fsas_, dest_states);
+    Ragged<int32_t> entering_arc_batches = GetEnteringArcIndexBatches(
+                        fsas_, incoming_arcs, state_batches),
+                    leaving_arc_batches =
+                        GetLeavingArcIndexBatches(fsas_, state_batches);
+    bool log_semiring = false;
+    Array1<int32_t> entering_arcs;
+    forward_scores_ = GetForwardScores<double>(
+        fsas_, state_batches, entering_arc_batches, log_semiring,
+        &entering_arcs);
+    backward_scores_ = GetBackwardScores<double>(
+        fsas_, state_batches, leaving_arc_batches, log_semiring);
+    Ragged<int32_t> best_paths = ShortestPath(fsas_, entering_arcs);
+    Array1<int32_t> best_path_labels(c_, best_paths.NumElements());
+    int32_t *best_path_labels_data = best_path_labels.Data();
+    const int32_t *best_paths_data = best_paths.values.Data();
+    const Arc *fsas_arcs_data = fsas_.values.Data();
+    K2_EVAL(
+        c_, best_paths.NumElements(), lambda_set_best_path_labels,
+        (int32_t i)->void {
+          best_path_labels_data[i] = fsas_arcs_data[best_paths_data[i]].label;
+        });
+    best_path_labels_ = Ragged<int32_t>(best_paths.shape, best_path_labels);
+
+    int32_t num_fsas = fsas_.Dim0();
+    cutoff_ = Array1<double>(c_, num_fsas);
+    fsa_num_states_ = Array1<int32_t>(c_, num_fsas);
+    num_reserved_ = Array1<int32_t>(c_, num_fsas);
+    double *cutoff_data = cutoff_.Data();
+    int32_t *fsa_num_states_data = fsa_num_states_.Data(),
+            *num_reserved_data = num_reserved_.Data();
+    const int32_t *fsas_row_splits1_data = fsas_.RowSplits(1).Data(),
+                  *best_paths_row_splits1_data = best_paths.RowSplits(1).Data();
+    const double *backward_scores_data = backward_scores_.Data();
+    K2_EVAL(
+        c_, num_fsas, lambda_init_pruning, (int32_t i)->void {
+          int32_t start_state_idx01 = fsas_row_splits1_data[i];
+          bool empty = (fsas_row_splits1_data[i + 1] == start_state_idx01);
+          // The backward score of the start-state is the best path score.
+          double best_score =
+              (empty ? 0.0 : backward_scores_data[start_state_idx01]);
+          cutoff_data[i] = best_score - beam;
+          fsa_num_states_data[i] = (empty ? 0 : 1);
+          // The det-states on the best path, other than the start- and
+          // final-state, one per arc.
+          int32_t best_path_len = best_paths_row_splits1_data[i + 1] -
+                                  best_paths_row_splits1_data[i];
+          num_reserved_data[i] = max(0, best_path_len - 1);
+        });
+  }
+
+  /*
+    Returns, for each group (unnormalized successor det-state), the score of
+    the best path through it, as in k2host::DeterminizerPruned: the best
+    forward-backward score of its elements, corrected so that it depends only
+    on the det-state and not on the path through which we reached it.  (This
+    may be more than the score of any path through the det-state, as the best
+    path to the base state may have a different symbol sequence.)
+
+      @param [in] groups_shape  The groups of runs, indexed [group][run]
+      @param [in] elems_begin  The index in elems_ of the element of run 0
+      @param [in] run_forward_prob  The forward prob of each run's element
+      @param [in] mrca  The most recent common ancestor of each group
+   */
+  Array1<double> GetGroupForwardBackwardProbs(RaggedShape &groups_shape,
+                                              int32_t elems_begin,
+                                              Array1<double> &run_forward_prob,
+                                              Array1<int32_t> &mrca) {
+    NVTX_RANGE(K2_FUNC);
+    int32_t num_groups = groups_shape.Dim0(),
+            num_runs = groups_shape.NumElements();
+    const TracebackElem *elems_data = elems_.Data();
+    const double *run_forward_prob_data = run_forward_prob.Data(),
+                 *forward_scores_data = forward_scores_.Data(),
+                 *backward_scores_data = backward_scores_.Data();
+    Array1<double> run_fb(c_, num_runs);
+    double *run_fb_data = run_fb.Data();
+    K2_EVAL(
+        c_, num_runs, lambda_set_run_fb, (int32_t r)->void {
+          int32_t s = elems_data[elems_begin + r].state_idx01;
+          run_fb_data[r] = run_forward_prob_data[r] + backward_scores_data[s];
+        });
+    Array1<double> group_path_fb(c_, num_groups);
+    Ragged<double> run_fb_ragged(groups_shape, run_fb);
+    MaxPerSublist(run_fb_ragged, -std::numeric_limits<double>::infinity(),
+                  &group_path_fb);
+    // Replace the forward prob of the common ancestor, which depends on the
+    // path, with the best forward score of its state.
+    Array1<double> group_fb(c_, num_groups);
+    double *group_fb_data = group_fb.Data();
+    const double *group_path_fb_data = group_path_fb.Data();
+    const int32_t *mrca_data = mrca.Data();
+    K2_EVAL(
+        c_, num_groups, lambda_correct_fb, (int32_t g)->void {
+          TracebackElem elem = elems_data[mrca_data[g]];
+          group_fb_data[g] = group_path_fb_data[g] +
+                             forward_scores_data[elem.state_idx01] -
+                             elem.forward_prob;
+        });
+    return group_fb;
+  }
+
+  /*
+    Enforces max_states_: if the winning groups (the new det-states) would
+    give an FSA more than max_states_ states, keeps only those with the best
+    forward-backward scores and drops the rest, marking them as
+    kPrunedDetState in the hash.  It also raises the cutoff of that FSA to
+    the best score it dropped, i.e. it tightens the beam, so that in later
+    iterations we don't create arcs and det-states that would be dropped
+    anyway.
+
+    Room is kept for the det-states on the best path that are still to be
+    created, so the best path survives if it has fewer than max_states_
+    arcs.  As the output is deterministic, these are the det-states reached
+    by the prefixes of the label sequence of the best path; we follow them
+    through states_best_path_pos_.  (Scores can't tell us which they are, as
+    the forward prob of a det-state depends on the path through which it was
+    first reached.)
+
+      @param [in] state_begin  The index of the first frontier det-state
+      @param [in] num_states  The number of det-states before this iteration
+      @param [in] group_parent  The index in the frontier of the parent of
+                             each group
+      @param [in] group_label  The label of each group
+      @param [in] group_fb  The forward-backward score of each group
+      @param [in] group_key  The hash key of each group
+      @param [in] existing_state  As set in ForwardOneIter(); for groups that
+                             are not winners but have the same det-state as
+                             the winning group g, it is num_states + g.
+      @param [in,out] keep_new_states  Indexed by group, 1 for the winning
+                             groups; at exit, set to 0 for the dropped ones.
+      @param [out] group_best_path_pos  Indexed by group; for the winning
+                             groups, the position of their det-state on the
+                             best path, or -1; see states_best_path_pos_.
+   */
+  void LimitNumNewStates(int32_t state_begin, int32_t num_states,
+                         Array1<int32_t> &group_parent,
+                         Array1<int32_t> &group_label,
+                         Array1<double> &group_fb,
+                         Array1<uint64_t> &group_key,
+                         Array1<int32_t> &existing_state,
+                         Array1<char> *keep_new_states,
+                         Array1<int32_t> *group_best_path_pos) {
+    NVTX_RANGE(K2_FUNC);
+    int32_t num_groups = group_parent.Dim(), max_states = max_states_;
+    // The group that follows the best path from a det-state on it, if any,
+    // reaches the next det-state on it.  At most one group per FSA does,
+    // and its det-state may be a winner, or one that exists already (if
+    // another path reached it first); `fsa_best_path_pos` records how far
+    // along the best path we got.
+    *group_best_path_pos = Array1<int32_t>(c_, num_groups, -1);
+    Array1<int32_t> fsa_best_path_pos(c_, fsas_.Dim0(), -1);
+    int32_t *group_best_path_pos_data = group_best_path_pos->Data(),
+            *fsa_best_path_pos_data = fsa_best_path_pos.Data(),
+            *states_best_path_pos_data = states_best_path_pos_.Data();
+    const int32_t *group_parent_data = group_parent.Data(),
+                  *group_label_data = group_label.Data(),
+                  *states_fsa_idx_data = states_fsa_idx_.Data(),
+                  *existing_state_data = existing_state.Data(),
+                  *best_path_labels_row_splits1_data =
+                      best_path_labels_.RowSplits(1).Data(),
+                  *best_path_labels_data = best_path_labels_.values.Data();
+    K2_EVAL(
+        c_, num_groups, lambda_follow_best_path, (int32_t g)->void {
+          int32_t parent = state_begin + group_parent_data[g],
+                  f = states_fsa_idx_data[parent],
+                  pos = states_best_path_pos_data[parent],
+                  begin = best_path_labels_row_splits1_data[f],
+                  len = best_path_labels_row_splits1_data[f + 1] - begin,
+                  existing = existing_state_data[g];
+          // Groups with label -1 reach the final-state, which we don't count
+          // here.
+          if (pos < 0 || pos + 1 >= len ||
+              group_label_data[g] != best_path_labels_data[begin + pos])
+            return;
+          fsa_best_path_pos_data[f] = pos + 1;
+          if (existing == -1)
+            group_best_path_pos_data[g] = pos + 1;
+          else if (existing >= num_states)
+            group_best_path_pos_data[existing - num_states] = pos + 1;
+          else if (existing >= 0)
+            states_best_path_pos_data[existing] = pos + 1;
+        });
+
+    Renumbering renumber_winners(c_, num_groups);
+    renumber_winners.Keep().CopyFrom(*keep_new_states);
+    int32_t num_winners = renumber_winners.NumNewElems();
+    if (num_winners == 0) return;
+
+    // The winners are sorted by FSA, like the frontier det-states they
+    // come from.  We sort them on their score, with those on the best path
+    // first.
+    const int32_t *winners_new2old_data = renumber_winners.New2Old().Data();
+    const double *group_fb_data = group_fb.Data();
+    Array1<int32_t> winner_fsa(c_, num_winners);
+    Array1<double> winner_score(c_, num_winners);
+    int32_t *winner_fsa_data = winner_fsa.Data();
+    double *winner_score_data = winner_score.Data();
+    double inf = std::numeric_limits<double>::infinity();
+    K2_EVAL(
+        c_, num_winners, lambda_set_winner_info, (int32_t i)->void {
+          int32_t g = winners_new2old_data[i];
+          winner_fsa_data[i] =
+              states_fsa_idx_data[state_begin + group_parent_data[g]];
+          winner_score_data[i] =
+              (group_best_path_pos_data[g] >= 0 ? inf : group_fb_data[g]);
+        });
+    int32_t num_fsas = fsas_.Dim0();
+    Array1<int32_t> winners_row_splits(c_, num_fsas + 1);
+    RowIdsToRowSplits(winner_fsa, &winners_row_splits);
+    Ragged<double> sorted_scores(
+        RaggedShape2(&winners_row_splits, &winner_fsa, num_winners),
+        winner_score);
+    Array1<int32_t> order(c_, num_winners);
+    SortSublists<double, GreaterThan<double>>(&sorted_scores, &order);
+
+    Array1<int32_t> num_kept(c_, num_fsas);
+    int32_t *num_kept_data = num_kept.Data(),
+            *fsa_num_states_data = fsa_num_states_.Data(),
+            *num_reserved_data = num_reserved_.Data();
+    const int32_t *winners_row_splits_data = winners_row_splits.Data(),
+                  *order_data = order.Data();
+    const double *sorted_scores_data = sorted_scores.values.Data();
+    double *cutoff_data = cutoff_.Data();
+    K2_EVAL(
+        c_, num_fsas, lambda_set_num_kept, (int32_t f)->void {
+          int32_t begin = winners_row_splits_data[f],
+                  n = winners_row_splits_data[f + 1] - begin,
+                  // Keep one state for the final-state.
+                  avail = max(0, max_states - 1 - fsa_num_states_data[f]),
+                  num_best = 0;
+          if (n > 0 && sorted_scores_data[begin] == inf) num_best = 1;
+          // The det-states on the best path after the one we reached.
+          int32_t pos = fsa_best_path_pos_data[f];
+          if (pos >= 0)
+            num_reserved_data[f] = best_path_labels_row_splits1_data[f + 1] -
+                                   best_path_labels_row_splits1_data[f] - 1 -
+                                   pos;
+          int32_t reserved = num_reserved_data[f],
+                  allowed = max(min(num_best, avail), avail - reserved);
+          if (n > allowed) {
+            int32_t g = winners_new2old_data[order_data[begin + allowed]];
+            double cutoff = group_fb_data[g] - kBestPathTolerance;
+            if (cutoff > cutoff_data[f]) cutoff_data[f] = cutoff;
+            n = allowed;
+          }
+          num_kept_data[f] = n;
+          fsa_num_states_data[f] += n;
+        });
+
+    auto repr_to_state_acc = repr_to_state_.GetAccessor();
+    char *keep_data = keep_new_states->Data();
+    const uint64_t *group_key_data = group_key.Data();
+    K2_EVAL(
+        c_, num_winners, lambda_drop_states, (int32_t i)->void {
+          int32_t f = winner_fsa_data[i];
+          if (i - winners_row_splits_data[f] < num_kept_data[f]) return;
+          int32_t g = winners_new2old_data[order_data[i]];
+          keep_data[g] = 0;
+          uint64_t value = 0, *key_value_location = nullptr;
+          bool found = repr_to_state_acc.Find(group_key_data[g], &value,
+                                              &key_value_location);
+          K2_CHECK(found);
+          repr_to_state_acc.SetValue(key_value_location, kPrunedDetState);
+        });
+  }
+
+  ContextPtr c_;
+  FsaVec fsas_;
+  DeterminizeWeightPushingType weight_pushing_type_;
+  // True if we are pruning, i.e. the beam is finite or max_states_ > 0.
+  bool pruned_;
+  int32_t max_states_;
+
+  // The following are only set if pruned_.
+  // The forward and backward scores of the states of fsas_.
+  Array1<double> forward_scores_;
+  Array1<double> backward_scores_;
+  // Indexed by FSA: det-states and arcs whose forward-backward score is
+  // less than this are pruned away.  Raised by LimitNumNewStates().
+  Array1<double> cutoff_;
+  // Indexed [fsa][arc]: the labels of the best path of each FSA; only set
+  // if max_states_ > 0.
+  Ragged<int32_t> best_path_labels_;
+  // Indexed by FSA: the number of det-states created so far, excluding the
+  // final-state.
+  Array1<int32_t> fsa_num_states_;
+  // Indexed by FSA: the number of det-states on the best path that are yet
+  // to be created; LimitNumNewStates() keeps room for them.
+  Array1<int32_t> num_reserved_;
+
+  // The traceback tree.
+  Array1<TracebackElem> elems_;
+
+  // Indexed by det-state: the FSA index (idx0 in fsas_) that it belongs to.
+  Array1<int32_t> states_fsa_idx_;
+  // Indexed by det-state (excluding final-states): the secondary hash of its
+  // representation, used to detect hash collisions.
+  Array1<uint64_t> states_check_;
+  // Only set if max_states_ > 0.  Indexed by det-state (excluding
+  // final-states): if it is reached from the start-state by the first n
+  // labels of the best path, n; else -1.
+  Array1<int32_t> states_best_path_pos_;
+
+  // iter_to_state_row_splits_cpu_, which is a copy of the row_splits of a
+  // ragged tensor [iter][det_state], tells us which det-states were created
+  // on each iteration.
+  std::vector<int32_t> iter_to_state_row_splits_cpu_;
+
+  // The det-states created on the last iteration, with their elements
+  // (indexes into elems_), indexed [det_state][elem].
+  Ragged<int32_t> frontier_;
+  // The length of the symbol sequence of the frontier det-states.
+  Array1<int32_t> frontier_seq_len_;
+  // The normalizer of the frontier det-states (0 if no weight pushing).
+  Array1<double> frontier_normalizer_;
+
+  // The output arcs, in order of their source det-state.
+  Array1<ArcInfo> arcs_;
+  // The arc_derivs for the arcs in arcs_, one ragged tensor per iteration.
+  std::vector<Ragged<int32_t>> derivs_;
+
+  // Maps from the hash of (base_state, symbol sequence) to the det-state.
+  Hash64 repr_to_state_;
+};
+
+void DeterminizeDevice(FsaOrVec &src,
+                       DeterminizeWeightPushingType weight_pushing_type,
+                       FsaOrVec *dest,
+                       Ragged<int32_t> *arc_derivs /*= nullptr*/) {
+  NVTX_RANGE(K2_FUNC);
+  K2_CHECK_NE(dest, nullptr);
+  K2_CHECK_GE(src.NumAxes(), 2);
+  K2_CHECK_LE(src.NumAxes(), 3);
+  if (src.NumAxes() == 2) {
+    // Turn single Fsa into FsaVec.
+    Fsa *srcs = &src;
+    FsaVec src_vec = CreateFsaVec(1, &srcs), dest_vec;
+    // Recurse..
+    DeterminizeDevice(src_vec, weight_pushing_type, &dest_vec, arc_derivs);
+    *dest = GetFsaVecElement(dest_vec, 0);
+    return;
+  }
+  DeviceDeterminizer determinizer(src, weight_pushing_type);
+  determinizer.Determinize();
+  *dest = determinizer.FormatOutput(arc_derivs);
+}
+
+void DeterminizePrunedDevice(FsaOrVec &src,
+                             DeterminizeWeightPushingType weight_pushing_type,
+                             float beam, int32_t max_states, FsaOrVec *dest,
+                             Ragged<int32_t> *arc_derivs /*= nullptr*/) {
+  NVTX_RANGE(K2_FUNC);
+  K2_CHECK_NE(dest, nullptr);
+  K2_CHECK_GE(src.NumAxes(), 2);
+  K2_CHECK_LE(src.NumAxes(), 3);
+  K2_CHECK_GT(beam, 0);
+  if (src.NumAxes() == 2) {
+    // Turn single Fsa into FsaVec.
+    Fsa *srcs = &src;
+    FsaVec src_vec = CreateFsaVec(1, &srcs), dest_vec;
+    // Recurse..
+    DeterminizePrunedDevice(src_vec, weight_pushing_type, beam, max_states,
+                            &dest_vec, arc_derivs);
+    *dest = GetFsaVecElement(dest_vec, 0);
+    return;
+  }
+  DeviceDeterminizer determinizer(src, weight_pushing_type, beam,
+                                  max_states);
+  determinizer.Determinize();
+  Ragged<int32_t> derivs;
+  FsaVec det = determinizer.FormatOutput(arc_derivs != nullptr ? &derivs
+                                                               : nullptr);
+  // Det-states dropped because of max_states may leave states from which
+  // the final-state can't be reached.
+  Array1<int32_t> arc_map;
+  Connect(det, dest, arc_derivs != nullptr ? &arc_map : nullptr);
+  if (arc_derivs != nullptr) *arc_derivs = Index(derivs, 0, arc_map);
+}
+
+}  // namespace k2
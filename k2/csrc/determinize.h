@@ -0,0 +1,96 @@
+/**
+ * Copyright      2026  Xiaomi Corporation
+ *
+ * See LICENSE for clarification regarding multiple authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef K2_CSRC_DETERMINIZE_H_
+#define K2_CSRC_DETERMINIZE_H_
+
+#include "k2/csrc/array.h"
+#include "k2/csrc/fsa.h"
+#include "k2/csrc/fsa_algo.h"
+#include "k2/csrc/ragged.h"
+
+namespace k2 {
+
+/*
+  Notes on our batched determinization algorithm, DeterminizeDevice().
+
+  It implements the same algorithm as the host code in
+  host/determinize_impl.h (class DeterminizerMax), i.e. determinization in the
+  tropical semiring with optional weight pushing, but instead of processing
+  one determinized state at a time from a queue, it processes all the
+  determinized states of all the FSAs in an FsaVec that were created in the
+  previous iteration (the "frontier") at once.
+
+  A determinized state (det-state) is a set of elements of a traceback tree;
+  each element is a state in the input FSA plus a pointer to the element
+  it came from, and the best forward score from the start-state.  Once
+  normalized, a det-state is identified by its "base state" (the input state of
+  the most recent common ancestor of its elements, i.e. where the paths
+  diverge) and the sequence of symbols from there.  One iteration does:
+
+    - Expand the arcs leaving all elements of all frontier det-states.
+    - Sort the resulting candidates per det-state on (label, dest-state);
+      each run of identical (label, dest-state) becomes a new traceback element
+      (keeping the best score), and each run of identical labels becomes an
+      unnormalized successor det-state.
+    - Normalize each successor det-state by stepping back through the
+      traceback tree until all its elements coincide; this gives its base
+      state and symbol-sequence length, the weight removed from it and the
+      arcs in `src` that the output arc corresponds to (arc_derivs).
+    - Look up (base-state, symbol-sequence) in a hash table (Hash64) to find
+      whether the det-state already exists; new ones form the next frontier.
+
+  Arcs with label -1 always go to the final state of the output FSA, which
+  is not looked up in the hash.  We stop when an iteration produces no new
+  det-states; as in DeviceIntersector, the states of each output FSA are
+  numbered by iteration, so the start-state is first and the final state last.
+
+  The pruned version, DeterminizePrunedDevice(), also computes the
+  forward-backward score of each successor det-state (the score of the best
+  path through it, as in k2host::DeterminizerPruned) and drops those, and the
+  arcs to them, that are not within the beam of the best path.  To bound the
+  number of states, if the new det-states of an iteration would take an FSA
+  over max_states it keeps only the best ones and raises the pruning cutoff
+  of that FSA to the best score it dropped, i.e. it tightens the beam.  It
+  keeps room for the det-states reached by the label sequence of the best
+  path, so that path survives.  Because we go breadth-first, the output is
+  connected at the end.
+*/
+
+/*
+  Version of Determinize() that works on CPU and GPU; it is optimized for
+  GPU.  See Determinize() in fsa_algo.h for documentation of the
+  args; this function has the same interface and produces equivalent output
+  (the state numbering may differ).
+ */
+void DeterminizeDevice(FsaOrVec &src,
+                       DeterminizeWeightPushingType weight_pushing_type,
+                       FsaOrVec *dest, Ragged<int32_t> *arc_derivs = nullptr);
+
+/*
+  Pruned version of DeterminizeDevice(), for lattices; see
+  DeterminizePruned() in fsa_algo.h for documentation of the args.
+ */
+void DeterminizePrunedDevice(FsaOrVec &src,
+                             DeterminizeWeightPushingType weight_pushing_type,
+                             float beam, int32_t max_states, FsaOrVec *dest,
+                             Ragged<int32_t> *arc_derivs = nullptr);
+
+}  // namespace k2
+
+#endif  // K2_CSRC_DETERMINIZE_H_
@@ -0,0 +1,282 @@
+/**
+ * Copyright      2026  Xiaomi Corporation
+ *
+ * See LICENSE for clarification regarding multiple authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <gtest/gtest.h>
+
+#include <limits>
+#include <string>
+#include <vector>
+
+#include "k2/csrc/determinize.h"
+#include "k2/csrc/fsa_algo.h"
+#include "k2/csrc/fsa_utils.h"
+#include "k2/csrc/host/determinize.h"
+#include "k2/csrc/host_shim.h"
+#include "k2/csrc/test_utils.h"
+
+namespace k2 {
+
+// Check that the score of each arc in `dest` equals the sum of the scores of
+// the arcs in `src` that `arc_derivs` says it corresponds to.  Only valid for
+// kNoWeightPushing.
+static void CheckArcDerivs(FsaOrVec &src, FsaOrVec &dest,
+                           Ragged<int32_t> &arc_derivs) {
+  ContextPtr cpu = GetCpuContext();
+  src = src.To(cpu);
+  dest = dest.To(cpu);
+  arc_derivs = arc_derivs.To(cpu);
+  ASSERT_EQ(arc_derivs.NumAxes(), 2);
+  ASSERT_EQ(arc_derivs.Dim0(), dest.NumElements());
+  const Arc *src_arcs_data = src.values.Data(),
+            *dest_arcs_data = dest.values.Data();
+  const int32_t *row_splits1_data = arc_derivs.RowSplits(1).Data(),
+                *derivs_data = arc_derivs.values.Data();
+  for (int32_t i = 0; i < dest.NumElements(); ++i) {
+    double sum = 0.0;
+    for (int32_t j = row_splits1_data[i]; j < row_splits1_data[i + 1]; ++j) {
+      const Arc &src_arc = src_arcs_data[derivs_data[j]];
+      EXPECT_EQ(src_arc.label == -1, j + 1 == row_splits1_data[i + 1] &&
+                                         dest_arcs_data[i].label == -1);
+      sum += src_arc.score;
+    }
+    EXPECT_NEAR(sum, dest_arcs_data[i].score, 1.0e-03);
+  }
+}
+
+static void CheckDeterministic(FsaOrVec &dest) {
+  FsaVec sorted;
+  ArcSort(dest, &sorted);
+  int32_t p;
+  if (sorted.NumAxes() == 2) {
+    p = GetFsaBasicProperties(sorted);
+  } else {
+    Array1<int32_t> properties;
+    GetFsaVecBasicProperties(sorted, &properties, &p);
+  }
+  EXPECT_EQ(p & kFsaPropertiesArcSortedAndDeterministic,
+            kFsaPropertiesArcSortedAndDeterministic);
+}
+
+TEST(Determinize, DeterminizeDeviceSimple) {
+  for (auto &context : {GetCpuContext(), GetCudaContext()}) {
+    std::string s = R"(0 4 1 1
+    0 1 1 1
+    1 2 2 2
+    1 3 3 3
+    2 7 1 4
+    3 7 1 5
+    4 6 1 2
+    4 6 1 3
+    4 5 1 3
+    4 8 -1 2
+    5 8 -1 4
+    6 8 -1 3
+    7 8 -1 5
+    8
+    )";
+    Fsa fsa = FsaFromString(s).To(context);
+    Fsa dest;
+    Ragged<int32_t> arc_derivs;
+    DeterminizeDevice(fsa, kNoWeightPushing, &dest, &arc_derivs);
+    EXPECT_EQ(dest.NumAxes(), 2);
+    EXPECT_TRUE(dest.Context()->IsCompatible(*context));
+    CheckDeterministic(dest);
+    bool log_semiring = false;
+    fsa = fsa.To(GetCpuContext());
+    dest = dest.To(GetCpuContext());
+    EXPECT_TRUE(IsRandEquivalent(fsa, dest, log_semiring));
+    CheckArcDerivs(fsa, dest, arc_derivs);
+
+    // Should give the same number of states and arcs as the host version.
+    Fsa host_dest;
+    Determinize(fsa, kNoWeightPushing, &host_dest);
+    EXPECT_EQ(dest.TotSize(0), host_dest.TotSize(0));
+    EXPECT_EQ(dest.NumElements(), host_dest.NumElements());
+  }
+}
+
+TEST(Determinize, DeterminizeDeviceRandom) {
+  for (auto &context : {GetCpuContext(), GetCudaContext()}) {
+    for (auto weight_pushing_type :
+         {kNoWeightPushing, kTropicalWeightPushing, kLogWeightPushing}) {
+      int32_t min_num_fsas = 1;
+      int32_t max_num_fsas = 100;
+      bool acyclic = true;
+      // set max_symbol=10 so that we have a high probability
+      // to create non-deterministic Fsas.
+      int32_t max_symbol = 10;
+      int32_t min_num_arcs = 0;
+      int32_t max_num_arcs = 1000;
+      FsaVec fsas = RandomFsaVec(min_num_fsas, max_num_fsas, acyclic,
+                                 max_symbol, min_num_arcs, max_num_arcs);
+      FsaVec connected;
+      Connect(fsas, &connected);
+      connected = connected.To(context);
+
+      FsaVec dest;
+      Ragged<int32_t> arc_derivs;
+      DeterminizeDevice(connected, weight_pushing_type, &dest, &arc_derivs);
+      EXPECT_EQ(dest.NumAxes(), 3);
+      EXPECT_EQ(dest.Dim0(), connected.Dim0());
+      CheckDeterministic(dest);
+
+      bool log_semiring = false;
+      float beam = std::numeric_limits<float>::infinity();
+      connected = connected.To(GetCpuContext());
+      dest = dest.To(GetCpuContext());
+      EXPECT_TRUE(
+          IsRandEquivalent(connected, dest, log_semiring, beam, true, 0.01));
+      if (weight_pushing_type == kNoWeightPushing)
+        CheckArcDerivs(connected, dest, arc_derivs);
+
+      FsaVec host_dest;
+      Determinize(connected, weight_pushing_type, &host_dest);
+      EXPECT_EQ(dest.TotSize(1), host_dest.TotSize(1));
+      EXPECT_EQ(dest.NumElements(), host_dest.NumElements());
+    }
+  }
+}
+
+static Array1<double> BestPathScores(FsaVec &fsas) {
+  Ragged<int32_t> state_batches = GetStateBatches(fsas, true);
+  Array1<int32_t> dest_states = GetDestStates(fsas, true);
+  Ragged<int32_t> incoming_arcs = GetIncomingArcs(fsas, dest_states);
+  Ragged<int32_t> entering_arc_batches =
+      GetEnteringArcIndexBatches(fsas, incoming_arcs, state_batches);
+  Array1<double> forward_scores = GetForwardScores<double>(
+      fsas, state_batches, entering_arc_batches, false);
+  return GetTotScores(fsas, forward_scores).To(GetCpuContext());
+}
+
+TEST(Determinize, DeterminizePrunedInfiniteBeam) {
+  for (auto &context : {GetCpuContext(), GetCudaContext()}) {
+    FsaVec fsas = RandomFsaVec(1, 50, true, 10, 0, 500);
+    FsaVec connected;
+    Connect(fsas, &connected);
+    connected = connected.To(context);
+
+    FsaVec dest, ref_dest;
+    Ragged<int32_t> arc_derivs;
+    float beam = std::numeric_limits<float>::infinity();
+    DeterminizePruned(connected, kNoWeightPushing, beam, 0, &dest,
+                      &arc_derivs);
+    DeterminizeDevice(connected, kNoWeightPushing, &ref_dest);
+    EXPECT_EQ(dest.TotSize(1), ref_dest.TotSize(1));
+    EXPECT_EQ(dest.NumElements(), ref_dest.NumElements());
+    CheckArcDerivs(connected, dest, arc_derivs);
+  }
+}
+
+TEST(Determinize, DeterminizePrunedBeam) {
+  for (auto &context : {GetCpuContext(), GetCudaContext()}) {
+    for (auto weight_pushing_type :
+         {kNoWeightPushing, kTropicalWeightPushing, kLogWeightPushing}) {
+      FsaVec fsas = RandomFsaVec(1, 50, true, 10, 0, 1000);
+      FsaVec connected;
+      Connect(fsas, &connected);
+      connected = connected.To(context);
+
+      FsaVec dest;
+      Ragged<int32_t> arc_derivs;
+      float beam = 8.0;
+      DeterminizePruned(connected, weight_pushing_type, beam, 0, &dest,
+                        &arc_derivs);
+      EXPECT_EQ(dest.Dim0(), connected.Dim0());
+      CheckDeterministic(dest);
+
+      connected = connected.To(GetCpuContext());
+      dest = dest.To(GetCpuContext());
+      if (weight_pushing_type == kNoWeightPushing)
+        CheckArcDerivs(connected, dest, arc_derivs);
+
+      // Should give the same number of states and arcs as the host version.
+      // (IsRandEquivalent() can't be used, as pruning may remove labels.)
+      for (int32_t i = 0; i < connected.Dim0(); ++i) {
+        Fsa src = connected.Index(0, i), this_dest = dest.Index(0, i);
+        if (src.Dim0() == 0) continue;
+        k2host::Fsa host_fsa = FsaToHostFsa(src);
+        std::vector<double> forward_weights(src.Dim0()),
+            backward_weights(src.Dim0());
+        k2host::WfsaWithFbWeights wfsa(host_fsa, k2host::kMaxWeight,
+                                       forward_weights.data(),
+                                       backward_weights.data());
+        k2host::DeterminizerPrunedMax determinizer(wfsa, beam, -1,
+                                                   k2host::kNoWeight);
+        k2host::Array2Size<int32_t> fsa_size, arc_derivs_size;
+        determinizer.GetSizes(&fsa_size, &arc_derivs_size);
+        EXPECT_EQ(this_dest.Dim0(), fsa_size.size1);
+        EXPECT_EQ(this_dest.NumElements(), fsa_size.size2);
+      }
+    }
+  }
+}
+
+TEST(Determinize, DeterminizePrunedMaxStates) {
+  for (auto &context : {GetCpuContext(), GetCudaContext()}) {
+    FsaVec fsas = RandomFsaVec(1, 50, true, 10, 0, 1000);
+    FsaVec connected;
+    Connect(fsas, &connected);
+    connected = connected.To(context);
+
+    FsaVec dest;
+    Ragged<int32_t> arc_derivs;
+    float beam = std::numeric_limits<float>::infinity();
+    int32_t max_states = 5;
+    DeterminizePruned(connected, kNoWeightPushing, beam, max_states, &dest,
+                      &arc_derivs);
+    EXPECT_EQ(dest.Dim0(), connected.Dim0());
+    CheckDeterministic(dest);
+
+    // The best path is kept if it has fewer than max_states arcs.
+    FsaVec sorted_dest;
+    TopSort(dest, &sorted_dest);
+    Array1<double> scores = BestPathScores(sorted_dest),
+                   ref_scores = BestPathScores(connected);
+    Array1<int32_t> entering_arcs;
+    {
+      Ragged<int32_t> state_batches = GetStateBatches(connected, true);
+      Array1<int32_t> dest_states = GetDestStates(connected, true);
+      Ragged<int32_t> incoming_arcs = GetIncomingArcs(connected, dest_states);
+      Ragged<int32_t> entering_arc_batches =
+          GetEnteringArcIndexBatches(connected, incoming_arcs, state_batches);
+      GetForwardScores<double>(connected, state_batches, entering_arc_batches,
+                               false, &entering_arcs);
+    }
+    Ragged<int32_t> best_paths =
+        ShortestPath(connected, entering_arcs).To(GetCpuContext());
+    dest = dest.To(GetCpuContext());
+    const int32_t *dest_row_splits1_data = dest.RowSplits(1).Data(),
+                  *best_paths_row_splits1_data = best_paths.RowSplits(1).Data();
+    for (int32_t i = 0; i < dest.Dim0(); ++i) {
+      EXPECT_LE(dest_row_splits1_data[i + 1] - dest_row_splits1_data[i],
+                max_states);
+      if (ref_scores[i] == -std::numeric_limits<double>::infinity())
+        EXPECT_EQ(scores[i], ref_scores[i]);
+      else if (best_paths_row_splits1_data[i + 1] -
+                   best_paths_row_splits1_data[i] <
+               max_states)
+        EXPECT_NEAR(scores[i], ref_scores[i], 1.0e-03);
+      else
+        EXPECT_LE(scores[i], ref_scores[i] + 1.0e-03);
+    }
+    connected = connected.To(GetCpuContext());
+    CheckArcDerivs(connected, dest, arc_derivs);
+  }
+}
+
+}  // namespace k2
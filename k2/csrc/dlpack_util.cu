@@ -0,0 +1,189 @@
+/**
+ * Copyright      2026  Xiaomi Corporation
+ *
+ * See LICENSE for clarification regarding multiple authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <limits>
+#include <memory>
+#include <vector>
+
+#include "k2/csrc/dlpack_util.h"
+
+namespace k2 {
+
+namespace {
+
+Dtype DtypeFromDLPack(const DLDataType &type) {
+  K2_CHECK_EQ(type.lanes, 1) << "Vector types are not supported";
+  switch (type.code) {
+    case kDLInt:
+      switch (type.bits) {
+        case 8: return kInt8Dtype;
+        case 16: return kInt16Dtype;
+        case 32: return kInt32Dtype;
+        case 64: return kInt64Dtype;
+      }
+      break;
+    case kDLUInt:
+      switch (type.bits) {
+        case 8: return kUint8Dtype;
+        case 16: return kUint16Dtype;
+        case 32: return kUint32Dtype;
+        case 64: return kUint64Dtype;
+      }
+      break;
+    case kDLFloat:
+      switch (type.bits) {
+        case 16: return kHalfDtype;
+        case 32: return kFloatDtype;
+        case 64: return kDoubleDtype;
+      }
+      break;
+  }
+  K2_LOG(FATAL) << "Unsupported DLPack dtype: code "
+                << static_cast<int32_t>(type.code) << ", bits "
+                << static_cast<int32_t>(type.bits);
+  return kAnyDtype;  // unreachable code
+}
+
+DLDataType DtypeToDLPack(Dtype dtype) {
+  DLDataType ans;
+  ans.lanes = 1;
+  ans.bits = TraitsOf(dtype).NumBytes() * 8;
+  switch (TraitsOf(dtype).GetBaseType()) {
+    case kFloatBase:
+      ans.code = kDLFloat;
+      break;
+    case kIntBase:
+      ans.code = kDLInt;
+      break;
+    case kUintBase:
+      ans.code = kDLUInt;
+      break;
+    default:
+      K2_LOG(FATAL) << "Unsupported dtype: " << TraitsOf(dtype).Name();
+  }
+  return ans;
+}
+
+void DeleteDLManagedTensor(void *p) {
+  auto *managed = reinterpret_cast<DLManagedTensor *>(p);
+  if (managed->deleter != nullptr) managed->deleter(managed);
+}
+
+// Owns what a DLManagedTensor returned by ToDLPack() points to.
+struct DLPackHolder {
+  Tensor tensor;  // keeps the Region alive
+  std::vector<int64_t> shape;
+  std::vector<int64_t> strides;
+  DLManagedTensor managed;
+
+  explicit DLPackHolder(const Tensor &t) : tensor(t) {}
+};
+
+void DeleteDLPackHolder(DLManagedTensor *self) {
+  delete reinterpret_cast<DLPackHolder *>(self->manager_ctx);
+}
+
+}  // namespace
+
+Tensor FromDLPack(DLManagedTensor *managed) {
+  NVTX_RANGE(K2_FUNC);
+  K2_CHECK_NE(managed, nullptr);
+  const DLTensor &t = managed->dl_tensor;
+
+  ContextPtr c;
+  switch (t.ctx.device_type) {
+    case kDLCPU:
+    case kDLCPUPinned:
+      c = GetCpuContext();
+      break;
+    case kDLGPU:
+      c = GetCudaContext(t.ctx.device_id);
+      break;
+    default:
+      K2_LOG(FATAL) << "Unsupported DLPack device type: "
+                    << static_cast<int32_t>(t.ctx.device_type)
+                    << "\nOnly CPU and CUDA are supported";
+  }
+  Dtype dtype = DtypeFromDLPack(t.dtype);
+
+  std::vector<int32_t> dims(t.ndim), strides(t.ndim);
+  int32_t stride = 1;
+  for (int32_t i = t.ndim - 1; i >= 0; --i) {
+    K2_CHECK_GE(t.shape[i], 0);
+    K2_CHECK_LE(t.shape[i], std::numeric_limits<int32_t>::max());
+    dims[i] = static_cast<int32_t>(t.shape[i]);
+    // A NULL `strides` means the tensor is compact and row-major.
+    if (t.strides != nullptr) {
+      K2_CHECK_GE(t.strides[i], 0) << "Negative strides are not supported";
+      K2_CHECK_LE(t.strides[i], std::numeric_limits<int32_t>::max());
+      strides[i] = static_cast<int32_t>(t.strides[i]);
+    } else {
+      strides[i] = stride;
+      stride *= dims[i];
+    }
+  }
+  Shape shape(dims, strides);
+
+  auto region = std::make_shared<Region>();
+  region->context = c;
+  region->data = t.data;
+  region->deleter_context = managed;
+  region->external_deleter = DeleteDLManagedTensor;
+  int64_t begin_elem, end_elem;
+  shape.GetReachableElems(&begin_elem, &end_elem);
+  region->num_bytes = t.byte_offset + end_elem * TraitsOf(dtype).NumBytes();
+  region->bytes_used = region->num_bytes;
+  return Tensor(dtype, shape, region, t.byte_offset);
+}
+
+DLManagedTensor *ToDLPack(const Tensor &tensor) {
+  NVTX_RANGE(K2_FUNC);
+  std::unique_ptr<DLPackHolder> holder(new DLPackHolder(tensor));
+  int32_t num_axes = tensor.NumAxes();
+  for (int32_t i = 0; i != num_axes; ++i) {
+    holder->shape.push_back(tensor.Dim(i));
+    holder->strides.push_back(tensor.Stride(i));
+  }
+
+  DLTensor &t = holder->managed.dl_tensor;
+  ContextPtr &c = tensor.GetRegion()->context;
+  switch (c->GetDeviceType()) {
+    case kCpu:
+      t.ctx.device_type = kDLCPU;
+      t.ctx.device_id = 0;
+      break;
+    case kCuda:
+      t.ctx.device_type = kDLGPU;
+      t.ctx.device_id = c->GetDeviceId();
+      break;
+    default:
+      K2_LOG(FATAL) << "Unsupported device type: " << c->GetDeviceType();
+  }
+  t.data = tensor.GetRegion()->data;
+  t.byte_offset = tensor.ByteOffset();
+  t.ndim = num_axes;
+  t.dtype = DtypeToDLPack(tensor.GetDtype());
+  t.shape = holder->shape.data();
+  t.strides = holder->strides.data();
+
+  holder->managed.manager_ctx = holder.get();
+  holder->managed.deleter = DeleteDLPackHolder;
+  return &holder.release()->managed;
+}
+
+}  // namespace k2
@@ -0,0 +1,106 @@
+/**
+ * Copyright      2026  Xiaomi Corporation
+ *
+ * See LICENSE for clarification regarding multiple authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef K2_CSRC_DLPACK_UTIL_H_
+#define K2_CSRC_DLPACK_UTIL_H_
+
+#include "k2/csrc/array.h"
+#include "k2/csrc/ragged.h"
+#include "k2/csrc/ragged_ops.h"
+#include "k2/csrc/tensor.h"
+// The DLPack header vendored for the host bindings; its structs have the
+// same layout as those of later DLPack versions (DLContext was renamed to
+// DLDevice and kDLGPU to kDLCUDA), so it interoperates with them.
+#include "k2/python/host/csrc/dlpack.h"
+
+/*
+  Zero-copy conversion between k2 arrays and DLPack tensors, for use with
+  frameworks other than PyTorch (e.g. JAX, TensorRT, CuPy).  Unlike the
+  functions in torch_util.h, these do not depend on PyTorch.
+*/
+
+namespace k2 {
+
+/* Convert a DLPack tensor to a k2 Tensor that shares its memory.
+
+     @param [in] managed  The DLPack tensor.  This function takes ownership of
+                   it: its deleter is called (and the memory released by its
+                   producer) when the last k2 object that refers to the memory
+                   is destroyed.  Its device must be CPU, CPU-pinned or CUDA
+                   and its dtype one that k2 supports; its dims must fit in
+                   int32_t and its strides must be non-negative.
+     @return  Returns a Tensor with the same dtype, dims and strides as
+              `managed`.
+ */
+Tensor FromDLPack(DLManagedTensor *managed);
+
+/* Convert a k2 Tensor to a DLPack tensor that shares its memory.
+
+     @param [in] tensor  The tensor to convert.
+     @return  Returns a newly allocated DLPack tensor that holds a reference
+              to the memory of `tensor`.  The consumer must call its deleter
+              when it is done with it.
+ */
+DLManagedTensor *ToDLPack(const Tensor &tensor);
+
+/* Convert a 1-D DLPack tensor to an Array1, sharing its memory if it is
+   contiguous (else the data is copied).  Takes ownership of `managed`; see
+   FromDLPack(). */
+template <typename T>
+Array1<T> Array1FromDLPack(DLManagedTensor *managed) {
+  Tensor tensor = FromDLPack(managed);
+  K2_CHECK_EQ(tensor.NumAxes(), 1);
+  K2_CHECK_EQ(tensor.GetDtype(), DtypeOf<T>::dtype);
+  return Array1<T>(tensor);
+}
+
+/* Convert a 2-D DLPack tensor to an Array2, sharing its memory if its
+   second axis has unit stride (else the data is copied).  Takes ownership
+   of `managed`; see FromDLPack(). */
+template <typename T>
+Array2<T> Array2FromDLPack(DLManagedTensor *managed) {
+  Tensor tensor = FromDLPack(managed);
+  K2_CHECK_EQ(tensor.GetDtype(), DtypeOf<T>::dtype);
+  return Array2<T>(tensor);
+}
+
+template <typename T>
+DLManagedTensor *Array1ToDLPack(const Array1<T> &array) {
+  return ToDLPack(array.ToTensor());
+}
+
+template <typename T>
+DLManagedTensor *Array2ToDLPack(Array2<T> &array) {
+  return ToDLPack(array.ToTensor());
+}
+
+/* Construct a ragged tensor with 2 axes from DLPack tensors with its row
+   splits and values, sharing their memory.  Takes ownership of both; see
+   FromDLPack().  (The components of an existing RaggedShape can be exported
+   with Array1ToDLPack(shape.RowSplits(axis)) and so on.) */
+template <typename T>
+Ragged<T> Ragged2FromDLPack(DLManagedTensor *row_splits,
+                            DLManagedTensor *values) {
+  Array1<int32_t> splits = Array1FromDLPack<int32_t>(row_splits);
+  Array1<T> vals = Array1FromDLPack<T>(values);
+  return Ragged<T>(RaggedShape2(&splits, nullptr, vals.Dim()), vals);
+}
+
+}  // namespace k2
+
+#endif  // K2_CSRC_DLPACK_UTIL_H_
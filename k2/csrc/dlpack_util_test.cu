@@ -0,0 +1,143 @@
+/**
+ * Copyright      2026  Xiaomi Corporation
+ *
+ * See LICENSE for clarification regarding multiple authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <gtest/gtest.h>
+
+#include <vector>
+
+#include "k2/csrc/array_ops.h"
+#include "k2/csrc/dlpack_util.h"
+#include "k2/csrc/test_utils.h"
+
+namespace k2 {
+
+namespace {
+
+// A DLPack tensor produced by "another framework", which owns `data`.
+struct ForeignTensor {
+  std::vector<int32_t> data;
+  int64_t shape[2];
+  DLManagedTensor managed;
+  bool *deleted;
+};
+
+void DeleteForeignTensor(DLManagedTensor *self) {
+  auto *foreign = reinterpret_cast<ForeignTensor *>(self->manager_ctx);
+  *foreign->deleted = true;
+  delete foreign;
+}
+
+DLManagedTensor *NewForeignTensor(const std::vector<int32_t> &data,
+                                  int32_t dim0, int32_t dim1, bool *deleted) {
+  auto *foreign = new ForeignTensor;
+  foreign->data = data;
+  foreign->shape[0] = dim0;
+  foreign->shape[1] = dim1;
+  foreign->deleted = deleted;
+  DLTensor &t = foreign->managed.dl_tensor;
+  t.data = foreign->data.data();
+  t.ctx.device_type = kDLCPU;
+  t.ctx.device_id = 0;
+  t.ndim = (dim1 < 0 ? 1 : 2);
+  t.dtype.code = kDLInt;
+  t.dtype.bits = 32;
+  t.dtype.lanes = 1;
+  t.shape = foreign->shape;
+  t.strides = nullptr;
+  t.byte_offset = 0;
+  foreign->managed.manager_ctx = foreign;
+  foreign->managed.deleter = DeleteForeignTensor;
+  return &foreign->managed;
+}
+
+}  // namespace
+
+TEST(DLPackUtilTest, FromDLPack) {
+  bool deleted = false;
+  {
+    DLManagedTensor *managed =
+        NewForeignTensor({1, 2, 3, 4, 5, 6}, 6, -1, &deleted);
+    const void *data = managed->dl_tensor.data;
+    Array1<int32_t> a = Array1FromDLPack<int32_t>(managed);
+    EXPECT_EQ(a.Data(), data);  // no copy
+    CheckArrayData(a, std::vector<int32_t>{1, 2, 3, 4, 5, 6});
+
+    Array1<int32_t> b = a.Arange(2, 5);
+    a = Array1<int32_t>();
+    EXPECT_FALSE(deleted);  // `b` still refers to the memory
+    CheckArrayData(b, std::vector<int32_t>{3, 4, 5});
+  }
+  EXPECT_TRUE(deleted);
+
+  deleted = false;
+  {
+    Array2<int32_t> a = Array2FromDLPack<int32_t>(
+        NewForeignTensor({1, 2, 3, 4, 5, 6}, 2, 3, &deleted));
+    EXPECT_EQ(a.Dim0(), 2);
+    EXPECT_EQ(a.Dim1(), 3);
+    EXPECT_EQ(a.ElemStride0(), 3);
+    CheckArrayData(a.Row(1), std::vector<int32_t>{4, 5, 6});
+  }
+  EXPECT_TRUE(deleted);
+
+  deleted = false;
+  {
+    bool values_deleted = false;
+    Ragged<int32_t> r = Ragged2FromDLPack<int32_t>(
+        NewForeignTensor({0, 2, 2, 3}, 4, -1, &deleted),
+        NewForeignTensor({10, 11, 12}, 3, -1, &values_deleted));
+    EXPECT_TRUE(Equal(r, Ragged<int32_t>("[ [ 10 11 ] [ ] [ 12 ] ]")));
+    r = Ragged<int32_t>();
+    EXPECT_TRUE(values_deleted);
+  }
+  EXPECT_TRUE(deleted);
+}
+
+TEST(DLPackUtilTest, ToDLPack) {
+  for (auto &c : {GetCpuContext(), GetCudaContext()}) {
+    Array2<float> a(c, 3, 4);
+    Array2<float> b = a.ColArange(1, 3);
+    DLManagedTensor *managed = Array2ToDLPack(b);
+    const DLTensor &t = managed->dl_tensor;
+    EXPECT_EQ(t.dtype.code, kDLFloat);
+    EXPECT_EQ(t.dtype.bits, 32);
+    EXPECT_EQ(t.ndim, 2);
+    EXPECT_EQ(t.shape[0], 3);
+    EXPECT_EQ(t.shape[1], 2);
+    EXPECT_EQ(t.strides[0], 4);
+    EXPECT_EQ(t.strides[1], 1);
+    EXPECT_EQ(t.ctx.device_type,
+              c->GetDeviceType() == kCpu ? kDLCPU : kDLGPU);
+    EXPECT_EQ(reinterpret_cast<char *>(t.data) + t.byte_offset,
+              reinterpret_cast<char *>(b.Data()));
+
+    // Round trip: shares the memory.
+    Array2<float> b2 = Array2FromDLPack<float>(managed);
+    EXPECT_EQ(b2.Data(), b.Data());
+    EXPECT_EQ(b2.ElemStride0(), 4);
+    EXPECT_TRUE(b2.Context()->IsCompatible(*c));
+
+    Array1<int32_t> row_splits(c, "[ 0 2 2 5 ]");
+    Array1<int32_t> row_splits2 =
+        Array1FromDLPack<int32_t>(Array1ToDLPack(row_splits));
+    EXPECT_EQ(row_splits2.Data(), row_splits.Data());
+    EXPECT_TRUE(Equal(row_splits, row_splits2));
+  }
+}
+
+}  // namespace k2
@@ -22,6 +22,7 @@
 
 #include <algorithm>
 #include <cassert>
+#include <limits>
 #include <map>
 #include <memory>
 #include <ostream>
@@ -34,6 +35,7 @@
 
 #include "k2/csrc/context.h"
 #include "k2/csrc/log.h"
+#include "k2/csrc/thread_pool.h"
 
 namespace k2 {
 
@@ -46,6 +48,17 @@ __global__ void eval_lambda(int32_t n, LambdaT lambda) {
   }
 }
 
+template <typename LambdaT1, typename LambdaT2>
+__global__ void eval_lambda_fused(int32_t n1, LambdaT1 lambda1, int32_t n2,
+                                  LambdaT2 lambda2) {
+  int32_t i = (blockIdx.y * gridDim.x + blockIdx.x) * blockDim.x + threadIdx.x;
+  if (i < n1) {
+    lambda1(i);
+  } else if (i - n1 < n2) {
+    lambda2(i - n1);
+  }
+}
+
 template <typename T, typename LambdaT>
 __global__ void set_data_with_lambda(T *data, int32_t n, LambdaT lambda) {
   int32_t i = blockIdx.x * blockDim.x + threadIdx.x;
@@ -85,18 +98,52 @@ __host__ __device__ __forceinline__ int32_t NumBlocks(int32_t size,
   return (size + block_size - 1) / block_size;
 }
 
+/* Evaluates lambda(i) for 0 <= i < n on the CPU.  Large loops are split into
+   chunks that run in parallel with ParallelFor() if SetNumCpuThreads() was
+   called; see SetCpuEvalConfig().  The lambdas are written for the GPU, so
+   they do not depend on the order in which the i's are processed.
+ */
+template <typename LambdaT>
+void EvalCpu(int32_t n, LambdaT &lambda) {
+  int32_t grain;
+  if (!UseParallelCpuEval(n, &grain)) {
+    for (int32_t i = 0; i < n; ++i) lambda(i);
+    return;
+  }
+  ParallelFor(0, NumBlocks(n, grain), [n, grain, &lambda](int32_t c) {
+    int32_t end = std::min<int32_t>(n, (c + 1) * grain);
+    for (int32_t i = c * grain; i < end; ++i) lambda(i);
+  });
+}
+
+/* Evaluates lambda(i, j) for 0 <= i < m and 0 <= j < n on the CPU; like
+   EvalCpu(), but the chunks are ranges of i.
+ */
+template <typename LambdaT>
+void Eval2Cpu(int32_t m, int32_t n, LambdaT &lambda) {
+  int32_t grain;
+  if (!UseParallelCpuEval(static_cast<int64_t>(m) * n, &grain)) {
+    for (int32_t i = 0; i < m; ++i)
+      for (int32_t j = 0; j < n; ++j) lambda(i, j);
+    return;
+  }
+  int32_t rows_per_chunk = std::max<int32_t>(1, grain / n);
+  ParallelFor(0, NumBlocks(m, rows_per_chunk),
+              [m, n, rows_per_chunk, &lambda](int32_t c) {
+                int32_t end = std::min<int32_t>(m, (c + 1) * rows_per_chunk);
+                for (int32_t i = c * rows_per_chunk; i < end; ++i)
+                  for (int32_t j = 0; j < n; ++j) lambda(i, j);
+              });
+}
+
 /* Eval() will evaluate lambda(i) for 0 <= i < n, on the appropriate
    device (CPU or GPU). */
 template <typename LambdaT>
 void Eval(cudaStream_t stream, int32_t n, LambdaT &lambda) {
-  NVTX_RANGE(K2_FUNC);
+  NVTX_RANGE_NO_OP_STATS(K2_FUNC);
   if (n <= 0) return;  // actually it would be an error if n < 0.
   if (stream == kCudaStreamInvalid) {
-    // TODO: if n is very large, we'll eventually support running this with
-    // multiple threads.
-    for (int32_t i = 0; i < n; ++i) {
-      lambda(i);
-    }
+    EvalCpu(n, lambda);
   } else {
     const int32_t block_size = 256;
     int32_t tot_grid_size = NumBlocks(n, block_size);
@@ -107,6 +154,7 @@ void Eval(cudaStream_t stream, int32_t n, LambdaT &lambda) {
     dim3 grid_dim(x_grid_size, y_grid_size, 1), block_dim(block_size, 1, 1);
     K2_CUDA_SAFE_CALL(eval_lambda<LambdaT>
                       <<<grid_dim, block_dim, 0, stream>>>(n, lambda));
+    OpStatsKernelLaunch();
   }
 }
 
@@ -146,6 +194,7 @@ void EvalDevice(cudaStream_t stream, int32_t n, LambdaT &lambda) {
 
   K2_CUDA_SAFE_CALL(eval_lambda<LambdaT>
                     <<<grid_dim, block_dim, 0, stream>>>(n, lambda));
+  OpStatsKernelLaunch();
 }
 
 // like Eval() but works only for device.
@@ -156,23 +205,73 @@ void EvalDevice(ContextPtrType c, int32_t n, LambdaT &lambda) {
   EvalDevice(c->GetCudaStream(), n, lambda);
 }
 
+/*
+  EvalFused() will evaluate lambda1(i) for 0 <= i < n1 and lambda2(j) for
+  0 <= j < n2, on the appropriate device (CPU or GPU).  On GPU this is done
+  with one kernel launch instead of two, which matters when n1 and n2 are
+  small (e.g. loops over the FSAs of a minibatch) and the launch overhead
+  dominates.
+
+  CAUTION: there is no ordering between the two lambdas (even on CPU you
+  should not rely on lambda1 finishing first), so they must not depend on
+  each other's output.  They must be __host__ __device__ lambdas, e.g.:
+
+    auto lambda_foo = [=] __host__ __device__(int32_t i) -> void { ... };
+    auto lambda_bar = [=] __host__ __device__(int32_t i) -> void { ... };
+    EvalFused(c, num_fsas, lambda_foo, num_states, lambda_bar);
+ */
+template <typename LambdaT1, typename LambdaT2>
+void EvalFused(cudaStream_t stream, int32_t n1, LambdaT1 &lambda1, int32_t n2,
+               LambdaT2 &lambda2) {
+  NVTX_RANGE_NO_OP_STATS(K2_FUNC);
+  if (n1 < 0) n1 = 0;  // actually it would be an error if n1 < 0.
+  if (n2 < 0) n2 = 0;
+  if (stream == kCudaStreamInvalid) {
+    EvalCpu(n1, lambda1);
+    EvalCpu(n2, lambda2);
+  } else {
+    int64_t n = static_cast<int64_t>(n1) + n2;
+    if (n == 0) return;
+    K2_CHECK_LE(n, std::numeric_limits<int32_t>::max());
+    const int32_t block_size = 256;
+    int32_t tot_grid_size = NumBlocks(static_cast<int32_t>(n), block_size);
+    int32_t x_grid_size = (tot_grid_size < (1 << 20) ?
+                           std::min<int32_t>(tot_grid_size, (1 << 10)) :
+                           32768),
+        y_grid_size = NumBlocks(tot_grid_size, x_grid_size);
+    dim3 grid_dim(x_grid_size, y_grid_size, 1), block_dim(block_size, 1, 1);
+    K2_CUDA_SAFE_CALL(eval_lambda_fused<LambdaT1, LambdaT2>
+                      <<<grid_dim, block_dim, 0, stream>>>(n1, lambda1, n2,
+                                                           lambda2));
+    OpStatsKernelLaunch();
+  }
+}
+
+template <typename ContextPtrType,  // Context*  or ContextPtr ==
+                                    // std::shared_ptr<Context>
+          typename LambdaT1, typename LambdaT2>
+void EvalFused(ContextPtrType c, int32_t n1, LambdaT1 &lambda1, int32_t n2,
+               LambdaT2 &lambda2) {
+  EvalFused(c->GetCudaStream(), n1, lambda1, n2, lambda2);
+}
+
 /* SetData() will do `data[i] = lambda(i)` for 0 <= i < n, on the appropriate
    device (CPU or GPU) */
 template <typename T, typename LambdaT>
 void SetData(cudaStream_t stream, T *data, int32_t n, LambdaT &lambda) {
-  NVTX_RANGE(K2_FUNC);
+  NVTX_RANGE_NO_OP_STATS(K2_FUNC);
   if (n <= 0) return;  // actually it would be an error if n < 0.
   if (stream == kCudaStreamInvalid) {
-    // TODO: if n is very large, we'll eventually support running this with
-    // multiple threads.
-    for (int32_t i = 0; i < n; ++i) {
+    auto lambda_set_data = [data, &lambda](int32_t i) -> void {
       data[i] = lambda(i);
-    }
+    };
+    EvalCpu(n, lambda_set_data);
   } else {
     int32_t block_size = 256;
     int32_t grid_size = NumBlocks(n, block_size);
     K2_CUDA_SAFE_CALL(set_data_with_lambda<T, LambdaT>
                       <<<grid_size, block_size, 0, stream>>>(data, n, lambda));
+    OpStatsKernelLaunch();
   }
 }
 
@@ -194,21 +293,16 @@ void SetData(ContextPtrType c, T *data, int32_t n, LambdaT &lambda) {
 */
 template <typename LambdaT>
 void Eval2(cudaStream_t stream, int32_t m, int32_t n, LambdaT &lambda) {
-  NVTX_RANGE(K2_FUNC);
+  NVTX_RANGE_NO_OP_STATS(K2_FUNC);
   if (m <= 0 || n <= 0)
     return;  // actually it would be an error if m < 0 or n < 0.
   if (stream == kCudaStreamInvalid) {
-    // TODO: if n is very large, we'll eventually support running this with
-    // multiple threads.
-    for (int32_t i = 0; i < m; ++i) {
-      for (int32_t j = 0; j < n; ++j) {
-        lambda(i, j);
-      }
-    }
+    Eval2Cpu(m, n, lambda);
   } else {
     dim3 block_dim, grid_dim;
     Lambda2KernelType kernel_type;
     GetBlockSizesForLambda2(m, n, &block_dim, &grid_dim, &kernel_type);
+    OpStatsKernelLaunch();
     switch (kernel_type) {
       case Lambda2KernelType::Simple:
         K2_CUDA_SAFE_CALL(
@@ -245,13 +339,14 @@ void Eval2(cudaStream_t stream, int32_t m, int32_t n, LambdaT &lambda) {
  */
 template <typename LambdaT>
 void Eval2Device(cudaStream_t stream, int32_t m, int32_t n, LambdaT &lambda) {
-  NVTX_RANGE(K2_FUNC);
+  NVTX_RANGE_NO_OP_STATS(K2_FUNC);
   if (m <= 0 || n <= 0)
     return;  // actually it would be an error if m < 0 or n < 0.
   K2_DCHECK(stream != kCudaStreamInvalid);
   dim3 block_dim, grid_dim;
   Lambda2KernelType kernel_type;
   GetBlockSizesForLambda2(m, n, &block_dim, &grid_dim, &kernel_type);
+  OpStatsKernelLaunch();
   switch (kernel_type) {
     case Lambda2KernelType::Simple:
       K2_CUDA_SAFE_CALL(
@@ -339,7 +434,7 @@ __global__ void eval_lambda_group(int32_t n, LambdaT lambda) {
  */
 template <unsigned int ThreadsPerGroup, typename ThreadGroupDataT, typename LambdaT>
 void EvalGroupDevice(cudaStream_t stream, int32_t n, LambdaT &lambda) {
-  NVTX_RANGE(K2_FUNC);
+  NVTX_RANGE_NO_OP_STATS(K2_FUNC);
   if (n <= 0) return;  // actually it would be an error if n < 0.
 
   K2_CHECK(stream != kCudaStreamInvalid);
@@ -88,6 +88,7 @@ enum FakedEnum {
   cudaMemcpyHostToDevice = -1,
   cudaMemcpyDeviceToDevice = -1,
   cudaEventDisableTiming = -1,
+  cudaStreamNonBlocking = -1,
 };
 
 using cudaMemcpyKind = FakedEnum;
@@ -164,6 +165,12 @@ inline cudaError_t cudaStreamCreate(cudaStream_t *pStream) {
   return 0;
 }
 
+inline cudaError_t cudaStreamCreateWithFlags(cudaStream_t *pStream,
+                                             unsigned int flags) {
+  K2_NIY;
+  return 0;
+}
+
 inline cudaError_t cudaStreamSynchronize(cudaStream_t stream) {
   K2_NIY;
   return 0;
@@ -171,8 +178,8 @@ inline cudaError_t cudaStreamSynchronize(cudaStream_t stream) {
 
 template <typename ContextPtrType, typename T>
 void SegmentedExclusiveSum(ContextPtrType context, const T *d_in,
-                           int32_t num_elements, const uint32_t *d_iflags,
-                           T *d_out) {
+                           int32_t num_elements, const int32_t *row_splits,
+                           const int32_t *row_ids, T *d_out) {
   K2_NIY;
 }
 
@@ -186,6 +193,11 @@ inline cudaError_t cudaMallocHost(void **ptr, size_t size) {
   return 0;
 }
 
+inline cudaError_t cudaFreeHost(void *ptr) {
+  K2_NIY;
+  return 0;
+}
+
 }  // namespace k2
 
 namespace cub {
@@ -44,6 +44,7 @@ std::string FsaPropertiesAsString(int32_t properties) {
   if (properties & kFsaPropertiesEpsilonFree) os << kSep << "EpsilonFree";
   if (properties & kFsaPropertiesMaybeAccessible) os << kSep << "MaybeAccessible";  // NOLINT
   if (properties & kFsaPropertiesMaybeCoaccessible) os << kSep << "MaybeCoaccessible";  // NOLINT
+  if (properties & kFsaPropertiesLinear) os << kSep << "Linear";
   // clang-format on
 
   size_t offset = (os.str().empty() ? 0 : 1);  // remove leading '|'
@@ -51,13 +52,7 @@ std::string FsaPropertiesAsString(int32_t properties) {
   return std::string("\"") + std::string(os.str().c_str() + offset);
 }
 
-void GetFsaVecBasicProperties(FsaVec &fsa_vec, Array1<int32_t> *properties_out,
-                              int32_t *tot_properties_out) {
-  if (properties_out == nullptr) {
-    Array1<int32_t> properties_temp;
-    GetFsaVecBasicProperties(fsa_vec, &properties_temp, tot_properties_out);
-    return;
-  }
+Array1<int32_t> GetFsaVecBasicPropertiesOnDevice(FsaVec &fsa_vec) {
   NVTX_RANGE(K2_FUNC);
   if (fsa_vec.NumAxes() != 3) {
     K2_LOG(FATAL) << "Input has wrong num-axes " << fsa_vec.NumAxes()
@@ -71,12 +66,19 @@ void GetFsaVecBasicProperties(FsaVec &fsa_vec, Array1<int32_t> *properties_out,
   Arc *arcs_data = fsa_vec.values.Data();
 
   int32_t num_arcs = fsa_vec.values.Dim();
-
-  // properties per arc; these will be and-ed over all arcs.
-  Array1<int32_t> properties(c, num_arcs);
   int32_t num_states = fsa_vec.shape.RowIds(1).Dim(),
           num_fsas = fsa_vec.shape.Dim0();
 
+  // ans[i] for i < num_fsas is the properties of FSA i and ans[num_fsas] is
+  // their `and`.  The kernels below clear the bits of the properties that
+  // don't hold; as the `and` of the per-FSA properties has exactly the bits
+  // that no FSA had cleared, every bit that is cleared for an FSA is also
+  // cleared in ans[num_fsas].  A bit is only cleared atomically if it is
+  // still set, so there is little contention.
+  Array1<int32_t> ans(c, num_fsas + 1,
+                      static_cast<int32_t>(kFsaAllProperties));
+  int32_t *ans_data = ans.Data();
+
   // `reachable[idx01]` will be true if the state with index idx01 has an arc
   // entering it or is state 0 of its FSA, not counting self-loops; it's a
   // looser condition than being 'accessible' in FSA terminology, simply meaning
@@ -86,15 +88,8 @@ void GetFsaVecBasicProperties(FsaVec &fsa_vec, Array1<int32_t> *properties_out,
   // the final-state of its FSA (i.e. last-numbered) or has at least one arc
   // leaving it, not counting self-loops. Again, it's a looser condition than
   // being 'co-accessible' in FSA terminology.
-
-  Array1<char> reachable_mem(c, num_states * 2 + num_fsas * 2,
-                             static_cast<char>(0));
-
-  Array1<char> reachable = reachable_mem.Range(0, num_states);
-  Array1<char> co_reachable = reachable_mem.Range(num_states, num_states);
-
-  int32_t *properties_data = properties.Data();
-  char *reachable_data = reachable.Data();  // access co_reachable via this.
+  Array1<char> reachable(c, num_states * 2, static_cast<char>(0));
+  char *reachable_data = reachable.Data();
 
   K2_EVAL(
       c, num_arcs, lambda_get_properties, (int32_t idx012)->void {
@@ -116,6 +111,12 @@ void GetFsaVecBasicProperties(FsaVec &fsa_vec, Array1<int32_t> *properties_out,
             neg_property |= kFsaPropertiesTopSorted;
         }
         if (arc.label == 0) neg_property |= kFsaPropertiesEpsilonFree;
+        // Together with the number of arcs checked below, this makes every
+        // non-final state have exactly one arc, to the next state.
+        if (arc.src_state != idx1 || arc.dest_state != idx1 + 1 ||
+            arc.dest_state >= this_fsa_num_states ||
+            row_splits2_data[idx01 + 1] - idx01x != 1)
+          neg_property |= kFsaPropertiesLinear;
         if (arc.label < 0) {
           if (arc.label != -1) {  // neg. symbols != -1 are not allowed.
             neg_property |= kFsaPropertiesValid;
@@ -155,65 +156,53 @@ void GetFsaVecBasicProperties(FsaVec &fsa_vec, Array1<int32_t> *properties_out,
               arc.dest_state < prev_arc.dest_state)
             neg_property |= kFsaPropertiesArcSorted;
         }
-        properties_data[idx012] = ~neg_property;
+        if ((ans_data[idx0] & neg_property) != 0)
+          AtomicAnd(ans_data + idx0, ~neg_property);
+        if ((ans_data[num_fsas] & neg_property) != 0)
+          AtomicAnd(ans_data + num_fsas, ~neg_property);
       });
 
-  // Figure out the properties per FSA.
-  RaggedShape fsa_to_arcs_shape = RemoveAxis(fsa_vec.shape, 1),
-              fsa_to_states_shape = RemoveAxis(fsa_vec.shape, 2);
-  Ragged<int32_t> properties_ragged(fsa_to_arcs_shape, properties);
-  Ragged<char> reachable_ragged(fsa_to_states_shape, reachable),
-      co_reachable_ragged(fsa_to_states_shape, co_reachable);
-
-  Array1<int32_t> properties_per_fsa_mem(c, num_fsas + 1),
-      properties_per_fsa = properties_per_fsa_mem.Range(0, num_fsas),
-      properties_total = properties_per_fsa_mem.Range(num_fsas, 1);
-
-  Array1<char> reachable_per_fsa =
-                   reachable_mem.Range(num_states * 2, num_fsas),
-               co_reachable_per_fsa =
-                   reachable_mem.Range(num_states * 2 + num_fsas, num_fsas);
-  {
-    ParallelRunner pr(c);
-    {
-      With(pr.NewStream());
-      AndPerSublist(properties_ragged, static_cast<int32_t>(kFsaAllProperties),
-                    &properties_per_fsa);
-    }
-    {
-      With(pr.NewStream());
-      AndPerSublist(reachable_ragged, static_cast<char>(1), &reachable_per_fsa);
-    }
-    {
-      With(pr.NewStream());
-      AndPerSublist(co_reachable_ragged, static_cast<char>(1),
-                    &co_reachable_per_fsa);
-    }
-  }
+  // Indexes i < num_fsas check whether FSA i has arcs and, for
+  // kFsaPropertiesLinear, one arc per non-final state; the rest are the
+  // states.
+  K2_EVAL(
+      c, num_fsas + num_states, lambda_finalize_properties, (int32_t i)->void {
+        int32_t neg_property, idx0;
+        if (i < num_fsas) {
+          idx0 = i;
+          int32_t this_fsa_num_states =
+                      row_splits1_data[i + 1] - row_splits1_data[i],
+                  this_fsa_num_arcs =
+                      row_splits2_data[row_splits1_data[i + 1]] -
+                      row_splits2_data[row_splits1_data[i]];
+          neg_property = (this_fsa_num_arcs == 0) * kFsaPropertiesNonempty;
+          if (this_fsa_num_states != 0 &&
+              this_fsa_num_arcs != this_fsa_num_states - 1)
+            neg_property |= kFsaPropertiesLinear;
+        } else {
+          int32_t idx01 = i - num_fsas;
+          idx0 = row_ids1_data[idx01];
+          neg_property =
+              (!reachable_data[idx01] * kFsaPropertiesMaybeAccessible) |
+              (!reachable_data[num_states + idx01] *
+               kFsaPropertiesMaybeCoaccessible);
+        }
+        if ((ans_data[idx0] & neg_property) != 0)
+          AtomicAnd(ans_data + idx0, ~neg_property);
+        if ((ans_data[num_fsas] & neg_property) != 0)
+          AtomicAnd(ans_data + num_fsas, ~neg_property);
+      });
+  return ans;
+}
 
-  {
-    int32_t *properties_per_fsa_data = properties_per_fsa.Data();
-    char *reachable_per_fsa_data = reachable_per_fsa.Data(),
-         *co_reachable_per_fsa_data = co_reachable_per_fsa.Data();
-
-    K2_EVAL(
-        c, num_fsas, lambda_finalize_properties, (int32_t i)->void {
-          int32_t neg_properties = ~(properties_per_fsa_data[i]);
-          char reachable = reachable_per_fsa_data[i],
-               co_reachable = co_reachable_per_fsa_data[i];
-          int32_t fsa_has_no_arcs = (row_splits2_data[row_splits1_data[i]] ==
-                                     row_splits2_data[row_splits1_data[i + 1]]);
-          neg_properties |= (!reachable * kFsaPropertiesMaybeAccessible) |
-                            (!co_reachable * kFsaPropertiesMaybeCoaccessible) |
-                            (fsa_has_no_arcs * kFsaPropertiesNonempty);
-          properties_per_fsa_data[i] = ~neg_properties;
-        });
-
-    And(properties_per_fsa, static_cast<int32_t>(kFsaAllProperties),
-        &properties_total);
-    *tot_properties_out = properties_total[0];
-    *properties_out = properties_per_fsa;
-  }
+void GetFsaVecBasicProperties(FsaVec &fsa_vec, Array1<int32_t> *properties_out,
+                              int32_t *tot_properties_out) {
+  NVTX_RANGE(K2_FUNC);
+  Array1<int32_t> properties = GetFsaVecBasicPropertiesOnDevice(fsa_vec);
+  int32_t num_fsas = properties.Dim() - 1;
+  *tot_properties_out = properties[num_fsas];
+  if (properties_out != nullptr)
+    *properties_out = properties.Range(0, num_fsas);
 }
 
 FsaVec FsaToFsaVec(const Fsa &fsa) {
@@ -227,9 +216,8 @@ int32_t GetFsaBasicProperties(const Fsa &fsa) {
   NVTX_RANGE(K2_FUNC);
   if (fsa.NumAxes() != 2) return 0;
   FsaVec vec = FsaToFsaVec(fsa);
-  Array1<int32_t> properties;
   int32_t ans;
-  GetFsaVecBasicProperties(vec, &properties, &ans);
+  GetFsaVecBasicProperties(vec, nullptr, &ans);
   return ans;
 }
 
@@ -509,23 +497,121 @@ Tensor FsaVecToTensor(const FsaVec &fsa_vec) {
   return Cat(fsa_vec.Context(), 4, (const Array1<int32_t> **)arrays).ToTensor();
 }
 
+// Converts 16-bit scores on CPU to float, for printing.
+static Array2<float> HalfScoresToFloat(const Array2<int16_t> &src, bool bf16) {
+  int32_t num_rows = src.Dim0(), num_cols = src.Dim1();
+  Array2<float> ans(GetCpuContext(), num_rows, num_cols);
+  auto src_acc = src.Accessor();
+  auto ans_acc = ans.Accessor();
+  for (int32_t i = 0; i < num_rows; i++)
+    for (int32_t j = 0; j < num_cols; j++)
+      ans_acc(i, j) = bf16 ? Bf16ToFloat(src_acc(i, j))
+                           : HalfToFloat(src_acc(i, j));
+  return ans;
+}
+
 std::ostream &operator<<(std::ostream &os, const DenseFsaVec &dfsavec) {
   DenseFsaVec d_cpu = dfsavec.To(GetCpuContext());
+  if (d_cpu.IsHalf()) {
+    if (d_cpu.IsPadded())
+      d_cpu.padded_scores =
+          HalfScoresToFloat(d_cpu.padded_half_scores, d_cpu.bf16);
+    else
+      d_cpu.scores = HalfScoresToFloat(d_cpu.half_scores, d_cpu.bf16);
+  }
   int32_t num_fsas = d_cpu.shape.Dim0();
   const int32_t *row_splits = d_cpu.shape.RowSplits(1).Data();
   os << "DenseFsaVec{ ";
   for (int32_t i = 0; i < num_fsas; i++) {
     int32_t start = row_splits[i], end = row_splits[i + 1];
-    os << dfsavec.scores.RowArange(start, end);
+    if (d_cpu.IsSparse())
+      os << d_cpu.top_cols.RowArange(start, end)
+         << d_cpu.top_scores.RowArange(start, end)
+         << d_cpu.floor_scores.Arange(start, end);
+    else if (d_cpu.IsPadded())
+      os << d_cpu.padded_scores.RowArange(
+                d_cpu.padded_row_offsets[i],
+                d_cpu.padded_row_offsets[i] + end - start - 1);
+    else
+      os << d_cpu.scores.RowArange(start, end);
   }
   return os << " }";
 }
 
+DenseFsaVecScores DenseFsaVecScoresAccessor(const DenseFsaVec &dfsavec) {
+  DenseFsaVecScores ans;
+  ans.stride = dfsavec.ScoresStride();
+  ans.padded_data = nullptr;
+  ans.padded_stride = 0;
+  ans.row_ids1 = nullptr;
+  ans.row_splits1 = nullptr;
+  ans.padded_row_offsets = nullptr;
+  ans.half_data = nullptr;
+  ans.padded_half_data = nullptr;
+  ans.bf16 = dfsavec.bf16;
+  if (dfsavec.IsPadded()) {
+    ans.data = nullptr;
+    ans.k = 0;
+    ans.top_cols = nullptr;
+    ans.top_scores = nullptr;
+    ans.floor_scores = nullptr;
+    if (dfsavec.IsHalf()) {
+      ans.padded_half_data = dfsavec.padded_half_scores.Data();
+      ans.padded_stride = dfsavec.padded_half_scores.ElemStride0();
+    } else {
+      ans.padded_data = dfsavec.padded_scores.Data();
+      ans.padded_stride = dfsavec.padded_scores.ElemStride0();
+    }
+    ans.row_ids1 = dfsavec.shape.RowIds(1).Data();
+    ans.row_splits1 = dfsavec.shape.RowSplits(1).Data();
+    ans.padded_row_offsets = dfsavec.padded_row_offsets.Data();
+  } else if (dfsavec.IsSparse()) {
+    ans.data = nullptr;
+    ans.k = dfsavec.top_cols.Dim1();
+    // The rows of top_cols and top_scores are expected to be contiguous.
+    K2_CHECK_EQ(dfsavec.top_cols.ElemStride0(), ans.k);
+    K2_CHECK_EQ(dfsavec.top_scores.ElemStride0(), ans.k);
+    ans.top_cols = dfsavec.top_cols.Data();
+    ans.top_scores = dfsavec.top_scores.Data();
+    ans.floor_scores = dfsavec.floor_scores.Data();
+  } else {
+    ans.data = nullptr;
+    if (dfsavec.IsHalf())
+      ans.half_data = dfsavec.half_scores.Data();
+    else
+      ans.data = dfsavec.scores.Data();
+    ans.k = 0;
+    ans.top_cols = nullptr;
+    ans.top_scores = nullptr;
+    ans.floor_scores = nullptr;
+  }
+  return ans;
+}
+
 DenseFsaVec DenseFsaVec::operator[] (const Array1<int32_t> &indexes) {
   Array1<int32_t> elem_indexes;
   RaggedShape ans_shape = Index(this->shape, 0, indexes,
                                 &elem_indexes);
   bool allow_minus_one = false;
+  if (IsSparse()) {
+    return DenseFsaVec(
+        ans_shape, sparse_num_cols,
+        IndexRows(this->top_cols, elem_indexes, allow_minus_one),
+        IndexRows(this->top_scores, elem_indexes, allow_minus_one),
+        Index(this->floor_scores, elem_indexes, allow_minus_one, 0.0f));
+  }
+  if (IsPadded()) {
+    Array1<int32_t> ans_row_offsets =
+        Index(padded_row_offsets, indexes, allow_minus_one, 0);
+    if (IsHalf())
+      return DenseFsaVec(ans_shape, padded_half_scores, ans_row_offsets, bf16);
+    return DenseFsaVec(ans_shape, padded_scores, ans_row_offsets);
+  }
+  if (IsHalf()) {
+    return DenseFsaVec(
+        ans_shape, IndexRows(half_scores, elem_indexes, allow_minus_one),
+        bf16);
+  }
   Array2<float> ans_scores = IndexRows(this->scores, elem_indexes,
                                        allow_minus_one);
   return DenseFsaVec(ans_shape, ans_scores);
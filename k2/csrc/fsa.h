@@ -20,9 +20,11 @@
 #ifndef K2_CSRC_FSA_H_
 #define K2_CSRC_FSA_H_
 
+#include <limits>
 #include <ostream>
 #include <string>
 
+#include "k2/csrc/half.h"
 #include "k2/csrc/ragged.h"
 #include "k2/csrc/ragged_ops.h"
 
@@ -97,7 +99,11 @@ enum FsaBasicProperties {
       0x0100,  // True if there are no obvious signs of
                // states not being co-accessible, i.e.
                // i.e. states with no arcs leaving them
-  kFsaAllProperties = 0x01FF
+  kFsaPropertiesLinear = 0x0200,  // The FSA is a single path: every state
+                                  // but the final state has exactly one arc
+                                  // leaving it, to the next state.  Empty
+                                  // FSAs are linear too.
+  kFsaAllProperties = 0x03FF
 };
 
 /* Convert FSA properties to a string.
@@ -163,8 +169,68 @@ struct DenseFsaVec {
   // (It's the final-transition).
   Array2<float> scores;
 
-  // NOTE: our notion of "arc-index" / arc_idx is an index into scores.Data().
-  int32_t NumArcs() const { return scores.Dim0() * scores.Dim1(); }
+  // Optional sparse form of the scores, for large vocabularies where most
+  // columns of `scores` are (near) -infinity; see SparsifyDenseFsaVec() in
+  // fsa_utils.h.  If IsSparse(), `scores` is empty and, for row j, the
+  // columns top_cols(j, 0..k-1) have scores top_scores(j, 0..k-1); any other
+  // column c has score floor_scores[j] if c > 0 and -infinity if c == 0
+  // (the final-transition).  Only IntersectDense() and IntersectDensePruned()
+  // support the sparse form.
+  int32_t sparse_num_cols = 0;  // == num_symbols+1 if IsSparse()
+  Array2<int32_t> top_cols;     // [shape.NumElements()][k], k > 0
+  Array2<float> top_scores;     // [shape.NumElements()][k]
+  Array1<float> floor_scores;   // [shape.NumElements()]
+
+  bool IsSparse() const { return sparse_num_cols != 0; }
+
+  // Optional padded form, which reads the nnet output where it is instead of
+  // copying it into `scores`; see CreatePaddedDenseFsaVec() in
+  // k2/torch/csrc/dense_fsa_vec.h.  If IsPadded(), `scores` is empty, and
+  // row `padded_row_offsets[i] + t` of `padded_scores` holds the scores of
+  // symbols 0, 1, ... for frame t of FSA i, i.e. of row
+  // `shape.RowSplits(1)[i] + t` and columns 1, 2, ... of the notional
+  // `scores`.  The rest of the notional `scores` is synthesized: the last
+  // row of each FSA is (0, -inf, -inf, ...), and column 0 of any other row
+  // is -infinity.
+  Array2<float> padded_scores;         // e.g. log_probs.reshape(N*T, C)
+  Array1<int32_t> padded_row_offsets;  // [shape.Dim0()]
+
+  // Optional 16-bit storage of `scores` or `padded_scores`, for nnet output
+  // in half precision; the scores are converted to float when they are read
+  // (see half.h), so the memory traffic is halved.  If `half_scores` is set,
+  // `scores` is empty; if `padded_half_scores` is set, `padded_scores` is
+  // empty.  They hold the bit patterns of fp16 numbers, or of bfloat16 ones
+  // if `bf16` is true.  Only IntersectDense(), IntersectDensePruned() and
+  // functions that read the scores through DenseFsaVecScoresAccessor()
+  // support them.
+  Array2<int16_t> half_scores;
+  Array2<int16_t> padded_half_scores;
+  bool bf16 = false;
+
+  bool IsPadded() const {
+    return padded_scores.Dim1() != 0 || padded_half_scores.Dim1() != 0;
+  }
+  bool IsHalf() const {
+    return half_scores.Dim1() != 0 || padded_half_scores.Dim1() != 0;
+  }
+  // Number of columns of the (possibly notional) scores matrix.
+  int32_t NumCols() const {
+    if (IsSparse()) return sparse_num_cols;
+    if (IsPadded())
+      return (IsHalf() ? padded_half_scores.Dim1() : padded_scores.Dim1()) +
+             1;
+    return IsHalf() ? half_scores.Dim1() : scores.Dim1();
+  }
+  // Stride used when computing the "arc-index"; see NumArcs().
+  int32_t ScoresStride() const {
+    if (IsSparse() || IsPadded()) return NumCols();
+    return IsHalf() ? half_scores.ElemStride0() : scores.ElemStride0();
+  }
+
+  // NOTE: our notion of "arc-index" / arc_idx is an index into scores.Data(),
+  // i.e. row_idx * ScoresStride() + symbol + 1 (also in the sparse and
+  // padded cases).
+  int32_t NumArcs() const { return shape.NumElements() * NumCols(); }
 
   DenseFsaVec() {}
   DenseFsaVec(const RaggedShape &shape, const Array2<float> &scores)
@@ -173,8 +239,76 @@ struct DenseFsaVec {
     K2_CHECK_EQ(shape.NumElements(), scores.Dim0());
     K2_CHECK_EQ(shape.NumAxes(), 2);
   }
+  // Constructor for the sparse form; see the documentation of `top_cols`.
+  DenseFsaVec(const RaggedShape &shape, int32_t num_cols,
+              const Array2<int32_t> &top_cols,
+              const Array2<float> &top_scores,
+              const Array1<float> &floor_scores)
+      : shape(shape),
+        sparse_num_cols(num_cols),
+        top_cols(top_cols),
+        top_scores(top_scores),
+        floor_scores(floor_scores) {
+    K2_CHECK_GT(num_cols, 0);
+    K2_CHECK_GT(top_cols.Dim1(), 0);
+    K2_CHECK_EQ(shape.NumAxes(), 2);
+    K2_CHECK(IsCompatible(shape, top_cols));
+    K2_CHECK(IsCompatible(shape, top_scores));
+    K2_CHECK(IsCompatible(shape, floor_scores));
+    K2_CHECK_EQ(shape.NumElements(), top_cols.Dim0());
+    K2_CHECK_EQ(top_cols.Dim0(), top_scores.Dim0());
+    K2_CHECK_EQ(top_cols.Dim1(), top_scores.Dim1());
+    K2_CHECK_EQ(shape.NumElements(), floor_scores.Dim());
+  }
+  // Constructor for the padded form; see the documentation of
+  // `padded_scores`.
+  DenseFsaVec(const RaggedShape &shape, const Array2<float> &padded_scores,
+              const Array1<int32_t> &padded_row_offsets)
+      : shape(shape),
+        padded_scores(padded_scores),
+        padded_row_offsets(padded_row_offsets) {
+    K2_CHECK_GT(padded_scores.Dim1(), 0);
+    K2_CHECK_EQ(shape.NumAxes(), 2);
+    K2_CHECK(IsCompatible(shape, padded_scores));
+    K2_CHECK(IsCompatible(shape, padded_row_offsets));
+    K2_CHECK_EQ(shape.Dim0(), padded_row_offsets.Dim());
+  }
+  // Constructor for the dense form with 16-bit scores; see the
+  // documentation of `half_scores`.
+  DenseFsaVec(const RaggedShape &shape, const Array2<int16_t> &half_scores,
+              bool bf16)
+      : shape(shape), half_scores(half_scores), bf16(bf16) {
+    K2_CHECK_GT(half_scores.Dim1(), 0);
+    K2_CHECK(IsCompatible(shape, half_scores));
+    K2_CHECK_EQ(shape.NumElements(), half_scores.Dim0());
+    K2_CHECK_EQ(shape.NumAxes(), 2);
+  }
+  // Constructor for the padded form with 16-bit scores.
+  DenseFsaVec(const RaggedShape &shape,
+              const Array2<int16_t> &padded_half_scores,
+              const Array1<int32_t> &padded_row_offsets, bool bf16)
+      : shape(shape),
+        padded_row_offsets(padded_row_offsets),
+        padded_half_scores(padded_half_scores),
+        bf16(bf16) {
+    K2_CHECK_GT(padded_half_scores.Dim1(), 0);
+    K2_CHECK_EQ(shape.NumAxes(), 2);
+    K2_CHECK(IsCompatible(shape, padded_half_scores));
+    K2_CHECK(IsCompatible(shape, padded_row_offsets));
+    K2_CHECK_EQ(shape.Dim0(), padded_row_offsets.Dim());
+  }
   ContextPtr &Context() const { return shape.Context(); }
   DenseFsaVec To(ContextPtr c) const {
+    if (IsSparse())
+      return DenseFsaVec(shape.To(c), sparse_num_cols, top_cols.To(c),
+                         top_scores.To(c), floor_scores.To(c));
+    if (IsPadded() && IsHalf())
+      return DenseFsaVec(shape.To(c), padded_half_scores.To(c),
+                         padded_row_offsets.To(c), bf16);
+    if (IsPadded())
+      return DenseFsaVec(shape.To(c), padded_scores.To(c),
+                         padded_row_offsets.To(c));
+    if (IsHalf()) return DenseFsaVec(shape.To(c), half_scores.To(c), bf16);
     return DenseFsaVec(shape.To(c), scores.To(c));
   }
   /* Indexing operator that rearranges the sequences, analogous to: RaggedShape
@@ -186,6 +320,70 @@ struct DenseFsaVec {
 
 std::ostream &operator<<(std::ostream &os, const DenseFsaVec &dfsavec);
 
+/*
+  Host/device accessor for the scores of a DenseFsaVec in its dense, sparse or
+  padded form, with float or 16-bit scores; get it with
+  DenseFsaVecScoresAccessor(b_fsas).  For the sparse form a lookup is a
+  linear search over the k kept columns of the row.
+ */
+struct DenseFsaVecScores {
+  const float *data;  // dense form
+  int32_t stride;     // DenseFsaVec::ScoresStride()
+  // sparse form (k > 0)
+  int32_t k;
+  const int32_t *top_cols;
+  const float *top_scores;
+  const float *floor_scores;
+  // padded form (padded_row_offsets != nullptr)
+  const float *padded_data;
+  int32_t padded_stride;
+  const int32_t *row_ids1;
+  const int32_t *row_splits1;
+  const int32_t *padded_row_offsets;
+  // 16-bit scores: half_data replaces data, or padded_half_data replaces
+  // padded_data.
+  const int16_t *half_data;
+  const int16_t *padded_half_data;
+  bool bf16;
+
+  __host__ __device__ __forceinline__ float HalfScore(int16_t h) const {
+    return bf16 ? Bf16ToFloat(h) : HalfToFloat(h);
+  }
+
+  // Returns the score of row `row` (an idx01 into DenseFsaVec::shape) and
+  // column `col` (symbol + 1).
+  __host__ __device__ __forceinline__ float operator()(int32_t row,
+                                                      int32_t col) const {
+    if (data != nullptr) return data[row * stride + col];
+    if (half_data != nullptr) return HalfScore(half_data[row * stride + col]);
+    if (padded_row_offsets != nullptr) {
+      int32_t fsa_idx0 = row_ids1[row];
+      if (row + 1 == row_splits1[fsa_idx0 + 1])  // final-transition frame
+        return col == 0 ? 0.0f : -std::numeric_limits<float>::infinity();
+      if (col == 0) return -std::numeric_limits<float>::infinity();
+      int32_t t = row - row_splits1[fsa_idx0],
+              i = (padded_row_offsets[fsa_idx0] + t) * padded_stride + col - 1;
+      return padded_data != nullptr ? padded_data[i]
+                                    : HalfScore(padded_half_data[i]);
+    }
+    const int32_t *this_cols = top_cols + row * k;
+    for (int32_t i = 0; i < k; i++)
+      if (this_cols[i] == col) return top_scores[row * k + i];
+    return col == 0 ? -std::numeric_limits<float>::infinity()
+                    : floor_scores[row];
+  }
+
+  // Returns the score for an "arc-index" (see DenseFsaVec::NumArcs()).
+  __host__ __device__ __forceinline__ float operator()(int32_t arc_idx) const {
+    if (data != nullptr) return data[arc_idx];
+    if (half_data != nullptr) return HalfScore(half_data[arc_idx]);
+    int32_t row = arc_idx / stride;
+    return (*this)(row, arc_idx - row * stride);
+  }
+};
+
+DenseFsaVecScores DenseFsaVecScoresAccessor(const DenseFsaVec &dfsavec);
+
 /*
   Create an FSA from a Tensor.  The Tensor t is expected to be an N by 4 tensor of
   int32_t, where N is the number of arcs (the format is src_state, dest_state,
@@ -384,6 +582,20 @@ int32_t GetFsaBasicProperties(const Fsa &fsa);
 void GetFsaVecBasicProperties(FsaVec &fsa_vec, Array1<int32_t> *properties_out,
                               int32_t *tot_properties_out);
 
+/*
+  Computes the same as GetFsaVecBasicProperties(), without waiting for the
+  result: the properties are computed in one pass over the arcs and one over
+  the states, with no device-to-host copies, so it only synchronizes when the
+  returned array is read.
+
+     @param [in] fsa_vec   FSAs to compute the properties of; must have 3
+                           axes.
+     @return  Returns an array on the same device as `fsa_vec`, with
+              fsa_vec.Dim0() + 1 elements: the properties of each FSA,
+              followed by their `and`.
+*/
+Array1<int32_t> GetFsaVecBasicPropertiesOnDevice(FsaVec &fsa_vec);
+
 // Return weights of `arcs` as a Tensor that shares the same memory
 // location
 Tensor WeightsOfArcsAsTensor(const Array1<Arc> &arcs);
@@ -18,6 +18,10 @@
  * limitations under the License.
  */
 
+#ifdef K2_WITH_CUDA
+#include <cooperative_groups.h>
+#endif
+
 #include <algorithm>
 #include <limits>
 #include <memory>
@@ -26,8 +30,11 @@
 #include <vector>
 
 #include "k2/csrc/array_ops.h"
+#include "k2/csrc/cub.h"
+#include "k2/csrc/determinize.h"
 #include "k2/csrc/fsa_algo.h"
 #include "k2/csrc/fsa_utils.h"
+#include "k2/csrc/hash.h"
 #include "k2/csrc/host/aux_labels.h"
 #include "k2/csrc/host/connect.h"
 #include "k2/csrc/host/determinize.h"
@@ -36,7 +43,10 @@
 #include "k2/csrc/host/topsort.h"
 #include "k2/csrc/host_shim.h"
 #include "k2/csrc/macros.h"
+#include "k2/csrc/math.h"
 #include "k2/csrc/rm_epsilon.h"
+#include "k2/csrc/scalar_readback.h"
+#include "k2/csrc/thread_pool.h"
 
 
 // this contains a subset of the algorithms in fsa_algo.h; currently it just
@@ -47,17 +57,22 @@ namespace k2 {
 bool RecursionWrapper(bool (*f)(Fsa &, Fsa *, Array1<int32_t> *), Fsa &src,
                       Fsa *dest, Array1<int32_t> *arc_map) {
   NVTX_RANGE(K2_FUNC);
-  // src is actually an FsaVec.  Just recurse for now.
+  // src is actually an FsaVec.  Just recurse for now; the FSAs are processed
+  // in parallel if SetNumCpuThreads() was called.
   int32_t num_fsas = src.shape.Dim0();
   std::vector<Fsa> srcs(num_fsas), dests(num_fsas);
   std::vector<Array1<int32_t>> arc_maps(num_fsas);
-  int32_t tot_num_arcs = 0;
-  for (int32_t i = 0; i < num_fsas; ++i) {
+  std::vector<char> ok(num_fsas);
+  src.shape.Populate();  // so src.Index() won't modify `src`.
+  ParallelFor(0, num_fsas, [&](int32_t i) -> void {
     srcs[i] = src.Index(0, i);
     // Recurse.
-    if (!f(srcs[i], &(dests[i]),
-           (arc_map != nullptr ? &(arc_maps[i]) : nullptr)))
-      return false;
+    ok[i] = f(srcs[i], &(dests[i]),
+              (arc_map != nullptr ? &(arc_maps[i]) : nullptr));
+  });
+  int32_t tot_num_arcs = 0;
+  for (int32_t i = 0; i < num_fsas; ++i) {
+    if (!ok[i]) return false;
     if (arc_map != nullptr) {
       // convert arc indexes in arc_maps from idx2 to idx012
       arc_maps[i] = Plus(arc_maps[i], tot_num_arcs);
@@ -123,7 +138,7 @@ bool TopSortHost(Fsa &src, Fsa *dest, Array1<int32_t> *arc_map /*=nullptr*/) {
 bool Intersect(FsaOrVec &a_fsas, int32_t properties_a, FsaOrVec &b_fsas,
                int32_t properties_b, bool treat_epsilons_specially, FsaVec *out,
                Array1<int32_t> *arc_map_a, Array1<int32_t> *arc_map_b) {
-  NVTX_RANGE(K2_FUNC);
+  NVTX_RANGE_PAYLOAD(K2_FUNC, kIntersect, b_fsas.NumElements());
   K2_CHECK(a_fsas.NumAxes() >= 2 && a_fsas.NumAxes() <= 3);
   K2_CHECK(b_fsas.NumAxes() >= 2 && b_fsas.NumAxes() <= 3);
   ContextPtr c = a_fsas.Context();
@@ -168,13 +183,13 @@ bool Intersect(FsaOrVec &a_fsas, int32_t properties_a, FsaOrVec &b_fsas,
 
   std::vector<std::unique_ptr<k2host::Intersection>> intersections(num_fsas);
   std::vector<k2host::Array2Size<int32_t>> sizes(num_fsas);
-  for (int32_t i = 0; i < num_fsas; ++i) {
+  ParallelFor(0, num_fsas, [&](int32_t i) -> void {
     k2host::Fsa host_fsa_a = FsaVecToHostFsa(a_fsas, i * stride_a),
                 host_fsa_b = FsaVecToHostFsa(b_fsas, i * stride_b);
     intersections[i] = std::make_unique<k2host::Intersection>(
         host_fsa_a, host_fsa_b, treat_epsilons_specially, false);
     intersections[i]->GetSizes(&(sizes[i]));
-  }
+  });
   FsaVecCreator creator(sizes);
   int32_t num_arcs = creator.NumArcs();
 
@@ -190,6 +205,8 @@ bool Intersect(FsaOrVec &a_fsas, int32_t properties_a, FsaOrVec &b_fsas,
   const int32_t *a_fsas_row_splits12_data = a_fsas_row_splits12.Data(),
                 *b_fsas_row_splits12_data = b_fsas_row_splits12.Data();
 
+  // Note: this loop stays serial as FsaVecCreator requires the output FSAs be
+  // written in order.
   bool ok = true;
   for (int32_t i = 0; i < num_fsas; ++i) {
     k2host::Fsa host_fsa_out = creator.GetHostFsa(i);
@@ -228,10 +245,13 @@ void RecursionWrapper(void (*f)(FsaOrVec &, FsaOrVec *, Ragged<int32_t> *),
   int32_t num_fsas = src.shape.Dim0();
   std::vector<Fsa> srcs(num_fsas), dests(num_fsas);
   std::vector<Ragged<int32_t>> arc_derivs(num_fsas);
-  int32_t tot_num_arcs = 0;
-  for (int32_t i = 0; i < num_fsas; ++i) {
+  src.shape.Populate();  // so src.Index() won't modify `src`.
+  ParallelFor(0, num_fsas, [&](int32_t i) -> void {
     srcs[i] = src.Index(0, i);
     f(srcs[i], &(dests[i]), arc_deriv != nullptr ? &(arc_derivs[i]) : nullptr);
+  });
+  int32_t tot_num_arcs = 0;
+  for (int32_t i = 0; i < num_fsas; ++i) {
     if (arc_deriv != nullptr) {
       // convert arc indexes in arc_derivs from idx2 to idx012
       Array1<int32_t> &values = arc_derivs[i].values;
@@ -264,7 +284,10 @@ void RemoveEpsilonHost(FsaOrVec &src, FsaOrVec *dest,
   float beam = std::numeric_limits<float>::infinity();
   k2host::EpsilonsRemoverPrunedMax eps_remover(max_wfsa, beam);
   k2host::Array2Size<int32_t> fsa_size, arc_derivs_size;
-  eps_remover.GetSizes(&fsa_size, &arc_derivs_size);
+  // The states are processed in parallel if SetNumCpuThreads() was called;
+  // for an FsaVec, ParallelFor() is already processing the FSAs in parallel
+  // and so the states of each are processed serially.
+  eps_remover.GetSizes(&fsa_size, &arc_derivs_size, ParallelFor);
   FsaCreator fsa_creator(fsa_size);
   k2host::Fsa host_dest_fsa = fsa_creator.GetHostFsa();
   K2_STATIC_ASSERT(
@@ -314,22 +337,30 @@ void RemoveEpsilonAndAddSelfLoops(FsaOrVec &src, int32_t properties,
 void Determinize(FsaOrVec &src,
                  DeterminizeWeightPushingType weight_pushing_type,
                  FsaOrVec *dest, Ragged<int32_t> *arc_derivs /*=nullptr*/) {
-  NVTX_RANGE(K2_FUNC);
+  NVTX_RANGE_PAYLOAD(K2_FUNC, kFsaAlgo, src.NumElements());
   int32_t num_axes = src.NumAxes();
   if (num_axes < 2 || num_axes > 3) {
     K2_LOG(FATAL) << "Input has bad num-axes " << num_axes;
+  } else if (src.Context()->GetDeviceType() != kCpu) {
+    // The host code only works on CPU; the device version processes all
+    // FSAs of an FsaVec at once.
+    DeterminizeDevice(src, weight_pushing_type, dest, arc_derivs);
+    return;
   } else if (num_axes == 3) {
     int32_t num_fsas = src.shape.Dim0();
     std::vector<Fsa> srcs(num_fsas), dests(num_fsas);
     std::vector<Ragged<int32_t>> derivs_vector(num_fsas);
-    int32_t tot_num_arcs = 0;
-    for (int32_t i = 0; i < num_fsas; ++i) {
+    src.shape.Populate();  // so src.Index() won't modify `src`.
+    ParallelFor(0, num_fsas, [&](int32_t i) -> void {
       srcs[i] = src.Index(0, i);
       Determinize(srcs[i], weight_pushing_type, &(dests[i]),
                  arc_derivs != nullptr ? &(derivs_vector[i]) : nullptr);
+    });
+    int32_t tot_num_arcs = 0;
+    for (int32_t i = 0; i < num_fsas; ++i) {
       if (arc_derivs != nullptr) {
         // convert arc indexes in arc_derivs from idx2 to idx012
-        Array1<int32_t> &values = arc_derivs[i].values;
+        Array1<int32_t> &values = derivs_vector[i].values;
         values = Plus(values, tot_num_arcs);
         tot_num_arcs += srcs[i].NumElements();
       }
@@ -361,6 +392,222 @@ void Determinize(FsaOrVec &src,
   if (arc_derivs != nullptr) *arc_derivs = ragged_creator.GetRagged2();
 }
 
+void DeterminizePruned(FsaOrVec &src,
+                       DeterminizeWeightPushingType weight_pushing_type,
+                       float beam, int32_t max_states, FsaOrVec *dest,
+                       Ragged<int32_t> *arc_derivs /*=nullptr*/) {
+  NVTX_RANGE(K2_FUNC);
+  int32_t num_axes = src.NumAxes();
+  if (num_axes < 2 || num_axes > 3)
+    K2_LOG(FATAL) << "Input has bad num-axes " << num_axes;
+  // Unlike Determinize(), we don't wrap the host code on CPU: its priority
+  // queue has no bound on the number of states.
+  DeterminizePrunedDevice(src, weight_pushing_type, beam, max_states, dest,
+                          arc_derivs);
+}
+
+// Returns a well-mixed 64-bit hash of `x` (the finalizer of MurmurHash3).
+static __host__ __device__ __forceinline__ uint64_t MixBits(uint64_t x) {
+  x ^= x >> 33;
+  x *= 0xff51afd7ed558ccdULL;
+  x ^= x >> 33;
+  x *= 0xc4ceb9fe1a85ec53ULL;
+  x ^= x >> 33;
+  return x;
+}
+
+// Returns the label and the bits of the score of `arc` as one integer.
+static __host__ __device__ __forceinline__ uint64_t ArcLabelAndScore(
+    const Arc &arc) {
+  union {
+    float f;
+    uint32_t i;
+  } score;
+  score.f = arc.score;
+  return (static_cast<uint64_t>(static_cast<uint32_t>(arc.label)) << 32) |
+         score.i;
+}
+
+void Minimize(FsaOrVec &src, const Array1<int32_t> *aux_labels,
+              FsaOrVec *dest, Array1<int32_t> *arc_map /*=nullptr*/) {
+  NVTX_RANGE_PAYLOAD(K2_FUNC, kFsaAlgo, src.NumElements());
+  if (src.NumAxes() == 2) {
+    FsaVec src_vec = FsaToFsaVec(src), dest_vec;
+    Minimize(src_vec, aux_labels, &dest_vec, arc_map);
+    *dest = dest_vec.RemoveAxis(0);
+    return;
+  }
+  K2_CHECK_EQ(src.NumAxes(), 3);
+  ContextPtr &c = src.Context();
+  int32_t num_states = src.TotSize(1), num_arcs = src.NumElements();
+  const int32_t *aux_labels_data = nullptr;
+  if (aux_labels != nullptr) {
+    K2_CHECK(c->IsCompatible(*aux_labels->Context()));
+    K2_CHECK_EQ(aux_labels->Dim(), num_arcs);
+    aux_labels_data = aux_labels->Data();
+  }
+
+  // The suffix of each state (the FSA we'd get by making it the start-state)
+  // is identified by two 64-bit hashes: `keys`, which we look up in the hash
+  // table, and `checks`, which we use to detect hash collisions.  A state's
+  // hashes are computed from those of the destination states of its arcs, so
+  // we go backwards through the batches of GetStateBatches().  The start-
+  // and final-states are never merged with other states, and neither are
+  // states of different FSAs.
+  Ragged<int32_t> state_batches = GetStateBatches(src, true),
+                  leaving_arc_batches =
+                      GetLeavingArcIndexBatches(src, state_batches);
+  RaggedAxis0Splitter<int32_t> arc_batches_splitter(leaving_arc_batches);
+  Array1<uint64_t> keys(c, num_states), checks(c, num_states);
+  uint64_t *keys_data = keys.Data(), *checks_data = checks.Data();
+  const Arc *arcs_data = src.values.Data();
+  const int32_t *src_row_splits1_data = src.RowSplits(1).Data(),
+                *src_row_ids1_data = src.RowIds(1).Data(),
+                *src_row_splits2_data = src.RowSplits(2).Data(),
+                *src_row_ids2_data = src.RowIds(2).Data();
+  for (int32_t i = state_batches.Dim0() - 1; i >= 0; --i) {
+    int32_t arc_begin;
+    Ragged<int32_t> this_arc_batch =
+        arc_batches_splitter.GetElement(i, &arc_begin);
+    int32_t state_begin = arc_batches_splitter.GetOffset(i, 2),
+            state_end = arc_batches_splitter.GetOffset(i + 1, 2),
+            num_states_this_batch = state_end - state_begin,
+            num_arcs_this_batch = this_arc_batch.NumElements();
+
+    Ragged<uint64_t> arc_keys(this_arc_batch.shape),
+        arc_checks(this_arc_batch.shape);
+    uint64_t *arc_keys_data = arc_keys.values.Data(),
+             *arc_checks_data = arc_checks.values.Data();
+    const int32_t *this_arc_batch_data = this_arc_batch.values.Data();
+    K2_EVAL(
+        c, num_arcs_this_batch, lambda_set_arc_hashes, (int32_t j)->void {
+          int32_t arc_idx012 = this_arc_batch_data[j];
+          Arc arc = arcs_data[arc_idx012];
+          int32_t src_state_idx01 = src_row_ids2_data[arc_idx012],
+                  dest_state_idx01 =
+                      src_state_idx01 - arc.src_state + arc.dest_state;
+          uint64_t label_and_score = ArcLabelAndScore(arc),
+                   aux_label = (aux_labels_data == nullptr
+                                    ? 0
+                                    : static_cast<uint32_t>(
+                                          aux_labels_data[arc_idx012]));
+          arc_keys_data[j] = MixBits(MixBits(label_and_score) ^
+                                     (keys_data[dest_state_idx01] +
+                                      aux_label));
+          arc_checks_data[j] = MixBits(label_and_score +
+                                       3 * checks_data[dest_state_idx01] +
+                                       5 * aux_label + 1);
+        });
+    // The order of the arcs doesn't matter as we add their hashes.
+    Array1<uint64_t> state_keys(c, num_states_this_batch),
+        state_checks(c, num_states_this_batch);
+    SumPerSublist<uint64_t>(arc_keys, 0, &state_keys);
+    SumPerSublist<uint64_t>(arc_checks, 0, &state_checks);
+
+    const int32_t *this_batch_state_ids_data =
+        state_batches.values.Data() + state_begin;
+    const uint64_t *state_keys_data = state_keys.Data(),
+                   *state_checks_data = state_checks.Data();
+    K2_EVAL(
+        c, num_states_this_batch, lambda_set_state_hashes, (int32_t j)->void {
+          int32_t state_idx01 = this_batch_state_ids_data[j],
+                  fsa_idx0 = src_row_ids1_data[state_idx01],
+                  num_arcs = src_row_splits2_data[state_idx01 + 1] -
+                             src_row_splits2_data[state_idx01];
+          // Unique for the start- and final-state of each FSA.
+          uint64_t id = static_cast<uint64_t>(fsa_idx0) * 4;
+          if (state_idx01 == src_row_splits1_data[fsa_idx0]) id += 1;
+          if (state_idx01 + 1 == src_row_splits1_data[fsa_idx0 + 1]) id += 2;
+          uint64_t key = MixBits(state_keys_data[j] + MixBits(id) +
+                                 static_cast<uint64_t>(num_arcs));
+          // All-ones is reserved to mean "empty" in class Hash64.
+          if (~key == 0) key = 0;
+          keys_data[state_idx01] = key;
+          checks_data[state_idx01] =
+              MixBits(state_checks_data[j] + 7 * id + 11 * num_arcs);
+        });
+  }
+
+  // Each group of states with the same key is replaced by the highest
+  // numbered of them, so that the output is top-sorted like the input.
+  int64_t num_buckets =
+      2 * static_cast<int64_t>(RoundUpToNearestPowerOfTwo(num_states));
+  Hash64 hash(c, std::max<int64_t>(num_buckets, 128));
+  auto hash_acc = hash.GetAccessor();
+  K2_EVAL(
+      c, num_states, lambda_insert, (int32_t s)->void {
+        uint64_t key = keys_data[s], old_value = 0,
+                 *key_value_location = nullptr;
+        if (hash_acc.Insert(key, static_cast<uint64_t>(s), &old_value,
+                            &key_value_location))
+          return;
+        // The other thread may not have written the value yet; Find() waits
+        // for it.
+        if (~old_value == 0) hash_acc.Find(key, &old_value);
+        while (old_value < static_cast<uint64_t>(s)) {
+          uint64_t prev = AtomicCAS(
+              (unsigned long long *)(key_value_location + 1), old_value,
+              static_cast<uint64_t>(s));
+          if (prev == old_value) break;
+          old_value = prev;
+        }
+      });
+  Array1<int32_t> state_rep(c, num_states);
+  int32_t *state_rep_data = state_rep.Data();
+  Renumbering renumber_states(c, num_states);
+  char *keep_states_data = renumber_states.Keep().Data();
+  K2_EVAL(
+      c, num_states, lambda_find_rep, (int32_t s)->void {
+        uint64_t value = 0;
+        bool found = hash_acc.Find(keys_data[s], &value);
+        K2_CHECK(found);
+        int32_t rep = static_cast<int32_t>(value);
+        K2_CHECK_EQ(checks_data[rep], checks_data[s])
+            << "Hash collision in Minimize()";
+        state_rep_data[s] = rep;
+        keep_states_data[s] = (char)(rep == s);
+      });
+  // The hash still contains entries; avoid the check in its destructor.
+  hash.Destroy();
+
+  Array1<int32_t> arcs_new2old;
+  RaggedShape ans_shape =
+      SubsetRaggedShape(src.shape, renumber_states, 1, &arcs_new2old);
+  int32_t ans_num_arcs = ans_shape.NumElements();
+  Array1<Arc> ans_arcs(c, ans_num_arcs);
+  Arc *ans_arcs_data = ans_arcs.Data();
+  const int32_t *arcs_new2old_data = arcs_new2old.Data(),
+                *states_old2new_data = renumber_states.Old2New().Data(),
+                *ans_row_splits1_data = ans_shape.RowSplits(1).Data();
+  K2_EVAL(
+      c, ans_num_arcs, lambda_set_arcs, (int32_t i)->void {
+        int32_t arc_idx012 = arcs_new2old_data[i],
+                src_state_idx01 = src_row_ids2_data[arc_idx012],
+                fsa_idx0 = src_row_ids1_data[src_state_idx01],
+                ans_idx0x = ans_row_splits1_data[fsa_idx0];
+        Arc arc = arcs_data[arc_idx012];
+        int32_t dest_state_idx01 =
+            src_state_idx01 - arc.src_state + arc.dest_state;
+        arc.src_state = states_old2new_data[src_state_idx01] - ans_idx0x;
+        arc.dest_state =
+            states_old2new_data[state_rep_data[dest_state_idx01]] - ans_idx0x;
+        ans_arcs_data[i] = arc;
+      });
+  *dest = FsaVec(ans_shape, ans_arcs);
+  if (arc_map != nullptr) *arc_map = arcs_new2old;
+}
+
+// Returns an array with `dim` elements on context `c`.  If `buffer` is not
+// nullptr the array is a prefix of *buffer, which is reallocated (with some
+// room to grow) only if it is too small or on a different device.
+template <typename T>
+static Array1<T> BufferArray(ContextPtr &c, int32_t dim, Array1<T> *buffer) {
+  if (buffer == nullptr) return Array1<T>(c, dim);
+  if (buffer->Dim() < dim || !buffer->Context()->IsCompatible(*c))
+    *buffer = Array1<T>(c, dim + dim / 4);
+  return buffer->Arange(0, dim);
+}
+
 Fsa LinearFsa(const Array1<int32_t> &symbols) {
   NVTX_RANGE(K2_FUNC);
   ContextPtr &c = symbols.Context();
@@ -385,72 +632,86 @@ Fsa LinearFsa(const Array1<int32_t> &symbols) {
   return Ragged<Arc>(RaggedShape2(&row_splits1, &row_ids1, num_arcs), arcs);
 }
 
-FsaVec LinearFsas(const Ragged<int32_t> &symbols) {
+FsaVec LinearFsas(const Ragged<int32_t> &symbols,
+                  FsaVecBuffer *buffer /*= nullptr*/) {
   NVTX_RANGE(K2_FUNC);
   K2_CHECK_EQ(symbols.NumAxes(), 2);
   ContextPtr &c = symbols.Context();
 
-  // if there are n symbols, there are n+2 states and n+1 arcs.
-  RaggedShape states_shape = ChangeSublistSize(symbols.shape, 2);
-
-  int32_t num_states = states_shape.NumElements(),
-          num_arcs = symbols.NumElements() + symbols.Dim0();
-
-  // row_splits2 maps from state_idx01 to arc_idx012; row_ids2 does the reverse.
-  // We'll set them in the lambda below.
-  Array1<int32_t> row_splits2(c, num_states + 1), row_ids2(c, num_arcs);
-  // If num_states equals to zero, the code below won't set the last value of
-  // row_splits2, we should initialize here, or it will be a random value.
-  if (num_states == 0) row_splits2 = 0;
+  // if there are n symbols, there are n+2 states and n+1 arcs, so the
+  // states of FSA i start at state_idx01 == symbols.RowSplits(1)[i] + 2 * i
+  // and its arcs at arc_idx012 == symbols.RowSplits(1)[i] + i.
+  int32_t num_fsas = symbols.Dim0(), num_symbols = symbols.values.Dim(),
+          num_states = num_symbols + 2 * num_fsas,
+          num_arcs = num_symbols + num_fsas;
+
+  Array1<int32_t> row_splits1 =
+      BufferArray(c, num_fsas + 1, buffer ? &buffer->row_splits1 : nullptr);
+  Array1<int32_t> row_ids1 =
+      BufferArray(c, num_states, buffer ? &buffer->row_ids1 : nullptr);
+  Array1<int32_t> row_splits2 =
+      BufferArray(c, num_states + 1, buffer ? &buffer->row_splits2 : nullptr);
+  Array1<int32_t> row_ids2 =
+      BufferArray(c, num_arcs, buffer ? &buffer->row_ids2 : nullptr);
+  Array1<Arc> arcs =
+      BufferArray(c, num_arcs, buffer ? &buffer->arcs : nullptr);
+  // If there are no FSAs, the kernel below won't set the only element of the
+  // row splits.
+  if (num_fsas == 0) {
+    row_splits1 = 0;
+    row_splits2 = 0;
+  }
 
-  int32_t *row_ids2_data = row_ids2.Data(),
-          *row_splits2_data = row_splits2.Data();
-  const int32_t *row_ids1_data = states_shape.RowIds(1).Data(),
-                *row_splits1_data = states_shape.RowSplits(1).Data(),
+  int32_t *row_splits1_data = row_splits1.Data(),
+          *row_ids1_data = row_ids1.Data(),
+          *row_splits2_data = row_splits2.Data(),
+          *row_ids2_data = row_ids2.Data();
+  const int32_t *symbols_row_ids1_data = symbols.RowIds(1).Data(),
+                *symbols_row_splits1_data = symbols.RowSplits(1).Data(),
                 *symbols_data = symbols.values.Data();
-  Array1<Arc> arcs(c, num_arcs);
   Arc *arcs_data = arcs.Data();
+  // There is a job for each symbol, which sets up the state before it and
+  // the arc leaving that state, and a job for each FSA (at
+  // `num_symbols + fsa_idx0`), which sets up its last two states and its
+  // final-arc.
   K2_EVAL(
-      c, num_states, lambda, (int32_t state_idx01)->void {
-        int32_t fsa_idx0 = row_ids1_data[state_idx01],
-                state_idx0x = row_splits1_data[fsa_idx0],
-                next_state_idx0x = row_splits1_data[fsa_idx0 + 1],
-                idx1 = state_idx01 - state_idx0x;
-
-        // the following works because each FSA has one fewer arcs than states.
-        int32_t arc_idx0xx = state_idx0x - fsa_idx0,
-                next_arc_idx0xx = next_state_idx0x - (fsa_idx0 + 1),
-                // the following may look a bit wrong.. here, the idx1 is the
-                // same as the idx12 if the arc exists, because each state has
-                // one arc leaving it (except the last state).
-            arc_idx012 = arc_idx0xx + idx1;
-        // the following works because each FSA has one fewer symbols than arcs
-        // (however it doesn't work for the last arc of each FSA; we check
-        // below.)
-        int32_t symbol_idx01 = arc_idx012 - fsa_idx0;
-        if (arc_idx012 < next_arc_idx0xx) {
-          int32_t src_state = idx1, dest_state = idx1 + 1,
-                  symbol = (arc_idx012 + 1 < next_arc_idx0xx
-                                ? symbols_data[symbol_idx01]
-                                : -1);  // kFinalSymbol
-          float score = 0.0;
-          arcs_data[arc_idx012] = Arc(src_state, dest_state, symbol, score);
+      c, num_symbols + num_fsas, lambda_set_arcs, (int32_t job)->void {
+        if (job < num_symbols) {
+          int32_t symbol_idx01 = job,
+                  fsa_idx0 = symbols_row_ids1_data[symbol_idx01],
+                  idx1 = symbol_idx01 - symbols_row_splits1_data[fsa_idx0],
+                  state_idx01 = symbol_idx01 + 2 * fsa_idx0,
+                  arc_idx012 = symbol_idx01 + fsa_idx0;
+          row_ids1_data[state_idx01] = fsa_idx0;
+          row_splits2_data[state_idx01] = arc_idx012;
           row_ids2_data[arc_idx012] = state_idx01;
+          arcs_data[arc_idx012] =
+              Arc(idx1, idx1 + 1, symbols_data[symbol_idx01], 0.0);
         } else {
-          // The following ensures that the last element of row_splits1_data
-          // (i.e. row_splits1[num_states]) is set to num_arcs.  It also writes
-          // something unnecessary for the last state of each FSA but the last
-          // one, which will cause 2 threads to write the same item to the same
-          // location. Note that there is no arc with index `arc_idx01`, if you
-          // reach here.
-          row_splits2_data[state_idx01 + 1] = arc_idx012;
+          int32_t fsa_idx0 = job - num_symbols,
+                  symbol_idx0x = symbols_row_splits1_data[fsa_idx0],
+                  symbol_idx0x_next = symbols_row_splits1_data[fsa_idx0 + 1],
+                  n = symbol_idx0x_next - symbol_idx0x,
+                  state_idx0x = symbol_idx0x + 2 * fsa_idx0,
+                  state_idx01 = state_idx0x + n,  // the last non-final state
+                  arc_idx012 = symbol_idx0x_next + fsa_idx0;
+          row_splits1_data[fsa_idx0] = state_idx0x;
+          row_ids1_data[state_idx01] = fsa_idx0;
+          row_ids1_data[state_idx01 + 1] = fsa_idx0;
+          row_splits2_data[state_idx01] = arc_idx012;
+          // the final state has no leaving arcs.
+          row_splits2_data[state_idx01 + 1] = arc_idx012 + 1;
+          row_ids2_data[arc_idx012] = state_idx01;
+          arcs_data[arc_idx012] = Arc(n, n + 1, -1, 0.0);  // kFinalSymbol
+          if (fsa_idx0 + 1 == num_fsas) {
+            row_splits1_data[num_fsas] = num_states;
+            row_splits2_data[num_states] = num_arcs;
+          }
         }
-        row_splits2_data[state_idx01] = arc_idx012;
       });
-  return Ragged<Arc>(
-      RaggedShape3(&states_shape.RowSplits(1), &states_shape.RowIds(1),
-                   num_states, &row_splits2, &row_ids2, num_arcs),
-      arcs);
+  return Ragged<Arc>(RaggedShape3(&row_splits1, &row_ids1, num_states,
+                                  &row_splits2, &row_ids2, num_arcs),
+                     arcs);
 }
 
 FsaVec LevenshteinGraphs(const Ragged<int32_t> &symbols,
@@ -574,159 +835,391 @@ FsaVec LevenshteinGraphs(const Ragged<int32_t> &symbols,
   return Ragged<Arc>(shape, arcs);
 }
 
+Array1<int32_t> LevenshteinDistance(Ragged<int32_t> &refs,
+                                    Ragged<int32_t> &hyps,
+                                    const Array1<int32_t> &hyp_to_ref_map,
+                                    Ragged<int32_t> *ref_alignment /*=nullptr*/,
+                                    Ragged<int32_t> *hyp_alignment
+                                    /*=nullptr*/) {
+  NVTX_RANGE(K2_FUNC);
+  K2_CHECK_EQ(refs.NumAxes(), 2);
+  K2_CHECK_EQ(hyps.NumAxes(), 2);
+  K2_CHECK_EQ(hyp_to_ref_map.Dim(), hyps.Dim0());
+  ContextPtr c = GetContext(refs, hyps, hyp_to_ref_map);
+  int32_t num_pairs = hyps.Dim0();
+
+  const int32_t *refs_row_splits1_data = refs.RowSplits(1).Data(),
+                *hyps_row_splits1_data = hyps.RowSplits(1).Data(),
+                *refs_data = refs.values.Data(),
+                *hyps_data = hyps.values.Data(),
+                *hyp_to_ref_map_data = hyp_to_ref_map.Data();
+
+  // The dynamic-programming matrix of the i'th pair, of size
+  // (ref_len + 1) * (hyp_len + 1) and stored row-major, starts at
+  // matrix_data + matrix_offsets_data[i].
+  Array1<int32_t> matrix_offsets(c, num_pairs + 1);
+  int32_t *matrix_offsets_data = matrix_offsets.Data();
+  K2_EVAL(
+      c, num_pairs, lambda_set_matrix_sizes, (int32_t i)->void {
+        int32_t r = hyp_to_ref_map_data[i],
+                ref_len = refs_row_splits1_data[r + 1] -
+                          refs_row_splits1_data[r],
+                hyp_len = hyps_row_splits1_data[i + 1] -
+                          hyps_row_splits1_data[i];
+        matrix_offsets_data[i] = (ref_len + 1) * (hyp_len + 1);
+      });
+  ExclusiveSum(matrix_offsets, &matrix_offsets);
+  Array1<int32_t> matrix(c, matrix_offsets.Back());
+  int32_t *matrix_data = matrix.Data();
+
+  if (c->GetDeviceType() == kCuda) {
+#ifdef K2_WITH_CUDA
+    // One warp per pair; it goes over the anti-diagonals of the matrix, whose
+    // elements only depend on those of the previous two anti-diagonals.
+    const unsigned int thread_group_size = 32;
+    namespace cg = cooperative_groups;
+    auto lambda_fill_matrix = [=] __device__(
+        cg::thread_block_tile<thread_group_size> g,
+        int32_t *shared_data,  // unused
+        int32_t i) -> void {
+      int32_t r = hyp_to_ref_map_data[i],
+              ref_begin = refs_row_splits1_data[r],
+              ref_len = refs_row_splits1_data[r + 1] - ref_begin,
+              hyp_begin = hyps_row_splits1_data[i],
+              hyp_len = hyps_row_splits1_data[i + 1] - hyp_begin,
+              stride = hyp_len + 1;
+      int32_t *this_matrix = matrix_data + matrix_offsets_data[i];
+      for (int32_t d = 0; d <= ref_len + hyp_len; ++d) {
+        int32_t begin = max(0, d - hyp_len), end = min(d, ref_len) + 1;
+        for (int32_t m = begin + g.thread_rank(); m < end; m += g.size()) {
+          int32_t n = d - m, cost;
+          if (m == 0) {
+            cost = n;
+          } else if (n == 0) {
+            cost = m;
+          } else {
+            int32_t sub = this_matrix[(m - 1) * stride + n - 1] +
+                          (refs_data[ref_begin + m - 1] !=
+                           hyps_data[hyp_begin + n - 1]),
+                    del = this_matrix[(m - 1) * stride + n] + 1,
+                    ins = this_matrix[m * stride + n - 1] + 1;
+            cost = min(sub, min(del, ins));
+          }
+          this_matrix[m * stride + n] = cost;
+        }
+        g.sync();
+      }
+    };
+    EvalGroupDevice<thread_group_size, int32_t>(c, num_pairs,
+                                                lambda_fill_matrix);
+#else
+    K2_LOG(FATAL) << "Unreachable code!";
+#endif
+  } else {
+    // CPU.
+    for (int32_t i = 0; i < num_pairs; ++i) {
+      int32_t r = hyp_to_ref_map_data[i],
+              ref_begin = refs_row_splits1_data[r],
+              ref_len = refs_row_splits1_data[r + 1] - ref_begin,
+              hyp_begin = hyps_row_splits1_data[i],
+              hyp_len = hyps_row_splits1_data[i + 1] - hyp_begin,
+              stride = hyp_len + 1;
+      int32_t *this_matrix = matrix_data + matrix_offsets_data[i];
+      for (int32_t n = 0; n <= hyp_len; ++n) this_matrix[n] = n;
+      for (int32_t m = 1; m <= ref_len; ++m) {
+        int32_t *row = this_matrix + m * stride, *prev_row = row - stride;
+        int32_t ref_symbol = refs_data[ref_begin + m - 1];
+        row[0] = m;
+        for (int32_t n = 1; n <= hyp_len; ++n) {
+          int32_t sub = prev_row[n - 1] +
+                        (ref_symbol != hyps_data[hyp_begin + n - 1]);
+          row[n] = std::min(sub, std::min(prev_row[n], row[n - 1]) + 1);
+        }
+      }
+    }
+  }
+
+  Array1<int32_t> ans(c, num_pairs);
+  int32_t *ans_data = ans.Data();
+  K2_EVAL(
+      c, num_pairs, lambda_set_ans, (int32_t i)->void {
+        // The last element of the matrix.
+        ans_data[i] = matrix_data[matrix_offsets_data[i + 1] - 1];
+      });
+  if (ref_alignment == nullptr && hyp_alignment == nullptr) return ans;
+
+  // Trace back the alignments, first to get their lengths, then to write
+  // them.  At each step we prefer a substitution (or match), then a
+  // deletion, then an insertion.
+  Array1<int32_t> alignment_row_splits(c, num_pairs + 1);
+  int32_t *alignment_row_splits_data = alignment_row_splits.Data();
+  K2_EVAL(
+      c, num_pairs, lambda_get_alignment_lengths, (int32_t i)->void {
+        int32_t r = hyp_to_ref_map_data[i],
+                ref_begin = refs_row_splits1_data[r],
+                m = refs_row_splits1_data[r + 1] - ref_begin,
+                hyp_begin = hyps_row_splits1_data[i],
+                n = hyps_row_splits1_data[i + 1] - hyp_begin,
+                stride = n + 1, length = 0;
+        const int32_t *this_matrix = matrix_data + matrix_offsets_data[i];
+        while (m > 0 || n > 0) {
+          int32_t cost = this_matrix[m * stride + n];
+          if (m > 0 && n > 0 &&
+              cost == this_matrix[(m - 1) * stride + n - 1] +
+                          (refs_data[ref_begin + m - 1] !=
+                           hyps_data[hyp_begin + n - 1])) {
+            --m;
+            --n;
+          } else if (m > 0 && cost == this_matrix[(m - 1) * stride + n] + 1) {
+            --m;
+          } else {
+            --n;
+          }
+          ++length;
+        }
+        alignment_row_splits_data[i] = length;
+      });
+  ExclusiveSum(alignment_row_splits, &alignment_row_splits);
+  int32_t tot_length = alignment_row_splits.Back();
+  Array1<int32_t> ref_labels(c, tot_length), hyp_labels(c, tot_length);
+  int32_t *ref_labels_data = ref_labels.Data(),
+          *hyp_labels_data = hyp_labels.Data();
+  K2_EVAL(
+      c, num_pairs, lambda_set_alignments, (int32_t i)->void {
+        int32_t r = hyp_to_ref_map_data[i],
+                ref_begin = refs_row_splits1_data[r],
+                m = refs_row_splits1_data[r + 1] - ref_begin,
+                hyp_begin = hyps_row_splits1_data[i],
+                n = hyps_row_splits1_data[i + 1] - hyp_begin,
+                stride = n + 1,
+                pos = alignment_row_splits_data[i + 1];
+        const int32_t *this_matrix = matrix_data + matrix_offsets_data[i];
+        while (m > 0 || n > 0) {
+          int32_t cost = this_matrix[m * stride + n],
+                  ref_symbol = (m > 0 ? refs_data[ref_begin + m - 1] : 0),
+                  hyp_symbol = (n > 0 ? hyps_data[hyp_begin + n - 1] : 0);
+          --pos;
+          if (m > 0 && n > 0 &&
+              cost == this_matrix[(m - 1) * stride + n - 1] +
+                          (ref_symbol != hyp_symbol)) {
+            ref_labels_data[pos] = ref_symbol;
+            hyp_labels_data[pos] = hyp_symbol;
+            --m;
+            --n;
+          } else if (m > 0 && cost == this_matrix[(m - 1) * stride + n] + 1) {
+            ref_labels_data[pos] = ref_symbol;
+            hyp_labels_data[pos] = 0;
+            --m;
+          } else {
+            ref_labels_data[pos] = 0;
+            hyp_labels_data[pos] = hyp_symbol;
+            --n;
+          }
+        }
+      });
+  RaggedShape alignment_shape =
+      RaggedShape2(&alignment_row_splits, nullptr, tot_length);
+  if (ref_alignment != nullptr)
+    *ref_alignment = Ragged<int32_t>(alignment_shape, ref_labels);
+  if (hyp_alignment != nullptr)
+    *hyp_alignment = Ragged<int32_t>(alignment_shape, hyp_labels);
+  return ans;
+}
+
 FsaVec CtcGraphs(const Ragged<int32_t> &symbols, bool modified /*= false*/,
-                 Array1<int32_t> *aux_labels /*= nullptr*/) {
+                 Array1<int32_t> *aux_labels /*= nullptr*/,
+                 FsaVecBuffer *buffer /*= nullptr*/) {
   NVTX_RANGE(K2_FUNC);
   K2_CHECK_EQ(symbols.NumAxes(), 2);
   ContextPtr &c = symbols.Context();
 
-  int32_t num_fsas = symbols.Dim0();
-  Array1<int32_t> num_states_for(c, num_fsas + 1);
-  int32_t *num_states_for_data = num_states_for.Data();
-  const int32_t *symbol_row_split1_data = symbols.RowSplits(1).Data();
-  // symbols indexed with [fsa][symbol]
-  // for each fsa we need `symbol_num * 2 + 1 + 1` states, `symbol_num * 2 + 1`
+  // For each fsa with n symbols we need `n * 2 + 1 + 1` states, `n * 2 + 1`
   // means that we need a blank state on each side of a symbol state, `+ 1` is
-  // for final state in k2
-  K2_EVAL(
-      c, num_fsas, lambda_set_num_states, (int32_t fsa_idx0)->void {
-        int32_t symbol_idx0x = symbol_row_split1_data[fsa_idx0],
-                symbol_idx0x_next = symbol_row_split1_data[fsa_idx0 + 1],
-                symbol_num = symbol_idx0x_next - symbol_idx0x;
-        num_states_for_data[fsa_idx0] = symbol_num * 2 + 2;
-      });
-
-  ExclusiveSum(num_states_for, &num_states_for);
-  Array1<int32_t> &fsa_to_states_row_splits = num_states_for;
-  RaggedShape fsa_to_states =
-      RaggedShape2(&fsa_to_states_row_splits, nullptr, -1);
+  // for final state in k2.  So the states of FSA i start at
+  // state_idx01 == 2 * symbols.RowSplits(1)[i] + 2 * i; the blank state
+  // before the j'th symbol has idx1 == 2 * j and the symbol state
+  // idx1 == 2 * j + 1.
+  int32_t num_fsas = symbols.Dim0(), num_symbols = symbols.values.Dim(),
+          num_states = 2 * num_symbols + 2 * num_fsas;
+
+  Array1<int32_t> row_splits1 =
+      BufferArray(c, num_fsas + 1, buffer ? &buffer->row_splits1 : nullptr);
+  Array1<int32_t> row_ids1 =
+      BufferArray(c, num_states, buffer ? &buffer->row_ids1 : nullptr);
+  Array1<int32_t> row_splits2 =
+      BufferArray(c, num_states + 1, buffer ? &buffer->row_splits2 : nullptr);
+  // If there are no FSAs, the kernels below won't set the only element of the
+  // row splits.
+  if (num_fsas == 0) {
+    row_splits1 = 0;
+    row_splits2 = 0;
+  }
+  int32_t *row_splits1_data = row_splits1.Data(),
+          *row_ids1_data = row_ids1.Data(),
+          *row_splits2_data = row_splits2.Data();
+  const int32_t *symbols_row_ids1_data = symbols.RowIds(1).Data(),
+                *symbols_row_splits1_data = symbols.RowSplits(1).Data(),
+                *symbols_data = symbols.values.Data();
 
-  int32_t num_states = fsa_to_states.NumElements();
-  Array1<int32_t> num_arcs_for(c, num_states + 1);
-  int32_t *num_arcs_for_data = num_arcs_for.Data();
-  const int32_t *fts_row_splits1_data = fsa_to_states.RowSplits(1).Data(),
-                *fts_row_ids1_data = fsa_to_states.RowIds(1).Data(),
-                *symbol_data = symbols.values.Data();
-  // set the arcs number for each state
+  // Blank states have two arcs (a self-loop and an arc to the next state),
+  // the final state has none and symbol states have three (a self-loop, an
+  // arc to the next blank state and one to the next symbol state), except
+  // that, for the standard topology, a symbol state cannot go directly to
+  // the next symbol state if its symbol is the same as the next one.  For
+  // the modified topology the arcs of FSA i thus start at
+  // arc_idx012 == 5 * symbols.RowSplits(1)[i] + 2 * i, and the arcs of the
+  // j'th blank state at 5 * j within the FSA; for the standard topology we
+  // write the number of arcs of each state to `row_splits2` and take the
+  // exclusive sum.
+  //
+  // There is a job for each symbol, which deals with the symbol state and
+  // the blank state before it, and a job for each FSA (at
+  // `num_symbols + fsa_idx0`), which deals with its last two states.
+  int32_t num_jobs = num_symbols + num_fsas;
   K2_EVAL(
-      c, num_states, lambda_set_num_arcs, (int32_t state_idx01)->void {
-        int32_t fsa_idx0 = fts_row_ids1_data[state_idx01],
-                // we minus fsa_idx0 here, because we are adding one more state,
-                // the final state for each fsa
-                sym_state_idx01 = state_idx01 / 2 - fsa_idx0,
-                remainder = state_idx01 % 2,
-                current_num_arcs = 2;  // normally there are two arcs, self-loop
-                                       // and arc pointing to the next state
-                                       // blank state always has two arcs
-        if (remainder) {  // symbol state
-          int32_t sym_final_state =
-                    symbol_row_split1_data[fsa_idx0 + 1];
-          // There are no arcs for final states
-          if (sym_state_idx01 == sym_final_state) {
-            current_num_arcs = 0;
-          } else if (modified) {
-            current_num_arcs = 3;
+      c, num_jobs, lambda_set_row_splits, (int32_t job)->void {
+        if (job < num_symbols) {
+          int32_t symbol_idx01 = job,
+                  fsa_idx0 = symbols_row_ids1_data[symbol_idx01],
+                  symbol_idx1 =
+                      symbol_idx01 - symbols_row_splits1_data[fsa_idx0],
+                  blank_state_idx01 = 2 * (symbol_idx01 + fsa_idx0);
+          row_ids1_data[blank_state_idx01] = fsa_idx0;
+          row_ids1_data[blank_state_idx01 + 1] = fsa_idx0;
+          if (modified) {
+            int32_t arc_idx0xx =
+                        5 * symbols_row_splits1_data[fsa_idx0] + 2 * fsa_idx0,
+                    blank_arc_idx01x = arc_idx0xx + 5 * symbol_idx1;
+            row_splits2_data[blank_state_idx01] = blank_arc_idx01x;
+            row_splits2_data[blank_state_idx01 + 1] = blank_arc_idx01x + 2;
           } else {
-            int32_t current_symbol = symbol_data[sym_state_idx01],
-                    // we set the next symbol of the last symbol to -1, so
-                    // the following if clause will always be true, which means
-                    // we will have 3 arcs for last symbol state
-                    next_symbol = (sym_state_idx01 + 1) == sym_final_state ?
-                                  -1 : symbol_data[sym_state_idx01 + 1];
+            int32_t current_symbol = symbols_data[symbol_idx01],
+                    // we set the next symbol of the last symbol to -1, so we
+                    // will have 3 arcs for the last symbol state.
+                next_symbol =
+                    symbol_idx01 + 1 == symbols_row_splits1_data[fsa_idx0 + 1]
+                        ? -1
+                        : symbols_data[symbol_idx01 + 1];
             // symbols must be not equal to -1, which is specially used in k2
             K2_CHECK_NE(current_symbol, -1);
-            // if current_symbol equals next_symbol, we need a blank state
-            // between them, so there are two arcs for this state
-            // otherwise, this state will point to blank state and next symbol
-            // state, so we need three arcs here.
-            // Note: for the simplified topology (standard equals false), there
-            // are always 3 arcs leaving symbol states.
-            if (current_symbol != next_symbol)
-              current_num_arcs = 3;
+            row_splits2_data[blank_state_idx01] = 2;
+            row_splits2_data[blank_state_idx01 + 1] =
+                current_symbol == next_symbol ? 2 : 3;
+          }
+        } else {
+          int32_t fsa_idx0 = job - num_symbols,
+                  symbol_idx0x = symbols_row_splits1_data[fsa_idx0],
+                  n = symbols_row_splits1_data[fsa_idx0 + 1] - symbol_idx0x,
+                  state_idx0x = 2 * (symbol_idx0x + fsa_idx0),
+                  blank_state_idx01 = state_idx0x + 2 * n;
+          row_splits1_data[fsa_idx0] = state_idx0x;
+          row_ids1_data[blank_state_idx01] = fsa_idx0;
+          row_ids1_data[blank_state_idx01 + 1] = fsa_idx0;
+          if (modified) {
+            int32_t blank_arc_idx01x =
+                5 * (symbol_idx0x + n) + 2 * fsa_idx0;
+            row_splits2_data[blank_state_idx01] = blank_arc_idx01x;
+            row_splits2_data[blank_state_idx01 + 1] = blank_arc_idx01x + 2;
+          } else {
+            row_splits2_data[blank_state_idx01] = 2;
+            row_splits2_data[blank_state_idx01 + 1] = 0;  // the final state
+          }
+          if (fsa_idx0 + 1 == num_fsas) {
+            row_splits1_data[num_fsas] = num_states;
+            if (modified)
+              row_splits2_data[num_states] =
+                  5 * num_symbols + 2 * num_fsas;
           }
         }
-        num_arcs_for_data[state_idx01] = current_num_arcs;
       });
 
-  ExclusiveSum(num_arcs_for, &num_arcs_for);
-  Array1<int32_t> &states_to_arcs_row_splits = num_arcs_for;
-  RaggedShape states_to_arcs =
-      RaggedShape2(&states_to_arcs_row_splits, nullptr, -1);
+  int32_t num_arcs;
+  if (modified) {
+    num_arcs = 5 * num_symbols + 2 * num_fsas;
+  } else {
+    ExclusiveSum(row_splits2, &row_splits2);
+    num_arcs = row_splits2.Back();
+  }
 
-  // ctc_shape with a index of [fsa][state][arc]
-  RaggedShape ctc_shape = ComposeRaggedShapes(fsa_to_states, states_to_arcs);
-  int32_t num_arcs = ctc_shape.NumElements();
-  Array1<Arc> arcs(c, num_arcs);
+  Array1<int32_t> row_ids2 =
+      BufferArray(c, num_arcs, buffer ? &buffer->row_ids2 : nullptr);
+  Array1<Arc> arcs =
+      BufferArray(c, num_arcs, buffer ? &buffer->arcs : nullptr);
+  int32_t *row_ids2_data = row_ids2.Data(), *aux_labels_data = nullptr;
   Arc *arcs_data = arcs.Data();
-  const int32_t *ctc_row_splits1_data = ctc_shape.RowSplits(1).Data(),
-                *ctc_row_ids1_data = ctc_shape.RowIds(1).Data(),
-                *ctc_row_splits2_data = ctc_shape.RowSplits(2).Data(),
-                *ctc_row_ids2_data = ctc_shape.RowIds(2).Data();
-  int32_t *aux_labels_data = nullptr;
   if (aux_labels != nullptr) {
-    *aux_labels = Array1<int32_t>(c, num_arcs);
+    *aux_labels =
+        BufferArray(c, num_arcs, buffer ? &buffer->aux_labels : nullptr);
     aux_labels_data = aux_labels->Data();
   }
 
   K2_EVAL(
-      c, num_arcs, lambda_set_arcs, (int32_t arc_idx012)->void {
-        int32_t state_idx01 = ctc_row_ids2_data[arc_idx012],
-                fsa_idx0 = ctc_row_ids1_data[state_idx01],
-                state_idx0x = ctc_row_splits1_data[fsa_idx0],
-                state_idx1 = state_idx01 - state_idx0x,
-                arc_idx01x = ctc_row_splits2_data[state_idx01],
-                arc_idx2 = arc_idx012 - arc_idx01x,
-                sym_state_idx01 = state_idx01 / 2 - fsa_idx0,
-                remainder = state_idx01 % 2,
-                sym_final_state = symbol_row_split1_data[fsa_idx0 + 1];
-        bool final_state = sym_final_state == sym_state_idx01;
-        int32_t current_symbol = final_state ?
-            -1 : symbol_data[sym_state_idx01];
-        Arc arc;
-        arc.score = 0;
-        arc.src_state = state_idx1;
-        int32_t aux_labels_value = 0;
-        if (remainder) {
-          if (final_state) return;
-          int32_t next_symbol = (sym_state_idx01 + 1) == sym_final_state ?
-              -1 : symbol_data[sym_state_idx01 + 1];
-          // for standard topology, the symbol state can not point to next
-          // symbol state if the next symbol is identical to current symbol.
-          if (current_symbol == next_symbol && !modified) {
-            K2_CHECK_LT(arc_idx2, 2);
-            arc.label = arc_idx2 == 0 ? 0 : current_symbol;
-            arc.dest_state = arc_idx2 == 0 ? state_idx1 + 1 : state_idx1;
-          } else {
-            switch (arc_idx2) {
-              case 0:   // the arc pointing to blank state
-                arc.label = 0;
-                arc.dest_state = state_idx1 + 1;
-                break;
-              case 1:   // the self loop arc
-                arc.label = current_symbol;
-                arc.dest_state = state_idx1;
-                break;
-              case 2:  // the arc pointing to the next symbol state
-                arc.label = next_symbol;
-                aux_labels_value = sym_state_idx01 + 1 == sym_final_state ?
-                    -1 : next_symbol;
-                arc.dest_state = state_idx1 + 2;
-                break;
-              default:
-                K2_LOG(FATAL) << "Arc index must be less than 3";
-            }
-          }
+      c, num_jobs, lambda_set_arcs, (int32_t job)->void {
+        int32_t fsa_idx0, symbol_idx1, current_symbol, next_symbol;
+        bool final_blank;
+        if (job < num_symbols) {
+          int32_t symbol_idx01 = job;
+          fsa_idx0 = symbols_row_ids1_data[symbol_idx01];
+          symbol_idx1 = symbol_idx01 - symbols_row_splits1_data[fsa_idx0];
+          current_symbol = symbols_data[symbol_idx01];
+          next_symbol =
+              symbol_idx01 + 1 == symbols_row_splits1_data[fsa_idx0 + 1]
+                  ? -1
+                  : symbols_data[symbol_idx01 + 1];
+          final_blank = false;
         } else {
-          K2_CHECK_LT(arc_idx2, 2);
-          arc.label = arc_idx2 == 0 ? 0 : current_symbol;
-          arc.dest_state = arc_idx2 == 0 ? state_idx1 : state_idx1 + 1;
-          aux_labels_value = arc_idx2 == 0 ? 0 : current_symbol;
-          if (final_state && arc_idx2 != 0) aux_labels_value = -1;
+          fsa_idx0 = job - num_symbols;
+          symbol_idx1 = symbols_row_splits1_data[fsa_idx0 + 1] -
+                        symbols_row_splits1_data[fsa_idx0];
+          // the blank state before the final state points to it.
+          current_symbol = -1;
+          final_blank = true;
+        }
+        int32_t blank_state_idx1 = 2 * symbol_idx1,
+                blank_state_idx01 =
+                    row_splits1_data[fsa_idx0] + blank_state_idx1,
+                arc_idx012 = row_splits2_data[blank_state_idx01];
+
+        // The arcs leaving the blank state: a self-loop and an arc to the
+        // symbol state (or to the final state).
+        arcs_data[arc_idx012] =
+            Arc(blank_state_idx1, blank_state_idx1, 0, 0.0);
+        arcs_data[arc_idx012 + 1] =
+            Arc(blank_state_idx1, blank_state_idx1 + 1, current_symbol, 0.0);
+        row_ids2_data[arc_idx012] = blank_state_idx01;
+        row_ids2_data[arc_idx012 + 1] = blank_state_idx01;
+        if (aux_labels_data) {
+          aux_labels_data[arc_idx012] = 0;
+          aux_labels_data[arc_idx012 + 1] = current_symbol;
+        }
+        if (final_blank) return;
+
+        // The arcs leaving the symbol state: an arc to the next blank
+        // state, a self-loop and, if allowed, an arc to the next symbol
+        // state (or to the final state).
+        int32_t symbol_state_idx1 = blank_state_idx1 + 1,
+                symbol_state_idx01 = blank_state_idx01 + 1;
+        arc_idx012 = row_splits2_data[symbol_state_idx01];
+        arcs_data[arc_idx012] =
+            Arc(symbol_state_idx1, symbol_state_idx1 + 1, 0, 0.0);
+        arcs_data[arc_idx012 + 1] =
+            Arc(symbol_state_idx1, symbol_state_idx1, current_symbol, 0.0);
+        row_ids2_data[arc_idx012] = symbol_state_idx01;
+        row_ids2_data[arc_idx012 + 1] = symbol_state_idx01;
+        if (aux_labels_data) {
+          aux_labels_data[arc_idx012] = 0;
+          aux_labels_data[arc_idx012 + 1] = 0;
+        }
+        if (modified || current_symbol != next_symbol) {
+          arcs_data[arc_idx012 + 2] = Arc(
+              symbol_state_idx1, symbol_state_idx1 + 2, next_symbol, 0.0);
+          row_ids2_data[arc_idx012 + 2] = symbol_state_idx01;
+          if (aux_labels_data) aux_labels_data[arc_idx012 + 2] = next_symbol;
         }
-        arcs_data[arc_idx012] = arc;
-        if (aux_labels) aux_labels_data[arc_idx012] = aux_labels_value;
       });
-  return Ragged<Arc>(ctc_shape, arcs);
+  return Ragged<Arc>(RaggedShape3(&row_splits1, &row_ids1, num_states,
+                                  &row_splits2, &row_ids2, num_arcs),
+                     arcs);
 }
 
 Fsa CtcTopo(const ContextPtr &c, int32_t max_token, bool modified,
@@ -780,8 +1273,14 @@ Fsa CtcTopo(const ContextPtr &c, int32_t max_token, bool modified,
         }
         arcs_data[idx01] = arc;
       });
+    // Each state but state 0 and the final state has two arcs.
     Array1<int32_t> row_splits(c, states + 1);
-    RowIdsToRowSplits(row_ids, &row_splits);
+    int32_t *row_splits_data = row_splits.Data();
+    K2_EVAL(
+      c, states + 1, lambda_set_row_splits, (int32_t i) -> void {
+        row_splits_data[i] =
+            i == 0 ? 0 : (states - 1) * 2 + (min(i, states - 1) - 1) * 2;
+      });
     return Ragged<Arc>(RaggedShape2(&row_splits, &row_ids, num_arcs), arcs);
   } else {
     // plusing 2 here to include 0(epsilon) and final state
@@ -811,7 +1310,11 @@ Fsa CtcTopo(const ContextPtr &c, int32_t max_token, bool modified,
           aux_labels_data[i * dim1 + j] = olabel;
       });
     Array1<int32_t> row_splits(c, states + 1);
-    RowIdsToRowSplits(row_ids, &row_splits);
+    int32_t *row_splits_data = row_splits.Data();
+    K2_EVAL(
+      c, states + 1, lambda_set_row_splits, (int32_t i) -> void {
+        row_splits_data[i] = min(i, dim0) * dim1;
+      });
     return Ragged<Arc>(RaggedShape2(&row_splits, &row_ids, dim0 * dim1), arcs);
   }
 }
@@ -821,11 +1324,12 @@ Fsa TrivialGraph(const ContextPtr &c, int32_t max_token,
   NVTX_RANGE(K2_FUNC);
   K2_CHECK(aux_labels);
   int32_t num_arcs = max_token + 1;
-  Array1<int32_t> row_splits(c, std::vector<int32_t>{0, num_arcs, num_arcs});
+  Array1<int32_t> row_splits(c, 3);
   Array1<int32_t> row_ids(c, num_arcs);
   Array1<Arc> values(c, num_arcs);
   *aux_labels = Array1<int32_t>(c, num_arcs);
-  int32_t *row_ids_data = row_ids.Data(),
+  int32_t *row_splits_data = row_splits.Data(),
+          *row_ids_data = row_ids.Data(),
           *aux_labels_data = aux_labels->Data();
   Arc *values_data = values.Data();
 
@@ -842,6 +1346,12 @@ Fsa TrivialGraph(const ContextPtr &c, int32_t max_token,
           arc.label = -1;
           aux_label = -1;
         }
+        if (idx == 0) {
+          // state 1 is the final state and has no leaving arcs.
+          row_splits_data[0] = 0;
+          row_splits_data[1] = num_arcs;
+          row_splits_data[2] = num_arcs;
+        }
         row_ids_data[idx] = row_id;
         values_data[idx] = arc;
         aux_labels_data[idx] = aux_label;
@@ -849,26 +1359,133 @@ Fsa TrivialGraph(const ContextPtr &c, int32_t max_token,
   return Ragged<Arc>(RaggedShape2(&row_splits, &row_ids, num_arcs), values);
 }
 
+// Returns a key whose order as an unsigned integer is the order of
+// Arc::operator< (label compared as unsigned, then dest_state, which is
+// never negative).
+static __host__ __device__ __forceinline__ uint64_t ArcSortKey(
+    const Arc &arc) {
+  return (static_cast<uint64_t>(static_cast<uint32_t>(arc.label)) << 32) |
+         static_cast<uint32_t>(arc.dest_state);
+}
+
+/* Sort the arcs leaving each state of `fsa`, which must be on GPU, in place.
+   The method is chosen by the number of arcs per state:
+
+     - If no state has more than kMaxArcsForThreadSort arcs (the usual case
+       for decoding graphs), each thread insertion-sorts the arcs of one
+       state; this avoids the per-segment overhead of library segmented
+       sorts, which dominates for millions of tiny sublists.
+     - Else, if the average number of arcs per state is at least
+       kMinArcsForRadixSort, the 64-bit keys from ArcSortKey() are sorted
+       with cub's segmented radix sort (one thread block per state).
+     - Else, moderngpu's segmented mergesort is used, as in SortSublists().
+
+   All of these are stable.  If `arc_map` is not NULL, it is set to the
+   permutation applied (new arc index -> old arc index).
+*/
+static void ArcSortCuda(Fsa *fsa, Array1<int32_t> *arc_map) {
+  NVTX_RANGE(K2_FUNC);
+  const int32_t kMaxArcsForThreadSort = 32,
+                kMinArcsForRadixSort = 256;
+  ContextPtr &c = fsa->Context();
+  K2_CHECK_EQ(c->GetDeviceType(), kCuda);
+  int32_t last_axis = fsa->NumAxes() - 1,
+      num_arcs = fsa->values.Dim();
+  Array1<int32_t> &row_splits = fsa->RowSplits(last_axis);
+  int32_t num_states = row_splits.Dim() - 1;
+  int32_t max_arcs = fsa->shape.MaxSize(last_axis);
+
+  if (max_arcs <= kMaxArcsForThreadSort) {
+    if (arc_map != nullptr) *arc_map = Range(c, num_arcs, 0);
+    Arc *arcs_data = fsa->values.Data();
+    int32_t *arc_map_data = (arc_map != nullptr ? arc_map->Data() : nullptr);
+    const int32_t *row_splits_data = row_splits.Data();
+    K2_EVAL(
+        c, num_states, lambda_sort_arcs, (int32_t state_idx)->void {
+          int32_t begin = row_splits_data[state_idx],
+                  end = row_splits_data[state_idx + 1];
+          for (int32_t i = begin + 1; i < end; ++i) {
+            Arc arc = arcs_data[i];
+            uint64_t key = ArcSortKey(arc);
+            int32_t map = (arc_map_data != nullptr ? arc_map_data[i] : 0);
+            int32_t j = i;
+            for (; j > begin && ArcSortKey(arcs_data[j - 1]) > key; --j) {
+              arcs_data[j] = arcs_data[j - 1];
+              if (arc_map_data != nullptr)
+                arc_map_data[j] = arc_map_data[j - 1];
+            }
+            arcs_data[j] = arc;
+            if (arc_map_data != nullptr) arc_map_data[j] = map;
+          }
+        });
+    return;
+  }
+
+#if __CUDACC_VER_MAJOR__ > 10 ||   \
+    (__CUDACC_VER_MAJOR__ == 10 && \
+     (__CUDACC_VER_MINOR__ > 1 ||  \
+      (__CUDACC_VER_MINOR__ == 1 && __CUDACC_VER_BUILD__ > 105)))
+  // NVCC 10.1.105 has a known issue for cub's radix sort; see
+  // GetTransposeReordering() in ragged_ops.cu.
+  if (num_arcs >= static_cast<int64_t>(kMinArcsForRadixSort) * num_states) {
+    Array1<uint64_t> keys(c, num_arcs), sorted_keys(c, num_arcs);
+    const Arc *arcs_data = fsa->values.Data();
+    uint64_t *keys_data = keys.Data();
+    K2_EVAL(
+        c, num_arcs, lambda_set_keys, (int32_t arc_idx)->void {
+          keys_data[arc_idx] = ArcSortKey(arcs_data[arc_idx]);
+        });
+    Array1<int32_t> indexes = Range(c, num_arcs, 0),
+                    sorted_indexes(c, num_arcs);
+    cudaStream_t stream = c->GetCudaStream();
+    std::size_t temp_storage_bytes = 0;
+    K2_CUDA_SAFE_CALL(cub::DeviceSegmentedRadixSort::SortPairs(
+        nullptr, temp_storage_bytes, keys.Data(), sorted_keys.Data(),
+        indexes.Data(), sorted_indexes.Data(), num_arcs, num_states,
+        row_splits.Data(), row_splits.Data() + 1, 0, 64, stream));
+    Array1<int8_t> d_temp_storage(c, temp_storage_bytes);
+    K2_CUDA_SAFE_CALL(cub::DeviceSegmentedRadixSort::SortPairs(
+        d_temp_storage.Data(), temp_storage_bytes, keys.Data(),
+        sorted_keys.Data(), indexes.Data(), sorted_indexes.Data(), num_arcs,
+        num_states, row_splits.Data(), row_splits.Data() + 1, 0, 64,
+        stream));
+    // Copy back so that the sort is in place like SortSublists().
+    fsa->values.CopyFrom(fsa->values[sorted_indexes]);
+    if (arc_map != nullptr) *arc_map = sorted_indexes;
+    return;
+  }
+#endif  // __CUDACC_VER_MAJOR__
+
+  if (arc_map != nullptr) *arc_map = Array1<int32_t>(c, num_arcs);
+  SortSublists<Arc>(fsa, arc_map);
+}
+
 void ArcSort(Fsa *fsa) {
   if (fsa->NumAxes() < 2) return;  // it is empty
-  SortSublists<Arc>(fsa);
+  if (fsa->values.Dim() != 0 && fsa->Context()->GetDeviceType() == kCuda)
+    ArcSortCuda(fsa, nullptr);
+  else
+    SortSublists<Arc>(fsa);
 }
 
 void ArcSort(Fsa &src, Fsa *dest, Array1<int32_t> *arc_map /*= nullptr*/) {
-  NVTX_RANGE(K2_FUNC);
+  NVTX_RANGE_PAYLOAD(K2_FUNC, kFsaAlgo, src.NumElements());
   if (!src.values.IsValid()) return;
 
-  if (arc_map != nullptr)
-    *arc_map = Array1<int32_t>(src.Context(), src.NumElements());
-
   Fsa tmp(src.shape, src.values.Clone());
-  SortSublists<Arc>(&tmp, arc_map);
+  if (src.NumElements() != 0 && src.Context()->GetDeviceType() == kCuda) {
+    ArcSortCuda(&tmp, arc_map);
+  } else {
+    if (arc_map != nullptr)
+      *arc_map = Array1<int32_t>(src.Context(), src.NumElements());
+    SortSublists<Arc>(&tmp, arc_map);
+  }
   *dest = tmp;
 }
 
 Ragged<int32_t> ShortestPath(FsaVec &fsas,
                              const Array1<int32_t> &entering_arcs) {
-  NVTX_RANGE(K2_FUNC);
+  NVTX_RANGE_PAYLOAD(K2_FUNC, kFsaAlgo, fsas.NumElements());
   K2_CHECK_EQ(fsas.NumAxes(), 3);
   const int32_t *entering_arcs_data = entering_arcs.Data();
   const Arc *arcs_data = fsas.values.Data();
@@ -1145,7 +1762,12 @@ Ragged<int32_t> ShortestPath(FsaVec &fsas,
 
 void AddEpsilonSelfLoops(FsaOrVec &src, FsaOrVec *dest,
                          Array1<int32_t> *arc_map /*= nullptr*/) {
-  NVTX_RANGE(K2_FUNC);
+  AddEpsilonSelfLoops(src, nullptr, dest, arc_map);
+}
+
+void AddEpsilonSelfLoops(FsaOrVec &src, FsaVecBuffer *buffer, FsaOrVec *dest,
+                         Array1<int32_t> *arc_map /*= nullptr*/) {
+  NVTX_RANGE_PAYLOAD(K2_FUNC, kFsaAlgo, src.NumElements());
   ContextPtr &c = src.Context();
   const int32_t *old_row_splits1_data = src.RowSplits(1).Data(),
                 *old_row_ids1_data = src.RowIds(1).Data();
@@ -1161,15 +1783,20 @@ void AddEpsilonSelfLoops(FsaOrVec &src, FsaOrVec *dest,
 
     int32_t old_num_arcs = src.TotSize(1),
             new_num_arcs = old_num_arcs + (num_states - 1);
-    Array1<int32_t> new_row_splits(c, num_states + 1),
-        new_row_ids(c, new_num_arcs);
-    Array1<Arc> new_arcs(c, new_num_arcs);
+    Array1<int32_t> new_row_splits = BufferArray(
+                        c, num_states + 1,
+                        buffer ? &buffer->row_splits1 : nullptr),
+                    new_row_ids = BufferArray(
+                        c, new_num_arcs, buffer ? &buffer->row_ids1 : nullptr);
+    Array1<Arc> new_arcs =
+        BufferArray(c, new_num_arcs, buffer ? &buffer->arcs : nullptr);
     int32_t *new_row_splits1_data = new_row_splits.Data(),
             *new_row_ids1_data = new_row_ids.Data();
     Arc *new_arcs_data = new_arcs.Data();
     int32_t *arc_map_data = nullptr;
     if (arc_map) {
-      *arc_map = Array1<int32_t>(c, new_num_arcs);
+      *arc_map = BufferArray(c, new_num_arcs,
+                             buffer ? &buffer->arc_map : nullptr);
       arc_map_data = arc_map->Data();
     }
     ParallelRunner pr(c);
@@ -1233,9 +1860,13 @@ void AddEpsilonSelfLoops(FsaOrVec &src, FsaOrVec *dest,
     // we subtract `num_nonempty_fsas` because final-states don't get a
     // self-loop.
 
-    Array1<int32_t> new_row_splits2(c, num_states + 1),
-        new_row_ids2(c, new_num_arcs);
-    Array1<Arc> new_arcs(c, new_num_arcs);
+    Array1<int32_t> new_row_splits2 = BufferArray(
+                        c, num_states + 1,
+                        buffer ? &buffer->row_splits2 : nullptr),
+                    new_row_ids2 = BufferArray(
+                        c, new_num_arcs, buffer ? &buffer->row_ids2 : nullptr);
+    Array1<Arc> new_arcs =
+        BufferArray(c, new_num_arcs, buffer ? &buffer->arcs : nullptr);
     // fsa_idx0_mod_data maps from fsa_idx0 to a modified fsa_idx0 that
     // "doesn't count" FSAs with zero states.
     const int32_t *fsa_idx0_mod_data = fsa_nonempty_data;
@@ -1244,7 +1875,8 @@ void AddEpsilonSelfLoops(FsaOrVec &src, FsaOrVec *dest,
     Arc *new_arcs_data = new_arcs.Data();
     int32_t *arc_map_data = nullptr;
     if (arc_map) {
-      *arc_map = Array1<int32_t>(c, new_num_arcs);
+      *arc_map = BufferArray(c, new_num_arcs,
+                             buffer ? &buffer->arc_map : nullptr);
       arc_map_data = arc_map->Data();
     }
     ParallelRunner pr(c);
@@ -1393,103 +2025,208 @@ Fsa Union(FsaVec &fsas, Array1<int32_t> *arc_map /*= nullptr*/) {
   return ans;
 }
 
-Fsa Closure(Fsa &fsa, Array1<int32_t> *arc_map /* = nullptr*/) {
+FsaVec Union(FsaVec &fsas, Ragged<int32_t> &groups,
+             Array1<int32_t> *arc_map /*= nullptr*/) {
   NVTX_RANGE(K2_FUNC);
-  K2_CHECK_EQ(fsa.NumAxes(), 2) << "We support only a single FSA.";
-  ContextPtr &c = fsa.Context();
-
-  int32_t num_states = fsa.Dim0();
-  if (num_states < 2) {
-    K2_CHECK_EQ(num_states, 0)
-        << "An empty fsa should contain no states at all";
-    if (arc_map != nullptr) *arc_map = Array1<int32_t>(c, 0);
-    return fsa;  // return itself if the input fsa is empty
-  }
+  K2_CHECK_EQ(fsas.NumAxes(), 3);
+  K2_CHECK_EQ(groups.NumAxes(), 2);
+  ContextPtr c = GetContext(fsas, groups);
+
+  // The members of all groups, one after another: member m of `sub` is
+  // fsas[groups.values[m]], so the arcs of the members of a group are
+  // contiguous in `sub`.
+  Array1<int32_t> sub_arc_map;
+  FsaVec sub = Index(fsas, 0, groups.values, &sub_arc_map);
+
+  int32_t num_groups = groups.Dim0(), num_members = sub.Dim0(),
+          num_sub_arcs = sub.NumElements();
+  const int32_t *groups_row_splits1_data = groups.RowSplits(1).Data(),
+                *groups_row_ids1_data = groups.RowIds(1).Data(),
+                *sub_row_splits1_data = sub.RowSplits(1).Data(),
+                *sub_row_splits2_data = sub.RowSplits(2).Data(),
+                *sub_row_ids1_data = sub.RowIds(1).Data(),
+                *sub_row_ids2_data = sub.RowIds(2).Data(),
+                *sub_arc_map_data = sub_arc_map.Data();
+  const Arc *sub_arcs_data = sub.values.Data();
+
+  // As in Union() above, the union of n FSAs with a total of num_states
+  // states has num_states + 2 - n states; the union of no FSAs is empty.
+  Array1<int32_t> out_row_splits1(c, num_groups + 1);
+  int32_t *out_row_splits1_data = out_row_splits1.Data();
+  K2_EVAL(
+      c, num_groups, lambda_count_states, (int32_t group_idx0) {
+        int32_t begin = groups_row_splits1_data[group_idx0],
+                end = groups_row_splits1_data[group_idx0 + 1];
+        int32_t num_states =
+            sub_row_splits1_data[end] - sub_row_splits1_data[begin];
+        out_row_splits1_data[group_idx0] =
+            (end == begin ? 0 : num_states + 2 - (end - begin));
+      });
+  ExclusiveSum(out_row_splits1, &out_row_splits1);
+  int32_t num_out_states = out_row_splits1.Back();
+
+  // The arcs of the union of a group are an arc from the new start state to
+  // the start state of each member, followed by the arcs of the members; so
+  // arc i of `sub`, in group g, becomes arc i + groups_row_splits1[g + 1] of
+  // the output.
+  int32_t num_out_arcs = num_sub_arcs + num_members;
+  Array1<int32_t> out_row_ids2(c, num_out_arcs);
+  Array1<Arc> out_arcs(c, num_out_arcs);
+  Array1<int32_t> tmp_arc_map(c, num_out_arcs);
+  int32_t *out_row_ids2_data = out_row_ids2.Data(),
+          *tmp_arc_map_data = tmp_arc_map.Data();
+  Arc *out_arcs_data = out_arcs.Data();
 
-  const int32_t *fsa_row_splits_data = fsa.RowSplits(1).Data();
-  const int32_t *fsa_row_ids_data = fsa.RowIds(1).Data();
-  const Arc *fsa_arcs_data = fsa.values.Data();
-  int32_t fsa_final_state = num_states - 1;
+  K2_EVAL(
+      c, num_members, lambda_set_start_arcs, (int32_t member_idx01) {
+        int32_t group_idx0 = groups_row_ids1_data[member_idx01],
+                member_idx0x = groups_row_splits1_data[group_idx0],
+                member_idx1 = member_idx01 - member_idx0x,
+                sub_state_idx0x = sub_row_splits1_data[member_idx0x];
+        // Each preceding member of the group lost its final state.
+        int32_t start_state_idx1 = 1 + sub_row_splits1_data[member_idx01] -
+                                   sub_state_idx0x - member_idx1;
+        int32_t out_arc_idx012 = sub_row_splits2_data[sub_state_idx0x] +
+                                 member_idx0x + member_idx1;
+        out_arcs_data[out_arc_idx012] = Arc(0, start_state_idx1, 0, 0);
+        out_row_ids2_data[out_arc_idx012] = out_row_splits1_data[group_idx0];
+        tmp_arc_map_data[out_arc_idx012] = -1;
+      });
 
-  int32_t num_out_states = num_states;
+  K2_EVAL(
+      c, num_sub_arcs, lambda_set_arcs, (int32_t sub_arc_idx012) {
+        int32_t sub_state_idx01 = sub_row_ids2_data[sub_arc_idx012],
+                member_idx01 = sub_row_ids1_data[sub_state_idx01],
+                group_idx0 = groups_row_ids1_data[member_idx01],
+                member_idx0x = groups_row_splits1_data[group_idx0],
+                member_idx1 = member_idx01 - member_idx0x;
+        int32_t member_final_state_idx01 =
+            sub_row_splits1_data[member_idx01 + 1] - 1;
+        K2_DCHECK_GT(member_final_state_idx01, sub_state_idx01)
+            << "We support only FSAs with at least two states at present";
+        int32_t member_state_idx0x = sub_row_splits1_data[member_idx01],
+                out_state_idx0x = out_row_splits1_data[group_idx0],
+                out_final_state_idx1 =
+                    out_row_splits1_data[group_idx0 + 1] - out_state_idx0x - 1;
+        int32_t out_state_idx1 = 1 + sub_state_idx01 -
+                                 sub_row_splits1_data[member_idx0x] -
+                                 member_idx1;
+
+        Arc arc = sub_arcs_data[sub_arc_idx012];
+        if (arc.dest_state ==
+            member_final_state_idx01 - member_state_idx0x)
+          arc.dest_state = out_final_state_idx1;
+        else
+          arc.dest_state = arc.dest_state - arc.src_state + out_state_idx1;
+        arc.src_state = out_state_idx1;
+
+        int32_t out_arc_idx012 =
+            sub_arc_idx012 + groups_row_splits1_data[group_idx0 + 1];
+        out_arcs_data[out_arc_idx012] = arc;
+        out_row_ids2_data[out_arc_idx012] = out_state_idx0x + out_state_idx1;
+        tmp_arc_map_data[out_arc_idx012] = sub_arc_map_data[sub_arc_idx012];
+      });
 
-  // An arc from the start state to the final state with label == -1 is added.
-  int32_t num_out_arcs = fsa.values.Dim() + 1;
+  if (arc_map != nullptr) *arc_map = std::move(tmp_arc_map);
+  Array1<int32_t> out_row_splits2(c, num_out_states + 1);
+  RowIdsToRowSplits(out_row_ids2, &out_row_splits2);
+  RaggedShape shape =
+      RaggedShape3(&out_row_splits1, nullptr, num_out_states,
+                   &out_row_splits2, &out_row_ids2, num_out_arcs);
+  return FsaVec(shape, out_arcs);
+}
 
-  Array1<int32_t> out_row_ids(c, num_out_arcs);
-  int32_t *out_row_ids_data = out_row_ids.Data();
+// Closure() of each FSA of `fsas`, see its documentation.
+static FsaVec ClosureVec(FsaVec &fsas, Array1<int32_t> *arc_map) {
+  NVTX_RANGE(K2_FUNC);
+  ContextPtr &c = fsas.Context();
+  int32_t num_fsas = fsas.Dim0(), num_states = fsas.TotSize(1),
+          num_arcs = fsas.NumElements();
+  const int32_t *fsas_row_splits1_data = fsas.RowSplits(1).Data(),
+                *fsas_row_ids1_data = fsas.RowIds(1).Data(),
+                *fsas_row_splits2_data = fsas.RowSplits(2).Data(),
+                *fsas_row_ids2_data = fsas.RowIds(2).Data();
+  const Arc *fsas_arcs_data = fsas.values.Data();
+
+  // An arc from the start state to the final state is added to each
+  // non-empty FSA; arcs_offset[i] is the number of arcs added to the FSAs
+  // before the i'th.
+  Array1<int32_t> arcs_offset(c, num_fsas + 1);
+  int32_t *arcs_offset_data = arcs_offset.Data();
+  K2_EVAL(
+      c, num_fsas, lambda_set_num_new_arcs, (int32_t fsa_idx0) {
+        int32_t num_states = fsas_row_splits1_data[fsa_idx0 + 1] -
+                             fsas_row_splits1_data[fsa_idx0];
+        K2_DCHECK_NE(num_states, 1)
+            << "An empty fsa should contain no states at all";
+        arcs_offset_data[fsa_idx0] = (num_states != 0);
+      });
+  ExclusiveSum(arcs_offset, &arcs_offset);
+  int32_t num_out_arcs = num_arcs + arcs_offset.Back();
 
-  Array1<Arc> out_arcs(c, num_out_arcs);
-  Arc *out_arcs_data = out_arcs.Data();
+  // The new arc is the last arc of the start state.
+  Array1<int32_t> out_row_splits2(c, num_states + 1);
+  int32_t *out_row_splits2_data = out_row_splits2.Data();
+  K2_EVAL(
+      c, num_states + 1, lambda_set_row_splits2, (int32_t state_idx01) {
+        if (state_idx01 == num_states) {
+          out_row_splits2_data[state_idx01] = num_out_arcs;
+          return;
+        }
+        int32_t fsa_idx0 = fsas_row_ids1_data[state_idx01];
+        out_row_splits2_data[state_idx01] =
+            fsas_row_splits2_data[state_idx01] + arcs_offset_data[fsa_idx0] +
+            (state_idx01 != fsas_row_splits1_data[fsa_idx0]);
+      });
 
+  Array1<Arc> out_arcs(c, num_out_arcs);
   Array1<int32_t> tmp_arc_map(c, num_out_arcs);
+  Arc *out_arcs_data = out_arcs.Data();
   int32_t *tmp_arc_map_data = tmp_arc_map.Data();
-
   K2_EVAL(
-      c, fsa.values.Dim(), lambda_set_arcs, (int32_t fsa_arc_idx01) {
-        int32_t fsa_state_idx0 = fsa_row_ids_data[fsa_arc_idx01];
-        int32_t fsa_arc_idx0x = fsa_row_splits_data[fsa_state_idx0];
-        int32_t fsa_arc_idx1 = fsa_arc_idx01 - fsa_arc_idx0x;
-        int32_t this_state_num_arcs =
-            fsa_row_splits_data[fsa_state_idx0 + 1] - fsa_arc_idx0x;
-
-        Arc arc = fsa_arcs_data[fsa_arc_idx01];
-        if (arc.dest_state == fsa_final_state) {
-          // modify arcs entering the final state such that:
-          //   - dest_state == 0
-          //   - label == 0
+      c, num_arcs, lambda_set_arcs, (int32_t arc_idx012) {
+        int32_t state_idx01 = fsas_row_ids2_data[arc_idx012],
+                fsa_idx0 = fsas_row_ids1_data[state_idx01],
+                state_idx0x = fsas_row_splits1_data[fsa_idx0],
+                final_state_idx1 =
+                    fsas_row_splits1_data[fsa_idx0 + 1] - state_idx0x - 1;
+        Arc arc = fsas_arcs_data[arc_idx012];
+        if (arc.dest_state == final_state_idx1) {
           arc.dest_state = 0;
           K2_DCHECK_EQ(arc.label, -1);
           arc.label = 0;
         }
-
-        int out_arc_idx01;
-        if (arc.src_state > 0) {
-          // this arc is not originated from the start state, so its index is
-          // incremented
-          out_arc_idx01 = fsa_arc_idx01 + 1;
-        } else {
-          out_arc_idx01 = fsa_arc_idx01;
-          if (fsa_arc_idx1 == this_state_num_arcs - 1) {
-            // This is the last arc of the original start state,
-            // so we add a new arc just after it.
-            Arc new_arc(0, fsa_final_state, -1, 0.0f);
-            out_arcs_data[out_arc_idx01 + 1] = new_arc;
-            out_row_ids_data[out_arc_idx01 + 1] = 0;
-            tmp_arc_map_data[out_arc_idx01 + 1] = -1;
-          }
-        }
-
-        // it may happen that the start state has no leaving arcs
-        if (fsa_row_splits_data[1] == 0) {
-          Arc new_arc(0, fsa_final_state, -1, 0.0f);
-          out_arcs_data[0] = new_arc;
-          out_row_ids_data[0] = 0;
-          tmp_arc_map_data[0] = -1;
-        }
-
-        tmp_arc_map_data[out_arc_idx01] = fsa_arc_idx01;
-
-        out_arcs_data[out_arc_idx01] = arc;
-        out_row_ids_data[out_arc_idx01] = arc.src_state;
+        int32_t out_arc_idx012 = arc_idx012 + arcs_offset_data[fsa_idx0] +
+                                 (state_idx01 != state_idx0x);
+        out_arcs_data[out_arc_idx012] = arc;
+        tmp_arc_map_data[out_arc_idx012] = arc_idx012;
       });
-
-  if (arc_map != nullptr) *arc_map = std::move(tmp_arc_map);
-
-  Array1<int32_t> out_row_splits(c, num_out_states + 1);
-  int32_t *out_row_splits_data = out_row_splits.Data();
-
   K2_EVAL(
-      c, out_row_splits.Dim(), lambda_set_row_splits, (int32_t i) {
-        if (i == 0)
-          out_row_splits_data[i] = 0;
-        else
-          out_row_splits_data[i] = fsa_row_splits_data[i] + 1;
+      c, num_fsas, lambda_set_new_arcs, (int32_t fsa_idx0) {
+        int32_t state_idx0x = fsas_row_splits1_data[fsa_idx0],
+                next_state_idx0x = fsas_row_splits1_data[fsa_idx0 + 1];
+        if (next_state_idx0x == state_idx0x) return;
+        int32_t out_arc_idx012 = out_row_splits2_data[state_idx0x + 1] - 1;
+        out_arcs_data[out_arc_idx012] =
+            Arc(0, next_state_idx0x - state_idx0x - 1, -1, 0.0f);
+        tmp_arc_map_data[out_arc_idx012] = -1;
       });
 
-  RaggedShape shape = RaggedShape2(&out_row_splits, &out_row_ids, num_out_arcs);
-  Fsa ans = Ragged<Arc>(shape, out_arcs);
-  return ans;
+  if (arc_map != nullptr) *arc_map = std::move(tmp_arc_map);
+  RaggedShape shape =
+      RaggedShape3(&fsas.RowSplits(1), &fsas.RowIds(1), num_states,
+                   &out_row_splits2, nullptr, num_out_arcs);
+  return FsaVec(shape, out_arcs);
+}
+
+Fsa Closure(Fsa &fsa, Array1<int32_t> *arc_map /* = nullptr*/) {
+  NVTX_RANGE(K2_FUNC);
+  if (fsa.NumAxes() == 2) {
+    FsaVec fsas = FsaToFsaVec(fsa);
+    return ClosureVec(fsas, arc_map).RemoveAxis(0);
+  }
+  K2_CHECK_EQ(fsa.NumAxes(), 3);
+  return ClosureVec(fsa, arc_map);
 }
 
 FsaOrVec ExpandArcs(FsaOrVec &fsas, RaggedShape &labels_shape,
@@ -1507,126 +2244,49 @@ FsaOrVec ExpandArcs(FsaOrVec &fsas, RaggedShape &labels_shape,
   ContextPtr &c = fsas.Context();
   K2_CHECK(c->IsCompatible(*labels_shape.Context()));
 
-  RaggedShape state_to_arcs = GetLayer(fsas.shape, 1);
-
-  // `state_to_foo` is a RaggedShape that, for each state in `fsas`, has a list
-  // of length `num_arcs + 1`, where `num_arcs` is the number of arcs leaving
-  // this state in `fsas`.  Interpret this as: one element for the state
-  // itself, then one for each arc leaving it.  This `foo` is an index that
-  // corresponds to num-arcs plus one, but because it is really a placeholder
-  // and we want to keep it distinct from other things, we call it `foo`.
-  RaggedShape state_to_foo = ChangeSublistSize(state_to_arcs, 1);
-
-  int32_t foo_size = state_to_foo.NumElements();
-
-  // For each element of `state_to_foo`, `num_ostates_for` says how many states
-  // there will be for this (state,foo) in the returned (output) FSA.  Here, the
-  // idx0 is the state, the idx1 is foo.  If idx1 == 0 (interpret this as "the
-  // state itself"), then `num_ostates_for[idx01] = 1`, meaning "keep the
-  // original state".  Otherwise, idx1 - 1 represents an arc_idx2 [into `fsas`],
-  // and we set `num_ostates_for[idx01] = max(0, seq_len-1)`, where seq_len is
-  // the length of the sequence in `labels_shape` corresponding to this
-  // arc-index.
-  Array1<int32_t> num_ostates_for(c, foo_size + 1);
-  int32_t *num_ostates_for_data = num_ostates_for.Data();
-
+  int32_t num_fsas = fsas.Dim0(), num_states = fsas.TotSize(1),
+          num_arcs = fsas.TotSize(2);
   const int32_t *labels_row_splits1_data = labels_shape.RowSplits(1).Data(),
+                *fsas_row_splits1_data = fsas.RowSplits(1).Data(),
+                *fsas_row_ids1_data = fsas.RowIds(1).Data(),
                 *fsas_row_splits2_data = fsas.RowSplits(2).Data(),
-                *state_to_foo_row_splits1_data =
-                    state_to_foo.RowSplits(1).Data(),
-                *state_to_foo_row_ids1_data = state_to_foo.RowIds(1).Data();
-
+                *fsas_row_ids2_data = fsas.RowIds(2).Data();
+
+  // An arc with a sequence of n labels becomes a chain of max(n, 1) arcs,
+  // i.e. it needs max(n - 1, 0) extra states, each with one arc leaving it.
+  // After the exclusive sum, `num_extra[arc_idx012]` is the number of extra
+  // states (and arcs) for the arcs before it.  In the output, each state is
+  // followed by the extra states of the arcs leaving it, in order, so:
+  //   - state s of `fsas` (an idx01) becomes state
+  //     s + num_extra[fsas.RowSplits(2)[s]], and its arcs start at arc
+  //     fsas.RowSplits(2)[s] + num_extra[fsas.RowSplits(2)[s]];
+  //   - the extra states of arc a leaving s start at state
+  //     s + 1 + num_extra[a], and their arcs at arc
+  //     fsas.RowSplits(2)[s + 1] + num_extra[a].
+  Array1<int32_t> num_extra(c, num_arcs + 1);
+  int32_t *num_extra_data = num_extra.Data();
   K2_EVAL(
-      c, foo_size, lambda_set_num_ostates, (int32_t idx01)->void {
-        // note: the idx01, idx0, idx0x are into `state_to_foo`.
-        // This idx0 is a state-index into `fsas` (an idx01 w.r.t. `fsas`).
-        int32_t idx0 = state_to_foo_row_ids1_data[idx01],
-                idx0x = state_to_foo_row_splits1_data[idx0],
-                idx1 = idx01 - idx0x;  // idx1 is `foo`.
-        int32_t num_ostates;
-        if (idx1 == 0) {
-          num_ostates = 1;  // this is a copy of the original state.
-        } else {
-          int32_t fsas_arc_idx2 = idx1 - 1, fsas_state_idx01 = idx0,
-                  fsas_arc_idx01x = fsas_row_splits2_data[fsas_state_idx01],
-                  fsas_arc_idx012 = fsas_arc_idx01x + fsas_arc_idx2,
-                  labels_shape_idx0 = fsas_arc_idx012,
-                  labels_shape_idx0x =
-                      labels_row_splits1_data[labels_shape_idx0],
-                  labels_shape_idx0x_next =
-                      labels_row_splits1_data[labels_shape_idx0 + 1],
-                  labels_shape_len1 =
-                      labels_shape_idx0x_next - labels_shape_idx0x;
-          // A sequence of n symbols will require n-1 extra states to represent
-          // it.
-          num_ostates = max(labels_shape_len1 - 1, (int32_t)0);
-        }
-        num_ostates_for_data[idx01] = num_ostates;
-      });
-  ExclusiveSum(num_ostates_for, &num_ostates_for);
-  Array1<int32_t> &foo_to_ostates_row_splits = num_ostates_for;
-  RaggedShape foo_to_ostates =
-      RaggedShape2(&foo_to_ostates_row_splits, nullptr, -1);
-
-  // to_ostates_shape has 4 axes: [fsa_id][orig_state][foo][ostate]
-  // where foo is a general-purpose index that ranges over the (num_arcs + 1) of
-  // the original state.
-  RaggedShape to_ostates_shape = ComposeRaggedShapes3(
-      GetLayer(fsas.shape, 0), state_to_foo, foo_to_ostates);
-
-  // Below, `tos` means `to_ostates_shape`.
-  const int32_t *tos_row_splits1_data = to_ostates_shape.RowSplits(1).Data(),
-                *tos_row_ids1_data = to_ostates_shape.RowIds(1).Data(),
-                *tos_row_splits2_data = to_ostates_shape.RowSplits(2).Data(),
-                *tos_row_ids2_data = to_ostates_shape.RowIds(2).Data(),
-                *tos_row_splits3_data = to_ostates_shape.RowSplits(3).Data(),
-                *tos_row_ids3_data = to_ostates_shape.RowIds(3).Data();
-
-  // `num_oarcs` gives the number of arcs in the returned (output) FSA for each
-  // `ostate` (i.e. leaving each state in the returned FSA).
-  int32_t tot_ostates = to_ostates_shape.NumElements();
-  Array1<int32_t> num_oarcs(c, tot_ostates + 1);
-  int32_t *num_oarcs_data = num_oarcs.Data();
-  K2_EVAL(
-      c, tot_ostates, lambda_set_num_oarcs, (int32_t idx0123)->void {
-        // All these indexes are into `to_ostates_shape`, indexed
-        // `[fsa][state][foo][ostate].`
-        int32_t idx012 = tos_row_ids3_data[idx0123],
-                idx012x = tos_row_splits3_data[idx012],
-                idx01 = tos_row_ids2_data[idx012],
-                idx01x = tos_row_splits2_data[idx01],
-                idx01x_next = tos_row_splits2_data[idx01 + 1],
-                len2 = idx01x_next - idx01x, idx2 = idx012 - idx01x,
-                idx3 = idx0123 - idx012x;
-        int32_t num_arcs;
-        if (idx2 == 0) {
-          K2_CHECK_EQ(idx3, 0);
-          // This ostate corresponds to the original state; it is not one of the
-          // extra states added to support chains of arcs.
-          // The original state had `orig_num_arcs` leaving it, which is the
-          // number of `foo` indexes minus one.
-          int32_t orig_num_arcs = len2 - 1;
-          num_arcs = orig_num_arcs;
-        } else {
-          // All newly-created states have exactly one arc leaving them.
-          num_arcs = 1;
-        }
-        num_oarcs_data[idx0123] = num_arcs;
+      c, num_arcs, lambda_set_num_extra, (int32_t arc_idx012)->void {
+        int32_t labels_len1 = labels_row_splits1_data[arc_idx012 + 1] -
+                              labels_row_splits1_data[arc_idx012];
+        num_extra_data[arc_idx012] = max(labels_len1 - 1, (int32_t)0);
       });
-  ExclusiveSum(num_oarcs, &num_oarcs);
-  Array1<int32_t> &ostate_to_oarcs_row_splits = num_oarcs;
-  RaggedShape ostate_to_oarcs =
-      RaggedShape2(&ostate_to_oarcs_row_splits, nullptr, -1);
-
-  // `full_shape` has 5 axes: [fsa][orig_state][foo][ostate][oarc]
-  RaggedShape full_shape =
-      ComposeRaggedShapes(to_ostates_shape, ostate_to_oarcs);
-  // for the lower-order row-splits and row-ids, use tot_row_{splits,idx}n_data
-  const int32_t *full_row_splits4_data = full_shape.RowSplits(4).Data(),
-                *full_row_ids4_data = full_shape.RowIds(4).Data();
-  int32_t tot_oarcs = full_shape.NumElements();
-  K2_CHECK_GE(tot_oarcs, fsas.NumElements());
-
+  ExclusiveSum(num_extra, &num_extra);
+  int32_t tot_extra = num_extra.Back(),
+          tot_ostates = num_states + tot_extra,
+          tot_oarcs = num_arcs + tot_extra;
+
+  // Maps each extra state (or arc) to the arc of `fsas` it belongs to.
+  Array1<int32_t> extra_to_arc(c, tot_extra);
+  RowSplitsToRowIds(num_extra, &extra_to_arc);
+  const int32_t *extra_to_arc_data = extra_to_arc.Data();
+
+  Array1<int32_t> orow_splits1(c, num_fsas + 1), orow_ids1(c, tot_ostates),
+      orow_splits2(c, tot_ostates + 1), orow_ids2(c, tot_oarcs);
+  int32_t *orow_splits1_data = orow_splits1.Data(),
+          *orow_ids1_data = orow_ids1.Data(),
+          *orow_splits2_data = orow_splits2.Data(),
+          *orow_ids2_data = orow_ids2.Data();
   int32_t *fsas_arc_map_data = nullptr, *labels_arc_map_data = nullptr;
   if (fsas_arc_map) {
     *fsas_arc_map = Array1<int32_t>(c, tot_oarcs);
@@ -1640,82 +2300,84 @@ FsaOrVec ExpandArcs(FsaOrVec &fsas, RaggedShape &labels_shape,
   Arc *oarcs_data = oarcs.Data();
   const Arc *arcs_data = fsas.values.Data();
 
+  // The jobs are: one per FSA (plus one, to set the last row splits), one
+  // per state, one per arc (for the first arc of its chain) and one per
+  // extra state (with the arc leaving it).
+  int32_t state_begin = num_fsas + 1, arc_begin = state_begin + num_states,
+          extra_begin = arc_begin + num_arcs,
+          num_jobs = extra_begin + tot_extra;
   K2_EVAL(
-      c, tot_oarcs, lambda_set_arcs, (int32_t idx01234)->void {
-        // All these indexes are into `full_shape`, indexed
-        // `[fsa][state][foo][ostate][oarc].`
-        int32_t idx0123 = full_row_ids4_data[idx01234],
-                idx0123x = full_row_splits4_data[idx0123],
-                idx4 = idx01234 - idx0123x, idx012 = tos_row_ids3_data[idx0123],
-                idx012x = tos_row_splits3_data[idx012],
-                idx3 = idx0123 - idx012x, idx01 = tos_row_ids2_data[idx012],
-                idx01x = tos_row_splits2_data[idx01], idx2 = idx012 - idx01x,
-                idx0 = tos_row_ids1_data[idx01],
-                idx0x = tos_row_splits1_data[idx0],
-                idx0xxx = tos_row_splits3_data[tos_row_splits2_data[idx0x]];
-
-        int32_t fsa_idx01x = fsas_row_splits2_data[idx01];
-
-        int32_t fsa_idx2;  // the idx2 (arc-index) into `fsas` of the input arc
-                           // that's most relevant to us..
-        int32_t seq_pos;  // seq_pos is our index into the sequence of arcs that
-                          // we produce for each original arc
-        if (idx2 == 0) {
-          K2_CHECK_EQ(idx3, 0);
-          fsa_idx2 = idx4;  // corresponds to foo=0, so idx3 will be 0; the idx4
-                            // enumerates the arcs leaving it..
+      c, num_jobs, lambda_set_arcs, (int32_t job)->void {
+        if (job < state_begin) {
+          int32_t fsa_idx0 = job,
+                  state_idx0x = fsas_row_splits1_data[fsa_idx0];
+          orow_splits1_data[fsa_idx0] =
+              state_idx0x + num_extra_data[fsas_row_splits2_data[state_idx0x]];
+          if (fsa_idx0 == num_fsas) orow_splits2_data[tot_ostates] = tot_oarcs;
+          return;
+        }
+        if (job < arc_begin) {
+          int32_t state_idx01 = job - state_begin,
+                  arc_idx01x = fsas_row_splits2_data[state_idx01],
+                  ostate_idx01 = state_idx01 + num_extra_data[arc_idx01x];
+          orow_splits2_data[ostate_idx01] =
+              arc_idx01x + num_extra_data[arc_idx01x];
+          orow_ids1_data[ostate_idx01] = fsas_row_ids1_data[state_idx01];
+          return;
+        }
+        int32_t arc_idx012, seq_pos;  // seq_pos is our index into the
+                                      // chain of arcs for this arc
+        if (job < extra_begin) {
+          arc_idx012 = job - arc_begin;
           seq_pos = 0;
         } else {
-          // this is one of the extra `foo` indexes, one per arc in the input
-          // FSA that leaves this state; each of those `foo` indexes has
-          // (seq_len - 1) states in it (idx3=0,1..seq_len-1); and each state
-          // has one arc leaving it (idx4==0).
-          K2_CHECK_EQ(idx4, 0);
-          fsa_idx2 = idx2 - 1;
-          seq_pos = idx3 + 1;
+          int32_t extra_idx = job - extra_begin;
+          arc_idx012 = extra_to_arc_data[extra_idx];
+          seq_pos = extra_idx - num_extra_data[arc_idx012] + 1;
         }
-        int32_t fsa_idx012 = fsa_idx01x + fsa_idx2;  // index of the arc in
-                                                     // source FSA FSA that
-                                                     // we're expanding..
-        Arc iarc = arcs_data[fsa_idx012];
-
-        int32_t labels_idx0x = labels_row_splits1_data[fsa_idx012],
-                labels_next_idx0x = labels_row_splits1_data[fsa_idx012 + 1],
-                labels_len1 = labels_next_idx0x - labels_idx0x;
-        // labels_len1 is length of label sequence for this arc
-        K2_CHECK_LT(seq_pos, max(int32_t(1), labels_len1));
-
-        int32_t dest_idx01 = idx0x + iarc.dest_state,  // original destination
-                                                       // state-index
-            orig_dest_idx0123 =
-                tos_row_splits3_data[tos_row_splits2_data[dest_idx01]];
-
-        Arc oarc;
-        oarc.src_state = idx0123 - idx0xxx;
-        // If this is the last arc in the sequence, the dest-state is the
-        // original dest-state of the arc.  Otherwise the dest-state is one of
-        // the new states that we created. The idx123 will be an idx1 after
-        // removing axes.
-        int32_t dest_idx123;
-        if (seq_pos + 1 >= labels_len1) {  // last arc in sequence..
-          dest_idx123 = orig_dest_idx0123 - idx0xxx;
+        Arc iarc = arcs_data[arc_idx012];
+        int32_t state_idx01 = fsas_row_ids2_data[arc_idx012],
+                fsa_idx0 = fsas_row_ids1_data[state_idx01],
+                state_idx0x = fsas_row_splits1_data[fsa_idx0],
+                ostate_idx0x =
+                    state_idx0x +
+                    num_extra_data[fsas_row_splits2_data[state_idx0x]],
+                // the first extra state of this arc, if any
+            extra_ostate_idx01 =
+                state_idx01 + 1 + num_extra_data[arc_idx012],
+                labels_idx0x = labels_row_splits1_data[arc_idx012],
+                labels_len1 =
+                    labels_row_splits1_data[arc_idx012 + 1] - labels_idx0x;
+
+        int32_t src_ostate_idx01, oarc_idx012;
+        if (seq_pos == 0) {
+          int32_t arc_idx01x = fsas_row_splits2_data[state_idx01];
+          src_ostate_idx01 = state_idx01 + num_extra_data[arc_idx01x];
+          oarc_idx012 = arc_idx012 + num_extra_data[arc_idx01x];
         } else {
-          int32_t dest_state_idx2 = fsa_idx2 + 1,  // index `foo` equals
-                                                   // orig_arc_idx+1
-              dest_state_idx3 = seq_pos,           // ostate index..
-              dest_idx012 = idx01x + dest_state_idx2,
-                  dest_idx012x = tos_row_splits3_data[dest_idx012],
-                  dest_idx0123 = dest_idx012x + dest_state_idx3;
-          dest_idx123 = dest_idx0123 - idx0xxx;
+          src_ostate_idx01 = extra_ostate_idx01 + seq_pos - 1;
+          oarc_idx012 = fsas_row_splits2_data[state_idx01 + 1] +
+                        num_extra_data[arc_idx012] + seq_pos - 1;
+          orow_splits2_data[src_ostate_idx01] = oarc_idx012;
+          orow_ids1_data[src_ostate_idx01] = fsa_idx0;
         }
-        oarc.dest_state = dest_idx123;  // indexes 1,2,3 will be combined; in
-                                        // the output FSA it will be an idx1.
-
-        if (fsas_arc_map_data)
-          fsas_arc_map_data[idx01234] = (seq_pos == 0 ? fsa_idx012 : -1);
-        if (labels_arc_map_data)
-          labels_arc_map_data[idx01234] =
-              (seq_pos < labels_len1 ? labels_idx0x + seq_pos : -1);
+        orow_ids2_data[oarc_idx012] = src_ostate_idx01;
+
+        // If this is the last arc in the chain, the dest-state is the
+        // original dest-state of the arc.  Otherwise it is the next extra
+        // state.
+        int32_t dest_ostate_idx01;
+        if (seq_pos + 1 >= labels_len1) {
+          int32_t dest_state_idx01 = state_idx0x + iarc.dest_state;
+          dest_ostate_idx01 =
+              dest_state_idx01 +
+              num_extra_data[fsas_row_splits2_data[dest_state_idx01]];
+        } else {
+          dest_ostate_idx01 = extra_ostate_idx01 + seq_pos;
+        }
+        Arc oarc;
+        oarc.src_state = src_ostate_idx01 - ostate_idx0x;
+        oarc.dest_state = dest_ostate_idx01 - ostate_idx0x;
         if (iarc.label != -1) {
           // normal case.. label goes on 1st arc in sequence
           oarc.label = (seq_pos == 0 ? iarc.label : 0);
@@ -1727,13 +2389,17 @@ FsaOrVec ExpandArcs(FsaOrVec &fsas, RaggedShape &labels_shape,
           oarc.label = (seq_pos + 1 >= labels_len1 ? -1 : 0);
         }
         oarc.score = (seq_pos == 0 ? iarc.score : 0.0);
-        oarcs_data[idx01234] = oarc;
+        oarcs_data[oarc_idx012] = oarc;
+        if (fsas_arc_map_data)
+          fsas_arc_map_data[oarc_idx012] = (seq_pos == 0 ? arc_idx012 : -1);
+        if (labels_arc_map_data)
+          labels_arc_map_data[oarc_idx012] =
+              (seq_pos < labels_len1 ? labels_idx0x + seq_pos : -1);
       });
 
-  // remove current axes 1 and 2... [after removing axis 1, old axis 2 becomes
-  // axis 1, so remove axis 1 twice].
-  RaggedShape temp = RemoveAxis(full_shape, 1);
-  return FsaVec(RemoveAxis(temp, 1), oarcs);
+  return FsaVec(RaggedShape3(&orow_splits1, &orow_ids1, tot_ostates,
+                             &orow_splits2, &orow_ids2, tot_oarcs),
+                oarcs);
 }
 
 
@@ -1798,6 +2464,66 @@ void Invert(FsaOrVec &src, Ragged<int32_t> &src_aux_labels, FsaOrVec *dest,
   if (arc_map != nullptr) *arc_map = src_arc_map;
 }
 
+void ToWordLattice(FsaOrVec &src, Ragged<int32_t> &src_aux_labels,
+                   int32_t properties, FsaOrVec *dest,
+                   Ragged<int32_t> *arc_map /*= nullptr*/) {
+  NVTX_RANGE(K2_FUNC);
+  K2_CHECK_EQ(src_aux_labels.NumAxes(), 2);
+  K2_CHECK_EQ(src_aux_labels.Dim0(), src.NumElements());
+  K2_CHECK(dest != nullptr);
+  ContextPtr c = GetContext(src, src_aux_labels);
+  if (src.NumAxes() == 2) {
+    Fsa *srcs = &src;
+    FsaVec src_vec = CreateFsaVec(1, &srcs), dest_vec;
+    ToWordLattice(src_vec, src_aux_labels, properties, &dest_vec, arc_map);
+    *dest = GetFsaVecElement(dest_vec, 0);
+    return;
+  }
+  // This is Invert() without the token-level aux_labels (they can be
+  // recovered from `arc_map`): we only put the words on the expanded arcs,
+  // and count the epsilons while doing so.
+  Array1<int32_t> src_arc_map, labels_arc_map;
+  FsaVec inverted =
+      ExpandArcs(src, src_aux_labels.shape, &src_arc_map, &labels_arc_map);
+  int32_t num_arcs = inverted.NumElements();
+  Arc *arcs_data = inverted.values.Data();
+  const int32_t *labels_arc_map_data = labels_arc_map.Data(),
+                *src_aux_labels_data = src_aux_labels.values.Data();
+  Array1<int32_t> is_epsilon(c, num_arcs);
+  int32_t *is_epsilon_data = is_epsilon.Data();
+  K2_EVAL(
+      c, num_arcs, lambda_set_labels, (int32_t arc_idx012)->void {
+        int32_t src_aux_labels_idx01 = labels_arc_map_data[arc_idx012];
+        int32_t label = src_aux_labels_idx01 == -1
+                            ? 0
+                            : src_aux_labels_data[src_aux_labels_idx01];
+        arcs_data[arc_idx012].label = label;
+        is_epsilon_data[arc_idx012] = (label == 0);
+      });
+
+  // `arc_map1` maps arcs of `eps_free` to arcs of `inverted`.
+  FsaVec eps_free;
+  Ragged<int32_t> arc_map1;
+  if (Sum(is_epsilon) == 0) {
+    eps_free = inverted;
+    arc_map1 = Ragged<int32_t>(RegularRaggedShape(c, num_arcs, 1),
+                               Range(c, num_arcs, 0));
+  } else {
+    // ExpandArcs() preserves top-sortedness, so `properties` still tells
+    // RemoveEpsilon() whether it can use the host algorithm.
+    RemoveEpsilon(inverted, properties, &eps_free, &arc_map1);
+  }
+  Array1<int32_t> connect_arc_map;
+  Connect(eps_free, dest, &connect_arc_map);
+  arc_map1 = Index(arc_map1, 0, connect_arc_map);
+  if (arc_map != nullptr) {
+    // Only the first arc of each expanded chain carries the score; the
+    // others have -1 in `src_arc_map`.
+    Ragged<int32_t> composed(arc_map1.shape, src_arc_map[arc_map1.values]);
+    *arc_map = RemoveValuesEq(composed, -1);
+  }
+}
+
 // Will be used in InvertHost to process FsaVec input recursively.
 void RecursionWrapperAuxLabels(void (*f)(FsaOrVec &, Ragged<int32_t> &,
                                          FsaOrVec *, Ragged<int32_t> *),
@@ -1879,145 +2605,79 @@ FsaOrVec ReplaceFsa(FsaVec &src, FsaOrVec &index, int32_t symbol_range_begin,
   ContextPtr &c = index.Context();
   K2_CHECK(c->IsCompatible(*src.Context()));
 
-  RaggedShape state_to_arcs = GetLayer(index.shape, 1);
-
-  // `state_to_foo` is a RaggedShape that, for each state in `index`, has a list
-  // of length `tot_arcs + 1`.  Interpret this as: one element for the state
-  // itself, then one for each arc leaving it.  This `foo` is an index that
-  // corresponds to num-arcs plus one, but because it is really a placeholder
-  // and we want to keep it distinct from other things, we call it `foo`.
-  RaggedShape state_to_foo = ChangeSublistSize(state_to_arcs, 1);
-
-  int32_t foo_size = state_to_foo.NumElements(),
-          num_src_fsas = src.Dim0();
-  // For each element of `state_to_foo`, `num_ostates_for` says how many states
-  // there will be for this (state,foo) in the returned (output) FSA.  Here, the
-  // idx0 is the state, the idx1 is foo.  If idx1 == 0 (interpret this as "the
-  // state itself"), then `num_ostates_for[idx01] = 1`, meaning "keep the
-  // original state".  Otherwise, idx1 - 1 represents an arc_idx2 [into `index`]
-  // and we set `num_ostates_for[idx01] = max(0, state_num-1)`, where state_num
-  // is the states number of the fsa in `src` that would repalce into this arc,
-  // the final state of this fsa will identify with the dest-state of this arc,
-  // so we minus 1.
-  Array1<int32_t> num_ostates_for(c, foo_size + 1);
-  int32_t *num_ostates_for_data = num_ostates_for.Data();
-  const Arc *index_arcs_data = index.values.Data();
-
-  const int32_t *src_row_splits1_data = src.RowSplits(1).Data(),
+  // Note: the prefix `index_` means it is an idxXXX w.r.t. `index`, the
+  // prefix `src_` means it is an idxXXX w.r.t. `src`.
+  int32_t num_fsas = index.Dim0(), num_states = index.TotSize(1),
+          num_arcs = index.TotSize(2), num_src_fsas = src.Dim0();
+  const int32_t *index_row_splits1_data = index.RowSplits(1).Data(),
+                *index_row_ids1_data = index.RowIds(1).Data(),
                 *index_row_splits2_data = index.RowSplits(2).Data(),
-                *state_to_foo_row_splits1_data =
-                    state_to_foo.RowSplits(1).Data(),
-                *state_to_foo_row_ids1_data = state_to_foo.RowIds(1).Data();
-
-  K2_EVAL(
-      c, foo_size, lambda_set_num_ostates, (int32_t idx01)->void {
-        // note: the idx01, idx0, idx0x are into `state_to_foo`.
-        // This idx0 is a state-index into `index` (an idx01 w.r.t. `index`).
-        int32_t idx0 = state_to_foo_row_ids1_data[idx01],
-                idx0x = state_to_foo_row_splits1_data[idx0],
-                idx1 = idx01 - idx0x;  // idx1 is `foo`.
-        int32_t num_ostates;
-        if (idx1 == 0) {
-          num_ostates = 1;  // this is a copy of the original state.
-        } else {
-          int32_t index_arc_idx2 = idx1 - 1, index_state_idx01 = idx0,
-                  index_arc_idx01x = index_row_splits2_data[index_state_idx01],
-                  index_arc_idx012 = index_arc_idx01x + index_arc_idx2,
-                  index_label = index_arcs_data[index_arc_idx012].label,
-                  src_idx0 = index_label - symbol_range_begin;
-          // will not replace for this arc
-          if (src_idx0 < 0 || src_idx0 >= num_src_fsas) {
-            num_ostates = 0;
-          } else {
-            int32_t src_idx0x = src_row_splits1_data[src_idx0],
-                    src_idx0x_next = src_row_splits1_data[src_idx0 + 1],
-                    src_len1 = src_idx0x_next - src_idx0x;
-            num_ostates = max(src_len1 - 1, (int32_t)0);
-          }
-        }
-        num_ostates_for_data[idx01] = num_ostates;
-      });
-  ExclusiveSum(num_ostates_for, &num_ostates_for);
-  Array1<int32_t> &foo_to_ostates_row_splits = num_ostates_for;
-  RaggedShape foo_to_ostates =
-      RaggedShape2(&foo_to_ostates_row_splits, nullptr, -1);
-
-  // to_ostates_shape has 4 axes: [fsa_id][orig_state][foo][ostate]
-  // where foo is a general-purpose index that ranges over the (num_arcs + 1) of
-  // the original state.
-  RaggedShape to_ostates_shape = ComposeRaggedShapes3(
-      GetLayer(index.shape, 0), state_to_foo, foo_to_ostates);
-
-  // Below, `tos` means `to_ostates_shape`.
-  const int32_t *tos_row_splits1_data = to_ostates_shape.RowSplits(1).Data(),
-                *tos_row_ids1_data = to_ostates_shape.RowIds(1).Data(),
-                *tos_row_splits2_data = to_ostates_shape.RowSplits(2).Data(),
-                *tos_row_ids2_data = to_ostates_shape.RowIds(2).Data(),
-                *tos_row_splits3_data = to_ostates_shape.RowSplits(3).Data(),
-                *tos_row_ids3_data = to_ostates_shape.RowIds(3).Data(),
+                *index_row_ids2_data = index.RowIds(2).Data(),
+                *src_row_splits1_data = src.RowSplits(1).Data(),
                 *src_row_splits2_data = src.RowSplits(2).Data();
-
-  // `num_oarcs` gives the number of arcs in the returned (output) FSA for each
-  // `ostate` (i.e. leaving each state in the returned FSA).
-  int32_t tot_ostates = to_ostates_shape.NumElements();
-  Array1<int32_t> num_oarcs(c, tot_ostates + 1);
-  int32_t *num_oarcs_data = num_oarcs.Data();
+  const Arc *index_arcs_data = index.values.Data(),
+            *src_arcs_data = src.values.Data();
+
+  // An arc of `index` whose label is replaced by an FSA of `src` with n
+  // states needs max(n - 1, 0) extra states (the final state of that FSA is
+  // identified with the dest-state of the arc), which have the same arcs as
+  // the non-final states of that FSA.  After the exclusive sums,
+  // `num_extra_states[index_arc_idx012]` and `num_extra_arcs[...]` are the
+  // numbers of extra states and arcs for the arcs before it.  In the output,
+  // each state is followed by the extra states of the arcs leaving it, in
+  // order, so:
+  //   - state s of `index` (an idx01) becomes state
+  //     s + num_extra_states[index.RowSplits(2)[s]], and its arcs start at
+  //     arc index.RowSplits(2)[s] + num_extra_arcs[index.RowSplits(2)[s]];
+  //   - the extra states of arc a leaving s start at state
+  //     s + 1 + num_extra_states[a], and their arcs at arc
+  //     index.RowSplits(2)[s + 1] + num_extra_arcs[a].
+  Array1<int32_t> num_extra_states(c, num_arcs + 1),
+      num_extra_arcs(c, num_arcs + 1);
+  int32_t *num_extra_states_data = num_extra_states.Data(),
+          *num_extra_arcs_data = num_extra_arcs.Data();
   K2_EVAL(
-      c, tot_ostates, lambda_set_num_oarcs, (int32_t idx0123)->void {
-        // All these indexes are into `to_ostates_shape`, indexed
-        // `[fsa][state][foo][ostate].`
-        int32_t idx012 = tos_row_ids3_data[idx0123],
-                idx012x = tos_row_splits3_data[idx012],
-                idx01 = tos_row_ids2_data[idx012],
-                idx01x = tos_row_splits2_data[idx01],
-                idx01x_next = tos_row_splits2_data[idx01 + 1],
-                len2 = idx01x_next - idx01x, idx2 = idx012 - idx01x,
-                idx3 = idx0123 - idx012x;
-        int32_t num_arcs;
-        if (idx2 == 0) {
-          K2_CHECK_EQ(idx3, 0);
-          // This ostate corresponds to the original state;
-          // The original state had `orig_num_arcs` leaving it, which is the
-          // number of `foo` indexes minus one.
-          int32_t orig_num_arcs = len2 - 1;
-          num_arcs = orig_num_arcs;
-        } else {
-          // All inserted states have the same num of arcs as in the src.
-          // note: the prefix `index_` means it is an idxXXX w.r.t. `index`.
-          // the prefix `src_` means the variable is an idxXXX w.r.t. `src`.
-          int32_t index_arc_idx2 = idx2 - 1,
-                  index_arc_idx01x = index_row_splits2_data[idx01],
-                  index_arc_idx012 = index_arc_idx01x + index_arc_idx2,
-                  index_label = index_arcs_data[index_arc_idx012].label,
-                  src_fsa_idx0 = index_label - symbol_range_begin;
-          K2_CHECK_GE(src_fsa_idx0, 0);
-          K2_CHECK_LT(src_fsa_idx0, num_src_fsas);
-          int32_t src_state_idx1 = idx3,
-                  src_state_idx0x = src_row_splits1_data[src_fsa_idx0],
-                  src_state_idx01 = src_state_idx0x + src_state_idx1,
-                  src_arc_idx01x = src_row_splits2_data[src_state_idx01],
-                  src_arc_idx01x_next =
-                    src_row_splits2_data[src_state_idx01 + 1],
-                  src_num_arcs = src_arc_idx01x_next - src_arc_idx01x;
-          num_arcs = src_num_arcs;
+      c, num_arcs, lambda_set_num_extra, (int32_t index_arc_idx012)->void {
+        int32_t label = index_arcs_data[index_arc_idx012].label,
+                src_idx0 = label - symbol_range_begin,
+                extra_states = 0, extra_arcs = 0;
+        if (src_idx0 >= 0 && src_idx0 < num_src_fsas) {
+          int32_t src_state_idx0x = src_row_splits1_data[src_idx0],
+                  src_state_idx0x_next = src_row_splits1_data[src_idx0 + 1];
+          if (src_state_idx0x_next > src_state_idx0x) {
+            extra_states = src_state_idx0x_next - src_state_idx0x - 1;
+            extra_arcs = src_row_splits2_data[src_state_idx0x_next - 1] -
+                         src_row_splits2_data[src_state_idx0x];
+          }
         }
-        num_oarcs_data[idx0123] = num_arcs;
+        num_extra_states_data[index_arc_idx012] = extra_states;
+        num_extra_arcs_data[index_arc_idx012] = extra_arcs;
       });
-  ExclusiveSum(num_oarcs, &num_oarcs);
-  Array1<int32_t> &ostate_to_oarcs_row_splits = num_oarcs;
-  RaggedShape ostate_to_oarcs =
-      RaggedShape2(&ostate_to_oarcs_row_splits, nullptr, -1);
-
-  // `full_shape` has 5 axes: [fsa][orig_state][foo][ostate][oarc]
-  RaggedShape full_shape =
-      ComposeRaggedShapes(to_ostates_shape, ostate_to_oarcs);
-
-  // for the lower-order row-splits and row-ids, use tot_row_{splits,ids}n_data
-  const int32_t *full_row_splits4_data = full_shape.RowSplits(4).Data(),
-                *full_row_ids4_data = full_shape.RowIds(4).Data();
-  int32_t tot_oarcs = full_shape.NumElements();
-  K2_CHECK_GE(tot_oarcs, index.NumElements());
-
+  ExclusiveSum(num_extra_states, &num_extra_states);
+  ExclusiveSum(num_extra_arcs, &num_extra_arcs);
+  ScalarReadback readback(c);
+  int32_t tot_extra_states_handle = readback.AddBack(num_extra_states),
+          tot_extra_arcs_handle = readback.AddBack(num_extra_arcs);
+  readback.Sync();
+  int32_t tot_extra_states = readback.Get<int32_t>(tot_extra_states_handle),
+          tot_extra_arcs = readback.Get<int32_t>(tot_extra_arcs_handle),
+          tot_ostates = num_states + tot_extra_states,
+          tot_oarcs = num_arcs + tot_extra_arcs;
+
+  // Map each extra state (or arc) to the arc of `index` it belongs to.
+  Array1<int32_t> extra_state_to_arc(c, tot_extra_states),
+      extra_arc_to_arc(c, tot_extra_arcs);
+  RowSplitsToRowIds(num_extra_states, &extra_state_to_arc);
+  RowSplitsToRowIds(num_extra_arcs, &extra_arc_to_arc);
+  const int32_t *extra_state_to_arc_data = extra_state_to_arc.Data(),
+                *extra_arc_to_arc_data = extra_arc_to_arc.Data();
+
+  Array1<int32_t> orow_splits1(c, num_fsas + 1), orow_ids1(c, tot_ostates),
+      orow_splits2(c, tot_ostates + 1), orow_ids2(c, tot_oarcs);
+  int32_t *orow_splits1_data = orow_splits1.Data(),
+          *orow_ids1_data = orow_ids1.Data(),
+          *orow_splits2_data = orow_splits2.Data(),
+          *orow_ids2_data = orow_ids2.Data();
   int32_t *arc_map_src_data = nullptr, *arc_map_index_data = nullptr;
   if (arc_map_src) {
     *arc_map_src = Array1<int32_t>(c, tot_oarcs);
@@ -2029,132 +2689,149 @@ FsaOrVec ReplaceFsa(FsaVec &src, FsaOrVec &index, int32_t symbol_range_begin,
   }
   Array1<Arc> oarcs(c, tot_oarcs);
   Arc *oarcs_data = oarcs.Data();
-  const Arc *src_arcs_data = src.values.Data();
 
+  // The jobs are: one per FSA (plus one, to set the last row splits), one
+  // per state, one per arc of `index`, one per extra state and one per extra
+  // arc.
+  int32_t state_begin = num_fsas + 1, arc_begin = state_begin + num_states,
+          extra_state_begin = arc_begin + num_arcs,
+          extra_arc_begin = extra_state_begin + tot_extra_states,
+          num_jobs = extra_arc_begin + tot_extra_arcs;
   K2_EVAL(
-      c, tot_oarcs, lambda_set_arcs, (int32_t idx01234)->void {
-        // All these indexes are into `full_shape`, indexed
-        // `[fsa][state][foo][ostate][oarc].`
-        // The prefix `index_` means it is an idxXXX w.r.t. `index`.
-        // the prefix `src_` means the variable is an idxXXX w.r.t. `src`.
-        int32_t idx0123 = full_row_ids4_data[idx01234],
-                idx0123x = full_row_splits4_data[idx0123],
-                idx4 = idx01234 - idx0123x,
-                idx012 = tos_row_ids3_data[idx0123],
-                idx012x = tos_row_splits3_data[idx012],
-                idx3 = idx0123 - idx012x,
-                idx01 = tos_row_ids2_data[idx012],
-                idx01x = tos_row_splits2_data[idx01],
-                idx2 = idx012 - idx01x,
-                idx0 = tos_row_ids1_data[idx01],
-                idx0x = tos_row_splits1_data[idx0],
-                idx0xxx = tos_row_splits3_data[tos_row_splits2_data[idx0x]];
-
-        int32_t index_arc_idx2;  // the idx2 (arc-index) into `index`
-        if (idx2 == 0) {
-          K2_CHECK_EQ(idx3, 0);
-          index_arc_idx2 = idx4;  // corresponds to foo=0, so idx3 will be 0;
-                                  // the idx4 enumerates the arcs leaving it..
-        } else {
-          // this is one of the extra `foo` indexes, it's conrespoding index
-          // into `index` is `foo` index minus 1
-          index_arc_idx2 = idx2 - 1;
+      c, num_jobs, lambda_set_arcs, (int32_t job)->void {
+        if (job < state_begin) {
+          int32_t fsa_idx0 = job,
+                  state_idx0x = index_row_splits1_data[fsa_idx0];
+          orow_splits1_data[fsa_idx0] =
+              state_idx0x +
+              num_extra_states_data[index_row_splits2_data[state_idx0x]];
+          if (fsa_idx0 == num_fsas) orow_splits2_data[tot_ostates] = tot_oarcs;
+          return;
         }
-
-        int32_t index_arc_idx01x = index_row_splits2_data[idx01];
-        // index of the arc in source FSA, FSA that we're replaceing..
-        int32_t index_arc_idx012 = index_arc_idx01x + index_arc_idx2;
-
+        if (job < arc_begin) {
+          int32_t state_idx01 = job - state_begin,
+                  arc_idx01x = index_row_splits2_data[state_idx01],
+                  ostate_idx01 =
+                      state_idx01 + num_extra_states_data[arc_idx01x];
+          orow_splits2_data[ostate_idx01] =
+              arc_idx01x + num_extra_arcs_data[arc_idx01x];
+          orow_ids1_data[ostate_idx01] = index_row_ids1_data[state_idx01];
+          return;
+        }
+        // The remaining jobs each belong to an arc of `index`.
+        int32_t index_arc_idx012;
+        if (job < extra_state_begin)
+          index_arc_idx012 = job - arc_begin;
+        else if (job < extra_arc_begin)
+          index_arc_idx012 = extra_state_to_arc_data[job - extra_state_begin];
+        else
+          index_arc_idx012 = extra_arc_to_arc_data[job - extra_arc_begin];
         Arc index_arc = index_arcs_data[index_arc_idx012];
-        // original destination state-index
-        int32_t dest_state_idx01 = idx0x + index_arc.dest_state,
-                orig_dest_state_idx0123 =
-                  tos_row_splits3_data[tos_row_splits2_data[dest_state_idx01]];
+        int32_t state_idx01 = index_row_ids2_data[index_arc_idx012],
+                fsa_idx0 = index_row_ids1_data[state_idx01],
+                state_idx0x = index_row_splits1_data[fsa_idx0],
+                ostate_idx0x =
+                    state_idx0x +
+                    num_extra_states_data[index_row_splits2_data[state_idx0x]],
+                dest_state_idx01 = state_idx0x + index_arc.dest_state,
+                // the original dest-state of the arc, in the output
+            dest_ostate_idx01 =
+                dest_state_idx01 +
+                num_extra_states_data[index_row_splits2_data[dest_state_idx01]],
+                // the first extra state of this arc, if any
+            extra_ostate_idx01 =
+                state_idx01 + 1 + num_extra_states_data[index_arc_idx012],
+                src_idx0 = index_arc.label - symbol_range_begin;
+        bool replaced = (src_idx0 >= 0 && src_idx0 < num_src_fsas);
+
+        if (job < extra_state_begin) {
+          // The arc of `index` itself.  If it is replaced, it becomes an
+          // epsilon arc to the start state of the FSA in `src` (or, if that
+          // FSA has fewer than 2 states, to its original dest-state).
+          int32_t arc_idx01x = index_row_splits2_data[state_idx01],
+                  src_ostate_idx01 =
+                      state_idx01 + num_extra_states_data[arc_idx01x],
+                  oarc_idx012 =
+                      index_arc_idx012 + num_extra_arcs_data[arc_idx01x];
+          bool has_extra_states = num_extra_states_data[index_arc_idx012 + 1] >
+                                  num_extra_states_data[index_arc_idx012];
+          Arc oarc;
+          oarc.src_state = src_ostate_idx01 - ostate_idx0x;
+          oarc.dest_state = (has_extra_states ? extra_ostate_idx01
+                                              : dest_ostate_idx01) -
+                            ostate_idx0x;
+          // set the label of the arc we are replacing to be 0(epsilon)
+          oarc.label = replaced ? 0 : index_arc.label;
+          oarc.score = index_arc.score;
+          oarcs_data[oarc_idx012] = oarc;
+          orow_ids2_data[oarc_idx012] = src_ostate_idx01;
+          if (arc_map_src_data) arc_map_src_data[oarc_idx012] = -1;
+          if (arc_map_index_data)
+            arc_map_index_data[oarc_idx012] = index_arc_idx012;
+          return;
+        }
+
+        int32_t src_state_idx0x = src_row_splits1_data[src_idx0],
+                src_arc_idx0xx = src_row_splits2_data[src_state_idx0x],
+                extra_arc_idx0 =
+                    index_row_splits2_data[state_idx01 + 1] +
+                    num_extra_arcs_data[index_arc_idx012];
+        if (job < extra_arc_begin) {
+          // An extra state, which is a copy of state `src_state_idx1` of the
+          // FSA in `src`.
+          int32_t src_state_idx1 = job - extra_state_begin -
+                                   num_extra_states_data[index_arc_idx012],
+                  src_state_idx01 = src_state_idx0x + src_state_idx1,
+                  ostate_idx01 = extra_ostate_idx01 + src_state_idx1;
+          orow_splits2_data[ostate_idx01] =
+              extra_arc_idx0 + src_row_splits2_data[src_state_idx01] -
+              src_arc_idx0xx;
+          orow_ids1_data[ostate_idx01] = fsa_idx0;
+          return;
+        }
 
-        Arc src_arc;
+        // An extra arc, which is a copy of an arc of the FSA in `src`.
+        int32_t src_arc_idx12 = job - extra_arc_begin -
+                                num_extra_arcs_data[index_arc_idx012],
+                src_arc_idx012 = src_arc_idx0xx + src_arc_idx12,
+                oarc_idx012 = extra_arc_idx0 + src_arc_idx12;
+        Arc src_arc = src_arcs_data[src_arc_idx012];
+        int32_t src_ostate_idx01 = extra_ostate_idx01 + src_arc.src_state;
         Arc oarc;
-        oarc.src_state = idx0123 - idx0xxx;
-        // initialize mapping index
-        int32_t arc_src_map_idx = -1,
-                arc_index_map_idx = -1;
-        int32_t src_fsa_idx0 = index_arc.label - symbol_range_begin;
-        // will not replace for this arc
-        // dest state is the dest state of index arc
-        if (src_fsa_idx0 < 0 || src_fsa_idx0 >= num_src_fsas) {
-          K2_CHECK_EQ(idx2, 0);
-          oarc.dest_state = orig_dest_state_idx0123 - idx0xxx;
-          oarc.label = index_arc.label;
-          oarc.score = index_arc.score;
-          arc_index_map_idx = index_arc_idx012;
+        oarc.src_state = src_ostate_idx01 - ostate_idx0x;
+        // the arcs to the final state of the FSA in src point to the
+        // dest-state of the arc we're replacing, and become epsilon arcs.
+        if (src_arc.label == -1) {
+          oarc.dest_state = dest_ostate_idx01 - ostate_idx0x;
+          oarc.label = 0;
         } else {
-          int32_t src_state_idx0x = src_row_splits1_data[src_fsa_idx0],
-                  src_state_idx0x_next = src_row_splits1_data[src_fsa_idx0 + 1],
-                  num_states = src_state_idx0x_next - src_state_idx0x,
-                  src_state_idx1 = idx3,
-                  src_state_idx01 = src_state_idx0x + src_state_idx1,
-                  src_arc_idx01x = src_row_splits2_data[src_state_idx01],
-                  src_arc_idx2 = idx4,
-                  src_arc_idx012 = src_arc_idx01x + src_arc_idx2;
-          src_arc = src_arcs_data[src_arc_idx012];
-          // handle the arcs belongs to index
-          if (idx2 == 0) {
-            // if the fsa to be replaced in is empty, this arc would point to
-            // its original dest-state
-            if (0 == num_states) {
-              oarc.dest_state = orig_dest_state_idx0123 - idx0xxx;
-            } else {
-              // this arc would point to the initial state of the fsa in src,
-              // the state id bias to current state(the src-state) is the count
-              // of all the ostates coresponding to the original state util now,
-              // the idx4 enumerates foo index
-              int32_t idx012_t = idx01x + 0,
-                      idx2_t = idx4,
-                      idx012x_t = tos_row_splits3_data[idx012_t],
-                      idx012x_next_t =
-                        tos_row_splits3_data[idx012_t + idx2_t + 1],
-                      bias = idx012x_next_t - idx012x_t;
-              oarc.dest_state = idx0123 + bias - idx0xxx;
-            }
-            // set the label of the arc we are replacing to be 0(epsilon)
-            oarc.label = 0;
-            oarc.score = index_arc.score;
-            arc_index_map_idx = index_arc_idx012;
-          } else {   // handle the arcs belongs to src
-            // the arc point to the final state of the fsa in src would point to
-            // the dest state of the arc we're replaceing
-            if (src_arc.label == -1) {
-              oarc.dest_state = orig_dest_state_idx0123 - idx0xxx;
-            } else {
-              // this is the inner arc of the fsa in src
-              int32_t dest_state_idx012x = idx0123 - idx3,
-                  dest_state_idx0123 = dest_state_idx012x + src_arc.dest_state;
-              oarc.dest_state = dest_state_idx0123 - idx0xxx;
-            }
-            // arcs in src fsas that point to final state would set to epsilon
-            // arc (label from -1 to 0)
-            oarc.label = src_arc.label == -1 ? 0 : src_arc.label;
-            oarc.score = src_arc.score;
-            arc_src_map_idx = src_arc_idx012;
-          }
+          oarc.dest_state =
+              extra_ostate_idx01 + src_arc.dest_state - ostate_idx0x;
+          oarc.label = src_arc.label;
         }
-        if (arc_map_src_data)
-          arc_map_src_data[idx01234] = arc_src_map_idx;
-        if (arc_map_index_data)
-          arc_map_index_data[idx01234] = arc_index_map_idx;
-        oarcs_data[idx01234] = oarc;
+        oarc.score = src_arc.score;
+        oarcs_data[oarc_idx012] = oarc;
+        orow_ids2_data[oarc_idx012] = src_ostate_idx01;
+        if (arc_map_src_data) arc_map_src_data[oarc_idx012] = src_arc_idx012;
+        if (arc_map_index_data) arc_map_index_data[oarc_idx012] = -1;
       });
-  // remove current axes 1 and 2... [after removing axis 1, old axis 2 becomes
-  // axis 1, so remove axis 1 twice].
-  RaggedShape temp = RemoveAxis(full_shape, 1);
-  return FsaVec(RemoveAxis(temp, 1), oarcs);
+
+  return FsaVec(RaggedShape3(&orow_splits1, &orow_ids1, tot_ostates,
+                             &orow_splits2, &orow_ids2, tot_oarcs),
+                oarcs);
 }
 
 FsaOrVec RemoveEpsilonSelfLoops(FsaOrVec &src,
                                 Array1<int32_t> *arc_map /* = nullptr */) {
+  return RemoveEpsilonSelfLoops(src, nullptr, arc_map);
+}
+
+FsaOrVec RemoveEpsilonSelfLoops(FsaOrVec &src, FsaVecBuffer *buffer,
+                                Array1<int32_t> *arc_map /* = nullptr */) {
   NVTX_RANGE(K2_FUNC);
   if (src.NumAxes() == 2) {
     FsaVec temp = FsaToFsaVec(src);
-    return RemoveEpsilonSelfLoops(temp, arc_map).RemoveAxis(0);
+    return RemoveEpsilonSelfLoops(temp, buffer, arc_map).RemoveAxis(0);
   }
   K2_CHECK_EQ(src.NumAxes(), 3);
 
@@ -2176,8 +2853,43 @@ FsaOrVec RemoveEpsilonSelfLoops(FsaOrVec &src,
         }
         keep_list_data[i] = keep;
       });
-  FsaVec ans = Index(src, 2, renumber_lists.New2Old(), arc_map);
-  return ans;
+  if (buffer == nullptr)
+    return Index(src, 2, renumber_lists.New2Old(), arc_map);
+
+  // This does what Index() does, but writes to `buffer`.
+  int32_t num_states = src.TotSize(1),
+          new_num_arcs = renumber_lists.New2Old().Dim();
+  Array1<int32_t> new_row_splits2 =
+                      BufferArray(c, num_states + 1, &buffer->row_splits2),
+                  new_row_ids2 =
+                      BufferArray(c, new_num_arcs, &buffer->row_ids2);
+  Array1<Arc> new_arcs = BufferArray(c, new_num_arcs, &buffer->arcs);
+  int32_t *arc_map_data = nullptr;
+  if (arc_map != nullptr) {
+    *arc_map = BufferArray(c, new_num_arcs, &buffer->arc_map);
+    arc_map_data = arc_map->Data();
+  }
+  const int32_t *old2new_data = renumber_lists.Old2New(true).Data(),
+                *new2old_data = renumber_lists.New2Old().Data(),
+                *old_row_splits2_data = src.RowSplits(2).Data(),
+                *old_row_ids2_data = src.RowIds(2).Data();
+  int32_t *new_row_splits2_data = new_row_splits2.Data(),
+          *new_row_ids2_data = new_row_ids2.Data();
+  Arc *new_arcs_data = new_arcs.Data();
+  K2_EVAL(
+      c, num_states + 1, lambda_set_row_splits, (int32_t i)->void {
+        new_row_splits2_data[i] = old2new_data[old_row_splits2_data[i]];
+      });
+  K2_EVAL(
+      c, new_num_arcs, lambda_set_arcs, (int32_t new_i)->void {
+        int32_t old_i = new2old_data[new_i];
+        new_row_ids2_data[new_i] = old_row_ids2_data[old_i];
+        new_arcs_data[new_i] = arcs_data[old_i];
+        if (arc_map_data) arc_map_data[new_i] = old_i;
+      });
+  return FsaVec(RaggedShape3(&src.RowSplits(1), &src.RowIds(1), num_states,
+                             &new_row_splits2, &new_row_ids2, new_num_arcs),
+                new_arcs);
 }
 
 }  // namespace k2
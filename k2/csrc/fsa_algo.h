@@ -22,7 +22,9 @@
 #define K2_CSRC_FSA_ALGO_H_
 
 #include "k2/csrc/array.h"
+#include "k2/csrc/compact_fsa.h"
 #include "k2/csrc/fsa.h"
+#include "k2/csrc/implicit_topo.h"
 
 namespace k2 {
 
@@ -83,6 +85,17 @@ void ArcSort(FsaOrVec &src, FsaOrVec *dest, Array1<int32_t> *arc_map = nullptr);
       @param [out] arc_map  If not nullptr, at exit a map from arc-indexes in
                       `dest` to their source arc-indexes in `src` will have
                        been assigned to this location.
+      @param [out] state_batches  If not nullptr, it will be set to the
+                      batches of states that the algorithm found, indexed
+                      [batch][fsa][state_list] and containing idx01's into
+                      `dest` (into FsaToFsaVec(*dest) if `src` has 2 axes).
+                      It can be used wherever the result of
+                      GetStateBatches(*dest, true) is needed, e.g. by
+                      GetForwardScores() or FsaVecTopology, to avoid
+                      computing the batches a second time.  (The batches may
+                      differ from those of GetStateBatches(), but each state
+                      only has arcs to states in later batches, self-loops
+                      aside).
 
   Implementation nots: from wikipedia
   https://en.wikipedia.org/wiki/Topological_sorting#Parallel_algorithms
@@ -95,7 +108,26 @@ void ArcSort(FsaOrVec &src, FsaOrVec *dest, Array1<int32_t> *arc_map = nullptr);
   vertices are also removed, there will be a new set of vertices of indegree 0,
   where the procedure is repeated until no vertices are left."
 */
-void TopSort(FsaVec &src, FsaVec *dest, Array1<int32_t> *arc_map = nullptr);
+void TopSort(FsaVec &src, FsaVec *dest, Array1<int32_t> *arc_map = nullptr,
+             Ragged<int32_t> *state_batches = nullptr);
+
+/*
+  Normalize a lattice: this is equivalent to calling Connect(), TopSort() and
+  ArcSort() in that order, but is faster because the arcs are only renumbered
+  and copied once, and only one arc_map is computed.
+
+      @param [in] src  Input Fsa or FsaVec.  The same requirements as for
+                      TopSort() apply to its connected part, i.e. it must
+                      be acyclic (self-loops aside) and have no arcs
+                      entering the start state.
+      @param [out] dest  Output Fsa or FsaVec.  At exit it will be
+                      connected, top-sorted and arc-sorted.
+      @param [out] arc_map  If not nullptr, at exit a map from arc-indexes in
+                      `dest` to their source arc-indexes in `src` will have
+                      been assigned to this location.
+ */
+void NormalizeLattice(FsaOrVec &src, FsaOrVec *dest,
+                      Array1<int32_t> *arc_map = nullptr);
 
 /*
   Same with `TopSort` above, but only works for CPU. It's just a wrapper of
@@ -143,6 +175,43 @@ bool TopSortHost(Fsa &src, Fsa *dest, Array1<int32_t> *arc_map = nullptr);
 void AddEpsilonSelfLoops(FsaOrVec &src, FsaOrVec *dest,
                          Array1<int32_t> *arc_map = nullptr);
 
+struct FsaVecBuffer;  // see below
+
+/*
+  Version of AddEpsilonSelfLoops() that writes the arcs of `dest` and
+  `arc_map` (if not nullptr) to the memory of `buffer`, see FsaVecBuffer; if
+  `buffer` is nullptr it is the same as the version above.  (If you are
+  going to compose with IntersectDevice(), you may not need to add the
+  self-loops at all: see its arg `a_self_loops`).
+ */
+void AddEpsilonSelfLoops(FsaOrVec &src, FsaVecBuffer *buffer, FsaOrVec *dest,
+                         Array1<int32_t> *arc_map = nullptr);
+
+/*
+  Per-frame statistics of the search done by IntersectDensePruned(), for
+  tuning the beams and finding out why some sequences are slow to decode.
+  All arrays have shape (T + 1, num_seqs), where T is the largest number of
+  frames of b_fsas (i.e. b_fsas.shape.MaxSize(1)) and num_seqs is
+  b_fsas.shape.Dim0(); element (t, i) is for frame t of sequence i, and is
+  zero for frames beyond the end of the sequence.  They are on the device
+  of b_fsas, and are filled in as a side-effect of the kernels that are run
+  anyway, so collecting them is cheap.
+ */
+struct IntersectDensePrunedStats {
+  // The number of states active on the frame.
+  Array2<int32_t> num_states;
+  // The number of arcs leaving those states, i.e. the arcs that were scored.
+  Array2<int32_t> num_arcs;
+  // The beam used to prune those arcs; see `search_beam` and
+  // {min,max}_active in IntersectDensePruned().  This is the dynamic beam of
+  // the sequence, scaled as required by `max_active_arcs`; it is very large
+  // on the last frame of each sequence, which is not pruned.
+  Array2<float> beams;
+  // The number of those arcs that are in the output, i.e. that survived
+  // pruning with `output_beam` (and `lattice_beam`).
+  Array2<int32_t> num_output_arcs;
+};
+
 /*
   compose/intersect array of FSAs (multiple streams decoding or training in
   parallel, in a batch)... basically composition with frame-synchronous beam
@@ -153,13 +222,18 @@ void AddEpsilonSelfLoops(FsaOrVec &src, FsaOrVec *dest,
          @param[in] a_fsas   Input FSAs, `decoding graphs`.   There should
                          either be one FSA (3 axes and a_fsas.Dim0() == 1; or
                          2 axes) or a vector of FSAs with the same size as
-                         b_fsas (a_fsas.Dim0() == b_fsas.Dim0()).  We don't
+                         b_fsas (a_fsas.Dim0() == b_fsas.Dim0()), unless
+                         b_to_a_map is given.  We don't
                          currently support having a_fsas.Dim0() > 1 and
                          b_fsas.Dim0() == 1, which is not a fundamental
                          limitation of the algorithm but it would require
                          code changes to support.
          @param[in] b_fsas   Input FSAs that correspond to neural network
-                         outputs (see documentation in fsa.h).
+                         outputs (see documentation in fsa.h).  May be in
+                         the sparse form returned by SparsifyDenseFsaVec(),
+                         and may have 16-bit scores (see
+                         DenseFsaVec::half_scores), which are read as half
+                         and accumulated in float.
          @param[in] search_beam   Beam for frame-synchronous beam pruning,
                     e.g. 20. Smaller is faster, larger is more exact
                     (less pruning). This is the default value; it may be
@@ -191,14 +265,135 @@ void AddEpsilonSelfLoops(FsaOrVec &src, FsaOrVec *dest,
          @param[out] arc_map_b  Will be set to a vector with Dim() equal to
                          the number of arcs in `out`, whose elements contain
                          the corresponding arc-index in b_fsas; this arc-index
-                         is the linear offset into b_fsas.scores.
+                         is the linear offset into b_fsas.scores (see
+                         DenseFsaVec::NumArcs() for the sparse case).
+         @param[in] use_arena  If true, the per-frame data of the search is
+                         allocated from a few large blocks of memory that are
+                         freed together at the end, instead of one small
+                         allocation per array; this reduces allocator
+                         overhead for long sequences at the cost of
+                         somewhat higher peak memory.
+         @param[in] lattice_beam  If > 0 and less than `output_beam`, the
+                         output is pruned once more after the search, over
+                         all frames at once, to keep only the arcs on a path
+                         within `lattice_beam` of the best path (i.e. with a
+                         Viterbi arc posterior of at least
+                         exp(-lattice_beam)).  This is cheaper than calling
+                         GetArcPost() and PruneOnArcPost() on `out`, since
+                         the larger lattice is never created; the pruning
+                         during the search is conservative, so it keeps more
+                         than `output_beam` alone would imply.
+         @param[out] entering_arcs  If not nullptr, will be set to a vector
+                         with Dim() equal to the number of states in `out`,
+                         containing for each state the arc_idx012 in `out`
+                         of the best (Viterbi) arc entering it, or -1 if
+                         there is none (e.g. for start states).  It is found
+                         from the forward scores of the search, so it can be
+                         given to ShortestPath() without calling
+                         GetForwardScores() on `out`.
+         @param[in] max_active_arcs  If > 0, a target for the total number
+                         of arcs on each frame, summed over all the
+                         sequences of the batch.  While it is exceeded, the
+                         beams of all sequences are scaled down together,
+                         and they recover gradually once it is not; this is
+                         in addition to the per-sequence {min,max}_active.
+                         It trades some accuracy for a bound on the work
+                         per frame when the batch is large or the graph is
+                         dense.  The last few frames of each sequence are
+                         not affected, so its final state is not pruned.
+         @param[out] stats  If not nullptr, will be set to statistics of the
+                         search; see IntersectDensePrunedStats.
+         @param[in] b_to_a_map  If not nullptr, maps from the index of a
+                         sequence in b_fsas to the index of its graph in
+                         a_fsas, i.e. `0 <= (*b_to_a_map)[i] < a_fsas.Dim0()`
+                         for `0 <= i < b_fsas.shape.Dim0()`, so that many
+                         sequences can share a few graphs (e.g. for
+                         contextual biasing) without copying them.  In this
+                         case a_fsas.Dim0() may have any value.  arc_map_a
+                         contains arc indexes of a_fsas as usual.
 */
 void IntersectDensePruned(FsaVec &a_fsas, DenseFsaVec &b_fsas,
+                          float search_beam, float output_beam,
+                          int32_t min_active_states, int32_t max_active_states,
+                          FsaVec *out, Array1<int32_t> *arc_map_a,
+                          Array1<int32_t> *arc_map_b, bool use_arena = false,
+                          float lattice_beam = 0,
+                          Array1<int32_t> *entering_arcs = nullptr,
+                          int32_t max_active_arcs = 0,
+                          IntersectDensePrunedStats *stats = nullptr,
+                          const Array1<int32_t> *b_to_a_map = nullptr);
+
+/*
+  A version of IntersectDensePruned() for one-best decoding, that returns the
+  best path directly instead of a lattice.  It is equivalent to calling
+  ShortestPath() on the output of IntersectDensePruned() with
+  output_beam == search_beam (up to ties), but during the search it keeps
+  only the best arc entering each active state instead of all the arcs, and
+  it skips the pruning of the lattice, so it is faster and its memory
+  scales with the number of active states rather than arcs.
+
+         @param[in] a_fsas  As for IntersectDensePruned().
+         @param[in] b_fsas  As for IntersectDensePruned().
+         @param[in] search_beam  As for IntersectDensePruned().
+         @param[in] min_active_states  As for IntersectDensePruned().
+         @param[in] max_active_states  As for IntersectDensePruned().
+         @param[out] out  Output vector of linear FSAs, with Dim0() equal to
+                         b_fsas.shape.Dim0(), each containing the best path
+                         of the composition; as for ShortestPath(), it is
+                         empty (has no states) if no path was found.
+         @param[out] arc_map_a  As for IntersectDensePruned().
+         @param[out] arc_map_b  As for IntersectDensePruned().
+         @param[in] b_to_a_map  As for IntersectDensePruned().
+*/
+void IntersectDensePrunedOneBest(FsaVec &a_fsas, DenseFsaVec &b_fsas,
+                                 float search_beam, int32_t min_active_states,
+                                 int32_t max_active_states, FsaVec *out,
+                                 Array1<int32_t> *arc_map_a,
+                                 Array1<int32_t> *arc_map_b,
+                                 const Array1<int32_t> *b_to_a_map = nullptr);
+
+/*
+  Versions of IntersectDensePruned() and IntersectDensePrunedOneBest() with
+  an implicit decoding graph, e.g. the CTC topology, whose arcs are computed
+  on the fly instead of being read from memory.  The result is the same as
+  with the materialized graph, e.g.
+  `FsaToFsaVec(CtcTopo(c, a_topo.max_token, false, &aux_labels))`; in
+  particular arc_map_a contains arc indexes of that graph, and the
+  aux_labels of the output can be obtained with ImplicitTopoAuxLabels().
+  The decoding graph is shared by all the sequences.
+*/
+void IntersectDensePruned(const ImplicitTopo &a_topo, DenseFsaVec &b_fsas,
                           float search_beam, float output_beam,
                           int32_t min_active_states, int32_t max_active_states,
                           FsaVec *out, Array1<int32_t> *arc_map_a,
                           Array1<int32_t> *arc_map_b);
 
+void IntersectDensePrunedOneBest(const ImplicitTopo &a_topo,
+                                 DenseFsaVec &b_fsas, float search_beam,
+                                 int32_t min_active_states,
+                                 int32_t max_active_states, FsaVec *out,
+                                 Array1<int32_t> *arc_map_a,
+                                 Array1<int32_t> *arc_map_b);
+
+/*
+  Versions of IntersectDensePruned() and IntersectDensePrunedOneBest() with
+  the decoding graphs in compact form, whose arcs take 12 or 8 bytes instead
+  of 16, which reduces the memory traffic of the search; see CompactFsaVec.
+  The result is the same as with a_fsas.ToFsaVec(), and arc_map_a contains
+  arc indexes of that graph, i.e. of the graph `a_fsas` was created from.
+*/
+void IntersectDensePruned(CompactFsaVec &a_fsas, DenseFsaVec &b_fsas,
+                          float search_beam, float output_beam,
+                          int32_t min_active_states, int32_t max_active_states,
+                          FsaVec *out, Array1<int32_t> *arc_map_a,
+                          Array1<int32_t> *arc_map_b);
+
+void IntersectDensePrunedOneBest(CompactFsaVec &a_fsas, DenseFsaVec &b_fsas,
+                                 float search_beam, int32_t min_active_states,
+                                 int32_t max_active_states, FsaVec *out,
+                                 Array1<int32_t> *arc_map_a,
+                                 Array1<int32_t> *arc_map_b);
+
 /* IntersectDense is a version of IntersectDensePruned that does not
    do pruning in the 1st pass.
 
@@ -209,7 +404,9 @@ void IntersectDensePruned(FsaVec &a_fsas, DenseFsaVec &b_fsas,
 
      @param[in] a_fsas   Input FSAs; must have 3 axes.
      @param[in] b_fsas   Input dense FSAs that likely correspond to neural
-                  network outputs (see documentation in fsa.h).
+                  network outputs (see documentation in fsa.h).  May be in
+                  the sparse form returned by SparsifyDenseFsaVec(), and may
+                  have 16-bit scores (see DenseFsaVec::half_scores).
                   If a_to_b_map == nullptr, must satisfy
                   b_fsas.shape.Dim0() == a_fsas.Dim0().
                   MUST BE SORTED BY DECREASING LENGTH.
@@ -245,13 +442,38 @@ void IntersectDensePruned(FsaVec &a_fsas, DenseFsaVec &b_fsas,
      @param[out] arc_map_b  Will be set to a vector with Dim() equal to
                    the number of arcs in `out`, whose elements contain
                    the corresponding arc-index in b_fsas; this arc-index
-                   is the linear offset into b_fsas.scores.
+                   is the linear offset into b_fsas.scores (see
+                   DenseFsaVec::NumArcs() for the sparse case).
+     @param[in] memory_budget  If >0, an approximate limit in bytes on the
+                   memory used for per-frame state information.  If storing
+                   it for all frames would exceed this, only the scores of
+                   every k'th frame are kept, with k about sqrt(num-frames),
+                   and the rest are recomputed segment by segment while
+                   pruning the output (about 3 times the propagation work).
+                   This makes memory grow as sqrt(num-frames) rather than
+                   num-frames, e.g. for aligning very long recordings.  The
+                   output is the same either way.  Ignored if
+                   search_beam > 0.
+     @param[in] search_beam  If >0, prune during the search too: on each
+                   frame, forward and backward scores more than
+                   `search_beam` below the best one of that FSA on that
+                   frame are discarded, and only the remaining ones are
+                   stored, so the memory grows with the number of states
+                   within the beam rather than all states (e.g. for
+                   aligning long recordings with CTC training graphs).
+                   The output is the same as without it, except for states
+                   and arcs outside the search beam.  If for some FSA the
+                   forward and backward passes disagree on the total score
+                   or find no path, which means the search beam pruned away
+                   the best path, the intersection is redone without it,
+                   so no alignment is lost.
  */
 void IntersectDense(FsaVec &a_fsas, DenseFsaVec &b_fsas,
                     const Array1<int32_t> *a_to_b_map,
                     float output_beam, int32_t max_states, int32_t max_arcs,
                     FsaVec *out, Array1<int32_t> *arc_map_a,
-                    Array1<int32_t> *arc_map_b);
+                    Array1<int32_t> *arc_map_b, int64_t memory_budget = -1,
+                    float search_beam = 0);
 
 /*
   This is 'normal' intersection for CPU (we would call this Compose() for FSTs,
@@ -344,13 +566,47 @@ bool Intersect(FsaOrVec &a_fsas, int32_t properties_a, FsaOrVec &b_fsas,
                       b_fsas.Dim0()` and `0 <= b_to_a_map[i] < a_fsas.Dim0()`.
     @param [out,optional] arc_map_a   If not nullptr, will be set to a new
                      array containing a map from arc-index in `out` to arc-index
-                     in `a_fsas`; elements will all be >= 0.
+                     in `a_fsas`; elements will all be >= 0 (unless
+                     a_self_loops is true).
     @param [out,optional] arc_map_b   If not nullptr, will be set to a new
                      array containing a map from arc-index in `out` to arc-index
                      in `b_fsas`; elements will all be >= 0.
     @param [in,optional] sorted_match_a  If true, will use a sorted matching
                      method on FSAs in `a_fsas`.  This requires that
                      (properties_a&kFsaPropertiesArcSorted) != 0.
+    @param [in] estimate_sizes  If true, first work out cheap upper bounds on
+                     the number of output states and arcs (from the numbers
+                     of states and arcs and the max out-degrees of the inputs)
+                     and size the internal hash and arrays from them, which
+                     avoids growing them as we go if the bounds are not too
+                     loose.  The result is the same either way.
+    @param [in] sorted_match_b  Only relevant if sorted_match_a is true.  If
+                     true, `b_fsas` must be arc-sorted too, i.e.
+                     (properties_b&kFsaPropertiesArcSorted) != 0, and for
+                     each pair of states we go through the arcs of the state
+                     with fewer arcs and binary-search the arcs of the other
+                     for each label; so e.g. composing a small lattice with a
+                     large arc-sorted G takes time proportional to the number
+                     of matched arcs rather than to the product of the
+                     out-degrees.  The result is the same up to the order of
+                     the arcs leaving each state.
+    @param [in] use_queue  If true, instead of processing the states of the
+                     output in lockstep iterations (breadth-first), which
+                     needs a few kernels and syncs with the host per
+                     iteration and so is slow if there are many iterations
+                     (cyclic or deep inputs), process them from a queue in a
+                     single kernel of persistent threads, with the hash
+                     deduplicating the state-pairs.  This sizes everything
+                     up front from the bounds used by `estimate_sizes`, and
+                     falls back to the iterative version if they are too
+                     large.  The result is the same up to the numbering of
+                     the states and the order of the arcs leaving each state.
+    @param [in] a_self_loops  If true, intersect as if AddEpsilonSelfLoops()
+                     had been called on `a_fsas` (e.g. a G that is to be
+                     composed with lattices that have epsilons), but without
+                     materializing the self-loops; the result is the same.
+                     Elements of `arc_map_a` will be -1 for arcs of the
+                     result that came from a self-loop.
     @return  Returns composed FsaVec;
              will satisfy `ans.Dim0() == b_fsas.Dim0()`.
 
@@ -363,7 +619,9 @@ bool Intersect(FsaOrVec &a_fsas, int32_t properties_a, FsaOrVec &b_fsas,
 FsaVec IntersectDevice(FsaVec &a_fsas, int32_t properties_a, FsaVec &b_fsas,
                        int32_t properties_b, const Array1<int32_t> &b_to_a_map,
                        Array1<int32_t> *arc_map_a, Array1<int32_t> *arc_map_b,
-                       bool sorted_match_a);
+                       bool sorted_match_a, bool estimate_sizes = false,
+                       bool sorted_match_b = false, bool use_queue = false,
+                       bool a_self_loops = false);
 
 /*
     Remove epsilons (symbol zero) in the input Fsas while maintaining
@@ -480,16 +738,77 @@ enum DeterminizeWeightPushingType {
                       `i` in `dest` corresponds to; the weight of the arc in
                       `dest` will equal the sum of those input arcs' weights.
 
-    Note we don't support pruning here.  There is a pruned form of
-    determinization implemented in the host code, which we may wrap later.
+    Note we don't support pruning here; see DeterminizePruned().
 
-    CAUTION: It only works for CPU;
+    On CPU this wraps the host code, one FSA at a time; on GPU it
+    calls DeterminizeDevice() (see determinize.h), which processes all the
+    FSAs in an FsaVec at once.  The outputs are equivalent but the state
+    numbering may differ.
  */
 void Determinize(FsaOrVec &src,
                  DeterminizeWeightPushingType weight_pushing_type,
                  FsaOrVec *dest,
                  Ragged<int32_t> *arc_derivs = nullptr);
 
+/*
+    Pruned determinization, intended for lattices.  It is like Determinize(),
+    but only keeps the states and arcs of `dest` whose best path is within
+    `beam` of the best path of the FSA (the scores are those of the tropical
+    semiring), and limits the number of states of each output FSA.
+
+    @param [in] src   Source Fsa or FsaVec.  Must be top-sorted and
+                      connected; otherwise as for Determinize().
+    @param [in] weight_pushing_type  See Determinize().
+    @param [in] beam  The pruning beam, > 0; may be infinity, for no pruning
+                      other than that required by `max_states`.  All symbol
+                      sequences of `src` whose best path is within `beam` of
+                      the best path are kept, unless `max_states` is reached.
+    @param [in] max_states  If > 0, the maximum number of states of each
+                      output FSA (the start- and final-state always exist, so
+                      values < 2 act as 2).  When it would be exceeded, only
+                      the best new states are kept and the beam of that FSA
+                      is tightened, so the time taken stays bounded.  The best
+                      path is kept as long as `max_states` is more than the
+                      number of arcs on it.
+    @param [out] dest  Destination; as for Determinize(), but connected.
+    @param [out] arc_derivs  See Determinize().
+
+    This works on CPU and GPU; it calls DeterminizePrunedDevice() (see
+    determinize.h), which processes all the FSAs in an FsaVec at once.
+ */
+void DeterminizePruned(FsaOrVec &src,
+                       DeterminizeWeightPushingType weight_pushing_type,
+                       float beam, int32_t max_states, FsaOrVec *dest,
+                       Ragged<int32_t> *arc_derivs = nullptr);
+
+/*
+    Minimize an acyclic Fsa or FsaVec, e.g. a lattice after Determinize(),
+    by merging the states that have the same suffix.  Two states are merged
+    if their arcs can be paired up so that each pair has the same label and
+    score (and aux_label, if `aux_labels` is given) and leads to the same or
+    merged states.  This works on CPU and GPU, processing all the FSAs at
+    once, one batch of states at a time from the final-states backwards.
+
+    Weights are not pushed, so for a deterministic input this gives the
+    minimal FSA only if equivalent suffixes have the same weights on the same
+    arcs; use weight pushing in Determinize() to merge more states.
+
+    @param [in] src   Source Fsa or FsaVec.  Must be top-sorted and
+                      acyclic.
+    @param [in] aux_labels  If not nullptr, a label per arc of `src` that
+                      must match as well, so that states are only merged if
+                      the arcs they lead to have the same aux_labels (the
+                      attributes of the arcs of `dest` are those of the
+                      arcs they were copied from; see `arc_map`).
+    @param [out] dest  Destination; will be top-sorted, and arc-sorted if
+                      `src` is.  Only the states of `src` that were not
+                      merged into a later state are kept, with their arcs.
+    @param [out] arc_map  If not nullptr, will be set to a map from the arcs
+                      of `dest` to the arcs of `src` they were copied from.
+ */
+void Minimize(FsaOrVec &src, const Array1<int32_t> *aux_labels,
+              FsaOrVec *dest, Array1<int32_t> *arc_map = nullptr);
+
 /*
   Create a linear FSA from a sequence of symbols
 
@@ -504,18 +823,41 @@ void Determinize(FsaOrVec &src,
 */
 Fsa LinearFsa(const Array1<int32_t> &symbols);
 
+/*
+  Memory that LinearFsas(), CtcGraphs(), AddEpsilonSelfLoops() and
+  RemoveEpsilonSelfLoops() can reuse across calls, e.g. across training steps
+  or the lattices of a rescoring loop, instead of allocating their output
+  afresh each time.  The arrays are reallocated (with some room to grow) only
+  when they are too small or on a different device.  Note: the FsaVec (and
+  aux_labels or arc_map) returned by a call share memory with the buffer, so
+  they are overwritten by the next call with the same buffer; in particular
+  the input of a call must not share memory with its buffer.
+ */
+struct FsaVecBuffer {
+  Array1<int32_t> row_splits1;
+  Array1<int32_t> row_ids1;
+  Array1<int32_t> row_splits2;
+  Array1<int32_t> row_ids2;
+  Array1<Arc> arcs;
+  Array1<int32_t> aux_labels;
+  Array1<int32_t> arc_map;
+};
+
 /*
   Create an FsaVec containing linear FSAs, given a list of sequences of
   symbols
 
     @param [in] symbols  Input symbol sequences (must not contain
                 kFinalSymbol == -1). Its num_axes is 2.
+    @param [in,out] buffer  If not nullptr, the returned FsaVec will be
+                written to its memory; see FsaVecBuffer.
 
     @return     Returns an FsaVec with `ans.Dim0() == symbols.Dim0()`.  Note: if
                 the i'th row of `symbols` has n elements, the i'th returned FSA
                 will have n+1 arcs (including the final-arc) and n+2 states.
  */
-FsaVec LinearFsas(const Ragged<int32_t> &symbols);
+FsaVec LinearFsas(const Ragged<int32_t> &symbols,
+                  FsaVecBuffer *buffer = nullptr);
 
 /*
   Create an FsaVec containing ctc graph FSAs, given a list of sequences of
@@ -527,11 +869,17 @@ FsaVec LinearFsas(const Ragged<int32_t> &symbols);
                          or "modified", where the "standard" one makes the
                          blank mandatory between a pair of identical symbols.
     @param [out] The olabels of the graphs.
+    @param [in,out] buffer  If not nullptr, the returned FsaVec and
+                `aux_labels` will be written to its memory; see FsaVecBuffer.
 
     @return     Returns an FsaVec with `ans.Dim0() == symbols.Dim0()`.
+                The number of states (and, for the modified topology, of
+                arcs) is known from `symbols`, so the graphs are built
+                directly on `symbols.Context()`.
  */
 FsaVec CtcGraphs(const Ragged<int32_t> &symbols, bool modified = false,
-                 Array1<int32_t> *aux_labels = nullptr);
+                 Array1<int32_t> *aux_labels = nullptr,
+                 FsaVecBuffer *buffer = nullptr);
 
 /*
   Create an FasVec containing levenshtein graph FSAs, given a list of sequences
@@ -557,6 +905,38 @@ FsaVec LevenshteinGraphs(const Ragged<int32_t> &symbols,
                          Array1<int32_t> *aux_labels = nullptr,
                          Array1<float> *score_offsets = nullptr);
 
+/*
+  Computes the levenshtein (edit) distance between pairs of symbol sequences
+  directly with dynamic programming, one group of threads per pair, i.e.
+  without building levenshtein graphs with LevenshteinGraphs() and
+  intersecting them.  Insertions, deletions and substitutions all cost 1.
+
+    @param [in] refs  The reference sequences, with 2 axes.
+    @param [in] hyps  The hypothesis sequences, with 2 axes.  Must be on
+                      the same device as `refs`.
+    @param [in] hyp_to_ref_map  Map from index in `hyps` to the index in
+                      `refs` it is compared with, e.g. Nbest::shape.RowIds(1).
+                      Requires `hyp_to_ref_map.Dim() == hyps.Dim0()` and
+                      `0 <= hyp_to_ref_map[i] < refs.Dim0()`.
+    @param [out] ref_alignment  If not nullptr, will be set to the aligned
+                      reference sequences, with 2 axes and
+                      `Dim0() == hyps.Dim0()`; insertions have label 0.
+    @param [out] hyp_alignment  If not nullptr, will be set to the aligned
+                      hypothesis sequences, with the same shape as
+                      `ref_alignment`; deletions have label 0.  As with
+                      levenshtein_alignment() in Python, substitutions are
+                      preferred to pairs of insertions and deletions.
+
+    @return  Returns an array with `ans.Dim() == hyps.Dim0()`, containing
+             the levenshtein distance between each hypothesis and its
+             reference.
+ */
+Array1<int32_t> LevenshteinDistance(Ragged<int32_t> &refs,
+                                    Ragged<int32_t> &hyps,
+                                    const Array1<int32_t> &hyp_to_ref_map,
+                                    Ragged<int32_t> *ref_alignment = nullptr,
+                                    Ragged<int32_t> *hyp_alignment = nullptr);
+
 /*
   Create ctc topology from max token id.
 
@@ -629,6 +1009,27 @@ Ragged<int32_t> ShortestPath(FsaVec &fsas,
  */
 Fsa Union(FsaVec &fsas, Array1<int32_t> *arc_map = nullptr);
 
+/* Compute the unions of groups of fsas in a FsaVec, as Union() above would
+   for each group, but for all groups at once.
+
+   @param [in]  fsas       Input FsaVec (must have 3 axes). Every fsa that is
+                           in a group must be non-empty.
+   @param [in]  groups     A ragged tensor with 2 axes, indexed
+                           [group][member], whose values are indexes into
+                           `fsas`, i.e. fsa_idx0.  An fsa may be in more than
+                           one group; the union of an empty group is an empty
+                           fsa.
+   @param [out] arc_map    It maps the arc indexes of the output to `fsas`.
+                           That is, arc_map[out_arc_index] = fsas_arc_index.
+                           Its entry may be -1 if there is no corresponding
+                           arc in fsas.
+   @return  returns an FsaVec with ans.Dim0() == groups.Dim0(), whose i'th
+            fsa is the union of the fsas in groups[i], with the same states
+            and arcs as Union() would give.
+ */
+FsaVec Union(FsaVec &fsas, Ragged<int32_t> &groups,
+             Array1<int32_t> *arc_map = nullptr);
+
 /* Compute the closure of an FSA.
 
    The closure is implemented in the following way:
@@ -649,14 +1050,16 @@ Fsa Union(FsaVec &fsas, Array1<int32_t> *arc_map = nullptr);
    Caution: The caller will have to modify any extra labels (like aux_labels) to
    deal with -1's correctly.
 
-   @param in]   fsa        The input FSA. Must have NumAxes() == 2, i.e., it
-                           must be a single FSA.
+   @param in]   fsa        The input FSA or FsaVec.  If it is an FsaVec, the
+                           closure of each of its FSAs is computed, all at
+                           once.
    @param [out] arc_map    It maps the arc indexes of the output fsa
                            to the input fsa. That is,
                            arc_map[out_arc_index] = fsa_arc_index.
                            Its entry may be -1 if there is no
                            corresponding arc in fsa.
-   @return It returns a closure of the input fsa.
+   @return It returns a closure of the input fsa (or of each of them); empty
+           FSAs are returned unchanged.
  */
 Fsa Closure(Fsa &fsa, Array1<int32_t> *arc_map = nullptr);
 
@@ -779,6 +1182,36 @@ void Invert(FsaOrVec &src, Ragged<int32_t> &src_aux_labels, FsaOrVec *dest,
 void InvertHost(FsaOrVec &src, Ragged<int32_t> &src_aux_labels, FsaOrVec *dest,
                 Ragged<int32_t> *dest_aux_labels);
 
+/*
+  Convert a token-level lattice with (ragged) word aux_labels into an
+  epsilon-free, connected word lattice.  This is equivalent to Invert(),
+  then RemoveEpsilon(), then Connect(), but it does not create the
+  token-level aux_labels of the inverted FSA, it skips RemoveEpsilon() if
+  the inverted FSA has no epsilons, and it outputs a single arc map that
+  goes all the way back to `src`.
+
+    @param [in] src             Input Fsa or FsaVec, e.g. a lattice from
+                                IntersectDensePruned().
+    @param [in] src_aux_labels  aux_labels of `src` (e.g. words); see
+                                Invert() for the requirements on it.
+    @param [in] properties      Properties of `src`.  See RemoveEpsilon()
+                                for how they are used.
+    @param [out] dest   Output Fsa or FsaVec, with
+                        dest.NumAxes() == src.NumAxes(), whose labels are
+                        the aux_labels of `src`.  It is epsilon-free and
+                        connected, and is equivalent to the inverse of `src`
+                        in the tropical semiring.
+    @param [out] arc_map  If not nullptr, will be set to a ragged tensor with
+                        2 axes and `arc_map->Dim0() == dest->NumElements()`;
+                        row i is the sequence of arcs in `src` whose scores
+                        sum to the score of arc i of `dest` (its token-level
+                        labels, other than epsilons, are the labels of those
+                        arcs).
+ */
+void ToWordLattice(FsaOrVec &src, Ragged<int32_t> &src_aux_labels,
+                   int32_t properties, FsaOrVec *dest,
+                   Ragged<int32_t> *arc_map = nullptr);
+
 /* Remove epsilon self-loops.
  *
  * Unlike RemoveEpsilon, this function removes only epsilon self-loops.
@@ -793,6 +1226,14 @@ void InvertHost(FsaOrVec &src, Ragged<int32_t> &src_aux_labels, FsaOrVec *dest,
 FsaOrVec RemoveEpsilonSelfLoops(FsaOrVec &src,
                                 Array1<int32_t> *arc_map = nullptr);
 
+/*
+  Version of RemoveEpsilonSelfLoops() that writes the output and `arc_map`
+  (if not nullptr) to the memory of `buffer`, see FsaVecBuffer; if `buffer`
+  is nullptr it is the same as the version above.
+ */
+FsaOrVec RemoveEpsilonSelfLoops(FsaOrVec &src, FsaVecBuffer *buffer,
+                                Array1<int32_t> *arc_map = nullptr);
+
 
 /*
   Replace, in `index`, labels
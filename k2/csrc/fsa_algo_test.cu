@@ -27,6 +27,7 @@
 #include "k2/csrc/fsa_utils.h"
 #include "k2/csrc/host_shim.h"
 #include "k2/csrc/test_utils.h"
+#include "k2/csrc/thread_pool.h"
 
 namespace k2 {
 
@@ -163,6 +164,46 @@ TEST(ArcSort, NonEmptyFsaVec) {
   }
 }
 
+TEST(ArcSort, CompareWithCpu) {
+  ContextPtr cuda = GetCudaContext();
+  // The number of arcs per state selects the method used on GPU: sort by
+  // thread, segmented mergesort and segmented radix sort.
+  for (int32_t arcs_per_state : {5, 100, 1000}) {
+    int32_t num_states = 20000 / arcs_per_state + 1,
+            num_arcs = (num_states - 1) * arcs_per_state;
+    std::vector<Arc> arcs;
+    std::vector<int32_t> row_splits;
+    for (int32_t s = 0; s != num_states; ++s) {
+      row_splits.push_back(static_cast<int32_t>(arcs.size()));
+      if (s + 1 == num_states) break;  // the final state has no arcs
+      // Labels and dest states are from small ranges so there are ties.
+      for (int32_t i = 0; i != arcs_per_state; ++i)
+        arcs.emplace_back(s, RandInt(0, 5), RandInt(-1, 10), i);
+    }
+    row_splits.push_back(num_arcs);
+    Array1<int32_t> splits(GetCpuContext(), row_splits);
+    Fsa fsa(RaggedShape2(&splits, nullptr, num_arcs),
+            Array1<Arc>(GetCpuContext(), arcs));
+
+    Fsa cpu_sorted;
+    Array1<int32_t> cpu_arc_map;
+    ArcSort(fsa, &cpu_sorted, &cpu_arc_map);
+    if (cuda->GetDeviceType() == kCpu) continue;
+
+    Fsa cuda_fsa = fsa.To(cuda), cuda_sorted;
+    Array1<int32_t> cuda_arc_map;
+    ArcSort(cuda_fsa, &cuda_sorted, &cuda_arc_map);
+    // The sort is stable, so even the order of ties matches.
+    EXPECT_TRUE(Equal(cuda_arc_map.To(GetCpuContext()), cpu_arc_map));
+    EXPECT_TRUE(Equal(cuda_sorted.values.To(GetCpuContext()),
+                      cpu_sorted.values));
+
+    ArcSort(&cuda_fsa);
+    EXPECT_TRUE(Equal(cuda_fsa.values.To(GetCpuContext()),
+                      cpu_sorted.values));
+  }
+}
+
 TEST(FsaAlgo, LinearFsa) {
   for (auto &context : {GetCudaContext(), GetCpuContext()}) {
     Array1<int32_t> symbols(context, std::vector<int32_t>{10, 20, 30});
@@ -561,6 +602,23 @@ TEST(FsaAlgo, RemoveEpsilonHosts) {
   }
 }
 
+TEST(FsaAlgo, RemoveEpsilonHostParallel) {
+  // The states of a single FSA are processed in parallel in chunks; the
+  // output must not depend on the number of threads.
+  Fsa fsa = RandomFsa(true, 10, 5000, 20000), dest;
+  Ragged<int32_t> arc_derivs;
+  RemoveEpsilonHost(fsa, &dest, &arc_derivs);
+
+  int32_t saved_num_threads = GetNumCpuThreads();
+  SetNumCpuThreads(4);
+  Fsa dest2;
+  Ragged<int32_t> arc_derivs2;
+  RemoveEpsilonHost(fsa, &dest2, &arc_derivs2);
+  EXPECT_TRUE(Equal(dest, dest2));
+  EXPECT_TRUE(Equal(arc_derivs, arc_derivs2));
+  SetNumCpuThreads(saved_num_threads);
+}
+
 TEST(FsaAlgo, Determinize) {
   {
     // simple case
@@ -665,6 +723,58 @@ TEST(FsaAlgo, Determinize) {
   }
 }
 
+TEST(FsaAlgo, UnionGroups) {
+  ContextPtr cpu = GetCpuContext();
+  for (auto &context : {GetCpuContext(), GetCudaContext()}) {
+    FsaVec fsas = RandomFsaVec(1, 20, false, 50, 40, 1000);
+    int32_t num_fsas = fsas.Dim0();
+    // Groups of 0 to 4 random fsas.
+    std::vector<int32_t> row_splits = {0}, values;
+    for (int32_t i = 0; i != 30; ++i) {
+      int32_t size = RandInt(0, 4);
+      for (int32_t j = 0; j != size; ++j)
+        values.push_back(RandInt(0, num_fsas - 1));
+      row_splits.push_back(values.size());
+    }
+    Array1<int32_t> row_splits_array(cpu, row_splits);
+    Ragged<int32_t> groups(RaggedShape2(&row_splits_array, nullptr, -1),
+                           Array1<int32_t>(cpu, values));
+
+    fsas = fsas.To(context);
+    groups = groups.To(context);
+    Array1<int32_t> arc_map;
+    FsaVec ans = Union(fsas, groups, &arc_map);
+    ASSERT_EQ(ans.Dim0(), groups.Dim0());
+
+    ans = ans.To(cpu);
+    arc_map = arc_map.To(cpu);
+    fsas = fsas.To(cpu);
+    groups = groups.To(cpu);
+    for (int32_t i = 0; i != groups.Dim0(); ++i) {
+      Fsa fsa = ans.Index(0, i);
+      int32_t begin = ans.RowSplits(2)[ans.RowSplits(1)[i]];
+      Array1<int32_t> this_arc_map =
+          arc_map.Arange(begin, begin + fsa.NumElements());
+
+      Array1<int32_t> indexes =
+          groups.values.Arange(row_splits[i], row_splits[i + 1]);
+      if (indexes.Dim() == 0) {
+        EXPECT_EQ(fsa.Dim0(), 0);
+        continue;
+      }
+      Array1<int32_t> group_arc_map, expected_arc_map;
+      FsaVec group = Index(fsas, 0, indexes, &group_arc_map);
+      Fsa expected = Union(group, &expected_arc_map);
+      EXPECT_TRUE(Equal(fsa, expected));
+      ASSERT_EQ(this_arc_map.Dim(), expected_arc_map.Dim());
+      for (int32_t j = 0; j != this_arc_map.Dim(); ++j) {
+        int32_t k = expected_arc_map[j];
+        EXPECT_EQ(this_arc_map[j], k == -1 ? -1 : group_arc_map[k]);
+      }
+    }
+  }
+}
+
 TEST(FsaAlgo, ClosureSimpleCase) {
   // 0 -> 1 -> 2 -> 3
   std::string s = R"(0 1 1 0.1
@@ -780,6 +890,43 @@ TEST(FsaAlgo, ClosureRandomCase) {
   }
 }
 
+TEST(FsaAlgo, ClosureFsaVec) {
+  ContextPtr cpu = GetCpuContext();
+  for (auto &context : {GetCpuContext(), GetCudaContext()}) {
+    FsaVec fsas = RandomFsaVec(1, 20, false, 50, 0, 1000);
+    // Make sure there is an empty FSA and one whose start state has no
+    // leaving arcs.
+    Fsa empty_fsa(EmptyRaggedShape(cpu, 2)),
+        fsa = FsaFromString("1 2 2 0.2\n2 3 -1 0.3\n3");
+    Fsa *fsa_array[] = {&empty_fsa, &fsa};
+    FsaVec extra = CreateFsaVec(2, &fsa_array[0]);
+    FsaVec *vec_array[] = {&fsas, &extra};
+    fsas = Cat(0, 2, vec_array);
+
+    fsas = fsas.To(context);
+    Array1<int32_t> arc_map;
+    FsaVec ans = Closure(fsas, &arc_map);
+    ASSERT_EQ(ans.Dim0(), fsas.Dim0());
+
+    ans = ans.To(cpu);
+    arc_map = arc_map.To(cpu);
+    fsas = fsas.To(cpu);
+    for (int32_t i = 0; i != fsas.Dim0(); ++i) {
+      Fsa src = fsas.Index(0, i), dest = ans.Index(0, i);
+      int32_t src_begin = fsas.RowSplits(2)[fsas.RowSplits(1)[i]],
+              dest_begin = ans.RowSplits(2)[ans.RowSplits(1)[i]];
+      Array1<int32_t> expected_arc_map;
+      Fsa expected = Closure(src, &expected_arc_map);
+      EXPECT_TRUE(Equal(dest, expected));
+      ASSERT_EQ(dest.NumElements(), expected_arc_map.Dim());
+      for (int32_t j = 0; j != dest.NumElements(); ++j) {
+        int32_t k = expected_arc_map[j];
+        EXPECT_EQ(arc_map[dest_begin + j], k == -1 ? -1 : src_begin + k);
+      }
+    }
+  }
+}
+
 TEST(FsaAlgo, TestExpandArcsA) {
   FsaVec fsa1("[ [ [ ] [ ] ] ]");
   RaggedShape labels_shape("[]");
@@ -1059,6 +1206,61 @@ TEST(FsaAlgo, TestInvertRandom) {
   }
 }
 
+TEST(FsaAlgo, TestToWordLattice) {
+  std::string s = R"(0 1 1 0.1
+    0 2 4 0.5
+    1 2 2 0.2
+    2 3 3 0.3
+    3 4 -1 0.4
+    4
+  )";
+  Fsa fsa = FsaFromString(s);
+  Fsa *fsa_array[] = {&fsa, &fsa};
+  FsaVec cpu_src = CreateFsaVec(2, &fsa_array[0]);
+  // The second aux_labels have no epsilons after inversion.
+  std::vector<std::string> aux_labels_strs = {
+      "[ [10] [] [] [11 12] [-1] [10] [] [] [11 12] [-1] ]",
+      "[ [10] [13] [14] [11 12] [-1] [10] [13] [14] [11 12] [-1] ]"};
+  ContextPtr cpu = GetCpuContext();
+  for (auto &context : {GetCpuContext(), GetCudaContext()}) {
+    for (const std::string &aux_labels_str : aux_labels_strs) {
+      FsaVec src = cpu_src.To(context);
+      Ragged<int32_t> aux_labels(context, aux_labels_str);
+      Array1<int32_t> properties_array;
+      int32_t properties;
+      GetFsaVecBasicProperties(src, &properties_array, &properties);
+
+      FsaVec dest;
+      Ragged<int32_t> arc_map;
+      ToWordLattice(src, aux_labels, properties, &dest, &arc_map);
+
+      // Compare with the unfused version.
+      FsaVec inverted, eps_free, expected;
+      Ragged<int32_t> inverted_aux_labels, eps_arc_map;
+      Invert(src, aux_labels, &inverted, &inverted_aux_labels);
+      RemoveEpsilon(inverted, properties, &eps_free, &eps_arc_map);
+      Connect(eps_free, &expected);
+      EXPECT_TRUE(Equal(dest, expected));
+      GetFsaVecBasicProperties(dest, &properties_array, &properties);
+      EXPECT_EQ(properties & kFsaPropertiesEpsilonFree,
+                kFsaPropertiesEpsilonFree);
+
+      // The score of each arc in `dest` is the sum of the scores of the arcs
+      // of `src` in its row of `arc_map`.
+      dest = dest.To(cpu);
+      arc_map = arc_map.To(cpu);
+      ASSERT_EQ(arc_map.Dim0(), dest.NumElements());
+      const int32_t *row_splits = arc_map.RowSplits(1).Data();
+      for (int32_t i = 0; i < dest.NumElements(); ++i) {
+        float score = 0;
+        for (int32_t j = row_splits[i]; j < row_splits[i + 1]; ++j)
+          score += cpu_src.values[arc_map.values[j]].score;
+        EXPECT_NEAR(dest.values[i].score, score, 1.0e-05);
+      }
+    }
+  }
+}
+
 TEST(FsaAlgo, TestRemoveEpsilonSelfLoopsSimple) {
   std::string s = R"(
     0 1 0 0.1
@@ -1120,6 +1322,38 @@ TEST(FsaAlgo, TestRemoveEplsionSelfRandomFsas) {
   }
 }
 
+TEST(FsaAlgo, EpsilonSelfLoopsWithBuffer) {
+  for (const ContextPtr &c : {GetCpuContext(), GetCudaContext()}) {
+    // The input of a call must not share memory with its buffer, so we use
+    // one buffer for each function.
+    FsaVecBuffer buffer, buffer2;
+    // The later inputs are smaller, so the memory is reused.
+    for (int32_t max_num_arcs : {1000, 500, 100}) {
+      FsaVec src = RandomFsaVec(1, 10, true, 20, 0, max_num_arcs).To(c);
+      for (int32_t num_axes : {3, 2}) {
+        FsaOrVec fsas = (num_axes == 3 ? src : src.Index(0, 0));
+        Array1<int32_t> arc_map, arc_map_ref;
+        FsaOrVec loops, loops_ref;
+        AddEpsilonSelfLoops(fsas, &buffer, &loops, &arc_map);
+        AddEpsilonSelfLoops(fsas, &loops_ref, &arc_map_ref);
+        EXPECT_TRUE(Equal(loops, loops_ref));
+        EXPECT_TRUE(Equal(arc_map, arc_map_ref));
+        if (loops.NumElements() > fsas.NumElements()) {
+          EXPECT_EQ(loops.values.Data(), buffer.arcs.Data());
+          EXPECT_EQ(arc_map.Data(), buffer.arc_map.Data());
+        }
+
+        FsaOrVec removed = RemoveEpsilonSelfLoops(loops, &buffer2, &arc_map),
+                 removed_ref = RemoveEpsilonSelfLoops(loops, &arc_map_ref);
+        EXPECT_TRUE(Equal(removed, removed_ref));
+        EXPECT_TRUE(Equal(arc_map, arc_map_ref));
+        EXPECT_TRUE(Equal(removed, fsas));
+        EXPECT_EQ(removed.values.Data(), buffer2.arcs.Data());
+      }
+    }
+  }
+}
+
 TEST(FsaAlgo, TestReplaceFsaA) {
   // Test when index fsa is empty
   for (const ContextPtr &c : {GetCpuContext(), GetCudaContext()}) {
@@ -1322,6 +1556,47 @@ TEST(FsaAlgo, TestCtcGraphSimplified) {
   }
 }
 
+TEST(FsaAlgo, CtcGraphsWithBuffer) {
+  for (const ContextPtr &c : {GetCpuContext(), GetCudaContext()}) {
+    for (bool modified : {false, true}) {
+      FsaVecBuffer buffer;
+      for (const char *str : {"[ [ 1 2 2 3 ] [ ] [ 4 4 ] [ 5 ] ]",
+                              "[ [ 3 3 3 ] [ 2 ] ]", "[ ]"}) {
+        Ragged<int32_t> symbols(c, str);
+        Array1<int32_t> aux_labels, aux_labels_ref;
+        FsaVec graph = CtcGraphs(symbols, modified, &aux_labels, &buffer);
+        FsaVec graph_ref = CtcGraphs(symbols, modified, &aux_labels_ref);
+        EXPECT_TRUE(Equal(graph, graph_ref));
+        EXPECT_TRUE(Equal(aux_labels, aux_labels_ref));
+        // The later inputs are smaller, so the memory is reused.
+        EXPECT_EQ(graph.values.Data(), buffer.arcs.Data());
+        EXPECT_EQ(aux_labels.Data(), buffer.aux_labels.Data());
+      }
+    }
+  }
+}
+
+TEST(FsaAlgo, LinearFsasWithBuffer) {
+  for (const ContextPtr &c : {GetCpuContext(), GetCudaContext()}) {
+    FsaVecBuffer buffer;
+    FsaVec fsas = LinearFsas(Ragged<int32_t>(c, "[ [ 1 2 ] [ ] [ 3 ] ]"),
+                             &buffer);
+    FsaVec fsas_ref(c, "[ [ [ 0 1 1 0 ] [ 1 2 2 0 ] [ 2 3 -1 0 ] [ ] ] "
+                       "  [ [ 0 1 -1 0 ] [ ] ] "
+                       "  [ [ 0 1 3 0 ] [ 1 2 -1 0 ] [ ] ] ]");
+    EXPECT_TRUE(Equal(fsas, fsas_ref));
+    EXPECT_EQ(fsas.values.Data(), buffer.arcs.Data());
+
+    fsas = LinearFsas(Ragged<int32_t>(c, "[ [ 4 ] ]"), &buffer);
+    EXPECT_TRUE(Equal(fsas, FsaVec(c, "[ [ [ 0 1 4 0 ] [ 1 2 -1 0 ] [ ] ] ]")));
+    EXPECT_EQ(fsas.values.Data(), buffer.arcs.Data());
+
+    fsas = LinearFsas(Ragged<int32_t>(c, "[ ]"), &buffer);
+    EXPECT_EQ(fsas.Dim0(), 0);
+    EXPECT_EQ(fsas.NumElements(), 0);
+  }
+}
+
 TEST(FsaAlgo, TestCtcTopo) {
   for (const ContextPtr &c : {GetCpuContext(), GetCudaContext()}) {
     // Test standard topology
@@ -1383,4 +1658,99 @@ TEST(FsaAlgo, TestLevenshteinGraph) {
   }
 }
 
+TEST(FsaAlgo, TestLevenshteinDistance) {
+  for (const ContextPtr &c : {GetCpuContext(), GetCudaContext()}) {
+    Ragged<int32_t> refs(c, "[ [ 1 2 4 ] [ 5 6 ] ]"),
+        hyps(c, "[ [ 1 2 3 ] [ 1 3 3 2 ] [ ] [ 2 4 ] ]");
+    Array1<int32_t> hyp_to_ref_map(c, "[ 0 0 1 0 ]");
+    Ragged<int32_t> ref_alignment, hyp_alignment;
+    Array1<int32_t> distance = LevenshteinDistance(
+        refs, hyps, hyp_to_ref_map, &ref_alignment, &hyp_alignment);
+    CheckArrayData(distance, std::vector<int32_t>{1, 3, 2, 1});
+    EXPECT_TRUE(Equal(ref_alignment, Ragged<int32_t>(
+        c, "[ [ 1 2 4 ] [ 1 0 2 4 ] [ 5 6 ] [ 1 2 4 ] ]")));
+    EXPECT_TRUE(Equal(hyp_alignment, Ragged<int32_t>(
+        c, "[ [ 1 2 3 ] [ 1 3 3 2 ] [ 0 0 ] [ 0 2 4 ] ]")));
+
+    // Without alignments.
+    EXPECT_TRUE(Equal(LevenshteinDistance(refs, hyps, hyp_to_ref_map),
+                      distance));
+  }
+}
+
+
+TEST(FsaAlgo, Minimize) {
+  for (const ContextPtr &c : {GetCpuContext(), GetCudaContext()}) {
+    // States 1 and 2 have the same suffix, and so do 3 and 4.
+    std::string s = R"(0 1 1 1.0
+      0 2 2 2.0
+      1 3 3 0.5
+      2 4 3 0.5
+      3 5 -1 0.0
+      4 5 -1 0.0
+      5
+    )";
+    Fsa fsa = FsaFromString(s).To(c);
+    Fsa dest;
+    Array1<int32_t> arc_map;
+    Minimize(fsa, nullptr, &dest, &arc_map);
+    Fsa expected = FsaFromString(R"(0 1 1 1.0
+      0 1 2 2.0
+      1 2 3 0.5
+      2 3 -1 0.0
+      3
+    )");
+    EXPECT_TRUE(Equal(dest, expected.To(c)));
+    CheckArrayData(arc_map, std::vector<int32_t>{0, 1, 3, 5});
+
+    // The aux_labels must match as well.
+    Array1<int32_t> aux_labels(c, "[ 1 2 3 4 5 5 ]");
+    Minimize(fsa, &aux_labels, &dest, &arc_map);
+    EXPECT_EQ(dest.Dim0(), 5);
+    CheckArrayData(arc_map, std::vector<int32_t>{0, 1, 2, 3, 5});
+  }
+}
+
+TEST(FsaAlgo, MinimizeRandom) {
+  for (const ContextPtr &c : {GetCpuContext(), GetCudaContext()}) {
+    for (int32_t i = 0; i < 5; ++i) {
+      FsaVec fsas = RandomFsaVec(1, 20, true, 5, 0, 200), connected,
+             det, sorted;
+      Connect(fsas, &connected);
+      Determinize(connected, kTropicalWeightPushing, &det);
+      TopSort(det, &sorted);
+      sorted = sorted.To(c);
+
+      FsaVec dest;
+      Array1<int32_t> arc_map;
+      Minimize(sorted, nullptr, &dest, &arc_map);
+      EXPECT_EQ(dest.Dim0(), sorted.Dim0());
+      EXPECT_LE(dest.TotSize(1), sorted.TotSize(1));
+      Array1<int32_t> properties;
+      int32_t tot_properties;
+      GetFsaVecBasicProperties(dest, &properties, &tot_properties);
+      EXPECT_TRUE(tot_properties & kFsaPropertiesValid);
+      EXPECT_TRUE(tot_properties & kFsaPropertiesTopSorted);
+
+      // Minimizing again changes nothing.
+      FsaVec dest2;
+      Minimize(dest, nullptr, &dest2);
+      EXPECT_TRUE(Equal(dest, dest2));
+
+      sorted = sorted.To(GetCpuContext());
+      dest = dest.To(GetCpuContext());
+      arc_map = arc_map.To(GetCpuContext());
+      for (int32_t j = 0; j < dest.NumElements(); ++j) {
+        Arc arc = dest.values[j], src_arc = sorted.values[arc_map[j]];
+        EXPECT_EQ(arc.label, src_arc.label);
+        EXPECT_EQ(arc.score, src_arc.score);
+      }
+      bool log_semiring = false;
+      float beam = std::numeric_limits<float>::infinity();
+      EXPECT_TRUE(
+          IsRandEquivalent(sorted, dest, log_semiring, beam, true, 0.01));
+    }
+  }
+}
+
 }  // namespace k2
@@ -18,6 +18,9 @@
 
 #include <gtest/gtest.h>
 
+#include <string>
+#include <vector>
+
 #include "k2/csrc/fsa.h"
 #include "k2/csrc/fsa_utils.h"
 #include "k2/csrc/test_utils.h"
@@ -40,6 +43,50 @@ TEST(FsaPropertiesAsString, NonEmpty) {
   EXPECT_EQ(s, "\"Valid|TopSorted\"");
 }
 
+TEST(FsaVecBasicProperties, OnDevice) {
+  // A top-sorted acyclic FSA, one with a cycle and an epsilon, one whose arcs
+  // are not sorted, one without arcs and an empty one.
+  std::vector<std::string> strs = {
+      "0 1 1 1\n1 2 -1 1\n2\n",
+      "0 1 0 1\n1 0 2 1\n1 2 -1 1\n2\n",
+      "0 1 2 1\n0 1 1 1\n1 2 -1 1\n2\n",
+      "1\n",
+  };
+  ContextPtr cpu = GetCpuContext();
+  std::vector<Fsa> fsas;
+  for (const auto &s : strs) fsas.push_back(FsaFromString(s));
+  fsas.push_back(Fsa(EmptyRaggedShape(cpu, 2)));
+  int32_t num_fsas = static_cast<int32_t>(fsas.size());
+  std::vector<Fsa *> fsa_ptrs;
+  for (auto &fsa : fsas) fsa_ptrs.push_back(&fsa);
+
+  for (auto &c : {GetCpuContext(), GetCudaContext()}) {
+    FsaVec fsa_vec = CreateFsaVec(num_fsas, fsa_ptrs.data()).To(c);
+    Array1<int32_t> properties = GetFsaVecBasicPropertiesOnDevice(fsa_vec);
+    ASSERT_EQ(properties.Dim(), num_fsas + 1);
+    EXPECT_EQ(properties.Context()->GetDeviceType(), c->GetDeviceType());
+    properties = properties.To(GetCpuContext());
+    int32_t tot_properties = kFsaAllProperties;
+    for (int32_t i = 0; i < num_fsas; i++) {
+      EXPECT_EQ(properties[i], GetFsaBasicProperties(fsas[i]));
+      tot_properties &= properties[i];
+    }
+    EXPECT_EQ(properties[num_fsas], tot_properties);
+    EXPECT_TRUE(properties[0] & kFsaPropertiesTopSortedAndAcyclic);
+    EXPECT_FALSE(properties[1] & kFsaPropertiesTopSorted);
+    EXPECT_FALSE(properties[1] & kFsaPropertiesEpsilonFree);
+    EXPECT_FALSE(properties[2] & kFsaPropertiesArcSorted);
+    EXPECT_FALSE(properties[3] & kFsaPropertiesNonempty);
+
+    Array1<int32_t> properties_out;
+    int32_t tot_properties_out;
+    GetFsaVecBasicProperties(fsa_vec, &properties_out, &tot_properties_out);
+    EXPECT_EQ(tot_properties_out, tot_properties);
+    EXPECT_TRUE(Equal(properties_out.To(GetCpuContext()),
+                      properties.Range(0, num_fsas)));
+  }
+}
+
 TEST(FsaIO, FromAndToTensor) {
   // src_state dst_state label cost
   std::string s = R"(0 1 1 1
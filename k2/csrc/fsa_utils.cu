@@ -24,17 +24,36 @@
 
 #include <algorithm>
 #include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
 #include <limits>
+#include <memory>
 #include <sstream>
+#include <string>
 #include <utility>
 #include <vector>
 
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#else
+#include <fstream>
+#include <iterator>
+#endif
+
 #include "k2/csrc/array.h"
 #include "k2/csrc/context.h"
+#include "k2/csrc/device_guard.h"
 #include "k2/csrc/fsa.h"
 #include "k2/csrc/fsa_utils.h"
 #include "k2/csrc/math.h"
+#include "k2/csrc/philox.h"
 #include "k2/csrc/ragged.h"
+#include "k2/csrc/scalar_readback.h"
+#include "k2/csrc/thread_pool.h"
 
 namespace k2 {
 
@@ -548,12 +567,309 @@ static Fsa OpenFstFromStream(std::istringstream &is,
   return ans;
 }
 
+namespace {
+
+// The result of parsing a range of lines of a text FSA; see ParseFsaText().
+struct FsaTextChunk {
+  std::vector<Arc> arcs;
+  std::vector<int32_t> aux_labels;  // num_aux_labels per arc
+  // For the k2 format there is at most one final state (and `final_scores`
+  // is unused); for the OpenFst format, the states with finite final costs.
+  std::vector<int32_t> final_states;
+  std::vector<float> final_scores;
+  int32_t first_state = -1;  // state on the first nonempty line
+  int32_t max_state = -1;
+  int32_t num_lines = 0;  // number of nonempty lines
+};
+
+inline bool IsBlank(char c) {
+  return c == ' ' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+}
+
+// Parse the whole of [begin, end) as a decimal integer; returns false if it
+// is not one or does not fit in int32_t.
+bool ParseInt32(const char *begin, const char *end, int32_t *out) {
+  bool negative = false;
+  if (begin != end && (*begin == '-' || *begin == '+'))
+    negative = (*begin++ == '-');
+  if (begin == end) return false;
+  int64_t ans = 0;
+  for (; begin != end; ++begin) {
+    if (*begin < '0' || *begin > '9') return false;
+    ans = ans * 10 + (*begin - '0');
+    if (ans > static_cast<int64_t>(std::numeric_limits<int32_t>::max()) + 1)
+      return false;
+  }
+  if (negative) ans = -ans;
+  if (ans > std::numeric_limits<int32_t>::max()) return false;
+  *out = static_cast<int32_t>(ans);
+  return true;
+}
+
+// Parse the whole of [begin, end) as a float, accepting what strtof()
+// accepts (including "inf" and "Inf").
+bool ParseFloat(const char *begin, const char *end, float *out) {
+  char buf[64];
+  std::size_t len = end - begin;
+  if (len == 0 || len >= sizeof(buf)) return false;
+  std::memcpy(buf, begin, len);
+  buf[len] = '\0';
+  char *p;
+  *out = std::strtof(buf, &p);
+  return p == buf + len;
+}
+
+/* Parse the lines in [begin, end) of an FSA in the k2 format (if !openfst)
+   or the OpenFst format, as described for FsaFromString(); ragged labels are
+   not supported.  Costs in the OpenFst format are negated. */
+void ParseFsaText(const char *begin, const char *end, bool openfst,
+                  int32_t num_aux_labels, FsaTextChunk *chunk) {
+  // fields of the current line, as [begin, end) pairs
+  std::vector<std::pair<const char *, const char *>> fields;
+  const int32_t max_fields = 4 + num_aux_labels;
+  bool final_seen = false;  // for the k2 format
+  while (begin != end) {
+    const char *line_end =
+        static_cast<const char *>(std::memchr(begin, '\n', end - begin));
+    if (line_end == nullptr) line_end = end;
+    const char *line_begin = begin;
+    begin = (line_end == end ? end : line_end + 1);
+
+    fields.clear();
+    for (const char *p = line_begin; p != line_end;) {
+      if (IsBlank(*p)) {
+        ++p;
+        continue;
+      }
+      const char *q = p;
+      while (q != line_end && !IsBlank(*q)) ++q;
+      fields.emplace_back(p, q);
+      p = q;
+      if (static_cast<int32_t>(fields.size()) > max_fields) break;
+    }
+    int32_t num_fields = fields.size();
+    if (num_fields == 0) continue;  // an empty line
+    ++chunk->num_lines;
+
+    auto bad_line = [line_begin, line_end]() -> std::string {
+      return std::string(line_begin, line_end);
+    };
+    int32_t state;
+    if (!ParseInt32(fields[0].first, fields[0].second, &state) || state < 0)
+      K2_LOG(FATAL) << "Invalid line: " << bad_line();
+    if (chunk->first_state == -1) chunk->first_state = state;
+    chunk->max_state = std::max(chunk->max_state, state);
+
+    if (!openfst && final_seen) {
+      K2_LOG(FATAL) << "Invalid line: " << bad_line()
+                    << ", final state has already been read, expected no "
+                       "more input.";
+    }
+    if (num_fields <= (openfst ? 2 : 1)) {  // a final state
+      float cost = 0.0;
+      if (num_fields == 2 &&
+          !ParseFloat(fields[1].first, fields[1].second, &cost))
+        K2_LOG(FATAL) << "Invalid line: " << bad_line();
+      if (!openfst) {
+        final_seen = true;
+        chunk->final_states.push_back(state);
+      } else if (cost != std::numeric_limits<float>::infinity()) {
+        chunk->final_states.push_back(state);
+        chunk->final_scores.push_back(-cost);
+      }
+      continue;
+    }
+
+    Arc arc(state, 0, 0, 0.0);
+    if (num_fields < 3 + num_aux_labels || num_fields > max_fields ||
+        !ParseInt32(fields[1].first, fields[1].second, &arc.dest_state) ||
+        !ParseInt32(fields[2].first, fields[2].second, &arc.label) ||
+        arc.dest_state < 0)
+      K2_LOG(FATAL) << "Invalid line: " << bad_line();
+    for (int32_t i = 0; i != num_aux_labels; ++i) {
+      const auto &field = fields[3 + i];
+      int32_t aux_label;
+      if (!ParseInt32(field.first, field.second, &aux_label)) {
+        // The k2 format also allows integers written as floats.
+        float f;
+        if (openfst || !ParseFloat(field.first, field.second, &f) ||
+            static_cast<int32_t>(f) != f)
+          K2_LOG(FATAL) << "Invalid line: " << bad_line()
+                        << ": Expected an integer for aux_labels";
+        aux_label = static_cast<int32_t>(f);
+      }
+      chunk->aux_labels.push_back(aux_label);
+    }
+    if (num_fields == max_fields) {
+      const auto &field = fields[max_fields - 1];
+      if (!ParseFloat(field.first, field.second, &arc.score))
+        K2_LOG(FATAL) << "Invalid line: " << bad_line();
+      if (openfst) arc.score = -arc.score;
+    }
+    if (!openfst && !chunk->arcs.empty() &&
+        state < chunk->arcs.back().src_state) {
+      K2_LOG(FATAL) << "Bad line " << bad_line()
+                    << ", arcs are not ordered by src-state, " << state
+                    << " < " << chunk->arcs.back().src_state;
+    }
+    chunk->max_state = std::max(chunk->max_state, arc.dest_state);
+    chunk->arcs.push_back(arc);
+  }
+}
+
+/* Create an Fsa from the text in [begin, end), in the k2 format (if
+   !openfst) or the OpenFst format; see FsaFromString().  The text is split
+   into GetNumCpuThreads() chunks on line boundaries, which are parsed in
+   parallel with ParallelFor(), and the arcs are written straight into the
+   output arrays.  Ragged labels are not supported. */
+Fsa FsaFromText(const char *begin, const char *end, bool openfst,
+                int32_t num_aux_labels, Array2<int32_t> *aux_labels_out) {
+  NVTX_RANGE(K2_FUNC);
+  K2_CHECK(num_aux_labels == 0 || aux_labels_out != nullptr);
+  // Don't bother with threads for chunks smaller than this.
+  const std::size_t kMinChunkSize = 1 << 20;
+  std::size_t size = end - begin;
+  int32_t num_chunks = static_cast<int32_t>(std::min<std::size_t>(
+      GetNumCpuThreads(), size / kMinChunkSize + 1));
+  std::vector<const char *> boundaries(num_chunks + 1, end);
+  boundaries[0] = begin;
+  for (int32_t i = 1; i < num_chunks; ++i) {
+    const char *p = std::max(begin + size * i / num_chunks, boundaries[i - 1]);
+    p = static_cast<const char *>(std::memchr(p, '\n', end - p));
+    boundaries[i] = (p == nullptr ? end : p + 1);
+  }
+  std::vector<FsaTextChunk> chunks(num_chunks);
+  ParallelFor(0, num_chunks, [&](int32_t i) -> void {
+    ParseFsaText(boundaries[i], boundaries[i + 1], openfst, num_aux_labels,
+                 &chunks[i]);
+  });
+
+  ContextPtr c = GetCpuContext();
+  int32_t max_state = -1, start_state = -1, num_arcs = 0;
+  std::vector<int32_t> arc_offsets(num_chunks + 1, 0);
+  for (int32_t i = 0; i != num_chunks; ++i) {
+    const FsaTextChunk &chunk = chunks[i];
+    max_state = std::max(max_state, chunk.max_state);
+    if (start_state == -1) start_state = chunk.first_state;
+    arc_offsets[i] = num_arcs;
+    num_arcs += chunk.arcs.size();
+  }
+  arc_offsets[num_chunks] = num_arcs;
+
+  // The OpenFst format: the start state is on the first line.  We add a
+  // super-final state, with an arc from each final state.
+  std::vector<Arc> final_arcs;
+  if (openfst) {
+    if (start_state == -1) {  // There were no lines.
+      if (num_aux_labels > 0)
+        *aux_labels_out = Array2<int32_t>(c, num_aux_labels, 0);
+      return Fsa(EmptyRaggedShape(c, 2));
+    }
+    int32_t super_final_state = std::max<int32_t>(max_state + 1, 1);
+    for (const FsaTextChunk &chunk : chunks)
+      for (std::size_t j = 0; j != chunk.final_states.size(); ++j)
+        final_arcs.emplace_back(chunk.final_states[j], super_final_state, -1,
+                                chunk.final_scores[j]);
+    max_state = super_final_state;
+  } else {
+    int32_t final_state = -1, prev_src_state = -1;
+    for (int32_t i = 0; i != num_chunks; ++i) {
+      const FsaTextChunk &chunk = chunks[i];
+      if (final_state != -1 && chunk.num_lines != 0)
+        K2_LOG(FATAL) << "Final state " << final_state << " has already "
+                      << "been read, expected no more input.";
+      if (!chunk.final_states.empty()) final_state = chunk.final_states[0];
+      if (!chunk.arcs.empty()) {
+        if (chunk.arcs.front().src_state < prev_src_state)
+          K2_LOG(FATAL) << "Arcs are not ordered by src-state, "
+                        << chunk.arcs.front().src_state << " < "
+                        << prev_src_state;
+        prev_src_state = chunk.arcs.back().src_state;
+      }
+    }
+    K2_CHECK_EQ(final_state != -1 || num_arcs == 0, true)
+        << "If there are arcs, there should be a final state";
+    K2_CHECK_EQ(max_state, final_state) << "The final_state id isn't "
+                                           "the max of all states";
+    start_state = 0;
+  }
+  int32_t num_states = max_state + 1,  // may be 0 for the k2 format
+      tot_arcs = num_arcs + static_cast<int32_t>(final_arcs.size());
+
+  // In the OpenFst format we renumber the start state to 0, swapping it
+  // with state 0.
+  auto map_state = [start_state](int32_t s) -> int32_t {
+    return s == start_state ? 0 : (s == 0 ? start_state : s);
+  };
+
+  Array1<int32_t> row_splits(c, num_states + 1, 0);
+  int32_t *row_splits_data = row_splits.Data();
+  Array1<Arc> arcs(c, tot_arcs);
+  Arc *arcs_data = arcs.Data();
+  Array2<int32_t> aux_labels(c, num_aux_labels, tot_arcs);
+  auto aux_labels_acc = aux_labels.Accessor();
+  if (!openfst) {
+    // The arcs are already in order, so each chunk is copied to its place.
+    ParallelFor(0, num_chunks, [&](int32_t i) -> void {
+      const FsaTextChunk &chunk = chunks[i];
+      int32_t offset = arc_offsets[i], n = chunk.arcs.size();
+      std::copy(chunk.arcs.begin(), chunk.arcs.end(), arcs_data + offset);
+      for (int32_t a = 0; a != n; ++a)
+        for (int32_t j = 0; j != num_aux_labels; ++j)
+          aux_labels_acc(j, offset + a) =
+              chunk.aux_labels[a * num_aux_labels + j];
+    });
+    for (int32_t a = 0; a != tot_arcs; ++a)
+      ++row_splits_data[arcs_data[a].src_state];
+    ExclusiveSum(row_splits, &row_splits);
+  } else {
+    // A stable counting sort on the (renumbered) source state; the arcs to
+    // the super-final state come after the other arcs of a state.
+    for (const FsaTextChunk &chunk : chunks)
+      for (const Arc &arc : chunk.arcs)
+        ++row_splits_data[map_state(arc.src_state)];
+    for (const Arc &arc : final_arcs)
+      ++row_splits_data[map_state(arc.src_state)];
+    ExclusiveSum(row_splits, &row_splits);
+    std::vector<int32_t> next(row_splits_data, row_splits_data + num_states);
+    auto add_arc = [&](Arc arc, const int32_t *this_aux_labels) -> void {
+      arc.src_state = map_state(arc.src_state);
+      arc.dest_state = map_state(arc.dest_state);
+      int32_t idx = next[arc.src_state]++;
+      arcs_data[idx] = arc;
+      for (int32_t j = 0; j != num_aux_labels; ++j)
+        aux_labels_acc(j, idx) =
+            (this_aux_labels != nullptr ? this_aux_labels[j] : -1);
+    };
+    for (const FsaTextChunk &chunk : chunks)
+      for (std::size_t a = 0; a != chunk.arcs.size(); ++a)
+        add_arc(chunk.arcs[a], chunk.aux_labels.data() + a * num_aux_labels);
+    for (const Arc &arc : final_arcs) add_arc(arc, nullptr);
+  }
+  if (num_aux_labels > 0) *aux_labels_out = aux_labels;
+
+  Fsa ans(RaggedShape2(&row_splits, nullptr, tot_arcs), arcs);
+#ifndef NDEBUG
+  // The FSA is not checked for validity if not in debug mode; user should
+  // check this (we do this anyway when constructing Fsa in Python.
+  int32_t props = GetFsaBasicProperties(ans);
+  if (!(props & kFsaPropertiesValid)) K2_LOG(FATAL) << "Fsa is not valid";
+#endif
+  return ans;
+}
+
+}  // namespace
+
 Fsa FsaFromString(const std::string &s,
                   bool openfst, /* = false*/
                   int32_t num_aux_labels, /* = 0*/
                   Array2<int32_t> *aux_labels, /* = nullptr*/
                   int32_t num_ragged_labels,  /* = 0 */
                   Ragged<int32_t> *ragged_labels) { /* = nullptr */
+  if (num_ragged_labels == 0)
+    return FsaFromText(s.data(), s.data() + s.size(), openfst, num_aux_labels,
+                       aux_labels);
+
   std::istringstream is(s);
   K2_CHECK(is);
 
@@ -566,6 +882,41 @@ Fsa FsaFromString(const std::string &s,
   }
 }
 
+Fsa FsaFromFile(const std::string &filename, bool openfst /*= false*/,
+                int32_t num_aux_labels /*= 0*/,
+                Array2<int32_t> *aux_labels /*= nullptr*/) {
+  NVTX_RANGE(K2_FUNC);
+#ifndef _WIN32
+  int fd = open(filename.c_str(), O_RDONLY);
+  K2_CHECK_GE(fd, 0) << "Failed to open " << filename;
+  struct stat st;
+  K2_CHECK_EQ(fstat(fd, &st), 0) << "Failed to stat " << filename;
+  std::size_t size = st.st_size;
+  if (size == 0) {
+    close(fd);
+    return FsaFromText(nullptr, nullptr, openfst, num_aux_labels,
+                       aux_labels);
+  }
+  void *data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  K2_CHECK_NE(data, MAP_FAILED) << "Failed to mmap " << filename;
+  madvise(data, size, MADV_SEQUENTIAL);
+  // Unmaps the file also if parsing fails.
+  std::unique_ptr<void, std::function<void(void *)>> unmapper(
+      data, [size](void *p) { munmap(p, size); });
+  const char *begin = static_cast<const char *>(data);
+  return FsaFromText(begin, begin + size, openfst, num_aux_labels,
+                     aux_labels);
+#else
+  std::ifstream is(filename, std::ios::binary);
+  K2_CHECK(is) << "Failed to open " << filename;
+  std::string s((std::istreambuf_iterator<char>(is)),
+                std::istreambuf_iterator<char>());
+  return FsaFromText(s.data(), s.data() + s.size(), openfst, num_aux_labels,
+                     aux_labels);
+#endif
+}
+
 std::string FsaToString(const Fsa &fsa, bool openfst, /*= false*/
                         int32_t num_aux_labels, /*= 0*/
                         const Array1<int32_t> *aux_labels, /*= nullptr*/
@@ -1042,7 +1393,7 @@ FsaVec ConvertDenseToFsaVec(DenseFsaVec &src) {
   ContextPtr &c = src.shape.Context();
   // caution: 'num_symbols' is the number of symbols excluding the final-symbol
   // -1.
-  int32_t num_fsas = src.shape.Dim0(), num_symbols = src.scores.Dim1() - 1;
+  int32_t num_fsas = src.shape.Dim0(), num_symbols = src.NumCols() - 1;
   // the "1" is the extra state per FSA we need in the FsaVec format,
   // for the final-state.
   RaggedShape fsa2state = ChangeSublistSize(src.shape, 1);
@@ -1062,7 +1413,7 @@ FsaVec ConvertDenseToFsaVec(DenseFsaVec &src) {
   Array1<Arc> arcs(c, num_arcs);
   Arc *arcs_data = arcs.Data();
 
-  auto scores_acc = src.scores.Accessor();
+  DenseFsaVecScores scores_acc = DenseFsaVecScoresAccessor(src);
 
   int32_t *row_splits2_data = row_splits2.Data(),
           *row_ids2_data = row_ids2.Data();
@@ -1121,6 +1472,227 @@ FsaVec ConvertDenseToFsaVec(DenseFsaVec &src) {
   return Ragged<Arc>(ComposeRaggedShapes(fsa2state, state2arc), arcs);
 }
 
+DenseFsaVec SparsifyDenseFsaVec(DenseFsaVec &src, int32_t k,
+                                float floor /*= -inf*/) {
+  NVTX_RANGE(K2_FUNC);
+  K2_CHECK(!src.IsSparse() && !src.IsPadded() && !src.IsHalf());
+  ContextPtr &c = src.shape.Context();
+  int32_t num_rows = src.scores.Dim0(), num_cols = src.scores.Dim1();
+  K2_CHECK_GT(k, 0);
+  k = std::min(k, num_cols);
+  Array2<int32_t> top_cols(c, num_rows, k);
+  Array2<float> top_scores(c, num_rows, k);
+  Array1<float> floor_scores(c, num_rows);
+  auto scores_acc = src.scores.Accessor();
+  int32_t *top_cols_data = top_cols.Data();
+  float *top_scores_data = top_scores.Data(),
+        *floor_scores_data = floor_scores.Data();
+  // One thread per row; keeps the best `k` columns seen so far sorted by
+  // score (best first) with insertion sort, which is cheap because most
+  // columns don't beat the current k'th best.
+  K2_EVAL(
+      c, num_rows, lambda_get_top_k, (int32_t row)->void {
+        int32_t *this_cols = top_cols_data + row * k;
+        float *this_scores = top_scores_data + row * k;
+        float best_dropped = -std::numeric_limits<float>::infinity();
+        for (int32_t col = 0; col < num_cols; col++) {
+          float score = scores_acc(row, col);
+          int32_t i = col;
+          if (col >= k) {
+            float dropped = this_scores[k - 1];
+            if (score > dropped) {
+              i = k - 1;  // drop the current k'th best
+            } else {
+              dropped = score;
+            }
+            if (dropped > best_dropped) best_dropped = dropped;
+            if (i != k - 1) continue;
+          }
+          for (; i > 0 && score > this_scores[i - 1]; i--) {
+            this_scores[i] = this_scores[i - 1];
+            this_cols[i] = this_cols[i - 1];
+          }
+          this_scores[i] = score;
+          this_cols[i] = col;
+        }
+        floor_scores_data[row] =
+            (floor < best_dropped ? floor : best_dropped);
+      });
+  return DenseFsaVec(src.shape, num_cols, top_cols, top_scores, floor_scores);
+}
+
+#if defined(K2_WITH_CUDA) && CUDART_VERSION >= 11000
+/*
+  Computes the forward scores (if `forward`) or the backward scores of all the
+  state batches in one launch: the grid stays resident and waits at a
+  grid-wide barrier after each batch.  Each thread computes the scores of
+  states of the current batch from their entering (or leaving) arcs; see
+  ComputeScoresInOneKernel() for the arguments.
+ */
+template <typename FloatType>
+__global__ void ComputeScoresKernel(
+    int32_t num_batches, const int32_t *batch_states_begin,
+    const int32_t *batch_states, const int32_t *arc_batches_row_splits3,
+    const int32_t *arc_batches, const Arc *arcs,
+    const int32_t *fsas_row_ids1, const int32_t *fsas_row_splits1,
+    const int32_t *fsas_row_ids2, bool forward, bool log_semiring,
+    FloatType *state_scores, int32_t *entering_arcs) {
+  namespace cg = cooperative_groups;
+  cg::grid_group grid = cg::this_grid();
+  const FloatType negative_infinity =
+      -std::numeric_limits<FloatType>::infinity();
+  LogAdd<FloatType> log_add;
+  for (int32_t i = 0; i < num_batches; ++i) {
+    int32_t batch = (forward ? i : num_batches - 1 - i),
+            state_begin = batch_states_begin[batch],
+            state_end = batch_states_begin[batch + 1];
+    for (int32_t idx = state_begin + grid.thread_rank(); idx < state_end;
+         idx += grid.size()) {
+      FloatType score = negative_infinity;
+      int32_t best_arc_idx012 = -1;
+      for (int32_t j = arc_batches_row_splits3[idx];
+           j < arc_batches_row_splits3[idx + 1]; ++j) {
+        int32_t arc_idx012 = arc_batches[j];
+        Arc arc = arcs[arc_idx012];
+        // For backward scores we need the dest-state of the arc.
+        int32_t src_state_idx01 = fsas_row_ids2[arc_idx012],
+                other_state_idx01 =
+                    (forward ? src_state_idx01
+                             : src_state_idx01 - arc.src_state +
+                                   arc.dest_state);
+        FloatType arc_score = state_scores[other_state_idx01] + arc.score;
+        if (log_semiring) {
+          score = log_add(score, arc_score);
+        } else if (arc_score > score) {
+          score = arc_score;
+          best_arc_idx012 = arc_idx012;
+        }
+      }
+      int32_t state_idx01 = batch_states[idx],
+              fsa_idx0 = fsas_row_ids1[state_idx01];
+      // Don't overwrite the zero score of the start-states (forward) or the
+      // final-states (backward); see GetForwardScores().
+      if (score != negative_infinity ||
+          (forward ? state_idx01 != fsas_row_splits1[fsa_idx0]
+                   : state_idx01 + 1 != fsas_row_splits1[fsa_idx0 + 1]))
+        state_scores[state_idx01] = score;
+      if (entering_arcs != nullptr)
+        entering_arcs[state_idx01] = best_arc_idx012;
+    }
+    grid.sync();
+  }
+}
+#endif
+
+/*
+  On GPU, the forward and backward scores of lattices with many state batches
+  (i.e. deep lattices, e.g. long utterances) are dominated by the launch
+  overhead of the few kernels per batch when the batches are small.  This
+  computes them in a single persistent kernel instead, if it is worthwhile and
+  the device supports cooperative launches.
+
+     @param [in] fsas  The FSAs; must be on GPU for this to do anything.
+     @param [in] state_batches  As for GetForwardScores().
+     @param [in] arc_batches  The entering_arc_batches (if `forward`) or the
+                          leaving_arc_batches for the states in
+                          `state_batches`.
+     @param [in] forward  True for forward scores, false for backward scores.
+     @param [in] log_semiring  True to use LogAdd, false to use max.
+     @param [in,out] state_scores_data  The state scores, initialized to 0
+                          for the start-states (forward) or final-states
+                          (backward) and -infinity otherwise.
+     @param [out] entering_arcs_data  If not nullptr (requires `forward` and
+                          !log_semiring), the best entering arc of each state
+                          is written here.
+     @return  Returns true if the scores were computed, false if the caller
+              should compute them batch by batch.
+ */
+template <typename FloatType>
+static bool ComputeScoresInOneKernel(FsaVec &fsas,
+                                     Ragged<int32_t> &state_batches,
+                                     Ragged<int32_t> &arc_batches,
+                                     bool forward, bool log_semiring,
+                                     FloatType *state_scores_data,
+                                     int32_t *entering_arcs_data) {
+  ContextPtr &c = fsas.Context();
+  if (c->GetDeviceType() != kCuda) return false;
+#if defined(K2_WITH_CUDA) && CUDART_VERSION >= 11000
+  NVTX_RANGE(K2_FUNC);
+  // Below kMinBatches batches, or if the batches are large, the per-batch
+  // kernels are fast enough; each thread here reduces the arcs of a state
+  // sequentially.
+  const int32_t kMinBatches = 64, kMaxAvgStatesPerBatch = 2048,
+                kBlockSize = 256;
+  int32_t num_batches = state_batches.Dim0(),
+          num_states = state_batches.NumElements();
+  if (num_batches < kMinBatches ||
+      num_states > kMaxAvgStatesPerBatch * num_batches)
+    return false;
+
+  int32_t device_id = c->GetDeviceId(), cooperative_launch = 0,
+          num_sms = 0, blocks_per_sm = 0;
+  DeviceGuard guard(device_id);
+  K2_CUDA_SAFE_CALL(cudaDeviceGetAttribute(
+      &cooperative_launch, cudaDevAttrCooperativeLaunch, device_id));
+  if (!cooperative_launch) return false;
+  K2_CUDA_SAFE_CALL(cudaDeviceGetAttribute(
+      &num_sms, cudaDevAttrMultiProcessorCount, device_id));
+  K2_CUDA_SAFE_CALL(cudaOccupancyMaxActiveBlocksPerMultiprocessor(
+      &blocks_per_sm, ComputeScoresKernel<FloatType>, kBlockSize, 0));
+
+  // batch_states_begin[b] is the index into state_batches.values of the
+  // first state of batch b.
+  Array1<int32_t> batch_states_begin(c, num_batches + 1);
+  int32_t *batch_states_begin_data = batch_states_begin.Data();
+  const int32_t *row_splits1_data = state_batches.RowSplits(1).Data(),
+                *row_splits2_data = state_batches.RowSplits(2).Data();
+  K2_EVAL(
+      c, num_batches + 1, lambda_set_batch_states_begin, (int32_t i)->void {
+        batch_states_begin_data[i] = row_splits2_data[row_splits1_data[i]];
+      });
+  Array1<int32_t> cpu_batch_states_begin =
+      batch_states_begin.To(GetCpuContext());
+  const int32_t *cpu_begin_data = cpu_batch_states_begin.Data();
+  int32_t max_batch_size = 0;
+  for (int32_t i = 0; i < num_batches; ++i)
+    max_batch_size =
+        std::max(max_batch_size, cpu_begin_data[i + 1] - cpu_begin_data[i]);
+  // The grid must be co-resident for grid.sync(); threads beyond the largest
+  // batch would only wait at the barrier.
+  int32_t num_blocks = std::min(blocks_per_sm * num_sms,
+                                NumBlocks(max_batch_size, kBlockSize));
+  if (num_blocks <= 0) return false;
+
+  const int32_t *batch_states_data = state_batches.values.Data(),
+                *arc_batches_row_splits3_data =
+                    arc_batches.RowSplits(3).Data(),
+                *arc_batches_data = arc_batches.values.Data(),
+                *fsas_row_ids1_data = fsas.RowIds(1).Data(),
+                *fsas_row_splits1_data = fsas.RowSplits(1).Data(),
+                *fsas_row_ids2_data = fsas.RowIds(2).Data();
+  const Arc *arcs_data = fsas.values.Data();
+  void *args[] = {&num_batches,
+                  &batch_states_begin_data,
+                  &batch_states_data,
+                  &arc_batches_row_splits3_data,
+                  &arc_batches_data,
+                  &arcs_data,
+                  &fsas_row_ids1_data,
+                  &fsas_row_splits1_data,
+                  &fsas_row_ids2_data,
+                  &forward,
+                  &log_semiring,
+                  &state_scores_data,
+                  &entering_arcs_data};
+  K2_CUDA_SAFE_CALL(cudaLaunchCooperativeKernel(
+      reinterpret_cast<void *>(ComputeScoresKernel<FloatType>),
+      dim3(num_blocks), dim3(kBlockSize), args, 0, c->GetCudaStream()));
+  return true;
+#else
+  return false;
+#endif
+}
+
 template <typename FloatType>
 Array1<FloatType> GetForwardScores(FsaVec &fsas, Ragged<int32_t> &state_batches,
                                    Ragged<int32_t> &entering_arc_batches,
@@ -1173,6 +1745,12 @@ Array1<FloatType> GetForwardScores(FsaVec &fsas, Ragged<int32_t> &state_batches,
     entering_arcs_data = entering_arcs->Data();
   }
 
+  if (ComputeScoresInOneKernel<FloatType>(fsas, state_batches,
+                                          entering_arc_batches, true,
+                                          log_semiring, state_scores_data,
+                                          entering_arcs_data))
+    return state_scores;
+
   RaggedAxis0Splitter<int32_t> arc_batches_splitter(entering_arc_batches);
 
   // process batch sequentially.
@@ -1277,6 +1855,184 @@ Array1<FloatType> GetForwardScores(FsaVec &fsas, Ragged<int32_t> &state_batches,
   return state_scores;
 }
 
+bool IsSmallFsaVec(FsaVec &fsas) {
+  NVTX_RANGE(K2_FUNC);
+  K2_CHECK_EQ(fsas.NumAxes(), 3);
+  ContextPtr &c = fsas.Context();
+  const int32_t *fsas_row_splits1_data = fsas.RowSplits(1).Data(),
+                *fsas_row_splits2_data = fsas.RowSplits(2).Data();
+  Array1<int32_t> too_big(c, 1, 0);
+  int32_t *too_big_data = too_big.Data();
+  K2_EVAL(
+      c, fsas.Dim0(), lambda_check_sizes, (int32_t fsa_idx) {
+        int32_t state_begin = fsas_row_splits1_data[fsa_idx],
+                state_end = fsas_row_splits1_data[fsa_idx + 1],
+                num_arcs = fsas_row_splits2_data[state_end] -
+                           fsas_row_splits2_data[state_begin];
+        // All writers write the same value, so the race is harmless.
+        if (state_end - state_begin > kSmallFsaMaxStates ||
+            num_arcs > kSmallFsaMaxArcs)
+          too_big_data[0] = 1;
+      });
+  return too_big[0] == 0;
+}
+
+template <typename FloatType>
+Array1<FloatType> GetForwardScoresOfSmallFsas(FsaVec &fsas,
+                                              bool log_semiring,
+                                              Array1<int32_t> *entering_arcs) {
+  NVTX_RANGE(K2_FUNC);
+  K2_STATIC_ASSERT((std::is_same<float, FloatType>::value ||
+                    std::is_same<double, FloatType>::value));
+  K2_CHECK_EQ(fsas.NumAxes(), 3);
+  ContextPtr &c = fsas.Context();
+  int32_t num_fsas = fsas.Dim0(), num_states = fsas.TotSize(1);
+
+  const FloatType negative_infinity =
+      -std::numeric_limits<FloatType>::infinity();
+  Array1<FloatType> state_scores(c, num_states);
+  FloatType *state_scores_data = state_scores.Data();
+  int32_t *entering_arcs_data = nullptr;
+  if (entering_arcs) {
+    K2_CHECK_EQ(log_semiring, false) << " entering_arcs supplied";
+    *entering_arcs = Array1<int32_t>(c, num_states);
+    entering_arcs_data = entering_arcs->Data();
+  }
+  if (num_fsas == 0) return state_scores;
+
+  const int32_t *fsas_row_splits1_data = fsas.RowSplits(1).Data(),
+                *fsas_row_splits2_data = fsas.RowSplits(2).Data();
+  const Arc *arcs = fsas.values.Data();
+
+  if (c->GetDeviceType() == kCuda) {
+#ifdef K2_WITH_CUDA
+    K2_DCHECK(IsSmallFsaVec(fsas));
+    namespace cg = cooperative_groups;
+    const unsigned int thread_group_size = 32;  // one warp per FSA.
+    const int32_t arcs_per_thread = kSmallFsaMaxArcs / thread_group_size;
+    static_assert(kSmallFsaMaxStates <= thread_group_size, "");
+    auto lambda_set_scores = [=] __device__(
+        cg::thread_block_tile<thread_group_size> g,
+        int32_t *,  // unused shared data
+        int32_t fsa_idx) -> void {
+      int32_t thread_idx = g.thread_rank(),
+              state_idx0x = fsas_row_splits1_data[fsa_idx],
+              this_num_states =
+                  fsas_row_splits1_data[fsa_idx + 1] - state_idx0x,
+              arc_idx0xx = fsas_row_splits2_data[state_idx0x],
+              this_num_arcs =
+                  fsas_row_splits2_data[state_idx0x + this_num_states] -
+                  arc_idx0xx;
+      // Thread `thread_idx` owns arcs thread_idx + k * thread_group_size
+      // (idx12's in this FSA) and the state numbered thread_idx.
+      int32_t src_states[arcs_per_thread], dest_states[arcs_per_thread];
+      float arc_scores[arcs_per_thread];
+      // arc_totals[k] is the forward score of the src-state of arc k plus
+      // its score, set once the src-state has been processed.
+      FloatType arc_totals[arcs_per_thread];
+      for (int32_t k = 0; k < arcs_per_thread; ++k) {
+        int32_t arc_idx12 = thread_idx + k * thread_group_size;
+        src_states[k] = -1;
+        dest_states[k] = -1;
+        arc_scores[k] = 0;
+        arc_totals[k] = negative_infinity;
+        if (arc_idx12 < this_num_arcs) {
+          const Arc &arc = arcs[arc_idx0xx + arc_idx12];
+          src_states[k] = arc.src_state;
+          dest_states[k] = arc.dest_state;
+          arc_scores[k] = arc.score;
+        }
+      }
+      FloatType my_score = (thread_idx == 0 ? 0 : negative_infinity);
+      int32_t my_entering_arc = -1;
+      for (int32_t s = 0; s < this_num_states; ++s) {
+        // The FSA is top-sorted, so the arcs entering state s leave states
+        // < s, whose scores are final.  `score` and `best_arc` become the
+        // same in all threads of the group.
+        FloatType score = 0;
+        int32_t best_arc = -1;
+        if (s > 0) {
+          score = negative_infinity;
+          for (int32_t k = 0; k < arcs_per_thread; ++k) {
+            if (dest_states[k] != s) continue;
+            if (log_semiring) {
+              score = LogAdd<FloatType>()(score, arc_totals[k]);
+            } else if (arc_totals[k] >= score) {
+              // Among equal scores, prefer the arc with the highest index,
+              // as ArgMaxPerSublist() does.
+              score = arc_totals[k];
+              best_arc = thread_idx + k * thread_group_size;
+            }
+          }
+          for (int32_t offset = thread_group_size / 2; offset > 0;
+               offset /= 2) {
+            FloatType other_score = g.shfl_xor(score, offset);
+            if (log_semiring) {
+              score = LogAdd<FloatType>()(score, other_score);
+            } else {
+              int32_t other_arc = g.shfl_xor(best_arc, offset);
+              if (other_score > score ||
+                  (other_score == score && other_arc > best_arc)) {
+                score = other_score;
+                best_arc = other_arc;
+              }
+            }
+          }
+          if (thread_idx == s) {
+            my_score = score;
+            my_entering_arc = best_arc;
+          }
+        }
+        for (int32_t k = 0; k < arcs_per_thread; ++k)
+          if (src_states[k] == s) arc_totals[k] = score + arc_scores[k];
+      }
+      if (thread_idx < this_num_states) {
+        state_scores_data[state_idx0x + thread_idx] = my_score;
+        if (entering_arcs_data != nullptr)
+          entering_arcs_data[state_idx0x + thread_idx] =
+              (my_entering_arc == -1 ? -1 : arc_idx0xx + my_entering_arc);
+      }
+    };
+    EvalGroupDevice<thread_group_size, int32_t>(c, num_fsas,
+                                                lambda_set_scores);
+#else
+    K2_LOG(FATAL) << "Unreachable code!";
+#endif
+  } else {
+    // CPU.  The arcs are sorted by src-state, so if we visit them in order
+    // the src-state of each arc has its final score when we get to it.
+    ParallelFor(0, num_fsas, [=](int32_t fsa_idx) -> void {
+      int32_t state_idx0x = fsas_row_splits1_data[fsa_idx],
+              state_end = fsas_row_splits1_data[fsa_idx + 1];
+      if (state_end == state_idx0x) return;
+      for (int32_t state_idx01 = state_idx0x; state_idx01 < state_end;
+           ++state_idx01) {
+        state_scores_data[state_idx01] = negative_infinity;
+        if (entering_arcs_data != nullptr)
+          entering_arcs_data[state_idx01] = -1;
+      }
+      state_scores_data[state_idx0x] = 0;
+      int32_t arc_end = fsas_row_splits2_data[state_end];
+      for (int32_t arc_idx012 = fsas_row_splits2_data[state_idx0x];
+           arc_idx012 < arc_end; ++arc_idx012) {
+        const Arc &arc = arcs[arc_idx012];
+        FloatType score = state_scores_data[state_idx0x + arc.src_state] +
+                          arc.score;
+        FloatType *dest_score =
+            state_scores_data + state_idx0x + arc.dest_state;
+        if (log_semiring) {
+          *dest_score = LogAdd<FloatType>()(*dest_score, score);
+        } else if (score >= *dest_score) {
+          *dest_score = score;
+          if (entering_arcs_data != nullptr)
+            entering_arcs_data[state_idx0x + arc.dest_state] = arc_idx012;
+        }
+      }
+    });
+  }
+  return state_scores;
+}
+
 template <typename FloatType>
 void BackpropGetArcPost(FsaVec &fsas, Ragged<int32_t> &incoming_arcs,
                         const Array1<FloatType> &arc_post_deriv,
@@ -1381,6 +2137,12 @@ Array1<FloatType> GetBackwardScores(FsaVec &fsas,
           state_scores_data[start_state_next_fsa - 1] = 0;
       });
 
+  if (ComputeScoresInOneKernel<FloatType>(fsas, state_batches,
+                                          leaving_arc_batches, false,
+                                          log_semiring, state_scores_data,
+                                          nullptr))
+    return state_scores;
+
   RaggedAxis0Splitter<int32_t> arc_batches_splitter(leaving_arc_batches);
 
   const Arc *arcs = fsas.values.Data();
@@ -1911,6 +2673,10 @@ template Array1<double> GetForwardScores(FsaVec &fsas,
                                          Ragged<int32_t> &entering_arc_batches,
                                          bool log_semiring,
                                          Array1<int32_t> *entering_arcs);
+template Array1<float> GetForwardScoresOfSmallFsas(
+    FsaVec &fsas, bool log_semiring, Array1<int32_t> *entering_arcs);
+template Array1<double> GetForwardScoresOfSmallFsas(
+    FsaVec &fsas, bool log_semiring, Array1<int32_t> *entering_arcs);
 
 template Array1<float> GetBackwardScores(FsaVec &fsas,
                                          Ragged<int32_t> &state_batches,
@@ -1933,6 +2699,94 @@ template Array1<float> GetTotScores(FsaVec &fsas,
 template Array1<double> GetTotScores(FsaVec &fsas,
                                      const Array1<double> &forward_scores);
 
+template <typename FloatType>
+Array1<FloatType> GetTotScoresOfLinearFsas(FsaVec &fsas) {
+  NVTX_RANGE(K2_FUNC);
+  K2_CHECK_EQ(fsas.NumAxes(), 3);
+  ContextPtr &c = fsas.Context();
+  int32_t num_fsas = fsas.Dim0(), num_arcs = fsas.NumElements();
+
+  Array1<FloatType> arc_scores(c, num_arcs);
+  FloatType *arc_scores_data = arc_scores.Data();
+  const Arc *arcs_data = fsas.values.Data();
+  K2_EVAL(
+      c, num_arcs, lambda_copy_arc_scores, (int32_t arc_idx012) {
+        arc_scores_data[arc_idx012] = arcs_data[arc_idx012].score;
+      });
+  // A linear FSA has a single path, so its total score is the sum of its
+  // arc scores in either semiring.
+  Ragged<FloatType> scores(RemoveAxis(fsas.shape, 1), arc_scores);
+  Array1<FloatType> tot_scores(c, num_fsas);
+  SumPerSublist<FloatType>(scores, 0, &tot_scores);
+
+  const FloatType negative_infinity =
+      -std::numeric_limits<FloatType>::infinity();
+  FloatType *tot_scores_data = tot_scores.Data();
+  const int32_t *fsa_row_splits1_data = fsas.RowSplits(1).Data();
+  K2_EVAL(
+      c, num_fsas, lambda_set_empty_fsas, (int32_t fsa_idx) {
+        if (fsa_row_splits1_data[fsa_idx + 1] == fsa_row_splits1_data[fsa_idx])
+          tot_scores_data[fsa_idx] = negative_infinity;
+      });
+  return tot_scores;
+}
+
+template Array1<float> GetTotScoresOfLinearFsas(FsaVec &fsas);
+template Array1<double> GetTotScoresOfLinearFsas(FsaVec &fsas);
+
+FsaVecTopology::FsaVecTopology(FsaVec &fsas)
+    : FsaVecTopology(fsas, GetStateBatches(fsas, true)) {}
+
+FsaVecTopology::FsaVecTopology(FsaVec &fsas,
+                               const Ragged<int32_t> &state_batches)
+    : fsas_(fsas), state_batches_(state_batches) {
+  NVTX_RANGE(K2_FUNC);
+  K2_CHECK_EQ(fsas.NumAxes(), 3);
+  K2_CHECK_EQ(state_batches.NumAxes(), 3);
+  K2_CHECK_EQ(state_batches.NumElements(), fsas.TotSize(1));
+  incoming_arcs_ = GetIncomingArcs(fsas, GetDestStates(fsas, true));
+  entering_arc_batches_ =
+      GetEnteringArcIndexBatches(fsas, incoming_arcs_, state_batches_);
+  leaving_arc_batches_ = GetLeavingArcIndexBatches(fsas, state_batches_);
+}
+
+template <typename FloatType>
+void FsaVecTopology::GetScores(FsaVec &fsas, bool log_semiring,
+                               Array1<FloatType> *forward_scores,
+                               Array1<FloatType> *backward_scores,
+                               Array1<FloatType> *arc_post,
+                               Array1<int32_t> *entering_arcs) {
+  NVTX_RANGE(K2_FUNC);
+  K2_CHECK_NE(forward_scores, nullptr);
+  K2_CHECK(IsCompatible(fsas, fsas_));
+  K2_CHECK_EQ(fsas.NumAxes(), 3);
+  K2_CHECK_EQ(fsas.Dim0(), fsas_.Dim0());
+  K2_CHECK_EQ(fsas.TotSize(1), fsas_.TotSize(1));
+  K2_CHECK_EQ(fsas.TotSize(2), fsas_.TotSize(2));
+
+  *forward_scores = GetForwardScores<FloatType>(
+      fsas, state_batches_, entering_arc_batches_, log_semiring,
+      entering_arcs);
+  if (backward_scores == nullptr && arc_post == nullptr) return;
+
+  Array1<FloatType> backward = GetBackwardScores<FloatType>(
+      fsas, state_batches_, leaving_arc_batches_, log_semiring);
+  if (arc_post != nullptr)
+    *arc_post = GetArcPost(fsas, *forward_scores, backward);
+  if (backward_scores != nullptr) *backward_scores = backward;
+}
+
+template void FsaVecTopology::GetScores(FsaVec &fsas, bool log_semiring,
+                                        Array1<float> *forward_scores,
+                                        Array1<float> *backward_scores,
+                                        Array1<float> *arc_post,
+                                        Array1<int32_t> *entering_arcs);
+template void FsaVecTopology::GetScores(FsaVec &fsas, bool log_semiring,
+                                        Array1<double> *forward_scores,
+                                        Array1<double> *backward_scores,
+                                        Array1<double> *arc_post,
+                                        Array1<int32_t> *entering_arcs);
+
 Fsa RandomFsa(bool acyclic /*=true*/, int32_t max_symbol /*=50*/,
               int32_t min_num_arcs /*=0*/, int32_t max_num_arcs /*=1000*/) {
   NVTX_RANGE(K2_FUNC);
@@ -1956,7 +2810,7 @@ Fsa RandomFsa(bool acyclic /*=true*/, int32_t max_symbol /*=50*/,
   RaggedShapeLayer ans_shape_dim;
   ans_shape_dim.row_splits = ans_row_splits1;
   ans_shape_dim.cached_tot_size = shape.TotSize(1);
-  RaggedShape ans_shape(std::vector<RaggedShapeLayer>{ans_shape_dim}, true);
+  RaggedShape ans_shape(RaggedShapeLayers{ans_shape_dim}, true);
   ans_shape.Populate();
 
   // will be used to generate scores on arcs.
@@ -2042,6 +2896,154 @@ DenseFsaVec RandomDenseFsaVec(int32_t min_num_fsas, int32_t max_num_fsas,
   return DenseFsaVec(RaggedShape2(&row_splits, nullptr, tot_frames), scores);
 }
 
+// Streams, i.e. the high halves of the Philox counters, of the random numbers
+// of the device-side generators below, so that they are independent.
+static constexpr uint64_t kNumStatesStream = 1, kOutDegreeStream = 2,
+                          kArcStream = 3, kNumFramesStream = 4,
+                          kScoresStream = 5;
+
+static uint64_t RandomSeedIfZero(uint64_t seed) {
+  if (seed != 0) return seed;
+  int32_t max_value = std::numeric_limits<int32_t>::max();
+  return (static_cast<uint64_t>(RandInt(0, max_value)) << 31) +
+         RandInt(1, max_value);
+}
+
+FsaVec RandomFsaVec(ContextPtr c, const RandomFsaVecOptions &opts) {
+  NVTX_RANGE(K2_FUNC);
+  K2_CHECK_GE(opts.num_fsas, 0);
+  K2_CHECK_GE(opts.min_num_states, 2);
+  K2_CHECK_GE(opts.max_num_states, opts.min_num_states);
+  K2_CHECK_GE(opts.min_out_degree, 0);
+  K2_CHECK_GE(opts.max_out_degree, opts.min_out_degree);
+  K2_CHECK_GT(opts.degree_skew, 0);
+  K2_CHECK_GE(opts.max_symbol, 1);
+  K2_CHECK(opts.epsilon_ratio >= 0 && opts.epsilon_ratio <= 1);
+  uint64_t seed = RandomSeedIfZero(opts.seed);
+  int32_t num_fsas = opts.num_fsas, min_num_states = opts.min_num_states,
+          num_states_range = opts.max_num_states - min_num_states + 1,
+          min_out_degree = opts.min_out_degree,
+          max_out_degree = opts.max_out_degree,
+          out_degree_range = max_out_degree - min_out_degree + 1,
+          max_symbol = opts.max_symbol;
+  float degree_skew = opts.degree_skew, epsilon_ratio = opts.epsilon_ratio;
+  bool acyclic = opts.acyclic;
+
+  Array1<int32_t> row_splits1(c, num_fsas + 1);
+  int32_t *row_splits1_data = row_splits1.Data();
+  K2_EVAL(
+      c, num_fsas, lambda_set_num_states, (int32_t fsa_idx0)->void {
+        uint32_t r[4];
+        Philox4x32(seed, kNumStatesStream, fsa_idx0, r);
+        row_splits1_data[fsa_idx0] = min_num_states + r[0] % num_states_range;
+      });
+  ExclusiveSum(row_splits1, &row_splits1);
+  int32_t num_states = row_splits1.Back();
+  RaggedShape states_shape = RaggedShape2(&row_splits1, nullptr, num_states);
+  const int32_t *row_ids1_data = states_shape.RowIds(1).Data();
+
+  Array1<int32_t> row_splits2(c, num_states + 1);
+  int32_t *row_splits2_data = row_splits2.Data();
+  K2_EVAL(
+      c, num_states, lambda_set_num_arcs, (int32_t state_idx01)->void {
+        int32_t fsa_idx0 = row_ids1_data[state_idx01];
+        if (state_idx01 + 1 == row_splits1_data[fsa_idx0 + 1]) {
+          row_splits2_data[state_idx01] = 0;  // the final state
+          return;
+        }
+        uint32_t r[4];
+        Philox4x32(seed, kOutDegreeStream, state_idx01, r);
+        float u = (r[0] >> 8) * (1.0f / 16777216.0f);  // in [0, 1)
+        int32_t out_degree =
+            min_out_degree +
+            static_cast<int32_t>(out_degree_range * powf(u, degree_skew));
+        row_splits2_data[state_idx01] =
+            (out_degree < max_out_degree ? out_degree : max_out_degree);
+      });
+  ExclusiveSum(row_splits2, &row_splits2);
+  int32_t num_arcs = row_splits2.Back();
+  RaggedShape arcs_shape = RaggedShape2(&row_splits2, nullptr, num_arcs);
+  const int32_t *row_ids2_data = arcs_shape.RowIds(1).Data();
+
+  Array1<Arc> arcs(c, num_arcs);
+  Arc *arcs_data = arcs.Data();
+  K2_EVAL(
+      c, num_arcs, lambda_set_arcs, (int32_t arc_idx012)->void {
+        int32_t state_idx01 = row_ids2_data[arc_idx012],
+                fsa_idx0 = row_ids1_data[state_idx01],
+                state_idx0x = row_splits1_data[fsa_idx0],
+                this_num_states =
+                    row_splits1_data[fsa_idx0 + 1] - state_idx0x,
+                src_state = state_idx01 - state_idx0x,
+                final_state = this_num_states - 1;
+        uint32_t r[4];
+        Philox4x32(seed, kArcStream, arc_idx012, r);
+        int32_t dest_state =
+            acyclic ? src_state + 1 + r[0] % (final_state - src_state)
+                    : r[0] % this_num_states;
+        int32_t label;
+        if (dest_state == final_state)
+          label = -1;
+        else if ((r[1] >> 8) * (1.0f / 16777216.0f) < epsilon_ratio)
+          label = 0;
+        else
+          label = 1 + r[2] % max_symbol;
+        float score = (r[3] >> 8) * (10.0f / 16777216.0f);
+        arcs_data[arc_idx012] = Arc(src_state, dest_state, label, score);
+      });
+  return FsaVec(ComposeRaggedShapes(states_shape, arcs_shape), arcs);
+}
+
+DenseFsaVec RandomDenseFsaVec(ContextPtr c, int32_t num_fsas,
+                              int32_t min_frames, int32_t max_frames,
+                              int32_t num_symbols,
+                              float scores_scale /*= 1.0*/,
+                              uint64_t seed /*= 0*/) {
+  NVTX_RANGE(K2_FUNC);
+  K2_CHECK_GE(num_fsas, 0);
+  K2_CHECK_GE(min_frames, 0);
+  K2_CHECK_GE(max_frames, min_frames);
+  K2_CHECK_GE(num_symbols, 1);
+  seed = RandomSeedIfZero(seed);
+  int32_t num_frames_range = max_frames - min_frames + 1,
+          num_cols = num_symbols + 1;
+
+  Array1<int32_t> row_splits(c, num_fsas + 1);
+  int32_t *row_splits_data = row_splits.Data();
+  K2_EVAL(
+      c, num_fsas, lambda_set_num_frames, (int32_t fsa_idx0)->void {
+        uint32_t r[4];
+        Philox4x32(seed, kNumFramesStream, fsa_idx0, r);
+        // + 1 for the frame of the final-symbol.
+        row_splits_data[fsa_idx0] =
+            min_frames + r[0] % num_frames_range + 1;
+      });
+  ExclusiveSum(row_splits, &row_splits);
+  int32_t tot_frames = row_splits.Back();
+  RaggedShape shape = RaggedShape2(&row_splits, nullptr, tot_frames);
+  const int32_t *row_ids_data = shape.RowIds(1).Data();
+
+  Array2<float> scores(c, tot_frames, num_cols);
+  auto scores_acc = scores.Accessor();
+  const float minus_inf = -std::numeric_limits<float>::infinity();
+  K2_EVAL2(
+      c, tot_frames, num_cols, lambda_set_scores,
+      (int32_t frame, int32_t col)->void {
+        // On the last frame of a sequence only the final-symbol -1 (in
+        // column 0) has a finite score; on the others, all but it.
+        bool is_last_frame =
+            frame + 1 == row_splits_data[row_ids_data[frame] + 1];
+        if (is_last_frame != (col == 0)) {
+          scores_acc(frame, col) = minus_inf;
+          return;
+        }
+        float u = PhiloxUniform<float>(
+            seed, kScoresStream, static_cast<uint64_t>(frame) * num_cols + col);
+        scores_acc(frame, col) = scores_scale * (u - 0.5f);
+      });
+  return DenseFsaVec(shape, scores);
+}
+
 Ragged<int32_t> GetStartStates(FsaVec &src) {
   NVTX_RANGE(K2_FUNC);
   ContextPtr &c = src.Context();
@@ -2337,7 +3339,8 @@ template <typename FloatType>
 Ragged<int32_t> RandomPaths(FsaVec &fsas,
                             const Array1<FloatType> &arc_cdf,
                             const Array1<int32_t> &num_paths,
-                            Ragged<int32_t> &state_batches) {
+                            Ragged<int32_t> &state_batches,
+                            int64_t seed /*= -1*/) {
   using namespace random_paths_internal;  // NOLINT
   K2_CHECK_EQ(fsas.NumAxes(), 3);
   K2_CHECK_EQ(fsas.NumElements(), arc_cdf.Dim());
@@ -2403,8 +3406,13 @@ Ragged<int32_t> RandomPaths(FsaVec &fsas,
   // the end (avoid theoretically possible segfault, as ExclusiveSum would read
   // that not-needed element).
   ExclusiveSum(num_paths_sum, &num_paths_sum);
-  int32_t tot_space_needed = storage_row_splits.Back(),
-      tot_num_paths = num_paths_sum.Back();
+  // Read both totals back with one sync.
+  ScalarReadback readback(c);
+  int32_t space_handle = readback.AddBack(storage_row_splits),
+      paths_handle = readback.AddBack(num_paths_sum);
+  readback.Sync();
+  int32_t tot_space_needed = readback.Get<int32_t>(space_handle),
+      tot_num_paths = readback.Get<int32_t>(paths_handle);
 
   Array1<int32_t> paths_row_ids(c, tot_num_paths);
   RowSplitsToRowIds(num_paths_sum, &paths_row_ids);
@@ -2459,7 +3467,9 @@ Ragged<int32_t> RandomPaths(FsaVec &fsas,
            end_arc = fsas_row_splits2_data[start_state + 1];
        shared_data->begin_arc_idx01x = begin_arc;
        shared_data->num_arcs = end_arc - begin_arc;
-       FloatType p = ((FloatType)0.5 + path_idx1) / num_paths;
+       FloatType p =
+           (seed < 0 ? ((FloatType)0.5 + path_idx1) / num_paths
+                     : PhiloxUniform<FloatType>(seed, fsa_idx, path_idx1));
        shared_data->p = p;
      }
 
@@ -2539,57 +3549,61 @@ Ragged<int32_t> RandomPaths(FsaVec &fsas,
     K2_LOG(FATAL) << "Unreachable code!";
 #endif
   } else {
-    // CPU.
-    for (int32_t fsa_idx = 0; fsa_idx < num_fsas; ++fsa_idx) {
-      int32_t state_idx0x = fsas_row_splits1_data[fsa_idx],
+    // CPU.  The paths are independent, so they are sampled in parallel if
+    // SetNumCpuThreads() was called.
+    ParallelFor(0, tot_num_paths, [=](int32_t i) -> void {
+      int32_t fsa_idx = paths_row_ids_data[i],
+          state_idx0x = fsas_row_splits1_data[fsa_idx],
           final_state = fsas_row_splits1_data[fsa_idx + 1] - 1,
-          num_paths = num_paths_data[fsa_idx],
+          path_begin = paths_row_splits_data[fsa_idx],
+          path_idx1 = i - path_begin,
+          num_paths = paths_row_splits_data[fsa_idx + 1] - path_begin,
           num_batches = num_state_batches_data[fsa_idx];
-      for (int32_t path_idx1 = 0; path_idx1 < num_paths; ++path_idx1) {
-        int32_t *path_storage_start = path_storage_data +
-            storage_row_splits_data[fsa_idx] + path_idx1 * num_batches;
-
-        int32_t cur_state_idx01 = state_idx0x;  // Start state.  Note: start
-                                                // state is never the final
-                                                // state.
-        FloatType p = (FloatType(0.5) + path_idx1) / num_paths;
-
-        int32_t path_pos;
-        for (path_pos = 0; path_pos <= num_batches; ++path_pos) {
-          // Note: if things are working correctly we should break from this
-          // loop before it naturally terminates.
-          if (cur_state_idx01 == final_state) {  // Finalize..
-            path_storage_start[0] = path_pos;
-            break;
-          }
-          int32_t arc_idx01x = fsas_row_splits2_data[cur_state_idx01],
-              arc_idx01x_next = fsas_row_splits2_data[cur_state_idx01 + 1];
-          K2_DCHECK_GT(arc_idx01x_next, arc_idx01x);
-          // std::upper_bound finds the first index i in the range
-          //  [arc_idx01x+1 .. arc_idx01x_next-1] such that
-          // arc_cdf_data[i] > p, and if it doesn't exist gives us
-          // arc_idx01x_next (so p will be in the last interval).
-          const FloatType *begin1 = arc_cdf_data + arc_idx01x + 1,
-              *end = arc_cdf_data + arc_idx01x_next;
-          int32_t arc_idx2 = std::upper_bound(begin1, end, p) - begin1;
-          int32_t arc_idx012 = arc_idx01x + arc_idx2;
-          FloatType interval_start = arc_cdf_data[arc_idx012],
-              interval_end = (arc_idx012 + 1 == arc_idx01x_next ? 1.0 :
-                              arc_cdf_data[arc_idx012 + 1]);
-          K2_DCHECK_GE(p, interval_start);
-          K2_DCHECK_LE(p, interval_end);
-          p = (p - interval_start) / (interval_end - interval_start);
-
-          // + 1 to leave space to store the path length.
-          path_storage_start[path_pos + 1] = arc_idx012;
-          int32_t next_state_idx01 = arcs[arc_idx012].dest_state + state_idx0x;
-          cur_state_idx01 = next_state_idx01;
+      int32_t *path_storage_start = path_storage_data +
+          storage_row_splits_data[fsa_idx] + path_idx1 * num_batches;
+
+      int32_t cur_state_idx01 = state_idx0x;  // Start state.  Note: start
+                                              // state is never the final
+                                              // state.
+      FloatType p = (seed < 0 ? (FloatType(0.5) + path_idx1) / num_paths
+                              : PhiloxUniform<FloatType>(seed, fsa_idx,
+                                                         path_idx1));
+
+      int32_t path_pos;
+      for (path_pos = 0; path_pos <= num_batches; ++path_pos) {
+        // Note: if things are working correctly we should break from this
+        // loop before it naturally terminates.
+        if (cur_state_idx01 == final_state) {  // Finalize..
+          path_storage_start[0] = path_pos;
+          break;
         }
-        if (path_pos > num_batches)
-          K2_LOG(FATAL)
-              << "Bug in RandomPaths, please ask maintainers for help..";
+        int32_t arc_idx01x = fsas_row_splits2_data[cur_state_idx01],
+            arc_idx01x_next = fsas_row_splits2_data[cur_state_idx01 + 1];
+        K2_DCHECK_GT(arc_idx01x_next, arc_idx01x);
+        // std::upper_bound finds the first index i in the range
+        //  [arc_idx01x+1 .. arc_idx01x_next-1] such that
+        // arc_cdf_data[i] > p, and if it doesn't exist gives us
+        // arc_idx01x_next (so p will be in the last interval).
+        const FloatType *begin1 = arc_cdf_data + arc_idx01x + 1,
+            *end = arc_cdf_data + arc_idx01x_next;
+        int32_t arc_idx2 = std::upper_bound(begin1, end, p) - begin1;
+        int32_t arc_idx012 = arc_idx01x + arc_idx2;
+        FloatType interval_start = arc_cdf_data[arc_idx012],
+            interval_end = (arc_idx012 + 1 == arc_idx01x_next ? 1.0 :
+                            arc_cdf_data[arc_idx012 + 1]);
+        K2_DCHECK_GE(p, interval_start);
+        K2_DCHECK_LE(p, interval_end);
+        p = (p - interval_start) / (interval_end - interval_start);
+
+        // + 1 to leave space to store the path length.
+        path_storage_start[path_pos + 1] = arc_idx012;
+        int32_t next_state_idx01 = arcs[arc_idx012].dest_state + state_idx0x;
+        cur_state_idx01 = next_state_idx01;
       }
-    }
+      if (path_pos > num_batches)
+        K2_LOG(FATAL)
+            << "Bug in RandomPaths, please ask maintainers for help..";
+    });
   }
 
   Array1<int32_t> path_lengths(c, tot_num_paths + 1);
@@ -2641,19 +3655,20 @@ template
 Ragged<int32_t> RandomPaths(FsaVec &fsas,
                             const Array1<float> &arc_cdf,
                             const Array1<int32_t> &num_paths,
-                            Ragged<int32_t> &state_batches);
+                            Ragged<int32_t> &state_batches, int64_t seed);
 template
 Ragged<int32_t> RandomPaths(FsaVec &fsas,
                             const Array1<double> &arc_cdf,
                             const Array1<int32_t> &num_paths,
-                            Ragged<int32_t> &state_batches);
+                            Ragged<int32_t> &state_batches, int64_t seed);
 
 template <typename FloatType>
 Ragged<int32_t> RandomPaths(FsaVec &fsas,
                             const Array1<FloatType> &arc_cdf,
                             int32_t num_paths,
                             const Array1<FloatType> &tot_scores,
-                            Ragged<int32_t> &state_batches) {
+                            Ragged<int32_t> &state_batches,
+                            int64_t seed /*= -1*/) {
   NVTX_RANGE(K2_FUNC);
   ContextPtr c = GetContext(fsas, arc_cdf, tot_scores, state_batches);
   int32_t num_fsas  = fsas.Dim0();
@@ -2669,7 +3684,7 @@ Ragged<int32_t> RandomPaths(FsaVec &fsas,
       int32_t this_num_paths = (tot_score > minus_inf ? num_paths : 0);
       num_paths_data[i] = this_num_paths;
     });
-  return RandomPaths(fsas, arc_cdf, num_paths_array, state_batches);
+  return RandomPaths(fsas, arc_cdf, num_paths_array, state_batches, seed);
 }
 
 template
@@ -2677,13 +3692,104 @@ Ragged<int32_t> RandomPaths(FsaVec &fsas,
                             const Array1<float> &arc_cdf,
                             int32_t num_paths,
                             const Array1<float> &tot_scores,
-                            Ragged<int32_t> &state_batches);
+                            Ragged<int32_t> &state_batches, int64_t seed);
 template
 Ragged<int32_t> RandomPaths(FsaVec &fsas,
                             const Array1<double> &arc_cdf,
                             int32_t num_paths,
                             const Array1<double> &tot_scores,
-                            Ragged<int32_t> &state_batches);
+                            Ragged<int32_t> &state_batches, int64_t seed);
+
+template <typename FloatType>
+Ragged<int32_t> SampleUniquePaths(FsaVec &fsas,
+                                  const Array1<FloatType> &arc_cdf,
+                                  const Array1<FloatType> &tot_scores,
+                                  Ragged<int32_t> &state_batches,
+                                  Ragged<int32_t> &aux_labels,
+                                  int32_t num_paths,
+                                  int32_t max_num_paths /*= 0*/,
+                                  Ragged<int32_t> *word_seqs /*= nullptr*/) {
+  NVTX_RANGE(K2_FUNC);
+  K2_CHECK_EQ(fsas.NumAxes(), 3);
+  K2_CHECK_EQ(aux_labels.NumAxes(), 2);
+  K2_CHECK_EQ(aux_labels.Dim0(), fsas.NumElements());
+  K2_CHECK_GT(num_paths, 0);
+  ContextPtr c = GetContext(fsas, arc_cdf, tot_scores, state_batches,
+                            aux_labels);
+  int32_t num_fsas = fsas.Dim0();
+  bool until_num_unique = (max_num_paths > num_paths);
+
+  Array1<int32_t> cur_num_paths(c, num_fsas);
+  int32_t *cur_num_paths_data = cur_num_paths.Data();
+  const FloatType *tot_scores_data = tot_scores.Data();
+  FloatType minus_inf = -std::numeric_limits<FloatType>::infinity();
+  K2_EVAL(c, num_fsas, lambda_set_num_paths, (int32_t i) {
+      cur_num_paths_data[i] = (tot_scores_data[i] > minus_inf ? num_paths : 0);
+    });
+
+  Ragged<int32_t> paths, unique_seqs;
+  Array1<int32_t> new2old;
+  while (true) {
+    // paths and seqs have 3 axes: [fsa][path][arc] and [fsa][path][label].
+    paths = RandomPaths(fsas, arc_cdf, cur_num_paths, state_batches);
+    Ragged<int32_t> seqs = Index(aux_labels, paths, true);
+    seqs = RemoveValuesLeq(seqs, 0);
+    // The paths of each FSA are kept in the order they were sampled in.
+    unique_seqs = UniqueSequencesHashed(seqs, nullptr, &new2old);
+    if (!until_num_unique) break;
+
+    // Double the number of paths of those FSAs that do not have `num_paths`
+    // unique paths yet.  The paths are taken at fixed intervals of the arc
+    // cdf, so sampling again is deterministic and the FSAs that are done
+    // get the same paths as before.
+    Array1<int32_t> next_num_paths(c, num_fsas);
+    int32_t *next_num_paths_data = next_num_paths.Data();
+    const int32_t *unique_row_splits1_data = unique_seqs.RowSplits(1).Data();
+    K2_EVAL(c, num_fsas, lambda_set_next_num_paths, (int32_t i) {
+        int32_t n = cur_num_paths_data[i],
+            num_unique = unique_row_splits1_data[i + 1] -
+                         unique_row_splits1_data[i];
+        if (num_unique < num_paths && n < max_num_paths)
+          n = min(2 * n, max_num_paths);
+        next_num_paths_data[i] = n;
+      });
+    if (Equal(cur_num_paths, next_num_paths)) break;
+    cur_num_paths = next_num_paths;
+    cur_num_paths_data = cur_num_paths.Data();
+  }
+
+  // Keep at most `num_paths` unique paths per FSA, the first ones sampled.
+  int32_t num_unique = unique_seqs.TotSize(1);
+  Renumbering renumbering(c, num_unique);
+  char *keep_data = renumbering.Keep().Data();
+  const int32_t *unique_row_ids1_data = unique_seqs.RowIds(1).Data(),
+                *unique_row_splits1_data = unique_seqs.RowSplits(1).Data();
+  K2_EVAL(c, num_unique, lambda_set_keep, (int32_t idx01) {
+      int32_t idx0 = unique_row_ids1_data[idx01],
+          idx1 = idx01 - unique_row_splits1_data[idx0];
+      keep_data[idx01] = (idx1 < num_paths);
+    });
+  Array1<int32_t> kept = renumbering.New2Old();
+  if (word_seqs != nullptr) *word_seqs = Index(unique_seqs, 1, kept);
+  return Index(paths, 1, new2old[kept]);
+}
+
+template
+Ragged<int32_t> SampleUniquePaths(FsaVec &fsas,
+                                  const Array1<float> &arc_cdf,
+                                  const Array1<float> &tot_scores,
+                                  Ragged<int32_t> &state_batches,
+                                  Ragged<int32_t> &aux_labels,
+                                  int32_t num_paths, int32_t max_num_paths,
+                                  Ragged<int32_t> *word_seqs);
+template
+Ragged<int32_t> SampleUniquePaths(FsaVec &fsas,
+                                  const Array1<double> &arc_cdf,
+                                  const Array1<double> &tot_scores,
+                                  Ragged<int32_t> &state_batches,
+                                  Ragged<int32_t> &aux_labels,
+                                  int32_t num_paths, int32_t max_num_paths,
+                                  Ragged<int32_t> *word_seqs);
 
 template <typename FloatType>
 FsaVec PruneOnArcPost(FsaVec &src, const Array1<FloatType> &arc_post,
@@ -2873,4 +3979,95 @@ FsaVec RenumberFsaVec(FsaVec &fsas, const Array1<int32_t> &order,
   return FsaVec(ans_shape, ans_arcs);
 }
 
+Array1<int32_t> GetLocalityStateOrder(
+    FsaVec &fsas, const Array1<int32_t> *state_counts /*= nullptr*/) {
+  NVTX_RANGE(K2_FUNC);
+  K2_CHECK_EQ(fsas.NumAxes(), 3);
+  ContextPtr &c = fsas.Context();
+  ContextPtr cpu = GetCpuContext();
+  FsaVec cpu_fsas = fsas.To(cpu);
+  Array1<int32_t> cpu_counts;
+  if (state_counts != nullptr) {
+    K2_CHECK_EQ(state_counts->Dim(), fsas.TotSize(1));
+    cpu_counts = state_counts->To(cpu);
+  }
+  const int32_t *row_splits1_data = cpu_fsas.RowSplits(1).Data(),
+                *row_splits2_data = cpu_fsas.RowSplits(2).Data(),
+                *counts_data =
+                    (state_counts != nullptr ? cpu_counts.Data() : nullptr);
+  const Arc *arcs_data = cpu_fsas.values.Data();
+  int32_t num_fsas = cpu_fsas.Dim0();
+
+  Array1<int32_t> ans(cpu, cpu_fsas.TotSize(1));
+  int32_t *ans_data = ans.Data();
+  std::vector<char> visited;
+  std::vector<int32_t> successors;
+  for (int32_t fsa_idx0 = 0; fsa_idx0 < num_fsas; ++fsa_idx0) {
+    int32_t state_idx0x = row_splits1_data[fsa_idx0],
+            num_states = row_splits1_data[fsa_idx0 + 1] - state_idx0x;
+    if (num_states == 0) continue;
+    auto num_arcs = [=](int32_t state_idx1) -> int32_t {
+      int32_t state_idx01 = state_idx0x + state_idx1;
+      return row_splits2_data[state_idx01 + 1] -
+             row_splits2_data[state_idx01];
+    };
+    // `order` holds idx1's; it is also the queue of the breadth-first
+    // search.  The final state is only added at the end.
+    int32_t *order = ans_data + state_idx0x, order_size = 0,
+            final_state = num_states - 1;
+    visited.assign(num_states, 0);
+    if (final_state > 0) visited[final_state] = 1;
+    visited[0] = 1;
+    order[order_size++] = 0;
+    for (int32_t head = 0; head < order_size; ++head) {
+      int32_t state_idx01 = state_idx0x + order[head];
+      successors.clear();
+      for (int32_t arc_idx012 = row_splits2_data[state_idx01];
+           arc_idx012 < row_splits2_data[state_idx01 + 1]; ++arc_idx012) {
+        int32_t dest_state = arcs_data[arc_idx012].dest_state;
+        if (!visited[dest_state]) {
+          visited[dest_state] = 1;
+          successors.push_back(dest_state);
+        }
+      }
+      std::stable_sort(successors.begin(), successors.end(),
+                       [&num_arcs](int32_t a, int32_t b) {
+                         return num_arcs(a) < num_arcs(b);
+                       });
+      for (int32_t dest_state : successors) order[order_size++] = dest_state;
+    }
+    for (int32_t state_idx1 = 0; state_idx1 < final_state; ++state_idx1)
+      if (!visited[state_idx1]) order[order_size++] = state_idx1;
+    if (final_state > 0) order[order_size++] = final_state;
+    K2_CHECK_EQ(order_size, num_states);
+
+    if (counts_data != nullptr && num_states > 2) {
+      const int32_t *this_counts = counts_data + state_idx0x;
+      std::stable_sort(order + 1, order + num_states - 1,
+                       [this_counts](int32_t a, int32_t b) {
+                         return this_counts[a] > this_counts[b];
+                       });
+    }
+    for (int32_t i = 0; i < num_states; ++i) order[i] += state_idx0x;
+  }
+  return ans.To(c);
+}
+
+Array1<int32_t> GetStateCounts(FsaVec &fsas, const Array1<int32_t> &arc_map) {
+  NVTX_RANGE(K2_FUNC);
+  K2_CHECK_EQ(fsas.NumAxes(), 3);
+  ContextPtr c = GetContext(fsas, arc_map);
+  Array1<int32_t> ans(c, fsas.TotSize(1), 0);
+  int32_t *ans_data = ans.Data();
+  const int32_t *arc_map_data = arc_map.Data(),
+                *row_ids2_data = fsas.RowIds(2).Data();
+  K2_EVAL(
+      c, arc_map.Dim(), lambda_count_states, (int32_t i)->void {
+        int32_t arc_idx012 = arc_map_data[i];
+        if (arc_idx012 >= 0)
+          AtomicAdd(ans_data + row_ids2_data[arc_idx012], 1);
+      });
+  return ans;
+}
+
 }  // namespace k2
@@ -21,8 +21,10 @@
 #ifndef K2_CSRC_FSA_UTILS_H_
 #define K2_CSRC_FSA_UTILS_H_
 
+#include <limits>
 #include <string>
 
+#include "k2/csrc/algorithms.h"
 #include "k2/csrc/array.h"
 #include "k2/csrc/fsa.h"
 
@@ -96,6 +98,21 @@ Fsa FsaFromString(const std::string &s,
                   int32_t num_ragged_labels = 0,
                   Ragged<int32_t> *ragged_labels = nullptr);
 
+/*
+  Create an Fsa from a file in the k2 or OpenFst text format (see
+  FsaFromString()), e.g. an HLG or G.fst.txt.  The file is memory-mapped and
+  parsed with up to GetNumCpuThreads() threads (see SetNumCpuThreads() in
+  thread_pool.h).  Ragged labels are not supported.
+
+  @param [in]  filename  The file to read.
+  @param [in]  openfst, num_extra_labels, extra_labels   See FsaFromString().
+
+  @return It returns an Fsa on CPU.
+ */
+Fsa FsaFromFile(const std::string &filename, bool openfst = false,
+                int32_t num_extra_labels = 0,
+                Array2<int32_t> *extra_labels = nullptr);
+
 /* Convert an FSA to a string.
 
    If the FSA is an acceptor, i.e., extra_labels == nullptr,  every arc
@@ -161,6 +178,52 @@ std::string FsaToString(const Fsa &fsa, bool openfst = false,
 FsaVec RenumberFsaVec(FsaVec &src, const Array1<int32_t> &order,
                       Array1<int32_t> *arc_map);
 
+/*
+  Returns an order of the states of `fsas`, for RenumberFsaVec(), in which
+  states that are close in the graph get close numbers, so that searches
+  like IntersectDensePruned(), whose active states on a frame are mostly
+  successors of those on the previous frame, read the states and arcs of the
+  graph with better memory locality than in the order in which the graph
+  was built.
+
+  The states of each FSA are ordered breadth-first from its start state,
+  with the successors of each state visited in order of increasing number of
+  leaving arcs (i.e. the Cuthill-McKee order).  The start state stays first
+  and the final state last, and unreachable states come before the final
+  state in their original order.  This is a one-off pass over the graph,
+  done on the CPU.
+
+      @param [in] fsas  The FSAs to reorder, with NumAxes() == 3; on any
+                   device.
+      @param [in] state_counts  If not nullptr, an array with one count per
+                   state of `fsas` (its idx01), e.g. the number of times
+                   each state was active in sample decodes, as returned by
+                   GetStateCounts().  The states other than the start and
+                   final state are then sorted by decreasing count, so the
+                   states that are most often active are packed together;
+                   states with equal counts (e.g. never active) stay in
+                   breadth-first order.
+      @return  Returns the order, with ans.Dim() == fsas.TotSize(1), on the
+               device of `fsas`.  E.g. RenumberFsaVec(fsas, ans, &arc_map)
+               returns the reordered FSAs; the arcs leaving each state keep
+               their order.
+ */
+Array1<int32_t> GetLocalityStateOrder(
+    FsaVec &fsas, const Array1<int32_t> *state_counts = nullptr);
+
+/*
+  Counts how many times each state of `fsas` is the source state of an arc
+  in `arc_map`, e.g. the arc_map_a output by IntersectDensePruned() with
+  `fsas` as the decoding graph; counts over several decodes can be summed
+  before calling GetLocalityStateOrder().
+
+      @param [in] fsas  The decoding graph, with NumAxes() == 3.
+      @param [in] arc_map  Arc indexes (idx012) into `fsas`; entries equal
+                   to -1 are ignored.  Must be on the same device as `fsas`.
+      @return  Returns an array with one count per state of `fsas`.
+ */
+Array1<int32_t> GetStateCounts(FsaVec &fsas, const Array1<int32_t> &arc_map);
+
 /*
   Returns a ragged tensor representing batches of states in top-sorted FSAs
   `fsas` which can be processed sequentially with each batch of states only
@@ -307,6 +370,43 @@ Array1<FloatType> BackpropGetForwardScores(
     const Array1<FloatType> &forward_scores,
     const Array1<FloatType> &forward_scores_deriv);
 
+// Limits on the size of each FSA for GetForwardScoresOfSmallFsas() on GPU,
+// where one warp handles one FSA and each of its 32 threads holds the score
+// of one state and up to 4 arcs in registers.
+constexpr int32_t kSmallFsaMaxStates = 32;
+constexpr int32_t kSmallFsaMaxArcs = 128;
+
+/*
+  Returns true if no FSA in `fsas` has more than kSmallFsaMaxStates states
+  or more than kSmallFsaMaxArcs arcs, i.e. if GetForwardScoresOfSmallFsas()
+  may be used.  (Requires a device-to-host copy of one element.)
+ */
+bool IsSmallFsaVec(FsaVec &fsas);
+
+/*
+  A version of GetForwardScores() for batches of many tiny FSAs (e.g. the
+  per-word or per-token lattices of a decoding batch), for which
+  GetStateBatches() and the per-batch kernels would cost far more than the
+  actual computation.  The scores of all FSAs are computed in a single
+  kernel: on GPU, one warp per FSA, which processes the states in order and
+  keeps everything in registers; on CPU, one sequential pass over the arcs
+  of each FSA.  The results are the same as those of GetForwardScores(),
+  including the choice of the entering arc among arcs with equal scores
+  (the one with the highest index); in the log semiring they may differ
+  by roundoff since the LogAdd()s are done in a different order.
+
+      @param [in] fsas  Input FsaVec (must have 3 axes).  Must be
+                 top-sorted and without self loops.  If it is on GPU,
+                 it must satisfy IsSmallFsaVec(fsas); on CPU, the FSAs
+                 may be of any size.
+      @param [in] log_semiring  See GetForwardScores().
+      @param [out,optional] entering_arcs  See GetForwardScores().
+      @return  Returns the forward scores, as GetForwardScores().
+ */
+template <typename FloatType>
+Array1<FloatType> GetForwardScoresOfSmallFsas(
+    FsaVec &fsas, bool log_semiring, Array1<int32_t> *entering_arcs = nullptr);
+
 /*
   Return array of total scores (one per FSA), e.g. could be interpreted as
   the data probability or partition function.
@@ -322,6 +422,21 @@ template <typename FloatType>
 Array1<FloatType> GetTotScores(FsaVec &fsas,
                                const Array1<FloatType> &forward_scores);
 
+/*
+  Return the total scores of FSAs that have the kFsaPropertiesLinear property,
+  i.e. that are single paths, as for numerator graphs in MMI training or
+  n-best paths.  The result is the same as GetTotScores() in either semiring,
+  but is computed as a sum of the arc scores of each FSA, which avoids the
+  state batches and the per-batch kernels of GetForwardScores().
+
+         @param [in] fsas   Input FsaVec (must have 3 axes).  Every FSA in it
+                            must be linear; this is not checked.
+         @return  Returns array of total scores, of dimension fsas.Dim0(),
+                  with -infinity for FSAs that had no states.
+*/
+template <typename FloatType>
+Array1<FloatType> GetTotScoresOfLinearFsas(FsaVec &fsas);
+
 /*
    Compute and return backward scores per state (like betas in Baum-Welch),
    or backward best-path scores if log_semiring == false.
@@ -426,6 +541,18 @@ void BackpropGetArcPost(FsaVec &fsas, Ragged<int32_t> &incoming_arcs,
                         Array1<FloatType> *forward_scores_deriv,
                         Array1<FloatType> *backward_scores_deriv);
 
+/*
+  Finds the states of an FsaVec that are both accessible (reachable from the
+  start state) and coaccessible (can reach the final state), i.e. the states
+  that Connect() keeps.  (Implemented in connect.cu).
+
+     @param [in] fsas   Source FsaVec; must have NumAxes() == 3.
+     @return            Returns a renumbering of the states of `fsas` (as
+                        idx01's) whose Keep() is 1 for the states that are
+                        both accessible and coaccessible, and 0 otherwise.
+ */
+Renumbering GetConnectedStates(FsaVec &fsas);
+
 /*
   Returns an array of the destination-states for all arcs in an FsaVec
 
@@ -444,6 +571,90 @@ void BackpropGetArcPost(FsaVec &fsas, Ragged<int32_t> &incoming_arcs,
 */
 Array1<int32_t> GetDestStates(FsaVec &fsas, bool as_idx01);
 
+/*
+  Caches the structures that GetForwardScores(), GetBackwardScores(),
+  GetArcPost() and their backprop functions need for an FsaVec: the state
+  batches, the incoming arcs and the entering and leaving arc-index batches.
+  These only depend on the topology (the shape and the src/dest states of the
+  arcs), not on the scores, so an object can be kept and reused for FsaVecs
+  that differ from the one it was constructed with only in their arc scores,
+  e.g. a training graph that is evaluated on every step.
+ */
+class FsaVecTopology {
+ public:
+  /*
+    Computes the batches for `fsas`.
+      @param [in] fsas  Input FsaVec (must have 3 axes).  Must be top-sorted
+                        and without self loops, see GetForwardScores().
+   */
+  explicit FsaVecTopology(FsaVec &fsas);
+
+  /*
+    Same as above, but uses `state_batches` instead of computing
+    GetStateBatches(fsas, true), e.g. the batches output by TopSort().
+   */
+  FsaVecTopology(FsaVec &fsas, const Ragged<int32_t> &state_batches);
+
+  ContextPtr &Context() { return fsas_.Context(); }
+
+  // The FsaVec given to the constructor.
+  FsaVec &Fsas() { return fsas_; }
+
+  // GetStateBatches(fsas, true)
+  Ragged<int32_t> &StateBatches() { return state_batches_; }
+
+  // GetIncomingArcs(fsas, GetDestStates(fsas, true))
+  Ragged<int32_t> &IncomingArcs() { return incoming_arcs_; }
+
+  // GetEnteringArcIndexBatches(fsas, IncomingArcs(), StateBatches())
+  Ragged<int32_t> &EnteringArcBatches() { return entering_arc_batches_; }
+
+  // GetLeavingArcIndexBatches(fsas, StateBatches())
+  Ragged<int32_t> &LeavingArcBatches() { return leaving_arc_batches_; }
+
+  /*
+    Computes the forward scores, backward scores and arc posteriors of `fsas`
+    in one call, reusing the cached batches.
+
+      @param [in] fsas  An FsaVec with the same topology as the one given to
+                   the constructor (only the arc scores may differ).  This
+                   is not fully checked.
+      @param [in] log_semiring  If true, use LogAdd to combine scores;
+                   if false, use max.
+      @param [out] forward_scores  The result of GetForwardScores() is
+                   written to here.
+      @param [out] backward_scores  If not nullptr, the result of
+                   GetBackwardScores() is written to here.
+      @param [out] arc_post  If not nullptr, the result of GetArcPost() is
+                   written to here.
+      @param [out] entering_arcs  See GetForwardScores(); it requires
+                   log_semiring == false if not nullptr.
+   */
+  template <typename FloatType>
+  void GetScores(FsaVec &fsas, bool log_semiring,
+                 Array1<FloatType> *forward_scores,
+                 Array1<FloatType> *backward_scores = nullptr,
+                 Array1<FloatType> *arc_post = nullptr,
+                 Array1<int32_t> *entering_arcs = nullptr);
+
+  /* Same as above, for the FsaVec given to the constructor. */
+  template <typename FloatType>
+  void GetScores(bool log_semiring, Array1<FloatType> *forward_scores,
+                 Array1<FloatType> *backward_scores = nullptr,
+                 Array1<FloatType> *arc_post = nullptr,
+                 Array1<int32_t> *entering_arcs = nullptr) {
+    GetScores(fsas_, log_semiring, forward_scores, backward_scores, arc_post,
+              entering_arcs);
+  }
+
+ private:
+  FsaVec fsas_;
+  Ragged<int32_t> state_batches_;
+  Ragged<int32_t> incoming_arcs_;
+  Ragged<int32_t> entering_arc_batches_;
+  Ragged<int32_t> leaving_arc_batches_;
+};
+
 /*
   Convert a DenseFsaVec to an FsaVec.  Intended for use in testing code.
 
@@ -455,6 +666,28 @@ Array1<int32_t> GetDestStates(FsaVec &fsas, bool as_idx01);
  */
 FsaVec ConvertDenseToFsaVec(DenseFsaVec &src);
 
+/*
+  Convert a DenseFsaVec to its sparse form (see the documentation of
+  DenseFsaVec::top_cols), keeping the `k` best-scoring columns of each row.
+
+     @param [in] src    DenseFsaVec to convert; must be in the dense form,
+                        with float scores.
+     @param [in] k      Number of columns to keep per row, e.g. 10; must be
+                        > 0.  If it is more than the number of columns, all
+                        columns are kept.
+     @param [in] floor  Score for columns that are not kept.  The score that
+                        is actually used for row j is the smaller of `floor`
+                        and the best score dropped from row j, so rows whose
+                        dropped columns were all -infinity (e.g. the last
+                        frame, which only has the final-transition) keep
+                        them at -infinity.  With the default of -infinity
+                        the columns that are not kept are simply pruned away.
+     @return  Returns the sparse DenseFsaVec; it shares `src.shape`.
+ */
+DenseFsaVec SparsifyDenseFsaVec(
+    DenseFsaVec &src, int32_t k,
+    float floor = -std::numeric_limits<float>::infinity());
+
 /*
   Return a random Fsa, with a CPU context. Intended for testing.
 
@@ -512,6 +745,69 @@ DenseFsaVec RandomDenseFsaVec(int32_t min_num_fsas = 1,
                               int32_t max_nsymbols = 50,
                               float scores_scale = 1.0);
 
+// Options for the RandomFsaVec() that generates the FSAs on a device.
+struct RandomFsaVecOptions {
+  int32_t num_fsas = 1;
+  // The number of states of each FSA is uniform in [min_num_states,
+  // max_num_states], counting the final state; must be >= 2.
+  int32_t min_num_states = 2;
+  int32_t max_num_states = 1000;
+  // The number of arcs leaving each state other than the final state is in
+  // [min_out_degree, max_out_degree], distributed as
+  //   min_out_degree +
+  //       floor((max_out_degree - min_out_degree + 1) * u^degree_skew)
+  // with u uniform on [0, 1).  So degree_skew == 1 is uniform, and a larger
+  // degree_skew gives mostly small degrees and a few states with many arcs,
+  // like the states of a decoding graph.
+  int32_t min_out_degree = 1;
+  int32_t max_out_degree = 10;
+  float degree_skew = 1.0;
+  // If true, arcs only go to higher-numbered states, so the FSAs are acyclic
+  // and top-sorted; otherwise to any state.
+  bool acyclic = true;
+  // Arcs to the final state have label -1; the other arcs have label 0
+  // (epsilon) with probability epsilon_ratio, otherwise a label uniform in
+  // [1, max_symbol].
+  int32_t max_symbol = 50;
+  float epsilon_ratio = 0.0;
+  // The same seed gives the same FSAs on every device; 0 means a random one.
+  uint64_t seed = 0;
+};
+
+/*
+  Return random FSAs generated on the device of `c` without any loops on
+  the host, which makes it possible to generate graphs with millions of arcs,
+  e.g. for benchmarks and stress tests, in milliseconds on GPU.  Scores are
+  uniform on [0, 10), as for RandomFsa().  The FSAs are not arc-sorted.
+
+  Unlike RandomFsaVec() above, where the number of arcs is given, here the
+  numbers of states and arcs per state are; the total number of arcs is
+  about num_fsas * mean(num_states) * mean(out_degree), and must fit in
+  int32_t.
+ */
+FsaVec RandomFsaVec(ContextPtr c, const RandomFsaVecOptions &opts);
+
+/*
+  Return a random DenseFsaVec generated on the device of `c`; see
+  RandomDenseFsaVec() above for the layout of the scores.
+
+     @param [in] c           Context of the result
+     @param [in] num_fsas    ans.shape.Dim0()
+     @param [in] min_frames  Minimum number of frames per sequence, not
+                             counting the frame for the final-symbol -1.
+     @param [in] max_frames  Maximum number of frames per sequence.
+     @param [in] num_symbols Number of symbols including epsilon but not the
+                             final-symbol -1, so scores.Dim1() will be
+                             num_symbols + 1.
+     @param [in] scores_scale  Scaling factor used on the scores
+     @param [in] seed        The same seed gives the same result on every
+                             device; 0 means a random one.
+ */
+DenseFsaVec RandomDenseFsaVec(ContextPtr c, int32_t num_fsas,
+                              int32_t min_frames, int32_t max_frames,
+                              int32_t num_symbols, float scores_scale = 1.0,
+                              uint64_t seed = 0);
+
 /*
   Create and return tensor containing the start-states of `src`, indexed by
   FSA (so ans.Dim0() == src.Dim0()) and then a list of 0 or 1 states.
@@ -594,7 +890,8 @@ Array1<FloatType> GetArcCdf(FsaOrVec &fsas,
 
 /*
   Return pseudo-randomly chosen paths through acyclic FSAs.  (Actually the paths
-  are deterministic, taken at fixed intervals through a certain cdf).
+  are deterministic, taken at fixed intervals through a certain cdf, unless
+  `seed` is given).
 
     @param [in] fsas  An FsaVec (3 axes) that we are sampling from.
     @param [in] arc_cdf  The result of calling GetArcCdf() with `fsas`.
@@ -607,6 +904,13 @@ Array1<FloatType> GetArcCdf(FsaOrVec &fsas,
                         Is needed so we can know the maximum
                         possible length of each path, to know how much memory to
                         allocate.
+   @param [in] seed  If negative, path i of an FSA with n paths is taken at
+                        position (i + 0.5) / n of the cdf.  Else the paths
+                        are sampled: the position of path i of FSA j is
+                        PhiloxUniform(seed, j, i) (see philox.h), so a path
+                        does not depend on the other paths, on num_paths or
+                        on how the work is scheduled, and the paths of
+                        different FSAs are independent.
 
    @return  Returns a ragged tensor with 3 axes: [fsa][path][arc],
             containing arc-indexes (idx012) into `fsas`,
@@ -622,12 +926,14 @@ template <typename FloatType>
 Ragged<int32_t> RandomPaths(FsaVec &fsas,
                             const Array1<FloatType> &arc_cdf,
                             const Array1<int32_t> &num_paths,
-                            Ragged<int32_t> &state_batches);
+                            Ragged<int32_t> &state_batches,
+                            int64_t seed = -1);
 
 
 /*
   Return pseudo-randomly chosen paths through acyclic FSAs.  (Actually the paths
-  are deterministic, taken at fixed intervals through a certain cdf).
+  are deterministic, taken at fixed intervals through a certain cdf, unless
+  `seed` is given).
 
     @param [in] fsas  An FsaVec (3 axes) that we are sampling from.
     @param [in] arc_cdf  The result of calling GetArcCdf() with `fsas`.
@@ -643,6 +949,9 @@ Ragged<int32_t> RandomPaths(FsaVec &fsas,
                       on `fsas`.  Is needed so we can know the maximum
                       possible length of each path, to know how much memory to
                       allocate.
+    @param [in] seed  If not negative, the paths are sampled with this seed
+                      instead of being taken at fixed intervals; see the
+                      other form of RandomPaths().
 
    @return  Returns a ragged tensor with 3 axes: [fsa][path][arc],
             containing arc-indexes (idx012) into `fsas`,
@@ -659,7 +968,54 @@ Ragged<int32_t> RandomPaths(FsaVec &fsas,
                             const Array1<FloatType> &arc_cdf,
                             int32_t num_paths,
                             const Array1<FloatType> &tot_scores,
-                            Ragged<int32_t> &state_batches);
+                            Ragged<int32_t> &state_batches,
+                            int64_t seed = -1);
+
+/*
+  Samples paths through acyclic FSAs as RandomPaths() does, maps them to
+  sequences of aux-labels (e.g. words) and removes the paths whose sequences
+  are repeats of those of earlier paths of the same FSA, all in one call.
+  This is what Nbest::FromLattice() needs.
+
+    @param [in] fsas  An FsaVec (3 axes) that we are sampling from.
+    @param [in] arc_cdf  The result of calling GetArcCdf() with `fsas`.
+    @param [in] tot_scores  Total score of each FSA in `fsas`, as for
+                      RandomPaths(); no paths are sampled from FSAs whose
+                      total score is -infinity.
+    @param [in] state_batches  The result of calling GetStateBatches(fsas, true)
+                      on `fsas`.
+    @param [in] aux_labels  A ragged tensor with 2 axes [arc][label] giving
+                      the aux-labels of each arc of `fsas`, i.e.
+                      `aux_labels.Dim0() == fsas.NumElements()`.  Labels
+                      <= 0 (epsilon and final) are ignored.
+    @param [in] num_paths  The number of paths to sample from each FSA,
+                      which is also the maximum number of paths returned for
+                      each FSA.
+    @param [in] max_num_paths  If greater than `num_paths`, the number of
+                      paths sampled from FSAs that have fewer than `num_paths`
+                      unique paths is doubled, and they are sampled again,
+                      until they have `num_paths` unique paths or
+                      `max_num_paths` paths were sampled from them.  Else
+                      `num_paths` paths are sampled once.
+    @param [out] word_seqs  If not nullptr, will be set to the aux-label
+                      sequences of the returned paths, with 3 axes
+                      [fsa][path][label].
+
+   @return  Returns a ragged tensor with 3 axes [fsa][path][arc] containing
+            arc-indexes (idx012) into `fsas`, as RandomPaths() does, with at
+            most `num_paths` paths per FSA, whose aux-label sequences differ
+            (up to hash collisions, see UniqueSequencesHashed()).  The paths
+            of each FSA are in the order they were sampled in.
+ */
+template <typename FloatType>
+Ragged<int32_t> SampleUniquePaths(FsaVec &fsas,
+                                  const Array1<FloatType> &arc_cdf,
+                                  const Array1<FloatType> &tot_scores,
+                                  Ragged<int32_t> &state_batches,
+                                  Ragged<int32_t> &aux_labels,
+                                  int32_t num_paths,
+                                  int32_t max_num_paths = 0,
+                                  Ragged<int32_t> *word_seqs = nullptr);
 
 
 
@@ -22,15 +22,21 @@
 #include <gtest/gtest.h>
 
 #include <algorithm>
+#include <cstdio>
+#include <fstream>
 #include <limits>
 #include <numeric>
+#include <sstream>
+#include <string>
 #include <vector>
 
 #include "k2/csrc/fsa.h"
 #include "k2/csrc/fsa_algo.h"
 #include "k2/csrc/fsa_utils.h"
 #include "k2/csrc/host_shim.h"
+#include "k2/csrc/ragged_ops.h"
 #include "k2/csrc/test_utils.h"
+#include "k2/csrc/thread_pool.h"
 
 namespace k2 {
 
@@ -460,6 +466,63 @@ TEST(FsaFromString, OpenFstTransducerNonZeroStartCase2) {
 
 // TODO(fangjun): write code to check the printed
 // strings matching expected ones.
+TEST(FsaFromFile, CompareWithFsaFromString) {
+  // Large enough to be parsed in several chunks.
+  int32_t num_states = 50000;
+  std::ostringstream k2_os, openfst_os;
+  for (int32_t s = 0; s + 1 < num_states; ++s) {
+    int32_t next = s + 1, label = (next + 1 == num_states ? -1 : s % 7);
+    k2_os << s << " " << next << " " << label << " " << s % 5 << " "
+          << s * 0.25 << "\n";
+    if (s % 3 == 0 && s + 2 < num_states - 1)
+      k2_os << s << " " << s + 2 << " 8 9\n";  // aux_label 9, default score
+  }
+  k2_os << num_states - 1 << "\n";
+  // In the OpenFst format arcs can be in any order; the start state is the
+  // source state on the first line.
+  for (int32_t s = num_states - 2; s >= 0; --s)
+    openfst_os << s << " " << s + 1 << " " << s % 7 << " " << s % 5 << " "
+               << s * 0.25 << "\n";
+  openfst_os << num_states - 1 << " 0.5\n"
+             << num_states / 2 << " Inf\n";
+
+  std::string filename = ::testing::TempDir() + "k2_fsa_from_file_test.txt";
+  int32_t saved_num_threads = GetNumCpuThreads();
+  for (bool openfst : {false, true}) {
+    std::string s = openfst ? openfst_os.str() : k2_os.str();
+    {
+      std::ofstream os(filename);
+      os << s;
+    }
+    SetNumCpuThreads(1);
+    Array2<int32_t> aux_labels1, aux_labels2;
+    Fsa fsa1 = FsaFromString(s, openfst, 1, &aux_labels1);
+    SetNumCpuThreads(4);
+    Fsa fsa2 = FsaFromFile(filename, openfst, 1, &aux_labels2);
+    EXPECT_TRUE(Equal(fsa1.shape, fsa2.shape));
+    EXPECT_TRUE(Equal(fsa1.values, fsa2.values));
+    EXPECT_TRUE(Equal(aux_labels1.Flatten(), aux_labels2.Flatten()));
+
+    if (!openfst) {
+      EXPECT_EQ(fsa2.Dim0(), num_states);
+      EXPECT_EQ((fsa2[{0, 1}]), (Arc{0, 2, 8, 0.0f}));
+      EXPECT_EQ(aux_labels2.Flatten()[1], 9);
+    } else {
+      // The start state (num_states - 2) is renumbered to 0, and there is
+      // a super-final state.
+      EXPECT_EQ(fsa2.Dim0(), num_states + 1);
+      EXPECT_EQ((fsa2[{0, 0}]),
+                (Arc{0, num_states - 1, (num_states - 2) % 7,
+                     -(num_states - 2) * 0.25f}));
+      EXPECT_EQ(fsa2.values.Back(),
+                (Arc{num_states - 1, num_states, -1, -0.5f}));
+      EXPECT_EQ(aux_labels2.Flatten().Back(), -1);
+    }
+  }
+  SetNumCpuThreads(saved_num_threads);
+  std::remove(filename.c_str());
+}
+
 TEST(FsaToString, Acceptor) {
   // src_state dst_state label cost
   std::string s = R"(0 1 2   -1.2
@@ -900,6 +963,50 @@ TEST_F(StatesBatchSuiteTest, TestForwardScores) {
   }
 }
 
+TEST(GetForwardScoresOfSmallFsas, CompareWithGetForwardScores) {
+  for (int32_t i = 0; i != 4; ++i) {
+    for (auto &context : {GetCpuContext(), GetCudaContext()}) {
+      FsaVec fsa_vec = RandomFsaVec(1, 100, true, 10, 0, 30);
+      if (i % 2 == 1) {
+        // With all scores equal there are ties everywhere, which tests
+        // that the same entering arcs are chosen.
+        Arc *arcs_data = fsa_vec.values.Data();
+        for (int32_t j = 0; j < fsa_vec.NumElements(); ++j)
+          arcs_data[j].score = 0;
+      }
+      fsa_vec = fsa_vec.To(context);
+      // On CPU, the FSAs may be of any size.
+      if (context->GetDeviceType() != kCpu && !IsSmallFsaVec(fsa_vec))
+        continue;
+
+      Ragged<int32_t> state_batches = GetStateBatches(fsa_vec, true);
+      Array1<int32_t> dest_states = GetDestStates(fsa_vec, true);
+      Ragged<int32_t> incoming_arcs = GetIncomingArcs(fsa_vec, dest_states);
+      Ragged<int32_t> entering_arc_batches =
+          GetEnteringArcIndexBatches(fsa_vec, incoming_arcs, state_batches);
+      {
+        // max
+        Array1<int32_t> entering_arcs, small_entering_arcs;
+        Array1<float> scores = GetForwardScores<float>(
+            fsa_vec, state_batches, entering_arc_batches, false,
+            &entering_arcs);
+        Array1<float> small_scores = GetForwardScoresOfSmallFsas<float>(
+            fsa_vec, false, &small_entering_arcs);
+        CheckArrayData(small_scores, scores, 0.0f);
+        CheckArrayData(small_entering_arcs, entering_arcs);
+      }
+      {
+        // logsum
+        Array1<double> scores = GetForwardScores<double>(
+            fsa_vec, state_batches, entering_arc_batches, true);
+        Array1<double> small_scores =
+            GetForwardScoresOfSmallFsas<double>(fsa_vec, true);
+        CheckArrayData(small_scores, scores);
+      }
+    }
+  }
+}
+
 TEST_F(StatesBatchSuiteTest, TestGetTotScores) {
   {
     // simple case
@@ -938,6 +1045,60 @@ TEST_F(StatesBatchSuiteTest, TestGetTotScores) {
   // TODO(haowen): add random cases
 }
 
+TEST(FsaUtilsTest, GetTotScoresOfLinearFsas) {
+  ContextPtr cpu = GetCpuContext();
+  std::string s1 = R"(0 1 1 0.5
+    1 2 2 -1.25
+    2 3 -1 2
+    3
+  )";
+  std::string s2 = R"(0 1 -1 3.5
+    1
+  )";
+  Fsa fsa1 = FsaFromString(s1), fsa2 = FsaFromString(s2),
+      empty_fsa(EmptyRaggedShape(cpu, 2));
+  Fsa *fsa_array[] = {&fsa1, &empty_fsa, &fsa2};
+  FsaVec linear = CreateFsaVec(3, &fsa_array[0]);
+
+  std::string s3 = R"(0 1 1 1
+    0 2 2 2
+    1 2 3 3
+    2 3 -1 0
+    3
+  )";
+  Fsa not_linear = FsaFromString(s3);
+
+  for (auto &c : {GetCpuContext(), GetCudaContext()}) {
+    FsaVec fsas = linear.To(c);
+    Array1<int32_t> properties;
+    int32_t tot_properties;
+    GetFsaVecBasicProperties(fsas, &properties, &tot_properties);
+    EXPECT_TRUE(tot_properties & kFsaPropertiesLinear);
+    EXPECT_FALSE(GetFsaBasicProperties(not_linear.To(c)) &
+                 kFsaPropertiesLinear);
+
+    Ragged<int32_t> state_batches = GetStateBatches(fsas, true);
+    Array1<int32_t> dest_states = GetDestStates(fsas, true);
+    Ragged<int32_t> incoming_arcs = GetIncomingArcs(fsas, dest_states);
+    Ragged<int32_t> entering_arc_batches =
+        GetEnteringArcIndexBatches(fsas, incoming_arcs, state_batches);
+    for (bool log_semiring : {false, true}) {
+      Array1<double> forward_scores = GetForwardScores<double>(
+          fsas, state_batches, entering_arc_batches, log_semiring);
+      Array1<double> expected = GetTotScores(fsas, forward_scores),
+                     tot_scores = GetTotScoresOfLinearFsas<double>(fsas);
+      EXPECT_EQ(tot_scores.Context()->GetDeviceType(), c->GetDeviceType());
+      EXPECT_EQ(tot_scores[1], -std::numeric_limits<double>::infinity());
+      EXPECT_EQ(expected[1], tot_scores[1]);
+      EXPECT_NEAR(tot_scores[0], expected[0], 1e-5);
+      EXPECT_NEAR(tot_scores[2], expected[2], 1e-5);
+    }
+    Array1<float> tot_scores = GetTotScoresOfLinearFsas<float>(fsas);
+    EXPECT_FLOAT_EQ(tot_scores[0], 1.25);
+    EXPECT_FLOAT_EQ(tot_scores[2], 3.5);
+  }
+}
+
 TEST_F(StatesBatchSuiteTest, TestBackwardScores) {
   ContextPtr cpu = GetCpuContext();  // will be used to copy data
   {
@@ -1465,6 +1626,176 @@ TEST_F(StatesBatchSuiteTest, TestRandomPaths) {
   }
 }
 
+TEST(FsaUtils, RandomPathsWithSeed) {
+  // The first arc is label 1 with probability 0.25, else label 2.
+  std::string s = R"(0 1 1 -1.3862944
+    0 1 2 -0.2876821
+    1 2 3 0.0
+    1 2 4 0.0
+    2 3 -1 0.0
+    3
+  )";
+  int32_t saved_num_threads = GetNumCpuThreads();
+  Ragged<int32_t> cpu_paths;
+  for (auto &c : {GetCpuContext(), GetCudaContext()}) {
+    Fsa fsa = FsaFromString(s).To(c);
+    Fsa *fsa_array[] = {&fsa, &fsa};
+    FsaVec fsas = CreateFsaVec(2, fsa_array);
+    Ragged<int32_t> state_batches = GetStateBatches(fsas, true);
+    Array1<int32_t> dest_states = GetDestStates(fsas, true);
+    Ragged<int32_t> incoming_arcs = GetIncomingArcs(fsas, dest_states);
+    Ragged<int32_t> entering_arc_batches =
+        GetEnteringArcIndexBatches(fsas, incoming_arcs, state_batches);
+    Ragged<int32_t> leaving_arc_batches =
+        GetLeavingArcIndexBatches(fsas, state_batches);
+    Array1<double> forward_scores = GetForwardScores<double>(
+        fsas, state_batches, entering_arc_batches, true, nullptr);
+    Array1<double> backward_scores = GetBackwardScores<double>(
+        fsas, state_batches, leaving_arc_batches, true);
+    Array1<double> arc_post = GetArcPost(fsas, forward_scores, backward_scores);
+    Array1<double> arc_cdf = GetArcCdf(fsas, arc_post);
+    Array1<double> tot_scores = GetTotScores(fsas, forward_scores);
+
+    int32_t num_paths = 2000, seed = 20221015;
+    Ragged<int32_t> paths = RandomPaths(fsas, arc_cdf, num_paths, tot_scores,
+                                        state_batches, seed);
+    // The same paths whatever the number of threads, and the first paths
+    // do not depend on the number of paths.
+    SetNumCpuThreads(4);
+    EXPECT_TRUE(Equal(paths, RandomPaths(fsas, arc_cdf, num_paths, tot_scores,
+                                         state_batches, seed)));
+    SetNumCpuThreads(saved_num_threads);
+    Ragged<int32_t> fewer_paths =
+        RandomPaths(fsas, arc_cdf, 10, tot_scores, state_batches, seed);
+    // Each path has 3 arcs; compare the paths of the first FSA.
+    EXPECT_TRUE(Equal(fewer_paths.values.Range(0, 30),
+                      paths.values.Range(0, 30)));
+    if (c->GetDeviceType() == kCpu)
+      cpu_paths = paths;
+    else
+      EXPECT_TRUE(Equal(paths, cpu_paths.To(c)));
+
+    paths = paths.To(GetCpuContext());
+    ASSERT_EQ(paths.TotSize(1), 2 * num_paths);
+    const Arc *arcs_data = fsas.values.To(GetCpuContext()).Data();
+    int32_t num_label1[2] = {0, 0}, num_label3[2] = {0, 0};
+    std::vector<int32_t> labels[2];
+    for (int32_t i = 0; i < paths.TotSize(1); i++) {
+      int32_t begin = paths.RowSplits(2)[i], fsa_idx = paths.RowIds(1)[i];
+      ASSERT_EQ(paths.RowSplits(2)[i + 1] - begin, 3);
+      int32_t label1 = arcs_data[paths.values[begin]].label,
+              label2 = arcs_data[paths.values[begin + 1]].label;
+      num_label1[fsa_idx] += (label1 == 1);
+      num_label3[fsa_idx] += (label2 == 3);
+      labels[fsa_idx].push_back(label1);
+      labels[fsa_idx].push_back(label2);
+    }
+    for (int32_t n = 0; n < 2; n++) {
+      EXPECT_NEAR(num_label1[n], 0.25 * num_paths, 0.05 * num_paths);
+      EXPECT_NEAR(num_label3[n], 0.5 * num_paths, 0.05 * num_paths);
+    }
+    // The two FSAs are sampled independently.
+    EXPECT_NE(labels[0], labels[1]);
+  }
+}
+
+TEST(FsaUtils, SampleUniquePaths) {
+  // In fsa1 the arc with label 1 has almost all of the probability mass; in
+  // fsa2 both paths have the word sequence [5].
+  std::string s1 = R"(0 1 1 0
+    0 1 2 -5
+    0 1 3 -5
+    1 2 -1 0
+    2
+  )";
+  std::string s2 = R"(0 1 1 0
+    0 1 2 0
+    1 2 -1 0
+    2
+  )";
+  Fsa fsa1 = FsaFromString(s1), fsa2 = FsaFromString(s2);
+  Fsa *fsa_array[] = {&fsa1, &fsa2};
+  FsaVec fsas_cpu = CreateFsaVec(2, &fsa_array[0]);
+  Ragged<int32_t> aux_labels_cpu("[ [10] [20] [30] [-1] [5] [5] [-1] ]");
+
+  for (auto &c : {GetCpuContext(), GetCudaContext()}) {
+    FsaVec fsas = fsas_cpu.To(c);
+    Ragged<int32_t> aux_labels = aux_labels_cpu.To(c);
+    FsaVecTopology topology(fsas);
+    Array1<float> forward_scores, arc_post;
+    topology.GetScores<float>(true, &forward_scores, nullptr, &arc_post);
+    Array1<float> arc_cdf = GetArcCdf(fsas, arc_post),
+                  tot_scores = GetTotScores(fsas, forward_scores);
+
+    Ragged<int32_t> word_seqs;
+    Ragged<int32_t> paths =
+        SampleUniquePaths(fsas, arc_cdf, tot_scores, topology.StateBatches(),
+                          aux_labels, 2, 0, &word_seqs);
+    EXPECT_TRUE(Equal(paths, Ragged<int32_t>(c, "[ [ [0 3] ] [ [4 6] ] ]")));
+    EXPECT_TRUE(Equal(word_seqs, Ragged<int32_t>(c, "[ [ [10] ] [ [5] ] ]")));
+
+    // Sampling more paths finds the second word sequence of fsa1 (after 64
+    // paths); fsa2 has only one, however many paths are sampled.
+    paths = SampleUniquePaths(fsas, arc_cdf, tot_scores,
+                              topology.StateBatches(), aux_labels, 2, 1000,
+                              &word_seqs);
+    EXPECT_TRUE(Equal(paths,
+                      Ragged<int32_t>(c, "[ [ [0 3] [1 3] ] [ [4 6] ] ]")));
+    EXPECT_TRUE(Equal(word_seqs,
+                      Ragged<int32_t>(c, "[ [ [10] [20] ] [ [5] ] ]")));
+  }
+}
+
+template <typename FloatType>
+void TestFsaVecTopology(FsaVec &fsa_vec_in) {
+  for (auto &context : {GetCpuContext(), GetCudaContext()}) {
+    FsaVec fsa_vec = fsa_vec_in.To(context);
+    FsaVecTopology topology(fsa_vec);
+    Ragged<int32_t> &state_batches = topology.StateBatches();
+    EXPECT_TRUE(Equal(state_batches, GetStateBatches(fsa_vec, true)));
+
+    // Only the scores differ; the cached batches are reused.
+    FsaVec fsa_vec2 = fsa_vec.Clone();
+    Arc *arcs_data = fsa_vec2.values.Data();
+    K2_EVAL(
+        context, fsa_vec2.NumElements(), lambda_set_scores,
+        (int32_t i)->void { arcs_data[i].score = 0.1 * (i % 7) - 0.2; });
+
+    for (bool log_semiring : {true, false}) {
+      for (FsaVec *fsas : {&fsa_vec, &fsa_vec2}) {
+        Array1<FloatType> forward_scores, backward_scores, arc_post;
+        topology.GetScores(*fsas, log_semiring, &forward_scores,
+                           &backward_scores, &arc_post);
+
+        Ragged<int32_t> leaving_arc_batches =
+            GetLeavingArcIndexBatches(*fsas, state_batches);
+        Array1<FloatType> expected_forward_scores =
+            GetForwardScores<FloatType>(*fsas, state_batches,
+                                        topology.EnteringArcBatches(),
+                                        log_semiring);
+        Array1<FloatType> expected_backward_scores =
+            GetBackwardScores<FloatType>(*fsas, state_batches,
+                                         leaving_arc_batches, log_semiring);
+        Array1<FloatType> expected_arc_post = GetArcPost(
+            *fsas, expected_forward_scores, expected_backward_scores);
+        EXPECT_TRUE(Equal(forward_scores, expected_forward_scores));
+        EXPECT_TRUE(Equal(backward_scores, expected_backward_scores));
+        EXPECT_TRUE(Equal(arc_post, expected_arc_post));
+      }
+    }
+  }
+}
+
+TEST_F(StatesBatchSuiteTest, TestFsaVecTopology) {
+  TestFsaVecTopology<float>(fsa_vec_);
+  TestFsaVecTopology<double>(fsa_vec_);
+  for (int32_t i = 0; i != 2; ++i) {
+    FsaVec random_fsas = RandomFsaVec();
+    TestFsaVecTopology<float>(random_fsas);
+    TestFsaVecTopology<double>(random_fsas);
+  }
+}
+
 template <typename FloatType>
 void TestBackpropGetArcPost(FsaVec &fsa_vec_in) {
   ContextPtr cpu = GetCpuContext();  // will be used to copy data
@@ -1742,4 +2073,130 @@ TEST(FixFinalLabels, FixFinalLabels) {
 
 
 
+TEST(FsaUtils, GetLocalityStateOrder) {
+  for (const ContextPtr &c : {GetCpuContext(), GetCudaContext()}) {
+    // State 5 is unreachable.
+    std::string s = R"(0 1 1 0.1
+      0 2 2 0.2
+      1 3 3 0.3
+      1 4 4 0.4
+      2 3 5 0.5
+      3 6 -1 0
+      4 6 -1 0
+      5 6 -1 0
+      6
+    )";
+    Fsa fsa = FsaFromString(s).To(c);
+    Fsa *fsa_ptrs[] = {&fsa, &fsa};
+    FsaVec fsas = Stack(0, 2, fsa_ptrs);
+
+    // State 2 has fewer leaving arcs than state 1, so it comes first.
+    Array1<int32_t> order = GetLocalityStateOrder(fsas);
+    CheckArrayData(order, std::vector<int32_t>{0, 2, 1, 3, 4, 5, 6, 7, 9, 8,
+                                               10, 11, 12, 13});
+
+    // Arcs 6 and 5 leave states 4 and 3 of the first FSA.
+    Array1<int32_t> arc_map(c, std::vector<int32_t>{6, 6, 5, -1});
+    Array1<int32_t> counts = GetStateCounts(fsas, arc_map);
+    CheckArrayData(counts, std::vector<int32_t>{0, 0, 0, 1, 2, 0, 0, 0, 0, 0,
+                                                0, 0, 0, 0});
+    order = GetLocalityStateOrder(fsas, &counts);
+    CheckArrayData(order, std::vector<int32_t>{0, 4, 3, 2, 1, 5, 6, 7, 9, 8,
+                                               10, 11, 12, 13});
+
+    // Reordering a linear FSA whose states were shuffled restores it.
+    std::string linear_str = R"(0 1 1 0.1
+      1 2 2 0.2
+      2 3 3 0.3
+      3 4 4 0.4
+      4 5 5 0.5
+      5 6 -1 0
+      6
+    )";
+    FsaVec linear = FsaToFsaVec(FsaFromString(linear_str).To(c));
+    Array1<int32_t> shuffle(c, std::vector<int32_t>{0, 3, 1, 5, 2, 4, 6});
+    FsaVec shuffled = RenumberFsaVec(linear, shuffle, nullptr);
+    Array1<int32_t> arc_map_out;
+    FsaVec restored = RenumberFsaVec(
+        shuffled, GetLocalityStateOrder(shuffled), &arc_map_out);
+    EXPECT_TRUE(Equal(restored, linear));
+  }
+}
+
+TEST(FsaUtils, RandomFsaVecOnDevice) {
+  ContextPtr cpu = GetCpuContext();
+  for (bool acyclic : {true, false}) {
+    RandomFsaVecOptions opts;
+    opts.num_fsas = 5;
+    opts.min_num_states = 2;
+    opts.max_num_states = 50;
+    opts.min_out_degree = 0;
+    opts.max_out_degree = 5;
+    opts.degree_skew = 2.0;
+    opts.acyclic = acyclic;
+    opts.max_symbol = 10;
+    opts.epsilon_ratio = 0.3;
+    opts.seed = 123;
+    FsaVec expected = RandomFsaVec(cpu, opts);
+    for (auto &c : {cpu, GetCudaContext()}) {
+      FsaVec fsas = RandomFsaVec(c, opts);
+      ASSERT_EQ(fsas.Dim0(), 5);
+      Array1<int32_t> properties;
+      int32_t tot_properties;
+      GetFsaVecBasicProperties(fsas, &properties, &tot_properties);
+      EXPECT_TRUE(tot_properties & kFsaPropertiesValid);
+      if (acyclic) {
+        EXPECT_TRUE(tot_properties & kFsaPropertiesTopSorted);
+      }
+
+      // The same seed gives the same FSAs on every device.
+      fsas = fsas.To(cpu);
+      ASSERT_TRUE(Equal(fsas.shape, expected.shape));
+      const Arc *arcs_data = fsas.values.Data(),
+                *expected_data = expected.values.Data();
+      int32_t num_epsilons = 0;
+      for (int32_t i = 0; i != fsas.NumElements(); ++i) {
+        EXPECT_EQ(arcs_data[i], expected_data[i]);
+        EXPECT_GE(arcs_data[i].label, -1);
+        EXPECT_LE(arcs_data[i].label, 10);
+        num_epsilons += (arcs_data[i].label == 0);
+      }
+      EXPECT_GT(num_epsilons, 0);
+      const int32_t *row_splits1_data = fsas.RowSplits(1).Data();
+      for (int32_t i = 0; i != fsas.Dim0(); ++i) {
+        int32_t num_states = row_splits1_data[i + 1] - row_splits1_data[i];
+        EXPECT_GE(num_states, 2);
+        EXPECT_LE(num_states, 50);
+      }
+    }
+  }
+}
+
+TEST(FsaUtils, RandomDenseFsaVecOnDevice) {
+  ContextPtr cpu = GetCpuContext();
+  DenseFsaVec expected = RandomDenseFsaVec(cpu, 3, 2, 10, 5, 1.0, 7);
+  for (auto &c : {cpu, GetCudaContext()}) {
+    DenseFsaVec dense = RandomDenseFsaVec(c, 3, 2, 10, 5, 1.0, 7).To(cpu);
+    ASSERT_TRUE(Equal(dense.shape, expected.shape));
+    ASSERT_EQ(dense.scores.Dim1(), 6);
+    auto scores_acc = dense.scores.Accessor(),
+         expected_acc = expected.scores.Accessor();
+    const int32_t *row_splits_data = dense.shape.RowSplits(1).Data();
+    for (int32_t i = 0; i != dense.shape.Dim0(); ++i) {
+      int32_t num_frames = row_splits_data[i + 1] - row_splits_data[i];
+      EXPECT_GE(num_frames, 3);
+      EXPECT_LE(num_frames, 11);
+      for (int32_t f = row_splits_data[i]; f != row_splits_data[i + 1]; ++f) {
+        bool is_last_frame = (f + 1 == row_splits_data[i + 1]);
+        for (int32_t j = 0; j != 6; ++j) {
+          EXPECT_EQ(std::isinf(scores_acc(f, j)), is_last_frame != (j == 0));
+          if (!std::isinf(scores_acc(f, j))) {
+            EXPECT_EQ(scores_acc(f, j), expected_acc(f, j));
+          }
+        }
+      }
+    }
+  }
+}
+
 }  // namespace k2
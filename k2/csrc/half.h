@@ -0,0 +1,109 @@
+/**
+ * Copyright      2026  Xiaomi Corporation
+ *
+ * See LICENSE for clarification regarding multiple authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef K2_CSRC_HALF_H_
+#define K2_CSRC_HALF_H_
+
+#include <cstdint>
+#include <cstring>
+
+#include "k2/csrc/context.h"
+
+namespace k2 {
+
+/*
+  Conversions between float and the bit patterns of 16-bit floats: IEEE
+  half precision (fp16) and bfloat16 (bf16).  The 16-bit values are stored
+  as int16_t, which is what torch::kHalf and torch::kBFloat16 tensors look
+  like when viewed as torch::kShort.  Conversions to 16 bits round to
+  nearest, ties to even; NaN stays NaN.
+ */
+
+__host__ __device__ __forceinline__ float BitsToFloat(uint32_t bits) {
+  float ans;
+  memcpy(&ans, &bits, sizeof(ans));
+  return ans;
+}
+
+__host__ __device__ __forceinline__ uint32_t FloatToBits(float f) {
+  uint32_t ans;
+  memcpy(&ans, &f, sizeof(ans));
+  return ans;
+}
+
+__host__ __device__ __forceinline__ float HalfToFloat(int16_t h) {
+  uint32_t u = static_cast<uint16_t>(h), sign = (u & 0x8000u) << 16,
+           exponent = (u >> 10) & 0x1fu, mantissa = u & 0x3ffu;
+  if (exponent == 0x1fu)  // inf or NaN
+    return BitsToFloat(sign | 0x7f800000u | (mantissa << 13));
+  if (exponent != 0)
+    return BitsToFloat(sign | ((exponent + 112) << 23) | (mantissa << 13));
+  if (mantissa == 0) return BitsToFloat(sign);
+  // A subnormal fp16 is a normal float.
+  exponent = 113;
+  while ((mantissa & 0x400u) == 0) {
+    mantissa <<= 1;
+    --exponent;
+  }
+  return BitsToFloat(sign | (exponent << 23) | ((mantissa & 0x3ffu) << 13));
+}
+
+__host__ __device__ __forceinline__ int16_t FloatToHalf(float f) {
+  uint32_t x = FloatToBits(f), sign = (x >> 16) & 0x8000u;
+  x &= 0x7fffffffu;
+  uint32_t ans;
+  if (x > 0x7f800000u) {
+    ans = sign | 0x7e00u;  // NaN
+  } else if (x >= 0x47800000u) {
+    ans = sign | 0x7c00u;  // >= 65536, or inf
+  } else if (x >= 0x38800000u) {
+    // Normal in fp16; a carry out of the mantissa rounds up to the next
+    // exponent, or to inf.
+    ans = (x >> 13) - (112u << 10);
+    uint32_t rem = x & 0x1fffu;
+    if (rem > 0x1000u || (rem == 0x1000u && (ans & 1))) ++ans;
+    ans |= sign;
+  } else if (x > 0x33000000u) {
+    // Subnormal in fp16, i.e. a multiple of 2^-24.
+    uint32_t shift = 126 - (x >> 23),
+             mantissa = (x & 0x7fffffu) | 0x800000u;
+    ans = mantissa >> shift;
+    uint32_t rem = mantissa & ((1u << shift) - 1),
+             halfway = 1u << (shift - 1);
+    if (rem > halfway || (rem == halfway && (ans & 1))) ++ans;
+    ans |= sign;
+  } else {
+    ans = sign;  // rounds to zero
+  }
+  return static_cast<int16_t>(ans);
+}
+
+__host__ __device__ __forceinline__ float Bf16ToFloat(int16_t h) {
+  return BitsToFloat(static_cast<uint32_t>(static_cast<uint16_t>(h)) << 16);
+}
+
+__host__ __device__ __forceinline__ int16_t FloatToBf16(float f) {
+  uint32_t x = FloatToBits(f);
+  if ((x & 0x7fffffffu) > 0x7f800000u)
+    return static_cast<int16_t>((x >> 16) | 0x40u);  // NaN
+  return static_cast<int16_t>((x + 0x7fffu + ((x >> 16) & 1)) >> 16);
+}
+
+}  // namespace k2
+
+#endif  // K2_CSRC_HALF_H_
@@ -17,6 +17,7 @@
  * limitations under the License.
  */
 
+#include "k2/csrc/array_ops.h"
 #include "k2/csrc/hash.h"
 
 namespace k2 {
@@ -27,9 +28,11 @@ void Hash::CheckEmpty() {
   Array1<int32_t> error(c, 1, -1);
   int32_t *error_data = error.Data();
   uint64_t *hash_data = data_.Data();
+  const uint64_t epoch_mask = EpochMask(), epoch = ShiftedEpoch();
 
   K2_EVAL(Context(), data_.Dim(), lambda_check_data, (int32_t i) -> void {
-      if (~(hash_data[i]) != 0) error_data[0] = i;
+      uint64_t elem = hash_data[i];
+      if (~elem != 0 && (elem & epoch_mask) == epoch) error_data[0] = i;
     });
   int32_t i = error[0];
   if (i >= 0) {  // there was an error; i is the index into the hash where
@@ -42,12 +45,63 @@ void Hash::CheckEmpty() {
   }
 }
 
+void Hash::TrackNumElements() {
+  NVTX_RANGE(K2_FUNC);
+  if (TracksNumElements()) return;
+  int32_t num_elements = NumElements();
+  num_elements_ = Array1<int32_t>(Context(), 1, num_elements);
+}
+
+int32_t Hash::NumElements() const {
+  NVTX_RANGE(K2_FUNC);
+  if (TracksNumElements()) return num_elements_[0];
+  if (data_.Dim() == 0) return 0;
+  ContextPtr c = Context();
+  Array1<int32_t> occupied(c, data_.Dim());
+  int32_t *occupied_data = occupied.Data();
+  const uint64_t *hash_data = data_.Data();
+  const uint64_t epoch_mask = EpochMask(), epoch = ShiftedEpoch();
+  K2_EVAL(c, data_.Dim(), lambda_set_occupied, (int32_t i) -> void {
+      uint64_t elem = hash_data[i];
+      occupied_data[i] = (~elem != 0 && (elem & epoch_mask) == epoch);
+    });
+  return Sum(occupied);
+}
+
+void Hash::Clear() {
+  NVTX_RANGE(K2_FUNC);
+  if (TracksNumElements()) num_elements_ = 0;
+  if (num_epoch_bits_ != 0 &&
+      ++epoch_ != (uint32_t(1) << num_epoch_bits_) - 1)
+    return;
+  // Either there are no epoch bits, or the epoch would wrap around, in which
+  // case the oldest stale elements would become current again.
+  epoch_ = 0;
+  data_ = ~(uint64_t)0;
+}
+
+bool Hash::PossiblyGrow(int32_t num_new_elements) {
+  NVTX_RANGE(K2_FUNC);
+  K2_CHECK_GE(num_new_elements, 0);
+  int64_t num_elements = int64_t(NumElements()) + num_new_elements;
+  int32_t num_buckets = NumBuckets();
+  int64_t new_num_buckets = num_buckets;
+  while (num_elements > max_load_factor_ * new_num_buckets)
+    new_num_buckets *= 2;
+  if (new_num_buckets == num_buckets) return false;
+  K2_CHECK_LE(new_num_buckets, int64_t(1) << 30)
+      << "Too many elements for the hash: " << num_elements;
+  Resize(static_cast<int32_t>(new_num_buckets), num_key_bits_,
+         num_value_bits_);
+  return true;
+}
+
 void Hash::Resize(int32_t new_num_buckets, int32_t num_key_bits,
                   int32_t num_value_bits,  // = -1,
                   bool copy_data) {        // = true
   NVTX_RANGE(K2_FUNC);
   if (num_value_bits < 0)
-    num_value_bits = 64 - num_key_bits;
+    num_value_bits = 64 - num_key_bits - num_epoch_bits_;
 
   K2_CHECK_GT(new_num_buckets, 0);
   K2_CHECK_EQ(new_num_buckets & (new_num_buckets - 1), 0);  // power of 2.
@@ -55,14 +109,27 @@ void Hash::Resize(int32_t new_num_buckets, int32_t num_key_bits,
   ContextPtr c = data_.Context();
   Hash new_hash(c, new_num_buckets,
                 num_key_bits,
-                num_value_bits);
+                num_value_bits,
+                num_epoch_bits_);
+
+  new_hash.max_load_factor_ = max_load_factor_;
+  // Keep the epoch, so that CopyDataFromSimple() can copy the elements
+  // unchanged.
+  new_hash.epoch_ = epoch_;
+  if (TracksNumElements()) new_hash.num_elements_ = Array1<int32_t>(c, 1, 0);
 
   if (copy_data) {
     if (num_key_bits == num_key_bits_ &&
         num_value_bits == num_value_bits_ &&
-        num_key_bits + num_value_bits == 64) {
+        num_key_bits + num_value_bits + num_epoch_bits_ == 64) {
       new_hash.CopyDataFromSimple(*this);
+      // CopyDataFromSimple() does not go through an accessor, so the count
+      // has to be carried over; it is unchanged.
+      if (TracksNumElements()) new_hash.num_elements_ = num_elements_;
     } else {
+      K2_CHECK_EQ(num_epoch_bits_, 0)
+          << "Changing the number of key or value bits of a hash with "
+          << "epoch bits is not supported";
       // we instantiate 2 versions of CopyDataFrom().
       if (new_hash.NumKeyBits() + new_hash.NumValueBits() == 64) {
         new_hash.CopyDataFrom<GenericAccessor>(*this);
@@ -77,4 +144,50 @@ void Hash::Resize(int32_t new_num_buckets, int32_t num_key_bits,
                        // expect the hash to be empty when destroyed).
 }
 
+void Hash64::Insert(const Array1<uint64_t> &keys,
+                    const Array1<uint64_t> &values,
+                    Array1<char> *inserted /*= nullptr*/) {
+  NVTX_RANGE(K2_FUNC);
+  ContextPtr c = Context();
+  K2_CHECK(c->IsCompatible(*keys.Context()));
+  K2_CHECK(c->IsCompatible(*values.Context()));
+  K2_CHECK_EQ(keys.Dim(), values.Dim());
+  int32_t num_keys = keys.Dim();
+  const uint64_t *keys_data = keys.Data(), *values_data = values.Data();
+  char *inserted_data = nullptr;
+  if (inserted != nullptr) {
+    *inserted = Array1<char>(c, num_keys);
+    inserted_data = inserted->Data();
+  }
+  Accessor acc = GetAccessor();
+  K2_EVAL(c, num_keys, lambda_insert, (int32_t i) -> void {
+      bool ans = acc.Insert(keys_data[i], values_data[i]);
+      if (inserted_data) inserted_data[i] = ans;
+    });
+}
+
+void Hash64::Find(const Array1<uint64_t> &keys, Array1<uint64_t> *values,
+                  Array1<char> *found /*= nullptr*/) {
+  NVTX_RANGE(K2_FUNC);
+  K2_CHECK_NE(values, nullptr);
+  ContextPtr c = Context();
+  K2_CHECK(c->IsCompatible(*keys.Context()));
+  int32_t num_keys = keys.Dim();
+  const uint64_t *keys_data = keys.Data();
+  *values = Array1<uint64_t>(c, num_keys);
+  uint64_t *values_data = values->Data();
+  char *found_data = nullptr;
+  if (found != nullptr) {
+    *found = Array1<char>(c, num_keys);
+    found_data = found->Data();
+  }
+  Accessor acc = GetAccessor();
+  K2_EVAL(c, num_keys, lambda_find, (int32_t i) -> void {
+      uint64_t value;
+      bool ans = acc.Find(keys_data[i], &value);
+      values_data[i] = ans ? value : ~(uint64_t)0;
+      if (found_data) found_data[i] = ans;
+    });
+}
+
 }  // namespace k2
@@ -20,6 +20,7 @@
 #define K2_CSRC_HASH_H_
 
 #include <string>
+#include <type_traits>
 #include <utility>
 #include <vector>
 
@@ -33,10 +34,8 @@
 namespace k2 {
 
 
-// __host__ __device__ version of CUDA's atomicCAS (copy and swap).  In the host
-// case it assumes the calling code is single-threaded and that `compare` is the
-// value that was just read from `address`, so it assumes it still has that
-// value and returns it.  The compiler should be able to optimize calling code.
+// __host__ __device__ version of CUDA's atomicCAS (copy and swap): returns the
+// old value of `*address`, and sets it to `val` if the old value was `compare`.
 unsigned long long int __forceinline__ __host__ __device__ AtomicCAS(
     unsigned long long int* address,
     unsigned long long int compare,
@@ -44,10 +43,8 @@ unsigned long long int __forceinline__ __host__ __device__ AtomicCAS(
 #ifdef __CUDA_ARCH__
   return atomicCAS(address, compare, val);
 #else
-  // For host code, we assume single-threaded for now).
-  unsigned long long int res = *address;
-  *address = *address == compare ? val : *address;
-  return res;
+  HostAtomicCompareExchange(address, &compare, val);
+  return compare;
 #endif
 }
 
@@ -69,6 +66,14 @@ unsigned long long int __forceinline__ __host__ __device__ AtomicCAS(
           plus value bits greater than 64; the rest of the bits are
           implicit in groups of buckets (the number of buckets must
           be >= 32 * 1 << (num_key_bits + num_value_bits - 64).
+        - Use BucketedAccessor<NUM_KEY_BITS>, which is like Accessor but
+          probes the buckets in contiguous groups (see its documentation);
+          this is a different layout, so you cannot mix it with the other
+          accessors on the same hash.
+        - Use EpochAccessor<NUM_KEY_BITS>, which is like Accessor but
+          keeps an epoch number in the top bits of each element, for a hash
+          constructed with num_epoch_bits > 0; Clear() then just increments
+          the epoch, which is much cheaper than deleting all the keys.
 
     - You must decide the number of key and value bits, and the number of
       buckets, when you create the hash, but you can resize it (manually)
@@ -80,7 +85,8 @@ unsigned long long int __forceinline__ __host__ __device__ AtomicCAS(
       both and key and value are set [that is used to mean "nothing here"]
     - The number of buckets must always be a power of 2.
     - When deleting values from the hash you must delete them all at
-      once (necessary because there is no concept of a "tombstone".
+      once (necessary because there is no concept of a "tombstone"), or
+      call Clear().
 
    Some notes on usage:
 
@@ -123,18 +129,27 @@ class Hash {
                 For PackedAccessor we allow that num_key_bits + num_value_bits > 64,
                 but with the constraint that
                   (num_buckets >> (64 - num_key_bits - num_value_bits)) >= 32
+     @param [in] num_epoch_bits  Number of bits (0 <= num_epoch_bits <= 16)
+                that hold the epoch, for use with EpochAccessor; if nonzero,
+                we require that
+                  num_key_bits + num_value_bits + num_epoch_bits == 64.
+                Clear() resets the buckets once every
+                (1 << num_epoch_bits) - 1 calls and otherwise just increments
+                the epoch.
   */
   Hash(ContextPtr c,
        int32_t num_buckets,
        int32_t num_key_bits,
-       int32_t num_value_bits=-1):
-      num_key_bits_(num_key_bits) {
-    std::ostringstream os;
+       int32_t num_value_bits=-1,
+       int32_t num_epoch_bits=0):
+      num_key_bits_(num_key_bits),
+      num_epoch_bits_(num_epoch_bits) {
+    NVTX_RANGE_PAYLOAD(K2_FUNC, kNone, num_buckets);
+    K2_CHECK(num_epoch_bits >= 0 && num_epoch_bits <= 16);
     if (num_value_bits < 0)
-      num_value_bits = 64 - num_key_bits;
-    os << K2_FUNC << ":num_buckets=" << num_buckets << ", num_key_bits="
-       << num_key_bits << ", num_value_bits=" << num_value_bits;
-    NVTX_RANGE(os.str().c_str());
+      num_value_bits = 64 - num_key_bits - num_epoch_bits;
+    if (num_epoch_bits != 0)
+      K2_CHECK_EQ(num_key_bits + num_value_bits + num_epoch_bits, 64);
     data_ = Array1<uint64_t>(c, num_buckets, ~(uint64_t)0);
     K2_CHECK_GE(num_buckets, 128);
     int32_t n = 2;
@@ -144,7 +159,8 @@ class Hash {
         << " num_buckets must be a power of 2.";
     num_value_bits_ = num_value_bits;
 
-    int32_t num_implicit_bits = num_key_bits_ + num_value_bits - 64;
+    int32_t num_implicit_bits =
+        num_key_bits_ + num_value_bits + num_epoch_bits - 64;
     K2_CHECK_GE(num_implicit_bits, 0);
 
     // keys that hash to a group of buckets of size (num_buckets >>
@@ -164,6 +180,8 @@ class Hash {
 
   int32_t NumValueBits() const { return num_value_bits_; }
 
+  int32_t NumEpochBits() const { return num_epoch_bits_; }
+
   int32_t NumBuckets() const { return data_.Dim(); }
 
   // Returns data pointer; for testing..
@@ -181,18 +199,22 @@ class Hash {
     NVTX_RANGE(K2_FUNC);
     K2_CHECK_EQ(num_key_bits_, src.num_key_bits_);
     K2_CHECK_EQ(num_value_bits_, src.num_value_bits_);
-    K2_CHECK_EQ(num_key_bits_ + num_value_bits_, 64);
+    K2_CHECK_EQ(num_epoch_bits_, src.num_epoch_bits_);
+    K2_CHECK_EQ(epoch_, src.epoch_);
+    K2_CHECK_EQ(num_key_bits_ + num_value_bits_ + num_epoch_bits_, 64);
     int32_t num_buckets = data_.Dim(),
         src_num_buckets = src.data_.Dim();
     const uint64_t *src_data = src.data_.Data();
     uint64_t *data = data_.Data();
-    const uint64_t key_mask = (uint64_t(1) << num_key_bits_) - 1;
+    const uint64_t key_mask = (uint64_t(1) << num_key_bits_) - 1,
+        epoch_mask = EpochMask(), epoch = ShiftedEpoch();
     size_t new_num_buckets_mask = static_cast<size_t>(num_buckets) - 1,
         new_buckets_num_bitsm1 = buckets_num_bitsm1_;
     ContextPtr c = data_.Context();
     K2_EVAL(c, src_num_buckets, lambda_copy_data, (int32_t i) -> void {
         uint64_t key_value = src_data[i];
         if (~key_value == 0) return;  // equals -1.. nothing there.
+        if ((key_value & epoch_mask) != epoch) return;  // stale element.
         uint64_t key = key_value & key_mask,
             bucket_inc = 1 | ((key >> new_buckets_num_bitsm1) ^ key);
         size_t cur_bucket = key & new_num_buckets_mask;
@@ -252,10 +274,13 @@ class Hash {
                   used to add any values that are currently in the hash.
        @param [in] num_value_bits  Number of bits in the value of the hash.
                  If not specified it defaults to the current number of value
-                 bits if num_key_bits == -1, else to 64 - num_key_bits; in future
+                 bits if num_key_bits == -1, else to
+                 64 - num_key_bits - NumEpochBits(); in future
                  we'll allow more bits than that, by making some bits of
                  the key implicit in the bucket index.
 
+     The number of epoch bits and the epoch are kept.
+
      CAUTION: Resizing will invalidate any accessor objects you have; you need
      to re-get the accessors before accessing the hash again.
   */
@@ -271,6 +296,59 @@ class Hash {
 
   ContextPtr &Context() const { return data_.Context(); }
 
+  /*
+    Start keeping a count of the number of elements in the hash.  After this
+    is called, the accessors update a counter (stored on the hash's device)
+    on each successful Insert() and each Delete(), so that NumElements() does
+    not need to scan the buckets.  This costs one atomic add per change to
+    the hash, so it is not enabled by default.  The count is initialized from
+    the current contents of the hash, and is preserved by Resize().
+
+    CAUTION: accessors obtained before calling this will not update the count.
+   */
+  void TrackNumElements();
+
+  bool TracksNumElements() const { return num_elements_.Dim() != 0; }
+
+  /*
+    Return the number of elements in the hash.  If TrackNumElements() has been
+    called this just reads the counter, otherwise it counts the occupied
+    buckets.  Either way it syncs with the hash's device, so it should not be
+    called while kernels that modify the hash are pending on other streams.
+   */
+  int32_t NumElements() const;
+
+  // Returns the fraction of buckets that are occupied.
+  float LoadFactor() const {
+    return NumElements() / static_cast<float>(NumBuckets());
+  }
+
+  /*
+    Set the maximum load factor (see LoadFactor()) that PossiblyGrow() will
+    allow, with 0 < max_load_factor < 1.  The default is 0.5; probe lengths
+    grow quickly above that.
+   */
+  void SetMaxLoadFactor(float max_load_factor) {
+    K2_CHECK(max_load_factor > 0.0f && max_load_factor < 1.0f);
+    max_load_factor_ = max_load_factor;
+  }
+
+  float MaxLoadFactor() const { return max_load_factor_; }
+
+  /*
+    Resize the hash (keeping its data, key bits and value bits) to the
+    smallest power of 2 that keeps the load factor at or below MaxLoadFactor()
+    after adding `num_new_elements` more elements, if it is not already big
+    enough.  It is intended to be called between the kernels that insert into
+    the hash, since a hash cannot be resized while it is being accessed.
+
+       @param [in] num_new_elements  An upper bound on the number of elements
+                  that are going to be inserted before the next call.
+       @return  Returns true if the hash was resized.  In that case existing
+                accessor objects are invalid, as with Resize().
+   */
+  bool PossiblyGrow(int32_t num_new_elements = 0);
+
   /*
      class Acccessor is the accessor object that is applicable when
      hash.NumKeyBits() + hash.NumValueBits() == 64, and hash.NumKeyBits() is
@@ -288,7 +366,8 @@ class Hash {
     Accessor(Hash &hash):
         data_(hash.data_.Data()),
         num_buckets_mask_(uint32_t(hash.NumBuckets())-1),
-        buckets_num_bitsm1_(hash.buckets_num_bitsm1_) {
+        buckets_num_bitsm1_(hash.buckets_num_bitsm1_),
+        num_elements_(hash.NumElementsData()) {
       K2_CHECK_EQ(NUM_KEY_BITS, hash.NumKeyBits());
       K2_CHECK_EQ(hash.NumKeyBits() + hash.NumValueBits(), 64);
     }
@@ -342,6 +421,7 @@ class Hash {
                                         cur_elem, new_elem);
           if (old_elem == cur_elem) {
             if (key_value_location) *key_value_location = data_ + cur_bucket;
+            if (num_elements_) AtomicAdd(num_elements_, 1);
             return true;  // Successfully inserted.
           }
           cur_elem = old_elem;
@@ -404,6 +484,23 @@ class Hash {
       }
     }
 
+    /*
+      Returns the number of buckets that Find(key) reads, i.e. the length of
+      the probe sequence up to the key or to an empty bucket.  This is for
+      benchmarks and tuning of the load factor.
+    */
+    __forceinline__ __host__ __device__ int32_t NumProbes(uint64_t key) const {
+      constexpr int64_t KEY_MASK = (uint64_t(1) << NUM_KEY_BITS) - 1;
+      uint32_t cur_bucket = key & num_buckets_mask_,
+          bucket_inc = 1 | ((key >> buckets_num_bitsm1_) ^ key);
+      int32_t num_probes = 1;
+      for (uint64_t elem = data_[cur_bucket];
+           ~elem != 0 && (elem & KEY_MASK) != key;
+           elem = data_[cur_bucket], ++num_probes)
+        cur_bucket = (cur_bucket + bucket_inc) & num_buckets_mask_;
+      return num_probes;
+    }
+
     /*
       Overwrite a value in a (key,value) pair whose location was obtained using
       Find().
@@ -478,6 +575,7 @@ class Hash {
         uint64_t old_elem = data_[cur_bucket];
         if ((old_elem & KEY_MASK) == key) {
           data_[cur_bucket] = ~((uint64_t)0);
+          if (num_elements_) AtomicAdd(num_elements_, -1);
           return;
         } else {
           cur_bucket = (cur_bucket + bucket_inc) & num_buckets_mask_;
@@ -495,9 +593,169 @@ class Hash {
     // A number satisfying num_buckets == 1 << (1+buckets_num_bitsm1_)
     // the number of bits in `num_buckets` minus one.
     uint32_t buckets_num_bitsm1_;
+    // Counter of elements in the hash, or nullptr if the hash does not track
+    // the number of elements; see TrackNumElements().
+    int32_t *num_elements_;
   };
 
 
+  /*
+    class EpochAccessor is like Accessor<NUM_KEY_BITS>, but for a hash that
+    was constructed with num_epoch_bits > 0 (it also works, as a slower
+    Accessor, if num_epoch_bits == 0).  The top num_epoch_bits bits of each
+    element hold the epoch in which it was written, and elements from an
+    earlier epoch are treated exactly like empty buckets; so Clear() can empty
+    the hash just by incrementing the epoch, without visiting the buckets,
+    and the hash can be reused for many rounds of Insert() without deleting
+    the keys of each round.
+
+    Values have NUM_VALUE_BITS = 64 - NUM_KEY_BITS - num_epoch_bits bits.
+
+    CAUTION: an EpochAccessor remembers the epoch that was current when it was
+    obtained; you have to re-get it after calling Clear().
+  */
+  template <int32_t NUM_KEY_BITS> class EpochAccessor {
+   public:
+    EpochAccessor(Hash &hash):
+        data_(hash.data_.Data()),
+        num_buckets_mask_(uint32_t(hash.NumBuckets())-1),
+        buckets_num_bitsm1_(hash.buckets_num_bitsm1_),
+        num_elements_(hash.NumElementsData()),
+        epoch_mask_(hash.EpochMask()),
+        epoch_(hash.ShiftedEpoch()) {
+      K2_CHECK_EQ(NUM_KEY_BITS, hash.NumKeyBits());
+      K2_CHECK_EQ(hash.NumKeyBits() + hash.NumValueBits() +
+                  hash.NumEpochBits(), 64);
+    }
+
+    // Copy constructor
+    EpochAccessor(const EpochAccessor &src) = default;
+
+    /*
+      Try to insert pair (key,value) into hash; see Accessor::Insert() for
+      the interface.  The value may only have the lowest-order NUM_VALUE_BITS
+      bits set.
+    */
+    __forceinline__ __host__ __device__ bool Insert(
+        uint64_t key, uint64_t value,
+        uint64_t *old_value = nullptr,
+        uint64_t **key_value_location = nullptr) const {
+      uint32_t cur_bucket = static_cast<uint32_t>(key) & num_buckets_mask_,
+          bucket_inc = 1 | ((key >> buckets_num_bitsm1_) ^ key);
+      constexpr uint64_t KEY_MASK = (uint64_t(1) << NUM_KEY_BITS) - 1;
+      const uint64_t key_epoch_mask = KEY_MASK | epoch_mask_,
+          key_epoch = key | epoch_;
+
+      K2_DCHECK_EQ((key & ~KEY_MASK) |
+                   ((value << NUM_KEY_BITS) & epoch_mask_), 0);
+
+      uint64_t new_elem = epoch_ | (value << NUM_KEY_BITS) | key;
+      while (1) {
+        uint64_t cur_elem = data_[cur_bucket];
+        if ((cur_elem & key_epoch_mask) == key_epoch) {
+          if (old_value) *old_value = Value(cur_elem);
+          if (key_value_location) *key_value_location = data_ + cur_bucket;
+          return false;  // key exists in hash
+        } else if (IsFree(cur_elem)) {
+          uint64_t old_elem = AtomicCAS(
+              (unsigned long long*)(data_ + cur_bucket), cur_elem, new_elem);
+          if (old_elem == cur_elem) {
+            if (key_value_location) *key_value_location = data_ + cur_bucket;
+            if (num_elements_) AtomicAdd(num_elements_, 1);
+            return true;  // Successfully inserted.
+          }
+          cur_elem = old_elem;
+          if ((cur_elem & key_epoch_mask) == key_epoch) {
+            if (old_value) *old_value = Value(cur_elem);
+            if (key_value_location) *key_value_location = data_ + cur_bucket;
+            return false;  // Another thread inserted this key
+          }
+        }
+        cur_bucket = (cur_bucket + bucket_inc) & num_buckets_mask_;
+      }
+    }
+
+    /*
+      Look up this key in this hash; see Accessor::Find() for the interface.
+    */
+    __forceinline__ __host__ __device__ bool Find(
+        uint64_t key, uint64_t *value_out,
+        uint64_t **key_value_location = nullptr) const {
+      constexpr uint64_t KEY_MASK = (uint64_t(1) << NUM_KEY_BITS) - 1;
+      const uint64_t key_epoch_mask = KEY_MASK | epoch_mask_,
+          key_epoch = key | epoch_;
+
+      uint32_t cur_bucket = key & num_buckets_mask_,
+          bucket_inc = 1 | ((key >> buckets_num_bitsm1_) ^ key);
+      while (1) {
+        uint64_t old_elem = data_[cur_bucket];
+        if ((old_elem & key_epoch_mask) == key_epoch) {
+          *value_out = Value(old_elem);
+          if (key_value_location)
+            *key_value_location = data_ + cur_bucket;
+          return true;
+        } else if (IsFree(old_elem)) {
+          return false;
+        } else {
+          cur_bucket = (cur_bucket + bucket_inc) & num_buckets_mask_;
+        }
+      }
+    }
+
+    /*
+      Overwrite a value in a (key,value) pair whose location was obtained using
+      Find(); see Accessor::SetValue().
+     */
+    __forceinline__ __host__ __device__ void SetValue(
+        uint64_t *key_value_location, uint64_t key, uint64_t value) const {
+      *key_value_location = epoch_ | (value << NUM_KEY_BITS) | key;
+    }
+
+    /* Deletes a key from a hash; see Accessor::Delete() for the limitations.
+       It is not necessary to delete the keys if you are going to call
+       Clear() anyway.
+    */
+    __forceinline__ __host__ __device__ void Delete(uint64_t key) const {
+      constexpr uint64_t KEY_MASK = (uint64_t(1) << NUM_KEY_BITS) - 1;
+      const uint64_t key_epoch_mask = KEY_MASK | epoch_mask_,
+          key_epoch = key | epoch_;
+      uint32_t cur_bucket = key & num_buckets_mask_,
+          bucket_inc = 1 | ((key >> buckets_num_bitsm1_) ^ key);
+      while (1) {
+        uint64_t old_elem = data_[cur_bucket];
+        if ((old_elem & key_epoch_mask) == key_epoch) {
+          data_[cur_bucket] = ~((uint64_t)0);
+          if (num_elements_) AtomicAdd(num_elements_, -1);
+          return;
+        } else {
+          cur_bucket = (cur_bucket + bucket_inc) & num_buckets_mask_;
+        }
+      }
+    }
+
+   private:
+    // Returns true if this element is empty or from an earlier epoch.
+    __forceinline__ __host__ __device__ bool IsFree(uint64_t elem) const {
+      return ~elem == 0 || (elem & epoch_mask_) != epoch_;
+    }
+
+    // Returns the value in an element of the current epoch.
+    __forceinline__ __host__ __device__ uint64_t Value(uint64_t elem) const {
+      return (elem & ~epoch_mask_) >> NUM_KEY_BITS;
+    }
+
+    // pointer to data
+    uint64_t *data_;
+    // See Accessor for these three.
+    uint32_t num_buckets_mask_;
+    uint32_t buckets_num_bitsm1_;
+    int32_t *num_elements_;
+    // The top num_epoch_bits bits set; 0 if the hash has no epoch bits.
+    uint64_t epoch_mask_;
+    // The current epoch, shifted into the bits of epoch_mask_.
+    uint64_t epoch_;
+  };
+
   /* class GenericAccessor is the version of the accessor object that is for
      use when hash.NumKeyBits() + hash.NumValueBits() == 64 and
      hash.NumKeyBits() is not known at compile time.  See also Accessor
@@ -509,7 +767,8 @@ class Hash {
         num_key_bits_(hash.num_key_bits_),
         buckets_num_bitsm1_(hash.buckets_num_bitsm1_),
         data_(hash.data_.Data()),
-        num_buckets_mask_(uint32_t(hash.NumBuckets() - 1)) {
+        num_buckets_mask_(uint32_t(hash.NumBuckets() - 1)),
+        num_elements_(hash.NumElementsData()) {
       K2_CHECK_EQ(hash.num_key_bits_ + hash.num_value_bits_, 64);
     }
 
@@ -563,6 +822,7 @@ class Hash {
                                         cur_elem, new_elem);
           if (old_elem == cur_elem) {
             if (key_value_location) *key_value_location = data_ + cur_bucket;
+            if (num_elements_) AtomicAdd(num_elements_, 1);
             return true;  // Successfully inserted.
           }
           cur_elem = old_elem;
@@ -624,6 +884,19 @@ class Hash {
       }
     }
 
+    // See Accessor::NumProbes().
+    __forceinline__ __host__ __device__ int32_t NumProbes(uint64_t key) const {
+      const int64_t key_mask = (uint64_t(1) << num_key_bits_) - 1;
+      uint32_t cur_bucket = key & num_buckets_mask_,
+          bucket_inc = 1 | ((key >> buckets_num_bitsm1_) ^ key);
+      int32_t num_probes = 1;
+      for (uint64_t elem = data_[cur_bucket];
+           ~elem != 0 && (elem & key_mask) != key;
+           elem = data_[cur_bucket], ++num_probes)
+        cur_bucket = (cur_bucket + bucket_inc) & num_buckets_mask_;
+      return num_probes;
+    }
+
     /*
       Overwrite a value in a (key,value) pair whose location was obtained using
       Find().
@@ -690,6 +963,7 @@ class Hash {
         uint64_t old_elem = data_[cur_bucket];
         if ((old_elem & key_mask) == key) {
           data_[cur_bucket] = ~((uint64_t)0);
+          if (num_elements_) AtomicAdd(num_elements_, -1);
           return;
         } else {
           cur_bucket = (cur_bucket + bucket_inc) & num_buckets_mask_;
@@ -713,6 +987,9 @@ class Hash {
 
     // pointer to data
     uint64_t *data_;
+    // Counter of elements in the hash, or nullptr if the hash does not track
+    // the number of elements; see TrackNumElements().
+    int32_t *num_elements_;
   };
 
 
@@ -735,7 +1012,8 @@ class Hash {
         num_implicit_key_bits_(num_key_bits_ - num_kept_key_bits_),
         buckets_num_bitsm1_(hash.buckets_num_bitsm1_),
         data_(hash.data_.Data()),
-        num_buckets_mask_(uint32_t(hash.NumBuckets() - 1)) {
+        num_buckets_mask_(uint32_t(hash.NumBuckets() - 1)),
+        num_elements_(hash.NumElementsData()) {
       K2_CHECK_GE(hash.num_key_bits_ + hash.num_value_bits_, 64);
       K2_CHECK_GT(num_kept_key_bits_, 0);
       K2_CHECK_GE(num_implicit_key_bits_, 0);
@@ -797,6 +1075,7 @@ class Hash {
                                         cur_elem, new_elem);
           if (old_elem == cur_elem) {
             if (key_value_location) *key_value_location = data_ + cur_bucket;
+            if (num_elements_) AtomicAdd(num_elements_, 1);
             return true;  // Successfully inserted.
           }
           cur_elem = old_elem;
@@ -856,6 +1135,21 @@ class Hash {
       }
     }
 
+    // See Accessor::NumProbes().
+    __forceinline__ __host__ __device__ int32_t NumProbes(uint64_t key) const {
+      const int64_t kept_key_mask = (uint64_t(1) << num_kept_key_bits_) - 1;
+      uint32_t cur_bucket = key & num_buckets_mask_,
+          bucket_inc = (1 | ((key >> buckets_num_bitsm1_) ^ key))
+          << num_implicit_key_bits_;
+      uint64_t kept_key = key >> num_implicit_key_bits_;
+      int32_t num_probes = 1;
+      for (uint64_t elem = data_[cur_bucket];
+           ~elem != 0 && (elem & kept_key_mask) != kept_key;
+           elem = data_[cur_bucket], ++num_probes)
+        cur_bucket = (cur_bucket + bucket_inc) & num_buckets_mask_;
+      return num_probes;
+    }
+
     /*
       Overwrite a value in a (key,value) pair whose location was obtained using
       Find().
@@ -928,6 +1222,7 @@ class Hash {
         uint64_t old_elem = data_[cur_bucket];
         if ((old_elem & kept_key_mask) == kept_key) {
           data_[cur_bucket] = ~((uint64_t)0);
+          if (num_elements_) AtomicAdd(num_elements_, -1);
           return;
         } else {
           cur_bucket = (cur_bucket + bucket_inc) & num_buckets_mask_;
@@ -962,8 +1257,201 @@ class Hash {
     // num_buckets is a power of 2 so this can be used as a mask to get a number
     // modulo num_buckets.
     uint32_t num_buckets_mask_;
+    // Counter of elements in the hash, or nullptr if the hash does not track
+    // the number of elements; see TrackNumElements().
+    int32_t *num_elements_;
   };
 
+  /*
+    class BucketedAccessor is an alternative to Accessor<NUM_KEY_BITS> (with
+    the same requirement that NUM_KEY_BITS + hash.NumValueBits() == 64) that
+    divides the buckets into groups of BUCKET_SIZE consecutive buckets.  A key
+    starts at bucket (key % num_buckets) like with Accessor, but on collision
+    it tries the following buckets of its group (wrapping around inside the
+    group) before moving on to another group, which is chosen with the same
+    odd increment as Accessor uses.  So a probe sequence mostly reads one or
+    two cache lines rather than buckets that are far apart, which helps when
+    many threads insert keys that collide, e.g. arcs entering the same states.
+
+    This is a different layout from the one the other accessors use, so a
+    hash must only ever be accessed by a single BucketedAccessor type.  Also
+    Resize() and PossiblyGrow() with copy_data == true re-insert the elements
+    with the standard layout; to resize a non-empty hash that uses this
+    accessor, construct a new Hash and call
+    CopyDataFrom<BucketedAccessor<NUM_KEY_BITS, BUCKET_SIZE> >() on it.
+    (Resizing an empty hash, with copy_data == false, is fine.)
+
+    Note: it would also be possible to let the threads of a warp probe a
+    group cooperatively, but that requires all the threads of the warp to
+    work on the same key, which does not fit with the per-thread Insert(),
+    Find() and Delete() interface of the accessors.
+  */
+  template <int32_t NUM_KEY_BITS, int32_t BUCKET_SIZE = 32>
+  class BucketedAccessor {
+   public:
+    static_assert(BUCKET_SIZE > 0 && (BUCKET_SIZE & (BUCKET_SIZE - 1)) == 0,
+                  "BUCKET_SIZE must be a power of 2");
+
+    BucketedAccessor(Hash &hash):
+        data_(hash.data_.Data()),
+        num_buckets_mask_(uint32_t(hash.NumBuckets())-1),
+        buckets_num_bitsm1_(hash.buckets_num_bitsm1_),
+        num_elements_(hash.NumElementsData()) {
+      K2_CHECK_EQ(NUM_KEY_BITS, hash.NumKeyBits());
+      K2_CHECK_EQ(hash.NumKeyBits() + hash.NumValueBits(), 64);
+      K2_CHECK_GE(hash.NumBuckets(), BUCKET_SIZE);
+    }
+
+    // Copy constructor
+    BucketedAccessor(const BucketedAccessor &src) = default;
+
+    /*
+      Try to insert pair (key,value) into hash; see Accessor::Insert() for
+      the interface.
+
+      Note: the const is with respect to the metadata only; it is required, to
+      avoid compilation errors.
+   */
+    __forceinline__ __host__ __device__ bool Insert(
+        uint64_t key, uint64_t value,
+        uint64_t *old_value = nullptr,
+        uint64_t **key_value_location = nullptr) const {
+      uint32_t cur_bucket = static_cast<uint32_t>(key) & num_buckets_mask_,
+          group_inc = GroupInc(key), n = 0;
+      constexpr int64_t KEY_MASK = (uint64_t(1)<<NUM_KEY_BITS) - 1,
+          VALUE_MASK = (uint64_t(1)<< (64 - NUM_KEY_BITS)) - 1;
+
+      K2_DCHECK_EQ((key & ~KEY_MASK) | (value & ~VALUE_MASK), 0);
+
+      uint64_t new_elem = (value << NUM_KEY_BITS) | key;
+      while (1) {
+        uint64_t cur_elem = data_[cur_bucket];
+        if ((cur_elem & KEY_MASK) == key) {
+          if (old_value) *old_value = (cur_elem >> NUM_KEY_BITS);
+          if (key_value_location) *key_value_location = data_ + cur_bucket;
+          return false;  // key exists in hash
+        }
+        else if (~cur_elem == 0) {
+          uint64_t old_elem = AtomicCAS((unsigned long long*)(data_ + cur_bucket),
+                                        cur_elem, new_elem);
+          if (old_elem == cur_elem) {
+            if (key_value_location) *key_value_location = data_ + cur_bucket;
+            if (num_elements_) AtomicAdd(num_elements_, 1);
+            return true;  // Successfully inserted.
+          }
+          cur_elem = old_elem;
+          if ((cur_elem & KEY_MASK) == key) {
+            if (old_value) *old_value = (cur_elem >> NUM_KEY_BITS);
+            if (key_value_location) *key_value_location = data_ + cur_bucket;
+            return false;  // Another thread inserted this key
+          }
+        }
+        cur_bucket = NextBucket(cur_bucket, group_inc, &n);
+      }
+    }
+
+    /*
+      Look up this key in the hash; see Accessor::Find() for the interface.
+    */
+    __forceinline__ __host__ __device__ bool Find(
+        uint64_t key, uint64_t *value_out,
+        uint64_t **key_value_location = nullptr) const {
+      constexpr int64_t KEY_MASK = (uint64_t(1) << NUM_KEY_BITS) - 1;
+
+      uint32_t cur_bucket = key & num_buckets_mask_,
+          group_inc = GroupInc(key), n = 0;
+      while (1) {
+        uint64_t old_elem = data_[cur_bucket];
+        if (~old_elem == 0) {
+          return false;
+        } else if ((old_elem & KEY_MASK) == key) {
+          *value_out = old_elem >> NUM_KEY_BITS;
+          if (key_value_location)
+            *key_value_location = data_ + cur_bucket;
+          return true;
+        } else {
+          cur_bucket = NextBucket(cur_bucket, group_inc, &n);
+        }
+      }
+    }
+
+    // See Accessor::NumProbes().
+    __forceinline__ __host__ __device__ int32_t NumProbes(uint64_t key) const {
+      constexpr int64_t KEY_MASK = (uint64_t(1) << NUM_KEY_BITS) - 1;
+      uint32_t cur_bucket = key & num_buckets_mask_,
+          group_inc = GroupInc(key), n = 0;
+      int32_t num_probes = 1;
+      for (uint64_t elem = data_[cur_bucket];
+           ~elem != 0 && (elem & KEY_MASK) != key;
+           elem = data_[cur_bucket], ++num_probes)
+        cur_bucket = NextBucket(cur_bucket, group_inc, &n);
+      return num_probes;
+    }
+
+    /*
+      Overwrite a value in a (key,value) pair whose location was obtained using
+      Find(); see Accessor::SetValue().
+    */
+    __forceinline__ __host__ __device__ void SetValue(
+        uint64_t *key_value_location, uint64_t key, uint64_t value) const {
+      *key_value_location = (value << NUM_KEY_BITS) | key;
+    }
+
+    /* Deletes a key from a hash; see Accessor::Delete() for the interface
+       and its limitations.
+    */
+    __forceinline__ __host__ __device__ void Delete(uint64_t key) const {
+      constexpr int64_t KEY_MASK = (uint64_t(1) << NUM_KEY_BITS) - 1;
+      uint32_t cur_bucket = key & num_buckets_mask_,
+          group_inc = GroupInc(key), n = 0;
+      while (1) {
+        uint64_t old_elem = data_[cur_bucket];
+        if ((old_elem & KEY_MASK) == key) {
+          data_[cur_bucket] = ~((uint64_t)0);
+          if (num_elements_) AtomicAdd(num_elements_, -1);
+          return;
+        } else {
+          cur_bucket = NextBucket(cur_bucket, group_inc, &n);
+        }
+      }
+    }
+
+   private:
+    // The increment between groups, a multiple of BUCKET_SIZE; this is
+    // Accessor's bucket_inc times BUCKET_SIZE, so it is an odd number of
+    // groups and the probe sequence eventually visits all groups.
+    __forceinline__ __host__ __device__ uint32_t GroupInc(uint64_t key) const {
+      return (1 | static_cast<uint32_t>((key >> buckets_num_bitsm1_) ^ key)) *
+             BUCKET_SIZE;
+    }
+
+    // Returns the bucket after `cur_bucket` in the probe sequence; `n` is
+    // the number of buckets tried so far, which is incremented.
+    __forceinline__ __host__ __device__ uint32_t NextBucket(
+        uint32_t cur_bucket, uint32_t group_inc, uint32_t *n) const {
+      constexpr uint32_t OFFSET_MASK = BUCKET_SIZE - 1;
+      // The next bucket in this group, wrapping around.  After BUCKET_SIZE
+      // steps that is the starting offset again, and we go to the next group.
+      cur_bucket =
+          (cur_bucket & ~OFFSET_MASK) | ((cur_bucket + 1) & OFFSET_MASK);
+      if ((++(*n) & OFFSET_MASK) == 0)
+        cur_bucket = (cur_bucket + group_inc) & num_buckets_mask_;
+      return cur_bucket;
+    }
+
+    // pointer to data
+    uint64_t *data_;
+    // num_buckets_mask is num_buckets (i.e. size of `data_` array) minus one;
+    // num_buckets is a power of 2 so this can be used as a mask to get a number
+    // modulo num_buckets.
+    uint32_t num_buckets_mask_;
+    // A number satisfying num_buckets == 1 << (1+buckets_num_bitsm1_)
+    // the number of bits in `num_buckets` minus one.
+    uint32_t buckets_num_bitsm1_;
+    // Counter of elements in the hash, or nullptr if the hash does not track
+    // the number of elements; see TrackNumElements().
+    int32_t *num_elements_;
+  };
 
   /*
     Return an Accessor object which can be used in kernel code (or on CPU if the
@@ -974,17 +1462,38 @@ class Hash {
        auto acc = hash.GetAccessor<Hash::GenericAccessor>();
     or:
        auto acc = hash.GetAccessor<Hash::PackedAccessor>();
+    or:
+       auto acc = hash.GetAccessor<Hash::BucketedAccessor<32>>();
   */
   template <typename AccessorT>
   AccessorT GetAccessor() {
     return AccessorT(*this);
   }
 
+  /* Empty type that carries an accessor type; see DispatchAccessor(). */
+  template <typename AccessorT>
+  struct AccessorTag {
+    using type = AccessorT;
+  };
+
+
+  /*
+    Removes all elements from the hash.  If NumEpochBits() > 0 this normally
+    just increments the epoch, so that the existing elements become stale
+    (see EpochAccessor); the buckets are only reset when the epoch would wrap
+    around.  Otherwise it resets all the buckets.
+
+    CAUTION: accessors obtained before calling this must not be used
+    afterwards.
+   */
+  void Clear();
 
   // You should call this before the destructor is called if the hash will still
   // contain values when it is destroyed, to bypass a check.
   void Destroy() { data_ = Array1<uint64_t>(); }
 
+  // Checks that the hash is empty (elements from an earlier epoch count as
+  // empty).
   void CheckEmpty();
 
   // The destructor checks that the hash is empty, if we are in debug mode.
@@ -1008,9 +1517,39 @@ class Hash {
   // than 64 we need to use class PackedAccessor as the accessor object.
   int32_t num_value_bits_;
 
+  // Number of bits at the top of each element that hold the epoch; if
+  // nonzero, num_key_bits_ + num_value_bits_ + num_epoch_bits_ == 64.
+  int32_t num_epoch_bits_ = 0;
+
+  // The current epoch, with 0 <= epoch_ < (1 << num_epoch_bits_) - 1; the
+  // epoch with all bits set is never used, so that empty buckets are never
+  // taken for elements of the current epoch.
+  uint32_t epoch_ = 0;
 
   // number satisfying data_.Dim() == 1 << (1+buckets_num_bitsm1_)
   int32_t buckets_num_bitsm1_;
+
+  // Either empty, or a single element containing the number of elements in
+  // the hash if TrackNumElements() has been called.
+  Array1<int32_t> num_elements_;
+
+  // See SetMaxLoadFactor().
+  float max_load_factor_ = 0.5f;
+
+  int32_t *NumElementsData() {
+    return num_elements_.Dim() != 0 ? num_elements_.Data() : nullptr;
+  }
+
+  // Returns the mask of the epoch bits of an element.
+  uint64_t EpochMask() const {
+    return num_epoch_bits_ == 0 ? 0 : ~(uint64_t)0 << (64 - num_epoch_bits_);
+  }
+
+  // Returns epoch_ shifted into the epoch bits of an element.
+  uint64_t ShiftedEpoch() const {
+    return num_epoch_bits_ == 0 ? 0 :
+        static_cast<uint64_t>(epoch_) << (64 - num_epoch_bits_);
+  }
 };
 
 
@@ -1030,7 +1569,8 @@ class Hash {
       both key and value are set [that is used to mean "nothing here"]
     - The number of buckets must always be a power of 2.
     - When deleting values from the hash you must delete them all at
-      once (necessary because there is no concept of a "tombstone".
+      once (necessary because there is no concept of a "tombstone"), or
+      call Clear().
 
    Some notes on usage:
 
@@ -1197,6 +1737,22 @@ class Hash64 {
       }
     }
 
+    /*
+      Returns the number of buckets that Find(key) reads, i.e. the length of
+      the probe sequence up to the key or to an empty bucket.  This is for
+      benchmarks and tuning of the load factor.
+    */
+    __forceinline__ __host__ __device__ int32_t NumProbes(uint64_t key) const {
+      uint64_t cur_bucket = key & num_buckets_mask_,
+               bucket_inc = 1 | ((key >> buckets_num_bitsm1_) ^ key);
+      int32_t num_probes = 1;
+      for (uint64_t cur_key = data_[2 * cur_bucket];
+           ~cur_key != 0 && cur_key != key;
+           cur_key = data_[2 * cur_bucket], ++num_probes)
+        cur_bucket = (cur_bucket + bucket_inc) & num_buckets_mask_;
+      return num_probes;
+    }
+
     /*
       Overwrite a value in a (key,value) pair whose location was obtained using
       Find().
@@ -1257,6 +1813,46 @@ class Hash64 {
   */
   Accessor GetAccessor() { return Accessor(*this); }
 
+  /*
+    Insert a batch of (key,value) pairs into the hash; this is for use from
+    host code, and runs as a single kernel on the hash's device.  It is the
+    batched version of Accessor::Insert().
+
+       @param [in] keys   The keys to insert; it is an error if ~key == 0.
+                          Must be on the same device as the hash.
+       @param [in] values The values to insert, with values.Dim() ==
+                          keys.Dim(); it is an error if ~value == 0.
+       @param [out] inserted  If not nullptr, will be set to an array with
+                          the same dimension as `keys`, with 1 where the pair
+                          was inserted and 0 where the key was already
+                          present (in which case its value is unchanged).
+                          If a key is repeated in `keys`, only one of those
+                          pairs is inserted.
+
+    It is the caller's responsibility to make sure the hash does not get too
+    full; see Resize().
+   */
+  void Insert(const Array1<uint64_t> &keys, const Array1<uint64_t> &values,
+              Array1<char> *inserted = nullptr);
+
+  /*
+    Look up a batch of keys in the hash; this is for use from host code, and
+    runs as a single kernel on the hash's device.  It is the batched version
+    of Accessor::Find().  It must not run at the same time as kernels that
+    modify the hash.
+
+       @param [in] keys   The keys to look up.  Must be on the same device as
+                          the hash.
+       @param [out] values  Will be set to an array with the same dimension
+                          as `keys`, containing the value of each key that
+                          is present and ~0 for keys that are not.
+       @param [out] found  If not nullptr, will be set to an array with the
+                          same dimension as `keys`, with 1 where the key is
+                          present and 0 otherwise.
+   */
+  void Find(const Array1<uint64_t> &keys, Array1<uint64_t> *values,
+            Array1<char> *found = nullptr);
+
   // You should call this before the destructor is called if the hash will still
   // contain values when it is destroyed, to bypass a check.
   void Destroy() { data_ = Array1<uint64_t>(); }
@@ -1373,6 +1969,99 @@ inline int32_t NumBitsNeededFor(int64_t size) {
   return 1 + HighestBitSet(size);
 }
 
+namespace internal {
+
+template <int32_t... KEY_BITS>
+struct AccessorDispatcher;
+
+template <>
+struct AccessorDispatcher<> {
+  template <typename F>
+  static auto Dispatch(const Hash &hash, F &f)
+      -> decltype(f(Hash::AccessorTag<Hash::GenericAccessor>())) {
+    if (hash.NumKeyBits() + hash.NumValueBits() == 64)
+      return f(Hash::AccessorTag<Hash::GenericAccessor>());
+    return f(Hash::AccessorTag<Hash::PackedAccessor>());
+  }
+};
+
+template <int32_t N, int32_t... REST>
+struct AccessorDispatcher<N, REST...> {
+  template <typename F>
+  static auto Dispatch(const Hash &hash, F &f)
+      -> decltype(f(Hash::AccessorTag<Hash::GenericAccessor>())) {
+    if (hash.NumKeyBits() == N && hash.NumValueBits() == 64 - N)
+      return f(Hash::AccessorTag<Hash::Accessor<N>>());
+    return AccessorDispatcher<REST...>::Dispatch(hash, f);
+  }
+};
+
+template <int32_t... KEY_BITS>
+struct KeyBitsDispatcher;
+
+template <int32_t N, int32_t... REST>
+struct KeyBitsDispatcher<N, REST...> {
+  template <typename F>
+  static auto Dispatch(int32_t num_key_bits, F &f)
+      -> decltype(f(std::integral_constant<int32_t, N>())) {
+    if (num_key_bits == N) return f(std::integral_constant<int32_t, N>());
+    return KeyBitsDispatcher<REST...>::Dispatch(num_key_bits, f);
+  }
+};
+
+template <int32_t N>
+struct KeyBitsDispatcher<N> {
+  template <typename F>
+  static auto Dispatch(int32_t num_key_bits, F &f)
+      -> decltype(f(std::integral_constant<int32_t, N>())) {
+    K2_CHECK_EQ(num_key_bits, N) << "Unsupported number of key bits";
+    return f(std::integral_constant<int32_t, N>());
+  }
+};
+
+}  // namespace internal
+
+/*
+  Calls `f(Hash::AccessorTag<AccessorT>())`, where AccessorT is the most
+  specialized accessor type that is suitable for `hash`:
+
+    - Hash::Accessor<N>, if hash.NumKeyBits() == N for one of the template
+      args KEY_BITS and hash.NumKeyBits() + hash.NumValueBits() == 64;
+    - else Hash::GenericAccessor, if the numbers of bits sum to 64;
+    - else Hash::PackedAccessor.
+
+  `f` is typically a generic lambda that calls a function templated on the
+  accessor type, e.g.:
+
+     DispatchAccessor<32>(hash, [&](auto tag) {
+       ForwardOneIter<typename decltype(tag)::type>(t);
+     });
+
+  Exactly sizeof...(KEY_BITS) + 2 accessor types are instantiated, so the
+  template args enumerate the key widths that get a specialized kernel; all
+  other widths use the generic path.  Returns what `f` returns; all
+  instantiations must return the same type.
+ */
+template <int32_t... KEY_BITS, typename F>
+auto DispatchAccessor(const Hash &hash, F &&f)
+    -> decltype(f(Hash::AccessorTag<Hash::GenericAccessor>())) {
+  return internal::AccessorDispatcher<KEY_BITS...>::Dispatch(hash, f);
+}
+
+/*
+  Like DispatchAccessor(), but for algorithms that need the number of key bits
+  itself at compile time (e.g. to use Hash::Accessor<NUM_KEY_BITS> and size
+  the hash); there is no generic fallback.  Calls
+  `f(std::integral_constant<int32_t, N>())` where N is the one of the template
+  args KEY_BITS that equals `num_key_bits`; it is an error if there is none.
+ */
+template <int32_t N, int32_t... KEY_BITS, typename F>
+auto DispatchKeyBits(int32_t num_key_bits, F &&f)
+    -> decltype(f(std::integral_constant<int32_t, N>())) {
+  return internal::KeyBitsDispatcher<N, KEY_BITS...>::Dispatch(num_key_bits,
+                                                              f);
+}
+
 }  // namespace k2
 
 #endif  // K2_CSRC_HASH_H_
@@ -16,8 +16,13 @@
  * limitations under the License.
  */
 
+#include <string>
+#include <type_traits>
+#include <vector>
+
 #include "gtest/gtest.h"
 #include "k2/csrc/array.h"
+#include "k2/csrc/array_ops.h"
 #include "k2/csrc/context.h"
 #include "k2/csrc/test_utils.h"
 #include "k2/csrc/hash.h"
@@ -392,6 +397,196 @@ void TestHash64Construct() {
   }
 }
 
+void TestHashNumElements() {
+  for (auto &c : {GetCpuContext(), GetCudaContext()}) {
+    int32_t num_key_bits = 32, size = 1024, num_elems = 400;
+    Hash hash(c, size, num_key_bits);
+    hash.TrackNumElements();
+    EXPECT_TRUE(hash.TracksNumElements());
+    EXPECT_EQ(hash.NumElements(), 0);
+
+    // Some keys may be identical.
+    Array1<uint32_t> keys = RandUniformArray1<uint32_t>(c, num_elems, 0,
+                                                        2 * num_elems),
+                     success(c, num_elems, 0);
+    const uint32_t *keys_data = keys.Data();
+    uint32_t *success_data = success.Data();
+    {
+      Hash::GenericAccessor acc = hash.GetAccessor<Hash::GenericAccessor>();
+      K2_EVAL(c, num_elems, lambda_insert_keys, (int32_t i) -> void {
+          success_data[i] = acc.Insert(keys_data[i], i);
+        });
+    }
+    int32_t num_inserted = Sum(success);
+    EXPECT_EQ(hash.NumElements(), num_inserted);
+    EXPECT_FLOAT_EQ(hash.LoadFactor(), num_inserted / float(size));
+
+    // Counting the occupied buckets gives the same answer.
+    Hash untracked(c, size, num_key_bits);
+    untracked.CopyDataFromSimple(hash);
+    EXPECT_FALSE(untracked.TracksNumElements());
+    EXPECT_EQ(untracked.NumElements(), num_inserted);
+    untracked.Destroy();
+
+    EXPECT_FALSE(hash.PossiblyGrow(0));
+    EXPECT_TRUE(hash.PossiblyGrow(num_elems));
+    EXPECT_EQ(hash.NumBuckets(), 2048);
+    EXPECT_EQ(hash.NumElements(), num_inserted);
+    EXPECT_LE(hash.LoadFactor(), hash.MaxLoadFactor());
+
+    // Resizing to a packed layout goes through the accessor.
+    hash.Resize(4096, num_key_bits, 34);
+    EXPECT_EQ(hash.NumElements(), num_inserted);
+
+    Hash::PackedAccessor acc = hash.GetAccessor<Hash::PackedAccessor>();
+    K2_EVAL(c, num_elems, lambda_check_find, (int32_t i) -> void {
+        uint64_t value;
+        K2_CHECK(acc.Find(keys_data[i], &value));
+        if (success_data[i]) K2_CHECK_EQ(value, static_cast<uint64_t>(i));
+      });
+    K2_EVAL(c, num_elems, lambda_delete, (int32_t i) -> void {
+        if (success_data[i]) acc.Delete(keys_data[i]);
+      });
+    EXPECT_EQ(hash.NumElements(), 0);
+  }
+}
+
+void TestHashEpoch() {
+  for (auto &c : {GetCpuContext(), GetCudaContext()}) {
+    int32_t num_key_bits = 32, num_epoch_bits = 2, size = 1024,
+            num_elems = 400;
+    Hash hash(c, size, num_key_bits, -1, num_epoch_bits);
+    EXPECT_EQ(hash.NumValueBits(), 30);
+    hash.TrackNumElements();
+    // 4 rounds, so the epoch wraps around (after 3 Clear() calls).
+    for (int32_t round = 0; round != 4; ++round) {
+      // Some keys may be identical; the values depend on the round, and
+      // the largest ones use all the value bits.
+      Array1<uint32_t> keys = RandUniformArray1<uint32_t>(c, num_elems, 0,
+                                                          2 * num_elems),
+                       success(c, num_elems, 0);
+      const uint32_t *keys_data = keys.Data();
+      uint32_t *success_data = success.Data();
+      // winners[key] is the index i that inserted the key.
+      Array1<int32_t> winners(c, 2 * num_elems + 1, -1);
+      int32_t *winners_data = winners.Data();
+      const uint64_t value_offset = (uint64_t(1) << 30) - num_elems;
+      auto acc = hash.GetAccessor<Hash::EpochAccessor<32>>();
+      K2_EVAL(c, num_elems, lambda_insert, (int32_t i) -> void {
+          if (acc.Insert(keys_data[i], value_offset + i)) {
+            success_data[i] = 1;
+            winners_data[keys_data[i]] = i;
+          }
+        });
+      int32_t num_inserted = Sum(success);
+      EXPECT_EQ(hash.NumElements(), num_inserted);
+
+      // Keys that are only present in earlier rounds must not be found.
+      K2_EVAL(c, 2 * num_elems + 1, lambda_check_find, (int32_t key) -> void {
+          uint64_t value = 0, *key_value_location = nullptr;
+          bool found = acc.Find(key, &value, &key_value_location);
+          K2_CHECK_EQ(found, winners_data[key] >= 0);
+          if (found) {
+            K2_CHECK_EQ(value, value_offset + winners_data[key]);
+            acc.SetValue(key_value_location, key, key);
+            K2_CHECK(acc.Find(key, &value));
+            K2_CHECK_EQ(value, static_cast<uint64_t>(key));
+          }
+        });
+      hash.Clear();
+      EXPECT_EQ(hash.NumElements(), 0);
+    }
+    // Elements of the current epoch are kept by Resize().
+    auto acc = hash.GetAccessor<Hash::EpochAccessor<32>>();
+    acc.Insert(10, 20);
+    hash.Resize(2048, num_key_bits);
+    EXPECT_EQ(hash.NumEpochBits(), num_epoch_bits);
+    EXPECT_EQ(hash.NumElements(), 1);
+    uint64_t value = 0;
+    acc = hash.GetAccessor<Hash::EpochAccessor<32>>();
+    EXPECT_TRUE(acc.Find(10, &value));
+    EXPECT_EQ(value, 20u);
+    acc.Delete(10);
+    EXPECT_EQ(hash.NumElements(), 0);
+  }
+}
+
+template <int32_t NUM_KEY_BITS>
+void TestHashBucketed() {
+  using AccessorT = Hash::BucketedAccessor<NUM_KEY_BITS>;
+  for (auto &c : {GetCpuContext(), GetCudaContext()}) {
+    for (int32_t size : {128, 1024, 65536}) {
+      Hash hash(c, size, NUM_KEY_BITS);
+      hash.TrackNumElements();
+      int32_t num_elems = size / 2;
+      // Many keys are identical, as when many arcs enter the same state.
+      int32_t key_bound = num_elems / 4;
+      Array1<uint32_t> keys = RandUniformArray1<uint32_t>(c, num_elems, 0,
+                                                          key_bound - 1),
+                       success(c, num_elems, 0);
+      const uint32_t *keys_data = keys.Data();
+      uint32_t *success_data = success.Data();
+      // winners[key] is the index i that inserted the key.
+      Array1<int32_t> winners(c, key_bound, -1);
+      int32_t *winners_data = winners.Data();
+
+      AccessorT acc = hash.GetAccessor<AccessorT>();
+      K2_EVAL(c, num_elems, lambda_insert_pairs, (int32_t i) -> void {
+          uint64_t old_value;
+          if (acc.Insert(keys_data[i], i, &old_value)) {
+            success_data[i] = 1;
+            winners_data[keys_data[i]] = i;
+          } else {
+            K2_CHECK_NE(old_value, static_cast<uint64_t>(i));
+          }
+        });
+      int32_t num_inserted = Sum(success);
+      EXPECT_EQ(hash.NumElements(), num_inserted);
+
+      // Copy to a bigger hash, which re-inserts using the bucketed layout.
+      Hash bigger(c, size * 2, NUM_KEY_BITS);
+      bigger.TrackNumElements();
+      bigger.CopyDataFrom<AccessorT>(hash);
+      EXPECT_EQ(bigger.NumElements(), num_inserted);
+      AccessorT bigger_acc = bigger.GetAccessor<AccessorT>();
+
+      K2_EVAL(c, num_elems, lambda_check_find, (int32_t i) -> void {
+          uint32_t key = keys_data[i];
+          uint64_t value = 0, bigger_value = 0;
+          K2_CHECK(acc.Find(key, &value));
+          K2_CHECK(bigger_acc.Find(key, &bigger_value));
+          K2_CHECK(!acc.Find(key + key_bound, &value));
+          K2_CHECK_EQ(value, static_cast<uint64_t>(winners_data[key]));
+          K2_CHECK_EQ(bigger_value, value);
+        });
+
+      K2_EVAL(c, num_elems, lambda_check_delete, (int32_t i) -> void {
+          if (success_data[i]) {
+            acc.Delete(keys_data[i]);
+            bigger_acc.Delete(keys_data[i]);
+          }
+        });
+      EXPECT_EQ(hash.NumElements(), 0);
+      EXPECT_EQ(bigger.NumElements(), 0);
+    }
+  }
+}
+
+// Keys 0 and 128 start at the same bucket of a hash with 128 buckets, so the
+// one inserted second is found after 2 probes.
+template <typename HashT, typename AccessorT>
+void TestNumProbes(HashT &hash) {
+  AccessorT acc(hash);
+  EXPECT_EQ(acc.NumProbes(0), 1);  // the hash is empty
+  acc.Insert(0, 10);
+  acc.Insert(128, 20);
+  EXPECT_EQ(acc.NumProbes(0), 1);
+  EXPECT_EQ(acc.NumProbes(128), 2);
+  // A missing key is probed until an empty bucket.
+  EXPECT_GE(acc.NumProbes(256), 2);
+  acc.Delete(0);
+  acc.Delete(128);
+}
 
 TEST(Hash, Construct) {
   // This indirection gets around a limitation of the CUDA compiler.
@@ -412,8 +607,90 @@ TEST(Hash, Construct) {
   }
 }
 
+TEST(Hash, Bucketed) {
+  TestHashBucketed<32>();
+  TestHashBucketed<40>();
+}
+
+TEST(Hash, NumElements) {
+  TestHashNumElements();
+}
+
+TEST(Hash, Epoch) {
+  TestHashEpoch();
+}
+
+TEST(Hash, DispatchAccessor) {
+  ContextPtr c = GetCpuContext();
+  auto name = [](auto tag) -> std::string {
+    using AccessorT = typename decltype(tag)::type;
+    if (std::is_same<AccessorT, Hash::Accessor<32>>::value) return "32";
+    if (std::is_same<AccessorT, Hash::Accessor<40>>::value) return "40";
+    if (std::is_same<AccessorT, Hash::GenericAccessor>::value)
+      return "generic";
+    if (std::is_same<AccessorT, Hash::PackedAccessor>::value) return "packed";
+    return "";
+  };
+  Hash h32(c, 128, 32), h36(c, 128, 36), h40(c, 128, 40),
+      packed(c, 256, 32, 34);
+  EXPECT_EQ((DispatchAccessor<32, 40>(h32, name)), "32");
+  EXPECT_EQ((DispatchAccessor<32, 40>(h36, name)), "generic");
+  EXPECT_EQ((DispatchAccessor<32, 40>(h40, name)), "40");
+  EXPECT_EQ((DispatchAccessor<32, 40>(packed, name)), "packed");
+  EXPECT_EQ(DispatchAccessor<>(h32, name), "generic");
+
+  auto key_bits = [](auto n) -> int32_t { return decltype(n)::value; };
+  EXPECT_EQ((DispatchKeyBits<32, 36, 40>(36, key_bits)), 36);
+  EXPECT_EQ((DispatchKeyBits<32, 36, 40>(40, key_bits)), 40);
+}
+
+TEST(Hash, NumProbes) {
+  ContextPtr c = GetCpuContext();
+  Hash h32(c, 128, 32), h36(c, 128, 36), bucketed(c, 128, 32),
+      packed(c, 128, 32, 34);
+  TestNumProbes<Hash, Hash::Accessor<32>>(h32);
+  TestNumProbes<Hash, Hash::GenericAccessor>(h36);
+  TestNumProbes<Hash, Hash::BucketedAccessor<32>>(bucketed);
+  TestNumProbes<Hash, Hash::PackedAccessor>(packed);
+  Hash64 h64(c, 128);
+  TestNumProbes<Hash64, Hash64::Accessor>(h64);
+}
+
 TEST(Hash64, Construct) {
   TestHash64Construct();
 }
 
+TEST(Hash64, BatchedInsertFind) {
+  for (auto &c : {GetCpuContext(), GetCudaContext()}) {
+    Hash64 hash(c, 1024);
+    // Keys such as (state << 32 | history); the last key repeats the first.
+    std::vector<uint64_t> keys_vec = {(uint64_t(5) << 32) | 7,
+                                      (uint64_t(1) << 40) | 3, 12,
+                                      (uint64_t(5) << 32) | 7};
+    Array1<uint64_t> keys(c, keys_vec),
+        values(c, std::vector<uint64_t>{100, 200, 300, 400});
+    Array1<char> inserted;
+    hash.Insert(keys, values, &inserted);
+    Array1<char> inserted_cpu = inserted.To(GetCpuContext());
+    EXPECT_EQ(inserted_cpu[1], 1);
+    EXPECT_EQ(inserted_cpu[2], 1);
+    EXPECT_EQ(inserted_cpu[0] + inserted_cpu[3], 1);
+    uint64_t first_value = inserted_cpu[0] ? 100 : 400;
+
+    // Inserting again leaves the existing values.
+    hash.Insert(keys, Array1<uint64_t>(c, 4, 1), &inserted);
+    CheckArrayData(inserted, std::vector<char>{0, 0, 0, 0});
+
+    Array1<uint64_t> query(c, std::vector<uint64_t>{12, 13, keys_vec[0],
+                                                    keys_vec[1]}),
+        found_values;
+    Array1<char> found;
+    hash.Find(query, &found_values, &found);
+    CheckArrayData(found, std::vector<char>{1, 0, 1, 1});
+    CheckArrayData(found_values,
+                   std::vector<uint64_t>{300, ~uint64_t(0), first_value, 200});
+    hash.Destroy();
+  }
+}
+
 }  // namespace k2
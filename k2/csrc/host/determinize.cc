@@ -9,6 +9,7 @@
 
 #include <algorithm>
 #include <cassert>
+#include <memory>
 #include <queue>
 #include <unordered_map>
 #include <unordered_set>
@@ -40,22 +41,25 @@ void Determinizer<TracebackState>::GetSizes(
   DetStatePriorityQueue<TracebackState> queue;
   DetStateMap<TracebackState> map;
   using DS = DetState<TracebackState>;
-  std::shared_ptr<DS> start_state(new DS());
+  // All the TracebackStates, which may be shared by many DetStates.
+  Arena<TracebackState> traceback_states;
+  DS *start_state = new DS(&traceback_states);
 
-  bool ans = map.GetOutputState(start_state.get(), fsa_in_);
+  bool ans = map.GetOutputState(start_state, fsa_in_);
   K2_CHECK(ans && start_state->state_id == 0);
 
   if (max_step_ <= 0) max_step_ = std::numeric_limits<int64_t>::max();
   int64_t num_steps = 0;
-  queue.push(std::move(start_state));
+  queue.push(start_state);
   while (num_steps < max_step_ && !queue.empty()) {
-    std::shared_ptr<DS> state(queue.top());
+    std::unique_ptr<DS> state(queue.top());
     queue.pop();
     num_steps +=
         state->ProcessArcs(fsa_in_, &arcs_, weight_pushing_type_,
-                           &arc_derivs_, &map, &queue);
+                           &arc_derivs_, &map, &queue, &traceback_states);
   }
   // We may stopped early due to max_step
+  for (; !queue.empty(); queue.pop()) delete queue.top();
 
   K2_CHECK_EQ(arcs_.size(), arc_derivs_.size());
   int32_t num_states_out = -1, num_derivs_out = 0;
@@ -105,9 +109,8 @@ void Determinizer<TracebackState>::GetOutput(
 template class Determinizer<MaxTracebackState>;
 template class Determinizer<LogSumTracebackState>;
 
-LogSumTracebackLink::LogSumTracebackLink(
-    const std::shared_ptr<LogSumTracebackState> &src, int32_t arc_index,
-    float arc_weight)
+LogSumTracebackLink::LogSumTracebackLink(LogSumTracebackState *src,
+                                         int32_t arc_index, float arc_weight)
     : prev_state(src),
       arc_index(arc_index),
       forward_prob(arc_weight + src->forward_prob) {}
@@ -121,7 +124,7 @@ int32_t GetMostRecentCommonAncestor(
     K2_CHECK(!cur_states->empty());
     for (LogSumTracebackState *s : *cur_states) {
       for (LogSumTracebackLink &l : s->prev_elements) {
-        prev_states.insert(l.prev_state.get());
+        prev_states.insert(l.prev_state);
       }
     }
     cur_states->clear();
@@ -138,7 +141,7 @@ int32_t GetMostRecentCommonAncestor(
   for (; cur_states->size() != 1; ans++) {
     K2_CHECK(!cur_states->empty());
     for (MaxTracebackState *s : *cur_states) {
-      prev_states.insert(s->prev_state.get());
+      prev_states.insert(s->prev_state);
     }
     cur_states->clear();
     cur_states->swap(prev_states);
@@ -167,7 +170,7 @@ void TraceBack(std::unordered_set<LogSumTracebackState *> *cur_states,
             static_cast<float>(link.forward_prob + backward_prob);
         deriv_out->push_back(
             std::pair<int32_t, float>(link.arc_index, expf(arc_log_posterior)));
-        LogSumTracebackState *prev_state = link.prev_state.get();
+        LogSumTracebackState *prev_state = link.prev_state;
         double new_backward_prob =
             backward_prob + arcs_in[link.arc_index].weight;
         if (prev_states.insert(prev_state).second) {  // newly inserted
@@ -207,7 +210,7 @@ void TraceBack(std::unordered_set<MaxTracebackState *> *cur_states,
     // `deriv_out` is just a list of arc indexes in the input FSA
     // that this output arc depends on (it's their sum).
     (*deriv_out)[i] = state->arc_id;
-    state = state->prev_state.get();
+    state = state->prev_state;
   }
   double prev_forward_prob = state->forward_prob;
   *weight_out = static_cast<float>(cur_forward_prob - prev_forward_prob);
@@ -24,7 +24,6 @@
 #include <cassert>
 #include <iterator>
 #include <limits>
-#include <memory>
 #include <queue>
 #include <unordered_map>
 #include <unordered_set>
@@ -176,8 +175,8 @@ struct MaxTracebackState {
 
   // prev_state is the state we trace back to (the previous state), which is the
   // src_state of the arc numbered arc_id.  It will be nullptr if state_id == 0
-  // (start state).
-  std::shared_ptr<MaxTracebackState> prev_state;
+  // (start state).  The states are owned by an Arena.
+  MaxTracebackState *prev_state;
 
   double forward_prob;  // The best forward log-probability from the start
                         // state to this state (along whichever specific
@@ -199,8 +198,7 @@ struct MaxTracebackState {
                       its dest_state will equal state_id.
      @param [in] arc_weight   Weight on the input arc
    */
-  MaxTracebackState(int32_t state_id,
-                    const std::shared_ptr<MaxTracebackState> &src,
+  MaxTracebackState(int32_t state_id, MaxTracebackState *src,
                     int32_t incoming_arc_index, float arc_weight)
       : state_id(state_id),
         arc_id(incoming_arc_index),
@@ -211,8 +209,7 @@ struct MaxTracebackState {
     This takes the same args as the constructor.  It will update the traceback
     info if this incoming arc had higher weight.
   */
-  void Accept(const std::shared_ptr<MaxTracebackState> &src, int32_t arc_index,
-              float arc_weight) {
+  void Accept(MaxTracebackState *src, int32_t arc_index, float arc_weight) {
     double new_forward_prob = src->forward_prob + arc_weight;
     if (new_forward_prob > forward_prob) {
       forward_prob = new_forward_prob;
@@ -232,8 +229,8 @@ class LogSumTracebackState;
   terminating in a specific state.
 */
 struct LogSumTracebackLink {
-  std::shared_ptr<LogSumTracebackState> prev_state;
-  // `prev_state` is the state that this points back to.
+  LogSumTracebackState *prev_state;
+  // `prev_state` is the state that this points back to (owned by an Arena).
 
   int32_t arc_index;  // Index (in input FSA) of this arc from prev_state to the
                       // destination state (in whose LogSumTracebackState this
@@ -250,8 +247,8 @@ struct LogSumTracebackLink {
                      // this data structure till you hit a LogSumTracebackState
                      // with prev_state == nullptr (and state_id == 0).
 
-  LogSumTracebackLink(const std::shared_ptr<LogSumTracebackState> &src,
-                      int32_t arc_index, float arc_weight);
+  LogSumTracebackLink(LogSumTracebackState *src, int32_t arc_index,
+                      float arc_weight);
 };
 
 /*
@@ -293,8 +290,7 @@ struct LogSumTracebackState {
                       will equal state_id.
      @param [in] arc_weight   Weight on the arc
    */
-  LogSumTracebackState(int32_t state_id,
-                       const std::shared_ptr<LogSumTracebackState> &src,
+  LogSumTracebackState(int32_t state_id, LogSumTracebackState *src,
                        int32_t incoming_arc_index, float arc_weight)
       : state_id(state_id), forward_prob(src->forward_prob + arc_weight) {
     prev_elements.emplace_back(src, incoming_arc_index, arc_weight);
@@ -311,8 +307,8 @@ struct LogSumTracebackState {
      @param [in] arc_weight   Weight on the incoming arc
 
    */
-  void Accept(const std::shared_ptr<LogSumTracebackState> &src,
-              int32_t arc_index, float arc_weight) {
+  void Accept(LogSumTracebackState *src, int32_t arc_index,
+              float arc_weight) {
     prev_elements.emplace_back(src, arc_index, arc_weight);
     this->forward_prob =
         LogAdd(this->forward_prob, src->forward_prob + arc_weight);
@@ -387,20 +383,21 @@ class DetState;
 
 template <class TracebackState>
 struct DetStateCompare {
-  bool operator()(const std::shared_ptr<DetState<TracebackState>> &a,
-                  const std::shared_ptr<DetState<TracebackState>> &b) {
+  bool operator()(const DetState<TracebackState> *a,
+                  const DetState<TracebackState> *b) {
     return a->forward_backward_prob < b->forward_backward_prob;
   }
 };
 // Priority queue template arguments:
-//   item queued = shared_ptr<DetState> (using pointer equality as comparison)
-//   container type = vector<shared_ptr<DetState> >
+//   item queued = DetState* (owned by the queue: whoever pops a DetState
+//   must delete it)
+//   container type = vector<DetState*>
 //   less-than operator = DetStateCompare (which compares the
 //   forward_backward_prob).
 template <class TracebackState>
 using DetStatePriorityQueue =
-    std::priority_queue<std::shared_ptr<DetState<TracebackState>>,
-                        std::vector<std::shared_ptr<DetState<TracebackState>>>,
+    std::priority_queue<DetState<TracebackState> *,
+                        std::vector<DetState<TracebackState> *>,
                         DetStateCompare<TracebackState>>;
 
 template <class TracebackState>
@@ -423,11 +420,14 @@ class DetState {
   // DerivType == int32_t for MaxTracbackState, or
   // pair<int32_t, float> for LogSumTracebackState.
 
-  // Constructor for the initial state of the determinized FSA
-  DetState() : seq_len(0), normalized(true), normalizer(0.0) {
+  // Constructor for the initial state of the determinized FSA; the
+  // TracebackStates of the determinization will be allocated from
+  // `traceback_states`.
+  explicit DetState(Arena<TracebackState> *traceback_states)
+      : seq_len(0), normalized(true), normalizer(0.0) {
     // the constructor of TracebackState that takes no args gives us what we
     // need for the start-state.
-    elements[0] = std::make_shared<TracebackState>();
+    elements[0] = traceback_states->New();
   }
 
   /*
@@ -456,15 +456,17 @@ class DetState {
          @param [in] incoming_arc_index  Arc in input FSA that enters state
                    `state_id`.
          @param [in] arc_weight  The weight on this arc
+         @param [in] traceback_states  The arena from which to allocate
+                   a TracebackState for `state_id`, if needed.
    */
-  void AcceptIncomingArc(int32_t state_id,
-                         const std::shared_ptr<TracebackState> &src,
-                         int32_t incoming_arc_index, float arc_weight) {
+  void AcceptIncomingArc(int32_t state_id, TracebackState *src,
+                         int32_t incoming_arc_index, float arc_weight,
+                         Arena<TracebackState> *traceback_states) {
     NVTX_RANGE(K2_FUNC);
     auto ret = elements.insert({state_id, nullptr});
     if (ret.second) {  // No such state existed in `elements`
-      ret.first->second = std::make_shared<TracebackState>(
-          state_id, src, incoming_arc_index, arc_weight);
+      ret.first->second = traceback_states->New(state_id, src,
+                                                incoming_arc_index, arc_weight);
     } else {  // A state with this staste_id existed in `elements`.
       ret.first->second->Accept(src, incoming_arc_index, arc_weight);
     }
@@ -508,7 +510,7 @@ class DetState {
   // derivatives.
   // It's a map from (state-id in input FSA) -> its corresponding
   // TracebackState.
-  std::unordered_map<int32_t, std::shared_ptr<TracebackState>> elements;
+  std::unordered_map<int32_t, TracebackState *> elements;
 
   // This is the weight on the best path that includes this determinized state.
   // It's needed to form a priority queue on DetStates, so we can process them
@@ -540,6 +542,9 @@ class DetState {
                                  to weighted input arcs.
               @param [in,out] state_map  Maps from DetState to int32_t state-id
                                  in the output FSA.
+              @param [in,out] queue  New determinized states are pushed here.
+              @param [in] traceback_states  The arena from which to allocate
+                                 the TracebackStates of the new states.
               @return   Returns a number that approximately indicates how much
                        computation was done (so we can avoid it taking too
                        long).
@@ -549,7 +554,8 @@ class DetState {
                       std::vector<Arc> *arcs_out,
                       std::vector<std::vector<DerivType>> *derivs_per_arc,
                       DetStateMap<TracebackState> *state_map,
-                      DetStatePriorityQueue<TracebackState> *queue);
+                      DetStatePriorityQueue<TracebackState> *queue,
+                      Arena<TracebackState> *traceback_states);
 
 
   /*
@@ -559,7 +565,8 @@ class DetState {
                       FbWeightType weight_pushing_type,
                       std::vector<std::vector<DerivType>> *derivs_per_arc,
                       DetStateMap<TracebackState> *state_map,
-                      DetStatePriorityQueue<TracebackState> *queue);
+                      DetStatePriorityQueue<TracebackState> *queue,
+                      Arena<TracebackState> *traceback_states);
 
 
  private:
@@ -567,6 +574,8 @@ class DetState {
     Process arcs leaving this determinized state and write its successor
     DetStates (unnormalized) to label_to_state. Will be called in `ProcessArcs`.
           @param [in] fsa     The input FSA that we are determinizing.
+          @param [in] traceback_states  The arena from which to allocate
+                              the TracebackStates of the successors.
           @param [out] label_to_state Maps from label to the successor
                               DetStates (unnormalized) of this determinized
                               state.
@@ -574,7 +583,7 @@ class DetState {
                     computation was done (so we can avoid it taking too long).
   */
   int32_t GetDetStatesSuccessor(
-      const Fsa &fsa,
+      const Fsa &fsa, Arena<TracebackState> *traceback_states,
       std::unordered_map<uint32_t, DetState<TracebackState> *> &label_to_state);
 
   /*
@@ -615,13 +624,13 @@ class DetState {
 
 template <class TracebackState>
 int32_t DetState<TracebackState>::GetDetStatesSuccessor(
-    const Fsa &fsa,
+    const Fsa &fsa, Arena<TracebackState> *traceback_states,
     std::unordered_map<uint32_t, DetState<TracebackState> *> &label_to_state) {
   NVTX_RANGE(K2_FUNC);
   int32_t num_steps = 0;
   const auto arcs = fsa.data + fsa.indexes[0];
   for (const auto &elem : elements) {
-    const auto &state_ptr = elem.second;
+    TracebackState *state_ptr = elem.second;
     int32_t state_id = state_ptr->state_id, begin_arc = fsa.indexes[state_id],
             end_arc = fsa.indexes[state_id + 1];
     num_steps += end_arc - begin_arc;
@@ -637,7 +646,7 @@ int32_t DetState<TracebackState>::GetDetStatesSuccessor(
       }
       DetState<TracebackState> *det_state = iter->second;
       det_state->AcceptIncomingArc(arc.dest_state, state_ptr, curr_arc,
-                                   arc.weight);
+                                   arc.weight, traceback_states);
     }
   }
   K2_CHECK(!label_to_state.empty() ||
@@ -655,11 +664,13 @@ int32_t DetState<TracebackState>::ProcessArcs(
     std::vector<std::vector<typename TracebackState::DerivType>>
         *derivs_per_arc,
     DetStateMap<TracebackState> *state_map,
-    DetStatePriorityQueue<TracebackState> *queue) {
+    DetStatePriorityQueue<TracebackState> *queue,
+    Arena<TracebackState> *traceback_states) {
   NVTX_RANGE(K2_FUNC);
   const Fsa &fsa = wfsa_in.fsa;
   std::unordered_map<uint32_t, DetState<TracebackState> *> label_to_state;
-  int32_t num_steps = GetDetStatesSuccessor(fsa, label_to_state);
+  int32_t num_steps =
+      GetDetStatesSuccessor(fsa, traceback_states, label_to_state);
   // The following loop normalizes successor det-states, outputs the arcs
   // that lead to them, and adds them to the queue if necessary.
   for (auto iter = label_to_state.begin(); iter != label_to_state.end();
@@ -676,7 +687,7 @@ int32_t DetState<TracebackState>::ProcessArcs(
                            static_cast<int32_t>(iter->first), arc_weight});
       derivs_per_arc->push_back(std::move(deriv_info));
       if (is_new_state)
-        queue->push(std::unique_ptr<DetState<TracebackState>>(det_state));
+        queue->push(det_state);
       else
         delete det_state;
     } else {
@@ -693,10 +704,12 @@ int32_t DetState<TracebackState>::ProcessArcs(
     std::vector<std::vector<typename TracebackState::DerivType>>
         *derivs_per_arc,
     DetStateMap<TracebackState> *state_map,
-    DetStatePriorityQueue<TracebackState> *queue) {
+    DetStatePriorityQueue<TracebackState> *queue,
+    Arena<TracebackState> *traceback_states) {
   NVTX_RANGE(K2_FUNC);
   std::unordered_map<uint32_t, DetState<TracebackState> *> label_to_state;
-  int32_t num_steps = GetDetStatesSuccessor(fsa_in, label_to_state);
+  int32_t num_steps =
+      GetDetStatesSuccessor(fsa_in, traceback_states, label_to_state);
   // The following loop normalizes successor det-states, outputs the arcs
   // that lead to them, and adds them to the queue if necessary.
   for (auto iter = label_to_state.begin(); iter != label_to_state.end();
@@ -717,7 +730,7 @@ int32_t DetState<TracebackState>::ProcessArcs(
                          static_cast<int32_t>(iter->first), arc_weight});
     derivs_per_arc->push_back(std::move(deriv_info));
     if (is_new_state)
-      queue->push(std::unique_ptr<DetState<TracebackState>>(det_state));
+      queue->push(det_state);
     else
       delete det_state;
   }
@@ -746,7 +759,7 @@ void DetState<TracebackState>::Normalize(const WfsaWithFbWeights &wfsa_in,
 
   double fb_prob = -std::numeric_limits<double>::infinity();
   for (const auto &p : elements) {
-    TracebackState *state = p.second.get();
+    TracebackState *state = p.second;
     fb_prob = LogSumOrMax<TracebackState>(
         fb_prob,
         state->forward_prob + wfsa_in.BackwardStateWeights()[state->state_id]);
@@ -791,7 +804,7 @@ void DetState<TracebackState>::Normalize(const Fsa &fsa_in,
   NVTX_RANGE(K2_FUNC);
   std::unordered_set<TracebackState *> cur_states;
   for (const auto &p : elements) {
-    TracebackState *state = p.second.get();
+    TracebackState *state = p.second;
     cur_states.insert(state);
   }
 
@@ -7,6 +7,7 @@
 
 #include <algorithm>
 #include <cassert>
+#include <memory>
 #include <queue>
 #include <unordered_map>
 #include <unordered_set>
@@ -39,28 +40,31 @@ void DeterminizerPruned<TracebackState>::GetSizes(
   DetStatePriorityQueue<TracebackState> queue;
   DetStateMap<TracebackState> map;
   using DS = DetState<TracebackState>;
-  std::shared_ptr<DS> start_state(new DS());
+  // All the TracebackStates, which may be shared by many DetStates.
+  Arena<TracebackState> traceback_states;
+  DS *start_state = new DS(&traceback_states);
 
-  bool ans = map.GetOutputState(start_state.get(), fsa_in_.fsa);
+  bool ans = map.GetOutputState(start_state, fsa_in_.fsa);
   K2_CHECK(ans && start_state->state_id == 0);
 
   if (max_step_ <= 0) max_step_ = std::numeric_limits<int64_t>::max();
   int64_t num_steps = 0;
   double total_prob = fsa_in_.BackwardStateWeights()[0],
          prune_cutoff = total_prob - beam_;
-  queue.push(std::move(start_state));
+  queue.push(start_state);
   while (num_steps < max_step_ && !queue.empty()) {
-    std::shared_ptr<DS> state(queue.top());
+    std::unique_ptr<DS> state(queue.top());
     queue.pop();
     num_steps += state->ProcessArcs(fsa_in_, prune_cutoff,
                                     weight_pushing_type_,
                                     &arcs_, &arc_derivs_,
-                                    &map, &queue);
+                                    &map, &queue, &traceback_states);
   }
 
   // We may stopped early due to max_step
   effective_beam_ =
       queue.empty() ? beam_ : total_prob - queue.top()->forward_backward_prob;
+  for (; !queue.empty(); queue.pop()) delete queue.top();
 
   K2_CHECK_EQ(arcs_.size(), arc_derivs_.size());
   int32_t num_states_out = -1, num_derivs_out = 0;
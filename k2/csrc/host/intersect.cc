@@ -7,8 +7,6 @@
 #include "k2/csrc/host/intersect.h"
 
 #include <algorithm>
-#include <queue>
-#include <unordered_map>
 #include <utility>
 #include <vector>
 
@@ -22,17 +20,17 @@ namespace {
 
 using StatePair = std::pair<int32_t, int32_t>;
 
+// Returns the state-id in the output of `new_state`, appending it to
+// `qstates` if we have not visited it before; the state-id of the i'th state
+// in `qstates` is i.
 static inline int32_t InsertIntersectionState(
-    const StatePair &new_state, int32_t *state_index_c,
-    std::queue<StatePair> *qstates,
-    std::unordered_map<StatePair, int32_t, k2host::PairHash> *state_pair_map) {
-  auto result = state_pair_map->insert({new_state, *state_index_c + 1});
-  if (result.second) {
-    // we have not visited `new_state` before.
-    qstates->push(new_state);
-    ++(*state_index_c);
-  }
-  return result.first->second;
+    const StatePair &new_state, std::vector<StatePair> *qstates,
+    k2host::FlatHashMap<int32_t> *state_pair_map) {
+  auto result = state_pair_map->Insert(
+      k2host::PairKey(new_state.first, new_state.second),
+      static_cast<int32_t>(qstates->size()));
+  if (result.second) qstates->push_back(new_state);
+  return *result.first;
 }
 }  // namespace
 
@@ -76,19 +74,20 @@ void Intersection::GetSizes(Array2Size<int32_t> *fsa_size) {
   const int32_t arc_map_none = -1;
 
   // map state pair to unique id
-  std::unordered_map<StatePair, int32_t, PairHash> state_pair_map;
-  std::queue<StatePair> qstates;
-  qstates.push({0, 0});
-  state_pair_map.insert({{0, 0}, 0});
-  state_pair_map.insert({{final_state_a, final_state_b}, final_state_c});
-  int32_t state_index_c = 0;
-  while (!qstates.empty()) {
+  FlatHashMap<int32_t> state_pair_map;
+  // The state pairs in the order they are visited (and numbered); we process
+  // them in the same order, so this is also the queue.
+  std::vector<StatePair> qstates;
+  qstates.push_back({0, 0});
+  state_pair_map.Insert(PairKey(0, 0), 0);
+  state_pair_map.Insert(PairKey(final_state_a, final_state_b), final_state_c);
+  for (int32_t curr_state_index = 0;
+       curr_state_index != static_cast<int32_t>(qstates.size());
+       ++curr_state_index) {
     arc_indexes_.push_back(static_cast<int32_t>(arcs_.size()));
 
-    auto curr_state_pair = qstates.front();
-    qstates.pop();
-    // as we have inserted `curr_state_pair` before.
-    int32_t curr_state_index = state_pair_map[curr_state_pair];
+    // copy here as `qstates` may be reallocated below.
+    StatePair curr_state_pair = qstates[curr_state_index];
 
     auto state_a = curr_state_pair.first;
     auto a_arc_iter_begin = arc_a_begin + a_.indexes[state_a];
@@ -104,7 +103,7 @@ void Intersection::GetSizes(Array2Size<int32_t> *fsa_size) {
 
         StatePair new_state{a_arc_iter_begin->dest_state, state_b};
         int32_t new_state_index = InsertIntersectionState(
-            new_state, &state_index_c, &qstates, &state_pair_map);
+            new_state, &qstates, &state_pair_map);
         arcs_.emplace_back(curr_state_index, new_state_index, kEpsilon,
                            a_arc_iter_begin->weight);
         arc_map_a_.push_back(
@@ -115,7 +114,7 @@ void Intersection::GetSizes(Array2Size<int32_t> *fsa_size) {
         if (kEpsilon != b_arc_iter_begin->label) break;
         StatePair new_state{state_a, b_arc_iter_begin->dest_state};
         int32_t new_state_index = InsertIntersectionState(
-            new_state, &state_index_c, &qstates, &state_pair_map);
+            new_state, &qstates, &state_pair_map);
         arcs_.emplace_back(curr_state_index, new_state_index, kEpsilon,
                            b_arc_iter_begin->weight);
         arc_map_a_.push_back(arc_map_none);
@@ -146,7 +145,7 @@ void Intersection::GetSizes(Array2Size<int32_t> *fsa_size) {
         if (swapped) std::swap(curr_a_arc, curr_b_arc);
         StatePair new_state{curr_a_arc.dest_state, curr_b_arc.dest_state};
         int32_t new_state_index = InsertIntersectionState(
-            new_state, &state_index_c, &qstates, &state_pair_map);
+            new_state, &qstates, &state_pair_map);
         arcs_.emplace_back(curr_state_index, new_state_index, curr_a_arc.label,
                            curr_a_arc.weight + curr_b_arc.weight);
 
@@ -163,7 +162,7 @@ void Intersection::GetSizes(Array2Size<int32_t> *fsa_size) {
 
   // push final state
   arc_indexes_.push_back(static_cast<int32_t>(arcs_.size()));
-  ++state_index_c;
+  int32_t state_index_c = static_cast<int32_t>(qstates.size());
   // then replace `final_state_c` with the real index of final state of `c`
   for (auto &arc : arcs_) {
     if (arc.dest_state == final_state_c) arc.dest_state = state_index_c;
@@ -20,6 +20,7 @@
 #ifndef K2_CSRC_HOST_RMEPSILON_H_
 #define K2_CSRC_HOST_RMEPSILON_H_
 
+#include <functional>
 #include <type_traits>
 #include <utility>
 #include <vector>
@@ -45,6 +46,12 @@ namespace k2host {
 template <typename TracebackState>
 class EpsilonsRemoverPruned {
  public:
+  /* A function that calls `func(i)` for `begin <= i < end`, possibly in
+     parallel, and returns when all calls have finished, e.g.
+     k2::ParallelFor(). */
+  using ParallelForFunc = std::function<void(
+      int32_t begin, int32_t end, const std::function<void(int32_t)> &func)>;
+
   /* Lightweight constructor that just keeps const references to the input
      parameters.
      @param [in] fsa_in  The input FSA, with weights and forward-backward
@@ -78,9 +85,16 @@ class EpsilonsRemoverPruned {
                                       `arc_derivs` definition in `GetOutput`
                                       below for details) will be written to
                                       here.
+        @param [in] parallel_for  If not empty, it is used to process the
+                                  states of the input FSA in parallel, in
+                                  chunks of consecutive states (the epsilon
+                                  paths from each state are found
+                                  independently of those of other states).
+                                  The output does not depend on it.
   */
   void GetSizes(Array2Size<int32_t> *fsa_size,
-                Array2Size<int32_t> *arc_derivs_size);
+                Array2Size<int32_t> *arc_derivs_size,
+                const ParallelForFunc &parallel_for = nullptr);
 
   /*
     Finish the operation and output the epsilon-free FSA to `fsa_out` and
@@ -113,6 +127,16 @@ class EpsilonsRemoverPruned {
       Array2<typename TracebackState::DerivType *, int32_t> *arc_derivs);
 
  private:
+  /* Finds the epsilon paths from state `state_in` of the input FSA that end
+     with a non-epsilon arc, and appends the corresponding arcs leaving
+     state `state_out` of the output FSA to `arcs` and their derivative
+     information to `arc_derivs`. */
+  void ProcessState(
+      int32_t state_in, int32_t state_out, const int32_t *state_map,
+      double best_weight, std::vector<Arc> *arcs,
+      std::vector<std::vector<typename TracebackState::DerivType>>
+          *arc_derivs) const;
+
   const WfsaWithFbWeights &fsa_in_;
   const float beam_;
 
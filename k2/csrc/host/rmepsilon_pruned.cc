@@ -5,11 +5,9 @@
  */
 
 #include <algorithm>
-#include <map>
-#include <memory>
+#include <functional>
 #include <queue>
-#include <set>
-#include <unordered_map>
+#include <utility>
 #include <vector>
 
 #include "k2/csrc/host/fsa.h"
@@ -79,16 +77,11 @@ static int32_t MapStates(const k2host::Fsa &fsa_in,
    in this sub-graph are epsilon arcs except the last one. Then, from the last
    state, we need to trace back to state `s` to find the derivative information
    for all epsilon arcs in this graph.
-       @param [in] curr_states   (This is consumed destructively, i.e. don't
-                       expect it to contain the same set on exit).
-                       A set of states, stored as a std::map that mapping
-                       state_id in input FSA to the corresponding
-                       LogSumTracebackState we created for this state;
-                       we'll iteratively trace back this set one element
-                       (processing all entering arcs) at a time.  At entry
-                       it must have size() == 1 which contains the last
-                       state mentioned above; it will also have size() == 1
-                       at exit which contains the state `s` above.
+       @param [in] last_state  The LogSumTracebackState of the last state
+                       mentioned above.  We trace back from it one state at
+                       a time (processing all entering arcs), in decreasing
+                       order of state_id, until we reach the state `s`
+                       above.
        @param [in] arcs_in  Array of arcs of the FSA, to look up weight
        @param [in] last_arc_index  The arc index of the last arc in the
                                    sub-graph above, it's a labeled arc,
@@ -103,19 +96,23 @@ static int32_t MapStates(const k2host::Fsa &fsa_in,
                        due to limitations of floating point representation).
  */
 static void TraceBackRmEpsilons(
-    std::map<int32_t, k2host::LogSumTracebackState *> *curr_states,
-    const k2host::Arc *arcs_in, int32_t last_arc_index,
-    std::vector<std::pair<int32_t, float>> *deriv_out) {
+    k2host::LogSumTracebackState *last_state, const k2host::Arc *arcs_in,
+    int32_t last_arc_index, std::vector<std::pair<int32_t, float>> *deriv_out) {
   NVTX_RANGE(K2_FUNC);
-  K2_CHECK_EQ(curr_states->size(), 1);
   deriv_out->clear();
   // push derivative info of the last arc
   deriv_out->emplace_back(last_arc_index, 1);
 
   // as the input fsa is top-sorted, we traverse states in a reverse order so we
   // can process them when they already have correct backward_prob (all leaving
-  // arcs have been processed).
-  k2host::LogSumTracebackState *state_ptr = curr_states->rbegin()->second;
+  // arcs have been processed).  The heap is keyed on state_id, and the states
+  // in it are also in `visited`.
+  std::priority_queue<std::pair<int32_t, k2host::LogSumTracebackState *>>
+      curr_states;
+  k2host::FlatHashMap<char> visited;
+  curr_states.emplace(last_state->state_id, last_state);
+  visited.Insert(last_state->state_id, 1);
+  k2host::LogSumTracebackState *state_ptr = last_state;
   // In the standard forward-backward algorithm for HMMs this backward_prob
   // would, mathematically, be 0.0, but if we set it to the negative of the
   // forward prob we can avoid having to subtract the total log-prob
@@ -127,25 +124,24 @@ static void TraceBackRmEpsilons(
       auto arc_log_posterior =
           static_cast<float>(link.forward_prob + backward_prob);
       deriv_out->emplace_back(link.arc_index, expf(arc_log_posterior));
-      k2host::LogSumTracebackState *prev_state = link.prev_state.get();
+      k2host::LogSumTracebackState *prev_state = link.prev_state;
       double new_backward_prob = backward_prob + arcs_in[link.arc_index].weight;
-      auto result = curr_states->emplace(prev_state->state_id, prev_state);
-      if (result.second) {
+      if (visited.Insert(prev_state->state_id, 1).second) {
+        curr_states.emplace(prev_state->state_id, prev_state);
         prev_state->backward_prob = new_backward_prob;
       } else {
         prev_state->backward_prob =
             k2host::LogAdd(new_backward_prob, prev_state->backward_prob);
       }
     }
-    // we have processed all entering arcs of state curr_states->rbegin(),
-    // we'll remove it now. As std::map.erase() does not support passing a
-    // reverse iterator, we here pass --end();
-    curr_states->erase(--curr_states->end());
-    K2_CHECK(!curr_states->empty());
-    state_ptr = curr_states->rbegin()->second;
+    // we have processed all entering arcs of state curr_states.top(), we'll
+    // remove it now.
+    curr_states.pop();
+    K2_CHECK(!curr_states.empty());
+    state_ptr = curr_states.top().second;
   }
   // we have reached the state from which we are trying to remove epsilon arcs.
-  K2_CHECK_EQ(curr_states->size(), 1);
+  K2_CHECK_EQ(curr_states.size(), 1);
 }
 
 /**
@@ -155,29 +151,94 @@ static void TraceBackRmEpsilons(
    EmpsilonRemover for MaxTracebackState, so here we just trace back the best
    path to get the derivative information.
  */
-static void TraceBackRmEpsilons(
-    std::map<int32_t, k2host::MaxTracebackState *> *curr_states,
-    const k2host::Arc *unused,  // arcs_in, unused
-    int32_t last_arc_index, std::vector<int32_t> *deriv_out) {
+static void TraceBackRmEpsilons(k2host::MaxTracebackState *last_state,
+                                const k2host::Arc *unused,  // arcs_in, unused
+                                int32_t last_arc_index,
+                                std::vector<int32_t> *deriv_out) {
   NVTX_RANGE(K2_FUNC);
-  K2_CHECK_EQ(curr_states->size(), 1);
   deriv_out->clear();
   // push derivative info of the last arc
   deriv_out->push_back(last_arc_index);
 
-  k2host::MaxTracebackState *state_ptr = curr_states->begin()->second;
+  k2host::MaxTracebackState *state_ptr = last_state;
   while (state_ptr->prev_state != nullptr) {
     deriv_out->push_back(state_ptr->arc_id);
-    state_ptr = state_ptr->prev_state.get();
+    state_ptr = state_ptr->prev_state;
   }
 }
 }  // namespace
 
 namespace k2host {
 
+template <typename TracebackState>
+void EpsilonsRemoverPruned<TracebackState>::ProcessState(
+    int32_t state_in, int32_t state_out, const int32_t *state_map,
+    double best_weight, std::vector<Arc> *arcs,
+    std::vector<std::vector<typename TracebackState::DerivType>> *arc_derivs)
+    const {
+  const auto &fsa = fsa_in_.fsa;
+  const auto &arcs_in = fsa.data + fsa.indexes[0];
+  const double *forward_state_weights = fsa_in_.ForwardStateWeights();
+  const double *backward_state_weights = fsa_in_.BackwardStateWeights();
+
+  // as the input FSA is top-sorted, we use a min-heap here so we can process
+  // states when they already have costs over all paths they are going to get
+  std::priority_queue<int32_t, std::vector<int32_t>, std::greater<int32_t>>
+      qstates;
+  Arena<TracebackState> arena;
+  FlatHashMap<TracebackState *>
+      traceback_states;  // state -> TracebackState of this state
+  TracebackState *start_state =
+      arena.New(state_in, forward_state_weights[state_in]);
+  double start_forward_weights = start_state->forward_prob;
+  traceback_states.Insert(state_in, start_state);
+  qstates.push(state_in);
+  while (!qstates.empty()) {
+    int32_t state = qstates.top();
+    qstates.pop();
+
+    TracebackState *curr_traceback_state = *traceback_states.Get(state);
+    double curr_forward_weights = curr_traceback_state->forward_prob;
+    int32_t arc_end = fsa.indexes[state + 1];
+    for (int32_t arc_index = fsa.indexes[state]; arc_index != arc_end;
+         ++arc_index) {
+      const int32_t curr_arc_index = arc_index - fsa.indexes[0];
+      int32_t next_state = arcs_in[curr_arc_index].dest_state;
+      int32_t label = arcs_in[curr_arc_index].label;
+      float curr_arc_weight = arcs_in[curr_arc_index].weight;
+      double next_weight = curr_forward_weights + curr_arc_weight;
+      if (next_weight + backward_state_weights[next_state] >= best_weight) {
+        if (label == kEpsilon) {
+          auto result = traceback_states.Insert(next_state, nullptr);
+          if (result.second) {
+            *result.first = arena.New(next_state, curr_traceback_state,
+                                      curr_arc_index, curr_arc_weight);
+            qstates.push(next_state);
+          } else {
+            (*result.first)->Accept(curr_traceback_state, curr_arc_index,
+                                    curr_arc_weight);
+          }
+        } else {
+          float arc_weight =
+              curr_forward_weights + curr_arc_weight - start_forward_weights;
+          arcs->emplace_back(state_out, state_map[next_state], label,
+                             arc_weight);
+
+          std::vector<typename TracebackState::DerivType> curr_arc_deriv;
+          TraceBackRmEpsilons(curr_traceback_state, arcs_in, curr_arc_index,
+                              &curr_arc_deriv);
+          std::reverse(curr_arc_deriv.begin(), curr_arc_deriv.end());
+          arc_derivs->emplace_back(std::move(curr_arc_deriv));
+        }
+      }
+    }
+  }
+}
+
 template <typename TracebackState>
 void EpsilonsRemoverPruned<TracebackState>::GetSizes(
-    Array2Size<int32_t> *fsa_size, Array2Size<int32_t> *arc_derivs_size) {
+    Array2Size<int32_t> *fsa_size, Array2Size<int32_t> *arc_derivs_size,
+    const ParallelForFunc &parallel_for /*= nullptr*/) {
   NVTX_RANGE(K2_FUNC);
   K2_CHECK_NE(fsa_size, nullptr);
   K2_CHECK_NE(arc_derivs_size, nullptr);
@@ -192,79 +253,64 @@ void EpsilonsRemoverPruned<TracebackState>::GetSizes(
   if (IsEmpty(fsa)) return;
   int32_t num_states_in = fsa.NumStates();
   int32_t final_state_in = fsa.FinalState();
-  const auto &arcs_in = fsa.data + fsa.indexes[0];
 
   // identify all states that should be kept
   std::vector<char> non_eps_in(num_states_in, 0);
   std::vector<int32_t> state_map(num_states_in, -1);
   int32_t num_states_out = MapStates(fsa, &non_eps_in, &state_map);
-
-  arc_indexes_.reserve(num_states_out + 1);
-  int32_t arc_num_out = 0;
-  int32_t derivs_num_out = 0;
-  const double *forward_state_weights = fsa_in_.ForwardStateWeights();
-  const double *backward_state_weights = fsa_in_.BackwardStateWeights();
-  const double best_weight = forward_state_weights[final_state_in] - beam_;
+  std::vector<int32_t> kept_states;
+  kept_states.reserve(num_states_out);
   for (int32_t i = 0; i != num_states_in; ++i) {
-    if (non_eps_in[i] != 1) continue;
-    arc_indexes_.push_back(arc_num_out);
-    int32_t curr_state_out = state_map[i];
+    if (non_eps_in[i] == 1) kept_states.push_back(i);
+  }
 
-    // as the input FSA is top-sorted, we use a set here so we can process
-    // states when they already have costs over all paths they are going to get
-    std::set<int32_t> qstates;
-    std::unordered_map<int32_t, std::shared_ptr<TracebackState>>
-        traceback_states;  // state -> TracebackState of this state
-    std::shared_ptr<TracebackState> start_state(
-        new TracebackState(i, forward_state_weights[i]));
-    double start_forward_weights = start_state->forward_prob;
-    traceback_states.emplace(i, start_state);
-    qstates.insert(i);
-    while (!qstates.empty()) {
-      int32_t state = *(qstates.begin());
-      qstates.erase(qstates.begin());
+  const double best_weight =
+      fsa_in_.ForwardStateWeights()[final_state_in] - beam_;
 
-      const auto &curr_traceback_state = traceback_states[state];
-      double curr_forward_weights = curr_traceback_state->forward_prob;
-      int32_t arc_end = fsa.indexes[state + 1];
-      for (int32_t arc_index = fsa.indexes[state]; arc_index != arc_end;
-           ++arc_index) {
-        const int32_t curr_arc_index = arc_index - fsa.indexes[0];
-        int32_t next_state = arcs_in[curr_arc_index].dest_state;
-        int32_t label = arcs_in[curr_arc_index].label;
-        float curr_arc_weight = arcs_in[curr_arc_index].weight;
-        double next_weight = curr_forward_weights + curr_arc_weight;
-        if (next_weight + backward_state_weights[next_state] >= best_weight) {
-          if (label == kEpsilon) {
-            auto result = traceback_states.emplace(next_state, nullptr);
-            if (result.second) {
-              result.first->second = std::make_shared<TracebackState>(
-                  next_state, curr_traceback_state, curr_arc_index,
-                  curr_arc_weight);
-              qstates.insert(next_state);
-            } else {
-              result.first->second->Accept(curr_traceback_state, curr_arc_index,
-                                           curr_arc_weight);
-            }
-          } else {
-            float arc_weight =
-                curr_forward_weights + curr_arc_weight - start_forward_weights;
-            arcs_.emplace_back(curr_state_out, state_map[next_state], label,
-                               arc_weight);
+  // The output arcs (and their derivs) of each chunk of consecutive kept
+  // states; the chunks are concatenated in order below, so the output is the
+  // same however they are processed.
+  const int32_t states_per_chunk = 256;
+  int32_t num_chunks =
+      (num_states_out + states_per_chunk - 1) / states_per_chunk;
+  struct Chunk {
+    std::vector<int32_t> num_arcs;  // indexed by kept state in this chunk
+    std::vector<Arc> arcs;
+    std::vector<std::vector<typename TracebackState::DerivType>> arc_derivs;
+  };
+  std::vector<Chunk> chunks(num_chunks);
+  auto process_chunk = [&](int32_t c) -> void {
+    Chunk &chunk = chunks[c];
+    int32_t begin = c * states_per_chunk,
+            end = std::min(begin + states_per_chunk, num_states_out);
+    chunk.num_arcs.reserve(end - begin);
+    for (int32_t i = begin; i != end; ++i) {
+      size_t prev_num_arcs = chunk.arcs.size();
+      ProcessState(kept_states[i], i, state_map.data(), best_weight,
+                   &chunk.arcs, &chunk.arc_derivs);
+      chunk.num_arcs.push_back(chunk.arcs.size() - prev_num_arcs);
+    }
+  };
+  if (parallel_for) {
+    parallel_for(0, num_chunks, process_chunk);
+  } else {
+    for (int32_t c = 0; c != num_chunks; ++c) process_chunk(c);
+  }
 
-            std::vector<typename TracebackState::DerivType> curr_arc_deriv;
-            std::map<int32_t, TracebackState *> curr_states;
-            curr_states.emplace(state, curr_traceback_state.get());
-            TraceBackRmEpsilons(&curr_states, arcs_in, curr_arc_index,
-                                &curr_arc_deriv);
-            std::reverse(curr_arc_deriv.begin(), curr_arc_deriv.end());
-            derivs_num_out += curr_arc_deriv.size();
-            arc_derivs_.emplace_back(std::move(curr_arc_deriv));
-            ++arc_num_out;
-          }
-        }
-      }
+  arc_indexes_.reserve(num_states_out + 1);
+  int32_t arc_num_out = 0;
+  int32_t derivs_num_out = 0;
+  for (auto &chunk : chunks) {
+    for (int32_t num_arcs : chunk.num_arcs) {
+      arc_indexes_.push_back(arc_num_out);
+      arc_num_out += num_arcs;
+    }
+    arcs_.insert(arcs_.end(), chunk.arcs.begin(), chunk.arcs.end());
+    for (auto &arc_deriv : chunk.arc_derivs) {
+      derivs_num_out += arc_deriv.size();
+      arc_derivs_.emplace_back(std::move(arc_deriv));
     }
+    chunk = Chunk();  // free the memory
   }
   // duplicate of final state
   arc_indexes_.push_back(arc_indexes_.back());
@@ -23,9 +23,14 @@
 #include <algorithm>
 #include <cfloat>
 #include <cmath>
+#include <cstdint>
 #include <functional>
 #include <limits>
+#include <memory>
+#include <new>
+#include <type_traits>
 #include <utility>
+#include <vector>
 
 namespace k2host {
 
@@ -54,6 +59,134 @@ struct PairHash {
   }
 };
 
+// Returns a key for FlatHashMap from a pair of int32_t, e.g. of state-ids.
+inline uint64_t PairKey(int32_t a, int32_t b) {
+  return (static_cast<uint64_t>(static_cast<uint32_t>(a)) << 32) |
+         static_cast<uint32_t>(b);
+}
+
+/*
+  A hash map from uint64_t keys (e.g. state-ids, or pairs of them; see
+  PairKey()) to values of type V, with open addressing and linear probing in
+  one flat array.  Unlike std::unordered_map it does no allocation per
+  element, which matters for the host algorithms that look up a state for
+  each arc they process.  Elements can't be removed, and the key ~0 (i.e.
+  PairKey(-1, -1)) is reserved.
+*/
+template <typename V>
+class FlatHashMap {
+ public:
+  explicit FlatHashMap(int32_t num_buckets_log2 = 4) {
+    Rehash(num_buckets_log2);
+  }
+
+  /*
+    Inserts (key, value) if `key` is not present.  Returns a pointer to the
+    value of `key`, which is valid until the next call to Insert(), and true
+    if it was inserted.
+   */
+  std::pair<V *, bool> Insert(uint64_t key, const V &value) {
+    std::size_t i = Find(key);
+    if (keys_[i] == key) return {&values_[i], false};
+    if (2 * (size_ + 1) > keys_.size()) {
+      Rehash(num_buckets_log2_ + 1);
+      i = Find(key);
+    }
+    keys_[i] = key;
+    values_[i] = value;
+    ++size_;
+    return {&values_[i], true};
+  }
+
+  // Returns a pointer to the value of `key`, or nullptr if it is not present.
+  V *Get(uint64_t key) {
+    std::size_t i = Find(key);
+    return keys_[i] == key ? &values_[i] : nullptr;
+  }
+
+  std::size_t size() const { return size_; }
+
+ private:
+  static constexpr uint64_t kEmpty = ~static_cast<uint64_t>(0);
+
+  // Returns the bucket of `key`, or the empty bucket where it would go.
+  std::size_t Find(uint64_t key) const {
+    std::size_t mask = keys_.size() - 1,
+                i = static_cast<std::size_t>(
+                    (key * 0x9E3779B97F4A7C15ULL) >> (64 - num_buckets_log2_));
+    while (keys_[i] != key && keys_[i] != kEmpty) i = (i + 1) & mask;
+    return i;
+  }
+
+  void Rehash(int32_t num_buckets_log2) {
+    std::vector<uint64_t> old_keys(std::size_t(1) << num_buckets_log2,
+                                   static_cast<uint64_t>(kEmpty));
+    std::vector<V> old_values(old_keys.size());
+    old_keys.swap(keys_);  // now old_keys holds the old keys.
+    old_values.swap(values_);
+    num_buckets_log2_ = num_buckets_log2;
+    for (std::size_t i = 0; i < old_keys.size(); ++i) {
+      if (old_keys[i] == kEmpty) continue;
+      std::size_t j = Find(old_keys[i]);
+      keys_[j] = old_keys[i];
+      values_[j] = old_values[i];
+    }
+  }
+
+  std::vector<uint64_t> keys_;
+  std::vector<V> values_;
+  std::size_t size_ = 0;
+  int32_t num_buckets_log2_;
+};
+
+/*
+  Owns objects of type T that are created one at a time and all freed
+  together when the Arena is destroyed, e.g. the traceback states of a
+  determinization, whose lifetimes are otherwise hard to track.  The objects
+  are constructed in blocks of memory whose size doubles (up to a limit), so
+  there are few allocations and objects created together are close in
+  memory.  Pointers returned by New() remain valid as more objects are
+  created.
+*/
+template <typename T>
+class Arena {
+ public:
+  Arena() = default;
+  Arena(const Arena &) = delete;
+  Arena &operator=(const Arena &) = delete;
+
+  ~Arena() {
+    for (std::size_t i = 0; i != blocks_.size(); ++i) {
+      std::size_t num_objects =
+          (i + 1 == blocks_.size() ? num_used_ : block_sizes_[i]);
+      T *block = reinterpret_cast<T *>(blocks_[i].get());
+      for (std::size_t j = 0; j != num_objects; ++j) block[j].~T();
+    }
+  }
+
+  template <typename... Args>
+  T *New(Args &&... args) {
+    if (blocks_.empty() || num_used_ == block_sizes_.back()) {
+      std::size_t block_size =
+          blocks_.empty() ? 64 : std::min<std::size_t>(
+                                     2 * block_sizes_.back(), 1 << 16);
+      blocks_.emplace_back(new Storage[block_size]);
+      block_sizes_.push_back(block_size);
+      num_used_ = 0;
+    }
+    void *p = &blocks_.back()[num_used_];
+    T *ans = new (p) T(std::forward<Args>(args)...);
+    ++num_used_;
+    return ans;
+  }
+
+ private:
+  using Storage = typename std::aligned_storage<sizeof(T), alignof(T)>::type;
+  std::vector<std::unique_ptr<Storage[]>> blocks_;
+  std::vector<std::size_t> block_sizes_;
+  std::size_t num_used_ = 0;  // Number of objects in the last block
+};
+
 static const double kMinLogDiffDouble = log(DBL_EPSILON);  // negative!
 static const float kMinLogDiffFloat = logf(FLT_EPSILON);   // negative!
 
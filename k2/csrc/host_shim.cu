@@ -23,6 +23,7 @@
 #include "k2/csrc/host/weights.h"
 #include "k2/csrc/host_shim.h"
 #include "k2/csrc/ragged.h"
+#include "k2/csrc/thread_pool.h"
 
 namespace k2 {
 
@@ -159,10 +160,10 @@ static Array1<bool> CheckProperties(FsaOrVec &fsas,
     int32_t num_fsas = fsas.Dim0();
     Array1<bool> ans(c, num_fsas);
     bool *ans_data = ans.Data();
-    for (int32_t i = 0; i != num_fsas; ++i) {
+    ParallelFor(0, num_fsas, [&](int32_t i) -> void {
       k2host::Fsa host_fsa = FsaVecToHostFsa(fsas, i);
       ans_data[i] = f(host_fsa);
-    }
+    });
     return ans;
   }
 }
@@ -275,7 +276,7 @@ Array1<FloatType> GetForwardScores(FsaVec &fsas, bool log_semiring) {
   // returned state_scores
   Array1<double> state_scores(c, num_states);
   double *state_scores_data = state_scores.Data();
-  for (int32_t i = 0; i != num_fsas; ++i) {
+  ParallelFor(0, num_fsas, [&](int32_t i) -> void {
     k2host::Fsa host_fsa = FsaVecToHostFsa(fsas, i);
     double *this_fsa_state_scores_data = state_scores_data + fsa_row_splits1[i];
     if (log_semiring) {
@@ -283,7 +284,7 @@ Array1<FloatType> GetForwardScores(FsaVec &fsas, bool log_semiring) {
     } else {
       k2host::ComputeForwardMaxWeights(host_fsa, this_fsa_state_scores_data);
     }
-  }
+  });
   return state_scores.AsType<FloatType>();
 }
 
@@ -303,7 +304,7 @@ Array1<FloatType> GetBackwardScores(
   // returned state_scores
   Array1<double> state_scores(c, num_states);
   double *state_scores_data = state_scores.Data();
-  for (int32_t i = 0; i != num_fsas; ++i) {
+  ParallelFor(0, num_fsas, [&](int32_t i) -> void {
     k2host::Fsa host_fsa = FsaVecToHostFsa(fsas, i);
     double *this_fsa_state_scores_data = state_scores_data + fsa_row_splits1[i];
     if (log_semiring) {
@@ -312,7 +313,7 @@ Array1<FloatType> GetBackwardScores(
     } else {
       k2host::ComputeBackwardMaxWeights(host_fsa, this_fsa_state_scores_data);
     }
-  }
+  });
 
   // add negative of tot_scores[i] to each state score in fsa[i]
   FloatType negative_infinity = -std::numeric_limits<FloatType>::infinity();
@@ -20,10 +20,12 @@
 
 #include <string>
 
+#include "k2/csrc/fsa_algo.h"
 #include "k2/csrc/fsa_utils.h"
 #include "k2/csrc/host/fsa_util.h"
 #include "k2/csrc/host_shim.h"
 #include "k2/csrc/test_utils.h"
+#include "k2/csrc/thread_pool.h"
 
 namespace k2 {
 TEST(HostShim, FsaToHostFsa) {
@@ -78,5 +80,30 @@ TEST(HostShim, FsaVecToHostFsa) {
   // TODO(fangjun): check the content of host_fsa
 }
 
+TEST(HostShim, MultiThreaded) {
+  // The results must not depend on the number of threads.
+  FsaVec random_fsas = RandomFsaVec(1, 100, true, 10, 0, 1000), fsas;
+  Connect(random_fsas, &fsas);
+  Array1<double> forward_scores = GetForwardScores<double>(fsas, true),
+                 backward_scores = GetBackwardScores<double>(fsas, nullptr,
+                                                             true);
+  Array1<bool> is_connected = IsConnected(fsas);
+  FsaVec determinized;
+  Ragged<int32_t> arc_derivs;
+  Determinize(fsas, kNoWeightPushing, &determinized, &arc_derivs);
+
+  int32_t saved_num_threads = GetNumCpuThreads();
+  SetNumCpuThreads(4);
+  EXPECT_TRUE(Equal(GetForwardScores<double>(fsas, true), forward_scores));
+  EXPECT_TRUE(Equal(GetBackwardScores<double>(fsas, nullptr, true),
+                    backward_scores));
+  EXPECT_TRUE(Equal(IsConnected(fsas), is_connected));
+  FsaVec determinized2;
+  Ragged<int32_t> arc_derivs2;
+  Determinize(fsas, kNoWeightPushing, &determinized2, &arc_derivs2);
+  EXPECT_TRUE(Equal(determinized, determinized2));
+  EXPECT_TRUE(Equal(arc_derivs, arc_derivs2));
+  SetNumCpuThreads(saved_num_threads);
+}
 
 }  // namespace k2
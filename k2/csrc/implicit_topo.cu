@@ -0,0 +1,71 @@
+/**
+ * Copyright      2026  Xiaomi Corporation
+ *
+ * See LICENSE for clarification regarding multiple authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <algorithm>
+#include <vector>
+
+#include "k2/csrc/implicit_topo.h"
+#include "k2/csrc/macros.h"
+#include "k2/csrc/ragged_ops.h"
+
+namespace k2 {
+
+RaggedShape ImplicitTopo::Shape(ContextPtr c) const {
+  NVTX_RANGE(K2_FUNC);
+  K2_CHECK_GE(max_token, 0);
+  int32_t num_states = NumStates(), num_arcs = NumArcs();
+  ImplicitTopo topo = *this;
+  Array1<int32_t> row_splits1(c, std::vector<int32_t>{0, num_states}),
+      row_splits2(c, num_states + 1);
+  int32_t *row_splits2_data = row_splits2.Data();
+  K2_EVAL(
+      c, num_states + 1, lambda_set_row_splits, (int32_t i)->void {
+        int32_t s = topo.max_token + 2, ans;
+        switch (topo.type) {
+          case ImplicitTopoType::kCtc:
+            ans = min(i, s - 1) * s;
+            break;
+          case ImplicitTopoType::kModifiedCtc:
+            ans = (i == 0 ? 0 : (s - 1) * 2 + (min(i, s - 1) - 1) * 2);
+            break;
+          default:  // all arcs leave state 0.
+            ans = (i == 0 ? 0 : num_arcs);
+        }
+        row_splits2_data[i] = ans;
+      });
+  return RaggedShape3(&row_splits1, nullptr, num_states, &row_splits2,
+                      nullptr, num_arcs);
+}
+
+Array1<int32_t> ImplicitTopoAuxLabels(const ImplicitTopo &topo,
+                                      const Array1<int32_t> &arc_map) {
+  NVTX_RANGE(K2_FUNC);
+  ContextPtr &c = arc_map.Context();
+  Array1<int32_t> ans(c, arc_map.Dim());
+  const int32_t *arc_map_data = arc_map.Data();
+  int32_t *ans_data = ans.Data();
+  ImplicitTopo t = topo;
+  K2_EVAL(
+      c, arc_map.Dim(), lambda_set_aux_labels, (int32_t i)->void {
+        int32_t arc_idx01 = arc_map_data[i];
+        ans_data[i] = (arc_idx01 < 0 ? -1 : t.GetAuxLabel(arc_idx01));
+      });
+  return ans;
+}
+
+}  // namespace k2
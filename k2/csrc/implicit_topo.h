@@ -0,0 +1,132 @@
+/**
+ * Copyright      2026  Xiaomi Corporation
+ *
+ * See LICENSE for clarification regarding multiple authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef K2_CSRC_IMPLICIT_TOPO_H_
+#define K2_CSRC_IMPLICIT_TOPO_H_
+
+#include "k2/csrc/array.h"
+#include "k2/csrc/fsa.h"
+#include "k2/csrc/ragged.h"
+
+namespace k2 {
+
+enum class ImplicitTopoType {
+  kCtc,          // as CtcTopo(c, max_token, false, ...)
+  kModifiedCtc,  // as CtcTopo(c, max_token, true, ...)
+  kTrivial,      // as TrivialGraph(c, max_token, ...)
+};
+
+/*
+  A decoding graph whose arcs are computed from their index instead of being
+  stored.  The standard CTC topology has (max_token + 1) * (max_token + 2)
+  arcs, which for a vocabulary of 5000 tokens is 25 million arcs (400 MB);
+  decoding with an ImplicitTopo needs only O(max_token) memory for the
+  row_splits of its shape.
+
+  The arcs (and their indexes, so arc maps are the same) are those of the
+  corresponding materialized graph; see ImplicitTopoType.  All the arc scores
+  are 0.
+*/
+struct ImplicitTopo {
+  ImplicitTopoType type;
+  int32_t max_token;
+
+  ImplicitTopo(ImplicitTopoType type, int32_t max_token)
+      : type(type), max_token(max_token) {}
+
+  __host__ __device__ __forceinline__ int32_t NumStates() const {
+    return type == ImplicitTopoType::kTrivial ? 2 : max_token + 2;
+  }
+
+  __host__ __device__ __forceinline__ int32_t NumArcs() const {
+    int32_t s = max_token + 2;
+    switch (type) {
+      case ImplicitTopoType::kCtc:
+        return (s - 1) * s;
+      case ImplicitTopoType::kModifiedCtc:
+        return (s - 1) * 2 + (s - 2) * 2;
+      default:
+        return max_token + 1;
+    }
+  }
+
+  // Returns the arc with index `arc_idx01`, 0 <= arc_idx01 < NumArcs().
+  __host__ __device__ __forceinline__ Arc GetArc(int32_t arc_idx01) const {
+    int32_t s = max_token + 2;
+    switch (type) {
+      case ImplicitTopoType::kCtc: {
+        int32_t i = arc_idx01 / s, j = arc_idx01 % s;
+        return Arc(i, j, j == s - 1 ? -1 : j, 0.0);
+      }
+      case ImplicitTopoType::kModifiedCtc: {
+        if (arc_idx01 < s - 1)  // self-loops of state 0
+          return Arc(0, 0, arc_idx01, 0.0);
+        if (arc_idx01 < (s - 1) * 2) {  // the other arcs leaving state 0
+          int32_t dest_state = arc_idx01 - (s - 1) + 1;
+          return Arc(0, dest_state, dest_state == s - 1 ? -1 : dest_state,
+                     0.0);
+        }
+        int32_t bias = arc_idx01 - (s - 1) * 2, state = bias / 2 + 1;
+        return Arc(state, (bias % 2) ? 0 : state, state, 0.0);
+      }
+      default:
+        if (arc_idx01 == max_token) return Arc(0, 1, -1, 0.0);
+        return Arc(0, 0, arc_idx01 + 1, 0.0);
+    }
+  }
+
+  // Returns the aux_label (olabel) of arc `arc_idx01`, i.e. the aux_labels
+  // output by CtcTopo() or TrivialGraph().
+  __host__ __device__ __forceinline__ int32_t GetAuxLabel(
+      int32_t arc_idx01) const {
+    int32_t s = max_token + 2;
+    switch (type) {
+      case ImplicitTopoType::kCtc: {
+        int32_t i = arc_idx01 / s, j = arc_idx01 % s;
+        return i == j ? 0 : (j == s - 1 ? -1 : j);
+      }
+      case ImplicitTopoType::kModifiedCtc:
+        return arc_idx01 < (s - 1) * 2 ? GetArc(arc_idx01).label : 0;
+      default:
+        return GetArc(arc_idx01).label;
+    }
+  }
+
+  /* Returns the shape of this graph as an FsaVec with one FSA, i.e. with 3
+     axes.  Only its row_splits are set (row_ids are computed on demand), so
+     it takes O(max_token) memory.
+   */
+  RaggedShape Shape(ContextPtr c) const;
+};
+
+/*
+  Returns the aux_labels of arcs of `topo`.
+
+     @param [in] topo  The graph.
+     @param [in] arc_map  Indexes of arcs of `topo`, e.g. the arc_map_a
+                    output by IntersectDensePruned().  Entries that are -1
+                    are allowed.
+     @return  Returns an array with ans[i] = topo.GetAuxLabel(arc_map[i]),
+              or -1 if arc_map[i] == -1.
+ */
+Array1<int32_t> ImplicitTopoAuxLabels(const ImplicitTopo &topo,
+                                      const Array1<int32_t> &arc_map);
+
+}  // namespace k2
+
+#endif  // K2_CSRC_IMPLICIT_TOPO_H_
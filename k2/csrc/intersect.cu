@@ -20,6 +20,7 @@
 #include <cooperative_groups.h>
 #endif
 
+#include <atomic>
 #include <limits>
 #include <vector>
 
@@ -42,7 +43,8 @@ struct StateInfo {
 };
 
 struct ArcInfo {
-  int32_t a_arc_idx012;  // The idx012 of the source arc in a_fsas_.
+  int32_t a_arc_idx012;  // The idx012 of the source arc in a_fsas_ (w.r.t.
+                         // a_shape_, see DeviceIntersector).
   int32_t b_arc_idx012;  // The idx012 of the source arc in b_fsas_.
   // Note: other fields, e.g. the label and score, can be worked
   // out from the arc-indexes.
@@ -62,11 +64,183 @@ os << "ArcInfo{" << a.a_arc_idx012 << "," << a.b_arc_idx012 << "}";
 }
 */
 
+// Returns the value of *address before atomically adding `value` to it.
+__host__ __device__ __forceinline__ int32_t AtomicFetchAdd(int32_t *address,
+                                                           int32_t value) {
+#ifdef __CUDA_ARCH__
+  return atomicAdd(address, value);
+#else
+  int32_t old = *address;
+  while (!HostAtomicCompareExchange(address, &old, old + value)) {
+  }
+  return old;
+#endif
+}
+
+// Reads *address from memory, for values written by other threads of the
+// kernel that is running.
+__host__ __device__ __forceinline__ int32_t LoadVolatile(
+    const int32_t *address) {
+  return *static_cast<const volatile int32_t *>(address);
+}
+
+// Makes the memory writes of this thread so far visible to other threads
+// before its later ones.
+__host__ __device__ __forceinline__ void ThreadFence() {
+#ifdef __CUDA_ARCH__
+  __threadfence();
+#else
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+#endif
+}
+
+/*
+  Gives access to the arcs of an FsaVec as if AddEpsilonSelfLoops() had been
+  called on it (if `self_loops` is true; otherwise just to its arcs), without
+  materializing the self-loops.  Arc indexes are w.r.t. the shape with the
+  self-loops (see GetSelfLoopsShape()), whose row_splits2 is `row_splits2`;
+  `fsas_row_splits2` is that of the FsaVec itself.
+ */
+struct ArcsAccessor {
+  const Arc *arcs;
+  const int32_t *row_splits1;
+  const int32_t *row_ids1;
+  const int32_t *row_splits2;
+  const int32_t *fsas_row_splits2;
+  bool self_loops;
+
+  // Returns the index in the FsaVec of the arc numbered `arc_idx012` leaving
+  // state `state_idx01`, or -1 if it is a self-loop.
+  __host__ __device__ __forceinline__ int32_t FsasArcIdx(
+      int32_t state_idx01, int32_t arc_idx012) const {
+    if (!self_loops) return arc_idx012;
+    int32_t arc_idx01x = row_splits2[state_idx01],
+            fsas_arc_idx01x = fsas_row_splits2[state_idx01],
+            // num_loops is 1, except for final-states.
+        num_loops = (row_splits2[state_idx01 + 1] - arc_idx01x) -
+                    (fsas_row_splits2[state_idx01 + 1] - fsas_arc_idx01x),
+            arc_idx2 = arc_idx012 - arc_idx01x;
+    return (arc_idx2 < num_loops ? -1
+                                 : fsas_arc_idx01x + arc_idx2 - num_loops);
+  }
+
+  // Returns the arc numbered `arc_idx012` leaving state `state_idx01`.
+  __host__ __device__ __forceinline__ Arc operator()(int32_t state_idx01,
+                                                     int32_t arc_idx012) const {
+    if (!self_loops) return arcs[arc_idx012];
+    int32_t fsas_arc_idx012 = FsasArcIdx(state_idx01, arc_idx012);
+    if (fsas_arc_idx012 >= 0) return arcs[fsas_arc_idx012];
+    int32_t state_idx1 = state_idx01 - row_splits1[row_ids1[state_idx01]];
+    return Arc(state_idx1, state_idx1, 0, 0.0);
+  }
+};
 
 }  // namespace intersect_internal
 
 using namespace intersect_internal;  // NOLINT
 
+/*
+  Returns the shape that `fsas` would have after AddEpsilonSelfLoops(), i.e.
+  with one more arc leaving each state other than the final-states.
+ */
+static RaggedShape GetSelfLoopsShape(FsaVec &fsas) {
+  NVTX_RANGE(K2_FUNC);
+  ContextPtr &c = fsas.Context();
+  int32_t num_states = fsas.TotSize(1);
+  Array1<int32_t> row_splits2(c, num_states + 1);
+  const int32_t *row_splits1_data = fsas.RowSplits(1).Data(),
+                *row_ids1_data = fsas.RowIds(1).Data(),
+                *fsas_row_splits2_data = fsas.RowSplits(2).Data();
+  int32_t *row_splits2_data = row_splits2.Data();
+  K2_EVAL(
+      c, num_states, lambda_set_num_arcs, (int32_t state_idx01)->void {
+        int32_t fsa_idx0 = row_ids1_data[state_idx01];
+        bool is_final = (state_idx01 + 1 == row_splits1_data[fsa_idx0 + 1]);
+        row_splits2_data[state_idx01] =
+            fsas_row_splits2_data[state_idx01 + 1] -
+            fsas_row_splits2_data[state_idx01] + (is_final ? 0 : 1);
+      });
+  ExclusiveSum(row_splits2, &row_splits2);
+  RaggedShape layer2 = RaggedShape2(&row_splits2, nullptr, -1);
+  return ComposeRaggedShapes(GetLayer(fsas.shape, 0), layer2);
+}
+
+/*
+  Works out cheap upper bounds on the number of states and arcs in the result
+  of intersecting b_fsas with a_fsas (see DeviceIntersector).  For the i'th
+  FSA in b_fsas, intersected with FSA a = b_to_a_map[i], each output arc pairs
+  an arc of b with one of at most max-out-degree(a) arcs of a (and vice
+  versa), and each output state other than the start state and the final
+  state is the dest-state of an output arc, so:
+
+     num_arcs <= min(num_arcs(b) * max_degree(a), num_arcs(a) * max_degree(b))
+     num_states <= min(num_states(a) * num_states(b), num_arcs + 2).
+
+  It only needs the shapes of the FSAs, `a_fsas` and `b_fsas`.
+
+    @param [out] num_states  The bound on the total number of output states.
+    @param [out] num_arcs    The bound on the total number of output arcs.
+ */
+// Caps on the bounds from EstimateIntersectionSize() that DeviceIntersector
+// sizes things from, as the bounds may be very loose.
+constexpr int32_t kMaxEstimatedStates = 1 << 24;
+constexpr int32_t kMaxEstimatedArcs = 1 << 26;
+
+static void EstimateIntersectionSize(RaggedShape &a_fsas, RaggedShape &b_fsas,
+                                     const Array1<int32_t> &b_to_a_map,
+                                     int64_t *num_states, int64_t *num_arcs) {
+  NVTX_RANGE(K2_FUNC);
+  ContextPtr &c = a_fsas.Context();
+  Array1<int32_t> max_degree_a(c, a_fsas.Dim0()),
+      max_degree_b(c, b_fsas.Dim0());
+  for (int32_t n = 0; n < 2; ++n) {
+    RaggedShape &fsas = (n == 0 ? a_fsas : b_fsas);
+    int32_t num_fsa_states = fsas.TotSize(1);
+    Array1<int32_t> degrees(c, num_fsa_states);
+    const int32_t *row_splits2_data = fsas.RowSplits(2).Data();
+    int32_t *degrees_data = degrees.Data();
+    K2_EVAL(
+        c, num_fsa_states, lambda_set_degrees, (int32_t i)->void {
+          degrees_data[i] = row_splits2_data[i + 1] - row_splits2_data[i];
+        });
+    Ragged<int32_t> degrees_ragged(GetLayer(fsas, 0), degrees);
+    MaxPerSublist(degrees_ragged, 0,
+                  n == 0 ? &max_degree_a : &max_degree_b);
+  }
+
+  int32_t num_fsas = b_fsas.Dim0();
+  Array1<int64_t> states_bound(c, num_fsas), arcs_bound(c, num_fsas);
+  const int32_t *a_row_splits1_data = a_fsas.RowSplits(1).Data(),
+                *a_row_splits2_data = a_fsas.RowSplits(2).Data(),
+                *b_row_splits1_data = b_fsas.RowSplits(1).Data(),
+                *b_row_splits2_data = b_fsas.RowSplits(2).Data(),
+                *b_to_a_map_data = b_to_a_map.Data(),
+                *max_degree_a_data = max_degree_a.Data(),
+                *max_degree_b_data = max_degree_b.Data();
+  int64_t *states_bound_data = states_bound.Data(),
+          *arcs_bound_data = arcs_bound.Data();
+  K2_EVAL(
+      c, num_fsas, lambda_set_bounds, (int32_t b_idx0)->void {
+        int32_t a_idx0 = b_to_a_map_data[b_idx0],
+                a_state_begin = a_row_splits1_data[a_idx0],
+                a_state_end = a_row_splits1_data[a_idx0 + 1],
+                b_state_begin = b_row_splits1_data[b_idx0],
+                b_state_end = b_row_splits1_data[b_idx0 + 1];
+        int64_t a_states = a_state_end - a_state_begin,
+                b_states = b_state_end - b_state_begin,
+                a_arcs = a_row_splits2_data[a_state_end] -
+                         a_row_splits2_data[a_state_begin],
+                b_arcs = b_row_splits2_data[b_state_end] -
+                         b_row_splits2_data[b_state_begin],
+                arcs = min(b_arcs * max_degree_a_data[a_idx0],
+                           a_arcs * max_degree_b_data[b_idx0]);
+        arcs_bound_data[b_idx0] = arcs;
+        states_bound_data[b_idx0] = min(a_states * b_states, arcs + 2);
+      });
+  *num_states = Sum(states_bound);
+  *num_arcs = Sum(arcs_bound);
+}
+
 /*
    Intersection (a.k.a. composition) that corresponds to decoding for
    speech recognition-type tasks.
@@ -93,16 +267,42 @@ class DeviceIntersector {
        @param [in] sorted_match_a  If true, the arcs of a_fsas arcs must be sorted
                            by label (checked by calling code via properties), and
                            we'll use a matching approach that requires this.
+       @param [in] sorted_match_b  Only relevant if sorted_match_a is true.
+                           If true, the arcs of b_fsas must be sorted by
+                           label too, and for each state-pair we'll
+                           binary-search the arcs of whichever of the two
+                           states has more arcs, so the time taken is
+                           proportional to the smaller out-degree (times a log
+                           factor) plus the number of matched arcs.
+       @param [in] use_queue  If true, use ForwardQueue(), which processes
+                           the state-pairs from a queue rather than in
+                           iterations, if the output sizes can be bounded;
+                           see ForwardQueue().
+       @param [in] estimate_sizes  If true, size the hash and the output
+                           arrays up front from the upper bounds given by
+                           EstimateIntersectionSize(), so they do not need
+                           to be grown (and copied) while we intersect,
+                           unless the bounds exceed kMaxEstimatedStates or
+                           kMaxEstimatedArcs.
+       @param [in] a_self_loops  If true, we intersect as if epsilon
+                           self-loops had been added to a_fsas with
+                           AddEpsilonSelfLoops(); see ArcsAccessor.
 
      Does not fully check its args (see wrapping code).  After constructing this object,
      call Intersect() and then FormatOutput().
    */
   DeviceIntersector(FsaVec &a_fsas, FsaVec &b_fsas,
                     const Array1<int32_t> &b_to_a_map,
-                    bool sorted_match_a):
+                    bool sorted_match_a, bool sorted_match_b = false,
+                    bool estimate_sizes = false, bool use_queue = false,
+                    bool a_self_loops = false):
       c_(a_fsas.Context()),
       a_fsas_(a_fsas),
+      a_shape_(a_self_loops ? GetSelfLoopsShape(a_fsas) : a_fsas.shape),
+      a_self_loops_(a_self_loops),
       sorted_match_a_(sorted_match_a),
+      sorted_match_b_(sorted_match_a && sorted_match_b),
+      use_queue_(use_queue),
       b_fsas_(b_fsas),
       b_to_a_map_(b_to_a_map),
       a_states_multiple_(b_fsas_.TotSize(1) | 1) {
@@ -122,11 +322,28 @@ class DeviceIntersector {
         min_hash_size = 1 << 16;
     if (hash_size < min_hash_size)
       hash_size = min_hash_size;
-    // caution: also use hash_size in FirstIter() as default size of various arrays.
+    initial_num_states_ = hash_size;
+    initial_num_arcs_ = hash_size;
+    if (estimate_sizes) {
+      int64_t num_states, num_arcs;
+      EstimateIntersectionSize(a_shape_, b_fsas_.shape, b_to_a_map_,
+                               &num_states, &num_arcs);
+      num_states = std::min<int64_t>(num_states, kMaxEstimatedStates);
+      num_arcs = std::min<int64_t>(num_arcs, kMaxEstimatedArcs);
+      // 4 times the number of states, to respect the max load factor.
+      hash_size = std::max<int32_t>(
+          hash_size, 4 * RoundUpToNearestPowerOfTwo(num_states));
+      initial_num_states_ = num_states;
+      initial_num_arcs_ = num_arcs;
+    }
     int32_t num_value_bits = std::max<int32_t>(NumBitsNeededFor(hash_size - 1),
                                                64 - num_key_bits);
     state_pair_to_state_ = Hash(c_, hash_size, num_key_bits,
                                 num_value_bits);
+    // Keep the hash at most 1/4 full, going by the actual number of state
+    // pairs in it; see PossiblyResizeHash().
+    state_pair_to_state_.TrackNumElements();
+    state_pair_to_state_.SetMaxLoadFactor(0.25);
 
 
     K2_CHECK(c_->IsCompatible(*b_fsas.Context()));
@@ -136,15 +353,14 @@ class DeviceIntersector {
 
   void FirstIter() {
     NVTX_RANGE(K2_FUNC);
-    int32_t initial_size = state_pair_to_state_.NumBuckets();
-    arcs_row_ids_ = Array1<int32_t>(c_, initial_size);
+    arcs_row_ids_ = Array1<int32_t>(c_, initial_num_arcs_);
     arcs_row_ids_.Resize(0, true);
-    arcs_ = Array1<ArcInfo>(c_, initial_size);
+    arcs_ = Array1<ArcInfo>(c_, initial_num_arcs_);
     arcs_.Resize(0, true);
 
     int32_t num_fsas = b_fsas_.Dim0();
 
-    states_ = Array1<StateInfo>(c_, initial_size);
+    states_ = Array1<StateInfo>(c_, initial_num_states_);
 
     Renumbering renumber_initial_states(c_, num_fsas);
 
@@ -210,10 +426,12 @@ class DeviceIntersector {
      output; the output is provided when you call FormatOutput(). */
   void Intersect() {
     FirstIter();
-    if (sorted_match_a_)
-      ForwardSortedA();
-    else
-      Forward();
+    if (!use_queue_ || !ForwardQueue()) {
+      if (sorted_match_a_)
+        ForwardSortedA();
+      else
+        Forward();
+    }
     LastIter();
   }
 
@@ -226,7 +444,9 @@ class DeviceIntersector {
 
          @param [out] arc_map_a_out  If non-NULL, the map from (arc-index of
                                   returned FsaVec) to (arc-index in a_fsas_)
-                                  will be written to here.
+                                  will be written to here; it is -1 for
+                                  arcs that used a self-loop of a_fsas_
+                                  (see a_self_loops in the constructor).
          @param [out] arc_map_b_out  If non-NULL, the map from (arc-index of
                                   returned FsaVec) to (arc-index in b_fsas_)
                                   will be written to here.
@@ -236,15 +456,12 @@ class DeviceIntersector {
   FsaVec FormatOutput(Array1<int32_t> *arc_map_a_out,
                       Array1<int32_t> *arc_map_b_out) {
     NVTX_RANGE(K2_FUNC);
-    int32_t num_key_bits = state_pair_to_state_.NumKeyBits(),
-        num_value_bits = state_pair_to_state_.NumValueBits();
-    if (num_key_bits + num_value_bits == 64) {
-      return FormatOutputTpl<Hash::GenericAccessor>(arc_map_a_out,
-                                                    arc_map_b_out);
-    } else {
-      return FormatOutputTpl<Hash::PackedAccessor>(arc_map_a_out,
-                                                   arc_map_b_out);
-    }
+    // FormatOutputTpl() only does lookups, so we don't specialize it on the
+    // number of key bits.
+    return DispatchAccessor<>(state_pair_to_state_, [&](auto tag) -> FsaVec {
+      return FormatOutputTpl<typename decltype(tag)::type>(arc_map_a_out,
+                                                           arc_map_b_out);
+    });
   }
 
   template <typename AccessorT>
@@ -340,8 +557,9 @@ class DeviceIntersector {
     Array1<int32_t> states_old2new = InvertPermutation(states_new2old);
 
     ArcInfo *arc_info_data = arcs_.Data();
-    const Arc *a_arcs_data = a_fsas_.values.Data(),
-              *b_arcs_data = b_fsas_.values.Data();
+    ArcsAccessor a_arcs = AArcs();
+    const Arc *b_arcs_data = b_fsas_.values.Data();
+    const int32_t *arcs_row_ids_data = arcs_row_ids_.Data();
     Arc *arcs_out_data = ans_values.Data();
     const int32_t *arcs_new2old_data = arcs_new2old.Data(),
                 *states_new2old_data = states_new2old.Data(),
@@ -364,10 +582,15 @@ class DeviceIntersector {
               old_arc_idx012 = arcs_new2old_data[new_arc_idx012];
 
         ArcInfo info = arc_info_data[old_arc_idx012];
-        int32_t fsa_idx0 = ans_shape_row_ids1[new_src_state_idx01];
-        Arc a_arc = a_arcs_data[info.a_arc_idx012],
+        int32_t fsa_idx0 = ans_shape_row_ids1[new_src_state_idx01],
+                a_src_state_idx01 =
+                    states_data[arcs_row_ids_data[old_arc_idx012]]
+                        .a_fsas_state_idx01;
+        Arc a_arc = a_arcs(a_src_state_idx01, info.a_arc_idx012),
             b_arc = b_arcs_data[info.b_arc_idx012];
-        if (arc_map_a_data) arc_map_a_data[new_arc_idx012] = info.a_arc_idx012;
+        if (arc_map_a_data)
+          arc_map_a_data[new_arc_idx012] =
+              a_arcs.FsasArcIdx(a_src_state_idx01, info.a_arc_idx012);
         if (arc_map_b_data) arc_map_b_data[new_arc_idx012] = info.b_arc_idx012;
 
         int32_t new_dest_state_idx01;  // index of the dest_state w.r.t
@@ -432,7 +655,7 @@ class DeviceIntersector {
 
       auto num_arcs_acc = num_arcs.Accessor();
       StateInfo *states_data = states_.Data();
-      const int32_t *a_fsas_row_splits2_data = a_fsas_.RowSplits(2).Data(),
+      const int32_t *a_fsas_row_splits2_data = a_shape_.RowSplits(2).Data(),
           *b_fsas_row_splits2_data = b_fsas_.RowSplits(2).Data();
 
       K2_EVAL(c_, num_states, lambda_find_num_arcs, (int32_t i) -> void {
@@ -466,21 +689,12 @@ class DeviceIntersector {
       // The following is a bound on how big we might need the hash to be, assuming
       // all arc-pairs match, which of course they won't, but it's safe.  For large
       // problems you should be using sorted_match_a=true.
-      PossiblyResizeHash(4 * (states_.Dim() + tot_ab),
-                         states_.Dim() + tot_ab);
-
-      int32_t num_key_bits = state_pair_to_state_.NumKeyBits(),
-          num_value_bits = state_pair_to_state_.NumValueBits();
-      if (num_key_bits == 32 && num_value_bits == 32) {
-        ForwardOneIter<Hash::Accessor<32> >(t, tot_ab, num_arcs_b,
-                                            row_splits_ab);
-      } else if (num_key_bits + num_value_bits == 64) {
-        ForwardOneIter<Hash::GenericAccessor>(t, tot_ab, num_arcs_b,
-                                              row_splits_ab);
-      } else {
-        ForwardOneIter<Hash::PackedAccessor>(t, tot_ab, num_arcs_b,
-                                             row_splits_ab);
-      }
+      PossiblyResizeHash(tot_ab, states_.Dim() + tot_ab);
+
+      DispatchAccessor<32>(state_pair_to_state_, [&](auto tag) -> void {
+        ForwardOneIter<typename decltype(tag)::type>(t, tot_ab, num_arcs_b,
+                                                     row_splits_ab);
+      });
     }
   }
   /*
@@ -513,8 +727,8 @@ class DeviceIntersector {
     int32_t state_begin = iter_to_state_row_splits_cpu_[t],
         state_end = iter_to_state_row_splits_cpu_[t + 1];
 
-    const Arc *a_arcs_data = a_fsas_.values.Data(),
-        *b_arcs_data = b_fsas_.values.Data();
+    ArcsAccessor a_arcs = AArcs();
+    const Arc *b_arcs_data = b_fsas_.values.Data();
 
     int32_t key_bits = state_pair_to_state_.NumKeyBits(),
         a_states_multiple = a_states_multiple_,
@@ -548,7 +762,7 @@ class DeviceIntersector {
     Renumbering arcs_newstates_renumbering(c_, tot_ab * 2);
     char *keep_arc_data = arcs_newstates_renumbering.Keep().Data(),
         *new_dest_state_data = keep_arc_data + tot_ab;
-    const int32_t *a_fsas_row_splits2 = a_fsas_.RowSplits(2).Data(),
+    const int32_t *a_fsas_row_splits2 = a_shape_.RowSplits(2).Data(),
         *b_fsas_row_splits2 = b_fsas_.RowSplits(2).Data();
     StateInfo *states_data = states_.Data();
     K2_EVAL(c_, tot_ab, lambda_set_keep_arc_newstate, (int32_t i) -> void {
@@ -569,11 +783,11 @@ class DeviceIntersector {
             b_arc_idx012 = b_arc_idx01x + b_arc_idx2;
         // Not treating epsilons specially here, see documentation for
         // IntersectDevice() in [currently] fsa_algo.h.
-        int keep_arc = (a_arcs_data[a_arc_idx012].label ==
-                        b_arcs_data[b_arc_idx012].label);
+        Arc a_arc = a_arcs(sinfo.a_fsas_state_idx01, a_arc_idx012);
+        int keep_arc = (a_arc.label == b_arcs_data[b_arc_idx012].label);
         keep_arc_data[i] = (char)keep_arc;
         int new_dest_state = 0;
-        if (keep_arc && a_arcs_data[a_arc_idx012].label != -1) {
+        if (keep_arc && a_arc.label != -1) {
           // investigate whether the dest-state is new (not currently allocated
           // a state-id).  We don't allocate ids for the final-state, so skip this
           // if label is -1.
@@ -581,7 +795,7 @@ class DeviceIntersector {
           int32_t b_dest_state_idx1 = b_arcs_data[b_arc_idx012].dest_state,
               b_dest_state_idx01 = b_dest_state_idx1 + sinfo.b_fsas_state_idx01 -
               b_arcs_data[b_arc_idx012].src_state,
-              a_dest_state_idx1 = a_arcs_data[a_arc_idx012].dest_state;
+              a_dest_state_idx1 = a_arc.dest_state;
           uint64_t hash_key = (((uint64_t)a_dest_state_idx1) * a_states_multiple) +
               b_dest_state_idx01, hash_value = i;
           // If it was successfully inserted, then this arc is assigned
@@ -641,14 +855,14 @@ class DeviceIntersector {
             a_arc_idx012 = a_arc_idx01x + a_arc_idx2,
             b_arc_idx012 = b_arc_idx01x + b_arc_idx2;
         Arc b_arc = b_arcs_data[b_arc_idx012],
-            a_arc = a_arcs_data[a_arc_idx012];
+            a_arc = a_arcs(src_sinfo.a_fsas_state_idx01, a_arc_idx012);
         K2_DCHECK_EQ(a_arc.label, b_arc.label);
 
         int32_t b_dest_state_idx1 = b_arcs_data[b_arc_idx012].dest_state,
             b_dest_state_idx01 = b_dest_state_idx1 + src_sinfo.b_fsas_state_idx01 -
             b_arcs_data[b_arc_idx012].src_state,
             b_fsa_idx0 = b_fsas_row_ids1_data[b_dest_state_idx01],
-            a_dest_state_idx1 = a_arcs_data[a_arc_idx012].dest_state,
+            a_dest_state_idx1 = a_arc.dest_state,
             a_dest_state_idx01 = a_fsas_row_splits1_data[b_to_a_map_data[b_fsa_idx0]] +
             a_dest_state_idx1;
         uint64_t hash_key = (((uint64_t)a_dest_state_idx1) * a_states_multiple) +
@@ -711,7 +925,7 @@ class DeviceIntersector {
             a_arc_idx012 = a_arc_idx01x + a_arc_idx2,
             b_arc_idx012 = b_arc_idx01x + b_arc_idx2;
         Arc b_arc = b_arcs_data[b_arc_idx012],
-            a_arc = a_arcs_data[a_arc_idx012];
+            a_arc = a_arcs(src_sinfo.a_fsas_state_idx01, a_arc_idx012);
         K2_DCHECK_EQ(a_arc.label, b_arc.label);
 
         //int32_t dest_state_idx = -1;
@@ -719,7 +933,7 @@ class DeviceIntersector {
           int32_t b_dest_state_idx1 = b_arcs_data[b_arc_idx012].dest_state,
               b_dest_state_idx01 = b_dest_state_idx1 + src_sinfo.b_fsas_state_idx01 -
               b_arcs_data[b_arc_idx012].src_state,
-              a_dest_state_idx1 = a_arcs_data[a_arc_idx012].dest_state;
+              a_dest_state_idx1 = a_arc.dest_state;
           uint64_t hash_key = (((uint64_t)a_dest_state_idx1) * a_states_multiple) +
               b_dest_state_idx01;
 
@@ -740,19 +954,18 @@ class DeviceIntersector {
   }
 
   /*
-    This function ensures that the hash `state_pair_to_state_` has an array
-    with at least `min_num_buckets` buckets, and NumValueBits() large enough to contain
-    at least `min_supported_values` values
+    This function ensures that the hash `state_pair_to_state_` has enough
+    buckets to accept `num_new_elements` more key/value pairs while staying
+    within its maximum load factor, and NumValueBits() large enough to contain
+    at least `min_supported_values` values.  The load factor is computed from
+    the number of elements the hash actually contains, which it keeps track of
+    itself.
 
     The number of bits allocated for the key will not be changed (this was
     set to the required value in the constructor).
 
-      @param [in] min_num_buckets  The minimum number of buckets required;
-                    the actual number chosen will be a power of 2 that is >=
-                    min_num_buckets.  CAUTION: this number should be
-                    considerably larger than the maximum number of key/value
-                    pairs you might want to store in the hash (or it will get
-                    too full).
+      @param [in] num_new_elements  An upper bound on the number of key/value
+                    pairs that will be inserted before the next call.
       @param [in] min_supported_values  The user declares that the
                     hash must have enough bits allocated to values that
                     it can store values 0 <= v < min_supported_values.
@@ -762,25 +975,324 @@ class DeviceIntersector {
                     allowed as a value if (1<<num_key_bits)-1 is allowed as a key,
                     which condition we are too lazy to check.
    */
-  void PossiblyResizeHash(int32_t min_num_buckets,
+  void PossiblyResizeHash(int32_t num_new_elements,
                           int32_t min_supported_values) {
     NVTX_RANGE(K2_FUNC);
-    K2_CHECK_GE(min_num_buckets, 0);
+    K2_CHECK_GE(num_new_elements, 0);
     int32_t cur_num_buckets = state_pair_to_state_.NumBuckets(),
         cur_num_key_bits = state_pair_to_state_.NumKeyBits(),
         cur_num_value_bits = state_pair_to_state_.NumValueBits(),
-        num_buckets = std::max<int32_t>(
-            RoundUpToNearestPowerOfTwo(min_num_buckets),
-            cur_num_buckets),
         num_value_bits = std::max<int32_t>(
             NumBitsNeededFor(min_supported_values),
             cur_num_value_bits);
-    if (num_value_bits != cur_num_value_bits ||
-        num_buckets != cur_num_buckets) {
-      state_pair_to_state_.Resize(num_buckets,
+    if (num_value_bits != cur_num_value_bits) {
+      state_pair_to_state_.Resize(cur_num_buckets,
                                   cur_num_key_bits,
                                   num_value_bits);
     }
+    state_pair_to_state_.PossiblyGrow(num_new_elements);
+  }
+
+  /*
+    Does the same as Forward() or ForwardSortedA() (depending on
+    sorted_match_a_ and sorted_match_b_), but without proceeding in
+    iterations, which for cyclic or deep inputs may be many, each needing a
+    few kernels and syncs with the host.  Instead, persistent threads take
+    the state-pairs from a queue (the array states_, to which they are
+    appended as the hash gives them ids) until it is empty, and the states
+    and arcs are put in the order FormatOutput() expects at the end.  This
+    needs the arrays and the hash to be sized up front from the bounds given
+    by EstimateIntersectionSize(), since they cannot be grown while the
+    threads run.
+
+    The states in the result are numbered differently, as each state except
+    the start-state is in the same (second) "iteration", and on GPU the order
+    of the states within it is not deterministic.
+
+      @return  Returns true on success, or false, having done nothing, if
+               the bounds are too large (see kMaxEstimatedStates and
+               kMaxEstimatedArcs), in which case the caller should use the
+               iterative version.
+   */
+  bool ForwardQueue() {
+    NVTX_RANGE(K2_FUNC);
+    int64_t max_states, max_arcs;
+    EstimateIntersectionSize(a_shape_, b_fsas_.shape, b_to_a_map_,
+                             &max_states, &max_arcs);
+    if (max_states > kMaxEstimatedStates || max_arcs > kMaxEstimatedArcs)
+      return false;
+    PossiblyResizeHash(max_states, max_states + 1);
+    DispatchAccessor<32>(state_pair_to_state_, [&](auto tag) -> void {
+      ForwardQueueTpl<typename decltype(tag)::type>(max_states, max_arcs);
+    });
+    return true;
+  }
+
+  /*
+    The part of ForwardQueue() that needs to be templated on the hash
+    accessor type; `max_states` and `max_arcs` are the bounds on the number
+    of states (excluding the final-states) and arcs.
+   */
+  template <typename HashAccessorT>
+  void ForwardQueueTpl(int32_t max_states, int32_t max_arcs) {
+    NVTX_RANGE(K2_FUNC);
+    int32_t num_initial_states = states_.Dim();
+    K2_CHECK_LE(num_initial_states, max_states);
+    // The states that have not been created yet have a_fsas_state_idx01 ==
+    // -1; threads that take them from the queue wait until it is set.
+    states_.Resize(max_states);
+    StateInfo *states_data = states_.Data();
+    K2_EVAL(
+        c_, max_states - num_initial_states, lambda_init_states,
+        (int32_t i)->void {
+          states_data[num_initial_states + i] = StateInfo{-1, -1};
+        });
+    // The arcs leaving each state are written to arcs_ contiguously, at
+    // state_arcs_begin[state_idx].
+    Array1<ArcInfo> arcs(c_, max_arcs);
+    Array1<int32_t> state_arcs_begin(c_, max_states),
+        state_num_arcs(c_, max_states);
+    ArcInfo *arcs_data = arcs.Data();
+    int32_t *state_arcs_begin_data = state_arcs_begin.Data(),
+            *state_num_arcs_data = state_num_arcs.Data();
+
+    // counters[0] is the index of the next state to be taken from the queue,
+    // counters[1] the number of states created, counters[2] the number of
+    // states processed and counters[3] the number of arcs.
+    Array1<int32_t> counters(c_,
+                             std::vector<int32_t>{0, num_initial_states, 0, 0});
+    int32_t *counters_data = counters.Data();
+
+    HashAccessorT state_pair_to_state_acc =
+        state_pair_to_state_.GetAccessor<HashAccessorT>();
+    ArcsAccessor a_arcs = AArcs(), b_arcs = BArcs();
+    const int32_t *a_fsas_row_splits2_data = a_shape_.RowSplits(2).Data(),
+                  *b_fsas_row_splits2_data = b_fsas_.RowSplits(2).Data();
+    int32_t a_states_multiple = a_states_multiple_;
+    bool sorted_match_a = sorted_match_a_, sorted_match_b = sorted_match_b_;
+
+    // On CPU a single thread processes the whole queue.  On GPU we start
+    // enough threads to fill the device; a thread only waits for states
+    // being created by threads that are running, so this cannot deadlock
+    // even if not all of them are resident.
+    int32_t num_threads = 1;
+#ifdef K2_WITH_CUDA
+    if (c_->GetDeviceType() == kCuda) {
+      int32_t num_sms = 0;
+      K2_CUDA_SAFE_CALL(cudaDeviceGetAttribute(
+          &num_sms, cudaDevAttrMultiProcessorCount, c_->GetDeviceId()));
+      num_threads = std::max<int32_t>(num_sms, 1) * 1024;
+    }
+#endif
+    K2_EVAL(
+        c_, num_threads, lambda_process_queue, (int32_t)->void {
+          while (true) {
+            int32_t state_idx = AtomicFetchAdd(counters_data, 1);
+            // Wait until this state has been created, or until all the
+            // states have been processed, in which case no more can be
+            // created.  counters[2] is read first: if it equals the number
+            // of states created after it, nothing was being processed.
+            while (true) {
+              int32_t num_done = LoadVolatile(counters_data + 2);
+              ThreadFence();
+              int32_t num_created = LoadVolatile(counters_data + 1);
+              if (state_idx < num_created) {
+                if (LoadVolatile(&states_data[state_idx].a_fsas_state_idx01)
+                    >= 0)
+                  break;
+              } else if (num_done == num_created) {
+                return;
+              }
+            }
+            ThreadFence();
+            StateInfo *info = states_data + state_idx;
+            int32_t a_state_idx01 = LoadVolatile(&info->a_fsas_state_idx01),
+                    b_state_idx01 = LoadVolatile(&info->b_fsas_state_idx01),
+                    a_begin = a_fsas_row_splits2_data[a_state_idx01],
+                    a_end = a_fsas_row_splits2_data[a_state_idx01 + 1],
+                    b_begin = b_fsas_row_splits2_data[b_state_idx01],
+                    b_end = b_fsas_row_splits2_data[b_state_idx01 + 1];
+            // As in ForwardSortedA(), we go through the arcs on the "probe"
+            // side and look for arcs with the same label on the other side,
+            // which (if sorted_match_a) is arc-sorted.
+            bool probe_a =
+                (sorted_match_b && a_end - a_begin < b_end - b_begin);
+            int32_t probe_begin = (probe_a ? a_begin : b_begin),
+                    probe_end = (probe_a ? a_end : b_end),
+                    other_begin = (probe_a ? b_begin : a_begin),
+                    other_end = (probe_a ? b_end : a_end);
+            const ArcsAccessor &probe_arcs = (probe_a ? a_arcs : b_arcs),
+                               &other_arcs = (probe_a ? b_arcs : a_arcs);
+            int32_t probe_state_idx01 = (probe_a ? a_state_idx01
+                                                 : b_state_idx01),
+                    other_state_idx01 = (probe_a ? b_state_idx01
+                                                 : a_state_idx01);
+
+            // On the first pass we count the arcs, so we can reserve
+            // contiguous space for them; on the second we write them.
+            int32_t num_arcs = 0, arc_idx = 0;
+            for (int32_t pass = 0; pass < 2; ++pass) {
+              if (pass == 1) {
+                if (num_arcs == 0) break;
+                arc_idx = AtomicFetchAdd(counters_data + 3, num_arcs);
+                K2_CHECK_LE(arc_idx + num_arcs, max_arcs);
+              }
+              for (int32_t p = probe_begin; p < probe_end; ++p) {
+                uint32_t label = static_cast<uint32_t>(
+                    probe_arcs(probe_state_idx01, p).label);
+                int32_t o = other_begin;
+                if (sorted_match_a) {
+                  // Find the first arc with a label >= `label`.
+                  int32_t end = other_end;
+                  while (o < end) {
+                    int32_t mid = (o + end) / 2;
+                    if (static_cast<uint32_t>(
+                            other_arcs(other_state_idx01, mid).label) < label)
+                      o = mid + 1;
+                    else
+                      end = mid;
+                  }
+                }
+                for (; o < other_end; ++o) {
+                  if (static_cast<uint32_t>(
+                          other_arcs(other_state_idx01, o).label) != label) {
+                    if (sorted_match_a) break;
+                    continue;
+                  }
+                  if (pass == 0) {
+                    ++num_arcs;
+                    continue;
+                  }
+                  int32_t a_arc_idx012 = (probe_a ? p : o),
+                          b_arc_idx012 = (probe_a ? o : p);
+                  Arc a_arc = a_arcs(a_state_idx01, a_arc_idx012),
+                      b_arc = b_arcs(b_state_idx01, b_arc_idx012);
+                  // We don't allocate state-ids for the final-states here;
+                  // see LastIter().
+                  if (a_arc.label != -1) {
+                    int32_t b_dest_state_idx01 =
+                                b_arc.dest_state + b_state_idx01 -
+                                b_arc.src_state,
+                            a_dest_state_idx1 = a_arc.dest_state;
+                    uint64_t hash_key =
+                        ((uint64_t)a_dest_state_idx1) * a_states_multiple +
+                        b_dest_state_idx01;
+                    uint64_t *hash_key_value_location = nullptr;
+                    if (state_pair_to_state_acc.Insert(
+                            hash_key, 0, nullptr, &hash_key_value_location)) {
+                      // This arc is responsible for creating its dest-state
+                      // and adding it to the queue.
+                      int32_t new_state_idx =
+                          AtomicFetchAdd(counters_data + 1, 1);
+                      K2_CHECK_LT(new_state_idx, max_states);
+                      state_pair_to_state_acc.SetValue(
+                          hash_key_value_location, hash_key, new_state_idx);
+                      int32_t a_dest_state_idx01 =
+                          a_dest_state_idx1 + a_state_idx01 - a_arc.src_state;
+                      states_data[new_state_idx].b_fsas_state_idx01 =
+                          b_dest_state_idx01;
+                      ThreadFence();
+                      *static_cast<volatile int32_t *>(
+                          &states_data[new_state_idx].a_fsas_state_idx01) =
+                          a_dest_state_idx01;
+                    }
+                  }
+                  arcs_data[arc_idx++] = ArcInfo{a_arc_idx012, b_arc_idx012};
+                }
+              }
+            }
+            state_arcs_begin_data[state_idx] = arc_idx - num_arcs;
+            state_num_arcs_data[state_idx] = num_arcs;
+            ThreadFence();
+            AtomicFetchAdd(counters_data + 2, 1);
+          }
+        });
+
+    Array1<int32_t> cpu_counters = counters.To(GetCpuContext());
+    int32_t num_states = cpu_counters[1];
+    states_.Resize(num_states);
+    state_num_arcs = state_num_arcs.Arange(0, num_states);
+
+    // FormatOutput() needs the states of each "iteration" to be sorted by
+    // FSA index.  The start-states are the first iteration, as from
+    // FirstIter(); we sort the others by FSA index (stably, so in the
+    // order they were created) and make them the second iteration.
+    int32_t num_other_states = num_states - num_initial_states,
+            num_fsas = b_fsas_.Dim0();
+    Array1<int32_t> states_new2old = Range(c_, num_states, 0);
+    if (num_other_states > 0) {
+      Array1<int32_t> fsa_idx(c_, num_other_states);
+      int32_t *fsa_idx_data = fsa_idx.Data();
+      const int32_t *b_fsas_row_ids1_data = b_fsas_.RowIds(1).Data();
+      K2_EVAL(
+          c_, num_other_states, lambda_get_fsa_idx, (int32_t i)->void {
+            fsa_idx_data[i] = b_fsas_row_ids1_data
+                [states_data[num_initial_states + i].b_fsas_state_idx01];
+          });
+      Ragged<int32_t> fsa_idx_ragged(
+          RegularRaggedShape(c_, 1, num_other_states), fsa_idx);
+      Array1<int32_t> order = GetTransposeReordering(fsa_idx_ragged, num_fsas),
+                      dest = states_new2old.Arange(num_initial_states,
+                                                   num_states);
+      const int32_t *order_data = order.Data();
+      int32_t *dest_data = dest.Data();
+      K2_EVAL(
+          c_, num_other_states, lambda_set_new2old, (int32_t i)->void {
+            dest_data[i] = num_initial_states + order_data[i];
+          });
+    }
+    states_ = states_[states_new2old];
+    states_data = states_.Data();
+
+    // Replace the state-ids in the hash with the new ones.
+    const int32_t *b_fsas_row_ids1_data = b_fsas_.RowIds(1).Data(),
+                  *b_to_a_map_data = b_to_a_map_.Data(),
+                  *a_fsas_row_splits1_data = a_fsas_.RowSplits(1).Data();
+    K2_EVAL(
+        c_, num_other_states, lambda_renumber_hash, (int32_t i)->void {
+          int32_t state_idx = num_initial_states + i;
+          StateInfo info = states_data[state_idx];
+          int32_t fsa_idx0 = b_fsas_row_ids1_data[info.b_fsas_state_idx01],
+                  a_state_idx1 =
+                      info.a_fsas_state_idx01 -
+                      a_fsas_row_splits1_data[b_to_a_map_data[fsa_idx0]];
+          uint64_t hash_key =
+              ((uint64_t)a_state_idx1) * a_states_multiple +
+              info.b_fsas_state_idx01;
+          uint64_t value, *hash_key_value_location = nullptr;
+          bool ans = state_pair_to_state_acc.Find(hash_key, &value,
+                                                  &hash_key_value_location);
+          K2_CHECK(ans);
+          state_pair_to_state_acc.SetValue(hash_key_value_location, hash_key,
+                                           state_idx);
+        });
+
+    // Put the arcs in the order of their source states.
+    Array1<int32_t> arcs_row_splits(c_, num_states + 1);
+    int32_t *arcs_row_splits_data = arcs_row_splits.Data();
+    const int32_t *states_new2old_data = states_new2old.Data();
+    K2_EVAL(
+        c_, num_states, lambda_get_num_arcs, (int32_t i)->void {
+          arcs_row_splits_data[i] = state_num_arcs_data[states_new2old_data[i]];
+        });
+    ExclusiveSum(arcs_row_splits, &arcs_row_splits);
+    int32_t num_arcs = arcs_row_splits.Back();
+    arcs_row_ids_ = Array1<int32_t>(c_, num_arcs);
+    RowSplitsToRowIds(arcs_row_splits, &arcs_row_ids_);
+    arcs_ = Array1<ArcInfo>(c_, num_arcs);
+    ArcInfo *new_arcs_data = arcs_.Data();
+    const int32_t *arcs_row_ids_data = arcs_row_ids_.Data();
+    K2_EVAL(
+        c_, num_arcs, lambda_reorder_arcs, (int32_t arc_idx)->void {
+          int32_t state_idx = arcs_row_ids_data[arc_idx],
+                  old_state_idx = states_new2old_data[state_idx],
+                  arc_idx1 = arc_idx - arcs_row_splits_data[state_idx];
+          new_arcs_data[arc_idx] =
+              arcs_data[state_arcs_begin_data[old_state_idx] + arc_idx1];
+        });
+
+    if (num_other_states > 0)
+      iter_to_state_row_splits_cpu_.push_back(num_states);
   }
 
   void ForwardSortedA() {
@@ -797,49 +1309,59 @@ class DeviceIntersector {
         break;
       }
       // We need to process output-states numbered state_begin..state_end-1.
-      // num_arcs_b will contain the number of arcs leaving the state in b_fsas_,
-      // i.e. the state with index StateInfo::b_fsas_state_idx01.
-      Array1<int32_t> num_arcs_b(c_, num_states + 1);
-      int32_t *num_arcs_b_data = num_arcs_b.Data();
+      // For each state-pair we go through the arcs leaving one of its two
+      // states (the "probe" side) and binary-search the arcs leaving the
+      // other, which must be arc-sorted, for each label.  The probe side is
+      // b, unless sorted_match_b_ is true and the state in a has fewer arcs,
+      // so that the work is proportional to the smaller of the two
+      // out-degrees (times a log factor) plus the number of matched arcs.
+      // num_probe_arcs will contain the number of arcs leaving the state on
+      // the probe side; probe_a is 1 if that is the state in a_fsas_.
+      Array1<int32_t> num_probe_arcs(c_, num_states + 1);
+      int32_t *num_probe_arcs_data = num_probe_arcs.Data();
+      Array1<char> probe_a(c_, num_states);
+      char *probe_a_data = probe_a.Data();
 
       StateInfo *states_data = states_.Data();
-      const int32_t *a_fsas_row_splits2_data = a_fsas_.RowSplits(2).Data(),
+      const int32_t *a_fsas_row_splits2_data = a_shape_.RowSplits(2).Data(),
           *b_fsas_row_splits2_data = b_fsas_.RowSplits(2).Data();
+      bool sorted_match_b = sorted_match_b_;
 
-      K2_EVAL(c_, num_states, lambda_find_num_arcs_b, (int32_t i) -> void {
+      K2_EVAL(c_, num_states, lambda_find_num_probe_arcs, (int32_t i) -> void {
         int32_t state_idx = state_begin + i;
         StateInfo info = states_data[state_idx];
-        int32_t b_fsas_state_idx01 = info.b_fsas_state_idx01,
-            b_start_arc = b_fsas_row_splits2_data[b_fsas_state_idx01],
-            b_end_arc =  b_fsas_row_splits2_data[b_fsas_state_idx01 + 1],
-            b_num_arcs = b_end_arc - b_start_arc;
-        num_arcs_b_data[i] = b_num_arcs;
+        int32_t a_fsas_state_idx01 = info.a_fsas_state_idx01,
+            b_fsas_state_idx01 = info.b_fsas_state_idx01,
+            a_num_arcs = a_fsas_row_splits2_data[a_fsas_state_idx01 + 1] -
+                         a_fsas_row_splits2_data[a_fsas_state_idx01],
+            b_num_arcs = b_fsas_row_splits2_data[b_fsas_state_idx01 + 1] -
+                         b_fsas_row_splits2_data[b_fsas_state_idx01];
+        char this_probe_a = (sorted_match_b && a_num_arcs < b_num_arcs);
+        probe_a_data[i] = this_probe_a;
+        num_probe_arcs_data[i] = (this_probe_a ? a_num_arcs : b_num_arcs);
         });
 
-      ExclusiveSum(num_arcs_b, &num_arcs_b);
-      int32_t num_b_arcs = num_arcs_b.Back();
+      ExclusiveSum(num_probe_arcs, &num_probe_arcs);
+      int32_t tot_probe_arcs = num_probe_arcs.Back();
 
-      Array1<int32_t> b_arc_to_state(c_, num_b_arcs);
-      RowSplitsToRowIds(num_arcs_b, &b_arc_to_state);
-      int32_t *b_arc_to_state_data = b_arc_to_state.Data();
+      Array1<int32_t> probe_arc_to_state(c_, tot_probe_arcs);
+      RowSplitsToRowIds(num_probe_arcs, &probe_arc_to_state);
+      int32_t *probe_arc_to_state_data = probe_arc_to_state.Data();
 
       /*
-        We now know, for each state-pair we need to
-        process, the total number of arcs leaving the state in b.
-        We need to figure out the range of matching arcs leaving
-        the state in a.
+        We now know, for each state-pair we need to process, the total
+        number of arcs leaving the state on the probe side.  We need to
+        figure out the range of matching arcs leaving the state on the other
+        side.
       */
-      Array1<int32_t> first_matching_a_arc_idx012(c_, num_b_arcs);
-      int32_t *first_matching_a_arc_idx012_data =
-          first_matching_a_arc_idx012.Data();
+      Array1<int32_t> first_matching_arc_idx012(c_, tot_probe_arcs);
+      int32_t *first_matching_arc_idx012_data =
+          first_matching_arc_idx012.Data();
       // The + 1 is because we'll do an exclusive sum.
-      Array1<int32_t> num_matching_a_arcs(c_, num_b_arcs + 1);
-      int32_t *num_matching_a_arcs_data = num_matching_a_arcs.Data();
+      Array1<int32_t> num_matching_arcs(c_, tot_probe_arcs + 1);
+      int32_t *num_matching_arcs_data = num_matching_arcs.Data();
 
-      const Arc *a_arcs_data = a_fsas_.values.Data(),
-          *b_arcs_data = b_fsas_.values.Data();
-      int32_t key_bits = state_pair_to_state_.NumKeyBits(),
-          value_bits = state_pair_to_state_.NumValueBits();
+      ArcsAccessor a_arcs = AArcs(), b_arcs = BArcs();
 
       if (c_->GetDeviceType() == kCuda) {
 #ifdef K2_WITH_CUDA
@@ -848,7 +1370,7 @@ class DeviceIntersector {
             thread_group_size = (1 << log_thread_group_size);  // 4
         static_assert(thread_group_size > 1, "Bad thread_group_size");
         // the "* 2" below is because pairs of thread groups handle the
-        // (beginning, end) of ranges of arcs in a_fsas_; and we need
+        // (beginning, end) of ranges of matching arcs; and we need
         // these groups to be within the same warp so we can sync them.
         static_assert(thread_group_size * 2 <= 32,
                       "thread_group_size too large");
@@ -862,45 +1384,61 @@ class DeviceIntersector {
           // thread_group_type is 0 if we're finding the beginning of the range
           // of matching arcs, and 1 if we're finding the end of the range of
           // matching arcs.
-          // 0 <= idx01 < num_b_arcs is an index into the list of arcs we're
-          // processing; the array's shape has (row_splits,row_ids) ==
-          // (num_arcs_b, b_arc_to-state).
+          // 0 <= idx01 < tot_probe_arcs is an index into the list of arcs
+          // we're processing; the array's shape has (row_splits,row_ids) ==
+          // (num_probe_arcs, probe_arc_to_state).
           int32_t arc_idx01 = idx01_doubled / 2,
               thread_group_type = idx01_doubled % 2;
 
-          // the idx01 is into the list of arcs in b that we're processing.
+          // the idx01 is into the list of probe arcs that we're processing.
           // 0 <= state_idx0 < num_states.
-          int32_t state_idx0 = b_arc_to_state_data[arc_idx01],
-              arc_idx1x = num_arcs_b_data[state_idx0],
+          int32_t state_idx0 = probe_arc_to_state_data[arc_idx01],
+              arc_idx1x = num_probe_arcs_data[state_idx0],
               arc_idx1 = arc_idx01 - arc_idx1x;
           // state_idx is an index into states_.
           int32_t state_idx = state_begin + state_idx0;
           StateInfo info = states_data[state_idx];
-          int32_t b_begin_arc_idx01x = b_fsas_row_splits2_data[info.b_fsas_state_idx01],
-              b_arc_idx012 = b_begin_arc_idx01x + arc_idx1;
-          // ignore the apparent name mismatch setting b_arc_idx012 above;
-          // arc_idx1 is an idx1 w.r.t. a different array than b_fsas_.
-          K2_DCHECK_LT(b_arc_idx012, b_fsas_row_splits2_data[info.b_fsas_state_idx01+1]);
-
-          int32_t a_begin_arc_idx012 = a_fsas_row_splits2_data[info.a_fsas_state_idx01],
-              a_end_arc_idx012 = a_fsas_row_splits2_data[info.a_fsas_state_idx01 + 1];
+          bool this_probe_a = (probe_a_data[state_idx0] != 0);
+          int32_t probe_state_idx01 = (this_probe_a ? info.a_fsas_state_idx01
+                                                    : info.b_fsas_state_idx01),
+              other_state_idx01 = (this_probe_a ? info.b_fsas_state_idx01
+                                                : info.a_fsas_state_idx01);
+          const int32_t *probe_row_splits2_data =
+              (this_probe_a ? a_fsas_row_splits2_data
+                            : b_fsas_row_splits2_data),
+              *other_row_splits2_data =
+                  (this_probe_a ? b_fsas_row_splits2_data
+                                : a_fsas_row_splits2_data);
+          const ArcsAccessor &probe_arcs = (this_probe_a ? a_arcs : b_arcs),
+              &other_arcs = (this_probe_a ? b_arcs : a_arcs);
+          int32_t probe_begin_arc_idx01x =
+                      probe_row_splits2_data[probe_state_idx01],
+              probe_arc_idx012 = probe_begin_arc_idx01x + arc_idx1;
+          // ignore the apparent name mismatch setting probe_arc_idx012 above;
+          // arc_idx1 is an idx1 w.r.t. a different array than the FSAs.
+          K2_DCHECK_LT(probe_arc_idx012,
+                       probe_row_splits2_data[probe_state_idx01 + 1]);
+
+          int32_t begin_arc_idx012 = other_row_splits2_data[other_state_idx01],
+              end_arc_idx012 = other_row_splits2_data[other_state_idx01 + 1];
 
           int32_t thread_idx = g.thread_rank(),
               num_threads = g.size();  // = thread_group_size.
 
           // We convert to uint64_t so we can add 1 without wrapping around;
           // this way, even-numbered thread groups (i.e. groups of size
-          // thread_group_size) find the beginning of the range of arcs in a,
-          // and odd-numbered thread groups find the end of the range of arcs.
+          // thread_group_size) find the beginning of the range of matching
+          // arcs, and odd-numbered thread groups find the end of the range.
           uint64_t label = static_cast<uint64_t>(static_cast<uint32_t>(
-                                        b_arcs_data[b_arc_idx012].label)) +
+                               probe_arcs(probe_state_idx01,
+                                          probe_arc_idx012).label)) +
                            static_cast<uint64_t>(thread_group_type);
 
           // We are now searching for the lowest arc-index i in the range
-          // a_begin_arc_idx012 <= i <= a_end_arc_idx012, where
-          // arcs_data[i].label >= `label`, where we treat the labels of arcs
-          // indexed i >= a_end_arc_idx012 as infinitely large.
-          int32_t range_len = a_end_arc_idx012 - a_begin_arc_idx012,  // > 0
+          // begin_arc_idx012 <= i <= end_arc_idx012, where
+          // other_arcs_data[i].label >= `label`, where we treat the labels of
+          // arcs indexed i >= end_arc_idx012 as infinitely large.
+          int32_t range_len = end_arc_idx012 - begin_arc_idx012,  // > 0
               log_range_len = 31 - __clz(range_len | 1),
                   num_iters = 1 + log_range_len / log_thread_group_size;
 
@@ -909,7 +1447,7 @@ class DeviceIntersector {
           //  0 <= range_len < 4  -> num_iters is 1
           //  4 <= range_len < 16  -> num_iters is 2
           // Note: at 4 and 16, we need num_iters to be (2,3)
-          // respectively because a_end_arc_idx012 is a value we need
+          // respectively because end_arc_idx012 is a value we need
           // to include in the search.
 
 
@@ -918,14 +1456,14 @@ class DeviceIntersector {
           // At this point, the group of threads is searching an interval
           // [interval_start ... interval_start+(per_thread_range*thread_group_size)].
           // for the lowest index i such that
-          //   (i>= a_end_arc_idx012 ? UINT64_MAX : (uint32_t)a_arcs_data[i]) >= label
-          // and such an i must exist in this range because the range includes a_end_arc_idx012
+          //   (i>= end_arc_idx012 ? UINT64_MAX : (uint32_t)other_arcs_data[i]) >= label
+          // and such an i must exist in this range because the range includes end_arc_idx012
           // (checked in K2_DCHECK below)
           int32_t per_thread_range =  1 << ((num_iters - 1) * log_thread_group_size); // > 0
-          int32_t interval_start = a_begin_arc_idx012;
+          int32_t interval_start = begin_arc_idx012;
 
           K2_DCHECK_GT(interval_start + per_thread_range * thread_group_size,
-                       a_end_arc_idx012);
+                       end_arc_idx012);
 
           while (per_thread_range > 0) {
             // this_thread_start is the beginning of the range of arcs that this
@@ -935,14 +1473,15 @@ class DeviceIntersector {
                 this_thread_last = this_thread_start + per_thread_range - 1;
             // last_label is the label on the last arc in the range that this
             // thread is responsible for.  We ensure that the range of arcs
-            // we are searching (which, remember, includes a_end_arc_idx012)
+            // we are searching (which, remember, includes end_arc_idx012)
             // always have at least one arc whose label (taken as +infty
             // for out-of-range arcs) is >= `label`.  So `last_label` for
             // the last thread will always be >= `label`.
-            uint64_t last_label = (this_thread_last >= a_end_arc_idx012 ?
+            uint64_t last_label = (this_thread_last >= end_arc_idx012 ?
                                     static_cast<uint64_t>(-1) :
                                     static_cast<uint64_t>(static_cast<uint32_t>(
-                                        a_arcs_data[this_thread_last].label))),
+                                        other_arcs(other_state_idx01,
+                                                   this_thread_last).label))),
                 prev_last_label = g.shfl_up(last_label, 1);
             // Note: prev_last_label is the last_label for the previous thread,
             // and it's a don't-care value which will be ignored if this
@@ -963,7 +1502,7 @@ class DeviceIntersector {
           // OK, now all threads in the group should share the variable
           // `interval_start`.  We construct a thread_block_tile of double
           // the size, so we can broadcast the lower and upper bounds of
-          // the range of matching arcs in a (look above for "thread_group_type"
+          // the range of matching arcs (look above for "thread_group_type"
           // for more explanation).
           cg::thread_block_tile<thread_group_size*2>
             g_double = cg::tiled_partition<thread_group_size*2>(cg::this_thread_block());
@@ -975,118 +1514,120 @@ class DeviceIntersector {
 
             if (g_double.thread_rank() == 0) {  // equiv. to:
                                                 // (thread_group_type == 0)
-              /*
-              K2_DCHECK_LE(lower_bound, upper_bound);
-              K2_DCHECK_LE(a_begin_arc_idx012, lower_bound);
-              K2_DCHECK_LE(upper_bound, a_end_arc_idx012);
-              K2_DCHECK(lower_bound == a_end_arc_idx012 ||
-                        a_arcs_data[lower_bound].label >= label);
-              K2_DCHECK(lower_bound == a_begin_arc_idx012 ||
-                        a_arcs_data[lower_bound - 1].label < label);
-              K2_DCHECK(upper_bound == a_end_arc_idx012 ||
-                uint32_t(a_arcs_data[upper_bound].label) > uint32_t(label)); */
-              if (upper_bound != a_begin_arc_idx012) {
-                K2_DCHECK_LE(uint32_t(a_arcs_data[upper_bound - 1].label),
+              if (upper_bound != begin_arc_idx012) {
+                K2_DCHECK_LE(uint32_t(other_arcs(other_state_idx01,
+                                                 upper_bound - 1).label),
                              uint32_t(label));
               }
-              first_matching_a_arc_idx012_data[arc_idx01] = lower_bound;
+              first_matching_arc_idx012_data[arc_idx01] = lower_bound;
             } else {
               // g_double.thread_rank() == thread_group_size
-              num_matching_a_arcs_data[arc_idx01] = upper_bound - lower_bound;
+              num_matching_arcs_data[arc_idx01] = upper_bound - lower_bound;
             }
           }
         };
         EvalGroupDevice<thread_group_size, int32_t>(
-            c_, num_b_arcs * 2, lambda_find_ranges);
+            c_, tot_probe_arcs * 2, lambda_find_ranges);
 #else
         K2_LOG(FATAL) << "Unreachable code";
 #endif
       } else {
         // Use regular binary search.
-        K2_EVAL(c_, num_b_arcs, lambda_find_ranges_cpu, (int32_t arc_idx01) -> void {
-            // the idx01 is into the list of arcs in b that we're processing..
+        K2_EVAL(c_, tot_probe_arcs, lambda_find_ranges_cpu, (int32_t arc_idx01) -> void {
+            // the idx01 is into the list of probe arcs that we're processing..
             // 0 <= state_idx0 < num_states.
             // state_idx is an index into states_.
-            int32_t state_idx0 = b_arc_to_state_data[arc_idx01],
-                arc_idx1x = num_arcs_b_data[state_idx0],
+            int32_t state_idx0 = probe_arc_to_state_data[arc_idx01],
+                arc_idx1x = num_probe_arcs_data[state_idx0],
                 arc_idx1 = arc_idx01 - arc_idx1x,
                 state_idx = state_begin + state_idx0;
             StateInfo info = states_data[state_idx];
-            int32_t
-                b_begin_arc_idx01x = b_fsas_row_splits2_data[info.b_fsas_state_idx01],
-                b_arc_idx012 = b_begin_arc_idx01x + arc_idx1;
-            // ignore the apparent name mismatch setting b_arc_idx012 above;
-            // arc_idx1 is an idx1 w.r.t. a different array than b_fsas_.
-            K2_DCHECK_LT(b_arc_idx012, b_fsas_row_splits2_data[info.b_fsas_state_idx01 + 1]);
-            int32_t a_begin_arc_idx012 = a_fsas_row_splits2_data[info.a_fsas_state_idx01],
-                a_end_arc_idx012 = a_fsas_row_splits2_data[info.a_fsas_state_idx01 + 1];
-            uint32_t label = static_cast<uint32_t>(b_arcs_data[b_arc_idx012].label);
-
-            int32_t begin = a_begin_arc_idx012,
-                end = a_end_arc_idx012;
+            bool this_probe_a = (probe_a_data[state_idx0] != 0);
+            int32_t probe_state_idx01 =
+                        (this_probe_a ? info.a_fsas_state_idx01
+                                      : info.b_fsas_state_idx01),
+                other_state_idx01 = (this_probe_a ? info.b_fsas_state_idx01
+                                                  : info.a_fsas_state_idx01);
+            const int32_t *probe_row_splits2_data =
+                (this_probe_a ? a_fsas_row_splits2_data
+                              : b_fsas_row_splits2_data),
+                *other_row_splits2_data =
+                (this_probe_a ? b_fsas_row_splits2_data
+                              : a_fsas_row_splits2_data);
+            const ArcsAccessor &probe_arcs = (this_probe_a ? a_arcs
+                                                           : b_arcs),
+                &other_arcs = (this_probe_a ? b_arcs : a_arcs);
+            int32_t probe_begin_arc_idx01x =
+                        probe_row_splits2_data[probe_state_idx01],
+                probe_arc_idx012 = probe_begin_arc_idx01x + arc_idx1;
+            // ignore the apparent name mismatch setting probe_arc_idx012
+            // above; arc_idx1 is an idx1 w.r.t. a different array than the
+            // FSAs.
+            K2_DCHECK_LT(probe_arc_idx012,
+                         probe_row_splits2_data[probe_state_idx01 + 1]);
+            int32_t begin_arc_idx012 =
+                        other_row_splits2_data[other_state_idx01],
+                end_arc_idx012 = other_row_splits2_data[other_state_idx01 + 1];
+            uint32_t label = static_cast<uint32_t>(
+                probe_arcs(probe_state_idx01, probe_arc_idx012).label);
+
+            int32_t begin = begin_arc_idx012,
+                end = end_arc_idx012;
             // We are looking for the first index begin <= i < end such that
-            //     a_arcs[i].label >= label.
+            //     other_arcs[i].label >= label.
             while (begin < end) {
               int32_t mid = (begin + end) / 2;
               assert(mid < end);  // temp?
-              uint32_t a_label = uint32_t(a_arcs_data[mid].label);
-              if (a_label < label) {
+              uint32_t other_label =
+                  uint32_t(other_arcs(other_state_idx01, mid).label);
+              if (other_label < label) {
                 begin = mid + 1;
               } else {
                 end = mid;
               }
             }
-            if (begin < a_end_arc_idx012) {
-              K2_CHECK_GE((uint32_t)a_arcs_data[begin].label, label);
+            if (begin < end_arc_idx012) {
+              K2_CHECK_GE(
+                  (uint32_t)other_arcs(other_state_idx01, begin).label, label);
             }
-            if (begin - 1 > a_begin_arc_idx012) {
-              K2_CHECK_LT((uint32_t)a_arcs_data[begin-1].label, label);
+            if (begin - 1 > begin_arc_idx012) {
+              K2_CHECK_LT(
+                  (uint32_t)other_arcs(other_state_idx01, begin - 1).label,
+                  label);
             }
 
-            // "range_begin" is the "begin" of the possibly-empty range of arc-indexes
-            // in a that matches `label`
+            // "range_begin" is the "begin" of the possibly-empty range of
+            // arc-indexes on the other side that matches `label`
             int32_t range_begin = begin, range_end = begin;
             // The following linear search will probably be faster than
             // logarithmic search in the normal case where there are not many
             // matching arcs.  In the unusual case where there are many matching
             // arcs per state, it won't dominate the running time of the entire
             // algorithm.
-            while (range_end < a_end_arc_idx012 &&
-                   uint32_t(a_arcs_data[range_end].label) == label)
+            while (range_end < end_arc_idx012 &&
+                   uint32_t(other_arcs(other_state_idx01, range_end).label) ==
+                       label)
               range_end++;
-            first_matching_a_arc_idx012_data[arc_idx01] = range_begin;
-            num_matching_a_arcs_data[arc_idx01] = range_end - range_begin;
+            first_matching_arc_idx012_data[arc_idx01] = range_begin;
+            num_matching_arcs_data[arc_idx01] = range_end - range_begin;
           });
       }
 
-      ExclusiveSum(num_matching_a_arcs, &num_matching_a_arcs);
-      int32_t tot_matched_arcs = num_matching_a_arcs.Back();
+      ExclusiveSum(num_matching_arcs, &num_matching_arcs);
+      int32_t tot_matched_arcs = num_matching_arcs.Back();
 
       {
         int32_t max_possible_states = states_.Dim() + tot_matched_arcs;
-        PossiblyResizeHash(4 * max_possible_states,
-                           max_possible_states);
+        PossiblyResizeHash(tot_matched_arcs, max_possible_states);
       }
 
 
-      int32_t num_key_bits = state_pair_to_state_.NumKeyBits(),
-          num_value_bits = state_pair_to_state_.NumValueBits();
-      if (num_key_bits == 32 && num_value_bits == 32) {
-        ForwardSortedAOneIter<Hash::Accessor<32> >(
-            t, num_arcs_b, b_arc_to_state,
-            num_matching_a_arcs, first_matching_a_arc_idx012,
-            tot_matched_arcs);
-      } else if (num_key_bits + num_value_bits == 64) {
-        ForwardSortedAOneIter<Hash::GenericAccessor>(
-            t, num_arcs_b, b_arc_to_state,
-            num_matching_a_arcs, first_matching_a_arc_idx012,
-            tot_matched_arcs);
-      } else {
-        ForwardSortedAOneIter<Hash::PackedAccessor>(
-            t, num_arcs_b, b_arc_to_state,
-            num_matching_a_arcs, first_matching_a_arc_idx012,
+      DispatchAccessor<32>(state_pair_to_state_, [&](auto tag) -> void {
+        ForwardSortedAOneIter<typename decltype(tag)::type>(
+            t, num_probe_arcs, probe_arc_to_state, probe_a,
+            num_matching_arcs, first_matching_arc_idx012,
             tot_matched_arcs);
-      }
+      });
     }
   }
 
@@ -1097,47 +1638,54 @@ class DeviceIntersector {
 
       @param [in] t    The iteration index >= 0, representing the batch of
                        states that we are processing arcs leaving from.
-      @param [in] num_arcs_b_row_splits   An array of shape equal to
+      @param [in] num_probe_arcs_row_splits   An array of shape equal to
                        1 + num_states, where num_states is the number of
                        states we're processing on this iteration (see the
                        variable in the code), with is the exclusive-sum
-                       of the number of arcs leaving the states in b
-                       (from "b" members of the state-pair we're processing)
-      @param [in] b_arc_to_state   The result of turning `num_arcs_b_row_splits`
-                       into a row-ids array.  Each element corresponds to an arc
-                       in b_fsas_ that we are processing.
-      @param [in] matching_a_arcs_row_splits   An array of size b_arc_to_state.Dim() + 1,
-                       which is the exclusive sum of the number of matching arcs
-                       in a_fsas_ for a particular arc in b_fsas_ that we are
+                       of the number of arcs leaving the states on the probe
+                       side of the state-pairs we're processing
+      @param [in] probe_arc_to_state   The result of turning
+                       `num_probe_arcs_row_splits` into a row-ids array.  Each
+                       element corresponds to a probe arc that we are
                        processing.
-      @param [in] first_matching_a_arc_idx012  An array of size b_arc_to-state.Dim(),
-                       giving the index of the first matching arc in a_fsas_ that
-                       matches the corresponding arc in b_fsas_.
-      @param [in] tot_matched_arcs  Must equal matching_a_arcs_row_splits.Back()
+      @param [in] probe_a  An array of size num_states; 1 if the probe side
+                       of that state-pair is a_fsas_, 0 if it is b_fsas_.
+      @param [in] matching_arcs_row_splits   An array of size
+                       probe_arc_to_state.Dim() + 1, which is the exclusive
+                       sum of the number of arcs on the other side that match
+                       a particular probe arc.
+      @param [in] first_matching_arc_idx012  An array of size
+                       probe_arc_to_state.Dim(), giving the index of the first
+                       arc on the other side that matches the corresponding
+                       probe arc.
+      @param [in] tot_matched_arcs  Must equal matching_arcs_row_splits.Back()
    */
   template <typename HashAccessorT>
   void ForwardSortedAOneIter(
       int32_t t,
-      const Array1<int32_t> &num_arcs_b_row_splits,
-      const Array1<int32_t> &b_arc_to_state,
-      const Array1<int32_t> &matching_a_arcs_row_splits,
-      const Array1<int32_t> &first_matching_a_arc_idx012,
+      const Array1<int32_t> &num_probe_arcs_row_splits,
+      const Array1<int32_t> &probe_arc_to_state,
+      const Array1<char> &probe_a,
+      const Array1<int32_t> &matching_arcs_row_splits,
+      const Array1<int32_t> &first_matching_arc_idx012,
       int32_t tot_matched_arcs) {
       NVTX_RANGE(K2_FUNC);
 
       HashAccessorT state_pair_to_state_acc =
           state_pair_to_state_.GetAccessor<HashAccessorT>();
-      const Arc *a_arcs_data = a_fsas_.values.Data(),
-          *b_arcs_data = b_fsas_.values.Data();
+      ArcsAccessor a_arcs = AArcs();
+      const Arc *b_arcs_data = b_fsas_.values.Data();
       int32_t state_begin = iter_to_state_row_splits_cpu_[t],
           state_end = iter_to_state_row_splits_cpu_[t + 1],
           a_states_multiple = a_states_multiple_;
 
-      Array1<int32_t> matched_arc_to_b_arc(c_, tot_matched_arcs);
-      RowSplitsToRowIds(matching_a_arcs_row_splits, &matched_arc_to_b_arc);
-      const int32_t *matched_arc_to_b_arc_data = matched_arc_to_b_arc.Data(),
-          *b_arc_to_state_data = b_arc_to_state.Data(),
-          *num_arcs_b_row_splits_data = num_arcs_b_row_splits.Data();
+      Array1<int32_t> matched_arc_to_probe_arc(c_, tot_matched_arcs);
+      RowSplitsToRowIds(matching_arcs_row_splits, &matched_arc_to_probe_arc);
+      const int32_t
+          *matched_arc_to_probe_arc_data = matched_arc_to_probe_arc.Data(),
+          *probe_arc_to_state_data = probe_arc_to_state.Data(),
+          *num_probe_arcs_row_splits_data = num_probe_arcs_row_splits.Data();
+      const char *probe_a_data = probe_a.Data();
 
       Renumbering new_state_renumbering(c_, tot_matched_arcs);
       // We'll write '1' where the arc-pair leads to a new state (exactly one
@@ -1167,9 +1715,9 @@ class DeviceIntersector {
       Array1<int32_t> a_dest_state_idx01_temp(c_, tot_matched_arcs);
       int32_t *a_dest_state_idx01_temp_data = a_dest_state_idx01_temp.Data();
       const int32_t
-          *matching_a_arcs_row_splits_data = matching_a_arcs_row_splits.Data(),
-          *first_matching_a_arc_idx012_data = first_matching_a_arc_idx012.Data(),
-          *a_fsas_row_splits2_data = a_fsas_.RowSplits(2).Data(),
+          *matching_arcs_row_splits_data = matching_arcs_row_splits.Data(),
+          *first_matching_arc_idx012_data = first_matching_arc_idx012.Data(),
+          *a_fsas_row_splits2_data = a_shape_.RowSplits(2).Data(),
           *b_fsas_row_splits2_data = b_fsas_.RowSplits(2).Data();
 
 
@@ -1177,34 +1725,43 @@ class DeviceIntersector {
       K2_EVAL(c_, tot_matched_arcs, lambda_set_arcs_and_new_state, (int32_t idx012) -> void {
           // `idx012` is into an ragged tensor that we haven't physically
           // constructed, containing the new arcs we are adding on this frame;
-          // its shape's 1st layer is formed by (num_arcs_b, b_arc_to_state),
-          // and its 2nd layer is formed by (matching_a_arcs_row_splits,
-          // matched_arc_to_b_arc).
-          int32_t b_arc_idx01 = matched_arc_to_b_arc_data[idx012],
-              matched_arc_idx01x = matching_a_arcs_row_splits_data[b_arc_idx01],
+          // its shape's 1st layer is formed by (num_probe_arcs,
+          // probe_arc_to_state), and its 2nd layer is formed by
+          // (matching_arcs_row_splits, matched_arc_to_probe_arc).
+          int32_t probe_arc_idx01 = matched_arc_to_probe_arc_data[idx012],
+              matched_arc_idx01x =
+                  matching_arcs_row_splits_data[probe_arc_idx01],
               matched_arc_idx2 = idx012 - matched_arc_idx01x,
-              state_idx0 = b_arc_to_state_data[b_arc_idx01],
-              b_arc_idx0x = num_arcs_b_row_splits_data[state_idx0],
-              b_arc_idx1 = b_arc_idx01 - b_arc_idx0x;
+              state_idx0 = probe_arc_to_state_data[probe_arc_idx01],
+              probe_arc_idx0x = num_probe_arcs_row_splits_data[state_idx0],
+              probe_arc_idx1 = probe_arc_idx01 - probe_arc_idx0x;
 
           int32_t state_idx = state_begin + state_idx0; // into states_
           StateInfo sinfo = states_data[state_idx];
-          int32_t b_fsas_state_idx01 = sinfo.b_fsas_state_idx01,
-              b_begin_arc_idx01x = b_fsas_row_splits2_data[b_fsas_state_idx01],
-              b_arc_idx012 = b_begin_arc_idx01x + b_arc_idx1;
-          // ignore the apparent name mismatch setting b_arc_idx012; arc_idx1
-          // is an idx1 w.r.t. a different array than b_fsas_.
-          int32_t first_matching_a_arc_idx012 =
-              first_matching_a_arc_idx012_data[b_arc_idx01],
-              a_arc_idx012 = first_matching_a_arc_idx012 + matched_arc_idx2;
+          bool this_probe_a = (probe_a_data[state_idx0] != 0);
+          int32_t probe_state_idx01 = (this_probe_a ? sinfo.a_fsas_state_idx01
+                                                    : sinfo.b_fsas_state_idx01),
+              probe_begin_arc_idx01x =
+                  (this_probe_a ? a_fsas_row_splits2_data
+                                : b_fsas_row_splits2_data)[probe_state_idx01],
+              probe_arc_idx012 = probe_begin_arc_idx01x + probe_arc_idx1;
+          // ignore the apparent name mismatch setting probe_arc_idx012;
+          // probe_arc_idx1 is an idx1 w.r.t. a different array than the FSAs.
+          int32_t other_arc_idx012 =
+              first_matching_arc_idx012_data[probe_arc_idx01] +
+              matched_arc_idx2,
+              a_arc_idx012 = (this_probe_a ? probe_arc_idx012
+                                           : other_arc_idx012),
+              b_arc_idx012 = (this_probe_a ? other_arc_idx012
+                                           : probe_arc_idx012);
 
           Arc b_arc = b_arcs_data[b_arc_idx012],
-              a_arc = a_arcs_data[a_arc_idx012];
+              a_arc = a_arcs(sinfo.a_fsas_state_idx01, a_arc_idx012);
           K2_CHECK_EQ(b_arc.label, a_arc.label);
 
           char new_dest_state = 0;
           // int32_t dest_state_idx = -1;
-          if (a_arcs_data[a_arc_idx012].label != -1) {
+          if (a_arc.label != -1) {
             // investigate whether the dest-state is new (not currently
             // allocated a state-id).  We don't allocate state-ids for the
             // final-state yet, so skip this if label is -1.
@@ -1279,6 +1836,22 @@ class DeviceIntersector {
   }
 
 
+  // Returns the accessor for the arcs of a_fsas_ (see a_shape_).
+  ArcsAccessor AArcs() {
+    return ArcsAccessor{a_fsas_.values.Data(), a_fsas_.RowSplits(1).Data(),
+                        a_fsas_.RowIds(1).Data(), a_shape_.RowSplits(2).Data(),
+                        a_fsas_.RowSplits(2).Data(), a_self_loops_};
+  }
+
+  // Returns the accessor for the arcs of b_fsas_, so the code can treat
+  // both sides the same way.
+  ArcsAccessor BArcs() {
+    const int32_t *row_splits2 = b_fsas_.RowSplits(2).Data();
+    return ArcsAccessor{b_fsas_.values.Data(), b_fsas_.RowSplits(1).Data(),
+                        b_fsas_.RowIds(1).Data(), row_splits2, row_splits2,
+                        false};
+  }
+
   ~DeviceIntersector() {
     // Prevent crash in destructor of hash (at exit, it still contains values, by design).
     state_pair_to_state_.Destroy();
@@ -1288,10 +1861,20 @@ class DeviceIntersector {
   ContextPtr c_;
   FsaVec a_fsas_;  // a_fsas_: decoding graphs
                    // Note: a_fsas_ has 3 axes.
+  // The shape of a_fsas_, with the self-loops if a_self_loops_; the arc
+  // indexes of a_fsas_ we use (e.g. in ArcInfo) are w.r.t. this shape.
+  RaggedShape a_shape_;
+  bool a_self_loops_;  // If true, intersect as if a_fsas_ had epsilon
+                       // self-loops; see ArcsAccessor.
   bool sorted_match_a_;  // If true, we'll require a_fsas_ to be arc-sorted; and
                          // we'll use a matching approach that won't blow up in
                          // memory or time when a_fsas_ has states with very
                          // high out-degree.
+  bool sorted_match_b_;  // If true (only possible if sorted_match_a_), we'll
+                         // require b_fsas_ to be arc-sorted too, and match
+                         // from the side with fewer arcs; see
+                         // ForwardSortedA().
+  bool use_queue_;  // If true, we'll try ForwardQueue() first.
 
   FsaVec b_fsas_;
 
@@ -1341,6 +1924,10 @@ class DeviceIntersector {
   // hash value.
   int32_t a_states_multiple_;
 
+  // The initial capacities of states_ and arcs_ (and arcs_row_ids_).
+  int32_t initial_num_states_;
+  int32_t initial_num_arcs_;
+
   // This hash will also contain -1 as values in cases where the dest-state is a
   // final-state (these are allocated right at the beginning); and inside of
   // Forward() and ForwardSortedA() it will also contain temporary quantities
@@ -1356,8 +1943,12 @@ FsaVec IntersectDevice(FsaVec &a_fsas, int32_t properties_a,
                        const Array1<int32_t> &b_to_a_map,
                        Array1<int32_t> *arc_map_a,
                        Array1<int32_t> *arc_map_b,
-                       bool sorted_match_a) {
-  NVTX_RANGE("IntersectDevice");
+                       bool sorted_match_a,
+                       bool estimate_sizes /*= false*/,
+                       bool sorted_match_b /*= false*/,
+                       bool use_queue /*= false*/,
+                       bool a_self_loops /*= false*/) {
+  NVTX_RANGE_PAYLOAD("IntersectDevice", kIntersect, b_fsas.Dim0());
   K2_CHECK_NE(properties_a & kFsaPropertiesValid, 0);
   K2_CHECK_NE(properties_b & kFsaPropertiesValid, 0);
   if (sorted_match_a && ((properties_a & kFsaPropertiesArcSorted) == 0)) {
@@ -1365,14 +1956,21 @@ FsaVec IntersectDevice(FsaVec &a_fsas, int32_t properties_a,
         "must be arc-sorted, but (according to the properties) "
         "it is not.";
   }
+  if (sorted_match_a && sorted_match_b &&
+      ((properties_b & kFsaPropertiesArcSorted) == 0)) {
+    K2_LOG(FATAL) << "If you provide sorted_match_b=true, b_fsas "
+        "must be arc-sorted, but (according to the properties) "
+        "it is not.";
+  }
   K2_CHECK_EQ(a_fsas.NumAxes(), 3);
   K2_CHECK_EQ(b_fsas.NumAxes(), 3);
   K2_CHECK_EQ(b_to_a_map.Dim(), b_fsas.Dim0());
   K2_CHECK_LT(static_cast<uint32_t>(MaxValue(b_to_a_map)),
               static_cast<uint32_t>(a_fsas.Dim0()));
 
-  DeviceIntersector intersector(a_fsas, b_fsas, b_to_a_map,
-                                sorted_match_a);
+  DeviceIntersector intersector(a_fsas, b_fsas, b_to_a_map, sorted_match_a,
+                                sorted_match_b, estimate_sizes, use_queue,
+                                a_self_loops);
   intersector.Intersect();
   return intersector.FormatOutput(arc_map_a, arc_map_b);
 }
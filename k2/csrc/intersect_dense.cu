@@ -16,6 +16,8 @@
  * limitations under the License.
  */
 
+#include <algorithm>
+#include <cmath>
 #include <limits>
 #include <vector>
 
@@ -70,7 +72,8 @@ using namespace intersect_dense_internal;  // NOLINT
 /*
    Intersection (a.k.a. composition) that corresponds to decoding for
    speech recognition-type tasks.  This version does only forward-backward
-   pruning in the backward pass; the forward pass does no pruning.
+   pruning in the backward pass; the forward pass does no pruning, unless
+   a search beam is given (see `search_beam` in the constructor).
 
    Note:
        In `MultiGraphDenseIntersectPruned` a_fsas is shared if Dim0 = 1.
@@ -120,14 +123,29 @@ class MultiGraphDenseIntersect {
        @param [in] output_beam    Beam >0 for pruning output, i.e. arcs that are
                            not on a path within `output_beam` of the best path
                            will not be retained.
+       @param [in] memory_budget  If >0, approximate limit in bytes on the
+                           memory used for per-frame state information; if
+                           it would be exceeded we only keep the state scores
+                           of every checkpoint_interval_'th frame and
+                           recompute the rest in FormatOutput().  Ignored if
+                           search_beam > 0.
+       @param [in] search_beam  If >0, we are in pruned mode: on each step,
+                           forward (resp. backward) scores more than
+                           `search_beam` below the best forward (resp.
+                           backward) score of that FSA on that frame are
+                           pruned away, and only the scores that remain are
+                           stored.  See Intersect() for what happens if this
+                           loses the best path.
    */
   MultiGraphDenseIntersect(FsaVec &a_fsas, DenseFsaVec &b_fsas,
                            const Array1<int32_t> &a_to_b_map,
                            float output_beam, int32_t max_states,
-                           int32_t max_arcs)
+                           int32_t max_arcs, int64_t memory_budget = -1,
+                           float search_beam = 0)
       : a_fsas_(a_fsas), b_fsas_(b_fsas), a_to_b_map_(a_to_b_map),
         output_beam_(output_beam), max_states_(max_states),
-        max_arcs_(max_arcs) {
+        max_arcs_(max_arcs), checkpoint_interval_(0),
+        search_beam_(search_beam) {
     NVTX_RANGE(K2_FUNC);
     c_ = GetContext(a_fsas.shape, b_fsas.shape, a_to_b_map);
 
@@ -188,6 +206,20 @@ class MultiGraphDenseIntersect {
       // context is a CudaContext
     }
 
+    if (search_beam_ > 0) {
+      InitHalvesRowSplits();
+    } else if (memory_budget > 0) {
+      // The non-checkpointed code needs, per (frame, state) pair, the forward
+      // and backward scores plus about 17 bytes of temporaries in
+      // FormatOutput().  With checkpointing, memory is O(sqrt(T_)) instead of
+      // O(T_) frames.
+      int64_t bytes_needed = static_cast<int64_t>(25) * (T_ + 1) *
+                             a_fsas_.TotSize(1);
+      if (bytes_needed > memory_budget)
+        checkpoint_interval_ =
+            static_cast<int32_t>(std::ceil(std::sqrt(T_ + 1.0)));
+    }
+
     // set up steps_, which contains a bunch of meta-information about the steps
     // of the algorithm.
     InitSteps();
@@ -201,8 +233,33 @@ class MultiGraphDenseIntersect {
   }
 
   /* Does the main work of intersection/composition, but doesn't produce any
-     output; the output is provided when you call FormatOutput(). */
+     output; the output is provided when you call FormatOutput().
+
+     In pruned mode, if for any FSA the pruned forward and backward passes do
+     not agree on the total score, or found no path at all (which is what
+     happens when the search beam prunes away the best path in one or both of
+     them), the intersection is done again without pruning, so that no
+     alignment is lost that the unpruned version would find. */
   void Intersect() {
+    if (search_beam_ > 0) {
+      IntersectPruned();
+      if (PrunedSearchOk()) return;
+      K2_LOG(INFO) << "The search with search_beam=" << search_beam_
+                   << " lost the best path; redoing it without pruning.";
+      search_beam_ = 0;
+      state_positions_ = Array1<int32_t *>();
+      state_values_ = Array1<float *>();
+      state_num_kept_ = Array1<int32_t>();
+      for (Step &step : steps_) {
+        step.kept_positions = Array1<int32_t>();
+        step.kept_scores = Array1<float>();
+        step.state_scores = Array1<float>(c_, step.arc_scores.TotSize(1));
+      }
+    }
+    if (checkpoint_interval_ > 0) {
+      IntersectCheckpointed();
+      return;
+    }
     DoStep0();
     for (int32_t t = 1; t <= T_; t++) DoStep(t);
   }
@@ -226,6 +283,8 @@ class MultiGraphDenseIntersect {
   FsaVec FormatOutput(Array1<int32_t> *arc_map_a,
                       Array1<int32_t> *arc_map_b) {
     NVTX_RANGE(K2_FUNC);
+    if (checkpoint_interval_ > 0)
+      return FormatOutputCheckpointed(arc_map_a, arc_map_b);
 
     Array1<float> score_cutoffs;
     float *score_cutoffs_data;
@@ -236,17 +295,30 @@ class MultiGraphDenseIntersect {
     const int32_t *a_fsas_row_ids1_data = a_fsas_.RowIds(1).Data(),
                   *a_fsas_row_splits2_data = a_fsas_.RowSplits(2).Data();
     FsaInfo *fsa_info_data = fsa_info_.Data();
+    StateScoresAccessor state_scores = GetStateScoresAccessor();
+
+    // In pruned mode, only the states whose forward scores were not pruned
+    // away are candidates for being kept; `candidates` maps from candidate
+    // index to an index into the (T+1) * num_states space of states used
+    // below.  Otherwise all states are candidates.
+    Array1<int32_t> candidates;
+    const int32_t *candidates_data = nullptr;
+    int32_t num_candidates = product;
+    if (search_beam_ > 0) {
+      candidates = GetPrunedCandidates();
+      candidates_data = candidates.Data();
+      num_candidates = candidates.Dim();
+    }
 
     while (1) {
       // This code is in a loop is in case we get too many states and have to
       // retry.  The limit `max_states` is to reduce the likelihood of
       // out-of-memory conditions.
-      renumber_states = Renumbering(c_, product);
+      renumber_states = Renumbering(c_, num_candidates);
       char *keep_state_data = renumber_states.Keep().Data();
       score_cutoffs = GetScoreCutoffs();
       score_cutoffs_data = score_cutoffs.Data();
-      float **state_scores_data = state_scores_.Data();
-      Array1<int64_t> state_arcs(c_, product);
+      Array1<int64_t> state_arcs(c_, num_candidates);
       int64_t *state_arcs_data = state_arcs.Data();
 
       // We'll do exclusive-sum on the following array, after setting its
@@ -261,8 +333,9 @@ class MultiGraphDenseIntersect {
       // the following lambda will set elements within `keep_state_data` to 0
       // or 1.
       K2_EVAL(
-          c_, product, lambda_set_keep, (int32_t i)->void {
+          c_, num_candidates, lambda_set_keep, (int32_t j)->void {
             // i is actually an idx012 of a state.
+            int32_t i = (candidates_data != nullptr ? candidates_data[j] : j);
 
             // the following works because each FSA has
             // (its num-states * (T_+1))
@@ -288,14 +361,14 @@ class MultiGraphDenseIntersect {
             char keep = 0;
             if (t <= fsa_info.T) {
               // This time is within the bounds for this FSA..
-              float forward_score = state_scores_data[t][forward_state_idx],
+              float forward_score = state_scores(t, forward_state_idx),
                   backward_score =
-                  state_scores_data[fsa_info.T - t][backward_state_idx];
+                  state_scores(fsa_info.T - t, backward_state_idx);
 
               if (forward_score + backward_score > cutoff) keep = 1;
             }
-            keep_state_data[i] = keep;
-            state_arcs_data[i] = keep * num_arcs;
+            keep_state_data[j] = keep;
+            state_arcs_data[j] = keep * num_arcs;
           });
       int32_t tot_states = renumber_states.New2Old().Dim();
       if (tot_states > max_states_) {
@@ -319,10 +392,20 @@ class MultiGraphDenseIntersect {
       }
     }
 
-    Array1<int32_t> &new2old = renumber_states.New2Old();
+    // new2old maps from state index in the output to an index into the
+    // (T+1) * num_states space of states.
+    Array1<int32_t> new2old = renumber_states.New2Old();
+    StateRenumberingAccessor states_old2new;
+    if (search_beam_ > 0) {
+      new2old = candidates[new2old];
+      states_old2new.old2new = nullptr;
+      states_old2new.new2old = new2old.Data();
+      states_old2new.num_kept = new2old.Dim();
+    } else {
+      states_old2new.old2new = renumber_states.Old2New().Data();
+    }
     const int32_t *new2old_data = new2old.Data();
     int32_t ans_tot_num_states = new2old.Dim();
-    float **state_scores_data = state_scores_.Data();
 
     // t_per_fsa will be set below to the number of time-steps that each FSA has
     // states active on; if each FSA i has scores for 0 <= t < T_i, then
@@ -398,11 +481,10 @@ class MultiGraphDenseIntersect {
 
     const int32_t *ans_row_ids1_data = ans_row_ids1.Data(),
                *ans_row_splits2_data = ans_row_splits2.Data(),
-               *ans_row_splits3_data = ans_row_splits3.Data(),
-                *states_old2new_data = renumber_states.Old2New().Data();
+               *ans_row_splits3_data = ans_row_splits3.Data();
     CompressedArc *carcs_data = carcs_.Data();
-    int32_t scores_stride = b_fsas_.scores.ElemStride0();
-    const float *scores_data = b_fsas_.scores.Data();
+    int32_t scores_stride = b_fsas_.ScoresStride();
+    DenseFsaVecScores scores_acc = DenseFsaVecScoresAccessor(b_fsas_);
 
     auto lambda_set_keep = [=] __host__ __device__(
         int32_t arc_idx0123, int32_t ans_state_idx012) -> bool {
@@ -425,7 +507,7 @@ class MultiGraphDenseIntersect {
           int32_t a_fsas_dest_state_idx1 = carc.dest_state;
           int32_t scores_index = fsa_info.scores_offset +
                                  (scores_stride * t_idx1) + carc.label_plus_one;
-          float arc_score = carc.score + scores_data[scores_index];
+          float arc_score = carc.score + scores_acc(scores_index);
 
           // unpruned_src_state_idx and unpruned_dest_state_idx are into
           // `renumber_states.Keep()` or `renumber_states.Old2New()`
@@ -436,24 +518,21 @@ class MultiGraphDenseIntersect {
                       fsa_info.state_offset * (T + 1) +
                       ((t_idx1 + 1) * fsa_info.num_states) +
                       a_fsas_dest_state_idx1;
-          K2_CHECK_EQ(states_old2new_data[unpruned_src_state_idx],
+          K2_CHECK_EQ(states_old2new(unpruned_src_state_idx),
                       ans_state_idx012);
           K2_CHECK_LT(t_idx1, (int32_t)fsa_info.T);
 
+          // -1 if the dest-state was pruned away.
           int32_t ans_dest_state_idx012 =
-                      states_old2new_data[unpruned_dest_state_idx],
-                  ans_dest_state_idx012_next =
-                      states_old2new_data[unpruned_dest_state_idx + 1];
+              states_old2new(unpruned_dest_state_idx);
           bool keep_this_arc = false;
 
-          const float *forward_state_scores = state_scores_data[t_idx1];
-          // 'next_backward_state_scores' is the state_scores vector for the
+          // 'next_backward_step' is the step with the state_scores for the
           // next frame (t_idx1 + 1); the backward scores are in the opposite
           // order so we index as ((int32_t)fsa_info.T) - (t_idx1 + 1).
-          const float *next_backward_state_scores =
-              state_scores_data[((int32_t)fsa_info.T) - (t_idx1 + 1)];
+          int32_t next_backward_step = ((int32_t)fsa_info.T) - (t_idx1 + 1);
 
-          if (ans_dest_state_idx012 < ans_dest_state_idx012_next) {
+          if (ans_dest_state_idx012 >= 0) {
             // The dest-state of this arc has a number (was not pruned away).
             // below, backward_dest_state_idx and forward_src_state_idx are into
             // the state_scores arrays.
@@ -463,8 +542,8 @@ class MultiGraphDenseIntersect {
                                             fsa_info.num_states +
                                             a_fsas_state_idx1;
             float arc_forward_backward_score =
-                forward_state_scores[forward_src_state_idx] + arc_score +
-                next_backward_state_scores[backward_dest_state_idx];
+                state_scores(t_idx1, forward_src_state_idx) + arc_score +
+                state_scores(next_backward_step, backward_dest_state_idx);
             if (arc_forward_backward_score > cutoff) {
               keep_this_arc = true;
             }
@@ -530,7 +609,7 @@ class MultiGraphDenseIntersect {
                                  (scores_stride * t_idx1) + carc.label_plus_one;
           arc_map_b_data[arc_idx_out] = scores_index;
 
-          float arc_score = carc.score + scores_data[scores_index];
+          float arc_score = carc.score + scores_acc(scores_index);
 
           // unpruned_src_state_idx and unpruned_dest_state_idx are into
           // `renumber_states.Keep()` or `renumber_states.Old2New()`
@@ -541,23 +620,20 @@ class MultiGraphDenseIntersect {
                       fsa_info.state_offset * (T + 1) +
                       ((t_idx1 + 1) * fsa_info.num_states) +
                       a_fsas_dest_state_idx1;
-          K2_CHECK_EQ(states_old2new_data[unpruned_src_state_idx],
+          K2_CHECK_EQ(states_old2new(unpruned_src_state_idx),
                       ans_state_idx012);
           K2_CHECK_LT(t_idx1, (int32_t)fsa_info.T);
 
+          // -1 if the dest-state was pruned away.
           int32_t ans_dest_state_idx012 =
-                      states_old2new_data[unpruned_dest_state_idx],
-                  ans_dest_state_idx012_next =
-                      states_old2new_data[unpruned_dest_state_idx + 1];
+              states_old2new(unpruned_dest_state_idx);
 
-          const float *forward_state_scores = state_scores_data[t_idx1];
-          // 'next_backward_state_scores' is the state_scores vector for the
+          // 'next_backward_step' is the step with the state_scores for the
           // next frame (t_idx1 + 1); the backward scores are in the opposite
           // order so we index as ((int32_t)fsa_info.T) - (t_idx1 + 1).
-          const float *next_backward_state_scores =
-              state_scores_data[((int32_t)fsa_info.T) - (t_idx1 + 1)];
+          int32_t next_backward_step = ((int32_t)fsa_info.T) - (t_idx1 + 1);
 
-          K2_CHECK_LT(ans_dest_state_idx012, ans_dest_state_idx012_next);
+          K2_CHECK_GE(ans_dest_state_idx012, 0);
 
           // below, backward_dest_state_idx and forward_src_state_idx are into
           // the state_scores arrays.
@@ -567,8 +643,8 @@ class MultiGraphDenseIntersect {
               fsa_info.num_states +
               a_fsas_state_idx1;
           float arc_forward_backward_score =
-              forward_state_scores[forward_src_state_idx] + arc_score +
-              next_backward_state_scores[backward_dest_state_idx];
+              state_scores(t_idx1, forward_src_state_idx) + arc_score +
+              state_scores(next_backward_step, backward_dest_state_idx);
           K2_CHECK_GE(arc_forward_backward_score, cutoff);
           Arc arc;
           arc.label = static_cast<int32_t>(carc.label_plus_one) - 1;
@@ -595,7 +671,18 @@ class MultiGraphDenseIntersect {
         ans_row_ids3_subsampled.Dim());
 
     // .. remove the 't' axis
-    return Ragged<Arc>(RemoveAxis(ans_shape, 1), arcs);
+    FsaVec ans(RemoveAxis(ans_shape, 1), arcs);
+    if (search_beam_ <= 0) return ans;
+
+    // In pruned mode, states may be left that cannot reach the final state,
+    // because the arcs leaving them go to states whose forward scores were
+    // pruned away.
+    FsaVec connected;
+    Array1<int32_t> connect_arc_map;
+    Connect(ans, &connected, &connect_arc_map);
+    if (arc_map_a) *arc_map_a = (*arc_map_a)[connect_arc_map];
+    if (arc_map_b) *arc_map_b = (*arc_map_b)[connect_arc_map];
+    return connected;
   }
 
   // We can't actually make the rest private for reasons relating to use of
@@ -657,7 +744,7 @@ class MultiGraphDenseIntersect {
           *b_fsas_row_splits1_data = b_fsas_.shape.RowSplits(1).Data(),
           *a_fsas_row_splits1_data = a_fsas_.shape.RowSplits(1).Data(),
           *a_fsas_row_splits2_data = a_fsas_.shape.RowSplits(2).Data();
-    int32_t scores_stride = b_fsas_.scores.ElemStride0();
+    int32_t scores_stride = b_fsas_.ScoresStride();
 
     fsa_info_ = Array1<FsaInfo>(c_, num_fsas_ + 1);
     FsaInfo *fsa_info_data = fsa_info_.Data();
@@ -733,8 +820,11 @@ class MultiGraphDenseIntersect {
           shape, arc_scores_.values.Arange(0, shape.NumElements()));
 
       int32_t num_states = a_fsas_row_splits1_cpu[step.num_fsas];
-      // * 2 because have both forward and backward.
-      step.state_scores = Array1<float>(c_, 2 * num_states);
+      // * 2 because have both forward and backward.  In checkpointed and
+      // pruned mode the state scores are allocated as needed by
+      // IntersectCheckpointed() and IntersectPruned().
+      if (checkpoint_interval_ == 0 && search_beam_ <= 0)
+        step.state_scores = Array1<float>(c_, 2 * num_states);
     }
   }
 
@@ -785,8 +875,8 @@ class MultiGraphDenseIntersect {
 
     CompressedArc *carcs_data = carcs_.Data();
     FsaInfo *fsa_info_data = fsa_info_.Data();
-    float *scores_data = b_fsas_.scores.Data();
-    int32_t scores_stride = b_fsas_.scores.ElemStride0();
+    DenseFsaVecScores scores_acc = DenseFsaVecScoresAccessor(b_fsas_);
+    int32_t scores_stride = b_fsas_.ScoresStride();
 
     K2_EVAL(
         c_, num_arcs, lambda_set_arc_scores, (int32_t arc_idx012)->void {
@@ -808,13 +898,13 @@ class MultiGraphDenseIntersect {
                 backward_dest_prob =
                     prev_state_scores_data[dest_state_scores_index_backward];
 
-          float b_score_forward = scores_data[fsa_info.scores_offset +
-                                              (scores_stride * (t - 1)) +
-                                              carc.label_plus_one],
+          float b_score_forward = scores_acc(fsa_info.scores_offset +
+                                             (scores_stride * (t - 1)) +
+                                             carc.label_plus_one),
                 b_score_backward =
-                    scores_data[fsa_info.scores_offset +
-                                (scores_stride * (fsa_info.T - t)) +
-                                carc.label_plus_one];
+                    scores_acc(fsa_info.scores_offset +
+                               (scores_stride * (fsa_info.T - t)) +
+                               carc.label_plus_one);
           float forward_arc_end_prob =
                     forward_src_prob + carc.score + b_score_forward,
                 backward_arc_begin_prob =
@@ -831,6 +921,754 @@ class MultiGraphDenseIntersect {
                   &step.state_scores);
   }
 
+  /*
+    Checkpointed version of Intersect(), used if checkpoint_interval_ > 0.  It
+    does the same steps as Intersect(), but frees the state scores of each step
+    once the next step has been computed, unless the step index is a multiple
+    of checkpoint_interval_.  The forward scores on those steps are the
+    checkpoints from which FormatOutputCheckpointed() recomputes the rest.
+   */
+  void IntersectCheckpointed() {
+    NVTX_RANGE(K2_FUNC);
+    const float minus_inf = -std::numeric_limits<float>::infinity();
+    tot_scores_start_ = Array1<float>(c_, num_fsas_, minus_inf);
+    tot_scores_end_ = Array1<float>(c_, num_fsas_, minus_inf);
+    int32_t k = checkpoint_interval_;
+
+    steps_[0].state_scores =
+        Array1<float>(c_, steps_[0].arc_scores.TotSize(1));
+    DoStep0();
+    RecordTotScores(0);
+    for (int32_t t = 1; t <= T_; t++) {
+      Step &step = steps_[t];
+      step.state_scores = Array1<float>(c_, step.arc_scores.TotSize(1));
+      DoStep(t);
+      RecordTotScores(t);
+      if ((t - 1) % k != 0) steps_[t - 1].state_scores = Array1<float>();
+    }
+    if (T_ % k != 0) steps_[T_].state_scores = Array1<float>();
+  }
+
+  /*
+    Sets up halves_row_splits_ (used in pruned mode), the row_splits of the
+    halves of the state scores of a step: for each FSA, its backward scores
+    and then its forward scores.
+   */
+  void InitHalvesRowSplits() {
+    NVTX_RANGE(K2_FUNC);
+    const int32_t *a_fsas_row_splits1_data = a_fsas_.RowSplits(1).Data();
+    halves_row_splits_ = Array1<int32_t>(c_, 2 * num_fsas_ + 1);
+    int32_t *halves_row_splits_data = halves_row_splits_.Data();
+    K2_EVAL(
+        c_, 2 * num_fsas_ + 1, lambda_set_halves_row_splits,
+        (int32_t i)->void {
+          int32_t fsa_idx0 = i / 2,
+                  begin = a_fsas_row_splits1_data[fsa_idx0];
+          halves_row_splits_data[i] =
+              (i % 2 == 0 ? 2 * begin
+                          : begin + a_fsas_row_splits1_data[fsa_idx0 + 1]);
+        });
+  }
+
+  /*
+    Pruned version of Intersect(), used if search_beam_ > 0.  It does the same
+    steps, but prunes the state scores of each step with PruneStep(), and once
+    the next step has been computed keeps only the scores that were not
+    pruned away (see CompactStep()).
+   */
+  void IntersectPruned() {
+    NVTX_RANGE(K2_FUNC);
+    steps_[0].state_scores =
+        Array1<float>(c_, steps_[0].arc_scores.TotSize(1));
+    DoStep0();
+    for (int32_t t = 1; t <= T_; t++) {
+      Step &step = steps_[t];
+      step.state_scores = Array1<float>(c_, step.arc_scores.TotSize(1));
+      DoStep(t);
+      PruneStep(t);
+      CompactStep(t - 1);
+    }
+    CompactStep(T_);
+  }
+
+  /*
+    Used in pruned mode; sets to -infinity the forward (resp. backward) scores
+    in steps_[t].state_scores that are more than search_beam_ below the best
+    forward (resp. backward) score of the same FSA.
+   */
+  void PruneStep(int32_t t) {
+    NVTX_RANGE(K2_FUNC);
+    Step &step = steps_[t];
+    const float minus_inf = -std::numeric_limits<float>::infinity();
+    int32_t num_halves = 2 * step.num_fsas,
+            num_scores = step.state_scores.Dim();
+    Array1<int32_t> row_splits = halves_row_splits_.Arange(0, num_halves + 1);
+    Ragged<float> scores(RaggedShape2(&row_splits, nullptr, num_scores),
+                         step.state_scores);
+    Array1<float> best_scores(c_, num_halves);
+    MaxPerSublist(scores, minus_inf, &best_scores);
+
+    const int32_t *row_ids_data = scores.RowIds(1).Data();
+    const float *best_scores_data = best_scores.Data();
+    float *scores_data = step.state_scores.Data();
+    float search_beam = search_beam_;
+    K2_EVAL(
+        c_, num_scores, lambda_prune, (int32_t i)->void {
+          if (scores_data[i] < best_scores_data[row_ids_data[i]] - search_beam)
+            scores_data[i] = minus_inf;
+        });
+  }
+
+  /*
+    Used in pruned mode once steps_[t].state_scores is no longer needed for
+    propagation: replaces it with the positions and values of its scores that
+    are not -infinity (steps_[t].kept_positions and steps_[t].kept_scores).
+   */
+  void CompactStep(int32_t t) {
+    NVTX_RANGE(K2_FUNC);
+    Step &step = steps_[t];
+    const float minus_inf = -std::numeric_limits<float>::infinity();
+    int32_t num_scores = step.state_scores.Dim();
+    const float *scores_data = step.state_scores.Data();
+    Renumbering renumbering(c_, num_scores);
+    char *keep_data = renumbering.Keep().Data();
+    K2_EVAL(
+        c_, num_scores, lambda_set_keep,
+        (int32_t i)->void { keep_data[i] = (scores_data[i] != minus_inf); });
+    // New2Old() may have been allocated with num_scores elements; Clone()
+    // frees the rest.
+    step.kept_positions = renumbering.New2Old().Clone();
+    step.kept_scores = step.state_scores[step.kept_positions];
+    step.state_scores = Array1<float>();
+  }
+
+  /*
+    Used in pruned mode after IntersectPruned(); returns false if, for some
+    FSA, the forward and backward total scores differ by more than roundoff
+    or are -infinity.
+   */
+  bool PrunedSearchOk() {
+    NVTX_RANGE(K2_FUNC);
+    StateScoresAccessor state_scores = GetStateScoresAccessor();
+    FsaInfo *fsa_info_data = fsa_info_.Data();
+    const float minus_inf = -std::numeric_limits<float>::infinity();
+    Array1<int32_t> bad(c_, num_fsas_);
+    int32_t *bad_data = bad.Data();
+    K2_EVAL(
+        c_, num_fsas_, lambda_check_tot_scores, (int32_t fsa_idx0)->void {
+          FsaInfo fsa_info = fsa_info_data[fsa_idx0];
+          if (fsa_info.num_states == 0) {
+            bad_data[fsa_idx0] = 0;
+            return;
+          }
+          int32_t backward_state_idx = 2 * fsa_info.state_offset,
+                  forward_state_idx =
+                      backward_state_idx + 2 * fsa_info.num_states - 1;
+          float tot_score_start =
+                    state_scores(fsa_info.T, backward_state_idx),
+                tot_score_end = state_scores(fsa_info.T, forward_state_idx);
+          bad_data[fsa_idx0] =
+              (tot_score_end == minus_inf || tot_score_start == minus_inf ||
+               fabs(tot_score_end - tot_score_start) >
+                   0.01 + 1.0e-05 * fabs(tot_score_start));
+        });
+    return MaxValue(bad) == 0;
+  }
+
+  /*
+    Used in pruned mode by FormatOutput(); returns the sorted indexes into the
+    (T_ + 1) * num-states space of states that FormatOutput() uses of the
+    states whose forward scores were not pruned away.  Other states cannot be
+    in the output.
+   */
+  Array1<int32_t> GetPrunedCandidates() {
+    NVTX_RANGE(K2_FUNC);
+    const int32_t *a_fsas_row_ids1_data = a_fsas_.RowIds(1).Data();
+    FsaInfo *fsa_info_data = fsa_info_.Data();
+    int32_t T = T_;
+    std::vector<Array1<int32_t>> keys(T_ + 1);
+    for (int32_t t = 0; t <= T_; t++) {
+      const Array1<int32_t> &positions = steps_[t].kept_positions;
+      const int32_t *positions_data = positions.Data();
+      keys[t] = Array1<int32_t>(c_, positions.Dim());
+      int32_t *keys_data = keys[t].Data();
+      K2_EVAL(
+          c_, positions.Dim(), lambda_set_keys, (int32_t i)->void {
+            int32_t pos = positions_data[i],
+                    fsa_idx0 = a_fsas_row_ids1_data[pos / 2];
+            FsaInfo fsa_info = fsa_info_data[fsa_idx0];
+            int32_t state_idx1 = pos - 2 * fsa_info.state_offset -
+                                 fsa_info.num_states;
+            // -1 for backward scores.
+            keys_data[i] = (state_idx1 < 0
+                                ? -1
+                                : fsa_info.state_offset * (T + 1) +
+                                      t * fsa_info.num_states + state_idx1);
+          });
+    }
+    Array1<int32_t> all_keys = Cat(c_, T_ + 1, keys.data());
+    const int32_t *all_keys_data = all_keys.Data();
+    Renumbering renumbering(c_, all_keys.Dim());
+    char *keep_data = renumbering.Keep().Data();
+    K2_EVAL(
+        c_, all_keys.Dim(), lambda_set_keep,
+        (int32_t i)->void { keep_data[i] = (all_keys_data[i] != -1); });
+    Array1<int32_t> ans = all_keys[renumbering.New2Old()];
+    Ragged<int32_t> sorted(RegularRaggedShape(c_, 1, ans.Dim()), ans);
+    SortSublists(&sorted);
+    return ans;
+  }
+
+  // Gives access to the state scores of all steps: steps_[t].state_scores,
+  // or in pruned mode the scores kept by CompactStep(), where the scores
+  // that were pruned away are -infinity.
+  struct StateScoresAccessor {
+    float **state_scores;  // nullptr in pruned mode
+    int32_t **positions;
+    float **values;
+    const int32_t *num_kept;
+
+    // Returns the score with index `i` in steps_[t].state_scores.
+    __host__ __device__ float operator()(int32_t t, int32_t i) const {
+      if (state_scores != nullptr) return state_scores[t][i];
+      const int32_t *p = positions[t];
+      int32_t begin = 0, end = num_kept[t];
+      while (begin < end) {  // find the first position >= i
+        int32_t mid = (begin + end) / 2;
+        if (p[mid] < i)
+          begin = mid + 1;
+        else
+          end = mid;
+      }
+      if (begin < num_kept[t] && p[begin] == i) return values[t][begin];
+      return -std::numeric_limits<float>::infinity();
+    }
+  };
+
+  // Not valid in checkpointed mode.
+  StateScoresAccessor GetStateScoresAccessor() {
+    NVTX_RANGE(K2_FUNC);
+    StateScoresAccessor ans;
+    if (search_beam_ > 0) {
+      if (state_positions_.Dim() == 0) {
+        std::vector<int32_t *> positions_vec(T_ + 1);
+        std::vector<float *> values_vec(T_ + 1);
+        std::vector<int32_t> num_kept_vec(T_ + 1);
+        for (int32_t t = 0; t <= T_; t++) {
+          positions_vec[t] = steps_[t].kept_positions.Data();
+          values_vec[t] = steps_[t].kept_scores.Data();
+          num_kept_vec[t] = steps_[t].kept_positions.Dim();
+        }
+        state_positions_ = Array1<int32_t *>(c_, positions_vec);
+        state_values_ = Array1<float *>(c_, values_vec);
+        state_num_kept_ = Array1<int32_t>(c_, num_kept_vec);
+      }
+      ans.state_scores = nullptr;
+      ans.positions = state_positions_.Data();
+      ans.values = state_values_.Data();
+      ans.num_kept = state_num_kept_.Data();
+    } else {
+      if (state_scores_.Dim() == 0) {
+        std::vector<float *> state_scores_vec(T_ + 1);
+        for (int32_t t = 0; t <= T_; t++)
+          state_scores_vec[t] = steps_[t].state_scores.Data();
+        state_scores_ = Array1<float *>(c_, state_scores_vec);
+      }
+      ans.state_scores = state_scores_.Data();
+    }
+    return ans;
+  }
+
+  // Maps from an index into the (T_ + 1) * num-states space of states that
+  // FormatOutput() uses to the index of that state in the output, or -1 if
+  // it was pruned away.
+  struct StateRenumberingAccessor {
+    // If not nullptr, the Old2New() of a renumbering of that space.
+    const int32_t *old2new;
+    // Otherwise (in pruned mode), the sorted indexes of the states kept.
+    const int32_t *new2old;
+    int32_t num_kept;
+
+    __host__ __device__ int32_t operator()(int32_t i) const {
+      if (old2new != nullptr)
+        return (old2new[i] < old2new[i + 1] ? old2new[i] : -1);
+      int32_t begin = 0, end = num_kept;
+      while (begin < end) {  // find the first state >= i
+        int32_t mid = (begin + end) / 2;
+        if (new2old[mid] < i)
+          begin = mid + 1;
+        else
+          end = mid;
+      }
+      return (begin < num_kept && new2old[begin] == i ? begin : -1);
+    }
+  };
+
+  /*
+    Called in checkpointed mode after step t has been computed; for FSAs whose
+    last frame is t, copies their total scores (the forward score of the final
+    state and the backward score of the start state, both of which are in the
+    state scores of step t) to tot_scores_end_ and tot_scores_start_.
+   */
+  void RecordTotScores(int32_t t) {
+    NVTX_RANGE(K2_FUNC);
+    const float *state_scores_data = steps_[t].state_scores.Data();
+    float *tot_scores_start_data = tot_scores_start_.Data(),
+          *tot_scores_end_data = tot_scores_end_.Data();
+    FsaInfo *fsa_info_data = fsa_info_.Data();
+    K2_EVAL(
+        c_, steps_[t].num_fsas, lambda_record_tot_scores,
+        (int32_t fsa_idx0)->void {
+          FsaInfo fsa_info = fsa_info_data[fsa_idx0];
+          if (fsa_info.T != t || fsa_info.num_states == 0) return;
+          int32_t backward_state_idx = 2 * fsa_info.state_offset,
+                  forward_state_idx =
+                      backward_state_idx + 2 * fsa_info.num_states - 1;
+          tot_scores_start_data[fsa_idx0] =
+              state_scores_data[backward_state_idx];
+          tot_scores_end_data[fsa_idx0] = state_scores_data[forward_state_idx];
+        });
+  }
+
+  /*
+    Used in checkpointed mode.  Unlike DoStep(), this computes scores for just
+    one direction, and indexes the backward scores by frame rather than by
+    step, so the forward and backward scores of frame t have the same layout
+    as steps_[t].state_scores.
+
+      @param [in] t   The frame to compute scores for, 0 <= t <= T_.
+      @param [in] forward  If true, compute the forward scores on frame t from
+                      the forward scores on frame t - 1 in `src` (`src` is
+                      not used if t == 0).  If false, compute the backward
+                      scores on frame t from the backward scores on frame
+                      t + 1 in `src` (not used for FSAs whose last frame is
+                      t).
+      @param [in] src  Scores with the layout of steps_[t - 1].state_scores if
+                      forward, else of steps_[t + 1].state_scores; only the
+                      scores for the direction we compute are read.
+      @param [out] dest  Will be set to an array with the layout of
+                      steps_[t].state_scores; the scores for the other
+                      direction will be -infinity.
+   */
+  void PropagateFrame(int32_t t, bool forward, const Array1<float> &src,
+                      Array1<float> *dest) {
+    NVTX_RANGE(K2_FUNC);
+    Step &step = steps_[t];
+    const float minus_inf = -std::numeric_limits<float>::infinity();
+    int32_t num_states = step.arc_scores.TotSize(1) / 2;
+    if (forward ? t == 0 : t == T_) {
+      *dest = Array1<float>(c_, 2 * num_states, minus_inf);
+    } else {
+      *dest = Array1<float>(c_, 2 * num_states);
+      int32_t num_arcs = step.arc_scores.values.Dim() / 2;
+      float *arc_scores_data = step.arc_scores.values.Data();
+      const float *src_data = src.Data();
+      CompressedArc *carcs_data = carcs_.Data();
+      FsaInfo *fsa_info_data = fsa_info_.Data();
+      DenseFsaVecScores scores_acc = DenseFsaVecScoresAccessor(b_fsas_);
+      int32_t scores_stride = b_fsas_.ScoresStride();
+      K2_EVAL(
+          c_, num_arcs, lambda_set_arc_scores, (int32_t arc_idx012)->void {
+            CompressedArc carc = carcs_data[arc_idx012];
+            FsaInfo fsa_info = fsa_info_data[carc.fsa_idx];
+            float forward_arc_end_prob = minus_inf,
+                  backward_arc_begin_prob = minus_inf;
+            // The expressions are the same as in DoStep(), so the scores are
+            // identical to the non-checkpointed ones.
+            if (forward) {
+              float forward_src_prob =
+                  src_data[2 * fsa_info.state_offset + fsa_info.num_states +
+                           carc.src_state];
+              float b_score = scores_acc(fsa_info.scores_offset +
+                                         (scores_stride * (t - 1)) +
+                                         carc.label_plus_one);
+              forward_arc_end_prob = forward_src_prob + carc.score + b_score;
+            } else if (t < static_cast<int32_t>(fsa_info.T)) {
+              float backward_dest_prob =
+                  src_data[2 * fsa_info.state_offset + carc.dest_state];
+              float b_score =
+                  scores_acc(fsa_info.scores_offset + (scores_stride * t) +
+                             carc.label_plus_one);
+              backward_arc_begin_prob =
+                  backward_dest_prob + carc.score + b_score;
+            }
+            arc_scores_data[carc.incoming_arc_idx012] = forward_arc_end_prob;
+            arc_scores_data[arc_idx012 + fsa_info.arc_offset] =
+                backward_arc_begin_prob;
+          });
+      MaxPerSublist(step.arc_scores, minus_inf, dest);
+    }
+
+    // Initialize the forward scores on frame 0, or the backward scores of FSAs
+    // whose last frame is t.
+    bool need_init = forward ? t == 0
+                             : (t == T_ || steps_[t + 1].num_fsas <
+                                               step.num_fsas);
+    if (!need_init) return;
+    float *dest_data = dest->Data();
+    const int32_t *a_fsas_row_ids1_data = a_fsas_.RowIds(1).Data();
+    FsaInfo *fsa_info_data = fsa_info_.Data();
+    K2_EVAL(
+        c_, num_states, lambda_init_state_scores, (int32_t state_idx01)->void {
+          FsaInfo fsa_info = fsa_info_data[a_fsas_row_ids1_data[state_idx01]];
+          int32_t state_idx1 = state_idx01 - fsa_info.state_offset,
+                  backward_state_idx = fsa_info.state_offset + state_idx01,
+                  forward_state_idx = backward_state_idx + fsa_info.num_states;
+          if (forward) {
+            dest_data[forward_state_idx] = (state_idx1 == 0 ? 0 : minus_inf);
+          } else if (static_cast<int32_t>(fsa_info.T) == t) {
+            dest_data[backward_state_idx] =
+                (state_idx1 + 1 == fsa_info.num_states ? 0 : minus_inf);
+          }
+        });
+  }
+
+  // The part of the output of FormatOutputCheckpointed() that was produced
+  // for one frame.
+  struct FrameOutput {
+    // For each state that was kept, the index into the (T_ + 1) * num-states
+    // space of states that FormatOutput() uses; sorting these gives the order
+    // of the states in the output.
+    Array1<int32_t> state_keys;
+    // For each state that was kept, the number of arcs kept that leave it.
+    Array1<int32_t> num_arcs;
+    // The arcs that were kept, in order of source state.  Their src_state and
+    // dest_state are positions in the list of states of all frames, in the
+    // order they were produced.
+    Array1<Arc> arcs;
+    Array1<int32_t> arc_map_a;
+    Array1<int32_t> arc_map_b;
+  };
+
+  /*
+    Used in checkpointed mode; prunes the states on frame t and the arcs
+    leaving them, with the same criteria as FormatOutput().  Frames must be
+    processed from last to first.
+
+      @param [in] t        The frame, 0 <= t <= T_.
+      @param [in] score_cutoffs  As returned by GetScoreCutoffs().
+      @param [in] forward  Forward scores on frame t, see PropagateFrame().
+      @param [in] backward  Backward scores on frame t.
+      @param [in] next_backward  Backward scores on frame t + 1 (unused if
+                            t == T_).
+      @param [in] next_old2new  Old2New() of the renumbering of the states on
+                            frame t + 1, as output by the previous call.
+      @param [in] next_offset  Position of the first kept state of frame
+                            t + 1 in the list of states of all frames.
+      @param [in] offset   Position of the first kept state of frame t.
+      @param [out] old2new  The Old2New() of the renumbering of the states on
+                            frame t will be written to here.
+      @param [out] num_arc_candidates  The number of arcs leaving kept states
+                            is written to here; this is what max_arcs_
+                            limits.
+      @return  Returns the states and arcs kept.
+   */
+  FrameOutput PruneFrame(int32_t t, const Array1<float> &score_cutoffs,
+                         const Array1<float> &forward,
+                         const Array1<float> &backward,
+                         const Array1<float> &next_backward,
+                         const Array1<int32_t> &next_old2new,
+                         int32_t next_offset, int32_t offset,
+                         Array1<int32_t> *old2new,
+                         int32_t *num_arc_candidates) {
+    NVTX_RANGE(K2_FUNC);
+    int32_t num_states = steps_[t].arc_scores.TotSize(1) / 2, T = T_;
+    const float *score_cutoffs_data = score_cutoffs.Data(),
+                *forward_data = forward.Data(),
+                *backward_data = backward.Data(),
+                *next_backward_data = next_backward.Data();
+    const int32_t *a_fsas_row_ids1_data = a_fsas_.RowIds(1).Data(),
+                  *a_fsas_row_splits2_data = a_fsas_.RowSplits(2).Data(),
+                  *next_old2new_data = next_old2new.Data();
+    FsaInfo *fsa_info_data = fsa_info_.Data();
+
+    Renumbering renumber_states(c_, num_states);
+    char *keep_state_data = renumber_states.Keep().Data();
+    K2_EVAL(
+        c_, num_states, lambda_set_keep, (int32_t state_idx01)->void {
+          int32_t fsa_idx0 = a_fsas_row_ids1_data[state_idx01];
+          FsaInfo fsa_info = fsa_info_data[fsa_idx0];
+          int32_t backward_state_idx = fsa_info.state_offset + state_idx01,
+                  forward_state_idx = backward_state_idx + fsa_info.num_states;
+          keep_state_data[state_idx01] =
+              (forward_data[forward_state_idx] +
+                   backward_data[backward_state_idx] >
+               score_cutoffs_data[fsa_idx0]);
+        });
+    Array1<int32_t> &new2old = renumber_states.New2Old();
+    const int32_t *new2old_data = new2old.Data();
+    int32_t num_kept = new2old.Dim();
+
+    FrameOutput ans;
+    ans.state_keys = Array1<int32_t>(c_, num_kept);
+    Array1<int32_t> arcs_row_splits(c_, num_kept + 1);
+    int32_t *state_keys_data = ans.state_keys.Data(),
+            *arcs_row_splits_data = arcs_row_splits.Data();
+    K2_EVAL(
+        c_, num_kept, lambda_set_keys, (int32_t i)->void {
+          int32_t state_idx01 = new2old_data[i];
+          FsaInfo fsa_info = fsa_info_data[a_fsas_row_ids1_data[state_idx01]];
+          int32_t state_idx1 = state_idx01 - fsa_info.state_offset;
+          state_keys_data[i] = (T + 1) * fsa_info.state_offset +
+                               t * fsa_info.num_states + state_idx1;
+          // No arcs leave copies of states on the last frame for each FSA.
+          arcs_row_splits_data[i] =
+              (t == fsa_info.T ? 0
+                               : a_fsas_row_splits2_data[state_idx01 + 1] -
+                                     a_fsas_row_splits2_data[state_idx01]);
+        });
+    ExclusiveSum(arcs_row_splits, &arcs_row_splits);
+    int32_t tot_arcs = arcs_row_splits.Back();
+    *num_arc_candidates = tot_arcs;
+
+    CompressedArc *carcs_data = carcs_.Data();
+    int32_t scores_stride = b_fsas_.ScoresStride();
+    DenseFsaVecScores scores_acc = DenseFsaVecScoresAccessor(b_fsas_);
+    auto lambda_set_keep_arc = [=] __host__ __device__(
+        int32_t arc_idx, int32_t i) -> bool {
+      int32_t state_idx01 = new2old_data[i],
+              a_fsas_arc_idx012 = a_fsas_row_splits2_data[state_idx01] +
+                                  arc_idx - arcs_row_splits_data[i];
+      int32_t fsa_idx0 = a_fsas_row_ids1_data[state_idx01];
+      FsaInfo fsa_info = fsa_info_data[fsa_idx0];
+      CompressedArc carc = carcs_data[a_fsas_arc_idx012];
+      int32_t dest_state_idx01 = fsa_info.state_offset + carc.dest_state;
+      if (next_old2new_data[dest_state_idx01] ==
+          next_old2new_data[dest_state_idx01 + 1])
+        return false;  // The dest-state was pruned away.
+      float arc_score =
+          carc.score + scores_acc(fsa_info.scores_offset +
+                                  (scores_stride * t) + carc.label_plus_one);
+      int32_t forward_src_state_idx = (2 * fsa_info.state_offset) +
+                                      fsa_info.num_states + carc.src_state,
+              backward_dest_state_idx =
+                  (2 * fsa_info.state_offset) + carc.dest_state;
+      float arc_forward_backward_score =
+          forward_data[forward_src_state_idx] + arc_score +
+          next_backward_data[backward_dest_state_idx];
+      return arc_forward_backward_score > score_cutoffs_data[fsa_idx0];
+    };
+    Array1<int32_t> arcs_new2old, arcs_row_ids;
+    GetNew2OldAndRowIds(arcs_row_splits, tot_arcs, lambda_set_keep_arc,
+                        &arcs_new2old, &arcs_row_ids);
+
+    int32_t num_arcs_out = arcs_new2old.Dim();
+    ans.num_arcs = Array1<int32_t>(c_, num_kept + 1);
+    RowIdsToRowSplits(arcs_row_ids, &ans.num_arcs);
+    ans.num_arcs = RowSplitsToSizes(ans.num_arcs);
+    ans.arcs = Array1<Arc>(c_, num_arcs_out);
+    ans.arc_map_a = Array1<int32_t>(c_, num_arcs_out);
+    ans.arc_map_b = Array1<int32_t>(c_, num_arcs_out);
+    Arc *arcs_data = ans.arcs.Data();
+    int32_t *arc_map_a_data = ans.arc_map_a.Data(),
+            *arc_map_b_data = ans.arc_map_b.Data();
+    const int32_t *arcs_new2old_data = arcs_new2old.Data(),
+                  *arcs_row_ids_data = arcs_row_ids.Data();
+    K2_EVAL(
+        c_, num_arcs_out, lambda_set_arcs_and_maps,
+        (int32_t arc_idx_out)->void {
+          int32_t i = arcs_row_ids_data[arc_idx_out],
+                  arc_idx = arcs_new2old_data[arc_idx_out],
+                  state_idx01 = new2old_data[i],
+                  a_fsas_arc_idx012 = a_fsas_row_splits2_data[state_idx01] +
+                                      arc_idx - arcs_row_splits_data[i];
+          FsaInfo fsa_info = fsa_info_data[a_fsas_row_ids1_data[state_idx01]];
+          CompressedArc carc = carcs_data[a_fsas_arc_idx012];
+          int32_t scores_index = fsa_info.scores_offset +
+                                 (scores_stride * t) + carc.label_plus_one,
+                  dest_state_idx01 = fsa_info.state_offset + carc.dest_state;
+          Arc arc;
+          arc.src_state = offset + i;
+          arc.dest_state = next_offset + next_old2new_data[dest_state_idx01];
+          arc.label = static_cast<int32_t>(carc.label_plus_one) - 1;
+          arc.score = carc.score + scores_acc(scores_index);
+          arcs_data[arc_idx_out] = arc;
+          arc_map_a_data[arc_idx_out] = a_fsas_arc_idx012;
+          arc_map_b_data[arc_idx_out] = scores_index;
+        });
+    *old2new = renumber_states.Old2New();
+    return ans;
+  }
+
+  /*
+    Checkpointed version of FormatOutput(), used if checkpoint_interval_ > 0;
+    the output is the same.  It goes over the frames in segments of
+    checkpoint_interval_ frames, from last to first; for each segment it
+    recomputes the forward scores from the checkpoint at its first frame, then
+    computes the backward scores frame by frame, pruning each frame as its
+    backward scores become available.  At the end the states and arcs of all
+    frames are put in the output order.
+   */
+  FsaVec FormatOutputCheckpointed(Array1<int32_t> *arc_map_a,
+                                  Array1<int32_t> *arc_map_b) {
+    NVTX_RANGE(K2_FUNC);
+    int32_t k = checkpoint_interval_, num_segments = T_ / k + 1;
+    std::vector<FrameOutput> outputs;
+    int32_t tot_states;
+
+    while (1) {
+      // This code is in a loop in case we get too many states or arcs and
+      // have to retry with a smaller beam, as in FormatOutput().  Like there,
+      // we count the states and arcs of all frames before checking the
+      // limits, so the beam is decreased in the same way; but we stop keeping
+      // the output once a limit is exceeded.
+      Array1<float> score_cutoffs = GetScoreCutoffs();
+      outputs.clear();
+      tot_states = 0;
+      int64_t tot_arcs = 0;
+
+      // Scores, renumbering and offset of the frame after the current one;
+      // there is none for the last frame, T_.
+      Array1<float> next_backward(c_, 0);
+      Array1<int32_t> next_old2new(c_, 0);
+      int32_t next_offset = 0;
+      for (int32_t seg = num_segments - 1; seg >= 0; seg--) {
+        int32_t begin = seg * k, end = std::min(begin + k, T_ + 1);
+        std::vector<Array1<float>> forward(end - begin);
+        forward[0] = steps_[begin].state_scores;
+        for (int32_t t = begin + 1; t < end; t++)
+          PropagateFrame(t, true, forward[t - 1 - begin],
+                         &forward[t - begin]);
+
+        for (int32_t t = end - 1; t >= begin; t--) {
+          Array1<float> backward;
+          PropagateFrame(t, false, next_backward, &backward);
+          Array1<int32_t> old2new;
+          int32_t num_arc_candidates;
+          FrameOutput output = PruneFrame(
+              t, score_cutoffs, forward[t - begin], backward, next_backward,
+              next_old2new, next_offset, tot_states, &old2new,
+              &num_arc_candidates);
+          next_offset = tot_states;
+          tot_states += output.state_keys.Dim();
+          tot_arcs += num_arc_candidates;
+          next_backward = backward;
+          next_old2new = old2new;
+          if (tot_states <= max_states_ && tot_arcs <= max_arcs_)
+            outputs.push_back(output);
+        }
+      }
+
+      if (tot_states > max_states_) {
+        float cur_beam = output_beam_;
+        DecreaseBeam(max_states_, tot_states);
+        K2_LOG(INFO) << "Num-states " << tot_states << " exceeds limit "
+                     << max_states_ << ", decreasing beam from " << cur_beam
+                     << " to " << output_beam_;
+      } else if (tot_arcs > max_arcs_) {
+        float cur_beam = output_beam_;
+        DecreaseBeam(max_arcs_, tot_arcs);
+        K2_LOG(INFO) << "Num-arcs " << tot_arcs << " exceeds limit "
+                     << max_arcs_ << ", decreasing beam from " << cur_beam
+                     << " to " << output_beam_;
+      } else {
+        break;
+      }
+    }
+
+    int32_t num_outputs = outputs.size();
+    std::vector<const Array1<int32_t> *> keys_vec(num_outputs),
+        num_arcs_vec(num_outputs), arc_map_a_vec(num_outputs),
+        arc_map_b_vec(num_outputs);
+    std::vector<const Array1<Arc> *> arcs_vec(num_outputs);
+    for (int32_t i = 0; i < num_outputs; i++) {
+      keys_vec[i] = &outputs[i].state_keys;
+      num_arcs_vec[i] = &outputs[i].num_arcs;
+      arcs_vec[i] = &outputs[i].arcs;
+      arc_map_a_vec[i] = &outputs[i].arc_map_a;
+      arc_map_b_vec[i] = &outputs[i].arc_map_b;
+    }
+    // In the following, "cat" refers to the order in which states and arcs
+    // were produced, i.e. last frame first.
+    Array1<int32_t> cat_keys = Cat(c_, num_outputs, keys_vec.data()),
+                    cat_num_arcs = Cat(c_, num_outputs, num_arcs_vec.data()),
+                    cat_arc_map_a = Cat(c_, num_outputs, arc_map_a_vec.data()),
+                    cat_arc_map_b = Cat(c_, num_outputs, arc_map_b_vec.data());
+    Array1<Arc> cat_arcs = Cat(c_, num_outputs, arcs_vec.data());
+    outputs.clear();
+    int32_t num_arcs_out = cat_arcs.Dim();
+    K2_CHECK_EQ(cat_keys.Dim(), tot_states);
+
+    // Sorting the keys puts the states in order of (FSA, frame, state), which
+    // is the order of the states in the output.
+    Array1<int32_t> new2cat(c_, tot_states);
+    if (tot_states > 0) {
+      Array1<int32_t> row_splits(c_, std::vector<int32_t>{0, tot_states});
+      Ragged<int32_t> keys(RaggedShape2(&row_splits, nullptr, tot_states),
+                           cat_keys);
+      SortSublists(&keys, &new2cat);
+      cat_keys = keys.values;
+    }
+
+    Array1<int32_t> cat2new(c_, tot_states),
+        ans_row_ids1(c_, tot_states), ans_row_splits1(c_, num_fsas_ + 1),
+        ans_row_splits2(c_, tot_states + 1),
+        cat_arcs_row_splits(c_, tot_states + 1);
+    const int32_t *new2cat_data = new2cat.Data(),
+                  *sorted_keys_data = cat_keys.Data(),
+                  *cat_num_arcs_data = cat_num_arcs.Data(),
+                  *a_fsas_row_ids1_data = a_fsas_.RowIds(1).Data();
+    int32_t *cat2new_data = cat2new.Data(),
+            *ans_row_ids1_data = ans_row_ids1.Data(),
+            *ans_row_splits2_data = ans_row_splits2.Data(),
+            *cat_arcs_row_splits_data = cat_arcs_row_splits.Data();
+    int32_t T = T_;
+    K2_EVAL(
+        c_, tot_states, lambda_set_state_order, (int32_t new_idx)->void {
+          int32_t cat_idx = new2cat_data[new_idx];
+          cat2new_data[cat_idx] = new_idx;
+          // See lambda_set_keep in FormatOutput().
+          ans_row_ids1_data[new_idx] =
+              a_fsas_row_ids1_data[sorted_keys_data[new_idx] / (T + 1)];
+          ans_row_splits2_data[new_idx] = cat_num_arcs_data[cat_idx];
+          cat_arcs_row_splits_data[cat_idx] = cat_num_arcs_data[cat_idx];
+        });
+    RowIdsToRowSplits(ans_row_ids1, &ans_row_splits1);
+    ExclusiveSum(ans_row_splits2, &ans_row_splits2);
+    ExclusiveSum(cat_arcs_row_splits, &cat_arcs_row_splits);
+
+    Array1<Arc> arcs(c_, num_arcs_out);
+    Array1<int32_t> ans_row_ids2(c_, num_arcs_out);
+    int32_t *arc_map_a_data = nullptr, *arc_map_b_data = nullptr;
+    if (arc_map_a) {
+      *arc_map_a = Array1<int32_t>(c_, num_arcs_out);
+      arc_map_a_data = arc_map_a->Data();
+    }
+    if (arc_map_b) {
+      *arc_map_b = Array1<int32_t>(c_, num_arcs_out);
+      arc_map_b_data = arc_map_b->Data();
+    }
+    Arc *arcs_data = arcs.Data();
+    const Arc *cat_arcs_data = cat_arcs.Data();
+    const int32_t *cat_arc_map_a_data = cat_arc_map_a.Data(),
+                  *cat_arc_map_b_data = cat_arc_map_b.Data(),
+                  *ans_row_splits1_data = ans_row_splits1.Data();
+    int32_t *ans_row_ids2_data = ans_row_ids2.Data();
+    K2_EVAL(
+        c_, num_arcs_out, lambda_set_arcs, (int32_t cat_arc_idx)->void {
+          Arc arc = cat_arcs_data[cat_arc_idx];
+          int32_t cat_src_idx = arc.src_state,
+                  src_idx = cat2new_data[cat_src_idx],
+                  dest_idx = cat2new_data[arc.dest_state],
+                  state_idx0x = ans_row_splits1_data[ans_row_ids1_data[src_idx]],
+                  arc_idx = ans_row_splits2_data[src_idx] + cat_arc_idx -
+                            cat_arcs_row_splits_data[cat_src_idx];
+          arc.src_state = src_idx - state_idx0x;
+          arc.dest_state = dest_idx - state_idx0x;
+          arcs_data[arc_idx] = arc;
+          ans_row_ids2_data[arc_idx] = src_idx;
+          if (arc_map_a_data)
+            arc_map_a_data[arc_idx] = cat_arc_map_a_data[cat_arc_idx];
+          if (arc_map_b_data)
+            arc_map_b_data[arc_idx] = cat_arc_map_b_data[cat_arc_idx];
+        });
+
+    RaggedShape ans_shape =
+        RaggedShape3(&ans_row_splits1, &ans_row_ids1, tot_states,
+                     &ans_row_splits2, &ans_row_ids2, num_arcs_out);
+    return Ragged<Arc>(ans_shape, arcs);
+  }
+
   /*
      Decrease output beam according to num_states or num_arcs, `limit` would be
      the max_states or max_arcs (mainly to avoid out-of-memory conditions),
@@ -855,15 +1693,17 @@ class MultiGraphDenseIntersect {
   Array1<float> GetScoreCutoffs() {
     NVTX_RANGE(K2_FUNC);
 
-    std::vector<float *> state_scores_vec(T_ + 1);
-    int32_t tot_states = a_fsas_.TotSize(1);
-    if (state_scores_.Dim() == 0) {
-      for (int32_t t = 0; t <= T_; t++) {
-        state_scores_vec[t] = steps_[t].state_scores.Data();
-      }
-      state_scores_ = Array1<float *>(c_, state_scores_vec);
+    // In checkpointed mode the total scores were saved by RecordTotScores(),
+    // as the state scores for most frames no longer exist.
+    const float *tot_scores_start_data = nullptr,
+                *tot_scores_end_data = nullptr;
+    StateScoresAccessor state_scores;
+    if (checkpoint_interval_ > 0) {
+      tot_scores_start_data = tot_scores_start_.Data();
+      tot_scores_end_data = tot_scores_end_.Data();
+    } else {
+      state_scores = GetStateScoresAccessor();
     }
-    float **state_scores_data = state_scores_.Data();
 
     FsaInfo *fsa_info_data = fsa_info_.Data();
     Array1<float> score_cutoffs(c_, num_fsas_),
@@ -886,16 +1726,22 @@ class MultiGraphDenseIntersect {
           // We get the start and end scores after fsa_info.T steps of
           // propagation, and the result is in the state_scores of the Step
           // indexed fsa_info.T.
-          float *this_state_scores = state_scores_data[fsa_info.T];
+          float tot_score_start, tot_score_end;
+          if (tot_scores_start_data != nullptr) {
+            tot_score_start = tot_scores_start_data[fsa_idx0];
+            tot_score_end = tot_scores_end_data[fsa_idx0];
+          } else {
+            tot_score_start =
+                (fsa_info.num_states == 0
+                     ? minus_inf
+                     : state_scores(fsa_info.T, backward_state_idx));
+            tot_score_end = (fsa_info.num_states == 0
+                                 ? minus_inf
+                                 : state_scores(fsa_info.T, forward_state_idx));
+          }
           // Take the worst of the state scores; this will reduce the chance of
           // roundoff errors causing all states to be pruned away.
-          float tot_score_start = (fsa_info.num_states == 0
-                                       ? minus_inf
-                                       : this_state_scores[backward_state_idx]),
-                tot_score_end = (fsa_info.num_states == 0
-                                     ? minus_inf
-                                     : this_state_scores[forward_state_idx]),
-                tot_score_min =
+          float tot_score_min =
                     (tot_score_start < tot_score_end ? tot_score_start
                                                      : tot_score_end);
           score_cutoffs_data[fsa_idx0] = tot_score_min - output_beam;
@@ -970,11 +1816,11 @@ class MultiGraphDenseIntersect {
     uint16_t T;
     // num_states is the number of states this FSA has.
     uint16_t num_states;
-    // scores_offset is the offset of first location in b_fsas_.scores.Data()
-    // that is for this FSA, i.e. b_fsas_.scores.Data()[scores_offset] is the
-    // score for t=0, symbol=-1 of this FSA.
+    // scores_offset is the "arc-index" (see DenseFsaVec::NumArcs()) of the
+    // score for t=0, symbol=-1 of this FSA, i.e. in the dense case
+    // b_fsas_.scores.Data()[scores_offset] is that score.
     // scores_offset == b_fsas_.shape.RowSplits(1)[fsa_idx] *
-    // b_fsas_.scores.ElemStride0().
+    // b_fsas_.ScoresStride().
     int32_t scores_offset;
     // state_offset is the idx0x corresponding to this FSA in a_fsas_.
     int32_t state_offset;
@@ -1009,6 +1855,13 @@ class MultiGraphDenseIntersect {
     // The order is:  [backward scores for FSA 0][forward scores for FSA 0]
     // [backward scores for FSA 1][forward scores for FSA 1] and so on.
     Array1<float> state_scores;
+
+    // Only used in pruned mode, where they replace `state_scores` once it
+    // is no longer needed for propagation: the sorted indexes into
+    // `state_scores` of the scores that were not pruned away, and those
+    // scores.  See CompactStep().
+    Array1<int32_t> kept_positions;
+    Array1<float> kept_scores;
   };
 
   // steps_.size() ==  T_ + 1.
@@ -1025,14 +1878,37 @@ class MultiGraphDenseIntersect {
 
   int32_t max_states_;  // number of max states to avoid out-of-memory
   int32_t max_arcs_;    // number of max arcs to avoid out-of-memory
+
+  // If >0, we are in checkpointed mode: after Intersect(), only
+  // steps_[t].state_scores for t a multiple of checkpoint_interval_ are kept.
+  // If 0, the state scores of all steps are kept.
+  int32_t checkpoint_interval_;
+
+  // Only used in checkpointed mode: for each FSA, the backward score of the
+  // start state on frame 0 and the forward score of the final state on its
+  // last frame, as set by RecordTotScores().
+  Array1<float> tot_scores_start_;
+  Array1<float> tot_scores_end_;
+
+  // If >0, we are in pruned mode, see the constructor.
+  float search_beam_;
+
+  // Only used in pruned mode: see InitHalvesRowSplits().
+  Array1<int32_t> halves_row_splits_;
+  // Only used in pruned mode: the Data() pointers of steps_[t].kept_positions
+  // and steps_[t].kept_scores, and their Dim(), for 0 <= t <= T_.
+  Array1<int32_t *> state_positions_;
+  Array1<float *> state_values_;
+  Array1<int32_t> state_num_kept_;
 };
 
 void IntersectDense(FsaVec &a_fsas, DenseFsaVec &b_fsas,
                     const Array1<int32_t> *a_to_b_map,
                     float output_beam, int32_t max_states, int32_t max_arcs,
                     FsaVec *out, Array1<int32_t> *arc_map_a,
-                    Array1<int32_t> *arc_map_b) {
-  NVTX_RANGE("IntersectDense");
+                    Array1<int32_t> *arc_map_b, int64_t memory_budget,
+                    float search_beam) {
+  NVTX_RANGE_PAYLOAD("IntersectDense", kIntersect, b_fsas.shape.Dim0());
   Array1<int32_t> temp;
   K2_CHECK_EQ(a_fsas.NumAxes(), 3);
   if (a_to_b_map == nullptr) {
@@ -1050,7 +1926,9 @@ void IntersectDense(FsaVec &a_fsas, DenseFsaVec &b_fsas,
                                        *a_to_b_map,
                                        output_beam,
                                        max_states,
-                                       max_arcs);
+                                       max_arcs,
+                                       memory_budget,
+                                       search_beam);
 
   intersector.Intersect();
   FsaVec ret = intersector.FormatOutput(arc_map_a, arc_map_b);
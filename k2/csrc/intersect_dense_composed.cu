@@ -0,0 +1,730 @@
+/**
+ * Copyright      2026  Xiaomi Corporation
+ *
+ * See LICENSE for clarification regarding multiple authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <limits>
+#include <memory>
+#include <vector>
+
+#include "k2/csrc/array_ops.h"
+#include "k2/csrc/fsa_utils.h"
+#include "k2/csrc/hash.h"
+#include "k2/csrc/intersect_dense_composed.h"
+#include "k2/csrc/macros.h"
+#include "k2/csrc/ragged_ops.h"
+
+namespace k2 {
+
+namespace intersect_dense_composed_internal {
+
+struct StateInfo {
+  // The state of HL, as an idx1 (HL has one FSA).
+  int32_t hl_state;
+  // The state of G, as an idx1 (G has one FSA).
+  int32_t g_state;
+  // Viterbi score of the best path to this state, as FloatToOrderedInt(), so
+  // that it can be updated with AtomicMax().
+  int32_t forward_loglike;
+  // Viterbi score of the best path from this state to the final state; set
+  // in BackwardPass().
+  float backward_loglike;
+};
+
+struct ArcInfo {
+  // The arc of HL that this arc came from.
+  int32_t hl_arc_idx012;
+  // The arc of G with the word of this arc, or -1 if it has no word.
+  int32_t g_arc_idx012;
+  // The state of G that this arc enters.
+  int32_t dest_g_state;
+  // The idx1 of the destination state in the `states` of the next frame, or
+  // -1 if the arc was pruned.
+  int32_t dest_state_idx1;
+  // Score of this arc: that of `b_fsas`, plus those of the arcs of HL and G
+  // (including any backoff arcs of G).
+  float arc_loglike;
+};
+
+struct FrameInfo {
+  // States active on this frame, indexed [seq][state].
+  Ragged<StateInfo> states;
+  // Arcs leaving those states, indexed [seq][state][arc]; they end on the
+  // next frame.
+  Ragged<ArcInfo> arcs;
+};
+
+// Returns the index of the first arc in [begin, end) whose label is not less
+// than `label`, comparing labels as unsigned like Arc::operator <.
+__host__ __device__ __forceinline__ int32_t LowerBoundLabel(const Arc *arcs,
+                                                            int32_t begin,
+                                                            int32_t end,
+                                                            int32_t label) {
+  while (begin < end) {
+    int32_t mid = (begin + end) / 2;
+    if (static_cast<uint32_t>(arcs[mid].label) < static_cast<uint32_t>(label))
+      begin = mid + 1;
+    else
+      end = mid;
+  }
+  return begin;
+}
+
+/*
+  Follows the arc with label `word` from state `g_state` of the arc-sorted FSA
+  G, taking backoff arcs (label 0) until a state with such an arc is found.
+
+     @param [in] g_row_splits2   RowSplits(2) of G, as an FsaVec with one FSA
+     @param [in] g_arcs    The arcs of G
+     @param [in] g_state   The state to start from
+     @param [in] word      The label to follow; must not be 0.
+     @param [out] dest_state  The state of G at the end of the arc found.
+     @param [out] score    The score of the arc found plus those of the
+                           backoff arcs taken.
+     @return  Returns the index of the arc found, or -1 if there was none
+              (i.e. a state with no backoff arc was reached first); in that
+              case `dest_state` and `score` are not set.
+*/
+__host__ __device__ __forceinline__ int32_t FindGArc(
+    const int32_t *g_row_splits2, const Arc *g_arcs, int32_t g_state,
+    int32_t word, int32_t *dest_state, float *score) {
+  float backoff_score = 0.0f;
+  while (true) {
+    int32_t begin = g_row_splits2[g_state], end = g_row_splits2[g_state + 1],
+            i = LowerBoundLabel(g_arcs, begin, end, word);
+    if (i < end && g_arcs[i].label == word) {
+      *dest_state = g_arcs[i].dest_state;
+      *score = backoff_score + g_arcs[i].score;
+      return i;
+    }
+    // Epsilon sorts first, so the backoff arc, if any, is the first arc.
+    if (begin == end || g_arcs[begin].label != 0) return -1;
+    backoff_score += g_arcs[begin].score;
+    g_state = g_arcs[begin].dest_state;
+  }
+}
+
+class ComposedDenseIntersectPruned {
+ public:
+  /*
+    Constructor; see IntersectDensePrunedComposed() for the meaning of the
+    args.  `hl` and `g` must be FsaVecs with one FSA each.
+  */
+  ComposedDenseIntersectPruned(FsaVec &hl, Array1<int32_t> &hl_aux_labels,
+                               FsaVec &g, DenseFsaVec &b_fsas,
+                               float search_beam, float output_beam,
+                               int32_t min_active, int32_t max_active)
+      : c_(GetContext(hl, hl_aux_labels, g, b_fsas)),
+        hl_(hl),
+        hl_aux_labels_(hl_aux_labels),
+        g_(g),
+        b_fsas_(b_fsas),
+        num_seqs_(b_fsas.shape.Dim0()),
+        search_beam_(search_beam),
+        output_beam_(output_beam),
+        min_active_(min_active),
+        max_active_(max_active),
+        dynamic_beams_(c_, b_fsas.shape.Dim0(), search_beam),
+        state_map_(c_, 128) {
+    NVTX_RANGE(K2_FUNC);
+    K2_CHECK_EQ(hl.Dim0(), 1);
+    K2_CHECK_EQ(g.Dim0(), 1);
+    K2_CHECK_EQ(hl_aux_labels.Dim(), hl.NumElements());
+    K2_CHECK_GT(search_beam, 0);
+    K2_CHECK_GT(output_beam, 0);
+    K2_CHECK_GE(min_active, 0);
+    K2_CHECK_GT(max_active, min_active);
+    // The hash is keyed on (seq, hl_state, g_state); all-ones is reserved to
+    // mean "empty" in class Hash64.
+    K2_CHECK_LT(static_cast<double>(num_seqs_) * hl.TotSize(1) * g.TotSize(1),
+                static_cast<double>(std::numeric_limits<int64_t>::max()))
+        << "Too many states in HL and G";
+  }
+
+  ~ComposedDenseIntersectPruned() {
+    // The hash is normally empty at this point, but may not be if an
+    // exception was thrown; avoid the check in its destructor.
+    state_map_.Destroy();
+  }
+
+  // Does the forward and backward passes; the result can then be obtained
+  // with FormatOutput().
+  void Intersect() {
+    NVTX_RANGE(K2_FUNC);
+    T_ = b_fsas_.shape.MaxSize(1);
+    frames_.reserve(T_ + 1);
+    frames_.push_back(InitialFrameInfo());
+    for (int32_t t = 0; t < T_; t++)
+      frames_.push_back(PropagateForward(t, frames_.back().get()));
+
+    // The states on the last frame have no arcs.
+    Ragged<StateInfo> &last_states = frames_.back()->states;
+    frames_.back()->arcs = Ragged<ArcInfo>(
+        ComposeRaggedShapes(
+            last_states.shape,
+            RegularRaggedShape(c_, last_states.NumElements(), 0)),
+        Array1<ArcInfo>(c_, 0));
+    BackwardPass();
+  }
+
+  void FormatOutput(FsaVec *ofsa, Array1<int32_t> *arc_map_hl,
+                    Array1<int32_t> *arc_map_g, Array1<int32_t> *arc_map_b) {
+    NVTX_RANGE(K2_FUNC);
+    int32_t T = T_;
+    // Best score of each sequence, or -infinity if it has no successful
+    // path.
+    Array1<float> tot_scores(c_, num_seqs_);
+    float *tot_scores_data = tot_scores.Data();
+    const StateInfo *start_states_data = frames_[0]->states.values.Data();
+    const int32_t *start_row_splits1_data =
+        frames_[0]->states.RowSplits(1).Data();
+    K2_EVAL(
+        c_, num_seqs_, lambda_set_tot_scores, (int32_t seq)->void {
+          int32_t begin = start_row_splits1_data[seq];
+          tot_scores_data[seq] =
+              (begin < start_row_splits1_data[seq + 1]
+                   ? start_states_data[begin].backward_loglike
+                   : -std::numeric_limits<float>::infinity());
+        });
+
+    // Decide which arcs to keep; a state is kept if any arc entering or
+    // leaving it is kept, so that we never keep an arc without its states
+    // because of roundoff.
+    std::vector<Renumbering> state_renumberings(T + 1),
+        arc_renumberings(T + 1);
+    for (int32_t t = 0; t <= T; t++) {
+      state_renumberings[t] =
+          Renumbering(c_, frames_[t]->states.NumElements());
+      state_renumberings[t].Keep() = 0;
+    }
+    float output_beam = output_beam_;
+    for (int32_t t = 0; t <= T; t++) {
+      Ragged<ArcInfo> &arcs = frames_[t]->arcs;
+      int32_t num_arcs = arcs.NumElements();
+      arc_renumberings[t] = Renumbering(c_, num_arcs);
+      if (num_arcs == 0) continue;
+      char *keep_arc_data = arc_renumberings[t].Keep().Data(),
+           *keep_state_data = state_renumberings[t].Keep().Data(),
+           *keep_next_state_data = state_renumberings[t + 1].Keep().Data();
+      const ArcInfo *arcs_data = arcs.values.Data();
+      const StateInfo *states_data = frames_[t]->states.values.Data(),
+                      *next_states_data = frames_[t + 1]->states.values.Data();
+      const int32_t *arcs_row_ids2_data = arcs.RowIds(2).Data(),
+                    *arcs_row_ids1_data = arcs.RowIds(1).Data(),
+                    *next_row_splits1_data =
+                        frames_[t + 1]->states.RowSplits(1).Data();
+      K2_EVAL(
+          c_, num_arcs, lambda_keep_arcs, (int32_t arc_idx012)->void {
+            ArcInfo arc = arcs_data[arc_idx012];
+            int32_t state_idx01 = arcs_row_ids2_data[arc_idx012],
+                    seq = arcs_row_ids1_data[state_idx01];
+            float tot_score = tot_scores_data[seq];
+            char keep = 0;
+            if (arc.dest_state_idx1 >= 0 &&
+                tot_score > -std::numeric_limits<float>::infinity()) {
+              int32_t next_state_idx01 =
+                  next_row_splits1_data[seq] + arc.dest_state_idx1;
+              float score =
+                  OrderedIntToFloat(states_data[state_idx01].forward_loglike) +
+                  arc.arc_loglike +
+                  next_states_data[next_state_idx01].backward_loglike;
+              if (score >= tot_score - output_beam) {
+                keep = 1;
+                // Benign races: all writers write 1.
+                keep_state_data[state_idx01] = 1;
+                keep_next_state_data[next_state_idx01] = 1;
+              }
+            }
+            keep_arc_data[arc_idx012] = keep;
+          });
+    }
+
+    // Renumber the kept arcs; their destination states must be renumbered
+    // with the states of the next frame.
+    std::vector<RaggedShape> arcs_shapes(T + 1);
+    std::vector<Array1<ArcInfo>> arcs_values(T + 1);
+    for (int32_t t = 0; t <= T; t++)
+      arcs_shapes[t] = SubsetRaggedShape(frames_[t]->arcs.shape,
+                                         state_renumberings[t],
+                                         arc_renumberings[t]);
+    for (int32_t t = 0; t < T; t++) {
+      Array1<int32_t> &arc_new2old = arc_renumberings[t].New2Old();
+      int32_t num_arcs = arc_new2old.Dim();
+      arcs_values[t] = Array1<ArcInfo>(c_, num_arcs);
+      ArcInfo *new_arcs_data = arcs_values[t].Data();
+      const ArcInfo *arcs_data = frames_[t]->arcs.values.Data();
+      const int32_t *arc_new2old_data = arc_new2old.Data(),
+                    *arcs_row_ids2_data = frames_[t]->arcs.RowIds(2).Data(),
+                    *arcs_row_ids1_data = frames_[t]->arcs.RowIds(1).Data(),
+                    *next_old_row_splits1_data =
+                        frames_[t + 1]->states.RowSplits(1).Data(),
+                    *next_new_row_splits1_data =
+                        arcs_shapes[t + 1].RowSplits(1).Data(),
+                    *next_state_old2new_data =
+                        state_renumberings[t + 1].Old2New().Data();
+      K2_EVAL(
+          c_, num_arcs, lambda_renumber_arcs, (int32_t new_arc_idx012)->void {
+            int32_t arc_idx012 = arc_new2old_data[new_arc_idx012],
+                    seq = arcs_row_ids1_data[arcs_row_ids2_data[arc_idx012]];
+            ArcInfo arc = arcs_data[arc_idx012];
+            int32_t next_state_idx01 = next_state_old2new_data
+                [next_old_row_splits1_data[seq] + arc.dest_state_idx1];
+            arc.dest_state_idx1 =
+                next_state_idx01 - next_new_row_splits1_data[seq];
+            new_arcs_data[new_arc_idx012] = arc;
+          });
+    }
+
+    RaggedShape oshape;
+    // see documentation of Stack() in ragged_ops.h for explanation.
+    Array1<uint32_t> oshape_merge_map;
+    {
+      std::vector<RaggedShape *> arcs_shapes_ptrs(T + 1);
+      for (int32_t t = 0; t <= T; t++) arcs_shapes_ptrs[t] = &arcs_shapes[t];
+      // oshape is indexed [seq][t][state][arc].
+      oshape = Stack(1, T + 1, arcs_shapes_ptrs.data(), &oshape_merge_map);
+    }
+
+    ContextPtr c_cpu = GetCpuContext();
+    Array1<ArcInfo *> arcs_data_ptrs(c_cpu, T + 1);
+    for (int32_t t = 0; t < T; t++)
+      arcs_data_ptrs.Data()[t] = arcs_values[t].Data();
+    arcs_data_ptrs.Data()[T] = nullptr;  // The last frame has no arcs.
+    arcs_data_ptrs = arcs_data_ptrs.To(c_);
+    ArcInfo **arcs_data_ptrs_data = arcs_data_ptrs.Data();
+
+    const int32_t *oshape_row_ids3 = oshape.RowIds(3).Data(),
+                  *oshape_row_ids2 = oshape.RowIds(2).Data(),
+                  *oshape_row_ids1 = oshape.RowIds(1).Data(),
+                  *oshape_row_splits2 = oshape.RowSplits(2).Data(),
+                  *oshape_row_splits1 = oshape.RowSplits(1).Data();
+    const uint32_t *oshape_merge_map_data = oshape_merge_map.Data();
+    int32_t num_arcs = oshape.NumElements();
+    Array1<Arc> arcs_out(c_, num_arcs);
+    *arc_map_hl = Array1<int32_t>(c_, num_arcs);
+    *arc_map_g = Array1<int32_t>(c_, num_arcs);
+    *arc_map_b = Array1<int32_t>(c_, num_arcs);
+    Arc *arcs_out_data = arcs_out.Data();
+    int32_t *arc_map_hl_data = arc_map_hl->Data(),
+            *arc_map_g_data = arc_map_g->Data(),
+            *arc_map_b_data = arc_map_b->Data();
+    const Arc *hl_arcs_data = hl_.values.Data();
+    const int32_t *b_fsas_row_splits1 = b_fsas_.shape.RowSplits(1).Data();
+    int32_t b_fsas_num_cols = b_fsas_.NumCols();
+    K2_EVAL(
+        c_, num_arcs, lambda_format_arc_data, (int32_t oarc_idx0123)->void {
+          int32_t oarc_idx012 = oshape_row_ids3[oarc_idx0123],
+                  oarc_idx01 = oshape_row_ids2[oarc_idx012],
+                  oarc_idx0 = oshape_row_ids1[oarc_idx01],
+                  oarc_idx0x = oshape_row_splits1[oarc_idx0],
+                  oarc_idx0xx = oshape_row_splits2[oarc_idx0x],
+                  oarc_idx01x_next = oshape_row_splits2[oarc_idx01 + 1];
+          uint32_t m = oshape_merge_map_data[oarc_idx0123];
+          int32_t t = m % (T + 1), arc_idx012 = m / (T + 1);
+          ArcInfo arc_info = arcs_data_ptrs_data[t][arc_idx012];
+          Arc arc;
+          arc.src_state = oarc_idx012 - oarc_idx0xx;
+          // The idx1 w.r.t. the frame's `states` is an idx2 w.r.t. `oshape`.
+          arc.dest_state =
+              oarc_idx01x_next + arc_info.dest_state_idx1 - oarc_idx0xx;
+          arc.label = hl_arcs_data[arc_info.hl_arc_idx012].label;
+          arc.score = arc_info.arc_loglike;
+          arcs_out_data[oarc_idx0123] = arc;
+          arc_map_hl_data[oarc_idx0123] = arc_info.hl_arc_idx012;
+          arc_map_g_data[oarc_idx0123] = arc_info.g_arc_idx012;
+          arc_map_b_data[oarc_idx0123] =
+              (b_fsas_row_splits1[oarc_idx0] + t) * b_fsas_num_cols +
+              arc.label + 1;
+        });
+    *ofsa = FsaVec(RemoveAxis(oshape, 1), arcs_out);
+  }
+
+ private:
+  // Returns the FrameInfo for frame 0, which contains the start state of
+  // each sequence, if HL and G are nonempty.
+  std::unique_ptr<FrameInfo> InitialFrameInfo() {
+    NVTX_RANGE(K2_FUNC);
+    int32_t num_states_per_seq =
+        (hl_.TotSize(1) > 0 && g_.TotSize(1) > 0 ? 1 : 0);
+    auto ans = std::make_unique<FrameInfo>();
+    ans->states = Ragged<StateInfo>(
+        RegularRaggedShape(c_, num_seqs_, num_states_per_seq),
+        Array1<StateInfo>(c_, num_seqs_ * num_states_per_seq));
+    StateInfo *states_data = ans->states.values.Data();
+    K2_EVAL(
+        c_, ans->states.NumElements(), lambda_set_start_states,
+        (int32_t i)->void {
+          StateInfo info;
+          info.hl_state = 0;
+          info.g_state = 0;
+          info.forward_loglike = FloatToOrderedInt(0.0f);
+          info.backward_loglike = -std::numeric_limits<float>::infinity();
+          states_data[i] = info;
+        });
+    return ans;
+  }
+
+  /*
+    Returns the arcs leaving the states of `cur_frame`, i.e. the arcs of HL
+    leaving their HL states, each combined with the arc of G with its word,
+    if any.  Arcs with a word that G cannot accept get a score of -infinity.
+    The `dest_state_idx1` of the arcs is set later, in PropagateForward().
+
+       @param [in] t    The frame index, 0 <= t < T_
+       @param [in] cur_frame  The frame whose `states` are to be expanded
+       @param [out] end_loglikes  Will be set to the forward score of the
+                        source state plus the score of each arc.
+  */
+  Ragged<ArcInfo> GetArcs(int32_t t, FrameInfo *cur_frame,
+                          Array1<float> *end_loglikes) {
+    NVTX_RANGE(K2_FUNC);
+    Ragged<StateInfo> &states = cur_frame->states;
+    const StateInfo *states_data = states.values.Data();
+    const int32_t *states_row_ids1_data = states.RowIds(1).Data(),
+                  *hl_row_splits2_data = hl_.RowSplits(2).Data(),
+                  *b_fsas_row_splits1 = b_fsas_.shape.RowSplits(1).Data();
+    int32_t num_states = states.NumElements();
+
+    Array1<int32_t> num_arcs(c_, num_states + 1);
+    int32_t *num_arcs_data = num_arcs.Data();
+    K2_EVAL(
+        c_, num_states, lambda_set_num_arcs, (int32_t state_idx01)->void {
+          int32_t seq = states_row_ids1_data[state_idx01],
+                  num_frames = b_fsas_row_splits1[seq + 1] -
+                               b_fsas_row_splits1[seq],
+                  hl_state = states_data[state_idx01].hl_state;
+          // The states on the last frame of a sequence have no arcs.
+          num_arcs_data[state_idx01] =
+              (t < num_frames ? hl_row_splits2_data[hl_state + 1] -
+                                    hl_row_splits2_data[hl_state]
+                              : 0);
+        });
+    ExclusiveSum(num_arcs, &num_arcs);
+    int32_t tot_arcs = num_arcs.Back();
+    RaggedShape arcs_shape = ComposeRaggedShapes(
+        states.shape, RaggedShape2(&num_arcs, nullptr, tot_arcs));
+
+    Array1<ArcInfo> arcs(c_, tot_arcs);
+    *end_loglikes = Array1<float>(c_, tot_arcs);
+    ArcInfo *arcs_data = arcs.Data();
+    float *end_loglikes_data = end_loglikes->Data();
+    const int32_t *arcs_row_ids2_data = arcs_shape.RowIds(2).Data(),
+                  *arcs_row_splits2_data = arcs_shape.RowSplits(2).Data(),
+                  *hl_aux_labels_data = hl_aux_labels_.Data(),
+                  *g_row_splits2_data = g_.RowSplits(2).Data();
+    const Arc *hl_arcs_data = hl_.values.Data(),
+              *g_arcs_data = g_.values.Data();
+    auto scores_acc = DenseFsaVecScoresAccessor(b_fsas_);
+    K2_EVAL(
+        c_, tot_arcs, lambda_set_arcs, (int32_t arc_idx012)->void {
+          int32_t state_idx01 = arcs_row_ids2_data[arc_idx012],
+                  seq = states_row_ids1_data[state_idx01];
+          StateInfo state = states_data[state_idx01];
+          int32_t hl_arc_idx012 = hl_row_splits2_data[state.hl_state] +
+                                  arc_idx012 -
+                                  arcs_row_splits2_data[state_idx01];
+          Arc hl_arc = hl_arcs_data[hl_arc_idx012];
+          float arc_loglike =
+              scores_acc(b_fsas_row_splits1[seq] + t, hl_arc.label + 1) +
+              hl_arc.score;
+          ArcInfo info;
+          info.hl_arc_idx012 = hl_arc_idx012;
+          info.g_arc_idx012 = -1;
+          info.dest_g_state = state.g_state;
+          info.dest_state_idx1 = -1;
+          int32_t word = hl_aux_labels_data[hl_arc_idx012];
+          if (word != 0) {
+            float g_score;
+            info.g_arc_idx012 =
+                FindGArc(g_row_splits2_data, g_arcs_data, state.g_state, word,
+                         &info.dest_g_state, &g_score);
+            if (info.g_arc_idx012 >= 0)
+              arc_loglike += g_score;
+            else  // G does not accept this word; the arc will be pruned.
+              arc_loglike = -std::numeric_limits<float>::infinity();
+          }
+          info.arc_loglike = arc_loglike;
+          arcs_data[arc_idx012] = info;
+          end_loglikes_data[arc_idx012] =
+              OrderedIntToFloat(state.forward_loglike) + arc_loglike;
+        });
+    return Ragged<ArcInfo>(arcs_shape, arcs);
+  }
+
+  /*
+    Sets up the arcs of `cur_frame`, prunes them, and returns the next frame,
+    whose states are the distinct (hl_state, g_state) pairs that the surviving
+    arcs enter.  See MultiGraphDenseIntersectPruned::PropagateForward() for
+    the non-composed version.
+  */
+  std::unique_ptr<FrameInfo> PropagateForward(int32_t t,
+                                              FrameInfo *cur_frame) {
+    NVTX_RANGE(K2_FUNC);
+    Array1<float> end_loglikes;
+    cur_frame->arcs = GetArcs(t, cur_frame, &end_loglikes);
+    Ragged<ArcInfo> &arcs = cur_frame->arcs;
+    int32_t num_arcs = arcs.NumElements();
+    Ragged<float> end_loglikes_ragged(arcs.shape, end_loglikes);
+    Array1<float> cutoffs = GetPruningCutoffs(end_loglikes_ragged, t);
+
+    // Keep the occupancy of the hash below 50%.
+    if (2 * static_cast<int64_t>(num_arcs) > state_map_.NumBuckets())
+      state_map_.Resize(RoundUpToNearestPowerOfTwo(2 * num_arcs), false);
+    auto state_map_acc = state_map_.GetAccessor();
+
+    const ArcInfo *arcs_data = arcs.values.Data();
+    const Arc *hl_arcs_data = hl_.values.Data();
+    const float *end_loglikes_data = end_loglikes.Data(),
+                *cutoffs_data = cutoffs.Data();
+    const int32_t *arcs_row_ids2_data = arcs.RowIds(2).Data(),
+                  *arcs_row_ids1_data = arcs.RowIds(1).Data();
+    uint64_t num_hl_states = hl_.TotSize(1), num_g_states = g_.TotSize(1);
+
+    // The key of the destination state of each arc, or all-ones if the arc
+    // is pruned.
+    Array1<uint64_t> keys(c_, num_arcs);
+    uint64_t *keys_data = keys.Data();
+    // An arc is "kept" by this renumbering if it is the one that inserted
+    // its destination state into the hash; the new numbering is that of the
+    // states of the next frame.
+    Renumbering renumber_states(c_, num_arcs);
+    char *keep_data = renumber_states.Keep().Data();
+    K2_EVAL(
+        c_, num_arcs, lambda_insert_states, (int32_t arc_idx012)->void {
+          int32_t seq = arcs_row_ids1_data[arcs_row_ids2_data[arc_idx012]];
+          uint64_t key = ~(uint64_t)0;
+          char keep = 0;
+          if (end_loglikes_data[arc_idx012] > cutoffs_data[seq]) {
+            ArcInfo arc = arcs_data[arc_idx012];
+            int32_t hl_state = hl_arcs_data[arc.hl_arc_idx012].dest_state;
+            key = (seq * num_hl_states + hl_state) * num_g_states +
+                  arc.dest_g_state;
+            if (state_map_acc.Insert(key, (uint64_t)arc_idx012)) keep = 1;
+          }
+          keys_data[arc_idx012] = key;
+          keep_data[arc_idx012] = keep;
+        });
+
+    int32_t num_states = renumber_states.NumNewElems();
+    const int32_t *old2new_data = renumber_states.Old2New().Data();
+    Array1<int32_t> row_ids1(c_, num_states);
+    Array1<StateInfo> states(c_, num_states);
+    int32_t *row_ids1_data = row_ids1.Data();
+    StateInfo *states_data = states.Data();
+    K2_EVAL(
+        c_, num_arcs, lambda_set_states, (int32_t arc_idx012)->void {
+          int32_t state_idx01 = old2new_data[arc_idx012];
+          if (old2new_data[arc_idx012 + 1] == state_idx01) return;
+          int32_t seq = arcs_row_ids1_data[arcs_row_ids2_data[arc_idx012]];
+          ArcInfo arc = arcs_data[arc_idx012];
+          StateInfo info;
+          info.hl_state = hl_arcs_data[arc.hl_arc_idx012].dest_state;
+          info.g_state = arc.dest_g_state;
+          info.forward_loglike =
+              FloatToOrderedInt(-std::numeric_limits<float>::infinity());
+          info.backward_loglike = -std::numeric_limits<float>::infinity();
+          states_data[state_idx01] = info;
+          row_ids1_data[state_idx01] = seq;
+          uint64_t value, *key_value_location = nullptr;
+          bool ans = state_map_acc.Find(keys_data[arc_idx012], &value,
+                                        &key_value_location);
+          K2_DCHECK(ans);
+          state_map_acc.SetValue(key_value_location, (uint64_t)state_idx01);
+        });
+
+    Array1<int32_t> row_splits1(c_, num_seqs_ + 1);
+    RowIdsToRowSplits(row_ids1, &row_splits1);
+    auto ans = std::make_unique<FrameInfo>();
+    ans->states = Ragged<StateInfo>(
+        RaggedShape2(&row_splits1, &row_ids1, num_states), states);
+    const int32_t *row_splits1_data = row_splits1.Data();
+
+    ArcInfo *arcs_data_mutable = arcs.values.Data();
+    K2_EVAL(
+        c_, num_arcs, lambda_set_dest_states, (int32_t arc_idx012)->void {
+          uint64_t key = keys_data[arc_idx012];
+          if (~key == 0) return;  // The arc was pruned.
+          int32_t seq = arcs_row_ids1_data[arcs_row_ids2_data[arc_idx012]];
+          uint64_t value = 0;
+          bool ans = state_map_acc.Find(key, &value);
+          K2_DCHECK(ans);
+          int32_t state_idx01 = static_cast<int32_t>(value);
+          arcs_data_mutable[arc_idx012].dest_state_idx1 =
+              state_idx01 - row_splits1_data[seq];
+          AtomicMax(&(states_data[state_idx01].forward_loglike),
+                    FloatToOrderedInt(end_loglikes_data[arc_idx012]));
+        });
+
+    // Leave the hash empty for the next frame.
+    K2_EVAL(
+        c_, num_arcs, lambda_clear_hash, (int32_t arc_idx012)->void {
+          if (old2new_data[arc_idx012 + 1] > old2new_data[arc_idx012])
+            state_map_acc.Delete(keys_data[arc_idx012]);
+        });
+    return ans;
+  }
+
+  /*
+    Returns the pruning cutoff for each sequence on frame t, as the best
+    score of any arc minus the dynamic beam; see
+    MultiGraphDenseIntersectPruned::GetPruningCutoffs(), whose adjustment of
+    the dynamic beams this follows.
+  */
+  Array1<float> GetPruningCutoffs(Ragged<float> &arc_end_scores, int32_t t) {
+    NVTX_RANGE(K2_FUNC);
+    Ragged<float> end_scores_per_seq = arc_end_scores.RemoveAxis(1);
+    Array1<float> max_per_seq(c_, num_seqs_);
+    MaxPerSublist(end_scores_per_seq, -std::numeric_limits<float>::infinity(),
+                  &max_per_seq);
+    const int32_t *arc_end_scores_row_splits1_data =
+                      arc_end_scores.RowSplits(1).Data(),
+                  *b_fsas_row_splits1 = b_fsas_.shape.RowSplits(1).Data();
+    const float *max_per_seq_data = max_per_seq.Data();
+    float *dynamic_beams_data = dynamic_beams_.Data();
+    float default_beam = search_beam_, max_active = max_active_,
+          min_active = min_active_;
+
+    Array1<float> cutoffs(c_, num_seqs_);
+    float *cutoffs_data = cutoffs.Data();
+    K2_EVAL(
+        c_, num_seqs_, lambda_set_beam_and_cutoffs, (int32_t i)->void {
+          float best_loglike = max_per_seq_data[i],
+                dynamic_beam = dynamic_beams_data[i];
+          int32_t active_states = arc_end_scores_row_splits1_data[i + 1] -
+                                  arc_end_scores_row_splits1_data[i],
+                  final_t = b_fsas_row_splits1[i + 1] - b_fsas_row_splits1[i];
+          float current_min_active = min_active;
+          if (t + 5 >= final_t)
+            current_min_active = max(min_active, max_active / 2);
+          if (active_states <= max_active) {
+            if (active_states >= current_min_active || active_states == 0) {
+              dynamic_beam = 0.8 * dynamic_beam + 0.2 * default_beam;
+            } else {
+              if (dynamic_beam < default_beam) dynamic_beam = default_beam;
+              dynamic_beam *= 1.25;
+            }
+          } else if (t + 5 < final_t) {
+            if (dynamic_beam > default_beam) dynamic_beam = default_beam;
+            dynamic_beam *= 0.8;
+          }
+          // no pruning on last frame; we want all final-arcs.
+          if (t == final_t - 1) dynamic_beam = 1.0e+10;
+          dynamic_beams_data[i] = dynamic_beam;
+          cutoffs_data[i] = best_loglike - dynamic_beam;
+        });
+    return cutoffs;
+  }
+
+  // Sets the `backward_loglike` of the states of all frames.  The states on
+  // the last frame of each sequence are its final states.
+  void BackwardPass() {
+    NVTX_RANGE(K2_FUNC);
+    const int32_t *b_fsas_row_splits1 = b_fsas_.shape.RowSplits(1).Data();
+    for (int32_t t = T_; t >= 0; t--) {
+      FrameInfo *cur_frame = frames_[t].get();
+      Ragged<ArcInfo> &arcs = cur_frame->arcs;
+      int32_t num_arcs = arcs.NumElements(),
+              num_states = cur_frame->states.NumElements();
+      Array1<float> arc_backward(c_, num_arcs);
+      float *arc_backward_data = arc_backward.Data();
+      if (num_arcs > 0) {
+        const ArcInfo *arcs_data = arcs.values.Data();
+        const StateInfo *next_states_data =
+            frames_[t + 1]->states.values.Data();
+        const int32_t *arcs_row_ids2_data = arcs.RowIds(2).Data(),
+                      *arcs_row_ids1_data = arcs.RowIds(1).Data(),
+                      *next_row_splits1_data =
+                          frames_[t + 1]->states.RowSplits(1).Data();
+        K2_EVAL(
+            c_, num_arcs, lambda_set_arc_backward, (int32_t arc_idx012)->void {
+              ArcInfo arc = arcs_data[arc_idx012];
+              float score = -std::numeric_limits<float>::infinity();
+              if (arc.dest_state_idx1 >= 0) {
+                int32_t seq =
+                    arcs_row_ids1_data[arcs_row_ids2_data[arc_idx012]];
+                score = arc.arc_loglike +
+                        next_states_data[next_row_splits1_data[seq] +
+                                         arc.dest_state_idx1]
+                            .backward_loglike;
+              }
+              arc_backward_data[arc_idx012] = score;
+            });
+      }
+      Ragged<float> arc_backward_per_state(RemoveAxis(arcs.shape, 0),
+                                           arc_backward);
+      Array1<float> state_backward(c_, num_states);
+      MaxPerSublist(arc_backward_per_state,
+                    -std::numeric_limits<float>::infinity(), &state_backward);
+      const float *state_backward_data = state_backward.Data();
+      StateInfo *states_data = cur_frame->states.values.Data();
+      const int32_t *states_row_ids1_data =
+          cur_frame->states.RowIds(1).Data();
+      K2_EVAL(
+          c_, num_states, lambda_set_state_backward,
+          (int32_t state_idx01)->void {
+            int32_t seq = states_row_ids1_data[state_idx01],
+                    num_frames = b_fsas_row_splits1[seq + 1] -
+                                 b_fsas_row_splits1[seq];
+            states_data[state_idx01].backward_loglike =
+                (t == num_frames ? 0.0f : state_backward_data[state_idx01]);
+          });
+    }
+  }
+
+  ContextPtr c_;
+  FsaVec hl_;
+  Array1<int32_t> hl_aux_labels_;
+  FsaVec g_;
+  DenseFsaVec b_fsas_;
+  int32_t num_seqs_;
+  float search_beam_;
+  float output_beam_;
+  int32_t min_active_;
+  int32_t max_active_;
+  // The current beam of each sequence, see GetPruningCutoffs().
+  Array1<float> dynamic_beams_;
+  // Maps the key of an (hl_state, g_state) pair on the next frame to its
+  // index; it is empty between frames.
+  Hash64 state_map_;
+  // The number of frames of the longest sequence.
+  int32_t T_ = 0;
+  // frames_[t] is the FrameInfo for frame t, for 0 <= t <= T_.
+  std::vector<std::unique_ptr<FrameInfo>> frames_;
+};
+
+}  // namespace intersect_dense_composed_internal
+
+void IntersectDensePrunedComposed(FsaOrVec &hl, Array1<int32_t> &hl_aux_labels,
+                                  FsaOrVec &g, DenseFsaVec &b_fsas,
+                                  float search_beam, float output_beam,
+                                  int32_t min_active_states,
+                                  int32_t max_active_states, FsaVec *out,
+                                  Array1<int32_t> *arc_map_hl,
+                                  Array1<int32_t> *arc_map_g,
+                                  Array1<int32_t> *arc_map_b) {
+  NVTX_RANGE_PAYLOAD("IntersectDensePrunedComposed", kIntersect,
+                     b_fsas.shape.Dim0());
+  K2_CHECK(out != nullptr && arc_map_hl != nullptr && arc_map_g != nullptr &&
+           arc_map_b != nullptr);
+  FsaVec hl_vec = FsaToFsaVec(hl), g_vec = FsaToFsaVec(g);
+  intersect_dense_composed_internal::ComposedDenseIntersectPruned intersector(
+      hl_vec, hl_aux_labels, g_vec, b_fsas, search_beam, output_beam,
+      min_active_states, max_active_states);
+  intersector.Intersect();
+  intersector.FormatOutput(out, arc_map_hl, arc_map_g, arc_map_b);
+}
+
+}  // namespace k2
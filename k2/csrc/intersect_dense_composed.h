@@ -0,0 +1,87 @@
+/**
+ * Copyright      2026  Xiaomi Corporation
+ *
+ * See LICENSE for clarification regarding multiple authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef K2_CSRC_INTERSECT_DENSE_COMPOSED_H_
+#define K2_CSRC_INTERSECT_DENSE_COMPOSED_H_
+
+#include "k2/csrc/array.h"
+#include "k2/csrc/fsa.h"
+
+namespace k2 {
+
+/*
+  Pruned intersection of `b_fsas` with the composition HL o G, where the
+  composition is done on the fly, for the states reached by the search only,
+  instead of compiling HLG beforehand.  This allows the language model G to
+  be swapped without recompiling the decoding graph, and the deployed graphs
+  HL and G are together much smaller than HLG.
+
+  A state of the search is a pair (state of HL, state of G); these pairs are
+  numbered on each frame with a hash keyed on them.  Every arc of HL consumes
+  one frame, as in IntersectDensePruned().  An arc of HL whose aux_label (a
+  word) is nonzero also takes the arc of G with that word as its label;
+  if the G state has no such arc, its backoff arc (label 0) is taken first,
+  repeatedly, i.e. the arcs of G with label 0 are treated as failure arcs,
+  which is exact for backoff language models.  The final arcs of HL (label
+  -1) take the final arcs of G in the same way.
+
+     @param [in] hl   The HL graph, an Fsa, or an FsaVec with one FSA.  Its
+                      labels are the symbols of `b_fsas` (e.g. tokens).
+     @param [in] hl_aux_labels  The word on each arc of `hl`: 0 for none,
+                      -1 on the final arcs.  Must have
+                      hl_aux_labels.Dim() == hl.NumElements().
+     @param [in] g    The G graph, an Fsa, or an FsaVec with one FSA; it must
+                      be arc-sorted and its labels are words.  The arcs with
+                      label 0 are backoff arcs and must not form cycles.
+     @param [in] b_fsas  The neural-net output, with each frame containing
+                      the log-likes of each symbol; as for
+                      IntersectDensePruned().
+     @param [in] search_beam  Beam for frame-synchronous beam pruning, e.g.
+                      20; as for IntersectDensePruned().
+     @param [in] output_beam  Beam with which to prune the output (relative
+                      to the best path), e.g. 8.
+     @param [in] min_active_states  Minimum number of states active on each
+                      frame of each sequence; see IntersectDensePruned().
+     @param [in] max_active_states  Maximum number of states active on each
+                      frame of each sequence; see IntersectDensePruned().
+     @param [out] out  Output lattices, one per sequence of `b_fsas`, with
+                      the labels of `hl`; the scores of the arcs are the sum
+                      of the scores of `b_fsas`, `hl` and `g` (including any
+                      backoff arcs taken).  The FSAs are empty for sequences
+                      with no successful path.
+     @param [out] arc_map_hl  Will be set to the index of the arc of `hl`
+                      that each arc of `out` came from.
+     @param [out] arc_map_g  Will be set to the index of the arc of `g` with
+                      the word of each arc of `out`, or -1 if it has no
+                      word.
+     @param [out] arc_map_b  Will be set to the index into the scores of
+                      `b_fsas` of each arc of `out`, as for
+                      IntersectDensePruned().
+ */
+void IntersectDensePrunedComposed(FsaOrVec &hl, Array1<int32_t> &hl_aux_labels,
+                                  FsaOrVec &g, DenseFsaVec &b_fsas,
+                                  float search_beam, float output_beam,
+                                  int32_t min_active_states,
+                                  int32_t max_active_states, FsaVec *out,
+                                  Array1<int32_t> *arc_map_hl,
+                                  Array1<int32_t> *arc_map_g,
+                                  Array1<int32_t> *arc_map_b);
+
+}  // namespace k2
+
+#endif  // K2_CSRC_INTERSECT_DENSE_COMPOSED_H_
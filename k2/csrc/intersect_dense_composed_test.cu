@@ -0,0 +1,191 @@
+/**
+ * Copyright      2026  Xiaomi Corporation
+ *
+ * See LICENSE for clarification regarding multiple authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <cmath>
+#include <limits>
+#include <string>
+
+#include "gtest/gtest.h"
+#include "k2/csrc/array_ops.h"
+#include "k2/csrc/fsa_algo.h"
+#include "k2/csrc/fsa_utils.h"
+#include "k2/csrc/intersect_dense_composed.h"
+#include "k2/csrc/test_utils.h"
+
+namespace k2 {
+
+static Array1<double> BestPathScores(FsaVec &fsas) {
+  Ragged<int32_t> state_batches = GetStateBatches(fsas, true);
+  Array1<int32_t> dest_states = GetDestStates(fsas, true);
+  Ragged<int32_t> incoming_arcs = GetIncomingArcs(fsas, dest_states);
+  Ragged<int32_t> entering_arc_batches =
+      GetEnteringArcIndexBatches(fsas, incoming_arcs, state_batches);
+  Array1<double> forward_scores = GetForwardScores<double>(
+      fsas, state_batches, entering_arc_batches, false);
+  return GetTotScores(fsas, forward_scores).To(GetCpuContext());
+}
+
+// Returns HL o G, composed statically, with the labels of `hl`.  `g` must be
+// epsilon-free.
+static Fsa ComposeHLG(Fsa &hl, Array1<int32_t> &hl_aux_labels, Fsa &g) {
+  Fsa hl_words = hl.Clone();
+  Arc *arcs_data = hl_words.values.Data();
+  for (int32_t i = 0; i < hl_words.NumElements(); i++)
+    arcs_data[i].label = hl_aux_labels[i];
+  Fsa hl_words_sorted;
+  Array1<int32_t> sort_arc_map;
+  ArcSort(hl_words, &hl_words_sorted, &sort_arc_map);
+
+  FsaVec hlg;
+  Array1<int32_t> arc_map_hl, arc_map_g;
+  bool ok = Intersect(hl_words_sorted, -1, g, -1, true, &hlg, &arc_map_hl,
+                      &arc_map_g);
+  K2_CHECK(ok);
+  arc_map_hl = sort_arc_map[arc_map_hl];
+  Arc *hlg_arcs_data = hlg.values.Data();
+  for (int32_t i = 0; i < hlg.NumElements(); i++)
+    hlg_arcs_data[i].label = hl.values[arc_map_hl[i]].label;
+  return hlg.Index(0, 0);
+}
+
+TEST(IntersectDensePrunedComposed, CompareWithStatic) {
+  // HL has tokens 0 (blank), 1 and 2 as labels and words 1 and 2 as
+  // aux_labels.
+  std::string hl_str = R"(0 0 0 0 0.0
+    0 1 1 1 -0.5
+    0 1 2 2 -0.5
+    0 2 -1 -1 0.0
+    1 0 0 0 0.0
+    1 0 2 2 -1.0
+    1 1 1 0 0.0
+    1 2 -1 -1 0.0
+    2
+  )";
+  // G with a backoff arc from state 1; word 1 is only accepted from state 1
+  // through it.
+  std::string g_str = R"(0 1 1 -1.0
+    0 0 2 -2.0
+    0 2 -1 0.0
+    1 0 0 -0.7
+    1 0 2 -0.5
+    1 2 -1 -0.2
+    2
+  )";
+  // The same language model, with the backoff arc replaced by the arc that
+  // it leads to.
+  std::string g_expanded_str = R"(0 1 1 -1.0
+    0 0 2 -2.0
+    0 2 -1 0.0
+    1 1 1 -1.7
+    1 0 2 -0.5
+    1 2 -1 -0.2
+    2
+  )";
+  Array2<int32_t> extra_labels;
+  Fsa hl = FsaFromString(hl_str, false, 1, &extra_labels);
+  Array1<int32_t> hl_aux_labels = extra_labels.Row(0);
+  Fsa g = FsaFromString(g_str), g_expanded = FsaFromString(g_expanded_str);
+  Fsa hlg = ComposeHLG(hl, hl_aux_labels, g_expanded);
+
+  for (auto &c : {GetCpuContext(), GetCudaContext()}) {
+    Fsa this_hl = hl.To(c), this_g = g.To(c), this_hlg = hlg.To(c);
+    Array1<int32_t> this_hl_aux_labels = hl_aux_labels.To(c);
+    for (int32_t i = 0; i < 5; i++) {
+      DenseFsaVec b_fsas = RandomDenseFsaVec(1, 4, 1, 20, 3, 3).To(c);
+      float search_beam = 1000.0, output_beam = 1000.0;
+      int32_t min_active = 0, max_active = 10000;
+      FsaVec out, ref_out;
+      Array1<int32_t> arc_map_hl, arc_map_g, arc_map_b, ref_arc_map_a,
+          ref_arc_map_b;
+      IntersectDensePrunedComposed(this_hl, this_hl_aux_labels, this_g,
+                                   b_fsas, search_beam, output_beam,
+                                   min_active, max_active, &out, &arc_map_hl,
+                                   &arc_map_g, &arc_map_b);
+      FsaVec hlg_vec = FsaToFsaVec(this_hlg);
+      IntersectDensePruned(hlg_vec, b_fsas, search_beam, output_beam,
+                           min_active, max_active, &ref_out, &ref_arc_map_a,
+                           &ref_arc_map_b);
+      ASSERT_EQ(out.Dim0(), b_fsas.shape.Dim0());
+      ASSERT_EQ(arc_map_hl.Dim(), out.NumElements());
+      ASSERT_EQ(arc_map_g.Dim(), out.NumElements());
+      ASSERT_EQ(arc_map_b.Dim(), out.NumElements());
+      Array1<int32_t> properties;
+      int32_t tot_properties;
+      GetFsaVecBasicProperties(out, &properties, &tot_properties);
+      EXPECT_TRUE(tot_properties & kFsaPropertiesValid);
+
+      Array1<double> scores = BestPathScores(out),
+                     ref_scores = BestPathScores(ref_out);
+      for (int32_t s = 0; s < scores.Dim(); s++) {
+        if (ref_scores[s] == -std::numeric_limits<double>::infinity())
+          EXPECT_EQ(scores[s], ref_scores[s]);
+        else
+          EXPECT_NEAR(scores[s], ref_scores[s], 1.0e-03);
+      }
+
+      // The scores of the arcs are those of b_fsas, HL and G, including any
+      // backoff arc, which is not in arc_map_g.
+      FsaVec cpu_out = out.To(GetCpuContext());
+      Array1<int32_t> cpu_arc_map_hl = arc_map_hl.To(GetCpuContext()),
+                      cpu_arc_map_g = arc_map_g.To(GetCpuContext()),
+                      cpu_arc_map_b = arc_map_b.To(GetCpuContext());
+      Array1<float> b_scores = b_fsas.scores.Flatten().To(GetCpuContext());
+      for (int32_t j = 0; j < cpu_out.NumElements(); j++) {
+        Arc arc = cpu_out.values[j], hl_arc = hl.values[cpu_arc_map_hl[j]];
+        EXPECT_EQ(arc.label, hl_arc.label);
+        float expected = b_scores[cpu_arc_map_b[j]] + hl_arc.score,
+              backoff_score = 0.0;
+        int32_t g_arc_idx = cpu_arc_map_g[j];
+        if (g_arc_idx >= 0) {
+          Arc g_arc = g.values[g_arc_idx];
+          EXPECT_EQ(g_arc.label, hl_aux_labels[cpu_arc_map_hl[j]]);
+          expected += g_arc.score;
+          // Word 1 leaves state 0 of G, which may be reached from state 1
+          // through the backoff arc.
+          if (g_arc.src_state == 0 && g_arc.label == 1) backoff_score = -0.7;
+        } else {
+          EXPECT_EQ(hl_aux_labels[cpu_arc_map_hl[j]], 0);
+        }
+        EXPECT_TRUE(std::abs(arc.score - expected) < 1.0e-03 ||
+                    std::abs(arc.score - expected - backoff_score) < 1.0e-03);
+      }
+    }
+  }
+}
+
+TEST(IntersectDensePrunedComposed, EmptyG) {
+  for (int32_t i = 0; i < 2; i++) {
+    ContextPtr c = (i == 0 ? GetCpuContext() : GetCudaContext());
+    Array2<int32_t> extra_labels;
+    Fsa hl = FsaFromString("0 1 -1 -1 0.0\n1\n", false, 1, &extra_labels)
+                 .To(c);
+    Array1<int32_t> hl_aux_labels = extra_labels.Row(0).To(c);
+    Fsa g(EmptyRaggedShape(c, 2));
+    DenseFsaVec b_fsas = RandomDenseFsaVec(2, 2, 1, 5, 3, 3).To(c);
+    FsaVec out;
+    Array1<int32_t> arc_map_hl, arc_map_g, arc_map_b;
+    IntersectDensePrunedComposed(hl, hl_aux_labels, g, b_fsas, 10.0, 5.0, 0,
+                                 100, &out, &arc_map_hl, &arc_map_g,
+                                 &arc_map_b);
+    EXPECT_EQ(out.Dim0(), 2);
+    EXPECT_EQ(out.TotSize(1), 0);
+    EXPECT_EQ(arc_map_hl.Dim(), 0);
+  }
+}
+
+}  // namespace k2
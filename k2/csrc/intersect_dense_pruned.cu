@@ -18,21 +18,49 @@
  */
 
 #include <algorithm>
+#include <cmath>
+#include <exception>
 #include <limits>
+#include <memory>
+#include <numeric>
+#include <thread>  // NOLINT
+#include <unordered_set>
 #include <vector>
 
 #include "k2/csrc/array_ops.h"
+#include "k2/csrc/compact_fsa.h"
 #include "k2/csrc/device_guard.h"
 #include "k2/csrc/fsa_algo.h"
 #include "k2/csrc/fsa_utils.h"
 #include "k2/csrc/hash.h"
+#include "k2/csrc/implicit_topo.h"
 #include "k2/csrc/intersect_dense_pruned.h"
 #include "k2/csrc/ragged_ops.h"
-#include "k2/csrc/thread_pool.h"
+#include "k2/csrc/region_arena.h"
 
 namespace k2 {
 using namespace intersect_pruned_internal;  // NOLINT
 
+/*
+  Gives kernels access to the arcs of the decoding graphs: either stored
+  arcs, or, if `arcs` is nullptr, the arcs of a CompactFsaVec if `compact` is
+  set, else the arcs of an ImplicitTopo computed from their index.  The
+  arcs of a CompactFsaVec have no src_state (see CompactArcsAccessor); only
+  their dest_state - src_state and label are used.
+*/
+struct GraphArcs {
+  const Arc *arcs;
+  ImplicitTopo topo;
+  CompactArcsAccessor compact;
+
+  __host__ __device__ __forceinline__ Arc operator[](int32_t idx) const {
+    if (arcs != nullptr) return arcs[idx];
+    if (compact.arcs != nullptr || compact.quantized_arcs != nullptr)
+      return compact[idx];
+    return topo.GetArc(idx);
+  }
+};
+
 /*
    Pruned intersection (a.k.a. composition) that corresponds to decoding for
    speech recognition-type tasks.  Can use either different decoding graphs (one
@@ -40,6 +68,11 @@ using namespace intersect_pruned_internal;  // NOLINT
 */
 class MultiGraphDenseIntersectPruned {
  public:
+  // In online decoding, the frames are pruned in ranges of this many frames
+  // ending at the current frame, so frames more than this many before the
+  // last frame decoded will not be pruned again.
+  static constexpr int32_t kOnlinePruneNumFrames = 15;
+
   /**
      Pruned intersection (a.k.a. composition) that corresponds to decoding for
      speech recognition-type tasks
@@ -71,21 +104,77 @@ class MultiGraphDenseIntersectPruned {
        @param [in] online_decoding  True for online decoding (i.e. chunk by
                                     chunk decoding), false for running in batch
                                     mode.
+       @param [in] use_arena  If true, the per-frame `states` and `arcs`
+                           created by the forward pass are allocated from a
+                           RegionArena rather than one by one, which reduces
+                           allocator traffic for long utterances.  The
+                           arena's memory is not reused, so memory freed by
+                           pruning is not given back until the frames that
+                           share its Regions have all been pruned or
+                           FormatOutput() has been called and this object
+                           (or, for online decoding, the chunk's frames) have
+                           been destroyed.
+       @param [in] a_fsas_arcs  If not nullptr, the arcs of `a_fsas` are read
+                           from here instead of from a_fsas.values, which
+                           may then be empty.  This is for decoding graphs
+                           too large for device memory: the arcs can be in
+                           pinned host memory, which kernels read directly,
+                           so only the arcs of the states active on each
+                           frame are transferred.  See PagedDenseIntersecter.
+       @param [in] implicit_topo  If not nullptr, a_fsas must have one FSA
+                           whose shape is implicit_topo->Shape(), and its
+                           arcs are computed on the fly; a_fsas.values may
+                           be empty.  Overrides a_fsas_arcs.
+       @param [in] compact_fsas  If not nullptr, the arcs of `a_fsas` are
+                           read from here, a compact copy of the graphs with
+                           the same shape; a_fsas.values may be empty.
+                           Overrides a_fsas_arcs and implicit_topo.
+       @param [in] max_active_arcs  If > 0, a target for the total number of
+                           arcs on a frame, over all the sequences.  While it
+                           is exceeded, the beams of all sequences are scaled
+                           down together (see GetPruningCutoffs()), on top
+                           of the per-sequence min_active/max_active
+                           adjustment.  This bounds the work per frame of the
+                           whole batch, at some cost in accuracy.
+       @param [in] b_to_a_map  If not nullptr, maps from sequence index
+                           (0 <= i < num_seqs) to the index of its graph in
+                           a_fsas, so that a few graphs can be shared by
+                           many sequences; a_fsas.Dim0() may then have any
+                           value.  If nullptr, a_fsas.Dim0() must be 1
+                           (shared graph) or num_seqs (one graph per
+                           sequence).
    */
   MultiGraphDenseIntersectPruned(FsaVec &a_fsas, int32_t num_seqs,
                                  float search_beam, float output_beam,
                                  int32_t min_active, int32_t max_active,
-                                 bool online_decoding)
+                                 bool online_decoding, bool use_arena = false,
+                                 const Arc *a_fsas_arcs = nullptr,
+                                 int32_t max_active_arcs = 0,
+                                 const ImplicitTopo *implicit_topo = nullptr,
+                                 const CompactFsaVec *compact_fsas = nullptr,
+                                 const Array1<int32_t> *b_to_a_map = nullptr)
       : a_fsas_(a_fsas),
+        a_fsas_arcs_{implicit_topo != nullptr || compact_fsas != nullptr
+                         ? nullptr
+                     : a_fsas_arcs != nullptr ? a_fsas_arcs
+                                              : a_fsas.values.Data(),
+                     implicit_topo != nullptr
+                         ? *implicit_topo
+                         : ImplicitTopo(ImplicitTopoType::kTrivial, 0),
+                     compact_fsas != nullptr
+                         ? CompactArcsAccessor(*compact_fsas)
+                         : CompactArcsAccessor()},
         num_seqs_(num_seqs),
         search_beam_(search_beam),
         output_beam_(output_beam),
         min_active_(min_active),
         max_active_(max_active),
+        max_active_arcs_(max_active_arcs),
+        beam_scale_(1.0),
         online_decoding_(online_decoding),
-        dynamic_beams_(a_fsas.Context(), num_seqs, search_beam),
+        dynamic_beams_(a_fsas.shape.Context(), num_seqs, search_beam),
         forward_semaphore_(1),
-        final_t_(a_fsas.Context(), num_seqs, 0) {
+        final_t_(a_fsas.shape.Context(), num_seqs, 0) {
     NVTX_RANGE(K2_FUNC);
     c_ = GetContext(a_fsas.shape);
     T_ = 0;
@@ -93,21 +182,36 @@ class MultiGraphDenseIntersectPruned {
     K2_CHECK_GT(output_beam, 0);
     K2_CHECK_GE(min_active, 0);
     K2_CHECK_GT(max_active, min_active);
-    K2_CHECK(a_fsas.shape.Dim0() == num_seqs || a_fsas.shape.Dim0() == 1);
+    K2_CHECK_GE(max_active_arcs, 0);
     K2_CHECK_GE(num_seqs, 1);
+    if (b_to_a_map != nullptr) {
+      K2_CHECK(c_->IsCompatible(*b_to_a_map->Context()));
+      K2_CHECK_EQ(b_to_a_map->Dim(), num_seqs);
+      b_to_a_map_ = *b_to_a_map;
+    } else if (a_fsas.shape.Dim0() == 1) {
+      b_to_a_map_ = Array1<int32_t>(c_, num_seqs, 0);
+    } else {
+      K2_CHECK_EQ(a_fsas.shape.Dim0(), num_seqs);
+      b_to_a_map_ = Range(c_, num_seqs, 0);
+    }
+    if (implicit_topo != nullptr) {
+      K2_CHECK_EQ(a_fsas.shape.Dim0(), 1);
+      K2_CHECK_EQ(a_fsas.TotSize(2), implicit_topo->NumArcs());
+    }
+    if (compact_fsas != nullptr)
+      K2_CHECK_EQ(a_fsas.TotSize(2), compact_fsas->NumArcs());
 
     int32_t num_buckets = RoundUpToNearestPowerOfTwo(num_seqs * 4 *
                                                      max_active);
     if (num_buckets < 128)
       num_buckets = 128;
     int32_t num_a_copies;
-    if (a_fsas.shape.Dim0() == 1) {
-      a_fsas_stride_ = 0;
+    if (a_fsas.shape.Dim0() == 1 || b_to_a_map != nullptr) {
+      // A graph may be shared by several sequences, so the keys of
+      // state_map_ need the sequence index.
       state_map_fsa_stride_ = a_fsas.TotSize(1);
       num_a_copies = num_seqs;
     } else {
-      K2_CHECK_EQ(a_fsas.shape.Dim0(), num_seqs);
-      a_fsas_stride_ = 1;
       state_map_fsa_stride_ = 0;
       num_a_copies = 1;
     }
@@ -130,7 +234,13 @@ class MultiGraphDenseIntersectPruned {
             "with more options: num_keys=" << num_keys;
       }
     }
-    state_map_ = Hash(c_, num_buckets, num_key_bits);
+    // With 32 key bits there are enough value bits left for the epoch, so
+    // that the hash can be cleared on each frame without deleting the states
+    // (see Hash::EpochAccessor); with more key bits we delete them.
+    int32_t num_epoch_bits = (num_key_bits == 32 ? 4 : 0);
+    state_map_ = Hash(c_, num_buckets, num_key_bits, -1, num_epoch_bits);
+    if (use_arena)
+      arena_ = std::make_unique<RegionArena>(c_);
   }
 
   /* Does the main work of intersection/composition, but doesn't produce any
@@ -139,8 +249,13 @@ class MultiGraphDenseIntersectPruned {
        @param [in] b_fsas  The neural-net output, with each frame containing the
                            log-likes of each phone.  A series of sequences of
                            (in general) different length.
+       @param [out] stats  If not nullptr, statistics of the search will be
+                           written to here, by this function and by
+                           FormatOutput(); see IntersectDensePrunedStats in
+                           fsa_algo.h.  Must outlive those calls.
    */
-  void Intersect(std::shared_ptr<DenseFsaVec> &b_fsas) {
+  void Intersect(std::shared_ptr<DenseFsaVec> &b_fsas,
+                 IntersectDensePrunedStats *stats = nullptr) {
     /*
       T is the largest number of (frames+1) of neural net output, or the largest
       number of frames of log-likelihoods we count the final frame with (0,
@@ -157,6 +272,14 @@ class MultiGraphDenseIntersectPruned {
     b_fsas_ = b_fsas;
     K2_CHECK_EQ(num_seqs_, b_fsas_->shape.Dim0());
     T_ = T_ + b_fsas_->shape.MaxSize(1);
+    SetNumFsasPerFrame();
+    stats_ = stats;
+    if (stats_ != nullptr) {
+      stats_->num_states = Array2<int32_t>(c_, T_ + 1, num_seqs_, 0);
+      stats_->num_arcs = Array2<int32_t>(c_, T_ + 1, num_seqs_, 0);
+      stats_->beams = Array2<float>(c_, T_ + 1, num_seqs_, 0.0f);
+      stats_->num_output_arcs = Array2<int32_t>(c_, T_ + 1, num_seqs_, 0);
+    }
 
     { // set up do_pruning_after_ and prune_t_begin_end_.
 
@@ -192,13 +315,14 @@ class MultiGraphDenseIntersectPruned {
 
     int32_t T = T_;
 
-    std::ostringstream os;
-    os << "Intersect:T=" << T << ",num_fsas=" << num_seqs_
-       << ",TotSize(1)=" << b_fsas_->shape.TotSize(1);
-    NVTX_RANGE(os.str().c_str());
+    // The payload is the total number of frames.
+    NVTX_RANGE_PAYLOAD("Intersect", kIntersect, b_fsas_->shape.TotSize(1));
 
-    ThreadPool* pool = GetThreadPool();
-    pool->SubmitTask([this]() { BackwardPassStatic(this); });
+    // The backward pass runs in a thread of the thread pool, on its own
+    // stream if there is enough work; see BackgroundRunner.
+    int32_t num_work_items = max_active_ * num_seqs_ * T_;
+    BackgroundRunner br(c_);
+    br.Background([this]() { BackwardPass(); }, num_work_items);
 
     // we'll initially populate frames_[0.. T+1], but discard the one at T+1,
     // which has no arcs or states, the ones we use are from 0 to T.
@@ -207,14 +331,11 @@ class MultiGraphDenseIntersectPruned {
     frames_.push_back(InitialFrameInfo());
 
     for (int32_t t = 0; t <= T; t++) {
-      if (state_map_.NumKeyBits() == 32) {
-        frames_.push_back(PropagateForward<32>(t, frames_.back().get()));
-      } else if (state_map_.NumKeyBits() == 36) {
-        frames_.push_back(PropagateForward<36>(t, frames_.back().get()));
-      } else {
-        K2_CHECK_EQ(state_map_.NumKeyBits(), 40);
-        frames_.push_back(PropagateForward<40>(t, frames_.back().get()));
-      }
+      frames_.push_back(DispatchKeyBits<32, 36, 40>(
+          state_map_.NumKeyBits(), [&](auto key_bits) {
+            return PropagateForward<decltype(key_bits)::value>(
+                t, frames_.back().get());
+          }));
       if (do_pruning_after_[t]) {
         // let a phase of backward-pass pruning commence.
         backward_semaphore_.Signal(c_);
@@ -229,7 +350,7 @@ class MultiGraphDenseIntersectPruned {
     // is set up (it has no arcs but we need the shape).
     frames_.pop_back();
 
-    pool->WaitAllTasksFinished();
+    br.Wait();
   }
 
   /* Does the main work of intersection/composition, but doesn't produce any
@@ -278,17 +399,14 @@ class MultiGraphDenseIntersectPruned {
     frames_.reserve(T + 2);
 
     if (T_ == 0) frames_.push_back(InitialFrameInfo());
-    int32_t prune_num_frames = 15, prune_shift = 10;
+    int32_t prune_num_frames = kOnlinePruneNumFrames, prune_shift = 10;
 
     for (int32_t t = 0; t <= b_fsas_->shape.MaxSize(1); t++) {
-      if (state_map_.NumKeyBits() == 32) {
-        frames_.push_back(PropagateForward<32>(t, frames_.back().get()));
-      } else if (state_map_.NumKeyBits() == 36) {
-        frames_.push_back(PropagateForward<36>(t, frames_.back().get()));
-      } else {
-        K2_CHECK_EQ(state_map_.NumKeyBits(), 40);
-        frames_.push_back(PropagateForward<40>(t, frames_.back().get()));
-      }
+      frames_.push_back(DispatchKeyBits<32, 36, 40>(
+          state_map_.NumKeyBits(), [&](auto key_bits) {
+            return PropagateForward<decltype(key_bits)::value>(
+                t, frames_.back().get());
+          }));
       if (t != 0 && (T_ + t) % prune_shift == 0 ||
           t == b_fsas_->shape.MaxSize(1)) {
         int32_t prune_t_begin =
@@ -323,15 +441,234 @@ class MultiGraphDenseIntersectPruned {
     return &frames_;
   }
 
-  void BackwardPass() {
-    int32_t num_fsas = b_fsas_->shape.Dim0(),
-      num_work_items = max_active_ * num_fsas * T_;
-    ParallelRunner pr(c_);
-    // if num_work_items is big enough, it will actually create a new stream.
-    cudaStream_t stream = pr.NewStream(num_work_items);
-    With w(stream);  // This overrides whatever stream c_ contains with `stream`, if it's not
+  /*
+    Prunes the result of Intersect() once more, over all frames at once,
+    keeping only the arcs and states that are on a path whose Viterbi score
+    is within `lattice_beam` of the best path; i.e. whose (Viterbi-style)
+    arc posterior, computed from the forward_loglike in StateInfo and the
+    backward loglikes, is at least exp(-lattice_beam).  This gives directly
+    what pruning the output of FormatOutput() with GetArcPost() and
+    PruneOnArcPost() would, but without materializing the larger lattice.
+
+    The pruning done during Intersect() is over overlapping ranges of frames
+    and must be conservative at the end of each range, so it keeps more
+    than `output_beam` would imply; the pass here is exact.
+
+    Must be called after Intersect() and before FormatOutput(); not
+    supported for online decoding.
+  */
+  void PruneOutput(float lattice_beam) {
+    NVTX_RANGE(K2_FUNC);
+    K2_CHECK(!online_decoding_);
+    K2_CHECK_GT(lattice_beam, 0);
+    K2_CHECK_EQ(static_cast<int32_t>(frames_.size()), T_ + 1);
+    if (T_ == 0) return;
+    float output_beam = output_beam_;
+    output_beam_ = lattice_beam;
+    PruneTimeRange(0, T_);
+    output_beam_ = output_beam;
+  }
+
+  /*
+    Does the search like Intersect(), but for one-best decoding: instead of
+    the arcs of each frame it keeps only the best arc entering each state
+    (see GetBackPointers()), and no pruning of the lattice is done, so the
+    memory used scales with the number of active states rather than arcs.
+    Call FormatOneBest() afterwards to get the result (not FormatOutput()).
+    Not supported for online decoding.
+  */
+  void IntersectOneBest(std::shared_ptr<DenseFsaVec> &b_fsas) {
+    K2_CHECK(!online_decoding_);
+    K2_CHECK(c_->IsCompatible(*b_fsas->Context()));
+    b_fsas_ = b_fsas;
+    K2_CHECK_EQ(num_seqs_, b_fsas_->shape.Dim0());
+    T_ = b_fsas_->shape.MaxSize(1);
+    SetNumFsasPerFrame();
+    int32_t T = T_;
+
+    NVTX_RANGE_PAYLOAD("IntersectOneBest", kIntersect,
+                       b_fsas_->shape.TotSize(1));
+
+    frames_.reserve(T + 2);
+    back_pointers_.reserve(T + 2);
+    frames_.push_back(InitialFrameInfo());
+    back_pointers_.push_back(Array1<BackPointer>(c_, 0));
+    for (int32_t t = 0; t <= T; t++) {
+      FrameInfo *cur_frame = frames_.back().get();
+      frames_.push_back(DispatchKeyBits<32, 36, 40>(
+          state_map_.NumKeyBits(), [&](auto key_bits) {
+            return PropagateForward<decltype(key_bits)::value>(t, cur_frame);
+          }));
+      back_pointers_.push_back(
+          GetBackPointers(cur_frame, frames_.back().get()));
+      // The arcs are no longer needed.
+      cur_frame->arcs = Ragged<ArcInfo>();
+    }
+    // As in Intersect(), the frame for time T+1 has no states.
+    frames_.pop_back();
+    back_pointers_.pop_back();
+  }
 
+  /*
+    Returns the best arc entering each state of `next_frame`, for the
+    one-best mode.  Must be called right after
+    `next_frame = PropagateForward(t, cur_frame)`.  The best arc is one
+    whose end_loglike (see GetArcs()) equals the forward_loglike of its
+    destination state; as both are computed in the same way, there is always
+    one.
+  */
+  Array1<BackPointer> GetBackPointers(FrameInfo *cur_frame,
+                                      FrameInfo *next_frame) {
+    NVTX_RANGE(K2_FUNC);
+    Ragged<ArcInfo> &arcs = cur_frame->arcs;
+    int32_t num_arcs = arcs.NumElements(),
+            num_states = next_frame->states.NumElements();
+    Array1<int32_t> best_arcs(c_, num_states, -1);
+    int32_t *best_arcs_data = best_arcs.Data();
+    const ArcInfo *arcs_data = arcs.values.Data();
+    const StateInfo *cur_states_data = cur_frame->states.values.Data(),
+                    *next_states_data = next_frame->states.values.Data();
+    const int32_t *arcs_row_ids1_data = arcs.RowIds(1).Data(),
+                  *arcs_row_ids2_data = arcs.RowIds(2).Data(),
+                  *next_row_splits1_data =
+                      next_frame->states.RowSplits(1).Data();
+    K2_EVAL(
+        c_, num_arcs, lambda_set_best_arcs, (int32_t arc_idx012)->void {
+          ArcInfo info = arcs_data[arc_idx012];
+          if (info.u.dest_info_state_idx1 < 0) return;  // pruned
+          int32_t state_idx01 = arcs_row_ids2_data[arc_idx012],
+                  fsa_idx0 = arcs_row_ids1_data[state_idx01],
+                  dest_state_idx01 = next_row_splits1_data[fsa_idx0] +
+                                     info.u.dest_info_state_idx1;
+          float end_loglike =
+              OrderedIntToFloat(cur_states_data[state_idx01].forward_loglike) +
+              info.arc_loglike;
+          // If there are ties, any of the arcs may win.
+          if (FloatToOrderedInt(end_loglike) ==
+              next_states_data[dest_state_idx01].forward_loglike)
+            best_arcs_data[dest_state_idx01] = arc_idx012;
+        });
 
+    Array1<BackPointer> ans(c_, num_states);
+    BackPointer *ans_data = ans.Data();
+    K2_EVAL(
+        c_, num_states, lambda_set_back_pointers, (int32_t state_idx01)->void {
+          int32_t arc_idx012 = best_arcs_data[state_idx01];
+          K2_DCHECK_GE(arc_idx012, 0);
+          ArcInfo info = arcs_data[arc_idx012];
+          BackPointer bp;
+          bp.src_state_idx01 = arcs_row_ids2_data[arc_idx012];
+          bp.a_fsas_arc_idx012 = info.a_fsas_arc_idx012;
+          bp.arc_loglike = info.arc_loglike;
+          ans_data[state_idx01] = bp;
+        });
+    return ans;
+  }
+
+  /*
+    Produces the result of IntersectOneBest(): the best path of each
+    sequence as a linear FSA, found by following the back-pointers from its
+    final state.  As for ShortestPath(), the FSA is empty (has no states) if
+    the final state was not reached.
+
+      @param [out] ofsa  The best paths, with Dim0() == num_seqs_.
+      @param [out] arc_map_a  As for FormatOutput().
+      @param [out] arc_map_b  As for FormatOutput().
+  */
+  void FormatOneBest(FsaVec *ofsa, Array1<int32_t> *arc_map_a,
+                     Array1<int32_t> *arc_map_b) {
+    NVTX_RANGE(K2_FUNC);
+    int32_t T = T_, num_fsas = num_seqs_;
+    K2_CHECK_EQ(static_cast<int32_t>(frames_.size()), T + 1);
+    K2_CHECK_EQ(static_cast<int32_t>(back_pointers_.size()), T + 1);
+
+    ContextPtr c_cpu = GetCpuContext();
+    Array1<BackPointer *> back_pointers_ptrs(c_cpu, T + 1);
+    Array1<int32_t *> states_row_splits1_ptrs(c_cpu, T + 1);
+    for (int32_t t = 0; t <= T; t++) {
+      back_pointers_ptrs.Data()[t] = back_pointers_[t].Data();
+      states_row_splits1_ptrs.Data()[t] =
+          frames_[t]->states.RowSplits(1).Data();
+    }
+    back_pointers_ptrs = back_pointers_ptrs.To(c_);
+    states_row_splits1_ptrs = states_row_splits1_ptrs.To(c_);
+    BackPointer **back_pointers_ptrs_data = back_pointers_ptrs.Data();
+    int32_t **states_row_splits1_ptrs_data = states_row_splits1_ptrs.Data();
+    const int32_t *b_fsas_row_splits1 = b_fsas_->shape.RowSplits(1).Data();
+
+    // The number of arcs on the best path of each sequence: final_t if the
+    // final state was reached on its last frame final_t, else 0.
+    Array1<int32_t> path_row_splits(c_, num_fsas + 1);
+    int32_t *path_row_splits_data = path_row_splits.Data();
+    K2_EVAL(
+        c_, num_fsas, lambda_set_path_lengths, (int32_t i)->void {
+          int32_t final_t = b_fsas_row_splits1[i + 1] - b_fsas_row_splits1[i];
+          const int32_t *row_splits1 = states_row_splits1_ptrs_data[final_t];
+          int32_t num_final_states = row_splits1[i + 1] - row_splits1[i];
+          K2_DCHECK_LE(num_final_states, 1);
+          path_row_splits_data[i] = num_final_states * final_t;
+        });
+    ExclusiveSum(path_row_splits, &path_row_splits);
+    int32_t num_arcs = path_row_splits.Back();
+
+    *arc_map_a = Array1<int32_t>(c_, num_arcs);
+    *arc_map_b = Array1<int32_t>(c_, num_arcs);
+    Array1<Arc> arcs(c_, num_arcs);
+    int32_t *arc_map_a_data = arc_map_a->Data(),
+            *arc_map_b_data = arc_map_b->Data();
+    Arc *arcs_data = arcs.Data();
+    GraphArcs a_fsas_arcs = a_fsas_arcs_;
+    int32_t b_fsas_num_cols = b_fsas_->NumCols();
+    // Follow the back-pointers; this is sequential in time, so we use one
+    // thread per sequence.
+    K2_EVAL(
+        c_, num_fsas, lambda_trace_back, (int32_t i)->void {
+          int32_t begin = path_row_splits_data[i],
+                  final_t = path_row_splits_data[i + 1] - begin;
+          if (final_t == 0) return;
+          // The final state is the only state of this sequence on frame
+          // final_t.
+          int32_t state_idx01 = states_row_splits1_ptrs_data[final_t][i];
+          for (int32_t t = final_t - 1; t >= 0; --t) {
+            BackPointer bp = back_pointers_ptrs_data[t + 1][state_idx01];
+            int32_t label = a_fsas_arcs[bp.a_fsas_arc_idx012].label;
+            arcs_data[begin + t] = Arc(t, t + 1, label, bp.arc_loglike);
+            arc_map_a_data[begin + t] = bp.a_fsas_arc_idx012;
+            arc_map_b_data[begin + t] =
+                (b_fsas_row_splits1[i] + t) * b_fsas_num_cols + (label + 1);
+            state_idx01 = bp.src_state_idx01;
+          }
+        });
+
+    // if there are n arcs (for n > 0), there are n + 1 states; if there are
+    // 0 arcs, there are 0 states.
+    RaggedShape path_shape = RaggedShape2(&path_row_splits, nullptr, num_arcs),
+                states_shape = ChangeSublistSizePinned(path_shape, 1);
+    int32_t num_states = states_shape.NumElements();
+    Array1<int32_t> row_splits2(c_, num_states + 1);
+    int32_t *row_splits2_data = row_splits2.Data();
+    const int32_t *states_row_ids1_data = states_shape.RowIds(1).Data(),
+                  *states_row_splits1_data = states_shape.RowSplits(1).Data();
+    // The state with idx1 == s of sequence i (whose last state has no arcs)
+    // has arcs from position path_row_splits[i] + s.
+    K2_EVAL(
+        c_, num_states + 1, lambda_set_row_splits2,
+        (int32_t state_idx01)->void {
+          if (state_idx01 == num_states) {
+            row_splits2_data[state_idx01] = num_arcs;
+            return;
+          }
+          int32_t i = states_row_ids1_data[state_idx01],
+                  s = state_idx01 - states_row_splits1_data[i];
+          row_splits2_data[state_idx01] = path_row_splits_data[i] + s;
+        });
+    *ofsa = FsaVec(RaggedShape3(&states_shape.RowSplits(1),
+                                &states_shape.RowIds(1), num_states,
+                                &row_splits2, nullptr, num_arcs),
+                   arcs);
+  }
+
+  void BackwardPass() {
     NVTX_RANGE(K2_FUNC);
     for (size_t i = 0; i < prune_t_begin_end_.size(); i++) {
       backward_semaphore_.Wait(c_);
@@ -342,14 +679,6 @@ class MultiGraphDenseIntersectPruned {
     }
   }
 
-  static void BackwardPassStatic(MultiGraphDenseIntersectPruned *c) {
-    // WARNING(fangjun): this is run in a separate thread, so we have
-    // to reset its default device. Otherwise, it will throw later
-    // if the main thread is using a different device.
-    DeviceGuard guard(c->c_);
-    c->BackwardPass();
-  }
-
   // Return FrameInfo for 1st frame, with `states` set but `arcs` not set.
   std::unique_ptr<FrameInfo> InitialFrameInfo() {
     NVTX_RANGE("InitialFrameInfo");
@@ -371,7 +700,9 @@ class MultiGraphDenseIntersectPruned {
             states_data[i] = info;
           });
     } else {
-      Ragged<int32_t> start_states = GetStartStates(a_fsas_);
+      // The start states of the graph of each sequence.
+      Ragged<int32_t> a_start_states = GetStartStates(a_fsas_),
+          start_states = Index(a_start_states, 0, b_to_a_map_);
       ans->states =
           Ragged<StateInfo>(start_states.shape,
                             Array1<StateInfo>(c_, start_states.NumElements()));
@@ -390,8 +721,16 @@ class MultiGraphDenseIntersectPruned {
     return ans;
   }
 
+  /*
+    Produces the output lattice.  See IntersectDensePruned() in fsa_algo.h
+    for the meaning of `arc_map_a`, `arc_map_b` and `entering_arcs`
+    (arc_map_b is not produced for online decoding).  If `is_final` is
+    false (online decoding only), the partial result up to the current
+    chunk is produced.
+  */
   void FormatOutput(FsaVec *ofsa, Array1<int32_t> *arc_map_a,
-                    Array1<int32_t> *arc_map_b, bool is_final) {
+                    Array1<int32_t> *arc_map_b, bool is_final,
+                    Array1<int32_t> *entering_arcs = nullptr) {
     NVTX_RANGE("FormatOutput");
 
     bool online_decoding = online_decoding_;
@@ -407,13 +746,19 @@ class MultiGraphDenseIntersectPruned {
     ContextPtr c_cpu = GetCpuContext();
     Array1<ArcInfo *> arcs_data_ptrs(c_cpu, T + 1);
     Array1<int32_t *> arcs_row_splits1_ptrs(c_cpu, T + 1);
+    // Only needed for `entering_arcs`.
+    Array1<StateInfo *> states_data_ptrs(c_cpu, T + 1);
     for (int32_t t = 0; t < T; t++) {
       arcs_data_ptrs.Data()[t] = frames_[t]->arcs.values.Data();
       arcs_row_splits1_ptrs.Data()[t] = frames_[t]->arcs.RowSplits(1).Data();
+      states_data_ptrs.Data()[t] = frames_[t]->states.values.Data();
     }
     arcs_data_ptrs.Data()[T] = is_final
                                    ? frames_[T]->arcs.values.Data()
                                    : partial_final_frame_->arcs.values.Data();
+    states_data_ptrs.Data()[T] =
+        is_final ? frames_[T]->states.values.Data()
+                 : partial_final_frame_->states.values.Data();
     arcs_row_splits1_ptrs.Data()[T] =
         is_final ? frames_[T]->arcs.RowSplits(1).Data()
                  : partial_final_frame_->arcs.RowSplits(1).Data();
@@ -424,9 +769,8 @@ class MultiGraphDenseIntersectPruned {
     arcs_row_splits1_ptrs = arcs_row_splits1_ptrs.To(c_);
     int32_t **arcs_row_splits1_ptrs_data = arcs_row_splits1_ptrs.Data();
     const int32_t *b_fsas_row_splits1 = b_fsas_->shape.RowSplits(1).Data();
-    const int32_t *a_fsas_row_splits1 = a_fsas_.RowSplits(1).Data();
-    int32_t a_fsas_stride = a_fsas_stride_;  // 0 or 1 depending if the decoding
-                                             // graph is shared.
+    const int32_t *a_fsas_row_splits1 = a_fsas_.RowSplits(1).Data(),
+                  *b_to_a_map_data = b_to_a_map_.Data();
     int32_t *final_t_data = final_t_.Data();
     int32_t num_fsas = b_fsas_->shape.Dim0();
 
@@ -456,8 +800,9 @@ class MultiGraphDenseIntersectPruned {
 
           // has_start_state is 1 if there is a start-state; note, we don't prune
           // the start-states, so they'll be present if they were present in a_fsas_.
-          int32_t has_start_state = (a_fsas_row_splits1[i * a_fsas_stride] <
-                                     a_fsas_row_splits1[i * a_fsas_stride + 1]);
+          int32_t a_idx0 = b_to_a_map_data[i],
+                  has_start_state = (a_fsas_row_splits1[a_idx0] <
+                                     a_fsas_row_splits1[a_idx0 + 1]);
 
           // num_extra_states_data[i] will be 1 if there was a start state but no final-state;
           // else, 0.
@@ -479,11 +824,18 @@ class MultiGraphDenseIntersectPruned {
       NVTX_RANGE("InitOshape");
       // each of these have 3 axes.
       std::vector<RaggedShape *> arcs_shapes(T + 2);
-      for (int32_t t = 0; t < T; t++)
-        arcs_shapes[t] = &(frames_[t]->arcs.shape);
-
-      arcs_shapes[T] = is_final ? &(frames_[T]->arcs.shape)
-                                : &(partial_final_frame_->arcs.shape);
+      // Stack() needs all the shapes to have the same Dim0(), so the frames
+      // from which finished sequences were left out are padded back to
+      // NumFsas().
+      std::vector<RaggedShape> padded_shapes(T + 1);
+      for (int32_t t = 0; t < T; t++) {
+        padded_shapes[t] = PadToNumFsas(frames_[t]->arcs.shape);
+        arcs_shapes[t] = &(padded_shapes[t]);
+      }
+      padded_shapes[T] = PadToNumFsas(is_final
+                                          ? frames_[T]->arcs.shape
+                                          : partial_final_frame_->arcs.shape);
+      arcs_shapes[T] = &(padded_shapes[T]);
 
       arcs_shapes[T + 1] = &final_arcs_shape;
 
@@ -508,8 +860,8 @@ class MultiGraphDenseIntersectPruned {
             *arc_map_b_data = online_decoding ? nullptr : arc_map_b->Data();
     Array1<Arc> arcs_out(c_, num_arcs);
     Arc *arcs_out_data = arcs_out.Data();
-    const Arc *a_fsas_arcs = a_fsas_.values.Data();
-    int32_t b_fsas_num_cols = b_fsas_->scores.Dim1();
+    GraphArcs a_fsas_arcs = a_fsas_arcs_;
+    int32_t b_fsas_num_cols = b_fsas_->NumCols();
     const int32_t *b_fsas_row_ids1 = b_fsas_->shape.RowIds(1).Data();
 
     const uint32_t *oshape_merge_map_data = oshape_merge_map.Data();
@@ -559,8 +911,101 @@ class MultiGraphDenseIntersectPruned {
           arc_map_a_data[oarc_idx0123] = arc_info.a_fsas_arc_idx012;
         });
 
+    if (entering_arcs != nullptr) {
+      NVTX_RANGE("GetEnteringArcs");
+      // The forward (Viterbi) loglikes of the states are already in
+      // StateInfo, so the best arc entering each state can be found with no
+      // further pass over the frames: it is the arc with the largest
+      // forward loglike of its source state plus its own loglike.  Since a
+      // state's best entering arc has the same score as the state itself,
+      // it survives any pruning that the state survives; we nevertheless
+      // take the max over the arcs that survived rather than comparing with
+      // the stored forward loglike of the destination state, so that
+      // roundoff in the pruning cannot leave a state without an entering
+      // arc.  Start states (and the final states that we added for FSAs
+      // whose final state did not survive) have no entering arc, for which
+      // we write -1.
+      states_data_ptrs = states_data_ptrs.To(c_);
+      StateInfo **states_data_ptrs_data = states_data_ptrs.Data();
+      int32_t num_states = oshape.TotSize(2);
+      Array1<int32_t> end_loglikes(c_, num_arcs),
+          best_end_loglikes(c_, num_states,
+                            FloatToOrderedInt(
+                                -std::numeric_limits<float>::infinity()));
+      *entering_arcs = Array1<int32_t>(c_, num_states, -1);
+      int32_t *end_loglikes_data = end_loglikes.Data(),
+              *best_end_loglikes_data = best_end_loglikes.Data(),
+              *entering_arcs_data = entering_arcs->Data();
+      K2_EVAL(
+          c_, num_arcs, lambda_set_best_end_loglikes,
+          (int32_t oarc_idx0123)->void {
+            int32_t oarc_idx012 = oshape_row_ids3[oarc_idx0123],
+                    oarc_idx01 = oshape_row_ids2[oarc_idx012],
+                    oarc_idx0 = oshape_row_ids1[oarc_idx01],
+                    oarc_idx0x = oshape_row_splits1[oarc_idx0],
+                    oarc_idx0xx = oshape_row_splits2[oarc_idx0x],
+                    t = oarc_idx01 - oarc_idx0x,
+                    oarc_idx2 = oarc_idx012 - oshape_row_splits2[oarc_idx01],
+                    // the source state as an idx01 into the frame's states.
+                    states_idx01 = arcs_row_splits1_ptrs_data[t][oarc_idx0] +
+                                   oarc_idx2;
+            float end_loglike =
+                OrderedIntToFloat(
+                    states_data_ptrs_data[t][states_idx01].forward_loglike) +
+                arcs_out_data[oarc_idx0123].score;
+            int32_t end_loglike_int = FloatToOrderedInt(end_loglike),
+                    dest_state_idx01 =
+                        oarc_idx0xx + arcs_out_data[oarc_idx0123].dest_state;
+            end_loglikes_data[oarc_idx0123] = end_loglike_int;
+            AtomicMax(best_end_loglikes_data + dest_state_idx01,
+                      end_loglike_int);
+          });
+      K2_EVAL(
+          c_, num_arcs, lambda_set_entering_arcs,
+          (int32_t oarc_idx0123)->void {
+            int32_t oarc_idx012 = oshape_row_ids3[oarc_idx0123],
+                    oarc_idx01 = oshape_row_ids2[oarc_idx012],
+                    oarc_idx0 = oshape_row_ids1[oarc_idx01],
+                    oarc_idx0xx =
+                        oshape_row_splits2[oshape_row_splits1[oarc_idx0]],
+                    dest_state_idx01 =
+                        oarc_idx0xx + arcs_out_data[oarc_idx0123].dest_state;
+            // If there are ties, any of the arcs may win.
+            if (end_loglikes_data[oarc_idx0123] ==
+                best_end_loglikes_data[dest_state_idx01])
+              entering_arcs_data[dest_state_idx01] = oarc_idx0123;
+          });
+    }
+
+    if (stats_ != nullptr && is_final) {
+      // oshape is indexed [fsa][t][state][arc], with T + 2 frames per FSA.
+      auto num_output_arcs_acc = stats_->num_output_arcs.Accessor();
+      K2_EVAL2(
+          c_, T + 1, num_fsas, lambda_set_num_output_arcs,
+          (int32_t t, int32_t i)->void {
+            int32_t oarc_idx01 = i * (T + 2) + t;
+            num_output_arcs_acc(t, i) =
+                oshape_row_splits3[oshape_row_splits2[oarc_idx01 + 1]] -
+                oshape_row_splits3[oshape_row_splits2[oarc_idx01]];
+          });
+    }
+
     // Remove axis 1, which corresponds to time.
     *ofsa = FsaVec(RemoveAxis(oshape, 1), arcs_out);
+
+    // The output does not refer to the arena's memory, so let the frames
+    // hold the only references to it; it is freed with them.
+    if (arena_)
+      arena_->Release();
+  }
+
+  /* Return a new uninitialized array of size `dim` for use in the FrameInfo
+     of a frame; it is allocated from `arena_` if we have one. */
+  template <typename T>
+  Array1<T> NewFrameArray(int32_t dim) {
+    if (arena_)
+      return arena_->NewArray1<T>(dim);
+    return Array1<T>(c_, dim);
   }
 
   /*
@@ -583,7 +1028,10 @@ class MultiGraphDenseIntersectPruned {
                     for any arc, minus the dynamic beam.  See the code for how
                     the dynamic beam is adjusted; it will approach
                     'search_beam_' as long as the number of active states in
-                    each FSA is between min_active and max_active.
+                    each FSA is between min_active and max_active.  If
+                    max_active_arcs_ > 0, the dynamic beams are also scaled
+                    by beam_scale_, which is shared by all FSAs and goes down
+                    while the total number of arcs exceeds max_active_arcs_.
   */
   Array1<float> GetPruningCutoffs(Ragged<float> &arc_end_scores, int32_t t) {
     NVTX_RANGE(K2_FUNC);
@@ -610,11 +1058,32 @@ class MultiGraphDenseIntersectPruned {
           min_active = min_active_;
     K2_CHECK_LT(min_active, max_active);
 
+    if (max_active_arcs_ > 0) {
+      // As for the dynamic beams, but for the whole batch: decrease the scale
+      // while there are too many arcs, else let it gradually approach 1.
+      if (arc_end_scores.NumElements() > max_active_arcs_)
+        beam_scale_ *= 0.8;
+      else
+        beam_scale_ = 0.8 * beam_scale_ + 0.2;
+    }
+    float beam_scale = beam_scale_;
+
     const int32_t *b_fsas_row_splits1 = b_fsas_->shape.RowSplits(1).Data();
 
     Array1<float> cutoffs(c_, num_fsas);
     float *cutoffs_data = cutoffs.Data();
 
+    // Row t of the statistics, if we are collecting them.
+    const int32_t *end_scores_row_splits1_data =
+        end_scores_per_fsa.RowSplits(1).Data();
+    int32_t *stats_num_states_data = nullptr, *stats_num_arcs_data = nullptr;
+    float *stats_beams_data = nullptr;
+    if (stats_ != nullptr) {
+      stats_num_states_data = stats_->num_states.Row(t).Data();
+      stats_num_arcs_data = stats_->num_arcs.Row(t).Data();
+      stats_beams_data = stats_->beams.Row(t).Data();
+    }
+
     K2_EVAL(
         c_, num_fsas, lambda_set_beam_and_cutoffs, (int32_t i)->void {
           float best_loglike = max_per_fsa_data[i],
@@ -660,7 +1129,17 @@ class MultiGraphDenseIntersectPruned {
           if (t == final_t - 1) dynamic_beam = 1.0e+10;
 
           dynamic_beams_data[i] = dynamic_beam;
+          // As for max_active, the batch-level scale is not applied on the
+          // last few frames, to avoid pruning away final states.
+          if (t + 5 < final_t) dynamic_beam *= beam_scale;
           cutoffs_data[i] = best_loglike - dynamic_beam;
+
+          if (stats_num_states_data != nullptr) {
+            stats_num_states_data[i] = active_states;
+            stats_num_arcs_data[i] = end_scores_row_splits1_data[i + 1] -
+                                     end_scores_row_splits1_data[i];
+            stats_beams_data[i] = dynamic_beam;
+          }
         });
 
     return cutoffs;
@@ -674,8 +1153,16 @@ class MultiGraphDenseIntersectPruned {
                            t >= 0
        @param [in] cur_frame   The FrameInfo for the current frame; only its
                        'states' member is expected to be set up on entry.
+       @param [out] end_loglikes  If not NULL, will be set to an array
+                       containing the end_loglike of each returned arc, i.e.
+                       the forward loglike of its source state plus its
+                       arc_loglike (this is needed for pruning; computing it
+                       here saves a kernel launch per frame).  It is not
+                       stored in ArcInfo because it is not needed after the
+                       forward pass.
    */
-  Ragged<ArcInfo> GetArcs(int32_t t, FrameInfo *cur_frame) {
+  Ragged<ArcInfo> GetArcs(int32_t t, FrameInfo *cur_frame,
+                          Array1<float> *end_loglikes = nullptr) {
     NVTX_RANGE(K2_FUNC);
     Ragged<StateInfo> &states = cur_frame->states;
     const StateInfo *state_values = states.values.Data();
@@ -684,7 +1171,7 @@ class MultiGraphDenseIntersectPruned {
     const int32_t *fsa_arc_splits = a_fsas_.shape.RowSplits(2).Data();
 
     int32_t num_states = states.values.Dim();
-    Array1<int32_t> num_arcs(c_, num_states + 1);
+    Array1<int32_t> num_arcs = NewFrameArray<int32_t>(num_states + 1);
     int32_t *num_arcs_data = num_arcs.Data();
     // `num_arcs` gives the num-arcs for each state in `states`.
     K2_EVAL(
@@ -698,12 +1185,15 @@ class MultiGraphDenseIntersectPruned {
           num_arcs_data[state_idx01] = a_fsas_num_arcs;
         });
     ExclusiveSum(num_arcs, &num_arcs);
+    int32_t tot_arcs = num_arcs.Back();
+    Array1<int32_t> arcs_row_ids = NewFrameArray<int32_t>(tot_arcs);
+    RowSplitsToRowIds(num_arcs, &arcs_row_ids);
 
     // initialize shape of array that will hold arcs leaving the active states.
     // Its shape is [fsa_index][state][arc]; the top two levels are shared with
     // `states`.  'ai' means ArcInfo.
-    RaggedShape ai_shape =
-        ComposeRaggedShapes(states.shape, RaggedShape2(&num_arcs, nullptr, -1));
+    RaggedShape ai_shape = ComposeRaggedShapes(
+        states.shape, RaggedShape2(&num_arcs, &arcs_row_ids, tot_arcs));
 
     // from state_idx01 (into `states` or `ai_shape`) -> fsa_idx0
     const int32_t *ai_row_ids1 = ai_shape.RowIds(1).Data();
@@ -714,17 +1204,21 @@ class MultiGraphDenseIntersectPruned {
     // from state_idx01 (into a_fsas_) to arc_idx01x (into a_fsas_)
     const int32_t *a_fsas_row_splits2 = a_fsas_.shape.RowSplits(2).Data();
 
-    const Arc *arcs = a_fsas_.values.Data();
+    GraphArcs arcs = a_fsas_arcs_;
     // fsa_idx0 to idx0x (into b_fsas_), which gives the 1st row for this
     // sequence.
     const int32_t *b_fsas_row_ids1 = b_fsas_->shape.RowIds(1).Data();
     const int32_t *b_fsas_row_splits1 = b_fsas_->shape.RowSplits(1).Data();
-    const float *score_data = b_fsas_->scores.Data();
-    int32_t scores_num_cols = b_fsas_->scores.Dim1();
-    auto scores_acc = b_fsas_->scores.Accessor();
+    int32_t scores_num_cols = b_fsas_->NumCols();
+    DenseFsaVecScores scores_acc = DenseFsaVecScoresAccessor(*b_fsas_);
 
-    Ragged<ArcInfo> ai(ai_shape);
+    Ragged<ArcInfo> ai(ai_shape, NewFrameArray<ArcInfo>(tot_arcs));
     ArcInfo *ai_data = ai.values.Data();  // uninitialized
+    float *end_loglikes_data = nullptr;
+    if (end_loglikes != nullptr) {
+      *end_loglikes = Array1<float>(c_, tot_arcs);
+      end_loglikes_data = end_loglikes->Data();
+    }
 
     K2_EVAL(
         c_, ai.values.Dim(), ai_lambda, (int32_t ai_arc_idx012)->void {
@@ -748,8 +1242,6 @@ class MultiGraphDenseIntersectPruned {
           ArcInfo ai;
           ai.a_fsas_arc_idx012 = a_fsas_arc_idx012;
           ai.arc_loglike = acoustic_score + arc.score;
-          ai.end_loglike =
-              OrderedIntToFloat(sinfo.forward_loglike) + ai.arc_loglike;
           // at least currently, the ArcInfo object's src_state and dest_state
           // are idx1's not idx01's, i.e. they don't contain the FSA-index,
           // where as the ai element is an idx01, so we need to do this to
@@ -758,14 +1250,72 @@ class MultiGraphDenseIntersectPruned {
           ai.u.dest_a_fsas_state_idx01 =
               sinfo.a_fsas_state_idx01 + arc.dest_state - arc.src_state;
           ai_data[ai_arc_idx012] = ai;
+          if (end_loglikes_data != nullptr)
+            end_loglikes_data[ai_arc_idx012] =
+                OrderedIntToFloat(sinfo.forward_loglike) + ai.arc_loglike;
         });
     return ai;
   }
 
   // Later we may choose to support b_fsas_->Dim0() == 1 and a_fsas_.Dim0() > 1,
-  // and we'll have to change various bits of code for that to work.
+  // and we'll have to change various bits of code for that to work.  (Many
+  // sequences sharing a few graphs is supported; see b_to_a_map_.)
   inline int32_t NumFsas() const { return b_fsas_->shape.Dim0(); }
 
+  /*
+    Returns the number of FSAs (the Dim0()) of the `states` and `arcs` of
+    frames_[t].  This is NumFsas() except in batch (not online) decoding,
+    where the sequences that have finished before frame t are left out if
+    they come after all the sequences that have not; see
+    num_fsas_per_frame_.
+  */
+  inline int32_t NumFsasOnFrame(int32_t t) const {
+    return num_fsas_per_frame_.empty() ? NumFsas() : num_fsas_per_frame_[t];
+  }
+
+  /*
+    Sets up num_fsas_per_frame_ for batch decoding of b_fsas_.  A sequence
+    with n rows in b_fsas_ (including the final row) has states only on
+    frames 0..n, so frame t needs to cover the sequences up to the last one
+    with at least t rows.  The batches are normally sorted from longest to
+    shortest, in which case all the finished sequences drop out.
+  */
+  void SetNumFsasPerFrame() {
+    int32_t num_fsas = NumFsas(), T = T_;
+    Array1<int32_t> row_splits1 = b_fsas_->shape.RowSplits(1).To(
+        GetCpuContext());
+    const int32_t *row_splits1_data = row_splits1.Data();
+    num_fsas_per_frame_.assign(T + 2, 0);
+    for (int32_t i = 0; i < num_fsas; i++) {
+      int32_t n = row_splits1_data[i + 1] - row_splits1_data[i];
+      num_fsas_per_frame_[n] = i + 1;
+    }
+    for (int32_t t = T; t >= 0; t--)
+      num_fsas_per_frame_[t] =
+          std::max(num_fsas_per_frame_[t], num_fsas_per_frame_[t + 1]);
+  }
+
+  /*
+    Returns `shape` (the shape of the `arcs` of a frame, with 3 axes) with
+    empty sub-lists appended on axis 0 so that its Dim0() is NumFsas(); see
+    NumFsasOnFrame().
+  */
+  RaggedShape PadToNumFsas(RaggedShape &shape) {
+    int32_t num_fsas = NumFsas(), dim0 = shape.Dim0();
+    if (dim0 == num_fsas) return shape;
+    K2_CHECK_LT(dim0, num_fsas);
+    Array1<int32_t> row_splits1(c_, num_fsas + 1);
+    int32_t *row_splits1_data = row_splits1.Data();
+    const int32_t *old_row_splits1_data = shape.RowSplits(1).Data();
+    K2_EVAL(
+        c_, num_fsas + 1, lambda_pad_row_splits1, (int32_t i)->void {
+          row_splits1_data[i] = old_row_splits1_data[min(i, dim0)];
+        });
+    return RaggedShape3(&row_splits1, &shape.RowIds(1), shape.TotSize(1),
+                        &shape.RowSplits(2), &shape.RowIds(2),
+                        shape.NumElements());
+  }
+
   /*
     Does the forward-propagation (basically: the decoding step) and
     returns a newly allocated FrameInfo* object for the next frame.
@@ -784,17 +1334,14 @@ class MultiGraphDenseIntersectPruned {
   template <int32_t NUM_KEY_BITS>
   std::unique_ptr<FrameInfo> PropagateForward(int32_t t, FrameInfo *cur_frame) {
     NVTX_RANGE("PropagateForward");
-    int32_t num_fsas = NumFsas();
     // Ragged<StateInfo> &states = cur_frame->states;
     // arc_info has 3 axes: fsa_id, state, arc.
-    cur_frame->arcs = GetArcs(t, cur_frame);
-
-    if (NUM_KEY_BITS > 32) { // a check.
-      constexpr int32_t NUM_VALUE_BITS = 64 - NUM_KEY_BITS,
-                             shift = std::min<int32_t>(31, NUM_VALUE_BITS);
-      // the 'min' part is to avoid a compiler warning about 'shift count too
-      // large' for code that is anyway unreachable.
-      K2_CHECK_EQ(cur_frame->arcs.NumElements() >> shift, 0) <<
+    Array1<float> ai_data_array1;  // the end_loglike of each arc.
+    cur_frame->arcs = GetArcs(t, cur_frame, &ai_data_array1);
+
+    int32_t num_value_bits = state_map_.NumValueBits();
+    if (num_value_bits < 31) { // a check.
+      K2_CHECK_EQ(cur_frame->arcs.NumElements() >> num_value_bits, 0) <<
           "Too many arcs to store in hash; try smaller NUM_KEY_BITS (would "
           "require code change) or reduce max_states or minibatch size.";
     }
@@ -802,14 +1349,10 @@ class MultiGraphDenseIntersectPruned {
     Ragged<ArcInfo> &arc_info = cur_frame->arcs;
 
     ArcInfo *ai_data = arc_info.values.Data();
-    Array1<float> ai_data_array1(c_, cur_frame->arcs.values.Dim());
-    float *ai_data_array1_data = ai_data_array1.Data();
-    K2_EVAL(
-        c_, ai_data_array1.Dim(), lambda_set_ai_data,
-        (int32_t i)->void { ai_data_array1_data[i] = ai_data[i].end_loglike; });
+    const float *end_loglikes_data = ai_data_array1.Data();
     Ragged<float> ai_loglikes(arc_info.shape, ai_data_array1);
 
-    // `cutoffs` is of dimension num_fsas.
+    // `cutoffs` is of dimension NumFsasOnFrame(t).
     Array1<float> cutoffs = GetPruningCutoffs(ai_loglikes, t);
     float *cutoffs_data = cutoffs.Data();
 
@@ -834,7 +1377,8 @@ class MultiGraphDenseIntersectPruned {
       state_map_.Resize(new_hash_size, NUM_KEY_BITS, -1, copy_data);
     }
 
-    auto state_map_acc = state_map_.GetAccessor<Hash::Accessor<NUM_KEY_BITS>>();
+    auto state_map_acc =
+        state_map_.GetAccessor<Hash::EpochAccessor<NUM_KEY_BITS>>();
 
     {
       NVTX_RANGE("LambdaSetStateMap");
@@ -844,7 +1388,7 @@ class MultiGraphDenseIntersectPruned {
             int32_t fsa_id = ai_row_ids1[ai_row_ids2[arc_idx012]];
             int32_t dest_state_idx01 =
                 ai_data[arc_idx012].u.dest_a_fsas_state_idx01;
-            float end_loglike = ai_data[arc_idx012].end_loglike,
+            float end_loglike = end_loglikes_data[arc_idx012],
                   cutoff = cutoffs_data[fsa_id];
             char keep_this_state = 0;  // only one arc entering any state will
                                        // have its 'keep_this_state_data' entry
@@ -869,53 +1413,32 @@ class MultiGraphDenseIntersectPruned {
     // state_to_fsa_id maps from an index into the next frame's
     // FrameInfo::states.values() vector to the sequence-id (fsa_id) associated
     // with it.  It should be non-decreasing.
-    Array1<int32_t> state_to_fsa_id(c_, num_states);
-    {  // This block sets 'state_to_fsa_id'.
-      NVTX_RANGE("LambdaSetStateToFsaId");
-      int32_t *state_to_fsa_id_data = state_to_fsa_id.Data();
-      K2_EVAL(
-          c_, arc_info.NumElements(), lambda_state_to_fsa_id,
-          (int32_t arc_idx012)->void {
-            int32_t fsa_id = ai_row_ids1[ai_row_ids2[arc_idx012]],
-                    this_state_j = state_reorder_data[arc_idx012],
-                    next_state_j = state_reorder_data[arc_idx012 + 1];
-            if (next_state_j > this_state_j) {
-              state_to_fsa_id_data[this_state_j] = fsa_id;
-            }
-          });
-
-      K2_DCHECK(IsMonotonic(state_to_fsa_id));
-    }
-
-    std::unique_ptr<FrameInfo> ans = std::make_unique<FrameInfo>();
-    Array1<int32_t> states_row_splits1(c_, num_fsas + 1);
-    RowIdsToRowSplits(state_to_fsa_id, &states_row_splits1);
-    ans->states = Ragged<StateInfo>(
-        RaggedShape2(&states_row_splits1, &state_to_fsa_id, num_states),
-        Array1<StateInfo>(c_, num_states));
-    StateInfo *ans_states_data = ans->states.values.Data();
-    const int32_t minus_inf_int =
-        FloatToOrderedInt(-std::numeric_limits<float>::infinity());
-    K2_EVAL(
-        c_, num_states, lambda_init_loglike, (int32_t i)->void {
-          ans_states_data[i].forward_loglike = minus_inf_int;
-        });
-
+    Array1<int32_t> state_to_fsa_id = NewFrameArray<int32_t>(num_states);
+    Array1<StateInfo> ans_states_values = NewFrameArray<StateInfo>(num_states);
     {
       NVTX_RANGE("LambdaModifyStateMap");
-      // Modify the elements of `state_map` to refer to the indexes into
-      // `ans->states` / `kept_states_data`, rather than the indexes into
-      // ai_data. This will decrease some of the values in `state_map`, in
-      // general.
+      // This one kernel (done as one to save kernel launches, since this is
+      // called on every frame) sets 'state_to_fsa_id', initializes the
+      // forward log-likes of the next frame's states, and modifies the
+      // elements of `state_map` to refer to the indexes into `ans->states` /
+      // `kept_states_data`, rather than the indexes into ai_data. This will
+      // decrease some of the values in `state_map`, in general.
+      int32_t *state_to_fsa_id_data = state_to_fsa_id.Data();
+      StateInfo *ans_states_data = ans_states_values.Data();
+      const int32_t minus_inf_int =
+          FloatToOrderedInt(-std::numeric_limits<float>::infinity());
       K2_EVAL(
           c_, arc_info.NumElements(), lambda_modify_state_map,
           (int32_t arc_idx012)->void {
             int32_t fsa_id = ai_row_ids1[ai_row_ids2[arc_idx012]];
-            int32_t dest_state_idx01 =
-                ai_data[arc_idx012].u.dest_a_fsas_state_idx01;
             int32_t this_j = state_reorder_data[arc_idx012],
                     next_j = state_reorder_data[arc_idx012 + 1];
             if (next_j > this_j) {
+              state_to_fsa_id_data[this_j] = fsa_id;
+              ans_states_data[this_j].forward_loglike = minus_inf_int;
+
+              int32_t dest_state_idx01 =
+                  ai_data[arc_idx012].u.dest_a_fsas_state_idx01;
               uint64_t state_map_idx = dest_state_idx01 +
                                       fsa_id * state_map_fsa_stride;
               uint64_t value, *key_value_addr = nullptr;
@@ -930,8 +1453,21 @@ class MultiGraphDenseIntersectPruned {
                                      (uint64_t)this_j);
             }
           });
+      K2_DCHECK(IsMonotonic(state_to_fsa_id));
     }
 
+    std::unique_ptr<FrameInfo> ans = std::make_unique<FrameInfo>();
+    // Sequences that have finished by frame t + 1 have no states on it, so
+    // they can be left out if none of the sequences after them is still
+    // active; see NumFsasOnFrame().
+    int32_t next_num_fsas = NumFsasOnFrame(t + 1);
+    Array1<int32_t> states_row_splits1 =
+        NewFrameArray<int32_t>(next_num_fsas + 1);
+    RowIdsToRowSplits(state_to_fsa_id, &states_row_splits1);
+    ans->states = Ragged<StateInfo>(
+        RaggedShape2(&states_row_splits1, &state_to_fsa_id, num_states),
+        ans_states_values);
+
     // We'll set up the data of the kept states below...
     StateInfo *kept_states_data = ans->states.values.Data();
 
@@ -974,7 +1510,8 @@ class MultiGraphDenseIntersectPruned {
             // to in the next line.
             kept_states_data[state_idx01].a_fsas_state_idx01 =
                 dest_a_fsas_state_idx01;
-            int32_t end_loglike_int = FloatToOrderedInt(info.end_loglike);
+            int32_t end_loglike_int =
+                FloatToOrderedInt(end_loglikes_data[arc_idx012]);
             // Set the forward log-like of the dest state to the largest of any
             // of those of the incoming arcs.  Note: we initialized this in
             // lambda_init_loglike above.
@@ -982,7 +1519,9 @@ class MultiGraphDenseIntersectPruned {
                       end_loglike_int);
           });
     }
-    {
+    if (state_map_.NumEpochBits() != 0) {
+      state_map_.Clear();
+    } else {
       NVTX_RANGE("LambdaResetStateMap");
       const int32_t *next_states_row_ids1 = ans->states.shape.RowIds(1).Data();
       K2_EVAL(
@@ -1001,8 +1540,9 @@ class MultiGraphDenseIntersectPruned {
 
 
   /*
-    Sets backward_loglike fields of StateInfo to the negative of the forward
-    prob if (this is the final-state or !only_final_probs), else -infinity.
+    Sets the backward loglikes of the states on `cur_frame` to the negative of
+    the forward prob if (this is the final-state or !only_final_probs), else
+    -infinity.
 
     This is used in computing the backward loglikes/scores for purposes of
     pruning.  This may be done after we're finished decoding/intersecting,
@@ -1027,14 +1567,20 @@ class MultiGraphDenseIntersectPruned {
     to save memory..."
 
       @param [in] cur_frame    Frame on which to set the backward probs
+      @param [out] backward_loglikes  Will be set to an array containing the
+                               backward loglike of each state in
+                               `cur_frame->states`.
   */
-  void SetBackwardProbsFinal(FrameInfo *cur_frame) {
+  void SetBackwardProbsFinal(FrameInfo *cur_frame,
+                             Array1<float> *backward_loglikes) {
     NVTX_RANGE("SetBackwardProbsFinal");
     Ragged<StateInfo> &cur_states = cur_frame->states;  // 2 axes: fsa,state
     int32_t num_states = cur_states.values.Dim();
+    *backward_loglikes = Array1<float>(c_, num_states);
     if (num_states == 0)
       return;
     StateInfo *cur_states_data = cur_states.values.Data();
+    float *backward_loglikes_data = backward_loglikes->Data();
     const int32_t *a_fsas_row_ids1_data = a_fsas_.shape.RowIds(1).Data(),
                *a_fsas_row_splits1_data = a_fsas_.shape.RowSplits(1).Data(),
               *cur_states_row_ids1_data = cur_states.RowIds(1).Data();
@@ -1058,14 +1604,14 @@ class MultiGraphDenseIntersectPruned {
         } else {
           backward_loglike = minus_inf;
         }
-        info->backward_loglike = backward_loglike;
+        backward_loglikes_data[state_idx01] = backward_loglike;
       });
   }
 
   /*
-    Does backward propagation of log-likes, which means setting the
-    backward_loglike field of the StateInfo variable (for cur_frame);
-    and works out which arcs and which states are to be pruned
+    Does backward propagation of log-likes, which means computing the
+    backward loglikes of the states on cur_frame; and works out which arcs and
+    which states are to be pruned
     on cur_frame; this information is output to Array1<char>'s which
     are supplied by the caller.
 
@@ -1073,7 +1619,13 @@ class MultiGraphDenseIntersectPruned {
     with the forward log-likes to produce the log-likelihood ratio vs the best
     path (this will be non-positive).  (To do this, for the final state we have
     to set the backward log-like to the negative of the forward log-like; see
-    SetBackwardProbsFinal()).
+    SetBackwardProbsFinal()).  I.e. the backward loglike of a state is the best
+    score of any path from there to the end, minus the best path in the
+    overall FSA, so you can treat backward + forward somewhat like a posterior
+    (except they don't sum to one as we're using max, not log-add).
+
+    The backward loglikes are only needed while pruning, so they are kept in
+    arrays parallel to `FrameInfo::states.values` rather than in StateInfo.
 
     This function also prunes arc-indexes on `cur_frame` and state-indexes
     on `next_frame`.
@@ -1084,11 +1636,13 @@ class MultiGraphDenseIntersectPruned {
                           set the forward log-like, and output pruning info
                           for arcs and states
        @param [in]  next_frame The next frame's FrameInfo, on which to look
-                           up log-likes for the next frame; the
-                           `backward_loglike` values of states on `next_frame`
-                           are assumed to already be set, either by
+                           up log-likes for the next frame.
+       @param [in]  next_backward_loglikes  The backward loglikes of the
+                           states on `next_frame`, as output by
                            SetBackwardProbsFinal() or a previous call to
                            PropagateBackward().
+       @param [out] cur_backward_loglikes  Will be set to the backward
+                           loglikes of the states on `cur_frame`.
        @param [out] cur_frame_states_keep   An array, created by the caller,
                         to which we'll write 1s for elements of cur_frame->states
                         which we need to keep, and 0s for others.
@@ -1100,6 +1654,8 @@ class MultiGraphDenseIntersectPruned {
   void PropagateBackward(int32_t t,
                          FrameInfo *cur_frame,
                          FrameInfo *next_frame,
+                         const Array1<float> &next_backward_loglikes,
+                         Array1<float> *cur_backward_loglikes,
                          Array1<char> *cur_frame_states_keep,
                          Array1<char> *cur_frame_arcs_keep) {
     NVTX_RANGE("PropagateBackward");
@@ -1133,7 +1689,8 @@ class MultiGraphDenseIntersectPruned {
     const int32_t *next_states_row_splits1_data =
         next_frame->states.RowSplits(1).Data();
 
-    StateInfo *next_states_data = next_frame->states.values.Data();
+    K2_CHECK_EQ(next_backward_loglikes.Dim(), next_num_states);
+    const float *next_backward_loglikes_data = next_backward_loglikes.Data();
     StateInfo *cur_states_data = cur_frame->states.values.Data();
 
     K2_EVAL(c_, num_arcs, lambda_set_arc_backward_prob_and_keep,
@@ -1155,7 +1712,7 @@ class MultiGraphDenseIntersectPruned {
       } else {
         float arc_loglike = arc->arc_loglike;
         float dest_state_backward_loglike =
-            next_states_data[dest_state_idx01].backward_loglike;
+            next_backward_loglikes_data[dest_state_idx01];
         // 'backward_loglike' is the loglike at the beginning of the arc
         backward_loglike = arc_loglike + dest_state_backward_loglike;
         float src_state_forward_loglike = OrderedIntToFloat(
@@ -1182,11 +1739,12 @@ class MultiGraphDenseIntersectPruned {
     MaxPerSublist(arc_backward_prob, minus_inf, &state_backward_prob);
 
     const float *state_backward_prob_data = state_backward_prob.Data();
+    *cur_backward_loglikes = Array1<float>(c_, num_states);
+    float *cur_backward_loglikes_data = cur_backward_loglikes->Data();
     const int32_t *cur_states_row_ids1 =
         cur_frame->states.shape.RowIds(1).Data();
 
-    int32_t num_fsas = NumFsas();
-    K2_DCHECK_EQ(cur_frame->states.shape.Dim0(), num_fsas);
+    K2_DCHECK_EQ(cur_frame->states.shape.Dim0(), NumFsasOnFrame(t));
     K2_EVAL(
         c_, cur_frame->states.NumElements(), lambda_set_state_backward_prob,
         (int32_t state_idx01)->void {
@@ -1207,7 +1765,7 @@ class MultiGraphDenseIntersectPruned {
           } else {
             backward_loglike = state_backward_prob_data[state_idx01];
           }
-          info->backward_loglike = backward_loglike;
+          cur_backward_loglikes_data[state_idx01] = backward_loglike;
           keep_cur_states_data[state_idx01] = (backward_loglike != minus_inf);
         });
   }
@@ -1234,16 +1792,21 @@ class MultiGraphDenseIntersectPruned {
   void PruneTimeRange(int32_t begin_t,
                       int32_t end_t) {
     NVTX_RANGE(K2_FUNC);
-    SetBackwardProbsFinal(frames_[end_t].get());
+    // The backward loglikes of the states on frame t + 1, for the `t` being
+    // processed in the loop below.
+    Array1<float> next_backward_loglikes;
+    SetBackwardProbsFinal(frames_[end_t].get(), &next_backward_loglikes);
     ContextPtr cpu = GetCpuContext();
     int32_t num_fsas = b_fsas_->shape.Dim0(),
                num_t = end_t - begin_t;
     Array1<int32_t> old_states_offsets(cpu, num_t + 1),
-        old_arcs_offsets(cpu, num_t + 1);
+        old_arcs_offsets(cpu, num_t + 1),
+        frames_num_fsas(cpu, num_t);  // the NumFsasOnFrame() of each frame
     int32_t tot_states = 0, tot_arcs = 0;
     {
       int32_t *old_states_offsets_data = old_states_offsets.Data(),
-                *old_arcs_offsets_data = old_arcs_offsets.Data();
+                *old_arcs_offsets_data = old_arcs_offsets.Data(),
+                 *frames_num_fsas_data = frames_num_fsas.Data();
       for (int32_t i = 0; i <= num_t; i++) {
         int32_t t = begin_t + i;
         old_states_offsets_data[i] = tot_states;
@@ -1251,6 +1814,7 @@ class MultiGraphDenseIntersectPruned {
         if (i < num_t) {
           tot_states += frames_[t]->arcs.TotSize(1);
           tot_arcs += frames_[t]->arcs.TotSize(2);
+          frames_num_fsas_data[i] = frames_[t]->arcs.Dim0();
         }
       }
     }
@@ -1284,8 +1848,11 @@ class MultiGraphDenseIntersectPruned {
             renumber_arcs.Keep().Arange(old_arcs_offsets_data[i],
                                         old_arcs_offsets_data[i + 1]);
         FrameInfo *cur_frame = frames_[t].get();
+        Array1<float> cur_backward_loglikes;
         PropagateBackward(t, cur_frame, frames_[t+1].get(),
+                          next_backward_loglikes, &cur_backward_loglikes,
                           &this_states_keep, &this_arcs_keep);
+        next_backward_loglikes = cur_backward_loglikes;
 
         old_row_splits1_ptrs_data[i] = cur_frame->arcs.RowSplits(1).Data();
         old_row_ids1_ptrs_data[i] = cur_frame->arcs.RowIds(1).Data();
@@ -1306,8 +1873,10 @@ class MultiGraphDenseIntersectPruned {
       }
     }
 
+    Array1<int32_t> frames_num_fsas_cpu = frames_num_fsas;
     old_states_offsets = old_states_offsets.To(c_);
     old_arcs_offsets = old_arcs_offsets.To(c_);
+    frames_num_fsas = frames_num_fsas.To(c_);
     Array1<int32_t> new_states_offsets = renumber_states.Old2New(true)[old_states_offsets],
                       new_arcs_offsets = renumber_arcs.Old2New(true)[old_arcs_offsets];
     int32_t new_num_states = renumber_states.NumNewElems(),
@@ -1327,10 +1896,13 @@ class MultiGraphDenseIntersectPruned {
                       *states_old2new_data = renumber_states.Old2New().Data(),
                       *states_new2old_data = renumber_states.New2Old().Data(),
                         *arcs_old2new_data = renumber_arcs.Old2New().Data(),
-                        *arcs_new2old_data = renumber_arcs.New2Old().Data();
+                        *arcs_new2old_data = renumber_arcs.New2Old().Data(),
+                         *frames_num_fsas_data = frames_num_fsas.Data();
 
     // Allocate the new row_splits and row_ids vectors for the shapes on the
-    // individual frames, and the new arc-info and state-info.
+    // individual frames, and the new arc-info and state-info.  Each row of
+    // `all_row_splits1` has room for all the FSAs; frames with fewer FSAs
+    // (see NumFsasOnFrame()) use only the start of it.
     Array2<int32_t> all_row_splits1(c_, num_t, num_fsas + 1);
     auto all_row_splits1_acc = all_row_splits1.Accessor();
     Array1<int32_t> all_row_ids1(c_, new_num_states);
@@ -1349,12 +1921,16 @@ class MultiGraphDenseIntersectPruned {
     old_all_ptrs = old_all_ptrs.To(c_);
     void **all_p = old_all_ptrs.Data();
 
-    K2_EVAL2(c_, num_t, num_fsas + 1,
-             lambda_set_new_row_splits1, (int32_t t_offset,
-                                          int32_t seq_idx) -> void {
+    // The following two lambdas are independent of each other, and are run
+    // with one kernel launch.
+    int32_t row_splits1_dim = num_fsas + 1;
+    auto lambda_set_new_row_splits1 = [=] __host__ __device__(
+                                          int32_t i) -> void {
       // note, t_offset is t - t_start.
+      int32_t t_offset = i / row_splits1_dim, seq_idx = i % row_splits1_dim;
       int32_t *old_row_splits1 = (int32_t*) all_p[t_offset];
-      int32_t old_idx0x = old_row_splits1[seq_idx];
+      int32_t old_idx0x =
+          old_row_splits1[min(seq_idx, frames_num_fsas_data[t_offset])];
       // "pos" means position in appended states vector
       // old_start_pos means start for this `t`.
       int32_t old_start_pos = old_states_offsets_data[t_offset],
@@ -1370,9 +1946,9 @@ class MultiGraphDenseIntersectPruned {
         // zero in each row_splits vector.
         all_row_splits2_data[new_pos + t_offset] = 0;
       }
-             });
+    };
 
-    K2_EVAL(c_, new_num_states, lambda_per_state, (int32_t new_i) -> void {
+    auto lambda_per_state = [=] __host__ __device__(int32_t new_i) -> void {
       // new_i is position in appended vector of all states.
       int32_t    t_offset = new_state_to_frame_data[new_i],
       old_state_start_pos = old_states_offsets_data[t_offset],
@@ -1413,7 +1989,9 @@ class MultiGraphDenseIntersectPruned {
         all_row_splits2_data[new_i + t_offset + 1] = new_arc_idx01x_next;
       }
       all_states_data[new_i] = old_states_data[old_state_idx01];
-      });
+    };
+    EvalFused(c_, num_t * row_splits1_dim, lambda_set_new_row_splits1,
+              new_num_states, lambda_per_state);
 
     K2_EVAL(c_, new_num_arcs, lambda_set_arcs, (int32_t new_i) -> void {
       // new_i is position in appended vector of all arcs
@@ -1478,7 +2056,8 @@ class MultiGraphDenseIntersectPruned {
            next_arc_offset = new_arcs_offsets_data[i + 1];
 
       // next line: operator[] into Array2 gives Array1, one row.
-      Array1<int32_t> row_splits1 = all_row_splits1.Row(i),
+      Array1<int32_t> row_splits1 = all_row_splits1.Row(i).Arange(
+                          0, frames_num_fsas_cpu[i] + 1),
                          row_ids1 = all_row_ids1.Arange(state_offset, next_state_offset),
                       row_splits2 = all_row_splits2.Arange(state_offset + i, next_state_offset + (i+1)),
                          row_ids2 = all_row_ids2.Arange(arc_offset, next_arc_offset);
@@ -1500,9 +2079,13 @@ class MultiGraphDenseIntersectPruned {
 
   ContextPtr c_;
   FsaVec &a_fsas_;         // Note: a_fsas_ has 3 axes.
-  int32_t a_fsas_stride_;  // 1 if we use a different FSA per sequence
-                           // (a_fsas_.Dim0() > 1), 0 if the decoding graph is
-                           // shared (a_fsas_.Dim0() == 1).
+  GraphArcs a_fsas_arcs_;  // The arcs of a_fsas_; normally
+                           // a_fsas_.values.Data(), but see the
+                           // constructor.
+  Array1<int32_t> b_to_a_map_;  // Maps from sequence index to the index of
+                                // its graph in a_fsas_; all zeros if the
+                                // decoding graph is shared, Range() if there
+                                // is one graph per sequence.
   std::shared_ptr<DenseFsaVec> b_fsas_;  // nnet_output to be decoded.
   int32_t num_seqs_;       // the number of sequences to decode at a time,
                            // i.e. batch size for decoding.
@@ -1513,6 +2096,12 @@ class MultiGraphDenseIntersectPruned {
   float output_beam_;
   int32_t min_active_;
   int32_t max_active_;
+  int32_t max_active_arcs_;  // 0 if not used; see the constructor.
+  // If not nullptr, where we write the statistics of the search; see
+  // Intersect().
+  IntersectDensePrunedStats *stats_ = nullptr;
+  float beam_scale_;         // scale on all the dynamic beams, in (0, 1];
+                             // only changes if max_active_arcs_ > 0.
   Array1<float> dynamic_beams_;  // dynamic beams (initially just search_beam_
                                  // but change due to max_active/min_active
                                  // constraints).
@@ -1523,8 +2112,14 @@ class MultiGraphDenseIntersectPruned {
   std::unique_ptr<FrameInfo> partial_final_frame_;  // store the final frame for
                                                     // partial results
 
+  // For batch decoding, num_fsas_per_frame_[t] (for 0 <= t <= T_ + 1) is the
+  // Dim0() of the `states` and `arcs` of frames_[t]; empty for online
+  // decoding, where all frames have NumFsas().  See NumFsasOnFrame().
+  std::vector<int32_t> num_fsas_per_frame_;
+
   int32_t state_map_fsa_stride_;  // state_map_fsa_stride_ is a_fsas_.TotSize(1)
-                                  // if a_fsas_.Dim0() == 1, else 0.
+                                  // if a graph may be shared by several
+                                  // sequences, else 0.
 
 
   Hash state_map_;    // state_map_ maps from:
@@ -1545,6 +2140,15 @@ class MultiGraphDenseIntersectPruned {
   // have -1 in them.
   std::vector<std::unique_ptr<FrameInfo>> frames_;
 
+  // Only used in the one-best mode (see IntersectOneBest()), in which it has
+  // the same size as frames_: back_pointers_[t] is indexed by the idx01 of
+  // the states of frames_[t], and is empty for t == 0.
+  std::vector<Array1<BackPointer>> back_pointers_;
+
+  // If non-NULL, the `states` and `arcs` of the frames created by
+  // PropagateForward() are allocated from here; see the constructor.
+  std::unique_ptr<RegionArena> arena_;
+
   // logically an array of bool, of size T_ + 1; for each 0 <= t <= T, after the
   // forward pass finishes propagation with cur_frame_ == t, if
   // do_pruning_after_[t] is false it will continue as normal; otherwise (if
@@ -1582,30 +2186,274 @@ void IntersectDensePruned(FsaVec &a_fsas, DenseFsaVec &b_fsas,
                           float search_beam, float output_beam,
                           int32_t min_active_states, int32_t max_active_states,
                           FsaVec *out, Array1<int32_t> *arc_map_a,
-                          Array1<int32_t> *arc_map_b) {
-  NVTX_RANGE("IntersectDensePruned");
+                          Array1<int32_t> *arc_map_b,
+                          bool use_arena /*= false*/,
+                          float lattice_beam /*= 0*/,
+                          Array1<int32_t> *entering_arcs /*= nullptr*/,
+                          int32_t max_active_arcs /*= 0*/,
+                          IntersectDensePrunedStats *stats /*= nullptr*/,
+                          const Array1<int32_t> *b_to_a_map /*= nullptr*/) {
+  NVTX_RANGE_PAYLOAD("IntersectDensePruned", kIntersect, b_fsas.shape.Dim0());
   FsaVec a_vec = FsaToFsaVec(a_fsas);
   bool online_decoding = false;
+  MultiGraphDenseIntersectPruned intersector(
+      a_vec, b_fsas.shape.Dim0(), search_beam, output_beam, min_active_states,
+      max_active_states, online_decoding, use_arena, nullptr, max_active_arcs,
+      nullptr, nullptr, b_to_a_map);
+
+  auto b_fsas_p = std::make_shared<DenseFsaVec>(b_fsas);
+  intersector.Intersect(b_fsas_p, stats);
+  if (lattice_beam > 0 && lattice_beam < output_beam)
+    intersector.PruneOutput(lattice_beam);
+  intersector.FormatOutput(out, arc_map_a, arc_map_b, true, entering_arcs);
+}
+
+void IntersectDensePrunedOneBest(FsaVec &a_fsas, DenseFsaVec &b_fsas,
+                                 float search_beam, int32_t min_active_states,
+                                 int32_t max_active_states, FsaVec *out,
+                                 Array1<int32_t> *arc_map_a,
+                                 Array1<int32_t> *arc_map_b,
+                                 const Array1<int32_t> *b_to_a_map
+                                 /*= nullptr*/) {
+  NVTX_RANGE_PAYLOAD("IntersectDensePrunedOneBest", kIntersect,
+                     b_fsas.shape.Dim0());
+  FsaVec a_vec = FsaToFsaVec(a_fsas);
+  bool online_decoding = false;
+  // output_beam is not used in the one-best mode.
+  MultiGraphDenseIntersectPruned intersector(
+      a_vec, b_fsas.shape.Dim0(), search_beam, search_beam, min_active_states,
+      max_active_states, online_decoding, false, nullptr, 0, nullptr, nullptr,
+      b_to_a_map);
+
+  auto b_fsas_p = std::make_shared<DenseFsaVec>(b_fsas);
+  intersector.IntersectOneBest(b_fsas_p);
+  intersector.FormatOneBest(out, arc_map_a, arc_map_b);
+}
+
+void IntersectDensePruned(const ImplicitTopo &a_topo, DenseFsaVec &b_fsas,
+                          float search_beam, float output_beam,
+                          int32_t min_active_states, int32_t max_active_states,
+                          FsaVec *out, Array1<int32_t> *arc_map_a,
+                          Array1<int32_t> *arc_map_b) {
+  NVTX_RANGE_PAYLOAD("IntersectDensePruned", kIntersect, b_fsas.shape.Dim0());
+  // Only the shape; the arcs are computed by the kernels.
+  FsaVec a_vec;
+  a_vec.shape = a_topo.Shape(b_fsas.Context());
+  a_vec.values = Array1<Arc>(b_fsas.Context(), 0);
+  bool online_decoding = false;
   MultiGraphDenseIntersectPruned intersector(a_vec, b_fsas.shape.Dim0(),
                                              search_beam, output_beam,
                                              min_active_states,
                                              max_active_states,
-                                             online_decoding);
+                                             online_decoding, false, nullptr,
+                                             0, &a_topo);
 
   auto b_fsas_p = std::make_shared<DenseFsaVec>(b_fsas);
   intersector.Intersect(b_fsas_p);
   intersector.FormatOutput(out, arc_map_a, arc_map_b, true);
 }
 
+void IntersectDensePrunedOneBest(const ImplicitTopo &a_topo,
+                                 DenseFsaVec &b_fsas, float search_beam,
+                                 int32_t min_active_states,
+                                 int32_t max_active_states, FsaVec *out,
+                                 Array1<int32_t> *arc_map_a,
+                                 Array1<int32_t> *arc_map_b) {
+  NVTX_RANGE_PAYLOAD("IntersectDensePrunedOneBest", kIntersect,
+                     b_fsas.shape.Dim0());
+  FsaVec a_vec;
+  a_vec.shape = a_topo.Shape(b_fsas.Context());
+  a_vec.values = Array1<Arc>(b_fsas.Context(), 0);
+  bool online_decoding = false;
+  MultiGraphDenseIntersectPruned intersector(a_vec, b_fsas.shape.Dim0(),
+                                             search_beam, search_beam,
+                                             min_active_states,
+                                             max_active_states,
+                                             online_decoding, false, nullptr,
+                                             0, &a_topo);
+
+  auto b_fsas_p = std::make_shared<DenseFsaVec>(b_fsas);
+  intersector.IntersectOneBest(b_fsas_p);
+  intersector.FormatOneBest(out, arc_map_a, arc_map_b);
+}
+
+void IntersectDensePruned(CompactFsaVec &a_fsas, DenseFsaVec &b_fsas,
+                          float search_beam, float output_beam,
+                          int32_t min_active_states, int32_t max_active_states,
+                          FsaVec *out, Array1<int32_t> *arc_map_a,
+                          Array1<int32_t> *arc_map_b) {
+  NVTX_RANGE_PAYLOAD("IntersectDensePruned", kIntersect, b_fsas.shape.Dim0());
+  // Only the shape; the arcs are read from `a_fsas` by the kernels.
+  FsaVec a_vec;
+  a_vec.shape = a_fsas.shape;
+  a_vec.values = Array1<Arc>(a_fsas.Context(), 0);
+  bool online_decoding = false;
+  MultiGraphDenseIntersectPruned intersector(a_vec, b_fsas.shape.Dim0(),
+                                             search_beam, output_beam,
+                                             min_active_states,
+                                             max_active_states,
+                                             online_decoding, false, nullptr,
+                                             0, nullptr, &a_fsas);
+
+  auto b_fsas_p = std::make_shared<DenseFsaVec>(b_fsas);
+  intersector.Intersect(b_fsas_p);
+  intersector.FormatOutput(out, arc_map_a, arc_map_b, true);
+}
+
+void IntersectDensePrunedOneBest(CompactFsaVec &a_fsas, DenseFsaVec &b_fsas,
+                                 float search_beam, int32_t min_active_states,
+                                 int32_t max_active_states, FsaVec *out,
+                                 Array1<int32_t> *arc_map_a,
+                                 Array1<int32_t> *arc_map_b) {
+  NVTX_RANGE_PAYLOAD("IntersectDensePrunedOneBest", kIntersect,
+                     b_fsas.shape.Dim0());
+  FsaVec a_vec;
+  a_vec.shape = a_fsas.shape;
+  a_vec.values = Array1<Arc>(a_fsas.Context(), 0);
+  bool online_decoding = false;
+  MultiGraphDenseIntersectPruned intersector(a_vec, b_fsas.shape.Dim0(),
+                                             search_beam, search_beam,
+                                             min_active_states,
+                                             max_active_states,
+                                             online_decoding, false, nullptr,
+                                             0, nullptr, &a_fsas);
+
+  auto b_fsas_p = std::make_shared<DenseFsaVec>(b_fsas);
+  intersector.IntersectOneBest(b_fsas_p);
+  intersector.FormatOneBest(out, arc_map_a, arc_map_b);
+}
+
+/*
+  Removes from `src` the frames on which the blank (symbol 0) has a
+  log-likelihood greater than `log_threshold`, except the first frame of each
+  run of such frames.  The last frame of each sequence (the final-transition)
+  is always kept.
+
+     @param [in] src  The chunk of nnet output to be decoded.
+     @param [in] log_threshold  The log-likelihood threshold for blank.
+     @param [in] prev_blank  prev_blank[i] is true if the last frame of
+                      sequence i in the previous chunk was a high-confidence
+                      blank frame, i.e. a run of them continues into `src`.
+     @param [out] last_blank  Will be set to the value of `prev_blank` for
+                      the next chunk.
+     @param [out] kept_frames  Will be set to a ragged tensor on CPU, indexed
+                      [seq][frame], with the idx1 into `src` of each frame
+                      that was kept (including the final-transition frame).
+     @return  Returns `src` with the skipped frames removed.
+ */
+static DenseFsaVec SkipBlankFrames(DenseFsaVec &src, float log_threshold,
+                                   const std::vector<char> &prev_blank,
+                                   std::vector<char> *last_blank,
+                                   Ragged<int32_t> *kept_frames) {
+  NVTX_RANGE(K2_FUNC);
+  ContextPtr &c = src.Context();
+  K2_CHECK_GE(src.NumCols(), 2);
+  // The frames that are kept can't be described by per-sequence offsets.
+  K2_CHECK(!src.IsPadded()) << "Blank skipping needs the dense or sparse form";
+  int32_t num_seqs = src.shape.Dim0(), num_rows = src.shape.NumElements();
+  K2_CHECK_EQ(num_seqs, static_cast<int32_t>(prev_blank.size()));
+  const int32_t *row_ids1_data = src.shape.RowIds(1).Data(),
+                *row_splits1_data = src.shape.RowSplits(1).Data();
+  DenseFsaVecScores scores_acc = DenseFsaVecScoresAccessor(src);
+
+  Array1<char> blank(c, num_rows);
+  char *blank_data = blank.Data();
+  K2_EVAL(
+      c, num_rows, lambda_set_blank, (int32_t row)->void {
+        int32_t seq = row_ids1_data[row];
+        // Column 1 is symbol 0, i.e. blank.
+        blank_data[row] = (row + 1 < row_splits1_data[seq + 1] &&
+                           scores_acc(row, 1) > log_threshold);
+      });
+
+  Array1<char> prev_blank_array(c, prev_blank),
+      last_blank_array(c, num_seqs);
+  const char *prev_blank_data = prev_blank_array.Data();
+  char *last_blank_data = last_blank_array.Data();
+  Renumbering renumbering(c, num_rows);
+  char *keep_data = renumbering.Keep().Data();
+  auto lambda_set_keep = [=] __host__ __device__(int32_t row) -> void {
+    int32_t seq = row_ids1_data[row];
+    char prev = (row == row_splits1_data[seq] ? prev_blank_data[seq]
+                                              : blank_data[row - 1]);
+    keep_data[row] = !(blank_data[row] && prev);
+  };
+  auto lambda_set_last_blank = [=] __host__ __device__(int32_t seq) -> void {
+    // row_end - 1 is the final-transition frame.
+    int32_t row_begin = row_splits1_data[seq],
+            row_end = row_splits1_data[seq + 1];
+    last_blank_data[seq] =
+        (row_end - 2 >= row_begin ? blank_data[row_end - 2]
+                                  : prev_blank_data[seq]);
+  };
+  EvalFused(c, num_rows, lambda_set_keep, num_seqs, lambda_set_last_blank);
+
+  Array1<int32_t> &new2old = renumbering.New2Old();
+  RaggedShape shape = SubsetRaggedShape(src.shape, renumbering);
+  const int32_t *new2old_data = new2old.Data();
+  Array1<int32_t> idx1s(c, new2old.Dim());
+  int32_t *idx1s_data = idx1s.Data();
+  K2_EVAL(
+      c, new2old.Dim(), lambda_set_idx1s, (int32_t i)->void {
+        int32_t row = new2old_data[i];
+        idx1s_data[i] = row - row_splits1_data[row_ids1_data[row]];
+      });
+  *kept_frames = Ragged<int32_t>(shape, idx1s).To(GetCpuContext());
+
+  last_blank_array = last_blank_array.To(GetCpuContext());
+  last_blank->assign(last_blank_array.Data(),
+                     last_blank_array.Data() + num_seqs);
+
+  bool allow_minus_one = false;
+  if (src.IsSparse()) {
+    return DenseFsaVec(
+        shape, src.sparse_num_cols,
+        IndexRows(src.top_cols, new2old, allow_minus_one),
+        IndexRows(src.top_scores, new2old, allow_minus_one),
+        Index(src.floor_scores, new2old, allow_minus_one, 0.0f));
+  }
+  if (src.IsHalf()) {
+    return DenseFsaVec(
+        shape, IndexRows(src.half_scores, new2old, allow_minus_one), src.bf16);
+  }
+  return DenseFsaVec(shape, IndexRows(src.scores, new2old, allow_minus_one));
+}
+
 OnlineDenseIntersecter::OnlineDenseIntersecter(FsaVec &a_fsas,
     int32_t num_seqs, float search_beam, float output_beam,
-    int32_t min_active_states, int32_t max_active_states) {
+    int32_t min_active_states, int32_t max_active_states,
+    bool use_arena /*= false*/, float blank_threshold /*= 0.0f*/,
+    int32_t max_active_arcs /*= 0*/) {
   bool online_decoding = true;
   K2_CHECK_EQ(a_fsas.NumAxes(), 3);
+  K2_CHECK_LT(blank_threshold, 1.0f);
   c_ = a_fsas.Context();
   search_beam_ = search_beam;
+  blank_threshold_ = blank_threshold;
   impl_ = new MultiGraphDenseIntersectPruned(a_fsas, num_seqs, search_beam,
-      output_beam, min_active_states, max_active_states, online_decoding);
+      output_beam, min_active_states, max_active_states, online_decoding,
+      use_arena, nullptr, max_active_arcs);
+}
+
+OnlineDenseIntersecter::OnlineDenseIntersecter(CompactFsaVec &a_fsas,
+    int32_t num_seqs, float search_beam, float output_beam,
+    int32_t min_active_states, int32_t max_active_states,
+    bool use_arena /*= false*/, float blank_threshold /*= 0.0f*/,
+    int32_t max_active_arcs /*= 0*/)
+    : compact_fsas_(a_fsas) {
+  bool online_decoding = true;
+  K2_CHECK_EQ(a_fsas.shape.NumAxes(), 3);
+  K2_CHECK_LT(blank_threshold, 1.0f);
+  c_ = a_fsas.Context();
+  search_beam_ = search_beam;
+  blank_threshold_ = blank_threshold;
+  // Only the shape; the arcs are read from compact_fsas_ by the kernels.
+  compact_shape_.shape = a_fsas.shape;
+  compact_shape_.values = Array1<Arc>(c_, 0);
+  impl_ = new MultiGraphDenseIntersectPruned(compact_shape_, num_seqs,
+      search_beam, output_beam, min_active_states, max_active_states,
+      online_decoding, use_arena, nullptr, max_active_arcs, nullptr,
+      &compact_fsas_);
 }
 
 OnlineDenseIntersecter::~OnlineDenseIntersecter(){
@@ -1623,22 +2471,133 @@ OnlineDenseIntersecter::~OnlineDenseIntersecter(){
   delete impl_;
 }
 
-void OnlineDenseIntersecter::Decode(DenseFsaVec &b_fsas,
-    std::vector<std::shared_ptr<DecodeStateInfo>> *decode_states,
-    FsaVec *ofsa, Array1<int32_t> *arc_map_a) {
-  auto b_fsas_p = std::make_shared<DenseFsaVec>(b_fsas);
-  int32_t num_seqs = b_fsas_p->shape.Dim0();
-
-  K2_CHECK_EQ(num_seqs, static_cast<int32_t>(decode_states->size()));
+/*
+  Splits each lattice of `lattice` in two at a state through which all its
+  paths pass: the states before split_states[i] of the i'th lattice, plus
+  that state, go to the i'th FSA of `prefix`, with a new final state and an
+  arc (label -1) to it from that state; the rest, renumbered so that
+  split_states[i] becomes the start state, stay in `lattice`.  If
+  split_states[i] is 0, the i'th FSA of `prefix` is empty.  `arc_map` is the
+  arc map of `lattice`, and is updated along with it; `prefix_arc_map` is set
+  to the arc map of `prefix`.
+*/
+static void SplitLatticePrefix(const Array1<int32_t> &split_states,
+                               FsaVec *lattice, Array1<int32_t> *arc_map,
+                               FsaVec *prefix,
+                               Array1<int32_t> *prefix_arc_map) {
+  NVTX_RANGE(K2_FUNC);
+  ContextPtr &c = lattice->Context();
+  int32_t num_fsas = lattice->Dim0(), num_states = lattice->TotSize(1);
+  const int32_t *split_states_data = split_states.Data(),
+                *row_splits1_data = lattice->RowSplits(1).Data(),
+                *row_ids1_data = lattice->RowIds(1).Data(),
+                *row_splits2_data = lattice->RowSplits(2).Data(),
+                *arc_map_data = arc_map->Data();
+  const Arc *arcs_data = lattice->values.Data();
+
+  Array1<int32_t> prefix_row_splits1(c, num_fsas + 1);
+  int32_t *prefix_row_splits1_data = prefix_row_splits1.Data();
+  K2_EVAL(
+      c, num_fsas, lambda_set_prefix_num_states, (int32_t fsa_idx0)->void {
+        int32_t split_state = split_states_data[fsa_idx0];
+        prefix_row_splits1_data[fsa_idx0] =
+            (split_state == 0 ? 0 : split_state + 2);
+      });
+  ExclusiveSum(prefix_row_splits1, &prefix_row_splits1);
+  int32_t prefix_num_states = prefix_row_splits1.Back();
+  Array1<int32_t> prefix_row_ids1(c, prefix_num_states),
+      prefix_row_splits2(c, prefix_num_states + 1);
+  RowSplitsToRowIds(prefix_row_splits1, &prefix_row_ids1);
+  const int32_t *prefix_row_ids1_data = prefix_row_ids1.Data();
+  int32_t *prefix_row_splits2_data = prefix_row_splits2.Data();
+  K2_EVAL(
+      c, prefix_num_states, lambda_set_prefix_num_arcs,
+      (int32_t state_idx01)->void {
+        int32_t fsa_idx0 = prefix_row_ids1_data[state_idx01],
+                state_idx1 = state_idx01 - prefix_row_splits1_data[fsa_idx0],
+                split_state = split_states_data[fsa_idx0], num_arcs;
+        if (state_idx1 < split_state) {
+          int32_t src_state_idx01 = row_splits1_data[fsa_idx0] + state_idx1;
+          num_arcs = row_splits2_data[src_state_idx01 + 1] -
+                     row_splits2_data[src_state_idx01];
+        } else {
+          num_arcs = (state_idx1 == split_state ? 1 : 0);
+        }
+        prefix_row_splits2_data[state_idx01] = num_arcs;
+      });
+  ExclusiveSum(prefix_row_splits2, &prefix_row_splits2);
+  int32_t prefix_num_arcs = prefix_row_splits2.Back();
+  Array1<int32_t> prefix_row_ids2(c, prefix_num_arcs);
+  RowSplitsToRowIds(prefix_row_splits2, &prefix_row_ids2);
+  const int32_t *prefix_row_ids2_data = prefix_row_ids2.Data();
+
+  Array1<Arc> prefix_arcs(c, prefix_num_arcs);
+  *prefix_arc_map = Array1<int32_t>(c, prefix_num_arcs);
+  Arc *prefix_arcs_data = prefix_arcs.Data();
+  int32_t *prefix_arc_map_data = prefix_arc_map->Data();
+  K2_EVAL(
+      c, prefix_num_arcs, lambda_set_prefix_arcs, (int32_t arc_idx012)->void {
+        int32_t state_idx01 = prefix_row_ids2_data[arc_idx012],
+                fsa_idx0 = prefix_row_ids1_data[state_idx01],
+                state_idx1 = state_idx01 - prefix_row_splits1_data[fsa_idx0],
+                split_state = split_states_data[fsa_idx0];
+        if (state_idx1 == split_state) {
+          prefix_arcs_data[arc_idx012] =
+              Arc(split_state, split_state + 1, -1, 0.0f);
+          prefix_arc_map_data[arc_idx012] = -1;
+          return;
+        }
+        int32_t src_arc_idx012 =
+            row_splits2_data[row_splits1_data[fsa_idx0] + state_idx1] +
+            arc_idx012 - prefix_row_splits2_data[state_idx01];
+        prefix_arcs_data[arc_idx012] = arcs_data[src_arc_idx012];
+        prefix_arc_map_data[arc_idx012] = arc_map_data[src_arc_idx012];
+      });
+  *prefix = FsaVec(RaggedShape3(&prefix_row_splits1, &prefix_row_ids1,
+                                prefix_num_states, &prefix_row_splits2,
+                                &prefix_row_ids2, prefix_num_arcs),
+                   prefix_arcs);
+
+  Renumbering renumbering(c, num_states);
+  char *keep_data = renumbering.Keep().Data();
+  K2_EVAL(
+      c, num_states, lambda_set_keep, (int32_t state_idx01)->void {
+        int32_t fsa_idx0 = row_ids1_data[state_idx01];
+        keep_data[state_idx01] = (state_idx01 - row_splits1_data[fsa_idx0] >=
+                                  split_states_data[fsa_idx0]);
+      });
+  Array1<int32_t> value_indexes;
+  FsaVec rest = Index(*lattice, 1, renumbering.New2Old(), &value_indexes);
+  Arc *rest_arcs_data = rest.values.Data();
+  const int32_t *rest_row_ids1_data = rest.RowIds(1).Data(),
+                *rest_row_ids2_data = rest.RowIds(2).Data();
+  K2_EVAL(
+      c, rest.NumElements(), lambda_renumber_arcs, (int32_t arc_idx012)->void {
+        int32_t fsa_idx0 = rest_row_ids1_data[rest_row_ids2_data[arc_idx012]],
+                split_state = split_states_data[fsa_idx0];
+        rest_arcs_data[arc_idx012].src_state -= split_state;
+        rest_arcs_data[arc_idx012].dest_state -= split_state;
+      });
+  *arc_map = (*arc_map)[value_indexes];
+  *lattice = rest;
+}
 
+void OnlineDenseIntersecter::StackDecodeStates(
+    const std::vector<std::shared_ptr<DecodeStateInfo>> &decode_states,
+    FrameInfoVec *frames, Array1<float> *beams,
+    std::vector<DecodeStateInfo> *infos) {
+  NVTX_RANGE(K2_FUNC);
+  int32_t num_seqs = static_cast<int32_t>(decode_states.size());
+  std::vector<std::shared_ptr<DecodeStateInfo>> states(decode_states);
   std::vector<Ragged<StateInfo> *> seq_states_ptr_vec(num_seqs);
   std::vector<Ragged<ArcInfo> *> seq_arcs_ptr_vec(num_seqs);
 
-  Array1<float> beams(GetCpuContext(), num_seqs);
-  float *beams_data = beams.Data();
+  *beams = Array1<float>(GetCpuContext(), num_seqs);
+  float *beams_data = beams->Data();
+  infos->resize(num_seqs);
   for (int32_t i = 0; i < num_seqs; ++i) {
     // initialization
-    if (!decode_states->at(i)) {
+    if (!states[i]) {
       DecodeStateInfo info;
       StateInfo sinfo;
       // start state of decoding graph
@@ -1652,11 +2611,16 @@ void OnlineDenseIntersecter::Decode(DenseFsaVec &b_fsas,
           Array1<ArcInfo>(c_, std::vector<ArcInfo>{ArcInfo()}));
 
       info.beam = search_beam_;
-      decode_states->at(i) = std::make_shared<DecodeStateInfo>(info);
+      states[i] = std::make_shared<DecodeStateInfo>(info);
     }
-    seq_states_ptr_vec[i] = &(decode_states->at(i)->states);
-    seq_arcs_ptr_vec[i] = &(decode_states->at(i)->arcs);
-    beams_data[i] = decode_states->at(i)->beam;
+    seq_states_ptr_vec[i] = &(states[i]->states);
+    seq_arcs_ptr_vec[i] = &(states[i]->arcs);
+    beams_data[i] = states[i]->beam;
+    DecodeStateInfo &info = (*infos)[i];
+    info.beam = states[i]->beam;
+    info.frame_times = states[i]->frame_times;
+    info.num_input_frames = states[i]->num_input_frames;
+    info.prev_frame_blank = states[i]->prev_frame_blank;
   }
 
   auto stack_states = Stack(0, num_seqs, seq_states_ptr_vec.data());
@@ -1675,43 +2639,424 @@ void OnlineDenseIntersecter::Decode(DenseFsaVec &b_fsas,
   Unstack(stack_states, 1, false /*pad_right*/, &frame_states_vec);
   Unstack(stack_arcs, 1, false /*pad_right*/, &frame_arcs_vec);
 
-  std::vector<std::unique_ptr<FrameInfo>> frames(frame_states_vec.size());
-
-  for (size_t i = 0; i < frames.size(); ++i) {
+  frames->clear();
+  frames->resize(frame_states_vec.size());
+  for (size_t i = 0; i < frames->size(); ++i) {
     FrameInfo info;
     info.states = frame_states_vec[i];
     info.arcs = frame_arcs_vec[i];
-    frames[i] = std::make_unique<FrameInfo>(info);
+    (*frames)[i] = std::make_unique<FrameInfo>(info);
   }
+}
 
-  const auto new_frames = impl_->OnlineIntersect(b_fsas_p, frames, beams);
+const OnlineDenseIntersecter::FrameInfoVec *
+OnlineDenseIntersecter::DecodeChunk(DenseFsaVec &b_fsas, FrameInfoVec *frames,
+                                    Array1<float> &beams,
+                                    std::vector<DecodeStateInfo> *infos,
+                                    FsaVec *ofsa, Array1<int32_t> *arc_map_a,
+                                    FsaVec *prefix,
+                                    Array1<int32_t> *prefix_arc_map_a,
+                                    std::vector<int32_t> *begin_frames,
+                                    bool *aligned) {
+  NVTX_RANGE(K2_FUNC);
+  auto b_fsas_p = std::make_shared<DenseFsaVec>(b_fsas);
+  int32_t num_seqs = b_fsas_p->shape.Dim0();
+  K2_CHECK_EQ(num_seqs, static_cast<int32_t>(infos->size()));
+
+  Array1<int32_t> row_splits;
+  if (blank_threshold_ > 0.0f) {
+    std::vector<char> prev_blank(num_seqs), last_blank;
+    for (int32_t i = 0; i < num_seqs; ++i)
+      prev_blank[i] = (*infos)[i].prev_frame_blank;
+    Ragged<int32_t> kept_frames;
+    *b_fsas_p = SkipBlankFrames(b_fsas, std::log(blank_threshold_),
+                                prev_blank, &last_blank, &kept_frames);
+    Array1<int32_t> src_row_splits =
+        b_fsas.shape.RowSplits(1).To(GetCpuContext());
+    const int32_t *src_row_splits_data = src_row_splits.Data(),
+                  *kept_row_splits_data = kept_frames.RowSplits(1).Data(),
+                  *kept_frames_data = kept_frames.values.Data();
+    for (int32_t i = 0; i < num_seqs; ++i) {
+      DecodeStateInfo &info = (*infos)[i];
+      // The last kept frame is the final-transition, which is not a frame
+      // of the input.
+      for (int32_t j = kept_row_splits_data[i];
+           j + 1 < kept_row_splits_data[i + 1]; ++j)
+        info.frame_times.push_back(info.num_input_frames +
+                                   kept_frames_data[j]);
+      info.num_input_frames +=
+          src_row_splits_data[i + 1] - src_row_splits_data[i] - 1;
+      info.prev_frame_blank = last_blank[i];
+    }
+    row_splits = kept_frames.RowSplits(1);
+  } else {
+    row_splits = b_fsas.shape.RowSplits(1).To(GetCpuContext());
+  }
+  const int32_t *row_splits_data = row_splits.Data();
+  *aligned = true;
+  for (int32_t i = 1; i < num_seqs; ++i)
+    if (row_splits_data[i + 1] - row_splits_data[i] != row_splits_data[1])
+      *aligned = false;
+
+  const auto new_frames = impl_->OnlineIntersect(b_fsas_p, *frames, beams);
   impl_->FormatOutput(ofsa, arc_map_a, nullptr/*arc_map_b*/, false);
+  begin_frames->assign(num_seqs, 0);
+  if (prefix == nullptr) return new_frames;
+
+  // Find the latest frame of each sequence that has only one state and will
+  // not be pruned again, other than the first frame of its history.
+  int32_t num_frames = new_frames->size();
+  Array1<const int32_t *> row_splits_ptrs(GetCpuContext(), num_frames);
+  for (int32_t t = 0; t < num_frames; ++t)
+    row_splits_ptrs.Data()[t] = (*new_frames)[t]->states.RowSplits(1).Data();
+  row_splits_ptrs = row_splits_ptrs.To(c_);
+  const int32_t *const *row_splits_ptrs_data = row_splits_ptrs.Data();
+  // For each sequence: the frame, the number of states of the lattice
+  // before it (i.e. the index of its state in the lattice) and the number of
+  // frames of the history before it.
+  Array2<int32_t> split(c_, 3, num_seqs);
+  auto split_acc = split.Accessor();
+  int32_t min_age = MultiGraphDenseIntersectPruned::kOnlinePruneNumFrames;
+  K2_EVAL(
+      c_, num_seqs, lambda_find_split, (int32_t seq)->void {
+        int32_t first_t = -1, last_t = -1;
+        for (int32_t t = 0; t < num_frames; ++t) {
+          const int32_t *row_splits1 = row_splits_ptrs_data[t];
+          if (row_splits1[seq + 1] > row_splits1[seq]) {
+            if (first_t < 0) first_t = t;
+            last_t = t;
+          }
+        }
+        int32_t split_t = 0, split_state = 0, num_states = 0;
+        for (int32_t t = first_t; t >= 0 && t + min_age <= last_t; ++t) {
+          const int32_t *row_splits1 = row_splits_ptrs_data[t];
+          int32_t n = row_splits1[seq + 1] - row_splits1[seq];
+          if (n == 1 && t > first_t) {
+            split_t = t;
+            split_state = num_states;
+          }
+          num_states += n;
+        }
+        split_acc(0, seq) = split_t;
+        split_acc(1, seq) = split_state;
+        split_acc(2, seq) = (split_t == 0 ? 0 : split_t - first_t);
+      });
+  Array1<int32_t> split_states = split.Row(1);
+  SplitLatticePrefix(split_states, ofsa, arc_map_a, prefix,
+                     prefix_arc_map_a);
+
+  Array2<int32_t> cpu_split = split.To(GetCpuContext());
+  auto cpu_split_acc = cpu_split.Accessor();
+  for (int32_t i = 0; i < num_seqs; ++i) {
+    (*begin_frames)[i] = cpu_split_acc(0, i);
+    if ((*begin_frames)[i] != 0) *aligned = false;
+    std::vector<int32_t> &frame_times = (*infos)[i].frame_times;
+    int32_t num_dropped = std::min<int32_t>(cpu_split_acc(2, i),
+                                            frame_times.size());
+    frame_times.erase(frame_times.begin(), frame_times.begin() + num_dropped);
+  }
+  return new_frames;
+}
 
-  int32_t frames_num = new_frames->size();
+void OnlineDenseIntersecter::UnstackDecodeStates(
+    const FrameInfoVec &frames, const std::vector<DecodeStateInfo> &infos,
+    const std::vector<int32_t> &begin_frames,
+    std::vector<std::shared_ptr<DecodeStateInfo>> *decode_states) {
+  NVTX_RANGE(K2_FUNC);
+  int32_t num_seqs = static_cast<int32_t>(infos.size());
+  int32_t frames_num = frames.size();
   std::vector<Ragged<StateInfo> *> frame_states_ptr_vec(frames_num);
   std::vector<Ragged<ArcInfo> *> frame_arcs_ptr_vec(frames_num);
   for (int32_t i = 0; i < frames_num; ++i) {
-    frame_states_ptr_vec[i] = &(new_frames->at(i)->states);
-    frame_arcs_ptr_vec[i] = &(new_frames->at(i)->arcs);
+    frame_states_ptr_vec[i] = &(frames[i]->states);
+    frame_arcs_ptr_vec[i] = &(frames[i]->arcs);
   }
 
-  stack_states = Stack(0, frames_num, frame_states_ptr_vec.data());
-  stack_arcs = Stack(0, frames_num, frame_arcs_ptr_vec.data());
+  auto stack_states = Stack(0, frames_num, frame_states_ptr_vec.data());
+  auto stack_arcs = Stack(0, frames_num, frame_arcs_ptr_vec.data());
 
   std::vector<Ragged<StateInfo>> seq_states_vec;
   std::vector<Ragged<ArcInfo>> seq_arcs_vec;
   Unstack(stack_states, 1, &seq_states_vec);
   Unstack(stack_arcs, 1, &seq_arcs_vec);
 
-  beams = impl_->GetBeams().To(GetCpuContext());
-  beams_data = beams.Data();
+  Array1<float> beams = impl_->GetBeams().To(GetCpuContext());
+  const float *beams_data = beams.Data();
+  decode_states->resize(num_seqs);
   for (int32_t i = 0; i < num_seqs; ++i) {
-    DecodeStateInfo info;
-    info.states = seq_states_vec[i];
-    info.arcs = seq_arcs_vec[i];
+    DecodeStateInfo info = infos[i];
+    if (begin_frames[i] == 0) {
+      info.states = seq_states_vec[i];
+      info.arcs = seq_arcs_vec[i];
+    } else {
+      // Copy the rest of the history so that the memory of the dropped
+      // frames is freed.
+      info.states = Arange(seq_states_vec[i], 0, begin_frames[i], frames_num)
+                        .Clone();
+      info.arcs =
+          Arange(seq_arcs_vec[i], 0, begin_frames[i], frames_num).Clone();
+    }
     info.beam = beams_data[i];
-    decode_states->at(i) = std::make_shared<DecodeStateInfo>(info);
+    (*decode_states)[i] = std::make_shared<DecodeStateInfo>(info);
   }
 }
 
+void OnlineDenseIntersecter::Decode(DenseFsaVec &b_fsas,
+    std::vector<std::shared_ptr<DecodeStateInfo>> *decode_states,
+    FsaVec *ofsa, Array1<int32_t> *arc_map_a, FsaVec *prefix /*= nullptr*/,
+    Array1<int32_t> *prefix_arc_map_a /*= nullptr*/) {
+  NVTX_RANGE(K2_FUNC);
+  int32_t num_seqs = b_fsas.shape.Dim0();
+  K2_CHECK_EQ(num_seqs, static_cast<int32_t>(decode_states->size()));
+  // The frames of DecodeStreams() are only valid until impl_ is used again.
+  SpillResidentStreams();
+
+  FrameInfoVec frames;
+  Array1<float> beams;
+  std::vector<DecodeStateInfo> infos;
+  StackDecodeStates(*decode_states, &frames, &beams, &infos);
+  std::vector<int32_t> begin_frames;
+  bool aligned;
+  const FrameInfoVec *new_frames =
+      DecodeChunk(b_fsas, &frames, beams, &infos, ofsa, arc_map_a, prefix,
+                  prefix_arc_map_a, &begin_frames, &aligned);
+  UnstackDecodeStates(*new_frames, infos, begin_frames, decode_states);
+}
+
+void OnlineDenseIntersecter::DecodeStreams(
+    DenseFsaVec &b_fsas, const std::vector<int32_t> &stream_ids,
+    FsaVec *ofsa, Array1<int32_t> *arc_map_a, FsaVec *prefix /*= nullptr*/,
+    Array1<int32_t> *prefix_arc_map_a /*= nullptr*/) {
+  NVTX_RANGE(K2_FUNC);
+  int32_t num_seqs = b_fsas.shape.Dim0();
+  K2_CHECK_EQ(num_seqs, static_cast<int32_t>(stream_ids.size()));
+  K2_CHECK_EQ(std::unordered_set<int32_t>(stream_ids.begin(),
+                                          stream_ids.end()).size(),
+              stream_ids.size()) << "Stream ids must be distinct";
+
+  FrameInfoVec frames;
+  Array1<float> beams;
+  std::vector<DecodeStateInfo> infos;
+  if (resident_aligned_ && stream_ids == resident_ids_) {
+    frames.swap(resident_frames_);
+    infos.swap(resident_infos_);
+    beams = impl_->GetBeams().To(GetCpuContext());
+  } else {
+    SpillResidentStreams();
+    std::vector<std::shared_ptr<DecodeStateInfo>> decode_states(num_seqs);
+    for (int32_t i = 0; i < num_seqs; ++i) {
+      auto iter = pool_.find(stream_ids[i]);
+      if (iter == pool_.end()) continue;
+      decode_states[i] = std::move(iter->second);
+      pool_.erase(iter);
+    }
+    StackDecodeStates(decode_states, &frames, &beams, &infos);
+  }
+  resident_ids_.clear();
+
+  std::vector<int32_t> begin_frames;
+  bool aligned;
+  const FrameInfoVec *new_frames =
+      DecodeChunk(b_fsas, &frames, beams, &infos, ofsa, arc_map_a, prefix,
+                  prefix_arc_map_a, &begin_frames, &aligned);
+
+  // Keep the frames as they are; they only hold references to the memory of
+  // those of impl_.
+  resident_frames_.clear();
+  resident_frames_.reserve(new_frames->size());
+  for (const auto &frame : *new_frames)
+    resident_frames_.push_back(std::make_unique<FrameInfo>(*frame));
+  resident_infos_ = std::move(infos);
+  resident_begin_frames_ = std::move(begin_frames);
+  resident_aligned_ = aligned;
+  resident_ids_ = stream_ids;
+}
+
+std::shared_ptr<DecodeStateInfo> OnlineDenseIntersecter::ReleaseStream(
+    int32_t stream_id) {
+  if (std::find(resident_ids_.begin(), resident_ids_.end(), stream_id) !=
+      resident_ids_.end())
+    SpillResidentStreams();
+  std::shared_ptr<DecodeStateInfo> ans;
+  auto iter = pool_.find(stream_id);
+  if (iter != pool_.end()) {
+    ans = std::move(iter->second);
+    pool_.erase(iter);
+  }
+  return ans;
+}
+
+void OnlineDenseIntersecter::SpillResidentStreams() {
+  if (resident_ids_.empty()) return;
+  NVTX_RANGE(K2_FUNC);
+  std::vector<std::shared_ptr<DecodeStateInfo>> decode_states;
+  UnstackDecodeStates(resident_frames_, resident_infos_,
+                      resident_begin_frames_, &decode_states);
+  for (size_t i = 0; i < resident_ids_.size(); ++i)
+    pool_[resident_ids_[i]] = decode_states[i];
+  resident_ids_.clear();
+  resident_frames_.clear();
+  resident_infos_.clear();
+  resident_begin_frames_.clear();
+  resident_aligned_ = false;
+}
+
+MultiDeviceDenseIntersecter::MultiDeviceDenseIntersecter(
+    FsaVec &a_fsas, const std::vector<ContextPtr> &contexts)
+    : contexts_(contexts) {
+  NVTX_RANGE(K2_FUNC);
+  K2_CHECK(!contexts_.empty());
+  FsaVec a_vec = FsaToFsaVec(a_fsas);
+  a_fsas_.reserve(contexts_.size());
+  for (const ContextPtr &c : contexts_) a_fsas_.push_back(a_vec.To(c));
+}
+
+void MultiDeviceDenseIntersecter::Intersect(
+    DenseFsaVec &b_fsas, float search_beam, float output_beam,
+    int32_t min_active_states, int32_t max_active_states, FsaVec *out,
+    Array1<int32_t> *arc_map_a, Array1<int32_t> *arc_map_b) {
+  NVTX_RANGE(K2_FUNC);
+  ContextPtr &c = b_fsas.Context();
+  int32_t num_seqs = b_fsas.shape.Dim0();
+  bool shared_graph = (a_fsas_[0].Dim0() == 1);
+  K2_CHECK(shared_graph || a_fsas_[0].Dim0() == num_seqs);
+  int32_t num_shards =
+      std::min<int32_t>(static_cast<int32_t>(contexts_.size()), num_seqs);
+  if (num_shards <= 1) {
+    FsaVec a_fsas = a_fsas_[0].To(c);
+    IntersectDensePruned(a_fsas, b_fsas, search_beam, output_beam,
+                         min_active_states, max_active_states, out, arc_map_a,
+                         arc_map_b);
+    return;
+  }
+
+  // Split the sequences, longest first, giving each to the shard with the
+  // fewest frames so far.
+  Array1<int32_t> row_splits = b_fsas.shape.RowSplits(1).To(GetCpuContext());
+  const int32_t *row_splits_data = row_splits.Data();
+  std::vector<int32_t> order(num_seqs);
+  std::iota(order.begin(), order.end(), 0);
+  std::stable_sort(order.begin(), order.end(), [=](int32_t i, int32_t j) {
+    return row_splits_data[i + 1] - row_splits_data[i] >
+           row_splits_data[j + 1] - row_splits_data[j];
+  });
+  std::vector<std::vector<int32_t>> shard_seqs(num_shards);
+  std::vector<int64_t> shard_frames(num_shards, 0);
+  for (int32_t seq : order) {
+    int32_t k = std::min_element(shard_frames.begin(), shard_frames.end()) -
+                shard_frames.begin();
+    shard_seqs[k].push_back(seq);
+    shard_frames[k] += row_splits_data[seq + 1] - row_splits_data[seq];
+  }
+
+  // Set up the inputs of each shard here, so that only the intersections
+  // themselves run concurrently.  elem_indexes[k] maps the rows of
+  // b_shards[k] to rows of b_fsas.
+  std::vector<DenseFsaVec> b_shards(num_shards);
+  std::vector<Array1<int32_t>> seqs(num_shards), elem_indexes(num_shards);
+  for (int32_t k = 0; k < num_shards; k++) {
+    Array1<int32_t> indexes(c, shard_seqs[k]);
+    Index(b_fsas.shape, 0, indexes, &elem_indexes[k]);
+    b_shards[k] = b_fsas[indexes].To(contexts_[k]);
+    seqs[k] = indexes.To(contexts_[k]);
+  }
+
+  std::vector<FsaVec> outs(num_shards);
+  std::vector<Array1<int32_t>> arc_maps_a(num_shards), arc_maps_b(num_shards);
+  std::vector<std::exception_ptr> errors(num_shards);
+  auto run_shard = [&](int32_t k) -> void {
+    try {
+      DeviceGuard guard(contexts_[k]);
+      FsaVec a_fsas = a_fsas_[k];
+      Array1<int32_t> a_value_indexes;
+      if (!shared_graph)
+        a_fsas = Index(a_fsas_[k], 0, seqs[k], &a_value_indexes);
+      IntersectDensePruned(a_fsas, b_shards[k], search_beam, output_beam,
+                           min_active_states, max_active_states, &outs[k],
+                           &arc_maps_a[k], &arc_maps_b[k]);
+      if (!shared_graph) arc_maps_a[k] = a_value_indexes[arc_maps_a[k]];
+    } catch (...) {
+      errors[k] = std::current_exception();
+    }
+  };
+  std::vector<std::thread> threads;
+  threads.reserve(num_shards - 1);
+  for (int32_t k = 1; k < num_shards; k++) threads.emplace_back(run_shard, k);
+  run_shard(0);
+  for (auto &thread : threads) thread.join();
+  for (auto &error : errors)
+    if (error) std::rethrow_exception(error);
+
+  // Bring the results to `c`, converting the arc-indexes in arc_maps_b from
+  // b_shards[k] to b_fsas.
+  int32_t scores_stride = b_fsas.ScoresStride();
+  for (int32_t k = 0; k < num_shards; k++) {
+    outs[k] = outs[k].To(c);
+    arc_maps_a[k] = arc_maps_a[k].To(c);
+    arc_maps_b[k] = arc_maps_b[k].To(c);
+    int32_t *arc_map_b_data = arc_maps_b[k].Data(),
+            shard_stride = b_shards[k].ScoresStride();
+    const int32_t *elem_indexes_data = elem_indexes[k].Data();
+    K2_EVAL(
+        c, arc_maps_b[k].Dim(), lambda_map_arc_idx, (int32_t i)->void {
+          int32_t arc_idx = arc_map_b_data[i], row = arc_idx / shard_stride,
+                  col = arc_idx - row * shard_stride;
+          arc_map_b_data[i] = elem_indexes_data[row] * scores_stride + col;
+        });
+  }
+
+  // Put the sequences back in their original order.  positions[i] is the
+  // position of sequence i in the concatenated shards.
+  std::vector<FsaVec *> out_ptrs(num_shards);
+  std::vector<int32_t> positions(num_seqs);
+  for (int32_t k = 0, pos = 0; k < num_shards; k++) {
+    out_ptrs[k] = &outs[k];
+    for (int32_t seq : shard_seqs[k]) positions[seq] = pos++;
+  }
+  FsaVec cat = Cat(0, num_shards, out_ptrs.data());
+  Array1<int32_t> new2old(c, positions), value_indexes;
+  *out = Index(cat, 0, new2old, &value_indexes);
+  if (arc_map_a)
+    *arc_map_a = Cat(c, num_shards, arc_maps_a.data())[value_indexes];
+  if (arc_map_b)
+    *arc_map_b = Cat(c, num_shards, arc_maps_b.data())[value_indexes];
+}
+
+PagedDenseIntersecter::PagedDenseIntersecter(FsaVec &a_fsas, ContextPtr c)
+    : c_(c) {
+  NVTX_RANGE(K2_FUNC);
+  FsaVec a_vec = FsaToFsaVec(a_fsas);
+  if (c_->GetDeviceType() != kCuda) {
+    a_fsas_ = a_vec.To(c_);
+    return;
+  }
+  a_fsas_.shape = a_vec.shape.To(c_);
+  // Not arcs_ = a_vec.values.To(GetPinnedContext()), which would not copy
+  // arcs that are already in (possibly unpinned) CPU memory.
+  arcs_ = Array1<Arc>(GetPinnedContext(), a_vec.values.Dim());
+  arcs_.CopyFrom(a_vec.values);
+}
+
+void PagedDenseIntersecter::Intersect(
+    DenseFsaVec &b_fsas, float search_beam, float output_beam,
+    int32_t min_active_states, int32_t max_active_states, FsaVec *out,
+    Array1<int32_t> *arc_map_a, Array1<int32_t> *arc_map_b) {
+  NVTX_RANGE(K2_FUNC);
+  K2_CHECK(b_fsas.Context()->IsCompatible(*c_));
+  if (c_->GetDeviceType() != kCuda) {
+    IntersectDensePruned(a_fsas_, b_fsas, search_beam, output_beam,
+                         min_active_states, max_active_states, out, arc_map_a,
+                         arc_map_b);
+    return;
+  }
+  bool online_decoding = false;
+  MultiGraphDenseIntersectPruned intersector(
+      a_fsas_, b_fsas.shape.Dim0(), search_beam, output_beam,
+      min_active_states, max_active_states, online_decoding,
+      false /*use_arena*/, arcs_.Data());
+  auto b_fsas_p = std::make_shared<DenseFsaVec>(b_fsas);
+  intersector.Intersect(b_fsas_p);
+  intersector.FormatOutput(out, arc_map_a, arc_map_b, true);
+}
+
 }  // namespace k2
@@ -20,8 +20,10 @@
 #define K2_CSRC_INTERSECT_DENSE_PRUNED_H_
 
 #include <memory>
+#include <unordered_map>
 #include <vector>
 
+#include "k2/csrc/compact_fsa.h"
 #include "k2/csrc/fsa.h"
 #include "k2/csrc/ragged_ops.h"
 
@@ -41,14 +43,8 @@ struct StateInfo {
      you want log-sum.  */
   int32_t forward_loglike;
 
-  /* Note: this `backward_loglike` is the best score of any path from here to
-     the end, minus the best path in the overall FSA, i.e. it's the backward
-     score you get if, at the final-state, you set backward_loglike ==
-     -forward_loglike. So backward_loglike + OrderedIntToFloat(forward_loglike)
-     <= 0, and you can treat it somewhat like a posterior (except they don't sum
-     to one as we're using max, not log-add).
-  */
-  float backward_loglike;
+  // Note: the backward log-likes, which are only needed while pruning, are
+  // not stored here but in temporary arrays; see PropagateBackward().
 };
 
 struct ArcInfo {              // for an arc that wasn't pruned away...
@@ -69,22 +65,30 @@ struct ArcInfo {              // for an arc that wasn't pruned away...
                                    // out from the structure of this frame's
                                    // ArcInfo.
   } u;
-  float end_loglike;  // loglike at the end of the arc just before
-  // (conceptually) it joins the destination state.
+  // Note: the end_loglike of each arc (the loglike at the end of the arc just
+  // before, conceptually, it joins the destination state) is only needed
+  // during the forward pass, so it is kept in a temporary array rather than
+  // here; see GetArcs().  This keeps the per-frame storage smaller.
+};
+
+// In the one-best mode (see IntersectDensePrunedOneBest()), this is kept for
+// each state instead of the arcs: the best (Viterbi) arc entering it.
+struct BackPointer {
+  int32_t src_state_idx01;    // The source state of the arc, as an idx01
+                              // into the previous frame's `states`.
+  int32_t a_fsas_arc_idx012;  // The arc-index in a_fsas_.
+  float arc_loglike;          // As in ArcInfo.
 };
 
 /*
 static std::ostream &operator<<(std::ostream &os, const StateInfo &s) {
   os << "StateInfo{" << s.a_fsas_state_idx01 << ","
-     << OrderedIntToFloat(s.forward_loglike) << "," << s.backward_loglike
-     << "}";
+     << OrderedIntToFloat(s.forward_loglike) << "}";
   return os;
 }
 static std::ostream &operator<<(std::ostream &os, const ArcInfo &a) {
   os << "ArcInfo{" << a.a_fsas_arc_idx012 << "," << a.arc_loglike << ","
-     << a.u.dest_a_fsas_state_idx01 << "," << a.end_loglike
-     << "[i=" << FloatToOrderedInt(a.end_loglike) << "]"
-     << "}";
+     << a.u.dest_a_fsas_state_idx01 << "}";
   return os;
 }
 */
@@ -135,6 +139,23 @@ struct DecodeStateInfo {
 
   // current search beam for this sequence
   float beam;
+
+  // The following are only maintained if blank-frame skipping is enabled
+  // (see `blank_threshold` in OnlineDenseIntersecter).
+
+  // frame_times[i] is the index of the i'th decoded frame within the input
+  // of this sequence (counting frames of all chunks so far, excluding the
+  // final-transition frame of each chunk).  The i'th arc on any path of the
+  // output lattice was generated from that frame, so this maps lattice
+  // times back to nnet-output times.  If the history is truncated (see
+  // `prefix` in OnlineDenseIntersecter::Decode()), the entries of the
+  // frames that were dropped are removed too.
+  std::vector<int32_t> frame_times;
+  // The number of input frames seen so far.
+  int32_t num_input_frames = 0;
+  // True if the last input frame was a high-confidence blank frame, so a
+  // run of such frames continues into the next chunk.
+  bool prev_frame_blank = false;
 };
 
 
@@ -165,12 +186,47 @@ struct DecodeStateInfo {
                            intersection/composition task. This is advisory,
                            in that it will try not to exceed that but may not
                            always succeed.  This determines the hash size.
+       @param [in] use_arena  If true, the per-frame data of each chunk is
+                           allocated from a few large blocks of memory rather
+                           than one allocation per array; see
+                           IntersectDensePruned() in fsa_algo.h.
+       @param [in] blank_threshold  If > 0, enables blank-frame skipping:
+                           frames on which the blank (symbol 0) has
+                           probability greater than this (i.e. log-likelihood
+                           greater than log(blank_threshold); the scores are
+                           assumed to be log-posteriors) are collapsed, so
+                           of each run of such frames only the first one is
+                           decoded.  For CTC-style graphs, where blank has a
+                           self-loop, this amounts to taking the blank
+                           self-loop on the skipped frames without scoring
+                           them.  Keeping the first frame of each run means
+                           repeated symbols separated by blank are still
+                           distinguished.  See DecodeStateInfo::frame_times
+                           for mapping lattice times back to input frames.
+                           E.g. 0.99.
+       @param [in] max_active_arcs  If > 0, a target for the number of arcs
+                           per frame over all the sequences of a chunk; see
+                           IntersectDensePruned() in fsa_algo.h.  The beam
+                           scale it controls carries over between chunks.
 */
 class OnlineDenseIntersecter {
  public:
     OnlineDenseIntersecter(FsaVec &a_fsas, int32_t num_seqs, float search_beam,
                       float output_beam, int32_t min_states,
-                      int32_t max_states);
+                      int32_t max_states, bool use_arena = false,
+                      float blank_threshold = 0.0f,
+                      int32_t max_active_arcs = 0);
+
+    /* Like the constructor above, but with a compact copy of the decoding
+       graphs, whose arcs take less memory and bandwidth; see CompactFsaVec.
+       It is copied (shallowly), so it need not outlive this object.
+     */
+    OnlineDenseIntersecter(CompactFsaVec &a_fsas, int32_t num_seqs,
+                           float search_beam, float output_beam,
+                           int32_t min_states, int32_t max_states,
+                           bool use_arena = false,
+                           float blank_threshold = 0.0f,
+                           int32_t max_active_arcs = 0);
 
     /* Does intersection/composition for current chunk of nnet_output(given
        by a DenseFsaVec), sequences in every chunk may come from different
@@ -192,18 +248,213 @@ class OnlineDenseIntersecter {
          @param [out] arc_map_a  At exit a map from arc-indexes in `ofsa` to
                         their source arc-indexes in `a_fsa_`(the decoding graph)
                         will have been assigned to this location.
+         @param [out] prefix  If not NULL, the frame history of the sequences
+                        is truncated, so that their memory (and the time
+                        taken to produce `ofsa`) does not grow without bound.
+                        If on some frame of a sequence only one state survived
+                        pruning, every path of its lattice passes through that
+                        state; if such a frame is old enough that it will not
+                        be pruned again, the part of the lattice up to the
+                        latest such state is final.  It is removed from `ofsa`
+                        and from the history, and is output in `prefix`, an
+                        FsaVec with one FSA per sequence: the states up to
+                        that state, plus a final state with an arc (label -1,
+                        score 0) from it.  The i'th FSA of `ofsa` then starts
+                        from that state, so the whole lattice is the
+                        concatenation of the prefixes output so far and
+                        `ofsa`.  The FSAs of `prefix` are empty for the
+                        sequences with nothing to output.
+         @param [out] prefix_arc_map_a  If `prefix` is not NULL, it is set to
+                        the map from arc-indexes in `prefix` to the decoding
+                        graph, as `arc_map_a`; its entries for the arcs to the
+                        added final states are -1.
      */
     void Decode(DenseFsaVec &b_fsas,
                 std::vector<std::shared_ptr<DecodeStateInfo>> *decode_states,
-                FsaVec *ofsa, Array1<int32_t> *arc_map_a);
+                FsaVec *ofsa, Array1<int32_t> *arc_map_a,
+                FsaVec *prefix = nullptr,
+                Array1<int32_t> *prefix_arc_map_a = nullptr);
+
+    /* Like Decode(), but the decoding states are kept by this object, in a
+       pool indexed by stream id, instead of being passed in and out.
+
+       The states of the streams of the last call stay in the batched
+       (per-frame) form that the intersection works on, so if the next call
+       decodes the same streams in the same order, and every sequence of the
+       last chunk had the same number of frames (the usual case for
+       fixed-size chunks), the frame histories are used as they are instead
+       of being split into per-stream states and stacked again.  Otherwise
+       they are split and put in the pool, and the states of the requested
+       streams are taken from it.
+
+         @param [in] b_fsas  As for Decode().
+         @param [in] stream_ids  stream_ids[i] is the id of the stream that
+                           the i'th sequence of `b_fsas` belongs to; they must
+                           be distinct.  A stream with no state in the pool
+                           (i.e. a new one) starts from the start state.
+         @param [out] ofsa  As for Decode().
+         @param [out] arc_map_a  As for Decode().
+         @param [out] prefix  As for Decode().
+         @param [out] prefix_arc_map_a  As for Decode().
+     */
+    void DecodeStreams(DenseFsaVec &b_fsas,
+                       const std::vector<int32_t> &stream_ids, FsaVec *ofsa,
+                       Array1<int32_t> *arc_map_a, FsaVec *prefix = nullptr,
+                       Array1<int32_t> *prefix_arc_map_a = nullptr);
+
+    /* Removes the decoding state of a stream from the pool of
+       DecodeStreams(), e.g. when the stream has ended, and returns it; or
+       returns nullptr if there is no state for `stream_id`.
+     */
+    std::shared_ptr<DecodeStateInfo> ReleaseStream(int32_t stream_id);
 
     ContextPtr &Context() { return c_;}
     ~OnlineDenseIntersecter();
 
  private:
+    using FrameInfoVec =
+        std::vector<std::unique_ptr<intersect_pruned_internal::FrameInfo>>;
+
+    /* Stacks the states of `decode_states` (some of which may be NULL, for
+       new sequences) into `frames`, indexed [frame][seq][state].  Sets
+       `beams` to their beams, on the CPU, and `infos` to copies of them
+       without the states and arcs.
+     */
+    void StackDecodeStates(
+        const std::vector<std::shared_ptr<DecodeStateInfo>> &decode_states,
+        FrameInfoVec *frames, Array1<float> *beams,
+        std::vector<DecodeStateInfo> *infos);
+
+    /* Does the intersection of a chunk given the stacked states and the
+       `infos` of its sequences, updating the blank-skipping state in
+       `infos`.  Returns the frames of the intersection.  Sets `aligned` to
+       true if all the sequences had the same number of (kept) frames.
+       If `prefix` is not NULL, the history is truncated as described for
+       Decode(): `begin_frames` is set to the frame (of the returned frames)
+       at which the history of each sequence now begins, or 0 if it is not
+       truncated; the frames themselves are not changed.
+     */
+    const FrameInfoVec *DecodeChunk(DenseFsaVec &b_fsas, FrameInfoVec *frames,
+                                    Array1<float> &beams,
+                                    std::vector<DecodeStateInfo> *infos,
+                                    FsaVec *ofsa, Array1<int32_t> *arc_map_a,
+                                    FsaVec *prefix,
+                                    Array1<int32_t> *prefix_arc_map_a,
+                                    std::vector<int32_t> *begin_frames,
+                                    bool *aligned);
+
+    /* Splits `frames`, the frames of the last chunk, into the states of its
+       sequences, which are written to `decode_states` along with `infos`
+       and the beams of the last chunk.  The history of sequence i starts
+       from frame begin_frames[i].
+     */
+    void UnstackDecodeStates(
+        const FrameInfoVec &frames, const std::vector<DecodeStateInfo> &infos,
+        const std::vector<int32_t> &begin_frames,
+        std::vector<std::shared_ptr<DecodeStateInfo>> *decode_states);
+
+    // Moves the states of resident_ids_ to pool_.
+    void SpillResidentStreams();
+
     ContextPtr c_;
     float search_beam_;
+    float blank_threshold_;
     MultiGraphDenseIntersectPruned* impl_;
+
+    // The state of DecodeStreams().  The streams of its last call are
+    // resident_ids_; their frames (which share memory with those of impl_)
+    // are resident_frames_, and the rest of their states resident_infos_.
+    // The history of resident_ids_[i] starts at resident_begin_frames_[i].
+    std::vector<int32_t> resident_ids_;
+    FrameInfoVec resident_frames_;
+    std::vector<DecodeStateInfo> resident_infos_;
+    std::vector<int32_t> resident_begin_frames_;
+    // True if resident_frames_ can be used as they are for the next chunk.
+    bool resident_aligned_ = false;
+    std::unordered_map<int32_t, std::shared_ptr<DecodeStateInfo>> pool_;
+
+    // Only used with a CompactFsaVec: the graphs, and an FsaVec with their
+    // shape and no arcs, which impl_ refers to.
+    CompactFsaVec compact_fsas_;
+    FsaVec compact_shape_;
+};
+
+/**
+     Runs IntersectDensePruned() with the batch split over several devices.
+     The decoding graphs are copied to each device once, in the constructor,
+     so that repeated calls to Intersect() don't pay for the copies.
+
+       @param [in] a_fsas  The decoding graphs; see `a_fsas` in
+                           IntersectDensePruned() in fsa_algo.h.  Must have
+                           Dim0() == 1 (a shared graph) or Dim0() equal to the
+                           Dim0() of the b_fsas given to Intersect().
+       @param [in] contexts  The devices to run on, e.g. one CUDA context per
+                           GPU; must be nonempty.  A batch of N sequences uses
+                           the first min(N, contexts.size()) of them.
+*/
+class MultiDeviceDenseIntersecter {
+ public:
+  MultiDeviceDenseIntersecter(FsaVec &a_fsas,
+                              const std::vector<ContextPtr> &contexts);
+
+  /* Does the same as IntersectDensePruned(a_fsas, b_fsas, ...) (see
+     fsa_algo.h for the meaning of the args), but the sequences of `b_fsas`
+     are split among the devices so that each gets about the same number of
+     frames: sequences are taken longest first and each is given to the
+     device that has the fewest frames so far.  The parts are intersected
+     concurrently, one thread per device, and the results are merged back in
+     the original order, so `out`, `arc_map_a` and `arc_map_b` are as if the
+     whole batch had been intersected at once.  They are on the context of
+     `b_fsas`.
+   */
+  void Intersect(DenseFsaVec &b_fsas, float search_beam, float output_beam,
+                 int32_t min_active_states, int32_t max_active_states,
+                 FsaVec *out, Array1<int32_t> *arc_map_a,
+                 Array1<int32_t> *arc_map_b);
+
+ private:
+  std::vector<ContextPtr> contexts_;
+  // a_fsas_[i] is the a_fsas given to the constructor, on contexts_[i].
+  std::vector<FsaVec> a_fsas_;
+};
+
+/**
+     Runs IntersectDensePruned() with a decoding graph that is too large to
+     fit in device memory.  The arcs of the graph (which take most of its
+     memory) are kept in pinned host memory, and only the states (i.e. the
+     row-splits) are copied to the device.  The kernels of the search read
+     the arcs of the states that are active on each frame directly from host
+     memory, so only those are transferred, frame by frame.  This is slower
+     than IntersectDensePruned() with the graph on the device, as each arc
+     read crosses the bus, but it allows much larger graphs.
+
+       @param [in] a_fsas  The decoding graphs, on any device; see `a_fsas`
+                           in IntersectDensePruned() in fsa_algo.h.  They
+                           are copied once, in the constructor.
+       @param [in] c       The device to decode on.  If it is not a CUDA
+                           device, the graphs are simply copied to it.
+*/
+class PagedDenseIntersecter {
+ public:
+  PagedDenseIntersecter(FsaVec &a_fsas, ContextPtr c);
+
+  /* Does the same as IntersectDensePruned(a_fsas, b_fsas, ...); see
+     fsa_algo.h for the meaning of the args.  `b_fsas` must be on the
+     device given to the constructor.
+   */
+  void Intersect(DenseFsaVec &b_fsas, float search_beam, float output_beam,
+                 int32_t min_active_states, int32_t max_active_states,
+                 FsaVec *out, Array1<int32_t> *arc_map_a,
+                 Array1<int32_t> *arc_map_b);
+
+ private:
+  ContextPtr c_;
+  // The decoding graphs on c_.  If c_ is a CUDA device, only the shape is
+  // set, and the arcs are in `arcs_`.
+  FsaVec a_fsas_;
+  // The arcs of the decoding graphs in pinned host memory, if c_ is a CUDA
+  // device; else empty.
+  Array1<Arc> arcs_;
 };
 };  // namespace k2
 
@@ -18,9 +18,16 @@
 
 #include <gtest/gtest.h>
 
+#include <algorithm>
+#include <limits>
+#include <memory>
+#include <utility>
+#include <vector>
+
 #include "k2/csrc/fsa_algo.h"
 #include "k2/csrc/fsa_utils.h"
 #include "k2/csrc/host_shim.h"
+#include "k2/csrc/intersect_dense_pruned.h"
 #include "k2/csrc/math.h"
 #include "k2/csrc/test_utils.h"
 
@@ -40,6 +47,35 @@ bool IsRandEquivalentWrapper(Fsa &a, Fsa &b, bool treat_epsilons_specially) {
                           delta, npath);
 }
 
+// Returns the dense form of a sparse or padded DenseFsaVec, on the same
+// device.
+static DenseFsaVec ToDenseForm(const DenseFsaVec &src) {
+  DenseFsaVec src_cpu = src.To(GetCpuContext());
+  int32_t num_rows = src_cpu.shape.NumElements(),
+          num_cols = src_cpu.NumCols();
+  Array2<float> scores(GetCpuContext(), num_rows, num_cols);
+  auto scores_acc = scores.Accessor();
+  DenseFsaVecScores src_acc = DenseFsaVecScoresAccessor(src_cpu);
+  for (int32_t i = 0; i < num_rows; i++)
+    for (int32_t j = 0; j < num_cols; j++) scores_acc(i, j) = src_acc(i, j);
+  return DenseFsaVec(src_cpu.shape, scores).To(src.Context());
+}
+
+// Returns `src`, which must be in the dense form, with its scores rounded to
+// 16 bits (fp16, or bfloat16 if `bf16`).
+static DenseFsaVec ToHalfForm(const DenseFsaVec &src, bool bf16) {
+  DenseFsaVec src_cpu = src.To(GetCpuContext());
+  int32_t num_rows = src_cpu.scores.Dim0(), num_cols = src_cpu.scores.Dim1();
+  Array2<int16_t> half_scores(GetCpuContext(), num_rows, num_cols);
+  auto half_scores_acc = half_scores.Accessor();
+  auto src_acc = src_cpu.scores.Accessor();
+  for (int32_t i = 0; i < num_rows; i++)
+    for (int32_t j = 0; j < num_cols; j++)
+      half_scores_acc(i, j) =
+          bf16 ? FloatToBf16(src_acc(i, j)) : FloatToHalf(src_acc(i, j));
+  return DenseFsaVec(src_cpu.shape, half_scores, bf16).To(src.Context());
+}
+
 TEST(Intersect, Simple) {
   // tests single FSA and also 2 copies of a single FSA.
   for (int i = 1; i < 8; i++) {
@@ -380,6 +416,397 @@ TEST(Intersect, RandomFsaVec) {
   }
 }
 
+TEST(Intersect, Checkpointed) {
+  // With a tiny memory budget IntersectDense() keeps only checkpoints of the
+  // state scores; the output should be exactly the same.
+  for (int32_t i = 0; i < 10; i++) {
+    ContextPtr c = (i % 2 == 0 ? GetCpuContext() : GetCudaContext());
+
+    int32_t max_symbol = 10, min_num_arcs = 0, max_num_arcs = 200;
+    bool acyclic = false;
+    int32_t num_fsas = RandInt(1, 5);
+    FsaVec fsavec = RandomFsaVec(num_fsas, num_fsas, acyclic, max_symbol,
+                                 min_num_arcs, max_num_arcs)
+                        .To(c);
+    ArcSort(&fsavec);
+
+    int32_t min_frames = 0, max_frames = 40, min_nsymbols = max_symbol + 1,
+            max_nsymbols = max_symbol + 4;
+    float scores_scale = 1.0;
+    DenseFsaVec dfsavec =
+        RandomDenseFsaVec(num_fsas, num_fsas, min_frames, max_frames,
+                          min_nsymbols, max_nsymbols, scores_scale);
+    dfsavec = dfsavec[GetDecreasingSizeOrder(dfsavec.shape)].To(c);
+
+    float output_beam = (i < 6 ? 100000.0 : 5.0);
+    int32_t max_states = 15000000, max_arcs = 1 << 30;
+    FsaVec out, out_checkpointed;
+    Array1<int32_t> arc_map_a, arc_map_b, arc_map_a_checkpointed,
+        arc_map_b_checkpointed;
+    IntersectDense(fsavec, dfsavec, nullptr, output_beam, max_states, max_arcs,
+                   &out, &arc_map_a, &arc_map_b);
+    // The last iterations also check that the beam is decreased in the same
+    // way, with a limit somewhere above the number of states of the best
+    // paths.
+    int32_t min_states = dfsavec.shape.NumElements() + num_fsas;
+    if (i >= 8 && out.TotSize(1) > min_states + 2) {
+      max_states = (out.TotSize(1) + min_states) / 2;
+      IntersectDense(fsavec, dfsavec, nullptr, output_beam, max_states,
+                     max_arcs, &out, &arc_map_a, &arc_map_b);
+    }
+    int64_t memory_budget = 1;
+    IntersectDense(fsavec, dfsavec, nullptr, output_beam, max_states, max_arcs,
+                   &out_checkpointed, &arc_map_a_checkpointed,
+                   &arc_map_b_checkpointed, memory_budget);
+    EXPECT_TRUE(Equal(out, out_checkpointed));
+    EXPECT_TRUE(Equal(arc_map_a, arc_map_a_checkpointed));
+    EXPECT_TRUE(Equal(arc_map_b, arc_map_b_checkpointed));
+  }
+}
+
+// Returns the best-path scores of the FSAs of `fsas`, on CPU; they are
+// -infinity for empty FSAs.
+static Array1<double> BestPathScores(FsaVec &fsas) {
+  Ragged<int32_t> state_batches = GetStateBatches(fsas, true);
+  Array1<int32_t> dest_states = GetDestStates(fsas, true);
+  Ragged<int32_t> incoming_arcs = GetIncomingArcs(fsas, dest_states);
+  Ragged<int32_t> entering_arc_batches =
+      GetEnteringArcIndexBatches(fsas, incoming_arcs, state_batches);
+  Array1<double> forward_scores = GetForwardScores<double>(
+      fsas, state_batches, entering_arc_batches, false);
+  return GetTotScores(fsas, forward_scores).To(GetCpuContext());
+}
+
+TEST(Intersect, SearchBeam) {
+  // With a search beam, IntersectDense() should give the same output if the
+  // beam is large, and the same best paths otherwise.
+  for (int32_t i = 0; i < 10; i++) {
+    ContextPtr c = (i % 2 == 0 ? GetCpuContext() : GetCudaContext());
+
+    int32_t max_symbol = 10, min_num_arcs = 0, max_num_arcs = 200;
+    bool acyclic = false;
+    int32_t num_fsas = RandInt(1, 5);
+    FsaVec fsavec = RandomFsaVec(num_fsas, num_fsas, acyclic, max_symbol,
+                                 min_num_arcs, max_num_arcs)
+                        .To(c);
+    ArcSort(&fsavec);
+
+    int32_t min_frames = 0, max_frames = 40, min_nsymbols = max_symbol + 1,
+            max_nsymbols = max_symbol + 4;
+    float scores_scale = 1.0;
+    DenseFsaVec dfsavec =
+        RandomDenseFsaVec(num_fsas, num_fsas, min_frames, max_frames,
+                          min_nsymbols, max_nsymbols, scores_scale);
+    dfsavec = dfsavec[GetDecreasingSizeOrder(dfsavec.shape)].To(c);
+
+    float output_beam = (i < 4 ? 100000.0 : 5.0),
+          search_beam = (i < 4 ? 100000.0 : RandInt(1, 10));
+    int32_t max_states = 15000000, max_arcs = 1 << 30;
+    FsaVec out, out_pruned;
+    Array1<int32_t> arc_map_a, arc_map_b, arc_map_a_pruned, arc_map_b_pruned;
+    IntersectDense(fsavec, dfsavec, nullptr, output_beam, max_states, max_arcs,
+                   &out, &arc_map_a, &arc_map_b);
+    int64_t memory_budget = -1;
+    IntersectDense(fsavec, dfsavec, nullptr, output_beam, max_states, max_arcs,
+                   &out_pruned, &arc_map_a_pruned, &arc_map_b_pruned,
+                   memory_budget, search_beam);
+    if (i < 4) {
+      EXPECT_TRUE(Equal(out, out_pruned));
+      EXPECT_TRUE(Equal(arc_map_a, arc_map_a_pruned));
+      EXPECT_TRUE(Equal(arc_map_b, arc_map_b_pruned));
+    } else {
+      EXPECT_LE(out_pruned.NumElements(), out.NumElements());
+      Array1<double> scores = BestPathScores(out),
+                     scores_pruned = BestPathScores(out_pruned);
+      for (int32_t j = 0; j < num_fsas; j++) {
+        if (scores[j] == -std::numeric_limits<double>::infinity())
+          EXPECT_EQ(scores[j], scores_pruned[j]);
+        else
+          EXPECT_NEAR(scores[j], scores_pruned[j], 1.0e-03);
+      }
+    }
+  }
+}
+
+TEST(Intersect, Sparse) {
+  // Intersecting with the sparse form should give the same result as
+  // intersecting with the equivalent dense scores.
+  for (int32_t i = 0; i < 8; i++) {
+    ContextPtr c = (i % 2 == 0 ? GetCpuContext() : GetCudaContext());
+
+    int32_t max_symbol = 10, min_num_arcs = 0, max_num_arcs = 200;
+    bool acyclic = false;
+    int32_t num_fsas = RandInt(1, 5);
+    FsaVec fsavec = RandomFsaVec(num_fsas, num_fsas, acyclic, max_symbol,
+                                 min_num_arcs, max_num_arcs)
+                        .To(c);
+    ArcSort(&fsavec);
+
+    int32_t min_frames = 0, max_frames = 20, min_nsymbols = max_symbol + 1,
+            max_nsymbols = max_symbol + 4;
+    float scores_scale = 1.0;
+    DenseFsaVec dfsavec =
+        RandomDenseFsaVec(num_fsas, num_fsas, min_frames, max_frames,
+                          min_nsymbols, max_nsymbols, scores_scale);
+    dfsavec = dfsavec[GetDecreasingSizeOrder(dfsavec.shape)].To(c);
+
+    // With k >= num_cols nothing is dropped.
+    int32_t k = (i < 2 ? 100 : RandInt(1, 4));
+    float floor = (i < 4 ? -std::numeric_limits<float>::infinity() : -4.0);
+    DenseFsaVec sparse = SparsifyDenseFsaVec(dfsavec, k, floor);
+    EXPECT_TRUE(sparse.IsSparse());
+    EXPECT_EQ(sparse.NumCols(), dfsavec.NumCols());
+    DenseFsaVec dense = ToDenseForm(sparse);
+    if (k >= dfsavec.NumCols()) {
+      EXPECT_TRUE(Equal(dense.scores, dfsavec.scores));
+    }
+
+    float output_beam = 100000.0;
+    int32_t max_states = 15000000, max_arcs = 1 << 30;
+    FsaVec out, out_sparse;
+    Array1<int32_t> arc_map_a, arc_map_b, arc_map_a_sparse, arc_map_b_sparse;
+    IntersectDense(fsavec, dense, nullptr, output_beam, max_states, max_arcs,
+                   &out, &arc_map_a, &arc_map_b);
+    IntersectDense(fsavec, sparse, nullptr, output_beam, max_states, max_arcs,
+                   &out_sparse, &arc_map_a_sparse, &arc_map_b_sparse);
+    EXPECT_TRUE(Equal(out, out_sparse));
+    EXPECT_TRUE(Equal(arc_map_a, arc_map_a_sparse));
+    EXPECT_TRUE(Equal(arc_map_b, arc_map_b_sparse));
+  }
+}
+
+TEST(Intersect, Half) {
+  // Intersecting with 16-bit scores should give the same result as
+  // intersecting with the same scores in float.
+  for (int32_t i = 0; i < 4; i++) {
+    ContextPtr c = (i % 2 == 0 ? GetCpuContext() : GetCudaContext());
+
+    int32_t max_symbol = 10, min_num_arcs = 0, max_num_arcs = 200;
+    bool acyclic = false;
+    int32_t num_fsas = RandInt(1, 5);
+    FsaVec fsavec = RandomFsaVec(num_fsas, num_fsas, acyclic, max_symbol,
+                                 min_num_arcs, max_num_arcs)
+                        .To(c);
+    ArcSort(&fsavec);
+
+    int32_t min_frames = 0, max_frames = 20, min_nsymbols = max_symbol + 1,
+            max_nsymbols = max_symbol + 4;
+    float scores_scale = 1.0;
+    DenseFsaVec dfsavec =
+        RandomDenseFsaVec(num_fsas, num_fsas, min_frames, max_frames,
+                          min_nsymbols, max_nsymbols, scores_scale);
+    dfsavec = dfsavec[GetDecreasingSizeOrder(dfsavec.shape)].To(c);
+    bool bf16 = (i >= 2);
+    DenseFsaVec half = ToHalfForm(dfsavec, bf16), dense = ToDenseForm(half);
+    EXPECT_TRUE(half.IsHalf());
+    EXPECT_EQ(half.NumCols(), dfsavec.NumCols());
+
+    float output_beam = 100000.0;
+    int32_t max_states = 15000000, max_arcs = 1 << 30;
+    FsaVec out, out_half;
+    Array1<int32_t> arc_map_a, arc_map_b, arc_map_a_half, arc_map_b_half;
+    IntersectDense(fsavec, dense, nullptr, output_beam, max_states, max_arcs,
+                   &out, &arc_map_a, &arc_map_b);
+    IntersectDense(fsavec, half, nullptr, output_beam, max_states, max_arcs,
+                   &out_half, &arc_map_a_half, &arc_map_b_half);
+    EXPECT_TRUE(Equal(out, out_half));
+    EXPECT_TRUE(Equal(arc_map_a, arc_map_a_half));
+    EXPECT_TRUE(Equal(arc_map_b, arc_map_b_half));
+  }
+}
+
+TEST(Intersect, EstimateSizes) {
+  // Sizing things up front should not change the result.
+  for (int32_t i = 0; i < 8; i++) {
+    ContextPtr c = (i % 2 == 0 ? GetCpuContext() : GetCudaContext());
+
+    int32_t max_symbol = 10, min_num_arcs = 0, max_num_arcs = 50;
+    bool acyclic = true;
+    int32_t num_fsas = RandInt(1, 5);
+    FsaVec a_fsas = RandomFsaVec(1, 1, acyclic, max_symbol, min_num_arcs,
+                                 max_num_arcs)
+                        .To(c),
+           b_fsas = RandomFsaVec(num_fsas, num_fsas, acyclic, max_symbol,
+                                 min_num_arcs, max_num_arcs)
+                        .To(c);
+    Array1<int32_t> b_to_a_map(c, num_fsas, 0);
+
+    FsaVec out, out_estimated;
+    Array1<int32_t> arc_map_a, arc_map_b, arc_map_a_estimated,
+        arc_map_b_estimated;
+    out = IntersectDevice(a_fsas, -1, b_fsas, -1, b_to_a_map, &arc_map_a,
+                          &arc_map_b, false);
+    out_estimated = IntersectDevice(a_fsas, -1, b_fsas, -1, b_to_a_map,
+                                    &arc_map_a_estimated,
+                                    &arc_map_b_estimated, false, true);
+    EXPECT_EQ(out.TotSize(1), out_estimated.TotSize(1));
+    EXPECT_EQ(out.NumElements(), out_estimated.NumElements());
+    FsaVec out_cpu = out.To(GetCpuContext()),
+           out_estimated_cpu = out_estimated.To(GetCpuContext());
+    EXPECT_TRUE(IsRandEquivalentWrapper(out_cpu, out_estimated_cpu, false));
+  }
+}
+
+TEST(Intersect, SortedMatchB) {
+  // Matching from the side with fewer arcs should give the same result, up to
+  // the order of the arcs.
+  for (int32_t i = 0; i < 8; i++) {
+    ContextPtr c = (i % 2 == 0 ? GetCpuContext() : GetCudaContext());
+
+    int32_t max_symbol = 10;
+    bool acyclic = true;
+    int32_t num_fsas = RandInt(1, 5);
+    // A large graph and small lattices.
+    FsaVec a_fsas = RandomFsaVec(1, 1, acyclic, max_symbol, 100, 400).To(c),
+           b_fsas = RandomFsaVec(num_fsas, num_fsas, acyclic, max_symbol, 0,
+                                 20)
+                        .To(c);
+    ArcSort(&a_fsas);
+    ArcSort(&b_fsas);
+    Array1<int32_t> b_to_a_map(c, num_fsas, 0);
+
+    FsaVec out, out_b;
+    Array1<int32_t> arc_map_a, arc_map_b, arc_map_a_b, arc_map_b_b;
+    out = IntersectDevice(a_fsas, -1, b_fsas, -1, b_to_a_map, &arc_map_a,
+                          &arc_map_b, true);
+    out_b = IntersectDevice(a_fsas, -1, b_fsas, -1, b_to_a_map, &arc_map_a_b,
+                            &arc_map_b_b, true, false, true);
+    EXPECT_EQ(out.TotSize(1), out_b.TotSize(1));
+    EXPECT_EQ(out.NumElements(), out_b.NumElements());
+    FsaVec out_cpu = out.To(GetCpuContext()),
+           out_b_cpu = out_b.To(GetCpuContext()),
+           a_cpu = a_fsas.To(GetCpuContext()),
+           b_cpu = b_fsas.To(GetCpuContext());
+    EXPECT_TRUE(IsRandEquivalentWrapper(out_cpu, out_b_cpu, false));
+
+    arc_map_a_b = arc_map_a_b.To(GetCpuContext());
+    arc_map_b_b = arc_map_b_b.To(GetCpuContext());
+    for (int32_t j = 0; j < out_b_cpu.NumElements(); j++) {
+      Arc arc = out_b_cpu.values[j], a_arc = a_cpu.values[arc_map_a_b[j]],
+          b_arc = b_cpu.values[arc_map_b_b[j]];
+      EXPECT_EQ(arc.label, a_arc.label);
+      EXPECT_EQ(arc.label, b_arc.label);
+      EXPECT_NEAR(arc.score, a_arc.score + b_arc.score, 1.0e-04);
+    }
+  }
+}
+
+TEST(Intersect, Queue) {
+  // Processing the states from a queue should give the same result as the
+  // iterations, up to the numbering of the states and the order of the arcs.
+  for (int32_t i = 0; i < 12; i++) {
+    ContextPtr c = (i % 2 == 0 ? GetCpuContext() : GetCudaContext());
+    // 0: unsorted matching; 1: sorted_match_a; 2: and sorted_match_b.
+    int32_t mode = (i / 2) % 3;
+    bool sorted_match_a = (mode >= 1), sorted_match_b = (mode == 2);
+
+    int32_t max_symbol = 10;
+    bool acyclic = (i < 6);
+    int32_t num_fsas = RandInt(1, 5);
+    FsaVec a_fsas = RandomFsaVec(1, 1, acyclic, max_symbol, 0, 100).To(c),
+           b_fsas = RandomFsaVec(num_fsas, num_fsas, acyclic, max_symbol, 0,
+                                 30)
+                        .To(c);
+    ArcSort(&a_fsas);
+    ArcSort(&b_fsas);
+    Array1<int32_t> b_to_a_map(c, num_fsas, 0);
+
+    FsaVec out, out_queue;
+    Array1<int32_t> arc_map_a, arc_map_b, arc_map_a_queue, arc_map_b_queue;
+    out = IntersectDevice(a_fsas, -1, b_fsas, -1, b_to_a_map, &arc_map_a,
+                          &arc_map_b, sorted_match_a, false, sorted_match_b);
+    out_queue = IntersectDevice(a_fsas, -1, b_fsas, -1, b_to_a_map,
+                                &arc_map_a_queue, &arc_map_b_queue,
+                                sorted_match_a, false, sorted_match_b, true);
+    EXPECT_EQ(out.Dim0(), out_queue.Dim0());
+    EXPECT_TRUE(Equal(out.RowSplits(1), out_queue.RowSplits(1)));
+    ASSERT_EQ(out.NumElements(), out_queue.NumElements());
+    // The outputs may be cyclic, so rather than checking equivalence we check
+    // that they contain the same pairs of arcs of a and b.
+    std::vector<std::pair<int32_t, int32_t>> arc_pairs, arc_pairs_queue;
+    for (int32_t j = 0; j < out.NumElements(); j++) {
+      arc_pairs.emplace_back(arc_map_a[j], arc_map_b[j]);
+      arc_pairs_queue.emplace_back(arc_map_a_queue[j], arc_map_b_queue[j]);
+    }
+    std::sort(arc_pairs.begin(), arc_pairs.end());
+    std::sort(arc_pairs_queue.begin(), arc_pairs_queue.end());
+    EXPECT_EQ(arc_pairs, arc_pairs_queue);
+
+    FsaVec out_queue_cpu = out_queue.To(GetCpuContext());
+    Array1<int32_t> properties;
+    int32_t tot_properties;
+    GetFsaVecBasicProperties(out_queue_cpu, &properties, &tot_properties);
+    EXPECT_TRUE(tot_properties & kFsaPropertiesValid);
+    FsaVec a_cpu = a_fsas.To(GetCpuContext()),
+           b_cpu = b_fsas.To(GetCpuContext());
+    arc_map_a_queue = arc_map_a_queue.To(GetCpuContext());
+    arc_map_b_queue = arc_map_b_queue.To(GetCpuContext());
+    for (int32_t j = 0; j < out_queue_cpu.NumElements(); j++) {
+      Arc arc = out_queue_cpu.values[j],
+          a_arc = a_cpu.values[arc_map_a_queue[j]],
+          b_arc = b_cpu.values[arc_map_b_queue[j]];
+      EXPECT_EQ(arc.label, a_arc.label);
+      EXPECT_EQ(arc.label, b_arc.label);
+      EXPECT_NEAR(arc.score, a_arc.score + b_arc.score, 1.0e-04);
+    }
+  }
+}
+
+TEST(Intersect, SelfLoops) {
+  // Intersecting with a_self_loops == true should give the same result as
+  // adding the epsilon self-loops to a_fsas first.
+  for (int32_t i = 0; i < 16; i++) {
+    ContextPtr c = (i % 2 == 0 ? GetCpuContext() : GetCudaContext());
+    // 0: unsorted matching; 1: sorted_match_a; 2: and sorted_match_b;
+    // 3: sorted_match_a with use_queue.
+    int32_t mode = (i / 2) % 4;
+    bool sorted_match_a = (mode >= 1), sorted_match_b = (mode == 2),
+         use_queue = (mode == 3), estimate_sizes = (i >= 8);
+
+    int32_t max_symbol = 10;
+    bool acyclic = true;
+    int32_t num_fsas = RandInt(1, 5);
+    FsaVec a_fsas = RandomFsaVec(1, 2, acyclic, max_symbol, 0, 100).To(c),
+           b_fsas = RandomFsaVec(num_fsas, num_fsas, acyclic, max_symbol, 0,
+                                 30)
+                        .To(c);
+    ArcSort(&a_fsas);
+    ArcSort(&b_fsas);
+    Array1<int32_t> b_to_a_map = RandUniformArray1(c, num_fsas, 0,
+                                                   a_fsas.Dim0() - 1);
+
+    FsaVec a_loops;
+    Array1<int32_t> loops_arc_map;
+    AddEpsilonSelfLoops(a_fsas, &a_loops, &loops_arc_map);
+
+    Array1<int32_t> arc_map_a, arc_map_b, arc_map_a_ref, arc_map_b_ref;
+    FsaVec out = IntersectDevice(a_fsas, -1, b_fsas, -1, b_to_a_map,
+                                 &arc_map_a, &arc_map_b, sorted_match_a,
+                                 estimate_sizes, sorted_match_b, use_queue,
+                                 true),
+           out_ref = IntersectDevice(a_loops, -1, b_fsas, -1, b_to_a_map,
+                                     &arc_map_a_ref, &arc_map_b_ref,
+                                     sorted_match_a, estimate_sizes,
+                                     sorted_match_b, use_queue);
+    EXPECT_TRUE(Equal(out.RowSplits(1), out_ref.RowSplits(1)));
+    ASSERT_EQ(out.NumElements(), out_ref.NumElements());
+    arc_map_a_ref = loops_arc_map[arc_map_a_ref];
+    // With use_queue the order of the arcs may differ on GPU, so we compare
+    // the pairs of arcs of a and b.
+    std::vector<std::pair<int32_t, int32_t>> arc_pairs, arc_pairs_ref;
+    for (int32_t j = 0; j < out.NumElements(); j++) {
+      arc_pairs.emplace_back(arc_map_a[j], arc_map_b[j]);
+      arc_pairs_ref.emplace_back(arc_map_a_ref[j], arc_map_b_ref[j]);
+    }
+    std::sort(arc_pairs.begin(), arc_pairs.end());
+    std::sort(arc_pairs_ref.begin(), arc_pairs_ref.end());
+    EXPECT_EQ(arc_pairs, arc_pairs_ref);
+    if (!use_queue) {
+      EXPECT_TRUE(Equal(out, out_ref));
+    }
+  }
+}
+
 TEST(IntersectPruned, Simple) {
   for (int i = 0; i < 2; i++) {
     K2_LOG(INFO) << "Intersection for " << (i == 0 ? "CPU" : "GPU");
@@ -733,4 +1160,987 @@ TEST(IntersectPruned, RandomFsaVec) {
   }
 }
 
+TEST(IntersectPruned, SharedGraphs) {
+  // Sequences that share graphs through b_to_a_map should give the same
+  // result as with a copy of its graph for each sequence.
+  for (int32_t i = 0; i < 4; i++) {
+    ContextPtr c = (i % 2 == 0 ? GetCpuContext() : GetCudaContext()),
+               cpu = GetCpuContext();
+    int32_t max_symbol = 10, num_graphs = RandInt(1, 3),
+            num_seqs = RandInt(1, 8);
+    FsaVec graphs = RandomFsaVec(num_graphs, num_graphs, false, max_symbol,
+                                 0, 100)
+                        .To(c);
+    ArcSort(&graphs);
+    DenseFsaVec dfsavec = RandomDenseFsaVec(num_seqs, num_seqs, 0, 10,
+                                            max_symbol + 1, max_symbol + 4,
+                                            1.0)
+                              .To(c);
+
+    Array1<int32_t> b_to_a_map(cpu, num_seqs);
+    for (int32_t n = 0; n < num_seqs; n++)
+      b_to_a_map.Data()[n] = RandInt(0, num_graphs - 1);
+    b_to_a_map = b_to_a_map.To(c);
+    Array1<int32_t> arc_map_copies;
+    FsaVec copies = Index(graphs, 0, b_to_a_map, &arc_map_copies);
+
+    float search_beam = 1000.0, output_beam = 1000.0;
+    int32_t min_active = 0, max_active = 10;
+    FsaVec out, ref_out;
+    Array1<int32_t> arc_map_a, arc_map_b, ref_arc_map_a, ref_arc_map_b;
+    IntersectDensePruned(copies, dfsavec, search_beam, output_beam,
+                         min_active, max_active, &ref_out, &ref_arc_map_a,
+                         &ref_arc_map_b);
+    IntersectDensePruned(graphs, dfsavec, search_beam, output_beam,
+                         min_active, max_active, &out, &arc_map_a, &arc_map_b,
+                         false, 0, nullptr, 0, nullptr, &b_to_a_map);
+    EXPECT_EQ(out.Dim0(), num_seqs);
+    if (c->GetDeviceType() == kCpu) {
+      // On CPU the search is deterministic, so the results are identical.
+      EXPECT_TRUE(Equal(out, ref_out));
+      EXPECT_TRUE(Equal(arc_map_a, arc_map_copies[ref_arc_map_a]));
+      EXPECT_TRUE(Equal(arc_map_b, ref_arc_map_b));
+    } else {
+      EXPECT_TRUE(IsRandEquivalentWrapper(out, ref_out, false));
+    }
+
+    FsaVec one_best, ref_one_best;
+    IntersectDensePrunedOneBest(copies, dfsavec, search_beam, min_active,
+                                max_active, &ref_one_best, &ref_arc_map_a,
+                                &ref_arc_map_b);
+    IntersectDensePrunedOneBest(graphs, dfsavec, search_beam, min_active,
+                                max_active, &one_best, &arc_map_a, &arc_map_b,
+                                &b_to_a_map);
+    if (c->GetDeviceType() == kCpu) {
+      EXPECT_TRUE(Equal(one_best, ref_one_best));
+      EXPECT_TRUE(Equal(arc_map_a, arc_map_copies[ref_arc_map_a]));
+    }
+  }
+}
+
+TEST(IntersectPruned, Arena) {
+  for (int32_t i = 0; i < 10; i++) {
+    int32_t max_symbol = 10, min_num_arcs = 0, max_num_arcs = 200;
+    bool acyclic = false;
+    ContextPtr c = (i % 2 == 0 ? GetCpuContext() : GetCudaContext()),
+               cpu = GetCpuContext();
+
+    int32_t num_b_fsas = RandInt(1, 5),
+            num_a_fsas = (RandInt(0, 1) ? 1 : num_b_fsas);
+
+    Fsa fsavec = RandomFsaVec(num_a_fsas, num_a_fsas, acyclic, max_symbol,
+                              min_num_arcs, max_num_arcs)
+                     .To(c);
+    ArcSort(&fsavec);
+
+    // Use enough frames that some frames get pruned before we are done.
+    int32_t min_frames = 0, max_frames = 50, min_nsymbols = max_symbol + 1,
+            max_nsymbols = max_symbol + 4;
+    float scores_scale = 1.0;
+    DenseFsaVec dfsavec =
+        RandomDenseFsaVec(num_b_fsas, num_b_fsas, min_frames, max_frames,
+                          min_nsymbols, max_nsymbols, scores_scale)
+            .To(c);
+
+    float search_beam = 20.0, output_beam = 8.0;
+    int32_t min_active = 0, max_active = 10;
+    FsaVec out_fsas, out_fsas_arena;
+    Array1<int32_t> arc_map_a, arc_map_b, arc_map_a_arena, arc_map_b_arena;
+    IntersectDensePruned(fsavec, dfsavec, search_beam, output_beam, min_active,
+                         max_active, &out_fsas, &arc_map_a, &arc_map_b);
+    bool use_arena = true;
+    IntersectDensePruned(fsavec, dfsavec, search_beam, output_beam, min_active,
+                         max_active, &out_fsas_arena, &arc_map_a_arena,
+                         &arc_map_b_arena, use_arena);
+
+    // Where the memory comes from should make no difference to the result.
+    EXPECT_TRUE(Equal(out_fsas.shape, out_fsas_arena.shape));
+    EXPECT_TRUE(Equal(arc_map_a, arc_map_a_arena));
+    EXPECT_TRUE(Equal(arc_map_b, arc_map_b_arena));
+    out_fsas = out_fsas.To(cpu);
+    out_fsas_arena = out_fsas_arena.To(cpu);
+    bool treat_epsilons_specially = false;
+    EXPECT_TRUE(IsRandEquivalentWrapper(out_fsas, out_fsas_arena,
+                                        treat_epsilons_specially));
+  }
+}
+
+TEST(IntersectPruned, LatticeBeam) {
+  for (int32_t i = 0; i < 10; i++) {
+    int32_t max_symbol = 10, min_num_arcs = 0, max_num_arcs = 200;
+    bool acyclic = false;
+    ContextPtr c = (i % 2 == 0 ? GetCpuContext() : GetCudaContext()),
+               cpu = GetCpuContext();
+
+    int32_t num_b_fsas = RandInt(1, 5),
+            num_a_fsas = (RandInt(0, 1) ? 1 : num_b_fsas);
+
+    Fsa fsavec = RandomFsaVec(num_a_fsas, num_a_fsas, acyclic, max_symbol,
+                              min_num_arcs, max_num_arcs)
+                     .To(c);
+    ArcSort(&fsavec);
+
+    int32_t min_frames = 0, max_frames = 50, min_nsymbols = max_symbol + 1,
+            max_nsymbols = max_symbol + 4;
+    float scores_scale = 1.0;
+    DenseFsaVec dfsavec =
+        RandomDenseFsaVec(num_b_fsas, num_b_fsas, min_frames, max_frames,
+                          min_nsymbols, max_nsymbols, scores_scale)
+            .To(c);
+
+    float search_beam = 20.0, output_beam = 8.0, lattice_beam = 2.0;
+    int32_t min_active = 0, max_active = 10;
+    FsaVec out_fsas, pruned_fsas;
+    Array1<int32_t> arc_map_a, arc_map_b, pruned_arc_map_a,
+        pruned_arc_map_b;
+    IntersectDensePruned(fsavec, dfsavec, search_beam, output_beam, min_active,
+                         max_active, &out_fsas, &arc_map_a, &arc_map_b);
+    IntersectDensePruned(fsavec, dfsavec, search_beam, output_beam, min_active,
+                         max_active, &pruned_fsas, &pruned_arc_map_a,
+                         &pruned_arc_map_b, false, lattice_beam);
+    EXPECT_LE(pruned_fsas.NumElements(), out_fsas.NumElements());
+
+    // The best path is not affected, and all the remaining arcs are on a
+    // path within `lattice_beam` of it.
+    Array1<float> forward_scores, pruned_forward_scores, arc_post;
+    FsaVecTopology(out_fsas).GetScores(false, &forward_scores);
+    FsaVecTopology(pruned_fsas)
+        .GetScores<float>(false, &pruned_forward_scores, nullptr, &arc_post);
+    Array1<float> tot_scores =
+                      GetTotScores(out_fsas, forward_scores).To(cpu),
+                  pruned_tot_scores =
+                      GetTotScores(pruned_fsas, pruned_forward_scores)
+                          .To(cpu);
+    for (int32_t n = 0; n < num_b_fsas; ++n) {
+      if (tot_scores[n] == -std::numeric_limits<float>::infinity())
+        EXPECT_EQ(pruned_tot_scores[n], tot_scores[n]);
+      else
+        EXPECT_NEAR(pruned_tot_scores[n], tot_scores[n], 1.0e-03);
+    }
+    arc_post = arc_post.To(cpu);
+    for (int32_t j = 0; j < arc_post.Dim(); ++j)
+      EXPECT_GE(arc_post[j], -lattice_beam - 1.0e-03);
+  }
+}
+
+TEST(IntersectPruned, EnteringArcs) {
+  for (int32_t i = 0; i < 10; i++) {
+    int32_t max_symbol = 10, min_num_arcs = 0, max_num_arcs = 200;
+    bool acyclic = false;
+    ContextPtr c = (i % 2 == 0 ? GetCpuContext() : GetCudaContext()),
+               cpu = GetCpuContext();
+
+    int32_t num_b_fsas = RandInt(1, 5),
+            num_a_fsas = (RandInt(0, 1) ? 1 : num_b_fsas);
+
+    Fsa fsavec = RandomFsaVec(num_a_fsas, num_a_fsas, acyclic, max_symbol,
+                              min_num_arcs, max_num_arcs)
+                     .To(c);
+    ArcSort(&fsavec);
+
+    int32_t min_frames = 0, max_frames = 50, min_nsymbols = max_symbol + 1,
+            max_nsymbols = max_symbol + 4;
+    float scores_scale = 1.0;
+    DenseFsaVec dfsavec =
+        RandomDenseFsaVec(num_b_fsas, num_b_fsas, min_frames, max_frames,
+                          min_nsymbols, max_nsymbols, scores_scale)
+            .To(c);
+
+    float search_beam = 20.0, output_beam = 8.0;
+    int32_t min_active = 0, max_active = 10;
+    FsaVec out_fsas;
+    Array1<int32_t> arc_map_a, arc_map_b, entering_arcs;
+    IntersectDensePruned(fsavec, dfsavec, search_beam, output_beam, min_active,
+                         max_active, &out_fsas, &arc_map_a, &arc_map_b, false,
+                         0, &entering_arcs);
+    ASSERT_EQ(entering_arcs.Dim(), out_fsas.TotSize(1));
+
+    // The best paths found with `entering_arcs` have the same scores as
+    // those found with the entering arcs from GetForwardScores() (the arcs
+    // may differ if there are ties).
+    Array1<float> forward_scores;
+    Array1<int32_t> expected_entering_arcs;
+    FsaVecTopology(out_fsas).GetScores<float>(false, &forward_scores, nullptr,
+                                              nullptr, &expected_entering_arcs);
+    Ragged<int32_t> best_paths = ShortestPath(out_fsas, entering_arcs).To(cpu),
+                    expected_best_paths =
+                        ShortestPath(out_fsas, expected_entering_arcs)
+                            .To(cpu);
+    Array1<Arc> arcs = out_fsas.values.To(cpu);
+    ASSERT_EQ(best_paths.Dim0(), num_b_fsas);
+    ASSERT_TRUE(Equal(best_paths.RowSplits(1),
+                      expected_best_paths.RowSplits(1)));
+    const int32_t *row_splits1_data = best_paths.RowSplits(1).Data();
+    for (int32_t n = 0; n < num_b_fsas; ++n) {
+      float score = 0, expected_score = 0;
+      for (int32_t j = row_splits1_data[n]; j < row_splits1_data[n + 1];
+           ++j) {
+        score += arcs[best_paths.values[j]].score;
+        expected_score += arcs[expected_best_paths.values[j]].score;
+      }
+      EXPECT_NEAR(score, expected_score, 1.0e-03);
+    }
+  }
+}
+
+TEST(IntersectPruned, OneBest) {
+  for (int32_t i = 0; i < 10; i++) {
+    int32_t max_symbol = 10, min_num_arcs = 0, max_num_arcs = 200;
+    bool acyclic = false;
+    ContextPtr c = (i % 2 == 0 ? GetCpuContext() : GetCudaContext()),
+               cpu = GetCpuContext();
+
+    int32_t num_b_fsas = RandInt(1, 5),
+            num_a_fsas = (RandInt(0, 1) ? 1 : num_b_fsas);
+
+    Fsa fsavec = RandomFsaVec(num_a_fsas, num_a_fsas, acyclic, max_symbol,
+                              min_num_arcs, max_num_arcs)
+                     .To(c);
+    ArcSort(&fsavec);
+
+    int32_t min_frames = 0, max_frames = 50, min_nsymbols = max_symbol + 1,
+            max_nsymbols = max_symbol + 4;
+    float scores_scale = 1.0;
+    DenseFsaVec dfsavec =
+        RandomDenseFsaVec(num_b_fsas, num_b_fsas, min_frames, max_frames,
+                          min_nsymbols, max_nsymbols, scores_scale)
+            .To(c);
+
+    float search_beam = 20.0;
+    int32_t min_active = 0, max_active = 10;
+    FsaVec best_paths;
+    Array1<int32_t> arc_map_a, arc_map_b;
+    IntersectDensePrunedOneBest(fsavec, dfsavec, search_beam, min_active,
+                                max_active, &best_paths, &arc_map_a,
+                                &arc_map_b);
+    ASSERT_EQ(best_paths.Dim0(), num_b_fsas);
+    ASSERT_EQ(arc_map_a.Dim(), best_paths.NumElements());
+    ASSERT_EQ(arc_map_b.Dim(), best_paths.NumElements());
+
+    // The best paths have the same scores as those found by ShortestPath()
+    // on the lattice (the arcs may differ if there are ties).
+    FsaVec lattice;
+    Array1<int32_t> lattice_arc_map_a, lattice_arc_map_b;
+    IntersectDensePruned(fsavec, dfsavec, search_beam, search_beam,
+                         min_active, max_active, &lattice, &lattice_arc_map_a,
+                         &lattice_arc_map_b);
+    Array1<float> forward_scores;
+    Array1<int32_t> entering_arcs;
+    FsaVecTopology(lattice).GetScores<float>(false, &forward_scores, nullptr,
+                                             nullptr, &entering_arcs);
+    Ragged<int32_t> expected_best_paths =
+        ShortestPath(lattice, entering_arcs).To(cpu);
+    Array1<Arc> lattice_arcs = lattice.values.To(cpu);
+    best_paths = best_paths.To(cpu);
+    const int32_t *row_splits1_data = best_paths.RowSplits(1).Data(),
+                  *row_splits2_data = best_paths.RowSplits(2).Data(),
+                  *expected_row_splits1_data =
+                      expected_best_paths.RowSplits(1).Data();
+    for (int32_t n = 0; n < num_b_fsas; ++n) {
+      float score = 0, expected_score = 0;
+      int32_t begin = row_splits2_data[row_splits1_data[n]],
+              end = row_splits2_data[row_splits1_data[n + 1]];
+      for (int32_t j = begin; j < end; ++j)
+        score += best_paths.values[j].score;
+      for (int32_t j = expected_row_splits1_data[n];
+           j < expected_row_splits1_data[n + 1]; ++j)
+        expected_score += lattice_arcs[expected_best_paths.values[j]].score;
+      EXPECT_EQ(end - begin, expected_row_splits1_data[n + 1] -
+                                 expected_row_splits1_data[n]);
+      EXPECT_NEAR(score, expected_score, 1.0e-03);
+    }
+  }
+}
+
+TEST(IntersectPruned, Sparse) {
+  for (int32_t i = 0; i < 8; i++) {
+    int32_t max_symbol = 10, min_num_arcs = 0, max_num_arcs = 200;
+    bool acyclic = false;
+    ContextPtr c = (i % 2 == 0 ? GetCpuContext() : GetCudaContext());
+
+    int32_t num_b_fsas = RandInt(1, 5),
+            num_a_fsas = (RandInt(0, 1) ? 1 : num_b_fsas);
+
+    Fsa fsavec = RandomFsaVec(num_a_fsas, num_a_fsas, acyclic, max_symbol,
+                              min_num_arcs, max_num_arcs)
+                     .To(c);
+    ArcSort(&fsavec);
+
+    int32_t min_frames = 0, max_frames = 50, min_nsymbols = max_symbol + 1,
+            max_nsymbols = max_symbol + 4;
+    float scores_scale = 1.0;
+    DenseFsaVec dfsavec =
+        RandomDenseFsaVec(num_b_fsas, num_b_fsas, min_frames, max_frames,
+                          min_nsymbols, max_nsymbols, scores_scale)
+            .To(c);
+
+    int32_t k = RandInt(1, 4);
+    float floor = (i < 4 ? -std::numeric_limits<float>::infinity() : -4.0);
+    DenseFsaVec sparse = SparsifyDenseFsaVec(dfsavec, k, floor),
+                dense = ToDenseForm(sparse);
+
+    float search_beam = 20.0, output_beam = 8.0;
+    int32_t min_active = 0, max_active = 10;
+    FsaVec out_fsas, out_fsas_sparse;
+    Array1<int32_t> arc_map_a, arc_map_b, arc_map_a_sparse, arc_map_b_sparse;
+    IntersectDensePruned(fsavec, dense, search_beam, output_beam, min_active,
+                         max_active, &out_fsas, &arc_map_a, &arc_map_b);
+    IntersectDensePruned(fsavec, sparse, search_beam, output_beam, min_active,
+                         max_active, &out_fsas_sparse, &arc_map_a_sparse,
+                         &arc_map_b_sparse);
+    EXPECT_TRUE(Equal(out_fsas, out_fsas_sparse));
+    EXPECT_TRUE(Equal(arc_map_a, arc_map_a_sparse));
+    EXPECT_TRUE(Equal(arc_map_b, arc_map_b_sparse));
+  }
+}
+
+TEST(IntersectPruned, Half) {
+  for (int32_t i = 0; i < 4; i++) {
+    int32_t max_symbol = 10, min_num_arcs = 0, max_num_arcs = 200;
+    bool acyclic = false;
+    ContextPtr c = (i % 2 == 0 ? GetCpuContext() : GetCudaContext());
+
+    int32_t num_fsas = RandInt(1, 5);
+    Fsa fsavec = RandomFsaVec(num_fsas, num_fsas, acyclic, max_symbol,
+                              min_num_arcs, max_num_arcs)
+                     .To(c);
+    ArcSort(&fsavec);
+
+    int32_t min_frames = 0, max_frames = 50, min_nsymbols = max_symbol + 1,
+            max_nsymbols = max_symbol + 4;
+    float scores_scale = 1.0;
+    DenseFsaVec dfsavec =
+        RandomDenseFsaVec(num_fsas, num_fsas, min_frames, max_frames,
+                          min_nsymbols, max_nsymbols, scores_scale)
+            .To(c);
+    bool bf16 = (i >= 2);
+    DenseFsaVec half = ToHalfForm(dfsavec, bf16), dense = ToDenseForm(half);
+
+    float search_beam = 20.0, output_beam = 8.0;
+    int32_t min_active = 0, max_active = 10;
+    FsaVec out_fsas, out_fsas_half;
+    Array1<int32_t> arc_map_a, arc_map_b, arc_map_a_half, arc_map_b_half;
+    IntersectDensePruned(fsavec, dense, search_beam, output_beam, min_active,
+                         max_active, &out_fsas, &arc_map_a, &arc_map_b);
+    IntersectDensePruned(fsavec, half, search_beam, output_beam, min_active,
+                         max_active, &out_fsas_half, &arc_map_a_half,
+                         &arc_map_b_half);
+    EXPECT_TRUE(Equal(out_fsas, out_fsas_half));
+    EXPECT_TRUE(Equal(arc_map_a, arc_map_a_half));
+    EXPECT_TRUE(Equal(arc_map_b, arc_map_b_half));
+  }
+}
+
+TEST(IntersectPruned, Padded) {
+  for (int32_t i = 0; i < 4; i++) {
+    int32_t max_symbol = 10, min_num_arcs = 0, max_num_arcs = 200;
+    bool acyclic = false;
+    ContextPtr c = (i % 2 == 0 ? GetCpuContext() : GetCudaContext());
+
+    int32_t num_fsas = RandInt(1, 5);
+    Fsa fsavec = RandomFsaVec(num_fsas, num_fsas, acyclic, max_symbol,
+                              min_num_arcs, max_num_arcs)
+                     .To(c);
+    ArcSort(&fsavec);
+
+    int32_t min_frames = 0, max_frames = 50, min_nsymbols = max_symbol + 1,
+            max_nsymbols = max_symbol + 4;
+    float scores_scale = 1.0;
+    DenseFsaVec dense =
+        RandomDenseFsaVec(num_fsas, num_fsas, min_frames, max_frames,
+                          min_nsymbols, max_nsymbols, scores_scale);
+    // The padded form has a score of 0 for the final-transition.
+    const int32_t *row_splits1_data = dense.shape.RowSplits(1).Data();
+    auto scores_acc = dense.scores.Accessor();
+    for (int32_t j = 1; j <= num_fsas; j++)
+      scores_acc(row_splits1_data[j] - 1, 0) = 0;
+    dense = dense.To(c);
+    // A view of the nnet output within dense.scores, i.e. without column 0.
+    // Its last row for each FSA is ignored.
+    Array1<int32_t> offsets = dense.shape.RowSplits(1).Arange(0, num_fsas);
+    DenseFsaVec padded(dense.shape,
+                       dense.scores.ColArange(1, dense.scores.Dim1()),
+                       offsets);
+    EXPECT_EQ(padded.NumCols(), dense.NumCols());
+    EXPECT_TRUE(Equal(ToDenseForm(padded).scores, dense.scores));
+
+    float search_beam = 20.0, output_beam = 8.0;
+    int32_t min_active = 0, max_active = 10;
+    FsaVec out_fsas, out_fsas_padded;
+    Array1<int32_t> arc_map_a, arc_map_b, arc_map_a_padded, arc_map_b_padded;
+    IntersectDensePruned(fsavec, dense, search_beam, output_beam, min_active,
+                         max_active, &out_fsas, &arc_map_a, &arc_map_b);
+    IntersectDensePruned(fsavec, padded, search_beam, output_beam, min_active,
+                         max_active, &out_fsas_padded, &arc_map_a_padded,
+                         &arc_map_b_padded);
+    EXPECT_TRUE(Equal(out_fsas, out_fsas_padded));
+    EXPECT_TRUE(Equal(arc_map_a, arc_map_a_padded));
+    EXPECT_TRUE(Equal(arc_map_b, arc_map_b_padded));
+
+    // Reordering the sequences keeps the view.
+    Array1<int32_t> indexes(c, std::vector<int32_t>(1, num_fsas - 1));
+    EXPECT_TRUE(Equal(ToDenseForm(padded[indexes]).scores,
+                      dense[indexes].scores));
+  }
+}
+
+TEST(IntersectPruned, FinishedSequences) {
+  for (int32_t i = 0; i < 4; i++) {
+    int32_t max_symbol = 10, min_num_arcs = 0, max_num_arcs = 200;
+    bool acyclic = false;
+    ContextPtr c = (i % 2 == 0 ? GetCpuContext() : GetCudaContext());
+
+    Fsa fsa = RandomFsaVec(1, 1, acyclic, max_symbol, min_num_arcs,
+                           max_num_arcs)
+                  .To(c);
+    ArcSort(&fsa);
+
+    int32_t num_fsas = RandInt(2, 6), min_frames = 0, max_frames = 50,
+            min_nsymbols = max_symbol + 1, max_nsymbols = max_symbol + 4;
+    float scores_scale = 1.0;
+    DenseFsaVec dense =
+        RandomDenseFsaVec(num_fsas, num_fsas, min_frames, max_frames,
+                          min_nsymbols, max_nsymbols, scores_scale);
+    // Sort from longest to shortest, so that the finished sequences are
+    // left out of the later frames; in the reversed batch the longest
+    // sequence is the last one, so none of them is.
+    const int32_t *row_splits1_data = dense.shape.RowSplits(1).Data();
+    std::vector<std::pair<int32_t, int32_t>> lengths;  // (-length, n)
+    for (int32_t n = 0; n < num_fsas; n++)
+      lengths.push_back({row_splits1_data[n] - row_splits1_data[n + 1], n});
+    std::sort(lengths.begin(), lengths.end());
+    std::vector<int32_t> sorted(num_fsas), reversed(num_fsas);
+    for (int32_t n = 0; n < num_fsas; n++) {
+      sorted[n] = lengths[n].second;
+      reversed[n] = num_fsas - 1 - n;
+    }
+    dense = dense.To(c);
+    DenseFsaVec dense_sorted = dense[Array1<int32_t>(c, sorted)];
+    Array1<int32_t> reversed_indexes(c, reversed);
+    DenseFsaVec dense_reversed = dense_sorted[reversed_indexes];
+
+    float search_beam = 20.0, output_beam = 8.0;
+    int32_t min_active = 0, max_active = 10;
+    FsaVec out_fsas, out_fsas_reversed;
+    Array1<int32_t> arc_map_a, arc_map_b, arc_map_a_reversed,
+        arc_map_b_reversed;
+    IntersectDensePruned(fsa, dense_sorted, search_beam, output_beam,
+                         min_active, max_active, &out_fsas, &arc_map_a,
+                         &arc_map_b);
+    IntersectDensePruned(fsa, dense_reversed, search_beam, output_beam,
+                         min_active, max_active, &out_fsas_reversed,
+                         &arc_map_a_reversed, &arc_map_b_reversed);
+    Array1<int32_t> value_indexes;
+    FsaVec out_fsas_unreversed =
+        Index(out_fsas_reversed, 0, reversed_indexes, &value_indexes);
+    EXPECT_TRUE(Equal(out_fsas, out_fsas_unreversed));
+    EXPECT_TRUE(Equal(arc_map_a, arc_map_a_reversed[value_indexes]));
+  }
+}
+
+TEST(IntersectPruned, MaxActiveArcs) {
+  for (int32_t i = 0; i < 4; i++) {
+    int32_t max_symbol = 10, min_num_arcs = 0, max_num_arcs = 200;
+    bool acyclic = false;
+    ContextPtr c = (i % 2 == 0 ? GetCpuContext() : GetCudaContext());
+
+    int32_t num_fsas = RandInt(1, 5);
+    Fsa fsa = RandomFsaVec(1, 1, acyclic, max_symbol, min_num_arcs,
+                           max_num_arcs)
+                  .To(c);
+    ArcSort(&fsa);
+
+    int32_t min_frames = 0, max_frames = 50, min_nsymbols = max_symbol + 1,
+            max_nsymbols = max_symbol + 4;
+    float scores_scale = 1.0;
+    DenseFsaVec dfsavec =
+        RandomDenseFsaVec(num_fsas, num_fsas, min_frames, max_frames,
+                          min_nsymbols, max_nsymbols, scores_scale)
+            .To(c);
+
+    float search_beam = 20.0, output_beam = 8.0;
+    int32_t min_active = 0, max_active = 10;
+    bool use_arena = false;
+    float lattice_beam = 0;
+    FsaVec out_fsas, out_fsas_limited;
+    Array1<int32_t> arc_map_a, arc_map_b, arc_map_a_limited,
+        arc_map_b_limited;
+    IntersectDensePruned(fsa, dfsavec, search_beam, output_beam, min_active,
+                         max_active, &out_fsas, &arc_map_a, &arc_map_b);
+
+    // A target that is never reached changes nothing.
+    IntersectDensePruned(fsa, dfsavec, search_beam, output_beam, min_active,
+                         max_active, &out_fsas_limited, &arc_map_a_limited,
+                         &arc_map_b_limited, use_arena, lattice_beam,
+                         nullptr, 1 << 30);
+    EXPECT_TRUE(Equal(out_fsas, out_fsas_limited));
+    EXPECT_TRUE(Equal(arc_map_a, arc_map_a_limited));
+    EXPECT_TRUE(Equal(arc_map_b, arc_map_b_limited));
+
+    // A small one narrows the beams of all the sequences.
+    IntersectDensePruned(fsa, dfsavec, search_beam, output_beam, min_active,
+                         max_active, &out_fsas_limited, &arc_map_a_limited,
+                         &arc_map_b_limited, use_arena, lattice_beam,
+                         nullptr, 1);
+    EXPECT_EQ(out_fsas_limited.Dim0(), num_fsas);
+    EXPECT_LE(out_fsas_limited.NumElements(), out_fsas.NumElements());
+    EXPECT_EQ(arc_map_a_limited.Dim(), out_fsas_limited.NumElements());
+  }
+}
+
+TEST(IntersectPruned, Stats) {
+  for (int32_t i = 0; i < 4; i++) {
+    int32_t max_symbol = 10, min_num_arcs = 0, max_num_arcs = 200;
+    bool acyclic = false;
+    ContextPtr c = (i % 2 == 0 ? GetCpuContext() : GetCudaContext()),
+               cpu = GetCpuContext();
+
+    int32_t num_fsas = RandInt(1, 5);
+    Fsa fsa = RandomFsaVec(1, 1, acyclic, max_symbol, min_num_arcs,
+                           max_num_arcs)
+                  .To(c);
+    ArcSort(&fsa);
+
+    int32_t min_frames = 0, max_frames = 50, min_nsymbols = max_symbol + 1,
+            max_nsymbols = max_symbol + 4;
+    float scores_scale = 1.0;
+    DenseFsaVec dfsavec =
+        RandomDenseFsaVec(num_fsas, num_fsas, min_frames, max_frames,
+                          min_nsymbols, max_nsymbols, scores_scale)
+            .To(c);
+
+    float search_beam = 20.0, output_beam = 8.0;
+    int32_t min_active = 0, max_active = 10;
+    FsaVec out_fsas, out_fsas_ref;
+    Array1<int32_t> arc_map_a, arc_map_b, arc_map_a_ref, arc_map_b_ref;
+    bool use_arena = false;
+    float lattice_beam = 0;
+    int32_t max_active_arcs = 0;
+    IntersectDensePrunedStats stats;
+    IntersectDensePruned(fsa, dfsavec, search_beam, output_beam, min_active,
+                         max_active, &out_fsas, &arc_map_a, &arc_map_b,
+                         use_arena, lattice_beam, nullptr, max_active_arcs,
+                         &stats);
+    // Collecting the statistics does not change the output.
+    IntersectDensePruned(fsa, dfsavec, search_beam, output_beam, min_active,
+                         max_active, &out_fsas_ref, &arc_map_a_ref,
+                         &arc_map_b_ref);
+    EXPECT_TRUE(Equal(out_fsas, out_fsas_ref));
+
+    int32_t T = dfsavec.shape.MaxSize(1);
+    Array2<int32_t> num_states = stats.num_states.To(cpu),
+                    num_arcs = stats.num_arcs.To(cpu),
+                    num_output_arcs = stats.num_output_arcs.To(cpu);
+    Array2<float> beams = stats.beams.To(cpu);
+    ASSERT_EQ(num_states.Dim0(), T + 1);
+    ASSERT_EQ(num_states.Dim1(), num_fsas);
+    auto num_states_acc = num_states.Accessor(),
+         num_arcs_acc = num_arcs.Accessor(),
+         num_output_arcs_acc = num_output_arcs.Accessor();
+    auto beams_acc = beams.Accessor();
+    Array1<int32_t> row_splits1 = dfsavec.shape.RowSplits(1).To(cpu),
+                    out_row_splits12 =
+                        out_fsas.RowSplits(2)[out_fsas.RowSplits(1)].To(cpu);
+    for (int32_t n = 0; n < num_fsas; n++) {
+      int32_t len = row_splits1[n + 1] - row_splits1[n], tot_output_arcs = 0;
+      EXPECT_EQ(num_states_acc(0, n), fsa.TotSize(1) > 0 ? 1 : 0);
+      for (int32_t t = 0; t <= T; t++) {
+        EXPECT_LE(num_output_arcs_acc(t, n), num_arcs_acc(t, n));
+        if (t >= len) {
+          // Only final states, which have no arcs, are on frame len.
+          EXPECT_EQ(num_arcs_acc(t, n), 0);
+          if (t > len) {
+            EXPECT_EQ(num_states_acc(t, n), 0);
+          }
+        } else if (num_states_acc(t, n) > 0) {
+          EXPECT_GT(beams_acc(t, n), 0);
+        }
+        tot_output_arcs += num_output_arcs_acc(t, n);
+      }
+      EXPECT_EQ(tot_output_arcs, out_row_splits12[n + 1] - out_row_splits12[n]);
+    }
+  }
+}
+
+TEST(IntersectPruned, OnlineBlankSkipping) {
+  // Decoding with blank-frame skipping should give the same lattice as
+  // decoding, without skipping, the input with the skipped frames removed.
+  for (int32_t i = 0; i < 4; i++) {
+    ContextPtr c = (i % 2 == 0 ? GetCpuContext() : GetCudaContext());
+    int32_t max_token = 5;
+    Array1<int32_t> aux_labels;
+    FsaVec graph = FsaToFsaVec(CtcTopo(c, max_token, false, &aux_labels));
+
+    int32_t num_seqs = RandInt(1, 5), min_frames = 0, max_frames = 30,
+            num_symbols = max_token + 1;
+    float scores_scale = 1.0;
+    DenseFsaVec dfsavec =
+        RandomDenseFsaVec(num_seqs, num_seqs, min_frames, max_frames,
+                          num_symbols, num_symbols, scores_scale);
+    // Make about half of the frames high-confidence blank frames, and work
+    // out which frames should be kept.
+    const int32_t *row_splits1_data = dfsavec.shape.RowSplits(1).Data();
+    auto scores_acc = dfsavec.scores.Accessor();
+    std::vector<int32_t> kept_rows, kept_row_splits(1, 0);
+    std::vector<std::vector<int32_t>> frame_times(num_seqs);
+    for (int32_t s = 0; s < num_seqs; s++) {
+      bool prev_blank = false;
+      int32_t begin = row_splits1_data[s], end = row_splits1_data[s + 1];
+      for (int32_t row = begin; row + 1 < end; row++) {
+        bool blank = (RandInt(0, 1) == 1);
+        scores_acc(row, 1) = (blank ? 0.0 : -1.0);
+        if (!(blank && prev_blank)) {
+          kept_rows.push_back(row);
+          frame_times[s].push_back(row - begin);
+        }
+        prev_blank = blank;
+      }
+      kept_rows.push_back(end - 1);
+      kept_row_splits.push_back(static_cast<int32_t>(kept_rows.size()));
+    }
+    Array1<int32_t> kept_rows_array(GetCpuContext(), kept_rows),
+        kept_row_splits_array(GetCpuContext(), kept_row_splits);
+    DenseFsaVec ref(RaggedShape2(&kept_row_splits_array, nullptr, -1),
+                    IndexRows(dfsavec.scores, kept_rows_array, false));
+    DenseFsaVec b_fsas = dfsavec.To(c), ref_b_fsas = ref.To(c);
+
+    float search_beam = 20.0, output_beam = 8.0, blank_threshold = 0.9;
+    int32_t min_active = 0, max_active = 10;
+    bool use_arena = false;
+    OnlineDenseIntersecter skipping(graph, num_seqs, search_beam, output_beam,
+                                    min_active, max_active, use_arena,
+                                    blank_threshold),
+        plain(graph, num_seqs, search_beam, output_beam, min_active,
+              max_active);
+    std::vector<std::shared_ptr<DecodeStateInfo>> states(num_seqs),
+        ref_states(num_seqs);
+    FsaVec out, ref_out;
+    Array1<int32_t> arc_map_a, ref_arc_map_a;
+    skipping.Decode(b_fsas, &states, &out, &arc_map_a);
+    plain.Decode(ref_b_fsas, &ref_states, &ref_out, &ref_arc_map_a);
+    EXPECT_TRUE(Equal(out, ref_out));
+    EXPECT_TRUE(Equal(arc_map_a, ref_arc_map_a));
+    for (int32_t s = 0; s < num_seqs; s++) {
+      EXPECT_EQ(states[s]->frame_times, frame_times[s]);
+      EXPECT_EQ(states[s]->num_input_frames,
+                row_splits1_data[s + 1] - row_splits1_data[s] - 1);
+      EXPECT_TRUE(ref_states[s]->frame_times.empty());
+    }
+  }
+}
+
+TEST(IntersectPruned, OnlineStreamPool) {
+  // Decoding with the states kept in the pool of the intersecter should give
+  // the same lattices as passing the states in and out.
+  for (int32_t i = 0; i < 4; i++) {
+    ContextPtr c = (i % 2 == 0 ? GetCpuContext() : GetCudaContext());
+    int32_t max_token = 5;
+    Array1<int32_t> aux_labels;
+    FsaVec graph = FsaToFsaVec(CtcTopo(c, max_token, false, &aux_labels));
+
+    float search_beam = 20.0, output_beam = 8.0;
+    int32_t num_seqs = 2, min_active = 0, max_active = 10;
+    OnlineDenseIntersecter pooled(graph, num_seqs, search_beam, output_beam,
+                                  min_active, max_active),
+        plain(graph, num_seqs, search_beam, output_beam, min_active,
+              max_active);
+
+    // The streams of each chunk; the same streams in a row are decoded from
+    // the resident frames, unless the chunk before had unequal lengths.
+    std::vector<std::vector<int32_t>> chunk_streams = {
+        {0, 1}, {0, 1}, {0, 1}, {1, 2}, {1, 2}, {0, 2}, {0, 2}};
+    std::vector<std::shared_ptr<DecodeStateInfo>> states(3);
+    for (size_t n = 0; n < chunk_streams.size(); n++) {
+      const std::vector<int32_t> &ids = chunk_streams[n];
+      int32_t min_frames = (n == 1 ? 2 : 6), max_frames = 6;
+      DenseFsaVec b_fsas =
+          RandomDenseFsaVec(num_seqs, num_seqs, min_frames, max_frames,
+                            max_token + 1, max_token + 1, 1.0)
+              .To(c);
+
+      FsaVec out, ref_out;
+      Array1<int32_t> arc_map_a, ref_arc_map_a;
+      pooled.DecodeStreams(b_fsas, ids, &out, &arc_map_a);
+      std::vector<std::shared_ptr<DecodeStateInfo>> ref_states = {
+          states[ids[0]], states[ids[1]]};
+      plain.Decode(b_fsas, &ref_states, &ref_out, &ref_arc_map_a);
+      states[ids[0]] = ref_states[0];
+      states[ids[1]] = ref_states[1];
+      EXPECT_TRUE(Equal(out, ref_out));
+      EXPECT_TRUE(Equal(arc_map_a, ref_arc_map_a));
+    }
+    for (int32_t s = 0; s < 3; s++) {
+      std::shared_ptr<DecodeStateInfo> state = pooled.ReleaseStream(s);
+      ASSERT_NE(state, nullptr);
+      EXPECT_EQ(state->beam, states[s]->beam);
+      // They may differ in the number of empty frames.
+      EXPECT_TRUE(Equal(RemoveEmptyLists(state->states.shape, 0),
+                        RemoveEmptyLists(states[s]->states.shape, 0)));
+      EXPECT_TRUE(Equal(RemoveEmptyLists(state->arcs.shape, 0),
+                        RemoveEmptyLists(states[s]->arcs.shape, 0)));
+      EXPECT_EQ(pooled.ReleaseStream(s), nullptr);
+    }
+  }
+}
+
+TEST(IntersectPruned, OnlineTruncation) {
+  // With peaky likelihoods the sequences often have only one active state,
+  // so most of the history is output in the prefixes; the prefixes followed
+  // by the last partial lattice should have the same best path as the
+  // lattice decoded without truncation.
+  for (int32_t i = 0; i < 4; i++) {
+    ContextPtr c = (i % 2 == 0 ? GetCpuContext() : GetCudaContext());
+    int32_t max_token = 5;
+    Array1<int32_t> aux_labels;
+    FsaVec graph = FsaToFsaVec(CtcTopo(c, max_token, false, &aux_labels));
+
+    float search_beam = 6.0, output_beam = 2.0;
+    int32_t num_seqs = 3, min_active = 0, max_active = 10;
+    OnlineDenseIntersecter truncated(graph, num_seqs, search_beam,
+                                     output_beam, min_active, max_active),
+        ref(graph, num_seqs, search_beam, output_beam, min_active,
+            max_active);
+    std::vector<std::shared_ptr<DecodeStateInfo>> states(num_seqs),
+        ref_states(num_seqs);
+    std::vector<double> prefix_scores(num_seqs, 0.0);
+    bool truncated_any = false;
+    for (int32_t n = 0; n < 8; n++) {
+      DenseFsaVec b_fsas = RandomDenseFsaVec(num_seqs, num_seqs, 10, 10,
+                                             max_token + 1, max_token + 1,
+                                             20.0)
+                               .To(c);
+      FsaVec out, ref_out, prefix;
+      Array1<int32_t> arc_map_a, ref_arc_map_a, prefix_arc_map_a;
+      truncated.Decode(b_fsas, &states, &out, &arc_map_a, &prefix,
+                       &prefix_arc_map_a);
+      ref.Decode(b_fsas, &ref_states, &ref_out, &ref_arc_map_a);
+      ASSERT_EQ(prefix.Dim0(), num_seqs);
+      EXPECT_EQ(prefix_arc_map_a.Dim(), prefix.NumElements());
+      EXPECT_EQ(arc_map_a.Dim(), out.NumElements());
+
+      Array1<double> scores = BestPathScores(out),
+                     ref_scores = BestPathScores(ref_out),
+                     this_prefix_scores = BestPathScores(prefix);
+      for (int32_t s = 0; s < num_seqs; s++) {
+        if (this_prefix_scores[s] != -std::numeric_limits<double>::infinity()) {
+          prefix_scores[s] += this_prefix_scores[s];
+          truncated_any = true;
+        }
+        EXPECT_NEAR(prefix_scores[s] + scores[s], ref_scores[s], 1.0e-02);
+        EXPECT_LE(states[s]->states.Dim0(), ref_states[s]->states.Dim0());
+      }
+    }
+    EXPECT_TRUE(truncated_any);
+  }
+}
+
+TEST(IntersectPruned, MultiDevice) {
+  // Splitting the batch over several devices should give the same result as
+  // intersecting it on one device.
+  for (int32_t i = 0; i < 8; i++) {
+    int32_t max_symbol = 10, min_num_arcs = 0, max_num_arcs = 200;
+    bool acyclic = false;
+    ContextPtr c = (i % 2 == 0 ? GetCpuContext() : GetCudaContext());
+    std::vector<ContextPtr> contexts = {GetCudaContext(), GetCpuContext(),
+                                        c};
+
+    int32_t num_b_fsas = RandInt(1, 8),
+            num_a_fsas = (i < 4 ? 1 : num_b_fsas);
+    FsaVec fsavec = RandomFsaVec(num_a_fsas, num_a_fsas, acyclic, max_symbol,
+                                 min_num_arcs, max_num_arcs)
+                        .To(c);
+    ArcSort(&fsavec);
+
+    int32_t min_frames = 0, max_frames = 50, min_nsymbols = max_symbol + 1,
+            max_nsymbols = max_symbol + 4;
+    float scores_scale = 1.0;
+    DenseFsaVec dfsavec =
+        RandomDenseFsaVec(num_b_fsas, num_b_fsas, min_frames, max_frames,
+                          min_nsymbols, max_nsymbols, scores_scale)
+            .To(c);
+
+    float search_beam = 20.0, output_beam = 8.0;
+    int32_t min_active = 0, max_active = 10;
+    FsaVec out, ref_out;
+    Array1<int32_t> arc_map_a, arc_map_b, ref_arc_map_a, ref_arc_map_b;
+    IntersectDensePruned(fsavec, dfsavec, search_beam, output_beam,
+                         min_active, max_active, &ref_out, &ref_arc_map_a,
+                         &ref_arc_map_b);
+    MultiDeviceDenseIntersecter intersecter(fsavec, contexts);
+    intersecter.Intersect(dfsavec, search_beam, output_beam, min_active,
+                          max_active, &out, &arc_map_a, &arc_map_b);
+    EXPECT_TRUE(Equal(out, ref_out));
+    EXPECT_TRUE(Equal(arc_map_a, ref_arc_map_a));
+    EXPECT_TRUE(Equal(arc_map_b, ref_arc_map_b));
+  }
+}
+
+TEST(IntersectPruned, Paged) {
+  // Reading the arcs of the graph from pinned host memory should give the
+  // same result as having the whole graph on the device.
+  for (int32_t i = 0; i < 4; i++) {
+    int32_t max_symbol = 10, min_num_arcs = 0, max_num_arcs = 200;
+    bool acyclic = false;
+    ContextPtr c = (i % 2 == 0 ? GetCpuContext() : GetCudaContext());
+
+    int32_t num_b_fsas = RandInt(1, 8),
+            num_a_fsas = (i < 2 ? 1 : num_b_fsas);
+    FsaVec fsavec = RandomFsaVec(num_a_fsas, num_a_fsas, acyclic, max_symbol,
+                                 min_num_arcs, max_num_arcs);
+    ArcSort(&fsavec);
+
+    int32_t min_frames = 0, max_frames = 50, min_nsymbols = max_symbol + 1,
+            max_nsymbols = max_symbol + 4;
+    float scores_scale = 1.0;
+    DenseFsaVec dfsavec =
+        RandomDenseFsaVec(num_b_fsas, num_b_fsas, min_frames, max_frames,
+                          min_nsymbols, max_nsymbols, scores_scale)
+            .To(c);
+
+    float search_beam = 20.0, output_beam = 8.0;
+    int32_t min_active = 0, max_active = 10;
+    FsaVec out, ref_out, a_fsas = fsavec.To(c);
+    Array1<int32_t> arc_map_a, arc_map_b, ref_arc_map_a, ref_arc_map_b;
+    IntersectDensePruned(a_fsas, dfsavec, search_beam, output_beam,
+                         min_active, max_active, &ref_out, &ref_arc_map_a,
+                         &ref_arc_map_b);
+    // `fsavec` is on the CPU.
+    PagedDenseIntersecter intersecter(fsavec, c);
+    intersecter.Intersect(dfsavec, search_beam, output_beam, min_active,
+                          max_active, &out, &arc_map_a, &arc_map_b);
+    EXPECT_TRUE(Equal(out, ref_out));
+    EXPECT_TRUE(Equal(arc_map_a, ref_arc_map_a));
+    EXPECT_TRUE(Equal(arc_map_b, ref_arc_map_b));
+  }
+}
+
+TEST(IntersectPruned, ImplicitTopo) {
+  // Decoding with an implicit graph should give the same result as with the
+  // materialized one.
+  for (const ContextPtr &c : {GetCpuContext(), GetCudaContext()}) {
+    int32_t max_token = 6;
+    for (auto type : {ImplicitTopoType::kCtc, ImplicitTopoType::kModifiedCtc,
+                      ImplicitTopoType::kTrivial}) {
+      ImplicitTopo topo(type, max_token);
+      Array1<int32_t> aux_labels;
+      Fsa graph = (type == ImplicitTopoType::kTrivial
+                       ? TrivialGraph(c, max_token, &aux_labels)
+                       : CtcTopo(c, max_token,
+                                 type == ImplicitTopoType::kModifiedCtc,
+                                 &aux_labels));
+      FsaVec a_fsas = FsaToFsaVec(graph);
+      ASSERT_EQ(topo.NumArcs(), a_fsas.NumElements());
+      EXPECT_TRUE(Equal(topo.Shape(c), a_fsas.shape));
+      Array1<int32_t> all_arcs = Range(c, topo.NumArcs(), 0);
+      EXPECT_TRUE(Equal(ImplicitTopoAuxLabels(topo, all_arcs), aux_labels));
+
+      int32_t num_seqs = RandInt(1, 5), min_frames = 0, max_frames = 30,
+              num_symbols = max_token + 1;
+      float scores_scale = 1.0;
+      DenseFsaVec dfsavec =
+          RandomDenseFsaVec(num_seqs, num_seqs, min_frames, max_frames,
+                            num_symbols, num_symbols, scores_scale)
+              .To(c);
+      float search_beam = 20.0, output_beam = 8.0;
+      int32_t min_active = 0, max_active = 10;
+      FsaVec out, ref_out;
+      Array1<int32_t> arc_map_a, arc_map_b, ref_arc_map_a, ref_arc_map_b;
+      IntersectDensePruned(a_fsas, dfsavec, search_beam, output_beam,
+                           min_active, max_active, &ref_out, &ref_arc_map_a,
+                           &ref_arc_map_b);
+      IntersectDensePruned(topo, dfsavec, search_beam, output_beam,
+                           min_active, max_active, &out, &arc_map_a,
+                           &arc_map_b);
+      EXPECT_TRUE(Equal(out, ref_out));
+      EXPECT_TRUE(Equal(arc_map_a, ref_arc_map_a));
+      EXPECT_TRUE(Equal(arc_map_b, ref_arc_map_b));
+
+      IntersectDensePrunedOneBest(a_fsas, dfsavec, search_beam, min_active,
+                                  max_active, &ref_out, &ref_arc_map_a,
+                                  &ref_arc_map_b);
+      IntersectDensePrunedOneBest(topo, dfsavec, search_beam, min_active,
+                                  max_active, &out, &arc_map_a, &arc_map_b);
+      EXPECT_TRUE(Equal(out, ref_out));
+      EXPECT_TRUE(Equal(arc_map_a, ref_arc_map_a));
+    }
+  }
+}
+
+TEST(IntersectPruned, CompactFsaVec) {
+  // Decoding with a compact graph should give the same result as with the
+  // graph it represents.
+  for (const ContextPtr &c : {GetCpuContext(), GetCudaContext()}) {
+    int32_t max_token = 6;
+    Array1<int32_t> aux_labels;
+    FsaVec graph = FsaToFsaVec(CtcTopo(c, max_token, false, &aux_labels))
+                       .To(GetCpuContext());
+    Arc *arcs_data = graph.values.Data();
+    for (int32_t i = 0; i < graph.NumElements(); i++)
+      arcs_data[i].score = -0.1 * RandInt(0, 30);
+    arcs_data[0].score = -std::numeric_limits<float>::infinity();
+    graph = graph.To(c);
+
+    int32_t num_seqs = RandInt(1, 5), min_frames = 0, max_frames = 30,
+            num_symbols = max_token + 1;
+    DenseFsaVec dfsavec =
+        RandomDenseFsaVec(num_seqs, num_seqs, min_frames, max_frames,
+                          num_symbols, num_symbols, 1.0)
+            .To(c);
+    float search_beam = 20.0, output_beam = 8.0;
+    int32_t min_active = 0, max_active = 10;
+
+    for (bool quantize : {false, true}) {
+      CompactFsaVec compact(graph, quantize);
+      FsaVec expanded = compact.ToFsaVec();
+      if (!quantize) {
+        EXPECT_TRUE(Equal(expanded, graph));
+      } else {
+        FsaVec cpu_expanded = expanded.To(GetCpuContext()),
+               cpu_graph = graph.To(GetCpuContext());
+        for (int32_t i = 0; i < graph.NumElements(); i++) {
+          Arc arc = cpu_expanded.values[i], ref_arc = cpu_graph.values[i];
+          EXPECT_EQ(arc.src_state, ref_arc.src_state);
+          EXPECT_EQ(arc.dest_state, ref_arc.dest_state);
+          EXPECT_EQ(arc.label, ref_arc.label);
+          if (i == 0)
+            EXPECT_EQ(arc.score, ref_arc.score);
+          else
+            EXPECT_NEAR(arc.score, ref_arc.score, compact.score_step);
+        }
+      }
+
+      FsaVec out, ref_out;
+      Array1<int32_t> arc_map_a, arc_map_b, ref_arc_map_a, ref_arc_map_b;
+      IntersectDensePruned(expanded, dfsavec, search_beam, output_beam,
+                           min_active, max_active, &ref_out, &ref_arc_map_a,
+                           &ref_arc_map_b);
+      IntersectDensePruned(compact, dfsavec, search_beam, output_beam,
+                           min_active, max_active, &out, &arc_map_a,
+                           &arc_map_b);
+      EXPECT_TRUE(Equal(out, ref_out));
+      EXPECT_TRUE(Equal(arc_map_a, ref_arc_map_a));
+      EXPECT_TRUE(Equal(arc_map_b, ref_arc_map_b));
+
+      IntersectDensePrunedOneBest(expanded, dfsavec, search_beam, min_active,
+                                  max_active, &ref_out, &ref_arc_map_a,
+                                  &ref_arc_map_b);
+      IntersectDensePrunedOneBest(compact, dfsavec, search_beam, min_active,
+                                  max_active, &out, &arc_map_a, &arc_map_b);
+      EXPECT_TRUE(Equal(out, ref_out));
+      EXPECT_TRUE(Equal(arc_map_a, ref_arc_map_a));
+
+      OnlineDenseIntersecter online(compact, num_seqs, search_beam,
+                                    output_beam, min_active, max_active),
+          ref_online(expanded, num_seqs, search_beam, output_beam,
+                     min_active, max_active);
+      std::vector<std::shared_ptr<DecodeStateInfo>> states(num_seqs),
+          ref_states(num_seqs);
+      online.Decode(dfsavec, &states, &out, &arc_map_a);
+      ref_online.Decode(dfsavec, &ref_states, &ref_out, &ref_arc_map_a);
+      EXPECT_TRUE(Equal(out, ref_out));
+      EXPECT_TRUE(Equal(arc_map_a, ref_arc_map_a));
+    }
+  }
+}
+
 }  // namespace k2
@@ -0,0 +1,206 @@
+/**
+ * Copyright      2026  Xiaomi Corporation
+ *
+ * See LICENSE for clarification regarding multiple authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <cstdlib>
+#include <cstring>
+#include <mutex>  // NOLINT
+#include <unordered_map>
+
+#ifdef __linux__
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include "k2/csrc/context.h"
+#include "k2/csrc/log.h"
+#include "k2/csrc/nvtx.h"
+
+namespace k2 {
+
+namespace {
+
+static constexpr std::size_t kAlignment = 64;
+
+#ifdef __linux__
+// From <linux/mempolicy.h> and <linux/mman.h>; we call mbind() and
+// get_mempolicy() with syscall() so as not to depend on libnuma.
+static constexpr int kMpolBind = 2;
+static constexpr int kMpolInterleave = 3;
+static constexpr int kMpolFMemsAllowed = 1 << 2;
+static constexpr int kMapHugeShift = 26;
+static constexpr unsigned long kMaxNumaNodes = 1024;           // NOLINT
+static constexpr unsigned long kBitsPerWord = 8 * sizeof(long);  // NOLINT
+
+static std::size_t PageSize(HugePageType type) {
+  switch (type) {
+    case HugePageType::k2MB:
+    case HugePageType::kTransparent:
+      return std::size_t(1) << 21;
+    case HugePageType::k1GB:
+      return std::size_t(1) << 30;
+    default:
+      return static_cast<std::size_t>(sysconf(_SC_PAGESIZE));
+  }
+}
+
+/* Map `bytes` bytes of anonymous memory, rounded up to the page size of
+   `type`, with explicit huge pages if `type` is k2MB or k1GB; returns
+   nullptr if that fails.  Sets *mapped_bytes to the size of the mapping. */
+static void *MapPages(std::size_t bytes, HugePageType type,
+                      std::size_t *mapped_bytes) {
+  std::size_t page_size = PageSize(type);
+  *mapped_bytes = (bytes + page_size - 1) / page_size * page_size;
+  int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+  if (type == HugePageType::k2MB)
+    flags |= MAP_HUGETLB | (21 << kMapHugeShift);
+  else if (type == HugePageType::k1GB)
+    flags |= MAP_HUGETLB | (30 << kMapHugeShift);
+  void *p = mmap(nullptr, *mapped_bytes, PROT_READ | PROT_WRITE, flags, -1, 0);
+  return p == MAP_FAILED ? nullptr : p;
+}
+
+/* Set the NUMA policy of the pages of [p, p + bytes), which must not have
+   been touched yet.  Returns false on failure. */
+static bool SetNumaPolicy(void *p, std::size_t bytes, NumaPolicy policy,
+                          int32_t numa_node) {
+  unsigned long mask[kMaxNumaNodes / kBitsPerWord] = {0};  // NOLINT
+  int mode;
+  if (policy == NumaPolicy::kInterleave) {
+    if (syscall(SYS_get_mempolicy, nullptr, mask, kMaxNumaNodes, nullptr,
+                kMpolFMemsAllowed) != 0)
+      return false;
+    mode = kMpolInterleave;
+  } else {
+    if (numa_node < 0 || numa_node >= static_cast<int32_t>(kMaxNumaNodes))
+      return false;
+    mask[numa_node / kBitsPerWord] |= 1UL << (numa_node % kBitsPerWord);
+    mode = kMpolBind;
+  }
+  return syscall(SYS_mbind, p, bytes, mode, mask, kMaxNumaNodes, 0) == 0;
+}
+#endif
+
+class LargePageCpuContext : public Context {
+ public:
+  explicit LargePageCpuContext(const LargePageOptions &options)
+      : options_(options) {}
+
+  DeviceType GetDeviceType() const override { return kCpu; }
+
+  void *Allocate(std::size_t bytes, void **deleter_context) override {
+    if (deleter_context != nullptr) *deleter_context = nullptr;
+    void *p = nullptr;
+#ifdef __linux__
+    if (bytes != 0 && bytes >= options_.min_bytes) {
+      p = AllocateLarge(bytes);
+      if (p != nullptr) return p;
+    }
+#endif
+    if (bytes) {
+      int32_t ret = posix_memalign(&p, kAlignment, bytes);
+      K2_CHECK_EQ(ret, 0);
+    }
+    return p;
+  }
+
+  void Deallocate(void *data, void * /*deleter_context*/) override {
+#ifdef __linux__
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      auto it = mappings_.find(data);
+      if (it != mappings_.end()) {
+        munmap(data, it->second);
+        mappings_.erase(it);
+        return;
+      }
+    }
+#endif
+    free(data);
+  }
+
+  bool IsCompatible(const Context &other) const override {
+    return other.GetDeviceType() == kCpu;
+  }
+
+  void CopyDataTo(size_t num_bytes, const void *src, ContextPtr dst_context,
+                  void *dst) override {
+    // The same as for any other CPU memory.
+    GetCpuContext()->CopyDataTo(num_bytes, src, dst_context, dst);
+  }
+
+ private:
+#ifdef __linux__
+  // Returns nullptr if the memory could not be mapped at all.
+  void *AllocateLarge(std::size_t bytes) {
+    NVTX_RANGE(K2_FUNC);
+    HugePageType type = options_.huge_pages;
+    std::size_t mapped_bytes = 0;
+    void *p = MapPages(bytes, type, &mapped_bytes);
+    if (p == nullptr && (type == HugePageType::k2MB ||
+                         type == HugePageType::k1GB)) {
+      WarnOnce(&warned_huge_pages_,
+               "Could not map explicit huge pages (are enough of them "
+               "reserved in /proc/sys/vm/nr_hugepages?). Using transparent "
+               "huge pages instead.");
+      type = HugePageType::kTransparent;
+      p = MapPages(bytes, type, &mapped_bytes);
+    }
+    if (p == nullptr) return nullptr;
+    if (type == HugePageType::kTransparent &&
+        madvise(p, mapped_bytes, MADV_HUGEPAGE) != 0) {
+      WarnOnce(&warned_huge_pages_,
+               "madvise(MADV_HUGEPAGE) failed; transparent huge pages may be "
+               "disabled. Using normal pages.");
+    }
+    if (options_.numa_policy != NumaPolicy::kDefault &&
+        !SetNumaPolicy(p, mapped_bytes, options_.numa_policy,
+                       options_.numa_node)) {
+      WarnOnce(&warned_numa_,
+               "Could not set the NUMA policy of the memory. Using the "
+               "default policy.");
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    mappings_[p] = mapped_bytes;
+    return p;
+  }
+#endif
+
+  void WarnOnce(bool *warned, const char *message) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (*warned) return;
+    *warned = true;
+    K2_LOG(WARNING) << message;
+  }
+
+  LargePageOptions options_;
+  std::mutex mutex_;
+  // Maps the memory returned by AllocateLarge() to the size of its mapping.
+  std::unordered_map<void *, std::size_t> mappings_;
+  bool warned_huge_pages_ = false;
+  bool warned_numa_ = false;
+};
+
+}  // namespace
+
+ContextPtr GetLargePageCpuContext(
+    const LargePageOptions &options /*= LargePageOptions()*/) {
+  return std::make_shared<LargePageCpuContext>(options);
+}
+
+}  // namespace k2
@@ -0,0 +1,471 @@
+/**
+ * Copyright      2026  Xiaomi Corporation
+ *
+ * See LICENSE for clarification regarding multiple authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <cctype>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "k2/csrc/lattice_archive.h"
+
+namespace k2 {
+
+namespace {
+
+// "K2LA" in little endian.
+constexpr uint32_t kLatticeArchiveMagic = 0x414c324b;
+
+// Bits of the flags of an encoded Fsa.
+constexpr uint8_t kHasAuxLabels = 0x1;
+constexpr uint8_t kQuantizedScores = 0x2;
+
+// The varint encodings of a quantized score that are not zigzag(q) + 2.
+constexpr uint64_t kNegInfScore = 0;
+constexpr uint64_t kPosInfScore = 1;
+
+inline uint64_t ZigZagEncode(int64_t i) {
+  return (static_cast<uint64_t>(i) << 1) ^ static_cast<uint64_t>(i >> 63);
+}
+
+inline int64_t ZigZagDecode(uint64_t u) {
+  return static_cast<int64_t>(u >> 1) ^ -static_cast<int64_t>(u & 1);
+}
+
+void PutVarint(uint64_t u, std::string *out) {
+  while (u >= 0x80) {
+    out->push_back(static_cast<char>((u & 0x7f) | 0x80));
+    u >>= 7;
+  }
+  out->push_back(static_cast<char>(u));
+}
+
+void PutFloat(float f, std::string *out) {
+  char buf[sizeof(float)];
+  std::memcpy(buf, &f, sizeof(float));
+  out->append(buf, sizeof(float));
+}
+
+// Decodes the data written by PutVarint() and PutFloat().
+class Decoder {
+ public:
+  Decoder(const char *data, std::size_t size, const std::string &filename)
+      : p_(data), end_(data + size), filename_(filename) {}
+
+  uint64_t GetVarint() {
+    uint64_t ans = 0;
+    for (int32_t shift = 0; shift < 64; shift += 7) {
+      if (p_ == end_) Corrupted();
+      uint8_t byte = static_cast<uint8_t>(*p_++);
+      ans |= static_cast<uint64_t>(byte & 0x7f) << shift;
+      if ((byte & 0x80) == 0) return ans;
+    }
+    Corrupted();
+    return 0;
+  }
+
+  int32_t GetInt32() {
+    int64_t ans = ZigZagDecode(GetVarint());
+    if (ans < std::numeric_limits<int32_t>::min() ||
+        ans > std::numeric_limits<int32_t>::max())
+      Corrupted();
+    return static_cast<int32_t>(ans);
+  }
+
+  float GetFloat() {
+    if (end_ - p_ < static_cast<std::ptrdiff_t>(sizeof(float))) Corrupted();
+    float ans;
+    std::memcpy(&ans, p_, sizeof(float));
+    p_ += sizeof(float);
+    return ans;
+  }
+
+  uint8_t GetByte() {
+    if (p_ == end_) Corrupted();
+    return static_cast<uint8_t>(*p_++);
+  }
+
+  bool Done() const { return p_ == end_; }
+
+  void Corrupted() const {
+    K2_LOG(FATAL) << "Corrupted lattice archive " << filename_;
+  }
+
+ private:
+  const char *p_;
+  const char *end_;
+  const std::string &filename_;
+};
+
+/*
+  Encode an Fsa (on CPU); see the documentation in lattice_archive.h.
+
+     @param [in] fsa  The Fsa, with 2 axes.
+     @param [in] aux_labels  If not NULL, the aux_labels of its arcs.
+     @param [in] score_quantum  See LatticeArchiveWriter().
+     @param [out] out   The encoded Fsa is appended to it.
+ */
+void EncodeFsa(Fsa &fsa, const Array1<int32_t> *aux_labels,
+               float score_quantum, std::string *out) {
+  int32_t num_states = fsa.Dim0(), num_arcs = fsa.NumElements();
+  const int32_t *row_splits = fsa.RowSplits(1).Data();
+  const Arc *arcs = fsa.values.Data();
+  const int32_t *aux_labels_data =
+      (aux_labels != nullptr ? aux_labels->Data() : nullptr);
+
+  PutVarint(num_states, out);
+  PutVarint(num_arcs, out);
+  uint8_t flags = (aux_labels != nullptr ? kHasAuxLabels : 0) |
+                  (score_quantum > 0 ? kQuantizedScores : 0);
+  out->push_back(static_cast<char>(flags));
+  if (score_quantum > 0) PutFloat(score_quantum, out);
+
+  for (int32_t s = 0; s < num_states; ++s)
+    PutVarint(row_splits[s + 1] - row_splits[s], out);
+
+  for (int32_t i = 0; i < num_arcs; ++i) {
+    const Arc &arc = arcs[i];
+    PutVarint(ZigZagEncode(static_cast<int64_t>(arc.dest_state) -
+                           arc.src_state),
+              out);
+    PutVarint(ZigZagEncode(arc.label), out);
+    if (aux_labels_data != nullptr)
+      PutVarint(ZigZagEncode(aux_labels_data[i]), out);
+    if (score_quantum > 0) {
+      float score = arc.score;
+      K2_CHECK(!std::isnan(score)) << "Cannot write a NaN score";
+      if (std::isinf(score)) {
+        PutVarint(score < 0 ? kNegInfScore : kPosInfScore, out);
+      } else {
+        int64_t q = std::llround(static_cast<double>(score) / score_quantum);
+        PutVarint(ZigZagEncode(q) + 2, out);
+      }
+    } else {
+      PutFloat(arc.score, out);
+    }
+  }
+}
+
+// The inverse of EncodeFsa(); `c` must be a CPU context.
+Fsa DecodeFsa(Decoder *decoder, ContextPtr c, Array1<int32_t> *aux_labels) {
+  uint64_t num_states = decoder->GetVarint(), num_arcs = decoder->GetVarint();
+  if (num_states > static_cast<uint64_t>(std::numeric_limits<int32_t>::max()) ||
+      num_arcs > static_cast<uint64_t>(std::numeric_limits<int32_t>::max()))
+    decoder->Corrupted();
+  uint8_t flags = decoder->GetByte();
+  float score_quantum = 0;
+  if (flags & kQuantizedScores) score_quantum = decoder->GetFloat();
+
+  Array1<int32_t> row_splits(c, num_states + 1);
+  int32_t *row_splits_data = row_splits.Data();
+  row_splits_data[0] = 0;
+  for (uint64_t s = 0; s < num_states; ++s) {
+    uint64_t n = decoder->GetVarint();
+    if (n > num_arcs - row_splits_data[s]) decoder->Corrupted();
+    row_splits_data[s + 1] = row_splits_data[s] + static_cast<int32_t>(n);
+  }
+  if (static_cast<uint64_t>(row_splits_data[num_states]) != num_arcs)
+    decoder->Corrupted();
+
+  Array1<Arc> arcs(c, num_arcs);
+  Arc *arcs_data = arcs.Data();
+  bool has_aux_labels = (flags & kHasAuxLabels) != 0;
+  if (aux_labels != nullptr) {
+    K2_CHECK(has_aux_labels) << "The Fsa has no aux_labels";
+    *aux_labels = Array1<int32_t>(c, num_arcs);
+  }
+  int32_t *aux_labels_data =
+      (aux_labels != nullptr ? aux_labels->Data() : nullptr);
+  int32_t src_state = 0;
+  for (uint64_t i = 0; i < num_arcs; ++i) {
+    while (static_cast<uint64_t>(row_splits_data[src_state + 1]) <= i)
+      ++src_state;
+    Arc &arc = arcs_data[i];
+    arc.src_state = src_state;
+    int64_t dest_state = src_state + ZigZagDecode(decoder->GetVarint());
+    if (dest_state < 0 || dest_state >= static_cast<int64_t>(num_states))
+      decoder->Corrupted();
+    arc.dest_state = static_cast<int32_t>(dest_state);
+    arc.label = decoder->GetInt32();
+    if (has_aux_labels) {
+      int32_t aux_label = decoder->GetInt32();
+      if (aux_labels_data != nullptr) aux_labels_data[i] = aux_label;
+    }
+    if (score_quantum > 0) {
+      uint64_t u = decoder->GetVarint();
+      if (u == kNegInfScore)
+        arc.score = -std::numeric_limits<float>::infinity();
+      else if (u == kPosInfScore)
+        arc.score = std::numeric_limits<float>::infinity();
+      else
+        arc.score = static_cast<float>(ZigZagDecode(u - 2) *
+                                       static_cast<double>(score_quantum));
+    } else {
+      arc.score = decoder->GetFloat();
+    }
+  }
+  if (!decoder->Done()) decoder->Corrupted();
+  return Fsa(RaggedShape2(&row_splits, nullptr, num_arcs), arcs);
+}
+
+void CheckKey(const std::string &key) {
+  K2_CHECK(!key.empty()) << "Empty key";
+  for (char ch : key)
+    K2_CHECK(!std::isspace(static_cast<unsigned char>(ch)))
+        << "Keys must not contain whitespace: '" << key << "'";
+}
+
+}  // namespace
+
+LatticeArchiveWriter::LatticeArchiveWriter(const std::string &filename,
+                                           float score_quantum,
+                                           int32_t max_queue_size)
+    : filename_(filename),
+      score_quantum_(score_quantum),
+      max_queue_size_(max_queue_size) {
+  K2_CHECK_GE(score_quantum, 0);
+  K2_CHECK_GT(max_queue_size, 0);
+  {
+    std::ifstream is(filename, std::ios::binary | std::ios::ate);
+    offset_ = (is ? static_cast<int64_t>(is.tellg()) : 0);
+  }
+  archive_.open(filename, std::ios::binary | std::ios::app);
+  if (!archive_) K2_LOG(FATAL) << "Failed to open " << filename;
+  index_.open(filename + ".idx", std::ios::app);
+  if (!index_) K2_LOG(FATAL) << "Failed to open " << filename << ".idx";
+  thread_ = std::thread([this]() { WriteLoop(); });
+}
+
+LatticeArchiveWriter::~LatticeArchiveWriter() {
+  try {
+    Close();
+  } catch (const std::exception &e) {
+    K2_LOG(WARNING) << "Failed to write lattice archive " << filename_
+                    << ": " << e.what();
+  }
+}
+
+void LatticeArchiveWriter::CheckError() {
+  std::exception_ptr error;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::swap(error, error_);
+  }
+  if (error) std::rethrow_exception(error);
+}
+
+void LatticeArchiveWriter::Write(const std::string &key, Fsa &fsa,
+                                 const Array1<int32_t> *aux_labels) {
+  NVTX_RANGE(K2_FUNC);
+  CheckKey(key);
+  K2_CHECK_EQ(fsa.NumAxes(), 2);
+  if (aux_labels != nullptr)
+    K2_CHECK_EQ(aux_labels->Dim(), fsa.NumElements());
+  CheckError();
+
+  // Copy to CPU in the calling thread, so that the copy is done on the
+  // caller's stream.
+  ContextPtr cpu = GetCpuContext();
+  Item item;
+  item.key = key;
+  item.fsa = fsa.To(cpu);
+  item.has_aux_labels = (aux_labels != nullptr);
+  if (item.has_aux_labels) item.aux_labels = aux_labels->To(cpu);
+
+  std::unique_lock<std::mutex> lock(mutex_);
+  K2_CHECK(!closing_) << "Write() after Close()";
+  cond_.wait(lock, [this]() {
+    return static_cast<int32_t>(queue_.size()) < max_queue_size_;
+  });
+  queue_.push_back(std::move(item));
+  cond_.notify_all();
+}
+
+void LatticeArchiveWriter::Write(const std::vector<std::string> &keys,
+                                 FsaVec &fsas,
+                                 const Array1<int32_t> *aux_labels) {
+  NVTX_RANGE(K2_FUNC);
+  K2_CHECK_EQ(fsas.NumAxes(), 3);
+  K2_CHECK_EQ(static_cast<int32_t>(keys.size()), fsas.Dim0());
+  Array1<int32_t> aux_labels_cpu;
+  if (aux_labels != nullptr) {
+    K2_CHECK_EQ(aux_labels->Dim(), fsas.NumElements());
+    aux_labels_cpu = aux_labels->To(GetCpuContext());
+  }
+  FsaVec fsas_cpu = fsas.To(GetCpuContext());
+  const int32_t *row_splits1 = fsas_cpu.RowSplits(1).Data(),
+                *row_splits2 = fsas_cpu.RowSplits(2).Data();
+  for (int32_t i = 0; i < fsas_cpu.Dim0(); ++i) {
+    Fsa fsa = fsas_cpu.Index(0, i);
+    if (aux_labels != nullptr) {
+      int32_t begin = row_splits2[row_splits1[i]],
+              end = row_splits2[row_splits1[i + 1]];
+      Array1<int32_t> this_aux_labels = aux_labels_cpu.Arange(begin, end);
+      Write(keys[i], fsa, &this_aux_labels);
+    } else {
+      Write(keys[i], fsa);
+    }
+  }
+}
+
+void LatticeArchiveWriter::WriteLoop() {
+  std::string record;
+  while (true) {
+    Item item;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      cond_.wait(lock, [this]() { return closing_ || !queue_.empty(); });
+      if (queue_.empty()) return;  // closing_ is true.
+      item = std::move(queue_.front());
+      queue_.pop_front();
+      cond_.notify_all();
+    }
+    try {
+      std::string payload;
+      EncodeFsa(item.fsa, item.has_aux_labels ? &item.aux_labels : nullptr,
+                score_quantum_, &payload);
+      record.clear();
+      char magic[sizeof(kLatticeArchiveMagic)];
+      std::memcpy(magic, &kLatticeArchiveMagic, sizeof(magic));
+      record.append(magic, sizeof(magic));
+      PutVarint(item.key.size(), &record);
+      record.append(item.key);
+      PutVarint(payload.size(), &record);
+      record.append(payload);
+
+      archive_.write(record.data(), record.size());
+      index_ << item.key << ' ' << offset_ << '\n';
+      if (!archive_ || !index_)
+        K2_LOG(FATAL) << "Failed to write lattice archive " << filename_;
+      offset_ += record.size();
+    } catch (...) {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (!error_) error_ = std::current_exception();
+    }
+  }
+}
+
+void LatticeArchiveWriter::Close() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    closing_ = true;
+    cond_.notify_all();
+  }
+  if (thread_.joinable()) {
+    thread_.join();
+    archive_.close();
+    index_.close();
+  }
+  CheckError();
+}
+
+LatticeArchiveReader::LatticeArchiveReader(const std::string &filename)
+    : filename_(filename), archive_(filename, std::ios::binary) {
+  if (!archive_) K2_LOG(FATAL) << "Failed to open " << filename;
+
+  std::ifstream index(filename + ".idx");
+  if (index) {
+    std::string key;
+    int64_t offset;
+    while (index >> key >> offset) {
+      keys_.push_back(key);
+      offsets_.push_back(offset);
+    }
+    if (!index.eof())
+      K2_LOG(FATAL) << "Bad index file " << filename << ".idx";
+  } else {
+    // Rebuild the index by reading the record headers.
+    std::string key;
+    uint64_t payload_size;
+    while (archive_.peek() != std::char_traits<char>::eof()) {
+      int64_t offset = archive_.tellg();
+      ReadRecordHeader(&key, &payload_size);
+      keys_.push_back(key);
+      offsets_.push_back(offset);
+      archive_.seekg(payload_size, std::ios::cur);
+    }
+    archive_.clear();
+  }
+  for (std::size_t i = 0; i != keys_.size(); ++i)
+    key_to_index_[keys_[i]] = static_cast<int32_t>(i);
+}
+
+uint64_t LatticeArchiveReader::ReadVarint() {
+  uint64_t ans = 0;
+  for (int32_t shift = 0; shift < 64; shift += 7) {
+    int ch = archive_.get();
+    if (ch == std::char_traits<char>::eof()) break;
+    ans |= static_cast<uint64_t>(ch & 0x7f) << shift;
+    if ((ch & 0x80) == 0) return ans;
+  }
+  K2_LOG(FATAL) << "Corrupted lattice archive " << filename_;
+  return 0;
+}
+
+void LatticeArchiveReader::ReadRecordHeader(std::string *key,
+                                            uint64_t *payload_size) {
+  uint32_t magic = 0;
+  archive_.read(reinterpret_cast<char *>(&magic), sizeof(magic));
+  if (!archive_ || magic != kLatticeArchiveMagic)
+    K2_LOG(FATAL) << "Corrupted lattice archive " << filename_;
+  uint64_t key_size = ReadVarint();
+  if (key_size > (1 << 20))
+    K2_LOG(FATAL) << "Corrupted lattice archive " << filename_;
+  key->resize(key_size);
+  archive_.read(&(*key)[0], key_size);
+  *payload_size = ReadVarint();
+  if (!archive_) K2_LOG(FATAL) << "Corrupted lattice archive " << filename_;
+}
+
+Fsa LatticeArchiveReader::Read(const std::string &key,
+                               Array1<int32_t> *aux_labels, ContextPtr c) {
+  auto iter = key_to_index_.find(key);
+  if (iter == key_to_index_.end())
+    K2_LOG(FATAL) << "Key '" << key << "' not found in " << filename_;
+  return Read(iter->second, aux_labels, c);
+}
+
+Fsa LatticeArchiveReader::Read(int32_t i, Array1<int32_t> *aux_labels,
+                               ContextPtr c) {
+  NVTX_RANGE(K2_FUNC);
+  K2_CHECK_GE(i, 0);
+  K2_CHECK_LT(i, NumFsas());
+  if (c == nullptr) c = GetCpuContext();
+
+  archive_.clear();
+  archive_.seekg(offsets_[i], std::ios::beg);
+  std::string key;
+  uint64_t payload_size;
+  ReadRecordHeader(&key, &payload_size);
+  if (key != keys_[i])
+    K2_LOG(FATAL) << "The index of " << filename_ << " does not match it";
+  std::string payload(payload_size, '\0');
+  archive_.read(&payload[0], payload_size);
+  if (!archive_) K2_LOG(FATAL) << "Corrupted lattice archive " << filename_;
+
+  Decoder decoder(payload.data(), payload.size(), filename_);
+  Array1<int32_t> aux_labels_cpu;
+  Fsa ans = DecodeFsa(&decoder, GetCpuContext(),
+                      aux_labels != nullptr ? &aux_labels_cpu : nullptr);
+  if (aux_labels != nullptr) *aux_labels = aux_labels_cpu.To(c);
+  return ans.To(c);
+}
+
+}  // namespace k2
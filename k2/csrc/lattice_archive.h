@@ -0,0 +1,196 @@
+/**
+ * Copyright      2026  Xiaomi Corporation
+ *
+ * See LICENSE for clarification regarding multiple authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef K2_CSRC_LATTICE_ARCHIVE_H_
+#define K2_CSRC_LATTICE_ARCHIVE_H_
+
+#include <condition_variable>  // NOLINT
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <fstream>
+#include <mutex>  // NOLINT
+#include <string>
+#include <thread>  // NOLINT
+#include <unordered_map>
+#include <vector>
+
+#include "k2/csrc/array.h"
+#include "k2/csrc/fsa.h"
+
+namespace k2 {
+
+/*
+  A lattice archive stores Fsas (e.g. the lattices of decoding), each with
+  optional aux_labels, under string keys.  It consists of two files:
+
+    - The archive `filename`, a sequence of records, one per Fsa, each of
+      which is a magic number, the key and the encoded Fsa.  In the encoded
+      Fsa, the number of arcs of each state, the (dest_state - src_state) and
+      the labels and aux_labels of the arcs are written as varints (with
+      zigzag encoding for signed values), and the scores are quantized to
+      integer multiples of `score_quantum`, also written as varints, unless
+      `score_quantum` is 0, in which case they are written as floats.
+
+    - The index `filename + ".idx"`, a text file with a line
+      "<key> <offset>" per record, where <offset> is the byte offset of the
+      record in the archive.
+
+  Both files are only ever appended to, so several writers may add to the
+  same archive one after another (not concurrently).  Keys must be
+  nonempty and must not contain whitespace.
+ */
+
+/*
+  Writes Fsas to a lattice archive.  Write() copies the Fsa to the CPU (if
+  needed) and queues it; the encoding and the writing are done by a
+  background thread.
+ */
+class LatticeArchiveWriter {
+ public:
+  /*
+     @param [in] filename  The archive to write; it is created if it does
+                           not exist, else appended to.
+     @param [in] score_quantum  If > 0, the scores are rounded to multiples
+                           of it (so their absolute error is at most
+                           score_quantum / 2); if 0, they are written
+                           exactly.
+     @param [in] max_queue_size  The maximum number of Fsas waiting to be
+                           written; Write() blocks while the queue is full.
+   */
+  explicit LatticeArchiveWriter(const std::string &filename,
+                                float score_quantum = 1.0f / 256,
+                                int32_t max_queue_size = 64);
+
+  LatticeArchiveWriter(const LatticeArchiveWriter &) = delete;
+  LatticeArchiveWriter &operator=(const LatticeArchiveWriter &) = delete;
+
+  // Calls Close(); any error of the background thread is logged.
+  ~LatticeArchiveWriter();
+
+  /*
+    Queue an Fsa to be written.
+
+       @param [in] key  The key of the Fsa.
+       @param [in] fsa  An Fsa with 2 axes, on any device.
+       @param [in] aux_labels  If not NULL, the aux_labels of the arcs of
+                       `fsa`, with aux_labels->Dim() == fsa.NumElements().
+
+    If the background thread failed to write an earlier Fsa, its error is
+    re-thrown here.
+   */
+  void Write(const std::string &key, Fsa &fsa,
+             const Array1<int32_t> *aux_labels = nullptr);
+
+  // Write each Fsa of `fsas` (with 3 axes) under the corresponding key;
+  // aux_labels, if not NULL, are the aux_labels of all the arcs of `fsas`.
+  void Write(const std::vector<std::string> &keys, FsaVec &fsas,
+             const Array1<int32_t> *aux_labels = nullptr);
+
+  /*
+    Wait for the queued Fsas to be written and close the files.  It is
+    called by the destructor; calling it again does nothing.  If the
+    background thread failed, its error is re-thrown here.
+   */
+  void Close();
+
+ private:
+  struct Item {
+    std::string key;
+    Fsa fsa;                     // On CPU
+    Array1<int32_t> aux_labels;  // On CPU
+    bool has_aux_labels;
+  };
+
+  // The loop of the background thread.
+  void WriteLoop();
+
+  // Re-throws the error of the background thread, if any.
+  void CheckError();
+
+  std::string filename_;
+  float score_quantum_;
+  int32_t max_queue_size_;
+
+  // Only used by the background thread after the constructor.
+  std::ofstream archive_;
+  std::ofstream index_;
+  int64_t offset_;  // The size of the archive
+
+  std::mutex mutex_;  // Protects the members below.
+  std::condition_variable cond_;
+  std::deque<Item> queue_;
+  bool closing_ = false;
+  std::exception_ptr error_;
+
+  std::thread thread_;
+};
+
+/*
+  Reads Fsas from a lattice archive by key or by position.  If the index
+  file does not exist, the index is rebuilt by scanning the archive.
+ */
+class LatticeArchiveReader {
+ public:
+  explicit LatticeArchiveReader(const std::string &filename);
+
+  // The number of Fsas in the archive.
+  int32_t NumFsas() const { return static_cast<int32_t>(keys_.size()); }
+
+  // The keys of the Fsas, in the order in which they were written; a key
+  // written more than once appears more than once.
+  const std::vector<std::string> &Keys() const { return keys_; }
+
+  bool HasKey(const std::string &key) const {
+    return key_to_index_.count(key) != 0;
+  }
+
+  /*
+    Read an Fsa.  If a key was written more than once, the last Fsa written
+    with it is returned.
+
+       @param [in] key  The key of the Fsa; it must exist.
+       @param [out] aux_labels  If not NULL, it is set to the aux_labels of
+                       the Fsa; it is an error if it had none.
+       @param [in] c   The context of the result; if NULL, GetCpuContext()
+                       is used.
+       @return  Returns the Fsa, with 2 axes.
+   */
+  Fsa Read(const std::string &key, Array1<int32_t> *aux_labels = nullptr,
+           ContextPtr c = nullptr);
+
+  // Read the i'th Fsa, 0 <= i < NumFsas(); see Read() above.
+  Fsa Read(int32_t i, Array1<int32_t> *aux_labels = nullptr,
+           ContextPtr c = nullptr);
+
+ private:
+  uint64_t ReadVarint();
+
+  // Read the header of the record at the current position of archive_.
+  void ReadRecordHeader(std::string *key, uint64_t *payload_size);
+
+  std::string filename_;
+  std::ifstream archive_;
+  std::vector<std::string> keys_;
+  std::vector<int64_t> offsets_;
+  std::unordered_map<std::string, int32_t> key_to_index_;
+};
+
+}  // namespace k2
+
+#endif  // K2_CSRC_LATTICE_ARCHIVE_H_
@@ -0,0 +1,132 @@
+/**
+ * Copyright      2026  Xiaomi Corporation
+ *
+ * See LICENSE for clarification regarding multiple authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <limits>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "k2/csrc/array_ops.h"
+#include "k2/csrc/fsa_utils.h"
+#include "k2/csrc/lattice_archive.h"
+#include "k2/csrc/ragged_ops.h"
+#include "k2/csrc/test_utils.h"
+
+namespace k2 {
+
+// Checks that `fsa` equals `expected` except that its scores may differ by
+// up to `tolerance`.
+static void CheckFsa(Fsa &fsa, Fsa &expected, float tolerance) {
+  EXPECT_TRUE(Equal(fsa.shape, expected.shape));
+  ASSERT_EQ(fsa.NumElements(), expected.NumElements());
+  const Arc *arcs = fsa.values.Data(), *expected_arcs = expected.values.Data();
+  for (int32_t i = 0; i < fsa.NumElements(); ++i) {
+    EXPECT_EQ(arcs[i].src_state, expected_arcs[i].src_state);
+    EXPECT_EQ(arcs[i].dest_state, expected_arcs[i].dest_state);
+    EXPECT_EQ(arcs[i].label, expected_arcs[i].label);
+    if (std::isinf(expected_arcs[i].score))
+      EXPECT_EQ(arcs[i].score, expected_arcs[i].score);
+    else
+      EXPECT_NEAR(arcs[i].score, expected_arcs[i].score, tolerance);
+  }
+}
+
+TEST(LatticeArchive, WriteAndRead) {
+  std::string filename = ::testing::TempDir() + "k2_lattice_archive_test.ark";
+  ContextPtr cpu = GetCpuContext();
+  for (float score_quantum : {0.0f, 1.0f / 64}) {
+    std::remove(filename.c_str());
+    std::remove((filename + ".idx").c_str());
+
+    FsaVec fsas = RandomFsaVec(2, 20, false, 50, 1, 100);
+    // An infinite score and an empty Fsa.
+    fsas.values.Data()[0].score = -std::numeric_limits<float>::infinity();
+    Fsa empty_fsa(EmptyRaggedShape(cpu, 2));
+    Array1<int32_t> aux_labels =
+        RandUniformArray1<int32_t>(cpu, fsas.NumElements(), -1, 1000);
+    std::vector<std::string> keys;
+    for (int32_t i = 0; i < fsas.Dim0(); ++i)
+      keys.push_back("utt-" + std::to_string(i));
+
+    {
+      LatticeArchiveWriter writer(filename, score_quantum, 2);
+      writer.Write(keys, fsas, &aux_labels);
+    }
+    {
+      // Append to it, and overwrite the first key.
+      LatticeArchiveWriter writer(filename, score_quantum);
+      writer.Write("empty", empty_fsa);
+      Fsa fsa = fsas.Index(0, 1);
+      writer.Write(keys[0], fsa);
+    }
+
+    for (bool with_index : {true, false}) {
+      if (!with_index) std::remove((filename + ".idx").c_str());
+      LatticeArchiveReader reader(filename);
+      ASSERT_EQ(reader.NumFsas(), fsas.Dim0() + 2);
+      EXPECT_EQ(reader.Keys()[fsas.Dim0()], "empty");
+      EXPECT_TRUE(reader.HasKey("empty"));
+      EXPECT_FALSE(reader.HasKey("utt"));
+
+      const int32_t *row_splits1 = fsas.RowSplits(1).Data(),
+                    *row_splits2 = fsas.RowSplits(2).Data();
+      float tolerance = score_quantum / 2 + 1e-5;
+      for (int32_t i = 0; i < fsas.Dim0(); ++i) {
+        Array1<int32_t> this_aux_labels;
+        Fsa fsa = reader.Read(i, &this_aux_labels);
+        Fsa expected = fsas.Index(0, i);
+        CheckFsa(fsa, expected, tolerance);
+        int32_t begin = row_splits2[row_splits1[i]],
+                end = row_splits2[row_splits1[i + 1]];
+        EXPECT_TRUE(Equal(this_aux_labels, aux_labels.Arange(begin, end)));
+      }
+      Fsa fsa = reader.Read("empty");
+      EXPECT_EQ(fsa.Dim0(), 0);
+      fsa = reader.Read(keys[0]);
+      Fsa expected = fsas.Index(0, 1);
+      CheckFsa(fsa, expected, tolerance);
+    }
+  }
+  std::remove(filename.c_str());
+  std::remove((filename + ".idx").c_str());
+}
+
+TEST(LatticeArchive, Compression) {
+  // With quantized scores, a lattice takes much less space than its arcs and
+  // aux_labels in memory.
+  std::string filename = ::testing::TempDir() + "k2_lattice_archive_test.ark";
+  std::remove(filename.c_str());
+  std::remove((filename + ".idx").c_str());
+  Fsa fsa = RandomFsa(true, 500, 100, 1000);
+  Array1<int32_t> aux_labels =
+      RandUniformArray1<int32_t>(GetCpuContext(), fsa.NumElements(), 0, 500);
+  {
+    LatticeArchiveWriter writer(filename);
+    writer.Write("a", fsa, &aux_labels);
+  }
+  std::ifstream is(filename, std::ios::binary | std::ios::ate);
+  int64_t size = is.tellg();
+  EXPECT_LT(size, fsa.NumElements() * (sizeof(Arc) + sizeof(int32_t)) / 2);
+  std::remove(filename.c_str());
+  std::remove((filename + ".idx").c_str());
+}
+
+}  // namespace k2
@@ -31,6 +31,7 @@
 #ifndef K2_CSRC_LOG_H_
 #define K2_CSRC_LOG_H_
 
+#include <atomic>
 #include <cassert>
 #include <cstdint>
 #include <cstdio>
@@ -286,15 +287,60 @@ inline bool EnableCudaDeviceSync() {
   return enable_cuda_sync;
 }
 
+/* How much validation is done on objects such as RaggedShape when they are
+   constructed (currently this affects the checks called in the constructor
+   of RaggedShape, which can otherwise dominate the time).
+
+     kOff    No validation.
+     kCheap  Only checks that use host-side metadata such as dimensions, i.e.
+             that don't launch any kernels or need device syncs.
+     kFull   All checks.
+
+   The default is set at compile time by K2_VALIDATION_LEVEL (0, 1 or 2; see
+   the CMake option of the same name), and may be overridden at run time by
+   the environment variable K2_VALIDATION_LEVEL (off, cheap or full) or by
+   SetValidationLevel().  The environment variable K2_DISABLE_CHECKS is
+   equivalent to K2_VALIDATION_LEVEL=off.
+*/
+enum class ValidationLevel { kOff = 0, kCheap = 1, kFull = 2 };
+
+#ifndef K2_VALIDATION_LEVEL
+#define K2_VALIDATION_LEVEL 2
+#endif
+
+inline std::atomic<int32_t> &ValidationLevelVar() {
+  static std::atomic<int32_t> level([]() -> int32_t {
+    static_assert(K2_VALIDATION_LEVEL >= 0 && K2_VALIDATION_LEVEL <= 2,
+                  "K2_VALIDATION_LEVEL must be 0, 1 or 2");
+    if (std::getenv("K2_DISABLE_CHECKS") != nullptr)
+      return static_cast<int32_t>(ValidationLevel::kOff);
+    const char *env = std::getenv("K2_VALIDATION_LEVEL");
+    if (env != nullptr) {
+      std::string s(env);
+      if (s == "off" || s == "0") return 0;
+      if (s == "cheap" || s == "1") return 1;
+      if (s == "full" || s == "2") return 2;
+      std::fprintf(stderr,
+                   "Invalid value '%s' for K2_VALIDATION_LEVEL (expected "
+                   "off, cheap or full); ignoring it.\n",
+                   env);
+    }
+    return K2_VALIDATION_LEVEL;
+  }());
+  return level;
+}
+
+inline ValidationLevel GetValidationLevel() {
+  return static_cast<ValidationLevel>(
+      ValidationLevelVar().load(std::memory_order_relaxed));
+}
+
+inline void SetValidationLevel(ValidationLevel level) {
+  ValidationLevelVar().store(static_cast<int32_t>(level));
+}
+
 inline bool DisableChecks() {
-  // Currently this just disables the checks called in the constructor of
-  // RaggedShape, which can otherwise dominate the time when in debug mode.
-  static std::once_flag init_flag;
-  static bool disable_checks = false;
-  std::call_once(init_flag, []() {
-    disable_checks = (std::getenv("K2_DISABLE_CHECKS") != nullptr);
-  });
-  return disable_checks;
+  return GetValidationLevel() == ValidationLevel::kOff;
 }
 
 /*
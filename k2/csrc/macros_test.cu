@@ -62,7 +62,29 @@ namespace k2 {
   }
 }
 
+/*static*/ void TestEvalFused() {
+  for (auto &c : {GetCpuContext(), GetCudaContext()}) {
+    Array1<int32_t> a = Range(c, 3, 0), b = Range(c, 300, 0);
+    int32_t *a_data = a.Data(), *b_data = b.Data();
+    auto lambda_inc_a = [=] __host__ __device__(int32_t i) -> void {
+      a_data[i] += 1;
+    };
+    auto lambda_double_b = [=] __host__ __device__(int32_t i) -> void {
+      b_data[i] *= 2;
+    };
+    EvalFused(c, a.Dim(), lambda_inc_a, b.Dim(), lambda_double_b);
+    CheckArrayData(a, std::vector<int32_t>{1, 2, 3});
+    CheckArrayData(b, Range(c, 300, 0, 2));
+
+    // either of them may be empty.
+    EvalFused(c, 0, lambda_inc_a, a.Dim(), lambda_inc_a);
+    EvalFused(c, a.Dim(), lambda_inc_a, 0, lambda_double_b);
+    CheckArrayData(a, std::vector<int32_t>{3, 4, 5});
+  }
+}
+
 TEST(Macros, Eval) { TestEval(); }
 TEST(Macros, Eval2) { TestEval2(); }
+TEST(Macros, EvalFused) { TestEvalFused(); }
 
 }  // namespace k2
@@ -16,6 +16,8 @@
  * limitations under the License.
  */
 
+#include <map>
+#include <memory>
 #include <mutex>  // NOLINT
 #include <utility>
 
@@ -35,11 +37,13 @@ class ModernGpuAllocator : public mgpu::standard_context_t {
     void *deleter_ = nullptr;
     void *p = context_->Allocate(size, &deleter_);
     K2_DCHECK(deleter_ == nullptr);
+    k2::OpStatsAllocation(p, size);
     return p;
   }
 
   void free(void *p, mgpu::memory_space_t space) override {
     K2_DCHECK_EQ(space, mgpu::memory_space_device);
+    k2::OpStatsDeallocation(p);
     context_->Deallocate(p, nullptr);
   }
 
@@ -51,16 +55,13 @@ class ModernGpuAllocator : public mgpu::standard_context_t {
 
 namespace k2 {
 
-static mgpu::context_t *mgpu_contexts[kMaxNumGpus];
-static std::once_flag mgpu_once_flags[kMaxNumGpus];
-
-static void InitModernGpuAllocator(ContextPtr context) {
-  int32_t device_index = context->GetDeviceId();
-  K2_CHECK_GE(device_index, 0);
-  K2_CHECK_LT(device_index, kMaxNumGpus);
-  // it is never freed
-  mgpu_contexts[device_index] = new ModernGpuAllocator(context);
-}
+// The moderngpu contexts, indexed by (device, stream), so that the kernels
+// launched by moderngpu run on the stream of the caller.  They are never
+// freed; there are only as many of them as streams used with k2.
+static std::map<std::pair<int32_t, cudaStream_t>,
+                std::unique_ptr<mgpu::context_t>>
+    mgpu_contexts;
+static std::mutex mgpu_contexts_mutex;
 
 mgpu::context_t *GetModernGpuAllocator(ContextPtr context) {
   K2_CHECK_EQ(context->GetDeviceType(), kCuda);
@@ -69,10 +70,15 @@ mgpu::context_t *GetModernGpuAllocator(ContextPtr context) {
   K2_CHECK_GE(device_index, 0);
   K2_CHECK_LT(device_index, kMaxNumGpus);
 
-  std::call_once(mgpu_once_flags[device_index], InitModernGpuAllocator,
-                 context);
-
-  return mgpu_contexts[device_index];
+  auto key = std::make_pair(device_index, context->GetCudaStream());
+  std::lock_guard<std::mutex> lock(mgpu_contexts_mutex);
+  std::unique_ptr<mgpu::context_t> &ans = mgpu_contexts[key];
+  if (ans == nullptr) {
+    // Constructing it queries the device and loads moderngpu's kernels.
+    InitPhaseTimer timer("ModernGpuContext");
+    ans = std::make_unique<ModernGpuAllocator>(context);
+  }
+  return ans.get();
 }
 
 }  // namespace k2
@@ -28,11 +28,18 @@ namespace k2 {
 
 /* Return an allocator for moderngpu.
 
+   There is one allocator per (device, CUDA stream), so that the kernels of
+   moderngpu run on the stream of `context`, and callers on different
+   streams don't serialize or need to synchronize with each other.
+
    Caution: The returned pointer is NOT owned by the caller and it
    should NOT be freed!
 
    @param  [in]  context  It is a CUDA context that will be used to
-                          allocate device memory for moderngpu.
+                          allocate device memory for moderngpu, and whose
+                          stream the kernels of moderngpu will run on.  The
+                          allocator created for a stream keeps the context
+                          it was first requested with.
 
    @return  Return a pointer to mgpu::context_t. The user should NOT
             free it.
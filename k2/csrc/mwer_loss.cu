@@ -0,0 +1,171 @@
+/**
+ * Copyright      2026  Xiaomi Corporation
+ *
+ * See LICENSE for clarification regarding multiple authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "k2/csrc/array_ops.h"
+#include "k2/csrc/fsa_algo.h"
+#include "k2/csrc/fsa_utils.h"
+#include "k2/csrc/macros.h"
+#include "k2/csrc/mwer_loss.h"
+#include "k2/csrc/ragged_ops.h"
+
+namespace k2 {
+
+template <typename FloatType>
+Ragged<FloatType> MwerLoss(FsaVec &lattice, Ragged<int32_t> &aux_labels,
+                           Ragged<int32_t> &ref_texts, float nbest_scale,
+                           int32_t num_paths, float temperature,
+                           Ragged<int32_t> *paths,
+                           Array1<FloatType> *path_probs) {
+  NVTX_RANGE(K2_FUNC);
+  K2_CHECK_EQ(lattice.NumAxes(), 3);
+  K2_CHECK_EQ(ref_texts.NumAxes(), 2);
+  K2_CHECK_EQ(ref_texts.Dim0(), lattice.Dim0());
+  K2_CHECK_GT(temperature, 0);
+  K2_CHECK(paths != nullptr && path_probs != nullptr);
+  ContextPtr c = GetContext(lattice, aux_labels, ref_texts);
+
+  // Sample paths with the scaled scores.
+  int32_t num_arcs = lattice.NumElements();
+  FsaVec scaled(lattice.shape, Array1<Arc>(c, num_arcs));
+  const Arc *arcs_data = lattice.values.Data();
+  Arc *scaled_arcs_data = scaled.values.Data();
+  K2_EVAL(
+      c, num_arcs, lambda_scale_scores, (int32_t i)->void {
+        Arc arc = arcs_data[i];
+        arc.score *= nbest_scale;
+        scaled_arcs_data[i] = arc;
+      });
+  FsaVecTopology topology(scaled);
+  bool log_semiring = true;
+  Array1<FloatType> forward_scores, arc_post;
+  topology.GetScores<FloatType>(log_semiring, &forward_scores,
+                                /*backward_scores*/ nullptr, &arc_post);
+  Array1<FloatType> arc_cdf = GetArcCdf(scaled, arc_post),
+                    tot_scores = GetTotScores(scaled, forward_scores);
+  Ragged<int32_t> word_seqs;
+  *paths = SampleUniquePaths(scaled, arc_cdf, tot_scores,
+                             topology.StateBatches(), aux_labels, num_paths,
+                             0, &word_seqs);
+
+  // The levenshtein distance of each path to its reference.
+  Array1<int32_t> hyp_to_ref_map = paths->RowIds(1);
+  Ragged<int32_t> hyps = word_seqs.RemoveAxis(0);
+  Array1<int32_t> wers = LevenshteinDistance(ref_texts, hyps, hyp_to_ref_map);
+
+  // The (unscaled) score of each path, divided by the temperature.
+  Ragged<FloatType> arc_scores(paths->shape,
+                               Array1<FloatType>(c, paths->NumElements()));
+  const int32_t *paths_data = paths->values.Data();
+  FloatType *arc_scores_data = arc_scores.values.Data();
+  K2_EVAL(
+      c, arc_scores.NumElements(), lambda_get_arc_scores, (int32_t i)->void {
+        arc_scores_data[i] = arcs_data[paths_data[i]].score / temperature;
+      });
+  arc_scores = arc_scores.RemoveAxis(0);
+  int32_t tot_paths = paths->TotSize(1);
+  Ragged<FloatType> path_scores(GetLayer(paths->shape, 0),
+                                Array1<FloatType>(c, tot_paths));
+  SumPerSublist<FloatType>(arc_scores, 0, &path_scores.values);
+
+  *path_probs = NormalizePerSublist(path_scores, true).values;
+  Ragged<FloatType> ans(path_scores.shape, Array1<FloatType>(c, tot_paths));
+  FloatType *path_probs_data = path_probs->Data(),
+            *ans_data = ans.values.Data();
+  const int32_t *wers_data = wers.Data();
+  K2_EVAL(
+      c, tot_paths, lambda_set_loss, (int32_t i)->void {
+        FloatType prob = exp(path_probs_data[i]);
+        path_probs_data[i] = prob;
+        ans_data[i] = prob * wers_data[i];
+      });
+  return ans;
+}
+
+template <typename FloatType>
+Array1<FloatType> MwerLossBackward(FsaVec &lattice, Ragged<int32_t> &paths,
+                                   const Array1<FloatType> &path_probs,
+                                   const Array1<FloatType> &path_loss,
+                                   float temperature,
+                                   const Array1<FloatType> &loss_grad) {
+  NVTX_RANGE(K2_FUNC);
+  K2_CHECK_EQ(paths.NumAxes(), 3);
+  int32_t tot_paths = paths.TotSize(1);
+  K2_CHECK_EQ(path_probs.Dim(), tot_paths);
+  K2_CHECK_EQ(path_loss.Dim(), tot_paths);
+  K2_CHECK_EQ(loss_grad.Dim(), tot_paths);
+  ContextPtr c = GetContext(lattice, paths, path_probs, path_loss, loss_grad);
+
+  // With the normalized posteriors p_i = exp(z_i) / sum_k exp(z_k) of the
+  // paths of an utterance and their loss l_i = p_i w_i, the derivative of
+  // sum_i g_i l_i w.r.t. z_j is g_j l_j - p_j sum_i g_i l_i.
+  Ragged<FloatType> weighted_loss(GetLayer(paths.shape, 0),
+                                  Array1<FloatType>(c, tot_paths));
+  const FloatType *loss_grad_data = loss_grad.Data(),
+                  *path_loss_data = path_loss.Data();
+  FloatType *weighted_loss_data = weighted_loss.values.Data();
+  K2_EVAL(
+      c, tot_paths, lambda_set_weighted_loss, (int32_t i)->void {
+        weighted_loss_data[i] = loss_grad_data[i] * path_loss_data[i];
+      });
+  Array1<FloatType> utt_sum(c, weighted_loss.Dim0());
+  SumPerSublist<FloatType>(weighted_loss, 0, &utt_sum);
+
+  const int32_t *paths_row_ids1_data = paths.RowIds(1).Data(),
+                *paths_row_ids2_data = paths.RowIds(2).Data(),
+                *paths_data = paths.values.Data();
+  const FloatType *path_probs_data = path_probs.Data(),
+                  *utt_sum_data = utt_sum.Data();
+  Array1<FloatType> ans(c, lattice.NumElements(), 0);
+  FloatType *ans_data = ans.Data();
+  // Paths of the same utterance may share arcs.
+  K2_EVAL(
+      c, paths.NumElements(), lambda_set_arc_grad, (int32_t i)->void {
+        int32_t path_idx01 = paths_row_ids2_data[i],
+                utt_idx0 = paths_row_ids1_data[path_idx01];
+        FloatType grad = weighted_loss_data[path_idx01] -
+                         path_probs_data[path_idx01] * utt_sum_data[utt_idx0];
+        AtomicAdd(ans_data + paths_data[i], grad / temperature);
+      });
+  return ans;
+}
+
+template Ragged<float> MwerLoss<float>(FsaVec &lattice,
+                                      Ragged<int32_t> &aux_labels,
+                                      Ragged<int32_t> &ref_texts,
+                                      float nbest_scale, int32_t num_paths,
+                                      float temperature,
+                                      Ragged<int32_t> *paths,
+                                      Array1<float> *path_probs);
+template Ragged<double> MwerLoss<double>(FsaVec &lattice,
+                                        Ragged<int32_t> &aux_labels,
+                                        Ragged<int32_t> &ref_texts,
+                                        float nbest_scale, int32_t num_paths,
+                                        float temperature,
+                                        Ragged<int32_t> *paths,
+                                        Array1<double> *path_probs);
+
+template Array1<float> MwerLossBackward<float>(
+    FsaVec &lattice, Ragged<int32_t> &paths, const Array1<float> &path_probs,
+    const Array1<float> &path_loss, float temperature,
+    const Array1<float> &loss_grad);
+template Array1<double> MwerLossBackward<double>(
+    FsaVec &lattice, Ragged<int32_t> &paths, const Array1<double> &path_probs,
+    const Array1<double> &path_loss, float temperature,
+    const Array1<double> &loss_grad);
+
+}  // namespace k2
@@ -0,0 +1,90 @@
+/**
+ * Copyright      2026  Xiaomi Corporation
+ *
+ * See LICENSE for clarification regarding multiple authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef K2_CSRC_MWER_LOSS_H_
+#define K2_CSRC_MWER_LOSS_H_
+
+#include "k2/csrc/array.h"
+#include "k2/csrc/fsa.h"
+#include "k2/csrc/ragged.h"
+
+namespace k2 {
+
+/*
+  Computes the Minimum Word Error Rate loss of lattices (see equation 2 of
+  https://arxiv.org/pdf/2106.02302.pdf), i.e. what MWERLoss in
+  k2/python/k2/mwer_loss.py computes with Nbest objects, in one call:
+  it samples paths with SampleUniquePaths(), computes their levenshtein
+  distances to the references with LevenshteinDistance() and their
+  posteriors, normalized over the unique paths of each lattice.
+
+    @param [in] lattice  The lattices, with 3 axes [utt][state][arc].  Must
+                     be top-sorted and acyclic.
+    @param [in] aux_labels  The aux-labels (word IDs) of the arcs of
+                     `lattice`, with 2 axes [arc][word];
+                     `aux_labels.Dim0() == lattice.NumElements()`.
+    @param [in] ref_texts  The reference word IDs, with 2 axes [utt][word];
+                     `ref_texts.Dim0() == lattice.Dim0()`.
+    @param [in] nbest_scale  The lattice scores are scaled by this for
+                     sampling paths (only).
+    @param [in] num_paths  The number of paths to sample from each lattice.
+    @param [in] temperature  The path scores are divided by this before
+                     the normalization.
+    @param [out] paths  Will be set to the unique paths that were kept,
+                     with 3 axes [utt][path][arc], containing arc-indexes
+                     (idx012) into `lattice`.  Needed by MwerLossBackward().
+    @param [out] path_probs  Will be set to the normalized posterior of each
+                     path in `paths`, with `path_probs->Dim() ==
+                     paths->TotSize(1)`.  Needed by MwerLossBackward().
+
+    @return  Returns the loss of each path, i.e. its posterior times its
+             levenshtein distance, with 2 axes [utt][path] (the shape of the
+             first 2 axes of `paths`).  The loss of an utterance is the sum
+             of the loss of its paths.
+ */
+template <typename FloatType>
+Ragged<FloatType> MwerLoss(FsaVec &lattice, Ragged<int32_t> &aux_labels,
+                           Ragged<int32_t> &ref_texts, float nbest_scale,
+                           int32_t num_paths, float temperature,
+                           Ragged<int32_t> *paths,
+                           Array1<FloatType> *path_probs);
+
+/*
+  Computes the derivatives of a function of the per-path loss output by
+  MwerLoss() w.r.t. the arc scores of the lattice.
+
+    @param [in] lattice  The lattice given to MwerLoss().
+    @param [in] paths  The `paths` output by MwerLoss().
+    @param [in] path_probs  The `path_probs` output by MwerLoss().
+    @param [in] path_loss  The values of the loss returned by MwerLoss().
+    @param [in] temperature  The temperature given to MwerLoss().
+    @param [in] loss_grad  The derivative of the function w.r.t. the loss of
+                     each path, e.g. all ones for the sum of the loss.
+    @return  Returns the derivatives w.r.t. the scores of the arcs of
+             `lattice`, with `ans.Dim() == lattice.NumElements()`.
+ */
+template <typename FloatType>
+Array1<FloatType> MwerLossBackward(FsaVec &lattice, Ragged<int32_t> &paths,
+                                   const Array1<FloatType> &path_probs,
+                                   const Array1<FloatType> &path_loss,
+                                   float temperature,
+                                   const Array1<FloatType> &loss_grad);
+
+}  // namespace k2
+
+#endif  // K2_CSRC_MWER_LOSS_H_
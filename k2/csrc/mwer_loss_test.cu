@@ -0,0 +1,113 @@
+/**
+ * Copyright      2026  Xiaomi Corporation
+ *
+ * See LICENSE for clarification regarding multiple authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <cmath>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "k2/csrc/array_ops.h"
+#include "k2/csrc/fsa_utils.h"
+#include "k2/csrc/mwer_loss.h"
+#include "k2/csrc/test_utils.h"
+
+namespace k2 {
+
+template <typename FloatType>
+static FloatType TotLoss(FsaVec &lattice, Ragged<int32_t> &aux_labels,
+                         Ragged<int32_t> &ref_texts, float temperature) {
+  Ragged<int32_t> paths;
+  Array1<FloatType> path_probs;
+  Ragged<FloatType> loss =
+      MwerLoss<FloatType>(lattice, aux_labels, ref_texts, 1.0, 100,
+                          temperature, &paths, &path_probs);
+  return Sum(loss.values);
+}
+
+template <typename FloatType>
+static void TestMwerLoss() {
+  // fsa1 has the word sequences [10] and [20]; fsa2 has [5 6], [5], [6]
+  // and [].
+  std::string s1 = R"(0 1 1 0
+    0 1 2 -1
+    1 2 -1 0
+    2
+  )";
+  std::string s2 = R"(0 1 1 -0.5
+    0 1 2 0
+    1 2 3 -1
+    1 2 4 0
+    2 3 -1 0
+    3
+  )";
+  Fsa fsa1 = FsaFromString(s1), fsa2 = FsaFromString(s2);
+  Fsa *fsa_array[] = {&fsa1, &fsa2};
+  FsaVec lattice_cpu = CreateFsaVec(2, &fsa_array[0]);
+  Ragged<int32_t> aux_labels_cpu(
+      "[ [10] [20] [-1] [5] [0] [6] [0] [-1] ]"),
+      ref_texts_cpu("[ [10] [5 6] ]");
+  float temperature = 2.0;
+
+  for (auto &c : {GetCpuContext(), GetCudaContext()}) {
+    FsaVec lattice = lattice_cpu.To(c);
+    Ragged<int32_t> aux_labels = aux_labels_cpu.To(c),
+                    ref_texts = ref_texts_cpu.To(c);
+    Ragged<int32_t> paths;
+    Array1<FloatType> path_probs;
+    Ragged<FloatType> loss =
+        MwerLoss<FloatType>(lattice, aux_labels, ref_texts, 1.0, 100,
+                            temperature, &paths, &path_probs);
+    EXPECT_EQ(paths.TotSize(1), 6);
+    // fsa1: the posteriors of [10] and [20] are those of scores 0 and -0.5
+    // (-1 / temperature), and only [20] is an error.
+    FloatType p20 = 1 / (1 + std::exp(0.5));
+    Array1<FloatType> utt_loss(c, 2);
+    SumPerSublist<FloatType>(loss, 0, &utt_loss);
+    utt_loss = utt_loss.To(GetCpuContext());
+    EXPECT_NEAR(utt_loss[0], p20, 1e-5);
+
+    Array1<FloatType> loss_grad(c, loss.NumElements(), 1);
+    Array1<FloatType> arc_grad =
+        MwerLossBackward<FloatType>(lattice, paths, path_probs, loss.values,
+                                    temperature, loss_grad)
+            .To(GetCpuContext());
+
+    // Compare with the numerical derivatives.
+    FsaVec perturbed = lattice_cpu.Clone();
+    FloatType eps = 1e-2;
+    for (int32_t i = 0; i < lattice_cpu.NumElements(); ++i) {
+      perturbed.values.Data()[i].score += eps;
+      FsaVec perturbed_c = perturbed.To(c);
+      FloatType plus = TotLoss<FloatType>(perturbed_c, aux_labels, ref_texts,
+                                          temperature);
+      perturbed.values.Data()[i].score -= 2 * eps;
+      perturbed_c = perturbed.To(c);
+      FloatType minus = TotLoss<FloatType>(perturbed_c, aux_labels,
+                                           ref_texts, temperature);
+      perturbed.values.Data()[i].score += eps;
+      EXPECT_NEAR(arc_grad[i], (plus - minus) / (2 * eps), 1e-3);
+    }
+  }
+}
+
+TEST(MwerLoss, Simple) {
+  TestMwerLoss<float>();
+  TestMwerLoss<double>();
+}
+
+}  // namespace k2
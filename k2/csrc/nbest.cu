@@ -20,10 +20,15 @@
 #include <algorithm>
 #include <vector>
 
+#include "k2/csrc/array_ops.h"
+#include "k2/csrc/hash.h"
+#include "k2/csrc/macros.h"
+#include "k2/csrc/math.h"
 #include "k2/csrc/nbest.h"
+#include "k2/csrc/ragged_ops.h"
 
-// This is not really a CUDA file but for build-system reasons I'm currently
-// leaving it with the .cu extension.
+// Most of this is CPU code; only the batched CreateSuffixArray() and
+// CreateLcpArray() and GetBestMatchingStatsDevice() run on GPU.
 
 namespace k2 {
 
@@ -392,6 +397,347 @@ void FindTightestNonemptyIntervals(int16_t seq_len,
                                    Array1<int16_t> *counts_exclusive_sum,
                                    Array1<int16_t> *leaf_parent_intervals);
 
+Ragged<int32_t> CreateSuffixArray(Ragged<int32_t> &text) {
+  NVTX_RANGE(K2_FUNC);
+  K2_CHECK_EQ(text.NumAxes(), 2);
+  ContextPtr &c = text.Context();
+  int32_t num_elements = text.NumElements();
+  Array1<int32_t> suffix_array(c, num_elements);
+  if (num_elements == 0) return Ragged<int32_t>(text.shape, suffix_array);
+
+  const int32_t *row_ids1_data = text.RowIds(1).Data(),
+                *row_splits1_data = text.RowSplits(1).Data();
+  // rank[i] is the rank (starting from 1) of the suffix starting at i (an
+  // idx01) among the suffixes of its sequence, when compared on their first
+  // `k` symbols.  For k == 1 we can use the symbols themselves.
+  Array1<int32_t> rank = text.values.Clone();
+  int32_t *rank_data = rank.Data();
+  for (int32_t k = 1;; k *= 2) {
+    // Sort on the first 2k symbols, i.e. on (rank[i], rank[i + k]), where a
+    // suffix shorter than k + 1 has 0 as the second rank.
+    Array1<int64_t> keys(c, num_elements);
+    int64_t *keys_data = keys.Data();
+    K2_EVAL(
+        c, num_elements, lambda_set_keys, (int32_t i)->void {
+          int32_t end = row_splits1_data[row_ids1_data[i] + 1];
+          int64_t second = (i + k < end ? rank_data[i + k] : 0);
+          keys_data[i] = (static_cast<int64_t>(rank_data[i]) << 32) | second;
+        });
+    Ragged<int64_t> sorted_keys(text.shape, keys);
+    Array1<int32_t> order(c, num_elements);
+    SortSublists<int64_t, LessThan<int64_t>>(&sorted_keys, &order);
+
+    // is_new[i] is 1 if the i'th sorted key differs from the one before it
+    // in its sequence; its exclusive-sum gives the new ranks.
+    Array1<int32_t> is_new(c, num_elements + 1);
+    int32_t *is_new_data = is_new.Data();
+    const int64_t *sorted_keys_data = sorted_keys.values.Data();
+    K2_EVAL(
+        c, num_elements + 1, lambda_set_is_new, (int32_t i)->void {
+          if (i == num_elements) {
+            is_new_data[i] = 0;
+            return;
+          }
+          int32_t begin = row_splits1_data[row_ids1_data[i]];
+          is_new_data[i] = (i == begin ||
+                            sorted_keys_data[i] != sorted_keys_data[i - 1]);
+        });
+    ExclusiveSum(is_new, &is_new);
+    const int32_t *order_data = order.Data();
+    K2_EVAL(
+        c, num_elements, lambda_set_rank, (int32_t i)->void {
+          int32_t begin = row_splits1_data[row_ids1_data[i]];
+          rank_data[order_data[i]] = is_new_data[i + 1] - is_new_data[begin];
+        });
+    // All suffixes are distinct (the termination symbol sees to that), so we
+    // are done when all ranks are.
+    if (is_new.Back() == num_elements) {
+      int32_t *suffix_array_data = suffix_array.Data();
+      K2_EVAL(
+          c, num_elements, lambda_set_suffix_array, (int32_t i)->void {
+            suffix_array_data[i] =
+                order_data[i] - row_splits1_data[row_ids1_data[i]];
+          });
+      break;
+    }
+  }
+  return Ragged<int32_t>(text.shape, suffix_array);
+}
+
+Ragged<int32_t> CreateLcpArray(Ragged<int32_t> &text,
+                               Ragged<int32_t> &suffix_array) {
+  NVTX_RANGE(K2_FUNC);
+  K2_CHECK_EQ(text.NumAxes(), 2);
+  K2_CHECK(Equal(text.shape, suffix_array.shape));
+  ContextPtr &c = text.Context();
+  int32_t num_elements = text.NumElements();
+  Array1<int32_t> lcp(c, num_elements);
+  int32_t *lcp_data = lcp.Data();
+  const int32_t *text_data = text.values.Data(),
+                *suffix_array_data = suffix_array.values.Data(),
+                *row_ids1_data = text.RowIds(1).Data(),
+                *row_splits1_data = text.RowSplits(1).Data();
+  K2_EVAL(
+      c, num_elements, lambda_set_lcp, (int32_t i)->void {
+        int32_t seq = row_ids1_data[i], begin = row_splits1_data[seq],
+                end = row_splits1_data[seq + 1];
+        if (i == begin) {
+          lcp_data[i] = 0;
+          return;
+        }
+        int32_t a = begin + suffix_array_data[i - 1],
+                b = begin + suffix_array_data[i], len = 0;
+        while (a + len < end && b + len < end &&
+               text_data[a + len] == text_data[b + len])
+          ++len;
+        lcp_data[i] = len;
+      });
+  return Ragged<int32_t>(text.shape, lcp);
+}
+
+/*
+  Returns the minimum of lcp[begin..last] (note: `last` is included), where
+  min_lcp[j][i] is the minimum of lcp[i..i + 2^j - 1].  Requires
+  begin <= last.
+ */
+static __host__ __device__ __forceinline__ int32_t LcpRangeMin(
+    int32_t **min_lcp, int32_t begin, int32_t last) {
+  int32_t j = 0;
+  while ((2 << j) <= last - begin + 1) ++j;
+  return min(min_lcp[j][begin], min_lcp[j][last - (1 << j) + 1]);
+}
+
+/*
+  Implementation of GetBestMatchingStats() for GPU; see its documentation in
+  nbest.h.  `tokens` must have 3 axes.  All collections are processed at once.
+
+  Instead of building the tree of lcp-intervals and walking up it as
+  FindTightestNonemptyIntervals() does, which is sequential, for each suffix
+  we directly find the lcp-value of the tightest enclosing nonempty interval
+  and then its boundaries, using range-minimum queries on the LCP array:
+    - for a key, it is the parent interval of the leaf, whose lcp-value is the
+      larger of the LCPs with its two neighbours in the suffix array;
+    - for a query, it is the larger of the LCPs with the nearest keys on
+      either side in the suffix array (0, meaning the root, if none).
+  The interval is then the maximal range around the suffix over which the LCP
+  array is >= that value.
+ */
+static void GetBestMatchingStatsDevice(Ragged<int32_t> &tokens,
+                                       Array1<float> &scores,
+                                       Array1<int32_t> &counts,
+                                       int32_t eos,
+                                       int32_t min_token,
+                                       int32_t max_token,
+                                       int32_t max_order,
+                                       Array1<float> *mean,
+                                       Array1<float> *var,
+                                       Array1<int32_t> *counts_out,
+                                       Array1<int32_t> *ngram_order) {
+  NVTX_RANGE(K2_FUNC);
+  K2_CHECK_EQ(tokens.NumAxes(), 3);
+  ContextPtr &c = tokens.Context();
+  int32_t num_collections = tokens.Dim0(),
+          num_elements = tokens.NumElements();
+  if (num_elements == 0) return;
+
+  // As in GetBestMatchingStatsInternal(), the text of each collection is its
+  // tokens in reverse order followed by eos and a termination symbol.
+  // elem_splits and text_splits are the row-splits of the tokens and the
+  // texts of the collections.
+  Array1<int32_t> elem_splits(c, num_collections + 1),
+      text_splits(c, num_collections + 1);
+  int32_t *elem_splits_data = elem_splits.Data(),
+          *text_splits_data = text_splits.Data();
+  const int32_t *tokens_row_splits1_data = tokens.RowSplits(1).Data(),
+                *tokens_row_ids1_data = tokens.RowIds(1).Data(),
+                *tokens_row_splits2_data = tokens.RowSplits(2).Data(),
+                *tokens_row_ids2_data = tokens.RowIds(2).Data();
+  K2_EVAL(
+      c, num_collections + 1, lambda_set_splits, (int32_t i)->void {
+        int32_t elem_split =
+            tokens_row_splits2_data[tokens_row_splits1_data[i]];
+        elem_splits_data[i] = elem_split;
+        text_splits_data[i] = elem_split + 2 * i;
+      });
+  int32_t text_len = num_elements + 2 * num_collections;
+  RaggedShape text_shape = RaggedShape2(&text_splits, nullptr, text_len);
+  const int32_t *text_row_ids1_data = text_shape.RowIds(1).Data();
+
+  int32_t offset = 1 - min_token, terminator = max_token + 1 + offset;
+  // orig_index[i] is the index into `tokens.values` of the i'th text
+  // position, or -1 for eos and the terminator.
+  Array1<int32_t> text(c, text_len), orig_index(c, text_len);
+  int32_t *text_data = text.Data(), *orig_index_data = orig_index.Data();
+  const int32_t *tokens_values_data = tokens.values.Data();
+  K2_EVAL(
+      c, text_len, lambda_set_text, (int32_t i)->void {
+        int32_t coll = text_row_ids1_data[i], j = i - text_splits_data[coll],
+                elem_begin = elem_splits_data[coll],
+                n = elem_splits_data[coll + 1] - elem_begin;
+        if (j < n) {
+          orig_index_data[i] = elem_begin + n - 1 - j;
+          text_data[i] = tokens_values_data[orig_index_data[i]] + offset;
+        } else {
+          orig_index_data[i] = -1;
+          text_data[i] = (j == n ? eos + offset : terminator);
+        }
+      });
+  Ragged<int32_t> text_ragged(text_shape, text);
+  Ragged<int32_t> suffix_array = CreateSuffixArray(text_ragged);
+  Ragged<int32_t> lcp = CreateLcpArray(text_ragged, suffix_array);
+  const int32_t *suffix_array_data = suffix_array.values.Data(),
+                *lcp_data = lcp.values.Data();
+
+  // The following are indexed by position in the suffix arrays (plus one
+  // extra element for ExclusiveSum()), like reorder_counts etc. in
+  // GetBestMatchingStatsInternal(); is_key is 1 for keys.  inv_suffix_array
+  // maps text positions to positions in the suffix arrays.
+  Array1<int32_t> reorder_counts(c, text_len + 1), is_key(c, text_len + 1),
+      inv_suffix_array(c, text_len);
+  Array1<float> reorder_scores(c, text_len + 1);
+  Array1<double> reorder_scores_square(c, text_len + 1);
+  int32_t *reorder_counts_data = reorder_counts.Data(),
+          *is_key_data = is_key.Data(),
+          *inv_suffix_array_data = inv_suffix_array.Data();
+  float *reorder_scores_data = reorder_scores.Data();
+  double *reorder_scores_square_data = reorder_scores_square.Data();
+  const int32_t *counts_data = counts.Data();
+  const float *scores_data = scores.Data();
+  K2_EVAL(
+      c, text_len + 1, lambda_reorder, (int32_t i)->void {
+        int32_t index = -1;
+        if (i < text_len) {
+          int32_t pos =
+              text_splits_data[text_row_ids1_data[i]] + suffix_array_data[i];
+          inv_suffix_array_data[pos] = i;
+          index = orig_index_data[pos];
+        }
+        int32_t count = (index < 0 ? 0 : counts_data[index]);
+        float score = (index < 0 ? 0 : scores_data[index]);
+        reorder_counts_data[i] = count;
+        is_key_data[i] = (count != 0);
+        reorder_scores_data[i] = score;
+        reorder_scores_square_data[i] = score * score;
+      });
+  ExclusiveSum(reorder_counts, &reorder_counts);
+  ExclusiveSum(is_key, &is_key);
+  ExclusiveSum(reorder_scores, &reorder_scores);
+  ExclusiveSum(reorder_scores_square, &reorder_scores_square);
+  // key_positions lists the positions of the keys in the suffix arrays;
+  // is_key, now exclusive-summed, indexes it.
+  Array1<int32_t> key_positions(c, is_key.Back());
+  int32_t *key_positions_data = key_positions.Data();
+  K2_EVAL(
+      c, text_len, lambda_set_key_positions, (int32_t i)->void {
+        if (is_key_data[i + 1] != is_key_data[i])
+          key_positions_data[is_key_data[i]] = i;
+      });
+
+  // min_lcp[j][i] is the minimum of lcp[i..i + 2^j - 1], for
+  // i + 2^j <= text_len.
+  std::vector<Array1<int32_t>> min_lcp(1, lcp.values);
+  for (int32_t j = 1; (1 << j) <= text_len; ++j) {
+    int32_t half = 1 << (j - 1), dim = text_len - (1 << j) + 1;
+    Array1<int32_t> this_min_lcp(c, dim);
+    int32_t *this_min_lcp_data = this_min_lcp.Data();
+    const int32_t *prev_min_lcp_data = min_lcp.back().Data();
+    K2_EVAL(
+        c, dim, lambda_set_min_lcp, (int32_t i)->void {
+          this_min_lcp_data[i] =
+              min(prev_min_lcp_data[i], prev_min_lcp_data[i + half]);
+        });
+    min_lcp.push_back(this_min_lcp);
+  }
+  int32_t num_levels = static_cast<int32_t>(min_lcp.size());
+  Array1<int32_t *> min_lcp_ptrs(GetCpuContext(), num_levels);
+  for (int32_t j = 0; j < num_levels; ++j)
+    min_lcp_ptrs.Data()[j] = min_lcp[j].Data();
+  min_lcp_ptrs = min_lcp_ptrs.To(c);
+  int32_t **min_lcp_ptrs_data = min_lcp_ptrs.Data();
+
+  float *mean_data = mean->Data(), *var_data = var->Data();
+  int32_t *counts_out_data = counts_out->Data(),
+          *ngram_order_data = ngram_order->Data();
+  K2_EVAL(
+      c, num_elements, lambda_set_stats, (int32_t i)->void {
+        int32_t sentence = tokens_row_ids2_data[i],
+                coll = tokens_row_ids1_data[sentence],
+                dist_to_begin = i - tokens_row_splits2_data[sentence] + 1,
+                elem_begin = elem_splits_data[coll],
+                n = elem_splits_data[coll + 1] - elem_begin,
+                begin = text_splits_data[coll],
+                end = text_splits_data[coll + 1],
+                p = inv_suffix_array_data[begin + n - 1 - (i - elem_begin)];
+
+        if (is_key_data[end] == is_key_data[begin]) {
+          // No keys in this collection.
+          mean_data[i] = 0;
+          var_data[i] = 0;
+          counts_out_data[i] = 0;
+          ngram_order_data[i] = 0;
+          return;
+        }
+        // `lcp_value` is the lcp-value of the tightest nonempty interval.
+        int32_t lcp_value = 0;
+        if (is_key_data[p + 1] != is_key_data[p]) {
+          lcp_value = lcp_data[p];
+          if (p + 1 < end) lcp_value = max(lcp_value, lcp_data[p + 1]);
+        } else {
+          int32_t num_keys_before = is_key_data[p];
+          if (num_keys_before > is_key_data[begin]) {
+            int32_t k = key_positions_data[num_keys_before - 1];
+            lcp_value = LcpRangeMin(min_lcp_ptrs_data, k + 1, p);
+          }
+          if (num_keys_before < is_key_data[end]) {
+            int32_t k = key_positions_data[num_keys_before];
+            lcp_value =
+                max(lcp_value, LcpRangeMin(min_lcp_ptrs_data, p + 1, k));
+          }
+        }
+        // The interval is [lb, rb]: lcp[lb + 1 .. rb] are >= lcp_value.
+        int32_t lb = begin, rb = end - 1;
+        if (lcp_value > 0) {
+          lb = p;
+          rb = p + 1;
+          for (int32_t j = num_levels - 1; j >= 0; --j) {
+            int32_t len = 1 << j;
+            if (lb - len + 1 >= 0 &&
+                min_lcp_ptrs_data[j][lb - len + 1] >= lcp_value)
+              lb -= len;
+            if (rb + len <= text_len && min_lcp_ptrs_data[j][rb] >= lcp_value)
+              rb += len;
+          }
+          rb = min(rb, end) - 1;
+        }
+        float scores_sum =
+            reorder_scores_data[rb + 1] - reorder_scores_data[lb];
+        double scores_square_sum = reorder_scores_square_data[rb + 1] -
+                                   reorder_scores_square_data[lb];
+        int32_t counts_out_interval =
+            reorder_counts_data[rb + 1] - reorder_counts_data[lb];
+        if (lcp_value == 0) {  // tightest interval is root interval
+          counts_out_data[i] = 0;
+          ngram_order_data[i] = 0;
+        } else {
+          counts_out_data[i] = counts_out_interval;
+          ngram_order_data[i] =
+              (dist_to_begin <= lcp_value ? max_order
+                                          : min(lcp_value, max_order));
+        }
+        float this_mean = counts_out_interval == 0
+                              ? 0
+                              : (scores_sum / counts_out_interval);
+        mean_data[i] = this_mean;
+        if (counts_out_interval == 0 || counts_out_interval == 1) {
+          var_data[i] = 0;
+        } else {
+          double numerator = scores_square_sum - 2 * this_mean * scores_sum +
+                             counts_out_interval * this_mean * this_mean;
+          var_data[i] = numerator / counts_out_interval;
+        }
+      });
+}
+
 // Internal implementation of GetBestMatchingStats(), that handles the case
 // where tokens.NumAxes() == 2 and tokens.NumElements() > 0.  It will
 // be instantiated with int16_t if the size of the problem permits, and
@@ -602,7 +948,6 @@ void GetBestMatchingStats(Ragged<int32_t> &tokens,
                           Array1<int32_t> *counts_out,
                           Array1<int32_t> *ngram_order) {
   ContextPtr &c = tokens.Context();
-  K2_CHECK_EQ(c->GetDeviceType(), kCpu);
 
   int32_t num_elements = tokens.NumElements();
   K2_CHECK(mean);
@@ -635,6 +980,16 @@ void GetBestMatchingStats(Ragged<int32_t> &tokens,
   K2_CHECK_EQ(num_elements, scores.Dim());
   K2_CHECK_EQ(num_elements, counts.Dim());
 
+  if (c->GetDeviceType() != kCpu) {
+    K2_CHECK(tokens.NumAxes() == 2 || tokens.NumAxes() == 3);
+    Ragged<int32_t> tokens3 =
+        (tokens.NumAxes() == 3 ? tokens : Unsqueeze(tokens, 0));
+    GetBestMatchingStatsDevice(tokens3, scores, counts, eos, min_token,
+                               max_token, max_order, mean, var, counts_out,
+                               ngram_order);
+    return;
+  }
+
   if (tokens.NumAxes() == 3) {
     int32_t num_collections = tokens.Dim0();
     for (int32_t i = 0; i < num_collections; i++) {
@@ -670,4 +1025,117 @@ void GetBestMatchingStats(Ragged<int32_t> &tokens,
   }
 }
 
+Ragged<int32_t> BuildPrefixTrie(Ragged<int32_t> &paths,
+                                Array1<int32_t> *parents,
+                                Array1<int32_t> *node_to_path) {
+  NVTX_RANGE(K2_FUNC);
+  K2_CHECK(parents != nullptr);
+  K2_CHECK(node_to_path != nullptr);
+  if (paths.NumAxes() == 2) {
+    Ragged<int32_t> temp = Unsqueeze(paths, 0);
+    return BuildPrefixTrie(temp, parents, node_to_path).RemoveAxis(0);
+  }
+  K2_CHECK_EQ(paths.NumAxes(), 3);
+  ContextPtr &c = paths.Context();
+  int32_t num_utts = paths.Dim0(), num_paths = paths.TotSize(1),
+          num_tokens = paths.NumElements();
+  const int32_t *utts_data = paths.RowIds(1).Data(),
+                *row_splits2_data = paths.RowSplits(2).Data(),
+                *tokens_data = paths.values.Data();
+
+  Array1<int32_t> nodes(c, num_tokens);
+  *parents = Array1<int32_t>(c, num_tokens);
+  *node_to_path = Array1<int32_t>(c, num_tokens);
+  int32_t *nodes_data = nodes.Data(), *parents_data = parents->Data(),
+          *node_to_path_data = node_to_path->Data();
+
+  // The key of a node is (parent, token), with the parent encoded as the
+  // utterance for the root and as num_utts + node otherwise, so keys of
+  // different depths and utterances never collide.  There is at most one
+  // node per token.
+  Hash64 hash(c, std::max<int32_t>(
+                     128, RoundUpToNearestPowerOfTwo(2 * num_tokens)));
+  auto acc = hash.GetAccessor();
+
+  // `active` contains the paths that have more than `depth` tokens.
+  Renumbering renumber_active(c, num_paths);
+  char *keep_data = renumber_active.Keep().Data();
+  K2_EVAL(
+      c, num_paths, lambda_set_keep_nonempty, (int32_t p)->void {
+        keep_data[p] = (row_splits2_data[p + 1] > row_splits2_data[p]);
+      });
+  Array1<int32_t> active = renumber_active.New2Old();
+  // slot[p] is the position of path p in `active`; neg_first[p], for a path
+  // p that got its key into the hash first, is minus the lowest-numbered
+  // path with the same key (using AtomicMax()).
+  Array1<int32_t> slot(c, num_paths), neg_first(c, num_paths);
+  int32_t *slot_data = slot.Data(), *neg_first_data = neg_first.Data();
+  int32_t num_nodes = 0;
+  for (int32_t depth = 0; active.Dim() != 0; ++depth) {
+    int32_t num_active = active.Dim();
+    const int32_t *active_data = active.Data();
+    Array1<uint64_t> keys(c, num_active);
+    uint64_t *keys_data = keys.Data();
+    K2_EVAL(
+        c, num_active, lambda_insert, (int32_t i)->void {
+          int32_t p = active_data[i], pos = row_splits2_data[p] + depth;
+          uint64_t parent = (depth == 0 ? utts_data[p]
+                                        : num_utts + nodes_data[pos - 1]),
+                   key = (parent << 32) |
+                         static_cast<uint32_t>(tokens_data[pos]);
+          acc.Insert(key, p);
+          keys_data[i] = key;
+          slot_data[p] = i;
+          neg_first_data[p] = -p;
+        });
+    // winner[i] is the path whose value is in the hash for the key of
+    // active[i].  Which path that is depends on scheduling, so we use the
+    // lowest-numbered one with that key instead.
+    Array1<int32_t> winner(c, num_active);
+    int32_t *winner_data = winner.Data();
+    K2_EVAL(
+        c, num_active, lambda_set_first, (int32_t i)->void {
+          // active[i] itself inserted this key, so it is always found.
+          uint64_t value = active_data[i];
+          bool found = acc.Find(keys_data[i], &value);
+          K2_DCHECK(found);
+          winner_data[i] = static_cast<int32_t>(value);
+          AtomicMax(neg_first_data + winner_data[i], -active_data[i]);
+        });
+    Renumbering renumber_new_nodes(c, num_active);
+    char *is_new_data = renumber_new_nodes.Keep().Data();
+    K2_EVAL(
+        c, num_active, lambda_set_is_new, (int32_t i)->void {
+          is_new_data[i] = (-neg_first_data[winner_data[i]] == active_data[i]);
+        });
+    const int32_t *old2new_data = renumber_new_nodes.Old2New().Data();
+    K2_EVAL(
+        c, num_active, lambda_set_nodes, (int32_t i)->void {
+          int32_t p = active_data[i], pos = row_splits2_data[p] + depth,
+                  first = -neg_first_data[winner_data[i]],
+                  node = num_nodes + old2new_data[slot_data[first]];
+          nodes_data[pos] = node;
+          if (first == p) {
+            parents_data[node] = (depth == 0 ? -1 : nodes_data[pos - 1]);
+            node_to_path_data[node] = p;
+          }
+        });
+    num_nodes += renumber_new_nodes.NumNewElems();
+
+    Renumbering renumber_next(c, num_active);
+    char *keep_next_data = renumber_next.Keep().Data();
+    K2_EVAL(
+        c, num_active, lambda_set_keep_next, (int32_t i)->void {
+          int32_t p = active_data[i];
+          keep_next_data[i] =
+              (row_splits2_data[p + 1] - row_splits2_data[p] > depth + 1);
+        });
+    active = active[renumber_next.New2Old()];
+  }
+  hash.Destroy();
+  *parents = parents->Arange(0, num_nodes);
+  *node_to_path = node_to_path->Arange(0, num_nodes);
+  return Ragged<int32_t>(paths.shape, nodes);
+}
+
 }  // namespace k2
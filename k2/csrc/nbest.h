@@ -116,6 +116,41 @@ void CreateLcpArray(const T *text_array,
                     T seq_len,
                     T *lcp_array);
 
+/*
+  Creates the suffix arrays of a batch of sequences; unlike the version of
+  CreateSuffixArray() above, this works on any device.  It uses prefix
+  doubling: the suffixes are sorted by their first 2, 4, 8, ... symbols, each
+  round being a segmented sort of pairs of ranks from the previous round,
+  until all ranks within each sequence are distinct.  That is O(n log n) work
+  per round, which is more than the CPU version does, but it parallelizes.
+
+    @param [in] text  A ragged array with 2 axes [seq][symbol].  The symbols
+           must be positive, and the last symbol of each nonempty sequence
+           must be a termination symbol ($) larger than its other symbols.
+           No terminating zeros are needed.
+    @return  Returns an array with the same shape as `text`, whose i'th row
+           is the suffix array of the i'th sequence, i.e. a permutation of
+           [ 0, 1, ... ] giving the start positions (idx1's) of its suffixes
+           in lexicographical order.
+*/
+Ragged<int32_t> CreateSuffixArray(Ragged<int32_t> &text);
+
+/*
+  Batched version of CreateLcpArray() that works on any device.  Each entry
+  is found by comparing the two suffixes directly, so the work is
+  proportional to the sum of the LCPs; this is fine for n-best lists, whose
+  common prefixes are at most a sentence or so long.
+
+     @param [in] text  The sequences, as given to CreateSuffixArray().
+     @param [in] suffix_array  Their suffix arrays, as returned by
+                    CreateSuffixArray(text).
+     @return  Returns an array with the same shape as `text`, whose i'th row
+                    is the LCP array of the i'th sequence; see the other
+                    version of CreateLcpArray().
+*/
+Ragged<int32_t> CreateLcpArray(Ragged<int32_t> &text,
+                               Ragged<int32_t> &suffix_array);
+
 /*
    Template args: T is a signed type, intended to be int16_t or int32_t
 
@@ -247,8 +282,10 @@ void FindTightestNonemptyIntervals(T seq_len,
     sentences.  This matching process matches the word and the words preceding
     it, looking for the highest-order match it can find (it's intended for
     approximating the scores of models that see only left-context, like language
-    models).  It is an efficient implementation using suffix arrays (done on CPU
-    for now, since the implementation is not very trivial).  The intended
+    models).  It is an efficient implementation using suffix arrays.  On CPU
+    the collections are processed one by one; on GPU they are all processed
+    at once, and the suffix-tree traversal is replaced by range-minimum
+    queries on the LCP arrays, so nothing is copied to the host.  The intended
     application is in estimating the scores of hypothesized transcripts, when we
     have actually computed the scores for only a subset of the hypotheses.
 
@@ -327,5 +364,36 @@ void GetBestMatchingStats(Ragged<int32_t> &tokens,
                           Array1<float> *var,
                           Array1<int32_t> *counts_out,
                           Array1<int32_t> *ngram_order);
+
+/*
+  Builds a prefix trie of a set of token sequences, e.g. the paths of an
+  n-best list, so that a rescorer can evaluate each distinct prefix once
+  and gather the results back per path.  Each node of the trie stands for a
+  distinct nonempty prefix (of one utterance, if `paths` has 3 axes); the
+  empty prefix is an implicit root.  Nodes are numbered depth by depth, and
+  within a depth in order of the first path they appear on, so the
+  numbering does not depend on scheduling and parents[n] < n for all n.
+
+     @param [in] paths  The sequences, with 2 axes [path][token] or 3 axes
+                   [utt][path][token]; identical prefixes of different
+                   utterances are distinct nodes.
+     @param [out] parents  Will be set to an array with one element per
+                   node, giving the node of the prefix that is one token
+                   shorter, or -1 if the node is at depth 1 (i.e. a child
+                   of the root).
+     @param [out] node_to_path  Will be set to an array with one element
+                   per node, giving the first path (an idx01 if `paths`
+                   has 3 axes) that has the node's prefix.  The node's
+                   token is the token at the node's depth minus one on
+                   that path.
+     @return  Returns an array with the same shape as `paths`, whose values
+              are the nodes of the prefixes that end at each token.
+
+  The implementation inserts (parent, token) pairs into a Hash64, one depth
+  at a time, so it makes as many passes as the longest path has tokens.
+ */
+Ragged<int32_t> BuildPrefixTrie(Ragged<int32_t> &paths,
+                                Array1<int32_t> *parents,
+                                Array1<int32_t> *node_to_path);
 }  // namespace k2
 #endif  // K2_CSRC_NBEST_H_
@@ -23,13 +23,16 @@
 #include <algorithm>
 #include <cstdio>
 #include <limits>
+#include <map>
 #include <numeric>
 #include <random>
+#include <utility>
 #include <vector>
 
 #include "k2/csrc/nbest.h"
 #include "k2/csrc/ragged.h"
 #include "k2/csrc/ragged_ops.h"
+#include "k2/csrc/test_utils.h"
 
 
 namespace k2 {
@@ -123,6 +126,48 @@ TEST(AlgorithmsTest, TestCreateLcpArray) {
   }
 }
 
+TEST(AlgorithmsTest, TestSuffixArrayBatched) {
+  for (int32_t i = 0; i < 20; i++) {
+    int32_t num_seqs = RandInt(0, 10);
+    std::vector<int32_t> row_splits(1, 0), values;
+    for (int32_t s = 0; s < num_seqs; s++) {
+      int32_t len = RandInt(0, 50), max_symbol = RandInt(2, 5);
+      for (int32_t j = 0; j + 1 < len; j++)
+        values.push_back(RandInt(1, max_symbol - 1));
+      if (len > 0) values.push_back(max_symbol);  // Termination symbol
+      row_splits.push_back(static_cast<int32_t>(values.size()));
+    }
+    ContextPtr cpu = GetCpuContext();
+    Array1<int32_t> row_splits_array(cpu, row_splits);
+    Ragged<int32_t> text(RaggedShape2(&row_splits_array, nullptr, -1),
+                         Array1<int32_t>(cpu, values));
+
+    for (auto &c : {GetCpuContext(), GetCudaContext()}) {
+      Ragged<int32_t> this_text = text.To(c);
+      Ragged<int32_t> suffix_array = CreateSuffixArray(this_text);
+      Ragged<int32_t> lcp = CreateLcpArray(this_text, suffix_array);
+      suffix_array = suffix_array.To(cpu);
+      lcp = lcp.To(cpu);
+      for (int32_t s = 0; s < num_seqs; s++) {
+        int32_t begin = row_splits[s], len = row_splits[s + 1] - begin;
+        if (len == 0) continue;
+        std::vector<int32_t> seq(values.begin() + begin,
+                                 values.begin() + begin + len);
+        seq.resize(len + 3, 0);
+        std::vector<int32_t> ref_suffix_array(len), ref_lcp(len);
+        CreateSuffixArray(seq.data(), len, *std::max_element(
+            seq.begin(), seq.end()), ref_suffix_array.data());
+        CreateLcpArray(seq.data(), ref_suffix_array.data(), len,
+                       ref_lcp.data());
+        for (int32_t j = 0; j < len; j++) {
+          EXPECT_EQ(suffix_array.values[begin + j], ref_suffix_array[j]);
+          EXPECT_EQ(lcp.values[begin + j], ref_lcp[j]);
+        }
+      }
+    }
+  }
+}
+
 TEST(AlgorithmsTest, TestCreateLcpIntervalArray) {
   ContextPtr cpu = GetCpuContext();
 
@@ -441,4 +486,108 @@ TEST(AlgorithmTest, TestGetBestMatchingStatsSingleMulti) {
   K2_CHECK(Equal(ngram_order, ngram_order_ref));
 }
 
+TEST(AlgorithmTest, TestGetBestMatchingStatsDevice) {
+  // The GPU version should give the same results as the CPU one.
+  Ragged<int32_t> tokens(GetCpuContext(), "[ [ [ 4 6 7 1 8 ] [ 4 3 7 1 8 ] "
+                                          "    [ 4 3 2 1 8 ] [ 5 6 7 1 8 ] ] "
+                                          "  [ [ 5 1 4 8 ] [ 5 1 2 8 ] "
+                                          "    [ 5 3 4 8 ] ] "
+                                          "  [ [ 4 6 8 ] [ 4 6 8 ] ] ]");
+  Array1<float> scores(GetCpuContext(), "[ 1 2 3 4 5 6 7 8 9 10 "
+                                        "  0 0 0 0 0 0 0 0 0 0 "
+                                        "  1 2 3 4 5 7 8 6 0 0 0 0 "
+                                        "  1 2 3 4 5 6 ]");
+  Array1<int32_t> counts(GetCpuContext(), "[ 1 1 1 1 1 1 1 1 1 1 "
+                                          "  0 0 0 0 0 0 0 0 0 0 "
+                                          "  1 1 1 1 1 1 1 1 0 0 0 0 "
+                                          "  0 0 0 0 0 0 ]");
+  int32_t eos = 8,
+          min_token = 0,
+          max_token = 10,
+          max_order = 5;
+  for (int32_t axes = 2; axes <= 3; axes++) {
+    Ragged<int32_t> this_tokens =
+        (axes == 3 ? tokens : tokens.RemoveAxis(0));
+    Array1<float> mean, var;
+    Array1<int32_t> counts_out, ngram_order;
+    GetBestMatchingStats(this_tokens, scores, counts, eos, min_token,
+                         max_token, max_order, &mean, &var, &counts_out,
+                         &ngram_order);
+
+    ContextPtr cuda = GetCudaContext();
+    Ragged<int32_t> cuda_tokens = this_tokens.To(cuda);
+    Array1<float> cuda_scores = scores.To(cuda), cuda_mean, cuda_var;
+    Array1<int32_t> cuda_counts = counts.To(cuda), cuda_counts_out,
+                    cuda_ngram_order;
+    GetBestMatchingStats(cuda_tokens, cuda_scores, cuda_counts, eos,
+                         min_token, max_token, max_order, &cuda_mean,
+                         &cuda_var, &cuda_counts_out, &cuda_ngram_order);
+    EXPECT_TRUE(ApproxEqual(mean, cuda_mean.To(GetCpuContext()), 1e-4f));
+    EXPECT_TRUE(ApproxEqual(var, cuda_var.To(GetCpuContext()), 1e-4f));
+    EXPECT_TRUE(Equal(counts_out, cuda_counts_out.To(GetCpuContext())));
+    EXPECT_TRUE(Equal(ngram_order, cuda_ngram_order.To(GetCpuContext())));
+  }
+}
+
+TEST(AlgorithmTest, TestBuildPrefixTrie) {
+  for (auto &c : {GetCpuContext(), GetCudaContext()}) {
+    Ragged<int32_t> paths(c, "[ [ [ 1 2 3 ] [ 1 2 4 ] [ 1 5 ] [ ] ] "
+                             "  [ [ 1 2 ] [ 1 2 3 ] [ 1 2 ] ] ]");
+    Array1<int32_t> parents, node_to_path;
+    Ragged<int32_t> nodes = BuildPrefixTrie(paths, &parents, &node_to_path);
+    // Depth 1: [1]@0 [1]@1; depth 2: [1 2]@0 [1 5]@0 [1 2]@1;
+    // depth 3: [1 2 3]@0 [1 2 4]@0 [1 2 3]@1.
+    Ragged<int32_t> nodes_ref(c, "[ [ [ 0 2 5 ] [ 0 2 6 ] [ 0 3 ] [ ] ] "
+                                 "  [ [ 1 4 ] [ 1 4 7 ] [ 1 4 ] ] ]");
+    Array1<int32_t> parents_ref(c, "[ -1 -1 0 0 1 2 2 4 ]"),
+        node_to_path_ref(c, "[ 0 4 0 2 4 0 1 5 ]");
+    EXPECT_TRUE(Equal(nodes, nodes_ref));
+    EXPECT_TRUE(Equal(parents, parents_ref));
+    EXPECT_TRUE(Equal(node_to_path, node_to_path_ref));
+
+    Ragged<int32_t> paths2 = paths.RemoveAxis(0);
+    nodes = BuildPrefixTrie(paths2, &parents, &node_to_path);
+    // Without the utterance axis, [1 2] and [1 2 3] are shared.
+    nodes_ref = Ragged<int32_t>(c, "[ [ 0 1 3 ] [ 0 1 4 ] [ 0 2 ] [ ] "
+                                   "  [ 0 1 ] [ 0 1 3 ] [ 0 1 ] ]");
+    EXPECT_TRUE(Equal(nodes, nodes_ref));
+    EXPECT_TRUE(Equal(parents, Array1<int32_t>(c, "[ -1 0 0 1 1 ]")));
+    EXPECT_TRUE(Equal(node_to_path, Array1<int32_t>(c, "[ 0 0 2 0 1 ]")));
+  }
+}
+
+TEST(AlgorithmTest, TestBuildPrefixTrieRandom) {
+  for (auto &c : {GetCpuContext(), GetCudaContext()}) {
+    for (int32_t iter = 0; iter < 5; ++iter) {
+      Ragged<int32_t> paths =
+          RandomRagged<int32_t>(0, 3, 3, 3, 0, 2000).To(c);
+      Array1<int32_t> parents, node_to_path;
+      Ragged<int32_t> nodes = BuildPrefixTrie(paths, &parents, &node_to_path);
+      paths = paths.To(GetCpuContext());
+      nodes = nodes.To(GetCpuContext());
+      parents = parents.To(GetCpuContext());
+      node_to_path = node_to_path.To(GetCpuContext());
+      // Two tokens have the same node iff they end the same prefix of the
+      // same utterance.
+      std::map<std::pair<int32_t, std::vector<int32_t>>, int32_t> prefixes;
+      const int32_t *row_ids1 = paths.RowIds(1).Data(),
+                    *row_splits2 = paths.RowSplits(2).Data();
+      for (int32_t p = 0; p < paths.TotSize(1); ++p) {
+        std::vector<int32_t> prefix;
+        for (int32_t i = row_splits2[p]; i < row_splits2[p + 1]; ++i) {
+          prefix.push_back(paths.values[i]);
+          auto ret = prefixes.emplace(std::make_pair(row_ids1[p], prefix),
+                                      nodes.values[i]);
+          EXPECT_EQ(ret.first->second, nodes.values[i]);
+          int32_t node = nodes.values[i];
+          EXPECT_EQ(parents[node],
+                    i == row_splits2[p] ? -1 : nodes.values[i - 1]);
+          EXPECT_LE(node_to_path[node], p);
+        }
+      }
+      EXPECT_EQ(static_cast<int32_t>(prefixes.size()), parents.Dim());
+    }
+  }
+}
+
 }  // namespace k2
@@ -0,0 +1,663 @@
+/**
+ * Copyright      2026  Xiaomi Corporation
+ *
+ * See LICENSE for clarification regarding multiple authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "k2/csrc/array_ops.h"
+#include "k2/csrc/macros.h"
+#include "k2/csrc/math.h"
+#include "k2/csrc/ngram_lm.h"
+#include "k2/csrc/ragged_ops.h"
+
+namespace k2 {
+
+/*
+  Sets `ans` to a hash that maps (ngram_states[i] * num_symbols +
+  ngram_words[i]) to i, for NgramLm.  (Hash64 cannot be returned by value, as
+  its copy constructor is explicit.)
+ */
+static void BuildNgramHash(int32_t num_symbols,
+                           const Array1<int32_t> &ngram_states,
+                           const Array1<int32_t> &ngram_words, Hash64 *ans) {
+  NVTX_RANGE(K2_FUNC);
+  ContextPtr &c = ngram_words.Context();
+  int32_t num_ngrams = ngram_words.Dim();
+  // Keep the hash at most half full.
+  int64_t num_buckets = 128;
+  while (num_buckets < 2 * static_cast<int64_t>(num_ngrams)) num_buckets *= 2;
+  *ans = Hash64(c, num_buckets);
+
+  Hash64::Accessor ans_acc = ans->GetAccessor();
+  const int32_t *ngram_states_data = ngram_states.Data(),
+                *ngram_words_data = ngram_words.Data();
+  K2_EVAL(
+      c, num_ngrams, lambda_insert_ngrams, (int32_t i)->void {
+        uint64_t key =
+            static_cast<uint64_t>(ngram_states_data[i]) * num_symbols +
+            ngram_words_data[i];
+        bool inserted = ans_acc.Insert(key, static_cast<uint64_t>(i));
+        K2_DCHECK(inserted);  // Each n-gram must appear only once.
+      });
+}
+
+NgramLm::NgramLm(int32_t num_words, int32_t start_state,
+                 const Array1<int32_t> &backoff_states,
+                 const Array1<float> &backoff_weights,
+                 const Array1<int32_t> &ngram_states,
+                 const Array1<int32_t> &ngram_words,
+                 const Array1<int32_t> &ngram_next_states,
+                 const Array1<float> &ngram_scores)
+    : num_words_(num_words),
+      start_state_(start_state),
+      backoff_states_(backoff_states),
+      backoff_weights_(backoff_weights),
+      ngram_states_(ngram_states),
+      ngram_words_(ngram_words),
+      ngram_next_states_(ngram_next_states),
+      ngram_scores_(ngram_scores) {
+  NVTX_RANGE(K2_FUNC);
+  K2_CHECK_GT(num_words, 0);
+  K2_CHECK_GT(backoff_states.Dim(), 0);
+  K2_CHECK_EQ(backoff_weights.Dim(), backoff_states.Dim());
+  int32_t num_ngrams = ngram_scores.Dim();
+  K2_CHECK_EQ(ngram_states.Dim(), num_ngrams);
+  K2_CHECK_EQ(ngram_words.Dim(), num_ngrams);
+  K2_CHECK_EQ(ngram_next_states.Dim(), num_ngrams);
+  // Checks that the arrays are on the same device.
+  GetContext(backoff_states, backoff_weights, ngram_states, ngram_words,
+             ngram_next_states, ngram_scores);
+  BuildNgramHash(num_words + 2, ngram_states, ngram_words, &ngrams_);
+}
+
+NgramLm NgramLm::To(ContextPtr c) const {
+  return NgramLm(num_words_, start_state_, backoff_states_.To(c),
+                 backoff_weights_.To(c), ngram_states_.To(c),
+                 ngram_words_.To(c), ngram_next_states_.To(c),
+                 ngram_scores_.To(c));
+}
+
+namespace {
+
+// The key of the history given by the `n` words starting at `words` in
+// ReadArpa().
+std::string HistoryKey(const int32_t *words, int32_t n) {
+  return std::string(reinterpret_cast<const char *>(words),
+                     n * sizeof(int32_t));
+}
+
+struct ArpaNgram {
+  std::vector<int32_t> words;
+  float score;    // natural-log prob
+  float backoff;  // natural-log backoff weight, 0 if not present
+};
+
+}  // namespace
+
+NgramLm ReadArpa(ContextPtr c, std::istream &is,
+                 const std::unordered_map<std::string, int32_t> &word2id) {
+  NVTX_RANGE(K2_FUNC);
+  int32_t num_words = 1;
+  for (const auto &p : word2id) {
+    K2_CHECK_GE(p.second, 0) << "Word ids must be >= 0: " << p.first;
+    num_words = std::max(num_words, p.second + 1);
+  }
+  const int32_t bos = num_words, eos = num_words + 1;
+  const float kLn10 = std::log(10.0f);
+
+  // ngrams[k - 1] contains the n-grams of order k.
+  std::vector<std::vector<ArpaNgram>> ngrams;
+  int32_t order = 0,  // Order of the current section; 0 in the header.
+      num_skipped = 0;
+  std::string line;
+  while (std::getline(is, line)) {
+    std::istringstream iss(line);
+    std::string first;
+    if (!(iss >> first)) continue;  // empty line
+    if (first[0] == '\\') {
+      if (first == "\\end\\") break;
+      if (first == "\\data\\") continue;
+      // "\<order>-grams:"
+      order = atoi(first.c_str() + 1);
+      K2_CHECK_GT(order, 0) << "Bad line in ARPA file: " << line;
+      if (static_cast<int32_t>(ngrams.size()) < order) ngrams.resize(order);
+      continue;
+    }
+    if (order == 0) continue;  // "ngram <order>=<count>" in the header
+
+    ArpaNgram ngram;
+    ngram.score = std::stof(first) * kLn10;
+    ngram.words.resize(order);
+    bool skip = false;
+    for (int32_t k = 0; k < order; ++k) {
+      std::string word;
+      K2_CHECK(iss >> word) << "Bad line in ARPA file: " << line;
+      if (word == "<s>") {
+        ngram.words[k] = bos;
+      } else if (word == "</s>") {
+        ngram.words[k] = eos;
+      } else {
+        auto iter = word2id.find(word);
+        if (iter == word2id.end() || iter->second == 0)
+          skip = true;
+        else
+          ngram.words[k] = iter->second;
+      }
+    }
+    float backoff = 0;
+    if (!(iss >> backoff)) backoff = 0;
+    ngram.backoff = backoff * kLn10;
+    if (skip)
+      ++num_skipped;
+    else
+      ngrams[order - 1].push_back(std::move(ngram));
+  }
+  int32_t max_order = static_cast<int32_t>(ngrams.size());
+  K2_CHECK_GT(max_order, 0) << "No n-grams found in the ARPA file";
+  if (num_skipped != 0)
+    K2_LOG(WARNING) << "Skipped " << num_skipped
+                    << " n-grams with words that are not in the words table";
+
+  // Each n-gram of order < max_order is a history state; state 0 is the
+  // empty history.
+  std::unordered_map<std::string, int32_t> history2state;
+  std::vector<float> backoff_weights(1, 0.0f);
+  for (int32_t k = 1; k < max_order; ++k) {
+    for (const ArpaNgram &ngram : ngrams[k - 1]) {
+      int32_t state = static_cast<int32_t>(backoff_weights.size());
+      history2state[HistoryKey(ngram.words.data(), k)] = state;
+      backoff_weights.push_back(ngram.backoff);
+    }
+  }
+  // Returns the state of the longest suffix of the `n` words at `words`
+  // that is a history.
+  auto longest_suffix_state = [&history2state](const int32_t *words,
+                                               int32_t n) -> int32_t {
+    for (int32_t j = 0; j < n; ++j) {
+      auto iter = history2state.find(HistoryKey(words + j, n - j));
+      if (iter != history2state.end()) return iter->second;
+    }
+    return 0;
+  };
+
+  std::vector<int32_t> backoff_states(backoff_weights.size(), 0);
+  for (int32_t k = 1; k < max_order; ++k) {
+    for (const ArpaNgram &ngram : ngrams[k - 1]) {
+      const int32_t *words = ngram.words.data();
+      backoff_states[history2state[HistoryKey(words, k)]] =
+          longest_suffix_state(words + 1, k - 1);
+    }
+  }
+
+  std::vector<int32_t> ngram_states, ngram_words, ngram_next_states;
+  std::vector<float> ngram_scores;
+  for (int32_t k = 1; k <= max_order; ++k) {
+    for (const ArpaNgram &ngram : ngrams[k - 1]) {
+      const int32_t *words = ngram.words.data();
+      int32_t word = words[k - 1];
+      if (word == bos) continue;  // "<s>" is only used as a history.
+      int32_t state = 0;
+      if (k > 1) {
+        auto iter = history2state.find(HistoryKey(words, k - 1));
+        if (iter == history2state.end()) continue;  // bad LM; ignore it.
+        state = iter->second;
+      }
+      int32_t m = std::min(k, max_order - 1),
+              next_state =
+                  (word == eos ? 0 : longest_suffix_state(words + k - m, m));
+      ngram_states.push_back(state);
+      ngram_words.push_back(word);
+      ngram_next_states.push_back(next_state);
+      ngram_scores.push_back(ngram.score);
+    }
+  }
+  int32_t bos_key = bos;
+  auto iter = history2state.find(HistoryKey(&bos_key, 1));
+  int32_t start_state = (iter != history2state.end() ? iter->second : 0);
+
+  return NgramLm(num_words, start_state, Array1<int32_t>(c, backoff_states),
+                 Array1<float>(c, backoff_weights),
+                 Array1<int32_t>(c, ngram_states),
+                 Array1<int32_t>(c, ngram_words),
+                 Array1<int32_t>(c, ngram_next_states),
+                 Array1<float>(c, ngram_scores));
+}
+
+namespace ngram_lm_internal {
+
+struct LmStateInfo {
+  int32_t lattice_state_idx01;
+  int32_t lm_state;  // -1 for the final state.
+};
+
+struct LmArcInfo {
+  int32_t lattice_arc_idx012;
+  int32_t dest_lm_state;  // Not used for arcs to the final state.
+  float lm_score;
+};
+
+/*
+  Does the work of ComposeWithNgramLm().  Like DeviceIntersector in
+  intersect.cu, it expands the reachable state pairs (here, pairs of a
+  lattice state and an LM state) one batch at a time, with a hash mapping
+  state pairs to their index; the difference is that the LM arcs are found
+  by looking up the LM rather than by matching arcs of an FSA.
+*/
+class NgramLmComposer {
+ public:
+  NgramLmComposer(NgramLm &lm, FsaVec &lattice)
+      : c_(lattice.Context()),
+        lm_(lm),
+        lattice_(lattice),
+        lattice_states_multiple_(lattice.TotSize(1) | 1) {
+    NVTX_RANGE(K2_FUNC);
+    K2_CHECK(c_->IsCompatible(*lm.Context()));
+    int32_t num_key_bits = NumBitsNeededFor(
+        static_cast<int64_t>(lm.NumStates()) * lattice_states_multiple_);
+    if (num_key_bits < 32) num_key_bits = 32;
+    int32_t hash_size = 4 * RoundUpToNearestPowerOfTwo(lattice.TotSize(1)),
+            min_hash_size = 1 << 16;
+    if (hash_size < min_hash_size) hash_size = min_hash_size;
+    int32_t num_value_bits = std::max<int32_t>(
+        NumBitsNeededFor(hash_size - 1), 64 - num_key_bits);
+    // Make sure the implicit key bits of Hash::PackedAccessor are allowed.
+    while ((hash_size >> (num_key_bits + num_value_bits - 64)) < 32)
+      hash_size *= 2;
+    state_pair_to_state_ = Hash(c_, hash_size, num_key_bits, num_value_bits);
+    state_pair_to_state_.TrackNumElements();
+    state_pair_to_state_.SetMaxLoadFactor(0.25);
+  }
+
+  ~NgramLmComposer() {
+    // The hash still contains values at this point, by design.
+    state_pair_to_state_.Destroy();
+  }
+
+  void Compose() {
+    FirstIter();
+    Forward();
+    LastIter();
+  }
+
+  FsaVec FormatOutput(Array1<int32_t> *arc_map_out,
+                      Array1<float> *lm_scores_out);
+
+  // The following are only public because of restrictions on lambdas in CUDA.
+  void FirstIter();
+  void Forward();
+  void ForwardOneIter(int32_t t);
+  void LastIter();
+
+ private:
+  ContextPtr c_;
+  NgramLm &lm_;
+  FsaVec &lattice_;
+  int32_t lattice_states_multiple_;
+
+  // Maps lm_state * lattice_states_multiple_ + lattice_state_idx01 to the
+  // index into states_.
+  Hash state_pair_to_state_;
+  Array1<LmStateInfo> states_;
+  // The final states (one per lattice that was not empty), which are appended
+  // to states_ in LastIter().
+  Array1<LmStateInfo> final_states_;
+  Array1<LmArcInfo> arcs_;
+  // The index into states_ of the source state of each arc.
+  Array1<int32_t> arcs_row_ids_;
+  // The states processed on iteration t are those in
+  // [iter_to_state_row_splits_cpu_[t], iter_to_state_row_splits_cpu_[t+1]).
+  std::vector<int32_t> iter_to_state_row_splits_cpu_;
+};
+
+void NgramLmComposer::FirstIter() {
+  NVTX_RANGE(K2_FUNC);
+  int32_t initial_size = state_pair_to_state_.NumBuckets();
+  arcs_row_ids_ = Array1<int32_t>(c_, initial_size);
+  arcs_row_ids_.Resize(0, true);
+  arcs_ = Array1<LmArcInfo>(c_, initial_size);
+  arcs_.Resize(0, true);
+
+  int32_t num_fsas = lattice_.Dim0();
+  const int32_t *row_splits1_data = lattice_.RowSplits(1).Data();
+  Renumbering renumber_fsas(c_, num_fsas);
+  char *keep_data = renumber_fsas.Keep().Data();
+  K2_EVAL(
+      c_, num_fsas, lambda_set_keep, (int32_t i)->void {
+        keep_data[i] = (char)(row_splits1_data[i + 1] > row_splits1_data[i]);
+      });
+  int32_t num_initial_states = renumber_fsas.New2Old().Dim();
+
+  states_ = Array1<LmStateInfo>(c_, initial_size);
+  states_.Resize(num_initial_states, true);
+  final_states_ = Array1<LmStateInfo>(c_, num_initial_states);
+  LmStateInfo *states_data = states_.Data(),
+              *final_states_data = final_states_.Data();
+  const int32_t *new2old_data = renumber_fsas.New2Old().Data();
+  int32_t start_state = lm_.StartState();
+  uint64_t lattice_states_multiple = lattice_states_multiple_;
+  Hash::PackedAccessor state_pair_to_state_acc =
+      state_pair_to_state_.GetAccessor<Hash::PackedAccessor>();
+  K2_EVAL(
+      c_, num_initial_states, lambda_set_state_info, (int32_t i)->void {
+        int32_t fsa_idx0 = new2old_data[i];
+        LmStateInfo info;
+        info.lattice_state_idx01 = row_splits1_data[fsa_idx0];
+        info.lm_state = start_state;
+        states_data[i] = info;
+        uint64_t key = start_state * lattice_states_multiple +
+                       info.lattice_state_idx01;
+        state_pair_to_state_acc.Insert(key, static_cast<uint64_t>(i));
+
+        info.lattice_state_idx01 = row_splits1_data[fsa_idx0 + 1] - 1;
+        info.lm_state = -1;
+        final_states_data[i] = info;
+      });
+
+  iter_to_state_row_splits_cpu_.reserve(128);
+  iter_to_state_row_splits_cpu_.push_back(0);
+  iter_to_state_row_splits_cpu_.push_back(num_initial_states);
+}
+
+void NgramLmComposer::LastIter() {
+  NVTX_RANGE(K2_FUNC);
+  int32_t cur_num_states = states_.Dim(),
+          tot_num_states = cur_num_states + final_states_.Dim();
+  states_.Resize(tot_num_states);
+  Array1<LmStateInfo> dest = states_.Arange(cur_num_states, tot_num_states);
+  Assign(final_states_, &dest);
+  iter_to_state_row_splits_cpu_.push_back(tot_num_states);
+}
+
+void NgramLmComposer::Forward() {
+  NVTX_RANGE(K2_FUNC);
+  for (int32_t t = 0;; t++) {
+    int32_t state_begin = iter_to_state_row_splits_cpu_[t],
+            state_end = iter_to_state_row_splits_cpu_[t + 1];
+    if (state_begin == state_end) {
+      // Remove the last, empty, iteration-index.
+      iter_to_state_row_splits_cpu_.pop_back();
+      break;
+    }
+    ForwardOneIter(t);
+  }
+}
+
+void NgramLmComposer::ForwardOneIter(int32_t t) {
+  NVTX_RANGE(K2_FUNC);
+  int32_t state_begin = iter_to_state_row_splits_cpu_[t],
+          state_end = iter_to_state_row_splits_cpu_[t + 1],
+          num_states = state_end - state_begin;
+
+  // Each arc of the lattice leaving the lattice states of this batch gives
+  // exactly one arc in the output (or none if its word is not in the LM).
+  Array1<int32_t> row_splits(c_, num_states + 1);
+  int32_t *row_splits_data = row_splits.Data();
+  const LmStateInfo *states_data = states_.Data();
+  const int32_t *lattice_row_splits2_data = lattice_.RowSplits(2).Data();
+  K2_EVAL(
+      c_, num_states, lambda_set_num_arcs, (int32_t i)->void {
+        int32_t s = states_data[state_begin + i].lattice_state_idx01;
+        row_splits_data[i] =
+            lattice_row_splits2_data[s + 1] - lattice_row_splits2_data[s];
+      });
+  ExclusiveSum(row_splits, &row_splits);
+  int32_t tot_arcs = row_splits.Back();
+  Array1<int32_t> row_ids(c_, tot_arcs);
+  RowSplitsToRowIds(row_splits, &row_ids);
+  const int32_t *row_ids_data = row_ids.Data();
+
+  // Bound on the number of new states, assuming all arcs lead to one.
+  int32_t cur_num_buckets = state_pair_to_state_.NumBuckets(),
+          num_key_bits = state_pair_to_state_.NumKeyBits(),
+          cur_num_value_bits = state_pair_to_state_.NumValueBits(),
+          num_value_bits = std::max<int32_t>(
+              NumBitsNeededFor(int64_t(state_end) + tot_arcs),
+              cur_num_value_bits);
+  if (num_value_bits != cur_num_value_bits)
+    state_pair_to_state_.Resize(cur_num_buckets, num_key_bits,
+                                num_value_bits);
+  state_pair_to_state_.PossiblyGrow(tot_arcs);
+  Hash::PackedAccessor state_pair_to_state_acc =
+      state_pair_to_state_.GetAccessor<Hash::PackedAccessor>();
+
+  // We look up the LM once per arc and keep the results here.
+  Array1<LmArcInfo> arc_infos(c_, tot_arcs);
+  LmArcInfo *arc_infos_data = arc_infos.Data();
+  // As in DeviceIntersector::ForwardOneIter(), we combine the renumbering
+  // of the arcs (which ones we keep) and of the dest-states (which ones are
+  // new) into one.
+  Renumbering arcs_newstates_renumbering(c_, tot_arcs * 2);
+  char *keep_arc_data = arcs_newstates_renumbering.Keep().Data(),
+       *new_dest_state_data = keep_arc_data + tot_arcs;
+  const Arc *lattice_arcs_data = lattice_.values.Data();
+  NgramLm::Accessor lm_acc = lm_.GetAccessor();
+  uint64_t lattice_states_multiple = lattice_states_multiple_;
+  K2_EVAL(
+      c_, tot_arcs, lambda_set_keep_arc_newstate, (int32_t i)->void {
+        int32_t state_i = row_ids_data[i];
+        LmStateInfo sinfo = states_data[state_begin + state_i];
+        int32_t arc_idx012 =
+            lattice_row_splits2_data[sinfo.lattice_state_idx01] + i -
+            row_splits_data[state_i];
+        Arc arc = lattice_arcs_data[arc_idx012];
+        LmArcInfo info;
+        info.lattice_arc_idx012 = arc_idx012;
+        info.dest_lm_state = sinfo.lm_state;
+        if (arc.label == -1)
+          info.lm_score = lm_acc.FinalScore(sinfo.lm_state);
+        else if (arc.label == 0)
+          info.lm_score = 0;
+        else
+          info.lm_score =
+              lm_acc.Score(sinfo.lm_state, arc.label, &info.dest_lm_state);
+        arc_infos_data[i] = info;
+        char keep_arc = (info.lm_score !=
+                         -std::numeric_limits<float>::infinity()),
+             new_dest_state = 0;
+        // We don't allocate ids for the final states here; see LastIter().
+        if (keep_arc && arc.label != -1) {
+          int32_t dest_state_idx01 =
+              sinfo.lattice_state_idx01 + arc.dest_state - arc.src_state;
+          uint64_t key = info.dest_lm_state * lattice_states_multiple +
+                         dest_state_idx01;
+          // The value is temporary; it is replaced below with the index
+          // into states_.
+          if (state_pair_to_state_acc.Insert(key, static_cast<uint64_t>(i)))
+            new_dest_state = 1;
+        }
+        keep_arc_data[i] = keep_arc;
+        new_dest_state_data[i] = new_dest_state;
+      });
+
+  int32_t num_kept_arcs = arcs_newstates_renumbering.Old2New(true)[tot_arcs],
+          num_kept_tot = arcs_newstates_renumbering.New2Old().Dim(),
+          num_new_states = num_kept_tot - num_kept_arcs,
+          next_state_end = state_end + num_new_states;
+  iter_to_state_row_splits_cpu_.push_back(next_state_end);
+  states_.Resize(next_state_end);
+  LmStateInfo *new_states_data = states_.Data();
+  const int32_t *new2old_data = arcs_newstates_renumbering.New2Old().Data();
+  K2_EVAL(
+      c_, num_new_states, lambda_set_new_states, (int32_t i)->void {
+        int32_t arc_i = new2old_data[num_kept_arcs + i] - tot_arcs;
+        LmArcInfo info = arc_infos_data[arc_i];
+        Arc arc = lattice_arcs_data[info.lattice_arc_idx012];
+        int32_t src_state_idx01 =
+            new_states_data[state_begin + row_ids_data[arc_i]]
+                .lattice_state_idx01,
+                dest_state_idx01 = src_state_idx01 + arc.dest_state -
+                                   arc.src_state;
+        uint64_t key = info.dest_lm_state * lattice_states_multiple +
+                       dest_state_idx01,
+                 value, *key_value_location = nullptr;
+        bool found = state_pair_to_state_acc.Find(key, &value,
+                                                  &key_value_location);
+        K2_DCHECK(found);
+        K2_DCHECK_EQ(value, static_cast<uint64_t>(arc_i));
+        int32_t dest_state = state_end + i;
+        state_pair_to_state_acc.SetValue(key_value_location, key,
+                                         static_cast<uint64_t>(dest_state));
+        LmStateInfo dest_info;
+        dest_info.lattice_state_idx01 = dest_state_idx01;
+        dest_info.lm_state = info.dest_lm_state;
+        new_states_data[dest_state] = dest_info;
+      });
+
+  int32_t old_num_arcs = arcs_.Dim(),
+          new_num_arcs = old_num_arcs + num_kept_arcs;
+  arcs_.Resize(new_num_arcs);
+  arcs_row_ids_.Resize(new_num_arcs);
+  LmArcInfo *arcs_data = arcs_.Data() + old_num_arcs;
+  int32_t *arcs_row_ids_data = arcs_row_ids_.Data() + old_num_arcs;
+  K2_EVAL(
+      c_, num_kept_arcs, lambda_set_arcs, (int32_t new_arc_i)->void {
+        int32_t arc_i = new2old_data[new_arc_i];
+        arcs_data[new_arc_i] = arc_infos_data[arc_i];
+        arcs_row_ids_data[new_arc_i] = state_begin + row_ids_data[arc_i];
+      });
+}
+
+FsaVec NgramLmComposer::FormatOutput(Array1<int32_t> *arc_map_out,
+                                     Array1<float> *lm_scores_out) {
+  NVTX_RANGE(K2_FUNC);
+  int32_t num_states = iter_to_state_row_splits_cpu_.back(),
+          num_iters = iter_to_state_row_splits_cpu_.size() - 1,
+          num_fsas = lattice_.Dim0();
+  K2_CHECK_EQ(num_states, states_.Dim());
+  Array1<int32_t> row_splits1(c_, iter_to_state_row_splits_cpu_),
+      row_ids1(c_, num_states);
+  RowSplitsToRowIds(row_splits1, &row_ids1);
+
+  // As in DeviceIntersector::FormatOutputTpl(), we change row_ids1 from
+  // mapping states to iterations to mapping them to
+  // (iter * num_fsas + fsa_idx0), and then reorder the rows so that the
+  // states of each FSA are together.  The final states come last as they
+  // were added on the last iteration.
+  const int32_t *lattice_row_ids1_data = lattice_.RowIds(1).Data();
+  int32_t *row_ids1_data = row_ids1.Data();
+  const LmStateInfo *states_data = states_.Data();
+  K2_EVAL(
+      c_, num_states, lambda_modify_row_ids, (int32_t i)->void {
+        int32_t iter = row_ids1_data[i],
+                fsa_idx0 =
+                    lattice_row_ids1_data[states_data[i].lattice_state_idx01];
+        row_ids1_data[i] = iter * num_fsas + fsa_idx0;
+      });
+  Array1<int32_t> &row_ids2 = row_ids1,
+                  row_splits2(c_, num_iters * num_fsas + 1);
+  RowIdsToRowSplits(row_ids2, &row_splits2);
+
+  Array1<int32_t> fsaiter_new2old(c_, num_iters * num_fsas);
+  int32_t *fsaiter_new2old_data = fsaiter_new2old.Data();
+  K2_EVAL(
+      c_, num_iters * num_fsas, lambda_set_reordering, (int32_t i)->void {
+        int32_t fsa_idx = i / num_iters, iter_idx = i % num_iters;
+        fsaiter_new2old_data[i] = iter_idx * num_fsas + fsa_idx;
+      });
+
+  Array1<int32_t> &row_ids3 = arcs_row_ids_;
+  Array1<int32_t> row_splits3(c_, num_states + 1);
+  RowIdsToRowSplits(row_ids3, &row_splits3);
+
+  RaggedShape layer2 = RaggedShape2(&row_splits2, &row_ids2, -1),
+              layer3 = RaggedShape2(&row_splits3, &row_ids3, -1);
+  Array1<int32_t> states_new2old, arcs_new2old;
+  RaggedShape layer2_new = Index(layer2, 0, fsaiter_new2old, &states_new2old),
+              layer3_new = Index(layer3, 0, states_new2old, &arcs_new2old),
+              layer1_new = RegularRaggedShape(c_, num_fsas, num_iters);
+  RaggedShape full_shape =
+      ComposeRaggedShapes3(layer1_new, layer2_new, layer3_new);
+  RaggedShape ans_shape = RemoveAxis(full_shape, 1);
+
+  int32_t num_arcs = arcs_.Dim();
+  K2_CHECK_EQ(ans_shape.NumElements(), num_arcs);
+  Array1<Arc> ans_values(c_, num_arcs);
+  int32_t *arc_map_data = nullptr;
+  float *lm_scores_data = nullptr;
+  if (arc_map_out) {
+    *arc_map_out = Array1<int32_t>(c_, num_arcs);
+    arc_map_data = arc_map_out->Data();
+  }
+  if (lm_scores_out) {
+    *lm_scores_out = Array1<float>(c_, num_arcs);
+    lm_scores_data = lm_scores_out->Data();
+  }
+
+  Array1<int32_t> states_old2new = InvertPermutation(states_new2old);
+  const LmArcInfo *arcs_data = arcs_.Data();
+  const Arc *lattice_arcs_data = lattice_.values.Data();
+  Arc *ans_values_data = ans_values.Data();
+  const int32_t *arcs_new2old_data = arcs_new2old.Data(),
+                *states_old2new_data = states_old2new.Data(),
+                *ans_row_ids2_data = ans_shape.RowIds(2).Data(),
+                *ans_row_ids1_data = ans_shape.RowIds(1).Data(),
+                *ans_row_splits1_data = ans_shape.RowSplits(1).Data(),
+                *lattice_row_ids2_data = lattice_.RowIds(2).Data();
+  uint64_t lattice_states_multiple = lattice_states_multiple_;
+  Hash::PackedAccessor state_pair_to_state_acc =
+      state_pair_to_state_.GetAccessor<Hash::PackedAccessor>();
+  K2_EVAL(
+      c_, num_arcs, lambda_set_output_data, (int32_t arc_idx012)->void {
+        int32_t src_state_idx01 = ans_row_ids2_data[arc_idx012],
+                fsa_idx0 = ans_row_ids1_data[src_state_idx01];
+        LmArcInfo info = arcs_data[arcs_new2old_data[arc_idx012]];
+        Arc arc = lattice_arcs_data[info.lattice_arc_idx012];
+        int32_t dest_state_idx01;
+        if (arc.label == -1) {
+          dest_state_idx01 = ans_row_splits1_data[fsa_idx0 + 1] - 1;
+        } else {
+          int32_t lattice_dest_state_idx01 =
+              lattice_row_ids2_data[info.lattice_arc_idx012] +
+              arc.dest_state - arc.src_state;
+          uint64_t key = info.dest_lm_state * lattice_states_multiple +
+                         lattice_dest_state_idx01,
+                   value = 0;
+          bool found = state_pair_to_state_acc.Find(key, &value);
+          K2_DCHECK(found);
+          dest_state_idx01 = states_old2new_data[static_cast<int32_t>(value)];
+        }
+        int32_t fsa_idx0x = ans_row_splits1_data[fsa_idx0];
+        Arc ans_arc(src_state_idx01 - fsa_idx0x, dest_state_idx01 - fsa_idx0x,
+                    arc.label, arc.score + info.lm_score);
+        ans_values_data[arc_idx012] = ans_arc;
+        if (arc_map_data) arc_map_data[arc_idx012] = info.lattice_arc_idx012;
+        if (lm_scores_data) lm_scores_data[arc_idx012] = info.lm_score;
+      });
+  return Ragged<Arc>(ans_shape, ans_values);
+}
+
+}  // namespace ngram_lm_internal
+
+using namespace ngram_lm_internal;  // NOLINT
+
+FsaVec ComposeWithNgramLm(NgramLm &lm, FsaVec &lattice,
+                          Array1<int32_t> *arc_map /*= nullptr*/,
+                          Array1<float> *lm_scores /*= nullptr*/) {
+  NVTX_RANGE(K2_FUNC);
+  K2_CHECK_EQ(lattice.NumAxes(), 3);
+  NgramLmComposer composer(lm, lattice);
+  composer.Compose();
+  return composer.FormatOutput(arc_map, lm_scores);
+}
+
+}  // namespace k2
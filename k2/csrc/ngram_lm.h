@@ -0,0 +1,205 @@
+/**
+ * Copyright      2026  Xiaomi Corporation
+ *
+ * See LICENSE for clarification regarding multiple authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef K2_CSRC_NGRAM_LM_H_
+#define K2_CSRC_NGRAM_LM_H_
+
+#include <istream>
+#include <limits>
+#include <string>
+#include <unordered_map>
+
+#include "k2/csrc/array.h"
+#include "k2/csrc/context.h"
+#include "k2/csrc/fsa.h"
+#include "k2/csrc/hash.h"
+
+namespace k2 {
+
+/*
+  A backoff n-gram language model stored in the form it is used in, rather
+  than expanded into an FSA: it can be looked up on the device without the
+  FSA (e.g. G in WholeLatticeRescoring(), with its backoff arcs and epsilon
+  self-loops) ever being built.
+
+  Each history (i.e. each n-gram of order less than the LM's order that
+  appears in the LM, plus the empty history, which is state 0) is a state.
+  For each n-gram (h, w) we store, in a hash keyed by (state of h, w), the
+  state we go to (that of the longest suffix of (h, w) that is a history)
+  and its log-prob; each state has a backoff state and weight.  See
+  Accessor::Score() for how these are used.
+
+  Word ids are those of the words table of the lattices to be rescored
+  (i.e. > 0).  The sentence-begin and sentence-end symbols of the LM are
+  given the ids NumWords() and NumWords() + 1.  All log-probs are natural
+  logs (unlike in ARPA files).
+*/
+class NgramLm {
+ public:
+  /*
+    Constructor.  All arrays must be on the same device, which will also be
+    the device of this object.
+
+      @param [in] num_words  One more than the largest word id.
+      @param [in] start_state  The state of the history "<s>", i.e. the
+                   state we are in at the start of a sentence.
+      @param [in] backoff_states  For each state s > 0, the state we back
+                   off to from s; backoff_states[0] is ignored.
+      @param [in] backoff_weights  For each state, the log-weight we add
+                   when backing off from it; backoff_weights[0] is ignored.
+      @param [in] ngram_states  For each n-gram (h, w), the state of h.
+      @param [in] ngram_words  For each n-gram (h, w), w, which must be
+                   < num_words + 2; the word "<s>" is not allowed.
+      @param [in] ngram_next_states  For each n-gram (h, w), the state of
+                   the longest suffix of (h, w) that is a history.
+      @param [in] ngram_scores  For each n-gram (h, w), its log-prob.
+   */
+  NgramLm(int32_t num_words, int32_t start_state,
+          const Array1<int32_t> &backoff_states,
+          const Array1<float> &backoff_weights,
+          const Array1<int32_t> &ngram_states,
+          const Array1<int32_t> &ngram_words,
+          const Array1<int32_t> &ngram_next_states,
+          const Array1<float> &ngram_scores);
+
+  NgramLm() = default;
+
+  // The hash still contains the n-grams when we are destroyed, by design.
+  ~NgramLm() { ngrams_.Destroy(); }
+
+  ContextPtr &Context() { return backoff_states_.Context(); }
+  int32_t NumWords() const { return num_words_; }
+  int32_t NumStates() const { return backoff_states_.Dim(); }
+  int32_t NumNgrams() const { return ngram_scores_.Dim(); }
+  int32_t StartState() const { return start_state_; }
+
+  /* Returns a copy of this object on the device of context `c`; the hash is
+     rebuilt there. */
+  NgramLm To(ContextPtr c) const;
+
+  /* The object through which the LM is looked up, on the host or in kernels.
+     It is only valid while the NgramLm it came from exists. */
+  class Accessor {
+   public:
+    explicit Accessor(NgramLm &lm)
+        : num_words_(lm.num_words_),
+          ngrams_acc_(lm.ngrams_.GetAccessor()),
+          backoff_states_(lm.backoff_states_.Data()),
+          backoff_weights_(lm.backoff_weights_.Data()),
+          ngram_next_states_(lm.ngram_next_states_.Data()),
+          ngram_scores_(lm.ngram_scores_.Data()) {}
+
+    /*
+      Returns the log-prob of `word` (> 0) in state `state`, backing off
+      to shorter histories as needed, and sets `*next_state` to the state
+      we are in after `word`.  Returns -infinity (and leaves `*next_state`
+      unchanged) if `word` is not in the LM at all.
+     */
+    __host__ __device__ __forceinline__ float Score(
+        int32_t state, int32_t word, int32_t *next_state) const {
+      if (static_cast<uint32_t>(word) > static_cast<uint32_t>(num_words_ + 1))
+        return -std::numeric_limits<float>::infinity();
+      float backoff = 0;
+      while (true) {
+        uint64_t key = static_cast<uint64_t>(state) * (num_words_ + 2) + word,
+                 value;
+        if (ngrams_acc_.Find(key, &value)) {
+          int32_t ngram_idx = static_cast<int32_t>(value);
+          *next_state = ngram_next_states_[ngram_idx];
+          return backoff + ngram_scores_[ngram_idx];
+        }
+        if (state == 0) return -std::numeric_limits<float>::infinity();
+        backoff += backoff_weights_[state];
+        state = backoff_states_[state];
+      }
+    }
+
+    /* Returns the log-prob of ending the sentence in state `state`. */
+    __host__ __device__ __forceinline__ float FinalScore(int32_t state) const {
+      int32_t next_state;
+      return Score(state, num_words_ + 1, &next_state);
+    }
+
+   private:
+    int32_t num_words_;
+    Hash64::Accessor ngrams_acc_;
+    const int32_t *backoff_states_;
+    const float *backoff_weights_;
+    const int32_t *ngram_next_states_;
+    const float *ngram_scores_;
+  };
+
+  Accessor GetAccessor() { return Accessor(*this); }
+
+ private:
+  int32_t num_words_ = 0;
+  int32_t start_state_ = 0;
+  Array1<int32_t> backoff_states_;
+  Array1<float> backoff_weights_;
+  // Kept so that To() can rebuild the hash.
+  Array1<int32_t> ngram_states_;
+  Array1<int32_t> ngram_words_;
+  Array1<int32_t> ngram_next_states_;
+  Array1<float> ngram_scores_;
+  // Maps (ngram_states_[i] * (num_words_ + 2) + ngram_words_[i]) to i.
+  Hash64 ngrams_;
+};
+
+/*
+  Reads an n-gram LM in ARPA format.
+
+     @param [in] c  The context of the returned LM.
+     @param [in] is  The stream to read the ARPA file from.
+     @param [in] word2id  Maps each word to its id, e.g. the words table of
+                   the lattices.  N-grams containing words that are not in
+                   it or have id 0 (epsilon) are skipped, as are n-grams of
+                   the sentence-begin symbol "<s>" (only used as a history).
+     @return  Returns the LM.
+ */
+NgramLm ReadArpa(ContextPtr c, std::istream &is,
+                 const std::unordered_map<std::string, int32_t> &word2id);
+
+/*
+  Composes word lattices with an n-gram LM, i.e. does what IntersectDevice()
+  does with an acceptor G of the LM that has epsilon self-loops, but without
+  G being built: the LM states are expanded on demand, only for the
+  (lattice state, LM state) pairs that are reached.  The LM is applied
+  exactly, i.e. backoff is only taken for n-grams that are not in the LM.
+
+     @param [in] lm  The n-gram LM.  Must be on the same device as `lattice`.
+     @param [in] lattice  The lattices to compose with the LM, with word ids
+                   as labels.  Arcs with label 0 (epsilon) do not change the
+                   LM state and get LM score 0; arcs with label -1 get the
+                   LM's sentence-end log-prob.  Arcs with words that are not
+                   in the LM are dropped.
+     @param [out] arc_map  If not nullptr, will be set to the map from
+                   arc-index in the output to arc-index in `lattice`.
+     @param [out] lm_scores  If not nullptr, will be set to the LM score of
+                   each arc in the output (already included in its score).
+     @return  Returns an FsaVec with the same Dim0() as `lattice`, whose
+              scores are those of `lattice` plus the LM scores.  It may
+              contain states that are not coaccessible; call Connect() if
+              that matters.
+ */
+FsaVec ComposeWithNgramLm(NgramLm &lm, FsaVec &lattice,
+                          Array1<int32_t> *arc_map = nullptr,
+                          Array1<float> *lm_scores = nullptr);
+
+}  // namespace k2
+
+#endif  // K2_CSRC_NGRAM_LM_H_
@@ -0,0 +1,150 @@
+/**
+ * Copyright      2026  Xiaomi Corporation
+ *
+ * See LICENSE for clarification regarding multiple authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <gtest/gtest.h>
+
+#include <cmath>
+#include <limits>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+
+#include "k2/csrc/fsa_algo.h"
+#include "k2/csrc/fsa_utils.h"
+#include "k2/csrc/ngram_lm.h"
+#include "k2/csrc/test_utils.h"
+
+namespace k2 {
+
+static const char *kArpa = R"(
+\data\
+ngram 1=4
+ngram 2=3
+
+\1-grams:
+-1.0 <s> -0.5
+-0.5 </s>
+-0.3 a -0.2
+-0.6 b -0.1
+
+\2-grams:
+-0.2 <s> a
+-0.4 a b
+-0.1 b </s>
+
+\end\
+)";
+
+static NgramLm GetTestLm(ContextPtr c) {
+  std::istringstream is(kArpa);
+  std::unordered_map<std::string, int32_t> word2id = {{"a", 1}, {"b", 2}};
+  return ReadArpa(c, is, word2id);
+}
+
+TEST(NgramLm, Score) {
+  NgramLm lm = GetTestLm(GetCpuContext());
+  EXPECT_EQ(lm.NumWords(), 3);
+  // The empty history, "<s>", "</s>", "a" and "b".
+  EXPECT_EQ(lm.NumStates(), 5);
+  // All n-grams except the unigram "<s>".
+  EXPECT_EQ(lm.NumNgrams(), 6);
+
+  const float ln10 = std::log(10.0f);
+  NgramLm::Accessor acc = lm.GetAccessor();
+  int32_t state = lm.StartState(), a_state, b_state;
+  // "<s> a b </s>" only uses bigrams.
+  EXPECT_NEAR(acc.Score(state, 1, &a_state), -0.2f * ln10, 1e-5);
+  EXPECT_NEAR(acc.Score(a_state, 2, &b_state), -0.4f * ln10, 1e-5);
+  EXPECT_NEAR(acc.FinalScore(b_state), -0.1f * ln10, 1e-5);
+  // "<s> b a </s>" backs off everywhere.
+  int32_t next_state;
+  EXPECT_NEAR(acc.Score(state, 2, &next_state), (-0.5f - 0.6f) * ln10, 1e-5);
+  EXPECT_EQ(next_state, b_state);
+  EXPECT_NEAR(acc.Score(next_state, 1, &next_state), (-0.1f - 0.3f) * ln10,
+              1e-5);
+  EXPECT_EQ(next_state, a_state);
+  EXPECT_NEAR(acc.FinalScore(next_state), (-0.2f - 0.5f) * ln10, 1e-5);
+  // Words that are not in the LM.
+  EXPECT_EQ(acc.Score(state, 10, &next_state),
+            -std::numeric_limits<float>::infinity());
+}
+
+TEST(NgramLm, ComposeWithNgramLm) {
+  for (const ContextPtr &c : {GetCpuContext(), GetCudaContext()}) {
+    NgramLm lm = GetTestLm(GetCpuContext()).To(c);
+    // The paths "a b" and "b a" meet in state 5, which is split in two in
+    // the output as their LM states differ; the path "a <eps> 10" is dropped
+    // as 10 is not in the LM.
+    std::string s1 = R"(0 1 1 0.5
+      0 2 2 0.25
+      0 3 1 0
+      1 5 2 0
+      2 5 1 0
+      3 4 0 0
+      4 5 10 0
+      5 6 -1 0
+      6
+    )";
+    std::string s2 = R"(0 1 1 1
+      1 2 0 2
+      2 3 2 3
+      3 4 -1 4
+      4
+    )";
+    Fsa fsa1 = FsaFromString(s1), fsa2 = FsaFromString(s2);
+    Fsa *fsa_array[] = {&fsa1, &fsa2};
+    FsaVec lattice = CreateFsaVec(2, &fsa_array[0]).To(c);
+
+    Array1<int32_t> arc_map;
+    Array1<float> lm_scores;
+    FsaVec composed = ComposeWithNgramLm(lm, lattice, &arc_map, &lm_scores);
+    ASSERT_EQ(composed.Dim0(), 2);
+    EXPECT_EQ(arc_map.Dim(), composed.NumElements());
+    EXPECT_EQ(lm_scores.Dim(), composed.NumElements());
+
+    FsaVec connected, sorted;
+    Array1<int32_t> connect_arc_map;
+    Connect(composed, &connected, &connect_arc_map);
+    TopSort(connected, &sorted);
+    // In fsa1: (0, <s>), (1, a), (2, b), (5, b), (5, a) and the final state.
+    EXPECT_EQ(sorted.TotSize(1), 6 + 5);
+    EXPECT_EQ(sorted.NumElements(), 6 + 4);
+
+    Array1<float> forward_scores;
+    FsaVecTopology(sorted).GetScores(false, &forward_scores);
+    Array1<float> tot_scores = GetTotScores(sorted, forward_scores).To(
+        GetCpuContext());
+    const float ln10 = std::log(10.0f);
+    // The best path of fsa1 is "a b", with scores 0.5 and 0.
+    EXPECT_NEAR(tot_scores[0], 0.5f + (-0.2f - 0.4f - 0.1f) * ln10, 1e-4);
+    EXPECT_NEAR(tot_scores[1], 10.0f + (-0.2f - 0.4f - 0.1f) * ln10, 1e-4);
+
+    // The LM scores of fsa2, whose arcs are all kept in order.
+    Array1<float> lm_scores_cpu = lm_scores.To(GetCpuContext());
+    Array1<int32_t> arc_map_cpu = arc_map.To(GetCpuContext());
+    int32_t num_arcs = arc_map_cpu.Dim();
+    for (int32_t i = 0; i < 4; ++i)  // fsa1 has 8 arcs.
+      EXPECT_EQ(arc_map_cpu[num_arcs - 4 + i], 8 + i);
+    EXPECT_NEAR(lm_scores_cpu[num_arcs - 4], -0.2f * ln10, 1e-5);
+    EXPECT_EQ(lm_scores_cpu[num_arcs - 3], 0.0f);
+    EXPECT_NEAR(lm_scores_cpu[num_arcs - 2], -0.4f * ln10, 1e-5);
+    EXPECT_NEAR(lm_scores_cpu[num_arcs - 1], -0.1f * ln10, 1e-5);
+  }
+}
+
+}  // namespace k2
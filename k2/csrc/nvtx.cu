@@ -0,0 +1,86 @@
+/**
+ * Copyright      2026  Xiaomi Corporation
+ *
+ * See LICENSE for clarification regarding multiple authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <cstdlib>
+#include <utility>
+
+#ifdef K2_ENABLE_NVTX
+#include "nvToolsExt.h"
+#endif
+
+#include "k2/csrc/nvtx.h"
+
+namespace k2 {
+
+namespace internal {
+
+std::atomic<bool> g_nvtx_enabled(std::getenv("K2_NVTX") != nullptr);
+
+#ifdef K2_ENABLE_NVTX
+namespace {
+
+// Created on first use, with the names of the categories.
+nvtxDomainHandle_t GetDomain() {
+  static nvtxDomainHandle_t domain = [] {
+    nvtxDomainHandle_t domain = nvtxDomainCreateA("k2");
+    const std::pair<NvtxCategory, const char *> names[] = {
+        {NvtxCategory::kRagged, "ragged"},
+        {NvtxCategory::kFsaAlgo, "fsa_algo"},
+        {NvtxCategory::kIntersect, "intersect"},
+        {NvtxCategory::kRnnt, "rnnt"}};
+    for (const auto &p : names)
+      nvtxDomainNameCategoryA(domain, static_cast<uint32_t>(p.first),
+                              p.second);
+    return domain;
+  }();
+  return domain;
+}
+
+}  // namespace
+#endif
+
+void NvtxPush(const char *name, NvtxCategory category, bool has_payload,
+              int64_t payload) {
+#ifdef K2_ENABLE_NVTX
+  nvtxEventAttributes_t attr = {0};
+  attr.version = NVTX_VERSION;
+  attr.size = NVTX_EVENT_ATTRIB_STRUCT_SIZE;
+  attr.category = static_cast<uint32_t>(category);
+  attr.messageType = NVTX_MESSAGE_TYPE_ASCII;
+  attr.message.ascii = name;
+  if (has_payload) {
+    attr.payloadType = NVTX_PAYLOAD_TYPE_INT64;
+    attr.payload.llValue = payload;
+  }
+  nvtxDomainRangePushEx(GetDomain(), &attr);
+#endif
+}
+
+void NvtxPop() {
+#ifdef K2_ENABLE_NVTX
+  nvtxDomainRangePop(GetDomain());
+#endif
+}
+
+}  // namespace internal
+
+void EnableNvtx(bool enable /*= true*/) {
+  internal::g_nvtx_enabled.store(enable, std::memory_order_relaxed);
+}
+
+}  // namespace k2
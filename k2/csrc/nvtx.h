@@ -15,30 +15,90 @@
  * See the License for the specific language governing permissions and
  * limitations under the License.
  */
+
+/*
+  NVTX ranges, for seeing what k2 is doing in Nsight Systems, e.g. with
+  `nsys profile --trace=cuda,nvtx`.
+
+  All the ranges are in the "k2" domain, and may have a category (see
+  NvtxCategory) and a payload, an integer that shows the size of the problem,
+  e.g. the number of elements, FSAs or frames.  If k2 was built with
+  K2_ENABLE_NVTX, the ranges are still disabled at runtime by default, which
+  costs one relaxed atomic load per range; they are enabled with EnableNvtx(),
+  or by setting the environment variable K2_NVTX.  Without K2_ENABLE_NVTX
+  they are compiled out.
+
+  NvtxRange also names the op that the counters and the allocations in
+  op_stats.h are attributed to, whether or not NVTX is enabled.
+ */
+
 #ifndef K2_CSRC_NVTX_H_
 #define K2_CSRC_NVTX_H_
 
-#ifdef K2_ENABLE_NVTX
-#include "nvToolsExt.h"
-#endif
+#include <atomic>
+#include <cstdint>
+
+#include "k2/csrc/op_stats.h"
 
 namespace k2 {
 
-class NvtxRange {
- public:
-  explicit NvtxRange(const char *name) {
+// The categories of the ranges, shown in Nsight Systems with these names;
+// see nvtx.cu.
+enum class NvtxCategory : uint32_t {
+  kNone = 0,
+  kRagged = 1,     // ragged tensor ops
+  kFsaAlgo = 2,    // FSA algorithms, e.g. ArcSort, Connect, ShortestPath
+  kIntersect = 3,  // intersection/composition, e.g. IntersectDensePruned
+  kRnnt = 4,       // RNN-T decoding and losses
+};
+
+// Enables or disables the NVTX ranges entered from now on.  It does nothing
+// if k2 was built without K2_ENABLE_NVTX.
+void EnableNvtx(bool enable = true);
+
+namespace internal {
+
+extern std::atomic<bool> g_nvtx_enabled;
+
+// Push and pop a range of the "k2" domain.
+void NvtxPush(const char *name, NvtxCategory category, bool has_payload,
+              int64_t payload);
+void NvtxPop();
+
+}  // namespace internal
+
+// True if the NVTX ranges are enabled; a constant false if k2 was built
+// without K2_ENABLE_NVTX.
+inline bool NvtxEnabled() {
 #ifdef K2_ENABLE_NVTX
-    nvtxRangePushA(name);
+  return internal::g_nvtx_enabled.load(std::memory_order_relaxed);
 #else
-    (void)name;
+  return false;
 #endif
+}
+
+class NvtxRange {
+ public:
+  explicit NvtxRange(const char *name, bool op_stats = true)
+      : NvtxRange(name, NvtxCategory::kNone, false, 0, op_stats) {}
+
+  // `payload` is ignored unless `has_payload` is true.
+  NvtxRange(const char *name, NvtxCategory category, bool has_payload,
+            int64_t payload, bool op_stats = true)
+      : nvtx_(NvtxEnabled()),
+        op_stats_(op_stats && internal::OpRangesEnabled()) {
+    if (nvtx_) internal::NvtxPush(name, category, has_payload, payload);
+    if (op_stats_) internal::PushOpStatsRange(name);
   }
 
   ~NvtxRange() {
-#ifdef K2_ENABLE_NVTX
-    nvtxRangePop();
-#endif
+    if (nvtx_) internal::NvtxPop();
+    if (op_stats_) internal::PopOpStatsRange();
   }
+
+ private:
+  bool nvtx_;  // true if we pushed an NVTX range
+  bool op_stats_;
 };
 
 #define _K2_CONCAT(a, b) a##b
@@ -50,11 +110,25 @@ class NvtxRange {
 #define K2_UNIQUE_VARIABLE_NAME(name) K2_CONCAT(name, __LINE__)
 #endif
 
-#ifdef K2_ENABLE_NVTX
 #define NVTX_RANGE(name) k2::NvtxRange K2_UNIQUE_VARIABLE_NAME(k2_nvtx_)(name)
-#else
-#define NVTX_RANGE(name)
-#endif
+
+// For thin wrappers such as Eval(), whose kernel launches should be counted
+// against the op that called them rather than against the wrapper itself.
+#define NVTX_RANGE_NO_OP_STATS(name) \
+  k2::NvtxRange K2_UNIQUE_VARIABLE_NAME(k2_nvtx_)(name, false)
+
+/* A range with a category, which is one of the enumerators of NvtxCategory,
+   e.g. kRagged, and an integer payload that shows the size of the problem,
+   e.g.
+
+     NVTX_RANGE_PAYLOAD(K2_FUNC, kIntersect, b_fsas.shape.Dim0());
+
+   `payload` is only evaluated if NVTX is enabled.
+ */
+#define NVTX_RANGE_PAYLOAD(name, category, payload)                   \
+  k2::NvtxRange K2_UNIQUE_VARIABLE_NAME(k2_nvtx_)(                    \
+      name, k2::NvtxCategory::category, true,                         \
+      k2::NvtxEnabled() ? static_cast<int64_t>(payload) : int64_t(0))
 
 }  // namespace k2
 
@@ -38,7 +38,10 @@
  *
  * 4. There are various subcommands of `nsys`. One example usage is:
  *
- *      nsys nvprof ./bin/cu_nvtx_test
+ *      K2_NVTX=1 nsys nvprof ./bin/cu_nvtx_test
+ *
+ *    The ranges of k2 are disabled at runtime unless the environment
+ *    variable K2_NVTX is set, or EnableNvtx() is called.
  *
  * 5. References:
  *
@@ -70,4 +73,30 @@ TEST(Nvtx, Sleep) {
   }
 }
 
+TEST(Nvtx, Payload) {
+  bool enabled = NvtxEnabled();
+  EnableNvtx();
+  int32_t num_evaluations = 0;
+  auto payload = [&num_evaluations]() -> int32_t {
+    ++num_evaluations;
+    return 10;
+  };
+  {
+    NVTX_RANGE_PAYLOAD("Sleep 100ms", kRagged, payload());
+    std::this_thread::sleep_for(100ms);
+  }
+  // If k2 was built without NVTX, it cannot be enabled.
+  EXPECT_EQ(num_evaluations, NvtxEnabled() ? 1 : 0);
+
+  // The payload is not evaluated if NVTX is disabled.
+  EnableNvtx(false);
+  EXPECT_FALSE(NvtxEnabled());
+  {
+    NVTX_RANGE_PAYLOAD("Sleep 100ms", kIntersect, payload());
+    std::this_thread::sleep_for(100ms);
+  }
+  EXPECT_LE(num_evaluations, 1);
+  EnableNvtx(enabled);
+}
+
 }  // namespace k2
@@ -0,0 +1,335 @@
+/**
+ * Copyright      2026  Xiaomi Corporation
+ *
+ * See LICENSE for clarification regarding multiple authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <iomanip>
+#include <mutex>  // NOLINT
+#include <sstream>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "k2/csrc/op_stats.h"
+
+namespace k2 {
+
+namespace internal {
+
+std::atomic<bool> g_op_stats_enabled(std::getenv("K2_OP_STATS") != nullptr);
+std::atomic<bool> g_allocation_observer_set(false);
+
+}  // namespace internal
+
+namespace {
+
+const char *const kNoOp = "<none>";
+
+// Keyed by the address of the name, which is cheaper than hashing the
+// string; GetOpStats() merges entries that have the same name.
+struct OpStatsRegistry {
+  std::mutex mutex;
+  std::unordered_map<const char *, OpStats> stats;
+  std::unordered_map<const char *, InitPhaseStats> init_phases;
+
+  ~OpStatsRegistry() {
+    if (std::getenv("K2_OP_STATS") != nullptr)
+      fprintf(stderr, "%s", OpStatsReport().c_str());
+  }
+};
+
+OpStatsRegistry &GetRegistry() {
+  static OpStatsRegistry registry;
+  return registry;
+}
+
+thread_local std::vector<const char *> op_stack;
+
+const char *CurrentOp() { return op_stack.empty() ? kNoOp : op_stack.back(); }
+
+// Never destroyed, so that allocations freed during static destruction can
+// still be observed.
+std::mutex &GetObserverMutex() {
+  static std::mutex *mutex = new std::mutex;
+  return *mutex;
+}
+
+std::shared_ptr<AllocationObserver> &GetObserver() {
+  static auto *observer = new std::shared_ptr<AllocationObserver>;
+  return *observer;
+}
+
+std::shared_ptr<AllocationObserver> CurrentObserver() {
+  std::lock_guard<std::mutex> lock(GetObserverMutex());
+  return GetObserver();
+}
+
+// Installs an AllocationTracer if K2_ALLOC_TRACE is set, and prints its
+// report at exit.
+struct AllocationTracerFromEnv {
+  std::shared_ptr<AllocationTracer> tracer;
+
+  AllocationTracerFromEnv() {
+    if (std::getenv("K2_ALLOC_TRACE") == nullptr) return;
+    tracer = std::make_shared<AllocationTracer>();
+    SetAllocationObserver(tracer);
+  }
+
+  ~AllocationTracerFromEnv() {
+    if (tracer != nullptr) fprintf(stderr, "%s", tracer->Report().c_str());
+  }
+};
+
+AllocationTracerFromEnv allocation_tracer_from_env;
+
+template <typename LambdaT>
+void Update(const char *name, LambdaT lambda) {
+  OpStatsRegistry &registry = GetRegistry();
+  std::lock_guard<std::mutex> lock(registry.mutex);
+  lambda(&registry.stats[name]);
+}
+
+}  // namespace
+
+void EnableOpStats(bool enable /*= true*/) {
+  GetRegistry();  // make sure it is destroyed after any user of it
+  internal::g_op_stats_enabled.store(enable);
+}
+
+void ResetOpStats() {
+  OpStatsRegistry &registry = GetRegistry();
+  std::lock_guard<std::mutex> lock(registry.mutex);
+  registry.stats.clear();
+}
+
+std::map<std::string, OpStats> GetOpStats() {
+  OpStatsRegistry &registry = GetRegistry();
+  std::lock_guard<std::mutex> lock(registry.mutex);
+  std::map<std::string, OpStats> ans;
+  for (const auto &p : registry.stats) {
+    OpStats &s = ans[p.first];
+    s.num_calls += p.second.num_calls;
+    s.num_kernel_launches += p.second.num_kernel_launches;
+    s.num_syncs += p.second.num_syncs;
+    s.num_allocations += p.second.num_allocations;
+    s.num_bytes_allocated += p.second.num_bytes_allocated;
+  }
+  return ans;
+}
+
+std::string OpStatsReport() {
+  std::map<std::string, OpStats> stats = GetOpStats();
+  std::vector<std::pair<std::string, OpStats>> sorted(stats.begin(),
+                                                      stats.end());
+  std::stable_sort(sorted.begin(), sorted.end(),
+                   [](const std::pair<std::string, OpStats> &a,
+                      const std::pair<std::string, OpStats> &b) {
+                     return a.second.num_kernel_launches >
+                            b.second.num_kernel_launches;
+                   });
+  std::ostringstream os;
+  os << std::setw(10) << "calls" << std::setw(10) << "launches"
+     << std::setw(10) << "syncs" << std::setw(10) << "allocs"
+     << std::setw(14) << "bytes"
+     << "  op\n";
+  for (const auto &p : sorted) {
+    const OpStats &s = p.second;
+    os << std::setw(10) << s.num_calls << std::setw(10)
+       << s.num_kernel_launches << std::setw(10) << s.num_syncs
+       << std::setw(10) << s.num_allocations << std::setw(14)
+       << s.num_bytes_allocated << "  " << p.first << "\n";
+  }
+  std::map<std::string, InitPhaseStats> init_phases = GetInitPhaseStats();
+  if (!init_phases.empty()) {
+    os << "\n" << std::setw(10) << "calls" << std::setw(14) << "seconds"
+       << "  initialization phase\n";
+    for (const auto &p : init_phases)
+      os << std::setw(10) << p.second.num_calls << std::setw(14)
+         << std::fixed << std::setprecision(6) << p.second.seconds << "  "
+         << p.first << "\n";
+  }
+  return os.str();
+}
+
+std::map<std::string, InitPhaseStats> GetInitPhaseStats() {
+  OpStatsRegistry &registry = GetRegistry();
+  std::lock_guard<std::mutex> lock(registry.mutex);
+  std::map<std::string, InitPhaseStats> ans;
+  for (const auto &p : registry.init_phases) {
+    InitPhaseStats &s = ans[p.first];
+    s.num_calls += p.second.num_calls;
+    s.seconds += p.second.seconds;
+  }
+  return ans;
+}
+
+void SetAllocationObserver(std::shared_ptr<AllocationObserver> observer) {
+  std::lock_guard<std::mutex> lock(GetObserverMutex());
+  internal::g_allocation_observer_set.store(observer != nullptr);
+  GetObserver() = std::move(observer);
+}
+
+void AllocationTracer::OnAllocate(const void *data, std::size_t num_bytes,
+                                  const char *op) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  live_[data] = Allocation{num_bytes, op, Clock::now()};
+  OpAllocationStats &s = stats_[op];
+  ++s.num_allocations;
+  s.num_bytes_allocated += num_bytes;
+  s.live_bytes += num_bytes;
+  s.peak_live_bytes = std::max(s.peak_live_bytes, s.live_bytes);
+  live_bytes_ += num_bytes;
+  if (live_bytes_ > peak_live_bytes_) {
+    peak_live_bytes_ = live_bytes_;
+    for (auto &p : stats_) p.second.live_bytes_at_peak = p.second.live_bytes;
+  }
+}
+
+void AllocationTracer::OnDeallocate(const void *data) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto iter = live_.find(data);
+  if (iter == live_.end()) return;  // allocated before the tracer was set
+  const Allocation &a = iter->second;
+  OpAllocationStats &s = stats_[a.op];
+  s.live_bytes -= a.num_bytes;
+  s.total_lifetime_seconds +=
+      std::chrono::duration<double>(Clock::now() - a.time).count();
+  ++s.num_freed;
+  live_bytes_ -= a.num_bytes;
+  live_.erase(iter);
+}
+
+void AllocationTracer::Reset() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  live_.clear();
+  stats_.clear();
+  live_bytes_ = 0;
+  peak_live_bytes_ = 0;
+}
+
+int64_t AllocationTracer::LiveBytes() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return live_bytes_;
+}
+
+int64_t AllocationTracer::PeakLiveBytes() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return peak_live_bytes_;
+}
+
+std::map<std::string, OpAllocationStats> AllocationTracer::GetStats() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  std::map<std::string, OpAllocationStats> ans;
+  for (const auto &p : stats_) {
+    OpAllocationStats &s = ans[p.first];
+    const OpAllocationStats &t = p.second;
+    s.num_allocations += t.num_allocations;
+    s.num_bytes_allocated += t.num_bytes_allocated;
+    s.live_bytes += t.live_bytes;
+    // an upper bound if several entries have the same name
+    s.peak_live_bytes += t.peak_live_bytes;
+    s.live_bytes_at_peak += t.live_bytes_at_peak;
+    s.total_lifetime_seconds += t.total_lifetime_seconds;
+    s.num_freed += t.num_freed;
+  }
+  return ans;
+}
+
+std::string AllocationTracer::Report(int32_t max_ops /*= 20*/) const {
+  std::map<std::string, OpAllocationStats> stats = GetStats();
+  std::vector<std::pair<std::string, OpAllocationStats>> sorted(stats.begin(),
+                                                                stats.end());
+  std::stable_sort(sorted.begin(), sorted.end(),
+                   [](const std::pair<std::string, OpAllocationStats> &a,
+                      const std::pair<std::string, OpAllocationStats> &b) {
+                     if (a.second.live_bytes_at_peak !=
+                         b.second.live_bytes_at_peak)
+                       return a.second.live_bytes_at_peak >
+                              b.second.live_bytes_at_peak;
+                     return a.second.num_bytes_allocated >
+                            b.second.num_bytes_allocated;
+                   });
+  if (static_cast<int32_t>(sorted.size()) > max_ops) sorted.resize(max_ops);
+  std::ostringstream os;
+  os << "Peak live bytes: " << PeakLiveBytes()
+     << ", live bytes: " << LiveBytes() << "\n";
+  os << std::setw(14) << "at_peak" << std::setw(14) << "op_peak"
+     << std::setw(10) << "allocs" << std::setw(14) << "bytes"
+     << std::setw(14) << "mean_life_us"
+     << "  op\n";
+  for (const auto &p : sorted) {
+    const OpAllocationStats &s = p.second;
+    double mean_life_us =
+        s.num_freed > 0 ? s.total_lifetime_seconds / s.num_freed * 1e6 : 0;
+    os << std::setw(14) << s.live_bytes_at_peak << std::setw(14)
+       << s.peak_live_bytes << std::setw(10) << s.num_allocations
+       << std::setw(14) << s.num_bytes_allocated << std::setw(14)
+       << std::fixed << std::setprecision(1) << mean_life_us << "  "
+       << p.first << "\n";
+  }
+  return os.str();
+}
+
+namespace internal {
+
+void PushOpStatsRange(const char *name) {
+  op_stack.push_back(name);
+  if (OpStatsEnabled()) Update(name, [](OpStats *s) { ++s->num_calls; });
+}
+
+void PopOpStatsRange() {
+  if (!op_stack.empty()) op_stack.pop_back();
+}
+
+void RecordKernelLaunch() {
+  Update(CurrentOp(), [](OpStats *s) { ++s->num_kernel_launches; });
+}
+
+void RecordSync() {
+  Update(CurrentOp(), [](OpStats *s) { ++s->num_syncs; });
+}
+
+void RecordAllocation(std::size_t num_bytes) {
+  Update(CurrentOp(), [num_bytes](OpStats *s) {
+    ++s->num_allocations;
+    s->num_bytes_allocated += num_bytes;
+  });
+}
+
+void NotifyAllocation(const void *data, std::size_t num_bytes) {
+  std::shared_ptr<AllocationObserver> observer = CurrentObserver();
+  if (observer != nullptr) observer->OnAllocate(data, num_bytes, CurrentOp());
+}
+
+void NotifyDeallocation(const void *data) {
+  std::shared_ptr<AllocationObserver> observer = CurrentObserver();
+  if (observer != nullptr) observer->OnDeallocate(data);
+}
+
+void RecordInitPhase(const char *name, double seconds) {
+  OpStatsRegistry &registry = GetRegistry();
+  std::lock_guard<std::mutex> lock(registry.mutex);
+  InitPhaseStats &s = registry.init_phases[name];
+  ++s.num_calls;
+  s.seconds += seconds;
+}
+
+}  // namespace internal
+
+}  // namespace k2
@@ -0,0 +1,255 @@
+/**
+ * Copyright      2026  Xiaomi Corporation
+ *
+ * See LICENSE for clarification regarding multiple authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+  Opt-in per-op counters of kernel launches, device-to-host syncs and memory
+  allocations, for finding out which ops are launch- or sync-bound.
+
+  Counts are attributed to the innermost enclosing NVTX_RANGE() on the
+  current thread (usually NVTX_RANGE(K2_FUNC)), or to "<none>" if there is
+  none.  Collection is disabled by default and costs one relaxed atomic load
+  per event when disabled.  It can be enabled with EnableOpStats(), or by
+  setting the environment variable K2_OP_STATS, in which case a report is
+  also printed to stderr when the program exits.
+
+  The one-time initialization phases (finding CUDA devices, creating the CUDA
+  context, allocators etc.) are timed separately, always, since they happen
+  only a few times per process; see GetInitPhaseStats().
+
+  Memory allocations can also be traced one by one with an
+  AllocationObserver, e.g. an AllocationTracer, which finds out which ops hold
+  the memory when the memory usage peaks.  Setting the environment variable
+  K2_ALLOC_TRACE installs an AllocationTracer and prints its report to stderr
+  when the program exits.
+ */
+
+#ifndef K2_CSRC_OP_STATS_H_
+#define K2_CSRC_OP_STATS_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <chrono>  // NOLINT
+#include <map>
+#include <memory>
+#include <mutex>  // NOLINT
+#include <string>
+#include <unordered_map>
+
+namespace k2 {
+
+struct OpStats {
+  int64_t num_calls = 0;  // number of times the NVTX_RANGE was entered
+  int64_t num_kernel_launches = 0;
+  int64_t num_syncs = 0;  // stream syncs and device-to-host copies
+  int64_t num_allocations = 0;
+  int64_t num_bytes_allocated = 0;
+};
+
+// Enables or disables collection; existing counts are kept.
+void EnableOpStats(bool enable = true);
+
+// Clears all counts collected so far.
+void ResetOpStats();
+
+// Returns a snapshot of the counts, indexed by op name.
+std::map<std::string, OpStats> GetOpStats();
+
+// Returns a human-readable table of the counts, ops with the most kernel
+// launches first, followed by the initialization phases if any.
+std::string OpStatsReport();
+
+struct InitPhaseStats {
+  int64_t num_calls = 0;
+  double seconds = 0;  // total time spent in the phase
+};
+
+/* Returns the time spent so far in each initialization phase, indexed by
+   phase name.  The phases are:
+
+     "CudaProbe"         checking for CUDA devices, on the first request for a
+                         CUDA or pinned context;
+     "CudaContext"       creating the CUDA context of a device (without
+                         PyTorch, which does it itself);
+     "CudaAllocator"     creating k2's allocator for a device (without
+                         PyTorch);
+     "PinnedMemory"      the first cudaMallocHost() for pinned memory;
+     "ModernGpuContext"  creating the moderngpu context of a stream, on the
+                         first sort or segmented reduction on it.
+
+   These are recorded whether or not collection is enabled, and are not
+   cleared by ResetOpStats().  See also PrewarmCuda() in context.h.
+ */
+std::map<std::string, InitPhaseStats> GetInitPhaseStats();
+
+/* Observer of the memory allocated by k2, i.e. of the memory of Regions and
+   of the temporary buffers of moderngpu.  Memory that k2 did not allocate
+   (e.g. tensors from PyTorch shared via DLPack) is not observed.  The
+   methods may be called from several threads at once.
+ */
+class AllocationObserver {
+ public:
+  virtual ~AllocationObserver() = default;
+
+  /* Called after `num_bytes` bytes have been allocated at `data` (not null).
+     `op` is the innermost enclosing NVTX_RANGE() on the current thread, as
+     for OpStats, or "<none>".
+   */
+  virtual void OnAllocate(const void *data, std::size_t num_bytes,
+                          const char *op) = 0;
+
+  // Called before the memory at `data`, allocated after the observer was set,
+  // is freed.
+  virtual void OnDeallocate(const void *data) = 0;
+};
+
+/* Install `observer`, which is notified of the allocations and deallocations
+   from now on, replacing the previous one; nullptr removes it.  Ops are known
+   only for the NVTX_RANGE()s entered after this call.
+ */
+void SetAllocationObserver(std::shared_ptr<AllocationObserver> observer);
+
+struct OpAllocationStats {
+  int64_t num_allocations = 0;
+  int64_t num_bytes_allocated = 0;
+  int64_t live_bytes = 0;       // bytes allocated and not yet freed
+  int64_t peak_live_bytes = 0;  // the largest live_bytes of this op
+  // live_bytes of this op when the total live bytes (of all ops) peaked
+  int64_t live_bytes_at_peak = 0;
+  // sum over the freed allocations of the seconds between allocation and
+  // deallocation
+  double total_lifetime_seconds = 0;
+  int64_t num_freed = 0;  // number of allocations that have been freed
+};
+
+/* An AllocationObserver that keeps track of the live allocations, and
+   attributes them to the ops that allocated them.
+ */
+class AllocationTracer : public AllocationObserver {
+ public:
+  void OnAllocate(const void *data, std::size_t num_bytes,
+                  const char *op) override;
+  void OnDeallocate(const void *data) override;
+
+  // Forget everything recorded so far, including the live allocations.
+  void Reset();
+
+  int64_t LiveBytes() const;      // bytes allocated and not yet freed
+  int64_t PeakLiveBytes() const;  // the largest LiveBytes() so far
+
+  // Returns a snapshot of the stats, indexed by op name.
+  std::map<std::string, OpAllocationStats> GetStats() const;
+
+  /* Returns a human-readable table of the `max_ops` ops that held the most
+     memory when the total live bytes peaked (then by bytes allocated), after
+     a summary line with the peak.
+   */
+  std::string Report(int32_t max_ops = 20) const;
+
+ private:
+  using Clock = std::chrono::steady_clock;
+  struct Allocation {
+    std::size_t num_bytes;
+    const char *op;
+    Clock::time_point time;
+  };
+
+  mutable std::mutex mutex_;
+  std::unordered_map<const void *, Allocation> live_;
+  // Keyed by the address of the op name, like the OpStats.
+  std::unordered_map<const char *, OpAllocationStats> stats_;
+  int64_t live_bytes_ = 0;
+  int64_t peak_live_bytes_ = 0;
+};
+
+namespace internal {
+
+extern std::atomic<bool> g_op_stats_enabled;
+extern std::atomic<bool> g_allocation_observer_set;
+
+inline bool OpStatsEnabled() {
+  return g_op_stats_enabled.load(std::memory_order_relaxed);
+}
+
+inline bool AllocationObserverSet() {
+  return g_allocation_observer_set.load(std::memory_order_relaxed);
+}
+
+// True if the NVTX_RANGE()s need to be tracked, for the OpStats or for the
+// AllocationObserver.
+inline bool OpRangesEnabled() {
+  return OpStatsEnabled() || AllocationObserverSet();
+}
+
+// `name` must outlive the program, e.g. a string literal or K2_FUNC.
+void PushOpStatsRange(const char *name);
+void PopOpStatsRange();
+
+void RecordKernelLaunch();
+void RecordSync();
+void RecordAllocation(std::size_t num_bytes);
+void NotifyAllocation(const void *data, std::size_t num_bytes);
+void NotifyDeallocation(const void *data);
+// `name` must outlive the program, e.g. a string literal.
+void RecordInitPhase(const char *name, double seconds);
+
+}  // namespace internal
+
+// Called from the launch sites in eval.h and from the Context
+// implementations; these are no-ops unless collection is enabled or an
+// AllocationObserver is set.
+inline void OpStatsKernelLaunch() {
+  if (internal::OpStatsEnabled()) internal::RecordKernelLaunch();
+}
+inline void OpStatsSync() {
+  if (internal::OpStatsEnabled()) internal::RecordSync();
+}
+inline void OpStatsAllocation(const void *data, std::size_t num_bytes) {
+  if (internal::OpStatsEnabled()) internal::RecordAllocation(num_bytes);
+  if (internal::AllocationObserverSet() && data != nullptr)
+    internal::NotifyAllocation(data, num_bytes);
+}
+inline void OpStatsDeallocation(const void *data) {
+  if (internal::AllocationObserverSet() && data != nullptr)
+    internal::NotifyDeallocation(data);
+}
+
+/* Times its scope as the initialization phase `name` (see
+   GetInitPhaseStats()), which must be a string literal; nothing is recorded
+   if `name` is nullptr.
+ */
+class InitPhaseTimer {
+ public:
+  explicit InitPhaseTimer(const char *name)
+      : name_(name), start_(std::chrono::steady_clock::now()) {}
+
+  ~InitPhaseTimer() {
+    if (name_ == nullptr) return;
+    std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start_;
+    internal::RecordInitPhase(name_, elapsed.count());
+  }
+
+ private:
+  const char *name_;
+  std::chrono::steady_clock::time_point start_;
+};
+
+}  // namespace k2
+
+#endif  // K2_CSRC_OP_STATS_H_
@@ -0,0 +1,132 @@
+/**
+ * Copyright      2026  Xiaomi Corporation
+ *
+ * See LICENSE for clarification regarding multiple authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <gtest/gtest.h>
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+
+#include "k2/csrc/array.h"
+#include "k2/csrc/context.h"
+#include "k2/csrc/op_stats.h"
+#include "k2/csrc/test_utils.h"
+
+namespace k2 {
+
+// Allocates an array and fills it with one kernel (on GPU).
+static void OpStatsTestOp(ContextPtr c) {
+  NVTX_RANGE("OpStatsTestOp");
+  Array1<int32_t> a(c, 100);
+  int32_t *a_data = a.Data();
+  K2_EVAL(
+      c, a.Dim(), lambda_set, (int32_t i)->void { a_data[i] = i; });
+  EXPECT_EQ(a.Back(), 99);
+}
+
+TEST(OpStats, Basic) {
+  for (auto &c : {GetCpuContext(), GetCudaContext()}) {
+    EnableOpStats();
+    ResetOpStats();
+    OpStatsTestOp(c);
+    OpStatsTestOp(c);
+    EnableOpStats(false);
+    OpStatsTestOp(c);  // not counted
+
+    std::map<std::string, OpStats> stats = GetOpStats();
+    ASSERT_EQ(stats.count("OpStatsTestOp"), 1);
+    const OpStats &s = stats["OpStatsTestOp"];
+    EXPECT_EQ(s.num_calls, 2);
+    EXPECT_EQ(s.num_allocations, 2);
+    EXPECT_EQ(s.num_bytes_allocated, 2 * 100 * sizeof(int32_t));
+    if (c->GetDeviceType() == kCuda) {
+      // The K2_EVAL is counted against the op, not against Eval() itself.
+      EXPECT_EQ(s.num_kernel_launches, 2);
+      EXPECT_EQ(s.num_syncs, 2);  // from a.Back()
+    } else {
+      EXPECT_EQ(s.num_kernel_launches, 0);
+      EXPECT_EQ(s.num_syncs, 0);
+    }
+    EXPECT_NE(OpStatsReport().find("OpStatsTestOp"), std::string::npos);
+  }
+  ResetOpStats();
+}
+
+TEST(OpStats, InitPhases) {
+  for (int32_t i = 0; i != 2; ++i) InitPhaseTimer timer("OpStatsTestPhase");
+  { InitPhaseTimer timer(nullptr); }  // not recorded
+  ResetOpStats();  // does not clear the phases
+
+  std::map<std::string, InitPhaseStats> stats = GetInitPhaseStats();
+  ASSERT_EQ(stats.count("OpStatsTestPhase"), 1);
+  EXPECT_EQ(stats["OpStatsTestPhase"].num_calls, 2);
+  EXPECT_GE(stats["OpStatsTestPhase"].seconds, 0);
+  EXPECT_NE(OpStatsReport().find("OpStatsTestPhase"), std::string::npos);
+
+  PrewarmCuda();
+  stats = GetInitPhaseStats();
+  EXPECT_EQ(stats.count("CudaProbe"), 1);
+  if (GetCudaContext()->GetDeviceType() == kCuda) {
+    EXPECT_EQ(stats.count("ModernGpuContext"), 1);
+    EXPECT_EQ(stats.count("PinnedMemory"), 1);
+  }
+}
+
+TEST(OpStats, AllocationTracer) {
+  for (auto &c : {GetCpuContext(), GetCudaContext()}) {
+    auto tracer = std::make_shared<AllocationTracer>();
+    SetAllocationObserver(tracer);
+    Array1<int32_t> kept;
+    {
+      NVTX_RANGE("AllocationTracerTestOp");
+      kept = Array1<int32_t>(c, 1000);
+      Array1<int32_t> temp(c, 500);
+    }
+    OpStatsTestOp(c);
+    SetAllocationObserver(nullptr);
+
+    int64_t kept_bytes = 1000 * sizeof(int32_t),
+            temp_bytes = 500 * sizeof(int32_t);
+    EXPECT_EQ(tracer->LiveBytes(), kept_bytes);
+    EXPECT_EQ(tracer->PeakLiveBytes(), kept_bytes + temp_bytes);
+
+    std::map<std::string, OpAllocationStats> stats = tracer->GetStats();
+    ASSERT_EQ(stats.count("AllocationTracerTestOp"), 1);
+    const OpAllocationStats &s = stats["AllocationTracerTestOp"];
+    EXPECT_EQ(s.num_allocations, 2);
+    EXPECT_EQ(s.num_bytes_allocated, kept_bytes + temp_bytes);
+    EXPECT_EQ(s.live_bytes, kept_bytes);
+    EXPECT_EQ(s.peak_live_bytes, kept_bytes + temp_bytes);
+    EXPECT_EQ(s.live_bytes_at_peak, kept_bytes + temp_bytes);
+    EXPECT_EQ(s.num_freed, 1);
+
+    ASSERT_EQ(stats.count("OpStatsTestOp"), 1);
+    const OpAllocationStats &t = stats["OpStatsTestOp"];
+    EXPECT_EQ(t.num_allocations, 1);
+    EXPECT_EQ(t.live_bytes, 0);
+    EXPECT_EQ(t.live_bytes_at_peak, 0);
+    EXPECT_EQ(t.num_freed, 1);
+
+    std::string report = tracer->Report(1);
+    EXPECT_NE(report.find("AllocationTracerTestOp"), std::string::npos);
+    EXPECT_EQ(report.find("OpStatsTestOp"), std::string::npos);
+  }
+}
+
+}  // namespace k2
@@ -0,0 +1,246 @@
+/**
+ * Copyright      2026  Xiaomi Corporation
+ *
+ * See LICENSE for clarification regarding multiple authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <algorithm>
+#include <fstream>
+#include <limits>
+#include <string>
+#include <vector>
+
+#include "k2/csrc/openfst_binary.h"
+
+namespace k2 {
+
+namespace {
+
+// Constants from OpenFst (fst/fst.h and fst/symbol-table.cc).
+constexpr int32_t kFstMagicNumber = 2125659606;
+constexpr int32_t kSymbolTableMagicNumber = 2125658996;
+constexpr int32_t kHasInputSymbols = 0x1;
+constexpr int32_t kHasOutputSymbols = 0x2;
+constexpr int32_t kIsAligned = 0x4;
+constexpr int32_t kFileAlign = 16;
+// Version 1 of the const format is always aligned.
+constexpr int32_t kConstAlignedFileVersion = 1;
+
+// The layout of an arc with float weights, both in memory (ArcTpl) and as
+// written by VectorFst, which writes the fields one after another.
+struct OpenFstArc {
+  int32_t ilabel;
+  int32_t olabel;
+  float weight;
+  int32_t nextstate;
+};
+static_assert(sizeof(OpenFstArc) == 16, "");
+
+// ConstState of ConstFst<Arc, uint32>.
+struct OpenFstConstState {
+  float final_weight;
+  uint32_t pos;
+  uint32_t narcs;
+  uint32_t niepsilons;
+  uint32_t noepsilons;
+};
+static_assert(sizeof(OpenFstConstState) == 20, "");
+
+class OpenFstBinaryReader {
+ public:
+  explicit OpenFstBinaryReader(const std::string &filename)
+      : filename_(filename), is_(filename, std::ios::binary) {
+    if (!is_) K2_LOG(FATAL) << "Failed to open " << filename;
+  }
+
+  template <typename T>
+  T Read() {
+    T ans;
+    ReadBytes(&ans, sizeof(T));
+    return ans;
+  }
+
+  void ReadBytes(void *dst, std::size_t num_bytes) {
+    is_.read(static_cast<char *>(dst), num_bytes);
+    if (!is_)
+      K2_LOG(FATAL) << "Unexpected end of file or read error in "
+                    << filename_;
+  }
+
+  std::string ReadString() {
+    int32_t size = Read<int32_t>();
+    if (size < 0) K2_LOG(FATAL) << "Bad string length in " << filename_;
+    std::string ans(size, '\0');
+    if (size != 0) ReadBytes(&ans[0], size);
+    return ans;
+  }
+
+  void SkipSymbolTable() {
+    if (Read<int32_t>() != kSymbolTableMagicNumber)
+      K2_LOG(FATAL) << "Bad symbol table in " << filename_;
+    ReadString();  // name
+    Read<int64_t>();  // available key
+    int64_t size = Read<int64_t>();
+    for (int64_t i = 0; i < size; ++i) {
+      ReadString();
+      Read<int64_t>();
+    }
+  }
+
+  // Skips to the next multiple of kFileAlign bytes from the start of the
+  // file, as OpenFst's AlignInput() does.
+  void Align() {
+    int64_t pos = is_.tellg();
+    if (pos % kFileAlign != 0)
+      is_.seekg(kFileAlign - pos % kFileAlign, std::ios::cur);
+  }
+
+  bool AtEof() { return is_.peek() == std::char_traits<char>::eof(); }
+
+  const std::string &Filename() const { return filename_; }
+
+ private:
+  std::string filename_;
+  std::ifstream is_;
+};
+
+}  // namespace
+
+Fsa FsaFromOpenFstBinary(const std::string &filename,
+                         Array1<int32_t> *aux_labels /*= nullptr*/,
+                         ContextPtr c /*= nullptr*/) {
+  NVTX_RANGE(K2_FUNC);
+  if (c == nullptr) c = GetCpuContext();
+  K2_CHECK_EQ(c->GetDeviceType(), kCpu);
+  OpenFstBinaryReader reader(filename);
+
+  // The header; see FstHeader::Read().
+  if (reader.Read<int32_t>() != kFstMagicNumber)
+    K2_LOG(FATAL) << filename << " is not an OpenFst binary FST";
+  std::string fst_type = reader.ReadString(),
+              arc_type = reader.ReadString();
+  int32_t version = reader.Read<int32_t>(), flags = reader.Read<int32_t>();
+  reader.Read<uint64_t>();  // properties
+  int64_t start = reader.Read<int64_t>(),
+          num_states = reader.Read<int64_t>(),
+          num_arcs = reader.Read<int64_t>();
+  if (arc_type != "standard" && arc_type != "log")
+    K2_LOG(FATAL) << "Unsupported arc type '" << arc_type << "' in "
+                  << filename << "; only float weights are supported";
+  if (flags & kHasInputSymbols) reader.SkipSymbolTable();
+  if (flags & kHasOutputSymbols) reader.SkipSymbolTable();
+
+  // For each state: its final cost, and the position and number of its arcs
+  // in `arcs`.
+  std::vector<float> final_costs;
+  std::vector<int64_t> arc_pos, arc_nums;
+  std::vector<OpenFstArc> arcs;
+  if (fst_type == "vector") {
+    // Each state is written as its final cost, its number of arcs (int64)
+    // and its arcs.  The number of states is -1 if it was not known.
+    for (int64_t s = 0; num_states < 0 ? !reader.AtEof() : s < num_states;
+         ++s) {
+      final_costs.push_back(reader.Read<float>());
+      int64_t n = reader.Read<int64_t>();
+      K2_CHECK_GE(n, 0) << "Bad number of arcs in " << filename;
+      arc_pos.push_back(arcs.size());
+      arc_nums.push_back(n);
+      arcs.resize(arcs.size() + n);
+      if (n != 0)
+        reader.ReadBytes(arcs.data() + arcs.size() - n,
+                         n * sizeof(OpenFstArc));
+    }
+    num_states = final_costs.size();
+  } else if (fst_type == "const") {
+    // An array of states and then an array of arcs.
+    K2_CHECK_GE(num_states, 0) << "Bad number of states in " << filename;
+    K2_CHECK_GE(num_arcs, 0) << "Bad number of arcs in " << filename;
+    bool aligned =
+        (flags & kIsAligned) || version == kConstAlignedFileVersion;
+    std::vector<OpenFstConstState> states(num_states);
+    if (aligned) reader.Align();
+    if (num_states != 0)
+      reader.ReadBytes(states.data(), num_states * sizeof(OpenFstConstState));
+    arcs.resize(num_arcs);
+    if (aligned) reader.Align();
+    if (num_arcs != 0)
+      reader.ReadBytes(arcs.data(), num_arcs * sizeof(OpenFstArc));
+    for (const OpenFstConstState &state : states) {
+      if (static_cast<int64_t>(state.pos) + state.narcs > num_arcs)
+        K2_LOG(FATAL) << "Bad arc range of a state in " << filename;
+      final_costs.push_back(state.final_weight);
+      arc_pos.push_back(state.pos);
+      arc_nums.push_back(state.narcs);
+    }
+  } else {
+    K2_LOG(FATAL) << "Unsupported FST type '" << fst_type << "' in "
+                  << filename << "; only vector and const are supported";
+  }
+
+  if (start < 0) {  // There is no start state, so the FST is empty.
+    if (aux_labels != nullptr) *aux_labels = Array1<int32_t>(c, 0);
+    return Fsa(EmptyRaggedShape(c, 2));
+  }
+  K2_CHECK_LT(start, num_states) << "Bad start state in " << filename;
+  K2_CHECK_LT(num_states, std::numeric_limits<int32_t>::max());
+
+  // We swap states 0 and `start`, and add a super-final state.
+  int32_t super_final_state = std::max<int32_t>(num_states, 1),
+          start_state = static_cast<int32_t>(start);
+  auto map_state = [start_state](int32_t s) -> int32_t {
+    return s == start_state ? 0 : (s == 0 ? start_state : s);
+  };
+  const float inf = std::numeric_limits<float>::infinity();
+
+  Array1<int32_t> row_splits(c, super_final_state + 2);
+  int32_t *row_splits_data = row_splits.Data();
+  int64_t tot_arcs = 0;
+  for (int32_t s = 0; s <= super_final_state; ++s) {
+    row_splits_data[s] = static_cast<int32_t>(tot_arcs);
+    if (s == super_final_state) continue;
+    int32_t old_s = map_state(s);
+    tot_arcs += arc_nums[old_s] + (final_costs[old_s] != inf ? 1 : 0);
+    K2_CHECK_LE(tot_arcs, std::numeric_limits<int32_t>::max());
+  }
+  row_splits_data[super_final_state + 1] = static_cast<int32_t>(tot_arcs);
+
+  Array1<Arc> ans_arcs(c, tot_arcs);
+  Array1<int32_t> ans_aux_labels(c, aux_labels != nullptr ? tot_arcs : 0);
+  Arc *ans_arcs_data = ans_arcs.Data();
+  int32_t *ans_aux_labels_data =
+      (aux_labels != nullptr ? ans_aux_labels.Data() : nullptr);
+  for (int32_t s = 0; s < super_final_state; ++s) {
+    int32_t old_s = map_state(s), idx = row_splits_data[s];
+    const OpenFstArc *src = arcs.data() + arc_pos[old_s];
+    for (int64_t a = 0; a < arc_nums[old_s]; ++a, ++idx) {
+      const OpenFstArc &arc = src[a];
+      if (arc.nextstate < 0 || arc.nextstate >= num_states)
+        K2_LOG(FATAL) << "Bad destination state " << arc.nextstate << " in "
+                      << filename;
+      ans_arcs_data[idx] =
+          Arc(s, map_state(arc.nextstate), arc.ilabel, -arc.weight);
+      if (ans_aux_labels_data != nullptr)
+        ans_aux_labels_data[idx] = arc.olabel;
+    }
+    if (final_costs[old_s] != inf) {
+      ans_arcs_data[idx] = Arc(s, super_final_state, -1, -final_costs[old_s]);
+      if (ans_aux_labels_data != nullptr) ans_aux_labels_data[idx] = -1;
+    }
+  }
+  if (aux_labels != nullptr) *aux_labels = ans_aux_labels;
+  return Fsa(RaggedShape2(&row_splits, nullptr, tot_arcs), ans_arcs);
+}
+
+}  // namespace k2
@@ -0,0 +1,58 @@
+/**
+ * Copyright      2026  Xiaomi Corporation
+ *
+ * See LICENSE for clarification regarding multiple authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef K2_CSRC_OPENFST_BINARY_H_
+#define K2_CSRC_OPENFST_BINARY_H_
+
+#include <string>
+
+#include "k2/csrc/array.h"
+#include "k2/csrc/fsa.h"
+
+namespace k2 {
+
+/*
+  Read an FST in OpenFst's binary format (as written by fstcompile or
+  Fst::Write()), without OpenFst and without going through the text format.
+
+  The "vector" and "const" FST types are supported, with the "standard"
+  (tropical) or "log" arc types, i.e. with float weights; the symbol tables,
+  if any, are skipped.
+
+  As for FsaFromString() with openfst == true, the costs are negated to
+  get scores, the start state is renumbered to 0 (by swapping it with state
+  0) and a super-final state is added, with an arc with label -1 from each
+  final state whose score is the negated final cost.
+
+     @param [in] filename  The file to read.
+     @param [out] aux_labels  If not NULL, it is set to the output labels of
+                     the arcs (-1 on the arcs to the super-final state); the
+                     labels of the returned Fsa are the input labels.
+     @param [in] c   The context to allocate the result with; it must be a
+                     CPU context (e.g. the one returned by GetPinnedContext(),
+                     for a fast transfer to GPU).  If NULL, GetCpuContext()
+                     is used.
+     @return  Returns the FSA, which has 2 axes.
+ */
+Fsa FsaFromOpenFstBinary(const std::string &filename,
+                         Array1<int32_t> *aux_labels = nullptr,
+                         ContextPtr c = nullptr);
+
+}  // namespace k2
+
+#endif  // K2_CSRC_OPENFST_BINARY_H_
@@ -0,0 +1,157 @@
+/**
+ * Copyright      2026  Xiaomi Corporation
+ *
+ * See LICENSE for clarification regarding multiple authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <cstdio>
+#include <fstream>
+#include <limits>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "k2/csrc/array_ops.h"
+#include "k2/csrc/fsa_utils.h"
+#include "k2/csrc/openfst_binary.h"
+#include "k2/csrc/ragged_ops.h"
+
+namespace k2 {
+
+namespace {
+
+struct TestArc {
+  int32_t ilabel, olabel;
+  float weight;
+  int32_t nextstate;
+};
+
+// An FST with states 0, 1, 2, 3 and start state 1.
+const int32_t kStart = 1;
+const std::vector<float> kFinalCosts = {
+    std::numeric_limits<float>::infinity(), 0.5,
+    std::numeric_limits<float>::infinity(), 1.25};
+const std::vector<std::vector<TestArc>> kArcs = {
+    {{3, 30, 0.25, 3}},
+    {{1, 10, 1.5, 0}, {2, 0, 2.5, 2}},
+    {{4, 40, -1, 3}, {5, 50, 0, 1}},
+    {}};
+// The same in the OpenFst text format, with aux labels.
+const char *kText = R"(1 0 1 10 1.5
+1 2 2 0 2.5
+0 3 3 30 0.25
+2 3 4 40 -1
+2 1 5 50 0
+1 0.5
+3 1.25
+)";
+
+template <typename T>
+void Write(std::ostream &os, const T &t) {
+  os.write(reinterpret_cast<const char *>(&t), sizeof(T));
+}
+
+void WriteString(std::ostream &os, const std::string &s) {
+  Write<int32_t>(os, s.size());
+  os.write(s.data(), s.size());
+}
+
+void WriteHeader(std::ostream &os, const std::string &fst_type,
+                 int32_t flags, int64_t num_arcs) {
+  Write<int32_t>(os, 2125659606);
+  WriteString(os, fst_type);
+  WriteString(os, "standard");
+  Write<int32_t>(os, 2);  // version
+  Write<int32_t>(os, flags);
+  Write<uint64_t>(os, 0);  // properties
+  Write<int64_t>(os, kStart);
+  Write<int64_t>(os, kFinalCosts.size());
+  Write<int64_t>(os, num_arcs);
+  if (flags & 1) {  // an input symbol table
+    Write<int32_t>(os, 2125658996);
+    WriteString(os, "isyms");
+    Write<int64_t>(os, 2);
+    Write<int64_t>(os, 2);
+    WriteString(os, "<eps>");
+    Write<int64_t>(os, 0);
+    WriteString(os, "a");
+    Write<int64_t>(os, 1);
+  }
+}
+
+void WriteArcs(std::ostream &os, const std::vector<TestArc> &arcs) {
+  for (const TestArc &arc : arcs) {
+    Write(os, arc.ilabel);
+    Write(os, arc.olabel);
+    Write(os, arc.weight);
+    Write(os, arc.nextstate);
+  }
+}
+
+void Align(std::ostream &os) {
+  while (os.tellp() % 16 != 0) os.put('\0');
+}
+
+}  // namespace
+
+TEST(OpenFstBinary, FsaFromOpenFstBinary) {
+  Array2<int32_t> expected_aux_labels;
+  Fsa expected = FsaFromString(kText, true, 1, &expected_aux_labels);
+
+  std::string filename = ::testing::TempDir() + "k2_openfst_binary_test.fst";
+  for (const std::string fst_type : {"vector", "const"}) {
+    for (int32_t flags : {0, 1, 4}) {  // none, input symbols, aligned
+      if (fst_type == "vector" && flags == 4) continue;
+      {
+        std::ofstream os(filename, std::ios::binary);
+        int32_t num_arcs = 0;
+        for (const auto &arcs : kArcs) num_arcs += arcs.size();
+        WriteHeader(os, fst_type, flags, num_arcs);
+        if (fst_type == "vector") {
+          for (std::size_t s = 0; s != kArcs.size(); ++s) {
+            Write(os, kFinalCosts[s]);
+            Write<int64_t>(os, kArcs[s].size());
+            WriteArcs(os, kArcs[s]);
+          }
+        } else {
+          if (flags & 4) Align(os);
+          uint32_t pos = 0;
+          for (std::size_t s = 0; s != kArcs.size(); ++s) {
+            Write(os, kFinalCosts[s]);
+            Write<uint32_t>(os, pos);
+            Write<uint32_t>(os, kArcs[s].size());
+            Write<uint32_t>(os, 0);  // niepsilons
+            Write<uint32_t>(os, 0);  // noepsilons
+            pos += kArcs[s].size();
+          }
+          if (flags & 4) Align(os);
+          for (const auto &arcs : kArcs) WriteArcs(os, arcs);
+        }
+      }
+
+      Array1<int32_t> aux_labels;
+      Fsa fsa = FsaFromOpenFstBinary(filename, &aux_labels);
+      EXPECT_TRUE(Equal(fsa.shape, expected.shape));
+      EXPECT_TRUE(Equal(fsa.values, expected.values));
+      EXPECT_TRUE(Equal(aux_labels, expected_aux_labels.Row(0)));
+
+      fsa = FsaFromOpenFstBinary(filename, nullptr, GetPinnedContext());
+      EXPECT_TRUE(Equal(fsa.values.To(GetCpuContext()), expected.values));
+    }
+  }
+  std::remove(filename.c_str());
+}
+
+}  // namespace k2
@@ -0,0 +1,89 @@
+/**
+ * Copyright      2026  Xiaomi Corporation
+ *
+ * See LICENSE for clarification regarding multiple authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef K2_CSRC_PHILOX_H_
+#define K2_CSRC_PHILOX_H_
+
+#include <cstdint>
+
+#include "k2/csrc/context.h"
+
+namespace k2 {
+
+/*
+  The counter-based random number generator Philox4x32-10 (Salmon et al.,
+  "Parallel random numbers: as easy as 1, 2, 3", SC 2011), as used by
+  curand, for host and device code.  Its output is a pure function of the
+  64-bit `key` and the 128-bit counter (`counter_hi`, `counter_lo`), so each
+  thread can generate its numbers independently of the others, and the
+  results do not depend on how the work is scheduled.  Writes 4 random
+  32-bit numbers to `out`.
+ */
+__host__ __device__ __forceinline__ void Philox4x32(uint64_t key,
+                                                    uint64_t counter_hi,
+                                                    uint64_t counter_lo,
+                                                    uint32_t *out) {
+  const uint32_t kMul0 = 0xD2511F53u, kMul1 = 0xCD9E8D57u,
+                 kWeyl0 = 0x9E3779B9u, kWeyl1 = 0xBB67AE85u;
+  uint32_t k0 = static_cast<uint32_t>(key),
+           k1 = static_cast<uint32_t>(key >> 32),
+           c0 = static_cast<uint32_t>(counter_lo),
+           c1 = static_cast<uint32_t>(counter_lo >> 32),
+           c2 = static_cast<uint32_t>(counter_hi),
+           c3 = static_cast<uint32_t>(counter_hi >> 32);
+  for (int32_t round = 0; round < 10; ++round) {
+    uint64_t p0 = static_cast<uint64_t>(kMul0) * c0,
+             p1 = static_cast<uint64_t>(kMul1) * c2;
+    uint32_t hi0 = static_cast<uint32_t>(p0 >> 32),
+             lo0 = static_cast<uint32_t>(p0),
+             hi1 = static_cast<uint32_t>(p1 >> 32),
+             lo1 = static_cast<uint32_t>(p1);
+    c0 = hi1 ^ c1 ^ k0;
+    c1 = lo1;
+    c2 = hi0 ^ c3 ^ k1;
+    c3 = lo0;
+    k0 += kWeyl0;
+    k1 += kWeyl1;
+  }
+  out[0] = c0;
+  out[1] = c1;
+  out[2] = c2;
+  out[3] = c3;
+}
+
+/*
+  Returns a number from the uniform distribution on [0, 1), which is a pure
+  function of (seed, stream, index): e.g. stream may be an FSA-index and
+  index a path-index.  `FloatType` is float or double.
+ */
+template <typename FloatType>
+__host__ __device__ __forceinline__ FloatType PhiloxUniform(uint64_t seed,
+                                                            uint64_t stream,
+                                                            uint64_t index) {
+  uint32_t r[4];
+  Philox4x32(seed, stream, index, r);
+  // 53 random bits; for float, the 24 most significant of them.
+  uint64_t bits = (static_cast<uint64_t>(r[0]) << 21) ^ (r[1] >> 11);
+  if (sizeof(FloatType) == sizeof(float))
+    return static_cast<FloatType>(bits >> 29) * (1.0f / 16777216.0f);
+  return static_cast<FloatType>(bits) * (1.0 / 9007199254740992.0);
+}
+
+}  // namespace k2
+
+#endif  // K2_CSRC_PHILOX_H_
@@ -19,11 +19,12 @@
 #include <string.h>  // memcpy
 
 #include <deque>
-#include <functional>
+#include <limits>
 #include <mutex>  // NOLINT
-#include <set>
 #include <unordered_map>
 #include <unordered_set>
+#include <utility>
+#include <vector>
 
 #include "k2/csrc/context.h"
 #include "k2/csrc/log.h"
@@ -34,49 +35,42 @@ namespace k2 {
 
 namespace {
 
-struct BlockSize {
-  size_t size;  // size of this memory block in bytes
-  void *ptr;    // pointer to the beginning of this memory block
-
-  explicit BlockSize(size_t size, void *ptr = nullptr) : size(size), ptr(ptr) {}
-};
-
-struct Block : public BlockSize {
+struct Block {
+  size_t size;     // size of this memory block in bytes (a size class)
   bool allocated;  // true if the block is currently allocated
                    // false if the block is available for allocation
 
   int event_count;  // number of outstanding cuda events
   std::unordered_set<cudaStream_t> streams;
 
-  Block(size_t size, void *ptr, bool allocated)
-      : BlockSize(size, ptr), allocated(allocated), event_count(0), streams() {}
+  explicit Block(size_t size)
+      : size(size), allocated(true), event_count(0), streams() {}
 };
 
-static bool BlockComparator(const BlockSize &a, const BlockSize &b) {
-  NVTX_RANGE(K2_FUNC);
-  // sort by size, break ties with pointer
-  if (a.size != b.size) return a.size < b.size;
-
-  return std::less<void *>()(a.ptr, b.ptr);
-}
-
 /* Allocate pinned memory using cudaMallocHost with caching.
 
-  WARNING: Once memory is allocated, it is not returned to the system.
-  Use it with care!
+  Requested sizes are rounded up to a size class: a power of 2 (at least
+  kMinBlockSize) below kLargeBlockSize, and a multiple of kLargeBlockSize
+  above, and each size class has its own list of free blocks, so finding a
+  block is O(1).  A freed block that is still read by copies queued on CUDA
+  streams (see RecordEvent()) is only reused once those copies are done,
+  which is checked with CUDA events only when its size class has no other
+  free block.  (The host may write to a block as soon as it is returned, so
+  it can't be handed out before that even to the same stream.)
+
+  Freed memory is kept for reuse, up to the limit set by SetLimit() (none by
+  default); EmptyCache() returns it all to the system.
  */
 class PinnedAllocator {
  public:
-  PinnedAllocator() : available_(&BlockComparator) {}
+  static constexpr size_t kMinBlockSize = 512;
+  static constexpr size_t kLargeBlockSize = 1 << 20;
 
   /* Allocate a block of memory.
 
-     If we can find a free block that is large enough (first fit or best fit
-     as free blocks are sorted by size) for the requested size, the free block
-     is marked as allocated and returned to the user.
-
-     If no free blocks are available, a new block is allocated by
-     using `cudaMallocHost`.
+     If a free block of the size class of `size` is available, it is marked
+     as allocated and returned to the user.  Otherwise, a new block is
+     allocated by using `cudaMallocHost`.
 
      @param  [in]   size        Number of bytes to be allocated.
      @param  [out]  ptr         On return, it contains the starting address of
@@ -87,46 +81,49 @@ class PinnedAllocator {
   cudaError_t Malloc(size_t size, void **ptr) {
     NVTX_RANGE(K2_FUNC);
     K2_CHECK_NE(ptr, nullptr);
+    *ptr = nullptr;
+    if (size == 0) return cudaSuccess;
+    size = RoundSize(size);
     std::lock_guard<std::mutex> lock(mutex_);
+    ++stats_.num_allocs;
 
-    // If the number of outstanding cuda events is larger
-    // than 100, we will invoke `ProcessEvents()`, which
-    // may make some blocks available for reuse.
-    //
-    // If the number of cuda_events_ is small,
-    // we first try to find a block from the pool. If it
-    // cannot find one, we then invoke `ProcessEvents`.
-    //
-    // The purpose is to reduce the time of waiting for
-    // the pending events.
-    for (int32_t iter = 0; iter < 2; ++iter) {
-      if (cuda_events_.size() > 100 || iter > 0) {
-        // ProcessEvents may free blocks
-        cudaError_t err = ProcessEvents();
-        if (err != cudaSuccess) return err;
-      }
-
-      // search for the smallest block which can hold this allocation
-      BlockSize search_key(size);
-      auto it = available_.lower_bound(search_key);
-      if (it != available_.end()) {
-        // we find an unused block
-        Block &block = blocks_.at(it->ptr);
-        K2_CHECK(!block.allocated && block.event_count == 0);
-        block.allocated = true;
-        *ptr = block.ptr;
-        available_.erase(it);
-        return cudaSuccess;
-      }
+    std::vector<void *> &free_blocks = available_[size];
+    if (free_blocks.empty() && !cuda_events_.empty()) {
+      // ProcessEvents may free blocks
+      cudaError_t err = ProcessEvents();
+      if (err != cudaSuccess) return err;
+    }
+    if (!free_blocks.empty()) {
+      *ptr = free_blocks.back();
+      free_blocks.pop_back();
+      Block &block = blocks_.at(*ptr);
+      K2_CHECK(!block.allocated && block.event_count == 0);
+      block.allocated = true;
+      ++stats_.num_cache_hits;
+      stats_.bytes_cached -= size;
+      stats_.bytes_in_use += size;
+      return cudaSuccess;
     }
 
     // we need to allocate a new block.
-    // note that cudaMallocHost may not touch pointer if size is 0
-    *ptr = 0;
-    cudaError_t err = cudaMallocHost(ptr, size);
-    if (err != cudaSuccess) return err;
-
-    blocks_.insert({*ptr, Block(size, *ptr, true)});
+    ++stats_.num_cache_misses;
+    cudaError_t err;
+    {
+      InitPhaseTimer timer(stats_.num_cuda_malloc_hosts == 0 ? "PinnedMemory"
+                                                             : nullptr);
+      err = cudaMallocHost(ptr, size);
+    }
+    if (err != cudaSuccess) {
+      // Return the cached blocks to the system and try again.
+      (void)cudaGetLastError();  // clear the error
+      err = Trim(0);
+      if (err != cudaSuccess) return err;
+      err = cudaMallocHost(ptr, size);
+      if (err != cudaSuccess) return err;
+    }
+    ++stats_.num_cuda_malloc_hosts;
+    stats_.bytes_in_use += size;
+    blocks_.insert({*ptr, Block(size)});
     return cudaSuccess;
   }
 
@@ -142,10 +139,6 @@ class PinnedAllocator {
     if (ptr == nullptr) return cudaSuccess;
     std::lock_guard<std::mutex> lock(mutex_);
 
-    // process outstanding cuda events which may have occurred
-    cudaError_t err = ProcessEvents();
-    if (err != cudaSuccess) return err;
-
     auto it = blocks_.find(ptr);
     K2_CHECK(it != blocks_.end())
         << "The passed pointer is not allocated by Malloc!";
@@ -154,16 +147,19 @@ class PinnedAllocator {
     K2_CHECK(block.allocated);
 
     block.allocated = false;
+    stats_.bytes_in_use -= block.size;
+    stats_.bytes_cached += block.size;
 
     // insert CUDA events for each stream on which this block was used.
-    err = InsertEvents(block);
+    cudaError_t err = InsertEvents(ptr, &block);
     if (err != cudaSuccess) return err;
 
     if (block.event_count == 0) {
       // the block can be re-used if there are no outstanding cuda events
-      available_.insert(block);
+      available_[block.size].push_back(ptr);
     }
 
+    if (stats_.bytes_cached > limit_) return Trim(limit_);
     return cudaSuccess;
   }
 
@@ -189,22 +185,55 @@ class PinnedAllocator {
     block.streams.insert(stream);
   }
 
+  PinnedMemoryStats GetStats() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    PinnedMemoryStats ans = stats_;
+    ans.cache_limit = limit_;
+    return ans;
+  }
+
+  cudaError_t SetLimit(size_t limit) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    limit_ = limit;
+    if (stats_.bytes_cached > limit_) return Trim(limit_);
+    return cudaSuccess;
+  }
+
+  cudaError_t EmptyCache() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return Trim(0);
+  }
+
  private:
-  cudaError_t InsertEvents(Block &block) {
+  static size_t RoundSize(size_t size) {
+    if (size >= kLargeBlockSize)
+      return (size + kLargeBlockSize - 1) / kLargeBlockSize * kLargeBlockSize;
+    size_t ans = kMinBlockSize;
+    while (ans < size) ans <<= 1;
+    return ans;
+  }
+
+  cudaError_t InsertEvents(void *ptr, Block *block) {
     NVTX_RANGE(K2_FUNC);
     // InsertEvents is called from `Free`, which has already held the mutex.
-    std::unordered_set<cudaStream_t> streams(std::move(block.streams));
+    std::unordered_set<cudaStream_t> streams(std::move(block->streams));
+    block->streams.clear();
     for (auto it = streams.begin(); it != streams.end(); ++it) {
       cudaEvent_t event;
-      cudaError_t err =
-          cudaEventCreateWithFlags(&event, cudaEventDisableTiming);
-      if (err != cudaSuccess) return err;
+      cudaError_t err;
+      if (!free_events_.empty()) {
+        event = free_events_.back();
+        free_events_.pop_back();
+      } else {
+        err = cudaEventCreateWithFlags(&event, cudaEventDisableTiming);
+        if (err != cudaSuccess) return err;
+      }
 
       err = cudaEventRecord(event, *it);
       if (err != cudaSuccess) return err;
 
-      ++block.event_count;
-      cuda_events_.emplace_back(event, block.ptr);
+      ++block->event_count;
+      cuda_events_.emplace_back(event, ptr);
     }
     return cudaSuccess;
   }
@@ -212,7 +241,8 @@ class PinnedAllocator {
   /* Process events in `cuda_events_`.
 
      If the events of a block have all been processed, this block
-     is put into `available_` and is ready for reuse.
+     is put into `available_` and is ready for reuse.  The events are kept
+     for reuse by InsertEvents().
 
      If `cudaEventQuery()` returns `cudaErrorNotReady`, it
      returns immediately.
@@ -222,43 +252,70 @@ class PinnedAllocator {
    */
   cudaError_t ProcessEvents() {
     NVTX_RANGE(K2_FUNC);
-    // InsertEvents is called from `Malloc` and `Free`,
-    // which has already held the mutex.
+    // ProcessEvents is called with the mutex held.
     while (!cuda_events_.empty()) {
       auto &e = cuda_events_.front();
       cudaEvent_t event = e.first;
 
       cudaError_t err = cudaEventQuery(event);
-      if (err == cudaErrorNotReady) break;
+      if (err == cudaErrorNotReady) {
+        (void)cudaGetLastError();  // clear the error
+        break;
+      }
 
       if (err != cudaSuccess) return err;
 
-      err = cudaEventDestroy(event);
-      if (err != cudaSuccess) return err;
+      free_events_.push_back(event);
 
       Block &block = blocks_.at(e.second);
       --block.event_count;
 
-      if (block.event_count == 0 && !block.allocated) available_.insert(block);
+      if (block.event_count == 0 && !block.allocated)
+        available_[block.size].push_back(e.second);
 
       cuda_events_.pop_front();
     }
     return cudaSuccess;
   }
 
+  /* Return free blocks to the system until at most `target` bytes are
+     cached (or there are no free blocks left; blocks with outstanding
+     events are kept).  Called with the mutex held. */
+  cudaError_t Trim(size_t target) {
+    NVTX_RANGE(K2_FUNC);
+    cudaError_t err = ProcessEvents();
+    if (err != cudaSuccess) return err;
+    for (auto &p : available_) {
+      std::vector<void *> &free_blocks = p.second;
+      while (!free_blocks.empty() && stats_.bytes_cached > target) {
+        void *ptr = free_blocks.back();
+        err = cudaFreeHost(ptr);
+        if (err != cudaSuccess) return err;
+        free_blocks.pop_back();
+        blocks_.erase(ptr);
+        stats_.bytes_cached -= p.first;
+      }
+    }
+    return cudaSuccess;
+  }
+
  private:
   // It contains all blocks allocated by Malloc.
   std::unordered_map<void *, Block> blocks_;
 
-  using Compare = bool (*)(const BlockSize &, const BlockSize &);
-  // It contains all free blocks **sorted** by block size in increasing order.
-  std::set<BlockSize, Compare> available_;
+  // Maps each size class to its free blocks that are ready for reuse.
+  std::unordered_map<size_t, std::vector<void *>> available_;
 
   // outstanding cuda events
   std::deque<std::pair<cudaEvent_t, void *>> cuda_events_;
 
-  // to protect `blocks_`, `available_` and `cuda_events_` being accessed
-  // from multiple threads
+  // processed events, for reuse
+  std::vector<cudaEvent_t> free_events_;
+
+  PinnedMemoryStats stats_;
+  size_t limit_ = std::numeric_limits<size_t>::max();
+
+  // to protect the members above from being accessed from multiple threads
   std::mutex mutex_;
 };
 
@@ -285,6 +342,7 @@ class PinnedContext : public Context {
   void *Allocate(std::size_t bytes, void **deleter_context) override {
     void *p = nullptr;
     cudaError_t err = allocator_->Malloc(bytes, &p);
+    K2_CHECK_CUDA_ERROR(err);
     if (deleter_context != nullptr) *deleter_context = nullptr;
     return p;
   }
@@ -331,6 +389,7 @@ ContextPtr GetPinnedContext() {
 
   std::call_once(has_cuda_init_flag, []() {
 #ifdef K2_WITH_CUDA
+    InitPhaseTimer timer("CudaProbe");
     int32_t count = 0;
     cudaError_t err = cudaGetDeviceCount(&count);
     if (err != cudaSuccess) {
@@ -354,6 +413,18 @@ ContextPtr GetPinnedContext() {
   return GetCpuContext();
 }
 
+PinnedMemoryStats GetPinnedMemoryStats() {
+  return GetPinnedAllocator()->GetStats();
+}
+
+void SetPinnedMemoryCacheLimit(std::size_t num_bytes) {
+  K2_CHECK_CUDA_ERROR(GetPinnedAllocator()->SetLimit(num_bytes));
+}
+
+void EmptyPinnedMemoryCache() {
+  K2_CHECK_CUDA_ERROR(GetPinnedAllocator()->EmptyCache());
+}
+
 ContextPtr GetContextForTransfer(DeviceType device_type) {
   switch (device_type) {
     case kCpu:
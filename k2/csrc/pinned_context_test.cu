@@ -16,6 +16,8 @@
  * limitations under the License.
  */
 
+#include <limits>
+
 #include "gtest/gtest.h"
 #include "k2/csrc/array.h"
 #include "k2/csrc/context.h"
@@ -54,23 +56,62 @@ TEST(PinnedContext, Cache) {
 
   {
     // a3 cannot reuse the memory of a1 since it
-    // requires 101 bytes, which is larger than 100
-    Array1<int8_t> a3(pinned, 101);
+    // requires 1000 bytes, which is in a larger size
+    // class than 100 bytes
+    Array1<int8_t> a3(pinned, 1000);
     EXPECT_NE(p, a3.Data());
     q = a3.Data();
   }
   // at this point, the pool contains two blocks
-  // of memory: 100 bytes and 101 bytes. The blocks
-  // are sorted by size in increasing order.
+  // of memory, of 512 bytes and 1024 bytes.
 
   {
-    Array1<int8_t> a4(pinned, 99);  // reuse the block with 100 bytes
-    Array1<int8_t> a5(pinned, 1);   // reuse the block with 101 bytes
+    Array1<int8_t> a4(pinned, 101);  // reuse the block of a1 (512 bytes)
+    Array1<int8_t> a5(pinned, 513);  // reuse the block of a3 (1024 bytes)
     EXPECT_EQ(p, a4.Data());
     EXPECT_EQ(q, a5.Data());
   }
 }
 
+TEST(PinnedContext, Stats) {
+  if (GetCudaContext()->GetDeviceType() == kCpu) {
+    // No CUDA capable devices are found, skip the test.
+    return;
+  }
+  ContextPtr pinned = GetPinnedContext();
+  EmptyPinnedMemoryCache();
+  PinnedMemoryStats before = GetPinnedMemoryStats();
+  EXPECT_EQ(before.bytes_cached, 0u);
+
+  {
+    Array1<int8_t> a(pinned, 3000);
+    PinnedMemoryStats stats = GetPinnedMemoryStats();
+    EXPECT_EQ(stats.bytes_in_use, before.bytes_in_use + 4096u);
+    EXPECT_EQ(stats.num_cache_misses, before.num_cache_misses + 1);
+  }
+  PinnedMemoryStats stats = GetPinnedMemoryStats();
+  EXPECT_EQ(stats.bytes_in_use, before.bytes_in_use);
+  EXPECT_EQ(stats.bytes_cached, 4096u);
+
+  {
+    Array1<int8_t> a(pinned, 4000);
+    EXPECT_EQ(GetPinnedMemoryStats().num_cache_hits,
+              stats.num_cache_hits + 1);
+  }
+
+  // Freed memory above the limit is returned to the system.
+  SetPinnedMemoryCacheLimit(1024);
+  EXPECT_EQ(GetPinnedMemoryStats().bytes_cached, 0u);
+  {
+    Array1<int8_t> a(pinned, 100), b(pinned, 100);
+  }
+  EXPECT_EQ(GetPinnedMemoryStats().bytes_cached, 1024u);
+
+  SetPinnedMemoryCacheLimit(0);
+  EXPECT_EQ(GetPinnedMemoryStats().bytes_cached, 0u);
+  SetPinnedMemoryCacheLimit(std::numeric_limits<std::size_t>::max());
+}
+
 static void PinnedContextSpeedTest() {
   ContextPtr cpu = GetCpuContext();
   ContextPtr cuda = GetCudaContext();
@@ -73,6 +73,7 @@ static std::once_flag has_cuda_init_flag;
 static bool has_cuda = false;
 static void InitHasCuda() {
 #ifdef K2_WITH_CUDA
+  InitPhaseTimer timer("CudaProbe");
   if (torch::cuda::is_available())
     has_cuda = true;
   else
@@ -168,7 +169,7 @@ class PytorchCudaContext : public Context {
 
   cudaStream_t GetCudaStream() const override {
 #ifdef K2_WITH_CUDA
-    return g_stream_override.OverrideStream(
+    return GetCudaStreamOverride().OverrideStream(
         c10::cuda::getCurrentCUDAStream(gpu_id_));
 #else
     return cudaStream_t{};
@@ -215,6 +216,7 @@ class PytorchCudaContext : public Context {
     DeviceGuard guard(gpu_id_);
     auto ret = cudaStreamSynchronize(GetCudaStream());
     K2_CHECK_CUDA_ERROR(ret);
+    OpStatsSync();
   }
 
   void CopyDataTo(size_t num_bytes, const void *src, ContextPtr dst_context,
@@ -225,6 +227,7 @@ class PytorchCudaContext : public Context {
         cudaError_t ret =
             cudaMemcpy(dst, src, num_bytes, cudaMemcpyDeviceToHost);
         K2_CHECK_CUDA_ERROR(ret);
+        OpStatsSync();
         break;
       }
       case kCuda: {
@@ -264,6 +267,22 @@ ContextPtr GetCudaContext(int32_t gpu_id /*= -1*/) {
   return GetCpuContext();
 }
 
+CudaMemoryStats GetCudaMemoryStats(int32_t /*gpu_id = -1*/) {
+  // Memory is managed by PyTorch; see torch.cuda.memory_stats().
+  return CudaMemoryStats();
+}
+
+void ResetPeakCudaMemoryStats(int32_t /*gpu_id = -1*/) {
+  // Memory is managed by PyTorch; see torch.cuda.reset_peak_memory_stats().
+}
+
+void EmptyCudaCache(int32_t /*gpu_id = -1*/) {
+#ifdef K2_WITH_CUDA
+  std::call_once(has_cuda_init_flag, InitHasCuda);
+  if (has_cuda) c10::cuda::CUDACachingAllocator::emptyCache();
+#endif
+}
+
 RegionPtr NewRegion(torch::Tensor tensor) {
   auto ans = std::make_shared<Region>();
   if (tensor.device().type() == torch::kCPU) {
@@ -23,6 +23,7 @@
 #include "k2/csrc/macros.h"
 #include "k2/csrc/math.h"
 #include "k2/csrc/ragged.h"
+#include "k2/csrc/ragged_ops.h"
 
 namespace {
 
@@ -182,15 +183,14 @@ RaggedShape RaggedShape::Index(int32_t axis, int32_t i,
 
   if (i == 0 && Dim0() == 1) {
     // Just remove first axis.  Common case so we make it efficient.
-    std::vector<RaggedShapeLayer> ans_axes(src_axes.begin() + 1,
-                                           src_axes.end());
+    RaggedShapeLayers ans_axes(src_axes.begin() + 1, src_axes.end());
     if (value_offset) *value_offset = 0;
-    return RaggedShape(ans_axes, false);
+    return RaggedShape(std::move(ans_axes), false);
   }
 
   int32_t idx_begin = (i != 0 ? src_axes[0].row_splits[i] : 0),
           idx_end = src_axes[0].row_splits[i + 1];
-  std::vector<RaggedShapeLayer> axes(src_axes.size() - 1);
+  RaggedShapeLayers axes(src_axes.size() - 1);
   ContextPtr &c = Context();
   for (int32_t i = 2; i < num_axes; ++i) {
     const Array1<int32_t> &src_row_splits = RowSplits(i),
@@ -214,12 +214,15 @@ RaggedShape RaggedShape::Index(int32_t axis, int32_t i,
     idx_end = idx_end_next;
   }
   if (value_offset) *value_offset = idx_begin;
-  return RaggedShape(axes);
+  return RaggedShape(std::move(axes));
 }
 
 void RaggedShape::Populate() {
   NVTX_RANGE(K2_FUNC);
   int32_t num_axes = NumAxes();
+  // Get all the unknown tot-sizes with one transfer, rather than one per axis.
+  RaggedShape *shapes[1] = {this};
+  PopulateTotSizes(1, shapes);
   ParallelRunner pr(this->Context());
   for (int32_t i = 1; i < num_axes; ++i) {
     With w(pr.NewStream());
@@ -233,7 +236,7 @@ RaggedShape RaggedShape::To(ContextPtr ctx,
                             bool copy_all) const {
   NVTX_RANGE(K2_FUNC);
   if (ctx->IsCompatible(*Context())) return *this;
-  std::vector<RaggedShapeLayer> layers(layers_.size());
+  RaggedShapeLayers layers(layers_.size());
   int32_t num_layers = layers.size();
   for (int32_t i = 0; i < num_layers; i++) {
     layers[i].row_splits = layers_[i].row_splits.To(ctx);
@@ -241,7 +244,7 @@ RaggedShape RaggedShape::To(ContextPtr ctx,
     if (copy_all && layers_[i].row_ids.IsValid())
       layers[i].row_ids = layers_[i].row_ids.To(ctx);
   }
-  return RaggedShape(layers);
+  return RaggedShape(std::move(layers));
 }
 
 RaggedShapeIndexIterator RaggedShape::Iterator() {
@@ -543,6 +546,34 @@ void RaggedShape::Check() const {
   }
 }
 
+void RaggedShape::CheckDims() const {
+  NVTX_RANGE(K2_FUNC);
+  ContextPtr &c = Context();
+  int32_t num_layers = layers_.size();
+  for (int32_t layer = 0; layer < num_layers; ++layer) {
+    const RaggedShapeLayer &rsd = layers_[layer];
+    K2_CHECK_GT(rsd.row_splits.Dim(), 0) << "layer=" << layer;
+    K2_CHECK(rsd.row_splits.Context()->IsCompatible(*c))
+        << "Incompatible contexts for different components of RaggedShape: "
+           "row_splits of layer " << layer << " vs. layer 0.";
+    if (rsd.row_ids.Dim() != 0) {
+      K2_CHECK(rsd.row_ids.Context()->IsCompatible(*c))
+          << "Incompatible contexts for different components of RaggedShape: "
+             "row_ids of layer " << layer << " vs. row_splits of layer 0.";
+      K2_CHECK_EQ(rsd.row_ids.Dim(), rsd.cached_tot_size)
+          << "layer=" << layer;
+    } else if (rsd.cached_tot_size < 0) {
+      K2_CHECK_EQ(rsd.cached_tot_size, -1) << "layer=" << layer;
+    }
+    if (layer + 1 < num_layers && rsd.cached_tot_size >= 0) {
+      int32_t next_num_rows = layers_[layer + 1].row_splits.Dim() - 1;
+      K2_CHECK_EQ(rsd.cached_tot_size, next_num_rows)
+          << "Ragged shape has num_elems for layer " << layer
+          << " vs. num-rows for layer " << (layer + 1);
+    }
+  }
+}
+
 bool Equal(const RaggedShape &a, const RaggedShape &b) {
   NVTX_RANGE(K2_FUNC);
   if (a.NumAxes() != b.NumAxes()) return false;
@@ -589,12 +620,12 @@ std::istream &operator>>(std::istream &is, RaggedShape &shape) {
           // row_splits is 0 0.
           row_splits.push_back(std::vector<int32_t>(1, 0));
         }
-        std::vector<RaggedShapeLayer> axes(row_splits.size());
+        RaggedShapeLayers axes(row_splits.size());
         for (size_t i = 0; i < row_splits.size(); i++) {
           axes[i].row_splits = Array1<int32_t>(GetCpuContext(), row_splits[i]);
           axes[i].cached_tot_size = -1;
         }
-        shape = RaggedShape(axes);
+        shape = RaggedShape(std::move(axes));
         return is;
       }
       row_splits[cur_level].push_back(
@@ -28,6 +28,7 @@
 #include "k2/csrc/array.h"
 #include "k2/csrc/context.h"
 #include "k2/csrc/log.h"
+#include "k2/csrc/small_vector.h"
 
 namespace k2 {
 
@@ -65,6 +66,11 @@ struct RaggedShapeLayer {
   int32_t cached_tot_size;
 };
 
+// The layers of a RaggedShape, indexed by axis-index minus one.  Shapes with
+// up to 4 axes (3 layers), which covers almost everything we create (e.g. an
+// FsaVec has 3 axes), keep their layers inline with no heap allocation.
+using RaggedShapeLayers = SmallVector<RaggedShapeLayer, 3>;
+
 class RaggedShapeIndexIterator;
 class RaggedShape;
 // Will write the elements as x, e.g. "[ [ x x ] [x] ]"
@@ -173,12 +179,21 @@ class RaggedShape {
   RaggedShapeIndexIterator Iterator();
 
   // TODO(dan): will at some point make it so check = false is the default.
-  explicit RaggedShape(const std::vector<RaggedShapeLayer> &layers,
+  // `layers` is taken by value, so callers that are done with their layers
+  // should std::move() them in.
+  explicit RaggedShape(RaggedShapeLayers layers,
                        bool check = !internal::kDisableDebug)
-      : layers_(layers) {
-    // the check can be disabled by setting the environment variable
-    // K2_DISABLE_CHECKS.
-    if (check && !internal::DisableChecks()) Check();
+      : layers_(std::move(layers)) {
+    // the check can be reduced or disabled by setting the validation level,
+    // e.g. with the environment variable K2_VALIDATION_LEVEL; see
+    // GetValidationLevel() in log.h.
+    if (check) {
+      internal::ValidationLevel level = internal::GetValidationLevel();
+      if (level == internal::ValidationLevel::kFull)
+        Check();
+      else if (level == internal::ValidationLevel::kCheap)
+        CheckDims();
+    }
   }
 
   explicit RaggedShape(const std::string &src) {
@@ -210,14 +225,19 @@ class RaggedShape {
 
   // Layers() is intended for internal-ish use; users shouldn't really have to
   // interact with it.
-  const std::vector<RaggedShapeLayer> &Layers() const { return layers_; }
+  const RaggedShapeLayers &Layers() const { return layers_; }
   // CAUTION: you probably shouldn't use this unless you really know what you
   // are doing.
-  std::vector<RaggedShapeLayer> &Layers() { return layers_; }
+  RaggedShapeLayers &Layers() { return layers_; }
 
   // Check the RaggedShape for consistency; die on failure.
   void Check() const;
 
+  // Does the subset of the checks in Check() that only need the
+  // dimensions and other host-side metadata, so it never launches a kernel
+  // or needs a device sync; die on failure.
+  void CheckDims() const;
+
   /*
     Copy to a possibly different device. If `copy_all == true`, will copy the
     row_ids rather than reconstructing it on the dest device; this is useful for
@@ -226,12 +246,9 @@ class RaggedShape {
   RaggedShape To(ContextPtr ctx, bool copy_all = false) const;
 
  private:
-  // TODO: could probably do away with the std::vector and have a max size and
-  // a fixed length array (more efficient)
-
   // indexed by axis-index minus one... axis 0 is special, its dim
   // equals layers_[0].row_splits.Dim()-1.
-  std::vector<RaggedShapeLayer> layers_;
+  RaggedShapeLayers layers_;
 };
 
 template <typename T, int MAX_DIM>
@@ -332,10 +349,11 @@ struct Ragged {
 
   Array1<T> values;
 
-  Ragged(const RaggedShape &shape, const Array1<T> &values)
-      : shape(shape), values(values) {
-    K2_CHECK(IsCompatible(shape, values));
-    K2_CHECK_EQ(shape.NumElements(), values.Dim());
+  // Arguments are taken by value so temporaries can be moved in.
+  Ragged(RaggedShape shape, Array1<T> values)
+      : shape(std::move(shape)), values(std::move(values)) {
+    K2_CHECK(IsCompatible(this->shape, this->values));
+    K2_CHECK_EQ(this->shape.NumElements(), this->values.Dim());
   }
 
   explicit Ragged(const RaggedShape &shape, Dtype dtype = DtypeOf<T>::dtype)
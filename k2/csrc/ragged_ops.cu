@@ -21,16 +21,20 @@
 #include <algorithm>
 #include <cmath>
 #include <memory>
+#include <numeric>
 #include <vector>
 
 #include "k2/csrc/array_ops.h"
 #include "k2/csrc/cub.h"
+#include "k2/csrc/hash.h"
 #include "k2/csrc/macros.h"
 #include "k2/csrc/math.h"
 #include "k2/csrc/moderngpu_allocator.h"
 #include "k2/csrc/ragged.h"
 #include "k2/csrc/ragged_ops.h"
 #include "k2/csrc/ragged_utils.h"
+#include "k2/csrc/scalar_readback.h"
+#include "k2/csrc/shape_capture.h"
 
 namespace {
 
@@ -66,7 +70,7 @@ RaggedShape RandomRaggedShape(bool set_row_ids, int32_t min_num_axes,
   int32_t num_elements = RandIntGeometric(min_num_elements, max_num_elements);
 
   bool done_repeats = false;
-  std::vector<RaggedShapeLayer> axes(num_axes - 1);
+  RaggedShapeLayers axes(num_axes - 1);
   for (int32_t axis = num_axes - 2; axis >= 0; axis--) {
     // this axis will have row_ids of length num_elements and
     // row_splits of length to be determined.
@@ -101,7 +105,7 @@ RaggedShape RandomRaggedShape(bool set_row_ids, int32_t min_num_axes,
   }
   // RaggedShape(axes, true) will check the returned RaggedShape for
   // consistency.
-  return RaggedShape(axes, true);
+  return RaggedShape(std::move(axes), true);
 }
 
 RaggedShape RaggedShape2(Array1<int32_t> *row_splits, Array1<int32_t> *row_ids,
@@ -118,7 +122,7 @@ RaggedShape RaggedShape2(Array1<int32_t> *row_splits, Array1<int32_t> *row_ids,
           << "Bad row splits is: " << *row_splits;
     }
   }
-  std::vector<RaggedShapeLayer> axes(1);
+  RaggedShapeLayers axes(1);
   if (row_splits != nullptr) {
     axes[0].row_splits = *row_splits;
   } else {
@@ -138,7 +142,7 @@ RaggedShape RaggedShape2(Array1<int32_t> *row_splits, Array1<int32_t> *row_ids,
   axes[0].cached_tot_size = cached_tot_size;
   // note below line will check if row_splits and row_ids are valid and agree
   // with each other.
-  return RaggedShape(axes);
+  return RaggedShape(std::move(axes));
 }
 
 RaggedShape ComposeRaggedShapes(const RaggedShape &a, const RaggedShape &b) {
@@ -151,12 +155,12 @@ RaggedShape ComposeRaggedShapes(const RaggedShape &a, const RaggedShape &b) {
   const auto &a_axes = a.Layers();
   const auto &b_axes = b.Layers();
   std::size_t a_size = a_axes.size(), b_size = b_axes.size();
-  std::vector<RaggedShapeLayer> axes;
+  RaggedShapeLayers axes;
   axes.reserve(a_size + b_size);
   for (std::size_t i = 0; i < a_size; ++i) axes.emplace_back(a_axes[i]);
   for (std::size_t i = 0; i < b_size; ++i) axes.emplace_back(b_axes[i]);
   bool validate = false;
-  return RaggedShape(axes, validate);
+  return RaggedShape(std::move(axes), validate);
 }
 
 RaggedShape ComposeRaggedShapes3(const RaggedShape &a, const RaggedShape &b,
@@ -177,13 +181,13 @@ RaggedShape ComposeRaggedShapes3(const RaggedShape &a, const RaggedShape &b,
   const auto &c_axes = c.Layers();
   std::size_t a_size = a_axes.size(), b_size = b_axes.size(),
               c_size = c_axes.size();
-  std::vector<RaggedShapeLayer> axes;
+  RaggedShapeLayers axes;
   axes.reserve(a_size + b_size + c_size);
   for (std::size_t i = 0; i < a_size; ++i) axes.emplace_back(a_axes[i]);
   for (std::size_t i = 0; i < b_size; ++i) axes.emplace_back(b_axes[i]);
   for (std::size_t i = 0; i < c_size; ++i) axes.emplace_back(c_axes[i]);
   bool validate = false;
-  return RaggedShape(axes, validate);
+  return RaggedShape(std::move(axes), validate);
 }
 
 RaggedShape RaggedShape3(Array1<int32_t> *row_splits1,
@@ -234,7 +238,7 @@ RaggedShape RaggedShapeFromTotSizes(ContextPtr c, int32_t num_axes,
                                     const int32_t *tot_sizes) {
   NVTX_RANGE(K2_FUNC);
   K2_CHECK_GE(num_axes, 2);
-  std::vector<RaggedShapeLayer> axes(num_axes - 1);
+  RaggedShapeLayers axes(num_axes - 1);
   int32_t tot_size = 0;
   for (int32_t axis = 1; axis < num_axes; ++axis) {
     tot_size += tot_sizes[axis - 1] + 1 + tot_sizes[axis];
@@ -250,7 +254,82 @@ RaggedShape RaggedShapeFromTotSizes(ContextPtr c, int32_t num_axes,
     axes[axis - 1].cached_tot_size = tot_sizes[axis];
   }
   // Not check here as we did not set the values of row_splits and row_ids
-  return RaggedShape(axes, false);
+  return RaggedShape(std::move(axes), false);
+}
+
+RaggedShape RaggedShapeFromSizes(const std::vector<Array1<int32_t>> &sizes) {
+  NVTX_RANGE(K2_FUNC);
+  int32_t num_layers = static_cast<int32_t>(sizes.size());
+  K2_CHECK_GE(num_layers, 1);
+  K2_CHECK_LE(num_layers, 4);
+  ContextPtr c = sizes[0].Context();
+
+  // We copy the sizes of all layers into `scan`, each followed by a zero, and
+  // do one exclusive sum over it.  Layer l then occupies
+  // [scan_begin(l), scan_begin(l+1)) in `scan`, which holds its row_splits
+  // plus offset(l), the total size of the layers before it.  Viewed as one
+  // big row_splits vector, `scan` has an empty row between layers, so one
+  // RowSplitsToRowIds() gives the row_ids of all layers (plus offsets).
+  SmallVec<const int32_t *, 4> sizes_data;
+  SmallVec<int32_t, 5> scan_begin;
+  scan_begin.data[0] = 0;
+  for (int32_t l = 0; l < num_layers; ++l) {
+    K2_CHECK(c->IsCompatible(*sizes[l].Context()));
+    sizes_data.data[l] = sizes[l].Data();
+    scan_begin.data[l + 1] = scan_begin.data[l] + sizes[l].Dim() + 1;
+  }
+  int32_t scan_dim = scan_begin.data[num_layers];
+  Array1<int32_t> scan(c, scan_dim);
+  int32_t *scan_data = scan.Data();
+  K2_EVAL(
+      c, scan_dim, lambda_copy_sizes, (int32_t i)->void {
+        int32_t l = 0;
+        while (i >= scan_begin(l + 1)) ++l;
+        int32_t j = i - scan_begin(l);
+        scan_data[i] = (i + 1 < scan_begin(l + 1) ? sizes_data(l)[j] : 0);
+      });
+  ExclusiveSum(scan, &scan);
+
+  ScalarReadback readback(c);
+  std::vector<int32_t> handles(num_layers);
+  for (int32_t l = 0; l < num_layers; ++l)
+    handles[l] = readback.Add(scan, scan_begin.data[l + 1] - 1);
+  readback.Sync();
+  SmallVec<int32_t, 5> offset;
+  offset.data[0] = 0;
+  for (int32_t l = 0; l < num_layers; ++l) {
+    offset.data[l + 1] = readback.Get<int32_t>(handles[l]);
+    if (l + 1 < num_layers)
+      K2_CHECK_EQ(offset.data[l + 1] - offset.data[l], sizes[l + 1].Dim())
+          << "Sizes of layer " << (l + 1) << " do not match layer " << l;
+  }
+  int32_t tot_row_ids = offset.data[num_layers];
+
+  Array1<int32_t> row_splits(c, scan_dim), row_ids(c, tot_row_ids);
+  int32_t *row_splits_data = row_splits.Data(), *row_ids_data = row_ids.Data();
+  RowSplitsToRowIds(c, scan_dim - 1, scan_data, tot_row_ids, row_ids_data);
+  K2_EVAL(
+      c, scan_dim + tot_row_ids, lambda_set_row_splits_and_ids,
+      (int32_t i)->void {
+        int32_t l = 0;
+        if (i < scan_dim) {
+          while (i >= scan_begin(l + 1)) ++l;
+          row_splits_data[i] = scan_data[i] - offset(l);
+        } else {
+          int32_t k = i - scan_dim;
+          while (k >= offset(l + 1)) ++l;
+          row_ids_data[k] -= scan_begin(l);
+        }
+      });
+
+  RaggedShapeLayers axes(num_layers);
+  for (int32_t l = 0; l < num_layers; ++l) {
+    axes[l].row_splits =
+        row_splits.Arange(scan_begin.data[l], scan_begin.data[l + 1]);
+    axes[l].row_ids = row_ids.Arange(offset.data[l], offset.data[l + 1]);
+    axes[l].cached_tot_size = offset.data[l + 1] - offset.data[l];
+  }
+  return RaggedShape(std::move(axes), false);
 }
 
 // See declaration in ragged.h for documentation of its purpose and interface.
@@ -274,12 +353,12 @@ RaggedShape Unsqueeze(const RaggedShape &src, int32_t axis) {
   ContextPtr &c = src.Context();
   K2_CHECK(axis >= 0 && axis <= src.NumAxes());
 
-  const std::vector<RaggedShapeLayer> &axes_in = src.Layers();
+  const RaggedShapeLayers &axes_in = src.Layers();
   int32_t num_axes_in = src.NumAxes();
 
   // Note: in RaggedShape, the vector of RaggedShapeLayer is of length
   // num_axes - 1, so the output will have one more axis than the input.
-  std::vector<RaggedShapeLayer> axes_out(num_axes_in);
+  RaggedShapeLayers axes_out(num_axes_in);
 
   int32_t row_splits_dim, row_ids_dim;
   Array1<int32_t> mem;
@@ -313,7 +392,7 @@ RaggedShape Unsqueeze(const RaggedShape &src, int32_t axis) {
   // Note: the returned array has `num_axes_in + 1` axes, so its
   // array of RaggedShapeLayer is of length `num_axes_in`.
   for (int32_t i = axis + 1; i < num_axes_in; ++i) axes_out[i] = axes_in[i - 1];
-  return RaggedShape(axes_out);
+  return RaggedShape(std::move(axes_out));
 }
 
 std::vector<RaggedShape> UnsqueezeParallel(int32_t num_srcs, RaggedShape **src,
@@ -340,7 +419,7 @@ std::vector<RaggedShape> UnsqueezeParallel(int32_t num_srcs, RaggedShape **src,
 
   for (int32_t i = 0; i < num_srcs; ++i) {
     int32_t num_axes = src[i]->NumAxes();
-    std::vector<RaggedShapeLayer> axes;
+    RaggedShapeLayers axes;
     axes.reserve(num_axes);  //  note, the size of the `layers` of a RaggedShape
                              //  is its NumAxes() - 1.
     axes.resize(1);
@@ -567,7 +646,8 @@ inline void GetOldAndNewOffsets(RaggedShape &src,
 RaggedShape Index(RaggedShape &src, int32_t axis,
                   const Array1<int32_t> &indexes,
                   Array1<int32_t> *elem_indexes /*=nullptr*/) {
-  NVTX_RANGE(K2_FUNC);
+  NVTX_RANGE_PAYLOAD(K2_FUNC, kRagged, indexes.Dim());
+  CaptureShape("Index", src, {axis, indexes.Dim()});
   int32_t num_axes = src.NumAxes();
   K2_CHECK_LT(static_cast<uint32_t>(axis), static_cast<uint32_t>(num_axes));
   if (axis == 0) {
@@ -588,12 +668,13 @@ RaggedShape Index(RaggedShape &src, int32_t axis,
     if (elem_indexes)
       *elem_indexes = indexes;
 
-    std::vector<RaggedShapeLayer> axes = src.Layers();
+    RaggedShapeLayers axes = src.Layers();
     axes.back().row_splits = last_row_splits;
     axes.back().row_ids = last_row_ids;
     axes.back().cached_tot_size = last_row_ids.Dim();
-    // TODO: disable checking by changing true to false.
-    return RaggedShape(axes, true);
+    // How much is checked here depends on the validation level; see
+    // GetValidationLevel() in log.h.
+    return RaggedShape(std::move(axes), true);
   } else {
     RaggedShape top, bottom;
     DecomposeRaggedShape(src, axis, &top, &bottom);
@@ -620,6 +701,8 @@ Array2<int32_t> GetOffsets(int32_t num_srcs, RaggedShape **src) {
     K2_CHECK_EQ(src[i]->NumAxes(), num_axes_in);
     K2_CHECK(ctx->IsCompatible(*src[i]->Context()));
   }
+  // So that the TotSize() calls below won't each need a device sync.
+  PopulateTotSizes(num_srcs, src);
 
   for (int32_t axis = 0; axis <= num_axes_in; ++axis) {
     int32_t sum = 0;
@@ -633,6 +716,27 @@ Array2<int32_t> GetOffsets(int32_t num_srcs, RaggedShape **src) {
   return src_offsets;
 }
 
+void PopulateTotSizes(int32_t num_srcs, RaggedShape **src) {
+  NVTX_RANGE(K2_FUNC);
+  std::vector<const Array1<int32_t> *> row_splits;
+  std::vector<RaggedShapeLayer *> layers;
+  for (int32_t i = 0; i < num_srcs; ++i) {
+    for (RaggedShapeLayer &layer : src[i]->Layers()) {
+      if (layer.cached_tot_size < 0) {
+        // if we had row_ids set up, we would have set cached_tot_size.
+        K2_CHECK_EQ(layer.row_ids.Dim(), 0);
+        row_splits.push_back(&layer.row_splits);
+        layers.push_back(&layer);
+      }
+    }
+  }
+  int32_t num_unknown = static_cast<int32_t>(row_splits.size());
+  std::vector<int32_t> tot_sizes(num_unknown);
+  GetLastElements(num_unknown, row_splits.data(), tot_sizes.data());
+  for (int32_t i = 0; i < num_unknown; ++i)
+    layers[i]->cached_tot_size = tot_sizes[i];
+}
+
 void GetRowInfo(RaggedShape &src, Array1<int32_t *> *row_splits,
                 Array1<int32_t *> *row_ids) {
   NVTX_RANGE(K2_FUNC);
@@ -683,39 +787,25 @@ void GetRowInfoMulti(int32_t num_srcs, RaggedShape **src,
   *row_ids = row_ids_ptrs.To(ctx);
 }
 
-/*static*/ RaggedShape StackAxis0(int32_t num_srcs, RaggedShape **src,
+/*static*/ RaggedShape StackAxis0(Array1OfRaggedShape &src,
                                   Array1<uint32_t> *merge_map /* == nullptr*/) {
   NVTX_RANGE(K2_FUNC);
-  if (num_srcs == 1) {
-    if (merge_map)
-      *merge_map =
-          Arange<uint32_t>(src[0]->Context(), 0, src[0]->NumElements());
-    RaggedShape top_layer = TrivialShape(src[0]->Context(), src[0]->Dim0());
-    return ComposeRaggedShapes(top_layer, **src);
-  }
-  // We can't handle num_srcs == 0 because we won't have a context object.
-  K2_CHECK_GT(num_srcs, 1);
-
-  int32_t num_axes_in = src[0]->NumAxes(),
+  int32_t num_srcs = src.NumSrcs(),
+      num_axes_in = src.NumAxes(),
       num_axes_out = num_axes_in + 1;
-  ContextPtr c = src[0]->Context();
-
-  // Check if they have same num-axes and compatible context
-  for (int32_t i = 1; i < num_srcs; ++i) {
-    K2_CHECK_EQ(num_axes_in, src[i]->NumAxes());
-    K2_CHECK(IsCompatible(*src[0], *src[i]));
-  }
+  ContextPtr c = src.Context();
 
-  // `offsets` will be on CPU for now.
-  // It shape is (num_axes_in + 1 == num_axes_out, num_srcs + 1).
-  Array2<int32_t> offsets = GetOffsets(num_srcs, src);
+  // `offsets` is on the device, its shape is
+  // (num_axes_in + 1 == num_axes_out, num_srcs + 1).
+  const Array2<int32_t> &offsets = src.Offsets();
   auto offsets_acc = offsets.Accessor();
 
   SmallVec<int32_t, 6> tot_sizes_out;
   K2_CHECK(num_axes_out <= 6);
   int32_t max_tot_size = 0;
-  for (int32_t axis = 0; axis < num_axes_out; axis++) {
-    tot_sizes_out.data[axis] = offsets_acc(axis, num_srcs);
+  tot_sizes_out.data[0] = num_srcs;
+  for (int32_t axis = 1; axis < num_axes_out; axis++) {
+    tot_sizes_out.data[axis] = src.TotSize(axis - 1);
     max_tot_size = std::max<int32_t>(max_tot_size,
                                      tot_sizes_out.data[axis]);
   }
@@ -724,21 +814,16 @@ void GetRowInfoMulti(int32_t num_srcs, RaggedShape **src,
                                             tot_sizes_out.data);
 
   // src_row_splits and src_row_ids are of dim num_axes_in-1 by num_srcs.
-  Array2<int32_t *> src_row_splits, src_row_ids;
-  GetRowInfoMulti(num_srcs, src, &src_row_splits, &src_row_ids);
-  auto src_row_splits_acc = src_row_splits.Accessor(),
-       src_row_ids_acc = src_row_ids.Accessor();
-
+  auto src_row_splits_acc = src.RowSplits()->Accessor(),
+       src_row_ids_acc = src.RowIds()->Accessor();
 
-  offsets = offsets.To(c);
-  offsets_acc = offsets.Accessor();
   for (int32_t axis = 1; axis < num_axes_out; axis++) {
     // we are not creating the actual row_ids here, except for axis 1; we are
     // creating "composed row_ids" which map to the index on axis 0.
     Array1<int32_t> row_ids = ans.RowIds(axis);
-    RowSplitsToRowIds(offsets.Row(axis), &row_ids);
+    RowSplitsToRowIds(src.MetaRowSplits(axis - 1), &row_ids);
   }
-  ans.Layers()[0].row_splits = offsets.Row(1);
+  ans.Layers()[0].row_splits = src.MetaRowSplits(0);
 
   // Caution: e.g. old_row_splits_acc(i) == src.RowSplits(i+1).
   RowSplitsAccessor<5> new_row_splits_acc(ans);
@@ -841,22 +926,38 @@ void GetRowInfoMulti(int32_t num_srcs, RaggedShape **src,
   return ans;
 }
 
+/*static*/ RaggedShape StackAxis0(int32_t num_srcs, RaggedShape **src,
+                                  Array1<uint32_t> *merge_map /* == nullptr*/) {
+  NVTX_RANGE(K2_FUNC);
+  if (num_srcs == 1) {
+    if (merge_map)
+      *merge_map =
+          Arange<uint32_t>(src[0]->Context(), 0, src[0]->NumElements());
+    RaggedShape top_layer = TrivialShape(src[0]->Context(), src[0]->Dim0());
+    return ComposeRaggedShapes(top_layer, **src);
+  }
+  // We can't handle num_srcs == 0 because we won't have a context object.
+  K2_CHECK_GT(num_srcs, 1);
+  Array1OfRaggedShape array_of_shapes(src, num_srcs);
+  return StackAxis0(array_of_shapes, merge_map);
+}
+
 RaggedShape Cat(int32_t axis, int32_t num_srcs, RaggedShape **src,
                 Array1<uint32_t> *merge_map /* == nullptr*/) {
   NVTX_RANGE(K2_FUNC);
   K2_CHECK_GT(num_srcs, 0);
   if (axis == 0) {
     RaggedShape temp = StackAxis0(num_srcs, src, merge_map);
-    std::vector<RaggedShapeLayer> ans_layers(
+    RaggedShapeLayers ans_layers(
         temp.Layers().begin() + 1, temp.Layers().end());
-    return RaggedShape(ans_layers, false);
+    return RaggedShape(std::move(ans_layers), false);
   }
 
   K2_CHECK_LT(static_cast<uint32_t>(axis),
               static_cast<uint32_t>(src[0]->NumAxes()));
 
   int32_t num_axes = src[0]->NumAxes();
-  std::vector<RaggedShapeLayer> ans_layers(num_axes - 1);
+  RaggedShapeLayers ans_layers(num_axes - 1);
 
   // If axis >= 2, some layers of `src` will pass through unchanged (we should
   // check that they are identical across all sources).
@@ -881,7 +982,22 @@ RaggedShape Cat(int32_t axis, int32_t num_srcs, RaggedShape **src,
     merge_map_local = merge_map_next;
   }
   // TODO(dan) after this is debugged: add ", false".
-  return RaggedShape(ans_layers);
+  return RaggedShape(std::move(ans_layers));
+}
+
+RaggedShape Stack(Array1OfRaggedShape &src,
+                  Array1<uint32_t> *merge_map /* == nullptr*/) {
+  NVTX_RANGE(K2_FUNC);
+  return StackAxis0(src, merge_map);
+}
+
+RaggedShape Cat(Array1OfRaggedShape &src,
+                Array1<uint32_t> *merge_map /* == nullptr*/) {
+  NVTX_RANGE(K2_FUNC);
+  RaggedShape temp = StackAxis0(src, merge_map);
+  RaggedShapeLayers ans_layers(
+      temp.Layers().begin() + 1, temp.Layers().end());
+  return RaggedShape(std::move(ans_layers), false);
 }
 
 RaggedShape RemoveAxis(RaggedShape &src, int32_t axis) {
@@ -894,9 +1010,9 @@ RaggedShape RemoveAxis(RaggedShape &src, int32_t axis) {
   // axes i and i+1 in the source.
   src.Populate();
 
-  const std::vector<RaggedShapeLayer> &axes_in = src.Layers();
+  const RaggedShapeLayers &axes_in = src.Layers();
 
-  std::vector<RaggedShapeLayer> axes_out(axes_in.size() - 1);
+  RaggedShapeLayers axes_out(axes_in.size() - 1);
   int32_t axes_out_size = static_cast<int32_t>(axes_out.size());
 
   for (int32_t i = 0; i < axis - 1; ++i) axes_out[i] = axes_in[i];
@@ -909,7 +1025,7 @@ RaggedShape RemoveAxis(RaggedShape &src, int32_t axis) {
     axes_out[axis - 1].cached_tot_size = axes_out[axis - 1].row_ids.Dim();
   }
   for (int32_t i = axis; i < axes_out_size; ++i) axes_out[i] = axes_in[i + 1];
-  return RaggedShape(axes_out);
+  return RaggedShape(std::move(axes_out));
 }
 
 RaggedShape MakeTransposable(RaggedShape &src) {
@@ -926,8 +1042,8 @@ RaggedShape MakeTransposable(RaggedShape &src) {
 
   src.Populate();
 
-  const std::vector<RaggedShapeLayer> &axes_in = src.Layers();
-  std::vector<RaggedShapeLayer> axes_out(num_axes - 1);
+  const RaggedShapeLayers &axes_in = src.Layers();
+  RaggedShapeLayers axes_out(num_axes - 1);
   const int32_t *src_row_splits1_data = src.RowSplits(1).Data();
   const int32_t *src_row_ids1_data = src.RowIds(1).Data();
 
@@ -998,7 +1114,7 @@ RaggedShape MakeTransposable(RaggedShape &src) {
   }
   // copy left row_splits and row_ids;
   for (int32_t i = 2; i < num_axes - 1; ++i) axes_out[i] = axes_in[i];
-  return RaggedShape(axes_out);
+  return RaggedShape(std::move(axes_out));
 }
 
 // transpose axes 0 and 1.
@@ -1037,7 +1153,7 @@ RaggedShape Transpose(RaggedShape &src, Array1<int32_t> *value_indexes) {
 
   int32_t num_rows = src_dim1, row_splits_dim = num_rows + 1,
           row_ids_dim = src_tot_size1;
-  std::vector<RaggedShapeLayer> ans_axis0(1);
+  RaggedShapeLayers ans_axis0(1);
   Array1<int32_t> mem(c, row_splits_dim + row_ids_dim);
   int32_t *mem_data = mem.Data();
   K2_EVAL(
@@ -1064,7 +1180,7 @@ RaggedShape Transpose(RaggedShape &src, Array1<int32_t> *value_indexes) {
 
 RaggedShape Stack(int32_t axis, int32_t num_srcs, RaggedShape **src,
                   Array1<uint32_t> *merge_map /* = nullptr*/) {
-  NVTX_RANGE(K2_FUNC);
+  NVTX_RANGE_PAYLOAD(K2_FUNC, kRagged, num_srcs);
   K2_CHECK_GT(num_srcs, 0);
   K2_CHECK_LT(static_cast<uint32_t>(axis),
               static_cast<uint32_t>(src[0]->NumAxes()));
@@ -1078,7 +1194,7 @@ RaggedShape Stack(int32_t axis, int32_t num_srcs, RaggedShape **src,
               static_cast<uint32_t>(src[0]->NumAxes()));
 
   int32_t num_axes = src[0]->NumAxes();
-  std::vector<RaggedShapeLayer> ans_layers(num_axes);
+  RaggedShapeLayers ans_layers(num_axes);
 
   // If axis >= 2, some layers of `src` will pass through unchanged (we should
   // check that they are identical across all sources).
@@ -1105,7 +1221,7 @@ RaggedShape Stack(int32_t axis, int32_t num_srcs, RaggedShape **src,
     merge_map_local = merge_map_next;
   }
   // TODO(dan) after this is debugged: add ", false".
-  return RaggedShape(ans_layers);
+  return RaggedShape(std::move(ans_layers));
 }
 
 /*
@@ -1429,7 +1545,7 @@ RaggedShape Merge(int32_t num_srcs, RaggedShape **src,
   K2_CHECK(num_srcs > 0);
   int32_t num_layers = src[0]->NumAxes() - 1;
 
-  std::vector<RaggedShapeLayer> ans_layers(num_layers);
+  RaggedShapeLayers ans_layers(num_layers);
 
   // Note: this is a shallow copy.
   Array1<uint32_t> merge_map_local = merge_map;
@@ -1443,7 +1559,7 @@ RaggedShape Merge(int32_t num_srcs, RaggedShape **src,
     merge_map_local = merge_map_next;
   }
   // TODO(dan) after this is debugged: add ", false".
-  return RaggedShape(ans_layers);
+  return RaggedShape(std::move(ans_layers));
 }
 
 RaggedShape TrivialShape(ContextPtr &c, int32_t num_elems) {
@@ -1482,21 +1598,30 @@ Ragged<int32_t> GetCountsPartitioned(Ragged<int32_t> &src,
 /*static*/ Array1<int32_t> GetTransposeReorderingCpu(Ragged<int32_t> &src,
                                                      int32_t num_cols) {
   NVTX_RANGE(K2_FUNC);
-  std::vector<std::vector<int32_t>> column_indexes(num_cols);  // [column][row]
   const int32_t *values_data = src.values.Data();
   int32_t n = src.values.Dim();
-
-  for (int32_t i = 0; i != n; ++i) {
-    int32_t bucket = values_data[i];
-    column_indexes[bucket].push_back(i);
-  }
-
   Array1<int32_t> ans(src.Context(), n);
   int32_t *ans_data = ans.Data();
-  for (int32_t i = 0; i != num_cols; ++i) {
-    std::copy(column_indexes[i].begin(), column_indexes[i].end(), ans_data);
-    ans_data += column_indexes[i].size();
+
+  if (num_cols > 8 * static_cast<int64_t>(n)) {
+    // Most columns are empty, so a counting sort would spend its time on
+    // the per-column counts; sort the indexes instead.  The sort is stable,
+    // so elements in the same column stay in order.
+    std::iota(ans_data, ans_data + n, 0);
+    std::stable_sort(ans_data, ans_data + n,
+                     [values_data](int32_t a, int32_t b) -> bool {
+                       return values_data[a] < values_data[b];
+                     });
+    return ans;
   }
+
+  // A counting sort: count the elements of each column, get where each
+  // column starts in `ans` with an exclusive sum, then put the elements
+  // there in order, which keeps those in the same column in order.
+  std::vector<int32_t> col_begin(num_cols + 1, 0);
+  for (int32_t i = 0; i != n; ++i) ++col_begin[values_data[i] + 1];
+  std::partial_sum(col_begin.begin(), col_begin.end(), col_begin.begin());
+  for (int32_t i = 0; i != n; ++i) ans_data[col_begin[values_data[i]]++] = i;
   return ans;
 }
 
@@ -1560,7 +1685,8 @@ static void CheckGetTransposeReordering(Ragged<int32_t> &src,
   }*/
 
 Array1<int32_t> GetTransposeReordering(Ragged<int32_t> &src, int32_t num_cols) {
-  NVTX_RANGE(K2_FUNC);
+  NVTX_RANGE_PAYLOAD(K2_FUNC, kRagged, src.NumElements());
+  CaptureShape("GetTransposeReordering", src.shape, {num_cols});
   ContextPtr &context = src.Context();
   if (src.NumAxes() < 2 || src.values.Dim() == 0) {
     // src is empty
@@ -1683,7 +1809,7 @@ RaggedShape ChangeSublistSize(const RaggedShape &src, int32_t size_delta) {
   K2_CHECK_GE(src.NumAxes(), 2);
   // the result will have the same num-axes as `src` (the NumAxes() of the
   // object is not the same as the number of RaggedShapeLayer axes).
-  std::vector<RaggedShapeLayer> ans_axes(src.NumAxes() - 1);
+  RaggedShapeLayers ans_axes(src.NumAxes() - 1);
   int32_t last_axis = src.NumAxes() - 1;
   // The following will only do something if src.NumAxes() > 2.
   for (int32_t i = 0; i + 1 < last_axis; ++i) ans_axes[i] = src.Layers()[i];
@@ -1746,7 +1872,7 @@ RaggedShape ChangeSublistSize(const RaggedShape &src, int32_t size_delta) {
     // validation code that gets invoked by the constructor of RaggedShape
     // below).
   }
-  return RaggedShape(ans_axes);
+  return RaggedShape(std::move(ans_axes));
 }
 
 // TODO(dan): this could definitely be made more efficient.
@@ -1756,7 +1882,7 @@ RaggedShape ChangeSublistSizePinned(RaggedShape &src, int32_t size_delta) {
 
   // the result will have the same num-axes as `src` (the NumAxes() of the
   // object is not the same as the number of RaggedShapeLayer axes).
-  std::vector<RaggedShapeLayer> ans_axes(src.NumAxes() - 1);
+  RaggedShapeLayers ans_axes(src.NumAxes() - 1);
   int32_t last_axis = src.NumAxes() - 1;
   // The following will only do something if src.NumAxes() > 2.
   for (int32_t i = 0; i + 1 < last_axis; ++i) ans_axes[i] = src.Layers()[i];
@@ -1785,7 +1911,7 @@ RaggedShape ChangeSublistSizePinned(RaggedShape &src, int32_t size_delta) {
       Array1<int32_t>(c, ans_axes.back().row_splits.Back());
   RowSplitsToRowIds(ans_axes.back().row_splits, &ans_axes.back().row_ids);
   ans_axes.back().cached_tot_size = ans_axes.back().row_ids.Dim();
-  return RaggedShape(ans_axes);
+  return RaggedShape(std::move(ans_axes));
 }
 
 RaggedShape Prefix(RaggedShape &src, int32_t n) {
@@ -1796,8 +1922,8 @@ RaggedShape Prefix(RaggedShape &src, int32_t n) {
   src.Populate();
   int32_t num_axes = src.NumAxes();
   K2_CHECK_GE(num_axes, 2);
-  const std::vector<RaggedShapeLayer> &axes_in = src.Layers();
-  std::vector<RaggedShapeLayer> axes_out(axes_in.size());
+  const RaggedShapeLayers &axes_in = src.Layers();
+  RaggedShapeLayers axes_out(axes_in.size());
 
   int32_t row_end = n;
   for (int32_t axis = 0; axis < num_axes - 1; ++axis) {
@@ -1807,7 +1933,7 @@ RaggedShape Prefix(RaggedShape &src, int32_t n) {
     axes_out[axis].row_ids = axes_in[axis].row_ids.Arange(0, row_end);
     axes_out[axis].cached_tot_size = row_end;
   }
-  return RaggedShape(axes_out);
+  return RaggedShape(std::move(axes_out));
 }
 
 std::vector<RaggedShape> GetPrefixes(RaggedShape &src,
@@ -1818,7 +1944,7 @@ std::vector<RaggedShape> GetPrefixes(RaggedShape &src,
   int32_t num_axes = src.NumAxes();
   K2_CHECK_GE(num_axes, 2);
   ContextPtr &c = src.Context();
-  const std::vector<RaggedShapeLayer> &axes_in = src.Layers();
+  const RaggedShapeLayers &axes_in = src.Layers();
 
   // get those row_end elements at each axis.
   int32_t ans_size = static_cast<int32_t>(sizes.size());
@@ -1836,7 +1962,7 @@ std::vector<RaggedShape> GetPrefixes(RaggedShape &src,
   row_ends = row_ends.To(GetCpuContext());
   std::vector<RaggedShape> ans(ans_size);
   for (int32_t i = 0; i != ans_size; ++i) {
-    std::vector<RaggedShapeLayer> axes_out(axes_in.size());
+    RaggedShapeLayers axes_out(axes_in.size());
     int32_t row_end = row_ends[i];
     K2_CHECK(row_end >= 0 && row_end <= dim0);
     for (int32_t axis = 0; axis < num_axes - 1; ++axis) {
@@ -1846,7 +1972,7 @@ std::vector<RaggedShape> GetPrefixes(RaggedShape &src,
       axes_out[axis].row_ids = axes_in[axis].row_ids.Arange(0, row_end);
       axes_out[axis].cached_tot_size = row_end;
     }
-    ans[i] = RaggedShape(axes_out, false);
+    ans[i] = RaggedShape(std::move(axes_out), false);
   }
   return ans;
 }
@@ -1869,10 +1995,10 @@ RaggedShape Arange(RaggedShape &src, int32_t axis, int32_t begin, int32_t end,
 
   src.Populate();
   ContextPtr &c = src.Context();
-  const std::vector<RaggedShapeLayer> &axes_in = src.Layers();
+  const RaggedShapeLayers &axes_in = src.Layers();
   int32_t ans_num_axes = num_axes - axis;
   // `-1` as Layers().size is NumAxes() - 1
-  std::vector<RaggedShapeLayer> axes_out(ans_num_axes - 1);
+  RaggedShapeLayers axes_out(ans_num_axes - 1);
 
   // get those `row_begin` and `row_end` indexes for all axes in a kernel so we
   // can do just one GPU to CPU memory transfer.
@@ -1915,7 +2041,7 @@ RaggedShape Arange(RaggedShape &src, int32_t axis, int32_t begin, int32_t end,
     axes_out[cur_axis - axis].cached_tot_size = row_end - row_begin;
   }
   if (value_range != nullptr) *value_range = std::make_pair(row_begin, row_end);
-  return RaggedShape(axes_out);
+  return RaggedShape(std::move(axes_out));
 }
 
 Ragged<int32_t> AddSuffixToRagged(Ragged<int32_t> &src,
@@ -2005,7 +2131,7 @@ RaggedShape SubsetRaggedShape(RaggedShape &src, Renumbering &r_before_last,
   // Make sure final and before-final row-ids are populated.
   src.RowIds(src.NumAxes() - 2);
   src.RowIds(src.NumAxes() - 1);
-  std::vector<RaggedShapeLayer> axes = src.Layers();
+  RaggedShapeLayers axes = src.Layers();
 
   // Suppose this shape has 3 axes (0,1,2).  Its NumAxes()==3;
   // axes.size()==2.
@@ -2079,19 +2205,19 @@ RaggedShape SubsetRaggedShape(RaggedShape &src, Renumbering &r_before_last,
   last.row_splits = last_row_splits;
   last.row_ids = last_row_ids;
   last.cached_tot_size = new_tot_size2;
-  return RaggedShape(axes);
+  return RaggedShape(std::move(axes));
 }
 
 RaggedShape EmptyRaggedShape(ContextPtr &c, int32_t num_axes) {
   NVTX_RANGE(K2_FUNC);
   K2_CHECK_GE(num_axes, 2);
-  std::vector<RaggedShapeLayer> axes(num_axes - 1);
+  RaggedShapeLayers axes(num_axes - 1);
   axes[0].row_splits = Array1<int32_t>(c, 1, 0);
   // row_ids will be the empty vector, with context `c`.
   axes[0].row_ids = axes[0].row_splits.Range(0, 0);
   axes[0].cached_tot_size = 0;
   for (int32_t a = 1; a + 1 < num_axes; ++a) axes[a] = axes[0];
-  return RaggedShape(axes);
+  return RaggedShape(std::move(axes));
 }
 
 Array1<int32_t> GetDecreasingSizeOrder(RaggedShape &shape) {
@@ -2108,10 +2234,10 @@ RaggedShape GetLayer(const RaggedShape &src, int32_t layer) {
   NVTX_RANGE(K2_FUNC);
   K2_CHECK_GE(layer, 0);
   K2_CHECK_LT(layer, src.NumAxes() - 1);
-  std::vector<RaggedShapeLayer> layers;
+  RaggedShapeLayers layers;
   layers.push_back(src.Layers()[layer]);
   bool check = false;
-  return RaggedShape(layers, check);
+  return RaggedShape(std::move(layers), check);
 }
 
 void DecomposeRaggedShape(const RaggedShape &src, int32_t axis,
@@ -2119,20 +2245,21 @@ void DecomposeRaggedShape(const RaggedShape &src, int32_t axis,
   NVTX_RANGE(K2_FUNC);
   K2_CHECK_GT(axis, 0);
   K2_CHECK_LT(axis, src.NumAxes() - 1);
-  const std::vector<RaggedShapeLayer> &src_layers = src.Layers();
-  std::vector<RaggedShapeLayer> top_layers(axis),
+  const RaggedShapeLayers &src_layers = src.Layers();
+  RaggedShapeLayers top_layers(axis),
       bottom_layers(src_layers.size() - axis);
   int32_t src_size = static_cast<int32_t>(src_layers.size());
   for (int32_t i = 0; i < axis; ++i) top_layers[i] = src_layers[i];
   for (int32_t i = axis; i < src_size; ++i)
     bottom_layers[i - axis] = src_layers[i];
-  *top = RaggedShape(top_layers);
-  *bottom = RaggedShape(bottom_layers);
+  *top = RaggedShape(std::move(top_layers));
+  *bottom = RaggedShape(std::move(bottom_layers));
 }
 
 RaggedShape RemoveEmptyLists(RaggedShape &src_shape, int32_t axis,
                              Renumbering *renumbering_out) {
-  NVTX_RANGE(K2_FUNC);
+  NVTX_RANGE_PAYLOAD(K2_FUNC, kRagged, src_shape.TotSize(axis));
+  CaptureShape("RemoveEmptyLists", src_shape, {axis});
   if (axis == 0) {
     return RemoveEmptyListsAxis0(src_shape, renumbering_out);
   }
@@ -2184,7 +2311,7 @@ RaggedShape RenumberAxis0Simple(RaggedShape &src_shape,
   K2_CHECK_EQ(renumbering.NumOldElems(), src_shape.Dim0());
   ContextPtr c = src_shape.Context();
   src_shape.RowIds(1);  // make sure RowIds(1) is populated.
-  std::vector<RaggedShapeLayer> layers = src_shape.Layers();
+  RaggedShapeLayers layers = src_shape.Layers();
   int32_t num_layers = layers.size();
   int32_t new_num_lists = renumbering.NumNewElems(),
           num_elems = src_shape.TotSize(1);  // unchanged old vs. new.
@@ -2229,7 +2356,7 @@ RaggedShape RenumberAxis0Simple(RaggedShape &src_shape,
   layers[0].row_splits = new_row_splits;
   layers[0].row_ids = new_row_ids;
   // no need to set its cached_tot_size; that didn't change.
-  return RaggedShape(layers);
+  return RaggedShape(std::move(layers));
 }
 
 RaggedShape CoveringShape(int32_t num_srcs, RaggedShape **srcs) {
@@ -2424,7 +2551,7 @@ RaggedShape RaggedShapeAxis0Splitter::GetElement(int32_t i,
                                                  int32_t *elem_offset) {
   NVTX_RANGE(K2_FUNC);
   int32_t num_layers_out = composite_row_splits_.Dim0() - 2;
-  std::vector<RaggedShapeLayer> out;
+  RaggedShapeLayers out;
   out.reserve(num_layers_out);
 
   auto composite_row_splits_cpu_acc = composite_row_splits_cpu_.Accessor();
@@ -2667,11 +2794,213 @@ Ragged<int32_t> UniqueSequences(Ragged<int32_t> &src,
   return ans;
 }
 
+Ragged<int32_t> UniqueSequencesHashed(
+    Ragged<int32_t> &src, Ragged<int32_t> *num_repeats /*=nullptr*/,
+    Array1<int32_t> *new2old_indexes /*=nullptr*/, bool exact /*=false*/) {
+  NVTX_RANGE(K2_FUNC);
+  ContextPtr &c = src.Context();
+  if (src.NumAxes() == 2) {
+    // Put 'fake' layer at front, process, then remove.
+    Ragged<int32_t> temp = Unsqueeze(src, 0);
+    return UniqueSequencesHashed(temp, num_repeats, new2old_indexes, exact)
+        .RemoveAxis(0);
+  }
+  Array1<int64_t> hashes = ComputeHash<int64_t>(src);
+  int32_t num_seqs = hashes.Dim();
+  // seqs_shape is indexed [utt][seq], where by `utt` we mean an index on axis
+  // src.NumAxes() - 3.
+  RaggedShape seqs_shape = GetLayer(src.shape, src.shape.NumLayers() - 2);
+  const int32_t *utts_data = seqs_shape.RowIds(1).Data(),
+                *seq_row_splits_data = src.RowSplits(src.NumAxes() - 1).Data(),
+                *src_data = src.values.Data();
+  const int64_t *hashes_data = hashes.Data();
+
+  // first[i] will be the first sequence that equals sequence i.  In each
+  // round, every pending sequence looks up its key in a hash, and is
+  // resolved if it equals the sequence that got there first, which is
+  // itself resolved; so each round resolves at least one sequence.
+  Array1<int32_t> first(c, num_seqs), pending = Range(c, num_seqs, 0);
+  int32_t *first_data = first.Data();
+  // neg_first[r], for a sequence r that was inserted into the hash, is
+  // minus the first sequence that matched it (using AtomicMax()).
+  Array1<int32_t> neg_first(c, num_seqs);
+  int32_t *neg_first_data = neg_first.Data();
+  while (pending.Dim() != 0) {
+    int32_t num_pending = pending.Dim();
+    Hash64 hash(c, std::max<int32_t>(
+                       128, RoundUpToNearestPowerOfTwo(2 * num_pending)));
+    Hash64::Accessor acc = hash.GetAccessor();
+    const int32_t *pending_data = pending.Data();
+    // repr[i] is the sequence found in the hash for pending[i], or -1 if
+    // pending[i] is not resolved in this round.
+    Array1<int32_t> repr(c, num_pending);
+    int32_t *repr_data = repr.Data();
+    K2_EVAL(
+        c, num_pending, lambda_insert, (int32_t i)->void {
+          int32_t seq = pending_data[i];
+          // The key combines the utterance and the hash of the sequence;
+          // sequences of different utterances whose keys collide are told
+          // apart in lambda_verify.
+          uint64_t key = static_cast<uint64_t>(hashes_data[seq]) +
+                         static_cast<uint64_t>(utts_data[seq] + 1) *
+                             0x9E3779B97F4A7C15ULL;
+          key ^= key >> 31;
+          if (~key == 0) key = 0;  // All-ones means "empty" in Hash64.
+          uint64_t value = seq;
+          // If the key was present, Find() waits for its value to be written
+          // (Insert() may return before that if another thread inserted it).
+          if (!acc.Insert(key, value)) acc.Find(key, &value);
+          repr_data[i] = static_cast<int32_t>(value);
+          neg_first_data[seq] = -seq;
+        });
+    K2_EVAL(
+        c, num_pending, lambda_verify, (int32_t i)->void {
+          int32_t seq = pending_data[i], r = repr_data[i];
+          bool same = (utts_data[seq] == utts_data[r]);
+          if (same && exact && seq != r) {
+            int32_t begin = seq_row_splits_data[seq],
+                    len = seq_row_splits_data[seq + 1] - begin,
+                    r_begin = seq_row_splits_data[r];
+            same = (len == seq_row_splits_data[r + 1] - r_begin);
+            for (int32_t j = 0; same && j < len; ++j)
+              same = (src_data[begin + j] == src_data[r_begin + j]);
+          }
+          if (same)
+            AtomicMax(neg_first_data + r, -seq);
+          else
+            repr_data[i] = -1;
+        });
+    Renumbering renumber_pending(c, num_pending);
+    char *keep_data = renumber_pending.Keep().Data();
+    K2_EVAL(
+        c, num_pending, lambda_set_first, (int32_t i)->void {
+          int32_t r = repr_data[i];
+          keep_data[i] = (r < 0);
+          if (r >= 0) first_data[pending_data[i]] = -neg_first_data[r];
+        });
+    pending = renumber_pending.Compact(pending);
+    hash.Destroy();
+  }
+
+  Renumbering renumber_seqs(c, num_seqs);
+  char *keep_data = renumber_seqs.Keep().Data();
+  Array1<int32_t> counts(c, num_seqs, 0);
+  int32_t *counts_data = counts.Data();
+  K2_EVAL(
+      c, num_seqs, lambda_set_keep, (int32_t i)->void {
+        keep_data[i] = (first_data[i] == i);
+        AtomicAdd(counts_data + first_data[i], 1);
+      });
+  Array1<int32_t> new2old = renumber_seqs.New2Old();
+  Ragged<int32_t> ans = Index(src, src.NumAxes() - 2, new2old);
+  if (num_repeats != nullptr)
+    *num_repeats = Ragged<int32_t>(GetLayer(ans.shape, ans.NumAxes() - 3),
+                                   counts[new2old]);
+  if (new2old_indexes != nullptr) *new2old_indexes = std::move(new2old);
+  return ans;
+}
+
 // Instantiate template for int64 and int32.
 template
 Array1<int64_t> ComputeHash(Ragged<int32_t> &src);
 template
 Array1<int32_t> ComputeHash(Ragged<int32_t> &src);
 
+// The number of bytes `array` takes in a region packed by PackArrays(),
+// where each array starts at a multiple of 64 bytes.
+static size_t PackedBytes(const Array1<Any> &array) {
+  return (array.Dim() * array.ElementSize() + 63) / 64 * 64;
+}
+
+// The arrays of `src` in the order they are packed by PackArrays(): the
+// row_splits and row_ids (if present) of each layer, then the values.
+static std::vector<Array1<Any>> RaggedArrays(Ragged<Any> &src) {
+  std::vector<Array1<Any>> ans;
+  for (RaggedShapeLayer &layer : src.shape.Layers()) {
+    ans.push_back(layer.row_splits.Generic());
+    if (layer.row_ids.IsValid()) ans.push_back(layer.row_ids.Generic());
+  }
+  ans.push_back(src.values);
+  return ans;
+}
+
+// The inverse of RaggedArrays().
+static Ragged<Any> RaggedFromArrays(Ragged<Any> &src,
+                                    std::vector<Array1<Any>> &arrays) {
+  RaggedShapeLayers layers = src.shape.Layers();
+  size_t i = 0;
+  for (RaggedShapeLayer &layer : layers) {
+    layer.row_splits = arrays[i++].Specialize<int32_t>();
+    if (layer.row_ids.IsValid())
+      layer.row_ids = arrays[i++].Specialize<int32_t>();
+  }
+  return Ragged<Any>(RaggedShape(std::move(layers)), arrays[i]);
+}
+
+/* Copy `arrays` into one new region of `ctx`, one after another.  Returns
+   the copies, which share the region.
+ */
+static std::vector<Array1<Any>> PackArrays(std::vector<Array1<Any>> &arrays,
+                                           ContextPtr ctx) {
+  NVTX_RANGE(K2_FUNC);
+  std::vector<size_t> byte_offsets(arrays.size());
+  size_t num_bytes = 0;
+  for (size_t i = 0; i != arrays.size(); ++i) {
+    byte_offsets[i] = num_bytes;
+    num_bytes += PackedBytes(arrays[i]);
+  }
+  RegionPtr region = NewRegion(ctx, num_bytes);
+  std::vector<Array1<Any>> ans;
+  for (size_t i = 0; i != arrays.size(); ++i) {
+    Array1<Any> &src = arrays[i];
+    ans.emplace_back(src.Dim(), region, byte_offsets[i], src.GetDtype());
+    src.Context()->CopyDataTo(src.Dim() * src.ElementSize(), src.Data(), ctx,
+                              ans.back().Data());
+  }
+  return ans;
+}
+
+// Returns true if `arrays` are laid out in one region as by PackArrays().
+static bool IsPacked(std::vector<Array1<Any>> &arrays) {
+  const Region *region = arrays[0].GetRegion().get();
+  size_t next_offset = 0;
+  for (Array1<Any> &array : arrays) {
+    if (array.GetRegion().get() != region || array.ByteOffset() != next_offset)
+      return false;
+    next_offset += PackedBytes(array);
+  }
+  return next_offset == region->num_bytes;
+}
+
+Ragged<Any> PinMemory(Ragged<Any> &src) {
+  NVTX_RANGE(K2_FUNC);
+  std::vector<Array1<Any>> arrays = RaggedArrays(src);
+  std::vector<Array1<Any>> packed = PackArrays(arrays, GetPinnedContext());
+  return RaggedFromArrays(src, packed);
+}
+
+Ragged<Any> PackedTo(Ragged<Any> &src, ContextPtr ctx) {
+  NVTX_RANGE(K2_FUNC);
+  ContextPtr src_context = src.Context();
+  if (ctx->IsCompatible(*src_context)) return src;
+  if (src_context->GetDeviceType() != kCpu ||
+      ctx->GetDeviceType() != kCuda)
+    return src.To(ctx);
+
+  std::vector<Array1<Any>> arrays = RaggedArrays(src);
+  // If `src` came from PinMemory(), its region is in pinned memory and
+  // the copy is asynchronous.
+  if (!IsPacked(arrays)) arrays = PackArrays(arrays, GetPinnedContext());
+  const RegionPtr &src_region = arrays[0].GetRegion();
+  RegionPtr region = NewRegion(ctx, src_region->num_bytes);
+  src_region->context->CopyDataTo(src_region->num_bytes, src_region->data, ctx,
+                                  region->data);
+  std::vector<Array1<Any>> ans;
+  for (Array1<Any> &array : arrays)
+    ans.emplace_back(array.Dim(), region, array.ByteOffset(),
+                     array.GetDtype());
+  return RaggedFromArrays(src, ans);
+}
+
 
 }  // namespace k2
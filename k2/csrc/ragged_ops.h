@@ -27,6 +27,7 @@
 
 #include "k2/csrc/algorithms.h"
 #include "k2/csrc/array.h"
+#include "k2/csrc/array_of_ragged.h"
 #include "k2/csrc/log.h"
 #include "k2/csrc/macros.h"
 #include "k2/csrc/ragged.h"
@@ -108,6 +109,35 @@ void LogSumPerSublist(Ragged<T> &src, T initial_value, Array1<T> *dst_values) {
 template <typename T>
 void ArgMaxPerSublist(Ragged<T> &src, T initial_value, Array1<int32_t> *argmax);
 
+/*
+  Output to an array `kth_values` the k-th largest element of each sub-list
+  along the last axis of `src` (k == 1 is the maximum).  This is done by
+  radix selection on the bits of the values (see FloatToOrderedUint()), a
+  byte at a time, so it takes sizeof(T) passes over the elements and is
+  cheaper than sorting the sub-lists when all we need is a cutoff.
+
+     @param [in] src        Input ragged array; must have src.NumAxes() >= 2.
+                            T must be float or double.
+     @param [in] k          The rank of the element wanted, k >= 1.
+     @param [in] default_value  The value to output for sub-lists with
+                            fewer than k elements.
+     @param [out] kth_values  Array to which the k-th largest values will be
+                            written, with kth_values->Dim() ==
+                            src.TotSize(src.NumAxes() - 2), i.e. num-rows of
+                            last axis of `src`.
+     @param [out] num_greater  If not nullptr, will be set to an array of the
+                            same dimension as `kth_values`, containing the
+                            number of elements in each sub-list that are
+                            strictly greater than its k-th largest element
+                            (so it is < k); the elements equal to it are
+                            needed to make up the top k.  Set to the sub-list
+                            size for sub-lists with fewer than k elements.
+ */
+template <typename T>
+void KthLargestPerSublist(Ragged<T> &src, int32_t k, T default_value,
+                          Array1<T> *kth_values,
+                          Array1<int32_t> *num_greater = nullptr);
+
 /* Normalize per sublist.
 
    @param [in] src  The source ragged tensor. The normalization
@@ -127,6 +157,10 @@ void ArgMaxPerSublist(Ragged<T> &src, T initial_value, Array1<int32_t> *argmax);
       2. Divide the sublist by the above sum
       3. Return the resulting sublist
 
+   (The two steps are fused: each sublist is normalized right after it is
+   reduced, while it is still in cache on CPU, or by the warp that reduced it
+   on GPU unless the sublists are very long.)
+
    @return The normalized ragged tensor.
  */
 template <typename T>
@@ -642,6 +676,21 @@ void DecomposeRaggedShape(const RaggedShape &src, int32_t axis,
  */
 Array2<int32_t> GetOffsets(int32_t num_srcs, RaggedShape **src);
 
+/*
+  Make sure the TotSize() of every axis of every shape in `src` is known on
+  the host (i.e. cached), fetching all the ones that were not known (each of
+  which would otherwise need a separate blocking device-to-host copy) in one go
+  via GetLastElements().  Shapes constructed with unknown sizes, e.g.
+  RaggedShape2(&row_splits, nullptr, -1), defer this copy until the size is
+  needed; this lets such shapes be resolved together.
+
+     @param [in] num_srcs  The number of `RaggedShape`s in `src`
+     @param [in,out] src   The shapes whose sizes we want; must all have
+                           compatible contexts.  Their cached_tot_size members
+                           may be set by this function.
+ */
+void PopulateTotSizes(int32_t num_srcs, RaggedShape **src);
+
 /*
   Make a shape `src` to be transposable by appending empty rows on axis 1.
   Specifically, suppose the size of longest sub list on axis 1 is `t`
@@ -732,6 +781,17 @@ Ragged<T> Transpose(Ragged<T> &src,
 RaggedShape Cat(int32_t axis, int32_t num_srcs, RaggedShape **src,
                 Array1<uint32_t> *merge_map = nullptr);
 
+/*
+  Versions of Stack() and Cat() on axis 0 that take an Array1OfRaggedShape,
+  whose row_splits and row_ids pointer tables and offsets already live on
+  the device.  Use these when appending many shapes: no per-source work is
+  done on the CPU here.  The `merge_map` is as for the versions above.
+ */
+RaggedShape Stack(Array1OfRaggedShape &src,
+                  Array1<uint32_t> *merge_map = nullptr);
+RaggedShape Cat(Array1OfRaggedShape &src,
+                Array1<uint32_t> *merge_map = nullptr);
+
 /*
   Extract meta-info from the shape (this will include populating any row_ids and
   row_splits that were not already populated).  This is used inside algorithms
@@ -1143,6 +1203,17 @@ template <typename T>
 Ragged<T> Cat(int32_t axis, int32_t num_srcs, Ragged<T> *src,
               Array1<uint32_t> *merge_map = nullptr);
 
+/*
+  Versions of Stack() and Cat() on axis 0 for an Array1OfRagged<T>; the
+  values are gathered with one kernel through the device-resident values
+  pointers of `src`.
+ */
+template <typename T>
+Ragged<T> Stack(Array1OfRagged<T> &src,
+                Array1<uint32_t> *merge_map = nullptr);
+template <typename T>
+Ragged<T> Cat(Array1OfRagged<T> &src, Array1<uint32_t> *merge_map = nullptr);
+
 /*
   Construct a RaggedShape with 2 axes.
      @param [in] row_splits   row_splits, or NULL (at least one of this and
@@ -1257,6 +1328,25 @@ RaggedShape RegularRaggedShape(ContextPtr &c, int32_t dim0, int32_t dim1);
 RaggedShape RaggedShapeFromTotSizes(ContextPtr c, int32_t num_axes,
                                     const int32_t *tot_sizes);
 
+/*
+  Creates a RaggedShape from the number of elements in each sublist on each
+  axis, for all axes at once.  It is equivalent to doing ExclusiveSum() on each
+  of `sizes` and RaggedShape2/3/4(), and then computing all the row_ids, but it
+  uses a fixed number of kernels and a single device-to-host sync whatever the
+  number of axes.
+
+     @param [in] sizes  For 0 <= i < sizes.size(), sizes[i][j] is the number
+                        of elements on axis i+1 in row j on axis i of the
+                        result.  We require 1 <= sizes.size() <= 4 and, for
+                        i > 0, sizes[i].Dim() == Sum(sizes[i-1]).  All must be
+                        on the same context.
+
+     @return  Returns a RaggedShape with sizes.size() + 1 axes and
+              Dim0() == sizes[0].Dim(), whose row_splits and row_ids
+              are all set.
+ */
+RaggedShape RaggedShapeFromSizes(const std::vector<Array1<int32_t>> &sizes);
+
 /*
   Returns an empty ragged shape with the specified number of axes.
   Require num_axes >= 2.
@@ -1343,7 +1433,9 @@ inline Ragged<T> RaggedFromTotSizes(ContextPtr &c,
   csr2csc functions
   https://docs.nvidia.com/cuda/cusparse/index.html#csr2cscEx2). However I'm not
   sure what it does when there are repeated elements.  It might be easiest to
-  implement it via sorting for now.
+  implement it via sorting for now.  (On CPU it is a counting sort, unless
+  num_cols is much larger than the number of elements, when the indexes are
+  sorted; on CUDA it is a radix sort on the ceil(log2(num_cols)) low bits.)
 
 
      @param [in] src  Input tensor, see above.
@@ -1546,11 +1638,29 @@ Ragged<T> Index(Array1<T> &src, Ragged<int32_t> &indexes, T default_value) {
                    Index(src, indexes.values, true, default_value));
 }
 
+/*
+   The same as Index(src, indexes, true) for `src` and `indexes` with 2 axes
+   (e.g. a ragged attribute of an FSA and the ragged arc_map of
+   RemoveEpsilon()), but done with one shape computation and one copy of the
+   values, and -1 is allowed in `indexes`, contributing nothing.  I.e. the i'th
+   sublist of the answer is the concatenation of the sublists
+   `src[indexes[i][j]]` with `indexes[i][j] != -1`.
+
+       @param [in] src   Source tensor, with 2 axes.
+       @param [in] indexes   Indexes into axis 0 of `src`, with 2 axes;
+                          must satisfy `-1 <= indexes.values[i] < src.Dim0()`.
+       @return  Returns a tensor with 2 axes and `ans.Dim0() ==
+                indexes.Dim0()`.
+*/
+template <typename T>
+Ragged<T> IndexAndRemoveAxis2(Ragged<T> &src, Ragged<int32_t> &indexes);
+
 /*
    Index ragged tensor with ragged tensor.
        @param [in] src   Source tensor, to be indexed
        @param [in] indexes   Indexes into source array; the values must
-                          satisfy `0 <= indexes.values[i] < src.Dim0()`.
+                          satisfy `-1 <= indexes.values[i] < src.Dim0()`,
+                          where -1 stands for an empty sublist.
        @param [in] remove_axis  If remove_axis == true,
              then we remove the last-but-one axis, which has the effect
              of appending lists, e.g.
@@ -1561,6 +1671,10 @@ Ragged<T> Index(Array1<T> &src, Ragged<int32_t> &indexes, T default_value) {
 
        @return  Returns indexed tensor.
 
+    If `src` has 2 axes, e.g. aux_labels indexed with n-best paths, this is
+    done with one ExclusiveSum() and one pass over the values, for any number
+    of axes of `indexes`; see also IndexAndRemoveAxis2().
+
     CAUTION: the validity of the indexes is not checked, which may
     result in segfault or undefined values.
 */
@@ -1661,6 +1775,28 @@ Ragged<int32_t> UniqueSequences(Ragged<int32_t> &src,
                                 Ragged<int32_t> *num_repeats = nullptr,
                                 Array1<int32_t> *new2old_indexes = nullptr);
 
+/*
+  Version of UniqueSequences() that does not sort: each sub-list is inserted
+  into a Hash64 keyed by (its index on axis src.NumAxes() - 3, its hash from
+  ComputeHash<int64_t>()), and of each set of repeats the first occurrence is
+  kept.  The output keeps the order of the input, i.e. `new2old_indexes` is
+  increasing.  This is faster than UniqueSequences() for many sub-lists, e.g.
+  when sampling many paths per utterance in Nbest::FromLattice().
+
+  The args and return value are as for UniqueSequences(), plus:
+
+     @param [in] exact  If true, each sub-list is compared with the first
+                       occurrence of its hash, and sub-lists whose hashes
+                       collide without them being equal are kept apart (they
+                       are processed again in a further round).  If false,
+                       as with UniqueSequences(), such sub-lists are treated
+                       as repeats.  Sub-lists in different indexes on axis
+                       src.NumAxes() - 3 are never treated as repeats.
+ */
+Ragged<int32_t> UniqueSequencesHashed(
+    Ragged<int32_t> &src, Ragged<int32_t> *num_repeats = nullptr,
+    Array1<int32_t> *new2old_indexes = nullptr, bool exact = false);
+
 /* Compute exclusive sum per sub-list.
 
     @param [in] src  The input ragged tensor. The exclusive sum is computed
@@ -1696,10 +1832,54 @@ Ragged<T> CreateRagged2(const std::vector<std::vector<T>> &vecs);
     @param [in] padding_value  Value for padded elements.
                      Used only when mode is "constant" or a list
                      is empty.
+    @param [in] max_len  If >= 0, the number of columns of the result,
+                     e.g. a bound on the list sizes known to the caller;
+                     this avoids computing src.shape.MaxSize(1), which
+                     needs a device-to-host copy on GPU.  Elements of
+                     lists longer than this are dropped.  If < 0, the
+                     maximum list size is used.
     @return  Returns the corresponding regular array (Array2).
  */
 template <typename T>
-Array2<T> PadRagged(Ragged<T> &src, const std::string &mode, T padding_value);
+Array2<T> PadRagged(Ragged<T> &src, const std::string &mode, T padding_value,
+                    int32_t max_len = -1);
+
+/*
+  Version of PadRagged() that writes into an existing array, e.g. one that
+  shares memory with a torch tensor, in a single kernel.  `dest` must be on
+  the same device as `src` and satisfy dest->Dim0() == src.Dim0(); its
+  Dim1() plays the role of `max_len` above.
+ */
+template <typename T>
+void PadRagged(Ragged<T> &src, const std::string &mode, T padding_value,
+               Array2<T> *dest);
+
+/*
+  Return a copy of `src` in pinned memory (see GetPinnedContext()), with
+  the row_splits, row_ids (if present) and values of all axes packed into
+  one region, so that PackedTo() can copy it to a GPU with a single
+  asynchronous transfer.  `src` may be on any device.
+ */
+Ragged<Any> PinMemory(Ragged<Any> &src);
+template <typename T>
+Ragged<T> PinMemory(Ragged<T> &src) {
+  return PinMemory(src.Generic()).template Specialize<T>();
+}
+
+/*
+  Copy `src` to `ctx` with one transfer: the arrays of `src` are copied
+  into one region on `ctx` (which the returned arrays share).  If `src` is
+  on CPU and `ctx` is a CUDA context, the copy is queued on the stream of
+  `ctx` and this returns without waiting for it; the arrays are first
+  packed into a pinned buffer unless `src` came from PinMemory().  Other
+  copies are done as by src.To(ctx).  Returns `src` if it is already on
+  `ctx`.
+ */
+Ragged<Any> PackedTo(Ragged<Any> &src, ContextPtr ctx);
+template <typename T>
+Ragged<T> PackedTo(Ragged<T> &src, ContextPtr ctx) {
+  return PackedTo(src.Generic(), ctx).template Specialize<T>();
+}
 
 }  // namespace k2
 
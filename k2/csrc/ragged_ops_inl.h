@@ -36,17 +36,83 @@
 
 #include "k2/csrc/array_ops.h"
 #ifdef K2_WITH_CUDA
-#include "k2/csrc/cudpp/cudpp.h"
+#include "k2/csrc/segmented_scan.h"
 #endif
 #include "k2/csrc/macros.h"
 #include "k2/csrc/moderngpu_allocator.h"
+#include "k2/csrc/shape_capture.h"
+#include "k2/csrc/simd_reduce.h"
 
 namespace k2 {
 
+namespace internal {
+// On CPU, SegmentedReduce() and ArgMaxPerSublist() use the SIMD kernels in
+// simd_reduce.h for float and double; the templates below return false for
+// the other cases, which use the plain loops.
+template <typename T, typename Op>
+bool SegmentedReduceSimd(const Op &, const int32_t *, int32_t, const T *, T,
+                         T *) {
+  return false;
+}
+
+inline bool SegmentedReduceSimd(const MaxOp<float> &,
+                                const int32_t *row_splits, int32_t num_rows,
+                                const float *values, float initial_value,
+                                float *dst) {
+  MaxPerSublistCpu(row_splits, num_rows, values, initial_value, dst);
+  return true;
+}
+
+inline bool SegmentedReduceSimd(const MaxOp<double> &,
+                                const int32_t *row_splits, int32_t num_rows,
+                                const double *values, double initial_value,
+                                double *dst) {
+  MaxPerSublistCpu(row_splits, num_rows, values, initial_value, dst);
+  return true;
+}
+
+inline bool SegmentedReduceSimd(const LogAdd<float> &,
+                                const int32_t *row_splits, int32_t num_rows,
+                                const float *values, float initial_value,
+                                float *dst) {
+  LogSumPerSublistCpu(row_splits, num_rows, values, initial_value, dst);
+  return true;
+}
+
+inline bool SegmentedReduceSimd(const LogAdd<double> &,
+                                const int32_t *row_splits, int32_t num_rows,
+                                const double *values, double initial_value,
+                                double *dst) {
+  LogSumPerSublistCpu(row_splits, num_rows, values, initial_value, dst);
+  return true;
+}
+
+template <typename T>
+bool ArgMaxPerSublistSimd(const int32_t *, int32_t, const T *, T,
+                          int32_t *) {
+  return false;
+}
+
+inline bool ArgMaxPerSublistSimd(const int32_t *row_splits, int32_t num_rows,
+                                 const float *values, float initial_value,
+                                 int32_t *dst) {
+  ArgMaxPerSublistCpu(row_splits, num_rows, values, initial_value, dst);
+  return true;
+}
+
+inline bool ArgMaxPerSublistSimd(const int32_t *row_splits, int32_t num_rows,
+                                 const double *values, double initial_value,
+                                 int32_t *dst) {
+  ArgMaxPerSublistCpu(row_splits, num_rows, values, initial_value, dst);
+  return true;
+}
+}  // namespace internal
+
 template <typename T, typename Op>
 void SegmentedReduce(const Ragged<T> &src, T initial_value, Array1<T> *dst) {
-  NVTX_RANGE(K2_FUNC);
+  NVTX_RANGE_PAYLOAD(K2_FUNC, kRagged, src.NumElements());
   K2_CHECK_GE(src.NumAxes(), 2);
+  CaptureShape("SegmentedReduce", src.shape);
   K2_CHECK(IsCompatible(src.shape, *dst));
 
   int32_t last_axis = src.NumAxes() - 1;
@@ -61,6 +127,9 @@ void SegmentedReduce(const Ragged<T> &src, T initial_value, Array1<T> *dst) {
   Op op;
 
   if (c->GetDeviceType() == kCpu) {
+    if (internal::SegmentedReduceSimd(op, row_splits, num_rows, values_data,
+                                      initial_value, output_data))
+      return;
     int32_t j = row_splits[0];
     for (int32_t i = 0; i < num_rows; ++i) {
       T val = initial_value;
@@ -100,8 +169,102 @@ Ragged<T> NormalizePerSublist(Ragged<T> &src, bool use_log) {
 
   ContextPtr &context = src.Context();
   int32_t num_axes = src.NumAxes();
-  Array1<T> values(context, src.TotSize(num_axes - 2));
+  const Array1<int32_t> &row_splits_array = src.RowSplits(num_axes - 1);
+  int32_t num_rows = row_splits_array.Dim() - 1;
+  const int32_t *row_splits = row_splits_array.Data();
+
+  Array1<T> ans_values(context, src.values.Dim());
+  Ragged<T> ans(src.shape, ans_values);
+
+  T *ans_data = ans.values.Data();
+  const T *src_data = src.values.Data();
+
+  if (context->GetDeviceType() == kCpu) {
+    // Normalize each sublist right after reducing it, while it is still in
+    // cache.
+    for (int32_t i = 0; i < num_rows; ++i) {
+      int32_t begin = row_splits[i], end = row_splits[i + 1];
+      if (use_log) {
+        T normalizer;
+        LogSumPerSublistCpu(row_splits + i, 1, src_data, negative_infinity,
+                            &normalizer);
+        for (int32_t j = begin; j < end; ++j)
+          ans_data[j] = src_data[j] - normalizer;
+      } else {
+        T normalizer = 0;
+        for (int32_t j = begin; j < end; ++j) normalizer += src_data[j];
+        normalizer += eps;
+        for (int32_t j = begin; j < end; ++j)
+          ans_data[j] = src_data[j] / normalizer;
+      }
+    }
+    return ans;
+  }
+
+#ifdef K2_WITH_CUDA
+  // Unless the sublists are long (when there are few of them, and a warp
+  // each would leave most of the GPU idle), one warp reduces each sublist,
+  // with an online log-sum-exp (a running max, by which the partial sum is
+  // rescaled when it grows) if use_log, and then writes it normalized, so
+  // the elements are read from memory once and there is one kernel.
+  const int32_t kMaxAvgSublistSize = 2048;
+  if (src.values.Dim() <= kMaxAvgSublistSize * static_cast<int64_t>(num_rows)) {
+    namespace cg = cooperative_groups;
+    const unsigned int thread_group_size = 32;
+    auto lambda_normalize = [=] __device__(
+        cg::thread_block_tile<thread_group_size> g,
+        int32_t *,  // unused shared data
+        int32_t row) -> void {
+      int32_t begin = row_splits[row], end = row_splits[row + 1];
+      T normalizer;
+      if (use_log) {
+        // Invariant: sum == sum of exp(x - max) over the elements seen.
+        T max = negative_infinity, sum = 0;
+        for (int32_t j = begin + g.thread_rank(); j < end;
+             j += thread_group_size) {
+          T x = src_data[j];
+          if (x > max) {
+            sum = sum * exp(max - x) + 1;
+            max = x;
+          } else if (x != negative_infinity) {
+            sum += exp(x - max);
+          }
+        }
+        for (int32_t offset = thread_group_size / 2; offset > 0;
+             offset /= 2) {
+          T other_max = g.shfl_xor(max, offset),
+            other_sum = g.shfl_xor(sum, offset);
+          T new_max = (other_max > max ? other_max : max);
+          if (new_max != negative_infinity)
+            sum = sum * exp(max - new_max) + other_sum * exp(other_max -
+                                                             new_max);
+          max = new_max;
+        }
+        // max is -inf if all the elements are -inf (then the result is
+        // NaN, as before), and +inf if one of them is +inf.
+        normalizer = (isinf(max) ? max : max + log(sum));
+      } else {
+        T sum = 0;
+        for (int32_t j = begin + g.thread_rank(); j < end;
+             j += thread_group_size)
+          sum += src_data[j];
+        for (int32_t offset = thread_group_size / 2; offset > 0;
+             offset /= 2)
+          sum += g.shfl_xor(sum, offset);
+        normalizer = sum + eps;
+      }
+      for (int32_t j = begin + g.thread_rank(); j < end;
+           j += thread_group_size)
+        ans_data[j] = (use_log ? src_data[j] - normalizer
+                               : src_data[j] / normalizer);
+    };
+    EvalGroupDevice<thread_group_size, int32_t>(context, num_rows,
+                                                lambda_normalize);
+    return ans;
+  }
+#endif
 
+  Array1<T> values(context, num_rows);
   if (use_log) {
     LogSumPerSublist<T>(src, negative_infinity, &values);
   } else {
@@ -111,12 +274,6 @@ Ragged<T> NormalizePerSublist(Ragged<T> &src, bool use_log) {
   const T *values_data = values.Data();
   const int32_t *row_ids_data = src.RowIds(num_axes - 1).Data();
 
-  Array1<T> ans_values(context, src.values.Dim());
-  Ragged<T> ans(src.shape, ans_values);
-
-  T *ans_data = ans.values.Data();
-  const T *src_data = src.values.Data();
-
   if (use_log) {
     K2_EVAL(
         context, ans_values.Dim(), lambda_do_normalization, (int32_t i)->void {
@@ -254,7 +411,54 @@ Ragged<T> Cat(int32_t axis, int32_t num_srcs, Ragged<T> *src,
   K2_CHECK_GT(num_srcs, 0);
   std::vector<Ragged<T> *> temp(num_srcs);
   for (int32_t i = 0; i != num_srcs; ++i) temp[i] = src + i;
-  return Cat(axis, num_srcs, temp.data());
+  return Cat(axis, num_srcs, temp.data(), merge_map);
+}
+
+namespace internal {
+// Gathers the values of `src` into the order given by `merge_map`, which
+// is as returned by Stack() or Cat() for src.shape.
+template <typename T>
+Array1<T> MergeValuesWithMap(Array1OfRagged<T> &src,
+                             const Array1<uint32_t> &merge_map) {
+  NVTX_RANGE(K2_FUNC);
+  ContextPtr &c = src.Context();
+  uint32_t num_srcs = static_cast<uint32_t>(src.NumSrcs());
+  int32_t dim = merge_map.Dim();
+  Array1<T> ans(c, dim);
+  const uint32_t *merge_map_data = merge_map.Data();
+  T *const *src_values_data = src.values.Data();
+  T *ans_data = ans.Data();
+  K2_EVAL(
+      c, dim, lambda_merge_values, (int32_t i)->void {
+        uint32_t m = merge_map_data[i];
+        ans_data[i] = src_values_data[m % num_srcs][m / num_srcs];
+      });
+  return ans;
+}
+}  // namespace internal
+
+template <typename T>
+Ragged<T> Stack(Array1OfRagged<T> &src,
+                Array1<uint32_t> *merge_map /* = nullptr */) {
+  NVTX_RANGE(K2_FUNC);
+  Array1<uint32_t> merge_map_temp;
+  Array1<uint32_t> *merge_map_ptr =
+      (merge_map != nullptr ? merge_map : &merge_map_temp);
+  RaggedShape ans_shape = Stack(src.shape, merge_map_ptr);
+  return Ragged<T>(ans_shape,
+                   internal::MergeValuesWithMap(src, *merge_map_ptr));
+}
+
+template <typename T>
+Ragged<T> Cat(Array1OfRagged<T> &src,
+              Array1<uint32_t> *merge_map /* = nullptr */) {
+  NVTX_RANGE(K2_FUNC);
+  Array1<uint32_t> merge_map_temp;
+  Array1<uint32_t> *merge_map_ptr =
+      (merge_map != nullptr ? merge_map : &merge_map_temp);
+  RaggedShape ans_shape = Cat(src.shape, merge_map_ptr);
+  return Ragged<T>(ans_shape,
+                   internal::MergeValuesWithMap(src, *merge_map_ptr));
 }
 
 template <typename T>
@@ -494,19 +698,97 @@ std::istream &operator>>(std::istream &is, Ragged<T> &r) {
     // row_splits is [ 0 ].
     row_splits.push_back(std::vector<int32_t>(1, 0));
   }
-  std::vector<RaggedShapeLayer> axes(row_splits.size());
+  RaggedShapeLayers axes(row_splits.size());
   for (size_t i = 0; i < row_splits.size(); i++) {
     axes[i].row_splits = Array1<int32_t>(GetCpuContext(), row_splits[i]);
     axes[i].cached_tot_size = -1;
   }
-  r.shape = RaggedShape(axes);
+  r.shape = RaggedShape(std::move(axes));
   r.values = Array1<T>(GetCpuContext(), elems);
   K2_CHECK(r.values.Dim() == r.shape.NumElements());
   return is;
 }
 
+namespace internal {
+
+/* Fused Index(src, indexes, remove_axis) for `src` with 2 axes and `indexes`
+   with any number of axes: one ExclusiveSum() gives the offsets of the
+   sublists of `src` in the answer, and the values are gathered in one pass.
+   The shape of the answer is that of `indexes` with its last layer replaced
+   (if remove_axis) or followed (otherwise) by a layer made from the offsets,
+   so there is no ComposeRaggedShapes() or RemoveAxis().  An index of -1 is
+   an empty sublist.
+ */
+template <typename T>
+Ragged<T> IndexRagged2(Ragged<T> &src, Ragged<int32_t> &indexes,
+                       bool remove_axis) {
+  NVTX_RANGE(K2_FUNC);
+  K2_CHECK_EQ(src.NumAxes(), 2);
+  K2_CHECK_GE(indexes.NumAxes(), 2);
+  ContextPtr &c = src.Context();
+  K2_CHECK(c->IsCompatible(*indexes.Context()));
+  int32_t num_indexes = indexes.NumElements(),
+          last_axis = indexes.NumAxes() - 1;
+  const int32_t *src_row_splits_data = src.RowSplits(1).Data(),
+                *indexes_data = indexes.values.Data();
+  // offsets[i] is, after the ExclusiveSum(), the offset in ans.values of the
+  // sublist of `src` that indexes.values[i] refers to.
+  Array1<int32_t> offsets(c, num_indexes + 1);
+  int32_t *offsets_data = offsets.Data();
+  K2_EVAL(
+      c, num_indexes, lambda_set_sizes, (int32_t i)->void {
+        int32_t index = indexes_data[i];
+        offsets_data[i] = (index < 0 ? 0
+                                     : src_row_splits_data[index + 1] -
+                                           src_row_splits_data[index]);
+      });
+  ExclusiveSum(offsets, &offsets);
+  int32_t num_values = offsets.Back();
+  // Maps from each element of ans.values to the index it came from; if
+  // remove_axis, this is overwritten with the row_ids of the last axis of
+  // the answer below.
+  Array1<int32_t> value_row_ids(c, num_values);
+  RowSplitsToRowIds(offsets, &value_row_ids);
+
+  Array1<T> ans_values(c, num_values);
+  const int32_t *indexes_row_ids_data = indexes.RowIds(last_axis).Data();
+  const T *src_values_data = src.values.Data();
+  T *ans_values_data = ans_values.Data();
+  int32_t *value_row_ids_data = value_row_ids.Data();
+  K2_EVAL(
+      c, num_values, lambda_set_values, (int32_t j)->void {
+        int32_t i = value_row_ids_data[j], index = indexes_data[i];
+        ans_values_data[j] =
+            src_values_data[src_row_splits_data[index] + j - offsets_data[i]];
+        if (remove_axis) value_row_ids_data[j] = indexes_row_ids_data[i];
+      });
+
+  RaggedShapeLayers layers = indexes.shape.Layers();
+  RaggedShapeLayer layer;
+  layer.row_ids = value_row_ids;
+  layer.cached_tot_size = num_values;
+  if (remove_axis) {
+    layer.row_splits = offsets[indexes.RowSplits(last_axis)];
+    layers.back() = std::move(layer);
+  } else {
+    layer.row_splits = offsets;
+    layers.push_back(std::move(layer));
+  }
+  return Ragged<T>(RaggedShape(std::move(layers)), ans_values);
+}
+
+}  // namespace internal
+
+template <typename T>
+Ragged<T> IndexAndRemoveAxis2(Ragged<T> &src, Ragged<int32_t> &indexes) {
+  K2_CHECK_EQ(indexes.NumAxes(), 2);
+  return internal::IndexRagged2(src, indexes, true);
+}
+
 template <typename T>
 Ragged<T> Index(Ragged<T> &src, Ragged<int32_t> &indexes, bool remove_axis) {
+  if (src.NumAxes() == 2)
+    return internal::IndexRagged2(src, indexes, remove_axis);
   Ragged<T> r = Index(src, 0, indexes.values);
   RaggedShape s = ComposeRaggedShapes(indexes.shape, r.shape);
   Ragged<T> ans(s, r.values);
@@ -608,6 +890,9 @@ void ArgMaxPerSublist(Ragged<T> &src, T initial_value, Array1<int32_t> *dst) {
   int32_t *output_data = dst->Data();
 
   if (c->GetDeviceType() == kCpu) {
+    if (internal::ArgMaxPerSublistSimd(row_splits, num_rows, values_data,
+                                       initial_value, output_data))
+      return;
     int32_t j = row_splits[0];
     for (int32_t i = 0; i < num_rows; ++i) {
       T val = initial_value;
@@ -679,6 +964,113 @@ void ArgMaxPerSublist(Ragged<T> &src, T initial_value, Array1<int32_t> *dst) {
   }
 }
 
+namespace kth_internal {
+// Maps values to unsigned keys with the same order; see FloatToOrderedUint().
+template <typename T>
+struct OrderedKey;
+
+template <>
+struct OrderedKey<float> {
+  static __host__ __device__ __forceinline__ uint64_t ToKey(float f) {
+    return FloatToOrderedUint(f);
+  }
+  static __host__ __device__ __forceinline__ float FromKey(uint64_t u) {
+    return OrderedUintToFloat(static_cast<uint32_t>(u));
+  }
+};
+
+template <>
+struct OrderedKey<double> {
+  static __host__ __device__ __forceinline__ uint64_t ToKey(double d) {
+    return DoubleToOrderedUint(d);
+  }
+  static __host__ __device__ __forceinline__ double FromKey(uint64_t u) {
+    return OrderedUintToDouble(u);
+  }
+};
+}  // namespace kth_internal
+
+template <typename T>
+void KthLargestPerSublist(Ragged<T> &src, int32_t k, T default_value,
+                          Array1<T> *kth_values,
+                          Array1<int32_t> *num_greater /*= nullptr*/) {
+  NVTX_RANGE(K2_FUNC);
+  K2_STATIC_ASSERT(
+      (std::is_same<float, T>::value || std::is_same<double, T>::value));
+  using Key = kth_internal::OrderedKey<T>;
+  K2_CHECK_GE(src.NumAxes(), 2);
+  K2_CHECK_GE(k, 1);
+  K2_CHECK(IsCompatible(src.shape, *kth_values));
+
+  int32_t last_axis = src.NumAxes() - 1;
+  int32_t num_rows = src.TotSize(last_axis - 1),
+          num_elems = src.NumElements();
+  K2_CHECK_EQ(kth_values->Dim(), num_rows);
+  ContextPtr &c = src.Context();
+  const int32_t *row_splits_data = src.RowSplits(last_axis).Data(),
+                *row_ids_data = src.RowIds(last_axis).Data();
+  const T *values_data = src.values.Data();
+
+  // prefix[i] contains the bits of the key of the k-th largest element of
+  // row i that have been determined so far; remaining[i] is the rank of that
+  // element among the elements of row i whose keys match the prefix, or 0
+  // for rows with fewer than k elements, which we don't process.
+  Array1<uint64_t> prefix(c, num_rows, 0);
+  Array1<int32_t> remaining(c, num_rows), greater(c, num_rows);
+  uint64_t *prefix_data = prefix.Data();
+  int32_t *remaining_data = remaining.Data(), *greater_data = greater.Data();
+  K2_EVAL(
+      c, num_rows, lambda_init, (int32_t i)->void {
+        int32_t size = row_splits_data[i + 1] - row_splits_data[i];
+        remaining_data[i] = (size >= k ? k : 0);
+        greater_data[i] = (size >= k ? 0 : size);
+      });
+
+  constexpr int32_t kNumBins = 256;
+  Array1<int32_t> counts(c, num_rows * kNumBins);
+  int32_t *counts_data = counts.Data();
+  for (int32_t shift = 8 * (sizeof(T) - 1); shift >= 0; shift -= 8) {
+    // Only elements whose bits above `shift + 8` match the prefix are
+    // counted.
+    uint64_t high_mask =
+        (shift + 8 == 64 ? 0 : ~((uint64_t(1) << (shift + 8)) - 1));
+    counts = 0;
+    K2_EVAL(
+        c, num_elems, lambda_count, (int32_t idx01)->void {
+          int32_t i = row_ids_data[idx01];
+          if (remaining_data[i] == 0) return;
+          uint64_t key = Key::ToKey(values_data[idx01]);
+          if ((key & high_mask) != prefix_data[i]) return;
+          AtomicAdd(counts_data + i * kNumBins + ((key >> shift) & 255), 1);
+        });
+    // Find the bin that contains the element of rank `remaining`, counting
+    // down from the largest bin.
+    K2_EVAL(
+        c, num_rows, lambda_select_bin, (int32_t i)->void {
+          int32_t r = remaining_data[i];
+          if (r == 0) return;
+          const int32_t *this_counts = counts_data + i * kNumBins;
+          int32_t bin = kNumBins - 1, above = 0;
+          for (; bin > 0; --bin) {
+            if (above + this_counts[bin] >= r) break;
+            above += this_counts[bin];
+          }
+          prefix_data[i] |= static_cast<uint64_t>(bin) << shift;
+          remaining_data[i] = r - above;
+          greater_data[i] += above;
+        });
+  }
+
+  T *kth_values_data = kth_values->Data();
+  K2_EVAL(
+      c, num_rows, lambda_set_output, (int32_t i)->void {
+        kth_values_data[i] = (remaining_data[i] == 0
+                                  ? default_value
+                                  : Key::FromKey(prefix_data[i]));
+      });
+  if (num_greater != nullptr) *num_greater = greater;
+}
+
 template <typename T>
 void SegmentedExclusiveSum(Ragged<T> &src, Array1<T> *dst) {
   NVTX_RANGE(K2_FUNC);
@@ -690,39 +1082,8 @@ void SegmentedExclusiveSum(Ragged<T> &src, Array1<T> *dst) {
   const int32_t *row_ids_data = src.RowIds(src.NumAxes() - 1).Data();
   T *dst_data = dst->Data();
   if (c->GetDeviceType() == kCuda) {
-    // there's roundoff problem for float type with the below implementation in
-    // else branch.
-    if (std::is_same<float, T>::value || std::is_same<double, T>::value) {
-      // flags is similar to `tails` (see concepts in k2/csrc/utils)
-      // But it indicates `heads` here. The very first segment always
-      // starts at zero, so flags[0] is always 0.
-      Array1<uint32_t> flags(c, dim);
-      uint32_t *flags_data = flags.Data();
-      K2_EVAL(
-          c, dim, set_flags, (int32_t idx01)->void {
-            int32_t idx0 = row_ids_data[idx01];
-            int32_t idx0x = row_splits_data[idx0];
-            int32_t idx0x_next = row_splits_data[idx0 + 1];
-            if (idx0x < idx0x_next) {
-              if (idx01 == idx0x)
-                flags_data[idx01] = idx01 == 0 ? 0 : 1;
-              else
-                flags_data[idx01] = 0;
-            }
-          });
-      SegmentedExclusiveSum(c, src.values.Data(), dim, flags_data, dst->Data());
-    } else {
-      Array1<T> exclusive_sum(c, dim);
-      ExclusiveSum(src.values, &exclusive_sum);
-      const T *exclusive_sum_data = exclusive_sum.Data();
-      K2_EVAL(
-          c, dim, set_ans_values, (int32_t idx01)->void {
-            int32_t idx0 = row_ids_data[idx01];
-            int32_t idx0x = row_splits_data[idx0];
-            dst_data[idx01] =
-                exclusive_sum_data[idx01] - exclusive_sum_data[idx0x];
-          });
-    }
+    SegmentedExclusiveSum(c, src.values.Data(), dim, row_splits_data,
+                          row_ids_data, dst_data);
   } else {
     // Though the above code for Cuda would be working for cpu as well, we still
     // add an implementation for cpu here as it only needs one iteration
@@ -762,9 +1123,24 @@ Ragged<T> CreateRagged2(const std::vector<std::vector<T>> &vecs) {
 }
 
 template <typename T>
-Array2<T> PadRagged(Ragged<T> &src, const std::string &mode, T padding_value) {
+Array2<T> PadRagged(Ragged<T> &src, const std::string &mode, T padding_value,
+                    int32_t max_len /*= -1*/) {
+  NVTX_RANGE(K2_FUNC);
+  K2_CHECK_EQ(src.NumAxes(), 2);
+  if (max_len < 0) max_len = src.shape.MaxSize(1);
+  Array2<T> res(src.Context(), src.Dim0(), max_len);
+  PadRagged(src, mode, padding_value, &res);
+  return res;
+}
+
+template <typename T>
+void PadRagged(Ragged<T> &src, const std::string &mode, T padding_value,
+               Array2<T> *dest) {
   NVTX_RANGE(K2_FUNC);
   K2_CHECK_EQ(src.NumAxes(), 2);
+  K2_CHECK_NE(dest, nullptr);
+  K2_CHECK_EQ(dest->Dim0(), src.Dim0());
+  K2_CHECK(IsCompatible(src, *dest));
 
   bool is_constant = false;
   if (mode == "constant") {
@@ -777,43 +1153,23 @@ Array2<T> PadRagged(Ragged<T> &src, const std::string &mode, T padding_value) {
   }
 
   ContextPtr &c = src.Context();
-  int32_t row_num = src.Dim0(),
-          col_num = src.shape.MaxSize(1);
-  Array2<T> res(c, row_num, col_num);
-  auto res_acc = res.Accessor();
+  auto dest_acc = dest->Accessor();
   const T *src_values_data = src.values.Data();
   const int32_t *src_row_splits1_data = src.RowSplits(1).Data();
-  if (is_constant) {
-    K2_EVAL2(
-        c, res.Dim0(), res.Dim1(), lambda, (int32_t i, int32_t j)->void {
-          int32_t idx0x = src_row_splits1_data[i],
-                  idx0x_next = src_row_splits1_data[i + 1],
-                  len = idx0x_next - idx0x;
-          if (j >= len)
-            res_acc(i, j) = padding_value;
-          else
-            res_acc(i, j) = src_values_data[idx0x + j];
-        });
-  } else {
-    K2_EVAL2(
-        c, res.Dim0(), res.Dim1(), lambda, (int32_t i, int32_t j)->void {
-          int32_t idx0x = src_row_splits1_data[i],
-                  idx0x_next = src_row_splits1_data[i + 1],
-                  len = idx0x_next - idx0x;
-
-          if (len == 0) {
-            res_acc(i, j) = padding_value;
-            return;
-          }
-
-          if (j >= len)
-            // replicate the last element in this list
-            res_acc(i, j) = src_values_data[idx0x_next - 1];
-          else
-            res_acc(i, j) = src_values_data[idx0x + j];
-        });
-  }
-  return res;
+  // One kernel for both modes; elements of rows longer than dest->Dim1()
+  // are dropped.
+  K2_EVAL2(
+      c, dest->Dim0(), dest->Dim1(), lambda_pad, (int32_t i, int32_t j)->void {
+        int32_t idx0x = src_row_splits1_data[i],
+                idx0x_next = src_row_splits1_data[i + 1],
+                len = idx0x_next - idx0x;
+        if (j < len)
+          dest_acc(i, j) = src_values_data[idx0x + j];
+        else if (is_constant || len == 0)
+          dest_acc(i, j) = padding_value;
+        else  // replicate the last element in this list
+          dest_acc(i, j) = src_values_data[idx0x_next - 1];
+      });
 }
 
 /* Prune a three axes ragged tensor on axis1
@@ -840,36 +1196,51 @@ Renumbering PruneRaggedAxis1(Ragged<T> &src, T beam,
   bool prune_with_max_elems =
       max_elems > 0 && max_elems < total_elements;
 
-  Array1<int32_t> order_map;
-  const int32_t *order_map_data;
-  if (prune_with_max_elems) {
-    Ragged<T> sorted_sub_max = ragged_sub_max.Clone();
-    order_map = Array1<int32_t>(c, total_elements);
-    SortSublists<T, GreaterThan<T>>(&sorted_sub_max, &order_map);
-    order_map_data = order_map.Data();
-  }
-
   char *keep_data = renumbering.Keep().Data();
   const T *sub_max_data = sub_max.Data(),
-          *best_scores_data = best_scores.Data(),
-          *src_data = src.values.Data();
+          *best_scores_data = best_scores.Data();
   const int32_t *row_ids1_data = src.RowIds(1).Data(),
                 *row_splits1_data = src.RowSplits(1).Data();
-  // prune_with_max_elems means we have sorted the sub-max ragged tensor
   if (prune_with_max_elems) {
-    K2_EVAL(c, total_elements, lambda_set_keep_sorted, (int32_t idx01) {
-                // idx01 is the index after sorting
-        int32_t original_idx01 = order_map_data[idx01],
-                // SortSublists wouldn't change idx0 and idx0x
-                idx0 = row_ids1_data[original_idx01],
-                idx0x = row_splits1_data[idx0],
-                // idx1 is the index after sorting
-                idx1 = idx01 - idx0x;
-        bool pruned_by_max_elems = idx1 >= max_elems,
-             pruned_by_beam =
-                 sub_max_data[original_idx01] < best_scores_data[idx0] - beam;
-        keep_data[original_idx01] =
-            !(pruned_by_max_elems || pruned_by_beam);
+    // We keep the sub-lists that are better than the max_elems-th best one
+    // in their row, plus as many of those equal to it as will fit, which
+    // are the first ones (so we keep the same ones as a stable sort would).
+    Array1<T> kth_best(c, src.TotSize(0));
+    Array1<int32_t> num_greater;
+    KthLargestPerSublist(ragged_sub_max, max_elems, negative_infinity,
+                         &kth_best, &num_greater);
+    const T *kth_best_data = kth_best.Data();
+    const int32_t *num_greater_data = num_greater.Data();
+
+    Array1<int32_t> num_ties_before(c, total_elements + 1);
+    int32_t *num_ties_before_data = num_ties_before.Data();
+    K2_EVAL(c, total_elements, lambda_set_is_tie, (int32_t idx01) {
+        int32_t idx0 = row_ids1_data[idx01];
+        num_ties_before_data[idx01] =
+            (row_splits1_data[idx0 + 1] - row_splits1_data[idx0] >
+                 max_elems &&
+             sub_max_data[idx01] == kth_best_data[idx0]);
+    });
+    ExclusiveSum(num_ties_before, &num_ties_before);
+
+    K2_EVAL(c, total_elements, lambda_set_keep_kth, (int32_t idx01) {
+        int32_t idx0 = row_ids1_data[idx01],
+                idx0x = row_splits1_data[idx0];
+        T score = sub_max_data[idx01];
+        bool pruned_by_max_elems;
+        if (row_splits1_data[idx0 + 1] - idx0x <= max_elems ||
+            score > kth_best_data[idx0]) {
+          pruned_by_max_elems = false;
+        } else if (score < kth_best_data[idx0]) {
+          pruned_by_max_elems = true;
+        } else {
+          int32_t tie_rank =
+              num_ties_before_data[idx01] - num_ties_before_data[idx0x];
+          pruned_by_max_elems =
+              tie_rank >= max_elems - num_greater_data[idx0];
+        }
+        bool pruned_by_beam = score < best_scores_data[idx0] - beam;
+        keep_data[idx01] = !(pruned_by_max_elems || pruned_by_beam);
     });
   } else {
     K2_EVAL(c, total_elements, lambda_set_keep, (int32_t idx01) {
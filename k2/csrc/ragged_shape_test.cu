@@ -21,6 +21,7 @@
 
 #include <algorithm>
 #include <numeric>
+#include <stdexcept>
 #include <vector>
 
 #include "k2/csrc/context.h"
@@ -67,7 +68,7 @@ TEST(RaggedShapeTest, RaggedShape) {
                                                 12, 13, 15, 15, 16};
       const std::vector<int32_t> row_ids3 = {0, 0, 1, 2, 2, 3, 3, 3,
                                              4, 5, 5, 5, 6, 7, 7, 9};
-      std::vector<RaggedShapeLayer> axes;
+      RaggedShapeLayers axes;
       axes.emplace_back(
           RaggedShapeLayer{Array1<int32_t>(context, row_splits1),
                            Array1<int32_t>(context, row_ids1),
@@ -200,7 +201,7 @@ TEST(RaggedShapeTest, RaggedShape) {
                                                 12, 13, 15, 15, 16};
       Array1<int32_t> row_ids;  // invalid row_ids as it has no context,
                                 // shape.RowIds(axis) will create it.
-      std::vector<RaggedShapeLayer> axes;
+      RaggedShapeLayers axes;
       axes.emplace_back(
           RaggedShapeLayer{Array1<int32_t>(context, row_splits1), row_ids, -1});
       axes.emplace_back(
@@ -236,7 +237,7 @@ TEST(RaggedShapeTest, RaggedShape) {
                                                 12, 13, 15, 15, 16};
       Array1<int32_t> row_ids;  // invalid row_ids as it has no context,
                                 // shape.RowIds(axis) will create it.
-      std::vector<RaggedShapeLayer> axes;
+      RaggedShapeLayers axes;
       axes.emplace_back(
           RaggedShapeLayer{Array1<int32_t>(context, row_splits1), row_ids, -1});
       axes.emplace_back(
@@ -272,6 +273,41 @@ TEST(RaggedShapeTest, RaggedShape) {
 }
 
 
+TEST(RaggedShapeTest, ValidationLevel) {
+  // Only on CPU, since on GPU the errors would be reported asynchronously.
+  ContextPtr cpu = GetCpuContext();
+  internal::ValidationLevel saved_level = internal::GetValidationLevel();
+
+  // Non-monotonic row_splits: only detected by the full check.
+  RaggedShapeLayers bad_splits(1);
+  bad_splits[0].row_splits =
+      Array1<int32_t>(cpu, std::vector<int32_t>{0, 3, 2});
+  bad_splits[0].cached_tot_size = -1;
+
+  // row_ids.Dim() inconsistent with cached_tot_size: detected by both.
+  RaggedShapeLayers bad_dims(1);
+  bad_dims[0].row_splits =
+      Array1<int32_t>(cpu, std::vector<int32_t>{0, 1, 2});
+  bad_dims[0].row_ids = Array1<int32_t>(cpu, std::vector<int32_t>{0, 1});
+  bad_dims[0].cached_tot_size = 3;
+
+  bool check = true;
+  internal::SetValidationLevel(internal::ValidationLevel::kFull);
+  EXPECT_THROW(RaggedShape(bad_splits, check), std::runtime_error);
+  EXPECT_THROW(RaggedShape(bad_dims, check), std::runtime_error);
+
+  internal::SetValidationLevel(internal::ValidationLevel::kCheap);
+  EXPECT_NO_THROW(RaggedShape(bad_splits, check));
+  EXPECT_THROW(RaggedShape(bad_dims, check), std::runtime_error);
+
+  internal::SetValidationLevel(internal::ValidationLevel::kOff);
+  EXPECT_TRUE(internal::DisableChecks());
+  EXPECT_NO_THROW(RaggedShape(bad_splits, check));
+  EXPECT_NO_THROW(RaggedShape(bad_dims, check));
+
+  internal::SetValidationLevel(saved_level);
+}
+
 TEST(RaggedShapeTest, DecomposeRaggedShape) {
   ContextPtr cpu = GetCpuContext();  // will be used to copy data
   for (const ContextPtr &c : {GetCpuContext(), GetCudaContext()}) {
@@ -375,7 +411,7 @@ TEST(RaggedShapeTest, RaggedShapeIterator) {
                                             12, 13, 15, 15, 16};
   Array1<int32_t> row_ids;  // invalid row_ids as it has no context,
                             // shape.RowIds(axis) will create it.
-  std::vector<RaggedShapeLayer> axes;
+  RaggedShapeLayers axes;
   axes.emplace_back(
       RaggedShapeLayer{Array1<int32_t>(context, row_splits1), row_ids, -1});
   axes.emplace_back(
@@ -23,9 +23,12 @@
 #include <gtest/gtest.h>
 
 #include <algorithm>
+#include <cmath>
 #include <limits>
+#include <map>
 #include <numeric>
 #include <set>
+#include <type_traits>
 #include <utility>
 #include <vector>
 
@@ -288,7 +291,7 @@ class RaggedShapeOpsSuiteTest : public ::testing::Test {
                                               12, 13, 15, 15, 16};
     const std::vector<int32_t> row_ids3 = {0, 0, 1, 2, 2, 3, 3, 3,
                                            4, 5, 5, 5, 6, 7, 7, 9};
-    std::vector<RaggedShapeLayer> axes;
+    RaggedShapeLayers axes;
     axes.emplace_back(RaggedShapeLayer{Array1<int32_t>(context, row_splits1),
                                        Array1<int32_t>(context, row_ids1),
                                        static_cast<int32_t>(row_ids1.size())});
@@ -389,7 +392,7 @@ void TestMaxPerSubListTest() {
       RaggedShapeLayer shape_dim;
       shape_dim.row_splits = Array1<int32_t>(context, row_splits);
       shape_dim.cached_tot_size = 0;
-      std::vector<RaggedShapeLayer> axes = {shape_dim};
+      RaggedShapeLayers axes = {shape_dim};
       RaggedShape shape(axes, true);
       Array1<T> values(context, 0);
       Ragged<T> ragged(shape, values);
@@ -407,7 +410,7 @@ void TestMaxPerSubListTest() {
       RaggedShapeLayer shape_dim;
       shape_dim.row_splits = Array1<int32_t>(context, row_splits);
       shape_dim.cached_tot_size = row_splits.back();
-      std::vector<RaggedShapeLayer> axes = {shape_dim};
+      RaggedShapeLayers axes = {shape_dim};
       RaggedShape shape(axes, true);
       const std::vector<T> values_vec = {1, 3, 2, 8, 0, -1};
       Array1<T> values(context, values_vec);
@@ -440,7 +443,7 @@ void TestMaxPerSubListTest() {
         RaggedShapeLayer shape_dim;
         shape_dim.row_splits = row_splits.To(GetCudaContext());
         shape_dim.cached_tot_size = shape.NumElements();
-        std::vector<RaggedShapeLayer> axes = {shape_dim};
+        RaggedShapeLayers axes = {shape_dim};
         gpu_shape = RaggedShape(axes, true);
       }
 
@@ -567,6 +570,113 @@ TEST(RaggedShapeOpsTest, ArgMaxPerSubListTest) {
   TestArgMaxPerSubListTest<int32_t>();
 }
 
+template <typename T>
+void TestKthLargestPerSublist() {
+  ContextPtr cpu = GetCpuContext();
+  for (auto &context : {GetCpuContext(), GetCudaContext()}) {
+    {
+      Ragged<T> ragged(context, "[ [ 1 -3 3 2.5 ] [ ] [ -1 -1 -2 ] [ 7 ] ]");
+      Array1<T> kth_values(context, 4);
+      Array1<int32_t> num_greater;
+      KthLargestPerSublist(ragged, 2, T(-100), &kth_values, &num_greater);
+      CheckArrayData(kth_values, std::vector<T>{2.5, -100, -1, -100});
+      CheckArrayData(num_greater, std::vector<int32_t>{1, 0, 0, 1});
+      KthLargestPerSublist(ragged, 3, T(-100), &kth_values, &num_greater);
+      CheckArrayData(kth_values, std::vector<T>{1, -100, -2, -100});
+      CheckArrayData(num_greater, std::vector<int32_t>{2, 0, 2, 1});
+    }
+    for (int32_t i = 0; i != 10; ++i) {
+      // Values in a small range, so there are plenty of ties.
+      Ragged<int32_t> ragged_int =
+          RandomRagged<int32_t>(-50, 50, 2, 4, 0, 5000);
+      std::vector<T> values_vec(ragged_int.NumElements());
+      for (int32_t j = 0; j < ragged_int.NumElements(); ++j)
+        values_vec[j] = ragged_int.values[j] * T(0.25);
+      Ragged<T> ragged(ragged_int.shape.To(context),
+                       Array1<T>(context, values_vec));
+      int32_t last_axis = ragged.NumAxes() - 1,
+              num_rows = ragged.TotSize(last_axis - 1), k = RandInt(1, 10);
+      Array1<T> kth_values(context, num_rows);
+      Array1<int32_t> num_greater;
+      KthLargestPerSublist(ragged, k, T(1000), &kth_values, &num_greater);
+      kth_values = kth_values.To(cpu);
+      num_greater = num_greater.To(cpu);
+
+      Array1<int32_t> row_splits = ragged_int.RowSplits(last_axis);
+      for (int32_t row = 0; row < num_rows; ++row) {
+        std::vector<T> sorted(values_vec.begin() + row_splits[row],
+                              values_vec.begin() + row_splits[row + 1]);
+        std::sort(sorted.begin(), sorted.end(), std::greater<T>());
+        int32_t size = sorted.size();
+        if (size < k) {
+          EXPECT_EQ(kth_values[row], T(1000));
+          EXPECT_EQ(num_greater[row], size);
+        } else {
+          T kth = sorted[k - 1];
+          EXPECT_EQ(kth_values[row], kth);
+          EXPECT_EQ(num_greater[row],
+                    std::count_if(sorted.begin(), sorted.end(),
+                                  [kth](T v) { return v > kth; }));
+        }
+      }
+    }
+  }
+}
+
+TEST(RaggedShapeOpsTest, KthLargestPerSublist) {
+  TestKthLargestPerSublist<float>();
+  TestKthLargestPerSublist<double>();
+}
+
+template <typename T>
+void TestNormalizePerSublist() {
+  ContextPtr cpu = GetCpuContext();
+  T tolerance = std::is_same<T, float>::value ? 1e-4 : 1e-10;
+  for (auto &context : {GetCpuContext(), GetCudaContext()}) {
+    for (int32_t i = 0; i != 4; ++i) {
+      // The sublists are long enough to be reduced in several chunks on
+      // CPU and with several elements per thread on GPU.
+      RaggedShape shape = RandomRaggedShape(false, 2, 2, 0, 5000);
+      Ragged<T> src(shape,
+                    RandUniformArray1<T>(cpu, shape.NumElements(), -50, 5));
+      bool use_log = (i % 2 == 0);
+      if (!use_log) {
+        // The sums must not be close to zero.
+        T *values = src.values.Data();
+        for (int32_t j = 0; j < src.values.Dim(); ++j)
+          values[j] = std::exp(values[j] / 10);
+      }
+      Ragged<T> src_on_device = src.To(context);
+      Ragged<T> ans = NormalizePerSublist(src_on_device, use_log).To(cpu);
+
+      const int32_t *row_splits = src.RowSplits(1).Data();
+      const T *values = src.values.Data();
+      for (int32_t row = 0; row < src.Dim0(); ++row) {
+        int32_t begin = row_splits[row], end = row_splits[row + 1];
+        double normalizer = (use_log ? -std::numeric_limits<double>::infinity()
+                                     : 0);
+        for (int32_t j = begin; j < end; ++j) {
+          if (use_log)
+            normalizer = LogAdd<double>()(normalizer, values[j]);
+          else
+            normalizer += values[j];
+        }
+        for (int32_t j = begin; j < end; ++j) {
+          double expected =
+              (use_log ? values[j] - normalizer : values[j] / normalizer);
+          EXPECT_NEAR(ans.values[j], expected,
+                      tolerance * (1 + std::abs(expected)));
+        }
+      }
+    }
+  }
+}
+
+TEST(RaggedShapeOpsTest, NormalizePerSublist) {
+  TestNormalizePerSublist<float>();
+  TestNormalizePerSublist<double>();
+}
+
 template <typename T>
 void TestMinPerSubListTest() {
   ContextPtr cpu = GetCpuContext();  // will be used to copy data
@@ -626,7 +736,7 @@ void TestAndOrPerSubListTest() {
       RaggedShapeLayer shape_dim;
       shape_dim.row_splits = Array1<int32_t>(context, row_splits);
       shape_dim.cached_tot_size = row_splits.back();
-      std::vector<RaggedShapeLayer> axes = {shape_dim};
+      RaggedShapeLayers axes = {shape_dim};
       RaggedShape shape(axes, true);
       const std::vector<T> values_vec = {1, 3, 3, 6, 11, 0};
       Array1<T> values(context, values_vec);
@@ -649,7 +759,7 @@ void TestAndOrPerSubListTest() {
       RaggedShapeLayer shape_dim;
       shape_dim.row_splits = Array1<int32_t>(context, row_splits);
       shape_dim.cached_tot_size = row_splits.back();
-      std::vector<RaggedShapeLayer> axes = {shape_dim};
+      RaggedShapeLayers axes = {shape_dim};
       RaggedShape shape(axes, true);
       const std::vector<T> values_vec = {1, 3, 3, 4, 6, 0};
       Array1<T> values(context, values_vec);
@@ -680,8 +790,8 @@ void TestUnsqueeze(const RaggedShape &input_shape) {
       // axis = 0.
       RaggedShape shape = Unsqueeze(src_shape, 0);
       int32_t dim0 = src_shape.Dim0();
-      const std::vector<RaggedShapeLayer> &src_axes = src_shape.Layers();
-      const std::vector<RaggedShapeLayer> &dest_axes = shape.Layers();
+      const RaggedShapeLayers &src_axes = src_shape.Layers();
+      const RaggedShapeLayers &dest_axes = shape.Layers();
 
       {
         const Array1<int32_t> &row_splits0 = dest_axes[0].row_splits;
@@ -708,8 +818,8 @@ void TestUnsqueeze(const RaggedShape &input_shape) {
       int32_t axis = 1;
       RaggedShape shape = Unsqueeze(src_shape, axis);
       int32_t tot_size = shape.TotSize(axis);
-      const std::vector<RaggedShapeLayer> &src_axes = src_shape.Layers();
-      const std::vector<RaggedShapeLayer> &dest_axes = shape.Layers();
+      const RaggedShapeLayers &src_axes = src_shape.Layers();
+      const RaggedShapeLayers &dest_axes = shape.Layers();
 
       {
         for (int32_t i = 0; i < axis; ++i) {
@@ -776,8 +886,8 @@ void TestRemoveAxis(const RaggedShape &input_shape) {
       // axis = 0.
       int32_t axis = 0;
       RaggedShape shape = RemoveAxis(src_shape, axis);
-      const std::vector<RaggedShapeLayer> &src_axes = src_shape.Layers();
-      const std::vector<RaggedShapeLayer> &dest_axes = shape.Layers();
+      const RaggedShapeLayers &src_axes = src_shape.Layers();
+      const RaggedShapeLayers &dest_axes = shape.Layers();
       ASSERT_EQ(src_axes.size(), 3);
       ASSERT_EQ(dest_axes.size(), 2);
 
@@ -793,8 +903,8 @@ void TestRemoveAxis(const RaggedShape &input_shape) {
       // axis = 1
       int32_t axis = 1;
       RaggedShape shape = RemoveAxis(src_shape, axis);
-      const std::vector<RaggedShapeLayer> &src_axes = src_shape.Layers();
-      const std::vector<RaggedShapeLayer> &dest_axes = shape.Layers();
+      const RaggedShapeLayers &src_axes = src_shape.Layers();
+      const RaggedShapeLayers &dest_axes = shape.Layers();
       ASSERT_EQ(src_axes.size(), 3);
       ASSERT_EQ(dest_axes.size(), 2);
 
@@ -822,8 +932,8 @@ void TestRemoveAxis(const RaggedShape &input_shape) {
       // axis = 3
       int32_t axis = 3;  // the last axis
       RaggedShape shape = RemoveAxis(src_shape, axis);
-      const std::vector<RaggedShapeLayer> &src_axes = src_shape.Layers();
-      const std::vector<RaggedShapeLayer> &dest_axes = shape.Layers();
+      const RaggedShapeLayers &src_axes = src_shape.Layers();
+      const RaggedShapeLayers &dest_axes = shape.Layers();
       ASSERT_EQ(src_axes.size(), 3);
       ASSERT_EQ(dest_axes.size(), 2);
 
@@ -871,6 +981,34 @@ TEST(RaggedShapeOpsTest, TestGetOffsets) {
   }
 }
 
+TEST(RaggedShapeOpsTest, TestPopulateTotSizes) {
+  for (auto &context : {GetCpuContext(), GetCudaContext()}) {
+    int32_t num_shape = RandInt(1, 20);
+    std::vector<RaggedShape> shape_vec(num_shape), ref_vec(num_shape);
+    std::vector<RaggedShape *> shapes(num_shape);
+    for (int32_t j = 0; j != num_shape; ++j) {
+      ref_vec[j] = RandomRaggedShape(false, 2, 4, 0, 1000).To(context);
+      // Rebuild it from just the row_splits, so the tot-sizes are unknown.
+      RaggedShapeLayers layers = ref_vec[j].Layers();
+      for (auto &layer : layers) {
+        layer.row_ids = Array1<int32_t>();
+        layer.cached_tot_size = -1;
+      }
+      bool check = false;
+      shape_vec[j] = RaggedShape(layers, check);
+      shapes[j] = &shape_vec[j];
+    }
+    PopulateTotSizes(num_shape, shapes.data());
+    for (int32_t j = 0; j != num_shape; ++j) {
+      for (const auto &layer : shape_vec[j].Layers())
+        EXPECT_GE(layer.cached_tot_size, 0);
+      for (int32_t axis = 0; axis < ref_vec[j].NumAxes(); ++axis)
+        EXPECT_EQ(shape_vec[j].TotSize(axis), ref_vec[j].TotSize(axis));
+      EXPECT_TRUE(Equal(shape_vec[j], ref_vec[j]));
+    }
+  }
+}
+
 // returns a random ragged shape where the dims on axis 1 are all the same
 // (so: can be transposed).
 RaggedShape RandomRaggedShapeToTranspose(ContextPtr c) {
@@ -1258,6 +1396,30 @@ TEST_F(RaggedShapeOpsSuiteTest, TestShapeFromTotSize) {
   TestShapeFromTotSize(random_shape_);
 }
 
+TEST(RaggedShapeOpsTest, TestShapeFromSizes) {
+  for (auto &context : {GetCpuContext(), GetCudaContext()}) {
+    for (int32_t i = 0; i != 10; ++i) {
+      RaggedShape shape = RandomRaggedShape(true, 2, 5, 0, 2000).To(context);
+      std::vector<Array1<int32_t>> sizes;
+      for (int32_t axis = 1; axis < shape.NumAxes(); ++axis)
+        sizes.push_back(RowSplitsToSizes(shape.RowSplits(axis)));
+      RaggedShape result = RaggedShapeFromSizes(sizes);
+      ASSERT_EQ(result.NumAxes(), shape.NumAxes());
+      for (int32_t axis = 1; axis < shape.NumAxes(); ++axis) {
+        EXPECT_EQ(result.TotSize(axis), shape.TotSize(axis));
+        EXPECT_TRUE(Equal(result.RowSplits(axis), shape.RowSplits(axis)));
+        EXPECT_TRUE(Equal(result.RowIds(axis), shape.RowIds(axis)));
+      }
+    }
+    // Empty sublists, including at the start and end.
+    Array1<int32_t> sizes1(context, "[ 0 2 0 1 0 ]"),
+        sizes2(context, "[ 3 0 0 ]");
+    RaggedShape result = RaggedShapeFromSizes({sizes1, sizes2});
+    RaggedShape expected("[ [ ] [ [ x x x ] [ ] ] [ ] [ [ ] ] [ ] ]");
+    EXPECT_TRUE(Equal(result, expected));
+  }
+}
+
 template <typename T>
 void TestRagged() {
   ContextPtr cpu = GetCpuContext();  // will be used to copy data
@@ -1279,7 +1441,7 @@ void TestRagged() {
                                              4, 5, 5, 5, 6, 7, 7, 9};
       const std::vector<T> values_vec = {1, 2, 4, 3, 0, 7, 8, 9,
                                          6, 3, 5, 7, 2, 3, 4, 8};
-      std::vector<RaggedShapeLayer> axes;
+      RaggedShapeLayers axes;
       axes.emplace_back(
           RaggedShapeLayer{Array1<int32_t>(context, row_splits1),
                            Array1<int32_t>(context, row_ids1),
@@ -1868,6 +2030,29 @@ TEST(GetTransposeReordering, RandomFsaVecTest) {
   }
 }
 
+TEST(GetTransposeReordering, FewAndManyColumns) {
+  // Few columns, with many elements per column, and many more columns than
+  // elements, which use different algorithms on CPU.
+  for (int32_t num_cols : {3, 100000}) {
+    for (auto &context : {GetCpuContext(), GetCudaContext()}) {
+      RaggedShape shape = RandomRaggedShape(false, 2, 2, 1, 2000);
+      int32_t n = shape.NumElements();
+      Array1<int32_t> values = RandUniformArray1<int32_t>(
+          GetCpuContext(), n, 0, num_cols - 1);
+      std::vector<int32_t> expected(n);
+      std::iota(expected.begin(), expected.end(), 0);
+      const int32_t *values_data = values.Data();
+      std::stable_sort(expected.begin(), expected.end(),
+                       [values_data](int32_t a, int32_t b) {
+                         return values_data[a] < values_data[b];
+                       });
+      Ragged<int32_t> src(shape.To(context), values.To(context));
+      Array1<int32_t> order = GetTransposeReordering(src, num_cols);
+      CheckArrayData(order, expected);
+    }
+  }
+}
+
 TEST(ChangeSublistSize, TwoAxes) {
   for (auto &context : {GetCpuContext(), GetCudaContext()}) {
     Array1<int32_t> row_splits1(context, std::vector<int32_t>{0, 2, 5});
@@ -2722,6 +2907,43 @@ TEST(RaggedTest, IndexRaggedRagged) {
   }
 }
 
+TEST(RaggedTest, IndexAndRemoveAxis2) {
+  for (auto &c : {GetCpuContext(), GetCudaContext()}) {
+    Ragged<int32_t> s =
+        Ragged<int32_t>(" [ [ 10 10 ] [ 11 ] [ ] [ 13 ] [ 14 14] ]").To(c);
+    Ragged<int32_t> r =
+        Ragged<int32_t>(" [ [ 4 -1 0 ] [ ] [ -1 ] [ 2 1 3 ] ]").To(c);
+    Ragged<int32_t> expected =
+        Ragged<int32_t>(" [ [ 14 14 10 10 ] [ ] [ ] [ 11 13 ] ]").To(c);
+    Ragged<int32_t> ans = IndexAndRemoveAxis2(s, r);
+    EXPECT_TRUE(Equal(ans, expected));
+    EXPECT_TRUE(Equal(ans.RowIds(1), expected.RowIds(1)));
+
+    for (int32_t i = 0; i < 5; i++) {
+      Ragged<int32_t> src = RandomRagged<int32_t>(0, 100, 2, 2, 1, 200).To(c);
+      // Indexes with 2 or 3 axes, e.g. [utt][path][arc] for n-best paths.
+      RaggedShape indexes_shape = RandomRaggedShape(false, 2, 3, 0, 200);
+      Ragged<int32_t> indexes(
+          indexes_shape.To(c),
+          RandUniformArray1<int32_t>(c, indexes_shape.NumElements(), -1,
+                                     src.Dim0() - 1));
+      // The unfused version, as for `src` with more than 2 axes.
+      Ragged<int32_t> r = Index(src, 0, indexes.values),
+                      unfused(ComposeRaggedShapes(indexes.shape, r.shape),
+                              r.values);
+      Ragged<int32_t> ans = Index(src, indexes, false);
+      EXPECT_TRUE(Equal(ans, unfused));
+      EXPECT_TRUE(Equal(ans.RowIds(ans.NumAxes() - 1),
+                        unfused.RowIds(unfused.NumAxes() - 1)));
+      Ragged<int32_t> ref = RemoveAxis(unfused, unfused.NumAxes() - 2);
+      ans = Index(src, indexes, true);
+      EXPECT_TRUE(Equal(ans, ref));
+      EXPECT_TRUE(Equal(ans.RowIds(ans.NumAxes() - 1),
+                        ref.RowIds(ref.NumAxes() - 1)));
+    }
+  }
+}
+
 TEST(RaggedShapeOpsTest, CoveringShape) {
   for (auto &c : {GetCpuContext(), GetCudaContext()}) {
     {
@@ -2956,6 +3178,46 @@ TEST(RaggedOpsTest, TestUniqueSequences) {
   }
 }
 
+TEST(RaggedOpsTest, TestUniqueSequencesHashed) {
+  for (int32_t i = 0; i < 20; i++) {
+    // Small values and few axes, so that there are many repeats.
+    Ragged<int32_t> src = RandomRagged<int32_t>(0, 2, 3, 3, 0, 2000);
+    // The reference: keep the first occurrence of each sequence in each
+    // utterance.
+    std::vector<int32_t> ref_new2old, ref_num_repeats;
+    const int32_t *row_splits1 = src.RowSplits(1).Data(),
+                  *row_splits2 = src.RowSplits(2).Data(),
+                  *values = src.values.Data();
+    for (int32_t utt = 0; utt < src.Dim0(); utt++) {
+      std::map<std::vector<int32_t>, int32_t> seq2new;
+      for (int32_t seq = row_splits1[utt]; seq < row_splits1[utt + 1];
+           seq++) {
+        std::vector<int32_t> v(values + row_splits2[seq],
+                               values + row_splits2[seq + 1]);
+        auto iter = seq2new.find(v);
+        if (iter == seq2new.end()) {
+          seq2new[v] = static_cast<int32_t>(ref_new2old.size());
+          ref_new2old.push_back(seq);
+          ref_num_repeats.push_back(1);
+        } else {
+          ref_num_repeats[iter->second]++;
+        }
+      }
+    }
+    for (auto &c : {GetCpuContext(), GetCudaContext()}) {
+      Ragged<int32_t> this_src = src.To(c), num_repeats;
+      Array1<int32_t> new2old;
+      bool exact = (i % 2 == 0);
+      Ragged<int32_t> unique =
+          UniqueSequencesHashed(this_src, &num_repeats, &new2old, exact);
+      CheckArrayData(new2old, ref_new2old);
+      CheckArrayData(num_repeats.values, ref_num_repeats);
+      EXPECT_TRUE(Equal(unique, Index(this_src, 1, new2old)));
+      EXPECT_TRUE(Equal(num_repeats.shape, GetLayer(unique.shape, 0)));
+    }
+  }
+}
+
 TEST(RaggedIntTest, TestCreateRagged2Int) {
   std::vector<std::vector<int32_t>> vecs{{7, 9}, {10, 12, 13}, {}};
   std::vector<int32_t> expected_values{7, 9, 10, 12, 13};
@@ -3030,6 +3292,22 @@ static void TestPadRagged() {
       K2_CHECK_EQ(res.Dim0(), 3);
       K2_CHECK_EQ(res.Dim1(), 0);
     }
+    {
+      // With a caller-supplied max_len; longer lists are truncated.
+      Ragged<T> src(c, "[ [1 2] [3 4 3] [] [5 6 7 8] ]");
+      Array2<T> res = PadRagged(src, "replicate", T(100), 3);
+      std::vector<T> expected = {1, 2, 2, 3, 4, 3, 100, 100, 100, 5, 6, 7};
+      CheckArrayData(res.Flatten(), expected);
+    }
+    {
+      // Into a sub-matrix of a larger array.
+      Ragged<T> src(c, "[ [1 2] [3] ]");
+      Array2<T> big(c, 2, 5, T(-5));
+      Array2<T> dest = big.ColArange(1, 4);
+      PadRagged(src, "constant", T(0), &dest);
+      std::vector<T> expected = {-5, 1, 2, 0, -5, -5, 3, 0, 0, -5};
+      CheckArrayData(big.Flatten(), expected);
+    }
   }
 }
 
@@ -3111,6 +3389,57 @@ TEST(RaggedTest, TestPruneRagged) {
   TestPruneRagged<double>();
 }
 
+// Checks PruneRagged() with max_elems against keeping the first max_elems
+// sub-lists of each row after a stable sort, which is how ties are broken.
+template <typename T>
+static void TestPruneRaggedRandom() {
+  ContextPtr cpu = GetCpuContext();
+  for (auto &c : {GetCpuContext(), GetCudaContext()}) {
+    for (int32_t i = 0; i != 10; ++i) {
+      Ragged<int32_t> ragged_int = RandomRagged<int32_t>(0, 20, 3, 3, 0, 3000);
+      std::vector<T> values_vec(ragged_int.NumElements());
+      for (int32_t j = 0; j < ragged_int.NumElements(); ++j)
+        values_vec[j] = ragged_int.values[j];
+      Ragged<T> src(ragged_int.shape.To(c), Array1<T>(c, values_vec));
+      T beam = RandInt(0, 25);
+      int32_t max_elems = RandInt(1, 10);
+      Array1<char> keep =
+          PruneRagged(src, 1, beam, max_elems).Keep().To(cpu);
+
+      RaggedShape &shape = ragged_int.shape;
+      const int32_t *row_splits1 = shape.RowSplits(1).Data(),
+                    *row_splits2 = shape.RowSplits(2).Data();
+      const T neg_inf = -std::numeric_limits<T>::infinity();
+      for (int32_t i0 = 0; i0 < shape.Dim0(); ++i0) {
+        int32_t begin = row_splits1[i0], end = row_splits1[i0 + 1];
+        std::vector<std::pair<T, int32_t>> sub_max;
+        T best = neg_inf;
+        for (int32_t i01 = begin; i01 < end; ++i01) {
+          T m = neg_inf;
+          for (int32_t j = row_splits2[i01]; j < row_splits2[i01 + 1]; ++j)
+            m = std::max(m, values_vec[j]);
+          sub_max.push_back({m, i01});
+          best = std::max(best, m);
+        }
+        std::stable_sort(sub_max.begin(), sub_max.end(),
+                         [](const std::pair<T, int32_t> &a,
+                            const std::pair<T, int32_t> &b) {
+                           return a.first > b.first;
+                         });
+        for (int32_t r = 0; r < static_cast<int32_t>(sub_max.size()); ++r) {
+          char expected = (r < max_elems && sub_max[r].first >= best - beam);
+          EXPECT_EQ(keep[sub_max[r].second], expected);
+        }
+      }
+    }
+  }
+}
+
+TEST(RaggedTest, TestPruneRaggedRandom) {
+  TestPruneRaggedRandom<float>();
+  TestPruneRaggedRandom<double>();
+}
+
 template <typename T>
 static void TestPruneRaggedAndSubsetRagged() {
   for (auto &c : {GetCpuContext(), GetCudaContext()}) {
@@ -3162,4 +3491,38 @@ TEST(RaggedTest, TestPruneRaggedAndSubsetRagged) {
   TestPruneRaggedAndSubsetRagged<double>();
 }
 
+TEST(RaggedTest, TestPinMemoryAndPackedTo) {
+  for (auto &c : {GetCpuContext(), GetCudaContext()}) {
+    for (int32_t i = 0; i != 5; ++i) {
+      Ragged<int32_t> src =
+          RandomRagged<int32_t>(0, 100, 2, 4, 0, 1000).To(c);
+      if (i % 2 == 0) src.RowIds(src.NumAxes() - 1);  // row_ids present
+
+      Ragged<int32_t> pinned = PinMemory(src);
+      EXPECT_EQ(pinned.Context()->GetDeviceType(), kCpu);
+      EXPECT_TRUE(Equal(pinned.To(c), src));
+      // Everything is in one region, and row_ids are kept if present.
+      for (int32_t layer = 0; layer + 1 < src.NumAxes(); ++layer) {
+        const RaggedShapeLayer &src_layer = src.shape.Layers()[layer],
+                               &pinned_layer = pinned.shape.Layers()[layer];
+        EXPECT_EQ(pinned_layer.row_splits.GetRegion(),
+                  pinned.values.GetRegion());
+        EXPECT_EQ(pinned_layer.row_ids.IsValid(),
+                  src_layer.row_ids.IsValid());
+        if (pinned_layer.row_ids.IsValid()) {
+          EXPECT_EQ(pinned_layer.row_ids.GetRegion(),
+                    pinned.values.GetRegion());
+        }
+      }
+
+      for (auto &dst : {GetCpuContext(), GetCudaContext()}) {
+        Ragged<int32_t> ans = PackedTo(pinned, dst);
+        EXPECT_TRUE(ans.Context()->IsCompatible(*dst));
+        EXPECT_TRUE(Equal(ans.To(c), src));
+        EXPECT_TRUE(Equal(PackedTo(src, dst).To(c), src));
+      }
+    }
+  }
+}
+
 }  // namespace k2
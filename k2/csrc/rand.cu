@@ -17,7 +17,7 @@
  */
 
 #include <cmath>
-#include <random>
+#include <mutex>  // NOLINT
 #include <type_traits>
 
 #ifdef K2_WITH_CUDA
@@ -25,6 +25,7 @@
 #include "curand_kernel.h"  // NOLINT
 #endif
 
+#include "k2/csrc/philox.h"
 #include "k2/csrc/rand.h"
 
 namespace k2 {
@@ -33,8 +34,12 @@ namespace {
 
 // when calling curand_init() in kernels, its arguments
 // seed and offset are from this struct. All kernels
-// share the same seed and offset.
+// share the same seed; each kernel gets its own offset (see
+// GetCudaSeedAndOffset()), so kernels launched concurrently from different
+// threads do not generate the same numbers.
 struct CudaRandState {
+  std::mutex mutex;  // protects `seed` and `offset`
+
   // the default value for seed is from
   // https://github.com/pytorch/pytorch/blob/master/c10/core/GeneratorImpl.h#L56
   //
@@ -43,9 +48,13 @@ struct CudaRandState {
   uint64_t offset = 0;
 };
 
+// The CPU generator is Philox4x32 (see philox.h), like that of curand, so
+// the elements of an array can be generated in parallel (see
+// SetNumCpuThreads()) and the result does not depend on the number of
+// threads.  Each call uses a new `offset` as the high part of the counter.
 struct CpuRandState {
-  uint64_t seed = std::mt19937::default_seed;
-  std::mt19937 generator;
+  uint64_t seed = 5489u;  // the default seed of std::mt19937
+  uint64_t offset = 0;
 };
 
 static CudaRandState &GetCudaRandState(ContextPtr context) {
@@ -54,20 +63,49 @@ static CudaRandState &GetCudaRandState(ContextPtr context) {
 
   static CudaRandState rand_states[kMaxNumGpus];
   return rand_states[device_id];
-}  // namespace
+}
+
+#ifdef K2_WITH_CUDA
+// Returns the seed and offset for the next kernel on the device of
+// `context` and advances the offset.
+static void GetCudaSeedAndOffset(ContextPtr context, uint64_t *seed,
+                                 uint64_t *offset) {
+  CudaRandState &state = GetCudaRandState(context);
+  std::lock_guard<std::mutex> lock(state.mutex);
+  *seed = state.seed;
+  *offset = state.offset;
+  state.offset += 4;
+}
+#endif
 
 static CpuRandState &GetCpuRandState() {
   static thread_local CpuRandState state;
   return state;
 }
 
-template <typename T, typename Distribution>
+// Sets out[i] to a number in [low, high) for 0 <= i < dim.  For int32_t,
+// `high` is exclusive as well.
+template <typename T>
 static void RandCpu(int32_t dim, T low, T high, T *out) {
-  Distribution distribution(low, high);
-  auto &generator = GetCpuRandState().generator;
-
-  for (int32_t i = 0; i != dim; ++i) {
-    out[i] = distribution(generator);
+  CpuRandState &state = GetCpuRandState();
+  uint64_t seed = state.seed, offset = state.offset++;
+  ContextPtr c = GetCpuContext();
+  if (std::is_integral<T>::value) {
+    uint32_t range = static_cast<uint32_t>(high - low);
+    K2_EVAL(
+        c, dim, lambda_rand_int, (int32_t i)->void {
+          uint32_t r[4];
+          Philox4x32(seed, offset, i, r);
+          out[i] = static_cast<T>(r[0] % range + low);
+        });
+  } else {
+    T range = high - low;
+    K2_EVAL(
+        c, dim, lambda_rand_real, (int32_t i)->void {
+          T t = PhiloxUniform<T>(seed, offset, i) * range + low;
+          // Rounding may give `high`.
+          out[i] = (t < high ? t : low);
+        });
   }
 }
 
@@ -75,7 +113,11 @@ static void RandCpu(int32_t dim, T low, T high, T *out) {
 
 uint64_t GetSeed(ContextPtr context) {
   DeviceType device_type = context->GetDeviceType();
-  if (device_type == kCuda) return GetCudaRandState(context).seed;
+  if (device_type == kCuda) {
+    CudaRandState &state = GetCudaRandState(context);
+    std::lock_guard<std::mutex> lock(state.mutex);
+    return state.seed;
+  }
 
   K2_CHECK_EQ(device_type, kCpu);
   return GetCpuRandState().seed;
@@ -84,8 +126,8 @@ uint64_t GetSeed(ContextPtr context) {
 void SetSeed(ContextPtr context, uint64_t seed) {
   DeviceType device_type = context->GetDeviceType();
   if (device_type == kCuda) {
-    // TODO(fangjun): we may need a lock here
     CudaRandState &state = GetCudaRandState(context);
+    std::lock_guard<std::mutex> lock(state.mutex);
     state.seed = seed;
     state.offset = 0;
     return;
@@ -94,7 +136,7 @@ void SetSeed(ContextPtr context, uint64_t seed) {
   K2_CHECK_EQ(device_type, kCpu);
   CpuRandState &state = GetCpuRandState();
   state.seed = seed;
-  state.generator.seed(seed);
+  state.offset = 0;
 }
 
 template <>
@@ -105,20 +147,20 @@ void Rand<float>(ContextPtr context, float low, float high, int32_t dim,
 
   DeviceType device_type = context->GetDeviceType();
   if (device_type == kCpu) {
-    RandCpu<float, std::uniform_real_distribution<float>>(dim, low, high,
-                                                          array_data);
+    RandCpu<float>(dim, low, high, array_data);
     return;
   }
 
   K2_CHECK_EQ(device_type, kCuda);
 #ifdef K2_WITH_CUDA
-  CudaRandState &state = GetCudaRandState(context);
+  uint64_t seed, offset;
+  GetCudaSeedAndOffset(context, &seed, &offset);
   float range = high - low;
   auto generate_rand_lambda_float = [=] __device__(int32_t i) {
     curandStatePhilox4_32_10_t philox_state;
-    curand_init(state.seed,
+    curand_init(seed,
                 i,  // sequence
-                state.offset, &philox_state);
+                offset, &philox_state);
 
     float4 r = curand_uniform4(&philox_state);
 
@@ -131,7 +173,6 @@ void Rand<float>(ContextPtr context, float low, float high, int32_t dim,
     array_data[i] = t * range + low;
   };
   EvalDevice(context, dim, generate_rand_lambda_float);
-  state.offset += 4;
 #else
   K2_LOG(FATAL) << "Unreachable code";
 #endif
@@ -145,19 +186,19 @@ void Rand<double>(ContextPtr context, double low, double high, int32_t dim,
 
   DeviceType device_type = context->GetDeviceType();
   if (device_type == kCpu) {
-    RandCpu<double, std::uniform_real_distribution<double>>(dim, low, high,
-                                                            array_data);
+    RandCpu<double>(dim, low, high, array_data);
     return;
   }
 #ifdef K2_WITH_CUDA
   K2_CHECK_EQ(device_type, kCuda);
-  CudaRandState &state = GetCudaRandState(context);
+  uint64_t seed, offset;
+  GetCudaSeedAndOffset(context, &seed, &offset);
   double range = high - low;
   auto generate_rand_lambda_double = [=] __device__(int32_t i) {
     curandStatePhilox4_32_10_t philox_state;
-    curand_init(state.seed,
+    curand_init(seed,
                 i,  // sequence
-                state.offset, &philox_state);
+                offset, &philox_state);
 
     double2 r = curand_uniform2_double(&philox_state);
     double t = (r.x == 1.0) ? 0.0 : r.x;
@@ -165,7 +206,6 @@ void Rand<double>(ContextPtr context, double low, double high, int32_t dim,
     array_data[i] = t * range + low;
   };
   EvalDevice(context, dim, generate_rand_lambda_double);
-  state.offset += 4;
 #else
   K2_LOG(FATAL) << "Unreachable code.";
 #endif
@@ -179,21 +219,20 @@ void Rand<int32_t>(ContextPtr context, int32_t low, int32_t high, int32_t dim,
   if (dim == 0) return;
   DeviceType device_type = context->GetDeviceType();
   if (device_type == kCpu) {
-    RandCpu<int32_t, std::uniform_int_distribution<int32_t>>(
-        dim, low, high - 1,  // -1 since high is to be excluded
-        array_data);
+    RandCpu<int32_t>(dim, low, high, array_data);
     return;
   }
 
 #ifdef K2_WITH_CUDA
   K2_CHECK_EQ(device_type, kCuda);
-  CudaRandState &state = GetCudaRandState(context);
+  uint64_t seed, offset;
+  GetCudaSeedAndOffset(context, &seed, &offset);
   uint32_t range = high - low;
   auto generate_rand_lambda_double = [=] __device__(int32_t i) {
     curandStatePhilox4_32_10_t philox_state;
-    curand_init(state.seed,
+    curand_init(seed,
                 i,  // sequence
-                state.offset, &philox_state);
+                offset, &philox_state);
 
     uint4 r = curand4(&philox_state);
     int32_t t = static_cast<int32_t>(r.x % range + low);
@@ -203,7 +242,6 @@ void Rand<int32_t>(ContextPtr context, int32_t low, int32_t high, int32_t dim,
 
   EvalDevice(context, dim, generate_rand_lambda_double);
 
-  state.offset += 4;
 #else
   K2_LOG(FATAL) << "Unreachable code.";
 #endif
@@ -36,6 +36,12 @@ namespace k2 {
 uint64_t GetSeed(ContextPtr context);
 
 /* Set the seed of the device associated with the given `context`.
+ *
+ * Note: The seed of the CPU is per thread (each thread has its own
+ * generator); that of a CUDA device is shared by all threads, but it is
+ * safe to call Rand() concurrently from several threads.  Both use the
+ * counter-based generator Philox4x32 (see philox.h), so after SetSeed()
+ * the numbers are the same whatever the number of CPU threads is.
  *
  * @param [in] context  It specifies the device whose seed is to be set.
  *                      It can be either a CPU context or a CUDA context.
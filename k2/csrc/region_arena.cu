@@ -0,0 +1,55 @@
+/**
+ * Copyright      2026  Xiaomi Corporation
+ *
+ * See LICENSE for clarification regarding multiple authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <algorithm>
+
+#include "k2/csrc/nvtx.h"
+#include "k2/csrc/region_arena.h"
+
+namespace k2 {
+
+void RegionArena::Release() { cur_region_ = nullptr; }
+
+std::size_t RegionArena::Allocate(std::size_t num_bytes, RegionPtr *region) {
+  NVTX_RANGE(K2_FUNC);
+  std::size_t byte_offset = 0;
+  if (cur_region_ != nullptr) {
+    byte_offset =
+        (cur_region_->bytes_used + kAlignment - 1) / kAlignment * kAlignment;
+  }
+  if (cur_region_ == nullptr ||
+      byte_offset + num_bytes > cur_region_->num_bytes) {
+    // The first Region is of size block_bytes_; after that, at least double
+    // the previous one, so the number of Regions is logarithmic in the
+    // total size.
+    std::size_t new_size = block_bytes_;
+    if (cur_region_ != nullptr)
+      new_size = std::max<std::size_t>(new_size, cur_region_->num_bytes * 2);
+    new_size = std::max<std::size_t>(new_size, num_bytes);
+    cur_region_ = NewRegion(c_, new_size);
+    cur_region_->bytes_used = 0;
+    num_bytes_allocated_ += new_size;
+    ++num_regions_allocated_;
+    byte_offset = 0;
+  }
+  cur_region_->bytes_used = byte_offset + num_bytes;
+  *region = cur_region_;
+  return byte_offset;
+}
+
+}  // namespace k2
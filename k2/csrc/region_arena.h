@@ -0,0 +1,109 @@
+/**
+ * Copyright      2026  Xiaomi Corporation
+ *
+ * See LICENSE for clarification regarding multiple authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef K2_CSRC_REGION_ARENA_H_
+#define K2_CSRC_REGION_ARENA_H_
+
+#include <cstddef>
+
+#include "k2/csrc/array.h"
+#include "k2/csrc/context.h"
+#include "k2/csrc/log.h"
+
+namespace k2 {
+
+/*
+  RegionArena hands out Array1's that are sub-ranges of a few large Regions
+  (obtained from NewRegion()), instead of doing one allocation per array.  It
+  is intended for algorithms like pruned intersection that create many
+  smallish arrays whose lifetime is about that of the algorithm, where the
+  allocator traffic (and, on GPU, fragmentation) may be significant.
+
+  The arrays it returns have the arena's Context() as their context, so
+  operations on them allocate their outputs in the normal way; only the
+  arrays explicitly created with NewArray1() come from the arena.
+
+  Memory is never reused: a Region is not freed until the arena has moved on
+  from it (or Release() has been called) and all arrays that point into it
+  have been destroyed.  Regions are never extended (which would move the
+  data), so raw pointers into arrays from the arena stay valid as long as the
+  arrays themselves do.
+
+  This class is not thread-safe.
+ */
+class RegionArena {
+ public:
+  /*
+     Constructor.
+       @param [in] c   Context from which the Regions will be allocated.
+       @param [in] block_bytes   Size in bytes of the first Region to be
+                       allocated; each subsequent Region will be at least
+                       double the size of the previous one.
+   */
+  explicit RegionArena(ContextPtr c, std::size_t block_bytes = (1 << 20))
+      : c_(c), block_bytes_(block_bytes) {
+    K2_CHECK_GT(block_bytes, 0);
+  }
+
+  ContextPtr &Context() { return c_; }
+
+  /* Return a newly created array with `dim` elements (uninitialized), which
+     is part of a Region owned by this arena. */
+  template <typename T>
+  Array1<T> NewArray1(int32_t dim) {
+    K2_CHECK_GE(dim, 0);
+    RegionPtr region;
+    std::size_t byte_offset = Allocate(sizeof(T) * dim, &region);
+    return Array1<T>(dim, region, byte_offset);
+  }
+
+  /* Drop this arena's reference to its current Region, so that the memory
+     will be freed once all arrays created with NewArray1() are destroyed.
+     The arena may still be used afterward; it will allocate a new Region
+     (of the initial size) when needed. */
+  void Release();
+
+  // Return the total number of bytes in the Regions this arena has allocated
+  // since it was constructed.
+  std::size_t NumBytesAllocated() const { return num_bytes_allocated_; }
+
+  // Return the number of Regions this arena has allocated since it was
+  // constructed.
+  int32_t NumRegionsAllocated() const { return num_regions_allocated_; }
+
+ private:
+  /* Reserve `num_bytes` bytes in the current Region (allocating a new one if
+     needed); sets `*region` to that Region and returns the byte offset of the
+     reserved memory in it.  The offset is a multiple of kAlignment. */
+  std::size_t Allocate(std::size_t num_bytes, RegionPtr *region);
+
+  // Alignment of the memory returned, in bytes.  This is what cudaMalloc()
+  // guarantees.
+  static constexpr std::size_t kAlignment = 256;
+
+  ContextPtr c_;
+  std::size_t block_bytes_;  // size of the first Region
+  RegionPtr cur_region_;     // Region we are currently allocating from; its
+                             // bytes_used is the number of bytes handed out.
+  std::size_t num_bytes_allocated_ = 0;
+  int32_t num_regions_allocated_ = 0;
+};
+
+}  // namespace k2
+
+#endif  // K2_CSRC_REGION_ARENA_H_
@@ -0,0 +1,79 @@
+/**
+ * Copyright      2026  Xiaomi Corporation
+ *
+ * See LICENSE for clarification regarding multiple authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <gtest/gtest.h>
+
+#include <cstdint>
+#include <vector>
+
+#include "k2/csrc/array.h"
+#include "k2/csrc/array_ops.h"
+#include "k2/csrc/context.h"
+#include "k2/csrc/region_arena.h"
+#include "k2/csrc/test_utils.h"
+
+namespace k2 {
+
+TEST(RegionArena, Basic) {
+  for (auto &c : {GetCpuContext(), GetCudaContext()}) {
+    RegionArena arena(c, 1024);
+    Array1<int32_t> a = arena.NewArray1<int32_t>(10);
+    Array1<float> b = arena.NewArray1<float>(3);
+    EXPECT_EQ(a.Dim(), 10);
+    EXPECT_EQ(b.Dim(), 3);
+    EXPECT_TRUE(a.Context()->IsCompatible(*c));
+    // Both come from the same Region, and the second one is aligned.
+    EXPECT_EQ(a.GetRegion(), b.GetRegion());
+    EXPECT_EQ(a.ByteOffset(), 0);
+    EXPECT_EQ(b.ByteOffset(), 256);
+    EXPECT_EQ(arena.NumRegionsAllocated(), 1);
+
+    // The arrays don't overlap.
+    Array1<int32_t> a_src = Range<int32_t>(c, 10, 0);
+    Array1<float> b_src(c, std::vector<float>{1, 2, 3});
+    Assign(a_src, &a);
+    Assign(b_src, &b);
+    CheckArrayData(a, a_src);
+    CheckArrayData(b, std::vector<float>{1, 2, 3});
+
+    // Does not fit in what is left of the first Region, and the next Region
+    // is at least double the size.
+    Array1<int8_t> d = arena.NewArray1<int8_t>(1000);
+    EXPECT_NE(d.GetRegion(), a.GetRegion());
+    EXPECT_EQ(d.ByteOffset(), 0);
+    EXPECT_EQ(arena.NumRegionsAllocated(), 2);
+    EXPECT_EQ(d.GetRegion()->num_bytes, 2048);
+
+    // Bigger than any Region so far.
+    Array1<int8_t> e = arena.NewArray1<int8_t>(10000);
+    EXPECT_EQ(e.GetRegion()->num_bytes, 10000);
+    EXPECT_EQ(arena.NumBytesAllocated(), 1024 + 2048 + 10000);
+
+    Array1<int32_t> empty = arena.NewArray1<int32_t>(0);
+    EXPECT_EQ(empty.Dim(), 0);
+
+    // After Release() the arena starts again from the initial size, and
+    // existing arrays are unaffected.
+    arena.Release();
+    Array1<int32_t> f = arena.NewArray1<int32_t>(1);
+    EXPECT_EQ(f.GetRegion()->num_bytes, 1024);
+    CheckArrayData(a, a_src);
+  }
+}
+
+}  // namespace k2
@@ -765,42 +765,52 @@ void ComputeEpsilonClosure(FsaVec &epsilon_fsa, FsaVec *closure_fsa,
   K2_CHECK_EQ(epsilon_fsa.NumAxes(), 3);
 
   // We repeatedly call ComputeEpsilonClosureOneIter() until there is no further
-  // change in the FsaVec (this can be by simple comparison on arcs vector,
-  // since thanks to sorting the order is deterministic).
-  Array1<Arc> epsilon_fsa_arcs = epsilon_fsa.values;
-  ComputeEpsilonClosureOneIter(epsilon_fsa, closure_fsa, arc_map);
-  Array1<Arc> closure_fsa_arcs = closure_fsa->values;
-  // note function `Equal` for Array1 requires the input two arrays have the
-  // same size.
-  while (epsilon_fsa_arcs.Dim() != closure_fsa_arcs.Dim() ||
-         !Equal(epsilon_fsa_arcs, closure_fsa_arcs)) {
-    epsilon_fsa_arcs = closure_fsa_arcs;
+  // change in the FsaVec.  As each iteration expands the arcs of the previous
+  // closure with the arcs of the previous closure, after k iterations it
+  // contains the best paths of up to 2^k arcs, so we need at most
+  // log2(max-num-states) iterations: no best path between two states is
+  // longer than that, and no epsilon cycle that we need to check is longer
+  // than max-num-states.  The `changed` flag lets us stop earlier, without
+  // comparing the arcs of consecutive iterations.
+  int32_t max_num_states = epsilon_fsa.shape.MaxSize(1);
+  bool changed = false;
+  ComputeEpsilonClosureOneIter(epsilon_fsa, closure_fsa, arc_map, &changed);
+  for (int32_t max_path_length = 2;
+       changed && max_path_length < max_num_states; max_path_length *= 2) {
     FsaVec cur_iter_closure_fsa;
     Ragged<int32_t> cur_iter_arc_map;
     ComputeEpsilonClosureOneIter(*closure_fsa, &cur_iter_closure_fsa,
-                                 &cur_iter_arc_map);
-    closure_fsa_arcs = cur_iter_closure_fsa.values;
+                                 &cur_iter_arc_map, &changed);
     *closure_fsa = cur_iter_closure_fsa;
     *arc_map = ComposeArcMaps(*arc_map, cur_iter_arc_map);
   }
 
-  // delete all epsilon self cycle.
+  // delete all epsilon self cycle.  If we stopped because of the bound on the
+  // number of iterations, epsilon cycles with positive weight have not been
+  // checked for yet.
   int32_t num_arcs = closure_fsa->NumElements();
   const Arc *arcs_data = closure_fsa->values.Data();
   ContextPtr &c = closure_fsa->Context();
   Renumbering arc_renumbering(c, num_arcs);
   char *arc_keep_data = arc_renumbering.Keep().Data();
+  Array1<int32_t> check_cycle(c, 1, 0);
+  int32_t *check_cycle_data = check_cycle.Data();
   K2_EVAL(
       c, num_arcs, lambda_set_keep_arc_data, (int32_t arc_idx012)->void {
         const Arc &cur_arc = arcs_data[arc_idx012];
-        arc_keep_data[arc_idx012] = (cur_arc.src_state != cur_arc.dest_state);
+        bool is_self_loop = (cur_arc.src_state == cur_arc.dest_state);
+        if (is_self_loop && cur_arc.score > 0) check_cycle_data[0] = 1;
+        arc_keep_data[arc_idx012] = !is_self_loop;
       });
+  K2_CHECK_EQ(check_cycle[0], 0)
+      << "Detected epsilon cycles with positive weight!";
   *closure_fsa = SubsetRagged(*closure_fsa, arc_renumbering);
   *arc_map = Index(*arc_map, 0, arc_renumbering.New2Old());
 }
 
 void ComputeEpsilonClosureOneIter(FsaVec &epsilon_fsa, FsaVec *closure_fsa,
-                                  Ragged<int32_t> *arc_map) {
+                                  Ragged<int32_t> *arc_map,
+                                  bool *changed /*= nullptr*/) {
   NVTX_RANGE(K2_FUNC);
   K2_CHECK(closure_fsa != nullptr && arc_map != nullptr);
   FsaVec &src = epsilon_fsa;
@@ -871,8 +881,10 @@ void ComputeEpsilonClosureOneIter(FsaVec &epsilon_fsa, FsaVec *closure_fsa,
       src.shape, RaggedShape2(&src_row_splits3, nullptr, expand_arc_nums));
   // just create an alias `expand_row_splits3_data` to use in below lambda.
   const int32_t *expand_row_splits3_data = src_row_splits3_data;
-  // expand_row_ids3 is the row_ids corresponding to expand_row_splits3.
-  const int32_t *expand_row_ids3_data = expand_shape.RowIds(3).Data();
+  // expand_row_ids3 is the row_ids corresponding to expand_row_splits3; we
+  // hold a reference to it as `expand_shape` is replaced below.
+  Array1<int32_t> expand_row_ids3 = expand_shape.RowIds(3);
+  const int32_t *expand_row_ids3_data = expand_row_ids3.Data();
   // Here we pretend we crate an Ragged<int32_t> `expand_arc_map` with NumAxes()
   // ==2, row i in it is the sequence of src_arc_idx012 that arc i in `expand`
   // corresponds to.
@@ -979,6 +991,38 @@ void ComputeEpsilonClosureOneIter(FsaVec &epsilon_fsa, FsaVec *closure_fsa,
         }
       });
 
+  if (changed != nullptr) {
+    // The closure differs from `src` (other than by removing repeated arcs
+    // between two states) if and only if we keep an `expanded` arc that is
+    // not tied with an arc copied from `src` (arcs in a tie are in any order
+    // after sorting).
+    Array1<int32_t> changed_array(c, 1, 0);
+    int32_t *changed_data = changed_array.Data();
+    const int32_t *sort_arc_map_data = sort_arc_map.Data();
+    K2_EVAL(
+        c, expand_arc_nums, lambda_set_changed, (int32_t arc_idx012)->void {
+          if (!arc_keep_data[arc_idx012]) return;
+          int32_t expand_state_idx01 = cur_expand_row_ids2_data[arc_idx012],
+                  next_state_arc_idx01x =
+                      cur_expand_row_splits2_data[expand_state_idx01 + 1];
+          const Arc &cur_arc = expand_arcs_data[arc_idx012];
+          for (int32_t i = arc_idx012; i < next_state_arc_idx01x; ++i) {
+            const Arc &arc = expand_arcs_data[i];
+            if (arc.dest_state != cur_arc.dest_state ||
+                arc.score != cur_arc.score)
+              break;
+            // `i` is copied from `src` if it is the first arc (i.e. with
+            // expand_arc_idx3 == 0) of its row on axis 3 before sorting.
+            int32_t expand_arc_idx0123 = sort_arc_map_data[i],
+                    src_arc_idx012 = expand_row_ids3_data[expand_arc_idx0123];
+            if (expand_arc_idx0123 == expand_row_splits3_data[src_arc_idx012])
+              return;
+          }
+          changed_data[0] = 1;
+        });
+    *changed = (changed_array[0] != 0);
+  }
+
   Array1<int32_t> arc_old_to_new = arc_renumbering.Old2New();
   Array1<int32_t> arc_new_to_old = arc_renumbering.New2Old();
   Array1<int32_t> closure_fsa_row_splits2 = arc_old_to_new[expand.RowSplits(2)];
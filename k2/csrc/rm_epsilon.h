@@ -260,6 +260,11 @@ void MapFsaVecStates(FsaVec &src, Array1<int32_t> &state_row_splits,
                            Will be arc-sorted, and no state will have more than
                            one arc to any other state.
 
+    The closure is computed by path doubling: each iteration (see
+    ComputeEpsilonClosureOneIter()) combines pairs of arcs of the previous
+    iteration, so the number of iterations is logarithmic in the length of the
+    longest epsilon path and at most log2(epsilon_fsa.shape.MaxSize(1)) + 1.
+
     CAUTION: For any epsilon cycle, e.g. s1->s1, if its score is negative or
     zero, we'll delete this arc; if its score is positive, we'll abort the
     program as positive score means we'll get infinity weight under tropical
@@ -283,9 +288,16 @@ void ComputeEpsilonClosure(FsaVec &epsilon_fsa, FsaVec *closure_fsa,
                   arc_idx012's in epsilon_fsa that was the source (the sequence
                   length is 1 or 2 depending on the arc is just copying from
                   `epsilon_fsa` (s1->s2) or it's an expanded arc (s1->s3).
+    @param [out] changed  If not nullptr, will be set to false if
+                  `closure_fsa` contains the same arcs as `epsilon_fsa`
+                  (apart from those removed for having the same source and
+                  destination states as a better arc), i.e. if the closure
+                  has converged, and to true otherwise.  This is cheaper than
+                  comparing the arcs of `epsilon_fsa` and `closure_fsa`.
 */
 void ComputeEpsilonClosureOneIter(FsaVec &epsilon_fsa, FsaVec *closure_fsa,
-                                  Ragged<int32_t> *arc_map);
+                                  Ragged<int32_t> *arc_map,
+                                  bool *changed = nullptr);
 
 /*
   Remove epsilons from FsaOrVec in `src_fsa`, producing an FsaOrVec `dest_fsa`
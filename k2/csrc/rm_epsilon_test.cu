@@ -21,6 +21,7 @@
 #include <algorithm>
 #include <limits>
 #include <set>
+#include <sstream>
 #include <string>
 #include <vector>
 
@@ -328,6 +329,40 @@ TEST(RmEpsilon, ComputeEpsilonClosureSimple) {
   // TODO(haowen): add random tests
 }
 
+TEST(RmEpsilon, ComputeEpsilonClosureLongChain) {
+  for (auto &context : {GetCpuContext(), GetCudaContext()}) {
+    // A chain 0 -> 1 -> ... -> 8, and an arc 0 -> 8 that is worse than it.
+    std::ostringstream os;
+    os << "0 8 0 -10\n";
+    for (int32_t i = 0; i < 8; ++i) os << i << " " << (i + 1) << " 0 -1\n";
+    os << "9\n";
+    Fsa fsa = FsaFromString(os.str());
+    Fsa *fsa_array[] = {&fsa};
+    FsaVec fsa_vec = CreateFsaVec(1, &fsa_array[0]).To(context);
+
+    FsaVec dest;
+    Ragged<int32_t> arc_map;
+    bool changed = false;
+    ComputeEpsilonClosureOneIter(fsa_vec, &dest, &arc_map, &changed);
+    EXPECT_TRUE(changed);
+
+    ComputeEpsilonClosure(fsa_vec, &dest, &arc_map);
+    // An arc from each state to each later state in the chain.
+    EXPECT_EQ(dest.NumElements(), 8 * 9 / 2);
+    EXPECT_EQ(arc_map.Dim0(), 8 * 9 / 2);
+    Array1<Arc> arcs = dest.values.To(GetCpuContext());
+    EXPECT_EQ(arcs[7].dest_state, 8);
+    EXPECT_EQ(arcs[7].score, -8);
+
+    // The closure has converged.
+    FsaVec dest2;
+    Ragged<int32_t> arc_map2;
+    ComputeEpsilonClosureOneIter(dest, &dest2, &arc_map2, &changed);
+    EXPECT_FALSE(changed);
+    EXPECT_TRUE(Equal(dest.values, dest2.values));
+  }
+}
+
 // arc_map is arc_map from dest to src
 void CheckArcMap(FsaVec &src, FsaVec &dest, Ragged<int32_t> &arc_map) {
   ContextPtr cpu = GetCpuContext();
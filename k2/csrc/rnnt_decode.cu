@@ -16,14 +16,18 @@
  * limitations under the License.
  */
 
+#include <algorithm>
 #include <cmath>
 #include <limits>
 #include <memory>
+#include <numeric>
 #include <utility>
 #include <vector>
 
 #include "k2/csrc/fsa.h"
+#include "k2/csrc/hash.h"
 #include "k2/csrc/macros.h"
+#include "k2/csrc/math.h"
 #include "k2/csrc/ragged_ops.h"
 #include "k2/csrc/rnnt_decode.h"
 
@@ -40,11 +44,51 @@ std::shared_ptr<RnntDecodingStream> CreateStream(
   // initialize to start state
   stream.states = Ragged<int64_t>(RegularRaggedShape(c, 1, 1),
                                   Array1<int64_t>(c, std::vector<int64_t>{0}));
-  stream.scores = Ragged<double>(stream.states.shape,
-                                 Array1<double>(c, std::vector<double>{0.0}));
+  stream.scores = Ragged<float>(stream.states.shape,
+                                Array1<float>(c, std::vector<float>{0.0}));
   return std::make_shared<RnntDecodingStream>(stream);
 }
 
+void CompactPrevFrames(int32_t horizon, RnntDecodingStream *stream) {
+  NVTX_RANGE(K2_FUNC);
+  K2_CHECK_GE(horizon, 0);
+  K2_CHECK(stream);
+  auto &frames = stream->prev_frames;
+  auto &best_arcs = stream->prev_best_arcs;
+  K2_CHECK_EQ(frames.size(), best_arcs.size());
+  int32_t num_frames = static_cast<int32_t>(frames.size()),
+          end = std::min(stream->num_finalized_frames, num_frames - horizon);
+  // frames[0, end - 1) are removed and frames[end - 1] is collapsed.
+  if (end < 2) return;
+
+  // All the states on frame `end` trace back to one state; find it by
+  // following the best path back from the finalized state.
+  int32_t state = stream->finalized_state;
+  for (int32_t t = stream->num_finalized_frames - 1; t >= end; --t) {
+    int32_t arc_idx = best_arcs[t]->values[state];
+    state = frames[t]->RowIds(1)[arc_idx];
+  }
+
+  ContextPtr c = frames[end - 1]->Context();
+  ArcInfo arc = frames[end - 1]->values[best_arcs[end - 1]->values[state]];
+  K2_CHECK_EQ(arc.dest_state, state);
+  auto collapsed = std::make_shared<Ragged<ArcInfo>>(
+      RegularRaggedShape(c, 1, 1),
+      Array1<ArcInfo>(c, std::vector<ArcInfo>{arc}));
+  // every state on frame `end` now has the collapsed arc as its best
+  // incoming arc; only `state` can reach the surviving states.
+  auto collapsed_best_arcs = std::make_shared<Ragged<int32_t>>(
+      best_arcs[end - 1]->shape,
+      Array1<int32_t>(c, best_arcs[end - 1]->NumElements(), 0));
+
+  frames.erase(frames.begin(), frames.begin() + end - 1);
+  best_arcs.erase(best_arcs.begin(), best_arcs.begin() + end - 1);
+  frames[0] = collapsed;
+  best_arcs[0] = collapsed_best_arcs;
+  stream->num_dropped_frames += end - 1;
+  stream->num_finalized_frames -= end - 1;
+}
+
 RnntDecodingStreams::RnntDecodingStreams(
     std::vector<std::shared_ptr<RnntDecodingStream>> &srcs,
     const RnntDecodingConfig &config)
@@ -52,26 +96,21 @@ RnntDecodingStreams::RnntDecodingStreams(
   K2_CHECK_GE(num_streams_, 1);
   c_ = srcs_[0]->graph->shape.Context();
 
-  Array1<int32_t> num_graph_states(GetCpuContext(), num_streams_);
-
-  int32_t *num_graph_states_data = num_graph_states.Data();
-
   std::vector<Ragged<int64_t> *> states_ptr(num_streams_);
-  std::vector<Ragged<double> *> scores_ptr(num_streams_);
-  std::vector<Fsa> graphs(num_streams_);
+  std::vector<Ragged<float> *> scores_ptr(num_streams_);
+  slot_graph_indexes_.resize(num_streams_);
 
   for (int32_t i = 0; i < num_streams_; ++i) {
     K2_CHECK(c_->IsCompatible(*(srcs_[i]->graph->shape.Context())));
-    num_graph_states_data[i] = srcs_[i]->num_graph_states;
     states_ptr[i] = &(srcs_[i]->states);
     scores_ptr[i] = &(srcs_[i]->scores);
-    graphs[i] = *(srcs_[i]->graph);
+    slot_graph_indexes_[i] = AddGraph(*(srcs_[i]->graph));
   }
 
-  num_graph_states_ = num_graph_states.To(c_);
   states_ = Stack(0, num_streams_, states_ptr.data());
   scores_ = Stack(0, num_streams_, scores_ptr.data());
-  graphs_ = Array1OfRagged<Arc>(graphs.data(), num_streams_);
+  UpdateGraphs(true);
+  attach_frame_.resize(num_streams_, 0);
 
   // We don't combine prev_frames_ here, will do that when needed, for example
   // when we need all prev_frames_ to format output fsas.
@@ -82,7 +121,7 @@ void RnntDecodingStreams::TerminateAndFlushToStreams() {
   // return directly if already detached or no frames decoded.
   if (!attached_ || prev_frames_.empty()) return;
   std::vector<Ragged<int64_t>> states;
-  std::vector<Ragged<double>> scores;
+  std::vector<Ragged<float>> scores;
   Unstack(states_, 0, &states);
   Unstack(scores_, 0, &scores);
   K2_CHECK_EQ(static_cast<int32_t>(states.size()), num_streams_);
@@ -104,10 +143,25 @@ void RnntDecodingStreams::TerminateAndFlushToStreams() {
 
   K2_CHECK_EQ(num_streams_ * prev_frames_.size(), frames.size());
 
+  // The same for prev_best_arcs_, which are indexed [stream][context][state].
+  std::vector<Ragged<int32_t> *> best_arcs_ptr;
+  for (size_t i = 0; i < prev_best_arcs_.size(); ++i) {
+    best_arcs_ptr.emplace_back(prev_best_arcs_[i].get());
+  }
+  auto stack_best_arcs =
+      Stack(0, prev_best_arcs_.size(), best_arcs_ptr.data()).RemoveAxis(0);
+  std::vector<Ragged<int32_t>> best_arcs;
+  Unstack(stack_best_arcs, 0, &best_arcs);
+  K2_CHECK_EQ(frames.size(), best_arcs.size());
+
   for (int32_t i = 0; i < num_streams_; ++i) {
-    for (size_t j = 0; j < prev_frames_.size(); ++j) {
+    if (srcs_[i] == nullptr) continue;  // empty slot, see DetachStream()
+    // the stream ignores the frames before it was attached.
+    for (size_t j = attach_frame_[i]; j < prev_frames_.size(); ++j) {
       srcs_[i]->prev_frames.emplace_back(
           std::make_shared<Ragged<ArcInfo>>(frames[j * num_streams_ + i]));
+      srcs_[i]->prev_best_arcs.emplace_back(
+          std::make_shared<Ragged<int32_t>>(best_arcs[j * num_streams_ + i]));
     }
     srcs_[i]->states = states[i];
     srcs_[i]->scores = scores[i];
@@ -115,11 +169,96 @@ void RnntDecodingStreams::TerminateAndFlushToStreams() {
 
   attached_ = false;
   prev_frames_.clear();
+  prev_best_arcs_.clear();
+}
+
+template <typename T>
+static Ragged<T> ReplaceSublist(Ragged<T> &src, int32_t i,
+                                const Ragged<T> &sub) {
+  K2_CHECK_EQ(sub.Dim0(), 1);
+  Ragged<T> before = Arange(src, 0, 0, i),
+            after = Arange(src, 0, i + 1, src.Dim0());
+  Ragged<T> *srcs[] = {&before, const_cast<Ragged<T> *>(&sub), &after};
+  return Cat(0, 3, srcs);
+}
+
+void RnntDecodingStreams::DetachStream(int32_t slot) {
+  NVTX_RANGE(K2_FUNC);
+  K2_CHECK(attached_) << "Streams terminated.";
+  K2_CHECK(slot >= 0 && slot < num_streams_);
+  K2_CHECK(srcs_[slot] != nullptr) << "Slot " << slot << " is empty";
+  RnntDecodingStream &stream = *srcs_[slot];
+
+  // The frames decoded since the stream was attached; these share memory
+  // with prev_frames_ rather than being copied.
+  for (size_t t = attach_frame_[slot]; t < prev_frames_.size(); ++t) {
+    stream.prev_frames.emplace_back(std::make_shared<Ragged<ArcInfo>>(
+        Arange(*prev_frames_[t], 0, slot, slot + 1).RemoveAxis(0)));
+    stream.prev_best_arcs.emplace_back(std::make_shared<Ragged<int32_t>>(
+        Arange(*prev_best_arcs_[t], 0, slot, slot + 1).RemoveAxis(0)));
+  }
+  stream.states = Arange(states_, 0, slot, slot + 1).RemoveAxis(0);
+  stream.scores = Arange(scores_, 0, slot, slot + 1).RemoveAxis(0);
+
+  // The slot is left with no contexts or states, so it doesn't take part in
+  // decoding.
+  RaggedShape empty = ComposeRaggedShapes(RegularRaggedShape(c_, 1, 0),
+                                          RegularRaggedShape(c_, 0, 0));
+  states_ = ReplaceSublist(states_, slot,
+                           Ragged<int64_t>(empty, Array1<int64_t>(c_, 0)));
+  scores_ = ReplaceSublist(scores_, slot,
+                           Ragged<float>(empty, Array1<float>(c_, 0)));
+  srcs_[slot] = nullptr;
+}
+
+int32_t RnntDecodingStreams::AddGraph(const Fsa &graph) {
+  std::pair<const Arc *, const int32_t *> key(graph.values.Data(),
+                                              graph.RowSplits(1).Data());
+  auto iter = graph_map_.find(key);
+  if (iter != graph_map_.end()) return iter->second;
+  int32_t index = unique_graphs_.size();
+  unique_graphs_.push_back(graph);
+  graph_map_[key] = index;
+  return index;
+}
+
+void RnntDecodingStreams::UpdateGraphs(bool rebuild_graphs) {
+  NVTX_RANGE(K2_FUNC);
+  if (rebuild_graphs)
+    graphs_ = Array1OfRagged<Arc>(unique_graphs_.data(),
+                                  unique_graphs_.size());
+  std::vector<int32_t> num_graph_states(num_streams_);
+  for (int32_t i = 0; i < num_streams_; ++i)
+    num_graph_states[i] = unique_graphs_[slot_graph_indexes_[i]].Dim0();
+  num_graph_states_ = Array1<int32_t>(c_, num_graph_states);
+  max_num_graph_states_ =
+      *std::max_element(num_graph_states.begin(), num_graph_states.end());
+  graph_indexes_ = Array1<int32_t>(c_, slot_graph_indexes_);
+}
+
+void RnntDecodingStreams::AttachStream(
+    int32_t slot, std::shared_ptr<RnntDecodingStream> stream) {
+  NVTX_RANGE(K2_FUNC);
+  K2_CHECK(attached_) << "Streams terminated.";
+  K2_CHECK(slot >= 0 && slot < num_streams_);
+  K2_CHECK(srcs_[slot] == nullptr) << "Slot " << slot << " is not empty";
+  K2_CHECK(stream);
+  K2_CHECK(c_->IsCompatible(*(stream->graph->shape.Context())));
+
+  states_ = ReplaceSublist(states_, slot, Unsqueeze(stream->states, 0));
+  scores_ = ReplaceSublist(scores_, slot, Unsqueeze(stream->scores, 0));
+
+  int32_t num_graphs = unique_graphs_.size();
+  slot_graph_indexes_[slot] = AddGraph(*(stream->graph));
+  UpdateGraphs(static_cast<int32_t>(unique_graphs_.size()) != num_graphs);
+
+  attach_frame_[slot] = prev_frames_.size();
+  srcs_[slot] = stream;
 }
 
 void RnntDecodingStreams::GetContexts(RaggedShape *shape,
                                       Array2<int32_t> *contexts) {
-  NVTX_RANGE(K2_FUNC);
+  NVTX_RANGE_PAYLOAD(K2_FUNC, kRnnt, states_.NumElements());
   K2_CHECK(shape);
   K2_CHECK(contexts);
   K2_CHECK_EQ(states_.NumAxes(), 3);
@@ -165,8 +304,86 @@ void RnntDecodingStreams::GetContexts(RaggedShape *shape,
       });
 }
 
-Ragged<double> RnntDecodingStreams::PruneTwice(Ragged<double> &incoming_scores,
-                                               Array1<int32_t> *arcs_new2old) {
+void RnntDecodingStreams::GetUniqueContexts(Array2<int32_t> *unique_contexts,
+                                            Array1<int32_t> *context_map) {
+  NVTX_RANGE(K2_FUNC);
+  K2_CHECK(unique_contexts);
+  K2_CHECK(context_map);
+  K2_CHECK_EQ(states_.NumAxes(), 3);
+
+  // The context_state of each context; equal context_states in different
+  // streams represent the same symbols.
+  int32_t num_contexts = states_.TotSize(1);
+  Array1<int64_t> context_states(c_, num_contexts);
+  int64_t *context_states_data = context_states.Data();
+  const int32_t *states_row_ids1_data = states_.RowIds(1).Data(),
+                *states_row_splits2_data = states_.RowSplits(2).Data(),
+                *num_graph_states_data = num_graph_states_.Data();
+  const int64_t *states_values_data = states_.values.Data();
+  K2_EVAL(
+      c_, num_contexts, lambda_set_context_states, (int32_t idx01) {
+        int32_t idx0 = states_row_ids1_data[idx01];
+        context_states_data[idx01] =
+            states_values_data[states_row_splits2_data[idx01]] /
+            num_graph_states_data[idx0];
+      });
+
+  Array1<int32_t> order;
+  Sort(&context_states, &order);
+  const int64_t *sorted_context_states_data = context_states.Data();
+  Renumbering renumber_unique(c_, num_contexts);
+  char *keep_data = renumber_unique.Keep().Data();
+  K2_EVAL(
+      c_, num_contexts, lambda_set_keep, (int32_t i) {
+        keep_data[i] = (i == 0 || sorted_context_states_data[i] !=
+                                      sorted_context_states_data[i - 1]);
+      });
+
+  int32_t num_unique = renumber_unique.NumNewElems();
+  const int32_t *old2new_data = renumber_unique.Old2New(true).Data(),
+                *order_data = order.Data(),
+                *new2old_data = renumber_unique.New2Old().Data();
+  *context_map = Array1<int32_t>(c_, num_contexts);
+  int32_t *context_map_data = context_map->Data();
+  K2_EVAL(
+      c_, num_contexts, lambda_set_context_map, (int32_t i) {
+        // The last kept element at or before i is the first one of its run.
+        context_map_data[order_data[i]] = old2new_data[i + 1] - 1;
+      });
+
+  int32_t decoder_history_len = config_.decoder_history_len,
+          vocab_size = config_.vocab_size;
+  *unique_contexts = Array2<int32_t>(c_, num_unique, decoder_history_len);
+  auto unique_contexts_acc = unique_contexts->Accessor();
+  K2_EVAL2(
+      c_, num_unique, decoder_history_len, lambda_set_unique_contexts,
+      (int32_t row, int32_t col) {
+        // See GetContexts() for how the symbols are extracted.
+        int64_t context_state = sorted_context_states_data[new2old_data[row]],
+                exp = decoder_history_len - col,
+                symbol = context_state % Pow(vocab_size, exp);
+        unique_contexts_acc(row, col) = symbol / Pow(vocab_size, exp - 1);
+      });
+}
+
+void RnntDecodingStreams::SetLmScores(const Array2<float> &lm_scores,
+                                      const Array1<int32_t> &context_map,
+                                      float lm_scale) {
+  NVTX_RANGE(K2_FUNC);
+  K2_CHECK(attached_) << "Streams terminated.";
+  K2_CHECK_EQ(context_map.Dim(), states_.TotSize(1));
+  K2_CHECK_EQ(lm_scores.Dim1(), config_.vocab_size);
+  K2_CHECK(c_->IsCompatible(*lm_scores.Context()));
+  K2_CHECK(c_->IsCompatible(*context_map.Context()));
+  K2_DCHECK(context_map.Dim() == 0 || MaxValue(context_map) < lm_scores.Dim0());
+  lm_scores_ = lm_scores;
+  lm_context_map_ = context_map;
+  lm_scale_ = lm_scale;
+  has_lm_scores_ = true;
+}
+
+Ragged<float> RnntDecodingStreams::PruneTwice(Ragged<float> &incoming_scores,
+                                              Array1<int32_t> *arcs_new2old) {
   NVTX_RANGE(K2_FUNC);
   K2_CHECK_EQ(incoming_scores.NumAxes(), 4);
   K2_CHECK_EQ(incoming_scores.Dim0(), num_streams_);
@@ -180,22 +397,23 @@ Ragged<double> RnntDecodingStreams::PruneTwice(Ragged<double> &incoming_scores,
   // removed. reduced_incoming_scores has a shape of [stream][state][arc].
   auto reduced_incoming_scores = incoming_scores.RemoveAxis(1);
   // states_prune is a renumbering on the states axis.
+  float beam = config_.beam;
   Renumbering states_prune = PruneRagged(reduced_incoming_scores, 1 /*axis*/,
-                                         config_.beam, config_.max_states);
+                                         beam, config_.max_states);
 
   // The new2old indexes in states_prune are global indexes along axis state,
   // so we can extract the surviving elements from `incoming_scores` along
   // state axis.
   Array1<int32_t> arcs_new2old1;
-  Ragged<double> temp_scores =
+  Ragged<float> temp_scores =
       SubsetRagged(incoming_scores, states_prune, 2 /*axis*/, &arcs_new2old1);
 
   // temp_scores has a shape of [stream][context][state][arc]
   // context_prune is a renumbering on the states context.
   Renumbering context_prune =
-      PruneRagged(temp_scores, 1 /*axis*/, config_.beam, config_.max_contexts);
+      PruneRagged(temp_scores, 1 /*axis*/, beam, config_.max_contexts);
   Array1<int32_t> arcs_new2old2;
-  Ragged<double> ans_scores =
+  Ragged<float> ans_scores =
       SubsetRagged(temp_scores, context_prune, 1 /*axis*/, &arcs_new2old2);
 
   if (arcs_new2old) *arcs_new2old = arcs_new2old1[arcs_new2old2];
@@ -217,6 +435,7 @@ RaggedShape RnntDecodingStreams::ExpandArcs() {
 
   const int64_t *states_values_data = states_.values.Data();
   const int32_t *const *graph_row_splits1_ptr_data = graphs_.shape.RowSplits(1);
+  const int32_t *graph_indexes_data = graph_indexes_.Data();
   int32_t *num_arcs_data = num_arcs.Data();
 
   K2_EVAL(
@@ -226,7 +445,8 @@ RaggedShape RnntDecodingStreams::ExpandArcs() {
                 num_graph_states = num_graph_states_data[idx0],
                 graph_state = state_value % num_graph_states;
 
-        const int32_t *graph_row_split1_data = graph_row_splits1_ptr_data[idx0];
+        const int32_t *graph_row_split1_data =
+            graph_row_splits1_ptr_data[graph_indexes_data[idx0]];
         if (graph_state == num_graph_states - 1) {
           // Super final state has no arcs.
           num_arcs_data[idx012] = 0;
@@ -247,8 +467,9 @@ RaggedShape RnntDecodingStreams::ExpandArcs() {
   return unpruned_arcs_shape;
 }
 
+template <typename LogprobsAccessor>
 Renumbering RnntDecodingStreams::DoFisrtPassPruning(
-    RaggedShape &unpruned_arcs_shape, const Array2<float> &logprobs) {
+    RaggedShape &unpruned_arcs_shape, const LogprobsAccessor &logprobs_acc) {
   NVTX_RANGE(K2_FUNC);
   K2_CHECK_EQ(unpruned_arcs_shape.NumAxes(), 4);
 
@@ -260,19 +481,18 @@ Renumbering RnntDecodingStreams::DoFisrtPassPruning(
   //   (2) for all other arcs, keep the it if the forward scores after the
   //       arc would be >= the max_scores_per_stream entry for this stream,
   //       minus the beam from the config.
-  Array1<double> max_scores_per_stream(c_, num_streams_);
-  double minus_inf = -std::numeric_limits<double>::infinity();
+  Array1<float> max_scores_per_stream(c_, num_streams_);
+  float minus_inf = -std::numeric_limits<float>::infinity();
   {
     // scores_ has 3 axes: [stream][context][state]
-    Ragged<double> scores_per_stream = scores_.RemoveAxis(1);
-    MaxPerSublist<double>(scores_per_stream, minus_inf, &max_scores_per_stream);
+    Ragged<float> scores_per_stream = scores_.RemoveAxis(1);
+    MaxPerSublist<float>(scores_per_stream, minus_inf, &max_scores_per_stream);
   }
   Renumbering pass1_renumbering(c_, unpruned_arcs_shape.NumElements());
   char *pass1_keep_data = pass1_renumbering.Keep().Data();
-  const auto logprobs_acc = logprobs.Accessor();
-  const double *scores_data = scores_.values.Data(),
+  const float *scores_data = scores_.values.Data(),
                *max_scores_per_stream_data = max_scores_per_stream.Data();
-  double beam = config_.beam;
+  float beam = config_.beam;
   // "uas" is short for unpruned_arcs_shape
   const int32_t *uas_row_ids3_data = unpruned_arcs_shape.RowIds(3).Data(),
                 *uas_row_splits3_data = unpruned_arcs_shape.RowSplits(3).Data(),
@@ -280,6 +500,7 @@ Renumbering RnntDecodingStreams::DoFisrtPassPruning(
                 *uas_row_ids1_data = unpruned_arcs_shape.RowIds(1).Data(),
                 *num_graph_states_data = num_graph_states_.Data();
   const int32_t *const *graph_row_splits1_ptr_data = graphs_.shape.RowSplits(1);
+  const int32_t *graph_indexes_data = graph_indexes_.Data();
   const int64_t *states_values_data = states_.values.Data();
 
   const Arc *const *graphs_arcs_data = graphs_.values.Data();
@@ -300,8 +521,9 @@ Renumbering RnntDecodingStreams::DoFisrtPassPruning(
                 idx0 = uas_row_ids1_data[idx01],
                 num_graph_states = num_graph_states_data[idx0];
 
-        const Arc *graph_arcs_data = graphs_arcs_data[idx0];
-        const int32_t *graph_row_split1_data = graph_row_splits1_ptr_data[idx0];
+        const Arc *graph_arcs_data = graphs_arcs_data[graph_indexes_data[idx0]];
+        const int32_t *graph_row_split1_data =
+            graph_row_splits1_ptr_data[graph_indexes_data[idx0]];
         int64_t state = states_values_data[idx012];
         int32_t graph_state = state % num_graph_states,
                 graph_idx0x = graph_row_split1_data[graph_state],
@@ -316,10 +538,10 @@ Renumbering RnntDecodingStreams::DoFisrtPassPruning(
           return;
         }
 
-        double log_prob = 0.0;  // make final probability 1.
+        float log_prob = 0.0;  // make final probability 1.
         if (arc.label != -1) log_prob = logprobs_acc(idx01, arc.label);
 
-        double this_score = scores_data[idx012], arc_score = arc.score,
+        float this_score = scores_data[idx012], arc_score = arc.score,
                score = this_score + arc_score + log_prob,
                max_score = max_scores_per_stream_data[idx0];
         // prune with beam
@@ -333,6 +555,171 @@ Renumbering RnntDecodingStreams::DoFisrtPassPruning(
 }
 
 RaggedShape RnntDecodingStreams::GroupStatesByContexts(
+    Ragged<int64_t> &states, Array1<int32_t> *new2old) {
+  NVTX_RANGE(K2_FUNC);
+  // states has a shape of [stream][arc]
+  K2_CHECK_EQ(states.NumAxes(), 2);
+  K2_CHECK(new2old != nullptr);
+  int32_t num_arcs = states.NumElements();
+
+  // We key the hash on (stream, state) and on (stream, context_state), packed
+  // as `(stream << state_bits) | value`, with the top bit telling the two
+  // kinds of key apart.  Work out whether that fits; state values are less
+  // than num_contexts * max_num_graph_states_.
+  const int64_t kMaxKey = int64_t(1) << 62;
+  int64_t max_state = max_num_graph_states_;
+  for (int32_t i = 0; i < config_.decoder_history_len; ++i) {
+    if (max_state > kMaxKey / config_.vocab_size) {
+      max_state = kMaxKey;
+      break;
+    }
+    max_state *= config_.vocab_size;
+  }
+  int32_t state_bits = HighestBitSet(std::max<int64_t>(max_state - 1, 1)) + 1,
+          stream_bits = HighestBitSet(std::max(states.Dim0() - 1, 1)) + 1;
+  if (num_arcs == 0 || state_bits + stream_bits > 62) {
+    *new2old = Array1<int32_t>(c_, num_arcs);
+    SortSublists(&states, new2old);
+    return GroupSortedStatesByContexts(states);
+  }
+
+  int64_t num_buckets = std::max<int64_t>(
+      4 * static_cast<int64_t>(RoundUpToNearestPowerOfTwo(num_arcs)), 128);
+  Hash64 hash(c_, num_buckets);
+  auto hash_acc = hash.GetAccessor();
+  const int32_t *states_row_ids1_data = states.RowIds(1).Data(),
+                *num_graph_states_data = num_graph_states_.Data();
+  const int64_t *states_data = states.values.Data();
+  const uint64_t kContextFlag = uint64_t(1) << 63;
+
+  // Each key ends up with the lowest arc index that has it as its value, so
+  // that the ids we assign below do not depend on the order in which threads
+  // run.
+  K2_EVAL(
+      c_, num_arcs, lambda_insert, (int32_t idx01)->void {
+        int32_t idx0 = states_row_ids1_data[idx01];
+        int64_t state = states_data[idx01],
+                context_state = state / num_graph_states_data[idx0];
+        uint64_t stream_key = static_cast<uint64_t>(idx0) << state_bits,
+                 keys[2] = {stream_key | static_cast<uint64_t>(state),
+                            kContextFlag | stream_key |
+                                static_cast<uint64_t>(context_state)},
+                 value = static_cast<uint64_t>(idx01);
+        for (int32_t k = 0; k < 2; ++k) {
+          uint64_t old_value = 0, *key_value_location = nullptr;
+          if (hash_acc.Insert(keys[k], value, &old_value,
+                              &key_value_location))
+            continue;
+          // The other thread may not have written the value yet; Find()
+          // waits for it.
+          if (~old_value == 0) hash_acc.Find(keys[k], &old_value);
+          while (old_value > value) {
+            uint64_t prev = AtomicCAS(
+                (unsigned long long *)(key_value_location + 1), old_value,
+                value);
+            if (prev == old_value) break;
+            old_value = prev;
+          }
+        }
+      });
+
+  // For each arc, state_rep and context_rep are the lowest-numbered arcs of
+  // the same stream with the same state and context_state respectively.
+  Array1<int32_t> state_rep(c_, num_arcs), context_rep(c_, num_arcs);
+  int32_t *state_rep_data = state_rep.Data(),
+          *context_rep_data = context_rep.Data();
+  Renumbering state_renumbering(c_, num_arcs),
+      context_renumbering(c_, num_arcs);
+  char *state_keep_data = state_renumbering.Keep().Data(),
+       *context_keep_data = context_renumbering.Keep().Data();
+  K2_EVAL(
+      c_, num_arcs, lambda_find_reps, (int32_t idx01)->void {
+        int32_t idx0 = states_row_ids1_data[idx01];
+        int64_t state = states_data[idx01],
+                context_state = state / num_graph_states_data[idx0];
+        uint64_t stream_key = static_cast<uint64_t>(idx0) << state_bits,
+                 state_value = 0, context_value = 0;
+        bool found = hash_acc.Find(stream_key | static_cast<uint64_t>(state),
+                                   &state_value);
+        found = hash_acc.Find(kContextFlag | stream_key |
+                                  static_cast<uint64_t>(context_state),
+                              &context_value) && found;
+        K2_CHECK(found);
+        state_rep_data[idx01] = static_cast<int32_t>(state_value);
+        context_rep_data[idx01] = static_cast<int32_t>(context_value);
+        state_keep_data[idx01] = (state_rep_data[idx01] == idx01);
+        context_keep_data[idx01] = (context_rep_data[idx01] == idx01);
+      });
+  // The hash still contains entries; avoid the check in its destructor.
+  hash.Destroy();
+
+  // States and contexts are numbered in order of their first arc, so they are
+  // in order of stream.
+  int32_t num_states = state_renumbering.NumNewElems(),
+          num_contexts = context_renumbering.NumNewElems();
+  Array1<int32_t> state_old2new = state_renumbering.Old2New(),
+                  state_new2old = state_renumbering.New2Old(),
+                  context_old2new_extra = context_renumbering.Old2New(true),
+                  context_new2old = context_renumbering.New2Old();
+
+  // Order the states by context; the sort is stable, so states with the same
+  // context stay in order of their first arc.
+  Array1<int32_t> state2ctx(c_, num_states);
+  int32_t *state2ctx_data = state2ctx.Data();
+  const int32_t *state_new2old_data = state_new2old.Data(),
+                *context_old2new_data = context_old2new_extra.Data();
+  K2_EVAL(
+      c_, num_states, lambda_set_state2ctx, (int32_t i)->void {
+        int32_t rep = state_new2old_data[i];
+        state2ctx_data[i] = context_old2new_data[context_rep_data[rep]];
+      });
+  Ragged<int32_t> state2ctx_ragged(RegularRaggedShape(c_, 1, num_states),
+                                   state2ctx);
+  Array1<int32_t> state_order =
+      GetTransposeReordering(state2ctx_ragged, num_contexts);
+
+  // state_rank is the inverse of state_order: the position of each state
+  // (numbered by its first arc) once ordered by context.  Then order the arcs
+  // by it, which puts them in [stream][context][state] order.
+  Array1<int32_t> state_rank(c_, num_states), arc2state(c_, num_arcs);
+  int32_t *state_rank_data = state_rank.Data(),
+          *arc2state_data = arc2state.Data();
+  const int32_t *state_order_data = state_order.Data(),
+                *state_old2new_data = state_old2new.Data();
+  K2_EVAL(
+      c_, num_states, lambda_set_state_rank, (int32_t i)->void {
+        state_rank_data[state_order_data[i]] = i;
+      });
+  K2_EVAL(
+      c_, num_arcs, lambda_set_arc2state, (int32_t idx01)->void {
+        arc2state_data[idx01] =
+            state_rank_data[state_old2new_data[state_rep_data[idx01]]];
+      });
+  Ragged<int32_t> arc2state_ragged(RegularRaggedShape(c_, 1, num_arcs),
+                                   arc2state);
+  *new2old = GetTransposeReordering(arc2state_ragged, num_states);
+  states.values = states.values[*new2old];
+
+  Array1<int32_t> arc2state_row_ids = arc2state[*new2old],
+                  state2ctx_row_ids = state2ctx[state_order];
+  RaggedShape state_arc_shape =
+      RaggedShape2(nullptr, &arc2state_row_ids, num_arcs);
+  RaggedShape ctx_state_shape =
+      RaggedShape2(nullptr, &state2ctx_row_ids, num_states);
+
+  RaggedShape &stream_arc_shape = states.shape;
+  Array1<int32_t> ctx2stream_row_ids =
+                      stream_arc_shape.RowIds(1)[context_new2old],
+                  stream2ctx_row_splits =
+                      context_old2new_extra[stream_arc_shape.RowSplits(1)];
+  RaggedShape stream_ctx_shape = RaggedShape2(
+      &stream2ctx_row_splits, &ctx2stream_row_ids, num_contexts);
+
+  return ComposeRaggedShapes3(stream_ctx_shape, ctx_state_shape,
+                              state_arc_shape);
+}
+
+RaggedShape RnntDecodingStreams::GroupSortedStatesByContexts(
     Ragged<int64_t> &states) {
   NVTX_RANGE(K2_FUNC);
   // states has a shape of [stream][arc]
@@ -424,21 +811,19 @@ RaggedShape RnntDecodingStreams::GroupStatesByContexts(
      (5) Second pass pruning (prune on state axis and context axis).
      (6) Update states_, scores_ and prev_frames_.
  */
-void RnntDecodingStreams::Advance(const Array2<float> &logprobs) {
+template <typename LogprobsAccessor>
+void RnntDecodingStreams::AdvanceInternal(
+    const LogprobsAccessor &logprobs_acc) {
   NVTX_RANGE(K2_FUNC);
-  K2_CHECK(attached_) << "Streams terminated.";
-  K2_CHECK_EQ(logprobs.Dim0(), states_.TotSize(1));
-  K2_CHECK_EQ(logprobs.Dim1(), config_.vocab_size);
-
-  ContextPtr c = logprobs.Context();
-  K2_CHECK(c_->IsCompatible(*c));
+  ContextPtr &c = c_;
 
   // (1) Expand arcs.
   // unpruned_arcs_shape has a shape of [stream][context][state][arc]
   auto unpruned_arcs_shape = ExpandArcs();
 
   // (2) Do initial pruning.
-  auto pass1_renumbering = DoFisrtPassPruning(unpruned_arcs_shape, logprobs);
+  auto pass1_renumbering =
+      DoFisrtPassPruning(unpruned_arcs_shape, logprobs_acc);
 
   // pass1_arcs_shape has a shape of [stream][context][state][arc]
   auto pass1_arcs_shape =
@@ -457,7 +842,7 @@ void RnntDecodingStreams::Advance(const Array2<float> &logprobs) {
   Ragged<int64_t> states(stream_arc_shape);
   // final-scores after arcs, indexed by [stream][arc]
   // It contains the forward scores of dest-states.
-  Ragged<double> scores(stream_arc_shape);
+  Ragged<float> scores(stream_arc_shape);
 
   // We will populate arcs, states and scores below; it computes
   // the destination state for each arc and puts it in 'states',
@@ -471,8 +856,8 @@ void RnntDecodingStreams::Advance(const Array2<float> &logprobs) {
 
   const int64_t *this_states_values_data = states_.values.Data();
   int64_t *states_data = states.values.Data();
-  const double *this_scores_data = scores_.values.Data();
-  double *scores_data = scores.values.Data();
+  const float *this_scores_data = scores_.values.Data();
+  float *scores_data = scores.values.Data();
   ArcInfo *arcs_data = arcs.values.Data();
   int32_t vocab_size = config_.vocab_size,
           decoder_history_len = config_.decoder_history_len;
@@ -485,7 +870,7 @@ void RnntDecodingStreams::Advance(const Array2<float> &logprobs) {
                 *uas_row_ids1_data = unpruned_arcs_shape.RowIds(1).Data(),
                 *pass1_new2old_data = pass1_renumbering.New2Old().Data();
   const int32_t *const *graph_row_splits1_ptr_data = graphs_.shape.RowSplits(1);
-  const auto logprobs_acc = logprobs.Accessor();
+  const int32_t *graph_indexes_data = graph_indexes_.Data();
   const Arc *const *graphs_arcs_data = graphs_.values.Data();
 
   K2_EVAL(
@@ -507,7 +892,7 @@ void RnntDecodingStreams::Advance(const Array2<float> &logprobs) {
             idx01 = uas_row_ids2_data[idx012], idx0 = uas_row_ids1_data[idx01],
                 num_graph_states = num_graph_states_data[idx0];
         int64_t this_state = this_states_values_data[idx012];
-        double this_score = this_scores_data[idx012];
+        float this_score = this_scores_data[idx012];
 
         // handle the implicit epsilon self-loop
         if (idx3 == 0) {
@@ -522,8 +907,9 @@ void RnntDecodingStreams::Advance(const Array2<float> &logprobs) {
           return;
         }
 
-        const Arc *graph_arcs_data = graphs_arcs_data[idx0];
-        const int32_t *graph_row_split1_data = graph_row_splits1_ptr_data[idx0];
+        const Arc *graph_arcs_data = graphs_arcs_data[graph_indexes_data[idx0]];
+        const int32_t *graph_row_split1_data =
+            graph_row_splits1_ptr_data[graph_indexes_data[idx0]];
 
         int64_t this_context_state = this_state / num_graph_states;
         int32_t this_graph_state = this_state % num_graph_states,
@@ -550,7 +936,7 @@ void RnntDecodingStreams::Advance(const Array2<float> &logprobs) {
         int64_t state = context_state * num_graph_states + arc.dest_state;
         states_data[arc_idx] = state;
 
-        double log_prob = 0.0;  // make final arc probability 1.
+        float log_prob = 0.0;  // make final arc probability 1.
         if (arc.label == -1) {
           log_prob = logprobs_acc(idx01, 0);
         } else {
@@ -567,21 +953,19 @@ void RnntDecodingStreams::Advance(const Array2<float> &logprobs) {
       });
 
   // (4) Rearrange dest-states by contexts and states.
-  // sort states so that we can group states by context-state
-  Array1<int32_t> dest_state_sort_new2old(c, states.NumElements());
-  SortSublists(&states, &dest_state_sort_new2old);
-
-  auto incoming_arcs_shape = GroupStatesByContexts(states);
+  Array1<int32_t> dest_state_sort_new2old;
+  auto incoming_arcs_shape =
+      GroupStatesByContexts(states, &dest_state_sort_new2old);
 
   scores.values = scores.values[dest_state_sort_new2old];
-  Ragged<double> incoming_scores(incoming_arcs_shape, scores.values);
+  Ragged<float> incoming_scores(incoming_arcs_shape, scores.values);
   // Note: `arcs` is not sorted. `renumber_arcs` will be used later
   // to map `pruned arcs` to `arcs`.
 
   // (5) Second pass pruning (prune on context axis and state axis).
   // The scores has been rearranged by context and destination state.
   Array1<int32_t> arcs_prune2_new2old;
-  Ragged<double> pruned_incoming_scores =
+  Ragged<float> pruned_incoming_scores =
       PruneTwice(incoming_scores, &arcs_prune2_new2old);
 
   Ragged<int64_t> pruned_dest_states(pruned_incoming_scores.shape,
@@ -591,14 +975,38 @@ void RnntDecodingStreams::Advance(const Array2<float> &logprobs) {
   // Here, use MaxPerSublist to reduce `pruned_incoming_scores` to be per
   // state not per arc.  (Need to remove last axis from the shape)
   int32_t num_dest_states = pruned_incoming_scores.TotSize(2);
-  Array1<double> dest_state_scores_values(c_, num_dest_states);
-  double minus_inf = -std::numeric_limits<double>::infinity();
-  MaxPerSublist(pruned_incoming_scores, minus_inf, &dest_state_scores_values);
+  // best_incoming_arcs contains, for each dest-state, the index into
+  // `pruned_incoming_scores` of its best incoming arc; we keep it (as
+  // prev_best_arcs_) to be able to trace back the best path.
+  Array1<int32_t> best_incoming_arcs(c_, num_dest_states);
+  float minus_inf = -std::numeric_limits<float>::infinity();
+  ArgMaxPerSublist(pruned_incoming_scores, minus_inf, &best_incoming_arcs);
+  Array1<float> dest_state_scores_values =
+      pruned_incoming_scores.values[best_incoming_arcs];
 
   // dest_state_scores will be the 'scores' held by this object on the next
   // frame
-  Ragged<double> dest_state_scores(RemoveAxis(pruned_incoming_scores.shape, 3),
-                                   dest_state_scores_values);
+  Ragged<float> dest_state_scores(RemoveAxis(pruned_incoming_scores.shape, 3),
+                                  dest_state_scores_values);
+
+  // Make the scores relative to the best state of each stream.  We only ever
+  // compare scores within a stream, and this keeps their magnitude bounded by
+  // about the beam however many frames we decode, so float doesn't lose
+  // precision the way an accumulated total score would.
+  Array1<float> best_scores_per_stream(c_, num_streams_);
+  {
+    Ragged<float> scores_per_stream = dest_state_scores.RemoveAxis(1);
+    MaxPerSublist(scores_per_stream, minus_inf, &best_scores_per_stream);
+  }
+  const int32_t *dss_row_ids2_data = dest_state_scores.RowIds(2).Data(),
+                *dss_row_ids1_data = dest_state_scores.RowIds(1).Data();
+  const float *best_scores_per_stream_data = best_scores_per_stream.Data();
+  float *dest_state_scores_data = dest_state_scores.values.Data();
+  K2_EVAL(
+      c_, num_dest_states, lambda_renormalize_scores, (int32_t idx012) {
+        int32_t idx0 = dss_row_ids1_data[dss_row_ids2_data[idx012]];
+        dest_state_scores_data[idx012] -= best_scores_per_stream_data[idx0];
+      });
   scores_ = std::move(dest_state_scores);
 
   // dest_states will be the `states` held by this object on the next frame.
@@ -669,8 +1077,86 @@ void RnntDecodingStreams::Advance(const Array2<float> &logprobs) {
         pruned_arcs_data[pruned_arc_idx0123] = info;
       });
 
+  // Work out the best incoming arc of each state on the next frame, as an
+  // index into the arcs of its stream on this frame (i.e. an idx12 into
+  // prev_frames_.back()), which stays valid after the frames are split into
+  // the individual streams.
+  Array1<int32_t> best_arcs(c_, num_dest_states);
+  int32_t *best_arcs_data = best_arcs.Data();
+  const int32_t *best_incoming_arcs_data = best_incoming_arcs.Data(),
+                *pa_row_splits1_data = pruned_arcs.RowSplits(1).Data(),
+                *pa_row_splits2_data = pruned_arcs.RowSplits(2).Data(),
+                *pa_row_splits3_data = pruned_arcs.RowSplits(3).Data();
+  K2_EVAL(
+      c_, num_dest_states, lambda_set_best_arcs, (int32_t idx01) {
+        int32_t idx0 = rpds_row_ids1_data[idx01],
+                idx0xxx = pa_row_splits3_data
+                    [pa_row_splits2_data[pa_row_splits1_data[idx0]]];
+        best_arcs_data[idx01] =
+            arcs_dest2src_data[best_incoming_arcs_data[idx01]] - idx0xxx;
+      });
+
   prev_frames_.emplace_back(
       std::make_shared<Ragged<ArcInfo>>(pruned_arcs.RemoveAxis(1)));
+  prev_best_arcs_.emplace_back(
+      std::make_shared<Ragged<int32_t>>(scores_.shape, best_arcs));
+}
+
+template <typename LogprobsAccessor>
+void RnntDecodingStreams::AdvanceWithLmScores(
+    const LogprobsAccessor &logprobs_acc) {
+  if (!has_lm_scores_) {
+    AdvanceInternal(logprobs_acc);
+    return;
+  }
+  // The LM scores were set for the current contexts; streams may have been
+  // attached or detached since.
+  K2_CHECK_EQ(lm_context_map_.Dim(), states_.TotSize(1));
+  const Array2<float> &lm_scores = lm_scores_;
+  LmFusedLogprobsAccessor<LogprobsAccessor> fused_acc(
+      logprobs_acc, lm_scores.Accessor(), lm_context_map_.Data(), lm_scale_);
+  AdvanceInternal(fused_acc);
+  has_lm_scores_ = false;
+  lm_scores_ = Array2<float>();
+  lm_context_map_ = Array1<int32_t>();
+}
+
+void RnntDecodingStreams::Advance(const Array2<float> &logprobs) {
+  NVTX_RANGE_PAYLOAD(K2_FUNC, kRnnt, logprobs.Dim0());
+  K2_CHECK(attached_) << "Streams terminated.";
+  K2_CHECK_EQ(logprobs.Dim0(), states_.TotSize(1));
+  K2_CHECK_EQ(logprobs.Dim1(), config_.vocab_size);
+  K2_CHECK(c_->IsCompatible(*logprobs.Context()));
+
+  AdvanceWithLmScores(logprobs.Accessor());
+}
+
+void RnntDecodingStreams::Advance(const Ragged<int32_t> &symbols,
+                                  const Ragged<float> &logprobs) {
+  NVTX_RANGE_PAYLOAD(K2_FUNC, kRnnt, symbols.NumElements());
+  K2_CHECK(attached_) << "Streams terminated.";
+  K2_CHECK_EQ(symbols.NumAxes(), 2);
+  K2_CHECK_EQ(symbols.Dim0(), states_.TotSize(1));
+  K2_CHECK_EQ(logprobs.NumAxes(), 2);
+  K2_CHECK_EQ(logprobs.NumElements(), symbols.NumElements());
+  K2_DCHECK(Equal(logprobs.shape, symbols.shape));
+  K2_CHECK(c_->IsCompatible(*symbols.Context()));
+  K2_CHECK(c_->IsCompatible(*logprobs.Context()));
+
+  // Sort the candidates of each context, so they can be looked up with a
+  // binary search.
+  Ragged<int32_t> sorted_symbols = symbols.Clone();
+  Array1<int32_t> order(c_, sorted_symbols.NumElements());
+  SortSublists(&sorted_symbols, &order);
+  Array1<float> sorted_logprobs = logprobs.values[order];
+
+  SparseLogprobsAccessor logprobs_acc;
+  logprobs_acc.row_splits = sorted_symbols.RowSplits(1).Data();
+  logprobs_acc.symbols = sorted_symbols.values.Data();
+  logprobs_acc.logprobs = sorted_logprobs.Data();
+  logprobs_acc.missing = -std::numeric_limits<float>::infinity();
+
+  AdvanceWithLmScores(logprobs_acc);
 }
 
 void RnntDecodingStreams::GatherPrevFrames(
@@ -682,6 +1168,7 @@ void RnntDecodingStreams::GatherPrevFrames(
   Array1<int32_t> stream2t_row_splits(GetCpuContext(), num_frames.size() + 1);
 
   for (size_t i = 0; i < num_frames.size(); ++i) {
+    K2_CHECK(srcs_[i] != nullptr) << "Slot " << i << " is empty";
     stream2t_row_splits.Data()[i] = num_frames[i];
     K2_CHECK_LE(num_frames[i],
                 static_cast<int32_t>(srcs_[i]->prev_frames.size()));
@@ -714,7 +1201,7 @@ void RnntDecodingStreams::GatherPrevFrames(
 void RnntDecodingStreams::FormatOutput(const std::vector<int32_t> &num_frames,
                                        bool allow_partial, FsaVec *ofsa,
                                        Array1<int32_t> *out_map) {
-  NVTX_RANGE(K2_FUNC);
+  NVTX_RANGE_PAYLOAD(K2_FUNC, kRnnt, num_frames.size());
   K2_CHECK(!attached_)
       << "You can only get outputs after calling TerminateAndFlushToStreams()";
   K2_CHECK(ofsa);
@@ -832,6 +1319,7 @@ void RnntDecodingStreams::FormatOutput(const std::vector<int32_t> &num_frames,
   Array1<Arc> arcs_out(c_, num_arcs);
   Arc *arcs_out_data = arcs_out.Data();
   const int32_t *const *graph_row_splits1_ptr_data = graphs_.shape.RowSplits(1);
+  const int32_t *graph_indexes_data = graph_indexes_.Data();
   const Arc *const *graphs_arcs_data = graphs_.values.Data();
 
   K2_EVAL(
@@ -865,7 +1353,8 @@ void RnntDecodingStreams::FormatOutput(const std::vector<int32_t> &num_frames,
           arc.label = -1;
           arc.score = 0;
         } else {
-          const Arc *graph_arcs_data = graphs_arcs_data[oarc_idx0];
+          const Arc *graph_arcs_data =
+              graphs_arcs_data[graph_indexes_data[oarc_idx0]];
           arc.src_state = oarc_idx012 - oarc_idx0xx;
 
           // Note: the idx1 w.r.t. the frame's `arcs` is an idx2 w.r.t.
@@ -893,5 +1382,72 @@ void RnntDecodingStreams::FormatOutput(const std::vector<int32_t> &num_frames,
   *ofsa = FsaVec(RemoveAxis(oshape, 1), arcs_out);
 }
 
+void RnntDecodingStreams::GetFinalizedBestPath(Ragged<int32_t> *best_path) {
+  NVTX_RANGE(K2_FUNC);
+  K2_CHECK(!attached_)
+      << "You can only get outputs after calling TerminateAndFlushToStreams()";
+  K2_CHECK(best_path);
+
+  // The back-pointers are followed on CPU; only the frames since the last
+  // call are transferred.
+  ContextPtr cpu = GetCpuContext();
+  std::vector<int32_t> row_splits(1, 0), arcs;
+  for (int32_t i = 0; i < num_streams_; ++i) {
+    if (srcs_[i] == nullptr) {  // empty slot, see DetachStream()
+      row_splits.push_back(arcs.size());
+      continue;
+    }
+    RnntDecodingStream &stream = *srcs_[i];
+    int32_t num_frames = static_cast<int32_t>(stream.prev_frames.size()),
+            begin = stream.num_finalized_frames;
+    K2_CHECK_EQ(stream.prev_best_arcs.size(), stream.prev_frames.size());
+    K2_CHECK_LE(begin, num_frames);
+    if (begin == num_frames) {
+      row_splits.push_back(arcs.size());
+      continue;
+    }
+
+    // Trace back all the states on the last frame until they converge to a
+    // single state, on frame t.  They all converge on frame `begin` at the
+    // latest, as every state there was traced back to one state by the
+    // previous call (or it is the start state).
+    std::vector<int32_t> states(stream.prev_best_arcs.back()->NumElements());
+    std::iota(states.begin(), states.end(), 0);
+    int32_t t = num_frames;
+    while (states.size() > 1 && t > begin) {
+      Ragged<ArcInfo> frame = stream.prev_frames[t - 1]->To(cpu);
+      Array1<int32_t> best_arcs = stream.prev_best_arcs[t - 1]->values.To(cpu);
+      const int32_t *row_ids1_data = frame.RowIds(1).Data(),
+                    *best_arcs_data = best_arcs.Data();
+      for (auto &state : states) state = row_ids1_data[best_arcs_data[state]];
+      std::sort(states.begin(), states.end());
+      states.erase(std::unique(states.begin(), states.end()), states.end());
+      --t;
+    }
+    K2_CHECK_EQ(states.size(), 1u);
+
+    // Follow the best path from that state back to frame `begin`.
+    std::size_t arcs_begin = arcs.size();
+    int32_t state = states[0];
+    for (int32_t u = t - 1; u >= begin; --u) {
+      Ragged<ArcInfo> frame = stream.prev_frames[u]->To(cpu);
+      Array1<int32_t> best_arcs = stream.prev_best_arcs[u]->values.To(cpu);
+      int32_t arc_idx = best_arcs[state];
+      ArcInfo ai = frame.values[arc_idx];
+      if (ai.graph_arc_idx01 != -1 && ai.label != -1)
+        arcs.push_back(ai.graph_arc_idx01);
+      state = frame.RowIds(1)[arc_idx];
+    }
+    std::reverse(arcs.begin() + arcs_begin, arcs.end());
+    row_splits.push_back(arcs.size());
+    stream.num_finalized_frames = t;
+    stream.finalized_state = states[0];
+  }
+
+  Array1<int32_t> row_splits_array(c_, row_splits);
+  RaggedShape shape = RaggedShape2(&row_splits_array, nullptr, arcs.size());
+  *best_path = Ragged<int32_t>(shape, Array1<int32_t>(c_, arcs));
+}
+
 }  // namespace rnnt_decoding
 }  // namespace k2
@@ -20,7 +20,9 @@
 #define K2_CSRC_RNNT_DECODE_H_
 
 #include <algorithm>
+#include <map>
 #include <memory>
+#include <utility>
 #include <vector>
 
 #include "k2/csrc/array.h"
@@ -111,6 +113,69 @@ struct ArcInfo {
   int32_t dest_state;
 };
 
+/* Looks up log-probs given as a ragged array of candidate symbols per
+   context, see the sparse version of RnntDecodingStreams::Advance().
+   Symbols that are not candidates get a log-prob of `missing` (i.e. -inf).
+   It has the same interface as Array2Accessor<float>, so the code of
+   Advance() can be shared.
+ */
+struct SparseLogprobsAccessor {
+  // row_splits of the [context][candidate] array
+  const int32_t *row_splits;
+  // The candidate symbols, sorted within each context.
+  const int32_t *symbols;
+  // The log-prob of each candidate.
+  const float *logprobs;
+  float missing;
+
+  __host__ __device__ __forceinline__ float operator()(int32_t context,
+                                                       int32_t symbol) const {
+    int32_t begin = row_splits[context], end = row_splits[context + 1];
+    // binary search for `symbol` in symbols[begin..end-1]
+    while (begin < end) {
+      int32_t mid = (begin + end) / 2;
+      if (symbols[mid] < symbol)
+        begin = mid + 1;
+      else
+        end = mid;
+    }
+    if (begin < row_splits[context + 1] && symbols[begin] == symbol)
+      return logprobs[begin];
+    return missing;
+  }
+};
+
+/* Adds the scores of an external language model, scaled by `lm_scale`, to
+   the log-probs given by `logprobs_acc` (either accessor above), for all
+   symbols but the termination symbol 0; see
+   RnntDecodingStreams::SetLmScores().
+ */
+template <typename LogprobsAccessor>
+struct LmFusedLogprobsAccessor {
+  LogprobsAccessor logprobs_acc;
+  // The LM scores, indexed [unique_context][symbol].
+  ConstArray2Accessor<float> lm_scores_acc;
+  // Maps the contexts to the rows of the LM scores.
+  const int32_t *context_map;
+  float lm_scale;
+
+  LmFusedLogprobsAccessor(const LogprobsAccessor &logprobs_acc,
+                          const ConstArray2Accessor<float> &lm_scores_acc,
+                          const int32_t *context_map, float lm_scale)
+      : logprobs_acc(logprobs_acc),
+        lm_scores_acc(lm_scores_acc),
+        context_map(context_map),
+        lm_scale(lm_scale) {}
+
+  __host__ __device__ __forceinline__ float operator()(int32_t context,
+                                                       int32_t symbol) const {
+    float ans = logprobs_acc(context, symbol);
+    if (symbol != 0)
+      ans += lm_scale * lm_scores_acc(context_map[context], symbol);
+    return ans;
+  }
+};
+
 struct RnntDecodingStream {
   // `graph` is a pointer to the FSA (decoding graph) that we are decoding this
   // stream with.  Different streams might have different graphs.  This must
@@ -124,17 +189,34 @@ struct RnntDecodingStream {
   //    state_idx = context_state * num_graph_states + graph_state.
   // `states` would be indexed
   // [context_state][state], i.e. the states are grouped first
-  // by context_state (they are sorted, to make this possible).
+  // by context_state (see RnntDecodingStreams::GroupStatesByContexts()).
   Ragged<int64_t> states;
 
-  // `scores` contains the forward scores of the states in `states`;
-  // it has the same shape as `states`.
-  Ragged<double> scores;
+  // `scores` contains the forward scores of the states in `states`, relative
+  // to the best state of the stream on the last decoded frame (so the best
+  // score is 0); it has the same shape as `states`.
+  Ragged<float> scores;
 
   // frames contains the arc information, for previously decoded
   // frames, that we can later use to create a lattice.
   // It contains Ragged<ArcInfo> with 2 axes (state, arc).
   std::vector<std::shared_ptr<Ragged<ArcInfo>>> prev_frames;
+
+  // prev_best_arcs[t] contains, for each state on frame t + 1 (indexed
+  // [context][state] like `states`), the index into prev_frames[t]->values of
+  // its best incoming arc, i.e. back-pointers for the best path.
+  std::vector<std::shared_ptr<Ragged<int32_t>>> prev_best_arcs;
+
+  // The number of frames (in prev_frames) for which the best path has already
+  // been output by RnntDecodingStreams::GetFinalizedBestPath(); every
+  // surviving state traces back to the state `finalized_state` on this frame.
+  int32_t num_finalized_frames = 0;
+  int32_t finalized_state = 0;
+
+  // The number of frames removed from the front of prev_frames by
+  // CompactPrevFrames(); frame t of prev_frames is frame
+  // t + num_dropped_frames of the stream.
+  int32_t num_dropped_frames = 0;
 };
 
 class RnntDecodingStreams {
@@ -160,6 +242,44 @@ class RnntDecodingStreams {
   */
   void GetContexts(RaggedShape *shape, Array2<int32_t> *contexts);
 
+  /* Like GetContexts(), but each distinct context over all the streams is
+     output only once, for evaluating an external language model (LM) for
+     shallow fusion without duplicate forward passes; see SetLmScores().  The
+     LM is thus conditioned on the same `decoder_history_len` symbols as the
+     decoder.
+
+       @param [out] unique_contexts  An array of shape
+                      [num_unique_contexts][decoder_history_len], containing
+                      the distinct rows of the `contexts` output by
+                      GetContexts(), will be written to here.
+       @param [out] context_map  An array with
+                      context_map->Dim() == States().TotSize(1), mapping each
+                      context (as output by GetContexts()) to its row in
+                      `unique_contexts`, will be written to here.  Its
+                      values serve as the LM state ids of the contexts.
+  */
+  void GetUniqueContexts(Array2<int32_t> *unique_contexts,
+                         Array1<int32_t> *context_map);
+
+  /* Set the scores of an external language model to be added to the
+     log-probs on the next call to Advance() (either version) only, for
+     shallow fusion.  The score of each arc with a symbol other than the
+     termination symbol 0 becomes
+       logprob + lm_scale * lm_scores(context_map[context], symbol),
+     so the LM scores take part in the pruning and are included in the
+     output lattice.
+
+       @param [in] lm_scores  Array of shape
+                    [num_unique_contexts][vocab_size], containing the LM
+                    scores of the symbols given the `unique_contexts` output
+                    by GetUniqueContexts().
+       @param [in] context_map  The `context_map` output by
+                    GetUniqueContexts().
+       @param [in] lm_scale  The scale of the LM scores, e.g. 0.3.
+   */
+  void SetLmScores(const Array2<float> &lm_scores,
+                   const Array1<int32_t> &context_map, float lm_scale);
+
   /*
     Advance decoding streams by one frame.
 
@@ -170,6 +290,26 @@ class RnntDecodingStreams {
    */
   void Advance(const Array2<float> &logprobs);
 
+  /*
+    Advance decoding streams by one frame, given log-probs for only some of
+    the symbols of each context (e.g. the top-k from the joiner), so that the
+    full [tot_contexts][vocab_size] matrix need not be computed or
+    transferred.  Symbols that are not candidates of a context are treated as
+    having a log-prob of -infinity, i.e. the arcs with them are pruned.
+
+      @param [in] symbols  Ragged array with 2 axes, indexed
+                    [context][candidate], with
+                    symbols.Dim0() == states_.TotSize(1) (i.e. the contexts
+                    output by `GetContexts()`), containing the candidate
+                    symbols (`0 <= value < vocab_size`) of each context, with
+                    no repeats.  They do not need to be sorted.  Each context
+                    must include the termination symbol 0, so that every
+                    state has an arc with a finite score.
+      @param [in] logprobs  The log-probs of the candidates in `symbols`;
+                    must have the same shape as `symbols`.
+   */
+  void Advance(const Ragged<int32_t> &symbols, const Ragged<float> &logprobs);
+
   /*
     Generate the lattice.
 
@@ -198,6 +338,28 @@ class RnntDecodingStreams {
   void FormatOutput(const std::vector<int32_t> &num_frames, bool allow_partial,
                     FsaVec *ofsa, Array1<int32_t> *out_map);
 
+  /*
+    Get the part of the best path of each stream that has become final since
+    the last call, for emitting partial results incrementally.  A frame is
+    final once all the surviving states of the stream trace back to the same
+    state on it, since no later frame can change the path before that point.
+    Only the frames since the last call (and until the paths converge) are
+    visited, so the cost does not grow with the length of the stream, and no
+    lattice is created.
+
+    Like FormatOutput(), this must be called after
+    TerminateAndFlushToStreams().
+
+      @param [out] best_path  A ragged array with 2 axes, indexed
+                     [stream][arc], will be written to here.  It contains the
+                     idx01 into the graph of each stream of the arcs on the
+                     newly finalized part of the best path, in order; the
+                     implicit epsilon self-loops (i.e. the termination
+                     symbol) and final arcs are not included.  The symbols
+                     can be obtained from the graph, e.g. from its aux_labels.
+   */
+  void GetFinalizedBestPath(Ragged<int32_t> *best_path);
+
   /*
     Terminate the decoding process of current RnntDecodingStreams object, it
     will update the states & scores of each individual stream and split &
@@ -209,13 +371,37 @@ class RnntDecodingStreams {
    */
   void TerminateAndFlushToStreams();
 
+  /*
+    Detach the stream in slot `slot` (i.e. srcs[slot] as passed to the
+    constructor, or the stream attached there by AttachStream()) while the
+    others keep decoding: like TerminateAndFlushToStreams() for this stream
+    only, its states and scores, and the frames decoded since it was
+    attached, are flushed to it.  The flushed frames share memory with
+    those of this object rather than being copied.
+
+    The slot is left empty (with no contexts or states, so GetContexts()
+    returns an empty list for it) until a stream is attached to it.
+    FormatOutput() can't be called while there are empty slots.
+   */
+  void DetachStream(int32_t slot);
+
+  /*
+    Attach `stream` to the empty slot `slot`, e.g. one emptied by
+    DetachStream(); it is decoded from the next call to Advance() on.  Only
+    this stream's states are copied into the batch, so streams can join and
+    leave without re-creating this object for all of them.
+   */
+  void AttachStream(int32_t slot, std::shared_ptr<RnntDecodingStream> stream);
+
   const ContextPtr &Context() const { return c_; }
   const Ragged<int64_t> &States() const { return states_; }
-  const Ragged<double> &Scores() const { return scores_; }
+  const Ragged<float> &Scores() const { return scores_; }
   const Array1<int32_t> &NumGraphStates() const { return num_graph_states_; }
   int32_t NumStreams() const { return num_streams_; }
+  // Returns the number of distinct graphs among the streams.
+  int32_t NumGraphs() const { return graphs_.NumSrcs(); }
 
-  // Note: The following three functions should be private members, they are not
+  // Note: The following four functions should be private members, they are not
   // expected to be called outside this class. We make it public because of the
   // extended lambda restrictions, see
   // https://docs.nvidia.com/cuda/cuda-c-programming-guide/#extended-lambda-restrictions
@@ -252,54 +438,88 @@ class RnntDecodingStreams {
 
       @param [in] unprund_arcs_shape   The RaggedShape returned by
                                        `ExpandArcs()`.
-      @param [in] logprobs  Array of shape [tot_contexts][num_symbols],
-                    containing log-probs of symbols given the contexts output
-                    by `GetContexts()`. Will satisfy
-                    logprobs.Dim0() == states_.TotSize(1).
-                    (Note: states_.ToSize(1) == unprund_arcs_shape.Tosize(1)).
+      @param [in] logprobs_acc  Returns the log-prob of a symbol given the
+                    context, as `logprobs_acc(context, symbol)`, where context
+                    is an idx01 into states_ (note: states_.ToSize(1) ==
+                    unprund_arcs_shape.Tosize(1)).  It is either the
+                    Array2Accessor of the dense log-probs or a
+                    SparseLogprobsAccessor, see the two versions of
+                    `Advance()`.
 
       @return Return the renumbering object indicating which arc will be kept.
    */
+  template <typename LogprobsAccessor>
   Renumbering DoFisrtPassPruning(RaggedShape &unprund_arcs_shape,
-                                 const Array2<float> &logprobs);
+                                 const LogprobsAccessor &logprobs_acc);
   /*
      Group states by contexts.
 
-     `states` has a shape of [stream][arc], it contains the sorted values
-     (per stream) which is:
-     `state = context_state * num_graph_states + graph_state`, this guarantees
-     the context_states of the states are sorted too. So that we can easily
-     separate these states by finding the boundaries of context_states.
+     `states` has a shape of [stream][arc], its values are:
+     `state = context_state * num_graph_states + graph_state`.  We reorder
+     the arcs of each stream so that arcs with the same context_state are
+     contiguous, and within those, arcs with the same state are contiguous.
 
      Note: Actually we will group the states by contexts and states, because
            we need a shape of [stream][context][state][arc], obviously the
            sub-lists along axis -1 contains same values.
 
+     Contexts are assigned ids with a hash keyed on (stream, context_state)
+     (and states likewise on (stream, state)), so within a stream contexts
+     and states appear in order of their first arc rather than sorted by
+     value.  If the packed keys would not fit in 63 bits we fall back to
+     sorting `states`, see GroupSortedStatesByContexts().
+
      Here is an example: suppose vocab_size=10, num_graph_states=10,
      decoder_history_len=2, we have a states like:
 
-     [ [ 112 120 123 125 345 345 ] [ 123 124 567 568 670 ] ]
+     [ [ 345 120 112 123 345 125 ] [ 123 567 124 670 568 ] ]
 
      the context_states are (context_state = state / num_graph_states):
 
-     [ [ 11 12 12 12 34 34 ] [ 12 12 56 56 67 ] ]
+     [ [ 34 12 11 12 34 12 ] [ 12 56 12 67 56 ] ]
 
      It will finally be grouped into ([stream][context][state][arc]):
 
-     [ [ [ [ 112 ] ] [ [ 120 ] [ 123 ] [ 125 ] ] [ [ 345 345 ] ] ]
+     [ [ [ [ 345 345 ] ] [ [ 120 ] [ 123 ] [ 125 ] ] [ [ 112 ] ] ]
        [ [ [ 123 ] [ 124 ] ] [ [ 567 ] [ 568 ] ] [ [ 670 ] ] ] ]
 
      Caution: This function is intended to be used in `Advance()` only.
 
-     @param [in] states  A two axes ragged tensor with each sub-list **sorted**.
+     @param [in,out] states  A two axes ragged tensor; at exit its values are
+                         reordered to match the returned shape.
+     @param [out] new2old  At exit, the new2old map of that reordering, i.e.
+                         `states.values(out) == states.values(in)[*new2old]`.
 
      @return  Return RaggedShape with 4 axes (i.e.[stream][context][state][arc])
               it satisfies `ans.NumElements() == states.NumElements()` and
               `ans.Dim0() == states.Dim0()`.
    */
-  RaggedShape GroupStatesByContexts(Ragged<int64_t> &states);
+  RaggedShape GroupStatesByContexts(Ragged<int64_t> &states,
+                                    Array1<int32_t> *new2old);
+
+  /*
+     The version of GroupStatesByContexts() for when each sub-list of `states`
+     is already **sorted**; that guarantees the context_states of the states
+     are sorted too, so we can separate the contexts and states by finding
+     their boundaries.
+   */
+  RaggedShape GroupSortedStatesByContexts(Ragged<int64_t> &states);
+
+  /* Does the work of `Advance()`, for either format of the log-probs; see
+     DoFisrtPassPruning() for the meaning of `logprobs_acc`.
+
+     Caution: This function is intended to be used in `Advance()` only.
+   */
+  template <typename LogprobsAccessor>
+  void AdvanceInternal(const LogprobsAccessor &logprobs_acc);
 
  private:
+  /* Calls AdvanceInternal(), with the LM scores set by SetLmScores() added
+     to the log-probs if there are any.
+   */
+  template <typename LogprobsAccessor>
+  void AdvanceWithLmScores(const LogprobsAccessor &logprobs_acc);
+
   /*
   Prune the incoming scores based on beam, max-states and max-contexts.
   Actually the beam part is not really necessary, as we already pruned
@@ -315,8 +535,8 @@ class RnntDecodingStreams {
    Returns: pruned array of incoming scores, indexed
       [stream][context][state][arc].
  */
-  Ragged<double> PruneTwice(Ragged<double> &incoming_scores,
-                            Array1<int32_t> *arcs_new2old);
+  Ragged<float> PruneTwice(Ragged<float> &incoming_scores,
+                           Array1<int32_t> *arcs_new2old);
 
   /*
     Gather all previously decoded frames until now, we need all the previous
@@ -334,6 +554,19 @@ class RnntDecodingStreams {
    */
   void GatherPrevFrames(const std::vector<int32_t> &num_frames);
 
+  /*
+    Return the index into unique_graphs_ of `graph`, appending it to
+    unique_graphs_ if it is not already there, in which case graphs_ must be
+    rebuilt by the caller.
+   */
+  int32_t AddGraph(const Fsa &graph);
+
+  /*
+    Set graph_indexes_ and num_graph_states_ from slot_graph_indexes_, and
+    also graphs_ from unique_graphs_ if `rebuild_graphs` is true.
+   */
+  void UpdateGraphs(bool rebuild_graphs);
+
   ContextPtr c_;
 
   bool attached_;  // A flag indicating whether this streams is still attached,
@@ -343,20 +576,41 @@ class RnntDecodingStreams {
 
   int32_t num_streams_;  // The number of RnntDecodingStream
 
-  // RnntDecodingStream pointers.
+  // RnntDecodingStream pointers, indexed by slot; nullptr for empty slots.
   std::vector<std::shared_ptr<RnntDecodingStream>> srcs_;
 
+  // The distinct graphs of the streams, in order of first appearance. Graphs
+  // are identified by the data pointers of their arcs and row_splits, since
+  // streams sharing a graph usually hold distinct Fsa objects that refer to
+  // the same memory.
+  std::vector<Fsa> unique_graphs_;
+  std::map<std::pair<const Arc *, const int32_t *>, int32_t> graph_map_;
+
+  // The index into unique_graphs_ of the graph of each slot (for empty slots,
+  // that of the last stream there).
+  std::vector<int32_t> slot_graph_indexes_;
+
+  // The index into prev_frames_ of the first frame decoded by the stream in
+  // each slot, i.e. the number of frames decoded when it was attached.
+  std::vector<int32_t> attach_frame_;
+
   // The configuration object.
   const RnntDecodingConfig config_;
 
-  // array of the individual graphs of the streams, with graphs.NumSrcs() ==
-  // number of streams. All the graphs might actually be the same.
+  // array of the distinct graphs of the streams, i.e. of unique_graphs_,
+  // with graphs_.NumSrcs() <= number of streams.
   Array1OfRagged<Arc> graphs_;
 
-  // Number of graph states, per graph; this is used in constructing:
+  // graph_indexes_[i] is the index into graphs_ of the graph of stream i,
+  // this is a copy of slot_graph_indexes_ on c_.
+  Array1<int32_t> graph_indexes_;
+
+  // Number of graph states, per stream; this is used in constructing:
   //   state_idx = context_state * num_graph_states + graph_state.
   // for elements of `states`.
   Array1<int32_t> num_graph_states_;
+  // The largest element of num_graph_states_, kept on the host.
+  int32_t max_num_graph_states_ = 0;
 
   // `states` contains int64_t which represents the decoder state; this is:
   //   state = context_state * num_graph_states + graph_state.
@@ -365,18 +619,32 @@ class RnntDecodingStreams {
   //
   // `states` is indexed [stream][context_state][state], i.e.
   // i.e. the states are grouped first
-  // by context_state (they are sorted, to make this possible).
+  // by context_state (see GroupStatesByContexts()).
   Ragged<int64_t> states_;
 
-  // `scores` contains the forward scores of the states in `states`;
-  // it has the same shape as `states`.
-  Ragged<double> scores_;
+  // `scores` contains the forward scores of the states in `states`,
+  // relative to the best-scoring state of the same stream; it has the same
+  // shape as `states`.  Because they are renormalized on every frame their
+  // magnitude is bounded by about the beam, so float is precise enough, see
+  // Advance().
+  Ragged<float> scores_;
 
   // frames contains the arc information for previously decoded
   // frames, to be split and appended to the prev_frames of the
   // individual streams when we are done with this RnnDecodingStreams
   // object. These arrays are indexed [stream][state][arc].
   std::vector<std::shared_ptr<Ragged<ArcInfo>>> prev_frames_;
+
+  // The back-pointers of the best path for prev_frames_, indexed
+  // [stream][context][state], see RnntDecodingStream::prev_best_arcs.
+  std::vector<std::shared_ptr<Ragged<int32_t>>> prev_best_arcs_;
+
+  // The LM scores set by SetLmScores() for the next frame, if
+  // has_lm_scores_ is true.
+  bool has_lm_scores_ = false;
+  Array2<float> lm_scores_;
+  Array1<int32_t> lm_context_map_;
+  float lm_scale_ = 0.0f;
 };
 
 /* Create a new decoding stream.
@@ -394,6 +662,26 @@ class RnntDecodingStreams {
 std::shared_ptr<RnntDecodingStream> CreateStream(
     const std::shared_ptr<Fsa> &graph);
 
+/* Bound the memory used by the decoded frames of a stream, e.g. for streams
+   that never end.  Finalized frames (see
+   RnntDecodingStreams::GetFinalizedBestPath()) that are at least `horizon`
+   frames older than the last one are removed from stream->prev_frames,
+   except for the most recent of them, which is collapsed to the single arc
+   that all the surviving states trace back to.  So the memory stays bounded
+   if GetFinalizedBestPath() and this are called regularly.
+
+   CAUTION: the lattices that FormatOutput() creates afterwards start with
+   that arc, and only cover the frames still in prev_frames; `num_frames`
+   passed to it counts those frames.
+
+     @param [in] horizon  The number of most recent frames that are always
+                    kept; must be >= 0.
+     @param [in,out] stream  The stream to compact.  It must not be part of a
+                    RnntDecodingStreams that is still being decoded (i.e.
+                    TerminateAndFlushToStreams() must have been called).
+ */
+void CompactPrevFrames(int32_t horizon, RnntDecodingStream *stream);
+
 }  // namespace rnnt_decoding
 }  // namespace k2
 
@@ -18,10 +18,16 @@
 
 #include <gtest/gtest.h>
 
+#include <algorithm>
+#include <limits>
+#include <memory>
+#include <vector>
+
 #include "k2/csrc/fsa.h"
 #include "k2/csrc/fsa_algo.h"
 #include "k2/csrc/fsa_utils.h"
 #include "k2/csrc/macros.h"
+#include "k2/csrc/ragged_ops.h"
 #include "k2/csrc/rnnt_decode.h"
 
 namespace k2 {
@@ -33,7 +39,7 @@ TEST(RnntDecodeStream, CreateRnntDecodeStream) {
     auto stream = CreateStream(graph);
     K2_CHECK(Equal(*graph, *(stream->graph)));
     K2_CHECK(Equal(stream->states, Ragged<int64_t>(c, "[[0]]")));
-    K2_CHECK(Equal(stream->scores, Ragged<double>(c, "[[0]]")));
+    K2_CHECK(Equal(stream->scores, Ragged<float>(c, "[[0]]")));
     K2_CHECK_EQ(stream->num_graph_states, graph->Dim0());
   }
 }
@@ -89,6 +95,14 @@ TEST(RnntDecodingStreams, Basic) {
           Array2<float>(probs.values, context_shape.NumElements(), vocab_size);
 
       streams.Advance(logprobs);
+
+      // The scores are relative to the best state of each stream.
+      Ragged<float> scores = streams.Scores();
+      scores = scores.RemoveAxis(1);
+      Array1<float> best_scores(c, num_streams);
+      MaxPerSublist(scores, -std::numeric_limits<float>::infinity(),
+                    &best_scores);
+      K2_CHECK(Equal(best_scores, Array1<float>(c, num_streams, 0.0f)));
     }
     streams.TerminateAndFlushToStreams();
 
@@ -113,6 +127,471 @@ TEST(RnntDecodingStreams, Basic) {
     }
   }
 }
+
+TEST(RnntDecodingStreams, SparseLogprobs) {
+  for (auto c : {GetCpuContext(), GetCudaContext()}) {
+    int32_t vocab_size = 6, num_streams = 3, steps = 5;
+    auto config =
+        RnntDecodingConfig(vocab_size, 2 /*decoder_history_len*/, 5.0f /*beam*/,
+                           8 /*max_states*/, 4 /*max_contexts*/);
+
+    Array1<int32_t> aux_labels;
+    auto ctc_topo = std::make_shared<Fsa>(CtcTopo(c, 5, false, &aux_labels));
+    std::vector<std::shared_ptr<RnntDecodingStream>> dense_vec(num_streams),
+        sparse_vec(num_streams);
+    for (int32_t i = 0; i < num_streams; ++i) {
+      dense_vec[i] = CreateStream(ctc_topo);
+      sparse_vec[i] = CreateStream(ctc_topo);
+    }
+    auto dense_streams = RnntDecodingStreams(dense_vec, config);
+    auto sparse_streams = RnntDecodingStreams(sparse_vec, config);
+
+    for (int32_t i = 0; i < steps; ++i) {
+      RaggedShape context_shape;
+      Array2<int32_t> context;
+      dense_streams.GetContexts(&context_shape, &context);
+      int32_t num_contexts = context_shape.NumElements();
+
+      auto probs = Ragged<float>(
+          RegularRaggedShape(c, num_contexts, vocab_size),
+          RandUniformArray1<float>(c, num_contexts * vocab_size, 0, 1));
+      probs = NormalizePerSublist<float>(probs, false /*use_log*/);
+      ApplyLog(probs);
+      auto logprobs = Array2<float>(probs.values, num_contexts, vocab_size);
+      dense_streams.Advance(logprobs);
+
+      // All the symbols but in reverse order, so it has to sort them.
+      Ragged<int32_t> symbols(probs.shape);
+      Ragged<float> sparse_logprobs(probs.shape);
+      int32_t *symbols_data = symbols.values.Data();
+      float *sparse_logprobs_data = sparse_logprobs.values.Data();
+      const float *probs_data = probs.values.Data();
+      K2_EVAL(
+          c, num_contexts * vocab_size, lambda_reverse, (int32_t i) {
+            int32_t row = i / vocab_size,
+                    symbol = vocab_size - 1 - i % vocab_size;
+            symbols_data[i] = symbol;
+            sparse_logprobs_data[i] = probs_data[row * vocab_size + symbol];
+          });
+      sparse_streams.Advance(symbols, sparse_logprobs);
+
+      K2_CHECK(Equal(dense_streams.States(), sparse_streams.States()));
+      K2_CHECK(Equal(dense_streams.Scores(), sparse_streams.Scores()));
+    }
+
+    // With only some of the symbols (always including 0), it still runs and
+    // produces a valid lattice.
+    for (int32_t i = 0; i < steps; ++i) {
+      RaggedShape context_shape;
+      Array2<int32_t> context;
+      sparse_streams.GetContexts(&context_shape, &context);
+      int32_t num_contexts = context_shape.NumElements();
+      Ragged<int32_t> symbols(RegularRaggedShape(c, num_contexts, 2));
+      Ragged<float> sparse_logprobs(symbols.shape);
+      int32_t *symbols_data = symbols.values.Data();
+      float *sparse_logprobs_data = sparse_logprobs.values.Data();
+      K2_EVAL(
+          c, num_contexts * 2, lambda_set_candidates, (int32_t i) {
+            symbols_data[i] = (i % 2 == 0 ? 0 : 1 + (i / 2) % (vocab_size - 1));
+            sparse_logprobs_data[i] = -1.0f;
+          });
+      sparse_streams.Advance(symbols, sparse_logprobs);
+    }
+    sparse_streams.TerminateAndFlushToStreams();
+
+    Array1<int32_t> out_map;
+    FsaVec ofsa;
+    sparse_streams.FormatOutput(std::vector<int32_t>(num_streams, 2 * steps),
+                                true /*allow_partial*/, &ofsa, &out_map);
+    Array1<int32_t> properties;
+    int32_t property;
+    GetFsaVecBasicProperties(ofsa, &properties, &property);
+    K2_CHECK(property & kFsaPropertiesValid);
+  }
+}
+
+TEST(RnntDecodingStreams, LmScores) {
+  for (auto c : {GetCpuContext(), GetCudaContext()}) {
+    int32_t vocab_size = 6, num_streams = 3, steps = 8;
+    float lm_scale = 0.5;
+    auto config =
+        RnntDecodingConfig(vocab_size, 2 /*decoder_history_len*/, 5.0f /*beam*/,
+                           8 /*max_states*/, 4 /*max_contexts*/);
+
+    Array1<int32_t> aux_labels;
+    auto ctc_topo = std::make_shared<Fsa>(CtcTopo(c, 5, false, &aux_labels));
+    std::vector<std::shared_ptr<RnntDecodingStream>> ref_vec(num_streams),
+        lm_vec(num_streams);
+    for (int32_t i = 0; i < num_streams; ++i) {
+      ref_vec[i] = CreateStream(ctc_topo);
+      lm_vec[i] = CreateStream(ctc_topo);
+    }
+    auto ref_streams = RnntDecodingStreams(ref_vec, config);
+    auto lm_streams = RnntDecodingStreams(lm_vec, config);
+
+    for (int32_t i = 0; i < steps; ++i) {
+      RaggedShape context_shape;
+      Array2<int32_t> contexts, unique_contexts;
+      Array1<int32_t> context_map;
+      lm_streams.GetContexts(&context_shape, &contexts);
+      lm_streams.GetUniqueContexts(&unique_contexts, &context_map);
+      int32_t num_contexts = context_shape.NumElements(),
+              num_unique = unique_contexts.Dim0();
+      ASSERT_EQ(context_map.Dim(), num_contexts);
+      EXPECT_LE(num_unique, num_contexts);
+      // All streams start with the same context.
+      if (i == 0) {
+        EXPECT_EQ(num_unique, 1);
+      }
+
+      // The unique contexts are distinct, and each context is mapped to a
+      // row with the same symbols.
+      Array2<int32_t> cpu_contexts = contexts.To(GetCpuContext()),
+                      cpu_unique_contexts = unique_contexts.To(GetCpuContext());
+      Array1<int32_t> cpu_context_map = context_map.To(GetCpuContext());
+      auto contexts_acc = cpu_contexts.Accessor(),
+           unique_acc = cpu_unique_contexts.Accessor();
+      for (int32_t j = 0; j < num_contexts; ++j)
+        for (int32_t k = 0; k < config.decoder_history_len; ++k)
+          EXPECT_EQ(contexts_acc(j, k), unique_acc(cpu_context_map[j], k));
+      for (int32_t j = 1; j < num_unique; ++j) {
+        bool same = true;
+        for (int32_t k = 0; k < config.decoder_history_len; ++k)
+          same = same && unique_acc(j, k) == unique_acc(j - 1, k);
+        EXPECT_FALSE(same);
+      }
+
+      auto probs = Ragged<float>(
+          RegularRaggedShape(c, num_contexts, vocab_size),
+          RandUniformArray1<float>(c, num_contexts * vocab_size, 0, 1));
+      probs = NormalizePerSublist<float>(probs, false /*use_log*/);
+      ApplyLog(probs);
+      auto logprobs = Array2<float>(probs.values, num_contexts, vocab_size);
+      Array1<float> lm_scores_values =
+          RandUniformArray1<float>(c, num_unique * vocab_size, -5, 0);
+      Array2<float> lm_scores(lm_scores_values, num_unique, vocab_size);
+
+      // The reference adds the LM scores to the log-probs itself.
+      Array2<float> fused_logprobs(c, num_contexts, vocab_size);
+      auto fused_acc = fused_logprobs.Accessor();
+      auto logprobs_acc = logprobs.Accessor();
+      auto lm_scores_acc = lm_scores.Accessor();
+      const int32_t *context_map_data = context_map.Data();
+      K2_EVAL2(
+          c, num_contexts, vocab_size, lambda_fuse, (int32_t i, int32_t j) {
+            float score = logprobs_acc(i, j);
+            if (j != 0)
+              score += lm_scale * lm_scores_acc(context_map_data[i], j);
+            fused_acc(i, j) = score;
+          });
+      ref_streams.Advance(fused_logprobs);
+
+      lm_streams.SetLmScores(lm_scores, context_map, lm_scale);
+      lm_streams.Advance(logprobs);
+
+      K2_CHECK(Equal(ref_streams.States(), lm_streams.States()));
+      K2_CHECK(Equal(ref_streams.Scores(), lm_streams.Scores()));
+    }
+
+    // The LM scores only apply to one frame.
+    RaggedShape context_shape;
+    Array2<int32_t> contexts;
+    lm_streams.GetContexts(&context_shape, &contexts);
+    int32_t num_contexts = context_shape.NumElements();
+    Array2<float> logprobs(c, num_contexts, vocab_size);
+    logprobs = -1.0f;
+    ref_streams.Advance(logprobs);
+    lm_streams.Advance(logprobs);
+    K2_CHECK(Equal(ref_streams.States(), lm_streams.States()));
+  }
+}
+
+TEST(RnntDecodingStreams, GetFinalizedBestPath) {
+  for (auto c : {GetCpuContext(), GetCudaContext()}) {
+    int32_t vocab_size = 6, num_streams = 3, num_chunks = 4, chunk_size = 3;
+    auto config =
+        RnntDecodingConfig(vocab_size, 2 /*decoder_history_len*/, 5.0f /*beam*/,
+                           8 /*max_states*/, 4 /*max_contexts*/);
+
+    Array1<int32_t> aux_labels;
+    auto ctc_topo = std::make_shared<Fsa>(CtcTopo(c, 5, false, &aux_labels));
+    std::vector<std::shared_ptr<RnntDecodingStream>> streams_vec(num_streams);
+    for (int32_t i = 0; i < num_streams; ++i)
+      streams_vec[i] = CreateStream(ctc_topo);
+
+    // Decode in chunks, as for streaming, getting the finalized part of the
+    // best path after each chunk.
+    std::vector<std::vector<int32_t>> finalized(num_streams);
+    std::unique_ptr<RnntDecodingStreams> streams;
+    for (int32_t n = 0; n < num_chunks; ++n) {
+      streams = std::make_unique<RnntDecodingStreams>(streams_vec, config);
+      for (int32_t i = 0; i < chunk_size; ++i) {
+        RaggedShape context_shape;
+        Array2<int32_t> context;
+        streams->GetContexts(&context_shape, &context);
+        int32_t num_contexts = context_shape.NumElements();
+        auto probs = Ragged<float>(
+            RegularRaggedShape(c, num_contexts, vocab_size),
+            RandUniformArray1<float>(c, num_contexts * vocab_size, 0, 1));
+        probs = NormalizePerSublist<float>(probs, false /*use_log*/);
+        ApplyLog(probs);
+        streams->Advance(
+            Array2<float>(probs.values, num_contexts, vocab_size));
+      }
+      streams->TerminateAndFlushToStreams();
+
+      Ragged<int32_t> best_path;
+      streams->GetFinalizedBestPath(&best_path);
+      EXPECT_EQ(best_path.Dim0(), num_streams);
+      best_path = best_path.To(GetCpuContext());
+      for (int32_t i = 0; i < num_streams; ++i) {
+        const int32_t *row_splits1_data = best_path.RowSplits(1).Data();
+        finalized[i].insert(finalized[i].end(),
+                            best_path.values.Data() + row_splits1_data[i],
+                            best_path.values.Data() + row_splits1_data[i + 1]);
+        EXPECT_LE(streams_vec[i]->num_finalized_frames, (n + 1) * chunk_size);
+      }
+
+      // Nothing more is final until we decode more frames.
+      streams->GetFinalizedBestPath(&best_path);
+      EXPECT_EQ(best_path.NumElements(), 0);
+    }
+
+    // The finalized arcs are a prefix of the best path of the whole
+    // lattice.
+    Array1<int32_t> out_map;
+    FsaVec ofsa;
+    streams->FormatOutput(
+        std::vector<int32_t>(num_streams, num_chunks * chunk_size),
+        true /*allow_partial*/, &ofsa, &out_map);
+    Ragged<int32_t> state_batches = GetStateBatches(ofsa, true);
+    Array1<int32_t> dest_states = GetDestStates(ofsa, true);
+    Ragged<int32_t> incoming_arcs = GetIncomingArcs(ofsa, dest_states);
+    Ragged<int32_t> entering_arc_batches =
+        GetEnteringArcIndexBatches(ofsa, incoming_arcs, state_batches);
+    Array1<int32_t> entering_arcs;
+    GetForwardScores<double>(ofsa, state_batches, entering_arc_batches,
+                             false /*log_semiring*/, &entering_arcs);
+    Ragged<int32_t> lattice_path = ShortestPath(ofsa, entering_arcs);
+    lattice_path.values = out_map[lattice_path.values];
+    lattice_path = lattice_path.To(GetCpuContext());
+    for (int32_t i = 0; i < num_streams; ++i) {
+      std::vector<int32_t> expected;
+      const int32_t *row_splits1_data = lattice_path.RowSplits(1).Data();
+      for (int32_t j = row_splits1_data[i]; j < row_splits1_data[i + 1]; ++j) {
+        int32_t graph_arc = lattice_path.values[j];
+        if (graph_arc != -1) expected.push_back(graph_arc);
+      }
+      ASSERT_LE(finalized[i].size(), expected.size());
+      EXPECT_TRUE(std::equal(finalized[i].begin(), finalized[i].end(),
+                             expected.begin()));
+    }
+  }
+}
+
+TEST(RnntDecodingStreams, CompactPrevFrames) {
+  for (auto c : {GetCpuContext(), GetCudaContext()}) {
+    int32_t vocab_size = 6, num_streams = 2, num_chunks = 8, chunk_size = 3,
+            horizon = 2;
+    auto config =
+        RnntDecodingConfig(vocab_size, 2 /*decoder_history_len*/, 5.0f /*beam*/,
+                           8 /*max_states*/, 4 /*max_contexts*/);
+
+    Array1<int32_t> aux_labels;
+    auto ctc_topo = std::make_shared<Fsa>(CtcTopo(c, 5, false, &aux_labels));
+    // streams_vec[0] is compacted, streams_vec[1] is not; they are decoded
+    // with the same log-probs.
+    std::vector<std::vector<std::shared_ptr<RnntDecodingStream>>> streams_vec(
+        2, std::vector<std::shared_ptr<RnntDecodingStream>>(num_streams));
+    for (int32_t k = 0; k < 2; ++k)
+      for (int32_t i = 0; i < num_streams; ++i)
+        streams_vec[k][i] = CreateStream(ctc_topo);
+
+    std::unique_ptr<RnntDecodingStreams> streams[2];
+    for (int32_t n = 0; n < num_chunks; ++n) {
+      for (int32_t k = 0; k < 2; ++k)
+        streams[k] =
+            std::make_unique<RnntDecodingStreams>(streams_vec[k], config);
+      for (int32_t i = 0; i < chunk_size; ++i) {
+        RaggedShape context_shape;
+        Array2<int32_t> context;
+        streams[0]->GetContexts(&context_shape, &context);
+        int32_t num_contexts = context_shape.NumElements();
+        auto probs = Ragged<float>(
+            RegularRaggedShape(c, num_contexts, vocab_size),
+            RandUniformArray1<float>(c, num_contexts * vocab_size, 0, 1));
+        probs = NormalizePerSublist<float>(probs, false /*use_log*/);
+        ApplyLog(probs);
+        Array2<float> logprobs(probs.values, num_contexts, vocab_size);
+        for (int32_t k = 0; k < 2; ++k) streams[k]->Advance(logprobs);
+      }
+      Ragged<int32_t> best_path[2];
+      for (int32_t k = 0; k < 2; ++k) {
+        streams[k]->TerminateAndFlushToStreams();
+        streams[k]->GetFinalizedBestPath(&best_path[k]);
+      }
+      K2_CHECK(Equal(best_path[0], best_path[1]));
+
+      for (int32_t i = 0; i < num_streams; ++i) {
+        RnntDecodingStream &stream = *streams_vec[0][i];
+        CompactPrevFrames(horizon, &stream);
+        int32_t num_frames = static_cast<int32_t>(stream.prev_frames.size());
+        EXPECT_EQ(num_frames + stream.num_dropped_frames, (n + 1) * chunk_size);
+        EXPECT_EQ(stream.prev_best_arcs.size(), stream.prev_frames.size());
+        // The frames are dropped once they are final and older than
+        // `horizon`.
+        EXPECT_LE(num_frames,
+                  std::max(horizon, num_frames - stream.num_finalized_frames) +
+                      1);
+      }
+    }
+
+    // The lattice of what is left is still valid.
+    Array1<int32_t> out_map;
+    FsaVec ofsa;
+    std::vector<int32_t> num_frames(num_streams);
+    for (int32_t i = 0; i < num_streams; ++i)
+      num_frames[i] = streams_vec[0][i]->prev_frames.size();
+    streams[0]->FormatOutput(num_frames, true /*allow_partial*/, &ofsa,
+                             &out_map);
+    Array1<int32_t> properties;
+    int32_t property;
+    GetFsaVecBasicProperties(ofsa, &properties, &property);
+    K2_CHECK(property & kFsaPropertiesValid);
+  }
+}
+
+TEST(RnntDecodingStreams, AttachDetach) {
+  for (auto c : {GetCpuContext(), GetCudaContext()}) {
+    int32_t vocab_size = 6, num_streams = 3;
+    auto config =
+        RnntDecodingConfig(vocab_size, 2 /*decoder_history_len*/, 5.0f /*beam*/,
+                           8 /*max_states*/, 4 /*max_contexts*/);
+
+    Array1<int32_t> aux_labels;
+    auto ctc_topo = std::make_shared<Fsa>(CtcTopo(c, 5, false, &aux_labels));
+    auto trivial_graph = std::make_shared<Fsa>(TrivialGraph(c, 5, &aux_labels));
+    std::vector<std::shared_ptr<RnntDecodingStream>> streams_vec(num_streams);
+    for (int32_t i = 0; i < num_streams; ++i)
+      streams_vec[i] = CreateStream(ctc_topo);
+    RnntDecodingStreams streams(streams_vec, config);
+
+    auto advance = [&](RnntDecodingStreams &streams, int32_t num_frames) {
+      for (int32_t t = 0; t < num_frames; ++t) {
+        RaggedShape context_shape;
+        Array2<int32_t> context;
+        streams.GetContexts(&context_shape, &context);
+        int32_t num_contexts = context_shape.NumElements();
+        auto probs = Ragged<float>(
+            RegularRaggedShape(c, num_contexts, vocab_size),
+            RandUniformArray1<float>(c, num_contexts * vocab_size, 0, 1));
+        probs = NormalizePerSublist<float>(probs, false /*use_log*/);
+        ApplyLog(probs);
+        streams.Advance(Array2<float>(probs.values, num_contexts, vocab_size));
+      }
+    };
+
+    advance(streams, 3);
+    Ragged<int64_t> states = streams.States();
+    Ragged<int64_t> expected_states = Arange(states, 0, 1, 2).RemoveAxis(0);
+    streams.DetachStream(1);
+    EXPECT_EQ(streams_vec[1]->prev_frames.size(), 3u);
+    K2_CHECK(Equal(streams_vec[1]->states, expected_states));
+    EXPECT_EQ(streams.States().Dim0(), num_streams);
+    states = streams.States();
+    EXPECT_EQ(Arange(states, 0, 1, 2).NumElements(), 0);
+
+    // The other streams keep decoding, then a new stream joins.
+    advance(streams, 2);
+    auto new_stream = CreateStream(trivial_graph);
+    streams.AttachStream(1, new_stream);
+    advance(streams, 2);
+    streams.TerminateAndFlushToStreams();
+
+    EXPECT_EQ(streams_vec[0]->prev_frames.size(), 7u);
+    EXPECT_EQ(streams_vec[1]->prev_frames.size(), 3u);
+    EXPECT_EQ(new_stream->prev_frames.size(), 2u);
+    EXPECT_EQ(streams_vec[2]->prev_frames.size(), 7u);
+
+    Array1<int32_t> out_map;
+    FsaVec ofsa;
+    streams.FormatOutput({7, 2, 7}, true /*allow_partial*/, &ofsa, &out_map);
+    Array1<int32_t> properties;
+    int32_t property;
+    GetFsaVecBasicProperties(ofsa, &properties, &property);
+    K2_CHECK(property & kFsaPropertiesValid);
+
+    // The detached stream can continue in another batch.
+    std::vector<std::shared_ptr<RnntDecodingStream>> resumed_vec(
+        {streams_vec[1]});
+    RnntDecodingStreams resumed(resumed_vec, config);
+    advance(resumed, 2);
+    resumed.TerminateAndFlushToStreams();
+    EXPECT_EQ(streams_vec[1]->prev_frames.size(), 5u);
+    resumed.FormatOutput({5}, true /*allow_partial*/, &ofsa, &out_map);
+    GetFsaVecBasicProperties(ofsa, &properties, &property);
+    K2_CHECK(property & kFsaPropertiesValid);
+  }
+}
+
+TEST(RnntDecodingStreams, SharedGraphs) {
+  for (auto c : {GetCpuContext(), GetCudaContext()}) {
+    int32_t vocab_size = 6, num_streams = 4;
+    auto config =
+        RnntDecodingConfig(vocab_size, 2 /*decoder_history_len*/, 5.0f /*beam*/,
+                           8 /*max_states*/, 4 /*max_contexts*/);
+
+    Array1<int32_t> aux_labels;
+    Fsa ctc_topo = CtcTopo(c, 5, false, &aux_labels);
+    Fsa trivial_graph = TrivialGraph(c, 5, &aux_labels);
+
+    // Streams 0, 2 and 3 share the same graph memory through distinct Fsa
+    // objects; `cloned` gives every stream its own copy of the graph.
+    std::vector<std::shared_ptr<RnntDecodingStream>> shared_vec(num_streams),
+        cloned_vec(num_streams);
+    for (int32_t i = 0; i < num_streams; ++i) {
+      Fsa &graph = (i == 1 ? trivial_graph : ctc_topo);
+      shared_vec[i] = CreateStream(std::make_shared<Fsa>(graph));
+      cloned_vec[i] = CreateStream(std::make_shared<Fsa>(graph.Clone()));
+    }
+    RnntDecodingStreams shared(shared_vec, config),
+        cloned(cloned_vec, config);
+    EXPECT_EQ(shared.NumGraphs(), 2);
+    EXPECT_EQ(cloned.NumGraphs(), num_streams);
+
+    for (int32_t t = 0; t < 5; ++t) {
+      RaggedShape context_shape, cloned_context_shape;
+      Array2<int32_t> context, cloned_context;
+      shared.GetContexts(&context_shape, &context);
+      cloned.GetContexts(&cloned_context_shape, &cloned_context);
+      K2_CHECK(Equal(context_shape, cloned_context_shape));
+      int32_t num_contexts = context_shape.NumElements();
+      auto probs = Ragged<float>(
+          RegularRaggedShape(c, num_contexts, vocab_size),
+          RandUniformArray1<float>(c, num_contexts * vocab_size, 0, 1));
+      probs = NormalizePerSublist<float>(probs, false /*use_log*/);
+      ApplyLog(probs);
+      Array2<float> logprobs(probs.values, num_contexts, vocab_size);
+      shared.Advance(logprobs);
+      cloned.Advance(logprobs);
+      K2_CHECK(Equal(shared.States(), cloned.States()));
+    }
+
+    // Attaching a stream that uses an already known graph does not add one.
+    shared.DetachStream(2);
+    shared.AttachStream(2, CreateStream(std::make_shared<Fsa>(trivial_graph)));
+    EXPECT_EQ(shared.NumGraphs(), 2);
+    shared.DetachStream(3);
+    shared.AttachStream(3, CreateStream(std::make_shared<Fsa>(
+                               trivial_graph.Clone())));
+    EXPECT_EQ(shared.NumGraphs(), 3);
+    EXPECT_EQ(shared.NumGraphStates()[3], trivial_graph.Dim0());
+
+    cloned.TerminateAndFlushToStreams();
+    for (int32_t i = 0; i < num_streams; ++i)
+      EXPECT_EQ(cloned_vec[i]->prev_frames.size(), 5u);
+  }
+}
 }  // namespace rnnt_decoding
 
 }  // namespace k2
@@ -0,0 +1,62 @@
+/**
+ * Copyright      2026  Xiaomi Corporation
+ *
+ * See LICENSE for clarification regarding multiple authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <cstring>
+
+#include "k2/csrc/device_guard.h"
+#include "k2/csrc/scalar_readback.h"
+
+namespace k2 {
+
+constexpr int32_t ScalarReadback::kBlockSize;
+
+ScalarReadback::ScalarReadback(ContextPtr c) : c_(c) {}
+
+ScalarReadback::~ScalarReadback() {
+  // Copies into the pinned blocks must finish before they are freed.
+  Sync();
+}
+
+int32_t ScalarReadback::AddInternal(const void *src, std::size_t num_bytes) {
+  NVTX_RANGE(K2_FUNC);
+  int32_t handle = num_scalars_++;
+  if (handle % kBlockSize == 0)
+    blocks_.emplace_back(GetContextForTransfer(c_->GetDeviceType()),
+                         kBlockSize);
+  int64_t *dst = blocks_.back().Data() + handle % kBlockSize;
+  if (c_->GetDeviceType() == kCpu) {
+    std::memcpy(dst, src, num_bytes);
+    num_synced_ = num_scalars_;
+  } else {
+    K2_CHECK_EQ(c_->GetDeviceType(), kCuda);
+    DeviceGuard guard(c_);
+    K2_CHECK_CUDA_ERROR(cudaMemcpyAsync(dst, src, num_bytes,
+                                        cudaMemcpyDeviceToHost,
+                                        c_->GetCudaStream()));
+  }
+  return handle;
+}
+
+void ScalarReadback::Sync() {
+  NVTX_RANGE(K2_FUNC);
+  if (num_synced_ == num_scalars_) return;
+  c_->Sync();
+  num_synced_ = num_scalars_;
+}
+
+}  // namespace k2
@@ -0,0 +1,109 @@
+/**
+ * Copyright      2026  Xiaomi Corporation
+ *
+ * See LICENSE for clarification regarding multiple authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef K2_CSRC_SCALAR_READBACK_H_
+#define K2_CSRC_SCALAR_READBACK_H_
+
+#include <cstring>
+#include <type_traits>
+#include <vector>
+
+#include "k2/csrc/array.h"
+#include "k2/csrc/context.h"
+
+namespace k2 {
+
+/*
+  Reads several elements of device arrays back to the host with a single
+  stream synchronization, instead of one synchronous copy per element as
+  `array.Back()` or `array[i]` do.  Example:
+
+    ScalarReadback r(c);
+    int32_t tot_arcs = r.AddBack(arc_row_splits),
+        tot_states = r.AddBack(state_row_splits);
+    r.Sync();
+    Array1<Arc> arcs(c, r.Get<int32_t>(tot_arcs));
+    ...
+
+  Each Add() queues an asynchronous copy of the element, as it is at that
+  point in the stream, into pinned memory; Sync() waits for all of them.
+  On CPU the elements are read directly and Sync() does nothing.
+  Not thread-safe.
+*/
+class ScalarReadback {
+ public:
+  explicit ScalarReadback(ContextPtr c);
+  ScalarReadback(const ScalarReadback &) = delete;
+  ScalarReadback &operator=(const ScalarReadback &) = delete;
+  ~ScalarReadback();
+
+  /* Queue a read of `src[i]`; returns a handle for Get().  `src` must be
+     on the context passed to the constructor and T at most 8 bytes. */
+  template <typename T>
+  int32_t Add(const Array1<T> &src, int32_t i) {
+    static_assert(sizeof(T) <= sizeof(int64_t) &&
+                      std::is_trivially_copyable<T>::value,
+                  "Only scalars of up to 8 bytes are supported");
+    K2_CHECK(c_->IsCompatible(*src.Context()));
+    K2_CHECK_GE(i, 0);
+    K2_CHECK_LT(i, src.Dim());
+    return AddInternal(src.Data() + i, sizeof(T));
+  }
+
+  // Queue a read of the last element of `src`, which must be nonempty.
+  template <typename T>
+  int32_t AddBack(const Array1<T> &src) {
+    return Add(src, src.Dim() - 1);
+  }
+
+  // Wait for all reads queued so far.  May be called more than once.
+  void Sync();
+
+  /* Return the value read for `handle`, as returned by Add().  Requires
+     that Sync() has been called after that Add(). */
+  template <typename T>
+  T Get(int32_t handle) const {
+    K2_CHECK_LT(handle, num_synced_) << "Call Sync() first";
+    T ans;
+    std::memcpy(&ans, SlotPtr(handle), sizeof(T));
+    return ans;
+  }
+
+  int32_t NumScalars() const { return num_scalars_; }
+
+ private:
+  static constexpr int32_t kBlockSize = 32;  // number of slots per block
+
+  int32_t AddInternal(const void *src, std::size_t num_bytes);
+
+  const int64_t *SlotPtr(int32_t handle) const {
+    return blocks_[handle / kBlockSize].Data() + handle % kBlockSize;
+  }
+
+  ContextPtr c_;
+  // Each scalar is copied to its own 8-byte slot.  Blocks are allocated in
+  // pinned memory as needed and never reallocated, as copies to them may be
+  // pending.
+  std::vector<Array1<int64_t>> blocks_;
+  int32_t num_scalars_ = 0;
+  int32_t num_synced_ = 0;
+};
+
+}  // namespace k2
+
+#endif  // K2_CSRC_SCALAR_READBACK_H_
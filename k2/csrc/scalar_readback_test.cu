@@ -0,0 +1,64 @@
+/**
+ * Copyright      2026  Xiaomi Corporation
+ *
+ * See LICENSE for clarification regarding multiple authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "k2/csrc/array_ops.h"
+#include "k2/csrc/op_stats.h"
+#include "k2/csrc/scalar_readback.h"
+#include "k2/csrc/test_utils.h"
+
+namespace k2 {
+
+TEST(ScalarReadbackTest, Basic) {
+  for (auto &c : {GetCpuContext(), GetCudaContext()}) {
+    Array1<int32_t> a = Range(c, 100, 0);
+    Array1<float> b(c, std::vector<float>{0.5, 1.5, -2.0});
+    Array1<int64_t> d(c, std::vector<int64_t>{int64_t(1) << 40});
+
+    ScalarReadback r(c);
+    std::vector<int32_t> handles;
+    // more than one block of slots
+    for (int32_t i = 0; i != 100; ++i) handles.push_back(r.Add(a, i));
+    int32_t b_handle = r.AddBack(b), d_handle = r.Add(d, 0);
+    EXPECT_EQ(r.NumScalars(), 102);
+
+    ResetOpStats();
+    EnableOpStats();
+    r.Sync();
+    r.Sync();  // nothing to wait for
+    EnableOpStats(false);
+    int64_t num_syncs = 0;
+    for (const auto &p : GetOpStats()) num_syncs += p.second.num_syncs;
+    EXPECT_EQ(num_syncs, c->GetDeviceType() == kCpu ? 0 : 1);
+
+    for (int32_t i = 0; i != 100; ++i)
+      EXPECT_EQ(r.Get<int32_t>(handles[i]), i);
+    EXPECT_EQ(r.Get<float>(b_handle), -2.0);
+    EXPECT_EQ(r.Get<int64_t>(d_handle), int64_t(1) << 40);
+
+    // The value is read as of the time of Add().
+    int32_t handle = r.Add(a, 5);
+    a = 0;
+    r.Sync();
+    EXPECT_EQ(r.Get<int32_t>(handle), 5);
+  }
+}
+
+}  // namespace k2
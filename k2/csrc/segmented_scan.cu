@@ -0,0 +1,148 @@
+/**
+ * Copyright      2026  Xiaomi Corporation
+ *
+ * See LICENSE for clarification regarding multiple authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "k2/csrc/cub.h"
+#include "k2/csrc/eval.h"
+#include "k2/csrc/log.h"
+#include "k2/csrc/macros.h"
+#include "k2/csrc/nvtx.h"
+#include "k2/csrc/segmented_scan.h"
+
+namespace k2 {
+
+namespace {
+
+constexpr int32_t kSegmentedScanBlockSize = 256;
+constexpr int32_t kSegmentedScanItemsPerThread = 4;
+constexpr int32_t kSegmentedScanTileSize =
+    kSegmentedScanBlockSize * kSegmentedScanItemsPerThread;
+
+// The key is the number of sub-lists that start in the range scanned, so
+// ReduceBySegmentOp restarts the sum of the values at each sub-list.
+template <typename T>
+using SegmentedScanPair = cub::KeyValuePair<int32_t, T>;
+template <typename T>
+using SegmentedScanTileState = cub::ScanTileState<SegmentedScanPair<T>>;
+using SegmentedScanOp = cub::ReduceBySegmentOp<cub::Sum>;
+
+template <typename T>
+__global__ void InitSegmentedScanTileStateKernel(
+    SegmentedScanTileState<T> tile_state, int32_t num_tiles) {
+  tile_state.InitializeStatus(num_tiles);
+}
+
+/*
+  Each block scans a tile of kSegmentedScanTileSize elements, and gets the
+  (number of sub-lists started, sum since the last start) of the elements
+  before its tile from the preceding tiles by decoupled look-back.
+ */
+template <typename T>
+__global__ void SegmentedExclusiveSumKernel(
+    int32_t num_elements, const T *in, const int32_t *row_splits,
+    const int32_t *row_ids, SegmentedScanTileState<T> tile_state, T *out) {
+  using PairT = SegmentedScanPair<T>;
+  using BlockScanT = cub::BlockScan<PairT, kSegmentedScanBlockSize>;
+  using PrefixOpT = cub::TilePrefixCallbackOp<PairT, SegmentedScanOp,
+                                              SegmentedScanTileState<T>>;
+  __shared__ typename PrefixOpT::TempStorage prefix_storage;
+  __shared__ typename BlockScanT::TempStorage scan_storage;
+
+  SegmentedScanOp op;
+  int32_t tile_idx = blockIdx.x,
+          begin = tile_idx * kSegmentedScanTileSize +
+                  threadIdx.x * kSegmentedScanItemsPerThread;
+  PairT items[kSegmentedScanItemsPerThread], thread_total(0, T(0));
+  for (int32_t k = 0; k < kSegmentedScanItemsPerThread; ++k) {
+    int32_t i = begin + k;
+    // Read all the inputs before writing any output, as `in` may be `out`.
+    if (i < num_elements)
+      items[k] = PairT(row_splits[row_ids[i]] == i, in[i]);
+    else
+      items[k] = PairT(0, T(0));
+    thread_total = op(thread_total, items[k]);
+  }
+
+  PairT prefix;
+  if (tile_idx == 0) {
+    PairT tile_total;
+    BlockScanT(scan_storage)
+        .ExclusiveScan(thread_total, prefix, PairT(0, T(0)), op, tile_total);
+    if (threadIdx.x == 0 && gridDim.x > 1)
+      tile_state.SetInclusive(0, tile_total);
+  } else {
+    PrefixOpT prefix_op(tile_state, prefix_storage, op, tile_idx);
+    BlockScanT(scan_storage).ExclusiveScan(thread_total, prefix, op,
+                                           prefix_op);
+  }
+
+  for (int32_t k = 0; k < kSegmentedScanItemsPerThread; ++k) {
+    int32_t i = begin + k;
+    if (i >= num_elements) break;
+    out[i] = (items[k].key ? T(0) : prefix.value);
+    prefix = op(prefix, items[k]);
+  }
+}
+
+}  // namespace
+
+template <typename T>
+void SegmentedExclusiveSum(ContextPtr context, const T *in,
+                           int32_t num_elements, const int32_t *row_splits,
+                           const int32_t *row_ids, T *out) {
+  NVTX_RANGE(K2_FUNC);
+  K2_CHECK_EQ(context->GetDeviceType(), kCuda);
+  if (num_elements == 0) return;
+  cudaStream_t stream = context->GetCudaStream();
+  int32_t num_tiles = NumBlocks(num_elements, kSegmentedScanTileSize);
+  SegmentedScanTileState<T> tile_state;
+  size_t tile_state_bytes = 0;
+  K2_CUDA_SAFE_CALL(
+      SegmentedScanTileState<T>::AllocationSize(num_tiles, tile_state_bytes));
+  RegionPtr tile_state_storage = NewRegion(context, tile_state_bytes);
+  K2_CUDA_SAFE_CALL(tile_state.Init(num_tiles, tile_state_storage->data,
+                                    tile_state_bytes));
+  int32_t num_init_blocks = NumBlocks(num_tiles, kSegmentedScanBlockSize);
+  K2_CUDA_SAFE_CALL(
+      InitSegmentedScanTileStateKernel<T><<<num_init_blocks,
+                                            kSegmentedScanBlockSize, 0,
+                                            stream>>>(tile_state, num_tiles));
+  K2_CUDA_SAFE_CALL(
+      SegmentedExclusiveSumKernel<T><<<num_tiles, kSegmentedScanBlockSize, 0,
+                                       stream>>>(num_elements, in, row_splits,
+                                                 row_ids, tile_state, out));
+}
+
+template void SegmentedExclusiveSum<int32_t>(ContextPtr context,
+                                             const int32_t *in,
+                                             int32_t num_elements,
+                                             const int32_t *row_splits,
+                                             const int32_t *row_ids,
+                                             int32_t *out);
+template void SegmentedExclusiveSum<float>(ContextPtr context, const float *in,
+                                           int32_t num_elements,
+                                           const int32_t *row_splits,
+                                           const int32_t *row_ids,
+                                           float *out);
+template void SegmentedExclusiveSum<double>(ContextPtr context,
+                                            const double *in,
+                                            int32_t num_elements,
+                                            const int32_t *row_splits,
+                                            const int32_t *row_ids,
+                                            double *out);
+
+}  // namespace k2
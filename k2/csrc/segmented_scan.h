@@ -0,0 +1,54 @@
+/**
+ * Copyright      2026  Xiaomi Corporation
+ *
+ * See LICENSE for clarification regarding multiple authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef K2_CSRC_SEGMENTED_SCAN_H_
+#define K2_CSRC_SEGMENTED_SCAN_H_
+
+#include <cstdint>
+
+#include "k2/csrc/context.h"
+
+namespace k2 {
+
+/* Exclusive sum per sub-list on GPU, i.e. the CUDA implementation of
+   SegmentedExclusiveSum(Ragged<T> &, Array1<T> *).  It is a single-pass scan
+   with decoupled look-back, over (is-first-in-sub-list, value) pairs, so
+   the sum is restarted at each sub-list and there is no roundoff from
+   subtracting prefix sums.  Instantiated for int32_t, float and double.
+
+   @param [in] context A CUDA context. `in`, `out`, `row_splits` and
+                       `row_ids` should be allocated by this context.
+   @param [in] in  Pointer to the input array, with `num_elements` elements.
+                   CAUTION: the last element of each sub-list does not
+                   contribute to the sum.
+   @param [in] num_elements  Number of elements in the input array.
+   @param [in] row_splits  The row_splits of the last axis of the ragged
+                   tensor whose values are `in`.
+   @param [in] row_ids  The row_ids of the last axis of the ragged tensor
+                   whose values are `in`.
+   @param [out] out  Pointer to the output array, with `num_elements`
+                   elements.  May be the same as `in`.
+ */
+template <typename T>
+void SegmentedExclusiveSum(ContextPtr context, const T *in,
+                           int32_t num_elements, const int32_t *row_splits,
+                           const int32_t *row_ids, T *out);
+
+}  // namespace k2
+
+#endif  // K2_CSRC_SEGMENTED_SCAN_H_
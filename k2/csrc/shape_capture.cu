@@ -0,0 +1,158 @@
+/**
+ * Copyright      2026  Xiaomi Corporation
+ *
+ * See LICENSE for clarification regarding multiple authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <cstdlib>
+#include <fstream>
+#include <mutex>  // NOLINT
+#include <sstream>
+#include <unordered_map>
+#include <utility>
+
+#include "k2/csrc/log.h"
+#include "k2/csrc/shape_capture.h"
+
+namespace k2 {
+
+namespace internal {
+
+std::atomic<bool> g_shape_capture_enabled(false);
+
+}  // namespace internal
+
+namespace {
+
+struct ShapeCaptureFile {
+  std::mutex mutex;
+  std::ofstream os;
+  int32_t max_records_per_op = -1;
+  // Keyed by the address of the op name, like the OpStats.
+  std::unordered_map<const char *, int32_t> num_records;
+};
+
+ShapeCaptureFile &GetCaptureFile() {
+  static ShapeCaptureFile file;
+  return file;
+}
+
+// Starts capturing if K2_SHAPE_CAPTURE is set.
+struct ShapeCaptureFromEnv {
+  ShapeCaptureFromEnv() {
+    const char *filename = std::getenv("K2_SHAPE_CAPTURE");
+    if (filename != nullptr) StartShapeCapture(filename);
+  }
+};
+
+ShapeCaptureFromEnv shape_capture_from_env;
+
+}  // namespace
+
+void StartShapeCapture(const std::string &filename,
+                       int32_t max_records_per_op /*= 1000*/) {
+  ShapeCaptureFile &file = GetCaptureFile();
+  std::lock_guard<std::mutex> lock(file.mutex);
+  if (file.os.is_open()) file.os.close();
+  file.os.open(filename, std::ios::trunc);
+  K2_CHECK(file.os) << "Failed to open " << filename;
+  file.max_records_per_op = max_records_per_op;
+  file.num_records.clear();
+  internal::g_shape_capture_enabled.store(true, std::memory_order_relaxed);
+}
+
+void StopShapeCapture() {
+  internal::g_shape_capture_enabled.store(false, std::memory_order_relaxed);
+  ShapeCaptureFile &file = GetCaptureFile();
+  std::lock_guard<std::mutex> lock(file.mutex);
+  if (file.os.is_open()) file.os.close();
+}
+
+namespace internal {
+
+void CaptureShape(const char *op, const RaggedShape &shape,
+                  const std::vector<int32_t> &sizes) {
+  ShapeCaptureFile &file = GetCaptureFile();
+  {
+    std::lock_guard<std::mutex> lock(file.mutex);
+    if (!file.os.is_open()) return;
+    int32_t &num_records = file.num_records[op];
+    if (file.max_records_per_op >= 0 &&
+        num_records >= file.max_records_per_op)
+      return;
+    ++num_records;
+  }
+
+  // The line is: op num_sizes sizes... num_axes, then for each axis > 0 the
+  // dim of its row_splits followed by the row_splits.
+  std::ostringstream os;
+  os << op << ' ' << sizes.size();
+  for (int32_t size : sizes) os << ' ' << size;
+  os << ' ' << shape.NumAxes();
+  ContextPtr cpu = GetCpuContext();
+  for (int32_t axis = 1; axis < shape.NumAxes(); ++axis) {
+    Array1<int32_t> row_splits = shape.RowSplits(axis).To(cpu);
+    const int32_t *row_splits_data = row_splits.Data();
+    os << ' ' << row_splits.Dim();
+    for (int32_t i = 0; i != row_splits.Dim(); ++i)
+      os << ' ' << row_splits_data[i];
+  }
+  os << '\n';
+
+  std::lock_guard<std::mutex> lock(file.mutex);
+  if (file.os.is_open()) file.os << os.str();
+}
+
+}  // namespace internal
+
+std::vector<CapturedShape> ReadCapturedShapes(const std::string &filename,
+                                              ContextPtr c) {
+  std::ifstream is(filename);
+  K2_CHECK(is) << "Failed to open " << filename;
+  ContextPtr cpu = GetCpuContext();
+  std::vector<CapturedShape> ans;
+  std::string line;
+  while (std::getline(is, line)) {
+    if (line.empty()) continue;
+    std::istringstream ss(line);
+    CapturedShape captured;
+    int32_t num_sizes, num_axes;
+    ss >> captured.op >> num_sizes;
+    K2_CHECK(ss && num_sizes >= 0)
+        << "Invalid line in " << filename << ": " << line;
+    captured.sizes.resize(num_sizes);
+    for (int32_t &size : captured.sizes) ss >> size;
+    ss >> num_axes;
+    K2_CHECK(ss && num_axes >= 2)
+        << "Invalid line in " << filename << ": " << line;
+    RaggedShapeLayers layers(num_axes - 1);
+    for (RaggedShapeLayer &layer : layers) {
+      int32_t dim;
+      ss >> dim;
+      K2_CHECK(ss && dim >= 1)
+          << "Invalid line in " << filename << ": " << line;
+      std::vector<int32_t> row_splits(dim);
+      for (int32_t &r : row_splits) ss >> r;
+      K2_CHECK(ss) << "Invalid line in " << filename << ": " << line;
+      layer.row_splits = Array1<int32_t>(cpu, row_splits).To(c);
+      layer.cached_tot_size = row_splits.back();
+    }
+    captured.shape = RaggedShape(std::move(layers));
+    ans.push_back(std::move(captured));
+  }
+  return ans;
+}
+
+}  // namespace k2
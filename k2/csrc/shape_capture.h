@@ -0,0 +1,100 @@
+/**
+ * Copyright      2026  Xiaomi Corporation
+ *
+ * See LICENSE for clarification regarding multiple authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+  Opt-in capture of the shapes seen by selected ragged ops during a real run,
+  e.g. a decode, so that the benchmarks can replay them (see
+  k2/csrc/benchmark/ragged_ops_benchmark.cu) instead of random shapes, which
+  look nothing like, say, the skewed state/arc shapes of real lattices.
+
+  While capturing, each call of one of the ops below appends a line with the
+  name of the op, a few sizes and its input shape to a file.  The row splits
+  are copied to the CPU for that, so capturing slows things down a lot; it is
+  disabled by default and costs one relaxed atomic load per call when
+  disabled.  It can be started with StartShapeCapture(), or by setting the
+  environment variable K2_SHAPE_CAPTURE to the name of the file.
+
+  The ops, and the sizes recorded for them, are:
+
+     "Index"                    Index(RaggedShape &src, axis, indexes):
+                                {axis, indexes.Dim()}
+     "GetTransposeReordering"   {num_cols}
+     "RemoveEmptyLists"         {axis}
+     "SegmentedReduce"          {}, for MaxPerSublist(), SumPerSublist()
+                                and the like.
+ */
+
+#ifndef K2_CSRC_SHAPE_CAPTURE_H_
+#define K2_CSRC_SHAPE_CAPTURE_H_
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "k2/csrc/context.h"
+#include "k2/csrc/ragged.h"
+
+namespace k2 {
+
+/* Start writing the shapes to `filename`, which is truncated, stopping any
+   capture in progress.  At most `max_records_per_op` calls of each op are
+   written (the first ones), which keeps the file to a manageable size for a
+   long decode; a negative value means no limit.
+ */
+void StartShapeCapture(const std::string &filename,
+                       int32_t max_records_per_op = 1000);
+
+// Stops capturing and closes the file; does nothing if not capturing.
+void StopShapeCapture();
+
+struct CapturedShape {
+  std::string op;              // e.g. "Index"; see the top of this file
+  std::vector<int32_t> sizes;  // the sizes recorded for `op`
+  RaggedShape shape;
+};
+
+// Reads a file written while capturing, with the shapes on context `c`.
+std::vector<CapturedShape> ReadCapturedShapes(const std::string &filename,
+                                              ContextPtr c);
+
+namespace internal {
+
+extern std::atomic<bool> g_shape_capture_enabled;
+
+inline bool ShapeCaptureEnabled() {
+  return g_shape_capture_enabled.load(std::memory_order_relaxed);
+}
+
+// `op` must outlive the program, e.g. a string literal.
+void CaptureShape(const char *op, const RaggedShape &shape,
+                  const std::vector<int32_t> &sizes);
+
+}  // namespace internal
+
+// Called from the ops listed at the top of this file; a no-op unless
+// capturing.
+inline void CaptureShape(const char *op, const RaggedShape &shape,
+                         const std::vector<int32_t> &sizes = {}) {
+  if (internal::ShapeCaptureEnabled())
+    internal::CaptureShape(op, shape, sizes);
+}
+
+}  // namespace k2
+
+#endif  // K2_CSRC_SHAPE_CAPTURE_H_
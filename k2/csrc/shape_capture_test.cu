@@ -0,0 +1,63 @@
+/**
+ * Copyright      2026  Xiaomi Corporation
+ *
+ * See LICENSE for clarification regarding multiple authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <gtest/gtest.h>
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "k2/csrc/array.h"
+#include "k2/csrc/context.h"
+#include "k2/csrc/ragged_ops.h"
+#include "k2/csrc/shape_capture.h"
+#include "k2/csrc/test_utils.h"
+
+namespace k2 {
+
+TEST(ShapeCapture, CaptureAndRead) {
+  std::string filename = ::testing::TempDir() + "k2_shape_capture_test.txt";
+  for (auto &c : {GetCpuContext(), GetCudaContext()}) {
+    RaggedShape shape(c, "[ [ [ x x ] [ ] ] [ [ x ] ] [ [ x x x ] ] ]");
+    Array1<int32_t> indexes(c, std::vector<int32_t>{2, 0});
+    Ragged<float> ragged(c, "[ [ 1 2 ] [ ] [ 3 ] ]");
+    Array1<float> max_values(c, 3);
+
+    StartShapeCapture(filename, 2);
+    for (int32_t i = 0; i != 3; ++i) Index(shape, 0, indexes);  // 2 kept
+    MaxPerSublist(ragged, 0.0f, &max_values);
+    StopShapeCapture();
+    Index(shape, 0, indexes);  // not captured
+
+    std::vector<CapturedShape> captured = ReadCapturedShapes(filename, c);
+    ASSERT_EQ(captured.size(), 3);
+    for (int32_t i = 0; i != 2; ++i) {
+      EXPECT_EQ(captured[i].op, "Index");
+      EXPECT_EQ(captured[i].sizes, (std::vector<int32_t>{0, 2}));
+      EXPECT_EQ(captured[i].shape.Context()->GetDeviceType(),
+                c->GetDeviceType());
+      EXPECT_TRUE(Equal(captured[i].shape, shape));
+    }
+    EXPECT_EQ(captured[2].op, "SegmentedReduce");
+    EXPECT_TRUE(captured[2].sizes.empty());
+    EXPECT_TRUE(Equal(captured[2].shape, ragged.shape));
+  }
+  std::remove(filename.c_str());
+}
+
+}  // namespace k2
@@ -0,0 +1,533 @@
+/**
+ * Copyright      2026  Xiaomi Corporation
+ *
+ * See LICENSE for clarification regarding multiple authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "k2/csrc/simd_reduce.h"
+
+#include <algorithm>
+#include <cmath>
+
+#if (defined(__x86_64__) || defined(_M_X64)) && \
+    (defined(__GNUC__) || defined(__clang__))
+#define K2_SIMD_REDUCE_X86 1
+#include <immintrin.h>
+#define K2_TARGET_AVX2 __attribute__((target("avx2,fma")))
+#define K2_TARGET_AVX512 __attribute__((target("avx512f")))
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#define K2_SIMD_REDUCE_NEON 1
+#include <arm_neon.h>
+#endif
+
+namespace k2 {
+
+namespace {
+
+// Constants for computing exp(x), from Cephes' expf() and exp().  The
+// argument is split as x = n * log(2) + r, with |r| <= log(2) / 2, and
+// exp(r) is approximated by a polynomial (float) or a Pade approximant
+// (double).  Inputs below kExpMin*, where the result would be a denormal,
+// give 0; this is fine for a sum of exponentials.
+constexpr float kExpMinF = -87.3365447505531f;  // log(2^-126)
+constexpr float kLog2eF = 1.44269504088896341f;
+constexpr float kLn2HiF = 0.693359375f;
+constexpr float kLn2LoF = -2.12194440e-4f;
+constexpr float kExpP0F = 1.9875691500e-4f;
+constexpr float kExpP1F = 1.3981999507e-3f;
+constexpr float kExpP2F = 8.3334519073e-3f;
+constexpr float kExpP3F = 4.1665795894e-2f;
+constexpr float kExpP4F = 1.6666665459e-1f;
+constexpr float kExpP5F = 5.0000001201e-1f;
+
+constexpr double kExpMinD = -708.3964185322641;  // log(2^-1022)
+constexpr double kLog2eD = 1.4426950408889634073599;
+constexpr double kLn2HiD = 6.93145751953125e-1;
+constexpr double kLn2LoD = 1.42860682030941723212e-6;
+constexpr double kExpP0D = 1.26177193074810590878e-4;
+constexpr double kExpP1D = 3.02994407707441961300e-2;
+constexpr double kExpP2D = 9.99999999999999999910e-1;
+constexpr double kExpQ0D = 3.00198505138664455042e-6;
+constexpr double kExpQ1D = 2.52448340349684104192e-3;
+constexpr double kExpQ2D = 2.27265548208155028766e-1;
+constexpr double kExpQ3D = 2.00000000000000000009e0;
+
+// The per-sublist kernels for one instruction set.  All the inputs of
+// sum_exp() are <= max, as max is the result of max() on the same sublist.
+template <typename T>
+struct RowKernels {
+  // Returns the max of initial_value and x[0] ... x[n-1].
+  T (*max)(const T *x, int32_t n, T initial_value);
+  // Returns the sum of exp(x[i] - max) for 0 <= i < n; max is finite.
+  T (*sum_exp)(const T *x, int32_t n, T max);
+};
+
+template <typename T>
+T RowMaxScalar(const T *x, int32_t n, T ans) {
+  // The same comparison as MaxOp, so that NaNs are treated alike.
+  for (int32_t i = 0; i < n; ++i) ans = (x[i] > ans ? x[i] : ans);
+  return ans;
+}
+
+template <typename T>
+T RowSumExpScalar(const T *x, int32_t n, T max) {
+  T sum = 0;
+  for (int32_t i = 0; i < n; ++i) sum += std::exp(x[i] - max);
+  return sum;
+}
+
+#ifdef K2_SIMD_REDUCE_X86
+
+K2_TARGET_AVX2 inline __m256 ExpAvx2(__m256 x) {
+  __m256 underflow = _mm256_cmp_ps(x, _mm256_set1_ps(kExpMinF), _CMP_LT_OQ);
+  x = _mm256_max_ps(x, _mm256_set1_ps(kExpMinF));
+  __m256 fx = _mm256_floor_ps(_mm256_fmadd_ps(x, _mm256_set1_ps(kLog2eF),
+                                              _mm256_set1_ps(0.5f)));
+  x = _mm256_fnmadd_ps(fx, _mm256_set1_ps(kLn2HiF), x);
+  x = _mm256_fnmadd_ps(fx, _mm256_set1_ps(kLn2LoF), x);
+  __m256 y = _mm256_set1_ps(kExpP0F);
+  y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(kExpP1F));
+  y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(kExpP2F));
+  y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(kExpP3F));
+  y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(kExpP4F));
+  y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(kExpP5F));
+  y = _mm256_fmadd_ps(y, _mm256_mul_ps(x, x),
+                      _mm256_add_ps(x, _mm256_set1_ps(1.0f)));
+  __m256i n = _mm256_add_epi32(_mm256_cvttps_epi32(fx),
+                               _mm256_set1_epi32(127));
+  y = _mm256_mul_ps(y, _mm256_castsi256_ps(_mm256_slli_epi32(n, 23)));
+  return _mm256_andnot_ps(underflow, y);
+}
+
+K2_TARGET_AVX2 inline __m256d ExpAvx2(__m256d x) {
+  __m256d underflow =
+      _mm256_cmp_pd(x, _mm256_set1_pd(kExpMinD), _CMP_LT_OQ);
+  x = _mm256_max_pd(x, _mm256_set1_pd(kExpMinD));
+  __m256d fx = _mm256_floor_pd(_mm256_fmadd_pd(x, _mm256_set1_pd(kLog2eD),
+                                               _mm256_set1_pd(0.5)));
+  x = _mm256_fnmadd_pd(fx, _mm256_set1_pd(kLn2HiD), x);
+  x = _mm256_fnmadd_pd(fx, _mm256_set1_pd(kLn2LoD), x);
+  __m256d xx = _mm256_mul_pd(x, x);
+  __m256d px = _mm256_fmadd_pd(_mm256_set1_pd(kExpP0D), xx,
+                               _mm256_set1_pd(kExpP1D));
+  px = _mm256_mul_pd(x, _mm256_fmadd_pd(px, xx, _mm256_set1_pd(kExpP2D)));
+  __m256d qx = _mm256_fmadd_pd(_mm256_set1_pd(kExpQ0D), xx,
+                               _mm256_set1_pd(kExpQ1D));
+  qx = _mm256_fmadd_pd(qx, xx, _mm256_set1_pd(kExpQ2D));
+  qx = _mm256_fmadd_pd(qx, xx, _mm256_set1_pd(kExpQ3D));
+  x = _mm256_div_pd(px, _mm256_sub_pd(qx, px));
+  x = _mm256_fmadd_pd(x, _mm256_set1_pd(2.0), _mm256_set1_pd(1.0));
+  // 2^52 + fx + 1023 has fx + 1023 in its low mantissa bits; shift them
+  // into the exponent to get 2^fx.
+  __m256d biased = _mm256_add_pd(fx, _mm256_set1_pd(4503599627370496.0 + 1023));
+  __m256i pow2n = _mm256_slli_epi64(_mm256_castpd_si256(biased), 52);
+  x = _mm256_mul_pd(x, _mm256_castsi256_pd(pow2n));
+  return _mm256_andnot_pd(underflow, x);
+}
+
+K2_TARGET_AVX2 float RowMaxAvx2(const float *x, int32_t n, float ans) {
+  int32_t i = 0;
+  if (n >= 8) {
+    __m256 m = _mm256_loadu_ps(x);
+    for (i = 8; i + 8 <= n; i += 8)
+      m = _mm256_max_ps(m, _mm256_loadu_ps(x + i));
+    alignas(32) float buf[8];
+    _mm256_store_ps(buf, m);
+    ans = RowMaxScalar(buf, 8, ans);
+  }
+  return RowMaxScalar(x + i, n - i, ans);
+}
+
+K2_TARGET_AVX2 double RowMaxAvx2(const double *x, int32_t n, double ans) {
+  int32_t i = 0;
+  if (n >= 4) {
+    __m256d m = _mm256_loadu_pd(x);
+    for (i = 4; i + 4 <= n; i += 4)
+      m = _mm256_max_pd(m, _mm256_loadu_pd(x + i));
+    alignas(32) double buf[4];
+    _mm256_store_pd(buf, m);
+    ans = RowMaxScalar(buf, 4, ans);
+  }
+  return RowMaxScalar(x + i, n - i, ans);
+}
+
+K2_TARGET_AVX2 float RowSumExpAvx2(const float *x, int32_t n, float max) {
+  int32_t i = 0;
+  float sum = 0;
+  if (n >= 8) {
+    __m256 m = _mm256_set1_ps(max), s = _mm256_setzero_ps();
+    for (; i + 8 <= n; i += 8)
+      s = _mm256_add_ps(s, ExpAvx2(_mm256_sub_ps(_mm256_loadu_ps(x + i), m)));
+    alignas(32) float buf[8];
+    _mm256_store_ps(buf, s);
+    for (int32_t j = 0; j < 8; ++j) sum += buf[j];
+  }
+  return sum + RowSumExpScalar(x + i, n - i, max);
+}
+
+K2_TARGET_AVX2 double RowSumExpAvx2(const double *x, int32_t n, double max) {
+  int32_t i = 0;
+  double sum = 0;
+  if (n >= 4) {
+    __m256d m = _mm256_set1_pd(max), s = _mm256_setzero_pd();
+    for (; i + 4 <= n; i += 4)
+      s = _mm256_add_pd(s, ExpAvx2(_mm256_sub_pd(_mm256_loadu_pd(x + i), m)));
+    alignas(32) double buf[4];
+    _mm256_store_pd(buf, s);
+    for (int32_t j = 0; j < 4; ++j) sum += buf[j];
+  }
+  return sum + RowSumExpScalar(x + i, n - i, max);
+}
+
+// The unmasked forms of some AVX-512 intrinsics pass an undefined vector
+// through, which g++ reports with -Wmaybe-uninitialized, so we use the
+// masked forms with all lanes set and an explicit pass-through.
+K2_TARGET_AVX512 inline __m512 MaxAvx512(__m512 a, __m512 b) {
+  return _mm512_mask_max_ps(a, 0xFFFF, a, b);
+}
+
+K2_TARGET_AVX512 inline __m512d MaxAvx512(__m512d a, __m512d b) {
+  return _mm512_mask_max_pd(a, 0xFF, a, b);
+}
+
+K2_TARGET_AVX512 inline __m512 ExpAvx512(__m512 x) {
+  __mmask16 keep =
+      _mm512_cmp_ps_mask(x, _mm512_set1_ps(kExpMinF), _CMP_GE_OQ);
+  x = MaxAvx512(x, _mm512_set1_ps(kExpMinF));
+  __m512 fx =
+      _mm512_fmadd_ps(x, _mm512_set1_ps(kLog2eF), _mm512_set1_ps(0.5f));
+  fx = _mm512_mask_roundscale_ps(fx, 0xFFFF, fx,
+                                 _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC);
+  x = _mm512_fnmadd_ps(fx, _mm512_set1_ps(kLn2HiF), x);
+  x = _mm512_fnmadd_ps(fx, _mm512_set1_ps(kLn2LoF), x);
+  __m512 y = _mm512_set1_ps(kExpP0F);
+  y = _mm512_fmadd_ps(y, x, _mm512_set1_ps(kExpP1F));
+  y = _mm512_fmadd_ps(y, x, _mm512_set1_ps(kExpP2F));
+  y = _mm512_fmadd_ps(y, x, _mm512_set1_ps(kExpP3F));
+  y = _mm512_fmadd_ps(y, x, _mm512_set1_ps(kExpP4F));
+  y = _mm512_fmadd_ps(y, x, _mm512_set1_ps(kExpP5F));
+  y = _mm512_fmadd_ps(y, _mm512_mul_ps(x, x),
+                      _mm512_add_ps(x, _mm512_set1_ps(1.0f)));
+  return _mm512_maskz_scalef_ps(keep, y, fx);
+}
+
+K2_TARGET_AVX512 inline __m512d ExpAvx512(__m512d x) {
+  __mmask8 keep =
+      _mm512_cmp_pd_mask(x, _mm512_set1_pd(kExpMinD), _CMP_GE_OQ);
+  x = MaxAvx512(x, _mm512_set1_pd(kExpMinD));
+  __m512d fx =
+      _mm512_fmadd_pd(x, _mm512_set1_pd(kLog2eD), _mm512_set1_pd(0.5));
+  fx = _mm512_mask_roundscale_pd(fx, 0xFF, fx,
+                                 _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC);
+  x = _mm512_fnmadd_pd(fx, _mm512_set1_pd(kLn2HiD), x);
+  x = _mm512_fnmadd_pd(fx, _mm512_set1_pd(kLn2LoD), x);
+  __m512d xx = _mm512_mul_pd(x, x);
+  __m512d px = _mm512_fmadd_pd(_mm512_set1_pd(kExpP0D), xx,
+                               _mm512_set1_pd(kExpP1D));
+  px = _mm512_mul_pd(x, _mm512_fmadd_pd(px, xx, _mm512_set1_pd(kExpP2D)));
+  __m512d qx = _mm512_fmadd_pd(_mm512_set1_pd(kExpQ0D), xx,
+                               _mm512_set1_pd(kExpQ1D));
+  qx = _mm512_fmadd_pd(qx, xx, _mm512_set1_pd(kExpQ2D));
+  qx = _mm512_fmadd_pd(qx, xx, _mm512_set1_pd(kExpQ3D));
+  x = _mm512_div_pd(px, _mm512_sub_pd(qx, px));
+  x = _mm512_fmadd_pd(x, _mm512_set1_pd(2.0), _mm512_set1_pd(1.0));
+  return _mm512_maskz_scalef_pd(keep, x, fx);
+}
+
+K2_TARGET_AVX512 float RowMaxAvx512(const float *x, int32_t n, float ans) {
+  int32_t i = 0;
+  if (n >= 16) {
+    __m512 m = _mm512_loadu_ps(x);
+    for (i = 16; i + 16 <= n; i += 16)
+      m = MaxAvx512(m, _mm512_loadu_ps(x + i));
+    alignas(64) float buf[16];
+    _mm512_store_ps(buf, m);
+    ans = RowMaxScalar(buf, 16, ans);
+  }
+  return RowMaxAvx2(x + i, n - i, ans);
+}
+
+K2_TARGET_AVX512 double RowMaxAvx512(const double *x, int32_t n,
+                                     double ans) {
+  int32_t i = 0;
+  if (n >= 8) {
+    __m512d m = _mm512_loadu_pd(x);
+    for (i = 8; i + 8 <= n; i += 8)
+      m = MaxAvx512(m, _mm512_loadu_pd(x + i));
+    alignas(64) double buf[8];
+    _mm512_store_pd(buf, m);
+    ans = RowMaxScalar(buf, 8, ans);
+  }
+  return RowMaxAvx2(x + i, n - i, ans);
+}
+
+K2_TARGET_AVX512 float RowSumExpAvx512(const float *x, int32_t n,
+                                       float max) {
+  int32_t i = 0;
+  float sum = 0;
+  if (n >= 16) {
+    __m512 m = _mm512_set1_ps(max), s = _mm512_setzero_ps();
+    for (; i + 16 <= n; i += 16)
+      s = _mm512_add_ps(s,
+                        ExpAvx512(_mm512_sub_ps(_mm512_loadu_ps(x + i), m)));
+    alignas(64) float buf[16];
+    _mm512_store_ps(buf, s);
+    for (int32_t j = 0; j < 16; ++j) sum += buf[j];
+  }
+  return sum + RowSumExpAvx2(x + i, n - i, max);
+}
+
+K2_TARGET_AVX512 double RowSumExpAvx512(const double *x, int32_t n,
+                                        double max) {
+  int32_t i = 0;
+  double sum = 0;
+  if (n >= 8) {
+    __m512d m = _mm512_set1_pd(max), s = _mm512_setzero_pd();
+    for (; i + 8 <= n; i += 8)
+      s = _mm512_add_pd(s,
+                        ExpAvx512(_mm512_sub_pd(_mm512_loadu_pd(x + i), m)));
+    alignas(64) double buf[8];
+    _mm512_store_pd(buf, s);
+    for (int32_t j = 0; j < 8; ++j) sum += buf[j];
+  }
+  return sum + RowSumExpAvx2(x + i, n - i, max);
+}
+
+#endif  // K2_SIMD_REDUCE_X86
+
+#ifdef K2_SIMD_REDUCE_NEON
+
+inline float32x4_t ExpNeon(float32x4_t x) {
+  uint32x4_t underflow = vcltq_f32(x, vdupq_n_f32(kExpMinF));
+  x = vmaxq_f32(x, vdupq_n_f32(kExpMinF));
+  // vfmaq_f32(a, b, c) is a + b * c, and vfmsq_f32(a, b, c) is a - b * c.
+  float32x4_t fx = vrndmq_f32(
+      vfmaq_f32(vdupq_n_f32(0.5f), x, vdupq_n_f32(kLog2eF)));
+  x = vfmsq_f32(x, fx, vdupq_n_f32(kLn2HiF));
+  x = vfmsq_f32(x, fx, vdupq_n_f32(kLn2LoF));
+  float32x4_t y = vdupq_n_f32(kExpP0F);
+  y = vfmaq_f32(vdupq_n_f32(kExpP1F), y, x);
+  y = vfmaq_f32(vdupq_n_f32(kExpP2F), y, x);
+  y = vfmaq_f32(vdupq_n_f32(kExpP3F), y, x);
+  y = vfmaq_f32(vdupq_n_f32(kExpP4F), y, x);
+  y = vfmaq_f32(vdupq_n_f32(kExpP5F), y, x);
+  y = vfmaq_f32(vaddq_f32(x, vdupq_n_f32(1.0f)), y, vmulq_f32(x, x));
+  int32x4_t n = vaddq_s32(vcvtq_s32_f32(fx), vdupq_n_s32(127));
+  y = vmulq_f32(y, vreinterpretq_f32_s32(vshlq_n_s32(n, 23)));
+  return vreinterpretq_f32_u32(
+      vbicq_u32(vreinterpretq_u32_f32(y), underflow));
+}
+
+float RowMaxNeon(const float *x, int32_t n, float ans) {
+  int32_t i = 0;
+  if (n >= 4) {
+    float32x4_t m = vld1q_f32(x);
+    for (i = 4; i + 4 <= n; i += 4) m = vmaxq_f32(m, vld1q_f32(x + i));
+    float buf[4];
+    vst1q_f32(buf, m);
+    ans = RowMaxScalar(buf, 4, ans);
+  }
+  return RowMaxScalar(x + i, n - i, ans);
+}
+
+float RowSumExpNeon(const float *x, int32_t n, float max) {
+  int32_t i = 0;
+  float sum = 0;
+  if (n >= 4) {
+    float32x4_t m = vdupq_n_f32(max), s = vdupq_n_f32(0.0f);
+    for (; i + 4 <= n; i += 4)
+      s = vaddq_f32(s, ExpNeon(vsubq_f32(vld1q_f32(x + i), m)));
+    sum = vaddvq_f32(s);
+  }
+  return sum + RowSumExpScalar(x + i, n - i, max);
+}
+
+#endif  // K2_SIMD_REDUCE_NEON
+
+enum class Isa { kNone, kNeon, kAvx2, kAvx512 };
+
+Isa GetIsa() {
+  static const Isa isa = [] {
+#if defined(K2_SIMD_REDUCE_X86)
+    __builtin_cpu_init();
+    // The AVX-512 kernels use the AVX2 ones for the tails.
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+      if (__builtin_cpu_supports("avx512f")) return Isa::kAvx512;
+      return Isa::kAvx2;
+    }
+#elif defined(K2_SIMD_REDUCE_NEON)
+    return Isa::kNeon;
+#endif
+    return Isa::kNone;
+  }();
+  return isa;
+}
+
+const RowKernels<float> &GetRowKernels(float) {
+  static const RowKernels<float> kernels = []() -> RowKernels<float> {
+    switch (GetIsa()) {
+#if defined(K2_SIMD_REDUCE_X86)
+      case Isa::kAvx512:
+        return {RowMaxAvx512, RowSumExpAvx512};
+      case Isa::kAvx2:
+        return {RowMaxAvx2, RowSumExpAvx2};
+#elif defined(K2_SIMD_REDUCE_NEON)
+      case Isa::kNeon:
+        return {RowMaxNeon, RowSumExpNeon};
+#endif
+      default:
+        return {RowMaxScalar<float>, RowSumExpScalar<float>};
+    }
+  }();
+  return kernels;
+}
+
+const RowKernels<double> &GetRowKernels(double) {
+  static const RowKernels<double> kernels = []() -> RowKernels<double> {
+    switch (GetIsa()) {
+#if defined(K2_SIMD_REDUCE_X86)
+      case Isa::kAvx512:
+        return {RowMaxAvx512, RowSumExpAvx512};
+      case Isa::kAvx2:
+        return {RowMaxAvx2, RowSumExpAvx2};
+#endif
+      default:
+        return {RowMaxScalar<double>, RowSumExpScalar<double>};
+    }
+  }();
+  return kernels;
+}
+
+template <typename T>
+void MaxPerSublistImpl(const int32_t *row_splits, int32_t num_rows,
+                       const T *values, T initial_value, T *dst) {
+  const RowKernels<T> &kernels = GetRowKernels(T());
+  for (int32_t i = 0; i != num_rows; ++i) {
+    int32_t begin = row_splits[i];
+    dst[i] = kernels.max(values + begin, row_splits[i + 1] - begin,
+                         initial_value);
+  }
+}
+
+// The log-sum of a sublist is computed a chunk at a time, keeping a running
+// max and the sum of exp(x - max), which is rescaled when the max grows.  The
+// second pass over each chunk (to sum the exps) then reads it from cache, so
+// long sublists are read from memory only once.
+constexpr int32_t kLogSumChunkSize = 2048;
+
+template <typename T>
+void LogSumPerSublistImpl(const int32_t *row_splits, int32_t num_rows,
+                          const T *values, T initial_value, T *dst) {
+  const RowKernels<T> &kernels = GetRowKernels(T());
+  for (int32_t i = 0; i != num_rows; ++i) {
+    int32_t begin = row_splits[i], end = row_splits[i + 1];
+    // `sum` does not include exp(initial_value - max).
+    T max = initial_value, sum = 0;
+    for (int32_t j = begin; j < end; j += kLogSumChunkSize) {
+      const T *x = values + j;
+      int32_t n = std::min(end - j, kLogSumChunkSize);
+      T chunk_max = kernels.max(x, n, max);
+      if (chunk_max != max) {
+        // If max was -inf, sum is 0 and stays 0.
+        if (!std::isinf(chunk_max)) sum *= std::exp(max - chunk_max);
+        max = chunk_max;
+      }
+      // Either all the inputs so far are -inf, or one of them is +inf;
+      // if the latter, the answer is +inf whatever follows.
+      if (std::isinf(max)) {
+        if (max > 0) break;
+        continue;
+      }
+      sum += kernels.sum_exp(x, n, max);
+    }
+    if (std::isinf(max)) {
+      dst[i] = max;
+      continue;
+    }
+    dst[i] = max + std::log(std::exp(initial_value - max) + sum);
+  }
+}
+
+template <typename T>
+void ArgMaxPerSublistImpl(const int32_t *row_splits, int32_t num_rows,
+                          const T *values, T initial_value, int32_t *dst) {
+  const RowKernels<T> &kernels = GetRowKernels(T());
+  for (int32_t i = 0; i != num_rows; ++i) {
+    int32_t begin = row_splits[i], end = row_splits[i + 1];
+    T max = kernels.max(values + begin, end - begin, initial_value);
+    // As in the scalar code, which keeps the last element that is >= the
+    // running max, we want the last occurrence of the max.
+    int32_t idx = -1;
+    for (int32_t j = end - 1; j >= begin; --j) {
+      if (values[j] == max) {
+        idx = j;
+        break;
+      }
+    }
+    dst[i] = idx;
+  }
+}
+
+}  // namespace
+
+void MaxPerSublistCpu(const int32_t *row_splits, int32_t num_rows,
+                      const float *values, float initial_value, float *dst) {
+  MaxPerSublistImpl(row_splits, num_rows, values, initial_value, dst);
+}
+
+void MaxPerSublistCpu(const int32_t *row_splits, int32_t num_rows,
+                      const double *values, double initial_value,
+                      double *dst) {
+  MaxPerSublistImpl(row_splits, num_rows, values, initial_value, dst);
+}
+
+void LogSumPerSublistCpu(const int32_t *row_splits, int32_t num_rows,
+                         const float *values, float initial_value,
+                         float *dst) {
+  LogSumPerSublistImpl(row_splits, num_rows, values, initial_value, dst);
+}
+
+void LogSumPerSublistCpu(const int32_t *row_splits, int32_t num_rows,
+                         const double *values, double initial_value,
+                         double *dst) {
+  LogSumPerSublistImpl(row_splits, num_rows, values, initial_value, dst);
+}
+
+void ArgMaxPerSublistCpu(const int32_t *row_splits, int32_t num_rows,
+                         const float *values, float initial_value,
+                         int32_t *dst) {
+  ArgMaxPerSublistImpl(row_splits, num_rows, values, initial_value, dst);
+}
+
+void ArgMaxPerSublistCpu(const int32_t *row_splits, int32_t num_rows,
+                         const double *values, double initial_value,
+                         int32_t *dst) {
+  ArgMaxPerSublistImpl(row_splits, num_rows, values, initial_value, dst);
+}
+
+const char *SimdReduceIsa() {
+  switch (GetIsa()) {
+    case Isa::kAvx512:
+      return "avx512";
+    case Isa::kAvx2:
+      return "avx2";
+    case Isa::kNeon:
+      return "neon";
+    default:
+      return "none";
+  }
+}
+
+}  // namespace k2
@@ -0,0 +1,75 @@
+/**
+ * Copyright      2026  Xiaomi Corporation
+ *
+ * See LICENSE for clarification regarding multiple authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef K2_CSRC_SIMD_REDUCE_H_
+#define K2_CSRC_SIMD_REDUCE_H_
+
+#include <cstdint>
+
+namespace k2 {
+
+/*
+  CPU implementations of MaxPerSublist(), LogSumPerSublist() and
+  ArgMaxPerSublist() for float and double, which use SIMD instructions when
+  the CPU has them.  On x86-64 the instruction set (AVX-512 or AVX2) is
+  chosen at runtime, on aarch64 NEON is used for float, and elsewhere plain
+  C++ is used.  They are called by the functions in ragged_ops.h for CPU
+  contexts; you would not normally call them directly.
+
+  All of them reduce the sublists of the last axis: sublist i is
+  values[row_splits[i]] ... values[row_splits[i + 1] - 1], for
+  0 <= i < num_rows, and they write one output per sublist.
+
+  The log-sum is computed as max + log(sum(exp(x - max))) rather than with
+  LogAdd() one element at a time, so results may differ from the CUDA version
+  in the last bits.  Long sublists are processed in cache-sized chunks with a
+  running max, by which the partial sum is rescaled when it grows, so each
+  element is read from memory only once.
+ */
+
+// dst[i] = max(initial_value, the elements of sublist i).
+void MaxPerSublistCpu(const int32_t *row_splits, int32_t num_rows,
+                      const float *values, float initial_value, float *dst);
+void MaxPerSublistCpu(const int32_t *row_splits, int32_t num_rows,
+                      const double *values, double initial_value,
+                      double *dst);
+
+// dst[i] = log(exp(initial_value) + sum_j exp(elements of sublist i)).
+void LogSumPerSublistCpu(const int32_t *row_splits, int32_t num_rows,
+                         const float *values, float initial_value,
+                         float *dst);
+void LogSumPerSublistCpu(const int32_t *row_splits, int32_t num_rows,
+                         const double *values, double initial_value,
+                         double *dst);
+
+// dst[i] = index into `values` of the last maximum of sublist i, or -1 if
+// the sublist is empty or all its elements are less than initial_value.
+void ArgMaxPerSublistCpu(const int32_t *row_splits, int32_t num_rows,
+                         const float *values, float initial_value,
+                         int32_t *dst);
+void ArgMaxPerSublistCpu(const int32_t *row_splits, int32_t num_rows,
+                         const double *values, double initial_value,
+                         int32_t *dst);
+
+// Returns the instruction set used by the functions above on this machine:
+// "avx512", "avx2", "neon" or "none".
+const char *SimdReduceIsa();
+
+}  // namespace k2
+
+#endif  // K2_CSRC_SIMD_REDUCE_H_
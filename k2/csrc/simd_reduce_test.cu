@@ -0,0 +1,127 @@
+/**
+ * Copyright      2026  Xiaomi Corporation
+ *
+ * See LICENSE for clarification regarding multiple authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <cmath>
+#include <limits>
+#include <type_traits>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "k2/csrc/array.h"
+#include "k2/csrc/array_ops.h"
+#include "k2/csrc/context.h"
+#include "k2/csrc/ragged.h"
+#include "k2/csrc/ragged_ops.h"
+#include "k2/csrc/simd_reduce.h"
+#include "k2/csrc/utils.h"
+
+namespace k2 {
+
+template <typename T>
+static void TestSimdReduce() {
+  ContextPtr c = GetCpuContext();
+  T negative_infinity = -std::numeric_limits<T>::infinity();
+  // Sublist sizes cover empty sublists, the scalar tails and several full
+  // vectors of every instruction set.
+  RaggedShape shape = RandomRaggedShape(false, 2, 2, 0, 5000);
+  Ragged<T> src(shape, RandUniformArray1<T>(c, shape.NumElements(), -50, 5));
+  T *values = src.values.Data();
+  for (int32_t i = 0; i < src.values.Dim(); i += 7)
+    values[i] = negative_infinity;
+
+  Array1<T> max_values(c, src.Dim0()), log_sums(c, src.Dim0());
+  Array1<int32_t> argmax(c, src.Dim0());
+  MaxPerSublist(src, negative_infinity, &max_values);
+  LogSumPerSublist(src, negative_infinity, &log_sums);
+  ArgMaxPerSublist(src, negative_infinity, &argmax);
+
+  const int32_t *row_splits = src.RowSplits(1).Data();
+  T tolerance = std::is_same<T, float>::value ? 1e-4 : 1e-12;
+  for (int32_t i = 0; i < src.Dim0(); ++i) {
+    T max_value = negative_infinity, log_sum = negative_infinity;
+    int32_t idx = -1;
+    for (int32_t j = row_splits[i]; j < row_splits[i + 1]; ++j) {
+      if (values[j] >= max_value) {
+        max_value = values[j];
+        idx = j;
+      }
+      log_sum = LogAdd<T>()(values[j], log_sum);
+    }
+    EXPECT_EQ(max_values[i], max_value);
+    EXPECT_EQ(argmax[i], idx);
+    if (std::isinf(log_sum))
+      EXPECT_EQ(log_sums[i], log_sum);
+    else
+      EXPECT_NEAR(log_sums[i], log_sum, tolerance * (1 + std::abs(log_sum)));
+  }
+}
+
+TEST(SimdReduce, PerSublist) {
+  K2_LOG(INFO) << "Instruction set: " << SimdReduceIsa();
+  TestSimdReduce<float>();
+  TestSimdReduce<double>();
+}
+
+TEST(SimdReduce, InitialValue) {
+  // A sublist with all elements less than the initial value.
+  std::vector<float> values = {-3, -2, -1};
+  std::vector<int32_t> row_splits = {0, 3};
+  float max_value, log_sum;
+  int32_t argmax;
+  MaxPerSublistCpu(row_splits.data(), 1, values.data(), 0, &max_value);
+  ArgMaxPerSublistCpu(row_splits.data(), 1, values.data(), 0, &argmax);
+  LogSumPerSublistCpu(row_splits.data(), 1, values.data(), 0, &log_sum);
+  EXPECT_EQ(max_value, 0);
+  EXPECT_EQ(argmax, -1);
+  EXPECT_NEAR(log_sum, std::log(1 + std::exp(-3.0) + std::exp(-2.0) +
+                                std::exp(-1.0)),
+              1e-6);
+
+  // +inf dominates.
+  values[1] = std::numeric_limits<float>::infinity();
+  LogSumPerSublistCpu(row_splits.data(), 1, values.data(), 0, &log_sum);
+  EXPECT_EQ(log_sum, std::numeric_limits<float>::infinity());
+}
+
+TEST(SimdReduce, LongSublists) {
+  // Sublists longer than the chunks in which they are reduced: one whose max
+  // grows from chunk to chunk, one whose first chunks are all -inf, and one
+  // with a +inf in a later chunk.
+  int32_t n = 10000;
+  double negative_infinity = -std::numeric_limits<double>::infinity();
+  std::vector<double> values(3 * n);
+  for (int32_t i = 0; i < n; ++i) {
+    values[i] = i * 0.01;
+    values[n + i] = (i < n / 2 ? negative_infinity : -i * 0.01);
+    values[2 * n + i] = 0;
+  }
+  values[2 * n + n / 2] = std::numeric_limits<double>::infinity();
+  std::vector<int32_t> row_splits = {0, n, 2 * n, 3 * n};
+  std::vector<double> log_sums(3);
+  LogSumPerSublistCpu(row_splits.data(), 3, values.data(), negative_infinity,
+                      log_sums.data());
+  for (int32_t row = 0; row < 2; ++row) {
+    double log_sum = negative_infinity;
+    for (int32_t j = row_splits[row]; j < row_splits[row + 1]; ++j)
+      log_sum = LogAdd<double>()(values[j], log_sum);
+    EXPECT_NEAR(log_sums[row], log_sum, 1e-10 * (1 + std::abs(log_sum)));
+  }
+  EXPECT_EQ(log_sums[2], std::numeric_limits<double>::infinity());
+}
+
+}  // namespace k2
@@ -0,0 +1,217 @@
+/**
+ * Copyright      2026  Xiaomi Corporation
+ *
+ * See LICENSE for clarification regarding multiple authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef K2_CSRC_SMALL_VECTOR_H_
+#define K2_CSRC_SMALL_VECTOR_H_
+
+#include <algorithm>
+#include <cstddef>
+#include <initializer_list>
+#include <iterator>
+#include <utility>
+#include <vector>
+
+#include "k2/csrc/log.h"
+
+namespace k2 {
+
+/*
+  SmallVector is a host-only, std::vector-like container that stores up to N
+  elements inline (i.e. inside the object itself) and only falls back to heap
+  storage, in a std::vector, when more than N elements are needed.  It exists
+  so that objects that nearly always hold a handful of elements, like the
+  layers of a RaggedShape, can be created, copied and moved without a heap
+  allocation.
+
+  Only the subset of the std::vector interface that we actually need is
+  provided.  Elements are always contiguous, so begin() and end() are plain
+  pointers.  Unlike std::vector, elements that are removed from the inline
+  buffer are reset to T() rather than destroyed, so T must be default
+  constructible and assignable.
+ */
+template <typename T, int N>
+class SmallVector {
+  static_assert(N > 0, "N must be positive");
+
+ public:
+  using value_type = T;
+  using size_type = std::size_t;
+  using reference = T &;
+  using const_reference = const T &;
+  using iterator = T *;
+  using const_iterator = const T *;
+
+  SmallVector() = default;
+
+  explicit SmallVector(size_type n) { resize(n); }
+
+  SmallVector(std::initializer_list<T> init)
+      : SmallVector(init.begin(), init.end()) {}
+
+  template <typename InputIt, typename = typename std::iterator_traits<
+                                  InputIt>::iterator_category>
+  SmallVector(InputIt first, InputIt last) {
+    insert(end(), first, last);
+  }
+
+  SmallVector(const SmallVector &other) : SmallVector(other.begin(),
+                                                       other.end()) {}
+
+  SmallVector(SmallVector &&other) noexcept { *this = std::move(other); }
+
+  SmallVector &operator=(const SmallVector &other) {
+    if (this != &other) {
+      clear();
+      insert(end(), other.begin(), other.end());
+    }
+    return *this;
+  }
+
+  SmallVector &operator=(SmallVector &&other) noexcept {
+    if (this == &other) return *this;
+    clear();
+    if (other.on_heap_) {
+      heap_ = std::move(other.heap_);
+      on_heap_ = true;
+      other.heap_.clear();
+      other.on_heap_ = false;
+    } else {
+      on_heap_ = false;  // `inline_` is all T() after clear().
+      for (size_type i = 0; i != other.size_; ++i)
+        inline_[i] = std::move(other.inline_[i]);
+      size_ = other.size_;
+      other.clear();
+    }
+    return *this;
+  }
+
+  size_type size() const { return on_heap_ ? heap_.size() : size_; }
+  bool empty() const { return size() == 0; }
+  // Returns true if the elements are held in the inline buffer, i.e. no heap
+  // allocation is in use.
+  bool IsInline() const { return !on_heap_; }
+
+  T *data() { return on_heap_ ? heap_.data() : inline_; }
+  const T *data() const { return on_heap_ ? heap_.data() : inline_; }
+
+  iterator begin() { return data(); }
+  iterator end() { return data() + size(); }
+  const_iterator begin() const { return data(); }
+  const_iterator end() const { return data() + size(); }
+
+  T &operator[](size_type i) { return data()[i]; }
+  const T &operator[](size_type i) const { return data()[i]; }
+
+  T &front() { return data()[0]; }
+  const T &front() const { return data()[0]; }
+  T &back() { return data()[size() - 1]; }
+  const T &back() const { return data()[size() - 1]; }
+
+  // Only a hint: while the elements fit in the inline buffer this does
+  // nothing, so callers can reserve without forcing a heap allocation.
+  void reserve(size_type n) {
+    if (on_heap_) heap_.reserve(n);
+  }
+
+  void resize(size_type n) {
+    if (!on_heap_ && n <= static_cast<size_type>(N)) {
+      for (size_type i = n; i < size_; ++i) inline_[i] = T();
+      size_ = n;
+    } else {
+      SpillToHeap(n);
+      heap_.resize(n);
+    }
+  }
+
+  void clear() {
+    if (on_heap_) {
+      heap_.clear();
+    } else {
+      for (size_type i = 0; i != size_; ++i) inline_[i] = T();
+      size_ = 0;
+    }
+  }
+
+  void push_back(const T &t) { emplace_back(t); }
+  void push_back(T &&t) { emplace_back(std::move(t)); }
+
+  template <typename... Args>
+  T &emplace_back(Args &&... args) {
+    if (!on_heap_ && size_ < static_cast<size_type>(N)) {
+      inline_[size_] = T(std::forward<Args>(args)...);
+      return inline_[size_++];
+    }
+    SpillToHeap(size() + 1);
+    heap_.emplace_back(std::forward<Args>(args)...);
+    return heap_.back();
+  }
+
+  void pop_back() {
+    K2_DCHECK(!empty());
+    if (on_heap_) {
+      heap_.pop_back();
+    } else {
+      inline_[--size_] = T();
+    }
+  }
+
+  // Inserts the elements in [first, last) before `pos`.  [first, last) must
+  // not refer to elements of *this.
+  template <typename InputIt>
+  iterator insert(const_iterator pos, InputIt first, InputIt last) {
+    size_type idx = pos - begin(),
+              count = static_cast<size_type>(std::distance(first, last));
+    K2_DCHECK_LE(idx, size());
+    if (!on_heap_ && size_ + count <= static_cast<size_type>(N)) {
+      std::move_backward(inline_ + idx, inline_ + size_,
+                         inline_ + size_ + count);
+      std::copy(first, last, inline_ + idx);
+      size_ += count;
+    } else {
+      SpillToHeap(size() + count);
+      heap_.insert(heap_.begin() + idx, first, last);
+    }
+    return begin() + idx;
+  }
+
+ private:
+  // Moves the elements to `heap_` (if they are not already there), making
+  // sure it has capacity for at least `n` elements.
+  void SpillToHeap(size_type n) {
+    if (on_heap_) {
+      heap_.reserve(n);
+      return;
+    }
+    heap_.reserve(std::max(n, static_cast<size_type>(2 * N)));
+    for (size_type i = 0; i != size_; ++i) {
+      heap_.push_back(std::move(inline_[i]));
+      inline_[i] = T();
+    }
+    size_ = 0;
+    on_heap_ = true;
+  }
+
+  T inline_[N];
+  size_type size_ = 0;  // Number of elements in `inline_`; 0 if on_heap_.
+  bool on_heap_ = false;
+  std::vector<T> heap_;
+};
+
+}  // namespace k2
+
+#endif  // K2_CSRC_SMALL_VECTOR_H_
@@ -0,0 +1,105 @@
+/**
+ * Copyright      2026  Xiaomi Corporation
+ *
+ * See LICENSE for clarification regarding multiple authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "k2/csrc/ragged.h"
+#include "k2/csrc/ragged_ops.h"
+#include "k2/csrc/small_vector.h"
+
+namespace k2 {
+
+TEST(SmallVector, InlineAndSpill) {
+  SmallVector<int32_t, 3> v;
+  EXPECT_TRUE(v.empty());
+  for (int32_t i = 0; i < 3; ++i) v.push_back(i);
+  EXPECT_TRUE(v.IsInline());
+  EXPECT_EQ(v.size(), 3u);
+  EXPECT_EQ(v.back(), 2);
+
+  v.push_back(3);  // spills to the heap
+  EXPECT_FALSE(v.IsInline());
+  std::vector<int32_t> expected = {0, 1, 2, 3};
+  EXPECT_EQ(std::vector<int32_t>(v.begin(), v.end()), expected);
+
+  std::vector<int32_t> extra = {4, 5};
+  v.insert(v.end(), extra.begin(), extra.end());
+  v.pop_back();
+  expected = {0, 1, 2, 3, 4};
+  EXPECT_EQ(std::vector<int32_t>(v.begin(), v.end()), expected);
+
+  SmallVector<int32_t, 3> w = {7, 9};
+  w.insert(w.begin(), extra.begin(), extra.begin() + 1);
+  expected = {4, 7, 9};
+  EXPECT_TRUE(w.IsInline());
+  EXPECT_EQ(std::vector<int32_t>(w.begin(), w.end()), expected);
+
+  w.resize(1);
+  EXPECT_EQ(w.size(), 1u);
+  w.resize(5);
+  EXPECT_FALSE(w.IsInline());
+  EXPECT_EQ(w.size(), 5u);
+  EXPECT_EQ(w[0], 4);
+}
+
+TEST(SmallVector, CopyAndMove) {
+  for (int32_t n : {2, 5}) {
+    SmallVector<std::shared_ptr<int32_t>, 3> v;
+    for (int32_t i = 0; i < n; ++i)
+      v.emplace_back(std::make_shared<int32_t>(i));
+    std::shared_ptr<int32_t> first = v[0];
+
+    SmallVector<std::shared_ptr<int32_t>, 3> copy(v);
+    EXPECT_EQ(copy.size(), v.size());
+    EXPECT_EQ(first.use_count(), 3);
+
+    SmallVector<std::shared_ptr<int32_t>, 3> moved(std::move(v));
+    EXPECT_TRUE(v.empty());  // NOLINT
+    EXPECT_EQ(moved.size(), static_cast<std::size_t>(n));
+    EXPECT_EQ(first.use_count(), 3);
+
+    // Elements removed from the inline buffer must not keep references
+    // alive.
+    copy.clear();
+    moved.resize(1);
+    EXPECT_EQ(first.use_count(), 2);
+    EXPECT_EQ(*moved[0], 0);
+
+    // Move-assign inline contents into a vector that has spilled.
+    SmallVector<std::shared_ptr<int32_t>, 3> big(4), small(1);
+    big = std::move(small);
+    EXPECT_TRUE(big.IsInline());
+    EXPECT_EQ(big.size(), 1u);
+  }
+}
+
+TEST(SmallVector, RaggedShapeLayers) {
+  RaggedShape shape("[ [ [ x x ] [ x ] ] [ [ x ] ] ]");
+  EXPECT_TRUE(shape.Layers().IsInline());
+  RaggedShape shape2(shape.Layers());
+  EXPECT_EQ(shape2.NumAxes(), 3);
+  EXPECT_TRUE(Equal(shape, shape2));
+
+  RaggedShape moved(std::move(shape2));
+  EXPECT_TRUE(Equal(shape, moved));
+}
+
+}  // namespace k2
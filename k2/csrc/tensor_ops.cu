@@ -9,16 +9,140 @@
 #include <string.h>  // memcpy, memset
 
 #include <algorithm>
+#include <cstdint>
 #include <memory>
 #include <vector>
 
+#include "k2/csrc/array_ops.h"
 #include "k2/csrc/dtype.h"
 #include "k2/csrc/macros.h"
 #include "k2/csrc/nvtx.h"
+#include "k2/csrc/ragged_ops.h"
 #include "k2/csrc/tensor_ops.h"
 
 namespace k2 {
 
+template <typename T>
+/*static*/ void CopyElements2dGeneric(ContextPtr c, int32_t dim0, int32_t dim1,
+                                      const T *src_data, int32_t src_stride0,
+                                      int32_t src_stride1, T *dest_data,
+                                      int32_t dest_stride0,
+                                      int32_t dest_stride1) {
+  K2_EVAL2(
+      c, dim0, dim1, lambda_set_elems, (int32_t i, int32_t j)->void {
+        dest_data[i * dest_stride0 + j * dest_stride1] =
+            src_data[i * src_stride0 + j * src_stride1];
+      });
+}
+
+// Copies the rows of T's in CopyRowsVectorized() as rows of WordT's.
+template <typename WordT, typename T>
+static void CopyRowsAs(ContextPtr c, int32_t dim0, int32_t dim1,
+                       const T *src_data, int32_t src_stride0, T *dest_data,
+                       int32_t dest_stride0) {
+  constexpr int32_t kRatio = sizeof(WordT) / sizeof(T);
+  CopyElements2dGeneric<WordT>(
+      c, dim0, dim1 / kRatio, reinterpret_cast<const WordT *>(src_data),
+      src_stride0 / kRatio, 1, reinterpret_cast<WordT *>(dest_data),
+      dest_stride0 / kRatio, 1);
+}
+
+/*
+  Copies the rows of a matrix whose rows are contiguous in both `src_data`
+  and `dest_data` on GPU, with 16-, 8- or 4-byte words (e.g. int4) instead
+  of one load and store per element.  Returns false if the alignment of the
+  rows does not allow a word wider than T, in which case nothing is done.
+ */
+template <typename T>
+static bool CopyRowsVectorized(ContextPtr c, int32_t dim0, int32_t dim1,
+                               const T *src_data, int32_t src_stride0,
+                               T *dest_data, int32_t dest_stride0) {
+#ifdef K2_WITH_CUDA
+  auto is_aligned = [=](int64_t word_size) -> bool {
+    int64_t elem_size = sizeof(T);
+    return reinterpret_cast<uintptr_t>(src_data) % word_size == 0 &&
+           reinterpret_cast<uintptr_t>(dest_data) % word_size == 0 &&
+           (dim1 * elem_size) % word_size == 0 &&
+           (dim0 == 1 || ((src_stride0 * elem_size) % word_size == 0 &&
+                          (dest_stride0 * elem_size) % word_size == 0));
+  };
+  if (sizeof(T) < 16 && is_aligned(16)) {
+    CopyRowsAs<int4>(c, dim0, dim1, src_data, src_stride0, dest_data,
+                     dest_stride0);
+    return true;
+  } else if (sizeof(T) < 8 && is_aligned(8)) {
+    CopyRowsAs<int2>(c, dim0, dim1, src_data, src_stride0, dest_data,
+                     dest_stride0);
+    return true;
+  } else if (sizeof(T) < 4 && is_aligned(4)) {
+    CopyRowsAs<int32_t>(c, dim0, dim1, src_data, src_stride0, dest_data,
+                        dest_stride0);
+    return true;
+  }
+#endif
+  return false;
+}
+
+#ifdef K2_WITH_CUDA
+constexpr int32_t kTransposeTileDim = 32;
+constexpr int32_t kTransposeBlockRows = 8;
+
+/*
+  Does dest_data[i * dest_stride0 + j] = src_data[i + j * src_stride1] for
+  0 <= i < dim0, 0 <= j < dim1, i.e. a transposition of the memory layout.
+  Each block handles a tile of kTransposeTileDim x kTransposeTileDim
+  elements, staged through shared memory so that both the loads and the
+  stores are coalesced.
+ */
+template <typename T>
+__global__ void TransposeCopyKernel(int32_t dim0, int32_t dim1,
+                                    const T *src_data, int32_t src_stride1,
+                                    T *dest_data, int32_t dest_stride0) {
+  // The + 1 avoids shared memory bank conflicts.
+  __shared__ T tile[kTransposeTileDim][kTransposeTileDim + 1];
+  int32_t i0 = blockIdx.y * kTransposeTileDim,
+          j0 = blockIdx.x * kTransposeTileDim;
+  for (int32_t k = threadIdx.y; k < kTransposeTileDim;
+       k += kTransposeBlockRows) {
+    int32_t i = i0 + threadIdx.x, j = j0 + k;
+    if (i < dim0 && j < dim1)
+      tile[k][threadIdx.x] = src_data[i + j * src_stride1];
+  }
+  __syncthreads();
+  for (int32_t k = threadIdx.y; k < kTransposeTileDim;
+       k += kTransposeBlockRows) {
+    int32_t i = i0 + k, j = j0 + threadIdx.x;
+    if (i < dim0 && j < dim1)
+      dest_data[i * dest_stride0 + j] = tile[threadIdx.x][k];
+  }
+}
+#endif
+
+/*
+  Copies a matrix whose layout in `src_data` is the transpose of that in
+  `dest_data` (src_stride0 == 1 and dest_stride1 == 1) on GPU with
+  TransposeCopyKernel(); returns false, doing nothing, if the grid would be
+  too large.
+ */
+template <typename T>
+static bool TransposeCopy(ContextPtr c, int32_t dim0, int32_t dim1,
+                          const T *src_data, int32_t src_stride1,
+                          T *dest_data, int32_t dest_stride0) {
+#ifdef K2_WITH_CUDA
+  int32_t grid_dim0 = NumBlocks(dim0, kTransposeTileDim),
+          grid_dim1 = NumBlocks(dim1, kTransposeTileDim);
+  if (grid_dim0 > 65535) return false;
+  dim3 grid_dim(grid_dim1, grid_dim0, 1),
+      block_dim(kTransposeTileDim, kTransposeBlockRows, 1);
+  K2_CUDA_SAFE_CALL(
+      TransposeCopyKernel<T><<<grid_dim, block_dim, 0, c->GetCudaStream()>>>(
+          dim0, dim1, src_data, src_stride1, dest_data, dest_stride0));
+  return true;
+#else
+  return false;
+#endif
+}
+
 template <typename T>
 /*static*/ void CopyTensorElements2d(ContextPtr c, int32_t dim0, int32_t dim1,
                                      const T *src_data, int32_t src_stride0,
@@ -29,19 +153,37 @@ template <typename T>
   DeviceType d = c->GetDeviceType();
   if (d == kCpu) {
     // this is just an optimization, the other branch would work for CPU too.
+    if (src_stride1 == 1 && dest_stride1 == 1) {
+      for (int32_t i = 0; i < dim0; i++)
+        memcpy(dest_data + i * dest_stride0, src_data + i * src_stride0,
+               dim1 * sizeof(T));
+      return;
+    }
     for (int32_t i = 0; i < dim0; i++) {
       for (int32_t j = 0; j < dim1; j++) {
         dest_data[i * dest_stride0 + j * dest_stride1] =
             src_data[i * src_stride0 + j * src_stride1];
       }
     }
-  } else {
-    K2_EVAL2(
-        c, dim0, dim1, lambda_set_elems, (int32_t i, int32_t j)->void {
-          dest_data[i * dest_stride0 + j * dest_stride1] =
-              src_data[i * src_stride0 + j * src_stride1];
-        });
+    return;
+  }
+  if (src_stride1 == 1 && dest_stride1 == 1) {
+    if (CopyRowsVectorized(c, dim0, dim1, src_data, src_stride0, dest_data,
+                           dest_stride0))
+      return;
+  } else if (dim0 > 1 && dim1 > 1) {
+    // Transpositions, e.g. making a column-major matrix contiguous.
+    if (src_stride0 == 1 && dest_stride1 == 1 &&
+        TransposeCopy(c, dim0, dim1, src_data, src_stride1, dest_data,
+                      dest_stride0))
+      return;
+    if (src_stride1 == 1 && dest_stride0 == 1 &&
+        TransposeCopy(c, dim1, dim0, src_data, src_stride0, dest_data,
+                      dest_stride1))
+      return;
   }
+  CopyElements2dGeneric(c, dim0, dim1, src_data, src_stride0, src_stride1,
+                        dest_data, dest_stride0, dest_stride1);
 }
 
 template <typename T>
@@ -49,50 +191,86 @@ void CopyTensorElements1d(ContextPtr c, int32_t dim, const T *src_data,
                           int32_t src_stride, T *dest_data,
                           int32_t dest_stride) {
   NVTX_RANGE(K2_FUNC);
+  if (src_stride == 1 && dest_stride == 1) {
+    // A single contiguous row.
+    CopyTensorElements2d(c, 1, dim, src_data, dim, 1, dest_data, dim, 1);
+    return;
+  }
   K2_EVAL(
       c, dim, lambda_set_elems, (int32_t i)->void {
         dest_data[i * dest_stride] = src_data[i * src_stride];
       });
 }
 
-// TODO(dan): this is far from ideal in terms of efficiency.  There is no
-// attempt to discover the simplest pattern that covers the copy, or to be smart
-// about memory loads if it turns out to be a transposition.
+/*
+  Simplifies the layout of a copy between tensors with dims `dims` and
+  strides `src_strides` and `dest_strides`: removes axes with dim 1 and
+  merges each axis with the next one when both src and dest are contiguous
+  across them, so that e.g. a copy between contiguous tensors becomes 1-D.
+  The number of elements is unchanged, and the result may have no axes if it
+  has one element.
+ */
+static void MergeCopyAxes(std::vector<int32_t> *dims,
+                          std::vector<int32_t> *src_strides,
+                          std::vector<int32_t> *dest_strides) {
+  std::vector<int32_t> new_dims, new_src_strides, new_dest_strides;
+  for (size_t i = 0; i != dims->size(); ++i) {
+    int32_t dim = (*dims)[i], src_stride = (*src_strides)[i],
+            dest_stride = (*dest_strides)[i];
+    if (dim == 1) continue;
+    if (!new_dims.empty() &&
+        new_src_strides.back() == dim * src_stride &&
+        new_dest_strides.back() == dim * dest_stride) {
+      new_dims.back() *= dim;
+      new_src_strides.back() = src_stride;
+      new_dest_strides.back() = dest_stride;
+    } else {
+      new_dims.push_back(dim);
+      new_src_strides.push_back(src_stride);
+      new_dest_strides.push_back(dest_stride);
+    }
+  }
+  dims->swap(new_dims);
+  src_strides->swap(new_src_strides);
+  dest_strides->swap(new_dest_strides);
+}
+
 void CopyTensorElements(Tensor src, Tensor dest) {
   NVTX_RANGE(K2_FUNC);
   K2_CHECK(src.SameDims(dest));
   ContextPtr c = GetContext(src, dest);
-  int32_t num_axes = src.NumAxes();
+  Dtype dtype = src.GetDtype();
+  K2_CHECK(dtype == dest.GetDtype());
+  if (src.NumElements() == 0) return;
+  const Shape &src_shape = src.GetShape(), &dest_shape = dest.GetShape();
+  std::vector<int32_t> dims = src_shape.Dims(),
+                       src_strides = src_shape.Strides(),
+                       dest_strides = dest_shape.Strides();
+  MergeCopyAxes(&dims, &src_strides, &dest_strides);
+  int32_t num_axes = static_cast<int32_t>(dims.size());
   if (num_axes > 2) {
     // For now, only directly support copies of at most 2 dims.
     int32_t leading_dim = src.Dim(0);
     ParallelRunner pr(c);
     for (int32_t i = 0; i < leading_dim; i++) {
-      With(pr.NewStream());
       Tensor src_part = src.Index(0, i), dest_part = dest.Index(0, i);
+      With w(pr.NewStream(dest_part.NumElements()));
       CopyTensorElements(src_part, dest_part);
     }
+  } else if (num_axes == 2) {
+    FOR_ALL_DTYPES(dtype, T,
+                   CopyTensorElements2d<T>(
+                       c, dims[0], dims[1], src.Data<T>(), src_strides[0],
+                       src_strides[1], dest.Data<T>(), dest_strides[0],
+                       dest_strides[1]));
   } else {
-    const Shape &src_shape = src.GetShape(), &dest_shape = dest.GetShape();
-    int32_t src_stride0 = (num_axes > 0 ? src_shape.Stride(0) : 0),
-            dest_stride0 = (num_axes > 0 ? dest_shape.Stride(0) : 0),
-            dim0 = (num_axes > 0 ? src_shape.Dim(0) : 1);
-    Dtype dtype = src.GetDtype();
-    K2_CHECK(dtype == dest.GetDtype());
-    int32_t num_axes = src.NumAxes();
-    if (num_axes == 2) {
-      int32_t src_stride1 = src_shape.Stride(1),
-              dest_stride1 = dest_shape.Stride(1), dim1 = src_shape.Dim(1);
-      FOR_ALL_DTYPES(dtype, T,
-                     CopyTensorElements2d<T>(
-                         c, dim0, dim1, src.Data<T>(), src_stride0, src_stride1,
-                         dest.Data<T>(), dest_stride0, dest_stride1));
-    } else {
-      FOR_ALL_DTYPES(
-          dtype, T,
-          CopyTensorElements1d<T>(c, dim0, src.Data<T>(), src_stride0,
-                                  dest.Data<T>(), dest_stride0));
-    }
+    int32_t dim0 = (num_axes > 0 ? dims[0] : 1),
+            src_stride0 = (num_axes > 0 ? src_strides[0] : 1),
+            dest_stride0 = (num_axes > 0 ? dest_strides[0] : 1);
+    FOR_ALL_DTYPES(
+        dtype, T,
+        CopyTensorElements1d<T>(c, dim0, src.Data<T>(), src_stride0,
+                                dest.Data<T>(), dest_stride0));
   }
 }
 
@@ -364,8 +542,100 @@ template <typename T>
       });
 }
 
+/*
+  Returns the order in which to visit the elements of `src` for a
+  deterministic IndexAdd(): a stable sort of `indexes`, with -1's (if
+  allowed) going after all others.  At exit `row_splits` will have
+  `dest_dim + 2` elements; the positions in the returned array whose
+  indexes are `r` are `row_splits[r] .. row_splits[r+1]-1`, where
+  `r == dest_dim` stands for -1.
+
+  Not static because it contains device lambdas.
+ */
+Array1<int32_t> GetIndexAddReordering(Array1<int32_t> &indexes,
+                                      bool allow_minus_one, int32_t dest_dim,
+                                      Array1<int32_t> *row_splits) {
+  NVTX_RANGE(K2_FUNC);
+  ContextPtr &context = indexes.Context();
+  int32_t n = indexes.Dim();
+  const int32_t *indexes_data = indexes.Data();
+  Array1<int32_t> cols(context, n);
+  int32_t *cols_data = cols.Data();
+  K2_EVAL(
+      context, n, lambda_set_cols, (int32_t i)->void {
+        int32_t index = indexes_data[i];
+        K2_DCHECK_LT(index, dest_dim);
+        K2_DCHECK_GE(index, allow_minus_one ? -1 : 0);
+        cols_data[i] = (index == -1 ? dest_dim : index);
+      });
+  // GetTransposeReordering() is a stable sort, so elements with the same
+  // index stay in their original order.
+  Ragged<int32_t> ragged(RegularRaggedShape(context, 1, n), cols);
+  Array1<int32_t> reordering = GetTransposeReordering(ragged, dest_dim + 1);
+
+  *row_splits = Array1<int32_t>(context, dest_dim + 2);
+  Array1<int32_t> sorted_cols = cols[reordering];
+  RowIdsToRowSplits(sorted_cols, row_splits);
+  return reordering;
+}
+
+template <typename T>
+/*static*/ void IndexAdd1DSortedImpl(ContextPtr context, const T *src_data,
+                                     int32_t src_dim, int32_t src_stride,
+                                     Array1<int32_t> &indexes,
+                                     bool allow_minus_one, int32_t dest_dim,
+                                     int32_t dest_stride, T *dest_data) {
+  NVTX_RANGE(K2_FUNC);
+  Array1<int32_t> row_splits;
+  Array1<int32_t> reordering =
+      GetIndexAddReordering(indexes, allow_minus_one, dest_dim, &row_splits);
+  const int32_t *reordering_data = reordering.Data();
+
+  Array1<T> sorted_values(context, src_dim);
+  T *sorted_values_data = sorted_values.Data();
+  K2_EVAL(
+      context, src_dim, lambda_gather, (int32_t i)->void {
+        sorted_values_data[i] = src_data[reordering_data[i] * src_stride];
+      });
+  Ragged<T> sorted(RaggedShape2(&row_splits, nullptr, src_dim),
+                   sorted_values);
+  // The last sum is that of the elements whose index is -1; it is unused.
+  Array1<T> sums(context, dest_dim + 1);
+  SumPerSublist<T>(sorted, 0, &sums);
+  const T *sums_data = sums.Data();
+  K2_EVAL(
+      context, dest_dim, lambda_add, (int32_t i)->void {
+        dest_data[i * dest_stride] += sums_data[i];
+      });
+}
+
+template <typename T>
+/*static*/ void IndexAdd2DSortedImpl(ContextPtr context, const T *src_data,
+                                     int32_t src_dim0, int32_t src_dim1,
+                                     int32_t src_stride0, int32_t src_stride1,
+                                     Array1<int32_t> &indexes,
+                                     bool allow_minus_one, int32_t dest_dim,
+                                     int32_t dest_stride0,
+                                     int32_t dest_stride1, T *dest_data) {
+  NVTX_RANGE(K2_FUNC);
+  Array1<int32_t> row_splits;
+  Array1<int32_t> reordering =
+      GetIndexAddReordering(indexes, allow_minus_one, dest_dim, &row_splits);
+  const int32_t *reordering_data = reordering.Data(),
+                *row_splits_data = row_splits.Data();
+  K2_EVAL2(
+      context, dest_dim, src_dim1, lambda_add, (int32_t i, int32_t j)->void {
+        T sum = 0;
+        for (int32_t k = row_splits_data[i]; k != row_splits_data[i + 1];
+             ++k)
+          sum += src_data[reordering_data[k] * src_stride0 + j * src_stride1];
+        dest_data[i * dest_stride0 + j * dest_stride1] += sum;
+      });
+}
+
 static void IndexAdd1D(Tensor &src, Array1<int32_t> &indexes,
-                       bool allow_minus_one, Tensor *dest) {
+                       bool allow_minus_one, bool deterministic,
+                       Tensor *dest) {
   NVTX_RANGE(K2_FUNC);
   K2_CHECK_EQ(src.NumAxes(), 1);
   K2_CHECK_NE(dest, nullptr);
@@ -383,6 +653,15 @@ static void IndexAdd1D(Tensor &src, Array1<int32_t> &indexes,
   int32_t dest_dim = dest->Dim(0);
   int32_t dest_stride = dest->Stride(0);
 
+  if (deterministic) {
+    FOR_REAL_AND_INT32_TYPES(
+        dtype, T,
+        IndexAdd1DSortedImpl<T>(context, src.Data<T>(), src_dim, src_stride,
+                                indexes, allow_minus_one, dest_dim,
+                                dest_stride, dest->Data<T>()));
+    return;
+  }
+
   // atomiAdd is not available for some types, e.g., int8_t and int16_t
   // see
   // https://docs.nvidia.com/cuda/cuda-c-programming-guide/index.html#atomicadd
@@ -394,7 +673,8 @@ static void IndexAdd1D(Tensor &src, Array1<int32_t> &indexes,
 }
 
 static void IndexAdd2D(Tensor &src, Array1<int32_t> &indexes,
-                       bool allow_minus_one, Tensor *dest) {
+                       bool allow_minus_one, bool deterministic,
+                       Tensor *dest) {
   NVTX_RANGE(K2_FUNC);
   K2_CHECK_EQ(src.NumAxes(), 2);
   K2_CHECK_NE(dest, nullptr);
@@ -415,6 +695,16 @@ static void IndexAdd2D(Tensor &src, Array1<int32_t> &indexes,
   int32_t dest_stride0 = dest->Stride(0);
   int32_t dest_stride1 = dest->Stride(1);
 
+  if (deterministic) {
+    FOR_REAL_AND_INT32_TYPES(
+        dtype, T,
+        IndexAdd2DSortedImpl<T>(context, src.Data<T>(), src_dim0, src_dim1,
+                                src_stride0, src_stride1, indexes,
+                                allow_minus_one, dest_dim, dest_stride0,
+                                dest_stride1, dest->Data<T>()));
+    return;
+  }
+
   const int32_t *indexes_data = indexes.Data();
 
   FOR_REAL_AND_INT32_TYPES(
@@ -425,13 +715,13 @@ static void IndexAdd2D(Tensor &src, Array1<int32_t> &indexes,
 }
 
 void IndexAdd(Tensor &src, Array1<int32_t> &indexes, bool allow_minus_one,
-              Tensor *dest) {
+              Tensor *dest, bool deterministic /*= false*/) {
   switch (src.NumAxes()) {
     case 1:
-      IndexAdd1D(src, indexes, allow_minus_one, dest);
+      IndexAdd1D(src, indexes, allow_minus_one, deterministic, dest);
       break;
     case 2:
-      IndexAdd2D(src, indexes, allow_minus_one, dest);
+      IndexAdd2D(src, indexes, allow_minus_one, deterministic, dest);
       break;
     default:
       K2_LOG(FATAL) << "Unsupported number of axes: " << src.NumAxes()
@@ -440,6 +730,74 @@ void IndexAdd(Tensor &src, Array1<int32_t> &indexes, bool allow_minus_one,
   }
 }
 
+template <typename T>
+/*static*/ void IndexAddSparseImpl(ContextPtr context, const T *src_data,
+                                   int32_t src_stride,
+                                   const int32_t *order_data,
+                                   Array1<int32_t> &row_splits,
+                                   int32_t num_elems, Tensor *ans) {
+  NVTX_RANGE(K2_FUNC);
+  Array1<T> sorted_values(context, num_elems);
+  T *sorted_values_data = sorted_values.Data();
+  K2_EVAL(
+      context, num_elems, lambda_gather, (int32_t i)->void {
+        sorted_values_data[i] = src_data[order_data[i] * src_stride];
+      });
+  Ragged<T> sorted(RaggedShape2(&row_splits, nullptr, num_elems),
+                   sorted_values);
+  Array1<T> sums(*ans);  // shares memory with `ans`
+  SumPerSublist<T>(sorted, 0, &sums);
+}
+
+Tensor IndexAddSparse(Tensor &src, Array1<int32_t> &indexes,
+                      Array1<int32_t> *unique_indexes) {
+  NVTX_RANGE(K2_FUNC);
+  K2_CHECK_EQ(src.NumAxes(), 1);
+  K2_CHECK_EQ(src.Dim(0), indexes.Dim());
+  K2_CHECK_NE(unique_indexes, nullptr);
+  ContextPtr context = GetContext(src, indexes);
+  int32_t n = indexes.Dim();
+  const int32_t *indexes_data = indexes.Data();
+
+  Renumbering valid(context, n);
+  char *valid_data = valid.Keep().Data();
+  K2_EVAL(
+      context, n, lambda_set_valid, (int32_t i)->void {
+        K2_DCHECK_GE(indexes_data[i], -1);
+        valid_data[i] = (indexes_data[i] != -1);
+      });
+  // `order` maps positions in the sorted array to positions in `src`; it
+  // starts as the positions of the valid indexes.  SortSublists() is a stable
+  // sort, so elements with the same index stay in their original order.
+  Array1<int32_t> order = valid.New2Old().Clone();
+  int32_t num_valid = order.Dim();
+  Array1<int32_t> keys = indexes[order];
+  Ragged<int32_t> sorted(RegularRaggedShape(context, 1, num_valid), keys);
+  Array1<int32_t> sort_order(context, num_valid);
+  SortSublists(&sorted, &sort_order);
+  order = order[sort_order];
+
+  const int32_t *keys_data = keys.Data();
+  Renumbering first(context, num_valid);
+  char *first_data = first.Keep().Data();
+  K2_EVAL(
+      context, num_valid, lambda_set_first, (int32_t i)->void {
+        first_data[i] = (i == 0 || keys_data[i] != keys_data[i - 1]);
+      });
+  // Element i of `row_splits` is the position of the first element with the
+  // i'th distinct index, and its last element is num_valid.
+  Array1<int32_t> row_splits = first.New2Old(true);
+  *unique_indexes = keys[first.New2Old()];
+
+  int32_t num_unique = unique_indexes->Dim();
+  Tensor ans(context, src.GetDtype(), std::vector<int32_t>{num_unique});
+  FOR_REAL_AND_INT32_TYPES(
+      src.GetDtype(), T,
+      IndexAddSparseImpl<T>(context, src.Data<T>(), src.Stride(0),
+                            order.Data(), row_splits, num_valid, &ans));
+  return ans;
+}
+
 template <typename T>
 /*static*/ void SimpleRaggedIndexSelect1DImpl(
     ContextPtr context, const T *src_data, int32_t src_stride, int32_t src_dim,
@@ -107,9 +107,42 @@ Tensor IndexAdd(Tensor &src, Array1<int32_t> &indexes, int32_t dim,
                       for each tuple of indexes `i,j,k..` into `src`,
                       `(*dest)[indexes[i],j,k..] += src[i,j,k]`
                       (if `indexes[i] != -1`).
+           @param [in] deterministic  If false, elements are added to `dest`
+                      with atomic adds, so for floating point types the
+                      order of the additions (and hence the rounding of
+                      the result) can differ from run to run.  If true, we
+                      instead sort `indexes` with GetTransposeReordering()
+                      and sum the elements that go to each row of `dest`
+                      with a segmented reduction, in the order they appear
+                      in `src`; the result is reproducible, and this is
+                      also faster when many elements go to the same row
+                      (e.g. backprop through arc_maps of a batch that
+                      shares arcs of one decoding graph).
  */
 void IndexAdd(Tensor &src, Array1<int32_t> &indexes, bool allow_minus_one,
-              Tensor *dest);
+              Tensor *dest, bool deterministic = false);
+
+/*
+  A sparse version of IndexAdd() for 1-D tensors: instead of adding into a
+  dense `dest`, it returns the distinct indexes and the sum of the elements
+  of `src` for each of them.  Its cost does not depend on the size of the
+  (virtual) destination, so use it when only a small fraction of its
+  elements would be touched, e.g. in backprop of intersect_dense_pruned(),
+  where the lattice visits only a few (frame, symbol) pairs of the scores.
+
+           @param [in] src  1-D tensor whose elements are to be summed.
+           @param [in] indexes  Indexes with `indexes.Dim() == src.Dim(0)`;
+                      each element must be -1 (ignored) or >= 0.
+           @param [out] unique_indexes  At exit, the sorted distinct
+                      elements of `indexes` other than -1.
+           @return  Returns a contiguous 1-D tensor with the same dtype as
+                    `src` and `ans.Dim(0) == unique_indexes->Dim()`, with
+                    `ans[i]` the sum of the `src[j]` with
+                    `indexes[j] == (*unique_indexes)[i]`, added in order of
+                    j, so the result is reproducible.
+ */
+Tensor IndexAddSparse(Tensor &src, Array1<int32_t> &indexes,
+                      Array1<int32_t> *unique_indexes);
 
 /*
   Returns a 1-D Tensor that is a result of indexing 1-D `src` with Ragged array
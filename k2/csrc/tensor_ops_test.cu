@@ -17,6 +17,7 @@
  */
 
 #include <algorithm>
+#include <map>
 #include <vector>
 
 #include "gtest/gtest.h"
@@ -196,7 +197,7 @@ TEST(Index, Index2D) {
 }
 
 template <typename T>
-static void TestIndexAdd1D() {
+static void TestIndexAdd1D(bool deterministic) {
   bool allow_minus_one;
   int32_t src_stride;
   int32_t dest_stride;
@@ -218,7 +219,7 @@ static void TestIndexAdd1D() {
     Tensor dest = GenerateRandTensor1D<T>(context, dest_dim, dest_stride);
     Tensor saved_dest = dest.Clone();
 
-    IndexAdd(src, indexes, allow_minus_one, &dest);
+    IndexAdd(src, indexes, allow_minus_one, &dest, deterministic);
 
     src = src.To(GetCpuContext());
     dest = dest.To(src.Context());
@@ -240,7 +241,7 @@ static void TestIndexAdd1D() {
 }
 
 template <typename T>
-static void TestIndexAdd2D() {
+static void TestIndexAdd2D(bool deterministic) {
   bool allow_minus_one;
   int32_t src_stride;
   int32_t dest_stride;
@@ -265,7 +266,7 @@ static void TestIndexAdd2D() {
         GenerateRandTensor2D<T>(context, num_dest_rows, num_cols, dest_stride);
     Tensor saved_dest = dest.Clone();
 
-    IndexAdd(src, indexes, allow_minus_one, &dest);
+    IndexAdd(src, indexes, allow_minus_one, &dest, deterministic);
 
     src = src.To(GetCpuContext());
     dest = dest.To(src.Context());
@@ -289,15 +290,67 @@ static void TestIndexAdd2D() {
 }
 
 TEST(IndexAdd, IndexAdd1D) {
-  TestIndexAdd1D<float>();
-  TestIndexAdd1D<double>();
-  TestIndexAdd1D<int32_t>();
+  for (bool deterministic : {false, true}) {
+    TestIndexAdd1D<float>(deterministic);
+    TestIndexAdd1D<double>(deterministic);
+    TestIndexAdd1D<int32_t>(deterministic);
+  }
 }
 
 TEST(IndexAdd, IndexAdd2D) {
-  TestIndexAdd2D<float>();
-  TestIndexAdd2D<double>();
-  TestIndexAdd2D<int32_t>();
+  for (bool deterministic : {false, true}) {
+    TestIndexAdd2D<float>(deterministic);
+    TestIndexAdd2D<double>(deterministic);
+    TestIndexAdd2D<int32_t>(deterministic);
+  }
+}
+
+template <typename T>
+static void TestIndexAddSparse() {
+  for (int32_t i = 0; i != 8; ++i) {
+    int32_t src_stride = RandInt(1, 10);
+    int32_t src_dim = RandInt(0, 20000);
+    // A large `dest_dim` makes most indexes distinct, a small one makes
+    // them repeat.
+    int32_t dest_dim = (i & 2) ? RandInt(1, 100) : RandInt(1, 1000000);
+
+    ContextPtr context = (i & 1) ? GetCpuContext() : GetCudaContext();
+    Array1<int32_t> indexes =
+        GenerateRandomIndexes(context, true, src_dim, dest_dim - 1);
+    Tensor src = GenerateRandTensor1D<T>(context, src_dim, src_stride);
+
+    Array1<int32_t> unique_indexes;
+    Tensor ans = IndexAddSparse(src, indexes, &unique_indexes);
+    EXPECT_EQ(ans.NumAxes(), 1);
+    EXPECT_EQ(ans.Dim(0), unique_indexes.Dim());
+
+    src = src.To(GetCpuContext());
+    ans = ans.To(src.Context());
+    indexes = indexes.To(src.Context());
+    unique_indexes = unique_indexes.To(src.Context());
+    const T *src_data = src.Data<T>();
+    std::map<int32_t, T> expected;
+    for (int32_t j = 0; j != src_dim; ++j) {
+      int32_t index = indexes[j];
+      if (index == -1) continue;
+      expected[index] += src_data[j];
+    }
+
+    ASSERT_EQ(unique_indexes.Dim(), static_cast<int32_t>(expected.size()));
+    const T *ans_data = ans.Data<T>();
+    int32_t j = 0;
+    for (const auto &p : expected) {
+      EXPECT_EQ(unique_indexes[j], p.first);
+      EXPECT_NEAR(ans_data[j], p.second, 1e-3);
+      ++j;
+    }
+  }
+}
+
+TEST(IndexAdd, IndexAddSparse) {
+  TestIndexAddSparse<float>();
+  TestIndexAddSparse<double>();
+  TestIndexAddSparse<int32_t>();
 }
 
 template <typename T>
@@ -347,4 +400,59 @@ TEST(Index, SimpleRaggedIndexSelect1D) {
   TestSimpleRaggedIndexSelect1D<int32_t>();
 }
 
+template <typename T>
+static void TestCopyTensorElements() {
+  // Each layout is (dims, strides, byte offset in elements) of the source;
+  // they cover contiguous copies, slices of rows and columns, transposed
+  // layouts and 3-D tensors.
+  struct Layout {
+    std::vector<int32_t> dims, strides;
+    int32_t offset;
+  };
+  std::vector<Layout> layouts = {
+      {{1000}, {1}, 0},         {{1000}, {1}, 1},
+      {{1000}, {3}, 2},         {{50, 40}, {40, 1}, 0},
+      {{50, 40}, {47, 1}, 0},   {{50, 8}, {40, 1}, 4},
+      {{50, 7}, {40, 1}, 1},    {{50, 40}, {1, 50}, 0},
+      {{70, 33}, {1, 75}, 3},   {{1, 40}, {1, 1}, 0},
+      {{40, 1}, {1, 1}, 0},     {{3, 20, 30}, {600, 30, 1}, 0},
+      {{3, 20, 30}, {1, 90, 3}, 0}, {{3, 20, 30}, {700, 32, 1}, 8}};
+  for (auto &c : {GetCpuContext(), GetCudaContext()}) {
+    for (const Layout &layout : layouts) {
+      Shape shape(layout.dims, layout.strides);
+      int64_t begin, end;
+      shape.GetReachableElems(&begin, &end);
+      std::vector<T> data(layout.offset + end);
+      for (size_t i = 0; i != data.size(); ++i) data[i] = T(i % 1000);
+      Array1<T> array(c, data);
+      Tensor src(DtypeOf<T>::dtype, shape, array.GetRegion(),
+                 array.ByteOffset() + layout.offset * sizeof(T));
+      Tensor dest = ToContiguous(src);
+      ASSERT_TRUE(dest.IsContiguous());
+      ASSERT_TRUE(dest.SameDims(src));
+      dest = dest.To(GetCpuContext());
+      const T *dest_data = dest.Data<T>();
+      std::vector<int32_t> index(layout.dims.size(), 0);
+      for (int32_t i = 0; i != dest.NumElements(); ++i) {
+        int32_t src_idx = layout.offset;
+        for (size_t k = 0; k != index.size(); ++k)
+          src_idx += index[k] * layout.strides[k];
+        EXPECT_EQ(dest_data[i], data[src_idx]);
+        // Move to the next index in row-major order.
+        for (int32_t k = static_cast<int32_t>(index.size()) - 1; k >= 0;
+             --k) {
+          if (++index[k] < layout.dims[k]) break;
+          index[k] = 0;
+        }
+      }
+    }
+  }
+}
+
+TEST(CopyTensorElements, Layouts) {
+  TestCopyTensorElements<float>();
+  TestCopyTensorElements<double>();
+  TestCopyTensorElements<int16_t>();
+}
+
 }  // namespace k2
@@ -16,6 +16,10 @@
  * limitations under the License.
  */
 
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <memory>
 #include <utility>
 
 #include "k2/csrc/thread_pool.h"
@@ -28,10 +32,17 @@ static int32_t GetDefaultNumThreads() {
   return num_threads;
 }
 
+// The pool whose thread is the current thread, if any, and the index of the
+// thread in it; used to push nested tasks onto the thread's own deque.
+static thread_local ThreadPool *current_pool = nullptr;
+static thread_local int32_t current_worker = -1;
+
 ThreadPool::ThreadPool(int32_t num_threads)
     : threads_(num_threads > 0 ? num_threads : GetDefaultNumThreads()) {
-  for (auto &thread : threads_)
-    thread = std::thread([this]() { this->ProcessTasks(); });
+  for (std::size_t i = 0; i != threads_.size(); ++i)
+    workers_.emplace_back(new Worker);
+  for (std::size_t i = 0; i != threads_.size(); ++i)
+    threads_[i] = std::thread([this, i]() { this->ProcessTasks(i); });
 }
 
 ThreadPool::~ThreadPool() {
@@ -45,47 +56,118 @@ ThreadPool::~ThreadPool() {
 }
 
 void ThreadPool::WaitAllTasksFinished() {
+  K2_CHECK_NE(current_pool, this) << "Called from a task of this pool";
   std::unique_lock<std::mutex> lock(mutex_);
-  while (!finished_) {
+  while (num_unfinished_ != 0) {
     // wait for the `empty_cond_` condition.
     empty_cond_.wait(lock);
   }
 }
 
-void ThreadPool::ProcessTasks() {
-  std::unique_lock<std::mutex> lock(mutex_);
-  while (keep_running_) {
-    while (tasks_.empty() && keep_running_) {
-      // Wait for the `not_empty_` condition.
-      // SubmitTask() or the destructor will signal it.
-      not_empty_cond_.wait(lock);
-    }
-
-    if (!keep_running_) break;
+void ThreadPool::Push(TaskFunc task) {
+  K2_CHECK_GT(threads_.size(), 0u);
+  int32_t num_workers = static_cast<int32_t>(workers_.size());
+  int32_t i = (current_pool == this ? current_worker
+                                    : next_worker_++ % num_workers);
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    ++num_unfinished_;
+  }
+  {
+    std::lock_guard<std::mutex> lock(workers_[i]->mutex);
+    workers_[i]->tasks.emplace_back(std::move(task));
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    ++num_queued_;
+  }
+  not_empty_cond_.notify_one();
+}
 
-    {
-      auto task = std::move(tasks_.front());
-      tasks_.pop();
-      if (!tasks_.empty()) not_empty_cond_.notify_one();
-      ++running_counter_;
-      lock.unlock();  // let other threads proceed
-      task();
-      // any resource associated with `task` is freed here
+bool ThreadPool::Pop(int32_t i, TaskFunc *task) {
+  int32_t num_workers = static_cast<int32_t>(workers_.size());
+  for (int32_t n = 0; n != num_workers; ++n) {
+    Worker &worker = *workers_[(i + n) % num_workers];
+    std::lock_guard<std::mutex> lock(worker.mutex);
+    if (worker.tasks.empty()) continue;
+    if (n == 0) {
+      *task = std::move(worker.tasks.back());
+      worker.tasks.pop_back();
+    } else {
+      *task = std::move(worker.tasks.front());
+      worker.tasks.pop_front();
     }
+    --num_queued_;
+    return true;
+  }
+  return false;
+}
 
-    lock.lock();
-    --running_counter_;
-    if (tasks_.empty() && running_counter_ == 0) {
-      finished_ = true;
+void ThreadPool::ProcessTasks(int32_t i) {
+  current_pool = this;
+  current_worker = i;
+  while (true) {
+    TaskFunc task;
+    if (Pop(i, &task)) {
+      task();
+      task = nullptr;  // any resource associated with `task` is freed here
+      std::lock_guard<std::mutex> lock(mutex_);
       // if WaitAllTasksFinished() is waiting, wake it up
-      empty_cond_.notify_one();
+      if (--num_unfinished_ == 0) empty_cond_.notify_all();
+      continue;
     }
+    std::unique_lock<std::mutex> lock(mutex_);
+    // Wait for the `not_empty_` condition.  Push() or the destructor will
+    // signal it.
+    not_empty_cond_.wait(
+        lock, [this]() { return num_queued_ > 0 || !keep_running_; });
+    if (!keep_running_ && num_queued_ == 0) break;
+  }
+}
 
-    // the lock is still held here as we assume
-    // that on entering the while() loop, the lock is locked by us
+TaskGroup::~TaskGroup() {
+  try {
+    Wait();
+  } catch (...) {
   }
 }
 
+bool TaskGroup::State::RunOne() {
+  ThreadPool::TaskFunc task;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (pending.empty()) return false;
+    task = std::move(pending.front());
+    pending.pop_front();
+  }
+  std::exception_ptr e;
+  try {
+    task();
+  } catch (...) {
+    e = std::current_exception();
+  }
+  task = nullptr;
+  std::lock_guard<std::mutex> lock(mutex);
+  if (e && !exception) exception = e;
+  if (--num_unfinished == 0) cond.notify_all();
+  return true;
+}
+
+void TaskGroup::Wait() {
+  // Run the tasks no pool thread has started rather than waiting for a
+  // pool thread to become free; this also means nested groups can't
+  // deadlock the pool.
+  while (state_->RunOne()) {
+  }
+  std::exception_ptr e;
+  {
+    std::unique_lock<std::mutex> lock(state_->mutex);
+    state_->cond.wait(lock, [this]() { return state_->num_unfinished == 0; });
+    std::swap(e, state_->exception);
+  }
+  if (e) std::rethrow_exception(e);
+}
+
 ThreadPool *GetThreadPool() {
   static ThreadPool *pool = nullptr;
   static std::once_flag init_flag;
@@ -101,4 +183,98 @@ ThreadPool *GetThreadPool() {
   return pool;
 }
 
+// Guards `cpu_thread_pool` and `num_cpu_threads`.
+static std::mutex cpu_thread_pool_mutex;
+// The workers used by ParallelFor(); it has num_cpu_threads - 1 threads, or is
+// nullptr if num_cpu_threads == 1.  It is a shared_ptr so SetNumCpuThreads()
+// does not destroy a pool that is still in use.
+static std::shared_ptr<ThreadPool> cpu_thread_pool;
+static int32_t num_cpu_threads = 1;
+
+void SetNumCpuThreads(int32_t num_threads) {
+  if (num_threads <= 0) num_threads = GetDefaultNumThreads();
+  std::lock_guard<std::mutex> lock(cpu_thread_pool_mutex);
+  if (num_threads == num_cpu_threads) return;
+  num_cpu_threads = num_threads;
+  if (num_threads == 1)
+    cpu_thread_pool = nullptr;
+  else
+    cpu_thread_pool = std::make_shared<ThreadPool>(num_threads - 1);
+}
+
+int32_t GetNumCpuThreads() {
+  std::lock_guard<std::mutex> lock(cpu_thread_pool_mutex);
+  return num_cpu_threads;
+}
+
+// True in a thread while it runs tasks of a ParallelFor(); nested calls are
+// then run serially, as the outer call already keeps the threads busy.
+static thread_local bool inside_parallel_for = false;
+
+void ParallelFor(int32_t begin, int32_t end,
+                 const std::function<void(int32_t)> &func) {
+  if (end <= begin) return;
+  std::shared_ptr<ThreadPool> pool;
+  if (!inside_parallel_for) {
+    std::lock_guard<std::mutex> lock(cpu_thread_pool_mutex);
+    pool = cpu_thread_pool;
+  }
+  if (pool == nullptr || end - begin == 1) {
+    for (int32_t i = begin; i != end; ++i) func(i);
+    return;
+  }
+
+  // Iterations are handed out dynamically; we use a TaskGroup rather than
+  // WaitAllTasksFinished() so that concurrent callers don't wait for each
+  // other's tasks.
+  std::atomic<int32_t> next(begin);
+  std::mutex mutex;
+  std::exception_ptr exception;
+  auto run = [&]() {
+    bool was_inside = inside_parallel_for;
+    inside_parallel_for = true;
+    int32_t i;
+    while ((i = next++) < end) {
+      try {
+        func(i);
+      } catch (...) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!exception) exception = std::current_exception();
+      }
+    }
+    inside_parallel_for = was_inside;
+  };
+
+  int32_t num_tasks = std::min<int32_t>(pool->GetNumThreads(),
+                                        end - begin - 1);
+  TaskGroup group(pool.get());
+  for (int32_t n = 0; n != num_tasks; ++n) group.Run(run);
+  run();  // the calling thread takes part too.
+  group.Wait();
+  if (exception) std::rethrow_exception(exception);
+}
+
+static std::atomic<int32_t> cpu_eval_min_size(32768);
+static std::atomic<int32_t> cpu_eval_grain(8192);
+
+void SetCpuEvalConfig(int32_t min_size, int32_t grain) {
+  K2_CHECK_GT(min_size, 0);
+  K2_CHECK_GT(grain, 0);
+  cpu_eval_min_size = min_size;
+  cpu_eval_grain = grain;
+}
+
+bool UseParallelCpuEval(int64_t n, int32_t *grain) {
+  // Most loops are small, so check the size before taking the lock.
+  if (n < cpu_eval_min_size.load(std::memory_order_relaxed) ||
+      inside_parallel_for)
+    return false;
+  {
+    std::lock_guard<std::mutex> lock(cpu_thread_pool_mutex);
+    if (cpu_thread_pool == nullptr) return false;
+  }
+  *grain = cpu_eval_grain.load(std::memory_order_relaxed);
+  return true;
+}
+
 }  // namespace k2
@@ -18,17 +18,29 @@
 #ifndef K2_CSRC_THREAD_POOL_H_
 #define K2_CSRC_THREAD_POOL_H_
 
+#include <atomic>
 #include <condition_variable>  // NOLINT
+#include <deque>
+#include <exception>
 #include <functional>
+#include <future>  // NOLINT
+#include <memory>
 #include <mutex>  // NOLINT
-#include <queue>
 #include <thread>  // NOLINT
+#include <utility>
 #include <vector>
 
 #include "k2/csrc/log.h"
 
 namespace k2 {
 
+/*
+  A pool of threads with one task deque per thread.  A thread takes tasks
+  from the back of its own deque and, when that is empty, steals them from the
+  front of the other threads' deques.  Tasks submitted from inside a task
+  of this pool go to the deque of the thread running it (so they don't contend
+  with tasks submitted from elsewhere); other tasks are distributed round-robin.
+ */
 class ThreadPool {
  public:
   using TaskFunc = std::function<void()>;
@@ -62,57 +74,72 @@ class ThreadPool {
    */
   template <typename Lambda>
   void SubmitTask(Lambda task) {
-    K2_CHECK_GT(threads_.size(), 0u);
-    std::lock_guard<std::mutex> lock(mutex_);
-    tasks_.emplace(static_cast<TaskFunc>(task));
-    not_empty_cond_.notify_one();
-    finished_ = false;
+    Push(static_cast<TaskFunc>(task));
   }
 
-  /* The caller is blocked if `tasks_` is not empty.
-   * If `tasks_` is empty, it returns immediately.
+  /* Like SubmitTask(), but returns a future for the return value of `task`
+   * (or the exception it throws).
+   *
+   * CAUTION: Don't wait for the future inside a task of this pool if the
+   * waited-for task may be queued behind it; use TaskGroup for that.
    */
-  void WaitAllTasksFinished();
+  template <typename Lambda>
+  auto Submit(Lambda task) -> std::future<decltype(task())> {
+    using R = decltype(task());
+    auto packaged = std::make_shared<std::packaged_task<R()>>(std::move(task));
+    std::future<R> ans = packaged->get_future();
+    Push([packaged]() { (*packaged)(); });
+    return ans;
+  }
 
- private:
-  /* Remove tasks from `task_` and process them.
-   *
-   * If `keep_running_` is false, the function will return
-   * after processing the current task.
-   *
-   * If the task queue is empty, the caller is blocked.
+  /* The caller is blocked until all submitted tasks have finished.
+   * It returns immediately if there are none.  Must not be called from a
+   * task of this pool.
    */
-  void ProcessTasks();
+  void WaitAllTasksFinished();
 
  private:
-  // new tasks are added to this queue
-  std::queue<TaskFunc> tasks_;
+  struct Worker {
+    std::mutex mutex;  // protects `tasks`
+    std::deque<TaskFunc> tasks;
+  };
+
+  void Push(TaskFunc task);
+
+  /* Take a task, trying the deque of thread `i` first (from the back) and
+   * then stealing from the others (from the front).  Return false if all
+   * deques are empty. */
+  bool Pop(int32_t i, TaskFunc *task);
 
+  // The loop of thread `i`.
+  void ProcessTasks(int32_t i);
+
+ private:
+  std::vector<std::unique_ptr<Worker>> workers_;
   std::vector<std::thread> threads_;
+
+  // Protects `num_unfinished_` and `keep_running_` and is used with the
+  // condition variables.  It is not held while tasks are queued or taken.
   std::mutex mutex_;
 
-  // When the last task is removed and processed from `tasks_`,
-  // `empty_cond_` is signaled.
+  // Signaled when `num_unfinished_` becomes 0.
   std::condition_variable empty_cond_;
 
-  // When a new task is added to `tasks_`,
-  // `not_empty_cond_` is signaled.
+  // Signaled when a task is queued.
   std::condition_variable not_empty_cond_;
 
-  // Set it to false in the destructor to
-  // ask threads to not process tasks in the
-  // waiting queue
+  // Set it to false in the destructor to ask the threads to exit.
   bool keep_running_ = true;
 
-  // Set it to true when the task queue is empty
-  bool finished_ = true;
+  // The number of tasks that are queued or running.
+  int32_t num_unfinished_ = 0;
 
-  // Whenever a thread is about to process a task,
-  // the counter is incremented
-  //
-  // Whenever a thread finishes processing a task,
-  // the counter is decremented.
-  int32_t running_counter_ = 0;
+  // The number of tasks in `workers_`; it is incremented with `mutex_` held
+  // so that threads about to wait for a task don't miss a new one.
+  std::atomic<int32_t> num_queued_{0};
+
+  // Used to distribute tasks submitted from outside the pool.
+  std::atomic<uint32_t> next_worker_{0};
 };
 
 /* Get a pointer to global thread pool.
@@ -122,6 +149,110 @@ class ThreadPool {
  */
 ThreadPool *GetThreadPool();
 
+/*
+  A set of tasks run on a ThreadPool that can be waited for independently of
+  other tasks in the pool.  Wait() runs the tasks of this group that no pool
+  thread has started yet in the calling thread, and then waits for the
+  others, so it is safe to use a TaskGroup (and wait for it) inside a task of
+  the same pool, e.g. for a task to wait for its subtasks.
+
+  Usage:
+     TaskGroup group;
+     for (...) group.Run([...]() { ... });
+     group.Wait();
+ */
+class TaskGroup {
+ public:
+  explicit TaskGroup(ThreadPool *pool = GetThreadPool())
+      : pool_(pool), state_(std::make_shared<State>()) {}
+
+  // Waits for the tasks (but does not re-throw their exceptions).
+  ~TaskGroup();
+
+  TaskGroup(const TaskGroup &) = delete;
+  TaskGroup &operator=(const TaskGroup &) = delete;
+
+  // Run `task`, which should be convertible to std::function<void()>, in
+  // the pool (or in Wait()).
+  template <typename Lambda>
+  void Run(Lambda task) {
+    {
+      std::lock_guard<std::mutex> lock(state_->mutex);
+      state_->pending.emplace_back(static_cast<ThreadPool::TaskFunc>(task));
+      ++state_->num_unfinished;
+    }
+    std::shared_ptr<State> state = state_;
+    pool_->SubmitTask([state]() { state->RunOne(); });
+  }
+
+  /* Wait for all tasks run so far to finish.  If any of them threw, the
+     first exception is re-thrown here. */
+  void Wait();
+
+ private:
+  struct State {
+    std::mutex mutex;
+    std::condition_variable cond;
+    // Tasks that no thread has started yet.
+    std::deque<ThreadPool::TaskFunc> pending;
+    // Tasks that are pending or running.
+    int32_t num_unfinished = 0;
+    std::exception_ptr exception;
+
+    // Runs the first pending task, if any; returns false if there was none.
+    bool RunOne();
+  };
+
+  ThreadPool *pool_;
+  std::shared_ptr<State> state_;
+};
+
+/* Set the number of threads that ParallelFor() uses, including the calling
+ * thread.  It is 1 by default, meaning ParallelFor() runs serially in the
+ * calling thread.  If `num_threads` is <= 0, it is set to
+ * `std::thread::hardware_concurrency()`.
+ *
+ * CAUTION: It is not safe to call this while another thread is inside
+ * ParallelFor().
+ */
+void SetNumCpuThreads(int32_t num_threads);
+
+// Return the number of threads that ParallelFor() uses.
+int32_t GetNumCpuThreads();
+
+/* Call `func(i)` for `begin <= i < end`, using up to GetNumCpuThreads()
+ * threads (the calling thread is one of them), and return when all calls
+ * have finished.  The order in which `func` is called is unspecified, so
+ * `func(i)` should only write to outputs that are specific to `i`; if it does,
+ * the result does not depend on the number of threads.
+ *
+ * If any call to `func` throws, the first exception is re-thrown in the
+ * calling thread after all calls have finished.
+ *
+ * If `func` itself calls ParallelFor(), the inner call runs serially in the
+ * thread that made it.
+ */
+void ParallelFor(int32_t begin, int32_t end,
+                 const std::function<void(int32_t)> &func);
+
+/* Configure how Eval(), Eval2(), EvalFused() and SetData() in eval.h (and so
+ * K2_EVAL() and K2_EVAL2()) run on CPU.  If ParallelFor() has more than one
+ * thread (see SetNumCpuThreads()) and a loop has at least `min_size`
+ * iterations, the loop is run with ParallelFor() in chunks of `grain`
+ * consecutive iterations; otherwise it is a plain loop.  The defaults are
+ * min_size = 32768 and grain = 8192.  Require min_size > 0 and grain > 0.
+ *
+ * CAUTION: Like SetNumCpuThreads(), it is not safe to call this while
+ * another thread is inside Eval().
+ */
+void SetCpuEvalConfig(int32_t min_size, int32_t grain);
+
+/* Used by Eval() and friends: return true if a CPU loop with `n` iterations
+ * should use ParallelFor(), and if so set `*grain` to the number of
+ * iterations per chunk.
+ */
+bool UseParallelCpuEval(int64_t n, int32_t *grain);
+
 }  // namespace k2
 
 #endif  // K2_CSRC_THREAD_POOL_H_
@@ -17,14 +17,22 @@
  */
 
 #include <algorithm>
+#include <atomic>
+#include <future>  // NOLINT
 #include <mutex>  // NOLINT
+#include <stdexcept>
 #include <string>
 #include <unordered_set>
 #include <utility>
+#include <vector>
 
 #include "gtest/gtest.h"
+#include "k2/csrc/array.h"
+#include "k2/csrc/context.h"
+#include "k2/csrc/eval.h"
 #include "k2/csrc/math.h"
 #include "k2/csrc/thread_pool.h"
+#include "k2/csrc/utils.h"
 
 namespace k2 {
 
@@ -94,4 +102,158 @@ TEST(ThreadPool, TestThreadPool) {
   for (int32_t i = 0; i != num_tasks; ++i) EXPECT_EQ(i, data[i]);
 }
 
+TEST(ThreadPool, TestSubmit) {
+  ThreadPool pool(4);
+  std::vector<std::future<int32_t>> futures;
+  for (int32_t i = 0; i != 100; ++i)
+    futures.push_back(pool.Submit([i]() -> int32_t { return i * i; }));
+  for (int32_t i = 0; i != 100; ++i) EXPECT_EQ(futures[i].get(), i * i);
+
+  std::future<void> f =
+      pool.Submit([]() -> void { throw std::runtime_error("error"); });
+  EXPECT_THROW(f.get(), std::runtime_error);
+}
+
+// Sums [begin, end) by splitting it recursively into subtasks, each of which
+// waits for its own subtasks.
+static int64_t RecursiveSum(ThreadPool *pool, int32_t begin, int32_t end) {
+  if (end - begin <= 10) {
+    int64_t ans = 0;
+    for (int32_t i = begin; i != end; ++i) ans += i;
+    return ans;
+  }
+  int32_t mid = (begin + end) / 2;
+  int64_t left = 0, right = 0;
+  TaskGroup group(pool);
+  group.Run([&]() { left = RecursiveSum(pool, begin, mid); });
+  group.Run([&]() { right = RecursiveSum(pool, mid, end); });
+  group.Wait();
+  return left + right;
+}
+
+TEST(ThreadPool, TestTaskGroup) {
+  // Nested groups must not deadlock, even with fewer threads than levels.
+  for (int32_t num_threads : {1, 2, 8}) {
+    ThreadPool pool(num_threads);
+    int32_t n = RandInt(0, 100000);
+    EXPECT_EQ(RecursiveSum(&pool, 0, n), static_cast<int64_t>(n) * (n - 1) / 2);
+
+    // Groups are waited for independently, and exceptions are re-thrown.
+    TaskGroup group1(&pool), group2(&pool);
+    std::atomic<int32_t> count1(0), count2(0);
+    for (int32_t i = 0; i != 50; ++i) {
+      group1.Run([&count1]() { ++count1; });
+      group2.Run([&count2]() { ++count2; });
+    }
+    group1.Run([]() { throw std::runtime_error("error"); });
+    EXPECT_THROW(group1.Wait(), std::runtime_error);
+    EXPECT_EQ(count1, 50);
+    group2.Wait();
+    EXPECT_EQ(count2, 50);
+  }
+}
+
+TEST(ThreadPool, TestParallelFor) {
+  int32_t saved_num_threads = GetNumCpuThreads();
+  for (int32_t num_threads : {1, 2, 8}) {
+    SetNumCpuThreads(num_threads);
+    EXPECT_EQ(GetNumCpuThreads(), num_threads);
+
+    int32_t begin = RandInt(0, 10), end = begin + RandInt(0, 10000);
+    std::vector<int32_t> data(end, -1);
+    ParallelFor(begin, end, [&data](int32_t i) -> void { data[i] = 2 * i; });
+    for (int32_t i = 0; i != end; ++i)
+      EXPECT_EQ(data[i], i < begin ? -1 : 2 * i);
+
+    // The exception is re-thrown in the calling thread.
+    EXPECT_THROW(ParallelFor(0, 100,
+                             [](int32_t i) -> void {
+                               if (i == 50) throw std::runtime_error("50");
+                             }),
+                 std::runtime_error);
+  }
+  SetNumCpuThreads(saved_num_threads);
+}
+
+TEST(ThreadPool, TestParallelCpuEval) {
+  ContextPtr c = GetCpuContext();
+  int32_t saved_num_threads = GetNumCpuThreads();
+  for (int32_t num_threads : {1, 4}) {
+    SetNumCpuThreads(num_threads);
+    SetCpuEvalConfig(RandInt(1, 100), RandInt(1, 50));
+
+    int32_t n = RandInt(0, 20000);
+    Array1<int32_t> a(c, n, -1);
+    int32_t *a_data = a.Data();
+    K2_EVAL(
+        c, n, lambda_set_a, (int32_t i)->void { a_data[i] = 3 * i; });
+    for (int32_t i = 0; i != n; ++i) EXPECT_EQ(a[i], 3 * i);
+
+    int32_t m = RandInt(0, 100), cols = RandInt(1, 200);
+    Array2<int32_t> b(c, m, cols);
+    auto b_acc = b.Accessor();
+    K2_EVAL2(
+        c, m, cols, lambda_set_b,
+        (int32_t i, int32_t j)->void { b_acc(i, j) = i * cols + j; });
+    for (int32_t i = 0; i != m; ++i)
+      for (int32_t j = 0; j != cols; ++j)
+        EXPECT_EQ(b.Accessor()(i, j), i * cols + j);
+
+    // Host atomics must be safe when the lambdas run in parallel.
+    Array1<int32_t> sum(c, 1, 0);
+    Array1<int32_t> max_value(c, 1, -1);
+    int32_t *sum_data = sum.Data();
+    int32_t *max_value_data = max_value.Data();
+    K2_EVAL(
+        c, n, lambda_sum, (int32_t i)->void {
+          AtomicAdd(sum_data, i);
+          AtomicMax(max_value_data, i);
+        });
+    EXPECT_EQ(sum[0], n * (n - 1) / 2);
+    EXPECT_EQ(max_value[0], n - 1);
+  }
+  // Restore the defaults.
+  SetCpuEvalConfig(32768, 8192);
+  SetNumCpuThreads(saved_num_threads);
+}
+
+TEST(ThreadPool, TestBackgroundRunner) {
+  for (auto &c : {GetCpuContext(), GetCudaContext()}) {
+    int32_t num_tasks = 20;
+    std::vector<Array1<int32_t>> results(num_tasks);
+    BackgroundRunner br(c);
+    for (int32_t i = 0; i != num_tasks; ++i) {
+      br.Background(
+          [c, i, &results]() -> void {
+            // tasks may themselves run things in the background.
+            BackgroundRunner inner(c);
+            inner.Background([c, i, &results]() -> void {
+              results[i] = Array1<int32_t>(c, 10 + i, i);
+            }, 10000);
+            inner.Wait();
+          },
+          100000);
+    }
+    br.Wait();
+    for (int32_t i = 0; i != num_tasks; ++i) {
+      Array1<int32_t> cpu = results[i].To(GetCpuContext());
+      ASSERT_EQ(cpu.Dim(), 10 + i);
+      for (int32_t j = 0; j != cpu.Dim(); ++j) EXPECT_EQ(cpu[j], i);
+    }
+
+    // The object can be re-used after Wait(), and the first exception is
+    // re-thrown there.
+    std::atomic<int32_t> count(0);
+    for (int32_t i = 0; i != num_tasks; ++i) {
+      br.Background([i, &count]() -> void {
+        ++count;
+        if (i % 2 == 1) throw std::runtime_error("odd");
+      });
+    }
+    EXPECT_THROW(br.Wait(), std::runtime_error);
+    EXPECT_EQ(count, num_tasks);
+    br.Wait();  // no tasks left.
+  }
+}
+
 }  // namespace k2
@@ -23,6 +23,7 @@
 #include "k2/csrc/context.h"
 #include "k2/csrc/fsa_algo.h"
 #include "k2/csrc/fsa_utils.h"
+#include "k2/csrc/ragged_ops.h"
 
 namespace k2 {
 
@@ -36,9 +37,28 @@ class TopSorter {
      high-level overview of the algorithm.
 
        @param [in] fsas    A vector of FSAs; must have 3 axes.
+       @param [in] keep_states  If not NULL, a renumbering of the states
+                           of `fsas` (as idx01's) whose Keep() is 1 for the
+                           states to sort and 0 for the states to drop,
+                           together with the arcs entering or leaving them.
+                           The states that are kept must be connected, see
+                           GetConnectedStates().
    */
-  explicit TopSorter(FsaVec &fsas) : c_(fsas.Context()), fsas_(fsas) {
+  explicit TopSorter(FsaVec &fsas, Renumbering *keep_states = nullptr)
+      : c_(fsas.Context()), fsas_(fsas) {
     K2_CHECK_EQ(fsas_.NumAxes(), 3);
+    if (keep_states != nullptr) {
+      K2_CHECK_EQ(keep_states->NumOldElems(), fsas_.TotSize(1));
+      keep_states_ = keep_states->Keep();
+      num_kept_states_ = keep_states->NumNewElems();
+    } else {
+      num_kept_states_ = fsas_.TotSize(1);
+    }
+  }
+
+  // Returns the data of keep_states_, or NULL if we are keeping all states.
+  const char *KeepStatesData() const {
+    return keep_states_.IsValid() ? keep_states_.Data() : nullptr;
   }
 
   /*
@@ -61,6 +81,7 @@ class TopSorter {
     // NOTE: this is not very optimal given that we're keeping only a small
     // number of states, but at this point I don't want to optimize too heavily.
     char *keep_data = state_renumbering.Keep().Data();
+    const char *keep_states_data = KeepStatesData();
     const int32_t *state_in_degree_data = state_in_degree_.Data(),
                   *fsas_row_ids1_data = fsas_.RowIds(1).Data(),
                   *fsas_row_splits1_data = fsas_.RowSplits(1).Data();
@@ -69,7 +90,9 @@ class TopSorter {
           // Make this state a member of the initial batch if it has zero
           // in-degree (note: this won't include final states, as we incremented
           // their in-degree to avoid them appearing here.)
-          keep_data[fsas_idx01] = state_in_degree_data[fsas_idx01] == 0;
+          keep_data[fsas_idx01] =
+              state_in_degree_data[fsas_idx01] == 0 &&
+              (keep_states_data == nullptr || keep_states_data[fsas_idx01]);
         });
 
     Array1<int32_t> first_iter_values = state_renumbering.New2Old();
@@ -133,6 +156,7 @@ class TopSorter {
                   *arcs_row_splits2_data = arcs_shape.RowSplits(2).Data(),
                   *fsas_row_splits1_data = fsas_.RowSplits(1).Data(),
                   *dest_states_data = dest_states_.values.Data();
+    const char *keep_states_data = KeepStatesData();
     char *keep_arc_data = arc_renumbering.Keep().Data();
     int32_t *state_in_degree_data = state_in_degree_.Data(),
             *next_iter_states_data = next_iter_states.Data(),
@@ -151,8 +175,11 @@ class TopSorter {
                   fsas_idx012 = fsas_idx01x + arcs_idx2,
                   fsas_dest_state_idx01 = dest_states_data[fsas_idx012];
           // if this arc is a self-loop, just ignore this arc as we have
-          // processed the dest_state (==src_state)
-          if (fsas_dest_state_idx01 == fsas_idx01) {
+          // processed the dest_state (==src_state); also ignore arcs to
+          // states that we are dropping.
+          if (fsas_dest_state_idx01 == fsas_idx01 ||
+              (keep_states_data != nullptr &&
+               !keep_states_data[fsas_dest_state_idx01])) {
             keep_arc_data[arcs_idx012] = 0;
             return;
           }
@@ -210,13 +237,17 @@ class TopSorter {
     NVTX_RANGE(K2_FUNC);
     int32_t num_fsas = fsas_.Dim0();
     const int32_t *fsas_row_splits1_data = fsas_.RowSplits(1).Data();
+    const char *keep_states_data = KeepStatesData();
     Array1<int32_t> has_final_state(c_, num_fsas + 1);
     int32_t *has_final_state_data = has_final_state.Data();
     K2_EVAL(
         c_, num_fsas, lambda_set_has_final_state, (int32_t i)->void {
           int32_t split = fsas_row_splits1_data[i],
                   next_split = fsas_row_splits1_data[i + 1];
-          has_final_state_data[i] = (next_split > split);
+          has_final_state_data[i] =
+              (next_split > split &&
+               (keep_states_data == nullptr ||
+                keep_states_data[next_split - 1]));
         });
     ExclusiveSum(has_final_state, &has_final_state);
 
@@ -249,20 +280,25 @@ class TopSorter {
 
     dest_states_ = Ragged<int32_t>(fsas_.shape, dest_states_idx01);
 
-    // remove those arcs which are self-loops, as we will not count them in
-    // state_in_degree_
+    // remove those arcs which are self-loops, or which enter or leave states
+    // that we are dropping, as we will not count them in state_in_degree_
     Renumbering arc_renumbering(c_, num_arcs);
     char *keep_arc_data = arc_renumbering.Keep().Data();
+    const char *keep_states_data = KeepStatesData();
     const int32_t *dest_states_data = dest_states_.values.Data(),
                   *fsas_row_ids2_data = fsas_.RowIds(2).Data();
     K2_EVAL(
         c_, num_arcs, lambda_set_keep_arc, (int32_t arc_idx012)->void {
           int32_t dest_state_idx01 = dest_states_data[arc_idx012],
                   src_state_idx01 = fsas_row_ids2_data[arc_idx012];
-          keep_arc_data[arc_idx012] = dest_state_idx01 != src_state_idx01;
+          keep_arc_data[arc_idx012] =
+              dest_state_idx01 != src_state_idx01 &&
+              (keep_states_data == nullptr ||
+               (keep_states_data[src_state_idx01] &&
+                keep_states_data[dest_state_idx01]));
         });
     state_in_degree_ =
-        GetCounts(dest_states_.values[arc_renumbering.New2Old()], num_states);
+        GetCounts(arc_renumbering.Compact(dest_states_.values), num_states);
 
     int32_t *state_in_degree_data = state_in_degree_.Data();
     const int32_t *fsas_row_splits1_data = fsas_.RowSplits(1).Data();
@@ -280,14 +316,17 @@ class TopSorter {
         });
   }
 
-  /* Does the main work of top-sorting and returns the resulting FSAs.
-        @param [out] arc_map  if non-NULL, the map from (arcs in output)
-                     to (corresponding arcs in input) is written to here.
-        @return   Returns the top-sorted FsaVec.  (Note: this may have
-                 fewer states than the input if there were unreachable
-                 states.)
+  /* Does the main work of top-sorting and returns the new order of the
+     states.
+        @param [out] state_batches  if non-NULL, the batches of states
+                     found while sorting, as idx01's into the output (i.e.
+                     indexes into the returned array), are written to
+                     here; see TopSort() in fsa_algo.h.
+        @return   Returns the kept states of fsas_ (as idx01's) in
+                  top-sorted order, i.e. the `order` to give to
+                  RenumberFsaVec().
    */
-  FsaVec TopSort(Array1<int32_t> *arc_map) {
+  Array1<int32_t> GetOrder(Ragged<int32_t> *state_batches) {
     NVTX_RANGE(K2_FUNC);
     InitDestStatesAndInDegree();
 
@@ -305,13 +344,16 @@ class TopSorter {
       // Act as a flag
       Array1<int32_t> start_state_present(c_, 1, 1);
       int32_t *start_state_present_data = start_state_present.Data();
+      const char *keep_states_data = KeepStatesData();
       K2_EVAL(
           c_, num_fsas, lambda_set_start_state_present,
           (int32_t fsa_idx0)->void {
             int32_t start_state_idx0x = fsas_row_splits1_data[fsa_idx0],
                     next_start_state_idx0x =
                         fsas_row_splits1_data[fsa_idx0 + 1];
-            if (next_start_state_idx0x > start_state_idx0x) {  // non-empty Fsa
+            if (next_start_state_idx0x > start_state_idx0x &&
+                (keep_states_data == nullptr ||
+                 keep_states_data[start_state_idx0x])) {  // non-empty Fsa
               // `first_state_idx01` is the 1st state in the first batch of this
               // fsa (it must be the start state of this Fsa according to our
               // implementation of `GetFirstBatch`
@@ -336,10 +378,32 @@ class TopSorter {
     for (size_t i = 0; i < iters.size(); ++i) iters_ptrs[i] = iters[i].get();
     Ragged<int32_t> all_states =
         Cat(1, static_cast<int32_t>(iters.size()), iters_ptrs.data());
-    K2_CHECK_EQ(all_states.NumElements(), fsas_.TotSize(1))
+    K2_CHECK_EQ(all_states.NumElements(), num_kept_states_)
         << "Our current implementation requires that the input Fsa is acyclic, "
            "but it seems there are cycles other than self-loops.";
-    return RenumberFsaVec(fsas_, all_states.values, arc_map);
+    if (state_batches != nullptr) {
+      // The n'th element of all_states.values becomes state n of the output
+      // (as an idx01), so map the states in each batch accordingly.  Each
+      // state only has arcs to states in later batches (or itself).
+      Ragged<int32_t> batches =
+          Stack(0, static_cast<int32_t>(iters.size()), iters_ptrs.data());
+      Array1<int32_t> old2new = InvertPermutation(all_states.values);
+      *state_batches = Ragged<int32_t>(batches.shape, old2new[batches.values]);
+    }
+    return all_states.values;
+  }
+
+  /* Top-sorts the FSAs and returns the result.
+        @param [out] arc_map  if non-NULL, the map from (arcs in output)
+                     to (corresponding arcs in input) is written to here.
+        @param [out] state_batches  See GetOrder().
+        @return   Returns the top-sorted FsaVec.  (Note: this may have
+                 fewer states than the input if there were unreachable
+                 states.)
+   */
+  FsaVec TopSort(Array1<int32_t> *arc_map, Ragged<int32_t> *state_batches) {
+    NVTX_RANGE(K2_FUNC);
+    return RenumberFsaVec(fsas_, GetOrder(state_batches), arc_map);
   }
 
   ContextPtr c_;
@@ -353,22 +417,160 @@ class TopSorter {
   // fsas_.TotSize(1)), i.e. number of incoming arcs (except those from
   // states that were already processed).
   Array1<int32_t> state_in_degree_;
+
+  // If valid, 1 for the states (idx01's into fsas_) that we are sorting and 0
+  // for those that we are dropping; see the constructor.
+  Array1<char> keep_states_;
+  // The number of states that we are sorting.
+  int32_t num_kept_states_;
 };
 
-void TopSort(FsaVec &src, FsaVec *dest, Array1<int32_t> *arc_map) {
+/*
+  Renumbers the states of `fsas` according to `order`, dropping the arcs that
+  enter or leave states that are not kept, and sorts the arcs leaving each
+  state as ArcSort() does.
+
+     @param [in] fsas  The FsaVec to renumber.
+     @param [in] keep_states  A renumbering of the states of `fsas` (as
+                       idx01's) whose Keep() is 1 for the states in `order`.
+     @param [in] order  The kept states (as idx01's into `fsas`) in the order
+                       in which they should appear in the output; the
+                       states of each FSA must be contiguous and in order
+                       of FSA index.
+     @param [out] arc_map  If not NULL, the map from arcs in the output to
+                       arcs in `fsas` will be written to here.
+     @return  Returns the renumbered, arc-sorted FsaVec.
+ */
+static FsaVec RenumberFsaVecAndArcSort(FsaVec &fsas, Renumbering &keep_states,
+                                       const Array1<int32_t> &order,
+                                       Array1<int32_t> *arc_map) {
   NVTX_RANGE(K2_FUNC);
+  ContextPtr &c = fsas.Context();
+  int32_t num_fsas = fsas.Dim0(), num_states = fsas.TotSize(1),
+          num_arcs = fsas.NumElements(), new_num_states = order.Dim();
+  K2_CHECK_EQ(new_num_states, keep_states.NumNewElems());
+
+  const Arc *fsas_arcs_data = fsas.values.Data();
+  const char *keep_states_data = keep_states.Keep().Data();
+  const int32_t *fsas_row_ids2_data = fsas.RowIds(2).Data();
+  Renumbering arc_renumbering(c, num_arcs);
+  char *keep_arc_data = arc_renumbering.Keep().Data();
+  K2_EVAL(
+      c, num_arcs, lambda_set_keep_arc, (int32_t arc_idx012)->void {
+        Arc arc = fsas_arcs_data[arc_idx012];
+        int32_t src_state_idx01 = fsas_row_ids2_data[arc_idx012],
+                dest_state_idx01 =
+                    arc.dest_state - arc.src_state + src_state_idx01;
+        keep_arc_data[arc_idx012] = keep_states_data[src_state_idx01] &&
+                                    keep_states_data[dest_state_idx01];
+      });
+  // arc_old2new has an extra element, so that the number of kept arcs
+  // leaving state `s` is arc_old2new[row_splits2[s + 1]] -
+  // arc_old2new[row_splits2[s]].
+  Array1<int32_t> arc_old2new = arc_renumbering.Old2New(true),
+                  arc_new2old = arc_renumbering.New2Old();
+
+  Array1<int32_t> state_old2new(c, num_states),
+      num_arcs_per_state(c, new_num_states + 1);
+  const int32_t *order_data = order.Data(),
+                *fsas_row_splits2_data = fsas.RowSplits(2).Data(),
+                *arc_old2new_data = arc_old2new.Data();
+  int32_t *state_old2new_data = state_old2new.Data(),
+          *num_arcs_per_state_data = num_arcs_per_state.Data();
+  K2_EVAL(
+      c, new_num_states, lambda_set_old2new_and_num_arcs,
+      (int32_t new_state_idx01)->void {
+        int32_t old_state_idx01 = order_data[new_state_idx01];
+        state_old2new_data[old_state_idx01] = new_state_idx01;
+        num_arcs_per_state_data[new_state_idx01] =
+            arc_old2new_data[fsas_row_splits2_data[old_state_idx01 + 1]] -
+            arc_old2new_data[fsas_row_splits2_data[old_state_idx01]];
+      });
+  ExclusiveSum(num_arcs_per_state, &num_arcs_per_state);
+
+  Array1<int32_t> new_row_ids1 = fsas.RowIds(1)[order],
+                  new_row_splits1(c, num_fsas + 1);
+  RowIdsToRowSplits(new_row_ids1, &new_row_splits1);
+  RaggedShape ans_shape = RaggedShape3(&new_row_splits1, &new_row_ids1,
+                                       new_num_states, &num_arcs_per_state,
+                                       nullptr, -1);
+
+  int32_t ans_num_arcs = ans_shape.NumElements();
+  Array1<Arc> ans_arcs(c, ans_num_arcs);
+  Array1<int32_t> ans_arc_map(c, ans_num_arcs);
+  Arc *ans_arcs_data = ans_arcs.Data();
+  int32_t *ans_arc_map_data = ans_arc_map.Data();
+  const int32_t *ans_row_ids2_data = ans_shape.RowIds(2).Data(),
+                *ans_row_ids1_data = ans_shape.RowIds(1).Data(),
+                *ans_row_splits1_data = ans_shape.RowSplits(1).Data(),
+                *ans_row_splits2_data = ans_shape.RowSplits(2).Data(),
+                *fsas_row_splits1_data = fsas.RowSplits(1).Data(),
+                *arc_new2old_data = arc_new2old.Data();
+  K2_EVAL(
+      c, ans_num_arcs, lambda_set_arcs, (int32_t ans_idx012)->void {
+        int32_t ans_idx01 = ans_row_ids2_data[ans_idx012],
+                ans_idx01x = ans_row_splits2_data[ans_idx01],
+                ans_idx0 = ans_row_ids1_data[ans_idx01],
+                ans_idx0x = ans_row_splits1_data[ans_idx0],
+                ans_idx2 = ans_idx012 - ans_idx01x,
+                fsas_idx01 = order_data[ans_idx01],
+                fsas_idx0x = fsas_row_splits1_data[ans_idx0],
+                fsas_idx012 = arc_new2old_data
+                    [arc_old2new_data[fsas_row_splits2_data[fsas_idx01]] +
+                     ans_idx2];
+        Arc arc = fsas_arcs_data[fsas_idx012];
+        arc.src_state = ans_idx01 - ans_idx0x;
+        arc.dest_state =
+            state_old2new_data[fsas_idx0x + arc.dest_state] - ans_idx0x;
+        ans_arcs_data[ans_idx012] = arc;
+        ans_arc_map_data[ans_idx012] = fsas_idx012;
+      });
+
+  FsaVec ans(ans_shape, ans_arcs);
+  if (arc_map != nullptr) {
+    Array1<int32_t> sort_order(c, ans_num_arcs);
+    SortSublists<Arc>(&ans, &sort_order);
+    *arc_map = ans_arc_map[sort_order];
+  } else {
+    SortSublists<Arc>(&ans);
+  }
+  return ans;
+}
+
+void NormalizeLattice(FsaOrVec &src, FsaOrVec *dest,
+                      Array1<int32_t> *arc_map /*= nullptr*/) {
+  NVTX_RANGE(K2_FUNC);
+  K2_CHECK_GE(src.NumAxes(), 2);
+  K2_CHECK_LE(src.NumAxes(), 3);
+  if (src.NumAxes() == 2) {
+    // Turn single Fsa into FsaVec.
+    FsaVec src_vec = FsaToFsaVec(src), dest_vec;
+    // Recurse..
+    NormalizeLattice(src_vec, &dest_vec, arc_map);
+    *dest = GetFsaVecElement(dest_vec, 0);
+    return;
+  }
+  Renumbering keep_states = GetConnectedStates(src);
+  TopSorter sorter(src, &keep_states);
+  Array1<int32_t> order = sorter.GetOrder(nullptr);
+  *dest = RenumberFsaVecAndArcSort(src, keep_states, order, arc_map);
+}
+
+void TopSort(FsaVec &src, FsaVec *dest, Array1<int32_t> *arc_map,
+             Ragged<int32_t> *state_batches /*= nullptr*/) {
+  NVTX_RANGE_PAYLOAD(K2_FUNC, kFsaAlgo, src.NumElements());
   K2_CHECK_GE(src.NumAxes(), 2);
   K2_CHECK_LE(src.NumAxes(), 3);
   if (src.NumAxes() == 2) {
     // Turn single Fsa into FsaVec.
     FsaVec src_vec = FsaToFsaVec(src), dest_vec;
     // Recurse..
-    TopSort(src_vec, &dest_vec, arc_map);
+    TopSort(src_vec, &dest_vec, arc_map, state_batches);
     *dest = GetFsaVecElement(dest_vec, 0);
     return;
   }
   TopSorter sorter(src);
-  *dest = sorter.TopSort(arc_map);
+  *dest = sorter.TopSort(arc_map, state_batches);
 }
 
 }  // namespace k2
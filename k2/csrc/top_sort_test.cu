@@ -253,6 +253,37 @@ TEST(TopSort, RandomVectorOfFsas) {
   }
 }
 
+TEST(TopSort, StateBatches) {
+  int num_fsas = 1 + RandInt(0, 10);
+  for (auto &context : {GetCpuContext(), GetCudaContext()}) {
+    std::vector<Fsa> fsas(num_fsas);
+    std::vector<Fsa *> fsa_array(num_fsas);
+    for (int32_t i = 0; i != num_fsas; ++i) {
+      fsas[i] = GetRandFsaNotTopSorted();
+      fsa_array[i] = &fsas[i];
+    }
+    FsaVec fsa_vec = CreateFsaVec(num_fsas, &fsa_array[0]).To(context);
+
+    FsaVec sorted;
+    Ragged<int32_t> state_batches;
+    TopSort(fsa_vec, &sorted, nullptr, &state_batches);
+    ASSERT_EQ(state_batches.NumAxes(), 3);
+    EXPECT_EQ(state_batches.TotSize(1), num_fsas * state_batches.Dim0());
+    EXPECT_EQ(state_batches.NumElements(), sorted.TotSize(1));
+
+    // The batches from TopSort() can be used in place of those from
+    // GetStateBatches().
+    Array1<double> forward_scores, expected_forward_scores, backward_scores,
+        expected_backward_scores;
+    FsaVecTopology(sorted, state_batches)
+        .GetScores(false, &forward_scores, &backward_scores);
+    FsaVecTopology(sorted).GetScores(false, &expected_forward_scores,
+                                     &expected_backward_scores);
+    EXPECT_TRUE(Equal(forward_scores, expected_forward_scores));
+    EXPECT_TRUE(Equal(backward_scores, expected_backward_scores));
+  }
+}
+
 // another random test which uses IsRandEquivalent to check the result
 TEST(TopSort, RandomVectorOfFsas1) {
   ContextPtr cpu = GetCpuContext();
@@ -337,4 +368,33 @@ TEST(TopSort, RandomVectorOfFsas1) {
     }
   }
 }
+
+TEST(NormalizeLattice, CompareWithConnectTopSortArcSort) {
+  for (int32_t n = 0; n != 4; ++n) {
+    for (auto &context : {GetCpuContext(), GetCudaContext()}) {
+      FsaVec fsa_vec = RandomFsaVec(1, 20, true).To(context);
+      // Add an unconnected FSA, which becomes empty.
+      FsaVec unconnected = FsaToFsaVec(FsaFromString(R"(0 1 1 1
+          2)")).To(context);
+      FsaVec *srcs[] = {&fsa_vec, &unconnected};
+      fsa_vec = Cat(0, 2, srcs);
+
+      FsaVec connected, top_sorted, expected, normalized;
+      Array1<int32_t> arc_map1, arc_map2, arc_map3, arc_map;
+      Connect(fsa_vec, &connected, &arc_map1);
+      TopSort(connected, &top_sorted, &arc_map2);
+      ArcSort(top_sorted, &expected, &arc_map3);
+      Array1<int32_t> expected_arc_map = arc_map1[arc_map2[arc_map3]];
+
+      NormalizeLattice(fsa_vec, &normalized, &arc_map);
+      EXPECT_TRUE(Equal(normalized, expected));
+      EXPECT_TRUE(Equal(arc_map, expected_arc_map));
+
+      // A single Fsa.
+      Fsa fsa = fsa_vec.Index(0, 0), normalized_fsa;
+      NormalizeLattice(fsa, &normalized_fsa);
+      EXPECT_TRUE(Equal(normalized_fsa, expected.Index(0, 0)));
+    }
+  }
+}
 }  // namespace k2
@@ -89,68 +89,12 @@ void RowSplitsToRowIds(ContextPtr c, int32_t num_rows,
     }
   } else {
     K2_CHECK_EQ(d, kCuda);
-    if (1) {
-      mgpu::context_t *mgpu_allocator = GetModernGpuAllocator(c);
-      mgpu::load_balance_search(num_elems, row_splits, num_rows, row_ids,
-                                *mgpu_allocator);
-    } else {
-      // TODO: Will probably just delete this branch at some point.
-
-      // The following algorithm isn't particularly adapted to GPU hardware in
-      // terms of coalesced reads and writes and so on, but it has reasonable
-      // asymptotic time complexity (assuming all kernels run in parallel),
-      // specifically: O(log(largest(row_splits[i+1]-row_splits[i])))
-
-      K2_EVAL(
-          c, num_elems + 1, lambda_init_minus_one,
-          (int32_t i)->void { row_ids[i] = -1; });
-
-      K2_EVAL(
-          c, num_elems + 1, lambda_phase_one, (int32_t i)->void {
-            int32_t this_row_split = row_splits[i],
-                    next_row_split =
-                        (i < num_rows ? row_splits[i + 1] : this_row_split + 1);
-            if (this_row_split < next_row_split) row_ids[this_row_split] = i;
-            // we have to fill in row_ids[this_row_split],
-            // row_ids[this_row_split+1]... row_ids[next_row_split-1] with the
-            // same value but that could be a long loop. Instead we write at
-            // this_row_split and all indexes this_row_split < i <
-            // next_row_split such that i is the result of rounding up
-            // this_row_split to (something)*2^n, for n = 1, 2, 3, ... this will
-            // take time logarithmic in (next_row_split - this_row_split). we
-            // can then fill in the gaps with a logarithmic-time loop, by
-            // looking for a value that's not (-1) by rounding the current index
-            // down to successively higher powers of 2.
-            for (int32_t power = 0, j = this_row_split;
-                 j + (1 << power) < next_row_split; power++) {
-              if (j & (1 << power)) {
-                j += (1 << power);
-                // we know that j is now < next_row_split, because we checked "j
-                // + (1<<power) < next_row_split" in the loop condition. Note,
-                // we don't want a loop-within-a-loop because of how SIMT
-                // works...
-                row_ids[j] = i;
-              }
-            }
-          });
-
-      // could do the next line for num_elems+1, but the element at `num_elems`
-      // will already be set.
-      K2_EVAL(
-          c, num_elems, lambda_phase_two, (int32_t j)->void {
-            int32_t row_index = row_ids[j];
-            if (row_index != -1) return;
-            int32_t power = 0, j2 = j;
-            for (; row_index != -1; power++) {
-              if (j2 & (1 << power)) {
-                j2 -= (1 << power);
-                row_index = row_ids[j2];
-              }
-              assert(power < 31);
-            }
-            row_ids[j] = row_ids[j2];
-          });
-    }
+    // Load-balanced search: each thread handles a fixed number of elements
+    // whatever the row lengths are, so very skewed shapes (e.g. one long row
+    // among many empty ones) do not leave threads idle.
+    mgpu::context_t *mgpu_allocator = GetModernGpuAllocator(c);
+    mgpu::load_balance_search(num_elems, row_splits, num_rows, row_ids,
+                              *mgpu_allocator);
   }
 }
 
@@ -22,6 +22,7 @@
 #define K2_CSRC_UTILS_H_
 
 #include <algorithm>
+#include <atomic>
 #include <cfloat>
 #include <vector>
 
@@ -191,6 +192,9 @@ namespace k2 {
       @param [in] src    Array from which to read the input data
       @param [out] dest    Array to which to write the exclusive sum
                            (may be the same as src)
+
+  On CPU, large arrays are scanned in parallel blocks if SetNumCpuThreads()
+  was called, with the sizes set by SetCpuEvalConfig().
  */
 template <typename SrcPtr, typename DestPtr>
 void ExclusiveSum(ContextPtr c, int32_t n, SrcPtr src, DestPtr dest);
@@ -204,6 +208,8 @@ void ExclusiveSum(ContextPtr c, int32_t n, SrcPtr src, DestPtr dest);
       @param [in] src    Array from which to read the input data
       @param [out] dest    Array to which to write the inclusive sum
                            (may be the same as src)
+
+  On CPU, large arrays are scanned in parallel as ExclusiveSum().
  */
 template <typename SrcPtr, typename DestPtr>
 void InclusiveSum(ContextPtr c, int32_t n, SrcPtr src, DestPtr dest);
@@ -243,6 +249,9 @@ T MaxValue(ContextPtr c, int32_t nelems, const T *t);
        @param [out] row_ids   Start of row_ids vector, we write the output to
                               here. Length is num_elems.
 
+   On CUDA this uses a load-balanced search (mgpu::load_balance_search), whose
+   cost depends on num_rows + num_elems but not on the lengths of the rows.
+
    Note: there is another function of the same name using the Array1 interface,
    declared in array_ops.h, that may be more convenient.
 */
@@ -334,6 +343,25 @@ __host__ __device__ __forceinline__ float IntAsFloat(int32_t i) {
   return u.f;
 }
 
+/* Host version of CUDA's atomicCAS() for any 4- or 8-byte type: if `*address`
+   equals `*expected` (compared bitwise), set it to `desired` and return true;
+   else set `*expected` to the current value of `*address` and return false.
+
+   The host versions of the atomic functions below use this.  They need to be
+   atomic because Eval() and friends may run lambdas in several threads on CPU
+   (see SetNumCpuThreads() in thread_pool.h).
+ */
+template <typename T>
+inline bool HostAtomicCompareExchange(T *address, T *expected, T desired) {
+#ifdef _MSC_VER
+  return reinterpret_cast<std::atomic<T> *>(address)->compare_exchange_strong(
+      *expected, desired);
+#else
+  return __atomic_compare_exchange(address, expected, &desired, false,
+                                   __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+#endif
+}
+
 /* Atomically decrement *i and return true if it is zero after the decrement (it
    is an error if it becomes less than zero).
 */
@@ -343,11 +371,11 @@ __host__ __device__ __forceinline__ bool AtomicDecAndCompareZero(int32_t *i) {
   K2_CHECK_GT(old, 0);
   return old == 1;
 #else
-  // For host code, we assume single-threaded for now).
-  int32_t i_value = *i;
-  *i = i_value - 1;
-  K2_CHECK_GE(i_value - 1, 0);
-  return i_value - 1 == 0;
+  int32_t old = *i;
+  while (!HostAtomicCompareExchange(i, &old, old - 1)) {
+  }
+  K2_CHECK_GT(old, 0);
+  return old == 1;
 #endif
 }
 
@@ -355,8 +383,6 @@ __host__ __device__ __forceinline__ bool AtomicDecAndCompareZero(int32_t *i) {
 
    It implements `*address += value`.
 
-   CAUTION: For host code, we assume single-threaded for now.
-
    @param  [inout]  address  The memory address.
    @param  [in]      value    The value to be added.
  */
@@ -365,8 +391,9 @@ __host__ __device__ __forceinline__ void AtomicAdd(T *address, T value) {
 #ifdef __CUDA_ARCH__
   atomicAdd(address, value);
 #else
-  // For host code, we assume single-threaded for now).
-  *address += value;
+  T old = *address;
+  while (!HostAtomicCompareExchange(address, &old, old + value)) {
+  }
 #endif
 }
 
@@ -393,8 +420,9 @@ __host__ __device__ __forceinline__ void AtomicAdd(double *address,
     // (since NaN != NaN)
   } while (assumed != old);
 #else
-  // For host code, we assume single-threaded for now.
-  *address += value;
+  double old = *address;
+  while (!HostAtomicCompareExchange(address, &old, old + value)) {
+  }
 #endif
 }
 
@@ -412,6 +440,41 @@ __host__ __device__ __forceinline__ float OrderedIntToFloat(int32_t i) {
   return IntAsFloat((i >= 0) ? i : i ^ 0x7FFFFFFF);
 }
 
+/*
+  Conversion float/double ---> unsigned integer whose unsigned order is the
+  same as the order of the float/double values (with -0.0 < 0.0 and NaNs
+  at the ends); this is used for radix selection on the bits of the keys.
+*/
+__host__ __device__ __forceinline__ uint32_t FloatToOrderedUint(float f) {
+  uint32_t u = static_cast<uint32_t>(FloatAsInt(f));
+  return (u & 0x80000000u) ? ~u : (u | 0x80000000u);
+}
+
+__host__ __device__ __forceinline__ float OrderedUintToFloat(uint32_t u) {
+  u = (u & 0x80000000u) ? (u & 0x7FFFFFFFu) : ~u;
+  return IntAsFloat(static_cast<int32_t>(u));
+}
+
+__host__ __device__ __forceinline__ uint64_t DoubleToOrderedUint(double d) {
+  union {
+    double d;
+    uint64_t u;
+  } x;
+  x.d = d;
+  const uint64_t sign = uint64_t(1) << 63;
+  return (x.u & sign) ? ~x.u : (x.u | sign);
+}
+
+__host__ __device__ __forceinline__ double OrderedUintToDouble(uint64_t u) {
+  const uint64_t sign = uint64_t(1) << 63;
+  union {
+    double d;
+    uint64_t u;
+  } x;
+  x.u = (u & sign) ? (u & ~sign) : ~u;
+  return x.d;
+}
+
 /*
   host version of Cuda's atomicMax function, marked __host__ (the default) for
   clarity.  So we can use this in lambdas that run on both host and device.
@@ -422,7 +485,25 @@ __host__ __device__ __forceinline__ int32_t AtomicMax(int32_t *address,
   return atomicMax(address, val);
 #else
   int32_t old = *address;
-  if (old < val) *address = val;
+  while (old < val && !HostAtomicCompareExchange(address, &old, val)) {
+  }
+  return old;
+#endif
+}
+
+/*
+  Atomically sets `*address &= val` and returns the old value; like
+  CUDA's atomicAnd(), but also usable on the host.
+ */
+__host__ __device__ __forceinline__ int32_t AtomicAnd(int32_t *address,
+                                                      int32_t val) {
+#if defined(__CUDA_ARCH__)
+  return atomicAnd(address, val);
+#else
+  int32_t old = *address;
+  while ((old & val) != old &&
+         !HostAtomicCompareExchange(address, &old, old & val)) {
+  }
   return old;
 #endif
 }
@@ -21,17 +21,69 @@
 #define K2_CSRC_UTILS_INL_H_
 
 #include <type_traits>
+#include <vector>
 
 #include "k2/csrc/array.h"
 #include "k2/csrc/cub.h"
 
 namespace k2 {
+namespace internal {
+
+/* Scan used by ExclusiveSum() and InclusiveSum() for large arrays on CPU
+   when ParallelFor() has more than one thread (see UseParallelCpuEval()).
+   The first pass sums each block of `grain` elements in parallel, the block
+   sums are scanned serially and the second pass scans each block in
+   parallel, starting from its offset.  As in the serial loops, src[i] is
+   read before dest[i] is written, so `src` and `dest` may be the same.
+
+   For floating point types the result may differ from the serial scan in
+   the last bits, as the sums are done in a different order; it does not
+   depend on the number of threads though.
+ */
+template <bool kInclusive, typename SrcPtr, typename DestPtr>
+void ParallelScanCpu(int32_t n, int32_t grain, const SrcPtr src,
+                     DestPtr dest) {
+  using SumType = typename std::decay<decltype(dest[0])>::type;
+  int32_t num_blocks = NumBlocks(n, grain);
+  std::vector<SumType> offsets(num_blocks);
+  SumType *offsets_data = offsets.data();
+  ParallelFor(0, num_blocks, [=](int32_t block) -> void {
+    int32_t begin = block * grain, end = std::min(n, begin + grain);
+    SumType sum = 0;
+    for (int32_t i = begin; i != end; ++i) sum += src[i];
+    offsets_data[block] = sum;
+  });
+  SumType sum = 0;
+  for (int32_t block = 0; block != num_blocks; ++block) {
+    SumType block_sum = offsets_data[block];
+    offsets_data[block] = sum;
+    sum += block_sum;
+  }
+  ParallelFor(0, num_blocks, [=](int32_t block) -> void {
+    int32_t begin = block * grain, end = std::min(n, begin + grain);
+    SumType sum = offsets_data[block];
+    for (int32_t i = begin; i != end; ++i) {
+      auto prev = src[i];
+      if (kInclusive) sum += prev;
+      dest[i] = sum;
+      if (!kInclusive) sum += prev;
+    }
+  });
+}
+
+}  // namespace internal
+
 template <typename SrcPtr, typename DestPtr>
 void ExclusiveSum(ContextPtr c, int32_t n, const SrcPtr src, DestPtr dest) {
   K2_CHECK_GE(n, 0);
   DeviceType d = c->GetDeviceType();
   using SumType = typename std::decay<decltype(dest[0])>::type;
   if (d == kCpu) {
+    int32_t grain;
+    if (UseParallelCpuEval(n, &grain)) {
+      internal::ParallelScanCpu<false>(n, grain, src, dest);
+      return;
+    }
     SumType sum = 0;
     for (int32_t i = 0; i != n; ++i) {
       auto prev = src[i];  // save a copy since src and dest
@@ -65,6 +117,11 @@ void InclusiveSum(ContextPtr c, int32_t n, const SrcPtr src, DestPtr dest) {
   DeviceType d = c->GetDeviceType();
   using SumType = typename std::decay<decltype(dest[0])>::type;
   if (d == kCpu) {
+    int32_t grain;
+    if (UseParallelCpuEval(n, &grain)) {
+      internal::ParallelScanCpu<true>(n, grain, src, dest);
+      return;
+    }
     SumType sum = 0;
     for (int32_t i = 0; i != n; ++i) {
       sum += src[i];
@@ -60,6 +60,44 @@ TEST(UtilsTest, ExclusiveSum) {
   // TODO(haowen): add tests where output type differs from input type?
 }
 
+template <typename T>
+void TestParallelCpuScan() {
+  ContextPtr cpu = GetCpuContext();
+  int32_t saved_num_threads = GetNumCpuThreads();
+  for (int32_t num_threads : {1, 4}) {
+    SetNumCpuThreads(num_threads);
+    SetCpuEvalConfig(RandInt(1, 100), RandInt(1, 50));
+    int32_t n = RandInt(0, 5000);
+    std::vector<T> data(n);
+    for (auto &d : data) d = RandInt(-10, 10);
+    std::vector<T> exclusive(n), inclusive(n);
+    T sum = 0;
+    for (int32_t i = 0; i != n; ++i) {
+      exclusive[i] = sum;
+      sum += data[i];
+      inclusive[i] = sum;
+    }
+
+    Array1<T> src(cpu, data), dest(cpu, n);
+    const T *src_data = src.Data(), *dest_data = dest.Data();
+    ExclusiveSum(cpu, n, src.Data(), dest.Data());
+    EXPECT_EQ(std::vector<T>(dest_data, dest_data + n), exclusive);
+    InclusiveSum(cpu, n, src.Data(), dest.Data());
+    EXPECT_EQ(std::vector<T>(dest_data, dest_data + n), inclusive);
+    // In place.
+    ExclusiveSum(cpu, n, src.Data(), src.Data());
+    EXPECT_EQ(std::vector<T>(src_data, src_data + n), exclusive);
+  }
+  SetNumCpuThreads(saved_num_threads);
+  SetCpuEvalConfig(32768, 8192);
+}
+
+TEST(UtilsTest, ParallelCpuScan) {
+  TestParallelCpuScan<int32_t>();
+  // Small integers, so the sums are exact in any order.
+  TestParallelCpuScan<double>();
+}
+
 template <typename T>
 void TestMaxValue() {
   ContextPtr cpu = GetCpuContext();  // will be used to copy data
@@ -34,6 +34,8 @@
 #include "k2/python/csrc/torch/ragged.h"
 #include "k2/python/csrc/torch/ragged_ops.h"
 #include "k2/python/csrc/torch/rnnt_decode.h"
+#include "k2/python/csrc/torch/rnnt_logprobs_pruned.h"
+#include "k2/python/csrc/torch/rnnt_pruning.h"
 #include "k2/python/csrc/torch/v2/k2.h"
 
 void PybindTorch(py::module &m) {
@@ -47,6 +49,8 @@ void PybindTorch(py::module &m) {
   PybindRagged(m);
   PybindRaggedOps(m);
   PybindRnntDecode(m);
+  PybindRnntLogprobsPruned(m);
+  PybindRnntPruning(m);
 
   k2::PybindV2(m);
 }
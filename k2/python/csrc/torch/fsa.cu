@@ -34,6 +34,7 @@
 #include "k2/csrc/fsa.h"
 #include "k2/csrc/fsa_utils.h"
 #include "k2/csrc/host_shim.h"
+#include "k2/csrc/openfst_binary.h"
 #include "k2/csrc/torch_util.h"
 #include "k2/python/csrc/torch/fsa.h"
 #include "k2/python/csrc/torch/v2/ragged_any.h"
@@ -162,6 +163,23 @@ static void PybindFsaUtil(py::module &m) {
       "`ragged_labels` is a list of RaggedAny (dtype is torch.int32) of length "
       "`num_ragged_labels`");
 
+  m.def(
+      "fsa_from_openfst_binary",
+      [](const std::string &filename, bool acceptor = true)
+          -> std::pair<Fsa, torch::optional<torch::Tensor>> {
+        Array1<int32_t> aux_labels;
+        Fsa fsa = FsaFromOpenFstBinary(filename,
+                                       acceptor ? nullptr : &aux_labels);
+        torch::optional<torch::Tensor> tensor;
+        if (!acceptor) tensor = ToTorch(aux_labels);
+        return std::make_pair(fsa, tensor);
+      },
+      py::arg("filename"), py::arg("acceptor") = true,
+      "It returns a pair (fsa, aux_labels).  `fsa` is the Fsa with 2 axes, "
+      "whose labels are the input labels; `aux_labels` is None if "
+      "`acceptor` is true, else a 1-D tensor of dtype torch.int32 with the "
+      "output labels.");
+
   // the following methods are for debugging only
   m.def(
       "fsa_to_fsa_vec",
@@ -378,6 +396,18 @@ static void PybindGetTotScores(py::module &m, const char *name) {
       py::arg("fsas"), py::arg("forward_scores"));
 }
 
+template <typename T>
+static void PybindGetTotScoresOfLinearFsas(py::module &m, const char *name) {
+  m.def(
+      name,
+      [](FsaVec &fsas) -> torch::Tensor {
+        DeviceGuard guard(fsas.Context());
+        Array1<T> tot_scores = GetTotScoresOfLinearFsas<T>(fsas);
+        return ToTorch(tot_scores);
+      },
+      py::arg("fsas"));
+}
+
 static void PybindDenseFsaVec(py::module &m) {
   using PyClass = DenseFsaVec;
   py::class_<PyClass> pyclass(m, "DenseFsaVec");
@@ -591,6 +621,59 @@ template <typename T>
   return ans_grad;
 }
 
+/* Compute the backward propagation of GetTotScores for FSAs with the
+   kFsaPropertiesLinear property, in either semiring.  Every arc of such an
+   FSA is on its only path, so it gets the gradient of the total score of
+   its FSA (or 0 if that total score is -infinity).
+
+   @param [in] fsa_vec     The input FsaVec for computing
+                           `GetTotScoresOfLinearFsas`.
+   @param [in] tot_scores  It is the return value of
+                           `GetTotScoresOfLinearFsas`.
+   @param [in] tot_scores_grad  The gradient of total scores.
+   @return It returns the gradient of scores of all arcs.
+ */
+template <typename T>
+/*static*/ torch::Tensor GetTotScoresOfLinearFsasBackward(
+    FsaVec &fsas, torch::Tensor tot_scores, torch::Tensor tot_scores_grad) {
+  DeviceGuard guard(fsas.Context());
+  K2_CHECK_EQ(fsas.NumAxes(), 3);
+  int32_t num_fsas = fsas.Dim0();
+  K2_CHECK_EQ(tot_scores.dim(), 1);
+  K2_CHECK_EQ(tot_scores.sizes()[0], static_cast<int64_t>(num_fsas));
+  K2_CHECK_EQ(tot_scores.scalar_type(), ToScalarType<T>::value);
+  K2_CHECK_EQ(tot_scores_grad.dim(), 1);
+  K2_CHECK_EQ(tot_scores_grad.sizes()[0], static_cast<int64_t>(num_fsas));
+  K2_CHECK_EQ(tot_scores_grad.scalar_type(), ToScalarType<T>::value);
+
+  std::vector<int64_t> dims = {fsas.NumElements()};
+  auto options = torch::TensorOptions()
+                     .dtype(torch::kFloat32)
+                     .device(tot_scores_grad.device());
+  torch::Tensor ans_grad = torch::empty(dims, options);  // it is contiguous
+  float *ans_grad_data = ans_grad.data_ptr<float>();
+  const T *tot_scores_data = tot_scores.data_ptr<T>(),
+          *tot_scores_grad_data = tot_scores_grad.data_ptr<T>();
+  int64_t tot_scores_stride = tot_scores.strides()[0],
+          tot_scores_grad_stride = tot_scores_grad.strides()[0];
+
+  const int32_t *fsas_row_ids1 = fsas.RowIds(1).Data();
+  const int32_t *fsas_row_ids2 = fsas.RowIds(2).Data();
+  const T negative_infinity = -std::numeric_limits<T>::infinity();
+
+  K2_EVAL(
+      fsas.Context(), fsas.NumElements(), lambda, (int32_t arc_idx012)->void {
+        int32_t state_idx01 = fsas_row_ids2[arc_idx012];
+        int32_t fsa_idx0 = fsas_row_ids1[state_idx01];
+        T tot_score = tot_scores_data[fsa_idx0 * tot_scores_stride];
+        ans_grad_data[arc_idx012] =
+            tot_score > negative_infinity
+                ? tot_scores_grad_data[fsa_idx0 * tot_scores_grad_stride]
+                : 0;
+      });
+  return ans_grad;
+}
+
 template <typename T>
 static void PybindGetTotScoresTropicalBackward(py::module &m,
                                                const char *name) {
@@ -604,6 +687,13 @@ static void PybindGetTotScoresLogBackward(py::module &m, const char *name) {
         py::arg("tot_scores_grad"));
 }
 
+template <typename T>
+static void PybindGetTotScoresOfLinearFsasBackward(py::module &m,
+                                                   const char *name) {
+  m.def(name, &GetTotScoresOfLinearFsasBackward<T>, py::arg("fsas"),
+        py::arg("tot_scores"), py::arg("tot_scores_grad"));
+}
+
 template <typename T>
 static void PybindGetArcCdf(py::module &m, const char *name) {
   m.def(
@@ -622,18 +712,19 @@ static void PybindRandomPaths(py::module &m, const char *name) {
   m.def(
       name,
       [](FsaVec &fsas, torch::Tensor arc_cdf, int32_t num_paths,
-         torch::Tensor tot_scores, RaggedAny &state_batches) -> RaggedAny {
+         torch::Tensor tot_scores, RaggedAny &state_batches,
+         int64_t seed = -1) -> RaggedAny {
         DeviceGuard guard(fsas.Context());
         Array1<T> arc_cdf_array = FromTorch<T>(arc_cdf);
         Array1<T> tot_scores_array = FromTorch<T>(tot_scores);
 
         Ragged<int32_t> ans =
             RandomPaths(fsas, arc_cdf_array, num_paths, tot_scores_array,
-                        state_batches.any.Specialize<int32_t>());
+                        state_batches.any.Specialize<int32_t>(), seed);
         return RaggedAny(ans.Generic());
       },
       py::arg("fsas"), py::arg("arc_cdf"), py::arg("num_paths"),
-      py::arg("tot_scores"), py::arg("state_batches"));
+      py::arg("tot_scores"), py::arg("state_batches"), py::arg("seed") = -1);
 }
 
 template <typename T>
@@ -699,6 +790,10 @@ void PybindFsa(py::module &m) {
       m, "backprop_get_backward_scores_double");
   k2::PybindGetTotScores<float>(m, "get_tot_scores_float");
   k2::PybindGetTotScores<double>(m, "get_tot_scores_double");
+  k2::PybindGetTotScoresOfLinearFsas<float>(
+      m, "get_tot_scores_of_linear_fsas_float");
+  k2::PybindGetTotScoresOfLinearFsas<double>(
+      m, "get_tot_scores_of_linear_fsas_double");
   k2::PybindGetArcPost<float>(m, "get_arc_post_float");
   k2::PybindGetArcPost<double>(m, "get_arc_post_double");
   k2::PybindBackpropGetArcPost<float>(m, "backprop_get_arc_post_float");
@@ -711,6 +806,10 @@ void PybindFsa(py::module &m) {
                                            "get_tot_scores_float_log_backward");
   k2::PybindGetTotScoresLogBackward<double>(
       m, "get_tot_scores_double_log_backward");
+  k2::PybindGetTotScoresOfLinearFsasBackward<float>(
+      m, "get_tot_scores_of_linear_fsas_float_backward");
+  k2::PybindGetTotScoresOfLinearFsasBackward<double>(
+      m, "get_tot_scores_of_linear_fsas_double_backward");
 
   k2::PybindGetArcCdf<float>(m, "get_arc_cdf_float");
   k2::PybindGetArcCdf<double>(m, "get_arc_cdf_double");
@@ -25,12 +25,15 @@
 #include <utility>
 #include <vector>
 
+#include "k2/csrc/ctc_loss.h"
 #include "k2/csrc/device_guard.h"
 #include "k2/csrc/fsa.h"
 #include "k2/csrc/fsa_algo.h"
 #include "k2/csrc/fsa_utils.h"
 #include "k2/csrc/host_shim.h"
+#include "k2/csrc/intersect_dense_composed.h"
 #include "k2/csrc/intersect_dense_pruned.h"
+#include "k2/csrc/mwer_loss.h"
 #include "k2/csrc/rm_epsilon.h"
 #include "k2/csrc/torch_util.h"
 #include "k2/python/csrc/torch/fsa_algo.h"
@@ -41,21 +44,29 @@ namespace k2 {
 static void PybindTopSort(py::module &m) {
   // TODO(fangjun): add docstring for this function
   //
-  // if need_arc_map is true, it returns (sorted_fsa_vec, arc_map);
-  // otherwise, it returns (sorted_fsa_vec, None)
+  // It returns (sorted_fsa_vec, arc_map, state_batches), where arc_map is
+  // None if need_arc_map is false and state_batches (see TopSort() in
+  // fsa_algo.h) is None if need_state_batches is false.
   m.def(
       "top_sort",
-      [](FsaVec &src, bool need_arc_map = true)
-          -> std::pair<FsaVec, torch::optional<torch::Tensor>> {
+      [](FsaVec &src, bool need_arc_map = true,
+         bool need_state_batches = false)
+          -> std::tuple<FsaVec, torch::optional<torch::Tensor>,
+                        torch::optional<RaggedAny>> {
         DeviceGuard guard(src.Context());
         Array1<int32_t> arc_map;
+        Ragged<int32_t> state_batches;
         FsaVec sorted;
-        TopSort(src, &sorted, need_arc_map ? &arc_map : nullptr);
+        TopSort(src, &sorted, need_arc_map ? &arc_map : nullptr,
+                need_state_batches ? &state_batches : nullptr);
         torch::optional<torch::Tensor> tensor;
         if (need_arc_map) tensor = ToTorch(arc_map);
-        return std::make_pair(sorted, tensor);
+        torch::optional<RaggedAny> batches;
+        if (need_state_batches) batches = RaggedAny(state_batches.Generic());
+        return std::make_tuple(sorted, tensor, batches);
       },
-      py::arg("src"), py::arg("need_arc_map") = true);
+      py::arg("src"), py::arg("need_arc_map") = true,
+      py::arg("need_state_batches") = false);
 }
 
 static void PybindLinearFsa(py::module &m) {
@@ -164,6 +175,10 @@ static void PybindIntersect(py::module &m) {
 }
 
 static void PybindIntersectDevice(py::module &m) {
+  // Long-running algorithms are bound with py::gil_scoped_release as a call
+  // guard: they don't touch Python objects, so other Python threads (e.g.
+  // other decoders) can run while they do.  Their arguments must not be
+  // modified by another thread meanwhile.
   // It works on both GPU and CPU.
   // But it is super slow on CPU.
   // Do not use this one for CPU; use `Intersect` for CPU.
@@ -171,8 +186,9 @@ static void PybindIntersectDevice(py::module &m) {
       "intersect_device",
       [](FsaVec &a_fsas, int32_t properties_a, FsaVec &b_fsas,
          int32_t properties_b, torch::Tensor b_to_a_map,
-         bool need_arc_map = true,
-         bool sorted_match_a =
+         bool need_arc_map = true, bool sorted_match_a = false,
+         bool sorted_match_b = false, bool use_queue = false,
+         bool a_self_loops =
              false) -> std::tuple<FsaVec, torch::optional<torch::Tensor>,
                                   torch::optional<torch::Tensor>> {
         DeviceGuard guard(a_fsas.Context());
@@ -183,7 +199,9 @@ static void PybindIntersectDevice(py::module &m) {
         FsaVec ans = IntersectDevice(
             a_fsas, properties_a, b_fsas, properties_b, b_to_a_map_array,
             need_arc_map ? &a_arc_map : nullptr,
-            need_arc_map ? &b_arc_map : nullptr, sorted_match_a);
+            need_arc_map ? &b_arc_map : nullptr, sorted_match_a,
+            /*estimate_sizes*/ false, sorted_match_b, use_queue,
+            a_self_loops);
         torch::optional<torch::Tensor> a_tensor;
         torch::optional<torch::Tensor> b_tensor;
         if (need_arc_map) {
@@ -192,9 +210,12 @@ static void PybindIntersectDevice(py::module &m) {
         }
         return std::make_tuple(ans, a_tensor, b_tensor);
       },
+      py::call_guard<py::gil_scoped_release>(),
       py::arg("a_fsas"), py::arg("properties_a"), py::arg("b_fsas"),
       py::arg("properties_b"), py::arg("b_to_a_map"),
-      py::arg("need_arc_map") = true, py::arg("sorted_match_a") = false);
+      py::arg("need_arc_map") = true, py::arg("sorted_match_a") = false,
+      py::arg("sorted_match_b") = false, py::arg("use_queue") = false,
+      py::arg("a_self_loops") = false);
 }
 
 static void PybindIntersectDensePruned(py::module &m) {
@@ -202,21 +223,101 @@ static void PybindIntersectDensePruned(py::module &m) {
       "intersect_dense_pruned",
       [](FsaVec &a_fsas, DenseFsaVec &b_fsas, float search_beam,
          float output_beam, int32_t min_active_states,
-         int32_t max_active_states)
-          -> std::tuple<FsaVec, torch::Tensor, torch::Tensor> {
+         int32_t max_active_states, float lattice_beam,
+         bool need_entering_arcs, int32_t max_active_arcs, bool need_stats,
+         torch::optional<torch::Tensor> b_to_a_map)
+          -> std::tuple<FsaVec, torch::Tensor, torch::Tensor,
+                        torch::optional<torch::Tensor>,
+                        std::vector<torch::Tensor>> {
         DeviceGuard guard(a_fsas.Context());
         Array1<int32_t> arc_map_a;
         Array1<int32_t> arc_map_b;
+        Array1<int32_t> entering_arcs;
+        IntersectDensePrunedStats stats;
         FsaVec out;
 
+        Array1<int32_t> b_to_a_map_array;
+        if (b_to_a_map.has_value())
+          b_to_a_map_array = FromTorch<int32_t>(b_to_a_map.value());
         IntersectDensePruned(a_fsas, b_fsas, search_beam, output_beam,
                              min_active_states, max_active_states, &out,
-                             &arc_map_a, &arc_map_b);
-        return std::make_tuple(out, ToTorch(arc_map_a), ToTorch(arc_map_b));
+                             &arc_map_a, &arc_map_b, false, lattice_beam,
+                             need_entering_arcs ? &entering_arcs : nullptr,
+                             max_active_arcs, need_stats ? &stats : nullptr,
+                             b_to_a_map.has_value() ? &b_to_a_map_array
+                                                    : nullptr);
+        torch::optional<torch::Tensor> entering_arcs_tensor;
+        if (need_entering_arcs) entering_arcs_tensor = ToTorch(entering_arcs);
+        // The statistics, in the order of IntersectDensePrunedStats; empty
+        // if not needed.
+        std::vector<torch::Tensor> stats_tensors;
+        if (need_stats)
+          stats_tensors = {ToTorch(stats.num_states), ToTorch(stats.num_arcs),
+                           ToTorch(stats.beams),
+                           ToTorch(stats.num_output_arcs)};
+        return std::make_tuple(out, ToTorch(arc_map_a), ToTorch(arc_map_b),
+                               entering_arcs_tensor, stats_tensors);
       },
+      py::call_guard<py::gil_scoped_release>(),
       py::arg("a_fsas"), py::arg("b_fsas"), py::arg("search_beam"),
       py::arg("output_beam"), py::arg("min_active_states"),
-      py::arg("max_active_states"));
+      py::arg("max_active_states"), py::arg("lattice_beam") = 0.0f,
+      py::arg("need_entering_arcs") = false, py::arg("max_active_arcs") = 0,
+      py::arg("need_stats") = false, py::arg("b_to_a_map") = py::none());
+
+  m.def(
+      "intersect_dense_pruned_one_best",
+      [](FsaVec &a_fsas, DenseFsaVec &b_fsas, float search_beam,
+         int32_t min_active_states, int32_t max_active_states,
+         torch::optional<torch::Tensor> b_to_a_map)
+          -> std::tuple<FsaVec, torch::Tensor, torch::Tensor> {
+        DeviceGuard guard(a_fsas.Context());
+        Array1<int32_t> arc_map_a;
+        Array1<int32_t> arc_map_b;
+        FsaVec out;
+
+        Array1<int32_t> b_to_a_map_array;
+        if (b_to_a_map.has_value())
+          b_to_a_map_array = FromTorch<int32_t>(b_to_a_map.value());
+        IntersectDensePrunedOneBest(a_fsas, b_fsas, search_beam,
+                                    min_active_states, max_active_states,
+                                    &out, &arc_map_a, &arc_map_b,
+                                    b_to_a_map.has_value() ? &b_to_a_map_array
+                                                           : nullptr);
+        return std::make_tuple(out, ToTorch(arc_map_a), ToTorch(arc_map_b));
+      },
+      py::call_guard<py::gil_scoped_release>(),
+      py::arg("a_fsas"), py::arg("b_fsas"), py::arg("search_beam"),
+      py::arg("min_active_states"), py::arg("max_active_states"),
+      py::arg("b_to_a_map") = py::none());
+
+  m.def(
+      "intersect_dense_pruned_composed",
+      [](FsaVec &hl, torch::Tensor hl_aux_labels, FsaVec &g,
+         DenseFsaVec &b_fsas, float search_beam, float output_beam,
+         int32_t min_active_states, int32_t max_active_states)
+          -> std::tuple<FsaVec, torch::Tensor, torch::Tensor,
+                        torch::Tensor> {
+        DeviceGuard guard(hl.Context());
+        Array1<int32_t> hl_aux_labels_array =
+            FromTorch<int32_t>(hl_aux_labels);
+        Array1<int32_t> arc_map_hl;
+        Array1<int32_t> arc_map_g;
+        Array1<int32_t> arc_map_b;
+        FsaVec out;
+
+        IntersectDensePrunedComposed(hl, hl_aux_labels_array, g, b_fsas,
+                                     search_beam, output_beam,
+                                     min_active_states, max_active_states,
+                                     &out, &arc_map_hl, &arc_map_g,
+                                     &arc_map_b);
+        return std::make_tuple(out, ToTorch(arc_map_hl), ToTorch(arc_map_g),
+                               ToTorch(arc_map_b));
+      },
+      py::call_guard<py::gil_scoped_release>(), py::arg("hl"),
+      py::arg("hl_aux_labels"), py::arg("g"), py::arg("b_fsas"),
+      py::arg("search_beam"), py::arg("output_beam"),
+      py::arg("min_active_states"), py::arg("max_active_states"));
 }
 
 static void PybindIntersectDense(py::module &m) {
@@ -224,8 +325,9 @@ static void PybindIntersectDense(py::module &m) {
       "intersect_dense",
       [](FsaVec &a_fsas, DenseFsaVec &b_fsas,
          torch::optional<torch::Tensor> a_to_b_map, float output_beam,
-         int32_t max_states,
-         int32_t max_arcs) -> std::tuple<FsaVec, torch::Tensor, torch::Tensor> {
+         int32_t max_states, int32_t max_arcs, int64_t memory_budget,
+         float search_beam)
+          -> std::tuple<FsaVec, torch::Tensor, torch::Tensor> {
         DeviceGuard guard(a_fsas.Context());
         Array1<int32_t> arc_map_a;
         Array1<int32_t> arc_map_b;
@@ -242,12 +344,126 @@ static void PybindIntersectDense(py::module &m) {
           a_to_b_map_array = Arange(a_fsa_vec.Context(), 0, a_fsa_vec.Dim0());
         }
         IntersectDense(a_fsa_vec, b_fsas, &a_to_b_map_array, output_beam,
-                       max_states, max_arcs, &out, &arc_map_a, &arc_map_b);
+                       max_states, max_arcs, &out, &arc_map_a, &arc_map_b,
+                       memory_budget, search_beam);
         return std::make_tuple(out, ToTorch(arc_map_a), ToTorch(arc_map_b));
       },
+      py::call_guard<py::gil_scoped_release>(),
       py::arg("a_fsas"), py::arg("b_fsas"), py::arg("a_to_b_map"),
       py::arg("output_beam"), py::arg("max_states") = 15000000,
-      py::arg("max_arcs") = 1073741824 /* 2^30 */);
+      py::arg("max_arcs") = 1073741824 /* 2^30 */,
+      py::arg("memory_budget") = -1, py::arg("search_beam") = 0);
+}
+
+static void PybindCtcLossBanded(py::module &m) {
+  m.def(
+      "ctc_loss_banded",
+      [](FsaVec &graphs, DenseFsaVec &dense, bool use_double_scores,
+         bool need_grad) -> torch::optional<
+                             std::pair<torch::Tensor,
+                                       torch::optional<torch::Tensor>>> {
+        DeviceGuard guard(graphs.Context());
+        BandedFsaVec banded;
+        if (graphs.NumAxes() != 3 || dense.IsSparse() ||
+            graphs.Dim0() != dense.shape.Dim0() ||
+            !GetBandedFsaVec(graphs, &banded))
+          return torch::nullopt;
+
+        Array2<float> dense_grad;
+        Array2<float> *dense_grad_ptr = need_grad ? &dense_grad : nullptr;
+        torch::Tensor tot_scores;
+        if (use_double_scores) {
+          Array1<double> ans;
+          CtcLossBanded<double>(banded, dense, &ans, dense_grad_ptr);
+          tot_scores = ToTorch(ans);
+        } else {
+          Array1<float> ans;
+          CtcLossBanded<float>(banded, dense, &ans, dense_grad_ptr);
+          tot_scores = ToTorch(ans);
+        }
+        torch::optional<torch::Tensor> grad;
+        if (need_grad) grad = ToTorch(dense_grad);
+        return std::make_pair(tot_scores, grad);
+      },
+      py::arg("graphs"), py::arg("dense"), py::arg("use_double_scores") = true,
+      py::arg("need_grad") = true,
+      R"(
+      Computes the total scores of GetTotScores() of the unpruned intersection
+      of `graphs` with `dense`, and optionally their derivatives w.r.t. the
+      scores of `dense`, with the CTC recursion instead of intersect_dense().
+      Returns None if `graphs` is not "banded" (see k2/csrc/ctc_loss.h),
+      e.g. not the output of ctc_graph(), or does not have one FSA per
+      sequence of `dense`; else returns (tot_scores, grad), with grad None if
+      `need_grad` is False.
+      )");
+}
+
+static void PybindMwerLoss(py::module &m) {
+  m.def(
+      "mwer_loss",
+      [](FsaVec &lattice, RaggedAny &aux_labels, RaggedAny &ref_texts,
+         float nbest_scale, int32_t num_paths, float temperature,
+         bool use_double_scores)
+          -> std::tuple<torch::Tensor, RaggedAny, torch::Tensor> {
+        DeviceGuard guard(lattice.Context());
+        Ragged<int32_t> &aux_labels_int = aux_labels.any.Specialize<int32_t>(),
+                        &ref_texts_int = ref_texts.any.Specialize<int32_t>();
+        Ragged<int32_t> paths;
+        torch::Tensor loss, path_probs;
+        if (use_double_scores) {
+          Array1<double> probs;
+          loss = ToTorch(MwerLoss<double>(lattice, aux_labels_int,
+                                          ref_texts_int, nbest_scale,
+                                          num_paths, temperature, &paths,
+                                          &probs)
+                             .values);
+          path_probs = ToTorch(probs);
+        } else {
+          Array1<float> probs;
+          loss = ToTorch(MwerLoss<float>(lattice, aux_labels_int,
+                                         ref_texts_int, nbest_scale,
+                                         num_paths, temperature, &paths,
+                                         &probs)
+                             .values);
+          path_probs = ToTorch(probs);
+        }
+        return std::make_tuple(loss, RaggedAny(paths.Generic()), path_probs);
+      },
+      py::arg("lattice"), py::arg("aux_labels"), py::arg("ref_texts"),
+      py::arg("nbest_scale"), py::arg("num_paths"), py::arg("temperature"),
+      py::arg("use_double_scores") = true,
+      R"(
+      Computes the MWER loss of each sampled path in one call; see
+      k2/csrc/mwer_loss.h.  Returns (loss, paths, path_probs), where `paths`
+      has axes [utt][path][arc] and `loss` and `path_probs` have one entry
+      per path.
+      )");
+
+  m.def(
+      "mwer_loss_backward",
+      [](FsaVec &lattice, RaggedAny &paths, torch::Tensor path_probs,
+         torch::Tensor path_loss, float temperature,
+         torch::Tensor loss_grad) -> torch::Tensor {
+        DeviceGuard guard(lattice.Context());
+        Ragged<int32_t> &paths_int = paths.any.Specialize<int32_t>();
+        loss_grad = loss_grad.to(path_loss.scalar_type()).contiguous();
+        if (path_probs.scalar_type() == torch::kDouble) {
+          return ToTorch(MwerLossBackward<double>(
+              lattice, paths_int, FromTorch<double>(path_probs),
+              FromTorch<double>(path_loss), temperature,
+              FromTorch<double>(loss_grad)));
+        }
+        return ToTorch(MwerLossBackward<float>(
+            lattice, paths_int, FromTorch<float>(path_probs),
+            FromTorch<float>(path_loss), temperature,
+            FromTorch<float>(loss_grad)));
+      },
+      py::arg("lattice"), py::arg("paths"), py::arg("path_probs"),
+      py::arg("path_loss"), py::arg("temperature"), py::arg("loss_grad"),
+      R"(
+      Returns the derivatives w.r.t. the arc scores of `lattice` given the
+      derivatives `loss_grad` w.r.t. the `loss` returned by mwer_loss().
+      )");
 }
 
 static void PybindConnect(py::module &m) {
@@ -267,6 +483,43 @@ static void PybindConnect(py::module &m) {
       py::arg("src"), py::arg("need_arc_map") = true);
 }
 
+static void PybindNormalizeLattice(py::module &m) {
+  m.def(
+      "normalize_lattice",
+      [](FsaOrVec &src, bool need_arc_map = true)
+          -> std::pair<FsaOrVec, torch::optional<torch::Tensor>> {
+        DeviceGuard guard(src.Context());
+        Array1<int32_t> arc_map;
+        FsaOrVec out;
+        NormalizeLattice(src, &out, need_arc_map ? &arc_map : nullptr);
+        torch::optional<torch::Tensor> tensor;
+        if (need_arc_map) tensor = ToTorch(arc_map);
+        return std::make_pair(out, tensor);
+      },
+      py::arg("src"), py::arg("need_arc_map") = true);
+}
+
+static void PybindMinimize(py::module &m) {
+  m.def(
+      "minimize",
+      [](FsaOrVec &src, torch::optional<torch::Tensor> aux_labels,
+         bool need_arc_map = true)
+          -> std::pair<FsaOrVec, torch::optional<torch::Tensor>> {
+        DeviceGuard guard(src.Context());
+        Array1<int32_t> aux_labels_array, arc_map;
+        if (aux_labels.has_value())
+          aux_labels_array = FromTorch<int32_t>(aux_labels.value());
+        FsaOrVec out;
+        Minimize(src, aux_labels.has_value() ? &aux_labels_array : nullptr,
+                 &out, need_arc_map ? &arc_map : nullptr);
+        torch::optional<torch::Tensor> tensor;
+        if (need_arc_map) tensor = ToTorch(arc_map);
+        return std::make_pair(out, tensor);
+      },
+      py::call_guard<py::gil_scoped_release>(), py::arg("src"),
+      py::arg("aux_labels") = py::none(), py::arg("need_arc_map") = true);
+}
+
 static void PybindArcSort(py::module &m) {
   m.def(
       "arc_sort",
@@ -353,6 +606,7 @@ static void PybindRemoveEpsilon(py::module &m) {
         RemoveEpsilonHost(src, &dest, &arc_map);
         return std::make_pair(dest, RaggedAny(arc_map.Generic()));
       },
+      py::call_guard<py::gil_scoped_release>(),
       py::arg("src"));
   m.def(
       "remove_epsilon_device",
@@ -363,6 +617,7 @@ static void PybindRemoveEpsilon(py::module &m) {
         RemoveEpsilonDevice(src, &dest, &arc_map);
         return std::make_pair(dest, RaggedAny(arc_map.Generic()));
       },
+      py::call_guard<py::gil_scoped_release>(),
       py::arg("src"));
   m.def(
       "remove_epsilon",
@@ -373,6 +628,7 @@ static void PybindRemoveEpsilon(py::module &m) {
         RemoveEpsilon(src, properties, &dest, &arc_map);
         return std::make_pair(dest, RaggedAny(arc_map.Generic()));
       },
+      py::call_guard<py::gil_scoped_release>(),
       py::arg("src"), py::arg("properties"));
   m.def(
       "remove_epsilon_and_add_self_loops",
@@ -383,6 +639,7 @@ static void PybindRemoveEpsilon(py::module &m) {
         RemoveEpsilonAndAddSelfLoops(src, properties, &dest, &arc_map);
         return std::make_pair(dest, RaggedAny(arc_map.Generic()));
       },
+      py::call_guard<py::gil_scoped_release>(),
       py::arg("src"), py::arg("properties"));
 }
 
@@ -406,6 +663,7 @@ static void PybindDeterminize(py::module &m) {
         Determinize(src, weight_pushing_type, &dest, &arc_map);
         return std::make_pair(dest, RaggedAny(arc_map.Generic()));
       },
+      py::call_guard<py::gil_scoped_release>(),
       py::arg("src"), py::arg("weight_pushing_type"));
 }
 
@@ -444,6 +702,22 @@ static void PybindInvert(py::module &m) {
       py::arg("src"), py::arg("src_aux_labels"), py::arg("need_arc_map"));
 }
 
+static void PybindToWordLattice(py::module &m) {
+  m.def(
+      "to_word_lattice",
+      [](FsaOrVec &src, RaggedAny &src_aux_labels,
+         int32_t properties) -> std::pair<FsaOrVec, RaggedAny> {
+        DeviceGuard guard(src.Context());
+        Ragged<int32_t> aux_labels = src_aux_labels.any.Specialize<int32_t>();
+        FsaOrVec dest;
+        Ragged<int32_t> arc_map;
+        ToWordLattice(src, aux_labels, properties, &dest, &arc_map);
+        return std::make_pair(dest, RaggedAny(arc_map.Generic()));
+      },
+      py::call_guard<py::gil_scoped_release>(), py::arg("src"),
+      py::arg("src_aux_labels"), py::arg("properties"));
+}
+
 static void PybindRemoveEpsilonSelfLoops(py::module &m) {
   m.def(
       "remove_epsilon_self_loops",
@@ -749,6 +1023,33 @@ static void PybindLevenshteinGraph(py::module &m) {
       py::arg("need_score_offset") = true);
 }
 
+static void PybindLevenshteinDistance(py::module &m) {
+  m.def(
+      "levenshtein_distance",
+      [](RaggedAny &refs, RaggedAny &hyps, torch::Tensor hyp_to_ref_map,
+         bool need_alignment = false)
+          -> std::tuple<torch::Tensor, torch::optional<RaggedAny>,
+                        torch::optional<RaggedAny>> {
+        DeviceGuard guard(refs.any.Context());
+        Array1<int32_t> hyp_to_ref_map_array =
+            FromTorch<int32_t>(hyp_to_ref_map);
+        Ragged<int32_t> ref_alignment, hyp_alignment;
+        Array1<int32_t> distance = LevenshteinDistance(
+            refs.any.Specialize<int32_t>(), hyps.any.Specialize<int32_t>(),
+            hyp_to_ref_map_array, need_alignment ? &ref_alignment : nullptr,
+            need_alignment ? &hyp_alignment : nullptr);
+        torch::optional<RaggedAny> ref_alignment_any, hyp_alignment_any;
+        if (need_alignment) {
+          ref_alignment_any = RaggedAny(ref_alignment.Generic());
+          hyp_alignment_any = RaggedAny(hyp_alignment.Generic());
+        }
+        return std::make_tuple(ToTorch(distance), ref_alignment_any,
+                               hyp_alignment_any);
+      },
+      py::arg("refs"), py::arg("hyps"), py::arg("hyp_to_ref_map"),
+      py::arg("need_alignment") = false);
+}
+
 static void PybindDecodeStateInfo(py::module &m) {
   using PyClass = DecodeStateInfo;
   py::class_<PyClass, std::shared_ptr<PyClass>> state_info(m,
@@ -762,16 +1063,19 @@ static void PybindOnlineDenseIntersecter(py::module &m) {
   intersecter.def(
       py::init([](FsaVec &decoding_graph, int32_t num_streams,
                   float search_beam, float output_beam,
-                  int32_t min_active_states,
-                  int32_t max_active_states) -> std::unique_ptr<PyClass> {
+                  int32_t min_active_states, int32_t max_active_states,
+                  int32_t max_active_arcs) -> std::unique_ptr<PyClass> {
         DeviceGuard guard(decoding_graph.Context());
-        return std::make_unique<PyClass>(decoding_graph, num_streams,
-                                         search_beam, output_beam,
-                                         min_active_states, max_active_states);
+        bool use_arena = false;
+        float blank_threshold = 0.0f;
+        return std::make_unique<PyClass>(
+            decoding_graph, num_streams, search_beam, output_beam,
+            min_active_states, max_active_states, use_arena, blank_threshold,
+            max_active_arcs);
       }),
       py::arg("decoding_graph"), py::arg("num_streams"), py::arg("search_beam"),
       py::arg("output_beam"), py::arg("min_active_states"),
-      py::arg("max_active_states"));
+      py::arg("max_active_states"), py::arg("max_active_arcs") = 0);
 
   intersecter.def(
       "decode",
@@ -787,6 +1091,45 @@ static void PybindOnlineDenseIntersecter(py::module &m) {
         return std::make_tuple(ofsa, arc_map_tensor, decode_states);
       },
       py::arg("dense_fsa_vec"), py::arg("decode_states"));
+
+  intersecter.def(
+      "decode_with_prefix",
+      [](PyClass &self, DenseFsaVec &dense_fsa_vec,
+         std::vector<std::shared_ptr<DecodeStateInfo>> &decode_states)
+          -> std::tuple<FsaVec, torch::Tensor, FsaVec, torch::Tensor,
+                        std::vector<std::shared_ptr<DecodeStateInfo>>> {
+        DeviceGuard guard(self.Context());
+        FsaVec ofsa, prefix;
+        Array1<int32_t> arc_map, prefix_arc_map;
+        self.Decode(dense_fsa_vec, &decode_states, &ofsa, &arc_map, &prefix,
+                    &prefix_arc_map);
+        torch::Tensor arc_map_tensor = ToTorch(arc_map),
+                      prefix_arc_map_tensor = ToTorch(prefix_arc_map);
+        return std::make_tuple(ofsa, arc_map_tensor, prefix,
+                               prefix_arc_map_tensor, decode_states);
+      },
+      py::arg("dense_fsa_vec"), py::arg("decode_states"));
+
+  intersecter.def(
+      "decode_streams",
+      [](PyClass &self, DenseFsaVec &dense_fsa_vec,
+         const std::vector<int32_t> &stream_ids)
+          -> std::pair<FsaVec, torch::Tensor> {
+        DeviceGuard guard(self.Context());
+        FsaVec ofsa;
+        Array1<int32_t> arc_map;
+        self.DecodeStreams(dense_fsa_vec, stream_ids, &ofsa, &arc_map);
+        return std::make_pair(ofsa, ToTorch(arc_map));
+      },
+      py::arg("dense_fsa_vec"), py::arg("stream_ids"));
+
+  intersecter.def(
+      "release_stream",
+      [](PyClass &self, int32_t stream_id) -> std::shared_ptr<DecodeStateInfo> {
+        DeviceGuard guard(self.Context());
+        return self.ReleaseStream(stream_id);
+      },
+      py::arg("stream_id"));
 }
 
 static void PybindReverse(py::module &m) {
@@ -815,6 +1158,8 @@ void PybindFsaAlgo(py::module &m) {
   k2::PybindClosure(m);
   k2::PybindConnect(m);
   k2::PybindCtcGraph(m);
+  k2::PybindCtcLossBanded(m);
+  k2::PybindMwerLoss(m);
   k2::PybindCtcTopo(m);
   k2::PybindDecodeStateInfo(m);
   k2::PybindDeterminize(m);
@@ -826,13 +1171,17 @@ void PybindFsaAlgo(py::module &m) {
   k2::PybindIntersectDevice(m);
   k2::PybindInvert(m);
   k2::PybindLevenshteinGraph(m);
+  k2::PybindLevenshteinDistance(m);
   k2::PybindLinearFsa(m);
+  k2::PybindMinimize(m);
+  k2::PybindNormalizeLattice(m);
   k2::PybindOnlineDenseIntersecter(m);
   k2::PybindRemoveEpsilon(m);
   k2::PybindRemoveEpsilonSelfLoops(m);
   k2::PybindReplaceFsa(m);
   k2::PybindReverse(m);
   k2::PybindShortestPath(m);
+  k2::PybindToWordLattice(m);
   k2::PybindTopSort(m);
   k2::PybindTrivialGraph(m);
   k2::PybindUnion(m);
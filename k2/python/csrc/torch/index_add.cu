@@ -25,6 +25,8 @@
  * limitations under the License.
  */
 
+#include <utility>
+
 #include "k2/csrc/context.h"
 #include "k2/csrc/device_guard.h"
 #include "k2/csrc/macros.h"
@@ -36,14 +38,26 @@
 namespace k2 {
 
 static void PybindIndexAdd(torch::Tensor index, torch::Tensor value,
-                           torch::Tensor *in_out) {
+                           torch::Tensor *in_out, bool deterministic) {
   NVTX_RANGE(K2_FUNC);
   DeviceGuard guard(GetContext(index));
 
   Array1<int32_t> indexes = FromTorch<int32_t>(index);
   Tensor src = FromTorch(value, TensorTag{});
   Tensor dest = FromTorch(*in_out, TensorTag{});
-  IndexAdd(src, indexes, true, &dest);
+  IndexAdd(src, indexes, true, &dest, deterministic);
+}
+
+static std::pair<torch::Tensor, torch::Tensor> PybindIndexAddSparse(
+    torch::Tensor index, torch::Tensor value) {
+  NVTX_RANGE(K2_FUNC);
+  DeviceGuard guard(GetContext(index));
+
+  Array1<int32_t> indexes = FromTorch<int32_t>(index);
+  Tensor src = FromTorch(value, TensorTag{});
+  Array1<int32_t> unique_indexes;
+  Tensor sums = IndexAddSparse(src, indexes, &unique_indexes);
+  return std::make_pair(ToTorch(unique_indexes), ToTorch(sums));
 }
 
 }  // namespace k2
@@ -51,7 +65,7 @@ static void PybindIndexAdd(torch::Tensor index, torch::Tensor value,
 void PybindIndexAdd(py::module &m) {
   // note it supports only 1-D and 2-D tensors.
   m.def("index_add", &k2::PybindIndexAdd, py::arg("index"), py::arg("value"),
-        py::arg("in_out"),
+        py::arg("in_out"), py::arg("deterministic") = false,
         R"(
         Args:
           index:
@@ -67,5 +81,35 @@ void PybindIndexAdd(py::module &m) {
             Must satisfy `in_out.dtype == value.dtype`.
 
             On return: `in_out[index[i]] += value[i]` if `index[i] != -1`
+          deterministic:
+            If true, sort `index` and sum the values for each row of
+            `in_out` with a segmented reduction instead of using atomic
+            adds, so the result is reproducible.  It is also faster if
+            many entries of `index` are the same.
+        )");
+
+  m.def("index_add_sparse", &k2::PybindIndexAddSparse, py::arg("index"),
+        py::arg("value"),
+        R"(
+        A sparse version of :func:`index_add` that does not need `in_out`:
+        it returns the distinct indexes and the sum of the values of each,
+        and its cost does not depend on the size of `in_out`.
+
+        Args:
+          index:
+            A 1-D **contiguous** tensor with dtype `torch.int32`.
+            Must satisfy `index[i] >= -1` and
+            `index.shape[0] == value.shape[0]`.
+          value:
+            A 1-D tensor. Supported dtypes are: `torch.int32`,
+            `torch.float32`, and `torch.float64`.
+        Returns:
+          Return a tuple `(unique_index, sums)`, where `unique_index` is a
+          1-D tensor with dtype `torch.int32` containing the sorted distinct
+          elements of `index` other than -1, and `sums[i]` is the sum of
+          the `value[j]` with `index[j] == unique_index[i]`, added in order
+          of `j` so the result is reproducible.  In other words, it is the
+          part of the result of :func:`index_add` into zeros that can be
+          nonzero.
         )");
 }
@@ -132,6 +132,79 @@ static torch::Tensor IndexSelect2D(torch::Tensor src, torch::Tensor index) {
   return ToTorch(ans_array);
 }
 
+/* Does IndexSelect1D(srcs[j], index, default_values[j]) for all j with a
+   single kernel (see IndexMany()).  All of `srcs` must be 1-D, contiguous
+   and have the same dtype and numel().  The returned tensors are the rows
+   of a 2-D tensor.
+ */
+template <typename T>
+static std::vector<torch::Tensor> IndexSelectMany1D(
+    const std::vector<torch::Tensor> &srcs, torch::Tensor index,
+    const std::vector<double> &default_values) {
+  NVTX_RANGE(K2_FUNC);
+  int32_t num_srcs = static_cast<int32_t>(srcs.size());
+  K2_CHECK_EQ(static_cast<int32_t>(default_values.size()), num_srcs);
+  K2_CHECK_EQ(index.dim(), 1)
+      << "Expected index dim: 1. Given : " << index.dim();
+  K2_CHECK_EQ(index.scalar_type(), ToScalarType<int32_t>::value)
+      << "Expected type int32_t Given : " << index.scalar_type();
+  K2_CHECK(index.is_contiguous()) << "Expected contiguous";
+
+  std::vector<torch::Tensor> ans;
+  if (index.numel() == 0 || srcs[0].numel() == 0) {
+    for (const auto &src : srcs)
+      ans.push_back(torch::empty({0}, src.options()));
+    return ans;
+  }
+  Array1<int32_t> index_array = FromTorch<int32_t>(index);
+  std::vector<Array1<T>> src_arrays;
+  std::vector<const Array1<T> *> src_ptrs;
+  std::vector<T> defaults;
+  src_arrays.reserve(num_srcs);
+  for (int32_t j = 0; j < num_srcs; ++j) {
+    const torch::Tensor &src = srcs[j];
+    K2_CHECK_EQ(src.dim(), 1) << "Expected dim: 1. Given: " << src.dim();
+    K2_CHECK_EQ(src.scalar_type(), ToScalarType<T>::value)
+        << "Expected equal type"
+        << " Given : " << src.scalar_type() << ", " << ToScalarType<T>::value;
+    K2_CHECK_EQ(src.device(), index.device())
+        << "Expected in the same device"
+        << " Given : " << src.device() << ", " << index.device();
+    src_arrays.push_back(FromTorch<T>(src.contiguous()));
+    src_ptrs.push_back(&src_arrays.back());
+    defaults.push_back(static_cast<T>(default_values[j]));
+  }
+  Array2<T> ans_array =
+      IndexMany(num_srcs, src_ptrs.data(), index_array, defaults.data());
+  for (int32_t j = 0; j < num_srcs; ++j) {
+    Array1<T> row = ans_array.Row(j);
+    ans.push_back(ToTorch(row));
+  }
+  return ans;
+}
+
+static std::vector<torch::Tensor> IndexSelectManyWrapper(
+    const std::vector<torch::Tensor> &srcs, torch::Tensor index,
+    const std::vector<double> &default_values) {
+  NVTX_RANGE(K2_FUNC);
+  if (srcs.empty()) return {};
+  DeviceGuard guard(GetContext(index));
+  auto scalar_type = srcs[0].scalar_type();
+  switch (scalar_type) {
+    case ToScalarType<int32_t>::value:
+      return IndexSelectMany1D<int32_t>(srcs, index, default_values);
+    case ToScalarType<int64_t>::value:
+      return IndexSelectMany1D<int64_t>(srcs, index, default_values);
+    case ToScalarType<float>::value:
+      return IndexSelectMany1D<float>(srcs, index, default_values);
+    case ToScalarType<double>::value:
+      return IndexSelectMany1D<double>(srcs, index, default_values);
+    default:
+      K2_LOG(FATAL) << "Unsupported scalar type: " << scalar_type;
+      return {};
+  }
+}
+
 static torch::Tensor IndexSelectWrapper(torch::Tensor src, torch::Tensor index,
                                         double default_value = 0) {
   NVTX_RANGE(K2_FUNC);
@@ -256,6 +329,25 @@ static void IndexSelect(py::module &m) {
           - `ans[i] = src[index[i]]` if `index[i] != -1`.
           - `ans[i] = default_value` if `index[i] == -1`
       )");
+  m.def("index_select_many", &IndexSelectManyWrapper, py::arg("srcs"),
+        py::arg("index"), py::arg("default_values"),
+        R"(
+      Like calling `index_select(srcs[i], index, default_values[i])` for
+      each i, but with a single kernel.
+
+      Args:
+        srcs:
+          A list of 1-D tensors with the same dtype and shape.  Supported
+          dtypes are the same as in `index_select`.
+        index:
+          It has to be a 1-D **contiguous** tensor with dtype `torch.int32`.
+          Must satisfy `-1 <= index[i] < srcs[j].shape[0]`.
+        default_values:
+          `default_values[j]` is the value of `ans[j][i]` if `index[i] == -1`.
+      Returns:
+        Return a list of 1-D tensors, `ans[j] = index_select(srcs[j], index,
+        default_values[j])`.  They share the memory of one 2-D tensor.
+      )");
   m.def("simple_ragged_index_select", &SimpleRaggedIndexSelectWrapper,
         py::arg("src"), py::arg("indexes"));
 }
@@ -23,6 +23,7 @@
 #include "k2/python/csrc/torch/mutual_information.h"
 
 void PybindMutualInformation(py::module &m) {
+  // These do not touch Python objects, so they release the GIL while they run.
   m.def(
       "mutual_information_forward",
       [](torch::Tensor px, torch::Tensor py,
@@ -41,21 +42,23 @@ void PybindMutualInformation(py::module &m) {
 #endif
         }
       },
+      py::call_guard<py::gil_scoped_release>(),
       py::arg("px"), py::arg("py"), py::arg("boundary"), py::arg("p"));
 
   m.def(
       "mutual_information_backward",
       [](torch::Tensor px, torch::Tensor py,
          torch::optional<torch::Tensor> boundary, torch::Tensor p,
-         torch::Tensor ans_grad) -> std::vector<torch::Tensor> {
+         torch::Tensor ans_grad, torch::optional<torch::Tensor> end_row_grad)
+          -> std::vector<torch::Tensor> {
         k2::DeviceGuard guard(k2::GetContext(px));
         if (px.device().is_cpu()) {
           return k2::MutualInformationBackwardCpu(px, py, boundary, p,
-                                                  ans_grad);
+                                                  ans_grad, end_row_grad);
         } else {
 #ifdef K2_WITH_CUDA
-          return k2::MutualInformationBackwardCuda(px, py, boundary, p,
-                                                   ans_grad, true);
+          return k2::MutualInformationBackwardCuda(
+              px, py, boundary, p, ans_grad, end_row_grad, true);
 #else
           K2_LOG(FATAL) << "Failed to find native CUDA module, make sure "
                         << "that you compiled the code with K2_WITH_CUDA.";
@@ -63,6 +66,51 @@ void PybindMutualInformation(py::module &m) {
 #endif
         }
       },
+      py::call_guard<py::gil_scoped_release>(),
       py::arg("px"), py::arg("py"), py::arg("boundary"), py::arg("p"),
-      py::arg("ans_grad"));
+      py::arg("ans_grad"), py::arg("end_row_grad") = py::none());
+
+  m.def(
+      "mutual_information_packed_forward",
+      [](torch::Tensor px, torch::Tensor py, torch::Tensor lengths,
+         bool modified) -> std::vector<torch::Tensor> {
+        k2::DeviceGuard guard(k2::GetContext(px));
+        if (px.device().is_cpu()) {
+          return k2::MutualInformationPackedCpu(px, py, lengths, modified);
+        } else {
+#ifdef K2_WITH_CUDA
+          return k2::MutualInformationPackedCuda(px, py, lengths, modified);
+#else
+          K2_LOG(FATAL) << "Failed to find native CUDA module, make sure "
+                        << "that you compiled the code with K2_WITH_CUDA.";
+          return std::vector<torch::Tensor>();
+#endif
+        }
+      },
+      py::call_guard<py::gil_scoped_release>(),
+      py::arg("px"), py::arg("py"), py::arg("lengths"), py::arg("modified"));
+
+  m.def(
+      "mutual_information_packed_backward",
+      [](torch::Tensor px, torch::Tensor py, torch::Tensor lengths,
+         bool modified, torch::Tensor p,
+         torch::Tensor ans_grad) -> std::vector<torch::Tensor> {
+        k2::DeviceGuard guard(k2::GetContext(px));
+        if (px.device().is_cpu()) {
+          return k2::MutualInformationPackedBackwardCpu(px, py, lengths,
+                                                        modified, p, ans_grad);
+        } else {
+#ifdef K2_WITH_CUDA
+          return k2::MutualInformationPackedBackwardCuda(
+              px, py, lengths, modified, p, ans_grad, true);
+#else
+          K2_LOG(FATAL) << "Failed to find native CUDA module, make sure "
+                        << "that you compiled the code with K2_WITH_CUDA.";
+          return std::vector<torch::Tensor>();
+#endif
+        }
+      },
+      py::call_guard<py::gil_scoped_release>(),
+      py::arg("px"), py::arg("py"), py::arg("lengths"), py::arg("modified"),
+      py::arg("p"), py::arg("ans_grad"));
 }
@@ -28,6 +28,94 @@
 #include "k2/python/csrc/torch.h"
 
 namespace k2 {
+
+/*
+  Returns the dtype of `p`, of the returned `ans` and of `ans_grad` for px
+  and py of dtype `t`: float for half and bfloat16 (the recursion is done in
+  float), else `t`.
+ */
+inline torch::ScalarType MutualInformationAccType(torch::ScalarType t) {
+  return (t == torch::kHalf || t == torch::kBFloat16) ? torch::kFloat : t;
+}
+
+// The C++ type corresponding to MutualInformationAccType().
+template <typename T>
+struct MutualInformationAcc {
+  using Type = T;
+};
+template <>
+struct MutualInformationAcc<at::Half> {
+  using Type = float;
+};
+template <>
+struct MutualInformationAcc<at::BFloat16> {
+  using Type = float;
+};
+
+/*
+  Index px, py and p (and their gradients) as x(b, s, t) in the CPU and CUDA
+  implementations.  MutualInformationPadded is for tensors of shape [B][*][*],
+  MutualInformationPacked for the 1-D tensors of the packed mode (see
+  MutualInformationPackedCpu()).
+ */
+template <typename T>
+struct MutualInformationPadded {
+  T *data;
+  int64_t stride0, stride1, stride2;
+
+  explicit MutualInformationPadded(torch::Tensor t)
+      : data(t.data_ptr<T>()),
+        stride0(t.stride(0)),
+        stride1(t.stride(1)),
+        stride2(t.stride(2)) {}
+
+  K2_CUDA_HOSTDEV T &operator()(int32_t b, int32_t s, int32_t t) const {
+    return data[b * stride0 + s * stride1 + t * stride2];
+  }
+};
+
+template <typename T>
+struct MutualInformationPacked {
+  T *data;
+  // offsets[b] is the index in `data` of element (b, 0, 0).
+  const int64_t *offsets;
+  // Contiguous, of shape [B][4]; row b is (0, 0, S_b, T_b).
+  const int64_t *boundary;
+  // The b'th matrix has rows of length T_b + extra.
+  int32_t extra;
+
+  MutualInformationPacked(torch::Tensor t, torch::Tensor offsets,
+                          torch::Tensor boundary, int32_t extra)
+      : data(t.data_ptr<T>()),
+        offsets(offsets.data_ptr<int64_t>()),
+        boundary(boundary.data_ptr<int64_t>()),
+        extra(extra) {}
+
+  K2_CUDA_HOSTDEV T &operator()(int32_t b, int32_t s, int32_t t) const {
+    return data[offsets[b] + s * (boundary[b * 4 + 3] + extra) + t];
+  }
+};
+
+/*
+  The layout of the packed px, py and p for a given `lengths` (see
+  MutualInformationPackedCpu()); all tensors are int64 and on the device of
+  `lengths`.
+ */
+struct MutualInformationPackedLayout {
+  torch::Tensor boundary;    // [B][4], contiguous; row b is (0, 0, S_b, T_b)
+  torch::Tensor px_offsets;  // [B], offset of the b'th sequence in px
+  torch::Tensor py_offsets;  // [B], offset of the b'th sequence in py
+  torch::Tensor p_offsets;   // [B], offset of the b'th sequence in p
+  int64_t px_size;           // The expected numel() of px, py and p.
+  int64_t py_size;
+  int64_t p_size;
+  int32_t S;  // max over b of S_b
+  int32_t T;  // max over b of T_b
+};
+
+MutualInformationPackedLayout GetMutualInformationPackedLayout(
+    torch::Tensor lengths, bool modified);
+
 /*
   Forward of mutual_information.  See also comment of `mutual_information`
   in mutual_information.py.  This is the core recursion
@@ -46,7 +134,8 @@ namespace k2 {
                Shape [B][S + 1][T]
     @param p   This function writes to p[b][s][t] the mutual information between
                sub-sequences of x and y of length s and t respectively, from the
-               b'th sequences in the batch.  Its shape is [B][S + 1][T + 1].
+               b'th sequences in the batch.  Its shape is [B][S + 1][T + 1]
+               and its dtype is MutualInformationAccType(px.scalar_type()).
                Concretely, this function implements the following recursion,
                in the case where s_begin == t_begin == 0:
 
@@ -66,7 +155,8 @@ namespace k2 {
                      of the x and y sequences that we should process.
                      Alternatively, may be a tensor of shape [0][0] and type
                      int64_t; the elements will default to (0, 0, S, T).
-    @return A tensor `ans` of shape [B], where this function will set
+    @return A tensor `ans` of shape [B] and of the same dtype as `p`,
+               where this function will set
                ans[b] = p[b][s_end][t_end],
                with s_end and t_end being (S, T) if `boundary` was specified,
                and (boundary[b][2], boundary[b][3]) otherwise.
@@ -90,19 +180,72 @@ torch::Tensor MutualInformationCuda(
     torch::Tensor p);                         //  [B][S+1][T+1]; an output
 
 /*
-  backward of mutual_information; returns (grad_px, grad_py)
+  backward of mutual_information; returns (grad_px, grad_py), of the same
+  dtype as px and py.  `p` and `ans_grad` are of dtype
+  MutualInformationAccType(px.scalar_type()).
 
   if overwrite_ans_grad == true, this function will overwrite ans_grad with a
   value that, if the computation worked correctly, should be identical to or
   very close to the value of ans_grad at entry.  This can be used
   to validate the correctness of this code.
+
+  If set, `end_row_grad` is a tensor of shape [B][T+1] and of the dtype of
+  `p`, whose element (b, t) is added to the grad of p[b][s_end][t], i.e. it
+  is the grad of the last row of p coming from a computation that continues
+  the recursion beyond s_end.  The checkpointed mode of
+  mutual_information_recursion() (see mutual_information.py) uses it to do
+  the backward pass one block of rows at a time.
 */
 std::vector<torch::Tensor> MutualInformationBackwardCpu(
     torch::Tensor px, torch::Tensor py, torch::optional<torch::Tensor> boundary,
-    torch::Tensor p, torch::Tensor ans_grad);
+    torch::Tensor p, torch::Tensor ans_grad,
+    torch::optional<torch::Tensor> end_row_grad);
 
 std::vector<torch::Tensor> MutualInformationBackwardCuda(
     torch::Tensor px, torch::Tensor py, torch::optional<torch::Tensor> boundary,
+    torch::Tensor p, torch::Tensor ans_grad,
+    torch::optional<torch::Tensor> end_row_grad, bool overwrite_ans_grad);
+
+/*
+  Forward of mutual_information for variable-length sequences stored without
+  padding, so that no memory or compute is spent on the padded (s, t)
+  positions.
+
+    @param lengths  A tensor of shape [B][2] and type int64_t, whose b'th row
+               is (S_b, T_b), the lengths of the b'th x and y sequences.
+    @param modified  See MutualInformationCpu(); it cannot be worked out from
+               the shapes here.
+    @param px  A 1-D tensor, the concatenation of the b'th sequence's px of
+               shape [S_b][T_b + 1] if not modified, [S_b][T_b] if modified,
+               flattened in row-major order, for b = 0 .. B - 1.
+    @param py  A 1-D tensor of the same dtype as px, the concatenation of the
+               flattened py of shape [S_b + 1][T_b].
+    @return Returns (ans, p), where ans of shape [B] is as returned by
+               MutualInformationCpu() with `boundary` set to (0, 0, S_b, T_b),
+               and p (needed for the backward pass) is the concatenation of
+               the flattened p of shape [S_b + 1][T_b + 1].  Their dtype is
+               MutualInformationAccType(px.scalar_type()).
+ */
+std::vector<torch::Tensor> MutualInformationPackedCpu(torch::Tensor px,
+                                                      torch::Tensor py,
+                                                      torch::Tensor lengths,
+                                                      bool modified);
+
+std::vector<torch::Tensor> MutualInformationPackedCuda(torch::Tensor px,
+                                                       torch::Tensor py,
+                                                       torch::Tensor lengths,
+                                                       bool modified);
+
+/*
+  Backward of MutualInformationPackedCpu(); returns (px_grad, py_grad), packed
+  like px and py.  `p` is as returned by the forward pass.
+ */
+std::vector<torch::Tensor> MutualInformationPackedBackwardCpu(
+    torch::Tensor px, torch::Tensor py, torch::Tensor lengths, bool modified,
+    torch::Tensor p, torch::Tensor ans_grad);
+
+std::vector<torch::Tensor> MutualInformationPackedBackwardCuda(
+    torch::Tensor px, torch::Tensor py, torch::Tensor lengths, bool modified,
     torch::Tensor p, torch::Tensor ans_grad, bool overwrite_ans_grad);
 
 }  // namespace k2
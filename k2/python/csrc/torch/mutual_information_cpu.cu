@@ -18,11 +18,218 @@
  * limitations under the License.
  */
 
+#include <ATen/Parallel.h>
+
+#include <algorithm>
+#include <limits>
+#include <vector>
+
 #include "k2/csrc/utils.h"  // for LogAdd
 #include "k2/python/csrc/torch/mutual_information.h"
 
 namespace k2 {
 
+// A sequence is processed by anti-diagonals, with the cells of each
+// anti-diagonal split among threads, only if its longest anti-diagonal has
+// at least this many cells; this is also the grain size of the split.
+static constexpr int32_t kMinCellsPerDiagonal = 64;
+
+/*
+  Calls f(s, t) for all s_begin <= s <= s_end and t_begin <= t <= t_end, in
+  an order such that f(s - 1, t), f(s, t - 1) and f(s - 1, t - 1) are called
+  before f(s, t) (after it if `reverse` is true).
+
+  If `wavefront` is true, the cells are visited by anti-diagonals
+  d = s + t, and the cells of an anti-diagonal, which do not depend on each
+  other, are visited in parallel; else they are visited row by row in the
+  calling thread.
+ */
+template <typename F>
+static void ForEachMutualInformationCell(int32_t s_begin, int32_t t_begin,
+                                         int32_t s_end, int32_t t_end,
+                                         bool reverse, bool wavefront, F f) {
+  if (!wavefront) {
+    if (!reverse) {
+      for (int32_t s = s_begin; s <= s_end; ++s)
+        for (int32_t t = t_begin; t <= t_end; ++t) f(s, t);
+    } else {
+      for (int32_t s = s_end; s >= s_begin; --s)
+        for (int32_t t = t_end; t >= t_begin; --t) f(s, t);
+    }
+    return;
+  }
+  int32_t d_begin = s_begin + t_begin, d_end = s_end + t_end;
+  for (int32_t i = d_begin; i <= d_end; ++i) {
+    int32_t d = (reverse ? d_end + d_begin - i : i);
+    int32_t s_lo = std::max(s_begin, d - t_end),
+            s_hi = std::min(s_end, d - t_begin);
+    at::parallel_for(s_lo, s_hi + 1, kMinCellsPerDiagonal,
+                     [&](int64_t begin, int64_t end) {
+                       for (int32_t s = begin; s < end; ++s) f(s, d - s);
+                     });
+  }
+}
+
+/*
+  Calls f(b, wavefront) for 0 <= b < B, where `wavefront` is to be passed to
+  ForEachMutualInformationCell().  If there are at least as many sequences
+  as threads, the sequences are processed in parallel; else they are
+  processed one after another, each by anti-diagonals in parallel if it is
+  large enough.
+ */
+template <typename F>
+static void ForEachMutualInformationSequence(
+    at::TensorAccessor<int64_t, 2> boundary_a, int B, F f) {
+  if (B >= at::get_num_threads()) {
+    at::parallel_for(0, B, 1, [&](int64_t begin, int64_t end) {
+      for (int32_t b = begin; b < end; ++b) f(b, false);
+    });
+    return;
+  }
+  for (int32_t b = 0; b < B; ++b) {
+    int64_t num_s = boundary_a[b][2] - boundary_a[b][0] + 1,
+            num_t = boundary_a[b][3] - boundary_a[b][1] + 1;
+    f(b, std::min(num_s, num_t) >= kMinCellsPerDiagonal);
+  }
+}
+
+/*
+  The loop of MutualInformationCpu() and MutualInformationPackedCpu().
+  XAccessor and PAccessor are MutualInformationPadded or MutualInformationPacked
+  of px's scalar type and of acc_t respectively.
+ */
+template <typename acc_t, typename XAccessor, typename PAccessor>
+static void MutualInformationCpuLoop(XAccessor px_a, XAccessor py_a,
+                                     PAccessor p_a,
+                                     at::TensorAccessor<int64_t, 2> boundary_a,
+                                     at::TensorAccessor<acc_t, 1> ans_a, int B,
+                                     bool modified) {
+  int t_offset = (modified ? -1 : 0);
+  ForEachMutualInformationSequence(boundary_a, B, [&](int b, bool wavefront) {
+    int s_begin = boundary_a[b][0];
+    int t_begin = boundary_a[b][1];
+    int s_end = boundary_a[b][2];
+    int t_end = boundary_a[b][3];
+    ForEachMutualInformationCell(
+        s_begin, t_begin, s_end, t_end, false, wavefront, [&](int s, int t) {
+          acc_t p;
+          if (t == t_begin) {
+            if (s == s_begin)
+              p = 0.0;
+            else if (modified)
+              p = -std::numeric_limits<acc_t>::infinity();
+            else  // note: t_offset = 0 so don't need t + t_offset below.
+              p = p_a(b, s - 1, t) + static_cast<acc_t>(px_a(b, s - 1, t));
+          } else if (s == s_begin) {
+            p = p_a(b, s, t - 1) + static_cast<acc_t>(py_a(b, s, t - 1));
+          } else {
+            p = LogAdd<acc_t>()(
+                p_a(b, s - 1, t + t_offset) +
+                    static_cast<acc_t>(px_a(b, s - 1, t + t_offset)),
+                p_a(b, s, t - 1) + static_cast<acc_t>(py_a(b, s, t - 1)));
+          }
+          p_a(b, s, t) = p;
+        });
+    ans_a[b] = p_a(b, s_end, t_end);
+  });
+}
+
+// The loop of MutualInformationBackwardCpu() and
+// MutualInformationPackedBackwardCpu(); see MutualInformationCpuLoop().
+// end_row_grad, if not nullptr, is the data of the `end_row_grad` of
+// MutualInformationBackwardCpu(), with rows of `end_row_grad_stride`.
+template <typename acc_t, typename XAccessor, typename PAccessor>
+static void MutualInformationBackwardCpuLoop(
+    XAccessor px_a, PAccessor px_grad_a, PAccessor py_grad_a, PAccessor p_a,
+    at::TensorAccessor<acc_t, 1> ans_grad_a, const acc_t *end_row_grad,
+    int64_t end_row_grad_stride, at::TensorAccessor<int64_t, 2> boundary_a,
+    int B, bool modified) {
+  int t_offset = (modified ? -1 : 0);
+
+  ForEachMutualInformationSequence(boundary_a, B, [&](int b, bool wavefront) {
+    int s_begin = boundary_a[b][0];
+    int t_begin = boundary_a[b][1];
+    int s_end = boundary_a[b][2];
+    int t_end = boundary_a[b][3];
+    // The grad of p(b, s_begin, t_begin), for the check below.
+    acc_t begin_grad = 0;
+    // Cells only write the grads of their own px and py terms, so that the
+    // cells of an anti-diagonal can be processed in parallel; each cell
+    // gathers the grad of its p from the px_grad and py_grad written by the
+    // cells that depend on it.  px_grad and py_grad are of type acc_t, so
+    // that this loses no precision for half and bfloat16.
+    ForEachMutualInformationCell(
+        s_begin, t_begin, s_end, t_end, true, wavefront, [&](int s, int t) {
+          // Backprop for: ans_a[b] = p_a(b, s_end, t_end);
+          acc_t grad = (s == s_end && t == t_end ? ans_grad_a[b] : 0);
+          if (s == s_end && end_row_grad != nullptr)
+            grad += end_row_grad[b * end_row_grad_stride + t];
+          // From p(b, s, t + 1), which uses p(b, s, t) + py(b, s, t).
+          if (t < t_end) grad += py_grad_a(b, s, t);
+          // From p(b, s + 1, t - t_offset), which uses
+          // p(b, s, t) + px(b, s, t).
+          if (s < s_end && (!modified || t < t_end))
+            grad += px_grad_a(b, s, t);
+
+          if (t == t_begin) {
+            if (s == s_begin) {
+              begin_grad = grad;
+            } else if (!modified) {
+              // Backprop for:
+              // p_a(b, s, t_begin) =
+              //    p_a(b, s - 1, t_begin) + px_a(b, s - 1, t_begin);
+              px_grad_a(b, s - 1, t) = grad;
+            }  // else p(b, s, t_begin) is -infinity and there is nothing to
+               // backprop.
+            return;
+          }
+          if (s == s_begin) {
+            // Backprop for:
+            // p_a(b, s_begin, t) =
+            //     p_a(b, s_begin, t - 1) + py_a(b, s_begin, t - 1);
+            py_grad_a(b, s, t - 1) = grad;
+            return;
+          }
+          // The statement we are backpropagating here is:
+          // p_a(b, s, t) = LogAdd(
+          //    p_a(b, s - 1, t + t_offset) + px_a(b, s - 1, t + t_offset),
+          //    p_a(b, s, t - 1) + py_a(b, s, t - 1));
+          acc_t term1 = p_a(b, s - 1, t + t_offset) +
+                        static_cast<acc_t>(px_a(b, s - 1, t + t_offset)),
+                // term2 = p_a(b, s, t - 1) + py_a(b, s, t - 1), <-- not
+                // actually needed..
+              total = p_a(b, s, t);
+          if (total - total != 0) total = 0;
+          acc_t term1_deriv = exp(term1 - total),
+                term2_deriv = 1.0 - term1_deriv;
+          acc_t term1_grad, term2_grad;
+          if (term1_deriv - term1_deriv == 0.0) {
+            term1_grad = term1_deriv * grad;
+            term2_grad = term2_deriv * grad;
+          } else {
+            // could happen if total == -inf
+            term1_grad = term2_grad = 0.0;
+          }
+          px_grad_a(b, s - 1, t + t_offset) = term1_grad;
+          py_grad_a(b, s, t - 1) = term2_grad;
+        });
+    // There is no backprop for:
+    // p_a(b, s_begin, t_begin) = 0.0;
+    // .. but we can use this for a check, that the grad at the beginning
+    // of the sequence is equal to the grad at the end of the sequence (which
+    // does not hold if grad also comes in through end_row_grad).
+    if (ans_grad_a[b] != 0.0 && end_row_grad == nullptr) {
+      float grad_ratio = begin_grad / ans_grad_a[b];
+      if (fabs(grad_ratio - 1.0) > 0.01) {
+        K2_LOG(WARNING)
+            << "Warning: mutual_information backprop: expected these "
+            << "numbers to be the same:" << static_cast<float>(begin_grad)
+            << " vs " << static_cast<float>(ans_grad_a[b]);
+      }
+    }
+  });
+}
+
 // forward of mutual_information.  See """... """ comment of
 // `mutual_information_recursion` in
 // in k2/python/k2/mutual_information.py for documentation of the
@@ -59,8 +266,10 @@ torch::Tensor MutualInformationCpu(torch::Tensor px, torch::Tensor py,
 
   bool modified = (px.size(2) == py.size(2));
 
-  auto scalar_t = px.scalar_type();
-  auto opts = torch::TensorOptions().dtype(scalar_t).device(px.device());
+  auto acc_type = MutualInformationAccType(px.scalar_type());
+  auto acc_opts = torch::TensorOptions().dtype(acc_type).device(px.device());
+  TORCH_CHECK(py.scalar_type() == px.scalar_type() &&
+              p.scalar_type() == acc_type);
 
   const int B = px.size(0), S = px.size(1), T = py.size(2);
   TORCH_CHECK(px.size(2) == (modified ? T : T + 1));
@@ -76,49 +285,18 @@ torch::Tensor MutualInformationCpu(torch::Tensor px, torch::Tensor py,
   TORCH_CHECK(boundary.size(0) == B && boundary.size(1) == 4);
   TORCH_CHECK(boundary.device().is_cpu() && boundary.dtype() == torch::kInt64);
 
-  torch::Tensor ans = torch::empty({B}, opts);
-
-  AT_DISPATCH_FLOATING_TYPES(
-      px.scalar_type(), "mutual_information_cpu_loop", ([&] {
-        auto px_a = px.accessor<scalar_t, 3>(),
-             py_a = py.accessor<scalar_t, 3>(), p_a = p.accessor<scalar_t, 3>();
-        auto boundary_a = boundary.accessor<int64_t, 2>();
-        auto ans_a = ans.accessor<scalar_t, 1>();
-
-        int t_offset = (modified ? -1 : 0);
-        for (int b = 0; b < B; b++) {
-          int s_begin = boundary_a[b][0];
-          int t_begin = boundary_a[b][1];
-          int s_end = boundary_a[b][2];
-          int t_end = boundary_a[b][3];
-          p_a[b][s_begin][t_begin] = 0.0;
-          if (modified) {
-            for (int s = s_begin + 1; s <= s_end; ++s)
-              p_a[b][s][t_begin] = -std::numeric_limits<scalar_t>::infinity();
-          } else {
-            // note: t_offset = 0 so don't need t_begin + t_offset below.
-            for (int s = s_begin + 1; s <= s_end; ++s)
-              p_a[b][s][t_begin] =
-                  p_a[b][s - 1][t_begin] + px_a[b][s - 1][t_begin];
-          }
-          for (int t = t_begin + 1; t <= t_end; ++t)
-            p_a[b][s_begin][t] =
-                p_a[b][s_begin][t - 1] + py_a[b][s_begin][t - 1];
-          for (int s = s_begin + 1; s <= s_end; ++s) {
-            scalar_t p_s_t1 = p_a[b][s][t_begin];
-            for (int t = t_begin + 1; t <= t_end; ++t) {
-              // The following statement is a small optimization of:
-              // p_a[b][s][t] = LogAdd(
-              //    p_a[b][s - 1][t + t_offset] + px_a[b][s -1][t + t_offset],
-              //    p_a[b][s][t - 1] + py_a[b][s][t - 1]);
-              // .. which obtains p_a[b][s][t - 1] from a register.
-              p_a[b][s][t] = p_s_t1 = LogAdd<scalar_t>()(
-                  p_a[b][s - 1][t + t_offset] + px_a[b][s - 1][t + t_offset],
-                  p_s_t1 + py_a[b][s][t - 1]);
-            }
-          }
-          ans_a[b] = p_a[b][s_end][t_end];
-        }
+  torch::Tensor ans = torch::empty({B}, acc_opts);
+
+  AT_DISPATCH_FLOATING_TYPES_AND2(
+      at::ScalarType::Half, at::ScalarType::BFloat16, px.scalar_type(),
+      "mutual_information_cpu_loop", ([&] {
+        using acc_t = typename MutualInformationAcc<scalar_t>::Type;
+        MutualInformationCpuLoop<acc_t>(
+            MutualInformationPadded<scalar_t>(px),
+            MutualInformationPadded<scalar_t>(py),
+            MutualInformationPadded<acc_t>(p),
+            boundary.accessor<int64_t, 2>(), ans.accessor<acc_t, 1>(), B,
+            modified);
       }));
   return ans;
 }
@@ -128,7 +306,7 @@ torch::Tensor MutualInformationCpu(torch::Tensor px, torch::Tensor py,
 std::vector<torch::Tensor> MutualInformationBackwardCpu(
     torch::Tensor px, torch::Tensor py,
     torch::optional<torch::Tensor> opt_boundary, torch::Tensor p,
-    torch::Tensor ans_grad) {
+    torch::Tensor ans_grad, torch::optional<torch::Tensor> end_row_grad) {
   TORCH_CHECK(px.dim() == 3, "px must be 3-dimensional");
   TORCH_CHECK(py.dim() == 3, "py must be 3-dimensional.");
   TORCH_CHECK(p.dim() == 3, "p must be 3-dimensional.");
@@ -140,8 +318,13 @@ std::vector<torch::Tensor> MutualInformationBackwardCpu(
                   p.device().is_cpu() && ans_grad.device().is_cpu(),
               "inputs must be CPU tensors");
 
-  auto scalar_t = px.scalar_type();
-  auto opts = torch::TensorOptions().dtype(scalar_t).device(px.device());
+  auto opts =
+      torch::TensorOptions().dtype(px.scalar_type()).device(px.device());
+  auto acc_type = MutualInformationAccType(px.scalar_type());
+  auto acc_opts = torch::TensorOptions().dtype(acc_type).device(px.device());
+  TORCH_CHECK(py.scalar_type() == px.scalar_type() &&
+              p.scalar_type() == acc_type &&
+              ans_grad.scalar_type() == acc_type);
 
   const int B = px.size(0), S = px.size(1), T = py.size(2);
   TORCH_CHECK(px.size(2) == (modified ? T : T + 1));
@@ -156,101 +339,184 @@ std::vector<torch::Tensor> MutualInformationBackwardCpu(
   TORCH_CHECK(boundary.dim() == 2, "boundary must be 2-dimensional.");
   TORCH_CHECK(boundary.size(0) == B && boundary.size(1) == 4);
   TORCH_CHECK(boundary.device().is_cpu() && boundary.dtype() == torch::kInt64);
+  if (end_row_grad.has_value()) {
+    end_row_grad = end_row_grad->contiguous();
+    TORCH_CHECK(end_row_grad->dim() == 2 && end_row_grad->size(0) == B &&
+                    end_row_grad->size(1) == T + 1,
+                "end_row_grad must be of shape [B][T+1]");
+    TORCH_CHECK(end_row_grad->device().is_cpu() &&
+                end_row_grad->scalar_type() == acc_type);
+  }
 
   bool has_boundary = opt_boundary.has_value();
   int T1 = T + (modified ? 0 : 1);
-  torch::Tensor p_grad = torch::zeros({B, S + 1, T + 1}, opts),
-                px_grad = (has_boundary ? torch::zeros({B, S, T1}, opts)
-                                        : torch::empty({B, S, T1}, opts)),
-                py_grad = (has_boundary ? torch::zeros({B, S + 1, T}, opts)
-                                        : torch::empty({B, S + 1, T}, opts));
-
-  AT_DISPATCH_FLOATING_TYPES(
-      px.scalar_type(), "mutual_information_cpu_backward_loop", ([&] {
-        auto px_a = px.accessor<scalar_t, 3>(), p_a = p.accessor<scalar_t, 3>(),
-             p_grad_a = p_grad.accessor<scalar_t, 3>(),
-             px_grad_a = px_grad.accessor<scalar_t, 3>(),
-             py_grad_a = py_grad.accessor<scalar_t, 3>();
-
-        auto ans_grad_a = ans_grad.accessor<scalar_t, 1>();
-        auto boundary_a = boundary.accessor<int64_t, 2>();
-        int t_offset = (modified ? -1 : 0);
-
-        for (int b = 0; b < B; b++) {
-          int s_begin = boundary_a[b][0];
-          int t_begin = boundary_a[b][1];
-          int s_end = boundary_a[b][2];
-          int t_end = boundary_a[b][3];
-          // Backprop for: ans_a[b] = p_a[b][s_end][t_end];
-          p_grad_a[b][s_end][t_end] = ans_grad_a[b];
-
-          for (int s = s_end; s > s_begin; --s) {
-            for (int t = t_end; t > t_begin; --t) {
-              // The s,t indexes correspond to
-              // The statement we are backpropagating here is:
-              // p_a[b][s][t] = LogAdd(
-              //    p_a[b][s - 1][t + t_offset] + px_a[b][s - 1][t + t_offset],
-              //    p_a[b][s][t - 1] + py_a[b][s][t - 1]);
-              // .. which obtains p_a[b][s][t - 1] from a register.
-              scalar_t term1 = p_a[b][s - 1][t + t_offset] +
-                               px_a[b][s - 1][t + t_offset],
-                       // term2 = p_a[b][s][t - 1] + py_a[b][s][t - 1], <-- not
-                       // actually needed..
-                  total = p_a[b][s][t];
-              if (total - total != 0) total = 0;
-              scalar_t term1_deriv = exp(term1 - total),
-                       term2_deriv = 1.0 - term1_deriv,
-                       grad = p_grad_a[b][s][t];
-              scalar_t term1_grad, term2_grad;
-              if (term1_deriv - term1_deriv == 0.0) {
-                term1_grad = term1_deriv * grad;
-                term2_grad = term2_deriv * grad;
-              } else {
-                // could happen if total == -inf
-                term1_grad = term2_grad = 0.0;
-              }
-              px_grad_a[b][s - 1][t + t_offset] = term1_grad;
-              p_grad_a[b][s - 1][t + t_offset] = term1_grad;
-              py_grad_a[b][s][t - 1] = term2_grad;
-              p_grad_a[b][s][t - 1] += term2_grad;
-            }
-          }
-          for (int t = t_end; t > t_begin; --t) {
-            // Backprop for:
-            // p_a[b][s_begin][t] =
-            //     p_a[b][s_begin][t - 1] + py_a[b][s_begin][t - 1];
-            scalar_t this_p_grad = p_grad_a[b][s_begin][t];
-            p_grad_a[b][s_begin][t - 1] += this_p_grad;
-            py_grad_a[b][s_begin][t - 1] = this_p_grad;
-          }
-          if (!modified) {
-            for (int s = s_end; s > s_begin; --s) {
-              // Backprop for:
-              // p_a[b][s][t_begin] =
-              //    p_a[b][s - 1][t_begin] + px_a[b][s - 1][t_begin];
-              scalar_t this_p_grad = p_grad_a[b][s][t_begin];
-              p_grad_a[b][s - 1][t_begin] += this_p_grad;
-              px_grad_a[b][s - 1][t_begin] = this_p_grad;
-            }
-          }  // else these were all -infinity's and there is nothing to
-             // backprop.
-          // There is no backprop for:
-          // p_a[b][s_begin][t_begin] = 0.0;
-          // .. but we can use this for a check, that the grad at the beginning
-          // of the sequence is equal to the grad at the end of the sequence.
-          if (ans_grad_a[b] != 0.0) {
-            float grad_ratio = p_grad_a[b][s_begin][t_begin] / ans_grad_a[b];
-            if (fabs(grad_ratio - 1.0) > 0.01) {
-              K2_LOG(WARNING)
-                  << "Warning: mutual_information backprop: expected these "
-                  << "numbers to be the same:"
-                  << static_cast<float>(p_grad_a[b][s_begin][t_begin]) << " vs "
-                  << static_cast<float>(ans_grad_a[b]);
-            }
-          }
-        }
+  // px_grad and py_grad are computed in acc_type; see
+  // MutualInformationBackwardCpuLoop().
+  torch::Tensor px_grad, py_grad;
+  if (has_boundary) {
+    px_grad = torch::zeros({B, S, T1}, acc_opts);
+    py_grad = torch::zeros({B, S + 1, T}, acc_opts);
+  } else {
+    px_grad = torch::empty({B, S, T1}, acc_opts);
+    py_grad = torch::empty({B, S + 1, T}, acc_opts);
+  }
+
+  AT_DISPATCH_FLOATING_TYPES_AND2(
+      at::ScalarType::Half, at::ScalarType::BFloat16, px.scalar_type(),
+      "mutual_information_cpu_backward_loop", ([&] {
+        using acc_t = typename MutualInformationAcc<scalar_t>::Type;
+        MutualInformationBackwardCpuLoop<acc_t>(
+            MutualInformationPadded<scalar_t>(px),
+            MutualInformationPadded<acc_t>(px_grad),
+            MutualInformationPadded<acc_t>(py_grad),
+            MutualInformationPadded<acc_t>(p),
+            ans_grad.accessor<acc_t, 1>(),
+            end_row_grad.has_value() ? end_row_grad->data_ptr<acc_t>()
+                                     : nullptr,
+            T + 1, boundary.accessor<int64_t, 2>(), B, modified);
+      }));
+
+  return std::vector<torch::Tensor>({px_grad.to(opts), py_grad.to(opts)});
+}
+
+MutualInformationPackedLayout GetMutualInformationPackedLayout(
+    torch::Tensor lengths, bool modified) {
+  TORCH_CHECK(lengths.dim() == 2 && lengths.size(1) == 2,
+              "lengths must be of shape [B][2]");
+  TORCH_CHECK(lengths.dtype() == torch::kInt64, "lengths must be int64");
+
+  const int B = lengths.size(0);
+  torch::Tensor lengths_cpu = lengths.cpu();
+  auto lengths_a = lengths_cpu.accessor<int64_t, 2>();
+
+  auto opts = torch::dtype(torch::kInt64);
+  torch::Tensor boundary = torch::zeros({B, 4}, opts),
+                px_offsets = torch::empty({B}, opts),
+                py_offsets = torch::empty({B}, opts),
+                p_offsets = torch::empty({B}, opts);
+  auto boundary_a = boundary.accessor<int64_t, 2>();
+  auto px_offsets_a = px_offsets.accessor<int64_t, 1>(),
+       py_offsets_a = py_offsets.accessor<int64_t, 1>(),
+       p_offsets_a = p_offsets.accessor<int64_t, 1>();
+
+  MutualInformationPackedLayout layout;
+  layout.px_size = layout.py_size = layout.p_size = 0;
+  layout.S = layout.T = 0;
+  for (int b = 0; b < B; ++b) {
+    int64_t S = lengths_a[b][0], T = lengths_a[b][1];
+    TORCH_CHECK(S >= 0 && T >= 0, "lengths must be nonnegative");
+    boundary_a[b][2] = S;
+    boundary_a[b][3] = T;
+    px_offsets_a[b] = layout.px_size;
+    py_offsets_a[b] = layout.py_size;
+    p_offsets_a[b] = layout.p_size;
+    layout.px_size += S * (modified ? T : T + 1);
+    layout.py_size += (S + 1) * T;
+    layout.p_size += (S + 1) * (T + 1);
+    layout.S = std::max<int32_t>(layout.S, S);
+    layout.T = std::max<int32_t>(layout.T, T);
+  }
+
+  layout.boundary = boundary.to(lengths.device());
+  layout.px_offsets = px_offsets.to(lengths.device());
+  layout.py_offsets = py_offsets.to(lengths.device());
+  layout.p_offsets = p_offsets.to(lengths.device());
+  return layout;
+}
+
+std::vector<torch::Tensor> MutualInformationPackedCpu(torch::Tensor px,
+                                                      torch::Tensor py,
+                                                      torch::Tensor lengths,
+                                                      bool modified) {
+  TORCH_CHECK(px.dim() == 1, "px must be 1-dimensional");
+  TORCH_CHECK(py.dim() == 1, "py must be 1-dimensional.");
+  TORCH_CHECK(px.device().is_cpu() && py.device().is_cpu() &&
+                  lengths.device().is_cpu(),
+              "inputs must be CPU tensors");
+  TORCH_CHECK(py.scalar_type() == px.scalar_type());
+
+  MutualInformationPackedLayout layout =
+      GetMutualInformationPackedLayout(lengths, modified);
+  TORCH_CHECK(px.numel() == layout.px_size && py.numel() == layout.py_size,
+              "The sizes of px and py do not match lengths");
+  px = px.contiguous();
+  py = py.contiguous();
+
+  const int B = lengths.size(0);
+  const int32_t px_extra = (modified ? 0 : 1);
+  auto acc_type = MutualInformationAccType(px.scalar_type());
+  auto acc_opts = torch::TensorOptions().dtype(acc_type).device(px.device());
+  torch::Tensor p = torch::empty({layout.p_size}, acc_opts),
+                ans = torch::empty({B}, acc_opts);
+
+  AT_DISPATCH_FLOATING_TYPES_AND2(
+      at::ScalarType::Half, at::ScalarType::BFloat16, px.scalar_type(),
+      "mutual_information_packed_cpu_loop", ([&] {
+        using acc_t = typename MutualInformationAcc<scalar_t>::Type;
+        MutualInformationCpuLoop<acc_t>(
+            MutualInformationPacked<scalar_t>(px, layout.px_offsets,
+                                              layout.boundary, px_extra),
+            MutualInformationPacked<scalar_t>(py, layout.py_offsets,
+                                              layout.boundary, 0),
+            MutualInformationPacked<acc_t>(p, layout.p_offsets,
+                                           layout.boundary, 1),
+            layout.boundary.accessor<int64_t, 2>(), ans.accessor<acc_t, 1>(),
+            B, modified);
+      }));
+  return std::vector<torch::Tensor>({ans, p});
+}
+
+std::vector<torch::Tensor> MutualInformationPackedBackwardCpu(
+    torch::Tensor px, torch::Tensor py, torch::Tensor lengths, bool modified,
+    torch::Tensor p, torch::Tensor ans_grad) {
+  TORCH_CHECK(px.dim() == 1, "px must be 1-dimensional");
+  TORCH_CHECK(py.dim() == 1, "py must be 1-dimensional.");
+  TORCH_CHECK(p.dim() == 1, "p must be 1-dimensional.");
+  TORCH_CHECK(ans_grad.dim() == 1, "ans_grad must be 1-dimensional.");
+  TORCH_CHECK(px.device().is_cpu() && py.device().is_cpu() &&
+                  p.device().is_cpu() && ans_grad.device().is_cpu() &&
+                  lengths.device().is_cpu(),
+              "inputs must be CPU tensors");
+
+  auto opts =
+      torch::TensorOptions().dtype(px.scalar_type()).device(px.device());
+  auto acc_type = MutualInformationAccType(px.scalar_type());
+  auto acc_opts = torch::TensorOptions().dtype(acc_type).device(px.device());
+  TORCH_CHECK(py.scalar_type() == px.scalar_type() &&
+              p.scalar_type() == acc_type &&
+              ans_grad.scalar_type() == acc_type);
+
+  MutualInformationPackedLayout layout =
+      GetMutualInformationPackedLayout(lengths, modified);
+  const int B = lengths.size(0);
+  TORCH_CHECK(px.numel() == layout.px_size && py.numel() == layout.py_size &&
+                  p.numel() == layout.p_size,
+              "The sizes of px, py and p do not match lengths");
+  TORCH_CHECK(ans_grad.size(0) == B);
+  px = px.contiguous();
+  p = p.contiguous();
+
+  const int32_t px_extra = (modified ? 0 : 1);
+  torch::Tensor px_grad = torch::empty({layout.px_size}, acc_opts),
+                py_grad = torch::empty({layout.py_size}, acc_opts);
+
+  AT_DISPATCH_FLOATING_TYPES_AND2(
+      at::ScalarType::Half, at::ScalarType::BFloat16, px.scalar_type(),
+      "mutual_information_packed_cpu_backward_loop", ([&] {
+        using acc_t = typename MutualInformationAcc<scalar_t>::Type;
+        MutualInformationBackwardCpuLoop<acc_t>(
+            MutualInformationPacked<scalar_t>(px, layout.px_offsets,
+                                              layout.boundary, px_extra),
+            MutualInformationPacked<acc_t>(px_grad, layout.px_offsets,
+                                           layout.boundary, px_extra),
+            MutualInformationPacked<acc_t>(py_grad, layout.py_offsets,
+                                           layout.boundary, 0),
+            MutualInformationPacked<acc_t>(p, layout.p_offsets,
+                                           layout.boundary, 1),
+            ans_grad.accessor<acc_t, 1>(), nullptr, 0,
+            layout.boundary.accessor<int64_t, 2>(), B, modified);
       }));
 
-  return std::vector<torch::Tensor>({px_grad, py_grad});
+  return std::vector<torch::Tensor>({px_grad.to(opts), py_grad.to(opts)});
 }
 }  // namespace k2
@@ -21,11 +21,254 @@
 #include <c10/cuda/CUDAStream.h>  // for getCurrentCUDAStream()
 #include <cooperative_groups.h>
 
+#include <cstdlib>  // for std::getenv()
+
 #include "k2/csrc/utils.h"  // for LogAdd
 #include "k2/python/csrc/torch/mutual_information.h"
 
 namespace k2 {
 
+/*
+  Computes one block of (up to) BLOCK_SIZE by BLOCK_SIZE elements of `p` for
+  batch element b, namely the one with block-indexes (block, iter - block) in
+  the s and t directions.  It is the body of mutual_information_kernel() and
+  mutual_information_persistent_kernel(); see their documentation for the
+  other args.
+
+  If PERSISTENT, the blocks this block depends on may be computed concurrently
+  by other thread-blocks, and `block_done`, of size
+  [B][num_s_blocks][num_t_blocks], is used to wait for them and to mark this
+  block as done; else they must have been computed by previous kernels.
+*/
+template <typename acc_t, int BLOCK_SIZE, bool PERSISTENT, typename XAccessor,
+          typename PAccessor>
+__device__ __forceinline__ void mutual_information_block(
+    XAccessor px, XAccessor py, PAccessor p,
+    torch::PackedTensorAccessor32<int64_t, 2> boundary,
+    torch::PackedTensorAccessor32<acc_t, 1> ans, bool modified, int b,
+    int block, int iter, int num_s_blocks, int num_t_blocks,
+    int *block_done) {
+  const int t_offset = (modified ? -1 : 0);  // see CPU code to understand.
+
+  // For the block with s_block_begin == 0 and t_block_begin == 0 (for
+  // easy illustration), px_buf[s][t] will contain px[s - 1][t + t_offset]; or
+  // -infinity. for out-of-range indexes into px. Likewise, py_buf[s][t] will
+  // contain (py[s][t - 1]).
+  __shared__ acc_t px_buf[BLOCK_SIZE][BLOCK_SIZE],
+      py_buf[BLOCK_SIZE][BLOCK_SIZE];
+
+  // p_buf[s][t] == p[s+s_block_begin-1][t+t_block_begin-1]
+  // 1st row/col of p_buf correspond to the previously computed blocks (lower
+  // `iter`), or to negative indexes into p.  So, for the origin block,
+  // p_buf[s][t] corresponds to p[s - 1][t - 1]; or -inf for
+  // out-of-range values.
+  __shared__ acc_t p_buf[BLOCK_SIZE + 1][BLOCK_SIZE + 1];
+
+  // boundary_buf will be used to store the b'th row of `boundary`.
+  __shared__ int64_t boundary_buf[4];
+
+  // Note: `block` can be no greater than `iter` because num_blocks_this_iter
+  // <= iter + 1, i.e. iter >= num_blocks_this_iter - 1; and
+  // block < num_blocks_this_iter, so iter - block >= 0.
+  int s_block_begin = block * BLOCK_SIZE,
+      t_block_begin = (iter - block) * BLOCK_SIZE;
+  bool is_origin_block = (s_block_begin + t_block_begin == 0);
+
+  __syncthreads();
+
+  if (threadIdx.x < 4) boundary_buf[threadIdx.x] = boundary[b][threadIdx.x];
+
+  __syncthreads();
+
+  int s_begin = boundary_buf[0], t_begin = boundary_buf[1],
+      s_end = boundary_buf[2], t_end = boundary_buf[3];
+
+  s_block_begin += s_begin;
+  t_block_begin += t_begin;
+
+  // block_S and block_T are the actual sizes of this block (the block of `p`
+  // that we will write), no greater than (BLOCK_SIZE, BLOCK_SIZE) but
+  // possibly less than that if we are towards the end of the sequence.  The
+  // last element in the output matrix p that we need to write is (s_end,
+  // t_end), i.e. the one-past-the-end index is (s_end + 1, t_end + 1).
+  int block_S = min(BLOCK_SIZE, s_end + 1 - s_block_begin),
+      block_T = min(BLOCK_SIZE, t_end + 1 - t_block_begin);
+
+  if (block_S <= 0 || block_T <= 0) return;
+
+  // Load px_buf and py_buf.
+  for (int i = threadIdx.x; i < BLOCK_SIZE * BLOCK_SIZE; i += blockDim.x) {
+    int s_in_block = i / BLOCK_SIZE, t_in_block = i % BLOCK_SIZE,
+        s = s_in_block + s_block_begin, t = t_in_block + t_block_begin,
+        t_off = t + t_offset;
+    // comparing as unsigned int makes sure the index is nonnegative.
+    // Caution: if s_begin > 0 or t_begin > 0 we may end up loading some px
+    // and py values that are outside the proper boundaries that we need, but
+    // the corresponding p_buf values will end up being 0 so this won't
+    // matter.
+    acc_t this_px = -INFINITY;
+    // Below, "&& t <= t_end" can be interpreted as:
+    //  "&& (modified ? t_off < t_end : t_off <= t_end)
+    // [since px's last valid index is t_end - 1 if modified, else t_end.
+    if (s > s_begin && s <= s_end && t_off >= t_begin && t <= t_end)
+      this_px = px(b, s - 1, t_off);
+
+    px_buf[s_in_block][t_in_block] = this_px;
+
+    acc_t this_py = -INFINITY;
+    if (t > t_begin && t <= t_end && s <= s_end) this_py = py(b, s, t - 1);
+    py_buf[s_in_block][t_in_block] = this_py;
+  }
+
+  if (PERSISTENT) {
+    // Wait until the blocks to the left of and below this one, which
+    // contain the context we load into the 1st row and column of p_buf, have
+    // been written by other thread-blocks.
+    if (threadIdx.x == 0) {
+      int *done = block_done + (b * num_s_blocks + block) * num_t_blocks +
+                  (iter - block);
+      if (block > 0)
+        while (atomicAdd(done - num_t_blocks, 0) == 0) {
+        }
+      if (iter - block > 0)
+        while (atomicAdd(done - 1, 0) == 0) {
+        }
+      __threadfence();
+    }
+    __syncthreads();
+  }
+
+  // Load the 1st row and 1st column of p_buf.
+  // This is the context from previously computed blocks of the
+  // image.  Remember: p_buf[s][t] will correspond to p[s + s_block_begin -
+  // 1][t + t_block_begin - 1]
+  if (threadIdx.x <= BLOCK_SIZE) {
+    // s_in_p_buf and t_in_pbuf are simply the indexes into p_buf
+    int s_in_p_buf = threadIdx.x, t_in_p_buf = 0,
+        s = s_in_p_buf + s_block_begin - 1,
+        t = t_in_p_buf + t_block_begin - 1;
+
+    acc_t this_p = -INFINITY;
+    if (s >= s_begin && s <= s_end && t >= t_begin && t <= t_end)
+      // (__ldcg() bypasses the L1 cache, which might hold stale values if p
+      // was written by another thread-block.)
+      this_p = PERSISTENT ? __ldcg(&p(b, s, t)) : p(b, s, t);
+    p_buf[s_in_p_buf][t_in_p_buf] = this_p;
+  } else if (static_cast<unsigned int>(static_cast<int>(threadIdx.x) - 64) <=
+             static_cast<unsigned int>(BLOCK_SIZE)) {
+    // Another warp handles the other leg.  Checking as unsigned
+    // tests that threadIdx.x - 64 is both >= 0 and <= BLOCK_SIZE
+    int s_in_p_buf = 0, t_in_p_buf = static_cast<int>(threadIdx.x) - 64,
+        s = s_in_p_buf + s_block_begin - 1,
+        t = t_in_p_buf + t_block_begin - 1;
+
+    acc_t this_p = -INFINITY;
+    if (s >= s_begin && s <= s_end && t >= t_begin && t <= t_end)
+      // (__ldcg() bypasses the L1 cache, which might hold stale values if p
+      // was written by another thread-block.)
+      this_p = PERSISTENT ? __ldcg(&p(b, s, t)) : p(b, s, t);
+    p_buf[s_in_p_buf][t_in_p_buf] = this_p;
+  }
+
+  __syncthreads();
+
+  // from here to the next __syncthreads(), only the 1st warp should be active
+  // so we shouldn't need to synchronize.  (implicit within-warp
+  // synchronization).
+
+  if (threadIdx.x == 0) {
+    // This if-statement is an optimization and modification of the loop below
+    // for the value i == 0, i.e. inner-iteration == 0.  The modification is
+    // to set p_buf to 1.0 = exp(0.0) if this is the "origin block",
+    // i.e. s == s_begin, t == t_begin.  This corresponds to the
+    // probability of the pair of sequences of length (0, 0).
+    p_buf[1][1] =
+        (is_origin_block ? 0.0
+                         : LogAdd<acc_t>()(
+                               // px_buf has t_offset applied.
+                               p_buf[0][1 + t_offset] + px_buf[0][0],
+                               p_buf[1][0] + py_buf[0][0]));
+  }
+
+  int s = threadIdx.x;
+  for (int i = 1; i < block_S + block_T - 1; ++i) {
+    __syncwarp();
+    // i is the inner iteration, which corresponds to the (s + t) indexes of
+    // the elements within the block that we write.  So i == 0 writes
+    // positions (s, t) == (0, 0) (but we treated i == 0 as a special case
+    // above); i == 1 writes (0, 1) and (1, 0); i == 2 writes (0, 2), (1, 1)
+    // and (2, 1); and so on.  Note: not many threads participate in this
+    // part, only up to BLOCK_SIZE at most.  Unfortunately we couldn't figure
+    // out a very meaningful way for more threads to do work, that looked like
+    // it would really spead things up.
+    // So this kernel does (2 * BLOCK_SIZE) iterations, which may seem a lot,
+    // but we do at least do the I/O in an efficient way and keep the
+    // inner loop simple and fast (e.g. no exp() or log()).
+    int t = i - s;
+    if (s < block_S &&
+        static_cast<unsigned int>(t) < static_cast<unsigned int>(block_T)) {
+      // p_buf is indexed by s + 1 and t + 1 because it has an extra initial
+      // row and column for context from previous blocks.  Taking into account
+      // the way these buffers relate to the tensors p, px and py,
+      // can be interpreted as follows,
+      // writing sbb for s_block_begin and tbb for t_block_begin:
+      //
+      //   p[b][s+sbb][t+tbb] = LogAdd(p[b][s+sbb-1][t+tbb] +
+      //   px[s+sbb-1][t+tbb],
+      //                               p[b][s+sbb][t+tbb-1] +
+      //                               py[s+sbb][t+tbb-1]
+      //
+      // where you can see that apart from the offsets of tbb and sbb, this is
+      // the same as the recursion defined for p in
+      // mutual_information.py:mutual_information_recursion(); and (eq. 0)
+      // above.
+
+      // note: px_buf has t_offset applied..
+      p_buf[s + 1][t + 1] =
+          LogAdd<acc_t>()(p_buf[s][t + 1 + t_offset] + px_buf[s][t],
+                             p_buf[s + 1][t] + py_buf[s][t]);
+      // We don't need to do __syncthreads() in this loop because all the
+      // threads that are active are in the same warp.  (However, in future,
+      // if NVidia changes some things, we might need to sync here).
+    }
+  }
+  __syncthreads();
+
+  // Write out the data to p;
+  for (int i = threadIdx.x; i < BLOCK_SIZE * BLOCK_SIZE; i += blockDim.x) {
+    int s_in_block = i / BLOCK_SIZE, t_in_block = i % BLOCK_SIZE,
+        s = s_in_block + s_block_begin, t = t_in_block + t_block_begin;
+    if (s_in_block < block_S && t_in_block < block_T) {
+      acc_t this_p = p_buf[s_in_block + 1][t_in_block + 1];
+      p(b, s, t) = this_p;
+    }
+  }
+
+  // Make this block of p visible to other thread-blocks before marking it
+  // as done.
+  if (PERSISTENT) __threadfence();
+
+  __syncthreads();
+
+  if (PERSISTENT && threadIdx.x == 0)
+    atomicExch(block_done + (b * num_s_blocks + block) * num_t_blocks +
+                   (iter - block),
+               1);
+
+  if (threadIdx.x == 0) {
+    // Write `ans`, if this is the final (top-right) block in its sequence
+    // Logically, the following equation corresponds to:
+    //   ans[b] = p[b][s_end][t_end]
+    if (s_block_begin + block_S - 1 == s_end &&
+        t_block_begin + block_T - 1 == t_end) {
+      // you could read block_S below as block_S - 1 + 1, meaning,
+      // it's the last index in a block of size block_S, but the indexes into
+      // p_buf have a "+ 1".  Likewise for block_T.
+      ans[b] = p_buf[block_S][block_T];
+    }
+  }
+}
+
 /*
   Forward of mutual_information.  Each thread block computes blocks of the 'p'
   array of (s, t) shape equal to (BLOCK_SIZE, BLOCK_SIZE), e.g. (32, 32).
@@ -36,11 +279,17 @@ namespace k2 {
   that each group handles are arranged in a diagonal.
 
   Template args:
-      scalar_t: the floating-point type, e.g. float, double; maybe eventually
-                half, although I think we don't support LogAdd for half yet.
+      acc_t:    the type of p, ans and of the computation: float if px and py
+                are half or bfloat16, else the same as their type (see
+                MutualInformationAcc).
       BLOCK_SIZE: an integer power of two no greater than 32 (this limitation
                 is because we assume BLOCK_SIZE + 1 <= 64 in some data-loading
                 code).
+      XAccessor, PAccessor: MutualInformationPadded or MutualInformationPacked
+                of the type of px and py, and of acc_t, respectively.  The
+                shapes below are those of the padded case; in the packed
+                case, the b'th sequence has S == boundary[b][2] and
+                T == boundary[b][3].
   Args:
       px:    Tensor of shape [B][S][T + 1], if !modified; [B][S][T] if modified;
              may be interpreted as the log-odds ratio of
@@ -75,6 +324,9 @@ namespace k2 {
               x and y sequences that we should process.  Otherwise, must be
               a tensor of shape [0][0] of type int64_t; the values will
               default to (0, 0, S, T).
+     B, S, T, modified: the batch size, the (maximum) lengths of the x and y
+            sequences, and whether px is of shape [B][S][T] rather than
+            [B][S][T + 1].
      ans: a tensor `ans` of shape [B], where this function will set
             ans[b] = p[b][s_end][t_end],
             with s_end and t_end being (S, T) if `boundary` was specified,
@@ -86,26 +338,23 @@ namespace k2 {
    The block-dim and grid-dim must both be 1-dimensional, and the block-dim must
    be at least 128.
 */
-template <typename scalar_t,
-          int BLOCK_SIZE>  // e.g. BLOCK_SIZE == 16 or 32.
+template <typename acc_t, int BLOCK_SIZE,  // e.g. BLOCK_SIZE == 16 or 32.
+          typename XAccessor, typename PAccessor>
 __global__ void mutual_information_kernel(
     // B, S, T + 1, i.e. batch, x_seq_length, y_seq_length + 1
-    torch::PackedTensorAccessor32<scalar_t, 3> px,
-    torch::PackedTensorAccessor32<scalar_t, 3> py,  // B, S + 1, T.
+    XAccessor px,
+    XAccessor py,  // B, S + 1, T.
     // B, S + 1, T + 1.  This is an output.
-    torch::PackedTensorAccessor32<scalar_t, 3> p,
+    PAccessor p,
     // B, 4;  or 0, 0 if boundaries are the defaults (0, 0, S, T)
     torch::PackedTensorAccessor32<int64_t, 2> boundary,
-    torch::PackedTensorAccessor32<scalar_t, 1> ans,  // [B]
+    torch::PackedTensorAccessor32<acc_t, 1> ans,  // [B]
+    int B, int S, int T, bool modified,
     int iter) {  // This kernel is sequentially called with 'iter' = 0, 1, 2 and
                  // so on, up to num_iters - 1 where num_iters = num_s_blocks +
                  // num_t_blocks - 1 num_s_blocks = S / BLOCK_SIZE + 1
                  // num_t_blocks = T / BLOCK_SIZE + 1
                  // so that each group depends on the previous group...
-  const int B = px.size(0), S = px.size(1), T = py.size(2);
-  const bool modified = (px.size(2) == T);
-  const int t_offset = (modified ? -1 : 0);  // see CPU code to understand.
-
   // num_s_blocks and num_t_blocks are the number of blocks we need to cover the
   // array of size (S, T) with blocks of this size, in the s and t directions
   // respectively.
@@ -125,34 +374,9 @@ __global__ void mutual_information_kernel(
   // `num_s_blocks` blocks (We'll never have more than num_t_blocks either, but
   // the numbering we use corresponds to s and not t, so when we hit the
   // num_t_blocks limit, the blocks with the lowest s indexes would just not be
-  // active and we'll 'continue' in the loop below).
+  // active and mutual_information_block() returns early for them).
   int num_blocks_this_iter = min(iter + 1, num_s_blocks);
 
-  // For the block with s_block_begin == 0 and t_block_begin == 0 (for
-  // easy illustration), px_buf[s][t] will contain px[s - 1][t + t_offset]; or
-  // -infinity. for out-of-range indexes into px. Likewise, py_buf[s][t] will
-  // contain (py[s][t - 1]).
-  __shared__ scalar_t px_buf[BLOCK_SIZE][BLOCK_SIZE],
-      py_buf[BLOCK_SIZE][BLOCK_SIZE];
-
-  // p_buf[s][t] == p[s+s_block_begin-1][t+t_block_begin-1]
-  // 1st row/col of p_buf correspond to the previously computed blocks (lower
-  // `iter`), or to negative indexes into p.  So, for the origin block,
-  // p_buf[s][t] corresponds to p[s - 1][t - 1]; or -inf for
-  // out-of-range values.
-  __shared__ scalar_t p_buf[BLOCK_SIZE + 1][BLOCK_SIZE + 1];
-
-  // boundary_buf will be used to store the b'th row of `boundary` if we have
-  // boundary information supplied; or (0, 0, S, T) otherwise.
-  __shared__ int64_t boundary_buf[4];
-
-  if (threadIdx.x == 0) {
-    boundary_buf[0] = 0;
-    boundary_buf[1] = 0;
-    boundary_buf[2] = S;
-    boundary_buf[3] = T;
-  }
-
   // batch_block_iter iterates over batch elements (index b) and block
   // indexes in the range [0..num_blocks_this_iter-1], combining both
   // batch and block indexes.
@@ -161,176 +385,55 @@ __global__ void mutual_information_kernel(
        batch_block_iter += gridDim.x) {
     int block = batch_block_iter / B,
         b = batch_block_iter % B;  // b is the index into the batch
+    mutual_information_block<acc_t, BLOCK_SIZE, false>(
+        px, py, p, boundary, ans, modified, b, block, iter, num_s_blocks, 0,
+        nullptr);
+  }
+}
 
-    // Note: `block` can be no greater than `iter` because num_blocks_this_iter
-    // <= iter + 1, i.e. iter >= num_blocks_this_iter - 1; and
-    // block < num_blocks_this_iter, so iter - block >= 0.
-    int s_block_begin = block * BLOCK_SIZE,
-        t_block_begin = (iter - block) * BLOCK_SIZE;
-    bool is_origin_block = (s_block_begin + t_block_begin == 0);
-
-    __syncthreads();
-
-    if (threadIdx.x < 4) boundary_buf[threadIdx.x] = boundary[b][threadIdx.x];
-
-    __syncthreads();
-
-    int s_begin = boundary_buf[0], t_begin = boundary_buf[1],
-        s_end = boundary_buf[2], t_end = boundary_buf[3];
-
-    s_block_begin += s_begin;
-    t_block_begin += t_begin;
-
-    // block_S and block_T are the actual sizes of this block (the block of `p`
-    // that we will write), no greater than (BLOCK_SIZE, BLOCK_SIZE) but
-    // possibly less than that if we are towards the end of the sequence.  The
-    // last element in the output matrix p that we need to write is (s_end,
-    // t_end), i.e. the one-past-the-end index is (s_end + 1, t_end + 1).
-    int block_S = min(BLOCK_SIZE, s_end + 1 - s_block_begin),
-        block_T = min(BLOCK_SIZE, t_end + 1 - t_block_begin);
-
-    if (block_S <= 0 || block_T <= 0) continue;
-
-    // Load px_buf and py_buf.
-    for (int i = threadIdx.x; i < BLOCK_SIZE * BLOCK_SIZE; i += blockDim.x) {
-      int s_in_block = i / BLOCK_SIZE, t_in_block = i % BLOCK_SIZE,
-          s = s_in_block + s_block_begin, t = t_in_block + t_block_begin,
-          t_off = t + t_offset;
-      // comparing as unsigned int makes sure the index is nonnegative.
-      // Caution: if s_begin > 0 or t_begin > 0 we may end up loading some px
-      // and py values that are outside the proper boundaries that we need, but
-      // the corresponding p_buf values will end up being 0 so this won't
-      // matter.
-      scalar_t this_px = -INFINITY;
-      // Below, "&& t <= t_end" can be interpreted as:
-      //  "&& (modified ? t_off < t_end : t_off <= t_end)
-      // [since px's last valid index is t_end - 1 if modified, else t_end.
-      if (s > s_begin && s <= s_end && t_off >= t_begin && t <= t_end)
-        this_px = px[b][s - 1][t_off];
-
-      px_buf[s_in_block][t_in_block] = this_px;
-
-      scalar_t this_py = -INFINITY;
-      if (t > t_begin && t <= t_end && s <= s_end) this_py = py[b][s][t - 1];
-      py_buf[s_in_block][t_in_block] = this_py;
-    }
-
-    // Load the 1st row and 1st column of p_buf.
-    // This is the context from previously computed blocks of the
-    // image.  Remember: p_buf[s][t] will correspond to p[s + s_block_begin -
-    // 1][t + t_block_begin - 1]
-    if (threadIdx.x <= BLOCK_SIZE) {
-      // s_in_p_buf and t_in_pbuf are simply the indexes into p_buf
-      int s_in_p_buf = threadIdx.x, t_in_p_buf = 0,
-          s = s_in_p_buf + s_block_begin - 1,
-          t = t_in_p_buf + t_block_begin - 1;
-
-      scalar_t this_p = -INFINITY;
-      if (s >= s_begin && s <= s_end && t >= t_begin && t <= t_end)
-        this_p = p[b][s][t];
-      p_buf[s_in_p_buf][t_in_p_buf] = this_p;
-    } else if (static_cast<unsigned int>(static_cast<int>(threadIdx.x) - 64) <=
-               static_cast<unsigned int>(BLOCK_SIZE)) {
-      // Another warp handles the other leg.  Checking as unsigned
-      // tests that threadIdx.x - 64 is both >= 0 and <= BLOCK_SIZE
-      int s_in_p_buf = 0, t_in_p_buf = static_cast<int>(threadIdx.x) - 64,
-          s = s_in_p_buf + s_block_begin - 1,
-          t = t_in_p_buf + t_block_begin - 1;
-
-      scalar_t this_p = -INFINITY;
-      if (s >= s_begin && s <= s_end && t >= t_begin && t <= t_end)
-        this_p = p[b][s][t];
-      p_buf[s_in_p_buf][t_in_p_buf] = this_p;
-    }
-
-    __syncthreads();
-
-    // from here to the next __syncthreads(), only the 1st warp should be active
-    // so we shouldn't need to synchronize.  (implicit within-warp
-    // synchronization).
-
-    if (threadIdx.x == 0) {
-      // This if-statement is an optimization and modification of the loop below
-      // for the value i == 0, i.e. inner-iteration == 0.  The modification is
-      // to set p_buf to 1.0 = exp(0.0) if this is the "origin block",
-      // i.e. s == s_begin, t == t_begin.  This corresponds to the
-      // probability of the pair of sequences of length (0, 0).
-      p_buf[1][1] =
-          (is_origin_block ? 0.0
-                           : LogAdd<scalar_t>()(
-                                 // px_buf has t_offset applied.
-                                 p_buf[0][1 + t_offset] + px_buf[0][0],
-                                 p_buf[1][0] + py_buf[0][0]));
-    }
-
-    int s = threadIdx.x;
-    for (int i = 1; i < block_S + block_T - 1; ++i) {
-      __syncwarp();
-      // i is the inner iteration, which corresponds to the (s + t) indexes of
-      // the elements within the block that we write.  So i == 0 writes
-      // positions (s, t) == (0, 0) (but we treated i == 0 as a special case
-      // above); i == 1 writes (0, 1) and (1, 0); i == 2 writes (0, 2), (1, 1)
-      // and (2, 1); and so on.  Note: not many threads participate in this
-      // part, only up to BLOCK_SIZE at most.  Unfortunately we couldn't figure
-      // out a very meaningful way for more threads to do work, that looked like
-      // it would really spead things up.
-      // So this kernel does (2 * BLOCK_SIZE) iterations, which may seem a lot,
-      // but we do at least do the I/O in an efficient way and keep the
-      // inner loop simple and fast (e.g. no exp() or log()).
-      int t = i - s;
-      if (s < block_S &&
-          static_cast<unsigned int>(t) < static_cast<unsigned int>(block_T)) {
-        // p_buf is indexed by s + 1 and t + 1 because it has an extra initial
-        // row and column for context from previous blocks.  Taking into account
-        // the way these buffers relate to the tensors p, px and py,
-        // can be interpreted as follows,
-        // writing sbb for s_block_begin and tbb for t_block_begin:
-        //
-        //   p[b][s+sbb][t+tbb] = LogAdd(p[b][s+sbb-1][t+tbb] +
-        //   px[s+sbb-1][t+tbb],
-        //                               p[b][s+sbb][t+tbb-1] +
-        //                               py[s+sbb][t+tbb-1]
-        //
-        // where you can see that apart from the offsets of tbb and sbb, this is
-        // the same as the recursion defined for p in
-        // mutual_information.py:mutual_information_recursion(); and (eq. 0)
-        // above.
-
-        // note: px_buf has t_offset applied..
-        p_buf[s + 1][t + 1] =
-            LogAdd<scalar_t>()(p_buf[s][t + 1 + t_offset] + px_buf[s][t],
-                               p_buf[s + 1][t] + py_buf[s][t]);
-        // We don't need to do __syncthreads() in this loop because all the
-        // threads that are active are in the same warp.  (However, in future,
-        // if NVidia changes some things, we might need to sync here).
-      }
-    }
-    __syncthreads();
-
-    // Write out the data to p;
-    for (int i = threadIdx.x; i < BLOCK_SIZE * BLOCK_SIZE; i += blockDim.x) {
-      int s_in_block = i / BLOCK_SIZE, t_in_block = i % BLOCK_SIZE,
-          s = s_in_block + s_block_begin, t = t_in_block + t_block_begin;
-      if (s_in_block < block_S && t_in_block < block_T) {
-        scalar_t this_p = p_buf[s_in_block + 1][t_in_block + 1];
-        p[b][s][t] = this_p;
-      }
-    }
-
+/*
+  A version of mutual_information_kernel() that is launched only once instead
+  of once per `iter`.  Its thread-blocks are persistent: they repeatedly take
+  the next block of `p` from a work counter, in the order of `iter` (and then
+  of block and batch element), and wait for the blocks it depends on using
+  flags in global memory.  Because the work is handed out in the order of the
+  dependencies, every block being waited for has been taken by a running
+  thread-block, so this cannot deadlock however many thread-blocks are
+  resident.
+
+   block_done: zero-initialized, of size [B][num_s_blocks][num_t_blocks].
+               Used for the flags.
+   next_work:  a zero-initialized counter.
+  See mutual_information_kernel() for the other args.
+*/
+template <typename acc_t, int BLOCK_SIZE, typename XAccessor,
+          typename PAccessor>
+__global__ void mutual_information_persistent_kernel(
+    XAccessor px, XAccessor py, PAccessor p,
+    torch::PackedTensorAccessor32<int64_t, 2> boundary,
+    torch::PackedTensorAccessor32<acc_t, 1> ans, int B, int S, int T,
+    bool modified, int *block_done, int *next_work) {
+  const int num_s_blocks = S / BLOCK_SIZE + 1,
+            num_t_blocks = T / BLOCK_SIZE + 1,
+            num_iters = num_s_blocks + num_t_blocks - 1;
+  // Each iteration has num_s_blocks * B work items, some of which may be
+  // inactive (see num_blocks_this_iter in mutual_information_kernel()).
+  const int items_per_iter = num_s_blocks * B,
+            num_items = num_iters * items_per_iter;
+
+  __shared__ int item_buf;
+  while (true) {
+    __syncthreads();  // item_buf may still be in use from the last item.
+    if (threadIdx.x == 0) item_buf = atomicAdd(next_work, 1);
     __syncthreads();
-
-    if (threadIdx.x == 0) {
-      // Write `ans`, if this is the final (top-right) block in its sequence
-      // Logically, the following equation corresponds to:
-      //   ans[b] = p[b][s_end][t_end]
-      if (s_block_begin + block_S - 1 == s_end &&
-          t_block_begin + block_T - 1 == t_end) {
-        // you could read block_S below as block_S - 1 + 1, meaning,
-        // it's the last index in a block of size block_S, but the indexes into
-        // p_buf have a "+ 1".  Likewise for block_T.
-        ans[b] = p_buf[block_S][block_T];
-      }
-    }
+    int item = item_buf;
+    if (item >= num_items) break;
+    int iter = item / items_per_iter, block = (item % items_per_iter) / B,
+        b = item % B;
+    if (block > iter) continue;
+    mutual_information_block<acc_t, BLOCK_SIZE, true>(
+        px, py, p, boundary, ans, modified, b, block, iter, num_s_blocks,
+        num_t_blocks, block_done);
   }
 }
 
@@ -398,21 +501,24 @@ __forceinline__ __device__ Real safe_exp(Real x) {
   of p_grad, we need context on the top and right instead of the bottom and
   left.  So there are offsets of 1.
  */
-template <typename scalar_t, int BLOCK_SIZE>
+template <typename acc_t, int BLOCK_SIZE, typename XAccessor,
+          typename PAccessor>
 __global__ void mutual_information_backward_kernel(
-    torch::PackedTensorAccessor32<scalar_t, 3>
-        px,  // B, S, T + 1 if !modified; B, S, T if modified.
-    torch::PackedTensorAccessor32<scalar_t, 3> py,  // B, S + 1, T.
+    XAccessor px,  // B, S, T + 1 if !modified; B, S, T if modified.
+    XAccessor py,  // B, S + 1, T.
     // B, S + 1, T + 1.  Produced in forward pass.
-    torch::PackedTensorAccessor32<scalar_t, 3> p,
+    PAccessor p,
     // [B].  This is an input.
-    torch::PackedTensorAccessor32<scalar_t, 1> ans_grad,
-    torch::PackedTensorAccessor32<scalar_t, 3>
-        p_grad,  // B, S + 1, T + 1 if !modified; B, S, T if modified.
-    torch::PackedTensorAccessor32<scalar_t, 3> px_grad,  // B, S, T + 1.
-    torch::PackedTensorAccessor32<scalar_t, 3> py_grad,  // B, S + 1, T.
+    torch::PackedTensorAccessor32<acc_t, 1> ans_grad,
+    // If not nullptr, the data of the end_row_grad of
+    // MutualInformationBackwardCuda(), with rows of end_row_grad_stride.
+    const acc_t *end_row_grad, int end_row_grad_stride,
+    PAccessor p_grad,  // B, S + 1, T + 1.
+    XAccessor px_grad,  // B, S, T + 1 if !modified; B, S, T if modified.
+    XAccessor py_grad,  // B, S + 1, T.
     // B, 4;  or 0, 0 if boundaries are the defaults (0, 0, S, T)
     torch::PackedTensorAccessor32<int64_t, 2> boundary,
+    int B, int S, int T, bool modified,
     int iter,  // This kernel is sequentially called with 'iter' = num_iters
                // - 1, num_iters - 2, .. 0, where num_iters can be taken to
                // be any sufficiently large number but will actually be:
@@ -423,8 +529,6 @@ __global__ void mutual_information_backward_kernel(
                                 // if everything is working correctly, should be
                                 // identical or very close to the value of
                                 // ans_grad that was passed in.
-  const int B = px.size(0), S = px.size(1), T = py.size(2);
-  const bool modified = (px.size(2) == T);
   const int neg_t_offset = (modified ? 1 : 0);
 
   // For statements that are the same as the forward pass, we are omitting some
@@ -448,7 +552,7 @@ __global__ void mutual_information_backward_kernel(
 
   // where ss == s + s_block_begin, tt = t + t_block_begin.
   // Unlike in the forward code, there is no offset of 1 in the indexes.
-  __shared__ scalar_t px_buf[BLOCK_SIZE][BLOCK_SIZE],
+  __shared__ acc_t px_buf[BLOCK_SIZE][BLOCK_SIZE],
       py_buf[BLOCK_SIZE][BLOCK_SIZE];
 
   // p_buf is initially used to store p, and then (after we are done putting
@@ -463,7 +567,7 @@ __global__ void mutual_information_backward_kernel(
   // (one past the largest indexes in the block).
   //
   // For out-of-range elements of p_buf, we'll put zero.
-  __shared__ scalar_t p_buf[BLOCK_SIZE + 1][BLOCK_SIZE + 1];
+  __shared__ acc_t p_buf[BLOCK_SIZE + 1][BLOCK_SIZE + 1];
 
   // boundary_buf will be used to store the b'th row of `boundary` if we have
   // boundary information supplied; or (0, 0, S, T) if not.
@@ -514,11 +618,11 @@ __global__ void mutual_information_backward_kernel(
       // will cause xderiv and yderiv for out-of-range values to be zero, and
       // cause correct behavior in edge cases (for the top and right blocks).
       // The issue is that p and p_grad are of larger size than px and py.
-      scalar_t this_px = -INFINITY;
-      if (s < s_end && t <= t_end) this_px = px[b][s][t];
+      acc_t this_px = -INFINITY;
+      if (s < s_end && t <= t_end) this_px = px(b, s, t);
       px_buf[s_in_block][t_in_block] = this_px;
-      scalar_t this_py = -INFINITY;
-      if (s <= s_end && t < t_end) this_py = py[b][s][t];
+      acc_t this_py = -INFINITY;
+      if (s <= s_end && t < t_end) this_py = py(b, s, t);
       py_buf[s_in_block][t_in_block] = this_py;
     }
     __syncthreads();
@@ -533,11 +637,10 @@ __global__ void mutual_information_backward_kernel(
       // ensure that we do the right thing in top and right edge cases,
       // i.e. that no derivatives will be propagated from out-of-bounds points
       // because the corresponding xderiv and yderiv values will be zero.
-      scalar_t this_p = 0.0;
-      if (s <= s_end && t <= t_end) this_p = p[b][s][t];
+      acc_t this_p = 0.0;
+      if (s <= s_end && t <= t_end) this_p = p(b, s, t);
       // if this_p is -inf, replace with large finite negative value, to avoid
-      // NaN's below.
-      // TODO: use a value that would work correctly in half precision
+      // NaN's below.  (p is never half precision, see acc_t).
       if (this_p < -1.0e+30) this_p = -1.0e+30;
       p_buf[s_in_block][t_in_block] = this_p;
     }
@@ -576,7 +679,7 @@ __global__ void mutual_information_backward_kernel(
       int s_in_block = threadIdx.x, t_in_block = block_T,
           s = s_in_block + s_block_begin, t = t_in_block + t_block_begin;
       p_buf[s_in_block][t_in_block] =
-          (s <= s_end && t <= t_end ? p_grad[b][s][t] : 0.0);
+          (s <= s_end && t <= t_end ? p_grad(b, s, t) : 0.0);
     } else if (static_cast<unsigned int>(static_cast<int>(threadIdx.x) - 64) <
                static_cast<unsigned int>(block_T)) {
       // casting to unsigned before the comparison tests for both negative and
@@ -584,7 +687,7 @@ __global__ void mutual_information_backward_kernel(
       int s_in_block = block_S, t_in_block = static_cast<int>(threadIdx.x) - 64,
           s = s_in_block + s_block_begin, t = t_in_block + t_block_begin;
       p_buf[s_in_block][t_in_block] =
-          (s <= s_end && t <= t_end ? p_grad[b][s][t] : 0.0);
+          (s <= s_end && t <= t_end ? p_grad(b, s, t) : 0.0);
     }
 
     __syncthreads();
@@ -604,7 +707,10 @@ __global__ void mutual_information_backward_kernel(
       // Normally this element of p_buf would be set by the first iteration of
       // the loop below, so if it's set this way we have to decrement first_iter
       // to prevent it from being overwritten.
-      p_buf[block_S - 1][block_T - 1] = ans_grad[b];
+      p_buf[block_S - 1][block_T - 1] =
+          ans_grad[b] + (end_row_grad != nullptr
+                             ? end_row_grad[b * end_row_grad_stride + t_end]
+                             : 0.0);
       --first_iter;
     }
 
@@ -621,8 +727,12 @@ __global__ void mutual_information_backward_kernel(
           //   p_grad[b,s,t]  =
           //      p_grad[b,s+1,t-t_offset] * term1(b,s,t)  +             (3a)
           //      p_grad[b,s,t+1] * term2(b,s,t)
-          p_buf[s][t] = (p_buf[s + 1][t + neg_t_offset] * px_buf[s][t] +
-                         p_buf[s][t + 1] * py_buf[s][t]);
+          acc_t grad = (p_buf[s + 1][t + neg_t_offset] * px_buf[s][t] +
+                        p_buf[s][t + 1] * py_buf[s][t]);
+          // Grad of the last row from beyond s_end, if any.
+          if (end_row_grad != nullptr && s + s_block_begin == s_end)
+            grad += end_row_grad[b * end_row_grad_stride + t + t_block_begin];
+          p_buf[s][t] = grad;
         }
       }
     }
@@ -636,7 +746,7 @@ __global__ void mutual_information_backward_kernel(
       // s_end and t_end are the one-past-the-end of the (x,y) sequences, but
       // the one-past-the-end element of p_grad would be (s_end + 1, t_end + 1).
       if (t <= t_end && s <= s_end) {
-        p_grad[b][s][t] = p_buf[s_in_block][t_in_block];
+        p_grad(b, s, t) = p_buf[s_in_block][t_in_block];
 
         if (s < s_end && t <= t_end - neg_t_offset) {
           // write px_grad, which is of shape [B][S][T + 1] if !modified,
@@ -646,13 +756,13 @@ __global__ void mutual_information_backward_kernel(
 
           // From (eq. 3b):
           // px_grad[b,s,t] = p_grad[b,s+1,t-t_offset] * term1(b,s,t)
-          px_grad[b][s][t] = (p_buf[s_in_block + 1][t_in_block + neg_t_offset] *
+          px_grad(b, s, t) = (p_buf[s_in_block + 1][t_in_block + neg_t_offset] *
                               px_buf[s_in_block][t_in_block]);
         }
         if (t < t_end) {  // write py_grad, which is of shape [B][S + 1][T]
           // from (eq. 3c):
           // py_grad[b,s,t] = p_grad[b,s,t+1] * term2(b,s,t)
-          py_grad[b][s][t] = (p_buf[s_in_block][t_in_block + 1] *
+          py_grad(b, s, t) = (p_buf[s_in_block][t_in_block + 1] *
                               py_buf[s_in_block][t_in_block]);
         }
       }
@@ -664,6 +774,86 @@ __global__ void mutual_information_backward_kernel(
   }
 }
 
+// Returns true if the forward pass is to use
+// mutual_information_persistent_kernel().  Setting the environment variable
+// K2_DISABLE_PERSISTENT_MUTUAL_INFORMATION makes it launch
+// mutual_information_kernel() once per iteration instead.
+static bool UsePersistentMutualInformation() {
+  static bool use_persistent =
+      (std::getenv("K2_DISABLE_PERSISTENT_MUTUAL_INFORMATION") == nullptr);
+  return use_persistent;
+}
+
+// Runs the forward pass, i.e. mutual_information_persistent_kernel() or
+// mutual_information_kernel() for all the iterations; see their
+// documentation for the arguments.
+template <typename acc_t, typename XAccessor, typename PAccessor>
+static void LaunchMutualInformationKernels(XAccessor px, XAccessor py,
+                                           PAccessor p, torch::Tensor boundary,
+                                           torch::Tensor ans, int B, int S,
+                                           int T, bool modified) {
+  // num_threads and num_blocks and BLOCK_SIZE can be tuned.
+  // (however, num_threads may not be less than 128).
+  const int num_threads = 128, num_blocks = 256, BLOCK_SIZE = 32;
+
+  // The blocks cover the 'p' matrix, which is of size (B, S+1, T+1),
+  // so dividing by BLOCK_SIZE rounding up we get e.g.
+  // (S+1 + BLOCK_SIZE-1) / BLOCK_SIZE == S / BLOCK_SIZE + 1
+  const int num_s_blocks = S / BLOCK_SIZE + 1,
+            num_t_blocks = T / BLOCK_SIZE + 1,
+            num_iters = num_s_blocks + num_t_blocks - 1;
+
+  if (num_iters > 1 && UsePersistentMutualInformation()) {
+    // The flags for the blocks, followed by the work counter.
+    int num_flags = B * num_s_blocks * num_t_blocks;
+    torch::Tensor flags = torch::zeros(
+        {num_flags + 1}, boundary.options().dtype(torch::kInt32));
+    int *block_done = flags.data_ptr<int32_t>();
+    mutual_information_persistent_kernel<acc_t, BLOCK_SIZE>
+        <<<num_blocks, num_threads>>>(
+            px, py, p, boundary.packed_accessor32<int64_t, 2>(),
+            ans.packed_accessor32<acc_t, 1>(), B, S, T, modified, block_done,
+            block_done + num_flags);
+    return;
+  }
+
+  for (int iter = 0; iter < num_iters; ++iter) {
+    mutual_information_kernel<acc_t, BLOCK_SIZE>
+        <<<num_blocks, num_threads>>>(
+            px, py, p, boundary.packed_accessor32<int64_t, 2>(),
+            ans.packed_accessor32<acc_t, 1>(), B, S, T, modified, iter);
+  }
+}
+
+// Runs mutual_information_backward_kernel for all the iterations; see its
+// documentation for the arguments.
+template <typename acc_t, typename XAccessor, typename PAccessor>
+static void LaunchMutualInformationBackwardKernels(
+    XAccessor px, XAccessor py, PAccessor p, torch::Tensor ans_grad,
+    const acc_t *end_row_grad, PAccessor p_grad, XAccessor px_grad,
+    XAccessor py_grad, torch::Tensor boundary, int B, int S, int T,
+    bool modified, bool overwrite_ans_grad) {
+  // num_threads and num_blocks and BLOCK_SIZE can be tuned.
+  // (however, num_threads may not be less than 128).
+  const int num_threads = 128, num_blocks = 256, BLOCK_SIZE = 32;
+
+  // The blocks cover the 'p' matrix, which is of size (B, S+1, T+1),
+  // so dividing by BLOCK_SIZE rounding up we get e.g.
+  // (S+1 + BLOCK_SIZE-1) / BLOCK_SIZE == S / BLOCK_SIZE + 1
+  const int num_s_blocks = S / BLOCK_SIZE + 1,
+            num_t_blocks = T / BLOCK_SIZE + 1,
+            num_iters = num_s_blocks + num_t_blocks - 1;
+
+  for (int iter = num_iters - 1; iter >= 0; --iter) {
+    mutual_information_backward_kernel<acc_t, BLOCK_SIZE>
+        <<<num_blocks, num_threads>>>(
+            px, py, p, ans_grad.packed_accessor32<acc_t, 1>(), end_row_grad,
+            T + 1, p_grad, px_grad, py_grad,
+            boundary.packed_accessor32<int64_t, 2>(), B, S, T, modified, iter,
+            overwrite_ans_grad);
+  }
+}
+
 // forward of mutual_information.  See """... """ comment of
 // `mutual_information` in mutual_information.py for documentation of the
 // behavior of this function.
@@ -677,8 +867,10 @@ torch::Tensor MutualInformationCuda(torch::Tensor px, torch::Tensor py,
       px.device().is_cuda() && py.device().is_cuda() && p.device().is_cuda(),
       "inputs must be CUDA tensors");
 
-  auto scalar_t = px.scalar_type();
-  auto opts = torch::TensorOptions().dtype(scalar_t).device(px.device());
+  auto acc_type = MutualInformationAccType(px.scalar_type());
+  auto acc_opts = torch::TensorOptions().dtype(acc_type).device(px.device());
+  TORCH_CHECK(py.scalar_type() == px.scalar_type() &&
+              p.scalar_type() == acc_type);
 
   const int B = px.size(0), S = px.size(1), T = py.size(2);
   TORCH_CHECK(px.size(2) == T || px.size(2) == T + 1);
@@ -693,30 +885,18 @@ torch::Tensor MutualInformationCuda(torch::Tensor px, torch::Tensor py,
   TORCH_CHECK(boundary.size(0) == B && boundary.size(1) == 4);
   TORCH_CHECK(boundary.device().is_cuda() && boundary.dtype() == torch::kInt64);
 
-  torch::Tensor ans = torch::empty({B}, opts);
-
-  // num_threads and num_blocks and BLOCK_SIZE can be tuned.
-  // (however, num_threads may not be less than 128).
-  const int num_threads = 128, num_blocks = 256, BLOCK_SIZE = 32;
-
-  // The blocks cover the 'p' matrix, which is of size (B, S+1, T+1),
-  // so dividing by BLOCK_SIZE rounding up we get e.g.
-  // (S+1 + BLOCK_SIZE-1) / BLOCK_SIZE == S / BLOCK_SIZE + 1
-  const int num_s_blocks = S / BLOCK_SIZE + 1,
-            num_t_blocks = T / BLOCK_SIZE + 1,
-            num_iters = num_s_blocks + num_t_blocks - 1;
+  torch::Tensor ans = torch::empty({B}, acc_opts);
+  const bool modified = (px.size(2) == T);
 
-  AT_DISPATCH_FLOATING_TYPES(
-      px.scalar_type(), "mutual_information_cuda_stub", ([&] {
-        for (int iter = 0; iter < num_iters; ++iter) {
-          mutual_information_kernel<scalar_t, BLOCK_SIZE>
-              <<<num_blocks, num_threads>>>(
-                  px.packed_accessor32<scalar_t, 3>(),
-                  py.packed_accessor32<scalar_t, 3>(),
-                  p.packed_accessor32<scalar_t, 3>(),
-                  boundary.packed_accessor32<int64_t, 2>(),
-                  ans.packed_accessor32<scalar_t, 1>(), iter);
-        }
+  AT_DISPATCH_FLOATING_TYPES_AND2(
+      at::ScalarType::Half, at::ScalarType::BFloat16, px.scalar_type(),
+      "mutual_information_cuda_stub", ([&] {
+        using acc_t = typename MutualInformationAcc<scalar_t>::Type;
+        LaunchMutualInformationKernels<acc_t>(
+            MutualInformationPadded<scalar_t>(px),
+            MutualInformationPadded<scalar_t>(py),
+            MutualInformationPadded<acc_t>(p), boundary, ans, B, S, T,
+            modified);
       }));
   return ans;
 }
@@ -728,7 +908,8 @@ torch::Tensor MutualInformationCuda(torch::Tensor px, torch::Tensor py,
 std::vector<torch::Tensor> MutualInformationBackwardCuda(
     torch::Tensor px, torch::Tensor py,
     torch::optional<torch::Tensor> opt_boundary, torch::Tensor p,
-    torch::Tensor ans_grad, bool overwrite_ans_grad) {
+    torch::Tensor ans_grad, torch::optional<torch::Tensor> end_row_grad,
+    bool overwrite_ans_grad) {
   TORCH_CHECK(px.dim() == 3, "px must be 3-dimensional");
   TORCH_CHECK(py.dim() == 3, "py must be 3-dimensional.");
   TORCH_CHECK(p.dim() == 3, "p must be 3-dimensional.");
@@ -738,8 +919,13 @@ std::vector<torch::Tensor> MutualInformationBackwardCuda(
               p.device().is_cuda() && ans_grad.device().is_cuda() &&
               "inputs must be CUDA tensors");
 
-  auto scalar_t = px.scalar_type();
-  auto opts = torch::TensorOptions().dtype(scalar_t).device(px.device());
+  auto opts =
+      torch::TensorOptions().dtype(px.scalar_type()).device(px.device());
+  auto acc_type = MutualInformationAccType(px.scalar_type());
+  auto acc_opts = torch::TensorOptions().dtype(acc_type).device(px.device());
+  TORCH_CHECK(py.scalar_type() == px.scalar_type() &&
+              p.scalar_type() == acc_type &&
+              ans_grad.scalar_type() == acc_type);
 
   const int B = px.size(0), S = px.size(1), T = py.size(2);
 
@@ -757,42 +943,136 @@ std::vector<torch::Tensor> MutualInformationBackwardCuda(
   TORCH_CHECK(boundary.size(0) == B && boundary.size(1) == 4);
   TORCH_CHECK(boundary.device().is_cuda() && boundary.dtype() == torch::kInt64);
   TORCH_CHECK(ans_grad.size(0) == B);
+  if (end_row_grad.has_value()) {
+    end_row_grad = end_row_grad->contiguous();
+    TORCH_CHECK(end_row_grad->dim() == 2 && end_row_grad->size(0) == B &&
+                    end_row_grad->size(1) == T + 1,
+                "end_row_grad must be of shape [B][T+1]");
+    TORCH_CHECK(end_row_grad->device() == px.device() &&
+                end_row_grad->scalar_type() == acc_type);
+  }
 
   bool has_boundary = opt_boundary.has_value();
 
   int T1 = T + (modified ? 0 : 1);
-  torch::Tensor p_grad = torch::empty({B, S + 1, T + 1}, opts),
+  torch::Tensor p_grad = torch::empty({B, S + 1, T + 1}, acc_opts),
                 px_grad = (has_boundary ? torch::zeros({B, S, T1}, opts)
                                         : torch::empty({B, S, T1}, opts)),
                 py_grad = (has_boundary ? torch::zeros({B, S + 1, T}, opts)
                                         : torch::empty({B, S + 1, T}, opts));
 
-  // num_threads and num_blocks and BLOCK_SIZE can be tuned.
-  // (however, num_threads may not be less than 128).
-  const int num_threads = 128, num_blocks = 256, BLOCK_SIZE = 32;
+  AT_DISPATCH_FLOATING_TYPES_AND2(
+      at::ScalarType::Half, at::ScalarType::BFloat16, px.scalar_type(),
+      "mutual_information_backward_stub", ([&] {
+        using acc_t = typename MutualInformationAcc<scalar_t>::Type;
+        LaunchMutualInformationBackwardKernels<acc_t>(
+            MutualInformationPadded<scalar_t>(px),
+            MutualInformationPadded<scalar_t>(py),
+            MutualInformationPadded<acc_t>(p), ans_grad,
+            end_row_grad.has_value() ? end_row_grad->data_ptr<acc_t>()
+                                     : nullptr,
+            MutualInformationPadded<acc_t>(p_grad),
+            MutualInformationPadded<scalar_t>(px_grad),
+            MutualInformationPadded<scalar_t>(py_grad), boundary, B, S, T,
+            modified, overwrite_ans_grad);
+      }));
+  return std::vector<torch::Tensor>({px_grad, py_grad});
+}
 
-  // The blocks cover the 'p' matrix, which is of size (B, S+1, T+1),
-  // so dividing by BLOCK_SIZE rounding up we get e.g.
-  // (S+1 + BLOCK_SIZE-1) / BLOCK_SIZE == S / BLOCK_SIZE + 1
-  const int num_s_blocks = S / BLOCK_SIZE + 1,
-            num_t_blocks = T / BLOCK_SIZE + 1,
-            num_iters = num_s_blocks + num_t_blocks - 1;
+std::vector<torch::Tensor> MutualInformationPackedCuda(torch::Tensor px,
+                                                       torch::Tensor py,
+                                                       torch::Tensor lengths,
+                                                       bool modified) {
+  TORCH_CHECK(px.dim() == 1, "px must be 1-dimensional");
+  TORCH_CHECK(py.dim() == 1, "py must be 1-dimensional.");
+  TORCH_CHECK(px.device().is_cuda() && py.device().is_cuda() &&
+                  lengths.device() == px.device(),
+              "inputs must be CUDA tensors on the same device");
+  TORCH_CHECK(py.scalar_type() == px.scalar_type());
+
+  // Note: this copies `lengths` to the CPU.
+  MutualInformationPackedLayout layout =
+      GetMutualInformationPackedLayout(lengths, modified);
+  TORCH_CHECK(px.numel() == layout.px_size && py.numel() == layout.py_size,
+              "The sizes of px and py do not match lengths");
+  px = px.contiguous();
+  py = py.contiguous();
+
+  const int B = lengths.size(0);
+  const int32_t px_extra = (modified ? 0 : 1);
+  auto acc_type = MutualInformationAccType(px.scalar_type());
+  auto acc_opts = torch::TensorOptions().dtype(acc_type).device(px.device());
+  torch::Tensor p = torch::empty({layout.p_size}, acc_opts),
+                ans = torch::empty({B}, acc_opts);
+
+  AT_DISPATCH_FLOATING_TYPES_AND2(
+      at::ScalarType::Half, at::ScalarType::BFloat16, px.scalar_type(),
+      "mutual_information_packed_cuda_stub", ([&] {
+        using acc_t = typename MutualInformationAcc<scalar_t>::Type;
+        LaunchMutualInformationKernels<acc_t>(
+            MutualInformationPacked<scalar_t>(px, layout.px_offsets,
+                                              layout.boundary, px_extra),
+            MutualInformationPacked<scalar_t>(py, layout.py_offsets,
+                                              layout.boundary, 0),
+            MutualInformationPacked<acc_t>(p, layout.p_offsets,
+                                           layout.boundary, 1),
+            layout.boundary, ans, B, layout.S, layout.T, modified);
+      }));
+  return std::vector<torch::Tensor>({ans, p});
+}
 
-  AT_DISPATCH_FLOATING_TYPES(
-      px.scalar_type(), "mutual_information_backward_stub", ([&] {
-        for (int iter = num_iters - 1; iter >= 0; --iter) {
-          mutual_information_backward_kernel<scalar_t, BLOCK_SIZE>
-              <<<num_blocks, num_threads>>>(
-                  px.packed_accessor32<scalar_t, 3>(),
-                  py.packed_accessor32<scalar_t, 3>(),
-                  p.packed_accessor32<scalar_t, 3>(),
-                  ans_grad.packed_accessor32<scalar_t, 1>(),
-                  p_grad.packed_accessor32<scalar_t, 3>(),
-                  px_grad.packed_accessor32<scalar_t, 3>(),
-                  py_grad.packed_accessor32<scalar_t, 3>(),
-                  boundary.packed_accessor32<int64_t, 2>(), iter,
-                  overwrite_ans_grad);
-        }
+std::vector<torch::Tensor> MutualInformationPackedBackwardCuda(
+    torch::Tensor px, torch::Tensor py, torch::Tensor lengths, bool modified,
+    torch::Tensor p, torch::Tensor ans_grad, bool overwrite_ans_grad) {
+  TORCH_CHECK(px.dim() == 1, "px must be 1-dimensional");
+  TORCH_CHECK(py.dim() == 1, "py must be 1-dimensional.");
+  TORCH_CHECK(p.dim() == 1, "p must be 1-dimensional.");
+  TORCH_CHECK(ans_grad.dim() == 1, "ans_grad must be 1-dimensional.");
+  TORCH_CHECK(px.device().is_cuda() && py.device().is_cuda() &&
+                  p.device().is_cuda() && ans_grad.device().is_cuda() &&
+                  lengths.device() == px.device(),
+              "inputs must be CUDA tensors on the same device");
+
+  auto opts =
+      torch::TensorOptions().dtype(px.scalar_type()).device(px.device());
+  auto acc_type = MutualInformationAccType(px.scalar_type());
+  auto acc_opts = torch::TensorOptions().dtype(acc_type).device(px.device());
+  TORCH_CHECK(py.scalar_type() == px.scalar_type() &&
+              p.scalar_type() == acc_type &&
+              ans_grad.scalar_type() == acc_type);
+
+  MutualInformationPackedLayout layout =
+      GetMutualInformationPackedLayout(lengths, modified);
+  const int B = lengths.size(0);
+  TORCH_CHECK(px.numel() == layout.px_size && py.numel() == layout.py_size &&
+                  p.numel() == layout.p_size,
+              "The sizes of px, py and p do not match lengths");
+  TORCH_CHECK(ans_grad.size(0) == B);
+  px = px.contiguous();
+  py = py.contiguous();
+  p = p.contiguous();
+
+  const int32_t px_extra = (modified ? 0 : 1);
+  torch::Tensor p_grad = torch::empty({layout.p_size}, acc_opts),
+                px_grad = torch::empty({layout.px_size}, opts),
+                py_grad = torch::empty({layout.py_size}, opts);
+
+  AT_DISPATCH_FLOATING_TYPES_AND2(
+      at::ScalarType::Half, at::ScalarType::BFloat16, px.scalar_type(),
+      "mutual_information_packed_backward_stub", ([&] {
+        using acc_t = typename MutualInformationAcc<scalar_t>::Type;
+        MutualInformationPacked<scalar_t> px_a(px, layout.px_offsets,
+                                               layout.boundary, px_extra),
+            py_a(py, layout.py_offsets, layout.boundary, 0),
+            px_grad_a(px_grad, layout.px_offsets, layout.boundary, px_extra),
+            py_grad_a(py_grad, layout.py_offsets, layout.boundary, 0);
+        MutualInformationPacked<acc_t> p_a(p, layout.p_offsets,
+                                           layout.boundary, 1),
+            p_grad_a(p_grad, layout.p_offsets, layout.boundary, 1);
+        LaunchMutualInformationBackwardKernels<acc_t>(
+            px_a, py_a, p_a, ans_grad, nullptr, p_grad_a, px_grad_a, py_grad_a,
+            layout.boundary, B, layout.S, layout.T, modified,
+            overwrite_ans_grad);
       }));
   return std::vector<torch::Tensor>({px_grad, py_grad});
 }
@@ -28,9 +28,11 @@
 
 #include "k2/csrc/device_guard.h"
 #include "k2/csrc/fsa.h"
+#include "k2/csrc/ragged_ops.h"
 #include "k2/csrc/rnnt_decode.h"
 #include "k2/csrc/torch_util.h"
 #include "k2/python/csrc/torch/rnnt_decode.h"
+#include "k2/python/csrc/torch/v2/ragged_any.h"
 
 namespace k2 {
 static void PybindRnntDecodingConfig(py::module &m) {
@@ -96,10 +98,16 @@ static void PybindRnntDecodingStream(py::module &m) {
        << "  num contexts : " << self.states.Dim0() << "\n"
        << "  num states : " << self.states.NumElements() << "\n"
        << "  num prev frames : " << self.prev_frames.size() << "\n"
+       << "  num dropped frames : " << self.num_dropped_frames << "\n"
        << "}";
     return os.str();
   });
 
+  stream.def("compact_prev_frames", [](PyClass &self, int32_t horizon) -> void {
+    DeviceGuard guard(self.graph->Context());
+    rnnt_decoding::CompactPrevFrames(horizon, &self);
+  });
+
   m.def("create_rnnt_decoding_stream",
         [](Fsa &graph) -> std::shared_ptr<PyClass> {
           DeviceGuard guard(graph.Context());
@@ -120,12 +128,38 @@ static void PybindRnntDecodingStreams(py::module &m) {
         return std::make_unique<PyClass>(srcs, config);
       }));
 
-  streams.def("advance", [](PyClass &self, torch::Tensor logprobs) -> void {
-    DeviceGuard guard(self.Context());
-    logprobs = logprobs.to(torch::kFloat);
-    Array2<float> logprobs_array = FromTorch<float>(logprobs, Array2Tag{});
-    self.Advance(logprobs_array);
-  });
+  // The long-running methods release the GIL (they don't touch Python
+  // objects), so that decoders in other Python threads can run meanwhile.  An
+  // RnntDecodingStreams object must not be used by two threads at once.
+  streams.def(
+      "advance",
+      [](PyClass &self, torch::Tensor logprobs) -> void {
+        DeviceGuard guard(self.Context());
+        logprobs = logprobs.to(torch::kFloat);
+        Array2<float> logprobs_array = FromTorch<float>(logprobs, Array2Tag{});
+        self.Advance(logprobs_array);
+      },
+      py::call_guard<py::gil_scoped_release>());
+
+  streams.def("advance_sparse",
+              [](PyClass &self, torch::Tensor symbols,
+                 torch::Tensor logprobs) -> void {
+                DeviceGuard guard(self.Context());
+                K2_CHECK_EQ(symbols.dim(), 2);
+                K2_CHECK(symbols.sizes() == logprobs.sizes());
+                int32_t num_contexts = symbols.size(0),
+                        num_candidates = symbols.size(1);
+                symbols = symbols.to(torch::kInt).contiguous().view({-1});
+                logprobs = logprobs.to(torch::kFloat).contiguous().view({-1});
+                RaggedShape shape = RegularRaggedShape(
+                    self.Context(), num_contexts, num_candidates);
+                Ragged<int32_t> symbols_ragged(shape,
+                                               FromTorch<int32_t>(symbols));
+                Ragged<float> logprobs_ragged(shape,
+                                              FromTorch<float>(logprobs));
+                self.Advance(symbols_ragged, logprobs_ragged);
+              },
+              py::call_guard<py::gil_scoped_release>());
 
   streams.def("get_contexts",
               [](PyClass &self) -> std::pair<RaggedShape, torch::Tensor> {
@@ -137,10 +171,37 @@ static void PybindRnntDecodingStreams(py::module &m) {
                 return std::make_pair(shape, contexts_tensor);
               });
 
-  streams.def("terminate_and_flush_to_streams", [](PyClass &self) -> void {
-    DeviceGuard guard(self.Context());
-    self.TerminateAndFlushToStreams();
-  });
+  streams.def("get_unique_contexts",
+              [](PyClass &self) -> std::pair<torch::Tensor, torch::Tensor> {
+                DeviceGuard guard(self.Context());
+                Array2<int32_t> unique_contexts;
+                Array1<int32_t> context_map;
+                self.GetUniqueContexts(&unique_contexts, &context_map);
+                return std::make_pair(ToTorch<int32_t>(unique_contexts),
+                                      ToTorch(context_map));
+              });
+
+  streams.def(
+      "set_lm_scores",
+      [](PyClass &self, torch::Tensor lm_scores, torch::Tensor context_map,
+         float lm_scale) -> void {
+        DeviceGuard guard(self.Context());
+        lm_scores = lm_scores.to(torch::kFloat);
+        Array2<float> lm_scores_array =
+            FromTorch<float>(lm_scores, Array2Tag{});
+        context_map = context_map.to(torch::kInt).contiguous();
+        Array1<int32_t> context_map_array = FromTorch<int32_t>(context_map);
+        self.SetLmScores(lm_scores_array, context_map_array, lm_scale);
+      },
+      py::arg("lm_scores"), py::arg("context_map"), py::arg("lm_scale"));
+
+  streams.def(
+      "terminate_and_flush_to_streams",
+      [](PyClass &self) -> void {
+        DeviceGuard guard(self.Context());
+        self.TerminateAndFlushToStreams();
+      },
+      py::call_guard<py::gil_scoped_release>());
 
   streams.def("format_output",
               [](PyClass &self, std::vector<int32_t> &num_frames,
@@ -151,7 +212,28 @@ static void PybindRnntDecodingStreams(py::module &m) {
                 self.FormatOutput(num_frames, allow_partial, &ofsa, &out_map);
                 torch::Tensor out_map_tensor = ToTorch<int32_t>(out_map);
                 return std::make_pair(ofsa, out_map_tensor);
-              });
+              },
+              py::call_guard<py::gil_scoped_release>());
+
+  streams.def("detach_stream", [](PyClass &self, int32_t slot) -> void {
+    DeviceGuard guard(self.Context());
+    self.DetachStream(slot);
+  });
+
+  streams.def(
+      "attach_stream",
+      [](PyClass &self, int32_t slot,
+         std::shared_ptr<rnnt_decoding::RnntDecodingStream> stream) -> void {
+        DeviceGuard guard(self.Context());
+        self.AttachStream(slot, stream);
+      });
+
+  streams.def("get_finalized_best_path", [](PyClass &self) -> RaggedAny {
+    DeviceGuard guard(self.Context());
+    Ragged<int32_t> best_path;
+    self.GetFinalizedBestPath(&best_path);
+    return RaggedAny(best_path.Generic());
+  });
 }
 
 }  // namespace k2
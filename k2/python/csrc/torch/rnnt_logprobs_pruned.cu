@@ -0,0 +1,76 @@
+/**
+ * @copyright
+ * Copyright      2026  Xiaomi Corporation
+ *
+ * @copyright
+ * See LICENSE for clarification regarding multiple authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <vector>
+
+#include "k2/csrc/device_guard.h"
+#include "k2/csrc/torch_util.h"
+#include "k2/python/csrc/torch/rnnt_logprobs_pruned.h"
+
+void PybindRnntLogprobsPruned(py::module &m) {
+  m.def(
+      "rnnt_logprobs_pruned_forward",
+      [](torch::Tensor logits, torch::Tensor symbols, torch::Tensor ranges,
+         int32_t termination_symbol,
+         bool modified) -> std::vector<torch::Tensor> {
+        k2::DeviceGuard guard(k2::GetContext(logits));
+        if (logits.device().is_cpu()) {
+          return k2::RnntLogprobsPrunedCpu(logits, symbols, ranges,
+                                           termination_symbol, modified);
+        } else {
+#ifdef K2_WITH_CUDA
+          return k2::RnntLogprobsPrunedCuda(logits, symbols, ranges,
+                                            termination_symbol, modified);
+#else
+          K2_LOG(FATAL) << "Failed to find native CUDA module, make sure "
+                        << "that you compiled the code with K2_WITH_CUDA.";
+          return std::vector<torch::Tensor>();
+#endif
+        }
+      },
+      py::arg("logits"), py::arg("symbols"), py::arg("ranges"),
+      py::arg("termination_symbol"), py::arg("modified"));
+
+  m.def(
+      "rnnt_logprobs_pruned_backward",
+      [](torch::Tensor logits, torch::Tensor symbols, torch::Tensor ranges,
+         int32_t termination_symbol, torch::Tensor normalizers,
+         torch::Tensor px_grad, torch::Tensor py_grad) -> torch::Tensor {
+        k2::DeviceGuard guard(k2::GetContext(logits));
+        if (logits.device().is_cpu()) {
+          return k2::RnntLogprobsPrunedBackwardCpu(
+              logits, symbols, ranges, termination_symbol, normalizers,
+              px_grad, py_grad);
+        } else {
+#ifdef K2_WITH_CUDA
+          return k2::RnntLogprobsPrunedBackwardCuda(
+              logits, symbols, ranges, termination_symbol, normalizers,
+              px_grad, py_grad);
+#else
+          K2_LOG(FATAL) << "Failed to find native CUDA module, make sure "
+                        << "that you compiled the code with K2_WITH_CUDA.";
+          return torch::Tensor();
+#endif
+        }
+      },
+      py::arg("logits"), py::arg("symbols"), py::arg("ranges"),
+      py::arg("termination_symbol"), py::arg("normalizers"),
+      py::arg("px_grad"), py::arg("py_grad"));
+}
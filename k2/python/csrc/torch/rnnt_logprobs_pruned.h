@@ -0,0 +1,104 @@
+/**
+ * @copyright
+ * Copyright      2026  Xiaomi Corporation
+ *
+ * @copyright
+ * See LICENSE for clarification regarding multiple authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef K2_PYTHON_CSRC_TORCH_RNNT_LOGPROBS_PRUNED_H_
+#define K2_PYTHON_CSRC_TORCH_RNNT_LOGPROBS_PRUNED_H_
+
+#include <torch/extension.h>
+
+#include <vector>
+
+#include "k2/python/csrc/torch.h"
+
+namespace k2 {
+/*
+  Forward of get_rnnt_logprobs_pruned() with fused=True; see the comment of
+  `get_rnnt_logprobs_pruned` in rnnt_loss.py.  It computes `px` and `py` for
+  mutual_information_recursion() directly from the pruned logits, without
+  materializing the log-softmax of `logits` or the gathered and padded
+  intermediate tensors.
+
+    @param logits  Contiguous tensor of shape [B][T][s_range][C], the pruned
+                   output of the joiner.
+    @param symbols  Contiguous int64 tensor of shape [B][S].
+    @param ranges  Contiguous int64 tensor of shape [B][T][s_range], as
+                   returned by get_rnnt_prune_ranges(); ranges[b][t][r]
+                   must equal ranges[b][t][0] + r.
+    @param termination_symbol  The blank symbol, 0 <= termination_symbol < C.
+    @param modified  If false, px has shape [B][S][T + 1] (rnnt_type is
+                   "regular"); if true, [B][S][T].
+    @return Returns (px, py, normalizers), where, with s = ranges[b][t][r]
+            and normalizers[b][t][r] = logsumexp(logits[b][t][r]),
+
+               px[b][s][t] = logits[b][t][r][symbols[b][s]]
+                             - normalizers[b][t][r]      (if s < S),
+               py[b][s][t] = logits[b][t][r][termination_symbol]
+                             - normalizers[b][t][r],
+
+            and all other elements of px (of shape as above) and py (of shape
+            [B][S + 1][T]) are -infinity.  `normalizers` is needed by the
+            backward pass.
+*/
+std::vector<torch::Tensor> RnntLogprobsPrunedCpu(torch::Tensor logits,
+                                                 torch::Tensor symbols,
+                                                 torch::Tensor ranges,
+                                                 int32_t termination_symbol,
+                                                 bool modified);
+
+std::vector<torch::Tensor> RnntLogprobsPrunedCuda(torch::Tensor logits,
+                                                  torch::Tensor symbols,
+                                                  torch::Tensor ranges,
+                                                  int32_t termination_symbol,
+                                                  bool modified);
+
+/*
+  Backward of RnntLogprobsPrunedCpu() and RnntLogprobsPrunedCuda(); returns
+  the gradient w.r.t. `logits`, of shape [B][T][s_range][C], i.e.
+
+    logits_grad[b][t][r][c] = -softmax(logits[b][t][r])[c] * (gx + gy)
+                              + (c == symbols[b][s] ? gx : 0)
+                              + (c == termination_symbol ? gy : 0)
+
+  where s = ranges[b][t][r], gx = (s < S ? px_grad[b][s][t] : 0) and
+  gy = py_grad[b][s][t].  px_grad and py_grad must have the same shapes as px
+  and py.
+*/
+torch::Tensor RnntLogprobsPrunedBackwardCpu(
+    torch::Tensor logits, torch::Tensor symbols, torch::Tensor ranges,
+    int32_t termination_symbol, torch::Tensor normalizers,
+    torch::Tensor px_grad, torch::Tensor py_grad);
+
+torch::Tensor RnntLogprobsPrunedBackwardCuda(
+    torch::Tensor logits, torch::Tensor symbols, torch::Tensor ranges,
+    int32_t termination_symbol, torch::Tensor normalizers,
+    torch::Tensor px_grad, torch::Tensor py_grad);
+
+/* Checks the arguments that the forward and backward passes have in common,
+   except for their devices, and sets `dims` to (B, T, s_range, C, S).
+ */
+void CheckRnntLogprobsPrunedArgs(torch::Tensor logits, torch::Tensor symbols,
+                                 torch::Tensor ranges,
+                                 int32_t termination_symbol, int32_t *dims);
+
+}  // namespace k2
+
+void PybindRnntLogprobsPruned(py::module &m);
+
+#endif  // K2_PYTHON_CSRC_TORCH_RNNT_LOGPROBS_PRUNED_H_
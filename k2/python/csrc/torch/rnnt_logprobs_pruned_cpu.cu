@@ -0,0 +1,170 @@
+/**
+ * @copyright
+ * Copyright      2026  Xiaomi Corporation
+ *
+ * @copyright
+ * See LICENSE for clarification regarding multiple authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <vector>
+
+#include "k2/python/csrc/torch/rnnt_logprobs_pruned.h"
+
+namespace k2 {
+
+void CheckRnntLogprobsPrunedArgs(torch::Tensor logits,
+                                 torch::Tensor symbols, torch::Tensor ranges,
+                                 int32_t termination_symbol, int32_t *dims) {
+  TORCH_CHECK(logits.dim() == 4, "logits must be 4-dimensional");
+  TORCH_CHECK(symbols.dim() == 2, "symbols must be 2-dimensional");
+  TORCH_CHECK(ranges.dim() == 3, "ranges must be 3-dimensional");
+  TORCH_CHECK(logits.is_contiguous() && symbols.is_contiguous() &&
+                  ranges.is_contiguous(),
+              "inputs must be contiguous");
+  TORCH_CHECK(symbols.scalar_type() == torch::kInt64 &&
+                  ranges.scalar_type() == torch::kInt64,
+              "symbols and ranges must be int64");
+  const int B = logits.size(0), T = logits.size(1), R = logits.size(2),
+            C = logits.size(3), S = symbols.size(1);
+  TORCH_CHECK(symbols.size(0) == B);
+  TORCH_CHECK(ranges.size(0) == B && ranges.size(1) == T &&
+              ranges.size(2) == R);
+  TORCH_CHECK(R <= S + 1, "s_range must not exceed S + 1");
+  TORCH_CHECK(termination_symbol >= 0 && termination_symbol < C);
+  dims[0] = B;
+  dims[1] = T;
+  dims[2] = R;
+  dims[3] = C;
+  dims[4] = S;
+}
+
+std::vector<torch::Tensor> RnntLogprobsPrunedCpu(torch::Tensor logits,
+                                                 torch::Tensor symbols,
+                                                 torch::Tensor ranges,
+                                                 int32_t termination_symbol,
+                                                 bool modified) {
+  TORCH_CHECK(logits.device().is_cpu() && symbols.device().is_cpu() &&
+                  ranges.device().is_cpu(),
+              "inputs must be CPU tensors");
+  int32_t dims[5];
+  CheckRnntLogprobsPrunedArgs(logits, symbols, ranges, termination_symbol,
+                              dims);
+  const int B = dims[0], T = dims[1], R = dims[2], C = dims[3], S = dims[4];
+
+  auto opts = torch::TensorOptions()
+                  .dtype(logits.scalar_type())
+                  .device(logits.device());
+  const double neg_inf = -std::numeric_limits<double>::infinity();
+  torch::Tensor px = torch::full({B, S, modified ? T : T + 1}, neg_inf, opts),
+                py = torch::full({B, S + 1, T}, neg_inf, opts),
+                normalizers = torch::empty({B, T, R}, opts);
+
+  AT_DISPATCH_FLOATING_TYPES(
+      logits.scalar_type(), "rnnt_logprobs_pruned_cpu_loop", ([&] {
+        const scalar_t *logits_data = logits.data_ptr<scalar_t>();
+        const int64_t *symbols_data = symbols.data_ptr<int64_t>(),
+                      *ranges_data = ranges.data_ptr<int64_t>();
+        auto px_a = px.accessor<scalar_t, 3>(),
+             py_a = py.accessor<scalar_t, 3>();
+        scalar_t *normalizers_data = normalizers.data_ptr<scalar_t>();
+
+        for (int b = 0; b < B; ++b) {
+          for (int t = 0; t < T; ++t) {
+            for (int r = 0; r < R; ++r) {
+              int64_t row = (static_cast<int64_t>(b) * T + t) * R + r;
+              const scalar_t *this_logits = logits_data + row * C;
+              scalar_t max_value = -std::numeric_limits<scalar_t>::infinity();
+              for (int c = 0; c < C; ++c)
+                max_value = std::max(max_value, this_logits[c]);
+              scalar_t normalizer = max_value;
+              if (max_value != -std::numeric_limits<scalar_t>::infinity()) {
+                scalar_t sum = 0;
+                for (int c = 0; c < C; ++c)
+                  sum += std::exp(this_logits[c] - max_value);
+                normalizer += std::log(sum);
+              }
+              normalizers_data[row] = normalizer;
+
+              int64_t s = ranges_data[row];
+              TORCH_CHECK(s >= 0 && s <= S, "Invalid ranges");
+              if (s < S)
+                px_a[b][s][t] =
+                    this_logits[symbols_data[b * S + s]] - normalizer;
+              py_a[b][s][t] = this_logits[termination_symbol] - normalizer;
+            }
+          }
+        }
+      }));
+  return {px, py, normalizers};
+}
+
+torch::Tensor RnntLogprobsPrunedBackwardCpu(
+    torch::Tensor logits, torch::Tensor symbols, torch::Tensor ranges,
+    int32_t termination_symbol, torch::Tensor normalizers,
+    torch::Tensor px_grad, torch::Tensor py_grad) {
+  TORCH_CHECK(logits.device().is_cpu() && symbols.device().is_cpu() &&
+                  ranges.device().is_cpu() && normalizers.device().is_cpu() &&
+                  px_grad.device().is_cpu() && py_grad.device().is_cpu(),
+              "inputs must be CPU tensors");
+  int32_t dims[5];
+  CheckRnntLogprobsPrunedArgs(logits, symbols, ranges, termination_symbol,
+                              dims);
+  const int B = dims[0], T = dims[1], R = dims[2], C = dims[3], S = dims[4];
+  TORCH_CHECK(normalizers.is_contiguous());
+  TORCH_CHECK(px_grad.dim() == 3 && px_grad.size(0) == B &&
+              px_grad.size(1) == S &&
+              (px_grad.size(2) == T || px_grad.size(2) == T + 1));
+  TORCH_CHECK(py_grad.dim() == 3 && py_grad.size(0) == B &&
+              py_grad.size(1) == S + 1 && py_grad.size(2) == T);
+
+  torch::Tensor logits_grad = torch::empty_like(logits);
+
+  AT_DISPATCH_FLOATING_TYPES(
+      logits.scalar_type(), "rnnt_logprobs_pruned_backward_cpu_loop", ([&] {
+        const scalar_t *logits_data = logits.data_ptr<scalar_t>(),
+                       *normalizers_data = normalizers.data_ptr<scalar_t>();
+        const int64_t *symbols_data = symbols.data_ptr<int64_t>(),
+                      *ranges_data = ranges.data_ptr<int64_t>();
+        auto px_grad_a = px_grad.accessor<scalar_t, 3>(),
+             py_grad_a = py_grad.accessor<scalar_t, 3>();
+        scalar_t *logits_grad_data = logits_grad.data_ptr<scalar_t>();
+
+        for (int b = 0; b < B; ++b) {
+          for (int t = 0; t < T; ++t) {
+            for (int r = 0; r < R; ++r) {
+              int64_t row = (static_cast<int64_t>(b) * T + t) * R + r;
+              const scalar_t *this_logits = logits_data + row * C;
+              scalar_t *this_grad = logits_grad_data + row * C;
+              int64_t s = ranges_data[row];
+              scalar_t gx = (s < S ? px_grad_a[b][s][t] : scalar_t(0)),
+                       gy = py_grad_a[b][s][t], g = gx + gy,
+                       normalizer = normalizers_data[row];
+              for (int c = 0; c < C; ++c)
+                this_grad[c] = (g == 0 ? scalar_t(0)
+                                       : -std::exp(this_logits[c] -
+                                                   normalizer) * g);
+              if (s < S) this_grad[symbols_data[b * S + s]] += gx;
+              this_grad[termination_symbol] += gy;
+            }
+          }
+        }
+      }));
+  return logits_grad;
+}
+
+}  // namespace k2
@@ -0,0 +1,231 @@
+/**
+ * @copyright
+ * Copyright      2026  Xiaomi Corporation
+ *
+ * @copyright
+ * See LICENSE for clarification regarding multiple authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <c10/cuda/CUDAStream.h>  // for getCurrentCUDAStream()
+
+#include <limits>
+#include <vector>
+
+#include "k2/csrc/log.h"
+#include "k2/python/csrc/torch/rnnt_logprobs_pruned.h"
+
+namespace k2 {
+
+// Each warp handles one row of `logits`, i.e. one (b, t, r).
+constexpr int kRnntLogprobsWarpSize = 32;
+
+template <typename scalar_t>
+__forceinline__ __device__ scalar_t WarpMax(scalar_t value) {
+  for (int offset = kRnntLogprobsWarpSize / 2; offset > 0; offset /= 2) {
+    scalar_t other = __shfl_xor_sync(0xffffffff, value, offset);
+    value = (other > value ? other : value);
+  }
+  return value;
+}
+
+template <typename scalar_t>
+__forceinline__ __device__ scalar_t WarpSum(scalar_t value) {
+  for (int offset = kRnntLogprobsWarpSize / 2; offset > 0; offset /= 2)
+    value += __shfl_xor_sync(0xffffffff, value, offset);
+  return value;
+}
+
+/*
+  Computes the log-softmax normalizer of each row of `logits` and writes
+  the elements of px and py that the row corresponds to; see
+  RnntLogprobsPrunedCuda() in rnnt_logprobs_pruned.h.  px and py must
+  have been set to -infinity.  The rows are indexed by
+  row = (b * T + t) * R + r and there are num_rows = B * T * R of them.
+ */
+template <typename scalar_t>
+__global__ void rnnt_logprobs_pruned_kernel(
+    const scalar_t *logits, const int64_t *symbols, const int64_t *ranges,
+    int32_t termination_symbol, int64_t num_rows, int32_t T, int32_t R,
+    int32_t C, int32_t S,
+    torch::PackedTensorAccessor32<scalar_t, 3> px,   // [B][S][T or T+1]
+    torch::PackedTensorAccessor32<scalar_t, 3> py,   // [B][S+1][T]
+    scalar_t *normalizers) {                         // [B][T][R]
+  int64_t row = (static_cast<int64_t>(blockIdx.x) * blockDim.x + threadIdx.x) /
+                kRnntLogprobsWarpSize;
+  int32_t lane = threadIdx.x % kRnntLogprobsWarpSize;
+  if (row >= num_rows) return;  // the same for all threads of the warp.
+
+  const scalar_t *this_logits = logits + row * C;
+  const scalar_t neg_inf = -std::numeric_limits<scalar_t>::infinity();
+  scalar_t max_value = neg_inf;
+  for (int32_t c = lane; c < C; c += kRnntLogprobsWarpSize) {
+    scalar_t x = this_logits[c];
+    max_value = (x > max_value ? x : max_value);
+  }
+  max_value = WarpMax(max_value);
+
+  scalar_t sum = 0;
+  if (max_value != neg_inf) {
+    for (int32_t c = lane; c < C; c += kRnntLogprobsWarpSize)
+      sum += exp(this_logits[c] - max_value);
+  }
+  sum = WarpSum(sum);
+
+  if (lane == 0) {
+    scalar_t normalizer = (max_value != neg_inf ? max_value + log(sum)
+                                                : max_value);
+    normalizers[row] = normalizer;
+
+    int32_t b = row / (static_cast<int64_t>(T) * R), t = (row / R) % T;
+    int64_t s = ranges[row];
+    if (s < 0 || s > S) return;  // invalid `ranges`; checked on the host.
+    if (s < S) px[b][s][t] = this_logits[symbols[b * S + s]] - normalizer;
+    py[b][s][t] = this_logits[termination_symbol] - normalizer;
+  }
+}
+
+/*
+  Backward of rnnt_logprobs_pruned_kernel(); writes `logits_grad`, of the same
+  shape as `logits`.  See RnntLogprobsPrunedBackwardCuda() in
+  rnnt_logprobs_pruned.h.
+ */
+template <typename scalar_t>
+__global__ void rnnt_logprobs_pruned_backward_kernel(
+    const scalar_t *logits, const int64_t *symbols, const int64_t *ranges,
+    int32_t termination_symbol, int64_t num_rows, int32_t T, int32_t R,
+    int32_t C, int32_t S, const scalar_t *normalizers,
+    torch::PackedTensorAccessor32<scalar_t, 3> px_grad,
+    torch::PackedTensorAccessor32<scalar_t, 3> py_grad,
+    scalar_t *logits_grad) {
+  int64_t row = (static_cast<int64_t>(blockIdx.x) * blockDim.x + threadIdx.x) /
+                kRnntLogprobsWarpSize;
+  int32_t lane = threadIdx.x % kRnntLogprobsWarpSize;
+  if (row >= num_rows) return;
+
+  int32_t b = row / (static_cast<int64_t>(T) * R), t = (row / R) % T;
+  int64_t s = ranges[row];
+  scalar_t gx = 0, gy = 0;
+  int64_t symbol = -1;
+  if (s >= 0 && s <= S) {
+    gy = py_grad[b][s][t];
+    if (s < S) {
+      gx = px_grad[b][s][t];
+      symbol = symbols[b * S + s];
+    }
+  }
+  scalar_t g = gx + gy, normalizer = normalizers[row];
+
+  const scalar_t *this_logits = logits + row * C;
+  scalar_t *this_grad = logits_grad + row * C;
+  for (int32_t c = lane; c < C; c += kRnntLogprobsWarpSize) {
+    scalar_t ans = (g == 0 ? scalar_t(0)
+                           : -exp(this_logits[c] - normalizer) * g);
+    if (c == symbol) ans += gx;
+    if (c == termination_symbol) ans += gy;
+    this_grad[c] = ans;
+  }
+}
+
+std::vector<torch::Tensor> RnntLogprobsPrunedCuda(torch::Tensor logits,
+                                                  torch::Tensor symbols,
+                                                  torch::Tensor ranges,
+                                                  int32_t termination_symbol,
+                                                  bool modified) {
+  TORCH_CHECK(logits.device().is_cuda() && symbols.device().is_cuda() &&
+                  ranges.device().is_cuda(),
+              "inputs must be CUDA tensors");
+  int32_t dims[5];
+  CheckRnntLogprobsPrunedArgs(logits, symbols, ranges, termination_symbol,
+                              dims);
+  const int B = dims[0], T = dims[1], R = dims[2], C = dims[3], S = dims[4];
+  TORCH_CHECK(ranges.min().item<int64_t>() >= 0 &&
+                  ranges.max().item<int64_t>() <= S,
+              "Invalid ranges");
+
+  auto opts = torch::TensorOptions()
+                  .dtype(logits.scalar_type())
+                  .device(logits.device());
+  const double neg_inf = -std::numeric_limits<double>::infinity();
+  torch::Tensor px = torch::full({B, S, modified ? T : T + 1}, neg_inf, opts),
+                py = torch::full({B, S + 1, T}, neg_inf, opts),
+                normalizers = torch::empty({B, T, R}, opts);
+
+  int64_t num_rows = static_cast<int64_t>(B) * T * R;
+  if (num_rows == 0) return {px, py, normalizers};
+
+  // num_threads can be tuned; it must be a multiple of the warp size.
+  const int num_threads = 256;
+  const int64_t num_blocks =
+      (num_rows * kRnntLogprobsWarpSize + num_threads - 1) / num_threads;
+  cudaStream_t stream = c10::cuda::getCurrentCUDAStream();
+
+  AT_DISPATCH_FLOATING_TYPES(
+      logits.scalar_type(), "rnnt_logprobs_pruned_cuda_stub", ([&] {
+        K2_CUDA_SAFE_CALL(
+            rnnt_logprobs_pruned_kernel<scalar_t>
+            <<<num_blocks, num_threads, 0, stream>>>(
+                logits.data_ptr<scalar_t>(), symbols.data_ptr<int64_t>(),
+                ranges.data_ptr<int64_t>(), termination_symbol, num_rows, T,
+                R, C, S, px.packed_accessor32<scalar_t, 3>(),
+                py.packed_accessor32<scalar_t, 3>(),
+                normalizers.data_ptr<scalar_t>()));
+      }));
+  return {px, py, normalizers};
+}
+
+torch::Tensor RnntLogprobsPrunedBackwardCuda(
+    torch::Tensor logits, torch::Tensor symbols, torch::Tensor ranges,
+    int32_t termination_symbol, torch::Tensor normalizers,
+    torch::Tensor px_grad, torch::Tensor py_grad) {
+  TORCH_CHECK(logits.device().is_cuda() && symbols.device().is_cuda() &&
+                  ranges.device().is_cuda() && normalizers.device().is_cuda() &&
+                  px_grad.device().is_cuda() && py_grad.device().is_cuda(),
+              "inputs must be CUDA tensors");
+  int32_t dims[5];
+  CheckRnntLogprobsPrunedArgs(logits, symbols, ranges, termination_symbol,
+                              dims);
+  const int B = dims[0], T = dims[1], R = dims[2], C = dims[3], S = dims[4];
+  TORCH_CHECK(normalizers.is_contiguous());
+  TORCH_CHECK(px_grad.dim() == 3 && px_grad.size(0) == B &&
+              px_grad.size(1) == S &&
+              (px_grad.size(2) == T || px_grad.size(2) == T + 1));
+  TORCH_CHECK(py_grad.dim() == 3 && py_grad.size(0) == B &&
+              py_grad.size(1) == S + 1 && py_grad.size(2) == T);
+
+  torch::Tensor logits_grad = torch::empty_like(logits);
+  int64_t num_rows = static_cast<int64_t>(B) * T * R;
+  if (num_rows == 0) return logits_grad;
+
+  const int num_threads = 256;
+  const int64_t num_blocks =
+      (num_rows * kRnntLogprobsWarpSize + num_threads - 1) / num_threads;
+  cudaStream_t stream = c10::cuda::getCurrentCUDAStream();
+
+  AT_DISPATCH_FLOATING_TYPES(
+      logits.scalar_type(), "rnnt_logprobs_pruned_backward_cuda_stub", ([&] {
+        K2_CUDA_SAFE_CALL(
+            rnnt_logprobs_pruned_backward_kernel<scalar_t>
+            <<<num_blocks, num_threads, 0, stream>>>(
+                logits.data_ptr<scalar_t>(), symbols.data_ptr<int64_t>(),
+                ranges.data_ptr<int64_t>(), termination_symbol, num_rows, T,
+                R, C, S, normalizers.data_ptr<scalar_t>(),
+                px_grad.packed_accessor32<scalar_t, 3>(),
+                py_grad.packed_accessor32<scalar_t, 3>(),
+                logits_grad.data_ptr<scalar_t>()));
+      }));
+  return logits_grad;
+}
+
+}  // namespace k2
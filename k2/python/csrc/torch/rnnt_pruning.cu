@@ -0,0 +1,82 @@
+/**
+ * @copyright
+ * Copyright      2026  Xiaomi Corporation
+ *
+ * @copyright
+ * See LICENSE for clarification regarding multiple authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "k2/csrc/device_guard.h"
+#include "k2/csrc/torch_util.h"
+#include "k2/python/csrc/torch/rnnt_pruning.h"
+
+void PybindRnntPruning(py::module &m) {
+  m.def(
+      "rnnt_prune_ranges",
+      [](torch::Tensor px_grad, torch::Tensor py_grad, torch::Tensor boundary,
+         int32_t s_range) -> torch::Tensor {
+        k2::DeviceGuard guard(k2::GetContext(px_grad));
+        if (px_grad.device().is_cpu()) {
+          return k2::RnntPruneRangesCpu(px_grad, py_grad, boundary, s_range);
+        } else {
+#ifdef K2_WITH_CUDA
+          return k2::RnntPruneRangesCuda(px_grad, py_grad, boundary, s_range);
+#else
+          K2_LOG(FATAL) << "Failed to find native CUDA module, make sure "
+                        << "that you compiled the code with K2_WITH_CUDA.";
+          return torch::Tensor();
+#endif
+        }
+      },
+      py::arg("px_grad"), py::arg("py_grad"), py::arg("boundary"),
+      py::arg("s_range"));
+
+  m.def(
+      "rnnt_prune_gather",
+      [](torch::Tensor lm, torch::Tensor ranges) -> torch::Tensor {
+        k2::DeviceGuard guard(k2::GetContext(lm));
+        if (lm.device().is_cpu()) {
+          return k2::RnntPruneGatherCpu(lm, ranges);
+        } else {
+#ifdef K2_WITH_CUDA
+          return k2::RnntPruneGatherCuda(lm, ranges);
+#else
+          K2_LOG(FATAL) << "Failed to find native CUDA module, make sure "
+                        << "that you compiled the code with K2_WITH_CUDA.";
+          return torch::Tensor();
+#endif
+        }
+      },
+      py::arg("lm"), py::arg("ranges"));
+
+  m.def(
+      "rnnt_prune_gather_backward",
+      [](torch::Tensor lm_pruned_grad, torch::Tensor ranges,
+         int32_t S1) -> torch::Tensor {
+        k2::DeviceGuard guard(k2::GetContext(lm_pruned_grad));
+        if (lm_pruned_grad.device().is_cpu()) {
+          return k2::RnntPruneGatherBackwardCpu(lm_pruned_grad, ranges, S1);
+        } else {
+#ifdef K2_WITH_CUDA
+          return k2::RnntPruneGatherBackwardCuda(lm_pruned_grad, ranges, S1);
+#else
+          K2_LOG(FATAL) << "Failed to find native CUDA module, make sure "
+                        << "that you compiled the code with K2_WITH_CUDA.";
+          return torch::Tensor();
+#endif
+        }
+      },
+      py::arg("lm_pruned_grad"), py::arg("ranges"), py::arg("S1"));
+}
@@ -0,0 +1,96 @@
+/**
+ * @copyright
+ * Copyright      2026  Xiaomi Corporation
+ *
+ * @copyright
+ * See LICENSE for clarification regarding multiple authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef K2_PYTHON_CSRC_TORCH_RNNT_PRUNING_H_
+#define K2_PYTHON_CSRC_TORCH_RNNT_PRUNING_H_
+
+#include <torch/extension.h>
+
+#include "k2/python/csrc/torch.h"
+
+namespace k2 {
+/*
+  Fused version of get_rnnt_prune_ranges() in rnnt_loss.py; see its
+  documentation.  It computes the best s_begin of each frame from the
+  gradients of px and py, fills the padding frames, and makes s_begin satisfy
+  the constraints described in _adjust_pruning_lower_bound(), without
+  creating intermediate tensors of the size of py_grad.
+
+    @param px_grad  Tensor of shape [B][S][T + 1] (regular RNN-T) or
+                    [B][S][T] (modified or constrained RNN-T).
+    @param py_grad  Tensor of shape [B][S + 1][T], of the same dtype as
+                    px_grad.
+    @param boundary  Contiguous int64 tensor of shape [B][4], with elements
+                    [begin_symbol, begin_frame, end_symbol, end_frame].
+    @param s_range  The number of symbols to keep for each frame,
+                    1 <= s_range <= S + 1.
+    @return Returns an int64 tensor `ranges` of shape [B][T][s_range] with
+            ranges[b][t][r] = s_begin[b][t] + r.
+*/
+torch::Tensor RnntPruneRangesCpu(torch::Tensor px_grad, torch::Tensor py_grad,
+                                 torch::Tensor boundary, int32_t s_range);
+
+torch::Tensor RnntPruneRangesCuda(torch::Tensor px_grad,
+                                  torch::Tensor py_grad,
+                                  torch::Tensor boundary, int32_t s_range);
+
+/*
+  Fused version of the gather of `lm` in do_rnnt_pruning(): returns
+  lm_pruned of shape [B][T][s_range][D] with
+
+     lm_pruned[b][t][r][d] = lm[b][ranges[b][t][r]][d].
+
+    @param lm  Tensor of shape [B][S + 1][D].
+    @param ranges  Contiguous int64 tensor of shape [B][T][s_range], as
+                   returned by get_rnnt_prune_ranges().
+*/
+torch::Tensor RnntPruneGatherCpu(torch::Tensor lm, torch::Tensor ranges);
+
+torch::Tensor RnntPruneGatherCuda(torch::Tensor lm, torch::Tensor ranges);
+
+/*
+  Backward of RnntPruneGatherCpu() and RnntPruneGatherCuda(); returns the
+  gradient w.r.t. `lm`, of shape [B][S1][D], given the gradient
+  `lm_pruned_grad` w.r.t. lm_pruned.
+*/
+torch::Tensor RnntPruneGatherBackwardCpu(torch::Tensor lm_pruned_grad,
+                                         torch::Tensor ranges, int32_t S1);
+
+torch::Tensor RnntPruneGatherBackwardCuda(torch::Tensor lm_pruned_grad,
+                                          torch::Tensor ranges, int32_t S1);
+
+/* Checks the arguments of RnntPruneRangesCpu() and RnntPruneRangesCuda(),
+   except for their devices, and sets `dims` to (B, S, T, T1).
+ */
+void CheckRnntPruneRangesArgs(torch::Tensor px_grad, torch::Tensor py_grad,
+                              torch::Tensor boundary, int32_t s_range,
+                              int32_t *dims);
+
+/* Checks the arguments of the gather and its backward, except for their
+   devices.  `lm_or_grad` is lm, of shape [B][S1][D], or lm_pruned_grad, of
+   shape [B][T][s_range][D].
+ */
+void CheckRnntPruneGatherArgs(torch::Tensor lm_or_grad, torch::Tensor ranges);
+
+}  // namespace k2
+
+void PybindRnntPruning(py::module &m);
+
+#endif  // K2_PYTHON_CSRC_TORCH_RNNT_PRUNING_H_
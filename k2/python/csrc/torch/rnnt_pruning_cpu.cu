@@ -0,0 +1,191 @@
+/**
+ * @copyright
+ * Copyright      2026  Xiaomi Corporation
+ *
+ * @copyright
+ * See LICENSE for clarification regarding multiple authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <vector>
+
+#include "k2/python/csrc/torch/rnnt_pruning.h"
+
+namespace k2 {
+
+void CheckRnntPruneRangesArgs(torch::Tensor px_grad, torch::Tensor py_grad,
+                              torch::Tensor boundary, int32_t s_range,
+                              int32_t *dims) {
+  TORCH_CHECK(px_grad.dim() == 3, "px_grad must be 3-dimensional");
+  TORCH_CHECK(py_grad.dim() == 3, "py_grad must be 3-dimensional");
+  TORCH_CHECK(boundary.dim() == 2, "boundary must be 2-dimensional");
+  TORCH_CHECK(px_grad.scalar_type() == py_grad.scalar_type(),
+              "px_grad and py_grad must have the same dtype");
+  TORCH_CHECK(boundary.scalar_type() == torch::kInt64 &&
+                  boundary.is_contiguous(),
+              "boundary must be a contiguous int64 tensor");
+  const int B = px_grad.size(0), S = px_grad.size(1), T1 = px_grad.size(2),
+            T = py_grad.size(2);
+  TORCH_CHECK(T1 == T || T1 == T + 1);
+  TORCH_CHECK(py_grad.size(0) == B && py_grad.size(1) == S + 1);
+  TORCH_CHECK(boundary.size(0) == B && boundary.size(1) == 4);
+  TORCH_CHECK(s_range >= 1 && s_range <= S + 1,
+              "s_range must be in [1, S + 1]");
+  dims[0] = B;
+  dims[1] = S;
+  dims[2] = T;
+  dims[3] = T1;
+}
+
+void CheckRnntPruneGatherArgs(torch::Tensor lm_or_grad, torch::Tensor ranges) {
+  TORCH_CHECK(ranges.dim() == 3, "ranges must be 3-dimensional");
+  TORCH_CHECK(ranges.scalar_type() == torch::kInt64 && ranges.is_contiguous(),
+              "ranges must be a contiguous int64 tensor");
+  TORCH_CHECK(lm_or_grad.is_contiguous(), "inputs must be contiguous");
+  TORCH_CHECK(lm_or_grad.size(0) == ranges.size(0));
+}
+
+torch::Tensor RnntPruneRangesCpu(torch::Tensor px_grad, torch::Tensor py_grad,
+                                 torch::Tensor boundary, int32_t s_range) {
+  TORCH_CHECK(px_grad.device().is_cpu() && py_grad.device().is_cpu() &&
+                  boundary.device().is_cpu(),
+              "inputs must be CPU tensors");
+  int32_t dims[4];
+  CheckRnntPruneRangesArgs(px_grad, py_grad, boundary, s_range, dims);
+  const int B = dims[0], S = dims[1], T = dims[2], T1 = dims[3], R = s_range;
+  // The largest s_begin, and the largest s_begin[t + 1] - s_begin[t].
+  const int max_s_begin = S + 1 - R, max_step = (T1 == T ? 2 : R) - 1;
+
+  torch::Tensor ranges = torch::empty(
+      {B, T, R},
+      torch::TensorOptions().dtype(torch::kInt64).device(px_grad.device()));
+  int64_t *ranges_data = ranges.data_ptr<int64_t>();
+  const int64_t *boundary_data = boundary.data_ptr<int64_t>();
+
+  AT_DISPATCH_FLOATING_TYPES(
+      px_grad.scalar_type(), "rnnt_prune_ranges_cpu_loop", ([&] {
+        auto px_grad_a = px_grad.accessor<scalar_t, 3>(),
+             py_grad_a = py_grad.accessor<scalar_t, 3>();
+        std::vector<int64_t> s_begin(T);
+        for (int b = 0; b < B; ++b) {
+          const int64_t *this_boundary = boundary_data + b * 4;
+          int64_t s_begin_padding =
+              std::max<int64_t>(this_boundary[2] - R + 1, 0);
+          for (int t = 0; t < T; ++t) {
+            if (t >= this_boundary[3] - 1) {
+              s_begin[t] = s_begin_padding;
+              continue;
+            }
+            // The first s with the largest sum of py_grad over
+            // [s, s + R) minus px_grad[s - 1], as torch.argmax() does.
+            scalar_t best = 0;
+            int64_t best_s = 0;
+            for (int s = 0; s <= max_s_begin; ++s) {
+              scalar_t sum = 0;
+              for (int r = 0; r < R; ++r) sum += py_grad_a[b][s + r][t];
+              if (s > 0) sum -= px_grad_a[b][s - 1][t];
+              if (s == 0 || sum > best) {
+                best = sum;
+                best_s = s;
+              }
+            }
+            s_begin[t] = best_s;
+          }
+          // See _adjust_pruning_lower_bound() in rnnt_loss.py.
+          int64_t min_value = std::numeric_limits<int64_t>::max();
+          for (int t = T - 1; t >= 0; --t) {
+            min_value = std::min(min_value, s_begin[t]);
+            s_begin[t] = min_value;
+          }
+          min_value = std::numeric_limits<int64_t>::max();
+          for (int t = T - 1; t >= 0; --t) {
+            int64_t x = static_cast<int64_t>(max_step) * t - s_begin[t];
+            min_value = std::min(min_value, x);
+            s_begin[t] = static_cast<int64_t>(max_step) * t -
+                         std::max<int64_t>(min_value, 0);
+          }
+          for (int t = 0; t < T; ++t) {
+            int64_t *this_ranges =
+                ranges_data + (static_cast<int64_t>(b) * T + t) * R;
+            for (int r = 0; r < R; ++r) this_ranges[r] = s_begin[t] + r;
+          }
+        }
+      }));
+  return ranges;
+}
+
+torch::Tensor RnntPruneGatherCpu(torch::Tensor lm, torch::Tensor ranges) {
+  TORCH_CHECK(lm.device().is_cpu() && ranges.device().is_cpu(),
+              "inputs must be CPU tensors");
+  TORCH_CHECK(lm.dim() == 3, "lm must be 3-dimensional");
+  CheckRnntPruneGatherArgs(lm, ranges);
+  const int B = ranges.size(0), T = ranges.size(1), R = ranges.size(2),
+            S1 = lm.size(1), D = lm.size(2);
+
+  torch::Tensor lm_pruned = torch::empty({B, T, R, D}, lm.options());
+  const int64_t *ranges_data = ranges.data_ptr<int64_t>();
+  AT_DISPATCH_FLOATING_TYPES(
+      lm.scalar_type(), "rnnt_prune_gather_cpu_loop", ([&] {
+        const scalar_t *lm_data = lm.data_ptr<scalar_t>();
+        scalar_t *lm_pruned_data = lm_pruned.data_ptr<scalar_t>();
+        for (int b = 0; b < B; ++b) {
+          int64_t begin = static_cast<int64_t>(b) * T * R,
+                  end = begin + T * R;
+          for (int64_t row = begin; row < end; ++row) {
+            int64_t s = ranges_data[row];
+            TORCH_CHECK(s >= 0 && s < S1, "Invalid ranges");
+            std::memcpy(lm_pruned_data + row * D, lm_data + (b * S1 + s) * D,
+                        D * sizeof(scalar_t));
+          }
+        }
+      }));
+  return lm_pruned;
+}
+
+torch::Tensor RnntPruneGatherBackwardCpu(torch::Tensor lm_pruned_grad,
+                                         torch::Tensor ranges, int32_t S1) {
+  TORCH_CHECK(lm_pruned_grad.device().is_cpu() && ranges.device().is_cpu(),
+              "inputs must be CPU tensors");
+  TORCH_CHECK(lm_pruned_grad.dim() == 4,
+              "lm_pruned_grad must be 4-dimensional");
+  CheckRnntPruneGatherArgs(lm_pruned_grad, ranges);
+  const int B = ranges.size(0), T = ranges.size(1), R = ranges.size(2),
+            D = lm_pruned_grad.size(3);
+
+  torch::Tensor lm_grad = torch::zeros({B, S1, D}, lm_pruned_grad.options());
+  const int64_t *ranges_data = ranges.data_ptr<int64_t>();
+  AT_DISPATCH_FLOATING_TYPES(
+      lm_pruned_grad.scalar_type(), "rnnt_prune_gather_backward_cpu_loop",
+      ([&] {
+        const scalar_t *grad_data = lm_pruned_grad.data_ptr<scalar_t>();
+        scalar_t *lm_grad_data = lm_grad.data_ptr<scalar_t>();
+        for (int b = 0; b < B; ++b) {
+          int64_t begin = static_cast<int64_t>(b) * T * R,
+                  end = begin + T * R;
+          for (int64_t row = begin; row < end; ++row) {
+            int64_t s = ranges_data[row];
+            TORCH_CHECK(s >= 0 && s < S1, "Invalid ranges");
+            const scalar_t *src = grad_data + row * D;
+            scalar_t *dest = lm_grad_data + (b * S1 + s) * D;
+            for (int d = 0; d < D; ++d) dest[d] += src[d];
+          }
+        }
+      }));
+  return lm_grad;
+}
+
+}  // namespace k2
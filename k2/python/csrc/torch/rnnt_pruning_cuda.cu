@@ -0,0 +1,217 @@
+/**
+ * @copyright
+ * Copyright      2026  Xiaomi Corporation
+ *
+ * @copyright
+ * See LICENSE for clarification regarding multiple authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <c10/cuda/CUDAStream.h>  // for getCurrentCUDAStream()
+
+#include "k2/csrc/log.h"
+#include "k2/csrc/utils.h"
+#include "k2/python/csrc/torch/rnnt_pruning.h"
+
+namespace k2 {
+
+/*
+  Computes the ranges of one sequence per block; see RnntPruneRangesCuda()
+  in rnnt_pruning.h.  The threads of a block first compute s_begin of the
+  frames in parallel, writing it to ranges[b][t][0]; then thread 0 applies
+  the (sequential) adjustment of _adjust_pruning_lower_bound(), and finally
+  the threads fill in the rest of ranges[b].
+ */
+template <typename scalar_t>
+__global__ void rnnt_prune_ranges_kernel(
+    torch::PackedTensorAccessor32<scalar_t, 3> px_grad,  // [B][S][T1]
+    torch::PackedTensorAccessor32<scalar_t, 3> py_grad,  // [B][S+1][T]
+    const int64_t *boundary,                             // [B][4]
+    int32_t T, int32_t R, int32_t max_s_begin, int32_t max_step,
+    int64_t *ranges) {                                   // [B][T][R]
+  int32_t b = blockIdx.x;
+  const int64_t *this_boundary = boundary + b * 4;
+  int64_t *this_ranges = ranges + static_cast<int64_t>(b) * T * R;
+  int64_t s_begin_padding = this_boundary[2] - R + 1;
+  if (s_begin_padding < 0) s_begin_padding = 0;
+
+  for (int32_t t = threadIdx.x; t < T; t += blockDim.x) {
+    int64_t best_s = s_begin_padding;
+    if (t < this_boundary[3] - 1) {
+      // The first s with the largest sum of py_grad over [s, s + R) minus
+      // px_grad[s - 1], as torch.argmax() does.
+      scalar_t best = 0;
+      for (int32_t s = 0; s <= max_s_begin; ++s) {
+        scalar_t sum = 0;
+        for (int32_t r = 0; r < R; ++r) sum += py_grad[b][s + r][t];
+        if (s > 0) sum -= px_grad[b][s - 1][t];
+        if (s == 0 || sum > best) {
+          best = sum;
+          best_s = s;
+        }
+      }
+    }
+    this_ranges[t * R] = best_s;
+  }
+  __syncthreads();
+
+  if (threadIdx.x == 0) {
+    // See _adjust_pruning_lower_bound() in rnnt_loss.py.
+    int64_t min_value = this_ranges[(T - 1) * R];
+    for (int32_t t = T - 1; t >= 0; --t) {
+      int64_t s = this_ranges[t * R];
+      min_value = (s < min_value ? s : min_value);
+      this_ranges[t * R] = min_value;
+    }
+    min_value = static_cast<int64_t>(max_step) * (T - 1) -
+                this_ranges[(T - 1) * R];
+    for (int32_t t = T - 1; t >= 0; --t) {
+      int64_t x = static_cast<int64_t>(max_step) * t - this_ranges[t * R];
+      min_value = (x < min_value ? x : min_value);
+      this_ranges[t * R] = static_cast<int64_t>(max_step) * t -
+                           (min_value > 0 ? min_value : 0);
+    }
+  }
+  __syncthreads();
+
+  for (int32_t i = threadIdx.x; i < T * R; i += blockDim.x) {
+    int32_t r = i % R;
+    if (r != 0) this_ranges[i] = this_ranges[i - r] + r;
+  }
+}
+
+/*
+  Sets lm_pruned[row][d] = lm[b][ranges[row]][d], one thread per element
+  of lm_pruned; the rows are indexed by row = (b * T + t) * R + r.  Rows
+  with invalid ranges are set to 0.
+ */
+template <typename scalar_t>
+__global__ void rnnt_prune_gather_kernel(const scalar_t *lm,
+                                         const int64_t *ranges,
+                                         int64_t num_elements, int32_t TR,
+                                         int32_t S1, int32_t D,
+                                         scalar_t *lm_pruned) {
+  int64_t i = static_cast<int64_t>(blockIdx.x) * blockDim.x + threadIdx.x;
+  if (i >= num_elements) return;
+  int64_t row = i / D;
+  int32_t d = i % D, b = row / TR;
+  int64_t s = ranges[row];
+  lm_pruned[i] = (s >= 0 && s < S1 ? lm[(b * S1 + s) * D + d] : scalar_t(0));
+}
+
+// Backward of rnnt_prune_gather_kernel(); lm_grad must be zero-initialized.
+template <typename scalar_t>
+__global__ void rnnt_prune_gather_backward_kernel(
+    const scalar_t *lm_pruned_grad, const int64_t *ranges,
+    int64_t num_elements, int32_t TR, int32_t S1, int32_t D,
+    scalar_t *lm_grad) {
+  int64_t i = static_cast<int64_t>(blockIdx.x) * blockDim.x + threadIdx.x;
+  if (i >= num_elements) return;
+  int64_t row = i / D;
+  int32_t d = i % D, b = row / TR;
+  int64_t s = ranges[row];
+  if (s < 0 || s >= S1) return;
+  // Different frames of a sequence may keep the same symbol.
+  AtomicAdd(lm_grad + (b * S1 + s) * D + d, lm_pruned_grad[i]);
+}
+
+torch::Tensor RnntPruneRangesCuda(torch::Tensor px_grad,
+                                  torch::Tensor py_grad,
+                                  torch::Tensor boundary, int32_t s_range) {
+  TORCH_CHECK(px_grad.device().is_cuda() && py_grad.device().is_cuda() &&
+                  boundary.device().is_cuda(),
+              "inputs must be CUDA tensors");
+  int32_t dims[4];
+  CheckRnntPruneRangesArgs(px_grad, py_grad, boundary, s_range, dims);
+  const int B = dims[0], S = dims[1], T = dims[2], T1 = dims[3], R = s_range;
+  const int max_s_begin = S + 1 - R, max_step = (T1 == T ? 2 : R) - 1;
+
+  torch::Tensor ranges = torch::empty(
+      {B, T, R},
+      torch::TensorOptions().dtype(torch::kInt64).device(px_grad.device()));
+  if (B == 0 || T == 0) return ranges;
+
+  // num_threads can be tuned.
+  const int num_threads = 256;
+  cudaStream_t stream = c10::cuda::getCurrentCUDAStream();
+  AT_DISPATCH_FLOATING_TYPES(
+      px_grad.scalar_type(), "rnnt_prune_ranges_cuda_stub", ([&] {
+        K2_CUDA_SAFE_CALL(
+            rnnt_prune_ranges_kernel<scalar_t>
+            <<<B, num_threads, 0, stream>>>(
+                px_grad.packed_accessor32<scalar_t, 3>(),
+                py_grad.packed_accessor32<scalar_t, 3>(),
+                boundary.data_ptr<int64_t>(), T, R, max_s_begin, max_step,
+                ranges.data_ptr<int64_t>()));
+      }));
+  return ranges;
+}
+
+torch::Tensor RnntPruneGatherCuda(torch::Tensor lm, torch::Tensor ranges) {
+  TORCH_CHECK(lm.device().is_cuda() && ranges.device().is_cuda(),
+              "inputs must be CUDA tensors");
+  TORCH_CHECK(lm.dim() == 3, "lm must be 3-dimensional");
+  CheckRnntPruneGatherArgs(lm, ranges);
+  const int B = ranges.size(0), T = ranges.size(1), R = ranges.size(2),
+            S1 = lm.size(1), D = lm.size(2);
+
+  torch::Tensor lm_pruned = torch::empty({B, T, R, D}, lm.options());
+  int64_t num_elements = lm_pruned.numel();
+  if (num_elements == 0) return lm_pruned;
+
+  const int num_threads = 256;
+  const int64_t num_blocks = (num_elements + num_threads - 1) / num_threads;
+  cudaStream_t stream = c10::cuda::getCurrentCUDAStream();
+  AT_DISPATCH_FLOATING_TYPES(
+      lm.scalar_type(), "rnnt_prune_gather_cuda_stub", ([&] {
+        K2_CUDA_SAFE_CALL(
+            rnnt_prune_gather_kernel<scalar_t>
+            <<<num_blocks, num_threads, 0, stream>>>(
+                lm.data_ptr<scalar_t>(), ranges.data_ptr<int64_t>(),
+                num_elements, T * R, S1, D, lm_pruned.data_ptr<scalar_t>()));
+      }));
+  return lm_pruned;
+}
+
+torch::Tensor RnntPruneGatherBackwardCuda(torch::Tensor lm_pruned_grad,
+                                          torch::Tensor ranges, int32_t S1) {
+  TORCH_CHECK(lm_pruned_grad.device().is_cuda() && ranges.device().is_cuda(),
+              "inputs must be CUDA tensors");
+  TORCH_CHECK(lm_pruned_grad.dim() == 4,
+              "lm_pruned_grad must be 4-dimensional");
+  CheckRnntPruneGatherArgs(lm_pruned_grad, ranges);
+  const int B = ranges.size(0), T = ranges.size(1), R = ranges.size(2),
+            D = lm_pruned_grad.size(3);
+
+  torch::Tensor lm_grad = torch::zeros({B, S1, D}, lm_pruned_grad.options());
+  int64_t num_elements = lm_pruned_grad.numel();
+  if (num_elements == 0) return lm_grad;
+
+  const int num_threads = 256;
+  const int64_t num_blocks = (num_elements + num_threads - 1) / num_threads;
+  cudaStream_t stream = c10::cuda::getCurrentCUDAStream();
+  AT_DISPATCH_FLOATING_TYPES(
+      lm_pruned_grad.scalar_type(), "rnnt_prune_gather_backward_cuda_stub",
+      ([&] {
+        K2_CUDA_SAFE_CALL(
+            rnnt_prune_gather_backward_kernel<scalar_t>
+            <<<num_blocks, num_threads, 0, stream>>>(
+                lm_pruned_grad.data_ptr<scalar_t>(),
+                ranges.data_ptr<int64_t>(), num_elements, T * R, S1, D,
+                lm_grad.data_ptr<scalar_t>()));
+      }));
+  return lm_grad;
+}
+
+}  // namespace k2
@@ -24,7 +24,9 @@
 #include <utility>
 #include <vector>
 
+#include "k2/csrc/array_ops.h"
 #include "k2/csrc/ragged.h"
+#include "k2/csrc/ragged_ops.h"
 #include "k2/csrc/torch_util.h"
 #include "k2/python/csrc/torch/v2/any.h"
 #include "k2/python/csrc/torch/v2/doc/any.h"
@@ -33,6 +35,40 @@
 
 namespace k2 {
 
+// Returns `obj` if it is a torch.Tensor, else torch.as_tensor(obj), which
+// shares the memory of numpy arrays.
+static torch::Tensor AsTensor(py::object obj) {
+  if (THPVariable_Check(obj.ptr())) return obj.cast<torch::Tensor>();
+  return py::module::import("torch")
+      .attr("as_tensor")(obj)
+      .cast<torch::Tensor>();
+}
+
+/* Create a ragged tensor with 2 axes from its values and the lengths of its
+   rows; see kCreateRaggedTensorFromLengthsDoc.
+ */
+static RaggedAny RaggedAnyFromLengths(torch::Tensor values,
+                                      torch::Tensor lengths) {
+  K2_CHECK_EQ(values.dim(), 1) << "Expect a 1-D tensor of values";
+  K2_CHECK_EQ(lengths.dim(), 1) << "Expect a 1-D tensor of lengths";
+  if (values.scalar_type() == torch::kLong) values = values.to(torch::kInt);
+  ContextPtr c = GetContext(values);
+  DeviceGuard guard(c);
+  lengths = lengths.to(values.device(), torch::kInt).contiguous();
+
+  int32_t num_rows = lengths.numel();
+  K2_CHECK(num_rows == 0 || lengths.min().item<int32_t>() >= 0)
+      << "Lengths must be non-negative";
+  Array1<int32_t> row_splits(c, num_rows + 1);
+  row_splits.Arange(0, num_rows).CopyFrom(FromTorch<int32_t>(lengths));
+  ExclusiveSum(row_splits, &row_splits);
+  int32_t tot_size = row_splits.Back();
+  K2_CHECK_EQ(tot_size, values.size(0))
+      << "The lengths must sum to the number of values";
+  RaggedShape shape = RaggedShape2(&row_splits, nullptr, tot_size);
+  return RaggedAny(shape, values.contiguous());
+}
+
 void PybindRaggedAny(py::module &m) {
   py::class_<RaggedAny> any(m, "RaggedTensor");
 
@@ -151,8 +187,10 @@ void PybindRaggedAny(py::module &m) {
       py::arg("key"), kRaggedAnyGetItem1DTensorDoc);
 
   any.def("index",
-          static_cast<RaggedAny (RaggedAny::*)(RaggedAny &)>(&RaggedAny::Index),
-          py::arg("indexes"), kRaggedAnyRaggedIndexDoc);
+          static_cast<RaggedAny (RaggedAny::*)(RaggedAny &, bool)>(
+              &RaggedAny::Index),
+          py::arg("indexes"), py::arg("remove_axis") = false,
+          kRaggedAnyRaggedIndexDoc);
 
   any.def("index",
           static_cast<std::pair<RaggedAny, torch::optional<torch::Tensor>> (
@@ -178,11 +216,13 @@ void PybindRaggedAny(py::module &m) {
 
   any.def(
       "to",
-      [](RaggedAny &self, py::object device) -> RaggedAny {
+      [](RaggedAny &self, py::object device,
+         bool non_blocking = false) -> RaggedAny {
         std::string device_str = device.is_none() ? "cpu" : py::str(device);
-        return self.To(torch::Device(device_str));
+        return self.To(torch::Device(device_str), non_blocking);
       },
-      py::arg("device"), kRaggedAnyToDeviceDoc);
+      py::arg("device"), py::arg("non_blocking") = false,
+      kRaggedAnyToDeviceDoc);
 
   any.def("to",
           static_cast<RaggedAny (RaggedAny::*)(const std::string &) const>(
@@ -194,6 +234,8 @@ void PybindRaggedAny(py::module &m) {
               &RaggedAny::To),
           py::arg("dtype"), kRaggedAnyToDtypeDoc);
 
+  any.def("pin_memory", &RaggedAny::PinMemory, kRaggedAnyPinMemoryDoc);
+
   any.def(
       "clone",
       [](const RaggedAny &self) -> RaggedAny {
@@ -352,6 +394,7 @@ void PybindRaggedAny(py::module &m) {
           kRaggedAnyNormalizeDoc);
 
   any.def("pad", &RaggedAny::Pad, py::arg("mode"), py::arg("padding_value"),
+          py::arg("max_len") = -1, py::arg("out") = py::none(),
           kRaggedAnyPadDoc);
 
   any.def("tolist", &RaggedAny::ToList, kRaggedAnyToListDoc);
@@ -492,6 +535,14 @@ void PybindRaggedAny(py::module &m) {
       "create_ragged_tensor",
       [](torch::Tensor tensor) -> RaggedAny { return RaggedAny(tensor); },
       py::arg("tensor"), kCreateRaggedTensorTensorDoc);
+
+  m.def(
+      "create_ragged_tensor_from_lengths",
+      [](py::object values, py::object lengths) -> RaggedAny {
+        return RaggedAnyFromLengths(AsTensor(values), AsTensor(lengths));
+      },
+      py::arg("values"), py::arg("lengths"),
+      kCreateRaggedTensorFromLengthsDoc);
 }
 
 }  // namespace k2
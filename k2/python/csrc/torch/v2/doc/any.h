@@ -507,15 +507,41 @@ device(type='cpu')
 >>> b = a.to(torch.device('cuda', 0))
 >>> b.device
 device(type='cuda', index=0)
+>>> c = a.pin_memory().to(torch.device('cuda', 0), non_blocking=True)
 
 Args:
   device:
     The target device to move this tensor.
+  non_blocking:
+    If ``True`` and ``self`` is on CPU, copy it to a CUDA device with one
+    transfer that is queued on the current CUDA stream, without waiting
+    for it.  The row_splits and values are first packed into one pinned
+    buffer, unless ``self`` was returned by :func:`pin_memory`.
 
 Returns:
   Return a tensor on the given device.
 )doc";
 
+static constexpr const char *kRaggedAnyPinMemoryDoc = R"doc(
+Return a copy of this tensor in pinned (page-locked) memory, with the
+row_splits of all axes and the values packed into one buffer, so that
+``to(device, non_blocking=True)`` copies it to a CUDA device with a single
+asynchronous transfer.  This is meant to be done in data-loader workers.
+
+>>> import torch
+>>> import k2.ragged as k2r
+>>> a = k2r.RaggedTensor([[1], [2, 3]]).pin_memory()
+>>> a.device
+device(type='cpu')
+>>> b = a.to(torch.device('cuda', 0), non_blocking=True)
+>>> b
+RaggedTensor([[1],
+              [2, 3]], device='cuda:0', dtype=torch.int32)
+
+Returns:
+  Return a tensor on CPU in pinned memory.
+)doc";
+
 static constexpr const char *kRaggedAnyToDeviceStrDoc = R"doc(
 Transfer this tensor to a given device.
 
@@ -1832,9 +1858,56 @@ Args:
     If a list is empty, then the given `padding_value` is also used for filling.
   padding_value:
     The filling value.
+  max_len:
+    If not negative, the number of columns of the result, e.g. a bound on
+    the list sizes that the caller already knows; this avoids computing the
+    maximum list size, which on CUDA needs a device-to-host copy. Entries of
+    lists longer than this are dropped.
+  out:
+    If given, a 2-D tensor with the same dtype and device as ``self``, with
+    ``self.dim0`` rows and a stride of 1 in its second dimension, into which
+    the result is written; its number of columns is used as ``max_len``.
 
 Returns:
-  A 2-D torch tensor, sharing the same dtype and device with ``self``.
+  A 2-D torch tensor, sharing the same dtype and device with ``self``
+  (``out``, if given).
+)doc";
+
+static constexpr const char *kCreateRaggedTensorFromLengthsDoc = R"doc(
+Create a ragged tensor with two axes from its values and the lengths of its
+rows, e.g. a batch of transcripts given as the concatenation of the token IDs
+and the number of tokens of each.  This does not walk Python lists, so it is
+much faster than :func:`create_ragged_tensor` on lists.
+
+>>> import numpy as np
+>>> import torch
+>>> import k2.ragged as k2r
+>>> a = k2r.create_ragged_tensor_from_lengths(
+...         torch.tensor([1, 2, 5, 9], dtype=torch.int32),
+...         torch.tensor([2, 1, 0, 1]))
+>>> a
+RaggedTensor([[1, 2],
+              [5],
+              [],
+              [9]], dtype=torch.int32)
+>>> b = k2r.create_ragged_tensor_from_lengths(
+...         np.array([0.5, 1.5], dtype=np.float32), np.array([0, 2]))
+>>> b
+RaggedTensor([[],
+              [0.5, 1.5]], dtype=torch.float32)
+
+Args:
+  values:
+    A 1-D torch tensor or numpy array with the values of all rows, one row
+    after another.  Supported dtypes are ``torch.int32``, ``torch.int64``
+    (which is converted to ``torch.int32``), ``torch.float32`` and
+    ``torch.float64``.  If it is a contiguous torch tensor of one of the
+    other dtypes, the returned tensor shares memory with it.
+  lengths:
+    A 1-D torch tensor or numpy array of integers with the number of values
+    in each row; they must sum to ``values.numel()``.
+Returns:
+  Return a ragged tensor on the device of ``values``.
 )doc";
 
 static constexpr const char *kRaggedAnyToListDoc = R"doc(
@@ -1939,12 +2012,28 @@ Index a ragged tensor with a ragged tensor.
                    [],
                    [2]]]]], dtype=torch.int32)
 
+**Example 3**:
+
+  >>> import k2.ragged as k2r
+  >>> src = k2r.RaggedTensor([[10, 10], [11], [12, 12]])
+  >>> i = k2r.RaggedTensor([[2, -1, 0], [], [1]])
+  >>> src.index(i, remove_axis=True)
+  RaggedTensor([[12, 12, 10, 10],
+                [],
+                [11]], dtype=torch.int32)
+
 Args:
   indexes:
-    Its values must satisfy ``0 <= values[i] < self.dim0``.
+    Its values must satisfy ``0 <= values[i] < self.dim0``. If
+    ``remove_axis`` is True and both ``self`` and ``indexes`` have 2 axes,
+    -1 is also allowed and contributes nothing to the result.
 
     Caution:
       Its dtype has to be ``torch.int32``.
+  remove_axis:
+    If True, remove the last-but-one axis of the result, i.e., concatenate
+    the sublists that each sublist of ``indexes`` selects. This is faster
+    than calling :func:`remove_axis` on the result.
 
 Returns:
   Return indexed tensor.
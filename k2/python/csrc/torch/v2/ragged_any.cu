@@ -78,6 +78,40 @@ void RaggedAnyToStringIter(std::ostream &os, const Ragged<T> ragged,
   }
 }
 
+/** Convert a Python number to T.  Python ints and floats, which is what
+   we normally get, are converted with the C API of Python, which is much
+   faster than pybind11's casts; other objects, and ints that overflow T,
+   are left to py::cast(), which throws py::cast_error if they can't be
+   converted.
+ */
+template <typename T>
+static T PyToNumber(PyObject *obj) {
+  if (PyFloat_CheckExact(obj)) return static_cast<T>(PyFloat_AS_DOUBLE(obj));
+  return py::cast<T>(py::handle(obj));
+}
+
+template <>
+int32_t PyToNumber<int32_t>(PyObject *obj) {
+  if (PyLong_CheckExact(obj)) {
+    int overflow = 0;
+    long v = PyLong_AsLongAndOverflow(obj, &overflow);  // NOLINT
+    if (overflow == 0 && v >= std::numeric_limits<int32_t>::min() &&
+        v <= std::numeric_limits<int32_t>::max())
+      return static_cast<int32_t>(v);
+  }
+  return py::cast<int32_t>(py::handle(obj));
+}
+
+// Append the numbers in the list `data` to `elems`.
+template <typename T>
+static void AppendElements(py::list data, std::vector<T> *elems) {
+  PyObject *list = data.ptr();
+  Py_ssize_t n = PyList_GET_SIZE(list);
+  elems->reserve(elems->size() + n);
+  for (Py_ssize_t i = 0; i != n; ++i)
+    elems->push_back(PyToNumber<T>(PyList_GET_ITEM(list, i)));
+}
+
 /** One iteration of RaggedAnyFromList.
 
   @param data It is a list or a list-of sublist(s).
@@ -131,8 +165,7 @@ static void RaggedAnyFromListIter(py::list data, int32_t *cur_level,
       throw std::runtime_error("Expect a [");
     }
 
-    auto tmp = data.cast<std::vector<T>>();
-    elems->insert(elems->end(), tmp.begin(), tmp.end());
+    AppendElements(data, elems);
   }
 
   *cur_level -= 1;
@@ -169,14 +202,14 @@ static Ragged<T> RaggedAnyFromList(py::list data) {
     row_splits.push_back(std::vector<int32_t>(1, 0));
   }
 
-  std::vector<RaggedShapeLayer> axes(row_splits.size());
+  RaggedShapeLayers axes(row_splits.size());
   ContextPtr c = GetCpuContext();
   for (size_t i = 0; i != row_splits.size(); ++i) {
     axes[i].row_splits = Array1<int32_t>(c, row_splits[i]);
     axes[i].cached_tot_size = row_splits[i].back();
   }
   Ragged<T> ans;
-  ans.shape = RaggedShape(axes);
+  ans.shape = RaggedShape(std::move(axes));
   ans.values = Array1<T>(c, elems);
   if (ans.values.Dim() != ans.shape.NumElements()) {
     throw std::runtime_error("Invalid format of a ragged tensor");
@@ -363,7 +396,8 @@ std::string RaggedAny::ToString(bool compact /*=false*/,
   return os.str();
 }
 
-RaggedAny RaggedAny::To(torch::Device device) const {
+RaggedAny RaggedAny::To(torch::Device device,
+                        bool non_blocking /*= false*/) const {
   ContextPtr context = any.Context();
   if (device.is_cpu()) {
     // CPU -> CPU
@@ -386,9 +420,18 @@ RaggedAny RaggedAny::To(torch::Device device) const {
   // CPU to CUDA
   // or from one GPU to another GPU
   DeviceGuard guard(device_index);
+  if (non_blocking) {
+    Ragged<Any> &src = const_cast<Ragged<Any> &>(any);
+    return RaggedAny(PackedTo(src, GetCudaContext(device_index)));
+  }
   return RaggedAny(any.To(GetCudaContext(device_index)));
 }
 
+RaggedAny RaggedAny::PinMemory() const {
+  DeviceGuard guard(any.Context());
+  return RaggedAny(k2::PinMemory(const_cast<Ragged<Any> &>(any)));
+}
+
 RaggedAny RaggedAny::To(const std::string &device) const {
   torch::Device d(device);
   return this->To(d);
@@ -600,47 +643,76 @@ RaggedAny RaggedAny::Normalize(bool use_log) /*const*/ {
   return out;
 }
 
-torch::Tensor RaggedAny::Pad(const std::string &mode,
-                             py::object padding_value) /*const*/ {
+torch::Tensor RaggedAny::Pad(const std::string &mode, py::object padding_value,
+                             int32_t max_len /*= -1*/,
+                             torch::optional<torch::Tensor> out
+                             /*= {}*/) /*const*/ {
   K2_CHECK((bool)padding_value);
   K2_CHECK(!padding_value.is_none());
 
   DeviceGuard guard(any.Context());
   Dtype t = any.GetDtype();
   FOR_REAL_AND_INT32_TYPES(t, T, {
-    Array2<T> arr =
-        PadRagged(any.Specialize<T>(), mode, padding_value.cast<T>());
+    if (out.has_value()) {
+      Array2<T> arr = FromTorch<T>(out.value(), Array2Tag{});
+      PadRagged(any.Specialize<T>(), mode, padding_value.cast<T>(), &arr);
+      return out.value();
+    }
+    Array2<T> arr = PadRagged(any.Specialize<T>(), mode,
+                              padding_value.cast<T>(), max_len);
     return ToTorch(arr);
   });
   // Unreachable code
   return {};
 }
 
-template <typename T>
-static py::list ToList(Ragged<T> &src, int32_t axis, int32_t begin,
-                       int32_t end) {
-  // assuming src is on CPU
-  int32_t num_axes = src.NumAxes();
-
-  K2_CHECK_GE(axis, 0);
-  K2_CHECK_LT(axis, num_axes);
-  K2_CHECK_LE(begin, end);
-  K2_CHECK_LE(end, src.TotSize(axis));
+// Return a new reference to a Python number; nullptr on failure.
+static PyObject *NumberToPy(int32_t v) { return PyLong_FromLong(v); }
+static PyObject *NumberToPy(float v) { return PyFloat_FromDouble(v); }
+static PyObject *NumberToPy(double v) { return PyFloat_FromDouble(v); }
 
+/* Return a new list whose elements are the objects in
+   [children[begin], children[end]), whose references are stolen.
+ */
+static py::list StealIntoList(std::vector<py::object> &children,
+                              int32_t begin, int32_t end) {
   py::list ans(end - begin);
-  if (axis == num_axes - 1) {
-    const T *data = src.values.Data();
-    // recursion ends here
-    for (int32_t i = begin; i != end; ++i) {
-      ans[i - begin] = data[i];
-    }
-  } else {
-    const int32_t *data = src.RowSplits(axis + 1).Data();
-    for (int32_t i = begin; i != end; ++i) {
-      ans[i - begin] = ToList(src, axis + 1, data[i], data[i + 1]);
+  for (int32_t i = begin; i != end; ++i)
+    PyList_SET_ITEM(ans.ptr(), i - begin, children[i].release().ptr());
+  return ans;
+}
+
+/* Turn `src` (which must be on CPU) into nested lists.  The lists are built
+   bottom-up, one axis at a time, with the C API of Python, instead of
+   recursively with pybind11 accessors, which is much faster for large
+   tensors.
+ */
+template <typename T>
+static py::list ToList(Ragged<T> &src) {
+  int32_t num_axes = src.NumAxes();
+  const T *values_data = src.values.Data();
+  // lists[i] is the list for the i'th sub-list on the current axis.
+  std::vector<py::object> lists(src.TotSize(num_axes - 2));
+  const int32_t *row_splits_data = src.RowSplits(num_axes - 1).Data();
+  for (size_t i = 0; i != lists.size(); ++i) {
+    int32_t begin = row_splits_data[i], end = row_splits_data[i + 1];
+    py::list list(end - begin);
+    for (int32_t j = begin; j != end; ++j) {
+      PyObject *obj = NumberToPy(values_data[j]);
+      if (obj == nullptr) throw py::error_already_set();
+      PyList_SET_ITEM(list.ptr(), j - begin, obj);
     }
+    lists[i] = std::move(list);
   }
-  return ans;
+  for (int32_t axis = num_axes - 2; axis >= 1; --axis) {
+    std::vector<py::object> parents(src.TotSize(axis - 1));
+    row_splits_data = src.RowSplits(axis).Data();
+    for (size_t i = 0; i != parents.size(); ++i)
+      parents[i] =
+          StealIntoList(lists, row_splits_data[i], row_splits_data[i + 1]);
+    lists.swap(parents);
+  }
+  return StealIntoList(lists, 0, static_cast<int32_t>(lists.size()));
 }
 
 py::list RaggedAny::ToList() /*const*/ {
@@ -650,8 +722,7 @@ py::list RaggedAny::ToList() /*const*/ {
 
   Dtype t = any.GetDtype();
   FOR_REAL_AND_INT32_TYPES(t, T, {
-    return k2::ToList(any.Specialize<T>(), /*axis*/ 0, /*begin*/ 0,
-                      /*end*/ any.Dim0());
+    return k2::ToList(any.Specialize<T>());
   });
 
   // Unreachable code
@@ -684,13 +755,13 @@ torch::optional<torch::Tensor> RaggedAny::Sort(
   return ans;
 }
 
-RaggedAny RaggedAny::Index(RaggedAny &indexes) /*const*/ {
+RaggedAny RaggedAny::Index(RaggedAny &indexes,
+                           bool remove_axis /*= false*/) /*const*/ {
   K2_CHECK_EQ(indexes.any.GetDtype(), kInt32Dtype)
       << "Unsupported dtype: " << TraitsOf(indexes.any.GetDtype()).Name();
 
   DeviceGuard guard(any.Context());
 
-  bool remove_axis = false;
   Dtype t = any.GetDtype();
   FOR_REAL_AND_INT32_TYPES(t, T, {
     return RaggedAny(k2::Index<T>(any.Specialize<T>(),
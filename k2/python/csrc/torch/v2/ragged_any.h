@@ -144,10 +144,13 @@ struct RaggedAny {
 
      @param device  A torch device, which can be either a CPU device
                     or a CUDA device.
+     @param non_blocking  If true and this tensor is on CPU, copy it to
+                    a CUDA device with one asynchronous transfer; see
+                    PackedTo() in ragged_ops.h.
 
      @return Return a ragged tensor on the given device.
    */
-  RaggedAny To(torch::Device device) const;
+  RaggedAny To(torch::Device device, bool non_blocking = false) const;
 
   /** Move this tensor to a given device.
 *
@@ -177,6 +180,10 @@ struct RaggedAny {
   /// Return a copy of this ragged tensor
   RaggedAny Clone() const;
 
+  /// Return a copy of this tensor packed into pinned memory; see
+  /// PinMemory() in ragged_ops.h.
+  RaggedAny PinMemory() const;
+
   /** Enable/Disable requires_grad of this tensor
 
      @param requires_grad True to require grad for this tensors.
@@ -251,8 +258,9 @@ struct RaggedAny {
   RaggedAny Normalize(bool use_log) /*const*/;
 
   /// Wrapper for k2::PadRagged
-  torch::Tensor Pad(const std::string &mode,
-                    py::object padding_value) /*const*/;
+  torch::Tensor Pad(const std::string &mode, py::object padding_value,
+                    int32_t max_len = -1,
+                    torch::optional<torch::Tensor> out = {}) /*const*/;
 
   /// Convert a ragged tensor to a list of lists [of lists ...]
   /// Note: You can use the return list to construct a ragged tensor.
@@ -263,7 +271,7 @@ struct RaggedAny {
                                       bool need_new2old_indexes = false);
 
   /// Wrapper for k2::Index
-  RaggedAny Index(RaggedAny &indexes) /*const*/;
+  RaggedAny Index(RaggedAny &indexes, bool remove_axis = false) /*const*/;
 
   /// Wrapper for k2::Index
   std::pair<RaggedAny, torch::optional<torch::Tensor>> Index(
@@ -60,13 +60,17 @@ from .fsa_algo import determinize
 from .fsa_algo import expand_ragged_attributes
 from .fsa_algo import intersect
 from .fsa_algo import intersect_device
+from .fsa_algo import intersect_dense_pruned_composed
 from .fsa_algo import invert
 from .fsa_algo import levenshtein_alignment
+from .fsa_algo import levenshtein_distance
 from .fsa_algo import levenshtein_graph
 from .fsa_algo import linear_fsa
 from .fsa_algo import linear_fsa_with_self_loops
 from .fsa_algo import linear_fst
 from .fsa_algo import linear_fst_with_self_loops
+from .fsa_algo import minimize
+from .fsa_algo import normalize_lattice
 from .fsa_algo import prune_on_arc_post
 from .fsa_algo import random_paths
 from .fsa_algo import remove_epsilon
@@ -75,12 +79,14 @@ from .fsa_algo import remove_epsilon_self_loops
 from .fsa_algo import replace_fsa
 from .fsa_algo import reverse
 from .fsa_algo import shortest_path
+from .fsa_algo import to_word_lattice
 from .fsa_algo import top_sort
 from .fsa_algo import trivial_graph
 from .fsa_algo import union
 from .fsa_properties import to_str as properties_to_str
 from .mutual_information import joint_mutual_information_recursion
 from .mutual_information import mutual_information_recursion
+from .mutual_information import mutual_information_recursion_packed
 from .mwer_loss import MWERLoss
 from .mwer_loss import mwer_loss
 from .nbest import Nbest
@@ -15,6 +15,7 @@
 # See the License for the specific language governing permissions and
 # limitations under the License.
 
+from typing import Dict
 from typing import List
 from typing import Optional
 from typing import Tuple
@@ -23,6 +24,7 @@ import torch
 import _k2
 import k2
 
+from . import fsa_properties
 from .fsa import Fsa
 from .dense_fsa_vec import DenseFsaVec
 
@@ -94,7 +96,16 @@ class _GetTotScoresFunction(torch.autograd.Function):
         use_double_scores = ctx.use_double_scores
         scores, = ctx.saved_tensors
 
-        if log_semiring is False:
+        if fsas.properties & fsa_properties.LINEAR:
+            # Every arc is on the only path of its FSA, in either semiring.
+            tot_scores = fsas._get_tot_scores(use_double_scores, log_semiring)
+            if use_double_scores:
+                bprop_func = _k2.get_tot_scores_of_linear_fsas_double_backward
+            else:
+                bprop_func = _k2.get_tot_scores_of_linear_fsas_float_backward
+            scores_grad = bprop_func(fsas.arcs, tot_scores, tot_scores_grad)
+            return None, None, None, scores_grad
+        elif log_semiring is False:
             entering_arcs = fsas._get_entering_arcs(use_double_scores)
             _, ragged_int = _k2.shortest_path(fsas.arcs, entering_arcs)
             if use_double_scores:
@@ -347,6 +358,55 @@ class _GetArcPostFunction(torch.autograd.Function):
         )
 
 
+def _sparse_log_probs_grad(arc_map_b: torch.Tensor,
+                           out_fsa_grad: torch.Tensor,
+                           log_probs_rows: torch.Tensor,
+                           log_probs: torch.Tensor) -> torch.Tensor:
+    '''Backprop of the arc scores of intersect_dense_pruned() into the
+    `log_probs` that its DenseFsaVec was constructed from.
+
+    Only the (frame, symbol) pairs used by the arcs are touched: the gradient
+    w.r.t. `b_fsas.scores` is kept as sorted, coalesced (index, value) pairs
+    instead of a dense matrix, and scattered into the layout of `log_probs`
+    without atomic adds, so the result is deterministic.
+
+    Args:
+      arc_map_b:
+        The map from the arcs of the output to elements of `b_fsas.scores`.
+      out_fsa_grad:
+        The gradient w.r.t. the scores of the output.
+      log_probs_rows:
+        Maps rows of `b_fsas.scores` to rows of `log_probs.reshape(-1, C)`,
+        with -1 for the rows it does not come from; see
+        `DenseFsaVec._log_probs_rows`.
+      log_probs:
+        The `log_probs` of shape `(N, T, C)` given to DenseFsaVec.
+    Returns:
+      Return the gradient w.r.t. `log_probs`.
+    '''
+    num_classes = log_probs.shape[-1]
+    index, value = _k2.index_add_sparse(arc_map_b, out_fsa_grad)
+
+    # b_fsas.scores has one more column than log_probs
+    row = index // (num_classes + 1)
+    col = index % (num_classes + 1)
+    row = log_probs_rows[row.long()]
+    index = row * num_classes + col - 1
+    # Column 0 and the extra row of the last frame are constants added
+    # by DenseFsaVec.
+    index[(col == 0) | (row < 0)] = -1
+
+    # Supervision segments may overlap, in which case some rows of
+    # log_probs appear more than once in b_fsas.scores.
+    index, value = _k2.index_add_sparse(index, value)
+
+    grad = torch.zeros(log_probs.shape,
+                       dtype=out_fsa_grad.dtype,
+                       device=log_probs.device)
+    grad.view(-1)[index.long()] = value
+    return grad
+
+
 class _IntersectDensePrunedFunction(torch.autograd.Function):
 
     @staticmethod
@@ -361,7 +421,14 @@ class _IntersectDensePrunedFunction(torch.autograd.Function):
                 unused_scores_a: torch.Tensor,
                 unused_scores_b: torch.Tensor,
                 seqframe_idx_name: Optional[str] = None,
-                frame_idx_name: Optional[str] = None) -> torch.Tensor:
+                frame_idx_name: Optional[str] = None,
+                lattice_beam: float = 0,
+                need_entering_arcs: bool = False,
+                one_best: bool = False,
+                max_active_arcs: int = 0,
+                stats: Optional[Dict[str, torch.Tensor]] = None,
+                b_to_a_map: Optional[torch.Tensor] = None
+                ) -> torch.Tensor:
         '''Intersect array of FSAs on CPU/GPU.
 
         Args:
@@ -369,7 +436,8 @@ class _IntersectDensePrunedFunction(torch.autograd.Function):
             Input FsaVec, i.e., `decoding graphs`, one per sequence. It might
             just be a linear sequence of phones, or might be something more
             complicated. Must have either `a_fsas.shape[0] == b_fsas.dim0()`, or
-            `a_fsas.shape[0] == 1` in which case the graph is shared.
+            `a_fsas.shape[0] == 1` in which case the graph is shared, unless
+            `b_to_a_map` is given.
           b_fsas:
             Input FSAs that correspond to neural network output.
           out_fsa:
@@ -397,8 +465,10 @@ class _IntersectDensePrunedFunction(torch.autograd.Function):
             It equals to `a_fsas.scores` and its sole purpose is for back
             propagation.
           unused_scores_b:
-            It equals to `b_fsas.scores` and its sole purpose is for back
-            propagation.
+            It equals to `b_fsas.scores`, or to the `log_probs` that b_fsas
+            was constructed from, and its sole purpose is for back
+            propagation.  In the latter case the gradient w.r.t. it is
+            computed without a dense gradient for `b_fsas.scores`.
           seqframe_idx_name:
             If set (e.g. to 'seqframe'), an attribute in the output will be
             created that encodes the sequence-index and the frame-index within
@@ -407,20 +477,62 @@ class _IntersectDensePrunedFunction(torch.autograd.Function):
           frame_idx_name:
             If set (e.g. to 'frame', an attribute in the output will be created
             that contains the frame-index within the corresponding sequence.
+          lattice_beam:
+            If > 0 and less than `output_beam`, prune the output to this beam
+            after the search; see :func:`intersect_dense_pruned`.
+          need_entering_arcs:
+            If true, cache the best arc entering each state of the output,
+            see :func:`intersect_dense_pruned`.
+          one_best:
+            If true, return only the best path; see
+            :func:`intersect_dense_pruned`.
+          max_active_arcs:
+            If > 0, a target for the number of arcs per frame over the whole
+            batch; see :func:`intersect_dense_pruned`.
+          stats:
+            If not None, statistics of the search are written to it; see
+            :func:`intersect_dense_pruned`.
+          b_to_a_map:
+            If not None, the index of the graph in `a_fsas` of each sequence;
+            see :func:`intersect_dense_pruned`.
         Returns:
            Return `out_fsa[0].scores`.
         '''
         assert len(out_fsa) == 1
 
-        ragged_arc, arc_map_a, arc_map_b = _k2.intersect_dense_pruned(
-            a_fsas=a_fsas.arcs,
-            b_fsas=b_fsas.dense_fsa_vec,
-            search_beam=search_beam,
-            output_beam=output_beam,
-            min_active_states=min_active_states,
-            max_active_states=max_active_states)
+        if one_best:
+            ragged_arc, arc_map_a, arc_map_b = \
+                _k2.intersect_dense_pruned_one_best(
+                    a_fsas=a_fsas.arcs,
+                    b_fsas=b_fsas.dense_fsa_vec,
+                    search_beam=search_beam,
+                    min_active_states=min_active_states,
+                    max_active_states=max_active_states,
+                    b_to_a_map=b_to_a_map)
+            entering_arcs = None
+        else:
+            ragged_arc, arc_map_a, arc_map_b, entering_arcs, stats_list = \
+                _k2.intersect_dense_pruned(
+                    a_fsas=a_fsas.arcs,
+                    b_fsas=b_fsas.dense_fsa_vec,
+                    search_beam=search_beam,
+                    output_beam=output_beam,
+                    min_active_states=min_active_states,
+                    max_active_states=max_active_states,
+                    lattice_beam=lattice_beam,
+                    need_entering_arcs=need_entering_arcs,
+                    max_active_arcs=max_active_arcs,
+                    need_stats=stats is not None,
+                    b_to_a_map=b_to_a_map)
+            if stats is not None:
+                stats.update(
+                    zip(('num_states', 'num_arcs', 'beams',
+                         'num_output_arcs'), stats_list))
 
         out_fsa[0] = Fsa(ragged_arc)
+        if entering_arcs is not None:
+            # It is used by k2.shortest_path(); see Fsa._get_entering_arcs().
+            out_fsa[0]._cache['entering_arcs'] = entering_arcs
 
         for name, a_value in a_fsas.named_tensor_attr(include_scores=False):
             if isinstance(a_value, torch.Tensor):
@@ -442,6 +554,12 @@ class _IntersectDensePrunedFunction(torch.autograd.Function):
         ctx.arc_map_b = arc_map_b
 
         ctx.save_for_backward(unused_scores_a, unused_scores_b)
+        if unused_scores_b is b_fsas.scores:
+            ctx.b_log_probs_rows = None
+        else:
+            # It is the `log_probs` that b_fsas was constructed from; see
+            # intersect_dense_pruned().
+            ctx.b_log_probs_rows = b_fsas._log_probs_rows
 
         seqframe_idx = None
         if frame_idx_name is not None:
@@ -476,14 +594,20 @@ class _IntersectDensePrunedFunction(torch.autograd.Function):
                              device=a_scores.device,
                              requires_grad=False)
 
-        grad_b = torch.zeros(
-            *b_scores.shape,
-            dtype=out_fsa_grad.dtype,
-            device=b_scores.device,
-            requires_grad=False).contiguous()  # will use its `view()` later
+        deterministic = k2.ops._deterministic_index_add()
+        _k2.index_add(arc_map_a, out_fsa_grad, grad_a, deterministic)
 
-        _k2.index_add(arc_map_a, out_fsa_grad, grad_a)
-        _k2.index_add(arc_map_b, out_fsa_grad, grad_b.view(-1))
+        if ctx.b_log_probs_rows is not None:
+            grad_b = _sparse_log_probs_grad(arc_map_b, out_fsa_grad,
+                                            ctx.b_log_probs_rows, b_scores)
+        else:
+            grad_b = torch.zeros(
+                *b_scores.shape,
+                dtype=out_fsa_grad.dtype,
+                device=b_scores.device,
+                requires_grad=False).contiguous()  # will use its `view()` later
+            _k2.index_add(arc_map_b, out_fsa_grad, grad_b.view(-1),
+                          deterministic)
 
         return (
             None,  # a_fass
@@ -496,7 +620,13 @@ class _IntersectDensePrunedFunction(torch.autograd.Function):
             grad_a,  # unused_scores_a
             grad_b,  # unused_scores_b
             None,  # seqframe_idx_name
-            None  # frame_idx_name
+            None,  # frame_idx_name
+            None,  # lattice_beam
+            None,  # need_entering_arcs
+            None,  # one_best
+            None,  # max_active_arcs
+            None,  # stats
+            None  # b_to_a_map
         )
 
 
@@ -628,8 +758,9 @@ class _IntersectDenseFunction(torch.autograd.Function):
             device=b_scores.device,
             requires_grad=False).contiguous()  # will use its `view()` later
 
-        _k2.index_add(arc_map_a, out_fsa_grad, grad_a)
-        _k2.index_add(arc_map_b, out_fsa_grad, grad_b.view(-1))
+        deterministic = k2.ops._deterministic_index_add()
+        _k2.index_add(arc_map_a, out_fsa_grad, grad_a, deterministic)
+        _k2.index_add(arc_map_b, out_fsa_grad, grad_b.view(-1), deterministic)
 
         return (
             None,  # a_fsas
@@ -653,7 +784,14 @@ def intersect_dense_pruned(a_fsas: Fsa,
                            min_active_states: int,
                            max_active_states: int,
                            seqframe_idx_name: Optional[str] = None,
-                           frame_idx_name: Optional[str] = None) -> Fsa:
+                           frame_idx_name: Optional[str] = None,
+                           lattice_beam: float = 0,
+                           need_entering_arcs: bool = False,
+                           one_best: bool = False,
+                           max_active_arcs: int = 0,
+                           stats: Optional[Dict[str, torch.Tensor]] = None,
+                           b_to_a_map: Optional[torch.Tensor] = None
+                           ) -> Fsa:
     '''Intersect array of FSAs on CPU/GPU.
 
     Caution:
@@ -664,7 +802,8 @@ def intersect_dense_pruned(a_fsas: Fsa,
         Input FsaVec, i.e., `decoding graphs`, one per sequence. It might just
         be a linear sequence of phones, or might be something more complicated.
         Must have either `a_fsas.shape[0] == b_fsas.dim0()`, or
-        `a_fsas.shape[0] == 1` in which case the graph is shared.
+        `a_fsas.shape[0] == 1` in which case the graph is shared, unless
+        `b_to_a_map` is given.
       b_fsas:
         Input FSAs that correspond to neural network output.
       search_beam:
@@ -692,6 +831,47 @@ def intersect_dense_pruned(a_fsas: Fsa,
       frame_idx_name:
         If set (e.g. to 'frame', an attribute in the output will be created
         that contains the frame-index within the corresponding sequence.
+      lattice_beam:
+        If > 0 and less than `output_beam`, the output is pruned once more
+        after the search, keeping only arcs on a path within `lattice_beam`
+        of the best path (i.e. whose Viterbi arc posterior is at least
+        `exp(-lattice_beam)`).  This is cheaper than pruning the returned
+        lattice afterwards, since the larger lattice is never created.
+      need_entering_arcs:
+        If true, the best arc entering each state of the output is found
+        from the forward scores of the search and cached in the output, so
+        that :func:`k2.shortest_path` on it (with unchanged scores) does not
+        have to compute forward scores over the whole lattice.
+      one_best:
+        If true, return the best path of the intersection instead of the
+        lattice, as :func:`k2.shortest_path` on the lattice would (with
+        `use_double_scores=False`, up to ties).  Only the best arc entering
+        each active state is kept during the search, so this is faster and
+        uses less memory than computing the lattice first.  `output_beam`,
+        `lattice_beam`, `need_entering_arcs`, `max_active_arcs` and `stats`
+        are ignored in this case.
+      max_active_arcs:
+        If > 0, a target for the total number of arcs on a frame, over all
+        the sequences of the batch.  While it is exceeded, the beams of all
+        sequences are reduced together, recovering gradually once it is not;
+        this is on top of `min_active_states` and `max_active_states`, which
+        act per sequence.  It bounds the work per frame (and so the latency)
+        of large batches at some cost in accuracy.  0 means no target.
+      stats:
+        If not None, a dict to which per-frame statistics of the search are
+        written, for tuning the beams.  Each is a tensor of shape
+        `(T + 1, N)` on the device of `b_fsas`, where `N` is the number of
+        sequences and `T` the number of frames of the longest one; the entry
+        `[t, i]` is for frame `t` of sequence `i`, and is 0 past its end.
+        The keys are: 'num_states' (active states), 'num_arcs' (arcs leaving
+        them), 'beams' (the beam they were pruned with; very large on the
+        last frame) and 'num_output_arcs' (arcs kept in the output).
+      b_to_a_map:
+        If not None, a 1-D tensor with dtype torch.int32 on the device of
+        `a_fsas`, with `b_to_a_map.shape[0] == b_fsas.dim0()`, containing the
+        index in `a_fsas` of the graph of each sequence.  This lets many
+        sequences share a few graphs, e.g. for contextual biasing, without
+        copying them; `a_fsas.shape[0]` may then have any value.
 
     Returns:
       The result of the intersection.
@@ -713,13 +893,22 @@ def intersect_dense_pruned(a_fsas: Fsa,
 
     out_fsa = [0]
 
+    # If possible, backprop directly into the `log_probs` b_fsas was
+    # constructed from, touching only the (frame, symbol) pairs used by the
+    # output, instead of into a dense gradient for `b_fsas.scores`.
+    unused_scores_b = b_fsas.scores
+    if b_fsas._log_probs is not None and b_fsas._log_probs.requires_grad:
+        unused_scores_b = b_fsas._log_probs
+
     # the following return value is discarded since it is already contained
     # in `out_fsa[0].scores`
     _IntersectDensePrunedFunction.apply(a_fsas, b_fsas, out_fsa, search_beam,
                                         output_beam, min_active_states,
                                         max_active_states, a_fsas.scores,
-                                        b_fsas.scores, seqframe_idx_name,
-                                        frame_idx_name)
+                                        unused_scores_b, seqframe_idx_name,
+                                        frame_idx_name, lattice_beam,
+                                        need_entering_arcs, one_best,
+                                        max_active_arcs, stats, b_to_a_map)
     return out_fsa[0]
 
 
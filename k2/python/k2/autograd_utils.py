@@ -70,7 +70,8 @@ class _PhantomIndexSelectScoresFunction(torch.autograd.Function):
                           dtype=torch.float32,
                           device=unused_in_fsa_scores.device,
                           requires_grad=False)
-        _k2.index_add(arc_map, out_fsa_scores_grad, ans)
+        _k2.index_add(arc_map, out_fsa_scores_grad, ans,
+                      k2.ops._deterministic_index_add())
         return (
             None,  # out_fsa
             ans,  # unused_in_fsa_scores
@@ -105,7 +106,8 @@ class _PhantomIndexAndSumScoresFunction(torch.autograd.Function):
                           dtype=torch.float32,
                           device=unused_in_fsa_scores.device,
                           requires_grad=False)
-        _k2.index_add(arc_map.values, expanded, ans)
+        _k2.index_add(arc_map.values, expanded, ans,
+                      k2.ops._deterministic_index_add())
 
         return (
             None,  # out_fsa
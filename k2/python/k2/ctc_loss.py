@@ -6,15 +6,78 @@ except ImportError:
     from typing_extensions import Literal  # for python < 3.8
 
 from typing import Optional
+from typing import Tuple
 
 import torch
 import torch.nn as nn
+import _k2
 
 from .autograd import intersect_dense
 from .dense_fsa_vec import DenseFsaVec
 from .fsa import Fsa
 
 
+class _CtcLossBandedFunction(torch.autograd.Function):
+
+    @staticmethod
+    def forward(ctx, tot_scores: torch.Tensor, grad: Optional[torch.Tensor],
+                row_ids: torch.Tensor,
+                unused_dense_scores: torch.Tensor) -> torch.Tensor:
+        '''Wraps the output of `_k2.ctc_loss_banded()` so that gradients
+        flow to `unused_dense_scores`, i.e. `dense_fsa_vec.scores`.
+
+        Args:
+          tot_scores:
+            The total scores, one per sequence.
+          grad:
+            The derivatives of `tot_scores` w.r.t. the dense scores, of the
+            same shape as `unused_dense_scores`, or None if no gradient
+            is needed.
+          row_ids:
+            row_ids[i] is the sequence that row i of the dense scores
+            belongs to.
+          unused_dense_scores:
+            It is `dense_fsa_vec.scores`; its sole purpose is for back
+            propagation.
+        Returns:
+          Return `tot_scores`.
+        '''
+        ctx.grad = grad
+        ctx.row_ids = row_ids
+        return tot_scores
+
+    @staticmethod
+    def backward(ctx, tot_scores_grad: torch.Tensor
+                ) -> Tuple[None, None, None, torch.Tensor]:
+        scale = tot_scores_grad.to(torch.float32)[ctx.row_ids.long()]
+        return None, None, None, ctx.grad * scale.unsqueeze(-1)
+
+
+def _ctc_loss_banded(decoding_graph: Fsa, dense_fsa_vec: DenseFsaVec,
+                     use_double_scores: bool) -> Optional[torch.Tensor]:
+    '''Computes the total scores of the unpruned intersection of
+    `decoding_graph` and `dense_fsa_vec` with the CTC alpha/beta recursion,
+    which is much faster than `intersect_dense()`.  Returns None if
+    `decoding_graph` is not a CTC-like graph (e.g. one returned by
+    :func:`k2.ctc_graph`) with one FSA per sequence, or if its scores require
+    gradients.'''
+    if decoding_graph.scores.requires_grad:
+        return None
+    need_grad = dense_fsa_vec.scores.requires_grad
+    ans = _k2.ctc_loss_banded(decoding_graph.arcs,
+                              dense_fsa_vec.dense_fsa_vec,
+                              use_double_scores=use_double_scores,
+                              need_grad=need_grad)
+    if ans is None:
+        return None
+    tot_scores, grad = ans
+    if not need_grad:
+        return tot_scores
+    row_ids = dense_fsa_vec.dense_fsa_vec.shape().row_ids(1)
+    return _CtcLossBandedFunction.apply(tot_scores, grad, row_ids,
+                                        dense_fsa_vec.scores)
+
+
 class CtcLoss(nn.Module):
     '''Ctc Loss computation in k2. It produces the same output as `torch.CtcLoss`
     if given the same input.
@@ -29,12 +92,20 @@ class CtcLoss(nn.Module):
     We assume that the blank label is always 0. The arguments `reduction` and
     `target_lengths` have the same meaning as their counterparts in
     `torch.CtcLoss`.
+
+    With `use_fast_path=True`, if the decoding graph has the structure of a
+    CTC graph (e.g. it is returned by :func:`k2.ctc_graph`), has one FSA per
+    sequence and its scores do not require gradients, the loss is computed
+    with the CTC recursion directly instead of with :func:`k2.intersect_dense`.
+    This gives the exact loss, i.e. `output_beam` is not applied, so the
+    result differs from that of the pruned intersection.
     '''
 
     def __init__(self,
                  output_beam: float,
                  reduction: Literal['none', 'mean', 'sum'] = 'sum',
-                 use_double_scores: bool = True):
+                 use_double_scores: bool = True,
+                 use_fast_path: bool = False):
         '''
         Args:
           output_beam:
@@ -49,12 +120,18 @@ class CtcLoss(nn.Module):
           use_double_scores:
             True to use double precision floating point in computing
             the total scores. False to use single precision.
+          use_fast_path:
+            True to use the CTC recursion instead of
+            :func:`k2.intersect_dense` for graphs that it can handle, in
+            which case `output_beam` is ignored.  False to always use
+            :func:`k2.intersect_dense`.
         '''
         super().__init__()
         assert reduction in ('none', 'mean', 'sum')
         self.output_beam = output_beam
         self.reduction = reduction
         self.use_double_scores = use_double_scores
+        self.use_fast_path = use_fast_path
 
     def forward(self,
                 decoding_graph: Fsa,
@@ -77,11 +154,16 @@ class CtcLoss(nn.Module):
           If `reduction` is `none`, return a 1-D tensor with size equal to batch
           size. If `reduction` is `mean` or `sum`, return a scalar.
         '''
-        lattice = intersect_dense(decoding_graph, dense_fsa_vec,
-                                  self.output_beam)
-
-        tot_scores = lattice.get_tot_scores(
-            log_semiring=True, use_double_scores=self.use_double_scores)
+        tot_scores = None
+        if self.use_fast_path:
+            tot_scores = _ctc_loss_banded(decoding_graph, dense_fsa_vec,
+                                          self.use_double_scores)
+        if tot_scores is None:
+            lattice = intersect_dense(decoding_graph, dense_fsa_vec,
+                                      self.output_beam)
+
+            tot_scores = lattice.get_tot_scores(
+                log_semiring=True, use_double_scores=self.use_double_scores)
         loss = -1 * tot_scores
         loss = loss.to(torch.float32)
 
@@ -100,7 +182,8 @@ def ctc_loss(decoding_graph: Fsa,
              output_beam: float = 10,
              reduction: Literal['none', 'mean', 'sum'] = 'sum',
              use_double_scores: bool = True,
-             target_lengths: Optional[torch.Tensor] = None) -> torch.Tensor:
+             target_lengths: Optional[torch.Tensor] = None,
+             use_fast_path: bool = False) -> torch.Tensor:
     '''Compute the CTC loss given a decoding graph and a dense fsa vector.
 
     Args:
@@ -125,12 +208,16 @@ def ctc_loss(decoding_graph: Fsa,
         Used only when `reduction` is `mean`. It is a 1-D tensor of batch
         size representing lengths of the targets, e.g., number of phones or
         number of word pieces in a sentence.
+      use_fast_path:
+        True to use the CTC recursion, which ignores `output_beam`, where
+        possible; see :class:`CtcLoss`.
     Returns:
       If `reduction` is `none`, return a 1-D tensor with size equal to batch
       size. If `reduction` is `mean` or `sum`, return a scalar.
     '''
     m = CtcLoss(output_beam=output_beam,
                 reduction=reduction,
-                use_double_scores=use_double_scores)
+                use_double_scores=use_double_scores,
+                use_fast_path=use_fast_path)
 
     return m(decoding_graph, dense_fsa_vec, target_lengths)
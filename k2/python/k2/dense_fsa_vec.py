@@ -144,6 +144,15 @@ class DenseFsaVec(object):
         self.dense_fsa_vec = _k2.DenseFsaVec(scores, row_splits)
         self.scores = scores  # for back propagation
 
+        # `_log_probs` and `_log_probs_rows` let intersect_dense_pruned()
+        # backprop directly into `log_probs`, touching only the (frame,
+        # symbol) pairs that it used; row i of `scores` (except for column 0)
+        # comes from row `_log_probs_rows[i]` of `log_probs.reshape(-1, C)`,
+        # which is -1 for the extra row of the last frame.
+        self._log_probs = log_probs
+        self._log_probs_rows = indexes.to(torch.int32)
+        self._log_probs_rows[last_frame_indexes] = -1
+
     @property
     def duration(self) -> torch.Tensor:
         '''Return the duration (on CPU) of each seq.
@@ -174,6 +183,8 @@ class DenseFsaVec(object):
         super(DenseFsaVec, ans).__init__()
         ans.dense_fsa_vec = dense_fsa_vec
         ans.scores = scores
+        ans._log_probs = None
+        ans._log_probs_rows = None
         return ans
 
     def dim0(self) -> int:
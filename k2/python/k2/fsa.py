@@ -24,9 +24,12 @@ from typing import Optional
 from typing import Tuple
 from typing import Union
 
+import collections.abc
 import os
 import re
 import shutil
+import weakref
+
 import torch
 
 import k2
@@ -36,6 +39,100 @@ import _k2
 from _k2 import RaggedArc
 from k2 import fsa_properties
 
+# The entries of `Fsa._cache` that depend only on the topology of the FSA,
+# i.e. on the source and destination states of its arcs.
+_TOPOLOGY_CACHE_NAMES = frozenset([
+    'state_batches', 'dest_states', 'incoming_arcs', 'entering_arc_batches',
+    'leaving_arc_batches'
+])
+
+
+class _TopologyCache(dict):
+    '''The entries of `Fsa._cache` in `_TOPOLOGY_CACHE_NAMES`, shared by the
+    Fsa objects whose arcs have the same storage, and by their clones and
+    detached copies.
+
+    It keeps a reference to the arcs it was created for, so that their
+    memory cannot be reused for other arcs (with the same key in
+    `_topology_caches`) while it is alive.
+    '''
+
+    def __init__(self, arcs: RaggedArc) -> None:
+        super().__init__()
+        self.arcs = arcs
+
+
+# Maps the storage of the arcs (see _arcs_storage_key()) to their
+# _TopologyCache, which is freed with the last Fsa that uses it.
+_topology_caches = weakref.WeakValueDictionary()
+
+
+def _arcs_storage_key(arcs: RaggedArc) -> Tuple:
+    values = arcs.values()
+    return (values.device, values.data_ptr(), values.shape[0]) + tuple(
+        arcs.row_splits(axis).data_ptr() for axis in range(1, arcs.num_axes()))
+
+
+class _FsaCache(collections.abc.MutableMapping):
+    '''The type of `Fsa._cache`.
+
+    The entries in `_TOPOLOGY_CACHE_NAMES` are kept in a `_TopologyCache`
+    that is looked up by the storage of the arcs when it is first needed, so
+    that they are computed once for all the Fsa objects built on the same
+    arcs (e.g. when a decoding graph is detached and rescored on every
+    training step); the other entries depend on the scores and belong to
+    this Fsa.
+    '''
+
+    def __init__(self, arcs: RaggedArc) -> None:
+        self._arcs = arcs
+        self._local = dict()
+        self._topology = None
+
+    def topology(self) -> _TopologyCache:
+        if self._topology is None:
+            key = _arcs_storage_key(self._arcs)
+            topology = _topology_caches.get(key)
+            if topology is None:
+                topology = _TopologyCache(self._arcs)
+                _topology_caches[key] = topology
+            self._topology = topology
+        return self._topology
+
+    def share_topology(self, other: '_FsaCache') -> None:
+        '''Use the topology-derived entries of `other`, whose FSA must
+        have the same topology as ours (e.g. if one is a clone of the other).
+        '''
+        self._topology = other.topology()
+
+    def local(self) -> Dict[str, Any]:
+        '''Returns the entries that are not shared, i.e. that depend on the
+        scores.'''
+        return self._local
+
+    def _dict(self, name: str) -> Dict[str, Any]:
+        return self.topology() if name in _TOPOLOGY_CACHE_NAMES else \
+                self._local
+
+    def __getitem__(self, name: str) -> Any:
+        return self._dict(name)[name]
+
+    def __setitem__(self, name: str, value: Any) -> None:
+        self._dict(name)[name] = value
+
+    def __delitem__(self, name: str) -> None:
+        del self._dict(name)[name]
+
+    def __contains__(self, name: object) -> bool:
+        return name in self._dict(name)
+
+    def __iter__(self) -> Iterator[str]:
+        yield from self._local
+        yield from self.topology()
+
+    def __len__(self) -> int:
+        return len(self._local) + len(self.topology())
+
 
 class Fsa(object):
     '''This class represents a single fsa or a vector of fsas.
@@ -178,7 +275,10 @@ class Fsa(object):
         #
         # - `_cache`
         #     It contains tensors for autograd. Users should NOT manipulate it.
-        #     The dict is filled in automagically.
+        #     The dict is filled in automagically.  The attributes that
+        #     depend only on the topology (`state_batches` to
+        #     `leaving_arc_batches` below) are shared with the other Fsa
+        #     objects on the same arcs, and with clones; see _FsaCache.
         #
         # The `_cache` dict contains the following attributes:
         #
@@ -218,8 +318,9 @@ class Fsa(object):
         #           returned by :func:`_k2.get_forward_scores_float` or
         #           :func:`_get_forward_scores_double` with `log_semiring=False`
 
-        for name in ['_tensor_attr', '_non_tensor_attr', '_cache']:
+        for name in ['_tensor_attr', '_non_tensor_attr']:
             self.__dict__[name] = dict()
+        self.__dict__['_cache'] = _FsaCache(arcs)
 
         self._tensor_attr['scores'] = _k2.as_float(self.arcs.values()[:, -1])
         if aux_labels is not None:
@@ -245,26 +346,30 @@ class Fsa(object):
         Args:
           scores_only:
             It True, it invalidates only cached entries related
-            to scores. If False, the whole cache is invalidated.
+            to scores. If False, the whole cache is invalidated,
+            including the entries that depend only on the topology,
+            which are shared with other Fsa objects.
 
         '''
+        cache = self.__dict__['_cache']
         if scores_only is False:
-            self.__dict__['_cache'] = dict()
+            cache.topology().clear()
+            cache.local().clear()
         else:
             pattern = re.compile(r'score|arc_cdf|arc_post')
             to_remove = []
 
-            for key in self.__dict__['_cache']:
+            for key in cache.local():
                 if pattern.search(key):
                     to_remove.append(key)
 
-            if 'entering_arcs' in self.__dict__['_cache']:
+            if 'entering_arcs' in cache.local():
                 # We also need to remove "entering_arcs"
                 # since it may be set in get_forward_scores()
                 to_remove.append('entering_arcs')
 
             for key in to_remove:
-                del self.__dict__['_cache'][key]
+                del cache.local()[key]
 
     def to_str(self, openfst: bool = False) -> str:
         extra_labels = []
@@ -658,6 +763,16 @@ class Fsa(object):
                ('log' if log_semiring else 'tropical')
         cache = self._cache
         if name not in cache:
+            if self.properties & fsa_properties.LINEAR:
+                # Single paths, e.g. numerator graphs or n-best paths: the
+                # total score is just the sum of the arc scores, which needs
+                # neither the state batches nor the forward scores.
+                if use_double_scores is True:
+                    func = _k2.get_tot_scores_of_linear_fsas_double
+                else:
+                    func = _k2.get_tot_scores_of_linear_fsas_float
+                cache[name] = func(self.arcs)
+                return cache[name]
             if use_double_scores is True:
                 func = _k2.get_tot_scores_double
             else:
@@ -1078,7 +1193,9 @@ class Fsa(object):
             setattr(fsa, key, value)
         return fsa
 
-    def to(self, device: Union[str, torch.device]) -> 'Fsa':
+    def to(self,
+           device: Union[str, torch.device],
+           non_blocking: bool = False) -> 'Fsa':
         '''Move the FSA onto a given device.
 
         Args:
@@ -1086,6 +1203,15 @@ class Fsa(object):
             An instance of `torch.device` or a string that can be used to
             construct a `torch.device`, e.g., 'cpu', 'cuda:0'.
             It supports only cpu and cuda devices.
+          non_blocking:
+            If True and we are copying from CPU to a CUDA device, the arcs,
+            the row_splits and values of ragged attributes and the 32-bit
+            tensor attributes are packed into one pinned buffer, which is
+            copied to the device with a single asynchronous copy (other
+            tensor attributes are copied asynchronously one by one).  The
+            copies are ordered on the current CUDA stream, so kernels launched
+            on it later will see the data; the host does not wait for them.
+            Otherwise it is ignored.
 
         Returns:
           Returns a new Fsa which is this object copied to the given device
@@ -1099,6 +1225,10 @@ class Fsa(object):
         if device == self.scores.device:
             return self
 
+        if non_blocking and self.scores.device.type == 'cpu' and \
+                device.type == 'cuda':
+            return self._to_cuda_non_blocking(device)
+
         ans = Fsa(self.arcs.to(device), properties=self.properties)
 
         for name, value in self.named_tensor_attr(include_scores=False):
@@ -1116,6 +1246,93 @@ class Fsa(object):
 
         return ans
 
+    def _to_cuda_non_blocking(self, device: torch.device) -> 'Fsa':
+        '''Implementation of `to(device, non_blocking=True)` for copying
+        from CPU to CUDA; see :func:`to`.
+        '''
+        # The int32 pieces to pack, and functions that rebuild what each
+        # attribute needs from the packed pieces once they are on `device`.
+        pieces = []
+
+        def add(t: torch.Tensor) -> Tuple[int, torch.Size]:
+            if t.dtype == torch.float32:
+                t = _k2.as_int(t)
+            assert t.dtype == torch.int32
+            pieces.append(t.reshape(-1))
+            return len(pieces) - 1, t.shape
+
+        def add_shape(shape: k2.RaggedShape) -> List[Tuple[int, int]]:
+            # Returns (piece index of row_splits, tot_size) for each axis;
+            # the tot_sizes are known on the host, so no syncs are needed to
+            # rebuild the shape.
+            return [(add(shape.row_splits(axis))[0], shape.tot_size(axis))
+                    for axis in range(1, shape.num_axes)]
+
+        def get(index: int, shape: torch.Size,
+                dtype: torch.dtype = torch.int32) -> torch.Tensor:
+            t = device_pieces[index].reshape(shape)
+            return _k2.as_float(t) if dtype == torch.float32 else t
+
+        def get_shape(axes: List[Tuple[int, int]]) -> k2.RaggedShape:
+            ans = None
+            for index, tot_size in axes:
+                layer = k2.ragged.create_ragged_shape2(
+                    row_splits=device_pieces[index],
+                    cached_tot_size=tot_size)
+                ans = layer if ans is None else ans.compose(layer)
+            return ans
+
+        arcs_shape = add_shape(self.arcs.shape())
+        arcs_values = add(self.arcs.values())
+
+        packed_tensors = dict()
+        packed_ragged = dict()
+        others = dict()
+        for name, value in self.named_tensor_attr(include_scores=False):
+            if value.dtype not in (torch.int32, torch.float32) or \
+                    value.requires_grad:
+                others[name] = value
+            elif isinstance(value, torch.Tensor):
+                packed_tensors[name] = (add(value), value.dtype)
+            else:
+                assert isinstance(value, k2.RaggedTensor)
+                packed_ragged[name] = (add_shape(value.shape),
+                                       add(value.values), value.dtype)
+
+        sizes = [p.numel() for p in pieces]
+        buf = torch.empty(sum(sizes), dtype=torch.int32, pin_memory=True)
+        torch.cat(pieces, out=buf)
+        device_pieces = buf.to(device, non_blocking=True).split(sizes)
+
+        arcs = RaggedArc(get_shape(arcs_shape), get(*arcs_values))
+        ans = Fsa(arcs, properties=self.properties)
+
+        for name, ((index, shape), dtype) in packed_tensors.items():
+            setattr(ans, name, get(index, shape, dtype))
+
+        for name, (axes, (index, shape), dtype) in packed_ragged.items():
+            setattr(ans, name,
+                    k2.RaggedTensor(get_shape(axes), get(index, shape, dtype)))
+
+        for name, value in others.items():
+            if isinstance(value, k2.RaggedTensor):
+                value = value.to(device)
+            elif value.requires_grad:
+                value = value.to(device, non_blocking=True)
+            else:
+                value = value.pin_memory().to(device, non_blocking=True)
+            setattr(ans, name, value)
+
+        for name, value in self.named_non_tensor_attr():
+            setattr(ans, name, value)
+
+        # The scores are already in `arcs`; this is only needed for backprop.
+        if self.scores.requires_grad:
+            k2.autograd_utils.phantom_set_scores_to(
+                ans, self.scores.to(device, non_blocking=True))
+
+        return ans
+
     def clone(self) -> 'Fsa':
         '''
         Return an Fsa that is a clone of this one, i.e. a close approximation
@@ -1132,13 +1349,15 @@ class Fsa(object):
             # Caution: We are not using `deepcopy` for `value`!
             setattr(ans, name, value)
 
-        # Just copy elements of the _cache that we might already have..
+        # Just copy elements of the _cache that we might already have, and
+        # share those that depend only on the topology, so that ones computed
+        # later for either FSA are seen by the other too.
         # These don't directly participate in autograd, and are not supposed to
         # be modified by the user, so this should be safe (i.e. it should
         # be safe to do this without clone(); these are mostly not tensors
         # anyway.
-        for name, value in self._cache.items():
-            ans._cache[name] = value
+        ans._cache.share_topology(self._cache)
+        ans._cache.local().update(self._cache.local())
 
         # The following is a magic invocation to make sure
         # the backprop happens.
@@ -1167,13 +1386,15 @@ class Fsa(object):
             # Caution: We are not using `deepcopy` for `value`!
             setattr(ans, name, value)
 
-        # Just copy elements of the _cache that we might already have..
+        # Just copy elements of the _cache that we might already have, and
+        # share those that depend only on the topology, so that ones computed
+        # later for either FSA are seen by the other too.
         # These don't directly participate in autograd, and are not supposed to
         # be modified by the user, so this should be safe (i.e. it should
         # be safe to do this without clone(); these are mostly not tensors
         # anyway.
-        for name, value in self._cache.items():
-            ans._cache[name] = value
+        ans._cache.share_topology(self._cache)
+        ans._cache.local().update(self._cache.local())
         return ans
 
     def named_tensor_attr(self, include_scores: bool = True
@@ -1358,6 +1579,32 @@ class Fsa(object):
                             aux_label_names, ragged_label_names,
                             openfst=True)
 
+    @classmethod
+    def from_openfst_binary(cls,
+                            filename: str,
+                            acceptor: bool = True) -> 'Fsa':
+        '''Create an Fsa from a file in OpenFst's binary format, e.g. as
+        written by `fstcompile`, without converting it to text first.
+
+        FSTs of type "vector" and "const" with the "standard" or "log" arc
+        types are supported; symbol tables are ignored.  As for
+        :func:`from_openfst`, the costs are negated to get scores, the start
+        state becomes state 0 and a super-final state is added.
+
+        Args:
+          filename:
+            The file to read.
+          acceptor:
+            If true, the output labels are ignored; else they are set as the
+            attribute `aux_labels` (-1 on arcs to the super-final state).
+        '''
+        arcs, aux_labels = _k2.fsa_from_openfst_binary(filename,
+                                                       acceptor=acceptor)
+        ans = Fsa(arcs)
+        if aux_labels is not None:
+            ans.aux_labels = aux_labels
+        return ans
+
     @staticmethod
     def from_fsas(fsas: List['Fsa']) -> 'Fsa':
         '''Create an FsaVec from a list of FSAs.
@@ -241,9 +241,17 @@ def top_sort(fsa: Fsa) -> Fsa:
       a vector of FSAs if the input is a vector of FSAs.
     '''
     need_arc_map = True
-    ragged_arc, arc_map = _k2.top_sort(fsa.arcs, need_arc_map=need_arc_map)
+    # The batches of states found while sorting are kept in the cache of the
+    # output, so that e.g. get_forward_scores() need not compute them again.
+    need_state_batches = fsa.arcs.num_axes() == 3
+    ragged_arc, arc_map, state_batches = _k2.top_sort(
+        fsa.arcs,
+        need_arc_map=need_arc_map,
+        need_state_batches=need_state_batches)
 
     out_fsa = k2.utils.fsa_from_unary_function_tensor(fsa, ragged_arc, arc_map)
+    if state_batches is not None:
+        out_fsa._cache['state_batches'] = state_batches
     return out_fsa
 
 
@@ -252,7 +260,10 @@ def intersect_device(
         b_fsas: Fsa,
         b_to_a_map: torch.Tensor,
         sorted_match_a: bool = False,
-        ret_arc_maps: bool = False
+        ret_arc_maps: bool = False,
+        sorted_match_b: bool = False,
+        use_queue: bool = False,
+        a_self_loops: bool = False
 ) -> Union[Fsa, Tuple[Fsa, torch.Tensor, torch.Tensor]]:  # noqa
     '''Compute the intersection of two FsaVecs treating epsilons
     as real, normal symbols.
@@ -309,6 +320,27 @@ def intersect_device(
               if the i-th arc in the resulting Fsa has no corresponding
               arc in b_fsas.
 
+      sorted_match_b:
+        Only relevant if sorted_match_a is true. If true, the arcs of
+        b_fsas must be sorted by label too, and for each pair of states
+        we binary-search the arcs of the state with more arcs, so that
+        e.g. composing a small lattice with a large arc-sorted G takes time
+        proportional to the number of matched arcs. The result is the same
+        up to the order of the arcs leaving each state.
+      use_queue:
+        If true, process the states of the result from a queue in a single
+        kernel instead of in breadth-first iterations, each of which needs
+        a few kernels and syncs with the host; this is faster if there are
+        many iterations (cyclic or deep inputs). The result is the same up
+        to the numbering of the states and the order of the arcs leaving
+        each state.
+      a_self_loops:
+        If true, intersect as if :func:`k2.add_epsilon_self_loops` had been
+        called on `a_fsas` (e.g. a G that is composed with lattices that
+        have epsilons), without creating the self-loops. The result is the
+        same; arcs of the result that came from a self-loop have -1 in
+        a_arc_map.
+
     Returns:
       If ret_arc_maps is False, return intersected FsaVec;
       will satisfy `ans.shape == b_fsas.shape`.
@@ -318,7 +350,8 @@ def intersect_device(
     need_arc_map = True
     ragged_arc, a_arc_map, b_arc_map = _k2.intersect_device(
         a_fsas.arcs, a_fsas.properties, b_fsas.arcs, b_fsas.properties,
-        b_to_a_map, need_arc_map, sorted_match_a)
+        b_to_a_map, need_arc_map, sorted_match_a, sorted_match_b, use_queue,
+        a_self_loops)
 
     out_fsas = k2.utils.fsa_from_binary_function_tensor(
         a_fsas, b_fsas, ragged_arc, a_arc_map, b_arc_map)
@@ -529,6 +562,30 @@ def connect(fsa: Fsa) -> Fsa:
     return out_fsa
 
 
+def normalize_lattice(fsa: Fsa) -> Fsa:
+    '''Connect, top-sort and arc-sort an FSA in one pass.
+
+    The result is the same as that of
+    ``k2.arc_sort(k2.top_sort(k2.connect(fsa)))``, but it is faster since
+    the arcs are renumbered only once.
+
+    Caution:
+      Like :func:`top_sort`, it requires the connected part of the input
+      to be acyclic (self-loops are allowed) with no arcs entering the
+      start state.
+
+    Args:
+      fsa:
+        The input FSA, either a single FSA or an FsaVec.
+
+    Returns:
+      An FSA that is connected, top-sorted and arc-sorted.
+    '''
+    ragged_arc, arc_map = _k2.normalize_lattice(fsa.arcs, need_arc_map=True)
+    out_fsa = k2.utils.fsa_from_unary_function_tensor(fsa, ragged_arc, arc_map)
+    return out_fsa
+
+
 def arc_sort(fsa: Fsa, ret_arc_map: bool = False
             ) -> Union[Fsa, Tuple[Fsa, torch.Tensor]]:  # noqa
     '''Sort arcs of every state.
@@ -758,7 +815,6 @@ def determinize(fsa: Fsa,
     '''Determinize the input Fsa.
 
     Caution:
-      - It only works on for CPU.
       - Any weight_pushing_type value other than kNoWeightPushing causes
         the 'arc_derivs' to not accurately reflect the real derivatives,
         although this will not matter as long as the derivatives ultimately
@@ -793,7 +849,6 @@ def determinize(fsa: Fsa,
       Otherwise, a new deterministic fsa is returned and the
       input `fsa` is NOT modified.
     '''
-    assert fsa.is_cpu()
     assert fsa.requires_grad is False
     if fsa.properties & fsa_properties.ARC_SORTED_AND_DETERMINISTIC != 0:  # noqa
         return fsa
@@ -803,6 +858,39 @@ def determinize(fsa: Fsa,
     return out_fsa
 
 
+def minimize(fsa: Fsa) -> Fsa:
+    '''Minimize an acyclic FSA, e.g. a lattice, by merging the states that
+    have the same suffix.
+
+    States are merged if their arcs have the same labels, scores and
+    ``aux_labels`` (if ``fsa`` has them as a tensor) and lead to the same or
+    merged states.  Weights are not pushed; use weight pushing in
+    :func:`determinize` to merge more states.
+
+    Caution:
+      Attributes other than ``aux_labels`` are not compared; the arcs of the
+      result get those of the arcs they were copied from.
+
+    Args:
+      fsa:
+        The input FSA, either a single FSA or an FsaVec.  Must be
+        top-sorted and acyclic.
+
+    Returns:
+      The minimized FSA, which is top-sorted.
+    '''
+    aux_labels = getattr(fsa, 'aux_labels', None)
+    if aux_labels is not None:
+        assert isinstance(aux_labels, torch.Tensor), \
+            'Ragged aux_labels are not supported'
+        aux_labels = aux_labels.to(torch.int32)
+    ragged_arc, arc_map = _k2.minimize(fsa.arcs,
+                                       aux_labels=aux_labels,
+                                       need_arc_map=True)
+    out_fsa = k2.utils.fsa_from_unary_function_tensor(fsa, ragged_arc, arc_map)
+    return out_fsa
+
+
 def closure(fsa: Fsa) -> Fsa:
     '''Compute the Kleene closure of the input FSA.
 
@@ -899,8 +987,47 @@ def invert(fsa: Fsa,
             return fsa
 
 
-def random_paths(fsas: Fsa, use_double_scores: bool,
-                 num_paths: int) -> k2.RaggedTensor:
+def to_word_lattice(fsa: Fsa) -> Fsa:
+    '''Convert a token-level lattice into an epsilon-free word lattice.
+
+    This is equivalent to ``connect(remove_epsilon(invert(fsa)))``, but it is
+    done in one call, without creating the intermediate FSAs and their
+    attributes, and with a single arc map from the result to `fsa`.
+
+    Args:
+      fsa:
+        The input FSA, e.g. a lattice from :func:`k2.intersect_dense_pruned`.
+        It can be either a single FSA or an FsaVec, and must have
+        `aux_labels` (e.g. word IDs), either a tensor or a ragged tensor.
+    Returns:
+      The word lattice, whose labels are the aux_labels of `fsa`.  Its
+      `aux_labels` are the labels of `fsa` (a ragged tensor, with epsilons
+      and the -1's of final-arcs removed); its scores are differentiable
+      w.r.t. the scores of `fsa`.  Other attributes are propagated as in
+      :func:`remove_epsilon`.
+    '''
+    aux_labels = fsa.aux_labels
+    if isinstance(aux_labels, torch.Tensor):
+        shape = k2.ragged.regular_ragged_shape(dim0=aux_labels.numel(),
+                                               dim1=1).to(aux_labels.device)
+        aux_labels = k2.RaggedTensor(shape, aux_labels.contiguous())
+    assert aux_labels.dtype == torch.int32
+
+    ragged_arc, arc_map = _k2.to_word_lattice(fsa.arcs, aux_labels,
+                                              fsa.properties)
+    out_fsa = k2.utils.fsa_from_unary_function_ragged(fsa, ragged_arc,
+                                                      arc_map)
+    labels = fsa.labels.clone()
+    labels[labels == -1] = 0
+    out_fsa.aux_labels = k2.ragged.index(labels, arc_map,
+                                         default_value=0).remove_values_eq(0)
+    return out_fsa
+
+
+def random_paths(fsas: Fsa,
+                 use_double_scores: bool,
+                 num_paths: int,
+                 seed: Optional[int] = None) -> k2.RaggedTensor:
     '''Compute pseudo-random paths through the FSAs in this vector of FSAs
     (this object must have 3 axes, `self.arcs.num_axes() == 3`)
 
@@ -908,8 +1035,8 @@ def random_paths(fsas: Fsa, use_double_scores: bool,
       It does not support autograd.
 
     Caution:
-      Do not be confused by the function name. There is no
-      randomness at all, thus no `seed`. It uses a deterministic algorithm
+      Do not be confused by the function name. Unless `seed` is given,
+      there is no randomness at all. It uses a deterministic algorithm
       internally, similar to arithmetic coding
       (see `<https://en.wikipedia.org/wiki/Arithmetic_coding>`_).
 
@@ -924,6 +1051,10 @@ def random_paths(fsas: Fsa, use_double_scores: bool,
       num_paths:
         Number of paths requested through each FSA. FSAs that have no successful
         paths will have zero paths returned.
+      seed:
+        If given (it must be >= 0), the paths are sampled independently
+        using a counter-based random number generator, so the result is a
+        function of `seed` only, and is the same on CPU and CUDA.
     Returns:
       Returns a k2.RaggedTensor (dtype is torch.int32) with 3 axes:
       [fsa][path][arc_pos]; the final
@@ -932,6 +1063,7 @@ def random_paths(fsas: Fsa, use_double_scores: bool,
       i.e. arc indexes.
     '''
     assert num_paths > 0, f'num_paths: {num_paths}'
+    assert seed is None or seed >= 0, f'seed: {seed}'
     log_semiring = True
     arc_cdf = fsas._get_arc_cdf(use_double_scores=use_double_scores,
                                 log_semiring=log_semiring)
@@ -947,7 +1079,8 @@ def random_paths(fsas: Fsa, use_double_scores: bool,
                arc_cdf=arc_cdf,
                num_paths=num_paths,
                tot_scores=tot_scores,
-               state_batches=state_batches)
+               state_batches=state_batches,
+               seed=-1 if seed is None else seed)
     return ans
 
 
@@ -1361,6 +1494,71 @@ def levenshtein_alignment(
     return alignment
 
 
+def levenshtein_distance(
+        refs: Union[k2.RaggedTensor, List[List[int]]],
+        hyps: Union[k2.RaggedTensor, List[List[int]]],
+        hyp_to_ref_map: torch.Tensor,
+        return_alignment: bool = False,
+) -> Union[torch.Tensor, Tuple[torch.Tensor, k2.RaggedTensor,
+                               k2.RaggedTensor]]:
+    '''Compute the levenshtein distance between pairs of symbol sequences.
+
+    Unlike :func:`levenshtein_alignment`, it does not build levenshtein
+    graphs and intersect them; it computes the distances directly with
+    dynamic programming, which is much faster.
+
+    Args:
+      refs:
+        The reference sequences. It can be one of the following types:
+
+            - A list of list-of-integers, e..g, `[ [1, 2], [1, 2, 3] ]`
+            - An instance of :class:`k2.RaggedTensor`.
+              Must have `num_axes == 2` and with dtype `torch.int32`.
+      hyps:
+        The hypothesis sequences, of the same types as `refs`. If it is a
+        :class:`k2.RaggedTensor`, it must be on the same device as `refs`.
+      hyp_to_ref_map:
+        A 1-D torch.Tensor with dtype torch.int32. Map from index in `hyps`
+        to the index in `refs` it is compared with.
+        Requires
+            - `hyp_to_ref_map.shape[0] == hyps.dim0`
+            - `0 <= hyp_to_ref_map[i] < refs.dim0`
+      return_alignment:
+        True to also return the alignments.
+
+    Returns:
+      Returns a 1-D torch.Tensor with dtype torch.int32 containing the
+      levenshtein distance of each hypothesis. If `return_alignment` is
+      True, also returns two :class:`k2.RaggedTensor` with 2 axes containing
+      the aligned sequences of refs and hyps, where insertions and deletions
+      are aligned to 0.
+
+    Examples:
+      >>> refs = k2.RaggedTensor([[1, 2, 4]])
+      >>> hyps = k2.RaggedTensor([[1, 2, 3], [1, 3, 3, 2]])
+      >>> k2.levenshtein_distance(
+              refs, hyps,
+              hyp_to_ref_map=torch.tensor([0, 0], dtype=torch.int32))
+      tensor([1, 3], dtype=torch.int32)
+    '''
+    if isinstance(hyps, k2.RaggedTensor):
+        device = hyps.device
+    elif isinstance(refs, k2.RaggedTensor):
+        device = refs.device
+    else:
+        device = hyp_to_ref_map.device
+    if not isinstance(refs, k2.RaggedTensor):
+        refs = k2.RaggedTensor(refs, device=device)
+    if not isinstance(hyps, k2.RaggedTensor):
+        hyps = k2.RaggedTensor(hyps, device=device)
+
+    distance, ref_alignment, hyp_alignment = _k2.levenshtein_distance(
+        refs, hyps, hyp_to_ref_map.to(refs.device), return_alignment)
+    if return_alignment:
+        return distance, ref_alignment, hyp_alignment
+    return distance
+
+
 def union(fsas: Fsa) -> Fsa:
     '''Compute the union of a FsaVec.
 
@@ -1381,3 +1579,56 @@ def union(fsas: Fsa) -> Fsa:
     out_fsa = k2.utils.fsa_from_unary_function_tensor(fsas, ragged_arc,
                                                       arc_map)
     return out_fsa
+
+
+def intersect_dense_pruned_composed(hl: Fsa, g: Fsa,
+                                    dense_fsa_vec: 'k2.DenseFsaVec',
+                                    search_beam: float, output_beam: float,
+                                    min_active_states: int,
+                                    max_active_states: int) -> Fsa:
+    '''Decode with the composition HL o G, done on the fly for the states
+    reached by the search, instead of with a statically compiled HLG.
+
+    A search state is a pair (state of HL, state of G).  An arc of HL with
+    a nonzero aux_label (a word) takes the arc of G with that word, taking
+    the backoff arcs of G (its arcs with label 0) first if needed.  The G
+    can therefore be swapped without recompiling the decoding graph.
+
+    Caution:
+      This function does not support autograd.
+
+    Args:
+      hl:
+        A single Fsa (or an FsaVec with one FSA) whose labels are the
+        symbols of ``dense_fsa_vec`` and whose ``aux_labels`` are words;
+        its final arcs must have -1 as aux_label.
+      g:
+        A single arc-sorted Fsa (or an FsaVec with one FSA) whose labels are
+        words.  Its backoff arcs must not form cycles.
+      dense_fsa_vec:
+        The neural-net output; as for :func:`k2.intersect_dense_pruned`.
+      search_beam:
+        Decoding beam, e.g. 20.
+      output_beam:
+        Pruning beam for the output (vs. best path), e.g. 8.
+      min_active_states:
+        Minimum number of states active on each frame of each sequence;
+        see :func:`k2.intersect_dense_pruned`.
+      max_active_states:
+        Maximum number of states active on each frame of each sequence;
+        see :func:`k2.intersect_dense_pruned`.
+
+    Returns:
+      Return an FsaVec with the lattices, whose attributes are those of
+      ``hl``; the scores are the sum of those of ``dense_fsa_vec``, ``hl``
+      and ``g``.  It has the attribute ``g_arc_map``, the index of the arc of
+      ``g`` with the word of each arc, or -1 if it has no word.
+    '''
+    assert hasattr(hl, 'aux_labels')
+    ragged_arc, arc_map_hl, arc_map_g, _ = _k2.intersect_dense_pruned_composed(
+        hl.arcs, hl.aux_labels, g.arcs, dense_fsa_vec.dense_fsa_vec,
+        search_beam, output_beam, min_active_states, max_active_states)
+    out_fsa = k2.utils.fsa_from_unary_function_tensor(hl, ragged_arc,
+                                                      arc_map_hl)
+    out_fsa.g_arc_map = arc_map_g
+    return out_fsa
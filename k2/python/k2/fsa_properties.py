@@ -42,7 +42,9 @@ ACCESSIBLE = 0x80  # True if there are no obvious signs
 COACCESSIBLE = 0x0100  # True if there are no obvious signs of
 # states not being co-accessible, i.e.
 # i.e. states with no arcs leaving them
-ALL = 0x01FF
+LINEAR = 0x0200  # The FSA is a single path: every state but the final
+# state has exactly one arc leaving it, to the next state
+ALL = 0x03FF
 
 
 def to_str(p: int) -> str:
@@ -21,6 +21,126 @@ from torch import Tensor
 from typing import Tuple, Optional, Sequence, Union, List
 
 
+def _acc_dtype(dtype: torch.dtype) -> torch.dtype:
+    """Returns the dtype in which the recursion is computed, and so of ``p``
+    and of the returned scores, for ``px`` and ``py`` of dtype ``dtype``:
+    float32 for float16 and bfloat16, else ``dtype``.
+    """
+    if dtype in (torch.float16, torch.bfloat16):
+        return torch.float32
+    return dtype
+
+
+def _checkpoint_block(
+    px: Tensor,
+    py: Tensor,
+    boundary: Tensor,
+    r0: int,
+    r1: int,
+    p_row: Optional[Tensor],
+) -> Tuple[Tensor, Tensor, Tensor]:
+    """Returns (px, py, boundary) of the recursion that computes rows ``r0``
+    to ``r1`` of ``p`` from its row ``r0``, ``p_row`` (unused if ``r0 == 0``).
+    Its row 0 of ``p`` is zero and ``p_row`` is added to its row 0 of
+    ``px``, so its rows ``1 .. r1 - r0`` of ``p`` are the rows
+    ``r0 + 1 .. r1`` of the whole recursion.  Its px and py are of the dtype
+    of ``p``.  Requires ``boundary[:, 0] == 0``.
+    """
+    acc_dtype = _acc_dtype(px.dtype)
+    block_px = px[:, r0:r1].to(acc_dtype, copy=True)
+    block_py = py[:, r0:r1 + 1].to(acc_dtype, copy=True)
+    if r0 > 0:
+        block_px[:, 0] += p_row[:, :px.shape[2]]
+        block_py[:, 0] = 0
+    block_boundary = boundary.clone()
+    block_boundary[:, 2] = (boundary[:, 2] - r0).clamp(0, r1 - r0)
+    return block_px, block_py, block_boundary
+
+
+def _mutual_information_checkpointed(
+    px: Tensor,
+    py: Tensor,
+    boundary: Optional[Tensor],
+    interval: int,
+    compute_grad: bool,
+) -> Tuple[Tensor, Optional[Tensor], Optional[Tensor]]:
+    """Computes what ``_k2.mutual_information_forward()`` followed (if
+    ``compute_grad``) by ``_k2.mutual_information_backward()`` with
+    ``ans_grad`` of ones would, returning ``(ans, px_grad, py_grad)``, but
+    keeps ``p`` only for ``interval`` rows at a time plus the last row of
+    each block of ``interval`` rows.  The backward pass goes over the blocks
+    in reverse order, recomputing each one from the kept row before it, with
+    the grad of its last row coming from the block after it.
+    """
+    (B, S, T1) = px.shape
+    T = py.shape[-1]
+    if boundary is None:
+        boundary = torch.tensor(
+            [0, 0, S, T], dtype=torch.int64, device=px.device
+        ).expand(B, 4)
+    acc_dtype = _acc_dtype(px.dtype)
+    s_end = boundary[:, 2]
+    starts = list(range(0, S, interval))
+    num_blocks = len(starts)
+
+    def run_block(j: int, p_row: Optional[Tensor]):
+        r0 = starts[j]
+        r1 = min(r0 + interval, S)
+        block_px, block_py, block_boundary = _checkpoint_block(
+            px, py, boundary, r0, r1, p_row
+        )
+        p = torch.empty(
+            B, r1 - r0 + 1, T + 1, device=px.device, dtype=acc_dtype
+        )
+        ans = _k2.mutual_information_forward(
+            block_px, block_py, block_boundary, p
+        )
+        # The sequences whose p[s_end][t_end] is in this block.
+        ends_here = (s_end <= r1) & ((s_end > r0) | (r0 == 0))
+        return (block_px, block_py, block_boundary, p, ans, ends_here)
+
+    # p_rows[j] is row starts[j] of p, for j > 0.
+    p_rows: List[Optional[Tensor]] = [None] * num_blocks
+    ans = torch.zeros(B, device=px.device, dtype=acc_dtype)
+    for j in range(num_blocks):
+        block = run_block(j, p_rows[j])
+        ans = torch.where(block[5], block[4], ans)
+        if j + 1 < num_blocks:
+            p_rows[j + 1] = block[3][:, -1].clone()
+    if not compute_grad:
+        return ans, None, None
+
+    px_grad = torch.zeros_like(px)
+    py_grad = torch.zeros_like(py)
+    end_row_grad = None
+    for j in reversed(range(num_blocks)):
+        r0 = starts[j]
+        r1 = min(r0 + interval, S)
+        # The last block is still there from the forward pass.
+        if j + 1 < num_blocks:
+            block = run_block(j, p_rows[j])
+        (block_px, block_py, block_boundary, p, _, ends_here) = block
+        (block_px_grad, block_py_grad) = _k2.mutual_information_backward(
+            block_px,
+            block_py,
+            block_boundary,
+            p,
+            ends_here.to(acc_dtype),
+            end_row_grad,
+        )
+        px_grad[:, r0:r1] = block_px_grad
+        if r0 == 0:
+            py_grad[:, : r1 + 1] = block_py_grad
+        else:
+            # Row 0 of block_py is not part of the recursion; the grad of
+            # row r0 of p is that of row 0 of block_px.
+            py_grad[:, r0 + 1 : r1 + 1] = block_py_grad[:, 1:]
+            end_row_grad = torch.nn.functional.pad(
+                block_px_grad[:, 0], (0, T + 1 - T1)
+            )
+    return ans, px_grad, py_grad
+
+
 class MutualInformationRecursionFunction(torch.autograd.Function):
     """A recursion that is useful in computing mutual information between two
     sequences of real vectors, but may be useful more generally in
@@ -36,6 +156,7 @@ class MutualInformationRecursionFunction(torch.autograd.Function):
         pxy_grads: List[Optional[torch.Tensor]],
         boundary: Optional[torch.Tensor] = None,
         return_grad: bool = False,
+        checkpoint_interval: int = 0,
     ) -> torch.Tensor:
         """
         Computing mutual information between two sequences of real vectors.
@@ -117,6 +238,9 @@ class MutualInformationRecursionFunction(torch.autograd.Function):
             ``torch.autograd.grad((scores.sum()), [px, py])``.
             This is useful to implement the pruned version of rnnt loss.
 
+          checkpoint_interval:
+            See :func:`mutual_information_recursion`.
+
         Returns:
           Returns a torch.Tensor of shape ``[B]``, containing the log of
           the mutual information between the b'th pair of sequences.  This is
@@ -154,13 +278,27 @@ class MutualInformationRecursionFunction(torch.autograd.Function):
         #               treating values with any -1 index as -infinity.
         #      .. if `boundary` is set, we start fom p[b,s_begin,t_begin]=0.0.
 
-        p = torch.empty(B, S + 1, T + 1, device=px.device, dtype=px.dtype)
+        compute_grad = return_grad or px.requires_grad or py.requires_grad
+        if 0 < checkpoint_interval < S:
+            (ans, px_grad, py_grad) = _mutual_information_checkpointed(
+                px, py, boundary, checkpoint_interval, compute_grad
+            )
+            if compute_grad:
+                ctx.save_for_backward(px_grad, py_grad)
+            assert len(pxy_grads) == 2, len(pxy_grads)
+            pxy_grads[0] = px_grad
+            pxy_grads[1] = py_grad
+            return ans
+
+        p = torch.empty(
+            B, S + 1, T + 1, device=px.device, dtype=_acc_dtype(px.dtype)
+        )
 
         ans = _k2.mutual_information_forward(px, py, boundary, p)
 
         px_grad, py_grad = None, None
-        if return_grad or px.requires_grad or py.requires_grad:
-            ans_grad = torch.ones(B, device=px.device, dtype=px.dtype)
+        if compute_grad:
+            ans_grad = torch.ones(B, device=px.device, dtype=ans.dtype)
             (px_grad, py_grad) = _k2.mutual_information_backward(
                 px, py, boundary, p, ans_grad)
             ctx.save_for_backward(px_grad, py_grad)
@@ -173,13 +311,13 @@ class MutualInformationRecursionFunction(torch.autograd.Function):
     @staticmethod
     def backward(
         ctx, ans_grad: Tensor
-    ) -> Tuple[torch.Tensor, torch.Tensor, None, None, None]:
+    ) -> Tuple[torch.Tensor, torch.Tensor, None, None, None, None]:
         (px_grad, py_grad) = ctx.saved_tensors
         (B,) = ans_grad.shape
         ans_grad = ans_grad.reshape(B, 1, 1)  # (B, 1, 1)
         px_grad *= ans_grad
         py_grad *= ans_grad
-        return (px_grad, py_grad, None, None, None)
+        return (px_grad, py_grad, None, None, None, None)
 
 
 def mutual_information_recursion(
@@ -187,6 +325,7 @@ def mutual_information_recursion(
     py: Tensor,
     boundary: Optional[Tensor] = None,
     return_grad: bool = False,
+    checkpoint_interval: int = 0,
 ) -> Union[Tuple[Tensor, Tuple[Tensor, Tensor]], Tensor]:
     """A recursion that is useful in computing mutual information between two
     sequences of real vectors, but may be useful more generally in
@@ -238,6 +377,10 @@ def mutual_information_recursion(
         (the ``t`` axis) has stride of 1; this is true if ``px`` and ``py`` are
         contiguous.
 
+        ``px`` and ``py`` may be float16 or bfloat16, e.g. under automatic
+        mixed precision; the recursion is then computed in float32 and the
+        gradients w.r.t. ``px`` and ``py`` have the same dtype as them.
+
       boundary:
         If supplied, a torch.LongTensor of shape ``[B][4]``, where each
         row contains ``[s_begin, t_begin, s_end, t_end]``,
@@ -255,9 +398,24 @@ def mutual_information_recursion(
         you'd get if you did ``torch.autograd.grad((scores.sum()), [px, py])``.
         This is useful to implement the pruned version of rnnt loss.
 
+      checkpoint_interval:
+        If positive and less than ``S``, the recursion is done in blocks of
+        this many rows of ``p`` (i.e. values of ``s``), keeping only the last
+        row of each block, and the gradients are computed block by block
+        from the last block to the first, recomputing each block from the
+        row kept before it.  This reduces the memory for ``p`` (and, on
+        CUDA, for its gradient) from ``O(S T)`` to
+        ``O((S / checkpoint_interval + checkpoint_interval) T)``, which is
+        smallest for ``checkpoint_interval`` near ``sqrt(S)``, at the cost of
+        computing the recursion about once more.  The results are the same.
+        Requires ``s_begin == 0`` in ``boundary``.  If 0 (the default), the
+        whole of ``p`` is kept.
+
     Returns:
       Returns a torch.Tensor of shape ``[B]``, containing the log of the mutual
-      information between the b'th pair of sequences.  This is defined by
+      information between the b'th pair of sequences (of dtype float32 if
+      ``px`` is float16 or bfloat16, else of the dtype of ``px``).
+      This is defined by
       the following recursion on ``p[b,s,t]`` (where ``p`` is of shape
       ``[B,S+1,T+1]``), representing a mutual information between sub-sequences
       of lengths ``s`` and ``t``::
@@ -287,13 +445,123 @@ def mutual_information_recursion(
         for s_begin, t_begin, s_end, t_end in boundary.tolist():
             assert 0 <= s_begin <= s_end <= S, (s_begin, s_end, S)
             assert 0 <= t_begin <= t_end <= T, (t_begin, t_end, T)
+            assert checkpoint_interval <= 0 or s_begin == 0, s_begin
+
+    # The following statements are for efficiency
+    px, py = px.contiguous(), py.contiguous()
+
+    pxy_grads = [None, None]
+    scores = MutualInformationRecursionFunction.apply(
+        px, py, pxy_grads, boundary, return_grad, checkpoint_interval
+    )
+    px_grad, py_grad = pxy_grads
+    return (scores, (px_grad, py_grad)) if return_grad else scores
+
+
+class MutualInformationPackedFunction(torch.autograd.Function):
+    """The packed counterpart of :class:`MutualInformationRecursionFunction`;
+    see :func:`mutual_information_recursion_packed`.
+    """
+
+    @staticmethod
+    def forward(
+        ctx,
+        px: torch.Tensor,
+        py: torch.Tensor,
+        pxy_grads: List[Optional[torch.Tensor]],
+        lengths: torch.Tensor,
+        modified: bool,
+        return_grad: bool = False,
+    ) -> torch.Tensor:
+        ans, p = _k2.mutual_information_packed_forward(
+            px, py, lengths, modified
+        )
+
+        px_grad, py_grad = None, None
+        if return_grad or px.requires_grad or py.requires_grad:
+            ans_grad = torch.ones_like(ans)
+            (px_grad, py_grad) = _k2.mutual_information_packed_backward(
+                px, py, lengths, modified, p, ans_grad
+            )
+            ctx.save_for_backward(px_grad, py_grad, lengths)
+            ctx.modified = modified
+        assert len(pxy_grads) == 2, len(pxy_grads)
+        pxy_grads[0] = px_grad
+        pxy_grads[1] = py_grad
+
+        return ans
+
+    @staticmethod
+    def backward(
+        ctx, ans_grad: Tensor
+    ) -> Tuple[torch.Tensor, torch.Tensor, None, None, None, None]:
+        (px_grad, py_grad, lengths) = ctx.saved_tensors
+        S, T = lengths[:, 0], lengths[:, 1]
+        px_sizes = S * (T if ctx.modified else T + 1)
+        py_sizes = (S + 1) * T
+        px_grad *= ans_grad.repeat_interleave(
+            px_sizes, output_size=px_grad.numel()
+        )
+        py_grad *= ans_grad.repeat_interleave(
+            py_sizes, output_size=py_grad.numel()
+        )
+        return (px_grad, py_grad, None, None, None, None)
+
+
+def mutual_information_recursion_packed(
+    px: Tensor,
+    py: Tensor,
+    lengths: Tensor,
+    modified: bool = False,
+    return_grad: bool = False,
+) -> Union[Tuple[Tensor, Tuple[Tensor, Tensor]], Tensor]:
+    """A version of :func:`mutual_information_recursion` for batches of
+    sequences of different lengths that are stored without padding.  The
+    padded version allocates and processes ``[B][S+1][T+1]`` elements whatever
+    the lengths; this one only the real ``(s, t)`` positions of each sequence,
+    which saves much memory and some compute if the lengths are skewed.
+
+    Args:
+      px:
+        A 1-D torch.Tensor of some floating point type, the concatenation
+        of ``px_b.flatten()`` for ``b = 0 .. B-1``, where ``px_b`` is the
+        ``px`` of the ``b``'th sequence as in
+        :func:`mutual_information_recursion`, of shape ``[S_b][T_b+1]``
+        (``[S_b][T_b]`` if ``modified``).
+      py:
+        A 1-D torch.Tensor of the same dtype as ``px``, the concatenation of
+        ``py_b.flatten()``, where ``py_b`` is of shape ``[S_b+1][T_b]``.
+      lengths:
+        A torch.LongTensor of shape ``[B][2]`` whose ``b``'th row is
+        ``[S_b, T_b]``.
+      modified:
+        Whether ``px`` is for the "modified" recursion (see
+        :func:`mutual_information_recursion`).  Unlike in the padded version,
+        it cannot be worked out from the shapes.
+      return_grad:
+        Whether to return grads of ``px`` and ``py``, packed like ``px`` and
+        ``py``; see :func:`mutual_information_recursion`.
+
+    Returns:
+      Returns a torch.Tensor of shape ``[B]``, the same as
+      ``mutual_information_recursion(px_padded, py_padded, boundary)`` would
+      return with each row of ``boundary`` being ``[0, 0, S_b, T_b]``.
+      If ``return_grad`` is True, also returns ``(px_grad, py_grad)``.
+    """
+    assert px.ndim == 1, px.shape
+    assert py.ndim == 1, py.shape
+    assert px.dtype == py.dtype, (px.dtype, py.dtype)
+    assert lengths.dtype == torch.int64, lengths.dtype
+    assert lengths.ndim == 2 and lengths.shape[1] == 2, lengths.shape
 
     # The following statements are for efficiency
     px, py = px.contiguous(), py.contiguous()
+    lengths = lengths.to(px.device)
 
     pxy_grads = [None, None]
-    scores = MutualInformationRecursionFunction.apply(px, py, pxy_grads,
-                                                      boundary, return_grad)
+    scores = MutualInformationPackedFunction.apply(
+        px, py, pxy_grads, lengths, modified, return_grad
+    )
     px_grad, py_grad = pxy_grads
     return (scores, (px_grad, py_grad)) if return_grad else scores
 
@@ -387,7 +655,9 @@ def joint_mutual_information_recursion(
     assert px_tot.ndim == 3, px_tot.shape
     assert py_tot.ndim == 3, py_tot.shape
 
-    p = torch.empty(B, S + 1, T + 1, device=px_tot.device, dtype=px_tot.dtype)
+    p = torch.empty(
+        B, S + 1, T + 1, device=px_tot.device, dtype=_acc_dtype(px_tot.dtype)
+    )
 
     # note, tot_probs is without grad.
     tot_probs = _k2.mutual_information_forward(px_tot, py_tot, boundary, p)
@@ -395,7 +665,7 @@ def joint_mutual_information_recursion(
     # this is a kind of "fake gradient" that we use, in effect to compute
     # occupation probabilities.  The backprop will work regardless of the
     # actual derivative w.r.t. the total probs.
-    ans_grad = torch.ones(B, device=px_tot.device, dtype=px_tot.dtype)
+    ans_grad = torch.ones(B, device=px_tot.device, dtype=tot_probs.dtype)
 
     (px_grad,
      py_grad) = _k2.mutual_information_backward(px_tot, py_tot, boundary, p,
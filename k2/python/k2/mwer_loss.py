@@ -1,11 +1,60 @@
 # Copyright (c)  2022  Xiaomi Corporation (authors: Liyong Guo)
 
-from typing import List, Literal, Union
+from typing import List, Literal, Optional, Tuple, Union
 
 import torch
+import _k2
 import k2
 
 
+class _MwerLossFunction(torch.autograd.Function):
+
+    @staticmethod
+    def forward(ctx, lattice: k2.Fsa, aux_labels: k2.RaggedTensor,
+                ref_texts: k2.RaggedTensor, nbest_scale: float,
+                num_paths: int, temperature: float, use_double_scores: bool,
+                paths: List[Optional[k2.RaggedTensor]],
+                unused_scores: torch.Tensor) -> torch.Tensor:
+        '''Computes the MWER loss of each sampled path with
+        `_k2.mwer_loss()`.
+
+        Args:
+          paths:
+            A list with one entry, which is set to the sampled paths, with
+            axes [utt][path][arc].
+          unused_scores:
+            It is `lattice.scores`; its sole purpose is for back
+            propagation.
+        Returns:
+          Return the loss of each path, a 1-D tensor.
+        '''
+        path_loss, paths[0], path_probs = _k2.mwer_loss(
+            lattice.arcs,
+            aux_labels,
+            ref_texts,
+            nbest_scale=nbest_scale,
+            num_paths=num_paths,
+            temperature=temperature,
+            use_double_scores=use_double_scores)
+        ctx.lattice = lattice
+        ctx.paths = paths[0]
+        ctx.temperature = temperature
+        ctx.save_for_backward(path_probs, path_loss, unused_scores)
+        return path_loss
+
+    @staticmethod
+    def backward(ctx, path_loss_grad: torch.Tensor
+                ) -> Tuple[None, None, None, None, None, None, None, None,
+                           torch.Tensor]:
+        path_probs, path_loss, scores = ctx.saved_tensors
+        arc_grad = _k2.mwer_loss_backward(ctx.lattice.arcs, ctx.paths,
+                                          path_probs, path_loss,
+                                          ctx.temperature,
+                                          path_loss_grad.contiguous())
+        return (None, None, None, None, None, None, None, None,
+                arc_grad.to(scores.dtype))
+
+
 class MWERLoss(torch.nn.Module):
     '''Minimum Word Error Rate Loss compuration in k2.
 
@@ -75,47 +124,31 @@ class MWERLoss(torch.nn.Module):
             Minimum Word Error Rate loss.
         '''
 
-        nbest = k2.Nbest.from_lattice(
-            lattice=lattice,
-            num_paths=num_paths,
-            use_double_scores=self.use_double_scores,
-            nbest_scale=nbest_scale,
-        )
         device = lattice.scores.device
-        path_arc_shape = nbest.kept_path.shape.to(device)
-        stream_path_shape = nbest.shape.to(device)
-
-        hyps = nbest.build_levenshtein_graphs()
-        refs = k2.levenshtein_graph(ref_texts, device=hyps.device)
-        levenshtein_alignment = k2.levenshtein_alignment(
-            refs=refs,
-            hyps=hyps,
-            hyp_to_ref_map=nbest.shape.row_ids(1),
-            sorted_match_ref=True,
-        )
-        # tot_scores is a torch.Tensor with shape [tot_num_paths in this batch]
-        tot_scores = levenshtein_alignment.get_tot_scores(
-            use_double_scores=self.use_double_scores, log_semiring=False
-        )
-        # Each path has a corresponding wer.
-        wers = -tot_scores.to(device)
-
-        # Group each log_prob into [path][arc]
-        ragged_nbest_logp = k2.RaggedTensor(path_arc_shape, nbest.fsa.scores)
-        # Get the probability of each path, in log format,
-        # with shape [stream][path].
-        path_logp = ragged_nbest_logp.sum() / self.temperature
-
-        ragged_path_logp = k2.RaggedTensor(stream_path_shape, path_logp)
-        prob_normalized = ragged_path_logp.normalize(use_log=True).values.exp()
-
-        prob_normalized = prob_normalized * wers
+        if not isinstance(ref_texts, k2.RaggedTensor):
+            ref_texts = k2.RaggedTensor(ref_texts, device=device)
+        if isinstance(lattice.aux_labels, torch.Tensor):
+            aux_labels = k2.RaggedTensor(lattice.aux_labels.unsqueeze(-1))
+        else:
+            aux_labels = lattice.aux_labels
+
+        # Sampling, removing repeated word sequences, the levenshtein
+        # distances and the posteriors of the paths are all done in C++;
+        # see k2/csrc/mwer_loss.h.
+        paths = [None]
+        path_loss = _MwerLossFunction.apply(lattice, aux_labels,
+                                            ref_texts.to(device), nbest_scale,
+                                            num_paths, self.temperature,
+                                            self.use_double_scores, paths,
+                                            lattice.scores)
         if self.reduction == 'sum':
-            loss = prob_normalized.sum()
+            loss = path_loss.sum()
         elif self.reduction == 'mean':
-            loss = prob_normalized.mean()
+            loss = path_loss.mean()
         else:
-            loss = k2.RaggedTensor(stream_path_shape, prob_normalized)
+            # stream_path_shape has axes [stream][path]
+            stream_path_shape = paths[0].shape.get_layer(0)
+            loss = k2.RaggedTensor(stream_path_shape, path_loss)
         return loss
 
 
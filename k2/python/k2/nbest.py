@@ -22,7 +22,8 @@ def _get_texts(
     """Extract the texts (as word IDs) from the best-path FSAs.
 
     Note:
-        Used by Nbest.build_levenshtein_graphs during MWER computation.
+        Used by Nbest.build_levenshtein_graphs and
+        Nbest.compute_levenshtein_distance.
         Copied from icefall.
 
     Args:
@@ -296,6 +297,27 @@ class Nbest(object):
         word_ids = _get_texts(self.fsa, return_ragged=True)
         return k2.levenshtein_graph(word_ids)
 
+    def compute_levenshtein_distance(
+        self, ref_texts: Union[k2.RaggedTensor, List[List[int]]]
+    ) -> torch.Tensor:
+        """Return the levenshtein distance between the word sequence of
+        each path and the reference text of its utterance, as a 1-D
+        tensor with dtype torch.int32.
+
+        It is much faster than aligning the output of
+        :meth:`build_levenshtein_graphs` with the references using
+        :func:`k2.levenshtein_alignment`.
+
+        Args:
+          ref_texts:
+            The reference word IDs of each utterance. It can be either a
+            list of list-of-integers or a :class:`k2.RaggedTensor` with
+            `num_axes == 2`.
+        """
+        word_ids = _get_texts(self.fsa, return_ragged=True)
+        hyp_to_ref_map = self.shape.row_ids(1).to(word_ids.device)
+        return k2.levenshtein_distance(ref_texts, word_ids, hyp_to_ref_map)
+
 
 def whole_lattice_rescoring(lats: Fsa, G_with_epsilon_loops: Fsa) -> Fsa:
     '''Rescore the 1st pass lattice with an LM.
@@ -15,6 +15,7 @@
 # limitations under the License.
 
 from typing import List
+from typing import Optional
 from typing import Tuple
 
 import k2
@@ -35,6 +36,7 @@ class OnlineDenseIntersecter(object):
         output_beam: float,
         min_active_states: int,
         max_active_states: int,
+        max_active_arcs: int = 0,
     ) -> None:
         """Create a new online intersecter object.
         Args:
@@ -59,6 +61,12 @@ class OnlineDenseIntersecter(object):
             given frame for any given intersection/composition task. This is
             advisory, in that it will try not to exceed that but may not always
             succeed. You can use a very large number if no constraint is needed.
+          max_active_arcs:
+            If > 0, a target for the number of arcs per frame over all the
+            streams being decoded; while it is exceeded, the beams of all
+            streams are reduced together (see
+            :func:`k2.intersect_dense_pruned`).  This adjustment carries over
+            between calls to :func:`decode`.  0 means no target.
         Examples:
           .. code-block:: python
             # create a ``OnlineDenseIntersecter`` which can handle 2 streams.
@@ -100,6 +108,7 @@ class OnlineDenseIntersecter(object):
             output_beam,
             min_active_states,
             max_active_states,
+            max_active_arcs,
         )
 
     def decode(
@@ -132,3 +141,83 @@ class OnlineDenseIntersecter(object):
             self.decoding_graph, ragged_arc, arc_map
         )
         return out_fsa, new_decode_states
+
+    def decode_with_prefix(
+        self, dense_fsas: DenseFsaVec, decode_states: List[DecodeStateInfo]
+    ) -> Tuple[Fsa, Fsa, List[DecodeStateInfo]]:
+        """Like :func:`decode`, but the frame history of the sequences is
+        truncated, so that the memory of long streams stays bounded.
+
+        Once all the paths of a sequence pass through one state that will not
+        be pruned again, the part of its lattice before that state is final;
+        it is removed from the decoding state and returned as a prefix, which
+        ends with an arc labeled -1 to a new final state.  The whole lattice
+        of a sequence is then the concatenation of the prefixes returned so
+        far and the last output lattice.
+
+        Args:
+          dense_fsas:
+            As for :func:`decode`.
+          decode_states:
+            As for :func:`decode`.
+        Return:
+          Return a tuple (lattices, prefixes, new decoding states); the Fsa
+          ``prefixes`` has 3 axes and its FSAs are empty for the sequences
+          with no new prefix.
+        """
+        (
+            ragged_arc,
+            arc_map,
+            prefix_ragged_arc,
+            prefix_arc_map,
+            new_decode_states,
+        ) = self.intersecter.decode_with_prefix(
+            dense_fsas.dense_fsa_vec, decode_states
+        )
+        out_fsa = k2.utils.fsa_from_unary_function_tensor(
+            self.decoding_graph, ragged_arc, arc_map
+        )
+        prefix_fsa = k2.utils.fsa_from_unary_function_tensor(
+            self.decoding_graph, prefix_ragged_arc, prefix_arc_map
+        )
+        return out_fsa, prefix_fsa, new_decode_states
+
+    def decode_streams(
+        self, dense_fsas: DenseFsaVec, stream_ids: List[int]
+    ) -> Fsa:
+        """Like :func:`decode`, but the decoding states are kept by the
+        intersecter, indexed by stream id, instead of being passed in and out.
+
+        If the same streams are decoded in the same order as in the previous
+        call, and all the sequences of the previous chunk had the same number
+        of frames, their frame histories are used as they are, without being
+        split into per-stream states and stacked again.
+
+        Args:
+          dense_fsas:
+            The neural-net output, with each frame containing the log-likes of
+            each modeling unit.
+          stream_ids:
+            ``stream_ids[i]`` is the id of the stream that the i-th sequence
+            of ``dense_fsas`` belongs to; they must be distinct.  A stream
+            that has not been decoded before starts from scratch.
+        Return:
+          Return an Fsa with 3 axes (i.e. (batch, state, arc)) containing the
+          output lattices.
+        """
+        ragged_arc, arc_map = self.intersecter.decode_streams(
+            dense_fsas.dense_fsa_vec, stream_ids
+        )
+        return k2.utils.fsa_from_unary_function_tensor(
+            self.decoding_graph, ragged_arc, arc_map
+        )
+
+    def release_stream(self, stream_id: int) -> Optional[DecodeStateInfo]:
+        """Remove the decoding state of a stream decoded with
+        :func:`decode_streams`, e.g. when the stream has ended.
+
+        Return:
+          Return its decoding state, which can be passed to :func:`decode`,
+          or None if the stream has no state.
+        """
+        return self.intersecter.release_stream(stream_id)
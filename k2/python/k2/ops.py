@@ -24,6 +24,17 @@ import _k2
 from .fsa import Fsa
 
 
+def _deterministic_index_add() -> bool:
+    '''Returns true if backprop through arc maps should use the deterministic
+    version of `_k2.index_add`, i.e., if deterministic algorithms are enabled
+    in PyTorch (see `torch.use_deterministic_algorithms()`).
+    '''
+    # torch.are_deterministic_algorithms_enabled() is available since
+    # PyTorch 1.8
+    enabled = getattr(torch, 'are_deterministic_algorithms_enabled', None)
+    return enabled is not None and enabled()
+
+
 class _IndexSelectFunction(torch.autograd.Function):
 
     @staticmethod
@@ -71,7 +82,7 @@ class _IndexSelectFunction(torch.autograd.Function):
                           dtype=out_grad.dtype,
                           device=src.device,
                           requires_grad=False)
-        _k2.index_add(index, out_grad, ans)
+        _k2.index_add(index, out_grad, ans, _deterministic_index_add())
         return (
             ans,  # src
             None,  # index
@@ -118,8 +129,10 @@ def index_select(src: torch.Tensor,
     return ans
 
 
-def index_add(index: torch.Tensor, value: torch.Tensor,
-              in_out: torch.Tensor) -> None:
+def index_add(index: torch.Tensor,
+              value: torch.Tensor,
+              in_out: torch.Tensor,
+              deterministic: bool = False) -> None:
     '''It implements in_out[index[i]] += value[i].
 
     Caution:
@@ -148,12 +161,19 @@ def index_add(index: torch.Tensor, value: torch.Tensor,
       in_out:
         A 1-D or 2-D tensor with the same dtype as `value`. It satisfies
         `in_out.shape[1] == value.shape[1]` if it is a 2-D tensor.
+      deterministic:
+        If True, `index` is sorted and the values for each row of `in_out`
+        are summed with a segmented reduction instead of atomic adds, so
+        the result is reproducible.  It is also faster if many entries of
+        `index` are the same.  Backprop through arc maps (e.g. of
+        `scores`) uses it when `torch.use_deterministic_algorithms(True)`
+        is in effect.
 
     Returns:
       Return None.
     '''
 
-    _k2.index_add(index, value, in_out)
+    _k2.index_add(index, value, in_out, deterministic)
 
 
 def index_fsa(src: Fsa, indexes: torch.Tensor) -> Fsa:
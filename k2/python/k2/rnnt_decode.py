@@ -57,10 +57,33 @@ class RnntDecodingStream(object):
         """
         return f"{self.stream}, device : {self.device}\n"
 
+    def compact_prev_frames(self, horizon: int) -> None:
+        """Bound the memory used by the decoded frames of this stream.
+
+        Finalized frames (see
+        :meth:`RnntDecodingStreams.get_finalized_best_path`) that are at least
+        `horizon` frames older than the last one are dropped, except for one
+        that is collapsed to the single arc all the surviving states trace
+        back to. Lattices from :meth:`RnntDecodingStreams.format_output` then
+        only cover the frames that are left.
+
+        It must not be called while the stream is part of a
+        :class:`RnntDecodingStreams` that is still decoding.
+
+        Args:
+          horizon:
+            The number of most recent frames that are always kept.
+        """
+        self.stream.compact_prev_frames(horizon)
+
 
 class RnntDecodingStreams(object):
     """See https://github.com/k2-fsa/icefall/blob/master/egs/librispeech/ASR/pruned_transducer_stateless/beam_search.py  # noqa
     for how this class is used in RNN-T decoding.
+
+    The decoding methods release the GIL while they run, so several objects
+    can be used in different Python threads; a single object must not be
+    used by more than one thread at a time.
     """
 
     def __init__(
@@ -121,6 +144,49 @@ class RnntDecodingStreams(object):
         """
         return self.streams.get_contexts()
 
+    def get_unique_contexts(self) -> Tuple[Tensor, Tensor]:
+        """
+        Like :func:`get_contexts`, but each distinct context over all the
+        streams is returned only once, so that an external language model
+        for shallow fusion (see :func:`set_lm_scores`) is evaluated once per
+        context.  The LM is conditioned on the same ``decoder_history_len``
+        symbols as the decoder.
+
+        Returns:
+          Return a two-element tuple:
+
+          unique_contexts:
+            A tensor of shape [num_unique_contexts][decoder_history_len]
+            containing the distinct rows of the contexts returned by
+            :func:`get_contexts`.  Its dtype is torch.int32.
+
+          context_map:
+            A 1-D tensor of dtype torch.int32, mapping each context returned
+            by :func:`get_contexts` to its row in ``unique_contexts``.
+        """
+        return self.streams.get_unique_contexts()
+
+    def set_lm_scores(
+        self, lm_scores: Tensor, context_map: Tensor, lm_scale: float
+    ) -> None:
+        """
+        Set the scores of an external language model, to be added to the
+        log-probs of all symbols but the termination symbol 0 on the next
+        call to :func:`advance` or :func:`advance_sparse` only, so they take
+        part in the pruning and are included in the output lattice.
+
+        Args:
+          lm_scores:
+            A tensor of shape [num_unique_contexts][vocab_size] containing the
+            LM scores of the symbols given the ``unique_contexts`` returned by
+            :func:`get_unique_contexts`.
+          context_map:
+            The ``context_map`` returned by :func:`get_unique_contexts`.
+          lm_scale:
+            The scale of the LM scores, e.g. 0.3.
+        """
+        self.streams.set_lm_scores(lm_scores, context_map, lm_scale)
+
     def advance(self, logprobs: Tensor) -> None:
         """
         Advance decoding streams by one frame.
@@ -134,6 +200,24 @@ class RnntDecodingStreams(object):
         """
         self.streams.advance(logprobs)
 
+    def advance_sparse(self, symbols: Tensor, logprobs: Tensor) -> None:
+        """
+        Advance decoding streams by one frame, given log-probs for only some
+        of the symbols of each context, e.g. the output of `torch.topk()` on
+        the joiner output.  Symbols that are not given are treated as having
+        a log-prob of -infinity.
+
+        Args:
+          symbols:
+            A tensor of shape [tot_contexts][num_candidates], containing the
+            candidate symbols of each context output by `get_contexts()`, with
+            no repeats.  Each row must contain the termination symbol 0.
+          logprobs:
+            A tensor with the same shape as `symbols`, containing the log-probs
+            of the candidates.
+        """
+        self.streams.advance_sparse(symbols, logprobs)
+
     def terminate_and_flush_to_streams(self) -> None:
         """
         Terminate the decoding process of current RnntDecodingStreams object.
@@ -146,6 +230,56 @@ class RnntDecodingStreams(object):
         """
         self.streams.terminate_and_flush_to_streams()
 
+    def detach_stream(self, slot: int) -> None:
+        """
+        Detach the stream in slot `slot` while the other streams keep
+        decoding; its decoding states and results are stored to it like
+        `terminate_and_flush_to_streams()` does. The slot stays empty until
+        `attach_stream()` is called for it.
+
+        Args:
+          slot:
+            The index of the stream in `src_streams`.
+        """
+        self.streams.detach_stream(slot)
+        self.src_streams[slot] = None
+
+    def attach_stream(self, slot: int, stream: RnntDecodingStream) -> None:
+        """
+        Attach `stream` to the empty slot `slot`, e.g. one emptied by
+        `detach_stream()`. It is decoded from the next call to `advance()`
+        on, without re-creating this object for the other streams.
+
+        Args:
+          slot:
+            The index of the slot, it must be empty.
+          stream:
+            The stream to attach.
+        """
+        assert self.src_streams[slot] is None, f"Slot {slot} is not empty"
+        assert stream.device == self.device, (stream.device, self.device)
+        self.streams.attach_stream(slot, stream.stream)
+        self.src_streams[slot] = stream
+
+    def get_finalized_best_path(self) -> RaggedTensor:
+        """
+        Get the part of the best path of each stream that has become final
+        since the last call, e.g. to emit partial results while decoding.
+        A frame is final once all the surviving states of the stream trace
+        back to the same state on it. Unlike `format_output()`, no lattice is
+        created, and only the frames since the last call are visited.
+
+        Like `format_output()`, it must be called after
+        `terminate_and_flush_to_streams()`.
+
+        Returns:
+          Return a RaggedTensor with 2 axes [stream][arc], containing the
+          arc indexes into the decoding graph of each stream of the newly
+          finalized arcs, in order (arcs that emit the termination symbol are
+          not included). Use them to index e.g. the aux_labels of the graph.
+        """
+        return self.streams.get_finalized_best_path()
+
     def format_output(
             self,
             num_frames: List[int],
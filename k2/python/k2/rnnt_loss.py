@@ -16,6 +16,7 @@
 
 import os
 
+import _k2
 import torch
 from torch import Tensor
 from typing import Optional, Tuple, Union
@@ -219,6 +220,7 @@ def rnnt_loss_simple(
     delay_penalty: float = 0.0,
     reduction: Optional[str] = "mean",
     return_grad: bool = False,
+    checkpoint_interval: int = 0,
 ) -> Union[Tensor, Tuple[Tensor, Tuple[Tensor, Tensor]]]:
     """A simple case of the RNN-T loss, where the 'joiner' network is just
     addition.
@@ -271,6 +273,10 @@ def rnnt_loss_simple(
         get if you did `torch.autograd.grad((-loss.sum()), [px, py])`, note, the
         loss here is the loss with reduction "none".
         This is useful to implement the pruned version of rnnt loss.
+      checkpoint_interval:
+        If positive, trade compute for memory for long symbol sequences; see
+        the documentation of `mutual_information_recursion`.  Values near
+        sqrt(S) use the least memory.
     Returns:
        If return_grad is False, returns a tensor of shape (B,), containing the
        total RNN-T loss values for each element of the batch if reduction equals
@@ -306,7 +312,11 @@ def rnnt_loss_simple(
         px += penalty.to(px.dtype)
 
     scores_and_grads = mutual_information_recursion(
-        px=px, py=py, boundary=boundary, return_grad=return_grad
+        px=px,
+        py=py,
+        boundary=boundary,
+        return_grad=return_grad,
+        checkpoint_interval=checkpoint_interval,
     )
     negated_loss = scores_and_grads[0] if return_grad else scores_and_grads
     if reduction == "none":
@@ -623,6 +633,7 @@ def get_rnnt_prune_ranges(
     py_grad: torch.Tensor,
     boundary: torch.Tensor,
     s_range: int,
+    fused: bool = False,
 ) -> torch.Tensor:
     """Get the pruning ranges of normal rnnt loss according to the grads
     of px and py returned by mutual_information_recursion.
@@ -661,6 +672,11 @@ def get_rnnt_prune_ranges(
         [begin_symbol, begin_frame, end_symbol, end_frame]
       s_range:
         How many symbols to keep for each frame.
+      fused:
+        If True and ``px_grad`` is of dtype torch.float32 or torch.float64,
+        compute the ranges with a single fused op (CPU or CUDA), which
+        avoids the intermediate tensors of the size of ``py_grad`` and the
+        many small kernels of the unfused code.  The result is the same.
     Returns:
       A tensor with the shape of (B, T, s_range) containing the indexes of the
       kept symbols for each frame.
@@ -691,6 +707,14 @@ def get_rnnt_prune_ranges(
         ), f"""Pruning range for standard RNN-T should be equal to or greater
         than 2, or no valid paths could survive pruning. Given {s_range}"""
 
+    if fused and px_grad.dtype in (torch.float32, torch.float64):
+        return _k2.rnnt_prune_ranges(
+            px_grad,
+            py_grad.to(px_grad.dtype),
+            boundary.to(torch.int64).contiguous(),
+            s_range,
+        )
+
     (B_stride, S_stride, T_stride) = py_grad.stride()
     blk_grad = torch.as_strided(
         py_grad,
@@ -875,8 +899,32 @@ def get_rnnt_prune_ranges_deprecated(
     return ranges
 
 
+class _RnntPruneGatherFunction(torch.autograd.Function):
+    """Computes ``lm_pruned`` of :func:`do_rnnt_pruning` with a fused op,
+    without expanding ``lm`` to (B, T, S + 1, decoder_dim) or ``ranges`` to
+    (B, T, s_range, decoder_dim).
+    """
+
+    @staticmethod
+    def forward(ctx, lm: Tensor, ranges: Tensor) -> Tensor:
+        ctx.S1 = lm.shape[1]
+        ctx.save_for_backward(ranges)
+        return _k2.rnnt_prune_gather(lm, ranges)
+
+    @staticmethod
+    def backward(ctx, lm_pruned_grad: Tensor) -> Tuple[Tensor, None]:
+        (ranges,) = ctx.saved_tensors
+        lm_grad = _k2.rnnt_prune_gather_backward(
+            lm_pruned_grad.contiguous(), ranges, ctx.S1
+        )
+        return lm_grad, None
+
+
 def do_rnnt_pruning(
-    am: torch.Tensor, lm: torch.Tensor, ranges: torch.Tensor
+    am: torch.Tensor,
+    lm: torch.Tensor,
+    ranges: torch.Tensor,
+    fused: bool = False,
 ) -> Tuple[torch.Tensor, torch.Tensor]:
     """Prune the output of encoder(am) and prediction network(lm) with ranges
     generated by `get_rnnt_prune_ranges`.
@@ -890,6 +938,9 @@ def do_rnnt_pruning(
         A tensor containing the symbol indexes for each frame that we want to
         keep. Its shape is (B, T, s_range), see the docs in
         `get_rnnt_prune_ranges` for more details of this tensor.
+      fused:
+        If True and ``lm`` is of dtype torch.float32 or torch.float64, gather
+        ``lm`` with a fused op (CPU or CUDA).  The result is the same.
 
     Returns:
       Return the pruned am and lm with shape (B, T, s_range, C)
@@ -909,6 +960,12 @@ def do_rnnt_pruning(
     # (B, T, s_range, encoder_dim)
     am_pruned = am.unsqueeze(2).expand((B, T, s_range, encoder_dim))
 
+    if fused and lm.dtype in (torch.float32, torch.float64):
+        lm_pruned = _RnntPruneGatherFunction.apply(
+            lm.contiguous(), ranges.to(torch.int64).contiguous()
+        )
+        return am_pruned, lm_pruned
+
     # (B, T, s_range, decoder_dim)
     lm_pruned = torch.gather(
         lm.unsqueeze(1).expand((B, T, S + 1, decoder_dim)),
@@ -955,6 +1012,59 @@ def _roll_by_shifts(src: torch.Tensor, shifts: torch.LongTensor):
     return torch.gather(src, 2, index)
 
 
+class _RnntLogprobsPrunedFunction(torch.autograd.Function):
+    """Computes px and py of :func:`get_rnnt_logprobs_pruned` from the pruned
+    logits in one fused op.  Unlike the unfused code, it neither keeps the
+    log-softmax of ``logits`` for backward nor creates intermediate tensors
+    of the size of ``logits``; backward writes the gradient w.r.t. ``logits``
+    directly.
+    """
+
+    @staticmethod
+    def forward(
+        ctx,
+        logits: Tensor,
+        symbols: Tensor,
+        ranges: Tensor,
+        termination_symbol: int,
+        modified: bool,
+    ) -> Tuple[Tensor, Tensor]:
+        px, py, normalizers = _k2.rnnt_logprobs_pruned_forward(
+            logits, symbols, ranges, termination_symbol, modified
+        )
+        ctx.termination_symbol = termination_symbol
+        ctx.modified = modified
+        ctx.save_for_backward(logits, symbols, ranges, normalizers)
+        return px, py
+
+    @staticmethod
+    def backward(
+        ctx, px_grad: Optional[Tensor], py_grad: Optional[Tensor]
+    ) -> Tuple[Tensor, None, None, None, None]:
+        logits, symbols, ranges, normalizers = ctx.saved_tensors
+        B, T, _, _ = logits.shape
+        S = symbols.shape[1]
+        if px_grad is None:
+            T1 = T if ctx.modified else T + 1
+            px_grad = torch.zeros(
+                (B, S, T1), device=logits.device, dtype=logits.dtype
+            )
+        if py_grad is None:
+            py_grad = torch.zeros(
+                (B, S + 1, T), device=logits.device, dtype=logits.dtype
+            )
+        logits_grad = _k2.rnnt_logprobs_pruned_backward(
+            logits,
+            symbols,
+            ranges,
+            ctx.termination_symbol,
+            normalizers,
+            px_grad.contiguous(),
+            py_grad.contiguous(),
+        )
+        return logits_grad, None, None, None, None
+
+
 def get_rnnt_logprobs_pruned(
     logits: Tensor,
     symbols: Tensor,
@@ -962,6 +1072,7 @@ def get_rnnt_logprobs_pruned(
     termination_symbol: int,
     boundary: Tensor,
     rnnt_type: str = "regular",
+    fused: bool = False,
 ) -> Tuple[Tensor, Tensor]:
     """Construct px, py for mutual_information_recursion with pruned output.
 
@@ -1000,6 +1111,14 @@ def get_rnnt_logprobs_pruned(
                        *next* context on the *current* frame, e.g. if we emit
                        c given "a b" context, we are forced to emit "blank"
                        given "b c" context on the current frame.
+      fused:
+        If True and ``logits`` is float32 or float64, compute px and py with
+        a single fused op (CPU or CUDA) that does the log-softmax
+        normalization and the gathering on the fly, and whose backward writes
+        the gradient w.r.t. ``logits`` directly.  This saves the intermediate
+        tensors of the size of ``logits`` that the unfused code keeps for
+        backward.  It requires ``ranges[b,t,r] == ranges[b,t,0] + r``, which
+        holds for the output of :func:`get_rnnt_prune_ranges`.
     Returns:
       (px, py) (the names are quite arbitrary)::
 
@@ -1040,6 +1159,20 @@ def get_rnnt_logprobs_pruned(
     assert T >= S, (T, S)
     assert rnnt_type in ["regular", "modified", "constrained"], rnnt_type
 
+    if fused and logits.dtype in (torch.float32, torch.float64):
+        px, py = _RnntLogprobsPrunedFunction.apply(
+            logits.contiguous(),
+            symbols.to(torch.int64).contiguous(),
+            ranges.to(torch.int64).contiguous(),
+            termination_symbol,
+            rnnt_type != "regular",
+        )
+        if rnnt_type == "regular":
+            px = fix_for_boundary(px, boundary)
+        elif rnnt_type == "constrained":
+            px += py[:, 1:, :]
+        return (px, py)
+
     normalizers = torch.logsumexp(logits, dim=3)
 
     symbols_with_terminal = torch.cat(
@@ -1136,6 +1269,7 @@ def rnnt_loss_pruned(
     rnnt_type: str = "regular",
     delay_penalty: float = 0.0,
     reduction: Optional[str] = "mean",
+    fused: bool = False,
 ) -> Tensor:
     """A RNN-T loss with pruning, which uses the output of a pruned 'joiner'
     network as input, i.e. a 4 dimensions tensor with shape (B, T, s_range, C),
@@ -1186,6 +1320,10 @@ def rnnt_loss_pruned(
         `mean`: apply `torch.mean` over the batches.
         `sum`: the output will be summed.
         Default: `mean`
+      fused:
+        If True, use a fused op to compute px and py from ``logits``, which
+        needs much less memory for training.  See the documentation of
+        :func:`get_rnnt_logprobs_pruned`.
     Returns:
       If reduction is `none`, returns a tensor of shape (B,), containing the
       total RNN-T loss values for each sequence of the batch, otherwise a scalar
@@ -1198,6 +1336,7 @@ def rnnt_loss_pruned(
         termination_symbol=termination_symbol,
         boundary=boundary,
         rnnt_type=rnnt_type,
+        fused=fused,
     )
 
     if delay_penalty > 0.0:
@@ -15,6 +15,7 @@
 # See the License for the specific language governing permissions and
 # limitations under the License.
 
+from collections import defaultdict
 from typing import Optional
 from typing import Tuple
 from typing import Union
@@ -443,7 +444,28 @@ def fsa_from_unary_function_tensor(src: Fsa, dest_arcs: _k2.RaggedArc,
     '''
     dest = Fsa(dest_arcs)
 
+    # 1-D tensor attributes that don't need autograd are indexed together,
+    # with one kernel per dtype.
+    to_pack = defaultdict(list)
     for name, value in src.named_tensor_attr(include_scores=False):
+        if isinstance(value, torch.Tensor) and value.ndim == 1 and \
+                not value.requires_grad:
+            to_pack[value.dtype].append(name)
+
+    packed = set()
+    for names in to_pack.values():
+        if len(names) == 1:
+            continue
+        values = _k2.index_select_many(
+            [getattr(src, name) for name in names], arc_map,
+            [float(src.get_filler(name)) for name in names])
+        for name, new_value in zip(names, values):
+            setattr(dest, name, new_value)
+        packed.update(names)
+
+    for name, value in src.named_tensor_attr(include_scores=False):
+        if name in packed:
+            continue
         if isinstance(value, torch.Tensor):
             filler = float(src.get_filler(name))
             new_value = index_select(value, arc_map, default_value=filler)
@@ -537,8 +559,7 @@ def fsa_from_unary_function_ragged(src: Fsa,
                 assert isinstance(value, k2.RaggedTensor)
                 # We currently don't support float ragged attributes
                 assert value.dtype == torch.int32
-                new_value = value.index(arc_map)
-                new_value = new_value.remove_axis(new_value.num_axes - 2)
+                new_value = value.index(arc_map, remove_axis=True)
             setattr(dest, name, new_value)
 
     for name, value in src.named_non_tensor_attr():
@@ -441,6 +441,39 @@ class TestCtcLoss(unittest.TestCase):
                                   atol=1e-2)
 
 
+    def test_fast_path(self):
+        for device in self.devices:
+            for modified in [False, True]:
+                T, N, C = 30, 3, 8
+                activations = torch.rand(N, T, C, device=device)
+                supervision_segments = torch.tensor(
+                    [[0, 0, T], [1, 0, T - 5], [2, 2, T - 10]],
+                    dtype=torch.int32)
+                targets = [
+                    torch.randint(1, C, (n,)).tolist() for n in [5, 10, 1]
+                ]
+                graph = k2.ctc_graph(targets, modified=modified,
+                                     device=device)
+
+                losses = []
+                grads = []
+                for use_fast_path in [True, False]:
+                    x = activations.detach().clone().requires_grad_(True)
+                    log_probs = torch.nn.functional.log_softmax(x, dim=-1)
+                    dense_fsa_vec = k2.DenseFsaVec(log_probs,
+                                                   supervision_segments)
+                    loss = k2.ctc_loss(graph,
+                                       dense_fsa_vec,
+                                       output_beam=1e10,
+                                       reduction='none',
+                                       use_fast_path=use_fast_path)
+                    scale = torch.arange(1, N + 1, device=device)
+                    (loss * scale).sum().backward()
+                    losses.append(loss)
+                    grads.append(x.grad)
+                assert torch.allclose(losses[0], losses[1])
+                assert torch.allclose(grads[0], grads[1], atol=1e-4)
+
 if __name__ == '__main__':
     torch.manual_seed(20210109)
     unittest.main()
@@ -21,12 +21,14 @@
 #
 #  ctest --verbose -R fsa_test_py -E "host|dense"
 
+import os
+import struct
+import tempfile
 import unittest
 
 import torch
 import _k2  # for test only, users should not import it.
 import k2
-import os
 
 
 def _remove_leading_spaces(s: str) -> str:
@@ -247,6 +249,44 @@ class TestFsa(unittest.TestCase):
                     [-1.2, -2.2, -3.2, -4.2, -5.2, -6.2, -7.2, -8.2, -9.2, 0],
                     dtype=torch.float32))
 
+    def test_from_openfst_binary(self):
+        # A VectorFst with states 0, 1, 2, start state 1 and final state 2,
+        # written as by OpenFst's VectorFst::Write().
+        def string(s):
+            return struct.pack('<i', len(s)) + s.encode()
+
+        inf = float('inf')
+        states = [(inf, [(3, 30, 0.25, 2)]),
+                  (inf, [(1, 10, 1.5, 0), (2, 20, 2.5, 2)]),
+                  (0.5, [])]
+        data = struct.pack('<i', 2125659606) + string('vector') + \
+            string('standard') + struct.pack('<iiQqqq', 2, 0, 0, 1, 3, 3)
+        for final_cost, arcs in states:
+            data += struct.pack('<fq', final_cost, len(arcs))
+            for arc in arcs:
+                data += struct.pack('<iifi', *arc)
+
+        expected = k2.Fsa.from_openfst(
+            """1 0 1 10 1.5
+               1 2 2 20 2.5
+               0 2 3 30 0.25
+               2 0.5
+            """,
+            acceptor=False)
+        with tempfile.TemporaryDirectory() as tmpdir:
+            filename = os.path.join(tmpdir, 'a.fst')
+            with open(filename, 'wb') as f:
+                f.write(data)
+            fsa = k2.Fsa.from_openfst_binary(filename, acceptor=False)
+            acceptor = k2.Fsa.from_openfst_binary(filename)
+
+        assert torch.all(torch.eq(fsa.arcs.values()[:, :3],
+                                  expected.arcs.values()[:, :3]))
+        assert torch.allclose(fsa.scores, expected.scores)
+        assert torch.all(torch.eq(fsa.aux_labels, expected.aux_labels))
+        assert not hasattr(acceptor, 'aux_labels')
+        assert torch.all(torch.eq(acceptor.labels, expected.labels))
+
     def test_acceptor_from_openfst_ragged1(self):
         s = '''
             0 1  2 [] -1.2
@@ -755,6 +795,40 @@ class TestFsa(unittest.TestCase):
         fsa = fsa.to('cpu')
         assert fsa.is_cpu()
 
+    def test_to_non_blocking(self):
+        if not (torch.cuda.is_available() and k2.with_cuda):
+            return
+        s0 = '''
+            0 1 1 0.1
+            1 2 2 0.2
+            2 3 -1 0.3
+            3
+        '''
+        s1 = '''
+            0 1 -1 0.4
+            1
+        '''
+        fsa0 = k2.Fsa.from_str(s0)
+        fsa1 = k2.Fsa.from_str(s1)
+        fsa = k2.create_fsa_vec([fsa0, fsa1]).requires_grad_(True)
+        fsa.aux_labels = k2.RaggedTensor('[[1 2] [] [3] [0]]')
+        fsa.phones = torch.tensor([5, 6, -1, -1], dtype=torch.int32)
+        fsa.tensor_attr = torch.tensor([0.5, 1.5, 2.5, 3.5])
+        fsa.int64_attr = torch.tensor([1, 2, 3, 4])
+
+        device = torch.device('cuda', 0)
+        expected = fsa.to(device)
+        ans = fsa.to(device, non_blocking=True)
+        torch.cuda.current_stream().synchronize()
+        assert ans.is_cuda()
+        assert str(ans) == str(expected)
+        assert ans.aux_labels == expected.aux_labels
+        for name in ['scores', 'phones', 'tensor_attr', 'int64_attr']:
+            assert torch.equal(getattr(ans, name), getattr(expected, name))
+
+        ans.scores.sum().backward()
+        assert torch.equal(fsa.scores.grad, torch.ones(4))
+
     def test_getitem(self):
         s0 = '''
             0 1 1 0.1
@@ -1160,8 +1234,10 @@ class TestFsa(unittest.TestCase):
             assert fsa.tensor_attr2 == expected
 
     def test_invalidate_cache(self):
+        # Not linear, so that get_tot_scores() computes the forward scores.
         s = '''
             0 1 1 0.1
+            0 1 2 0.15
             1 2 -1 0.2
             2
         '''
@@ -1177,6 +1253,35 @@ class TestFsa(unittest.TestCase):
         assert 'forward_scores_double_log' not in fsa._cache
         assert 'state_batches' in fsa._cache
 
+    def test_shared_topology_cache(self):
+        s = '''
+            0 1 1 0.1
+            0 1 2 0.15
+            1 2 -1 0.2
+            2
+        '''
+        fsa = k2.create_fsa_vec([k2.Fsa.from_str(s)])
+        detached = fsa.detach()
+        detached.get_tot_scores(True, True)
+
+        # The topology-derived entries are shared, the scores are not.
+        assert 'state_batches' in fsa._cache
+        assert 'forward_scores_double_log' not in fsa._cache
+        assert fsa._get_state_batches() is detached._get_state_batches()
+
+        cloned = fsa.clone()
+        assert cloned._get_entering_arc_batches() is \
+                fsa._get_entering_arc_batches()
+        assert 'entering_arc_batches' in detached._cache
+
+        # Also shared by an Fsa constructed on the same arcs.
+        other = k2.Fsa(fsa.arcs)
+        assert 'state_batches' in other._cache
+        assert 'forward_scores_double_log' not in other._cache
+
+        cloned._invalidate_cache_()
+        assert 'state_batches' not in fsa._cache
+
 
 if __name__ == '__main__':
     unittest.main()
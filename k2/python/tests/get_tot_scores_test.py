@@ -323,6 +323,38 @@ class TestGetTotScores(unittest.TestCase):
             assert torch.allclose(fsa2.scores.grad,
                                   scale[1] * expected_grad_fsa2)
 
+    def test_linear_fsas(self):
+        # Linear FSAs take a fast path that sums the arc scores.
+        s1 = '''
+            0 1 1 0.5
+            1 2 2 -1.25
+            2 3 -1 2
+            3
+        '''
+        s2 = '''
+            0 1 -1 3.5
+            1
+        '''
+        for device in self.devices:
+            for log_semiring in (False, True):
+                for use_double_scores in (False, True):
+                    fsa1 = k2.Fsa.from_str(s1).to(device)
+                    fsa2 = k2.Fsa.from_str(s2).to(device)
+                    fsa_vec = k2.create_fsa_vec([fsa1, fsa2])
+                    assert fsa_vec.properties & k2.fsa_properties.LINEAR
+                    fsa_vec.requires_grad_(True)
+                    log_like = fsa_vec.get_tot_scores(
+                        log_semiring=log_semiring,
+                        use_double_scores=use_double_scores)
+                    expected_log_like = torch.tensor([1.25, 3.5]).to(log_like)
+                    assert torch.allclose(log_like, expected_log_like)
+
+                    scale = torch.tensor([-2.5, 1.5]).to(log_like)
+                    (scale * log_like).sum().backward()
+                    expected_grad = torch.tensor([-2.5, -2.5, -2.5,
+                                                  1.5]).to(device)
+                    assert torch.allclose(fsa_vec.scores.grad, expected_grad)
+
 
 if __name__ == '__main__':
     unittest.main()
@@ -204,6 +204,30 @@ class TestIndexAdd(unittest.TestCase):
                 saved.index_add_(0, index.to(torch.int64) + 1, value)
                 assert torch.all(torch.eq(src, saved[1:]))
 
+    def test_deterministic(self):
+        for device in self.devices:
+            for shape in [(5000,), (5000, 3)]:
+                # high fan-in: many values go to the same few rows
+                index = torch.randint(-1,
+                                      4,
+                                      size=(shape[0],),
+                                      dtype=torch.int32,
+                                      device=device)
+                value = torch.rand(*shape, device=device)
+                dest = torch.rand(4, *shape[1:], device=device)
+
+                ans = dest.clone()
+                k2.index_add(index, value, ans, deterministic=True)
+                for i in range(3):
+                    again = dest.clone()
+                    k2.index_add(index, value, again, deterministic=True)
+                    assert torch.equal(ans, again)
+
+                expected = torch.cat([torch.zeros_like(dest[:1]), dest])
+                expected.index_add_(0, index.to(torch.int64) + 1, value)
+                assert torch.allclose(ans, expected[1:])
+
+
 
 if __name__ == '__main__':
     unittest.main()
@@ -26,6 +26,7 @@ import unittest
 
 import k2
 import torch
+import _k2
 
 
 class TestIndexSelect(unittest.TestCase):
@@ -95,6 +96,29 @@ class TestIndexSelect(unittest.TestCase):
                 assert torch.allclose(c, expected)
                 assert torch.allclose(a.grad, new_a.grad)
 
+    def test_1d_many(self):
+        for device in self.devices:
+            for dtype in [torch.int32, torch.int64, torch.float32]:
+                num_rows = torch.randint(1, 2000, size=(1,)).item()
+                srcs = [
+                    torch.randint(-1000,
+                                  1000,
+                                  size=(num_rows,),
+                                  device=device).to(dtype) for _ in range(3)
+                ]
+                num_indexes = torch.randint(1, 20000, size=(1,)).item()
+                index = torch.randint(-1,
+                                      num_rows,
+                                      size=(num_indexes,),
+                                      dtype=torch.int32,
+                                      device=device)
+                default_values = [0, -1, 2]
+                ans = _k2.index_select_many(srcs, index, default_values)
+                assert len(ans) == len(srcs)
+                for src, d, a in zip(srcs, default_values, ans):
+                    expected = k2.index_select(src, index, default_value=d)
+                    assert torch.equal(a, expected)
+
     def test_1d_empty_index(self):
         for device in self.devices:
             for dtype in [torch.int32, torch.int64]:
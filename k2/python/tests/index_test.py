@@ -156,6 +156,14 @@ class TestIndexRaggedTensor(unittest.TestCase):
                                            device=device)
             self.assertTrue(torch.allclose(ans.values, expected_values))
 
+            # index with ragged int, with -1, removing the axis directly
+            ragged_index = k2.RaggedTensor([[0, -1, 3], [], [-1], [2, 1]],
+                                           dtype=torch.int32).to(device)
+            ans = src.index(ragged_index, remove_axis=True)
+            expected = k2.RaggedTensor([[1, 2, 4, 5, 6], [], [], [3]],
+                                       dtype=torch.int32).to(device)
+            self.assertEqual(ans, expected)
+
             # index with tensor
             tensor_index = torch.tensor([0, 3, 2, 1, 2, 1],
                                         dtype=torch.int32,
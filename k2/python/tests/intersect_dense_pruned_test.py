@@ -281,6 +281,159 @@ class TestIntersectDensePruned(unittest.TestCase):
                                             use_double_scores=False)
             scores.sum().backward()
 
+    def test_need_entering_arcs(self):
+        s = '''
+            0 1 1 1.0
+            1 1 1 2.0
+            1 2 2 2.0
+            1 2 1 0.5
+            2 3 -1 3.0
+            3
+        '''
+        for device in self.devices:
+            fsa = k2.arc_sort(k2.Fsa.from_str(s)).to(device)
+            fsa_vec = k2.create_fsa_vec([fsa, fsa])
+            log_prob = torch.rand((2, 20, 3),
+                                  dtype=torch.float32,
+                                  device=device)
+            supervision_segments = torch.tensor([[0, 0, 20], [1, 5, 10]],
+                                                dtype=torch.int32)
+            dense_fsa_vec = k2.DenseFsaVec(log_prob, supervision_segments)
+            out_fsa = k2.intersect_dense_pruned(fsa_vec,
+                                                dense_fsa_vec,
+                                                search_beam=100,
+                                                output_beam=100,
+                                                min_active_states=1,
+                                                max_active_states=10,
+                                                need_entering_arcs=True)
+            assert 'entering_arcs' in out_fsa._cache
+            best_path = k2.shortest_path(out_fsa, use_double_scores=False)
+
+            out_fsa._invalidate_cache_(scores_only=False)
+            assert 'entering_arcs' not in out_fsa._cache
+            expected_best_path = k2.shortest_path(out_fsa,
+                                                  use_double_scores=False)
+            assert torch.allclose(
+                best_path.get_tot_scores(False, False),
+                expected_best_path.get_tot_scores(False, False))
+
+    def test_one_best(self):
+        s = '''
+            0 1 1 1.0
+            1 1 1 2.0
+            1 2 2 2.0
+            1 2 1 0.5
+            2 3 -1 3.0
+            3
+        '''
+        for device in self.devices:
+            fsa = k2.arc_sort(k2.Fsa.from_str(s)).to(device)
+            fsa.aux_labels = torch.tensor([10, 11, 12, 13, -1],
+                                          dtype=torch.int32).to(device)
+            fsa_vec = k2.create_fsa_vec([fsa, fsa])
+            log_prob = torch.rand((2, 20, 3),
+                                  dtype=torch.float32,
+                                  device=device,
+                                  requires_grad=True)
+            supervision_segments = torch.tensor([[0, 0, 20], [1, 5, 10]],
+                                                dtype=torch.int32)
+            dense_fsa_vec = k2.DenseFsaVec(log_prob, supervision_segments)
+            best_path = k2.intersect_dense_pruned(fsa_vec,
+                                                  dense_fsa_vec,
+                                                  search_beam=100,
+                                                  output_beam=100,
+                                                  min_active_states=1,
+                                                  max_active_states=10,
+                                                  one_best=True)
+            lattice = k2.intersect_dense_pruned(fsa_vec,
+                                                dense_fsa_vec,
+                                                search_beam=100,
+                                                output_beam=100,
+                                                min_active_states=1,
+                                                max_active_states=10)
+            expected_best_path = k2.shortest_path(lattice,
+                                                  use_double_scores=False)
+            assert best_path.shape[0] == 2
+            scores = best_path.get_tot_scores(False, False)
+            assert torch.allclose(
+                scores, expected_best_path.get_tot_scores(False, False))
+            assert best_path.aux_labels.numel() == best_path.num_arcs
+
+            scores.sum().backward()
+            # Each frame of each sequence is on the best path exactly once.
+            assert torch.allclose(log_prob.grad.sum(),
+                                  torch.tensor(30.0, device=device))
+
+    def test_stats(self):
+        s = '''
+            0 1 1 1.0
+            1 1 1 2.0
+            1 2 2 2.0
+            1 2 1 0.5
+            2 3 -1 3.0
+            3
+        '''
+        for device in self.devices:
+            fsa = k2.arc_sort(k2.Fsa.from_str(s)).to(device)
+            fsa_vec = k2.create_fsa_vec([fsa, fsa])
+            log_prob = torch.rand((2, 20, 3),
+                                  dtype=torch.float32,
+                                  device=device)
+            supervision_segments = torch.tensor([[0, 0, 20], [1, 5, 10]],
+                                                dtype=torch.int32)
+            dense_fsa_vec = k2.DenseFsaVec(log_prob, supervision_segments)
+            stats = dict()
+            out_fsa = k2.intersect_dense_pruned(fsa_vec,
+                                                dense_fsa_vec,
+                                                search_beam=100,
+                                                output_beam=100,
+                                                min_active_states=1,
+                                                max_active_states=10,
+                                                stats=stats)
+            # 21 frames including the final one of the longest sequence.
+            for name in ('num_states', 'num_arcs', 'beams',
+                         'num_output_arcs'):
+                assert stats[name].shape == (22, 2)
+                assert stats[name].device == device
+            assert stats['num_output_arcs'].sum() == out_fsa.num_arcs
+            # The sequences have 20 + 1 and 10 + 1 frames, and states on
+            # the frame after the last one (the final state).
+            assert torch.all(stats['num_states'][:, 0] > 0)
+            assert torch.all(stats['num_states'][:12, 1] > 0)
+            assert torch.all(stats['num_states'][12:, 1] == 0)
+
+    def test_sparse_log_probs_grad(self):
+        # Compare the gradient w.r.t. log_probs, which is computed from a
+        # sparse gradient of the scores, with the one through a dense
+        # gradient of the scores.  The last two supervision segments
+        # overlap.
+        for device in self.devices:
+            fsa_vec = k2.ctc_graph([[1, 2, 2], [3], [1, 3, 1]], device=device)
+            log_prob = torch.randn((2, 20, 4),
+                                   dtype=torch.float32,
+                                   device=device).log_softmax(-1)
+            supervision_segments = torch.tensor(
+                [[0, 0, 20], [1, 2, 10], [1, 5, 15]], dtype=torch.int32)
+
+            grads = []
+            for sparse in (True, False):
+                log_prob = log_prob.detach().requires_grad_(True)
+                dense_fsa_vec = k2.DenseFsaVec(log_prob, supervision_segments)
+                if not sparse:
+                    dense_fsa_vec = k2.DenseFsaVec._from_dense_fsa_vec(
+                        dense_fsa_vec.dense_fsa_vec, dense_fsa_vec.scores)
+                out_fsa = k2.intersect_dense_pruned(fsa_vec,
+                                                    dense_fsa_vec,
+                                                    search_beam=100,
+                                                    output_beam=100,
+                                                    min_active_states=1,
+                                                    max_active_states=10000)
+                scores = out_fsa.get_tot_scores(log_semiring=True,
+                                                use_double_scores=False)
+                scores.sum().backward()
+                grads.append(log_prob.grad)
+            assert torch.allclose(grads[0], grads[1], atol=1e-5)
+
 
 if __name__ == '__main__':
     unittest.main()
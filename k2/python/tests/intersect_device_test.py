@@ -116,6 +116,123 @@ class TestIntersectDevice(unittest.TestCase):
                     b_fsa_2.grad,
                     torch.tensor([-1, -1, -1]).to(b_fsa_2.grad))
 
+    def test_sorted_match_b(self):
+        # The state in b has one arc and the state in a has many, so the
+        # arcs of b are used to search those of a, and vice versa.
+        s1 = '''
+            0 1 1 0.1
+            0 1 2 0.2
+            0 1 3 0.3
+            0 1 4 0.4
+            1 2 2 0.5
+            2 3 -1 0.5
+            3
+        '''
+        s2 = '''
+            0 1 3 1
+            1 2 1 2
+            1 2 2 3
+            1 2 3 4
+            2 3 -1 5
+            3
+        '''
+        for device in self.devices:
+            a_fsas = k2.create_fsa_vec([k2.Fsa.from_str(s1)]).to(device)
+            b_fsas = k2.create_fsa_vec([k2.Fsa.from_str(s2)]).to(device)
+            b_to_a_map = torch.tensor([0], dtype=torch.int32).to(device)
+            c_fsas = k2.intersect_device(a_fsas,
+                                         b_fsas,
+                                         b_to_a_map,
+                                         sorted_match_a=True)
+            c_fsas_b = k2.intersect_device(a_fsas,
+                                           b_fsas,
+                                           b_to_a_map,
+                                           sorted_match_a=True,
+                                           sorted_match_b=True)
+            c_fsas = k2.connect(c_fsas.to('cpu'))
+            c_fsas_b = k2.connect(c_fsas_b.to('cpu'))
+            expected = '\n'.join(
+                ['0 1 3 1.3', '1 2 2 3.5', '2 3 -1 5.5', '3'])
+            assert k2.to_str_simple(c_fsas[0]).strip() == expected
+            assert k2.to_str_simple(c_fsas_b[0]).strip() == expected
+
+    def test_use_queue(self):
+        # recognizes 0(12)*3
+        s1 = '''
+            0 1 0 0.1
+            1 2 1 0.2
+            1 3 3 0.3
+            2 1 2 0.4
+            3 4 -1 0.5
+            4
+        '''
+        # recognizes 012123
+        s2 = '''
+            0 1 0 1
+            1 2 1 2
+            2 3 2 3
+            3 4 1 4
+            4 5 2 5
+            5 6 3 6
+            6 7 -1 7
+            7
+        '''
+        for device in self.devices:
+            a_fsas = k2.create_fsa_vec([k2.Fsa.from_str(s1)]).to(device)
+            b_fsas = k2.create_fsa_vec([k2.Fsa.from_str(s2)]).to(device)
+            b_to_a_map = torch.tensor([0], dtype=torch.int32).to(device)
+            for sorted_match_a in [True, False]:
+                c_fsas = k2.intersect_device(a_fsas,
+                                             b_fsas,
+                                             b_to_a_map,
+                                             sorted_match_a=sorted_match_a,
+                                             use_queue=True)
+                c_fsas = k2.connect(c_fsas.to('cpu'))
+                assert c_fsas[0].num_arcs == 7
+                assert torch.allclose(
+                    c_fsas[0].get_tot_scores(use_double_scores=True,
+                                             log_semiring=False),
+                    torch.tensor([30.1], dtype=torch.float64))
+
+    def test_a_self_loops(self):
+        s1 = '''
+            0 1 1 0.1
+            1 2 2 0.2
+            2 3 -1 0.3
+            3
+        '''
+        # has an epsilon between the 1 and the 2
+        s2 = '''
+            0 1 1 1
+            1 2 0 2
+            2 3 2 3
+            3 4 -1 4
+            4
+        '''
+        for device in self.devices:
+            a_fsa = k2.Fsa.from_str(s1).to(device)
+            a_fsas = k2.create_fsa_vec([a_fsa])
+            b_fsas = k2.create_fsa_vec([k2.Fsa.from_str(s2)]).to(device)
+            b_to_a_map = torch.tensor([0], dtype=torch.int32).to(device)
+            c_fsas, a_arc_map, _ = k2.intersect_device(a_fsas,
+                                                       b_fsas,
+                                                       b_to_a_map,
+                                                       sorted_match_a=True,
+                                                       ret_arc_maps=True,
+                                                       a_self_loops=True)
+            a_loops = k2.create_fsa_vec([k2.add_epsilon_self_loops(a_fsa)])
+            c_fsas_ref = k2.intersect_device(a_loops,
+                                             b_fsas,
+                                             b_to_a_map,
+                                             sorted_match_a=True)
+            c_fsas = k2.connect(c_fsas.to('cpu'))
+            c_fsas_ref = k2.connect(c_fsas_ref.to('cpu'))
+            expected = k2.to_str_simple(c_fsas_ref[0]).strip()
+            assert k2.to_str_simple(c_fsas[0]).strip() == expected
+            assert c_fsas[0].num_arcs == 4
+            # the epsilon arc of b matched a self-loop of a
+            assert (a_arc_map == -1).sum().item() == 1
+
 
 if __name__ == '__main__':
     unittest.main()
@@ -124,6 +124,42 @@ class TestLevenshteinDistance(unittest.TestCase):
             )
             assert torch.allclose(distance.to("cpu"), distance_refs)
 
+    def test_direct_distance(self):
+        for device in self.devices:
+            refs_vec = [
+                [random.randint(1, 10) for i in range(random.randint(0, 10))]
+                for j in range(3)
+            ]
+            hyps_vec = [
+                [random.randint(1, 10) for i in range(random.randint(0, 10))]
+                for j in range(8)
+            ]
+            hyp_to_ref_map = [random.randint(0, 2) for j in range(8)]
+
+            distance, ref_alignment, hyp_alignment = k2.levenshtein_distance(
+                k2.RaggedTensor(refs_vec, device=device),
+                k2.RaggedTensor(hyps_vec, device=device),
+                hyp_to_ref_map=torch.tensor(
+                    hyp_to_ref_map, dtype=torch.int32, device=device
+                ),
+                return_alignment=True,
+            )
+            ref_alignment = ref_alignment.tolist()
+            hyp_alignment = hyp_alignment.tolist()
+            for i in range(8):
+                ref = refs_vec[hyp_to_ref_map[i]]
+                assert distance[i].item() == levenshtein_distance(
+                    ref, hyps_vec[i]
+                )
+                # Removing the 0s gives back the sequences, and each
+                # position that differs is an edit.
+                assert [x for x in ref_alignment[i] if x != 0] == ref
+                assert [x for x in hyp_alignment[i] if x != 0] == hyps_vec[i]
+                num_edits = sum(
+                    x != y for x, y in zip(ref_alignment[i], hyp_alignment[i])
+                )
+                assert num_edits == distance[i].item()
+
 
 if __name__ == "__main__":
     unittest.main()
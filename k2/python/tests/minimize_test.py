@@ -0,0 +1,96 @@
+#!/usr/bin/env python3
+#
+# Copyright      2026  Xiaomi Corp.
+#
+# See ../../../LICENSE for clarification regarding multiple authors
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+# To run this single test, use
+#
+#  ctest --verbose -R minimize_test_py
+
+import unittest
+
+import k2
+import torch
+
+
+class TestMinimize(unittest.TestCase):
+
+    @classmethod
+    def setUpClass(cls):
+        cls.devices = [torch.device('cpu')]
+        if torch.cuda.is_available() and k2.with_cuda:
+            cls.devices.append(torch.device('cuda', 0))
+            if torch.cuda.device_count() > 1:
+                torch.cuda.set_device(1)
+                cls.devices.append(torch.device('cuda', 1))
+
+    def test(self):
+        # States 1 and 2 have the same suffix, and so do 3 and 4.
+        s = '''
+            0 1 1 1
+            0 2 2 2
+            1 3 3 0.5
+            2 4 3 0.5
+            3 5 -1 0
+            4 5 -1 0
+            5
+        '''
+        expected = '''
+            0 1 1 1
+            0 1 2 2
+            1 2 3 0.5
+            2 3 -1 0
+            3
+        '''
+        for device in self.devices:
+            fsa = k2.Fsa.from_str(s).to(device)
+            fsa.requires_grad_(True)
+            minimized = k2.minimize(fsa)
+            assert k2.to_str_simple(minimized.to('cpu')) == \
+                k2.to_str_simple(k2.Fsa.from_str(expected))
+
+            minimized.scores.sum().backward()
+            assert torch.all(
+                torch.eq(fsa.grad,
+                         torch.tensor([1, 1, 0, 1, 0, 1],
+                                      dtype=torch.float32,
+                                      device=device)))
+
+    def test_aux_labels(self):
+        # The aux_labels of the arcs leaving states 1 and 2 differ.
+        s = '''
+            0 1 1 1 1
+            0 2 2 2 2
+            1 3 3 0.5 3
+            2 4 3 0.5 4
+            3 5 -1 0 -1
+            4 5 -1 0 -1
+            5
+        '''
+        for device in self.devices:
+            fsa = k2.Fsa.from_str(s, num_aux_labels=1).to(device)
+            minimized = k2.minimize(fsa)
+            # Only states 3 and 4 are merged.
+            assert minimized.shape[0] == 5
+            assert torch.all(
+                torch.eq(minimized.aux_labels,
+                         torch.tensor([1, 2, 3, 4, -1],
+                                      dtype=torch.int32,
+                                      device=device)))
+
+
+if __name__ == '__main__':
+    unittest.main()
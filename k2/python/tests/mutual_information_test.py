@@ -186,6 +186,177 @@ class TestMutualInformation(unittest.TestCase):
                         m, expected_m.to(device), atol=1.0e-02, rtol=1.0e-02
                     )
 
+    def test_mutual_information_half(self):
+        for _iter in range(10):
+            (B, S, T) = (
+                random.randint(1, 10),
+                random.randint(1, 50),
+                random.randint(1, 100),
+            )
+            modified = random.random() < 0.5
+            if modified and T < S:
+                T = S + random.randint(0, 30)
+            T1 = T + (0 if modified else 1)
+            px_ = torch.randn(B, S, T1)
+            py_ = torch.randn(B, S + 1, T)
+
+            for device in self.devices:
+                for dtype in [torch.float16, torch.bfloat16]:
+                    # The reference is computed in float32 from the same
+                    # (rounded) values.
+                    px = px_.to(device=device, dtype=dtype)
+                    py = py_.to(device=device, dtype=dtype)
+                    ref_px = px.float().requires_grad_()
+                    ref_py = py.float().requires_grad_()
+                    px.requires_grad_()
+                    py.requires_grad_()
+
+                    m = k2.mutual_information_recursion(px, py)
+                    ref_m = k2.mutual_information_recursion(ref_px, ref_py)
+                    assert m.dtype == torch.float32, m.dtype
+                    assert torch.allclose(m, ref_m, atol=1e-4, rtol=1e-4)
+
+                    m_grad = torch.rand(B, device=device)
+                    m.backward(gradient=m_grad)
+                    ref_m.backward(gradient=m_grad)
+                    assert px.grad.dtype == dtype, px.grad.dtype
+                    assert py.grad.dtype == dtype, py.grad.dtype
+                    assert torch.allclose(
+                        px.grad.float(), ref_px.grad, atol=1e-2, rtol=1e-2
+                    )
+                    assert torch.allclose(
+                        py.grad.float(), ref_py.grad, atol=1e-2, rtol=1e-2
+                    )
+
+    def test_mutual_information_packed(self):
+        for _iter in range(10):
+            B = random.randint(1, 10)
+            modified = random.random() < 0.5
+            lengths = []
+            for b in range(B):
+                S, T = random.randint(1, 50), random.randint(1, 100)
+                if modified and T < S:
+                    T = S + random.randint(0, 30)
+                lengths.append([S, T])
+            T1 = 0 if modified else 1
+            px_list = [torch.randn(S, T + T1) for S, T in lengths]
+            py_list = [torch.randn(S + 1, T) for S, T in lengths]
+
+            for device in self.devices:
+                for dtype in self.dtypes:
+                    px = torch.cat([x.flatten() for x in px_list])
+                    py = torch.cat([y.flatten() for y in py_list])
+                    px = px.to(device=device, dtype=dtype).requires_grad_()
+                    py = py.to(device=device, dtype=dtype).requires_grad_()
+                    m = k2.mutual_information_recursion_packed(
+                        px,
+                        py,
+                        torch.tensor(lengths, dtype=torch.int64),
+                        modified=modified,
+                    )
+                    m_grad = torch.rand(B, dtype=dtype, device=device)
+                    m.backward(gradient=m_grad)
+
+                    # The reference processes the sequences one by one.
+                    px_grads, py_grads = [], []
+                    for b in range(B):
+                        ref_px = px_list[b].to(device=device, dtype=dtype)
+                        ref_py = py_list[b].to(device=device, dtype=dtype)
+                        ref_px = ref_px.unsqueeze(0).requires_grad_()
+                        ref_py = ref_py.unsqueeze(0).requires_grad_()
+                        ref_m = k2.mutual_information_recursion(
+                            ref_px, ref_py
+                        )
+                        assert torch.allclose(
+                            m[b], ref_m[0], atol=1e-4, rtol=1e-4
+                        ), (m[b], ref_m[0])
+                        ref_m.backward(gradient=m_grad[b:b + 1])
+                        px_grads.append(ref_px.grad.flatten())
+                        py_grads.append(ref_py.grad.flatten())
+
+                    assert torch.allclose(
+                        px.grad, torch.cat(px_grads), atol=1e-4, rtol=1e-4
+                    )
+                    assert torch.allclose(
+                        py.grad, torch.cat(py_grads), atol=1e-4, rtol=1e-4
+                    )
+
+    def test_mutual_information_cpu_threads(self):
+        # With a few large sequences, the CPU code splits the anti-diagonals
+        # of each sequence among threads; with many sequences, it splits the
+        # batch.  Compare both with the single-threaded results.
+        num_threads = torch.get_num_threads()
+        for (B, S, T) in [(1, 150, 300), (2, 100, 200), (32, 20, 50)]:
+            for modified in [False, True]:
+                T1 = T + (0 if modified else 1)
+                px_ = torch.randn(B, S, T1, dtype=torch.float64)
+                py_ = torch.randn(B, S + 1, T, dtype=torch.float64)
+                m_grad = torch.rand(B, dtype=torch.float64)
+
+                results = []
+                for threads in [1, max(num_threads, 4)]:
+                    torch.set_num_threads(threads)
+                    px = px_.clone().requires_grad_()
+                    py = py_.clone().requires_grad_()
+                    m = k2.mutual_information_recursion(px, py)
+                    m.backward(gradient=m_grad)
+                    results.append((m.detach(), px.grad, py.grad))
+                torch.set_num_threads(num_threads)
+
+                for a, b in zip(results[0], results[1]):
+                    assert torch.allclose(a, b), (a, b)
+
+    def test_mutual_information_checkpointed(self):
+        for _iter in range(10):
+            (B, S, T) = (
+                random.randint(1, 8),
+                random.randint(2, 60),
+                random.randint(1, 80),
+            )
+            modified = random.random() < 0.5
+            if modified and T < S:
+                T = S + random.randint(0, 30)
+            T1 = T + (0 if modified else 1)
+            boundary = None
+            if random.random() < 0.5:
+                rows = []
+                for b in range(B):
+                    s_end = random.randint(0, S)
+                    t_begin = random.randint(0, T - s_end if modified else T)
+                    t_end = random.randint(
+                        t_begin + (s_end if modified else 0), T
+                    )
+                    rows.append([0, t_begin, s_end, t_end])
+                boundary = torch.tensor(rows, dtype=torch.int64)
+            interval = random.randint(1, S - 1)
+            px_ = torch.randn(B, S, T1)
+            py_ = torch.randn(B, S + 1, T)
+            m_grad_ = torch.rand(B)
+
+            for device in self.devices:
+                for dtype in self.dtypes:
+                    results = []
+                    for checkpoint_interval in [0, interval]:
+                        px = px_.to(device=device, dtype=dtype)
+                        py = py_.to(device=device, dtype=dtype)
+                        px.requires_grad_()
+                        py.requires_grad_()
+                        m = k2.mutual_information_recursion(
+                            px,
+                            py,
+                            None if boundary is None else boundary.to(device),
+                            checkpoint_interval=checkpoint_interval,
+                        )
+                        m.backward(gradient=m_grad_.to(device=device,
+                                                       dtype=dtype))
+                        results.append((m.detach(), px.grad, py.grad))
+                    for a, b in zip(results[0], results[1]):
+                        assert torch.allclose(a, b, atol=1e-4, rtol=1e-4), (
+                            a,
+                            b,
+                            interval,
+                        )
+
     def test_mutual_information_deriv(self):
         for _iter in range(100):
             (B, S, T) = (
@@ -0,0 +1,71 @@
+#!/usr/bin/env python3
+#
+# Copyright      2026  Xiaomi Corp.
+#
+# See ../../../LICENSE for clarification regarding multiple authors
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+# To run this single test, use
+#
+#  ctest --verbose -R normalize_lattice_test_py
+
+import unittest
+
+import k2
+import torch
+
+
+class TestNormalizeLattice(unittest.TestCase):
+
+    @classmethod
+    def setUpClass(cls):
+        cls.devices = [torch.device('cpu')]
+        if torch.cuda.is_available() and k2.with_cuda:
+            cls.devices.append(torch.device('cuda', 0))
+            if torch.cuda.device_count() > 1:
+                torch.cuda.set_device(1)
+                cls.devices.append(torch.device('cuda', 1))
+
+    def test(self):
+        # State 4 is not coaccessible and state 5 is not accessible;
+        # states 1 and 2 are not top-sorted.
+        s = '''
+            0 2 2 1
+            0 4 1 2
+            2 1 3 3
+            1 6 -1 4
+            5 1 1 5
+            6
+        '''
+        for device in self.devices:
+            fsa = k2.Fsa.from_str(s).to(device)
+            fsa.requires_grad_(True)
+            fsa.attr = torch.arange(fsa.num_arcs, device=device)
+            normalized = k2.normalize_lattice(fsa)
+            expected = k2.arc_sort(k2.top_sort(k2.connect(fsa)))
+
+            assert str(normalized) == str(expected)
+            assert torch.all(torch.eq(normalized.attr, expected.attr))
+
+            loss = normalized.scores.sum()
+            loss.backward()
+            assert torch.allclose(
+                fsa.scores.grad,
+                torch.tensor([1, 0, 1, 1, 0],
+                             dtype=torch.float32,
+                             device=device))
+
+
+if __name__ == '__main__':
+    unittest.main()
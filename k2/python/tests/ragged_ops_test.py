@@ -104,6 +104,30 @@ class TestRaggedOps(unittest.TestCase):
 
             assert torch.all(torch.eq(ans, expected))
 
+    def test_pad_max_len_and_out(self):
+        s = '''
+            [ [ 1 2 ] [ 3 ] [ ] [ 4 5 6 ] ]
+        '''
+        for device in self.devices:
+            src = k2.RaggedTensor(s).to(device)
+            ans = src.pad('replicate', -1, max_len=2)
+            expected = torch.tensor([[1, 2], [3, 3], [-1, -1], [4, 5]],
+                                    dtype=torch.int32,
+                                    device=device)
+            assert torch.all(torch.eq(ans, expected))
+
+            out = torch.full((4, 5), 100, dtype=torch.int32, device=device)
+            ans = src.pad('constant', 0, out=out[:, 1:])
+            assert ans.data_ptr() == out[:, 1:].data_ptr()
+            expected = torch.tensor(
+                [[100, 1, 2, 0, 0],
+                 [100, 3, 0, 0, 0],
+                 [100, 0, 0, 0, 0],
+                 [100, 4, 5, 6, 0]],
+                dtype=torch.int32,
+                device=device)
+            assert torch.all(torch.eq(out, expected))
+
     def test_pad_empty(self):
         s = '''
             [ [ ] [ ] [ ] ]
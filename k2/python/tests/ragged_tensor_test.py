@@ -128,6 +128,55 @@ class TestRaggedTensor(unittest.TestCase):
                     b.values[1] = -100
                     assert c[1] != -100
 
+    def test_create_ragged_tensor_from_lengths(self):
+        for device in self.devices:
+            for dtype in self.dtypes + [torch.int64]:
+                values = torch.tensor([1, 2, 5, 9], dtype=dtype, device=device)
+                lengths = torch.tensor([2, 1, 0, 1], device=device)
+                a = k2r.create_ragged_tensor_from_lengths(values, lengths)
+                expected_dtype = torch.int32 if dtype == torch.int64 else dtype
+                b = k2r.RaggedTensor(
+                    [[1, 2], [5], [], [9]], dtype=expected_dtype, device=device
+                )
+                assert a == b
+                assert a.device == device
+
+            a = k2r.create_ragged_tensor_from_lengths(
+                torch.tensor([], device=device),
+                torch.tensor([0, 0], dtype=torch.int32, device=device),
+            )
+            assert a == k2r.RaggedTensor(
+                [[], []], dtype=torch.float32, device=device
+            )
+
+        # numpy arrays
+        a = k2r.create_ragged_tensor_from_lengths(
+            torch.tensor([0.5, 1.5]).numpy(), torch.tensor([0, 2]).numpy()
+        )
+        assert a == k2r.RaggedTensor([[], [0.5, 1.5]])
+
+        with self.assertRaises(RuntimeError):
+            k2r.create_ragged_tensor_from_lengths(
+                torch.tensor([1, 2], dtype=torch.int32), torch.tensor([1, 2])
+            )
+
+    def test_tolist(self):
+        for device in self.devices:
+            for dtype in self.dtypes:
+                for data in [
+                    [[]],
+                    [[1, 2], [5], [], [9]],
+                    [[[], [1, 2], [3], []], [[5, 6, 7]], [[], [0], [], []]],
+                    [[[[1], []]], [], [[[2, 3]]]],
+                ]:
+                    a = k2r.RaggedTensor(data, dtype=dtype, device=device)
+                    b = a.tolist()
+                    assert b == data
+                    assert k2r.RaggedTensor(b, dtype=dtype, device=device) == a
+            a = k2r.RaggedTensor([[1.25], [2, 3.5]], device=device)
+            assert a.tolist() == [[1.25], [2.0, 3.5]]
+            assert isinstance(a.tolist()[1][0], float)
+
     def test_property_values(self):
         for device in self.devices:
             for dtype in self.dtypes:
@@ -172,6 +221,21 @@ class TestRaggedTensor(unittest.TestCase):
     def test_cpu_to_cuda(self):
         pass
 
+    def test_pin_memory_and_non_blocking_to(self):
+        for dtype in self.dtypes:
+            a = k2r.RaggedTensor(
+                [[[1, 2], [], [3]], [[4]], []], dtype=dtype
+            )
+            b = a.pin_memory()
+            assert b == a
+            assert b.device == torch.device("cpu")
+            for device in self.devices:
+                for src in [a, b]:
+                    c = src.to(device, non_blocking=True)
+                    assert c.device == device
+                    assert c.dtype == dtype
+                    assert c.to("cpu") == a
+
     def test_cuda_to_cpu(self):
         pass
 
@@ -567,6 +567,142 @@ class TestRnntLoss(unittest.TestCase):
                     )
                     print(f"Pruned loss with range {r} : {pruned_loss}")
 
+    def test_rnnt_loss_pruned_fused(self):
+        B = 3
+        T = 40
+        S = 10
+        C = 12
+
+        frames = torch.randint(S, T, (B,))
+        seq_length = torch.randint(3, S - 1, (B,))
+        T = torch.max(frames)
+        S = torch.max(seq_length)
+
+        am_ = torch.randn((B, T, C), dtype=torch.float64)
+        lm_ = torch.randn((B, S + 1, C), dtype=torch.float64)
+        symbols_ = torch.randint(0, C - 1, (B, S))
+        terminal_symbol = C - 1
+
+        boundary_ = torch.zeros((B, 4), dtype=torch.int64)
+        boundary_[:, 2] = seq_length
+        boundary_[:, 3] = frames
+
+        for rnnt_type in ["regular", "modified", "constrained"]:
+            for device in self.devices:
+                am = am_.to(device)
+                lm = lm_.to(device)
+                symbols = symbols_.to(device)
+                boundary = boundary_.to(device)
+
+                _, (px_grad, py_grad) = k2.rnnt_loss_simple(
+                    lm=lm,
+                    am=am,
+                    symbols=symbols,
+                    termination_symbol=terminal_symbol,
+                    boundary=boundary,
+                    rnnt_type=rnnt_type,
+                    return_grad=True,
+                    reduction="none",
+                )
+                for r in [2, 5]:
+                    ranges = k2.get_rnnt_prune_ranges(
+                        px_grad=px_grad,
+                        py_grad=py_grad,
+                        boundary=boundary,
+                        s_range=r,
+                    )
+                    pruned_am, pruned_lm = k2.do_rnnt_pruning(
+                        am=am, lm=lm, ranges=ranges
+                    )
+                    logits_ = pruned_am + pruned_lm
+                    scale = torch.rand(B, device=device, dtype=am.dtype)
+
+                    losses = []
+                    grads = []
+                    for fused in [False, True]:
+                        logits = logits_.detach().clone().requires_grad_()
+                        loss = k2.rnnt_loss_pruned(
+                            logits=logits,
+                            symbols=symbols,
+                            ranges=ranges,
+                            termination_symbol=terminal_symbol,
+                            boundary=boundary,
+                            rnnt_type=rnnt_type,
+                            reduction="none",
+                            fused=fused,
+                        )
+                        (loss * scale).sum().backward()
+                        losses.append(loss.detach())
+                        grads.append(logits.grad)
+                    assert torch.allclose(losses[0], losses[1])
+                    assert torch.allclose(grads[0], grads[1])
+
+    def test_prune_ranges_fused(self):
+        B = 3
+        T = 40
+        S = 10
+        C = 12
+
+        frames = torch.randint(S, T, (B,))
+        seq_length = torch.randint(3, S - 1, (B,))
+        T = torch.max(frames)
+        S = torch.max(seq_length)
+
+        am_ = torch.randn((B, T, C), dtype=torch.float64)
+        lm_ = torch.randn((B, S + 1, C), dtype=torch.float64)
+        symbols_ = torch.randint(0, C - 1, (B, S))
+        terminal_symbol = C - 1
+
+        boundary_ = torch.zeros((B, 4), dtype=torch.int64)
+        boundary_[:, 2] = seq_length
+        boundary_[:, 3] = frames
+
+        for rnnt_type in ["regular", "modified", "constrained"]:
+            for device in self.devices:
+                am = am_.to(device)
+                lm = lm_.to(device)
+                symbols = symbols_.to(device)
+                boundary = boundary_.to(device)
+
+                _, (px_grad, py_grad) = k2.rnnt_loss_simple(
+                    lm=lm,
+                    am=am,
+                    symbols=symbols,
+                    termination_symbol=terminal_symbol,
+                    boundary=boundary,
+                    rnnt_type=rnnt_type,
+                    return_grad=True,
+                    reduction="none",
+                )
+                for r in [1, 2, 5, int(S) + 3]:
+                    if r == 1 and rnnt_type == "regular":
+                        continue
+                    all_ranges = []
+                    lm_pruned = []
+                    lm_grads = []
+                    for fused in [False, True]:
+                        ranges = k2.get_rnnt_prune_ranges(
+                            px_grad=px_grad,
+                            py_grad=py_grad,
+                            boundary=boundary,
+                            s_range=r,
+                            fused=fused,
+                        )
+                        this_lm = lm.detach().clone().requires_grad_()
+                        _, pruned = k2.do_rnnt_pruning(
+                            am=am, lm=this_lm, ranges=ranges, fused=fused
+                        )
+                        scale = torch.arange(
+                            pruned.numel(), device=device, dtype=lm.dtype
+                        ).reshape(pruned.shape)
+                        (pruned * scale).sum().backward()
+                        all_ranges.append(ranges)
+                        lm_pruned.append(pruned.detach())
+                        lm_grads.append(this_lm.grad)
+                    assert torch.equal(all_ranges[0], all_ranges[1])
+                    assert torch.equal(lm_pruned[0], lm_pruned[1])
+                    assert torch.allclose(lm_grads[0], lm_grads[1])
+
     # Test the sequences that only have small number of symbols,
     # at this circumstance, the s_range would be greater than S, which will
     # raise errors (like, nan or inf loss) in our previous versions.
@@ -0,0 +1,72 @@
+#!/usr/bin/env python3
+#
+# Copyright      2026  Xiaomi Corp.
+#
+# See ../../../LICENSE for clarification regarding multiple authors
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+# To run this single test, use
+#
+#  ctest --verbose -R to_word_lattice_test_py
+
+import unittest
+
+import torch
+import k2
+
+
+class TestToWordLattice(unittest.TestCase):
+
+    @classmethod
+    def setUpClass(cls):
+        cls.devices = [torch.device('cpu')]
+        if torch.cuda.is_available() and k2.with_cuda:
+            cls.devices.append(torch.device('cuda', 0))
+
+    def test(self):
+        s = '''
+            0 1 1 0.1
+            0 2 4 0.5
+            1 2 2 0.2
+            2 3 3 0.3
+            3 4 -1 0.4
+            4
+        '''
+        for device in self.devices:
+            for aux_labels in ([[10], [], [], [11, 12], [-1]],
+                               [[10], [13], [14], [11, 12], [-1]]):
+                fsa = k2.Fsa.from_str(s).to(device)
+                fsa.aux_labels = k2.RaggedTensor(aux_labels).to(device)
+                fsa.requires_grad_(True)
+                ref_fsa = k2.Fsa.from_str(s).to(device)
+                ref_fsa.aux_labels = k2.RaggedTensor(aux_labels).to(device)
+                ref_fsa.requires_grad_(True)
+
+                dest = k2.to_word_lattice(fsa)
+                expected = k2.connect(k2.remove_epsilon(k2.invert(ref_fsa)))
+                assert torch.all(torch.eq(dest.arcs.values()[:, :3],
+                                          expected.arcs.values()[:, :3]))
+                assert torch.allclose(dest.scores, expected.scores)
+                assert dest.aux_labels == expected.aux_labels
+                assert dest.properties & k2.fsa_properties.EPSILON_FREE
+
+                dest.get_tot_scores(log_semiring=True,
+                                    use_double_scores=False).backward()
+                expected.get_tot_scores(log_semiring=True,
+                                        use_double_scores=False).backward()
+                assert torch.allclose(fsa.grad, ref_fsa.grad)
+
+
+if __name__ == '__main__':
+    unittest.main()
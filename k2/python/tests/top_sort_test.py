@@ -66,5 +66,28 @@ class TestTopSort(unittest.TestCase):
                              device=device))
 
 
+    def test_state_batches(self):
+        s = '''
+            0 1 1 1
+            0 2 2 2
+            1 3 -1 3
+            2 1 3 4
+            3
+        '''
+        for device in self.devices:
+            fsa = k2.Fsa.from_str(s).to(device)
+            fsa_vec = k2.create_fsa_vec([fsa, fsa])
+            sorted_fsa_vec = k2.top_sort(fsa_vec)
+            # top_sort() caches the batches of states it found
+            assert 'state_batches' in sorted_fsa_vec._cache
+            scores = sorted_fsa_vec.get_forward_scores(
+                use_double_scores=True, log_semiring=True)
+
+            # recompute them with the batches from get_state_batches()
+            sorted_fsa_vec._invalidate_cache_(scores_only=False)
+            expected_scores = sorted_fsa_vec.get_forward_scores(
+                use_double_scores=True, log_semiring=True)
+            assert torch.allclose(scores, expected_scores)
+
 if __name__ == '__main__':
     unittest.main()
@@ -73,6 +73,9 @@ C10_DEFINE_double(nbest_scale, 0.5,
 C10_DEFINE_string(word_table, "", "Path to words.txt.");
 C10_DEFINE_int(sos_id, -1, "ID of start of sentence symbol.");
 C10_DEFINE_int(eos_id, -1, "ID of end of sentence symbol.");
+C10_DEFINE_int(attention_batch_size, 100,
+               "Maximum number of token sequences given to the attention "
+               "decoder at once.");
 
 // Fsa decoding related
 C10_DEFINE_double(search_beam, 20, "search_beam in IntersectDensePruned");
@@ -258,52 +261,13 @@ int main(int argc, char *argv[]) {
   torch::Tensor am_scores = nbest.ComputeAmScores();
   torch::Tensor ngram_lm_scores = nbest.ComputeLmScores();
 
-  K2_CHECK(nbest.fsa.HasTensorAttr("tokens"));
-
-  auto &path_to_utt_map_array = nbest.shape.RowIds(1);
-  torch::Tensor path_to_utt_map =
-      Array1ToTorch(path_to_utt_map_array).to(torch::kLong);
-
-  // the shape of memory is (T, N, C), so we use axis=1 here
-  torch::Tensor expanded_memory = memory.index_select(1, path_to_utt_map);
-
-  // the shape of memory_key_padding_mask is (N, T), so we use axis=0 here
-  torch::Tensor expanded_memory_key_padding_mask =
-      memory_key_padding_mask.index_select(0, path_to_utt_map);
-
-  k2::RaggedShape tokens_shape = k2::RemoveAxis(nbest.fsa.fsa.shape, 1);
-
-  torch::Tensor tokens_value = nbest.fsa.GetTensorAttr("tokens");
-  k2::Ragged<int32_t> tokens{tokens_shape,
-                             k2::Array1FromTorch<int32_t>(tokens_value)};
-  tokens = k2::RemoveValuesLeq(tokens, 0);
-
-  std::vector<std::vector<int32_t>> token_ids = tokens.ToVecVec();
-  // convert std::vector<std::vector<int32_t>>
-  // to
-  // torch::List<torch::IValue> where torch::IValue is torch::Tensor
-  torch::List<torch::IValue> token_ids_list(torch::TensorType::get());
-
-  token_ids_list.reserve(token_ids.size());
-  for (const auto tids : token_ids) {
-    torch::Tensor tids_tensor = torch::tensor(tids);
-    token_ids_list.emplace_back(tids_tensor);
-  }
-
   K2_LOG(INFO) << "Run attention decoder";
-  torch::Tensor nll =
-      module
-          .run_method("decoder_nll", expanded_memory,
-                      expanded_memory_key_padding_mask, token_ids_list,
-                      FLAGS_sos_id, FLAGS_eos_id)
-          .toTensor();
-  K2_CHECK_EQ(nll.dim(), 2);
-  K2_CHECK_EQ(nll.size(0), nbest.shape.TotSize(1));
+  torch::Tensor attention_scores = nbest.ComputeAttentionScores(
+      module, memory, memory_key_padding_mask, FLAGS_sos_id, FLAGS_eos_id,
+      FLAGS_attention_batch_size);
 
   K2_LOG(INFO) << "Rescoring";
 
-  torch::Tensor attention_scores = -1 * nll.sum(1);
-
   torch::Tensor tot_scores = am_scores +
                              FLAGS_ngram_lm_scale * ngram_lm_scores +
                              FLAGS_attention_scale * attention_scores;
@@ -0,0 +1,497 @@
+/**
+ * Copyright      2026  Xiaomi Corporation
+ *
+ * See LICENSE for clarification regarding multiple authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <algorithm>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "k2/csrc/fsa_algo.h"
+#include "k2/csrc/log.h"
+#include "k2/csrc/rnnt_decode.h"
+#include "k2/csrc/timer.h"
+#include "k2/torch/csrc/decode.h"
+#include "k2/torch/csrc/dense_fsa_vec.h"
+#include "k2/torch/csrc/deserialization.h"
+#include "k2/torch/csrc/features.h"
+#include "k2/torch/csrc/fsa_algo.h"
+#include "k2/torch/csrc/parse_options.h"
+#include "k2/torch/csrc/utils.h"
+#include "k2/torch/csrc/wave_reader.h"
+#include "torch/all.h"
+#include "torch/script.h"
+
+static constexpr const char *kUsageMessage = R"(
+This file benchmarks decoding end to end, i.e. from the nnet output (or from
+wave files) to the best path, and reports the real time factor (RTF) and the
+time spent in each stage for each batch size.
+
+There are two modes:
+
+  --mode=hlg   Offline decoding with GetLattice()-style intersection, like
+               ./bin/hlg_decode.  The batch size is the number of utterances
+               decoded together.
+  --mode=rnnt  Streaming RNN-T decoding with DecodeOneChunk(), like
+               ./bin/rnnt_demo.  The batch size is the number of streams.
+
+The input is one of:
+
+  (1) Wave files and --nn-model: features and the nnet are run and timed as
+      well.  The model is the one expected by ./bin/hlg_decode (hlg) or
+      ./bin/pruned_stateless_transducer (rnnt).
+  (2) --nnet-output: a file saved by torch.save() with a tensor of shape
+      (N, T, C), which is the log-probs (hlg) or the encoder output (rnnt,
+      needs --nn-model for the decoder and the joiner).
+  (3) Nothing: random log-probs with --vocab-size columns, or random encoder
+      output with --encoder-dim columns if --nn-model is given (rnnt).
+
+The utterances are repeated to fill each batch.  Without --graph, a CTC
+topology (hlg) or a trivial graph (rnnt) over --vocab-size symbols is used.
+
+Usage:
+  ./bin/decode_benchmark \
+    --use-gpu=true \
+    --mode=hlg \
+    --graph=/path/to/HLG.pt \
+    --vocab-size=500 \
+    --batch-sizes=1,8,32,128
+
+The output is one CSV line per batch size on stdout; times are in seconds in
+total over --num-iters iterations.  In rnnt mode, `search` includes the
+decoder and the joiner when --nn-model is given.
+)";
+
+namespace k2 {
+
+// Seconds spent in each stage of decoding
+struct StageTimes {
+  double feature = 0;
+  double nnet = 0;
+  double search = 0;  // intersection in hlg mode
+  double format = 0;
+  double best_path = 0;
+
+  double Total() const { return feature + nnet + search + format + best_path; }
+};
+
+struct BenchmarkOptions {
+  std::string mode = "hlg";
+  std::string nn_model;
+  std::string nnet_output;
+  std::string graph;
+  bool use_gpu = false;
+  std::string batch_sizes = "1,8,32";
+  int32_t num_iters = 5;
+  int32_t num_warm_up = 1;
+  int32_t vocab_size = 500;
+  int32_t encoder_dim = 512;
+  int32_t num_frames = 250;
+  int32_t subsampling_factor = 4;
+
+  // hlg mode
+  float search_beam = 20;
+  float output_beam = 8;
+  int32_t min_activate_states = 30;
+  int32_t max_activate_states = 10000;
+
+  // rnnt mode
+  int32_t context_size = 2;
+  float beam = 8;
+  int32_t max_states = 64;
+  int32_t max_contexts = 8;
+  int32_t chunk_size = 10;
+  bool cuda_graph = false;
+
+  void Register(ParseOptions *po) {
+    po->Register("mode", &mode, "hlg or rnnt");
+    po->Register("nn-model", &nn_model, "Path to the torch jit model file");
+    po->Register("nnet-output", &nnet_output,
+                 "Path to a recorded nnet output (N, T, C) saved by "
+                 "torch.save()");
+    po->Register("graph", &graph,
+                 "Path to the decoding graph, e.g. HLG.pt or LG.pt");
+    po->Register("use-gpu", &use_gpu, "true to use GPU 0; false to use CPU");
+    po->Register("batch-sizes", &batch_sizes,
+                 "Comma separated batch sizes (or numbers of streams)");
+    po->Register("num-iters", &num_iters,
+                 "Number of timed iterations for each batch size");
+    po->Register("num-warm-up", &num_warm_up,
+                 "Number of untimed iterations for each batch size");
+    po->Register("vocab-size", &vocab_size,
+                 "Number of columns of random log-probs (blank included)");
+    po->Register("encoder-dim", &encoder_dim,
+                 "Number of columns of random encoder output");
+    po->Register("num-frames", &num_frames,
+                 "Number of nnet output frames of random utterances");
+    po->Register("subsampling-factor", &subsampling_factor,
+                 "Subsampling factor of the nnet; used to compute the audio "
+                 "duration of the nnet output");
+    po->Register("search-beam", &search_beam, "See IntersectDensePruned()");
+    po->Register("output-beam", &output_beam, "See IntersectDensePruned()");
+    po->Register("min-activate-states", &min_activate_states,
+                 "See IntersectDensePruned()");
+    po->Register("max-activate-states", &max_activate_states,
+                 "See IntersectDensePruned()");
+    po->Register("context-size", &context_size,
+                 "Decoder context size of the RNN-T model");
+    po->Register("beam", &beam, "beam in RnntDecodingStreams");
+    po->Register("max-states", &max_states,
+                 "max_states in RnntDecodingStreams");
+    po->Register("max-contexts", &max_contexts,
+                 "max_contexts in RnntDecodingStreams");
+    po->Register("chunk-size", &chunk_size,
+                 "Number of frames per DecodeOneChunk() call");
+    po->Register("cuda-graph", &cuda_graph,
+                 "true to replay the decoder and the joiner of each frame as "
+                 "a CUDA graph; see DecodeStepGraph");
+  }
+};
+
+// A batch of utterances as given to the nnet or to the search.
+struct Batch {
+  std::vector<torch::Tensor> waves;  // set if the input is wave files
+  torch::Tensor nnet_output;         // (B, T, C), set otherwise
+  double audio_seconds = 0;
+};
+
+static std::vector<int32_t> ParseBatchSizes(const std::string &s) {
+  std::vector<int32_t> ans;
+  std::istringstream is(s);
+  std::string item;
+  while (std::getline(is, item, ',')) {
+    ans.push_back(std::stoi(item));
+    K2_CHECK_GT(ans.back(), 0) << "Invalid batch sizes: " << s;
+  }
+  K2_CHECK(!ans.empty()) << "Invalid batch sizes: " << s;
+  return ans;
+}
+
+// Return `batch_size` utterances, repeating those in `waves` or in the rows of
+// `nnet_output` (one of them is used).
+static Batch GetBatch(const std::vector<torch::Tensor> &waves,
+                      torch::Tensor nnet_output, int32_t batch_size,
+                      const BenchmarkOptions &opts, float sample_rate,
+                      float frame_shift_ms) {
+  Batch batch;
+  if (!waves.empty()) {
+    for (int32_t i = 0; i != batch_size; ++i) {
+      batch.waves.push_back(waves[i % waves.size()]);
+      batch.audio_seconds += batch.waves.back().numel() / sample_rate;
+    }
+    return batch;
+  }
+  torch::Tensor indexes =
+      torch::arange(batch_size, torch::kLong) % nnet_output.size(0);
+  batch.nnet_output =
+      nnet_output.index_select(0, indexes.to(nnet_output.device()));
+  batch.audio_seconds = batch_size * nnet_output.size(1) *
+                        opts.subsampling_factor * frame_shift_ms / 1000;
+  return batch;
+}
+
+// Run the feature extractor and the nnet on `batch` if it contains waves.
+// Return the nnet output (the log-probs in hlg mode, the encoder output in
+// rnnt mode) and write the number of valid frames of each utterance to
+// `num_frames`.
+static torch::Tensor RunNnet(const Batch &batch, const BenchmarkOptions &opts,
+                             kaldifeat::Fbank *fbank,
+                             torch::jit::script::Module *module,
+                             const Timer &timer, StageTimes *times,
+                             std::vector<int32_t> *num_frames) {
+  if (batch.waves.empty()) {
+    num_frames->assign(batch.nnet_output.size(0), batch.nnet_output.size(1));
+    return batch.nnet_output;
+  }
+  int32_t batch_size = batch.waves.size();
+  timer.Reset();
+  std::vector<int64_t> feature_lens;
+  std::vector<torch::Tensor> features_vec =
+      ComputeFeatures(*fbank, batch.waves, &feature_lens);
+  // Note: math.log(1e-10) is -23.025850929940457
+  torch::Tensor features = torch::nn::utils::rnn::pad_sequence(
+      features_vec, true, -23.025850929940457f);
+  times->feature += timer.Elapsed();
+
+  timer.Reset();
+  torch::Tensor nnet_output, lens;
+  if (opts.mode == "hlg") {
+    torch::Dict<std::string, torch::Tensor> sup;
+    sup.insert("sequence_idx", torch::arange(batch_size, torch::kInt));
+    sup.insert("start_frame", torch::zeros({batch_size}, torch::kInt));
+    sup.insert("num_frames",
+               torch::from_blob(feature_lens.data(), {batch_size},
+                                torch::kLong)
+                   .to(torch::kInt));
+    torch::IValue supervisions(sup);
+    auto outputs =
+        module->run_method("forward", features, supervisions).toTuple();
+    nnet_output = outputs->elements()[0].toTensor();
+    lens = GetSupervisionSegments(supervisions, opts.subsampling_factor)
+               .index({torch::indexing::Slice(), 2});
+  } else {
+    torch::Tensor input_lens =
+        torch::tensor(feature_lens, features.device());
+    auto outputs = module->attr("encoder")
+                       .toModule()
+                       .run_method("forward", features, input_lens)
+                       .toTuple();
+    nnet_output = outputs->elements()[0].toTensor();
+    lens = outputs->elements()[1].toTensor();
+  }
+  lens = lens.to(torch::kCPU).to(torch::kInt).contiguous();
+  times->nnet += timer.Elapsed();
+  // The lengths computed from the number of feature frames may exceed that
+  // of the nnet output by one frame due to the subsampling.
+  lens = lens.clamp_max(nnet_output.size(1));
+  num_frames->assign(lens.data_ptr<int32_t>(),
+                     lens.data_ptr<int32_t>() + batch_size);
+  return nnet_output;
+}
+
+// Decode `nnet_output` with intersection, as GetLattice() does.
+static void DecodeHlg(torch::Tensor nnet_output,
+                      const std::vector<int32_t> &num_frames,
+                      const BenchmarkOptions &opts, FsaClass &graph,
+                      const Timer &timer, StageTimes *times) {
+  int32_t batch_size = nnet_output.size(0);
+  timer.Reset();
+  torch::Tensor supervision_segments =
+      torch::stack({torch::arange(batch_size, torch::kInt),
+                    torch::zeros({batch_size}, torch::kInt),
+                    torch::tensor(num_frames, torch::kInt)},
+                   1);
+  DenseFsaVec dense_fsa_vec =
+      CreatePaddedDenseFsaVec(nnet_output, supervision_segments);
+  FsaVec fsa;
+  Array1<int32_t> graph_arc_map, dense_arc_map;
+  IntersectDensePruned(graph.fsa, dense_fsa_vec, opts.search_beam,
+                       opts.output_beam, opts.min_activate_states,
+                       opts.max_activate_states, &fsa, &graph_arc_map,
+                       &dense_arc_map);
+  times->search += timer.Elapsed();
+
+  timer.Reset();
+  FsaClass lattice(fsa);
+  lattice.CopyAttrs(graph, Array1ToTorch(graph_arc_map));
+  times->format += timer.Elapsed();
+
+  timer.Reset();
+  GetBestPathTexts(lattice);
+  times->best_path += timer.Elapsed();
+}
+
+// Decode `nnet_output` (the encoder output, or nothing if there is no model)
+// chunk by chunk with one stream per utterance.  Without a model, each frame
+// is advanced with random log-probs.
+static void DecodeRnnt(torch::Tensor nnet_output,
+                       const std::vector<int32_t> &num_frames,
+                       const BenchmarkOptions &opts, FsaClass &graph,
+                       torch::jit::script::Module *module,
+                       DecodeStepGraph *step_graph, const Timer &timer,
+                       StageTimes *times) {
+  using namespace rnnt_decoding;  // NOLINT
+  int32_t batch_size = num_frames.size();
+  timer.Reset();
+  RnntDecodingConfig config(opts.vocab_size, opts.context_size, opts.beam,
+                            opts.max_states, opts.max_contexts);
+  auto graph_ptr = std::make_shared<Fsa>(graph.fsa);
+  std::vector<std::shared_ptr<RnntDecodingStream>> streams_vec(batch_size);
+  for (int32_t i = 0; i != batch_size; ++i)
+    streams_vec[i] = CreateStream(graph_ptr);
+
+  int32_t T = nnet_output.size(1);
+  for (int32_t start = 0; start < T; start += opts.chunk_size) {
+    RnntDecodingStreams streams(streams_vec, config);
+    int32_t end = std::min(start + opts.chunk_size, T);
+    torch::Tensor chunk =
+        nnet_output.index({torch::indexing::Slice(),
+                           torch::indexing::Slice(start, end),
+                           torch::indexing::Slice()});
+    if (module != nullptr) {
+      DecodeOneChunk(streams, *module, chunk, nullptr, step_graph);
+    } else {
+      for (int32_t t = start; t != end; ++t) {
+        RaggedShape shape;
+        Array2<int32_t> contexts;
+        streams.GetContexts(&shape, &contexts);
+        // The log-probs are random, so they need not depend on the contexts.
+        torch::Tensor logprobs =
+            torch::randn({contexts.Dim0(), opts.vocab_size},
+                         nnet_output.options())
+                .log_softmax(-1);
+        streams.Advance(Array2FromTorch<float>(logprobs));
+      }
+      streams.TerminateAndFlushToStreams();
+    }
+  }
+  times->search += timer.Elapsed();
+
+  timer.Reset();
+  RnntDecodingStreams streams(streams_vec, config);
+  FsaVec ofsa;
+  Array1<int32_t> out_map;
+  streams.FormatOutput(num_frames, /*allow_partial*/ true, &ofsa, &out_map);
+  FsaClass lattice(ofsa);
+  // All streams use the same graph, so out_map indexes its arcs.
+  lattice.CopyAttrs(graph, Array1ToTorch(out_map));
+  times->format += timer.Elapsed();
+
+  timer.Reset();
+  GetBestPathTexts(lattice);
+  times->best_path += timer.Elapsed();
+}
+
+static int32_t RunDecodeBenchmark(int32_t argc, char *argv[]) {
+  ParseOptions po(kUsageMessage);
+  BenchmarkOptions opts;
+  opts.Register(&po);
+  kaldifeat::FbankOptions fbank_opts;
+  fbank_opts.frame_opts.dither = 0;
+  fbank_opts.mel_opts.num_bins = 80;
+  po.Register("sample-frequency", &fbank_opts.frame_opts.samp_freq,
+              "Waveform data sample frequency");
+  po.Register("frame-shift", &fbank_opts.frame_opts.frame_shift_ms,
+              "Frame shift in milliseconds");
+  po.Register("num-mel-bins", &fbank_opts.mel_opts.num_bins,
+              "Number of triangular mel-frequency bins");
+  po.Read(argc, argv);
+
+  K2_CHECK(opts.mode == "hlg" || opts.mode == "rnnt")
+      << "--mode should be hlg or rnnt. Given: " << opts.mode;
+  int32_t num_waves = po.NumArgs();
+  K2_CHECK(num_waves == 0 || !opts.nn_model.empty())
+      << "Wave files need --nn-model";
+  K2_CHECK(opts.mode == "rnnt" || opts.nnet_output.empty() ||
+           opts.nn_model.empty())
+      << "--nn-model is not used with --nnet-output in hlg mode";
+  K2_CHECK(opts.mode == "hlg" || opts.nnet_output.empty() ||
+           !opts.nn_model.empty())
+      << "--nnet-output needs --nn-model in rnnt mode";
+
+  torch::Device device(torch::kCPU);
+  if (opts.use_gpu) device = torch::Device(torch::kCUDA, 0);
+  fbank_opts.device = device;
+  K2_LOG(INFO) << "Device: " << device;
+
+  std::unique_ptr<torch::jit::script::Module> module;
+  if (!opts.nn_model.empty()) {
+    module = std::make_unique<torch::jit::script::Module>(
+        torch::jit::load(opts.nn_model));
+    module->eval();
+    module->to(device);
+    if (module->hasattr("subsampling_factor"))
+      opts.subsampling_factor = module->attr("subsampling_factor").toInt();
+  }
+
+  std::vector<torch::Tensor> waves;
+  torch::Tensor nnet_output;
+  float sample_rate = fbank_opts.frame_opts.samp_freq;
+  if (num_waves > 0) {
+    std::vector<std::string> filenames(num_waves);
+    for (int32_t i = 0; i != num_waves; ++i) filenames[i] = po.GetArg(i + 1);
+    waves = ReadWave(filenames, sample_rate);
+    for (auto &w : waves) w = w.to(device);
+  } else if (!opts.nnet_output.empty()) {
+    nnet_output = Load(opts.nnet_output, device).toTensor();
+    K2_CHECK_EQ(nnet_output.dim(), 3);
+    nnet_output = nnet_output.to(torch::kFloat);
+  } else {
+    int32_t dim = (opts.mode == "hlg" || module == nullptr) ? opts.vocab_size
+                                                            : opts.encoder_dim;
+    nnet_output = torch::randn({1, opts.num_frames, dim},
+                               torch::dtype(torch::kFloat).device(device));
+    if (opts.mode == "hlg") nnet_output = (nnet_output * 5).log_softmax(-1);
+  }
+
+  FsaClass graph;
+  if (!opts.graph.empty()) {
+    graph = LoadFsa(opts.graph, device);
+  } else if (opts.mode == "hlg") {
+    graph = CtcTopo(opts.vocab_size - 1, false, device);
+  } else {
+    graph = TrivialGraph(opts.vocab_size - 1, device);
+  }
+  K2_CHECK(graph.HasTensorAttr("aux_labels") ||
+           graph.HasRaggedTensorAttr("aux_labels"));
+  if (opts.mode == "hlg") {
+    graph.fsa = FsaToFsaVec(graph.fsa);
+  } else {
+    K2_CHECK_EQ(graph.fsa.NumAxes(), 2) << "Expect a single graph";
+  }
+
+  kaldifeat::Fbank fbank(fbank_opts);
+  Timer timer(ContextFromDevice(device));
+  // Without a model, rnnt mode advances the frames of `nnet_output` with
+  // random log-probs; it has no nnet.
+  torch::jit::script::Module *search_module =
+      opts.mode == "rnnt" ? module.get() : nullptr;
+
+  std::cout << "mode,batch_size,num_iters,audio_seconds,feature,nnet,search,"
+               "format,best_path,total,rtf,frames_per_second\n";
+  for (int32_t batch_size : ParseBatchSizes(opts.batch_sizes)) {
+    Batch batch = GetBatch(waves, nnet_output, batch_size, opts, sample_rate,
+                           fbank_opts.frame_opts.frame_shift_ms);
+    StageTimes times;
+    int64_t tot_frames = 0;
+    // The graph is captured on the first (warm-up) iteration and replayed
+    // afterwards.
+    std::unique_ptr<DecodeStepGraph> step_graph;
+    if (opts.cuda_graph && search_module != nullptr)
+      step_graph = std::make_unique<DecodeStepGraph>(
+          *search_module, batch_size * opts.max_contexts);
+    for (int32_t i = -opts.num_warm_up; i < opts.num_iters; ++i) {
+      StageTimes iter_times;
+      std::vector<int32_t> num_frames;
+      torch::Tensor output = RunNnet(batch, opts, &fbank, module.get(), timer,
+                                     &iter_times, &num_frames);
+      if (opts.mode == "hlg")
+        DecodeHlg(output, num_frames, opts, graph, timer, &iter_times);
+      else
+        DecodeRnnt(output, num_frames, opts, graph, search_module,
+                   step_graph.get(), timer, &iter_times);
+      if (i < 0) continue;  // warm up
+      times.feature += iter_times.feature;
+      times.nnet += iter_times.nnet;
+      times.search += iter_times.search;
+      times.format += iter_times.format;
+      times.best_path += iter_times.best_path;
+      for (int32_t n : num_frames) tot_frames += n;
+    }
+    double audio_seconds = batch.audio_seconds * opts.num_iters;
+    std::cout << opts.mode << "," << batch_size << "," << opts.num_iters
+              << "," << audio_seconds << "," << times.feature << ","
+              << times.nnet << "," << times.search << "," << times.format
+              << "," << times.best_path << "," << times.Total() << ","
+              << times.Total() / audio_seconds << ","
+              << tot_frames / times.Total() << std::endl;
+  }
+  return 0;
+}
+
+}  // namespace k2
+
+int main(int argc, char *argv[]) {
+  // see
+  // https://pytorch.org/docs/stable/notes/cpu_threading_torchscript_inference.html
+  torch::set_num_threads(1);
+  torch::set_num_interop_threads(1);
+  torch::NoGradGuard no_grad;
+  return k2::RunDecodeBenchmark(argc, argv);
+}
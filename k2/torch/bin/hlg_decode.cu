@@ -16,6 +16,10 @@
  * limitations under the License.
  */
 
+#include <algorithm>
+#include <string>
+#include <vector>
+
 #include "k2/torch/csrc/decode.h"
 #include "k2/torch/csrc/dense_fsa_vec.h"
 #include "k2/torch/csrc/deserialization.h"
@@ -69,6 +73,14 @@ C10_DEFINE_double(frame_shift_ms, 10.0,
 C10_DEFINE_double(frame_length_ms, 25.0,
                   "Frame length in ms for computing Fbank");
 C10_DEFINE_int(num_bins, 80, "Number of triangular bins for computing Fbank");
+// Batching related
+C10_DEFINE_int(batch_size, 0,
+               "Number of wave files decoded together. If it is <= 0, all "
+               "wave files are decoded in a single batch. Features of the "
+               "next batch are computed while the current one is decoded.");
+C10_DEFINE_int(num_io_threads, 4,
+               "Number of threads used to read wave files. If it is <= 0, "
+               "the number of CPU cores is used.");
 
 static void CheckArgs() {
 #if !defined(K2_WITH_CUDA)
@@ -121,13 +133,6 @@ int main(int argc, char *argv[]) {
     wave_filenames[i] = argv[i + 1];
   }
 
-  K2_LOG(INFO) << "Load wave files";
-  auto wave_data = k2::ReadWave(wave_filenames, FLAGS_sample_rate);
-
-  for (auto &w : wave_data) {
-    w = w.to(device);
-  }
-
   K2_LOG(INFO) << "Build Fbank computer";
   kaldifeat::FbankOptions fbank_opts;
   fbank_opts.frame_opts.samp_freq = FLAGS_sample_rate;
@@ -137,15 +142,20 @@ int main(int argc, char *argv[]) {
   fbank_opts.mel_opts.num_bins = FLAGS_num_bins;
   fbank_opts.device = device;
 
-  kaldifeat::Fbank fbank(fbank_opts);
-
-  K2_LOG(INFO) << "Compute features";
-  std::vector<int64_t> num_frames;
-  auto features_vec = k2::ComputeFeatures(fbank, wave_data, &num_frames);
-
-  // Note: math.log(1e-10) is -23.025850929940457
-  auto features = torch::nn::utils::rnn::pad_sequence(features_vec, true,
-                                                      -23.025850929940457f);
+  // Wave files are read and their features computed in the background,
+  // overlapped with the decoding of the previous batch.
+  k2::FeatureLoader loader(fbank_opts, FLAGS_sample_rate,
+                           FLAGS_num_io_threads);
+  int32_t batch_size = FLAGS_batch_size > 0 ? FLAGS_batch_size : num_waves;
+  int32_t num_submitted = 0;
+  auto submit_next_batch = [&]() -> void {
+    if (num_submitted == num_waves) return;
+    int32_t end = std::min(num_submitted + batch_size, num_waves);
+    loader.Submit(std::vector<std::string>(
+        wave_filenames.begin() + num_submitted, wave_filenames.begin() + end));
+    num_submitted = end;
+  };
+  submit_next_batch();
 
   K2_LOG(INFO) << "Load neural network model";
   torch::jit::script::Module module = torch::jit::load(FLAGS_nn_model);
@@ -153,65 +163,65 @@ int main(int argc, char *argv[]) {
   module.to(device);
 
   int32_t subsampling_factor = module.attr("subsampling_factor").toInt();
-  torch::Dict<std::string, torch::Tensor> sup;
-  sup.insert("sequence_idx", torch::arange(num_waves, torch::kInt));
-  sup.insert("start_frame", torch::zeros({num_waves}, torch::kInt));
-  sup.insert("num_frames",
-             torch::from_blob(num_frames.data(), {num_waves}, torch::kLong)
-                 .to(torch::kInt));
-
-  torch::IValue supervisions(sup);
-
-  K2_LOG(INFO) << "Compute nnet_output";
-  // the output for module.forward() is a tuple of 3 tensors
-  // See the definition of the model in conformer_ctc/transformer.py
-  // from icefall.
-  // If you use a model that has a different signature for `forward`,
-  // you can change the following line.
-  auto outputs = module.run_method("forward", features, supervisions).toTuple();
-  assert(outputs->elements().size() == 3u);
-
-  auto nnet_output = outputs->elements()[0].toTensor();
-  auto memory = outputs->elements()[1].toTensor();
-
-  torch::Tensor supervision_segments =
-      k2::GetSupervisionSegments(supervisions, subsampling_factor);
 
   K2_LOG(INFO) << "Load " << FLAGS_hlg;
   k2::FsaClass decoding_graph = k2::LoadFsa(FLAGS_hlg, device);
   K2_CHECK(decoding_graph.HasTensorAttr("aux_labels") ||
            decoding_graph.HasRaggedTensorAttr("aux_labels"));
 
-  K2_LOG(INFO) << "Decoding";
-  k2::FsaClass lattice = k2::GetLattice(
-      nnet_output, decoding_graph, supervision_segments, FLAGS_search_beam,
-      FLAGS_output_beam, FLAGS_min_activate_states, FLAGS_max_activate_states,
-      subsampling_factor);
-
-  lattice = k2::ShortestPath(lattice);
-
-  auto ragged_aux_labels = k2::GetTexts(lattice);
-  auto aux_labels_vec = ragged_aux_labels.ToVecVec();
-
-  std::vector<std::string> texts;
   k2::SymbolTable symbol_table(FLAGS_word_table);
-  for (const auto &ids : aux_labels_vec) {
-    std::string text;
-    std::string sep = "";
-    for (auto id : ids) {
-      text.append(sep);
-      text.append(symbol_table[id]);
-      sep = " ";
-    }
-    texts.emplace_back(std::move(text));
-  }
 
   std::ostringstream os;
   os << "\nDecoding result:\n\n";
-  for (int32_t i = 0; i != num_waves; ++i) {
-    os << wave_filenames[i] << "\n";
-    os << texts[i];
-    os << "\n\n";
+  while (loader.NumPending() > 0) {
+    k2::FeatureBatch batch = loader.Next();
+    submit_next_batch();
+
+    int32_t num_batch_waves = static_cast<int32_t>(batch.filenames.size());
+
+    // Note: math.log(1e-10) is -23.025850929940457
+    auto features = torch::nn::utils::rnn::pad_sequence(
+        batch.features, true, -23.025850929940457f);
+
+    torch::Dict<std::string, torch::Tensor> sup;
+    sup.insert("sequence_idx", torch::arange(num_batch_waves, torch::kInt));
+    sup.insert("start_frame", torch::zeros({num_batch_waves}, torch::kInt));
+    sup.insert("num_frames", torch::from_blob(batch.num_frames.data(),
+                                              {num_batch_waves}, torch::kLong)
+                                 .to(torch::kInt));
+
+    torch::IValue supervisions(sup);
+
+    K2_LOG(INFO) << "Compute nnet_output";
+    // the output for module.forward() is a tuple of 3 tensors
+    // See the definition of the model in conformer_ctc/transformer.py
+    // from icefall.
+    // If you use a model that has a different signature for `forward`,
+    // you can change the following line.
+    auto outputs =
+        module.run_method("forward", features, supervisions).toTuple();
+    assert(outputs->elements().size() == 3u);
+
+    auto nnet_output = outputs->elements()[0].toTensor();
+
+    torch::Tensor supervision_segments =
+        k2::GetSupervisionSegments(supervisions, subsampling_factor);
+
+    K2_LOG(INFO) << "Decoding";
+    k2::FsaClass lattice = k2::GetLattice(
+        nnet_output, decoding_graph, supervision_segments, FLAGS_search_beam,
+        FLAGS_output_beam, FLAGS_min_activate_states,
+        FLAGS_max_activate_states, subsampling_factor);
+
+    auto ragged_aux_labels = k2::GetBestPathTexts(lattice);
+    std::vector<std::string> texts =
+        symbol_table.Decode(ragged_aux_labels, /*sep*/ " ");
+
+    for (int32_t i = 0; i != num_batch_waves; ++i) {
+      os << batch.filenames[i] << "\n";
+      os << texts[i];
+      os << "\n\n";
+    }
   }
   K2_LOG(INFO) << os.str();
 
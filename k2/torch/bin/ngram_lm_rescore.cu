@@ -16,13 +16,17 @@
  * limitations under the License.
  */
 
+#include <fstream>
+
 #include "k2/csrc/fsa_algo.h"
+#include "k2/csrc/ngram_lm.h"
 #include "k2/torch/csrc/decode.h"
 #include "k2/torch/csrc/dense_fsa_vec.h"
 #include "k2/torch/csrc/deserialization.h"
 #include "k2/torch/csrc/features.h"
 #include "k2/torch/csrc/fsa_algo.h"
 #include "k2/torch/csrc/symbol_table.h"
+#include "k2/torch/csrc/utils.h"
 #include "k2/torch/csrc/wave_reader.h"
 #include "torch/all.h"
 #include "torch/script.h"
@@ -43,6 +47,9 @@ Usage:
     <path to bar.wav> \
     <more waves if any>
 
+Instead of --g, you can use --arpa <path to an ARPA file, e.g., 4-gram.arpa>
+to look up the LM on demand, without building G.
+
 To see all possible options, use
   ./bin/ngram_lm_rescore --help
 
@@ -57,6 +64,9 @@ C10_DEFINE_bool(use_gpu, false, "true to use GPU; false to use CPU");
 C10_DEFINE_string(nn_model, "", "Path to the model exported by torch script.");
 C10_DEFINE_string(hlg, "", "Path to HLG.pt.");
 C10_DEFINE_string(g, "", "Path to an ngram LM, e.g, G_4gram.pt");
+C10_DEFINE_string(arpa, "",
+                  "Path to an ngram LM in ARPA format, e.g., 4-gram.arpa. "
+                  "If given, it is used instead of --g");
 C10_DEFINE_double(ngram_lm_scale, 1.0, "Scale for ngram LM scores");
 C10_DEFINE_string(word_table, "", "Path to words.txt.");
 
@@ -95,8 +105,8 @@ static void CheckArgs() {
     exit(EXIT_FAILURE);
   }
 
-  if (FLAGS_g.empty()) {
-    std::cerr << "Please provide --g\n" << torch::UsageMessage();
+  if (FLAGS_g.empty() && FLAGS_arpa.empty()) {
+    std::cerr << "Please provide --g or --arpa\n" << torch::UsageMessage();
     exit(EXIT_FAILURE);
   }
 
@@ -202,17 +212,29 @@ int main(int argc, char *argv[]) {
       FLAGS_output_beam, FLAGS_min_activate_states, FLAGS_max_activate_states,
       subsampling_factor);
 
-  K2_LOG(INFO) << "Load n-gram LM: " << FLAGS_g;
-  k2::FsaClass G = k2::LoadFsa(FLAGS_g, device);
-  G.fsa = k2::FsaToFsaVec(G.fsa);
-
-  K2_CHECK_EQ(G.NumAttrs(), 0) << "G is expected to be an acceptor.";
-  k2::AddEpsilonSelfLoops(G.fsa, &G.fsa);
-  k2::ArcSort(&G.fsa);
-  G.SetTensorAttr("lm_scores", G.Scores().clone());
-
-  K2_LOG(INFO) << "Rescore with an n-gram LM";
-  WholeLatticeRescoring(G, FLAGS_ngram_lm_scale, &lattice);
+  k2::SymbolTable symbol_table(FLAGS_word_table);
+  if (!FLAGS_arpa.empty()) {
+    K2_LOG(INFO) << "Load n-gram LM: " << FLAGS_arpa;
+    std::ifstream is(FLAGS_arpa);
+    K2_CHECK(is) << "Failed to open " << FLAGS_arpa;
+    k2::NgramLm lm = k2::ReadArpa(k2::ContextFromDevice(device), is,
+                                  symbol_table.sym2id());
+
+    K2_LOG(INFO) << "Rescore with an n-gram LM";
+    WholeLatticeRescoring(lm, FLAGS_ngram_lm_scale, &lattice);
+  } else {
+    K2_LOG(INFO) << "Load n-gram LM: " << FLAGS_g;
+    k2::FsaClass G = k2::LoadFsa(FLAGS_g, device);
+    G.fsa = k2::FsaToFsaVec(G.fsa);
+
+    K2_CHECK_EQ(G.NumAttrs(), 0) << "G is expected to be an acceptor.";
+    k2::AddEpsilonSelfLoops(G.fsa, &G.fsa);
+    k2::ArcSort(&G.fsa);
+    G.SetTensorAttr("lm_scores", G.Scores().clone());
+
+    K2_LOG(INFO) << "Rescore with an n-gram LM";
+    WholeLatticeRescoring(G, FLAGS_ngram_lm_scale, &lattice);
+  }
 
   lattice = k2::ShortestPath(lattice);
 
@@ -220,7 +242,6 @@ int main(int argc, char *argv[]) {
   auto aux_labels_vec = ragged_aux_labels.ToVecVec();
 
   std::vector<std::string> texts;
-  k2::SymbolTable symbol_table(FLAGS_word_table);
   for (const auto &ids : aux_labels_vec) {
     std::string text;
     std::string sep = "";
@@ -15,6 +15,7 @@
  * See the License for the specific language governing permissions and
  * limitations under the License.
  */
+#include <algorithm>
 #include <cassert>
 #include <cstdio>
 #include <cstdlib>
@@ -58,6 +59,9 @@ C10_DEFINE_double(frame_shift_ms, 10.0,
 C10_DEFINE_double(frame_length_ms, 25.0,
                   "Frame length in ms for computing Fbank");
 C10_DEFINE_int(num_bins, 80, "Number of triangular bins for computing Fbank");
+C10_DEFINE_double(audio_chunk_ms, 100,
+                  "The audio is given to the feature extractor in chunks "
+                  "of this many ms, as it would arrive when streaming");
 C10_DEFINE_int(num_streams, 2, "Number of concurrent streams");
 
 static void CheckArgs() {
@@ -154,18 +158,34 @@ int main(int argc, char *argv[]) {
   fbank_opts.mel_opts.num_bins = FLAGS_num_bins;
   fbank_opts.device = device;
 
-  kaldifeat::Fbank fbank(fbank_opts);
-
   K2_LOG(INFO) << "Load wave files";
   auto wave_data = k2::ReadWave(wave_filenames, FLAGS_sample_rate);
 
-  for (auto &w : wave_data) {
-    w = w.to(device);
-  }
-
   K2_LOG(INFO) << "Compute features";
-  std::vector<int64_t> num_frames;
-  auto features_vec = k2::ComputeFeatures(fbank, wave_data, &num_frames);
+  // Feed the audio of all waves chunk by chunk; the features of each chunk
+  // are computed for all waves at once.
+  k2::OnlineFbank online_fbank(fbank_opts, num_waves);
+  std::vector<std::vector<torch::Tensor>> frames(num_waves);
+  int64_t audio_chunk_size = std::max<int64_t>(
+      1, static_cast<int64_t>(FLAGS_sample_rate * FLAGS_audio_chunk_ms / 1000));
+  for (int64_t start = 0;; start += audio_chunk_size) {
+    bool has_audio = false;
+    for (int32_t i = 0; i != num_waves; ++i) {
+      if (start >= wave_data[i].size(0)) continue;
+      online_fbank.AcceptWaveform(
+          i, wave_data[i].slice(0, start, start + audio_chunk_size));
+      has_audio = true;
+    }
+    if (!has_audio) break;
+    std::vector<torch::Tensor> ready = online_fbank.ComputeReadyFrames();
+    for (int32_t i = 0; i != num_waves; ++i) frames[i].push_back(ready[i]);
+  }
+  std::vector<int64_t> num_frames(num_waves);
+  std::vector<torch::Tensor> features_vec(num_waves);
+  for (int32_t i = 0; i != num_waves; ++i) {
+    features_vec[i] = torch::cat(frames[i], 0);
+    num_frames[i] = online_fbank.NumFramesComputed(i);
+  }
 
   // Note: math.log(1e-10) is -23.025850929940457
   auto features = torch::nn::utils::rnn::pad_sequence(features_vec, true,
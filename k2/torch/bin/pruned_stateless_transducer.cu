@@ -168,7 +168,8 @@ int main(int argc, char *argv[]) {
     hyp_tokens = k2::GreedySearch(module, encoder_out, encoder_out_lens.cpu());
   } else {
     hyp_tokens =
-        k2::ModifiedBeamSearch(module, encoder_out, encoder_out_lens.cpu());
+        k2::BatchedModifiedBeamSearch(module, encoder_out,
+                                      encoder_out_lens.cpu());
   }
 
   k2::SymbolTable symbol_table(tokens);
@@ -21,14 +21,20 @@
 
 #include <algorithm>
 #include <deque>
+#include <limits>
 #include <utility>
 #include <vector>
 
 #include "k2/csrc/array.h"
+#include "k2/csrc/array_ops.h"
 #include "k2/csrc/log.h"
+#include "k2/csrc/macros.h"
 #include "k2/csrc/ragged_ops.h"
+#include "k2/csrc/utils.h"
 #include "k2/torch/csrc/beam_search.h"
+#include "k2/torch/csrc/decoder_cache.h"
 #include "k2/torch/csrc/hypothesis.h"
+#include "k2/torch/csrc/utils.h"
 #include "torch/all.h"
 
 namespace k2 {
@@ -82,6 +88,74 @@ static torch::Tensor BuildDecoderInput(const std::vector<Hypothesis> hyps,
   return decoder_input;
 }
 
+/**
+ * Construct the decoder input from hypotheses stored as a ragged tensor.
+ *
+ * @param hyps  A ragged tensor with axes [utt][hyp][token]. Each hypothesis
+ *              has at least `context_size` tokens.
+ * @param context_size  Context size of the decoder.
+ * @return Return a 2-D tensor of shape (num_hyps, context_size) with dtype
+ *         torch.kLong, on the same device as `hyps`, containing the last
+ *         `context_size` tokens of each hypothesis.
+ */
+static torch::Tensor BuildDecoderInput(Ragged<int32_t> &hyps,
+                                       int32_t context_size) {
+  ContextPtr c = hyps.Context();
+  int32_t num_hyps = hyps.TotSize(1);
+  torch::Tensor ans =
+      torch::empty({num_hyps, context_size},
+                   torch::device(DeviceFromContext(c)).dtype(torch::kLong));
+  int64_t *ans_data = ans.data_ptr<int64_t>();
+  const int32_t *row_splits2_data = hyps.RowSplits(2).Data(),
+                *tokens_data = hyps.values.Data();
+  K2_EVAL2(
+      c, num_hyps, context_size, lambda_set_decoder_input,
+      (int32_t i, int32_t j)->void {
+        int32_t end = row_splits2_data[i + 1];
+        ans_data[i * context_size + j] = tokens_data[end - context_size + j];
+      });
+  return ans;
+}
+
+/**
+ * Run the decoder and the decoder projection of the joiner on the given
+ * decoder input. Hypotheses of the same utterance often share the same
+ * context, so the decoder runs only on the unique rows of `decoder_input`.
+ *
+ * @param decoder_input  A 2-D tensor of shape (num_hyps, context_size).
+ * @return Return a tensor of shape (num_hyps, 1, joiner_dim).
+ */
+static torch::Tensor RunDecoderOnUniqueContexts(
+    torch::jit::Module &decoder, torch::jit::Module &decoder_proj,
+    const torch::Tensor &decoder_input) {
+  torch::Tensor unique_input, inverse, counts;
+  std::tie(unique_input, inverse, counts) =
+      torch::unique_dim(decoder_input, /*dim*/ 0, /*sorted*/ true,
+                        /*return_inverse*/ true, /*return_counts*/ false);
+  auto decoder_out =
+      decoder.run_method("forward", unique_input, /*need_pad*/ false)
+          .toTensor();
+  decoder_out = decoder_proj.run_method("forward", decoder_out).toTensor();
+  return decoder_out.index_select(/*dim*/ 0, inverse);
+}
+
+/**
+ * Return a function that runs the decoder and the decoder projection of the
+ * joiner on its input, for use with DecoderOutputCache. The input is moved
+ * to `device`, i.e., the device of the model, first.
+ */
+static DecoderOutputCache::DecoderFunc MakeDecoderFunc(
+    torch::jit::Module &decoder, torch::jit::Module &decoder_proj,
+    torch::Device device) {
+  return [&decoder, &decoder_proj, device](const torch::Tensor &contexts) {
+    auto decoder_out = decoder
+                           .run_method("forward", contexts.to(device),
+                                       /*need_pad*/ false)
+                           .toTensor();
+    return decoder_proj.run_method("forward", decoder_out).toTensor();
+  };
+}
+
 /** Return a ragged shape with axes [utt][num_hyps].
  *
  * @param hyps hyps.size() == batch_size. Each entry contains the active
@@ -105,7 +179,8 @@ static RaggedShape GetHypsShape(const std::vector<Hypotheses> &hyps) {
 
 std::vector<std::vector<int32_t>> GreedySearch(
     const torch::jit::Module &model, const torch::Tensor &encoder_out,
-    const torch::Tensor &encoder_out_lens) {
+    const torch::Tensor &encoder_out_lens,
+    DecoderOutputCache *cache /*= nullptr*/) {
   K2_CHECK_EQ(encoder_out.dim(), 3);
   K2_CHECK_EQ(encoder_out.scalar_type(), torch::kFloat);
 
@@ -145,11 +220,11 @@ std::vector<std::vector<int32_t>> GreedySearch(
       torch::full({batch_size, context_size}, blank_id,
                   torch::dtype(torch::kLong)
                       .memory_format(torch::MemoryFormat::Contiguous));
-  auto decoder_out =
-      decoder
-          .run_method("forward", decoder_input.to(device), /*need_pad*/ false)
-          .toTensor();
-  decoder_out = decoder_proj.run_method("forward", decoder_out).toTensor();
+  DecoderOutputCache local_cache;
+  if (cache == nullptr) cache = &local_cache;
+  auto run_decoder = MakeDecoderFunc(decoder, decoder_proj, device);
+
+  auto decoder_out = cache->Get(decoder_input, run_decoder);
   // decoder_out's shape is (batch_size, 1, joiner_dim)
 
   using torch::indexing::Slice;
@@ -192,11 +267,7 @@ std::vector<std::vector<int32_t>> GreedySearch(
         decoder_input = decoder_input.index({Slice(0, cur_batch_size)});
       }
       BuildDecoderInput(hyps, &decoder_input);
-      decoder_out = decoder
-                        .run_method("forward", decoder_input.to(device),
-                                    /*need_pad*/ false)
-                        .toTensor();
-      decoder_out = decoder_proj.run_method("forward", decoder_out).toTensor();
+      decoder_out = cache->Get(decoder_input, run_decoder);
     }
   }
 
@@ -215,7 +286,8 @@ std::vector<std::vector<int32_t>> GreedySearch(
 
 std::vector<std::vector<int32_t>> ModifiedBeamSearch(
     const torch::jit::Module &model, const torch::Tensor &encoder_out,
-    const torch::Tensor &encoder_out_lens, int32_t num_acitve_paths /*=4*/) {
+    const torch::Tensor &encoder_out_lens, int32_t num_acitve_paths /*=4*/,
+    DecoderOutputCache *cache /*= nullptr*/) {
   K2_CHECK_EQ(encoder_out.dim(), 3);
   K2_CHECK_EQ(encoder_out.scalar_type(), torch::kFloat);
 
@@ -255,6 +327,10 @@ std::vector<std::vector<int32_t>> ModifiedBeamSearch(
   std::vector<Hypotheses> cur(batch_size, blank_hyp);
   std::vector<Hypothesis> prev;
 
+  DecoderOutputCache local_cache;
+  if (cache == nullptr) cache = &local_cache;
+  auto run_decoder = MakeDecoderFunc(decoder, decoder_proj, device);
+
   using torch::indexing::Slice;
   auto batch_sizes_acc = packed_seq.batch_sizes().accessor<int64_t, 1>();
   int32_t num_batches = packed_seq.batch_sizes().numel();
@@ -299,13 +375,9 @@ std::vector<std::vector<int32_t>> ModifiedBeamSearch(
       ys_log_probs_acc[k][0] = prev[k].log_prob;
     }
 
-    auto decoder_input = BuildDecoderInput(prev, context_size).to(device);
-
-    auto decoder_out =
-        decoder.run_method("forward", decoder_input, /*need_pad*/ false)
-            .toTensor();
+    auto decoder_input = BuildDecoderInput(prev, context_size);
 
-    decoder_out = decoder_proj.run_method("forward", decoder_out).toTensor();
+    auto decoder_out = cache->Get(decoder_input, run_decoder);
     // decoder_out is of shape (num_hyps, 1, joiner_dim)
 
     auto row_ids = hyps_shape.RowIds(1);
@@ -359,7 +431,7 @@ std::vector<std::vector<int32_t>> ModifiedBeamSearch(
 
         int32_t new_token = topk_token_indexes_acc[j];
         if (new_token != blank_id && new_token != unk_id) {
-          new_hyp.ys.push_back(new_token);
+          new_hyp.Append(new_token);
         }
 
         // We already added log_prob of the path to log_probs before, so
@@ -388,6 +460,265 @@ std::vector<std::vector<int32_t>> ModifiedBeamSearch(
   return ans;
 }
 
+std::vector<std::vector<int32_t>> BatchedModifiedBeamSearch(
+    const torch::jit::Module &model, const torch::Tensor &encoder_out,
+    const torch::Tensor &encoder_out_lens, int32_t num_active_paths /*=4*/) {
+  K2_CHECK_EQ(encoder_out.dim(), 3);
+  K2_CHECK_EQ(encoder_out.scalar_type(), torch::kFloat);
+
+  K2_CHECK_EQ(encoder_out_lens.dim(), 1);
+  K2_CHECK_EQ(encoder_out_lens.scalar_type(), torch::kLong);
+  K2_CHECK(encoder_out_lens.device().is_cpu());
+  K2_CHECK_GT(num_active_paths, 0);
+
+  torch::nn::utils::rnn::PackedSequence packed_seq =
+      torch::nn::utils::rnn::pack_padded_sequence(encoder_out, encoder_out_lens,
+                                                  /*batch_first*/ true,
+                                                  /*enforce_sorted*/ false);
+  torch::jit::Module decoder = model.attr("decoder").toModule();
+  torch::jit::Module joiner = model.attr("joiner").toModule();
+  torch::jit::Module decoder_proj = joiner.attr("decoder_proj").toModule();
+
+  auto projected_encoder_out = joiner.attr("encoder_proj")
+                                   .toModule()
+                                   .run_method("forward", packed_seq.data())
+                                   .toTensor();
+
+  int32_t blank_id = decoder.attr("blank_id").toInt();
+
+  int32_t unk_id = blank_id;
+  if (decoder.hasattr("unk_id")) {
+    unk_id = decoder.attr("unk_id").toInt();
+  }
+
+  int32_t context_size = decoder.attr("context_size").toInt();
+  int32_t batch_size = encoder_out_lens.size(0);
+
+  torch::Device device = encoder_out.device();
+  ContextPtr c = ContextFromDevice(device);
+  auto float_opts = torch::device(device).dtype(torch::kFloat);
+
+  // hyps has axes [utt][hyp][token]; each utterance starts with a single
+  // hypothesis containing `context_size` blanks. log_probs[i] is the
+  // log-prob of the i-th hypothesis, i.e., of hyps[idx0][idx1] with
+  // idx01 == i.
+  Ragged<int32_t> hyps;
+  {
+    Array1<int32_t> row_splits1 = Arange<int32_t>(c, 0, batch_size + 1);
+    Array1<int32_t> row_splits2 = Arange<int32_t>(
+        c, 0, (batch_size + 1) * context_size, context_size);
+    RaggedShape shape =
+        RaggedShape3(&row_splits1, nullptr, batch_size, &row_splits2, nullptr,
+                     batch_size * context_size);
+    hyps = Ragged<int32_t>(
+        shape, Array1<int32_t>(c, batch_size * context_size, blank_id));
+  }
+  torch::Tensor log_probs = torch::zeros({batch_size}, float_opts);
+
+  // Utterances are sorted by length in decreasing order, so finished
+  // utterances are always at the end of `hyps`.
+  std::deque<Ragged<int32_t>> finalized_hyps;
+  std::deque<torch::Tensor> finalized_log_probs;
+
+  using torch::indexing::Slice;
+  auto batch_sizes_acc = packed_seq.batch_sizes().accessor<int64_t, 1>();
+  int32_t num_batches = packed_seq.batch_sizes().numel();
+  int32_t offset = 0;
+  for (int32_t i = 0; i != num_batches; ++i) {
+    int32_t cur_batch_size = batch_sizes_acc[i];
+    int32_t start = offset;
+    int32_t end = start + cur_batch_size;
+    auto cur_encoder_out = projected_encoder_out.index({Slice(start, end)});
+    offset = end;
+
+    cur_encoder_out = cur_encoder_out.unsqueeze(1).unsqueeze(1);
+    // Now cur_encoder_out's shape is (cur_batch_size, 1, 1, joiner_dim)
+
+    if (cur_batch_size < hyps.Dim0()) {
+      int32_t num_kept_hyps = hyps.RowSplits(1)[cur_batch_size];
+      finalized_hyps.push_front(
+          Arange(hyps, /*axis*/ 0, cur_batch_size, hyps.Dim0()));
+      finalized_log_probs.push_front(
+          log_probs.slice(/*dim*/ 0, num_kept_hyps));
+      hyps = Arange(hyps, /*axis*/ 0, 0, cur_batch_size);
+      log_probs = log_probs.slice(/*dim*/ 0, 0, num_kept_hyps);
+    }
+
+    int32_t num_hyps = hyps.TotSize(1);
+    auto decoder_input = BuildDecoderInput(hyps, context_size);
+    auto decoder_out =
+        RunDecoderOnUniqueContexts(decoder, decoder_proj, decoder_input);
+    // decoder_out is of shape (num_hyps, 1, joiner_dim)
+
+    auto row_ids1 = Array1ToTorch(hyps.RowIds(1)).to(torch::kLong);
+    auto row_splits1 = Array1ToTorch(hyps.RowSplits(1)).to(torch::kLong);
+
+    cur_encoder_out =
+        cur_encoder_out.index_select(/*dim*/ 0, /*index*/ row_ids1);
+    // cur_encoder_out is of shape (num_hyps, 1, 1, joiner_dim)
+
+    auto logits =
+        joiner
+            .run_method("forward", cur_encoder_out, decoder_out.unsqueeze(1),
+                        /*project_input*/ false)
+            .toTensor();
+    // logits' shape is (num_hyps, 1, 1, vocab_size)
+    logits = logits.squeeze(1).squeeze(1);
+    // now logits' shape is (num_hyps, vocab_size)
+
+    auto scores = logits.log_softmax(-1).add_(log_probs.unsqueeze(1));
+    int32_t vocab_size = scores.size(1);
+    K2_CHECK_GE(vocab_size, num_active_paths);
+
+    // Segmented top-k over the hypotheses of each utterance: every
+    // utterance has at most num_active_paths hypotheses, so we scatter the
+    // scores into a padded (cur_batch_size, num_active_paths * vocab_size)
+    // tensor and take the top-k of each row.
+    auto idx_in_utt = torch::arange(num_hyps, row_ids1.options()) -
+                      row_splits1.index_select(/*dim*/ 0, row_ids1);
+    auto padded = torch::full({cur_batch_size, num_active_paths, vocab_size},
+                              -std::numeric_limits<float>::infinity(),
+                              float_opts);
+    padded.index_put_({row_ids1, idx_in_utt}, scores);
+
+    torch::Tensor values, indexes;
+    std::tie(values, indexes) =
+        padded.view({cur_batch_size, -1})
+            .topk(/*k*/ num_active_paths, /*dim*/ 1,
+                  /*largest*/ true, /*sorted*/ true);
+    // values and indexes are of shape (cur_batch_size, num_active_paths)
+
+    auto parents = (FloorDivide(indexes, vocab_size) +
+                    row_splits1.slice(/*dim*/ 0, 0, cur_batch_size)
+                        .unsqueeze(1))
+                       .reshape(-1)
+                       .to(torch::kInt)
+                       .contiguous();
+    auto new_tokens = torch::remainder(indexes, vocab_size)
+                          .reshape(-1)
+                          .to(torch::kInt)
+                          .contiguous();
+    values = values.reshape(-1).contiguous();
+
+    // Extend the parent of each new hypothesis with its new token, if any.
+    int32_t num_new_hyps = cur_batch_size * num_active_paths;
+    const int32_t *parents_data = parents.data_ptr<int32_t>(),
+                  *new_tokens_data = new_tokens.data_ptr<int32_t>(),
+                  *row_splits2_data = hyps.RowSplits(2).Data(),
+                  *tokens_data = hyps.values.Data();
+
+    Array1<int32_t> new_row_splits1 =
+        Arange<int32_t>(c, 0, num_new_hyps + 1, num_active_paths);
+    Array1<int32_t> new_row_splits2(c, num_new_hyps + 1);
+    int32_t *new_row_splits2_data = new_row_splits2.Data();
+    K2_EVAL(
+        c, num_new_hyps, lambda_set_num_tokens, (int32_t i)->void {
+          int32_t p = parents_data[i], t = new_tokens_data[i];
+          new_row_splits2_data[i] = row_splits2_data[p + 1] -
+                                    row_splits2_data[p] +
+                                    (t != blank_id && t != unk_id);
+        });
+    ExclusiveSum(new_row_splits2, &new_row_splits2);
+    int32_t num_tokens = new_row_splits2.Back();
+    RaggedShape new_shape =
+        RaggedShape3(&new_row_splits1, nullptr, num_new_hyps,
+                     &new_row_splits2, nullptr, num_tokens);
+
+    Array1<int32_t> tokens(c, num_tokens);
+    int32_t *new_tokens_out_data = tokens.Data();
+    const int32_t *new_row_ids2_data = new_shape.RowIds(2).Data();
+    K2_EVAL(
+        c, num_tokens, lambda_set_tokens, (int32_t i)->void {
+          int32_t h = new_row_ids2_data[i],
+                  j = i - new_row_splits2_data[h], p = parents_data[h],
+                  begin = row_splits2_data[p],
+                  n = row_splits2_data[p + 1] - begin;
+          new_tokens_out_data[i] =
+              (j < n ? tokens_data[begin + j] : new_tokens_data[h]);
+        });
+    Ragged<int32_t> new_hyps(new_shape, tokens);
+
+    // Merge hypotheses of the same utterance with identical token sequences:
+    // the first of them is kept and its log-prob is the log-sum of theirs.
+    Array1<int64_t> hashes = ComputeHash<int64_t>(new_hyps);
+    const int64_t *hashes_data = hashes.Data();
+    const float *values_data = values.data_ptr<float>();
+    torch::Tensor merged = torch::empty_like(values);
+    float *merged_data = merged.data_ptr<float>();
+    Renumbering renumbering(c, num_new_hyps);
+    char *keep_data = renumbering.Keep().Data();
+    K2_EVAL(
+        c, num_new_hyps, lambda_merge_hyps, (int32_t i)->void {
+          int32_t begin = i - i % num_active_paths,
+                  end = begin + num_active_paths;
+          int64_t hash = hashes_data[i];
+          for (int32_t j = begin; j != i; ++j) {
+            if (hashes_data[j] == hash) {
+              keep_data[i] = 0;
+              return;
+            }
+          }
+          keep_data[i] = 1;
+          float log_prob = values_data[i];
+          for (int32_t j = i + 1; j != end; ++j) {
+            if (hashes_data[j] == hash)
+              log_prob = LogAdd<float>()(log_prob, values_data[j]);
+          }
+          merged_data[i] = log_prob;
+        });
+
+    Array1<int32_t> new2old = renumbering.New2Old();
+    hyps = SubsetRagged(new_hyps, renumbering, /*axis*/ 1);
+    log_probs = merged.index_select(/*dim*/ 0,
+                                    Array1ToTorch(new2old).to(torch::kLong));
+  }
+
+  std::vector<Ragged<int32_t>> all_hyps_vec(1, hyps);
+  std::vector<torch::Tensor> all_log_probs_vec(1, log_probs);
+  all_hyps_vec.insert(all_hyps_vec.end(), finalized_hyps.begin(),
+                      finalized_hyps.end());
+  all_log_probs_vec.insert(all_log_probs_vec.end(),
+                           finalized_log_probs.begin(),
+                           finalized_log_probs.end());
+  Ragged<int32_t> all_hyps =
+      Cat(/*axis*/ 0, static_cast<int32_t>(all_hyps_vec.size()),
+          all_hyps_vec.data());
+  torch::Tensor all_log_probs = torch::cat(all_log_probs_vec).contiguous();
+
+  // Pick the best hypothesis of each utterance, normalized by length
+  // (including the initial blanks, as in Hypotheses::GetMostProbable()).
+  auto row_splits2 = Array1ToTorch(all_hyps.RowSplits(2));
+  auto lengths = (row_splits2.slice(/*dim*/ 0, 1) -
+                  row_splits2.slice(/*dim*/ 0, 0, -1))
+                     .to(torch::kFloat);
+  auto normalized = (all_log_probs / lengths).contiguous();
+  RaggedShape utt_hyps_shape = RemoveAxis(all_hyps.shape, 2);
+  Ragged<float> normalized_ragged(utt_hyps_shape,
+                                  Array1FromTorch<float>(normalized));
+  Array1<int32_t> best(c, batch_size);
+  ArgMaxPerSublist(normalized_ragged,
+                   -std::numeric_limits<float>::infinity(), &best);
+
+  // This is the only place where the hypotheses leave the device.
+  best = best.To(GetCpuContext());
+  all_hyps = all_hyps.To(GetCpuContext());
+  const int32_t *best_data = best.Data(),
+                *cpu_row_splits2_data = all_hyps.RowSplits(2).Data(),
+                *cpu_tokens_data = all_hyps.values.Data();
+
+  auto unsorted_indices = packed_seq.unsorted_indices().cpu();
+  auto unsorted_indices_accessor = unsorted_indices.accessor<int64_t, 1>();
+
+  std::vector<std::vector<int32_t>> ans(batch_size);
+  for (int32_t i = 0; i != batch_size; ++i) {
+    int32_t h = best_data[unsorted_indices_accessor[i]];
+    ans[i].assign(cpu_tokens_data + cpu_row_splits2_data[h] + context_size,
+                  cpu_tokens_data + cpu_row_splits2_data[h + 1]);
+  }
+
+  return ans;
+}
+
 }  // namespace k2
 
 #endif  // K2_TORCH_CSRC_BEAM_SEARCH_H_
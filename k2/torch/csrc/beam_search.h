@@ -21,6 +21,7 @@
 
 #include <vector>
 
+#include "k2/torch/csrc/decoder_cache.h"
 #include "torch/all.h"
 
 namespace k2 {
@@ -39,17 +40,45 @@ namespace k2 {
  *                         and its shape is (batch_size,). Also, it must be
  *                         on CPU.
  *
+ * @param cache  If not null, decoder outputs are looked up in and added to
+ *               this cache, so it can be shared between calls with the same
+ *               model. If null, a cache local to this call is used. The
+ *               decoder only runs on contexts that are not in the cache.
+ *
  * @return Return A list-of-list of token IDs containing the decoding results.
  * The returned vector has size `batch_size` and each entry contains the
  * decoding results for the corresponding input in encoder_out.
  */
 std::vector<std::vector<int32_t>> GreedySearch(
     const torch::jit::Module &model, const torch::Tensor &encoder_out,
-    const torch::Tensor &encoder_out_lens);
+    const torch::Tensor &encoder_out_lens,
+    DecoderOutputCache *cache = nullptr);
 
+/** RNN-T modified beam search, i.e., one symbol per frame with
+ * `num_acitve_paths` hypotheses per utterance.
+ *
+ * See GreedySearch() above for the meaning of the arguments.
+ */
 std::vector<std::vector<int32_t>> ModifiedBeamSearch(
     const torch::jit::Module &model, const torch::Tensor &encoder_out,
-    const torch::Tensor &encoder_out_lens, int32_t num_acitve_paths = 4);
+    const torch::Tensor &encoder_out_lens, int32_t num_acitve_paths = 4,
+    DecoderOutputCache *cache = nullptr);
+
+/** Same as ModifiedBeamSearch() above, but all hypotheses of the batch are
+ * kept on the device of `encoder_out` in a ragged tensor with axes
+ * [utt][hyp][token]. Merging of hypotheses with identical token sequences
+ * uses ComputeHash() and the pruning to `num_active_paths` hypotheses per
+ * utterance is a segmented top-k, so no per-hypothesis work is done on the
+ * host. The decoder is run only on the unique contexts of each frame.
+ *
+ * See GreedySearch() for the meaning of the arguments.
+ *
+ * @param num_active_paths  Number of hypotheses kept per utterance. It must
+ *                          not be larger than the vocabulary size.
+ */
+std::vector<std::vector<int32_t>> BatchedModifiedBeamSearch(
+    const torch::jit::Module &model, const torch::Tensor &encoder_out,
+    const torch::Tensor &encoder_out_lens, int32_t num_active_paths = 4);
 
 }  // namespace k2
 
@@ -16,11 +16,20 @@
  * limitations under the License.
  */
 
+#include <algorithm>
 #include <limits>
+#include <vector>
 
+#ifdef K2_WITH_CUDA
+#include "c10/cuda/CUDAGuard.h"
+#include "c10/cuda/CUDAStream.h"
+#endif
+#include "k2/csrc/array_ops.h"
 #include "k2/csrc/fsa_algo.h"
 #include "k2/csrc/fsa_utils.h"
+#include "k2/csrc/macros.h"
 #include "k2/csrc/ragged_ops.h"
+#include "k2/csrc/thread_pool.h"
 #include "k2/torch/csrc/decode.h"
 #include "k2/torch/csrc/dense_fsa_vec.h"
 #include "k2/torch/csrc/fsa_algo.h"
@@ -31,12 +40,86 @@ namespace k2 {
 FsaClass GetLattice(torch::Tensor nnet_output, FsaClass &decoding_graph,
                     torch::Tensor supervision_segments, float search_beam,
                     float output_beam, int32_t min_activate_states,
-                    int32_t max_activate_states, int32_t subsampling_factor) {
-  DenseFsaVec dense_fsa_vec = CreateDenseFsaVec(
-      nnet_output, supervision_segments, subsampling_factor - 1);
-  return IntersectDensePruned(decoding_graph, dense_fsa_vec, search_beam,
-                              output_beam, min_activate_states,
-                              max_activate_states);
+                    int32_t max_activate_states, int32_t subsampling_factor,
+                    int32_t num_buckets /*= 1*/) {
+  int32_t num_segments = supervision_segments.size(0);
+  if (num_buckets <= 1 || num_segments <= 1) {
+    // No derivatives are needed here, so read the scores from `nnet_output`
+    // instead of copying them.
+    DenseFsaVec dense_fsa_vec = CreatePaddedDenseFsaVec(
+        nnet_output, supervision_segments, subsampling_factor - 1);
+    return IntersectDensePruned(decoding_graph, dense_fsa_vec, search_beam,
+                                output_beam, min_activate_states,
+                                max_activate_states);
+  }
+  num_buckets = std::min(num_buckets, num_segments);
+
+  // order[i] is the index of the segment with the i'th largest duration;
+  // bucket b has the segments order[b * N / num_buckets] to
+  // order[(b + 1) * N / num_buckets - 1].
+  torch::Tensor order =
+      torch::argsort(supervision_segments.select(1, 2).cpu(), /*dim*/ 0,
+                     /*descending*/ true);
+
+  // The buckets use the graph concurrently.
+  decoding_graph.PrepareForSharing();
+  bool is_cuda = nnet_output.is_cuda();
+#ifdef K2_WITH_CUDA
+  // The streams of the buckets must not read nnet_output before it is ready.
+  if (is_cuda) c10::cuda::getCurrentCUDAStream().synchronize();
+#endif
+
+  std::vector<FsaVec> lattices(num_buckets);
+  std::vector<Array1<int32_t>> arc_maps(num_buckets);
+  TaskGroup group;
+  for (int32_t b = 0; b != num_buckets; ++b) {
+    torch::Tensor indexes =
+        order.slice(0, static_cast<int64_t>(b) * num_segments / num_buckets,
+                    static_cast<int64_t>(b + 1) * num_segments / num_buckets);
+    group.Run([&, b, indexes]() {
+#ifdef K2_WITH_CUDA
+      c10::optional<c10::cuda::CUDAStreamGuard> stream_guard;
+      if (is_cuda) {
+        stream_guard.emplace(c10::cuda::getStreamFromPool(
+            /*isHighPriority*/ false, nnet_output.device().index()));
+      }
+#endif
+      torch::Tensor segments = supervision_segments.index_select(
+          0, indexes.to(supervision_segments.device()));
+      DenseFsaVec dense_fsa_vec = CreatePaddedDenseFsaVec(
+          nnet_output, segments, subsampling_factor - 1);
+      Array1<int32_t> dense_arc_map;
+      IntersectDensePruned(decoding_graph.fsa, dense_fsa_vec, search_beam,
+                           output_beam, min_activate_states,
+                           max_activate_states, &lattices[b], &arc_maps[b],
+                           &dense_arc_map);
+#ifdef K2_WITH_CUDA
+      // The results are used on the stream of the caller.
+      if (is_cuda) stream_guard->current_stream().synchronize();
+#endif
+    });
+  }
+  group.Wait();
+
+  // Put the lattices back in the order of the segments.
+  ContextPtr c = lattices[0].Context();
+  FsaVec sorted_lattices = Cat(0, num_buckets, lattices.data());
+  Array1<int32_t> sorted_arc_map = Cat(c, num_buckets, arc_maps.data());
+  // Segment i is the new2old[i]'th of `sorted_lattices`.
+  torch::Tensor new2old_tensor = torch::argsort(order).to(torch::kInt);
+  Array1<int32_t> new2old = Array1FromTorch<int32_t>(new2old_tensor).To(c);
+  Array1<int32_t> value_indexes;
+  FsaVec fsa = Index(sorted_lattices, 0, new2old, &value_indexes);
+  Array1<int32_t> graph_arc_map = sorted_arc_map[value_indexes];
+  FsaClass dest(fsa);
+  dest.CopyAttrs(decoding_graph, Array1ToTorch(graph_arc_map));
+#ifdef K2_WITH_CUDA
+  // The memory of `lattices` was allocated on the streams of the buckets and
+  // may be reused by them as soon as it is freed, so wait for the kernels
+  // above that read it.
+  if (is_cuda) c10::cuda::getCurrentCUDAStream().synchronize();
+#endif
+  return dest;
 }
 
 Ragged<int32_t> GetTexts(FsaClass &lattice) {
@@ -61,6 +144,40 @@ Ragged<int32_t> GetTexts(FsaClass &lattice) {
   }
 }
 
+Ragged<int32_t> GetBestPathTexts(FsaClass &lattice) {
+  Ragged<int32_t> best_arcs = ShortestPathArcIndexes(lattice);
+  ContextPtr c = best_arcs.Context();
+  if (lattice.HasTensorAttr("aux_labels")) {
+    torch::Tensor aux_labels =
+        lattice.GetTensorAttr("aux_labels").contiguous();
+    const int32_t *aux_labels_data = aux_labels.data_ptr<int32_t>(),
+                  *best_arcs_data = best_arcs.values.Data();
+    int32_t num_arcs = best_arcs.NumElements();
+    Array1<int32_t> labels(c, num_arcs);
+    int32_t *labels_data = labels.Data();
+    Renumbering renumbering(c, num_arcs);
+    char *keep_data = renumbering.Keep().Data();
+    K2_EVAL(
+        c, num_arcs, lambda_gather_labels, (int32_t i)->void {
+          int32_t label = aux_labels_data[best_arcs_data[i]];
+          labels_data[i] = label;
+          keep_data[i] = (label > 0);
+        });
+    Ragged<int32_t> ans(best_arcs.shape, labels);
+    return SubsetRagged(ans, renumbering);
+  } else {
+    K2_CHECK(lattice.HasRaggedTensorAttr("aux_labels"));
+    Ragged<int32_t> aux_labels = lattice.GetRaggedTensorAttr("aux_labels");
+    // [arc][aux_label], for the arcs on the best paths
+    Ragged<int32_t> labels =
+        Index(aux_labels, /*axis*/ 0, best_arcs.values);
+    RaggedShape shape = ComposeRaggedShapes(best_arcs.shape, labels.shape);
+    shape = RemoveAxis(shape, 1);
+    Ragged<int32_t> ans(shape, labels.values);
+    return RemoveValuesLeq(ans, 0);
+  }
+}
+
 void WholeLatticeRescoring(FsaClass &G, float ngram_lm_scale,
                            FsaClass *lattice) {
   K2_CHECK(lattice->HasTensorAttr("lm_scores"));
@@ -107,6 +224,40 @@ void WholeLatticeRescoring(FsaClass &G, float ngram_lm_scale,
   }
 }
 
+void WholeLatticeRescoring(NgramLm &lm, float ngram_lm_scale,
+                           FsaClass *lattice) {
+  K2_CHECK(lattice->HasTensorAttr("lm_scores"));
+
+  torch::Tensor am_scores =
+      lattice->Scores() - lattice->GetTensorAttr("lm_scores");
+  lattice->SetScores(am_scores);
+  lattice->DeleteTensorAttr("lm_scores");
+
+  k2::Invert(lattice);
+  // Now lattice has word IDs as labels and token IDs as aux_labels.
+
+  k2::Array1<int32_t> arc_map;
+  k2::Array1<float> lm_scores;
+  k2::FsaVec dest =
+      k2::ComposeWithNgramLm(lm, lattice->fsa, &arc_map, &lm_scores);
+
+  lattice->properties = 0;
+  lattice->fsa = dest;
+  lattice->CopyAttrs(*lattice, k2::Array1ToTorch(arc_map));
+  lattice->SetTensorAttr("lm_scores", k2::Array1ToTorch(lm_scores));
+  k2::Connect(lattice);
+  k2::TopSort(lattice);
+  k2::Invert(lattice);
+  // Now lattice has token IDs as labels and word IDs as aux_labels
+
+  if (ngram_lm_scale != 1) {
+    torch::Tensor lm_scores = lattice->GetTensorAttr("lm_scores");
+    am_scores = lattice->Scores() - lm_scores;
+    torch::Tensor scores = am_scores / ngram_lm_scale + lm_scores;
+    lattice->SetScores(scores);
+  }
+}
+
 FsaClass GetBestPaths(FsaClass &lattice, bool use_max, int32_t num_paths,
                       float nbest_scale) {
   if (use_max) {
@@ -168,9 +319,12 @@ FsaClass GetBestPaths(FsaClass &lattice, bool use_max, int32_t num_paths,
 
 void DecodeOneChunk(rnnt_decoding::RnntDecodingStreams &streams,
                     torch::jit::script::Module module,
-                    torch::Tensor encoder_outs) {
+                    torch::Tensor encoder_outs,
+                    DecoderOutputCache *cache /*= nullptr*/,
+                    DecodeStepGraph *step_graph /*= nullptr*/) {
   K2_CHECK_EQ(encoder_outs.dim(), 3);
   K2_CHECK_EQ(streams.NumStreams(), encoder_outs.size(0));
+  K2_CHECK(cache == nullptr || step_graph == nullptr);
   int32_t T = encoder_outs.size(1);
   for (int32_t t = 0; t < T; ++t) {
     RaggedShape shape;
@@ -179,10 +333,21 @@ void DecodeOneChunk(rnnt_decoding::RnntDecodingStreams &streams,
     auto contexts_tensor = Array2ToTorch<int32_t>(contexts);
     // `nn.Embedding()` in torch below v1.7.1 supports only torch.int64
     contexts_tensor = contexts_tensor.to(torch::kInt64);
-    auto decoder_outs = module.attr("decoder")
-                            .toModule()
-                            .run_method("forward", contexts_tensor, false)
-                            .toTensor();
+    if (step_graph != nullptr) {
+      auto row_ids = Array1ToTorch<int32_t>(shape.RowIds(1));
+      auto current_encoder_outs = torch::index_select(
+          encoder_outs.narrow(1, t, 1), 0, row_ids);
+      auto logprobs = step_graph->Run(contexts_tensor, current_encoder_outs);
+      streams.Advance(Array2FromTorch<float>(logprobs));
+      continue;
+    }
+    auto decoder = module.attr("decoder").toModule();
+    auto run_decoder = [&decoder](const torch::Tensor &contexts) {
+      return decoder.run_method("forward", contexts, false).toTensor();
+    };
+    auto decoder_outs = cache != nullptr
+                            ? cache->Get(contexts_tensor, run_decoder)
+                            : run_decoder(contexts_tensor);
     auto current_encoder_outs = encoder_outs.index(
         {torch::indexing::Slice(), torch::indexing::Slice(t, t + 1),
          torch::indexing::Slice()});
@@ -21,8 +21,11 @@
 
 #include "k2/csrc/array.h"
 #include "k2/csrc/fsa.h"
+#include "k2/csrc/ngram_lm.h"
 #include "k2/csrc/ragged.h"
 #include "k2/csrc/rnnt_decode.h"
+#include "k2/torch/csrc/decode_graph.h"
+#include "k2/torch/csrc/decoder_cache.h"
 #include "k2/torch/csrc/fsa_class.h"
 #include "torch/script.h"
 
@@ -47,6 +50,13 @@ namespace k2 {
    @param min_activate_states  See `k2::IntersectDensePruned()` for its meaning.
    @param max_activate_states  See `k2::IntersectDensePruned()` for its meaning.
    @param subsampling_factor  The subsampling factor of the model.
+   @param num_buckets  If greater than 1, the segments are sorted by duration
+                       and split into (up to) this many buckets of similar
+                       durations, which are intersected separately and
+                       concurrently (on CUDA, each on its own stream), so that
+                       the frames of short segments are not processed in
+                       lockstep with those of the longest one.  The lattices
+                       are still in the order of `supervision_segments`.
 
    @return Return an FsaClass, which contains the intersection of decoding graph
            and the FSA constructed from `nnet_output`. All the attributes of the
@@ -55,7 +65,8 @@ namespace k2 {
 FsaClass GetLattice(torch::Tensor nnet_output, FsaClass &decoding_graph,
                     torch::Tensor supervision_segments, float search_beam,
                     float output_beam, int32_t min_activate_states,
-                    int32_t max_activate_states, int32_t subsampling_factor);
+                    int32_t max_activate_states, int32_t subsampling_factor,
+                    int32_t num_buckets = 1);
 
 /** Get aux labels of each FSA contained in the lattice.
 
@@ -66,6 +77,21 @@ FsaClass GetLattice(torch::Tensor nnet_output, FsaClass &decoding_graph,
  */
 Ragged<int32_t> GetTexts(FsaClass &lattice);
 
+/** Get the aux labels on the best path of each FSA in a lattice.
+
+    It is equivalent to `GetTexts(ShortestPath(lattice))`, but it neither
+    builds the best paths nor propagates the other attributes: the aux labels
+    are gathered directly from the arcs on the best paths on the device of
+    the lattice.
+
+    @param lattice An FsaVec with the attribute `aux_labels`, either a tensor
+                   or a ragged tensor.
+
+    @return Return a ragged array with two axes [utt][aux_label] on the device
+            of the lattice. Aux labels that are 0 or -1 are removed.
+ */
+Ragged<int32_t> GetBestPathTexts(FsaClass &lattice);
+
 /** Rescore a lattice with an n-gram LM.
 
     @param G  An acceptor. It MUST be an FsaVec containing only one
@@ -79,6 +105,23 @@ Ragged<int32_t> GetTexts(FsaClass &lattice);
 void WholeLatticeRescoring(FsaClass &G, float ngram_lm_scale,
                            FsaClass *lattice);
 
+/** Rescore a lattice with an n-gram LM that is looked up on demand.
+
+    It is like the above, but G is never built: the LM states are expanded
+    only for the lattice states that reach them (see ComposeWithNgramLm()),
+    so a large LM can be used without its FSA being resident on the device.
+    The LM is applied exactly, i.e. without the approximation of following
+    backoff arcs when an n-gram exists.
+
+    @param lm  The n-gram LM, e.g. from ReadArpa() with the words table of
+               the lattice. It MUST be on the same device as the lattice.
+    @param ngram_lm_scale  The scale value for ngram LM scores.
+    @param lattice The input/output lattice. It can be the
+                   return value of `GetLattice()`.
+ */
+void WholeLatticeRescoring(NgramLm &lm, float ngram_lm_scale,
+                           FsaClass *lattice);
+
 /** Get the best path of a given lattice.
 
     @param lattice  The given lattice.
@@ -104,6 +147,16 @@ FsaClass GetBestPaths(FsaClass &lattice, bool use_max, int32_t num_paths,
                          (B, T, C), B (i.e. the batch size) equals to
                          streams.NumStreams(). T is the chunk size. C is the
                          embedding dimension.
+    @param cache  If not null, decoder outputs are looked up in and added to
+                  this cache, and the decoder runs only on the contexts that
+                  are not in it. Note that looking up the contexts needs a
+                  device-to-host copy of them for every frame.
+    @param step_graph  If not null, the decoder, joiner and log_softmax of
+                  each frame run through it, i.e., as a CUDA graph replay
+                  where possible. Its MaxRows() must be at least
+                  streams.NumStreams() * max_contexts, and it must be created
+                  with the same `module`. It cannot be used together with
+                  `cache`.
 
     Note: streams.TerminateAndFlushToStreams() will be invoked in this function,
           so all the decoding results will be flushed back to the individual
@@ -111,7 +164,9 @@ FsaClass GetBestPaths(FsaClass &lattice, bool use_max, int32_t num_paths,
  */
 void DecodeOneChunk(rnnt_decoding::RnntDecodingStreams &streams,
                     torch::jit::script::Module module,
-                    torch::Tensor encoder_outs);
+                    torch::Tensor encoder_outs,
+                    DecoderOutputCache *cache = nullptr,
+                    DecodeStepGraph *step_graph = nullptr);
 
 }  // namespace k2
 
@@ -0,0 +1,142 @@
+/**
+ * Copyright      2026  Xiaomi Corporation
+ *
+ * See LICENSE for clarification regarding multiple authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <exception>
+#include <utility>
+#include <vector>
+
+#include "k2/csrc/log.h"
+#include "k2/torch/csrc/decode_graph.h"
+
+// at::cuda::CUDAGraph is available since torch 1.10
+#if defined(K2_WITH_CUDA) &&      \
+    (K2_TORCH_VERSION_MAJOR > 1 || \
+     (K2_TORCH_VERSION_MAJOR == 1 && K2_TORCH_VERSION_MINOR >= 10))
+#define K2_HAVE_CUDA_GRAPH
+#include "ATen/cuda/CUDAGraph.h"
+#include "c10/cuda/CUDAGuard.h"
+#include "c10/cuda/CUDAStream.h"
+#endif
+
+namespace k2 {
+
+struct DecodeStepGraph::Graph {
+#ifdef K2_HAVE_CUDA_GRAPH
+  at::cuda::CUDAGraph graph;
+#endif
+};
+
+DecodeStepGraph::DecodeStepGraph(torch::jit::script::Module module,
+                                 int32_t max_rows)
+    : module_(std::move(module)), max_rows_(max_rows) {
+  K2_CHECK_GT(max_rows, 0);
+}
+
+// Defined here, where Graph is a complete type.
+DecodeStepGraph::~DecodeStepGraph() = default;
+
+bool DecodeStepGraph::IsCaptured() const { return graph_ != nullptr; }
+
+torch::Tensor DecodeStepGraph::Forward(const torch::Tensor &contexts,
+                                       const torch::Tensor &encoder_out) {
+  auto decoder_out = module_.attr("decoder")
+                         .toModule()
+                         .run_method("forward", contexts, false)
+                         .toTensor();
+  auto logits = module_.attr("joiner")
+                    .toModule()
+                    .run_method("forward", encoder_out.unsqueeze(1),
+                                decoder_out.unsqueeze(1))
+                    .toTensor()
+                    .squeeze(1)
+                    .squeeze(1);
+  return logits.log_softmax(-1);
+}
+
+void DecodeStepGraph::Capture(const torch::Tensor &contexts,
+                              const torch::Tensor &encoder_out) {
+  tried_capture_ = true;
+  // Zeros are valid contexts (all blanks), so the rows past the actual
+  // number of contexts can be computed safely.
+  contexts_buf_ = torch::zeros({max_rows_, contexts.size(1)},
+                               contexts.options());
+  std::vector<int64_t> encoder_out_sizes = encoder_out.sizes().vec();
+  encoder_out_sizes[0] = max_rows_;
+  encoder_out_buf_ = torch::zeros(encoder_out_sizes, encoder_out.options());
+#ifdef K2_HAVE_CUDA_GRAPH
+  if (!contexts.is_cuda()) return;
+  torch::NoGradGuard no_grad;
+  c10::DeviceIndex device_index = contexts.device().index();
+  // Capturing is not allowed on the default stream.
+  c10::cuda::CUDAStream current_stream =
+                            c10::cuda::getCurrentCUDAStream(device_index),
+                        capture_stream =
+                            c10::cuda::getStreamFromPool(false, device_index);
+  current_stream.synchronize();
+  auto graph = std::make_unique<Graph>();
+  bool capturing = false;
+  try {
+    c10::cuda::CUDAStreamGuard guard(capture_stream);
+    // Warm up first, so that lazy initialization inside torch, e.g., of
+    // cuBLAS handles, does not happen while capturing.
+    for (int32_t i = 0; i != 3; ++i)
+      logprobs_buf_ = Forward(contexts_buf_, encoder_out_buf_);
+    capture_stream.synchronize();
+
+    graph->graph.capture_begin();
+    capturing = true;
+    logprobs_buf_ = Forward(contexts_buf_, encoder_out_buf_);
+    capturing = false;
+    graph->graph.capture_end();
+    capture_stream.synchronize();
+    graph_ = std::move(graph);
+  } catch (const std::exception &e) {
+    if (capturing) {
+      // Leave the stream usable again.
+      cudaGraph_t cuda_graph = nullptr;
+      cudaStreamEndCapture(capture_stream.stream(), &cuda_graph);
+      if (cuda_graph != nullptr) cudaGraphDestroy(cuda_graph);
+      (void)cudaGetLastError();
+    }
+    K2_LOG(WARNING) << "Failed to capture a CUDA graph for decoding, "
+                    << "running without one: " << e.what();
+  }
+#endif
+}
+
+torch::Tensor DecodeStepGraph::Run(const torch::Tensor &contexts,
+                                   const torch::Tensor &encoder_out) {
+  int32_t num_rows = contexts.size(0);
+  K2_CHECK_LE(num_rows, max_rows_);
+  K2_CHECK_EQ(encoder_out.size(0), num_rows);
+  if (!tried_capture_) Capture(contexts, encoder_out);
+  if (graph_ == nullptr) return Forward(contexts, encoder_out);
+
+  K2_CHECK_EQ(contexts.size(1), contexts_buf_.size(1));
+  K2_CHECK(encoder_out.sizes().slice(1).equals(
+      encoder_out_buf_.sizes().slice(1)))
+      << "The shape of the encoder output changed after capturing";
+  contexts_buf_.narrow(0, 0, num_rows).copy_(contexts);
+  encoder_out_buf_.narrow(0, 0, num_rows).copy_(encoder_out);
+#ifdef K2_HAVE_CUDA_GRAPH
+  graph_->graph.replay();
+#endif
+  return logprobs_buf_.narrow(0, 0, num_rows);
+}
+
+}  // namespace k2
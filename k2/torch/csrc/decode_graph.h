@@ -0,0 +1,103 @@
+/**
+ * Copyright      2026  Xiaomi Corporation
+ *
+ * See LICENSE for clarification regarding multiple authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef K2_TORCH_CSRC_DECODE_GRAPH_H_
+#define K2_TORCH_CSRC_DECODE_GRAPH_H_
+
+#include <cstdint>
+#include <memory>
+
+#include "torch/script.h"
+
+namespace k2 {
+
+/** Runs the network part of a frame of RNN-T decoding, i.e., the decoder,
+    the joiner and log_softmax, on fixed-size buffers, so that on CUDA it can
+    be captured once as a CUDA graph and then replayed for every frame.
+
+    With small batches, most of the time of a frame is spent launching the
+    many small kernels of the decoder and joiner; replaying a graph launches
+    them all at once. The number of contexts changes from frame to frame, so
+    the buffers have `max_rows` rows, which must be at least the number of
+    contexts RnntDecodingStreams::GetContexts() can return, i.e.,
+    num_streams * max_contexts. Rows past the actual number of contexts are
+    computed but ignored.
+
+    The rest of a frame (GetContexts() and Advance()) has data-dependent
+    shapes and synchronizes with the host, so it is not captured.
+
+    If capturing fails, e.g., because the model contains operations that
+    cannot be captured, or CUDA graphs are not supported by the torch version
+    k2 was built with, the network is run as usual instead; see IsCaptured().
+    On CPU, it always runs as usual.
+ */
+class DecodeStepGraph {
+ public:
+  /**
+     @param module  Jit script module containing "decoder" and "joiner"
+                    submodules; see DecodeOneChunk().
+     @param max_rows  Number of rows of the fixed-size buffers.
+   */
+  DecodeStepGraph(torch::jit::script::Module module, int32_t max_rows);
+  ~DecodeStepGraph();
+
+  /** Compute the log-probs of a frame.
+
+      @param contexts  A 2-D tensor of shape (N, context_size) with dtype
+                       torch.kLong, with N <= max_rows.
+      @param encoder_out  A 3-D tensor of shape (N, 1, C), the encoder
+                          output of the frame for each of the contexts.
+      @return Return a tensor of shape (N, vocab_size). CAUTION: it may be
+              a view into a buffer that is overwritten by the next call.
+   */
+  torch::Tensor Run(const torch::Tensor &contexts,
+                    const torch::Tensor &encoder_out);
+
+  // True if Run() replays a CUDA graph, which is known after the first call.
+  bool IsCaptured() const;
+
+  int32_t MaxRows() const { return max_rows_; }
+
+ private:
+  // Runs the decoder, joiner and log_softmax without a graph.
+  torch::Tensor Forward(const torch::Tensor &contexts,
+                        const torch::Tensor &encoder_out);
+
+  // Allocates the buffers for the shapes of the given inputs and tries to
+  // capture the graph.
+  void Capture(const torch::Tensor &contexts,
+               const torch::Tensor &encoder_out);
+
+  torch::jit::script::Module module_;
+  int32_t max_rows_;
+  bool tried_capture_ = false;
+
+  // The static inputs and output of the graph, with max_rows_ rows.
+  torch::Tensor contexts_buf_;
+  torch::Tensor encoder_out_buf_;
+  torch::Tensor logprobs_buf_;
+
+  // Defined in decode_graph.cu, so that this header does not need the CUDA
+  // headers of torch.
+  struct Graph;
+  std::unique_ptr<Graph> graph_;
+};
+
+}  // namespace k2
+
+#endif  // K2_TORCH_CSRC_DECODE_GRAPH_H_
@@ -0,0 +1,144 @@
+/**
+ * Copyright      2026  Xiaomi Corporation
+ *
+ * See LICENSE for clarification regarding multiple authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <algorithm>
+#include <iterator>
+#include <utility>
+
+#include "k2/csrc/log.h"
+#include "k2/torch/csrc/decoder_cache.h"
+#include "k2/torch/csrc/hypothesis.h"
+
+namespace k2 {
+
+// The same hash as that of Hypothesis::ys; the contexts are token IDs.
+static uint64_t HashContext(const int64_t *context, int32_t context_size) {
+  uint64_t hash = Hypothesis::kInitialHash;
+  for (int32_t i = 0; i != context_size; ++i)
+    hash = Hypothesis::HashToken(hash, static_cast<int32_t>(context[i]));
+  return hash;
+}
+
+DecoderOutputCache::DecoderOutputCache(int32_t capacity /*= 10000*/)
+    : capacity_(capacity) {
+  K2_CHECK_GT(capacity, 0);
+}
+
+DecoderOutputCache::EntryList::iterator DecoderOutputCache::Find(
+    uint64_t hash, const int64_t *context, int32_t context_size) {
+  auto range = index_.equal_range(hash);
+  for (auto it = range.first; it != range.second; ++it) {
+    const std::vector<int64_t> &c = it->second->context;
+    if (std::equal(c.begin(), c.end(), context)) return it->second;
+  }
+  return lru_.end();
+}
+
+torch::Tensor DecoderOutputCache::Get(const torch::Tensor &contexts,
+                                      const DecoderFunc &decoder) {
+  K2_CHECK_EQ(contexts.dim(), 2);
+  int32_t num_contexts = contexts.size(0);
+  if (num_contexts == 0) return decoder(contexts.to(torch::kLong));
+  int32_t context_size = contexts.size(1);
+  torch::Tensor cpu_contexts =
+      contexts.to(torch::kCPU, torch::kLong).contiguous();
+  const int64_t *p = cpu_contexts.data_ptr<int64_t>();
+
+  // rows[i] is the output of the i-th context, or undefined if it is a miss
+  std::vector<torch::Tensor> rows(num_contexts);
+  // For a miss, miss_index[i] is the index of the i-th context in the
+  // unique missing contexts; otherwise it is -1.
+  std::vector<int32_t> miss_index(num_contexts, -1);
+  std::vector<int32_t> misses;  // index of the first occurrence of a miss
+  std::unordered_multimap<uint64_t, int32_t> miss_map;
+  std::vector<uint64_t> hashes(num_contexts);
+
+  for (int32_t i = 0; i != num_contexts; ++i) {
+    const int64_t *context = p + i * context_size;
+    uint64_t hash = HashContext(context, context_size);
+    hashes[i] = hash;
+    auto it = Find(hash, context, context_size);
+    if (it != lru_.end()) {
+      lru_.splice(lru_.begin(), lru_, it);
+      rows[i] = it->value;
+      ++num_hits_;
+      continue;
+    }
+    auto range = miss_map.equal_range(hash);
+    for (auto m = range.first; m != range.second; ++m) {
+      const int64_t *other = p + misses[m->second] * context_size;
+      if (std::equal(other, other + context_size, context)) {
+        miss_index[i] = m->second;
+        break;
+      }
+    }
+    if (miss_index[i] == -1) {
+      miss_index[i] = static_cast<int32_t>(misses.size());
+      miss_map.emplace(hash, miss_index[i]);
+      misses.push_back(i);
+    }
+    ++num_misses_;
+  }
+
+  if (!misses.empty()) {
+    int32_t num_misses = static_cast<int32_t>(misses.size());
+    torch::Tensor missing = torch::empty({num_misses, context_size},
+                                         torch::kLong);
+    int64_t *q = missing.data_ptr<int64_t>();
+    for (int32_t i : misses) {
+      std::copy(p + i * context_size, p + (i + 1) * context_size, q);
+      q += context_size;
+    }
+    torch::Tensor out = decoder(missing.to(contexts.device()));
+    K2_CHECK_EQ(out.size(0), num_misses);
+
+    // The entries hold copies of the rows, as a view out[j] would keep all
+    // of `out` alive as long as the entry is kept.
+    for (int32_t j = 0; j != num_misses; ++j) {
+      const int64_t *context = p + misses[j] * context_size;
+      lru_.push_front({hashes[misses[j]],
+                       std::vector<int64_t>(context, context + context_size),
+                       out[j].clone()});
+      index_.emplace(hashes[misses[j]], lru_.begin());
+    }
+    for (int32_t i = 0; i != num_contexts; ++i) {
+      if (miss_index[i] != -1) rows[i] = out[miss_index[i]];
+    }
+
+    while (static_cast<int32_t>(lru_.size()) > capacity_) {
+      auto last = std::prev(lru_.end());
+      auto range = index_.equal_range(last->hash);
+      for (auto it = range.first; it != range.second; ++it) {
+        if (it->second == last) {
+          index_.erase(it);
+          break;
+        }
+      }
+      lru_.pop_back();
+    }
+  }
+
+  return torch::stack(rows);
+}
+
+void DecoderOutputCache::Clear() {
+  lru_.clear();
+  index_.clear();
+}
+
+}  // namespace k2
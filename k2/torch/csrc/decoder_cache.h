@@ -0,0 +1,101 @@
+/**
+ * Copyright      2026  Xiaomi Corporation
+ *
+ * See LICENSE for clarification regarding multiple authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef K2_TORCH_CSRC_DECODER_CACHE_H_
+#define K2_TORCH_CSRC_DECODER_CACHE_H_
+
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <unordered_map>
+#include <vector>
+
+#include "torch/script.h"
+
+namespace k2 {
+
+/** An LRU cache of the outputs of a stateless RNN-T decoder, keyed by the
+    decoder context, i.e., the last `context_size` tokens of a hypothesis.
+
+    Many hypotheses share the same context, e.g., all of them at the start
+    of decoding and those that just emitted blanks, so a search only needs
+    to run the decoder on the contexts it has not seen recently. Cached
+    outputs stay on the device the decoder produced them on.
+ */
+class DecoderOutputCache {
+ public:
+  /* Given a 2-D tensor of contexts of shape (num_contexts, context_size),
+     return the decoder outputs, whose dim 0 has size num_contexts. */
+  using DecoderFunc = std::function<torch::Tensor(const torch::Tensor &)>;
+
+  /**
+     @param capacity  Maximum number of contexts kept in the cache. When it
+                      is exceeded, the least recently used ones are evicted.
+   */
+  explicit DecoderOutputCache(int32_t capacity = 10000);
+
+  /** Return the decoder outputs for the given contexts.
+
+      @param contexts  A 2-D tensor of shape (N, context_size) with dtype
+                       torch.kLong or torch.kInt. It may be on any device.
+      @param decoder   It is called at most once, with the unique contexts
+                       that are not in the cache, as a torch.kLong tensor on
+                       the device of `contexts`.
+      @return Return a tensor whose dim 0 has size N; its i-th row is the
+              decoder output of the i-th context.
+   */
+  torch::Tensor Get(const torch::Tensor &contexts,
+                    const DecoderFunc &decoder);
+
+  /// Remove all entries from the cache.
+  void Clear();
+
+  int32_t Size() const { return static_cast<int32_t>(lru_.size()); }
+  int32_t Capacity() const { return capacity_; }
+
+  /// Number of contexts found in (resp. missing from) the cache by Get().
+  int64_t NumHits() const { return num_hits_; }
+  int64_t NumMisses() const { return num_misses_; }
+
+ private:
+  struct Entry {
+    uint64_t hash;
+    std::vector<int64_t> context;
+    // The decoder output of `context`. It is a view into the output of the
+    // decoder call in which it was computed.
+    torch::Tensor value;
+  };
+  using EntryList = std::list<Entry>;
+
+  // Return the entry of `context` or lru_.end() if it is not cached.
+  EntryList::iterator Find(uint64_t hash, const int64_t *context,
+                           int32_t context_size);
+
+  int32_t capacity_;
+  // Most recently used entries are at the front.
+  EntryList lru_;
+  // Maps a hash to its entries; there is more than one only on collisions.
+  std::unordered_multimap<uint64_t, EntryList::iterator> index_;
+
+  int64_t num_hits_ = 0;
+  int64_t num_misses_ = 0;
+};
+
+}  // namespace k2
+
+#endif  // K2_TORCH_CSRC_DECODER_CACHE_H_
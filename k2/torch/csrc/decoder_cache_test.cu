@@ -0,0 +1,68 @@
+/**
+ * Copyright      2026  Xiaomi Corporation
+ *
+ * See LICENSE for clarification regarding multiple authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "k2/torch/csrc/decoder_cache.h"
+
+namespace k2 {
+
+TEST(DecoderOutputCache, Get) {
+  // A fake decoder: the output of a context is the sum of its tokens,
+  // repeated twice.
+  std::vector<int32_t> num_calls;
+  auto decoder = [&num_calls](const torch::Tensor &contexts) {
+    num_calls.push_back(contexts.size(0));
+    return contexts.sum(/*dim*/ 1, /*keepdim*/ true).repeat({1, 2});
+  };
+
+  DecoderOutputCache cache(3);
+  auto contexts = torch::tensor({1, 2, 3, 4, 1, 2}, torch::kLong).view({3, 2});
+  auto out = cache.Get(contexts, decoder);
+  EXPECT_TRUE(out.equal(decoder(contexts)));
+  num_calls.pop_back();
+  // Identical contexts in one call are computed only once.
+  EXPECT_EQ(num_calls, (std::vector<int32_t>{2}));
+  EXPECT_EQ(cache.Size(), 2);
+  EXPECT_EQ(cache.NumHits(), 0);
+  EXPECT_EQ(cache.NumMisses(), 3);
+
+  contexts = torch::tensor({3, 4, 5, 6}, torch::kInt).view({2, 2});
+  out = cache.Get(contexts, decoder);
+  auto expected = torch::tensor({7, 7, 11, 11}, torch::kLong).view({2, 2});
+  EXPECT_TRUE(out.equal(expected));
+  EXPECT_EQ(num_calls, (std::vector<int32_t>{2, 1}));
+  EXPECT_EQ(cache.Size(), 3);
+  EXPECT_EQ(cache.NumHits(), 1);
+
+  // [1, 2] is the least recently used, so it is evicted.
+  contexts = torch::tensor({7, 8}, torch::kLong).view({1, 2});
+  cache.Get(contexts, decoder);
+  EXPECT_EQ(cache.Size(), 3);
+  contexts = torch::tensor({1, 2, 3, 4}, torch::kLong).view({2, 2});
+  out = cache.Get(contexts, decoder);
+  expected = torch::tensor({3, 3, 7, 7}, torch::kLong).view({2, 2});
+  EXPECT_TRUE(out.equal(expected));
+  EXPECT_EQ(num_calls, (std::vector<int32_t>{2, 1, 1, 1}));
+
+  cache.Clear();
+  EXPECT_EQ(cache.Size(), 0);
+}
+
+}  // namespace k2
@@ -30,7 +30,10 @@ namespace k2 {
 DenseFsaVec CreateDenseFsaVec(torch::Tensor log_probs,
                               torch::Tensor supervision_segments,
                               int32_t allow_truncate /*=0*/) {
-  K2_CHECK_EQ(log_probs.dtype(), torch::kFloat32);
+  K2_CHECK(log_probs.dtype() == torch::kFloat32 ||
+           log_probs.dtype() == torch::kFloat16 ||
+           log_probs.dtype() == torch::kBFloat16)
+      << "Unsupported dtype: " << log_probs.dtype();
   K2_CHECK_EQ(log_probs.dim(), 3);
 
   K2_CHECK_EQ(supervision_segments.dtype(), torch::kInt);
@@ -136,7 +139,7 @@ DenseFsaVec CreateDenseFsaVec(torch::Tensor log_probs,
       torch::from_blob(
           tmp.data(), /*sizes*/ {int64_t(tmp.size())},
           /*options*/ torch::device(torch::kCPU).dtype(torch::kFloat32))
-          .to(log_probs.device());
+          .to(scores.options());
 
   scores.index_put_({extra_frame_indexes_tensor}, extra_frame);
 
@@ -148,13 +151,88 @@ DenseFsaVec CreateDenseFsaVec(torch::Tensor log_probs,
 
   ContextPtr ctx = ContextFromTensor(log_probs);
   Array1<int32_t> row_splits_array(ctx, row_splits);
-  Array2<float> scores_array = Array2FromTorch<float>(scores);
   RaggedShape shape =
       RaggedShape2(&row_splits_array, nullptr, row_splits.back());
 
+  if (scores.dtype() != torch::kFloat32) {
+    // The 16-bit scores are passed on as their bit patterns.
+    bool bf16 = scores.dtype() == torch::kBFloat16;
+    return DenseFsaVec(
+        shape, Array2FromTorch<int16_t>(scores.view(torch::kShort)), bf16);
+  }
+  Array2<float> scores_array = Array2FromTorch<float>(scores);
   return {shape, scores_array};
 }
 
+DenseFsaVec CreatePaddedDenseFsaVec(torch::Tensor log_probs,
+                                    torch::Tensor supervision_segments,
+                                    int32_t allow_truncate /*=0*/) {
+  K2_CHECK(log_probs.dtype() == torch::kFloat32 ||
+           log_probs.dtype() == torch::kFloat16 ||
+           log_probs.dtype() == torch::kBFloat16)
+      << "Unsupported dtype: " << log_probs.dtype();
+  K2_CHECK_EQ(log_probs.dim(), 3);
+
+  K2_CHECK_EQ(supervision_segments.dtype(), torch::kInt);
+  K2_CHECK_EQ(supervision_segments.dim(), 2);
+  K2_CHECK_EQ(supervision_segments.size(1), 3);
+  K2_CHECK_EQ(supervision_segments.device().type(), torch::kCPU);
+  K2_CHECK_GE(allow_truncate, 0);
+
+  int32_t N = log_probs.size(0);
+  int32_t T = log_probs.size(1);
+  int32_t C = log_probs.size(2);
+
+  int32_t num_utt = supervision_segments.size(0);
+  int32_t stride = supervision_segments.stride(0);
+  const int32_t *p_sup = supervision_segments.data_ptr<int32_t>();
+
+  // row_offsets[i] is the row of log_probs.reshape({-1, C}) that contains
+  // the first frame of segment i.
+  std::vector<int32_t> row_splits(num_utt + 1), row_offsets(num_utt);
+  row_splits[0] = 0;
+  for (int32_t i = 0; i != num_utt; ++i) {
+    const int32_t *this_row = p_sup + i * stride;
+    int32_t utt_index = this_row[0];
+    int32_t start_frame = this_row[1];
+    int32_t duration = this_row[2];
+
+    K2_CHECK_GE(utt_index, 0);
+    K2_CHECK_LT(utt_index, N);
+
+    K2_CHECK_GE(start_frame, 0);
+    K2_CHECK_LT(start_frame, T);
+
+    K2_CHECK_GE(duration, 0);
+    K2_CHECK_LE(start_frame + duration, T + allow_truncate);
+
+    int32_t end_frame = std::min(start_frame + duration, T);  // exclusive
+    duration = end_frame - start_frame;
+
+    row_offsets[i] = utt_index * T + start_frame;
+    // plus one for the extra frame
+    row_splits[i + 1] = row_splits[i] + duration + 1;
+  }
+
+  if (log_probs.stride(2) != 1) log_probs = log_probs.contiguous();
+  // This is a view of log_probs unless its rows are not evenly spaced.
+  torch::Tensor padded_scores = log_probs.reshape({-1, C});
+
+  ContextPtr ctx = ContextFromTensor(log_probs);
+  Array1<int32_t> row_splits_array(ctx, row_splits),
+      row_offsets_array(ctx, row_offsets);
+  RaggedShape shape =
+      RaggedShape2(&row_splits_array, nullptr, row_splits.back());
+  if (padded_scores.dtype() != torch::kFloat32) {
+    bool bf16 = padded_scores.dtype() == torch::kBFloat16;
+    return DenseFsaVec(
+        shape, Array2FromTorch<int16_t>(padded_scores.view(torch::kShort)),
+        row_offsets_array, bf16);
+  }
+  return DenseFsaVec(shape, Array2FromTorch<float>(padded_scores),
+                     row_offsets_array);
+}
+
 torch::Tensor GetSupervisionSegments(torch::IValue supervisions,
                                      int32_t subsampling_factor) {
   torch::Dict<torch::IValue, torch::IValue> dict = supervisions.toGenericDict();
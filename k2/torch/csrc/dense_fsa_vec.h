@@ -31,6 +31,10 @@ namespace k2 {
                      `T` the maximum input length, and `C` the number of
                      output classes. This is usually the output of the
                      log-softmax layer of a neural network.
+                     It may also be of dtype torch.float16 or
+                     torch.bfloat16, in which case the scores of the
+                     returned object are stored in 16 bits (see
+                     DenseFsaVec::half_scores).
 
   @param supervision_segments  A 2-D tensor of dtype torch.int32 with 3 columns.
             It has be to on CPU.
@@ -68,6 +72,25 @@ DenseFsaVec CreateDenseFsaVec(torch::Tensor log_probs,
                               torch::Tensor supervision_segments,
                               int32_t allow_truncate = 0);
 
+/** Like CreateDenseFsaVec(), but returns a DenseFsaVec in the padded form
+  (see DenseFsaVec::padded_scores), which reads the scores from `log_probs`
+  instead of copying them into a new (sum(duration)+num_segments, C+1)
+  matrix; the column for the final symbol and the extra frame of each
+  segment are synthesized when they are read.
+
+  As with CreateDenseFsaVec(), `log_probs` may be of dtype torch.float16 or
+  torch.bfloat16, and is then read as such.
+
+  `log_probs` must not be modified while the returned object is in use.  It
+  is copied only if its last dim is not contiguous or its rows can't be
+  viewed as a 2-D tensor of shape (N*T, C).  The returned object can be used
+  by IntersectDensePruned() and IntersectDense(), but not if the derivatives
+  w.r.t. the scores are needed.
+ */
+DenseFsaVec CreatePaddedDenseFsaVec(torch::Tensor log_probs,
+                                    torch::Tensor supervision_segments,
+                                    int32_t allow_truncate = 0);
+
 // See
 // https://github.com/lhotse-speech/lhotse/blob/master/lhotse/dataset/speech_recognition.py#L32
 // for the format of "supervisions"
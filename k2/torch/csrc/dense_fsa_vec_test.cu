@@ -16,6 +16,7 @@
  * limitations under the License.
  */
 
+#include <cmath>
 #include <vector>
 
 #ifdef K2_WITH_CUDA
@@ -158,4 +159,87 @@ TEST(CreateDenseFsaVec, AllowTruncate_1) {
   }
 }
 
+TEST(CreatePaddedDenseFsaVec, CompareWithCreateDenseFsaVec) {
+  // clang-format off
+  std::vector<float> v = {
+    // utterance 0, 3 frames
+    -1, 2, 3, 4,
+    8,  9, 6, 5.5,
+    2,  3, 4, 5,
+    // utterance 1, 1 frame
+    -2, -1, 3, 4,
+    2,   3, 0, 8,
+    8,   9, 0, 9.8,
+  };
+
+  std::vector<int32_t> sup = {
+    // utterance 1
+    1, 2, 2,
+    // utterance 0
+    0, 0, 5,
+    // utterance 1
+    1, 0, 2,
+  };
+  // clang-format on
+  torch::Tensor log_probs = torch::from_blob(
+      v.data(), {2, 3, 4}, torch::device(torch::kCPU).dtype(torch::kFloat32));
+  torch::Tensor supervision_segments = torch::from_blob(
+      sup.data(), {3, 3}, torch::device(torch::kCPU).dtype(torch::kInt));
+
+  DenseFsaVec dense = CreateDenseFsaVec(log_probs, supervision_segments, 2);
+  DenseFsaVec padded =
+      CreatePaddedDenseFsaVec(log_probs, supervision_segments, 2);
+  EXPECT_TRUE(padded.IsPadded());
+  // no copy was made
+  EXPECT_EQ(padded.padded_scores.Data(), log_probs.data_ptr<float>());
+  EXPECT_TRUE(Equal(dense.shape, padded.shape));
+  EXPECT_EQ(dense.NumCols(), padded.NumCols());
+
+  int32_t num_rows = dense.shape.NumElements(), num_cols = dense.NumCols();
+  auto dense_acc = dense.scores.Accessor();
+  DenseFsaVecScores padded_acc = DenseFsaVecScoresAccessor(padded);
+  for (int32_t i = 0; i != num_rows; ++i)
+    for (int32_t j = 0; j != num_cols; ++j)
+      EXPECT_EQ(dense_acc(i, j), padded_acc(i, j));
+}
+
+TEST(CreateDenseFsaVec, HalfScores) {
+  // clang-format off
+  std::vector<float> v = {
+    -1, 2, 3, 4,
+    8,  9, 6, 5.5,
+    2,  3, 4, 5.1,
+  };
+  std::vector<int32_t> sup = {0, 1, 2};
+  // clang-format on
+  torch::Tensor log_probs = torch::from_blob(
+      v.data(), {1, 3, 4}, torch::device(torch::kCPU).dtype(torch::kFloat32));
+  torch::Tensor supervision_segments = torch::from_blob(
+      sup.data(), {1, 3}, torch::device(torch::kCPU).dtype(torch::kInt));
+  DenseFsaVec dense = CreateDenseFsaVec(log_probs, supervision_segments);
+  auto dense_acc = dense.scores.Accessor();
+  int32_t num_rows = dense.shape.NumElements(), num_cols = dense.NumCols();
+
+  for (auto dtype : {torch::kFloat16, torch::kBFloat16}) {
+    torch::Tensor half_log_probs = log_probs.to(dtype);
+    for (bool padded : {false, true}) {
+      DenseFsaVec half =
+          padded ? CreatePaddedDenseFsaVec(half_log_probs, supervision_segments)
+                 : CreateDenseFsaVec(half_log_probs, supervision_segments);
+      EXPECT_TRUE(half.IsHalf());
+      EXPECT_EQ(half.IsPadded(), padded);
+      EXPECT_EQ(half.bf16, dtype == torch::kBFloat16);
+      EXPECT_EQ(half.NumCols(), num_cols);
+      DenseFsaVecScores half_acc = DenseFsaVecScoresAccessor(half);
+      for (int32_t i = 0; i != num_rows; ++i)
+        for (int32_t j = 0; j != num_cols; ++j) {
+          if (std::isinf(dense_acc(i, j)))
+            EXPECT_EQ(dense_acc(i, j), half_acc(i, j));
+          else
+            EXPECT_NEAR(dense_acc(i, j), half_acc(i, j), 0.05);
+        }
+    }
+  }
+}
+
 }  // namespace k2
@@ -16,8 +16,12 @@
  * limitations under the License.
  */
 
+#include <sys/stat.h>
+
+#include <map>
 #include <memory>
 #include <mutex>  // NOLINT
+#include <string>
 #include <unordered_set>
 #include <utility>
 #include <vector>
@@ -27,6 +31,7 @@
 #include "k2/csrc/fsa.h"
 #include "k2/csrc/ragged.h"
 #include "k2/torch/csrc/deserialization.h"
+#include "k2/torch/csrc/native_fsa_io.h"
 #include "k2/torch/csrc/utils.h"
 #include "torch/csrc/jit/serialization/import_source.h"
 #if K2_TORCH_VERSION_MAJOR > 1 || \
@@ -415,6 +420,9 @@ torch::IValue Load(
 k2::FsaClass LoadFsa(
     const std::string &filename,
     torch::optional<torch::Device> map_location /*= torch::nullopt*/) {
+  if (IsNativeFsaFile(filename))
+    return LoadFsaNative(filename, map_location.value_or(torch::kCPU));
+
   auto ivalue = Load(filename, map_location);
   K2_CHECK(ivalue.isGenericDict())
       << "Expect a dict. Given: " << ivalue.tagKind();
@@ -452,4 +460,76 @@ k2::FsaClass LoadFsa(
   return ans;
 }
 
+namespace {
+
+struct CachedFsa {
+  // Modification time and size of the file when it was loaded.
+  int64_t mtime;
+  int64_t size;
+  std::shared_ptr<FsaClass> fsa;
+};
+
+// The key is (filename, device).
+using FsaCache = std::map<std::pair<std::string, std::string>, CachedFsa>;
+
+std::mutex g_fsa_cache_mutex;
+FsaCache g_fsa_cache;
+
+}  // namespace
+
+std::shared_ptr<FsaClass> LoadFsaCached(
+    const std::string &filename, torch::Device map_location /*= kCPU*/) {
+  struct stat st;
+  K2_CHECK_EQ(stat(filename.c_str(), &st), 0)
+      << "Failed to stat '" << filename << "'";
+  int64_t mtime = static_cast<int64_t>(st.st_mtime),
+          size = static_cast<int64_t>(st.st_size);
+
+  std::lock_guard<std::mutex> lock(g_fsa_cache_mutex);
+  CachedFsa &entry = g_fsa_cache[{filename, map_location.str()}];
+  if (!entry.fsa || entry.mtime != mtime || entry.size != size) {
+    // Reset first so the stale copy can be freed before loading the new one
+    // if nobody else holds it.
+    entry.fsa.reset();
+    try {
+      entry.fsa = std::make_shared<FsaClass>(LoadFsa(filename, map_location));
+      entry.fsa->PrepareForSharing();
+    } catch (...) {
+      g_fsa_cache.erase({filename, map_location.str()});
+      throw;
+    }
+    entry.mtime = mtime;
+    entry.size = size;
+  }
+  return entry.fsa;
+}
+
+int32_t EvictCachedFsa(const std::string &filename /*= ""*/) {
+  std::lock_guard<std::mutex> lock(g_fsa_cache_mutex);
+  int32_t num_removed = 0;
+  for (auto iter = g_fsa_cache.begin(); iter != g_fsa_cache.end();) {
+    if (filename.empty() || iter->first.first == filename) {
+      iter = g_fsa_cache.erase(iter);
+      ++num_removed;
+    } else {
+      ++iter;
+    }
+  }
+  return num_removed;
+}
+
+int32_t EvictUnusedCachedFsas() {
+  std::lock_guard<std::mutex> lock(g_fsa_cache_mutex);
+  int32_t num_removed = 0;
+  for (auto iter = g_fsa_cache.begin(); iter != g_fsa_cache.end();) {
+    if (iter->second.fsa.use_count() == 1) {
+      iter = g_fsa_cache.erase(iter);
+      ++num_removed;
+    } else {
+      ++iter;
+    }
+  }
+  return num_removed;
+}
+
 }  // namespace k2
@@ -19,6 +19,7 @@
 #ifndef K2_TORCH_CSRC_DESERIALIZATION_H_
 #define K2_TORCH_CSRC_DESERIALIZATION_H_
 
+#include <memory>
 #include <string>
 
 #include "k2/csrc/fsa.h"
@@ -53,6 +54,10 @@ torch::IValue Load(
 
   Note: `_use_new_zipfile_serialization` is True by default
 
+  It also accepts files in k2's native format, written by SaveFsaNative()
+  (see native_fsa_io.h), which load much faster.  For them, a `map_location`
+  of nullopt means CPU.
+
   @param filename Path to the filename produced in Python by `torch.save()`.
   @param map_location  It has the same meaning as the one in `torch.load()`.
                        The loaded FSA is moved to this device
@@ -63,6 +68,49 @@ k2::FsaClass LoadFsa(
     const std::string &filename,
     torch::optional<torch::Device> map_location = torch::nullopt);
 
+/**
+  Like LoadFsa(), but keeps the loaded FSA in a process-wide cache, keyed by
+  `filename`, the modification time and size of the file, and `map_location`.
+  Loading the same file again for the same device returns the same object
+  without reading the file or copying to the device, so several decoders can
+  share one copy of a large graph.  If the file has changed since it was
+  cached, it is loaded again and replaces the stale entry.
+
+  The cache keeps a reference to each FSA it holds; entries are only removed
+  by EvictCachedFsa() and EvictUnusedCachedFsas().  Evicting an FSA that is
+  still referenced by a caller does not free it; it is freed when the last
+  reference goes away.
+
+  Caution: The returned FSA is shared, so it must not be modified.  Files are
+  identified by `filename` as given, so different paths to the same file are
+  cached separately.  Concurrent calls are safe; they are serialized while a
+  file is being loaded.  The returned FSA has been prepared with
+  FsaClass::PrepareForSharing(), so it can be used by several threads at
+  once.
+
+  @param filename Path to the filename produced in Python by `torch.save()`.
+  @param map_location  The device on which to return the FSA.
+  @return Return the FSA contained in the filename.
+ */
+std::shared_ptr<k2::FsaClass> LoadFsaCached(
+    const std::string &filename, torch::Device map_location = torch::kCPU);
+
+/**
+  Remove the entries for `filename` (for all devices) from the cache used by
+  LoadFsaCached(); if `filename` is empty, remove all entries.
+
+  @return Return the number of entries removed.
+ */
+int32_t EvictCachedFsa(const std::string &filename = "");
+
+/**
+  Remove the entries of the cache used by LoadFsaCached() whose FSA is not
+  referenced outside the cache, i.e. that no decoder is using any more.
+
+  @return Return the number of entries removed.
+ */
+int32_t EvictUnusedCachedFsas();
+
 }  // namespace k2
 
 #endif  // K2_TORCH_CSRC_DESERIALIZATION_H_
@@ -200,6 +200,41 @@ static void TestLoadFsaMapToCpu(const std::string &dir_name) {
   assert(ret == 0);
 }
 
+static void TestLoadFsaCached(const std::string &dir_name) {
+  std::string filename = dir_name + "/d4_cached.pt";
+  {
+    std::ofstream os(filename, std::ofstream::binary);
+    os.write(reinterpret_cast<const char *>(kTestLoadData4),
+             sizeof(kTestLoadData4));
+  }
+  auto fsa = LoadFsaCached(filename, torch::kCPU);
+  EXPECT_EQ(DeviceFromContext(fsa->fsa.Context()),
+            torch::Device(torch::kCPU));
+  // The second load is served from the cache.
+  EXPECT_EQ(LoadFsaCached(filename, torch::kCPU), fsa);
+
+  // The entry is still in use, so it is kept.
+  EXPECT_EQ(EvictUnusedCachedFsas(), 0);
+  EXPECT_EQ(LoadFsaCached(filename, torch::kCPU), fsa);
+
+  std::weak_ptr<FsaClass> weak = fsa;
+  fsa.reset();
+  EXPECT_EQ(EvictUnusedCachedFsas(), 1);
+  EXPECT_TRUE(weak.expired());
+
+  fsa = LoadFsaCached(filename, torch::kCPU);
+  EXPECT_EQ(EvictCachedFsa(filename), 1);
+  EXPECT_EQ(EvictCachedFsa(filename), 0);
+  // Evicting doesn't free an FSA that is still in use.
+  EXPECT_TRUE(fsa->GetTensorAttr("attr").allclose(
+      torch::tensor({1.5}, torch::kFloat32)));
+  EXPECT_NE(LoadFsaCached(filename, torch::kCPU), fsa);
+  EXPECT_EQ(EvictCachedFsa(), 1);
+
+  int32_t ret = remove(filename.c_str());
+  assert(ret == 0);
+}
+
 TEST(Deserialization, Test) {
   char pattern[] = "/tmp/k2_test.XXXXXX";
 #ifndef _MSC_VER
@@ -213,6 +248,7 @@ TEST(Deserialization, Test) {
   TestDictOfTensorAndRaggedTensor(dir_name);
   TestDictOfTensorAndRaggedTensorMapToCpu(dir_name);
   TestLoadFsaMapToCpu(dir_name);
+  TestLoadFsaCached(dir_name);
 
 #ifdef K2_WITH_CUDA
   if (torch::cuda::is_available()) {
@@ -18,7 +18,9 @@
 
 #include <utility>
 
+#include "k2/csrc/log.h"
 #include "k2/torch/csrc/features.h"
+#include "k2/torch/csrc/wave_reader.h"
 #include "kaldifeat/csrc/feature-fbank.h"
 
 namespace k2 {
@@ -53,4 +55,112 @@ std::vector<torch::Tensor> ComputeFeatures(
   return ans;
 }
 
+FeatureLoader::FeatureLoader(const kaldifeat::FbankOptions &opts,
+                             float expected_sample_rate,
+                             int32_t num_threads /*= 0*/)
+    : fbank_(opts),
+      expected_sample_rate_(expected_sample_rate),
+      pool_(num_threads) {}
+
+FeatureLoader::~FeatureLoader() {
+  for (auto &f : pending_) {
+    if (f.valid()) f.wait();
+  }
+}
+
+void FeatureLoader::Submit(const std::vector<std::string> &filenames) {
+  pending_.emplace_back(std::async(
+      std::launch::async,
+      [this, filenames]() -> FeatureBatch { return Prepare(filenames); }));
+}
+
+FeatureBatch FeatureLoader::Next() {
+  K2_CHECK(!pending_.empty()) << "No batch has been submitted";
+  std::future<FeatureBatch> f = std::move(pending_.front());
+  pending_.pop_front();
+  return f.get();
+}
+
+FeatureBatch FeatureLoader::Prepare(
+    const std::vector<std::string> &filenames) {
+  // Grad mode is thread local
+  torch::NoGradGuard no_grad;
+
+  FeatureBatch ans;
+  ans.filenames = filenames;
+  std::vector<torch::Tensor> wave_data =
+      ReadWave(filenames, expected_sample_rate_, &pool_);
+
+  std::lock_guard<std::mutex> lock(fbank_mutex_);
+  const torch::Device &device = fbank_.GetOptions().device;
+  for (auto &w : wave_data) w = w.to(device);
+
+  ans.features = ComputeFeatures(fbank_, wave_data, &ans.num_frames);
+  return ans;
+}
+
+OnlineFbank::OnlineFbank(const kaldifeat::FbankOptions &opts,
+                         int32_t num_streams)
+    : fbank_(opts),
+      window_size_(opts.frame_opts.WindowSize()),
+      window_shift_(opts.frame_opts.WindowShift()),
+      streams_(num_streams) {
+  K2_CHECK(opts.frame_opts.snip_edges)
+      << "OnlineFbank needs frame_opts.snip_edges == true";
+  K2_CHECK_GT(num_streams, 0);
+  for (int32_t s = 0; s != num_streams; ++s) Reset(s);
+}
+
+void OnlineFbank::AcceptWaveform(int32_t s, torch::Tensor samples) {
+  K2_CHECK_EQ(samples.dim(), 1) << "Expect a 1-D tensor of samples";
+  Stream &stream = streams_[s];
+  stream.samples = torch::cat(
+      {stream.samples, samples.to(fbank_.GetOptions().device, torch::kFloat)});
+}
+
+std::vector<torch::Tensor> OnlineFbank::ComputeReadyFrames() {
+  torch::NoGradGuard no_grad;
+  const auto &frame_opts = fbank_.GetOptions().frame_opts;
+  int32_t num_streams = NumStreams();
+  std::vector<int64_t> num_new_frames(num_streams, 0);
+  std::vector<torch::Tensor> strided_vec;
+  for (int32_t s = 0; s != num_streams; ++s) {
+    Stream &stream = streams_[s];
+    int64_t num_samples = stream.samples.size(0);
+    if (num_samples < window_size_) continue;
+    int64_t n = 1 + (num_samples - window_size_) / window_shift_;
+    torch::Tensor samples =
+        stream.samples.slice(0, 0, (n - 1) * window_shift_ + window_size_);
+    strided_vec.push_back(kaldifeat::GetStrided(samples, frame_opts));
+    // Keep the samples from the start of the next frame on.
+    stream.samples = stream.samples.slice(0, n * window_shift_).clone();
+    stream.num_frames += n;
+    num_new_frames[s] = n;
+  }
+
+  std::vector<torch::Tensor> ans(num_streams);
+  torch::Tensor features;
+  if (!strided_vec.empty()) {
+    features = fbank_.ComputeFeatures(torch::cat(strided_vec, 0),
+                                      /*vtln_warp*/ 1.0f);
+  } else {
+    features = torch::empty(
+        {0, fbank_.Dim()},
+        torch::device(fbank_.GetOptions().device).dtype(torch::kFloat));
+  }
+  int64_t offset = 0;
+  for (int32_t s = 0; s != num_streams; ++s) {
+    ans[s] = features.slice(0, offset, offset + num_new_frames[s]);
+    offset += num_new_frames[s];
+  }
+  return ans;
+}
+
+void OnlineFbank::Reset(int32_t s) {
+  Stream &stream = streams_[s];
+  stream.samples = torch::empty(
+      {0}, torch::device(fbank_.GetOptions().device).dtype(torch::kFloat));
+  stream.num_frames = 0;
+}
+
 }  // namespace k2
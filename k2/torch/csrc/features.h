@@ -19,8 +19,14 @@
 #ifndef K2_TORCH_CSRC_FEATURES_H_
 #define K2_TORCH_CSRC_FEATURES_H_
 
+#include <deque>
+#include <future>  // NOLINT
+#include <memory>
+#include <mutex>  // NOLINT
+#include <string>
 #include <vector>
 
+#include "k2/csrc/thread_pool.h"
 #include "kaldifeat/csrc/feature-fbank.h"
 
 namespace k2 {
@@ -44,6 +50,159 @@ std::vector<torch::Tensor> ComputeFeatures(
     kaldifeat::Fbank &fbank, const std::vector<torch::Tensor> &wave_data,
     std::vector<int64_t> *num_frames = nullptr);
 
+/// The features of a batch of wave files, as returned by
+/// FeatureLoader::Next().
+struct FeatureBatch {
+  /// The wave files of this batch, in the order they were given to
+  /// FeatureLoader::Submit().
+  std::vector<std::string> filenames;
+
+  /// features[i] is a 2-D tensor containing the features of filenames[i],
+  /// on the device of the Fbank options given to FeatureLoader.
+  std::vector<torch::Tensor> features;
+
+  /// num_frames[i] == features[i].size(0)
+  std::vector<int64_t> num_frames;
+};
+
+/** Reads wave files and computes their fbank features in the background,
+    so that the preparation of the next batch overlaps with the processing
+    (e.g., neural network computation and decoding) of the current one.
+
+    The wave files of a batch are read in parallel by a thread pool; the
+    samples are then moved to the device of the Fbank options and the
+    features of the whole batch are computed with one call to
+    ComputeFeatures(), i.e., on the GPU if the Fbank options say so.
+
+    Usage:
+
+        FeatureLoader loader(fbank_opts, expected_sample_rate);
+        loader.Submit(batch0);
+        loader.Submit(batch1);
+        while (loader.NumPending() > 0) {
+          FeatureBatch batch = loader.Next();  // batch1 is read meanwhile
+          // Submit more batches here if there are any.
+          // Process `batch` here.
+        }
+ */
+class FeatureLoader {
+ public:
+  /**
+     @param opts  Options for the Fbank computer.
+     @param expected_sample_rate  Expected sample rate of the wave files.
+     @param num_threads  Number of threads used to read the wave files.
+                         If it is <= 0, `std::thread::hardware_concurrency()`
+                         is used.
+   */
+  FeatureLoader(const kaldifeat::FbankOptions &opts,
+                float expected_sample_rate, int32_t num_threads = 0);
+
+  // Waits for the batches that are still being prepared.
+  ~FeatureLoader();
+
+  /// Start preparing a batch of wave files in the background. Batches are
+  /// returned by Next() in the order they are submitted.
+  void Submit(const std::vector<std::string> &filenames);
+
+  /// Return the number of batches that have been submitted but not
+  /// yet returned by Next().
+  int32_t NumPending() const { return static_cast<int32_t>(pending_.size()); }
+
+  /// Block until the oldest pending batch is ready and return it. If reading
+  /// or feature computation failed, the exception is re-thrown here.
+  /// It is an error to call it if NumPending() is 0.
+  FeatureBatch Next();
+
+ private:
+  FeatureBatch Prepare(const std::vector<std::string> &filenames);
+
+  kaldifeat::Fbank fbank_;
+  float expected_sample_rate_;
+  ThreadPool pool_;
+
+  // Batches are prepared in their own threads, but they share fbank_,
+  // so the feature computation is serialized with this mutex.
+  std::mutex fbank_mutex_;
+
+  std::deque<std::future<FeatureBatch>> pending_;
+};
+
+/** Computes the fbank features of a number of audio streams incrementally,
+    for streaming recognition: audio is given to it as it arrives, and the
+    features of each frame are computed as soon as all of its samples are
+    available, instead of after the whole utterance.
+
+    The samples after the start of the first frame that has not been
+    computed yet are kept for each stream, so frames that overlap two
+    chunks of audio are handled correctly, and the features are the same
+    as ComputeFeatures() would compute for the whole utterance.  The ready
+    frames of all streams are computed with one call to the Fbank computer
+    (on the device of the Fbank options), so the cost per chunk does not
+    grow with the number of streams.
+
+    It requires `opts.frame_opts.snip_edges == true`, since otherwise the
+    first frame depends on samples that have not arrived yet.  The last
+    samples of a stream that do not fill a frame are discarded, as in
+    ComputeFeatures().
+
+    Usage:
+
+        OnlineFbank fbank(fbank_opts, num_streams);
+        while (...) {
+          // For each stream s with new samples:
+          fbank.AcceptWaveform(s, samples);
+          std::vector<torch::Tensor> frames = fbank.ComputeReadyFrames();
+          // frames[s] contains the new frames of stream s.
+        }
+
+    It is not thread-safe.
+ */
+class OnlineFbank {
+ public:
+  /**
+     @param opts  Options for the Fbank computer.
+     @param num_streams  The number of streams; they are numbered from 0.
+   */
+  OnlineFbank(const kaldifeat::FbankOptions &opts, int32_t num_streams);
+
+  int32_t NumStreams() const { return static_cast<int32_t>(streams_.size()); }
+
+  /// Append a 1-D tensor of samples (with dtype torch.float32, in the
+  /// range [-1, 1)) to stream `s`.
+  void AcceptWaveform(int32_t s, torch::Tensor samples);
+
+  /** Compute the features of the frames of all streams whose samples are
+      all available and that have not been computed before.
+
+      @return Return a vector of size NumStreams(), whose s'th element
+              contains the features of the new frames of stream s, with
+              shape (num_new_frames, num_bins); num_new_frames may be 0.
+   */
+  std::vector<torch::Tensor> ComputeReadyFrames();
+
+  /// Return the number of frames of stream `s` that have been returned
+  /// by ComputeReadyFrames() since it was created or reset.
+  int64_t NumFramesComputed(int32_t s) const {
+    return streams_[s].num_frames;
+  }
+
+  /// Discard the state of stream `s`, so that it can be reused for another
+  /// utterance.
+  void Reset(int32_t s);
+
+ private:
+  struct Stream {
+    // The samples from the start of frame `num_frames` on.
+    torch::Tensor samples;
+    int64_t num_frames = 0;
+  };
+
+  kaldifeat::Fbank fbank_;
+  int64_t window_size_;   // number of samples per frame
+  int64_t window_shift_;  // number of samples between frames
+  std::vector<Stream> streams_;
+};
+
 }  // namespace k2
 
 #endif  // K2_TORCH_CSRC_FEATURES_H_
@@ -59,21 +59,16 @@ FsaClass IntersectDensePruned(FsaClass &graph, DenseFsaVec &dense,
   return dest;
 }
 
-FsaClass ShortestPath(FsaClass &lattice) {
-  Ragged<int32_t> state_batches = GetStateBatches(lattice.fsa, true);
-  Array1<int32_t> dest_states = GetDestStates(lattice.fsa, true);
-  Ragged<int32_t> incoming_arcs = GetIncomingArcs(lattice.fsa, dest_states);
-  Ragged<int32_t> entering_arc_batches =
-      GetEnteringArcIndexBatches(lattice.fsa, incoming_arcs, state_batches);
-
+Ragged<int32_t> ShortestPathArcIndexes(FsaClass &lattice) {
   bool log_semiring = false;
   Array1<int32_t> entering_arcs;
-  GetForwardScores<float>(lattice.fsa, state_batches, entering_arc_batches,
-                          log_semiring, &entering_arcs);
+  lattice.GetForwardScores<float>(log_semiring, &entering_arcs);
 
-  Ragged<int32_t> best_path_arc_indexes =
-      ShortestPath(lattice.fsa, entering_arcs);
+  return ShortestPath(lattice.fsa, entering_arcs);
+}
 
+FsaClass ShortestPath(FsaClass &lattice) {
+  Ragged<int32_t> best_path_arc_indexes = ShortestPathArcIndexes(lattice);
   FsaVec out = FsaVecFromArcIndexes(lattice.fsa, best_path_arc_indexes);
   torch::Tensor arc_map = Array1ToTorch(best_path_arc_indexes.values);
   return FsaClass::FromUnaryFunctionTensor(lattice, out, arc_map);
@@ -117,10 +112,14 @@ void Invert(FsaClass *lattice) {
 }
 
 void ArcSort(FsaClass *lattice) {
+  // Sorting would be the identity.
+  if (lattice->HasCachedProperties(kFsaPropertiesArcSorted)) return;
   Fsa dest;
   Array1<int32_t> arc_map;
   ArcSort(lattice->fsa, &dest, &arc_map);
-  lattice->properties = 0;
+  // Reordering the arcs leaving each state does not change the other
+  // properties.
+  if (lattice->properties != 0) lattice->properties |= kFsaPropertiesArcSorted;
   lattice->fsa = dest;
   lattice->CopyAttrs(*lattice, Array1ToTorch(arc_map));
 }
@@ -135,6 +134,7 @@ void Connect(FsaClass *lattice) {
 }
 
 void TopSort(FsaClass *lattice) {
+  if (lattice->HasCachedProperties(kFsaPropertiesTopSorted)) return;
   Fsa dest;
   Array1<int32_t> arc_map;
   TopSort(lattice->fsa, &dest, &arc_map);
@@ -143,74 +143,46 @@ void TopSort(FsaClass *lattice) {
   lattice->CopyAttrs(*lattice, Array1ToTorch(arc_map));
 }
 
-Nbest RandomPaths(FsaClass &lattice, int32_t num_paths) {
+Nbest RandomPaths(FsaClass &lattice, int32_t num_paths,
+                  int32_t max_num_paths /*= 0*/) {
   auto &fsas = lattice.fsa;
-  Ragged<int32_t> state_batches = GetStateBatches(fsas, /*transpose*/ true);
-  Array1<int32_t> dest_states = GetDestStates(fsas, /*as_idx01*/ true);
-
-  Ragged<int32_t> incoming_arcs = GetIncomingArcs(fsas, dest_states);
-
-  Ragged<int32_t> entering_arc_batches =
-      GetEnteringArcIndexBatches(fsas, incoming_arcs, state_batches);
-
-  Ragged<int32_t> leaving_arc_batches =
-      GetLeavingArcIndexBatches(fsas, state_batches);
+  FsaVecTopology &topology = lattice.GetTopology();
   bool log_semiring = true;
 
   using FloatType = float;
-  Array1<FloatType> forward_scores = GetForwardScores<FloatType>(
-      fsas, state_batches, entering_arc_batches, log_semiring, nullptr);
-
-  Array1<FloatType> backward_scores = GetBackwardScores<FloatType>(
-      fsas, state_batches, leaving_arc_batches, log_semiring);
-
-  Array1<FloatType> arc_post =
-      GetArcPost(fsas, forward_scores, backward_scores);
+  Array1<FloatType> forward_scores =
+                        lattice.GetForwardScores<FloatType>(log_semiring),
+                    arc_post = lattice.GetArcPost<FloatType>(log_semiring);
 
   Array1<FloatType> arc_cdf = GetArcCdf(fsas, arc_post);
 
   Array1<FloatType> tot_scores = GetTotScores(fsas, forward_scores);
 
-  // paths has three axes [utt][path][arc_pos]
-  Ragged<int32_t> paths =
-      RandomPaths(fsas, arc_cdf, num_paths, tot_scores, state_batches);
-
+  // aux_labels has two axes [arc][word_id]
   bool has_ragged_aux_labels = true;
-
-  // word_seqs has three axes [utt][path[word_id]
-  Ragged<int32_t> word_seqs;
+  Ragged<int32_t> aux_labels;
   if (lattice.HasTensorAttr("aux_labels")) {
     has_ragged_aux_labels = false;
-    // Index a tensor with a ragged index
-    // see Index() in k2/csrc/ragged_ops.h
-    auto &aux_labels = lattice.GetTensorAttr("aux_labels");
-    Array1<int32_t> aux_labels_array = Array1FromTorch<int32_t>(aux_labels);
-    word_seqs = Index(aux_labels_array, paths);
+    auto &aux_labels_tensor = lattice.GetTensorAttr("aux_labels");
+    Array1<int32_t> aux_labels_array =
+        Array1FromTorch<int32_t>(aux_labels_tensor);
+    ContextPtr c = aux_labels_array.Context();
+    aux_labels = Ragged<int32_t>(
+        RegularRaggedShape(c, aux_labels_array.Dim(), 1), aux_labels_array);
   } else {
     K2_CHECK(lattice.HasRaggedTensorAttr("aux_labels"));
-    auto &aux_labels = lattice.GetRaggedTensorAttr("aux_labels");
-    // Index a ragged tensor with a ragged index
-    // see Index() in k2/csrc/ragged_ops.h
-    bool remove_axis = true;
-    word_seqs = Index(aux_labels, paths, remove_axis);
+    aux_labels = lattice.GetRaggedTensorAttr("aux_labels");
   }
 
-  word_seqs = RemoveValuesLeq(word_seqs, 0);
-
   // Each utterance has `num_paths` paths but some of them transduces
-  // to the same word sequence, so we need to remove repeated word
+  // to the same word sequence, so SampleUniquePaths() removes repeated word
   // sequences within an utterance. After removing repeats, each utterance
   // contains different number of paths
   //
-  // `new2old` maps from the output path index to the input path index.
-  Array1<int32_t> new2old_indexes;
-  (void)UniqueSequences(word_seqs, nullptr, &new2old_indexes);
-
-  // Index a ragged tensor with a tensor
-  // See Index() in k2/csrc/ragged_ops.h
-  //
   // kept_paths has axes [utt][path][arc_pos]
-  Ragged<int32_t> kept_paths = Index(paths, /*axis*/ 1, new2old_indexes);
+  Ragged<int32_t> kept_paths =
+      SampleUniquePaths(fsas, arc_cdf, tot_scores, topology.StateBatches(),
+                        aux_labels, num_paths, max_num_paths);
 
   // utt_to_path_shape has axes [utt][path]
   RaggedShape utt_to_path_shape = GetLayer(kept_paths.shape, 0);
@@ -234,18 +206,15 @@ Nbest RandomPaths(FsaClass &lattice, int32_t num_paths) {
   Fsa dest = LinearFsas(labels);
   FsaClass ans_lattice(dest);
   if (has_ragged_aux_labels) {
-    auto &aux_labels = lattice.GetRaggedTensorAttr("aux_labels");
     // Index a ragged tensor with a tensor
     // See Index() in k2/csrc/ragged_ops.h
     Ragged<int32_t> ans_aux_labels =
         Index(aux_labels, /*axis*/ 0, kept_paths.values);
     ans_lattice.SetRaggedTensorAttr("aux_labels", ans_aux_labels);
   } else {
-    auto &aux_labels = lattice.GetTensorAttr("aux_labels");
-    Array1<int32_t> aux_labels_array = Array1FromTorch<int32_t>(aux_labels);
     // Index a tensor with a tensor index
     // See Index() in k2/csrc/array_ops.h
-    Array1<int32_t> ans_aux_labels = Index(aux_labels_array, kept_paths.values,
+    Array1<int32_t> ans_aux_labels = Index(aux_labels.values, kept_paths.values,
                                            false,  // allow_minus_one
                                            0);     // default value
     ans_lattice.SetTensorAttr("aux_labels", Array1ToTorch(ans_aux_labels));
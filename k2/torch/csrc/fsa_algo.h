@@ -105,6 +105,16 @@ FsaClass IntersectDensePruned(FsaClass &graphs, DenseFsaVec &dense,
  */
 FsaClass ShortestPath(FsaClass &lattice);
 
+/* Return the arcs on the shortest path of each FSA in `lattice`, i.e., the
+   arc_map of the FsaClass returned by ShortestPath(), without building the
+   paths or propagating any attributes.
+
+   @param lattice The input FsaClass.
+   @return A ragged array with axes [fsa][arc] containing the idx012 of the
+           arcs on the best path of each FSA, in order.
+ */
+Ragged<int32_t> ShortestPathArcIndexes(FsaClass &lattice);
+
 
 /*
   Return array of total scores (one per FSA)
@@ -116,6 +126,8 @@ FsaClass ShortestPath(FsaClass &lattice);
                 which will contain the scores in the final-states of
                 `forward_scores`, or -infinity for FSAs that had no
                 states.
+
+  The forward scores are cached in `fsa`; see FsaClass::GetForwardScores().
 */
 template <typename FloatType>
 Array1<FloatType> GetTotScores(FsaClass &fsa, bool log_semiring = true);
@@ -130,7 +142,9 @@ Array1<FloatType> GetTotScores(FsaClass &fsa, bool log_semiring = true);
  */
 void Invert(FsaClass *lattice);
 
-/** Arc sort an FSA in place.
+/** Arc sort an FSA in place.  It does nothing if the cached properties of
+    `lattice` say it is already arc-sorted; see
+    FsaClass::HasCachedProperties().
 
   @param lattice The input/output lattice.
  */
@@ -142,7 +156,8 @@ void ArcSort(FsaClass *lattice);
  */
 void Connect(FsaClass *lattice);
 
-/** TopSort an FSA in place.
+/** TopSort an FSA in place.  It does nothing if the cached properties of
+    `lattice` say it is already top-sorted.
 
   @param lattice The input/output lattice.
  */
@@ -151,10 +166,16 @@ void TopSort(FsaClass *lattice);
 /** Sample num_paths from the given lattice.
     @param lattice The input lattice to be sampled from.
     @param num_paths  Number of paths to sample
+    @param max_num_paths  If greater than num_paths, keep sampling more
+                          paths (up to max_num_paths) from utterances that
+                          have fewer than num_paths unique paths; see
+                          SampleUniquePaths() in k2/csrc/fsa_utils.h.
 
-    @return Return a nbest object containing the sampled paths.
+    @return Return a nbest object containing the sampled paths, with
+            duplicated paths being removed.
  */
-Nbest RandomPaths(FsaClass &lattice, int32_t num_paths);
+Nbest RandomPaths(FsaClass &lattice, int32_t num_paths,
+                  int32_t max_num_paths = 0);
 
 /// Wrapper for k2::IntersectDevice() in k2/csrc/fsa_algo.h
 /// to support attribute propagation.
@@ -31,14 +31,8 @@ namespace k2 {
 
 template <typename FloatType>
 Array1<FloatType> GetTotScores(FsaClass &fsa, bool log_semiring /* = true*/) {
-  Ragged<int32_t> state_batches = GetStateBatches(fsa.fsa, true);
-  Array1<int32_t> dest_states = GetDestStates(fsa.fsa, true);
-  Ragged<int32_t> incoming_arcs = GetIncomingArcs(fsa.fsa, dest_states);
-  Ragged<int32_t> entering_arc_batches =
-      GetEnteringArcIndexBatches(fsa.fsa, incoming_arcs, state_batches);
-
-  auto forward_scores = GetForwardScores<FloatType>(
-      fsa.fsa, state_batches, entering_arc_batches, log_semiring, nullptr);
+  Array1<FloatType> forward_scores =
+      fsa.GetForwardScores<FloatType>(log_semiring);
   return GetTotScores<FloatType>(fsa.fsa, forward_scores);
 }
 
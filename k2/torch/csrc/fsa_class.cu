@@ -20,8 +20,12 @@
  * limitations under the License.
  */
 
+#include <algorithm>
 #include <exception>
+#include <map>
+#include <memory>
 #include <string>
+#include <type_traits>
 #include <vector>
 
 #include "k2/csrc/device_guard.h"
@@ -42,23 +46,104 @@ FsaClass FsaClass::FromUnaryFunctionTensor(FsaClass &src, const FsaOrVec &arcs,
 }
 
 void FsaClass::CopyAttrs(FsaClass &src, torch::Tensor arc_map) {
-  CopyTensorAttrs(src, arc_map);
-  CopyRaggedTensorAttrs(src, arc_map);
+  // Rather than indexing the attributes of `src` now, we record them along
+  // with `arc_map`, composing `arc_map` with the arc_maps of any attributes
+  // of `src` that are still pending; see MaterializeAttrs().
+  std::vector<PendingAttrs> new_pending;
+  new_pending.reserve(src.pending_attrs_.size() + 1);
+  for (const auto &pending : src.pending_attrs_) {
+    PendingAttrs p = pending;
+    p.arc_map = IndexSelect<int32_t>(pending.arc_map, arc_map, -1);
+    new_pending.push_back(std::move(p));
+  }
+  if (!src.tensor_attrs.empty() || !src.ragged_tensor_attrs.empty()) {
+    PendingAttrs p;
+    p.tensor_attrs = src.tensor_attrs;
+    p.ragged_tensor_attrs = src.ragged_tensor_attrs;
+    p.arc_map = arc_map;
+    new_pending.push_back(std::move(p));
+  }
+  // The attributes of `src` replace ours with the same names (`src` may be
+  // this object, in which case all of ours are replaced).
+  for (const auto &p : new_pending) {
+    for (const auto &iter : p.tensor_attrs) {
+      ErasePendingAttr(iter.first);
+      tensor_attrs.erase(iter.first);
+    }
+    for (const auto &iter : p.ragged_tensor_attrs) {
+      ErasePendingAttr(iter.first);
+      ragged_tensor_attrs.erase(iter.first);
+    }
+  }
+  for (auto &p : new_pending) pending_attrs_.push_back(std::move(p));
 }
 
 void FsaClass::CopyAttrs(std::vector<FsaClass> &srcs,
                          Ragged<int32_t> &arc_map) {
   K2_CHECK_EQ(fsa.NumAxes(), 3);
+  for (const auto &src : srcs) src.MaterializeAttrs();
   CopyTensorAttrs(srcs, arc_map);
   CopyRaggedTensorAttrs(srcs, arc_map);
 }
 
-void FsaClass::CopyTensorAttrs(FsaClass &src, torch::Tensor arc_map) {
-  for (const auto &iter : src.tensor_attrs) {
-    Dtype dtype = ConvertDtype(iter.second.scalar_type());
+void FsaClass::MaterializeAttrs() const {
+  if (pending_attrs_.empty()) return;
+  std::vector<PendingAttrs> pending_attrs;
+  pending_attrs.swap(pending_attrs_);
+  for (const auto &pending : pending_attrs) {
+    CopyTensorAttrs(pending.tensor_attrs, pending.arc_map);
+    CopyRaggedTensorAttrs(pending.ragged_tensor_attrs, pending.arc_map);
+  }
+}
+
+void FsaClass::ErasePendingAttr(const std::string &name) {
+  for (auto &pending : pending_attrs_) {
+    pending.tensor_attrs.erase(name);
+    pending.ragged_tensor_attrs.erase(name);
+  }
+  pending_attrs_.erase(
+      std::remove_if(pending_attrs_.begin(), pending_attrs_.end(),
+                     [](const PendingAttrs &pending) {
+                       return pending.tensor_attrs.empty() &&
+                              pending.ragged_tensor_attrs.empty();
+                     }),
+      pending_attrs_.end());
+}
+
+void FsaClass::CopyTensorAttrs(
+    const std::unordered_map<std::string, torch::Tensor> &src_attrs,
+    torch::Tensor arc_map) const {
+  // Attributes of the same dtype are indexed together, with one kernel; see
+  // IndexMany().
+  std::map<torch::ScalarType, std::vector<std::string>> names_per_dtype;
+  for (const auto &iter : src_attrs)
+    names_per_dtype[iter.second.scalar_type()].push_back(iter.first);
+
+  for (const auto &iter : names_per_dtype) {
+    const std::vector<std::string> &names = iter.second;
+    int32_t num_attrs = static_cast<int32_t>(names.size());
+    Dtype dtype = ConvertDtype(iter.first);
     FOR_REAL_AND_INT32_TYPES(dtype, T, {
-      auto value = IndexSelect<T>(iter.second, arc_map, 0);
-      SetTensorAttr(iter.first, value);
+      if (num_attrs == 1 || arc_map.numel() == 0) {
+        for (const auto &name : names)
+          tensor_attrs[name] = IndexSelect<T>(src_attrs.at(name), arc_map, 0);
+      } else {
+        Array1<int32_t> indexes = Array1FromTorch<int32_t>(arc_map);
+        std::vector<Array1<T>> srcs;
+        std::vector<const Array1<T> *> src_ptrs;
+        srcs.reserve(num_attrs);
+        for (const auto &name : names) {
+          srcs.push_back(Array1FromTorch<T>(src_attrs.at(name).contiguous()));
+          src_ptrs.push_back(&srcs.back());
+        }
+        std::vector<T> default_values(num_attrs, 0);
+        Array2<T> values = IndexMany(num_attrs, src_ptrs.data(), indexes,
+                                     default_values.data());
+        for (int32_t j = 0; j < num_attrs; ++j) {
+          Array1<T> row = values.Row(j);
+          tensor_attrs[names[j]] = Array1ToTorch(row);
+        }
+      }
     });
   }
 }
@@ -101,11 +186,14 @@ void FsaClass::CopyTensorAttrs(std::vector<FsaClass> &srcs,
   }
 }
 
-void FsaClass::CopyRaggedTensorAttrs(FsaClass &src, torch::Tensor arc_map) {
+void FsaClass::CopyRaggedTensorAttrs(
+    const std::unordered_map<std::string, Ragged<int32_t>> &src_attrs,
+    torch::Tensor arc_map) const {
   Array1<int32_t> indexes_array = Array1FromTorch<int32_t>(arc_map);
-  for (auto &iter : src.ragged_tensor_attrs) {
-    auto value = Index<int32_t>(iter.second, 0, indexes_array, nullptr);
-    SetRaggedTensorAttr(iter.first, value);
+  for (const auto &iter : src_attrs) {
+    Ragged<int32_t> attr = iter.second;
+    ragged_tensor_attrs[iter.first] =
+        Index<int32_t>(attr, 0, indexes_array, nullptr);
   }
 }
 
@@ -145,6 +233,94 @@ void FsaClass::SetScores(torch::Tensor scores) {
   K2_CHECK_EQ(scores.scalar_type(), torch::kFloat32);
   K2_CHECK(ContextFromTensor(scores)->IsCompatible(*fsa.Context()));
   Scores().copy_(scores);
+  InvalidateCache();
+}
+
+void FsaClass::CheckCache() {
+  if (cached_fsa_.NumAxes() == 3 && fsa.NumAxes() == 3 &&
+      cached_fsa_.values.Data() == fsa.values.Data() &&
+      cached_fsa_.NumElements() == fsa.NumElements() &&
+      cached_fsa_.RowSplits(1).Data() == fsa.RowSplits(1).Data() &&
+      cached_fsa_.RowSplits(2).Data() == fsa.RowSplits(2).Data())
+    return;
+  InvalidateCache(false);
+  cached_fsa_ = fsa;
+}
+
+FsaVecTopology &FsaClass::GetTopology() {
+  CheckCache();
+  if (topology_ == nullptr) topology_ = std::make_shared<FsaVecTopology>(fsa);
+  return *topology_;
+}
+
+template <typename FloatType>
+Array1<FloatType> FsaClass::GetForwardScores(
+    bool log_semiring, Array1<int32_t> *entering_arcs /*= nullptr*/) {
+  K2_CHECK(entering_arcs == nullptr || !log_semiring);
+  CheckCache();
+  std::string name = std::string("forward_scores_") +
+                     (std::is_same<FloatType, double>::value ? "double_"
+                                                             : "float_") +
+                     (log_semiring ? "log" : "tropical");
+  auto iter = scores_cache_.find(name);
+  if (iter == scores_cache_.end()) {
+    Array1<FloatType> forward_scores;
+    Array1<int32_t> this_entering_arcs;
+    Array1<int32_t> *entering_arcs_ptr =
+        log_semiring ? nullptr : &this_entering_arcs;
+    // For a batch of tiny FSAs, computing the state batches would cost more
+    // than the scores themselves, so don't compute the topology just for
+    // this.
+    if (topology_ == nullptr && fsa.NumAxes() == 3 && IsSmallFsaVec(fsa)) {
+      forward_scores = GetForwardScoresOfSmallFsas<FloatType>(
+          fsa, log_semiring, entering_arcs_ptr);
+    } else {
+      GetTopology().GetScores<FloatType>(fsa, log_semiring, &forward_scores,
+                                         nullptr, nullptr, entering_arcs_ptr);
+    }
+    iter = scores_cache_.emplace(name, Array1ToTorch(forward_scores)).first;
+    if (!log_semiring)
+      scores_cache_["entering_arcs"] = Array1ToTorch(this_entering_arcs);
+  }
+  if (entering_arcs != nullptr)
+    *entering_arcs =
+        Array1FromTorch<int32_t>(scores_cache_.at("entering_arcs"));
+  return Array1FromTorch<FloatType>(iter->second);
+}
+
+template <typename FloatType>
+Array1<FloatType> FsaClass::GetArcPost(bool log_semiring) {
+  std::string suffix =
+      std::string(std::is_same<FloatType, double>::value ? "double_"
+                                                         : "float_") +
+      (log_semiring ? "log" : "tropical");
+  Array1<FloatType> forward_scores =
+      GetForwardScores<FloatType>(log_semiring);
+  auto iter = scores_cache_.find("arc_post_" + suffix);
+  if (iter == scores_cache_.end()) {
+    FsaVecTopology &topology = GetTopology();
+    Array1<FloatType> backward_scores = k2::GetBackwardScores<FloatType>(
+        fsa, topology.StateBatches(), topology.LeavingArcBatches(),
+        log_semiring);
+    Array1<FloatType> arc_post =
+        k2::GetArcPost(fsa, forward_scores, backward_scores);
+    scores_cache_["backward_scores_" + suffix] = Array1ToTorch(backward_scores);
+    iter = scores_cache_.emplace("arc_post_" + suffix, Array1ToTorch(arc_post))
+               .first;
+  }
+  return Array1FromTorch<FloatType>(iter->second);
+}
+
+template Array1<float> FsaClass::GetForwardScores<float>(
+    bool log_semiring, Array1<int32_t> *entering_arcs);
+template Array1<double> FsaClass::GetForwardScores<double>(
+    bool log_semiring, Array1<int32_t> *entering_arcs);
+template Array1<float> FsaClass::GetArcPost<float>(bool log_semiring);
+template Array1<double> FsaClass::GetArcPost<double>(bool log_semiring);
+
+void FsaClass::InvalidateCache(bool scores_only /*= true*/) {
+  scores_cache_.clear();
+  if (!scores_only) topology_ = nullptr;
 }
 
 torch::Tensor FsaClass::Scores() {
@@ -164,6 +340,12 @@ torch::Tensor FsaClass::Scores() {
   return tmp_scores.index({"...", -1});
 }
 
+void FsaClass::PrepareForSharing() {
+  MaterializeAttrs();
+  fsa.shape.Populate();
+  for (auto &p : ragged_tensor_attrs) p.second.shape.Populate();
+}
+
 int32_t FsaClass::Properties() {
   if (properties == 0) {
     if (fsa.NumAxes() == 2) {
@@ -23,6 +23,7 @@
 #ifndef K2_TORCH_CSRC_FSA_CLASS_H_
 #define K2_TORCH_CSRC_FSA_CLASS_H_
 
+#include <memory>
 #include <string>
 #include <unordered_map>
 #include <unordered_set>
@@ -30,6 +31,7 @@
 #include <vector>
 
 #include "k2/csrc/fsa.h"
+#include "k2/csrc/fsa_utils.h"
 #include "k2/csrc/ragged.h"
 #include "k2/torch/csrc/utils.h"
 #include "torch/script.h"
@@ -40,17 +42,25 @@ namespace k2 {
 struct FsaClass {
   // TODO(fangjun): Make it a class and set its data members to private
   FsaOrVec fsa;
+  /// The cached properties of `fsa` (see GetFsaBasicProperties()), or 0 if
+  /// they are not known.  Code that modifies `fsa` must reset it to 0, or
+  /// set it to the properties of the result if it knows them.
   int32_t properties = 0;
 
   // TODO(fangjun): Use two arrays to represent tensor_attrs
   // as there are usually only one or two attributes associated
   // with an FSA in decoding.
   //
-  /// It contains all tensor attributes of this FSA
-  std::unordered_map<std::string, torch::Tensor> tensor_attrs;
+  /// It contains the tensor attributes of this FSA, except those that are
+  /// still pending (see CopyAttrs()); call MaterializeAttrs() before
+  /// accessing it directly.  It is mutable as attributes are materialized
+  /// lazily, also from const accessors.
+  mutable std::unordered_map<std::string, torch::Tensor> tensor_attrs;
 
-  /// It contains all ragged tensor attributes of this FSA
-  std::unordered_map<std::string, Ragged<int32_t>> ragged_tensor_attrs;
+  /// It contains the ragged tensor attributes of this FSA, except those that
+  /// are still pending; see `tensor_attrs`.
+  mutable std::unordered_map<std::string, Ragged<int32_t>>
+      ragged_tensor_attrs;
 
   // The default constructor initializes an invalid FSA.
   FsaClass() = default;
@@ -68,9 +78,19 @@ struct FsaClass {
 
   /// Returns the number of attributes contained in this FSA
   int32_t NumAttrs() const {
-    return tensor_attrs.size() + ragged_tensor_attrs.size();
+    int32_t ans = tensor_attrs.size() + ragged_tensor_attrs.size();
+    for (const auto &pending : pending_attrs_)
+      ans += pending.tensor_attrs.size() + pending.ragged_tensor_attrs.size();
+    return ans;
   }
 
+  /** Propagate the attributes that are still pending, i.e. index them with
+      their arc_maps (see CopyAttrs()), and move them into `tensor_attrs`
+      and `ragged_tensor_attrs`.  The accessors of attributes call this, so
+      you only need to call it before accessing those members directly.
+   */
+  void MaterializeAttrs() const;
+
   /**
     Create an Fsa object, including propagating properties from the source FSA.
     This is intended to be called from unary functions on FSAs where the arc_map
@@ -91,7 +111,8 @@ struct FsaClass {
      */
   torch::Tensor Scores();
 
-  /** Set scores, will modify scores in fsa.arcs
+  /** Set scores, will modify scores in fsa.arcs.  It invalidates the cached
+     scores, see InvalidateCache().
 
      @param scores A 1-D tensor of dtype torch.float32.
    */
@@ -111,36 +132,104 @@ struct FsaClass {
   // Get fsa properties.
   int32_t Properties();
 
+  /// Return true if the cached `properties` are known to include all of
+  /// `props`.  Unlike Properties(), it never computes them (which needs a
+  /// pass over the arcs and a sync), so false means "no, or not known".
+  bool HasCachedProperties(int32_t props) const {
+    return properties != 0 && (properties & props) == props;
+  }
+
+  /** Return the state batches, entering arc batches etc. of `fsa` (see
+      FsaVecTopology), computing them when first used.  `fsa` must be an
+      FsaVec that is top-sorted and has no self-loops.
+
+      As for the Python class Fsa, this and the scores below are cached:
+      the cache is invalidated when `fsa` is replaced (e.g. by ArcSort() or
+      Connect() in k2/torch/csrc/fsa_algo.h; we compare its memory) or by
+      SetScores(), but if you modify the arcs in place otherwise, e.g. via
+      Scores(), you must call InvalidateCache().
+   */
+  FsaVecTopology &GetTopology();
+
+  /** Return the forward scores of `fsa` (see GetForwardScores() in
+      k2/csrc/fsa_utils.h), computing them when first used.  If
+      GetTopology() was not called yet and IsSmallFsaVec(fsa), they are
+      computed with GetForwardScoresOfSmallFsas() instead.
+
+      @param [in] log_semiring  If true, combine path scores with LogAdd;
+                  if false, with max.
+      @param [out] entering_arcs  If not nullptr, it is set to the best
+                  entering arc of each state; requires log_semiring ==
+                  false.
+   */
+  template <typename FloatType>
+  Array1<FloatType> GetForwardScores(bool log_semiring,
+                                     Array1<int32_t> *entering_arcs = nullptr);
+
+  /** Return the arc posteriors of `fsa` (see GetArcPost() in
+      k2/csrc/fsa_utils.h), computing them, and the backward scores they
+      need, when first used.
+   */
+  template <typename FloatType>
+  Array1<FloatType> GetArcPost(bool log_semiring);
+
+  /** Invalidate the cached structures derived from `fsa`, see GetTopology().
+
+      @param scores_only  If true, invalidate only those that depend on the
+                  scores (e.g. after modifying Scores() in place); if false,
+                  also those that depend only on the topology.
+   */
+  void InvalidateCache(bool scores_only = true);
+
+  /** Compute what is otherwise computed lazily when first used, i.e. the
+      row_ids of `fsa` and of the ragged attributes and the pending
+      attributes, so that using this object without modifying it (e.g. as
+      the decoding graph of IntersectDensePruned()) does not write to it.
+      After this call it can be used from several threads at once, as long
+      as none of them modifies it.
+   */
+  void PrepareForSharing();
+
   /// Return the given tensor attribute by its name
   const torch::Tensor &GetTensorAttr(const std::string &name) const {
+    MaterializeAttrs();
     return tensor_attrs.at(name);
   }
 
   /// Return the given tensor attribute by its name
   torch::Tensor &GetTensorAttr(const std::string &name) {
+    MaterializeAttrs();
     return tensor_attrs.at(name);
   }
 
   /// Return the given ragged tensor attribute by its name
   const Ragged<int32_t> &GetRaggedTensorAttr(const std::string &name) const {
+    MaterializeAttrs();
     return ragged_tensor_attrs.at(name);
   }
 
   /// Return the given ragged tensor attribute by its name
   Ragged<int32_t> &GetRaggedTensorAttr(const std::string &name) {
+    MaterializeAttrs();
     return ragged_tensor_attrs.at(name);
   }
 
   /// Return true if this FSA has a tensor attribute with such a name.
   /// Return false otherwise.
   bool HasTensorAttr(const std::string &name) const {
-    return tensor_attrs.count(name) > 0;
+    if (tensor_attrs.count(name) > 0) return true;
+    for (const auto &pending : pending_attrs_)
+      if (pending.tensor_attrs.count(name) > 0) return true;
+    return false;
   }
 
   /// Return true if this FSA has a ragged tensor attribute with such a name.
   /// Return false otherwise.
   bool HasRaggedTensorAttr(const std::string &name) const {
-    return ragged_tensor_attrs.count(name) > 0;
+    if (ragged_tensor_attrs.count(name) > 0) return true;
+    for (const auto &pending : pending_attrs_)
+      if (pending.ragged_tensor_attrs.count(name) > 0) return true;
+    return false;
   }
 
   /** Delete a tensor attribute by its name.
@@ -150,11 +239,11 @@ struct FsaClass {
     @param name The attribute name.
    */
   void DeleteTensorAttr(const std::string &name) {
-    auto it = tensor_attrs.find(name);
-    if (it == tensor_attrs.end()) {
+    if (!HasTensorAttr(name)) {
       K2_LOG(FATAL) << "No such tensor attribute: " << name;
     }
-    tensor_attrs.erase(it);
+    ErasePendingAttr(name);
+    tensor_attrs.erase(name);
   }
 
   /** Delete a ragged attribute by its name.
@@ -164,17 +253,24 @@ struct FsaClass {
       @param name The attribute name.
    */
   void DeleteRaggedTensorAttr(const std::string &name) {
-    auto it = ragged_tensor_attrs.find(name);
-    if (it == ragged_tensor_attrs.end()) {
+    if (!HasRaggedTensorAttr(name)) {
       K2_LOG(FATAL) << "No such ragged tensor attribute: " << name;
     }
-    ragged_tensor_attrs.erase(it);
+    ErasePendingAttr(name);
+    ragged_tensor_attrs.erase(name);
   }
 
   /** Propagate attributes from source FsaClass via tensor arc_map.
 
-    @param src  The source FsaClass.
+    This is done lazily: the attributes of `src` are only indexed when they
+    are first accessed (see MaterializeAttrs()).  If `src` has pending
+    attributes itself, their arc_maps are composed with `arc_map`, so a chain
+    like Connect() -> TopSort() -> ArcSort() indexes only an int32 arc_map
+    per step, and each attribute once at the end.
+
+    @param src  The source FsaClass.  May be this object.
     @param arc_map  The arc_map (as idx012) to select items in attributes.
+                    -1 is allowed, meaning the arc has no source arc.
    */
   void CopyAttrs(FsaClass &src, torch::Tensor arc_map);
 
@@ -210,6 +306,7 @@ struct FsaClass {
         << "'" << name
         << "': shape[0] of the tensor MUST be equal to number of arcs";
     K2_CHECK(ContextFromTensor(value)->IsCompatible(*fsa.Context()));
+    ErasePendingAttr(name);
     tensor_attrs[name] = value;
   }
 
@@ -224,17 +321,62 @@ struct FsaClass {
         << "'" << name
         << "': dim0 of the tensor MUST be equal to number of arcs";
     K2_CHECK(value.Context()->IsCompatible(*fsa.Context()));
+    ErasePendingAttr(name);
     ragged_tensor_attrs[name] = value;
   }
 
  private:
-  /** Propagate tensor attributes from source FsaClass via tensor arc_map.
-
-      @param src  The source FsaClass.
+  // Attributes of a source FSA that have not been propagated to this FSA
+  // yet; see CopyAttrs().
+  struct PendingAttrs {
+    std::unordered_map<std::string, torch::Tensor> tensor_attrs;
+    std::unordered_map<std::string, Ragged<int32_t>> ragged_tensor_attrs;
+    // Maps from arc-index in this FSA to arc-index in the attributes above,
+    // or -1.
+    torch::Tensor arc_map;
+  };
+
+  // Oldest first.  Each attribute name is in at most one of these, and
+  // not also in `tensor_attrs` or `ragged_tensor_attrs`.
+  mutable std::vector<PendingAttrs> pending_attrs_;
+
+  // Removes the attribute `name` from pending_attrs_, if it is there.
+  void ErasePendingAttr(const std::string &name);
+
+  // The cached GetTopology(), or nullptr.  It is shared by copies of this
+  // object, which share `fsa`.
+  std::shared_ptr<FsaVecTopology> topology_;
+
+  // The cached results that depend on the scores, with names like those of
+  // the Python class Fsa, e.g. "forward_scores_float_log" and
+  // "entering_arcs".
+  std::unordered_map<std::string, torch::Tensor> scores_cache_;
+
+  // `fsa` as it was when the caches above were filled.  Holding it keeps its
+  // memory alive, so comparing its memory with that of `fsa` tells us
+  // whether `fsa` was replaced since.
+  FsaVec cached_fsa_;
+
+  // Invalidates the caches if `fsa` was replaced since they were filled.
+  void CheckCache();
+
+  /** Propagate tensor attributes via tensor arc_map.
+
+      @param src_attrs  The tensor attributes to propagate.
       @param arc_map  The arc_map (as idx012) to select items in attributes.
      */
-  void CopyTensorAttrs(FsaClass &src, torch::Tensor arc_map);
+  void CopyTensorAttrs(
+      const std::unordered_map<std::string, torch::Tensor> &src_attrs,
+      torch::Tensor arc_map) const;
 
+  /** Propagate ragged tensor attributes via tensor arc_map.
+
+    @param src_attrs  The ragged tensor attributes to propagate.
+    @param arc_map  The arc_map (as idx012) to select items in attributes.
+   */
+  void CopyRaggedTensorAttrs(
+      const std::unordered_map<std::string, Ragged<int32_t>> &src_attrs,
+      torch::Tensor arc_map) const;
 
   /** Propagate tensor attributes from a list of source FsaClasses via ragged
       tensor arc_map.
@@ -245,14 +387,6 @@ struct FsaClass {
    */
   void CopyTensorAttrs(std::vector<FsaClass> &srcs, Ragged<int32_t> &arc_map);
 
-  /** Propagate ragged tensor attributes from source FsaClass via tensor
-    arc_map.
-
-    @param src  The source FsaClass.
-    @param arc_map  The arc_map (as idx012) to select items in attributes.
-   */
-  void CopyRaggedTensorAttrs(FsaClass &src, torch::Tensor arc_map);
-
   /** Propagate ragged tensor attributes from a list of source FsaClasses via
       ragged tensor arc_map.
       See docs in CopyAttrs that has same arguments for more details.
@@ -16,6 +16,7 @@
  * limitations under the License.
  */
 
+#include <cmath>
 #include <limits>
 #include <string>
 #include <vector>
@@ -24,6 +25,7 @@
 #include "k2/csrc/fsa_algo.h"
 #include "k2/csrc/fsa_utils.h"
 #include "k2/csrc/ragged_ops.h"
+#include "k2/torch/csrc/fsa_algo.h"
 #include "k2/torch/csrc/fsa_class.h"
 #include "k2/torch/csrc/utils.h"
 
@@ -127,4 +129,170 @@ TEST(FsaClassTest, Attributes) {
   }
 }
 
+
+TEST(FsaClassTest, LazyAttrs) {
+  for (const ContextPtr &c : {GetCpuContext(), GetCudaContext()}) {
+    auto device = DeviceFromContext(c);
+    std::string s = R"(0 1 2 10
+        0 1 1 20
+        1 2 -1 30
+        2)";
+    FsaClass fsa(FsaFromString(s).To(c));
+
+    auto float32_opts = torch::dtype(torch::kFloat32).device(device);
+    auto int32_opts = torch::dtype(torch::kInt32).device(device);
+    fsa.SetTensorAttr("float_attr",
+                      torch::tensor({0.1, 0.2, 0.3}, float32_opts));
+    fsa.SetTensorAttr("int_attr", torch::tensor({1, 2, 3}, int32_opts));
+    fsa.SetTensorAttr("int_attr2", torch::tensor({4, 5, 6}, int32_opts));
+    fsa.SetRaggedTensorAttr("ragged_attr",
+                            Ragged<int32_t>(c, "[[1 2 3] [5 6] []]"));
+
+    // Two steps on this object itself, as in ArcSort() etc.; the second
+    // arc_map has an arc with no source arc.
+    Fsa fsa2 = FsaFromString(R"(0 1 1 20
+        0 1 2 10
+        1 2 -1 30
+        2)").To(c);
+    fsa.fsa = fsa2;
+    fsa.CopyAttrs(fsa, torch::tensor({1, 0, 2}, int32_opts));
+    Fsa fsa3 = FsaFromString(R"(0 1 2 10
+        0 1 3 0
+        1 2 -1 30
+        2)").To(c);
+    fsa.fsa = fsa3;
+    fsa.CopyAttrs(fsa, torch::tensor({1, -1, 2}, int32_opts));
+    EXPECT_EQ(fsa.NumAttrs(), 4);
+    EXPECT_TRUE(fsa.HasTensorAttr("int_attr"));
+    EXPECT_TRUE(fsa.HasRaggedTensorAttr("ragged_attr"));
+
+    // Setting an attribute replaces the pending one.
+    fsa.SetTensorAttr("int_attr2", torch::tensor({7, 8, 9}, int32_opts));
+
+    EXPECT_TRUE(torch::allclose(fsa.GetTensorAttr("float_attr"),
+                                torch::tensor({0.1, 0.0, 0.3}, float32_opts)));
+    EXPECT_TRUE(torch::equal(fsa.GetTensorAttr("int_attr"),
+                             torch::tensor({1, 0, 3}, int32_opts)));
+    EXPECT_TRUE(torch::equal(fsa.GetTensorAttr("int_attr2"),
+                             torch::tensor({7, 8, 9}, int32_opts)));
+    EXPECT_TRUE(Equal(fsa.GetRaggedTensorAttr("ragged_attr"),
+                      Ragged<int32_t>(c, "[[1 2 3] [] []]")));
+    EXPECT_EQ(fsa.NumAttrs(), 4);
+  }
+}
+
+TEST(FsaClassTest, PrepareForSharing) {
+  for (const ContextPtr &c : {GetCpuContext(), GetCudaContext()}) {
+    auto device = DeviceFromContext(c);
+    std::string s = R"(0 1 2 10
+        0 1 1 20
+        1 2 -1 30
+        2)";
+    FsaClass src(FsaFromString(s).To(c));
+    auto int32_opts = torch::dtype(torch::kInt32).device(device);
+    src.SetTensorAttr("int_attr", torch::tensor({1, 2, 3}, int32_opts));
+
+    // A freshly created shape has no row_ids yet.
+    Array1<int32_t> row_splits = src.fsa.RowSplits(1);
+    FsaClass fsa(Fsa(RaggedShape2(&row_splits, nullptr, 3), src.fsa.values));
+    fsa.CopyAttrs(src, torch::tensor({2, 1, 0}, int32_opts));
+    EXPECT_EQ(fsa.fsa.shape.Layers()[0].row_ids.Dim(), 0);
+
+    fsa.PrepareForSharing();
+    EXPECT_EQ(fsa.fsa.shape.Layers()[0].row_ids.Dim(), 3);
+    EXPECT_EQ(fsa.tensor_attrs.size(), 1u);  // no longer pending
+    EXPECT_TRUE(torch::equal(fsa.GetTensorAttr("int_attr"),
+                             torch::tensor({3, 2, 1}, int32_opts)));
+  }
+}
+
+TEST(FsaClassTest, CachedProperties) {
+  for (const ContextPtr &c : {GetCpuContext(), GetCudaContext()}) {
+    std::string s = R"(0 1 2 10
+        0 1 1 20
+        1 2 -1 30
+        2)";
+    auto device = DeviceFromContext(c);
+    auto int32_opts = torch::dtype(torch::kInt32).device(device);
+    FsaClass fsa(FsaFromString(s).To(c));
+    EXPECT_FALSE(fsa.HasCachedProperties(kFsaPropertiesArcSorted));
+    EXPECT_TRUE(fsa.HasCachedProperties(kFsaPropertiesTopSorted));
+    fsa.SetTensorAttr("int_attr", torch::tensor({1, 2, 3}, int32_opts));
+
+    ArcSort(&fsa);
+    EXPECT_TRUE(fsa.HasCachedProperties(kFsaPropertiesArcSorted |
+                                        kFsaPropertiesTopSorted));
+    int32_t properties = fsa.properties;
+    fsa.properties = 0;
+    EXPECT_EQ(fsa.Properties(), properties);
+
+    // Now it is the identity, without any work.
+    const Arc *arcs_data = fsa.fsa.values.Data();
+    ArcSort(&fsa);
+    TopSort(&fsa);
+    EXPECT_EQ(fsa.fsa.values.Data(), arcs_data);
+    EXPECT_TRUE(torch::equal(fsa.GetTensorAttr("int_attr"),
+                             torch::tensor({2, 1, 3}, int32_opts)));
+
+    // Changing the labels invalidates the cached properties.
+    fsa.SetLabels(torch::tensor({5, 4, -1}, int32_opts));
+    EXPECT_FALSE(fsa.HasCachedProperties(kFsaPropertiesArcSorted));
+  }
+}
+
+TEST(FsaClassTest, Cache) {
+  for (const ContextPtr &c : {GetCpuContext(), GetCudaContext()}) {
+    std::string s = R"(0 1 1 1
+        0 1 2 2
+        1 2 -1 3
+        2)";
+    auto device = DeviceFromContext(c);
+    auto float32_opts = torch::dtype(torch::kFloat32).device(device);
+    Fsa fsa = FsaFromString(s).To(c);
+    FsaClass lattice(FsaToFsaVec(fsa));
+
+    FsaVecTopology *topology = &lattice.GetTopology();
+    EXPECT_EQ(&lattice.GetTopology(), topology);
+    Array1<float> tot_scores = GetTotScores<float>(lattice, false);
+    EXPECT_EQ(tot_scores[0], 5);
+    Array1<float> forward_scores = lattice.GetForwardScores<float>(false);
+    // It is cached, so no new memory.
+    EXPECT_EQ(lattice.GetForwardScores<float>(false).Data(),
+              forward_scores.Data());
+    Ragged<int32_t> best_path = ShortestPathArcIndexes(lattice);
+    EXPECT_TRUE(Equal(best_path, Ragged<int32_t>(c, "[ [ 1 2 ] ]")));
+
+    // Setting the scores invalidates only the scores.
+    lattice.SetScores(torch::tensor({4, 2, 3}, float32_opts));
+    EXPECT_EQ(&lattice.GetTopology(), topology);
+    EXPECT_EQ(GetTotScores<float>(lattice, false)[0], 7);
+    best_path = ShortestPathArcIndexes(lattice);
+    EXPECT_TRUE(Equal(best_path, Ragged<int32_t>(c, "[ [ 0 2 ] ]")));
+
+    // Modifying them in place needs InvalidateCache().
+    lattice.Scores().fill_(1);
+    lattice.InvalidateCache();
+    EXPECT_EQ(GetTotScores<float>(lattice, false)[0], 2);
+    // The two paths have the same score.
+    Array1<float> arc_post = lattice.GetArcPost<float>(true);
+    EXPECT_NEAR(arc_post[0], -std::log(2.0f), 1.0e-04);
+    EXPECT_NEAR(arc_post[2], 0, 1.0e-04);
+
+    // Replacing `fsa` invalidates the whole cache.
+    Connect(&lattice);
+    EXPECT_EQ(lattice.GetTopology().Fsas().values.Data(),
+              lattice.fsa.values.Data());
+    EXPECT_EQ(GetTotScores<float>(lattice, false)[0], 2);
+
+    // For small FSAs the scores are computed without the topology.
+    FsaClass small_lattice(FsaToFsaVec(FsaFromString(s).To(c)));
+    Array1<int32_t> entering_arcs;
+    EXPECT_EQ(small_lattice.GetForwardScores<float>(false, &entering_arcs)[2],
+              5);
+    EXPECT_EQ(entering_arcs[2], 2);
+    EXPECT_NEAR(GetTotScores<float>(small_lattice, true)[0],
+                3 + std::log(std::exp(1.0f) + std::exp(2.0f)), 1.0e-04);
+  }
+}
+
 }  // namespace k2
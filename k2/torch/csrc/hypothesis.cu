@@ -24,12 +24,25 @@
 namespace k2 {
 
 void Hypotheses::Add(Hypothesis hyp) {
-  auto key = hyp.Key();
-  auto it = hyps_dict_.find(key);
-  if (it == hyps_dict_.end()) {
-    hyps_dict_[key] = std::move(hyp);
-  } else {
-    it->second.log_prob = LogAdd<double>()(it->second.log_prob, hyp.log_prob);
+  auto range = hyps_dict_.equal_range(hyp.hash);
+  for (auto it = range.first; it != range.second; ++it) {
+    if (it->second.ys == hyp.ys) {
+      it->second.log_prob =
+          LogAdd<double>()(it->second.log_prob, hyp.log_prob);
+      return;
+    }
+  }
+  uint64_t hash = hyp.hash;
+  hyps_dict_.emplace(hash, std::move(hyp));
+}
+
+void Hypotheses::Remove(const Hypothesis &hyp) {
+  auto range = hyps_dict_.equal_range(hyp.hash);
+  for (auto it = range.first; it != range.second; ++it) {
+    if (it->second.ys == hyp.ys) {
+      hyps_dict_.erase(it);
+      return;
+    }
   }
 }
 
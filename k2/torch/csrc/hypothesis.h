@@ -19,6 +19,7 @@
 #ifndef K2_TORCH_CSRC_HYPOTHESIS_H_
 #define K2_TORCH_CSRC_HYPOTHESIS_H_
 
+#include <cstdint>
 #include <string>
 #include <unordered_map>
 #include <utility>
@@ -30,17 +31,39 @@ namespace k2 {
 
 struct Hypothesis {
   // The predicted tokens so far. Newly predicated tokens are appended.
+  //
+  // CAUTION: Use Append() to add tokens so that `hash` is kept up to date.
+  // If you modify it in any other way, call UpdateHash() afterwards.
   std::vector<int32_t> ys;
 
   // The total score of ys in log space.
   double log_prob = 0;
 
+  // A rolling hash of ys; see HashToken(). Two hypotheses with the same
+  // ys have the same hash.
+  uint64_t hash = kInitialHash;
+
   Hypothesis() = default;
   Hypothesis(const std::vector<int32_t> &ys, double log_prob)
-      : ys(ys), log_prob(log_prob) {}
+      : ys(ys), log_prob(log_prob) {
+    UpdateHash();
+  }
+
+  // Append a token to ys and update the hash in O(1) time.
+  void Append(int32_t token) {
+    ys.push_back(token);
+    hash = HashToken(hash, token);
+  }
+
+  // Recompute the hash from ys. It takes O(ys.size()) time.
+  void UpdateHash() {
+    hash = kInitialHash;
+    for (int32_t token : ys) hash = HashToken(hash, token);
+  }
 
   // If two Hypotheses have the same `Key`, then they contain
-  // the same token sequence.
+  // the same token sequence. It takes O(ys.size()) time and is not
+  // used by Hypotheses; it is kept for debugging.
   std::string Key() const { return torch::Join("-", ys); }
 
   // For debugging
@@ -49,6 +72,15 @@ struct Hypothesis {
     os << "(" << Key() << ", " << log_prob << ")";
     return os.str();
   }
+
+  static constexpr uint64_t kInitialHash = 14695981039346656037ULL;
+
+  // Return the hash of a token sequence after appending `token` to a
+  // sequence whose hash is `hash`. It is a polynomial rolling hash modulo
+  // 2^64.
+  static uint64_t HashToken(uint64_t hash, int32_t token) {
+    return hash * 1099511628211ULL + static_cast<uint32_t>(token) + 1;
+  }
 };
 
 class Hypotheses {
@@ -57,15 +89,21 @@ class Hypotheses {
 
   explicit Hypotheses(std::vector<Hypothesis> hyps) {
     for (auto &h : hyps) {
-      hyps_dict_[h.Key()] = std::move(h);
+      Add(std::move(h));
     }
   }
 
-  explicit Hypotheses(std::unordered_map<std::string, Hypothesis> hyps_dict)
-      : hyps_dict_(std::move(hyps_dict)) {}
+  explicit Hypotheses(std::unordered_map<std::string, Hypothesis> hyps_dict) {
+    for (auto &p : hyps_dict) {
+      Add(std::move(p.second));
+    }
+  }
 
   // Add hyp to this object. If it already exists, its log_prob
   // is updated with the given hyp using log-sum-exp.
+  //
+  // Hypotheses are looked up by their hash; the token sequences are compared
+  // only if the hashes are equal, so hash collisions are handled correctly.
   void Add(Hypothesis hyp);
 
   // Get the hyp that has the largest log_prob.
@@ -75,7 +113,7 @@ class Hypotheses {
 
   // Remove the given hyp from this object.
   // It is *NOT* an error if hyp does not exist in this object.
-  void Remove(const Hypothesis &hyp) { hyps_dict_.erase(hyp.Key()); }
+  void Remove(const Hypothesis &hyp);
 
   // Return a list of hyps contained in this object.
   std::vector<Hypothesis> Vec() const {
@@ -104,7 +142,9 @@ class Hypotheses {
   const auto end() const { return hyps_dict_.end(); }
 
  private:
-  using Map = std ::unordered_map<std::string, Hypothesis>;
+  // Maps Hypothesis::hash to hypotheses. Distinct token sequences with the
+  // same hash are stored as separate entries.
+  using Map = std::unordered_multimap<uint64_t, Hypothesis>;
   Map hyps_dict_;
 };
 
@@ -16,6 +16,9 @@
  * limitations under the License.
  */
 
+#include <cmath>
+#include <vector>
+
 #include "gtest/gtest.h"
 #include "k2/torch/csrc/hypothesis.h"
 
@@ -40,4 +43,36 @@ TEST(Hypotheses, ConstructorFromVector) {
   EXPECT_TRUE(hyp_vec.empty());
 }
 
+TEST(Hypothesis, Hash) {
+  Hypothesis hyp({1, 2}, 0);
+  hyp.Append(3);
+  EXPECT_EQ(hyp.hash, Hypothesis({1, 2, 3}, 0).hash);
+  EXPECT_NE(hyp.hash, Hypothesis({1, 3, 2}, 0).hash);
+  EXPECT_NE(hyp.hash, Hypothesis({1, 2}, 0).hash);
+
+  hyp.ys.pop_back();
+  hyp.UpdateHash();
+  EXPECT_EQ(hyp.hash, Hypothesis({1, 2}, 0).hash);
+}
+
+TEST(Hypotheses, Add) {
+  Hypotheses hyps;
+  hyps.Add(Hypothesis({1, 2}, -1));
+  hyps.Add(Hypothesis({1, 3}, -2));
+  hyps.Add(Hypothesis({1, 2}, -1));
+  EXPECT_EQ(hyps.Size(), 2);
+  EXPECT_NEAR(hyps.GetMostProbable(false).log_prob, -1 + std::log(2.0),
+              1e-6);
+
+  // Different token sequences with the same hash are kept apart.
+  Hypothesis collision({5}, -3);
+  collision.hash = Hypothesis({1, 2}, 0).hash;
+  hyps.Add(collision);
+  EXPECT_EQ(hyps.Size(), 3);
+
+  hyps.Remove(collision);
+  EXPECT_EQ(hyps.Size(), 2);
+  EXPECT_EQ(hyps.GetMostProbable(false).ys, (std::vector<int32_t>{1, 2}));
+}
+
 }  // namespace k2
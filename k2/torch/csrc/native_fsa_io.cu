@@ -0,0 +1,607 @@
+/**
+ * Copyright      2026  Xiaomi Corporation
+ *
+ * See LICENSE for clarification regarding multiple authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _MSC_VER
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "k2/csrc/device_guard.h"
+#include "k2/csrc/pinned_context.h"
+#include "k2/csrc/ragged_ops.h"
+#include "k2/torch/csrc/native_fsa_io.h"
+#include "k2/torch/csrc/utils.h"
+
+namespace k2 {
+
+namespace {
+
+constexpr char kMagic[8] = {'k', '2', 'f', 's', 'a', 'b', 'i', 'n'};
+constexpr uint32_t kVersion = 1;
+
+enum SectionKind : int32_t {
+  kArcsSection = 0,             // the arcs of the FSA, [num_arcs][4] int32
+  kRowSplitsSection = 1,        // row_splits `axis` of the FSA
+  kTensorAttrSection = 2,       // the tensor attribute `name`
+  kRaggedRowSplitsSection = 3,  // row_splits `axis` of ragged attr `name`
+  kRaggedValuesSection = 4,     // the values of ragged attribute `name`
+};
+
+enum SectionDtype : int32_t {
+  kInt32Section = 0,
+  kInt64Section = 1,
+  kFloat32Section = 2,
+  kFloat64Section = 3,
+};
+
+struct FileHeader {
+  char magic[8];
+  uint32_t version;
+  int32_t properties;  // FsaClass::properties
+  int32_t num_axes;    // 2 for an Fsa, 3 for an FsaVec
+  int32_t num_sections;
+  // Byte offset in the file of the data of the sections; a multiple of
+  // kNativeFsaAlignment.
+  int64_t data_offset;
+  int64_t data_bytes;
+  char reserved[24];
+};
+static_assert(sizeof(FileHeader) == 64, "Unexpected size of FileHeader");
+
+struct SectionHeader {
+  char name[64];  // NUL-terminated; empty for sections of the FSA itself
+  int32_t kind;   // SectionKind
+  int32_t axis;   // for kRowSplitsSection and kRaggedRowSplitsSection
+  int32_t dtype;  // SectionDtype
+  int32_t num_dims;
+  int64_t dims[4];
+  // Byte offset of the data relative to FileHeader::data_offset; a multiple
+  // of kNativeFsaAlignment.
+  int64_t offset;
+  int64_t num_bytes;
+};
+static_assert(sizeof(SectionHeader) == 128,
+              "Unexpected size of SectionHeader");
+
+struct Section {
+  SectionHeader header;
+  torch::Tensor data;  // contiguous, on CPU
+};
+
+int32_t ToSectionDtype(torch::ScalarType scalar_type) {
+  switch (scalar_type) {
+    case torch::kInt:
+      return kInt32Section;
+    case torch::kLong:
+      return kInt64Section;
+    case torch::kFloat:
+      return kFloat32Section;
+    case torch::kDouble:
+      return kFloat64Section;
+    default:
+      K2_LOG(FATAL) << "Unsupported dtype: " << scalar_type;
+      return -1;
+  }
+}
+
+torch::ScalarType FromSectionDtype(int32_t dtype) {
+  switch (dtype) {
+    case kInt32Section:
+      return torch::kInt;
+    case kInt64Section:
+      return torch::kLong;
+    case kFloat32Section:
+      return torch::kFloat;
+    case kFloat64Section:
+      return torch::kDouble;
+    default:
+      K2_LOG(FATAL) << "Unsupported dtype in file: " << dtype;
+      return torch::kInt;
+  }
+}
+
+int64_t RoundUpToAlignment(int64_t n) {
+  return (n + kNativeFsaAlignment - 1) / kNativeFsaAlignment *
+         kNativeFsaAlignment;
+}
+
+Section MakeSection(SectionKind kind, const std::string &name, int32_t axis,
+                    torch::Tensor t) {
+  K2_CHECK_LT(name.size(), sizeof(SectionHeader::name))
+      << "Attribute name too long: '" << name << "'";
+  K2_CHECK_LE(t.dim(), 4) << "'" << name << "': too many dimensions";
+  Section ans;
+  ans.data = t.to(torch::kCPU).contiguous();
+  SectionHeader &h = ans.header;
+  std::memset(&h, 0, sizeof(h));
+  std::memcpy(h.name, name.data(), name.size());
+  h.kind = kind;
+  h.axis = axis;
+  h.dtype = ToSectionDtype(ans.data.scalar_type());
+  h.num_dims = ans.data.dim();
+  for (int32_t i = 0; i < h.num_dims; ++i) h.dims[i] = ans.data.size(i);
+  h.num_bytes = ans.data.nbytes();
+  return ans;
+}
+
+// Build a RaggedShape from its row_splits (given for axes 1, 2, ...) and
+// its number of elements.
+RaggedShape ShapeFromRowSplits(const std::vector<torch::Tensor> &row_splits,
+                               int32_t num_elems) {
+  K2_CHECK(!row_splits.empty());
+  RaggedShape ans;
+  for (size_t i = 0; i != row_splits.size(); ++i) {
+    K2_CHECK(row_splits[i].defined()) << "Missing row_splits " << (i + 1);
+    Array1<int32_t> this_row_splits =
+        Array1FromTorch<int32_t>(row_splits[i]);
+    int32_t tot_size = (i + 1 < row_splits.size()
+                            ? row_splits[i + 1].numel() - 1
+                            : num_elems);
+    RaggedShape shape = RaggedShape2(&this_row_splits, nullptr, tot_size);
+    ans = (i == 0 ? shape : ComposeRaggedShapes(ans, shape));
+  }
+  return ans;
+}
+
+// Collect the sections of `fsa` and fill in `header` and the offsets of the
+// sections.
+std::vector<Section> GetSections(const FsaClass &fsa, FileHeader *header) {
+  std::vector<Section> sections;
+
+  Array1<Arc> arcs = fsa.fsa.values.To(GetCpuContext());
+  torch::Tensor arcs_tensor =
+      arcs.Dim() == 0
+          ? torch::empty({0, 4}, torch::kInt)
+          : torch::from_blob(arcs.Data(), {arcs.Dim(), 4},
+                             [saved_region = arcs.GetRegion()](void *) {},
+                             torch::kInt);
+  sections.push_back(MakeSection(kArcsSection, "", 0, arcs_tensor));
+
+  RaggedShape shape = fsa.fsa.shape;
+  for (int32_t axis = 1; axis < shape.NumAxes(); ++axis)
+    sections.push_back(MakeSection(kRowSplitsSection, "", axis,
+                                   Array1ToTorch(shape.RowSplits(axis))));
+
+  // Sort the attribute names so that the output doesn't depend on the order
+  // of the unordered_maps.
+  fsa.MaterializeAttrs();
+  std::map<std::string, torch::Tensor> tensor_attrs(fsa.tensor_attrs.begin(),
+                                                    fsa.tensor_attrs.end());
+  for (const auto &p : tensor_attrs)
+    sections.push_back(MakeSection(kTensorAttrSection, p.first, 0, p.second));
+
+  std::map<std::string, Ragged<int32_t>> ragged_attrs(
+      fsa.ragged_tensor_attrs.begin(), fsa.ragged_tensor_attrs.end());
+  for (auto &p : ragged_attrs) {
+    Ragged<int32_t> &value = p.second;
+    for (int32_t axis = 1; axis < value.NumAxes(); ++axis)
+      sections.push_back(MakeSection(kRaggedRowSplitsSection, p.first, axis,
+                                     Array1ToTorch(value.RowSplits(axis))));
+    sections.push_back(MakeSection(kRaggedValuesSection, p.first, 0,
+                                   Array1ToTorch(value.values)));
+  }
+
+  int64_t data_bytes = 0;
+  for (auto &section : sections) {
+    section.header.offset = data_bytes;
+    data_bytes = RoundUpToAlignment(data_bytes + section.header.num_bytes);
+  }
+
+  std::memset(header, 0, sizeof(*header));
+  std::memcpy(header->magic, kMagic, sizeof(kMagic));
+  header->version = kVersion;
+  header->properties = fsa.properties;
+  header->num_axes = shape.NumAxes();
+  header->num_sections = static_cast<int32_t>(sections.size());
+  header->data_offset = RoundUpToAlignment(
+      sizeof(FileHeader) + sections.size() * sizeof(SectionHeader));
+  header->data_bytes = data_bytes;
+  return sections;
+}
+
+// Write the file image described by `header` and `sections` as a sequence of
+// calls write(const char *src, int64_t num_bytes).
+template <typename WriteFunc>
+void WriteImage(const FileHeader &header, const std::vector<Section> &sections,
+                WriteFunc write) {
+  std::vector<char> zeros(kNativeFsaAlignment, 0);
+  write(reinterpret_cast<const char *>(&header), sizeof(header));
+  for (const auto &section : sections)
+    write(reinterpret_cast<const char *>(&section.header),
+          sizeof(SectionHeader));
+  int64_t pos = sizeof(FileHeader) + sections.size() * sizeof(SectionHeader);
+  write(zeros.data(), header.data_offset - pos);
+  pos = 0;
+  for (const auto &section : sections) {
+    write(reinterpret_cast<const char *>(section.data.data_ptr()),
+          section.header.num_bytes);
+    pos += section.header.num_bytes;
+    int64_t padded = RoundUpToAlignment(pos);
+    write(zeros.data(), padded - pos);
+    pos = padded;
+  }
+}
+
+// Parse and check the header and the section table at the start of
+// `file_data`.  If `with_data` is true, the data of the sections must follow
+// them within `file_bytes`.  `what` names the file in error messages.
+void ReadHeaders(const char *file_data, int64_t file_bytes, bool with_data,
+                 const std::string &what, FileHeader *header,
+                 std::vector<SectionHeader> *section_headers) {
+  K2_CHECK_GE(file_bytes, static_cast<int64_t>(sizeof(*header)))
+      << "'" << what << "' is not a k2 native FSA file";
+  std::memcpy(header, file_data, sizeof(*header));
+  K2_CHECK_EQ(std::memcmp(header->magic, kMagic, sizeof(kMagic)), 0)
+      << "'" << what << "' is not a k2 native FSA file";
+  K2_CHECK_EQ(header->version, kVersion)
+      << "Unsupported version of '" << what << "'";
+  K2_CHECK(header->num_axes == 2 || header->num_axes == 3);
+  K2_CHECK_GE(header->num_sections, 1);
+  int64_t table_end =
+      sizeof(FileHeader) + header->num_sections * sizeof(SectionHeader);
+  int64_t end = (with_data ? header->data_offset + header->data_bytes
+                           : table_end);
+  K2_CHECK(header->data_offset >= table_end && header->data_bytes >= 0 &&
+           end <= file_bytes)
+      << "'" << what << "' is truncated or corrupted";
+  section_headers->resize(header->num_sections);
+  std::memcpy(section_headers->data(), file_data + sizeof(FileHeader),
+              header->num_sections * sizeof(SectionHeader));
+}
+
+// Build the FsaClass described by `header` and `section_headers`, whose
+// arrays point into `data`, the data of the sections (on any device).
+FsaClass FsaFromSections(const FileHeader &header,
+                         const std::vector<SectionHeader> &section_headers,
+                         torch::Tensor data, const std::string &what) {
+  K2_CHECK_EQ(data.numel(), header.data_bytes);
+  uint8_t *data_ptr = reinterpret_cast<uint8_t *>(data.data_ptr());
+
+  torch::Tensor arcs;
+  std::vector<torch::Tensor> row_splits(header.num_axes - 1);
+  std::vector<std::pair<std::string, torch::Tensor>> tensor_attrs;
+  std::map<std::string, std::vector<torch::Tensor>> ragged_row_splits;
+  std::map<std::string, torch::Tensor> ragged_values;
+  for (const auto &h : section_headers) {
+    K2_CHECK(h.num_dims >= 0 && h.num_dims <= 4);
+    std::vector<int64_t> sizes(h.dims, h.dims + h.num_dims);
+    torch::ScalarType scalar_type = FromSectionDtype(h.dtype);
+    auto options = torch::device(data.device()).dtype(scalar_type);
+    int64_t numel = 1;
+    for (int64_t s : sizes) numel *= s;
+    K2_CHECK(h.offset >= 0 && h.offset + h.num_bytes <= header.data_bytes &&
+             h.offset % kNativeFsaAlignment == 0 &&
+             numel * static_cast<int64_t>(torch::elementSize(scalar_type)) ==
+                 h.num_bytes)
+        << "'" << what << "' is corrupted";
+    torch::Tensor t =
+        numel == 0 ? torch::empty(sizes, options)
+                   : torch::from_blob(data_ptr + h.offset, sizes,
+                                      [data](void *) {}, options);
+    std::string name(h.name, strnlen(h.name, sizeof(h.name)));
+    switch (h.kind) {
+      case kArcsSection:
+        arcs = t;
+        break;
+      case kRowSplitsSection:
+        K2_CHECK(h.axis >= 1 && h.axis < header.num_axes);
+        row_splits[h.axis - 1] = t;
+        break;
+      case kTensorAttrSection:
+        tensor_attrs.emplace_back(name, t);
+        break;
+      case kRaggedRowSplitsSection: {
+        K2_CHECK_GE(h.axis, 1);
+        auto &this_row_splits = ragged_row_splits[name];
+        if (static_cast<int32_t>(this_row_splits.size()) < h.axis)
+          this_row_splits.resize(h.axis);
+        this_row_splits[h.axis - 1] = t;
+        break;
+      }
+      case kRaggedValuesSection:
+        ragged_values[name] = t;
+        break;
+      default:
+        K2_LOG(FATAL) << "Unknown section kind " << h.kind << " in '"
+                      << what << "'";
+    }
+  }
+
+  K2_CHECK(arcs.defined()) << "No arcs in '" << what << "'";
+  Array1<Arc> arcs_array = Array1FromTorch<Arc>(arcs);
+  FsaClass ans;
+  ans.fsa = Ragged<Arc>(ShapeFromRowSplits(row_splits, arcs_array.Dim()),
+                        arcs_array);
+  ans.properties = header.properties;
+  ans.Properties();  // only computes them if they were not saved.
+
+  for (auto &p : tensor_attrs) ans.SetTensorAttr(p.first, p.second);
+  for (auto &p : ragged_values) {
+    Array1<int32_t> values = Array1FromTorch<int32_t>(p.second);
+    ans.SetRaggedTensorAttr(
+        p.first,
+        Ragged<int32_t>(ShapeFromRowSplits(ragged_row_splits[p.first],
+                                           values.Dim()),
+                        values));
+  }
+  return ans;
+}
+
+// Copy `src`, a 1-D byte tensor on CPU (e.g. in a mapped file), to `device`.
+// For CUDA, the bytes are staged in pinned memory a chunk at a time, so
+// that the copies are asynchronous (on the stream of the context of
+// `device`) and overlap with reading the next chunk.
+torch::Tensor CopyToDevice(torch::Tensor src, torch::Device device) {
+  if (device.type() != torch::kCUDA || src.numel() == 0)
+    return src.to(device);
+  ContextPtr c = ContextFromDevice(device),
+             pinned_context = GetPinnedContext();
+  DeviceGuard guard(c);
+  int64_t num_bytes = src.numel();
+  RegionPtr region = NewRegion(c, num_bytes);
+  const char *src_data = reinterpret_cast<const char *>(src.data_ptr());
+  char *dst_data = reinterpret_cast<char *>(region->data);
+  constexpr int64_t kChunkBytes = int64_t(64) << 20;
+  for (int64_t begin = 0; begin < num_bytes; begin += kChunkBytes) {
+    int64_t n = std::min(kChunkBytes, num_bytes - begin);
+    // The pinned allocator does not reuse the chunk until the copy is done.
+    RegionPtr staging = NewRegion(pinned_context, n);
+    std::memcpy(staging->data, src_data + begin, n);
+    pinned_context->CopyDataTo(n, staging->data, c, dst_data + begin);
+  }
+  return torch::from_blob(region->data, {num_bytes},
+                          [region](void *) {},
+                          torch::device(device).dtype(torch::kByte));
+}
+
+}  // namespace
+
+void SaveFsaNative(const FsaClass &fsa, const std::string &filename) {
+  FileHeader header;
+  std::vector<Section> sections = GetSections(fsa, &header);
+
+  std::ofstream os(filename, std::ofstream::binary);
+  K2_CHECK(os) << "Failed to open '" << filename << "' for writing";
+  WriteImage(header, sections, [&os](const char *src, int64_t num_bytes) {
+    os.write(src, num_bytes);
+  });
+  K2_CHECK(os) << "Failed to write '" << filename << "'";
+}
+
+FsaClass LoadFsaNative(const std::string &filename,
+                       torch::Device map_location /*= torch::kCPU*/) {
+  torch::Tensor file = MapFile(filename);
+  FileHeader header;
+  std::vector<SectionHeader> section_headers;
+  ReadHeaders(reinterpret_cast<const char *>(file.data_ptr()), file.numel(),
+              true, filename, &header, &section_headers);
+
+  // All sections share the storage of `data`.  For devices other than CPU,
+  // this is the only copy of the data.
+  torch::Tensor data = file.narrow(0, header.data_offset, header.data_bytes);
+  if (map_location != torch::Device(torch::kCPU))
+    data = CopyToDevice(data, map_location);
+  return FsaFromSections(header, section_headers, data, filename);
+}
+
+bool IsNativeFsaFile(const std::string &filename) {
+  std::ifstream is(filename, std::ifstream::binary);
+  char magic[sizeof(kMagic)];
+  if (!is.read(magic, sizeof(magic))) return false;
+  return std::memcmp(magic, kMagic, sizeof(kMagic)) == 0;
+}
+
+namespace {
+
+constexpr char kSharedMagic[8] = {'k', '2', 'f', 's', 'a', 's', 'h', 'm'};
+
+// The start of the shared memory segment of a SharedFsa; it is followed by
+// the file image written by SaveFsaNative(), without the data of the
+// sections if they are on CUDA.
+struct SharedHeader {
+  char magic[8];
+  int32_t device_type;   // 0 for CPU, 1 for CUDA
+  int32_t device_index;  // the CUDA device of the data
+  int64_t image_bytes;   // number of bytes of the image after this header
+  char ipc_handle[64];   // the cudaIpcMemHandle_t of the data, for CUDA
+  char reserved[40];
+};
+static_assert(sizeof(SharedHeader) == 128,
+              "Unexpected size of SharedHeader");
+static_assert(sizeof(SharedHeader) % kNativeFsaAlignment == 0,
+              "The image must stay aligned");
+#ifdef K2_WITH_CUDA
+static_assert(sizeof(cudaIpcMemHandle_t) == sizeof(SharedHeader::ipc_handle),
+              "Unexpected size of cudaIpcMemHandle_t");
+#endif
+
+}  // namespace
+
+SharedFsa::SharedFsa(const FsaClass &fsa, const std::string &name)
+    : name_(name) {
+#ifndef _MSC_VER
+  FileHeader header;
+  std::vector<Section> sections = GetSections(fsa, &header);
+  std::vector<SectionHeader> section_headers;
+  for (const auto &section : sections)
+    section_headers.push_back(section.header);
+
+  ContextPtr c = fsa.fsa.Context();
+  bool on_cuda = (c->GetDeviceType() == kCuda);
+  int64_t image_bytes = header.data_offset + (on_cuda ? 0 : header.data_bytes);
+  size_t size = sizeof(SharedHeader) + image_bytes;
+
+  int fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0644);
+  K2_CHECK_GE(fd, 0) << "Failed to create shared memory '" << name << "'";
+  if (ftruncate(fd, size) != 0) {
+    close(fd);
+    shm_unlink(name.c_str());
+    K2_LOG(FATAL) << "Failed to resize shared memory '" << name << "'";
+  }
+  void *addr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (addr == MAP_FAILED) {
+    shm_unlink(name.c_str());
+    K2_LOG(FATAL) << "Failed to mmap shared memory '" << name << "'";
+  }
+  std::shared_ptr<void> mapping(addr,
+                                [size](void *p) { munmap(p, size); });
+
+  SharedHeader *shared_header = static_cast<SharedHeader *>(addr);
+  std::memset(shared_header, 0, sizeof(SharedHeader));
+  std::memcpy(shared_header->magic, kSharedMagic, sizeof(kSharedMagic));
+  shared_header->device_type = on_cuda ? 1 : 0;
+  shared_header->image_bytes = image_bytes;
+  char *image = static_cast<char *>(addr) + sizeof(SharedHeader);
+
+  torch::Tensor data;
+  int64_t pos = 0;
+  if (!on_cuda) {
+    WriteImage(header, sections,
+               [image, &pos](const char *src, int64_t num_bytes) {
+                 std::memcpy(image + pos, src, num_bytes);
+                 pos += num_bytes;
+               });
+    data = torch::from_blob(image + header.data_offset, {header.data_bytes},
+                            [mapping](void *) {}, torch::kByte);
+  } else {
+#ifdef K2_WITH_CUDA
+    DeviceGuard guard(c);
+    shared_header->device_index = c->GetDeviceId();
+    // The buffer is allocated with cudaMalloc() rather than by the context,
+    // as an IPC handle refers to a whole allocation.
+    void *buffer_ptr = nullptr;
+    cudaError_t ret =
+        cudaMalloc(&buffer_ptr, std::max<int64_t>(header.data_bytes, 1));
+    K2_CHECK_CUDA_ERROR(ret);
+    std::shared_ptr<void> buffer(buffer_ptr, [](void *p) { cudaFree(p); });
+    cudaIpcMemHandle_t handle;
+    ret = cudaIpcGetMemHandle(&handle, buffer_ptr);
+    K2_CHECK_CUDA_ERROR(ret);
+    std::memcpy(shared_header->ipc_handle, &handle, sizeof(handle));
+
+    char *buffer_data = static_cast<char *>(buffer_ptr);
+    int64_t data_offset = header.data_offset;
+    WriteImage(header, sections, [=, &pos](const char *src,
+                                           int64_t num_bytes) {
+      // The headers and their padding end exactly at data_offset.
+      if (pos < data_offset) {
+        std::memcpy(image + pos, src, num_bytes);
+      } else if (num_bytes != 0) {
+        cudaError_t e = cudaMemcpy(buffer_data + pos - data_offset, src,
+                                   num_bytes, cudaMemcpyHostToDevice);
+        K2_CHECK_CUDA_ERROR(e);
+      }
+      pos += num_bytes;
+    });
+    data = torch::from_blob(
+        buffer_ptr, {header.data_bytes}, [buffer](void *) {},
+        torch::device(DeviceFromContext(c)).dtype(torch::kByte));
+#else
+    K2_LOG(FATAL) << "k2 compiled without CUDA support";
+#endif
+  }
+  fsa_ = FsaFromSections(header, section_headers, data, name);
+#else
+  K2_LOG(FATAL) << "Shared FSAs are not supported on Windows";
+#endif
+}
+
+SharedFsa::~SharedFsa() {
+#ifndef _MSC_VER
+  shm_unlink(name_.c_str());
+#endif
+}
+
+FsaClass OpenSharedFsa(const std::string &name) {
+#ifndef _MSC_VER
+  int fd = shm_open(name.c_str(), O_RDONLY, 0);
+  K2_CHECK_GE(fd, 0) << "Failed to open shared memory '" << name << "'";
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    close(fd);
+    K2_LOG(FATAL) << "Failed to stat shared memory '" << name << "'";
+  }
+  size_t size = st.st_size;
+  void *addr = size < sizeof(SharedHeader)
+                   ? MAP_FAILED
+                   : mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  K2_CHECK(addr != MAP_FAILED)
+      << "Failed to mmap shared memory '" << name << "'";
+  std::shared_ptr<void> mapping(addr,
+                                [size](void *p) { munmap(p, size); });
+
+  SharedHeader shared_header;
+  std::memcpy(&shared_header, addr, sizeof(shared_header));
+  K2_CHECK_EQ(
+      std::memcmp(shared_header.magic, kSharedMagic, sizeof(kSharedMagic)), 0)
+      << "'" << name << "' is not a shared k2 FSA";
+  K2_CHECK_LE(shared_header.image_bytes,
+              static_cast<int64_t>(size - sizeof(SharedHeader)))
+      << "'" << name << "' is truncated";
+  char *image = static_cast<char *>(addr) + sizeof(SharedHeader);
+  bool on_cuda = (shared_header.device_type == 1);
+  FileHeader header;
+  std::vector<SectionHeader> section_headers;
+  ReadHeaders(image, shared_header.image_bytes, !on_cuda, name, &header,
+              &section_headers);
+
+  torch::Tensor data;
+  if (!on_cuda) {
+    data = torch::from_blob(image + header.data_offset, {header.data_bytes},
+                            [mapping](void *) {}, torch::kByte);
+  } else {
+#ifdef K2_WITH_CUDA
+    DeviceGuard guard(shared_header.device_index);
+    cudaIpcMemHandle_t handle;
+    std::memcpy(&handle, shared_header.ipc_handle, sizeof(handle));
+    void *buffer_ptr = nullptr;
+    cudaError_t ret = cudaIpcOpenMemHandle(&buffer_ptr, handle,
+                                           cudaIpcMemLazyEnablePeerAccess);
+    K2_CHECK_CUDA_ERROR(ret);
+    std::shared_ptr<void> buffer(buffer_ptr,
+                                 [](void *p) { cudaIpcCloseMemHandle(p); });
+    data = torch::from_blob(
+        buffer_ptr, {header.data_bytes}, [buffer](void *) {},
+        torch::device(torch::Device(torch::kCUDA,
+                                    shared_header.device_index))
+            .dtype(torch::kByte));
+#else
+    K2_LOG(FATAL) << "k2 compiled without CUDA support";
+#endif
+  }
+  return FsaFromSections(header, section_headers, data, name);
+#else
+  K2_LOG(FATAL) << "Shared FSAs are not supported on Windows";
+  return FsaClass();
+#endif
+}
+
+}  // namespace k2
@@ -0,0 +1,132 @@
+/**
+ * Copyright      2026  Xiaomi Corporation
+ *
+ * See LICENSE for clarification regarding multiple authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef K2_TORCH_CSRC_NATIVE_FSA_IO_H_
+#define K2_TORCH_CSRC_NATIVE_FSA_IO_H_
+
+#include <memory>
+#include <string>
+
+#include "k2/torch/csrc/fsa_class.h"
+#include "torch/script.h"
+
+namespace k2 {
+
+/*
+  k2's native on-disk format for an FsaClass.  Unlike files written by
+  `torch.save()`, it needs no unpickling: a file is a fixed-size header, a
+  table of section descriptors and then the raw data of each section, each
+  aligned to kNativeFsaAlignment bytes.  The sections are the arcs and the
+  row_splits of the FSA, the tensor attributes, and the row_splits and values
+  of the ragged attributes (e.g. `aux_labels`).  The FSA's properties are
+  stored in the header, so they are not recomputed on loading.
+
+  All numbers are stored in the byte order of the machine that wrote the
+  file; loading a file written on a machine with a different byte order is
+  not supported.
+ */
+constexpr int32_t kNativeFsaAlignment = 64;
+
+/* Save an FsaClass in k2's native format.
+
+   @param fsa  The FSA to save.  It may be on any device.  Only tensor
+               attributes of dtype int32, int64, float32 and float64 are
+               supported, and they may have at most 4 dimensions.
+   @param filename  The file to write.
+ */
+void SaveFsaNative(const FsaClass &fsa, const std::string &filename);
+
+/* Load a file written by SaveFsaNative().
+
+   The file is memory-mapped and the arrays of the returned FSA point into the
+   mapping, so loading to CPU does not read or copy the data up front.  For
+   CUDA devices, the data is staged through pinned memory and copied
+   asynchronously on the stream of the device's context.
+
+   @param filename  The file to load.
+   @param map_location  The device on which to return the FSA.
+   @return Return the loaded FSA.
+ */
+FsaClass LoadFsaNative(const std::string &filename,
+                       torch::Device map_location = torch::kCPU);
+
+/* Return true if `filename` starts with the magic string of the format
+   written by SaveFsaNative().  LoadFsa() uses this to dispatch to
+   LoadFsaNative().
+ */
+bool IsNativeFsaFile(const std::string &filename);
+
+/*
+  An FsaClass exported to shared memory, so that other processes on the same
+  machine can open it with OpenSharedFsa() and use it without a copy of their
+  own, e.g. several decoder processes sharing one HLG per GPU.
+
+  The FSA is stored in k2's native format (see SaveFsaNative()) in a POSIX
+  shared memory segment with the given name.  For an FSA on CUDA, only the
+  header and the section table are in the segment; the data of the sections
+  is in one device buffer, which other processes open with
+  cudaIpcOpenMemHandle().
+
+  Destroying this object removes the name of the segment, so no process can
+  open the FSA any more.  On CPU, processes that have opened it keep their
+  mapping until they release the FSA.  On CUDA, the device buffer is freed
+  once this object and the FSAs returned by Fsa() are destroyed, so they must
+  outlive the use of the FSA by all other processes.
+ */
+class SharedFsa {
+ public:
+  /*
+     @param fsa   The FSA to export, on any device.  Its attributes are
+                  subject to the same constraints as for SaveFsaNative().
+     @param name  The name of the shared memory segment, as for shm_open(),
+                  e.g. "/k2-hlg"; it must not exist.
+   */
+  SharedFsa(const FsaClass &fsa, const std::string &name);
+  ~SharedFsa();
+
+  SharedFsa(const SharedFsa &) = delete;
+  SharedFsa &operator=(const SharedFsa &) = delete;
+
+  const std::string &Name() const { return name_; }
+
+  /* Return the exported FSA in this process.  Its arrays point into the
+     shared memory (or the device buffer), so the caller can release its own
+     copy of the FSA.  It must not be modified in place.
+   */
+  FsaClass Fsa() const { return fsa_; }
+
+ private:
+  std::string name_;
+  FsaClass fsa_;
+};
+
+/* Open an FSA exported by SharedFsa in another process.
+
+   The arrays of the returned FSA are read-only views of the shared memory (or
+   of the device buffer of the exporting process, on the same device); no
+   data is copied.  They must not be modified in place: on CPU, writing to
+   them crashes the process.
+
+   @param name  The name passed to the constructor of SharedFsa.
+   @return Return the shared FSA.
+ */
+FsaClass OpenSharedFsa(const std::string &name);
+
+}  // namespace k2
+
+#endif  // K2_TORCH_CSRC_NATIVE_FSA_IO_H_
@@ -0,0 +1,120 @@
+/**
+ * Copyright      2026  Xiaomi Corporation
+ *
+ * See LICENSE for clarification regarding multiple authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _MSC_VER
+#include <unistd.h>
+#endif
+
+#include <cassert>
+#include <cstdio>
+#include <string>
+
+#include "gtest/gtest.h"
+#include "k2/csrc/fsa_utils.h"
+#include "k2/torch/csrc/deserialization.h"
+#include "k2/torch/csrc/native_fsa_io.h"
+#include "k2/torch/csrc/utils.h"
+
+namespace k2 {
+
+TEST(NativeFsaIo, SaveAndLoad) {
+  char pattern[] = "/tmp/k2_test.XXXXXX";
+#ifndef _MSC_VER
+  char *dir_name = mkdtemp(pattern);
+#else
+  char *dir_name = "./";
+#endif
+  assert(dir_name != nullptr);
+  std::string filename = std::string(dir_name) + "/fsa.k2fsa";
+
+  for (const ContextPtr &c : {GetCpuContext(), GetCudaContext()}) {
+    std::string s = R"(0 1 2 10
+        0 1 1 20
+        1 2 -1 30
+        2)";
+    auto device = DeviceFromContext(c);
+    FsaClass src(FsaToFsaVec(FsaFromString(s).To(c)));
+    src.SetTensorAttr(
+        "float_attr",
+        torch::tensor({0.1, 0.2, 0.3}, torch::dtype(torch::kFloat32))
+            .to(device));
+    src.SetTensorAttr(
+        "int2_attr",
+        torch::tensor({1, 2, 3, 4, 5, 6}, torch::dtype(torch::kInt64))
+            .reshape({3, 2})
+            .to(device));
+    src.SetRaggedTensorAttr("aux_labels",
+                            Ragged<int32_t>(c, "[[1 2 3] [5 6] []]"));
+    SaveFsaNative(src, filename);
+    EXPECT_TRUE(IsNativeFsaFile(filename));
+
+    for (const ContextPtr &dst_c : {GetCpuContext(), c}) {
+      auto dst_device = DeviceFromContext(dst_c);
+      // LoadFsa() dispatches to LoadFsaNative() for this format.
+      for (int32_t i = 0; i < 2; ++i) {
+        FsaClass dst = (i == 0 ? LoadFsaNative(filename, dst_device)
+                               : LoadFsa(filename, dst_device));
+        EXPECT_EQ(DeviceFromContext(dst.fsa.Context()), dst_device);
+        EXPECT_EQ(dst.properties, src.properties);
+        EXPECT_TRUE(Equal(dst.fsa, src.fsa.To(dst_c)));
+        for (const auto &name : {"float_attr", "int2_attr"}) {
+          EXPECT_TRUE(torch::equal(dst.GetTensorAttr(name).cpu(),
+                                   src.GetTensorAttr(name).cpu()));
+        }
+        EXPECT_TRUE(Equal(dst.GetRaggedTensorAttr("aux_labels"),
+                          src.GetRaggedTensorAttr("aux_labels").To(dst_c)));
+      }
+    }
+  }
+  int32_t ret = remove(filename.c_str());
+  assert(ret == 0);
+}
+
+#ifndef _MSC_VER
+TEST(NativeFsaIo, SharedFsa) {
+  // CUDA IPC handles cannot be opened in the process that created them, so
+  // only the CPU version is tested here.
+  std::string s = R"(0 1 2 10
+      0 1 1 20
+      1 2 -1 30
+      2)";
+  FsaClass src(FsaToFsaVec(FsaFromString(s)));
+  src.SetTensorAttr("float_attr", torch::tensor({0.1, 0.2, 0.3},
+                                                torch::dtype(torch::kFloat32)));
+  src.SetRaggedTensorAttr(
+      "aux_labels", Ragged<int32_t>(GetCpuContext(), "[[1 2 3] [5 6] []]"));
+
+  std::string name = "/k2_test_shared_fsa_" + std::to_string(getpid());
+  FsaClass dst;
+  {
+    SharedFsa shared(src, name);
+    EXPECT_EQ(shared.Name(), name);
+    EXPECT_TRUE(Equal(shared.Fsa().fsa, src.fsa));
+    dst = OpenSharedFsa(name);
+  }
+  // The mapping stays valid after the exporter is gone.
+  EXPECT_EQ(dst.properties, src.properties);
+  EXPECT_TRUE(Equal(dst.fsa, src.fsa));
+  EXPECT_TRUE(torch::equal(dst.GetTensorAttr("float_attr"),
+                           src.GetTensorAttr("float_attr")));
+  EXPECT_TRUE(Equal(dst.GetRaggedTensorAttr("aux_labels"),
+                    src.GetRaggedTensorAttr("aux_labels")));
+}
+#endif
+
+}  // namespace k2
@@ -16,9 +16,17 @@
  * limitations under the License.
  */
 
+#include <algorithm>
+#include <map>
+#include <utility>
+#include <vector>
+
 #include "k2/csrc/fsa_algo.h"
+#include "k2/csrc/fsa_utils.h"
+#include "k2/csrc/ragged_ops.h"
 #include "k2/torch/csrc/fsa_algo.h"
 #include "k2/torch/csrc/nbest.h"
+#include "k2/torch/csrc/utils.h"
 namespace k2 {
 
 Nbest::Nbest(const FsaClass &fsa, const RaggedShape &shape)
@@ -29,7 +37,8 @@ Nbest::Nbest(const FsaClass &fsa, const RaggedShape &shape)
 }
 
 Nbest Nbest::FromLattice(FsaClass &lattice, int32_t num_paths,
-                         float nbest_scale /*= 0.5*/) {
+                         float nbest_scale /*= 0.5*/,
+                         int32_t max_num_paths /*= 0*/) {
   K2_CHECK_EQ(lattice.fsa.NumAxes(), 3);
   K2_CHECK_GT(num_paths, 1);
 
@@ -38,7 +47,7 @@ Nbest Nbest::FromLattice(FsaClass &lattice, int32_t num_paths,
 
   scores = scores * nbest_scale;
   lattice.SetScores(scores);
-  Nbest ans = RandomPaths(lattice, num_paths);
+  Nbest ans = RandomPaths(lattice, num_paths, max_num_paths);
   lattice.SetScores(saved_scores);
   return ans;
 }
@@ -66,16 +75,31 @@ void Nbest::Intersect(FsaClass *lattice) {
   // Now lattice has word IDs as labels and token IDs as aux_labels
   ArcSort(lattice);
 
+  // The lattice is shared by all paths of an utterance via path_to_utt_map,
+  // so it is not replicated.  The attributes of the lattice are only copied
+  // for the arcs of the best paths, not for every arc of the intersection,
+  // which has up to num_paths times as many arcs as the lattice.
   FsaClass word_fsa_with_epsilon_self_loops_wrapper(
       word_fsa_with_epsilon_self_loops);
-
-  FsaClass ans =
-      IntersectDevice(*lattice, word_fsa_with_epsilon_self_loops_wrapper,
-                      path_to_utt_map, true);
-
-  Connect(&ans);
-  TopSort(&ans);
-  ans = ShortestPath(ans);
+  Array1<int32_t> arc_map;
+  FsaVec composed = IntersectDevice(
+      lattice->fsa, lattice->Properties(), word_fsa_with_epsilon_self_loops,
+      word_fsa_with_epsilon_self_loops_wrapper.Properties(), path_to_utt_map,
+      &arc_map, nullptr, true);
+
+  FsaVec connected, sorted;
+  Array1<int32_t> connect_arc_map, sort_arc_map;
+  Connect(composed, &connected, &connect_arc_map);
+  TopSort(connected, &sorted, &sort_arc_map);
+  arc_map = arc_map[connect_arc_map][sort_arc_map];
+
+  FsaClass sorted_wrapper(sorted);
+  Ragged<int32_t> best_path_arc_indexes =
+      ShortestPathArcIndexes(sorted_wrapper);
+  FsaVec best_paths = FsaVecFromArcIndexes(sorted, best_path_arc_indexes);
+  FsaClass ans(best_paths);
+  ans.CopyAttrs(*lattice,
+                Array1ToTorch(arc_map[best_path_arc_indexes.values]));
   Invert(&ans);
   // now ans.fsa has token IDs as labels and word IDs as aux_labels.
 
@@ -113,4 +137,72 @@ torch::Tensor Nbest::ComputeLmScores() {
   return Array1ToTorch(tot_scores);
 }
 
+torch::Tensor Nbest::ComputeAttentionScores(
+    torch::jit::script::Module &module, torch::Tensor memory,
+    torch::Tensor memory_key_padding_mask, int32_t sos_id, int32_t eos_id,
+    int32_t max_batch_size /*= 100*/) {
+  K2_CHECK(fsa.HasTensorAttr("tokens"));
+  K2_CHECK_GT(max_batch_size, 0);
+
+  RaggedShape tokens_shape = RemoveAxis(fsa.fsa.shape, 1);
+  Ragged<int32_t> tokens{
+      tokens_shape, Array1FromTorch<int32_t>(fsa.GetTensorAttr("tokens"))};
+  tokens = RemoveValuesLeq(tokens, 0);
+  std::vector<std::vector<int32_t>> token_ids = tokens.ToVecVec();
+  Array1<int32_t> path_to_utt = shape.RowIds(1).To(GetCpuContext());
+  const int32_t *path_to_utt_data = path_to_utt.Data();
+
+  // Number the distinct (utterance, token sequence) pairs.
+  int32_t num_paths = static_cast<int32_t>(token_ids.size());
+  std::map<std::pair<int32_t, std::vector<int32_t>>, int64_t> seq_to_unique;
+  std::vector<int64_t> path_to_unique(num_paths);
+  std::vector<int32_t> unique_to_path;
+  for (int32_t p = 0; p != num_paths; ++p) {
+    auto ret = seq_to_unique.emplace(
+        std::make_pair(path_to_utt_data[p], token_ids[p]),
+        static_cast<int64_t>(unique_to_path.size()));
+    if (ret.second) unique_to_path.push_back(p);
+    path_to_unique[p] = ret.first->second;
+  }
+
+  // Score them in batches of sequences of similar length.
+  int64_t num_unique = static_cast<int64_t>(unique_to_path.size());
+  std::vector<int64_t> order(num_unique);
+  for (int64_t u = 0; u != num_unique; ++u) order[u] = u;
+  std::stable_sort(order.begin(), order.end(),
+                   [&](int64_t a, int64_t b) -> bool {
+                     return token_ids[unique_to_path[a]].size() <
+                            token_ids[unique_to_path[b]].size();
+                   });
+  torch::Device device = memory.device();
+  torch::Tensor unique_scores =
+      torch::empty({num_unique}, torch::device(device).dtype(torch::kFloat));
+  for (int64_t begin = 0; begin < num_unique; begin += max_batch_size) {
+    int64_t end = std::min<int64_t>(begin + max_batch_size, num_unique);
+    std::vector<int64_t> batch(order.begin() + begin, order.begin() + end);
+    std::vector<int64_t> utts;
+    torch::List<torch::IValue> token_ids_list(torch::TensorType::get());
+    token_ids_list.reserve(batch.size());
+    for (int64_t u : batch) {
+      int32_t p = unique_to_path[u];
+      utts.push_back(path_to_utt_data[p]);
+      token_ids_list.emplace_back(torch::tensor(token_ids[p]));
+    }
+    torch::Tensor utts_tensor = torch::tensor(utts).to(device);
+    // memory is (T, N, C) and memory_key_padding_mask is (N, T)
+    torch::Tensor nll =
+        module
+            .run_method("decoder_nll", memory.index_select(1, utts_tensor),
+                        memory_key_padding_mask.index_select(0, utts_tensor),
+                        token_ids_list, sos_id, eos_id)
+            .toTensor();
+    K2_CHECK_EQ(nll.dim(), 2);
+    K2_CHECK_EQ(nll.size(0), static_cast<int64_t>(batch.size()));
+    unique_scores.index_copy_(0, torch::tensor(batch).to(device),
+                              -nll.sum(1).to(torch::kFloat));
+  }
+  return unique_scores.index_select(0,
+                                    torch::tensor(path_to_unique).to(device));
+}
+
 }  // namespace k2
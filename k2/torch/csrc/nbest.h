@@ -25,6 +25,7 @@
 
 #include "k2/csrc/fsa.h"
 #include "k2/torch/csrc/fsa_class.h"
+#include "torch/script.h"
 
 namespace k2 {
 
@@ -68,11 +69,16 @@ struct Nbest {
       @param num_paths  Number of paths to sample.
       @param nbest_scale  Scale lattice.scores by this value before
                           sampling.
+      @param max_num_paths  If greater than num_paths, keep sampling
+                          until each utterance has num_paths unique paths
+                          or max_num_paths paths were sampled from it,
+                          instead of sampling num_paths paths once.
       @return Return an Nbest object containing the sampled paths, with
               duplicated paths being removed.
    */
   static Nbest FromLattice(FsaClass &lattice, int32_t num_paths,
-                           float nbest_scale = 0.5);
+                           float nbest_scale = 0.5,
+                           int32_t max_num_paths = 0);
 
   /// Intersect this object with a lattice to assign scores
   /// `this` nbest.
@@ -91,6 +97,38 @@ struct Nbest {
   /// Compute the LM scores of each path
   /// Return a 1-D torch.float32 tensor with dim equal to fsa.Dim0()
   torch::Tensor ComputeLmScores() /*const*/;
+
+  /** Compute the attention decoder scores of each path, i.e., the negated
+      total negative log-likelihood of its token sequence (given by the
+      tensor attribute "tokens" of `fsa`; tokens <= 0 are ignored).
+
+      Paths of the same utterance with the same token sequence are scored
+      only once.  The distinct sequences are sorted by length and scored in
+      batches of at most `max_batch_size`, so little padding is computed,
+      and the encoder memory of each batch is selected through the
+      path-to-utterance map (shape.RowIds(1)) instead of being expanded for
+      all paths at once.
+
+      @param module  A TorchScript module with a method
+                     `decoder_nll(memory, memory_key_padding_mask,
+                     token_ids, sos_id, eos_id)` returning a 2-D tensor
+                     of negative log-likelihoods with one row per sequence,
+                     e.g., the conformer_ctc model of icefall.
+      @param memory  The output of the encoder, of shape (T, N, C), where N
+                     is shape.Dim0().
+      @param memory_key_padding_mask  Its padding mask, of shape (N, T).
+      @param sos_id  ID of the start-of-sentence symbol.
+      @param eos_id  ID of the end-of-sentence symbol.
+      @param max_batch_size  The maximum number of sequences given to
+                     the decoder at once.
+      @return Return a 1-D torch.float32 tensor with dim equal to
+              fsa.Dim0(), on the device of `memory`.
+   */
+  torch::Tensor ComputeAttentionScores(torch::jit::script::Module &module,
+                                       torch::Tensor memory,
+                                       torch::Tensor memory_key_padding_mask,
+                                       int32_t sos_id, int32_t eos_id,
+                                       int32_t max_batch_size = 100);
 };
 
 }  // namespace k2
@@ -0,0 +1,290 @@
+/**
+ * Copyright      2026  Xiaomi Corporation
+ *
+ * See LICENSE for clarification regarding multiple authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <algorithm>
+#include <exception>
+#include <utility>
+#include <vector>
+
+#include "k2/csrc/log.h"
+#include "k2/torch/csrc/decode.h"
+#include "k2/torch/csrc/fsa_algo.h"
+#include "k2/torch/csrc/rnnt_server.h"
+#include "k2/torch/csrc/utils.h"
+
+namespace k2 {
+
+RnntServer::RnntServer(
+    torch::jit::Module module, FsaClass decoding_graph,
+    const rnnt_decoding::RnntDecodingConfig &decoding_config,
+    const RnntServerConfig &config /*= RnntServerConfig()*/)
+    : module_(std::move(module)),
+      decoding_graph_(std::move(decoding_graph)),
+      decoding_config_(decoding_config),
+      config_(config) {
+  K2_CHECK_GT(config_.max_batch_size, 0);
+  K2_CHECK_GE(config_.max_wait_ms, 0);
+  K2_CHECK_GT(config_.chunk_size, 0);
+  K2_CHECK(decoding_graph_.HasTensorAttr("aux_labels") ||
+           decoding_graph_.HasRaggedTensorAttr("aux_labels"));
+
+  graph_ = std::make_shared<Fsa>(decoding_graph_.fsa);
+  if (config_.decoder_cache_capacity > 0) {
+    cache_ = std::make_unique<DecoderOutputCache>(
+        config_.decoder_cache_capacity);
+  }
+  worker_ = std::thread([this]() { Run(); });
+}
+
+RnntServer::~RnntServer() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  cond_.notify_all();
+  worker_.join();
+}
+
+int64_t RnntServer::CreateStream() {
+  auto s = std::make_shared<Stream>();
+  s->decoding_stream = rnnt_decoding::CreateStream(graph_);
+  std::lock_guard<std::mutex> lock(mutex_);
+  int64_t stream_id = next_stream_id_++;
+  streams_[stream_id] = std::move(s);
+  return stream_id;
+}
+
+void RnntServer::AcceptEncoderOut(int64_t stream_id,
+                                  torch::Tensor encoder_out) {
+  K2_CHECK_EQ(encoder_out.dim(), 2);
+  if (encoder_out.size(0) == 0) return;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = streams_.find(stream_id);
+    K2_CHECK(it != streams_.end()) << "Unknown stream: " << stream_id;
+    Stream *s = it->second.get();
+    K2_CHECK(!s->input_finished)
+        << "Input of stream " << stream_id << " is already finished";
+    if (s->error) return;  // The stream failed; InputFinished() reports it.
+    s->num_pending_frames += encoder_out.size(0);
+    s->pending.push_back(std::move(encoder_out));
+    MaybeEnqueue(stream_id, s);
+  }
+  cond_.notify_one();
+}
+
+std::future<std::vector<int32_t>> RnntServer::InputFinished(
+    int64_t stream_id) {
+  std::future<std::vector<int32_t>> ans;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = streams_.find(stream_id);
+    K2_CHECK(it != streams_.end()) << "Unknown stream: " << stream_id;
+    Stream *s = it->second.get();
+    K2_CHECK(!s->input_finished)
+        << "Input of stream " << stream_id << " is already finished";
+    s->input_finished = true;
+    ans = s->result.get_future();
+    if (s->error) {
+      s->result.set_exception(s->error);
+      streams_.erase(it);
+      return ans;
+    }
+    if (s->num_taken_frames == 0 && s->num_pending_frames == 0) {
+      // Nothing to decode
+      s->result.set_value({});
+      streams_.erase(it);
+      return ans;
+    }
+    MaybeEnqueue(stream_id, s);
+  }
+  cond_.notify_one();
+  return ans;
+}
+
+int32_t RnntServer::NumStreams() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return static_cast<int32_t>(streams_.size());
+}
+
+bool RnntServer::IsReady(const Stream &s) const {
+  return s.num_pending_frames > config_.chunk_size ||
+         (s.input_finished && s.num_pending_frames > 0);
+}
+
+void RnntServer::MaybeEnqueue(int64_t stream_id, Stream *s) {
+  if (s->queued || !IsReady(*s)) return;
+  s->queued = true;
+  s->ready_time = std::chrono::steady_clock::now();
+  ready_.push_back(stream_id);
+}
+
+torch::Tensor RnntServer::TakeChunk(Stream *s) {
+  int32_t n = std::min(config_.chunk_size, s->num_pending_frames);
+  std::vector<torch::Tensor> parts;
+  int32_t needed = n;
+  while (needed > 0) {
+    torch::Tensor &front = s->pending.front();
+    int32_t num_frames = front.size(0);
+    if (num_frames <= needed) {
+      parts.push_back(std::move(front));
+      s->pending.pop_front();
+      needed -= num_frames;
+    } else {
+      parts.push_back(front.slice(/*dim*/ 0, 0, needed));
+      front = front.slice(/*dim*/ 0, needed);
+      needed = 0;
+    }
+  }
+  s->num_pending_frames -= n;
+  s->num_taken_frames += n;
+  return parts.size() == 1 ? parts[0] : torch::cat(parts);
+}
+
+void RnntServer::Run() {
+  torch::NoGradGuard no_grad;
+  while (true) {
+    std::vector<std::shared_ptr<Stream>> streams;
+    std::vector<torch::Tensor> chunks;
+    std::vector<bool> is_final;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      cond_.wait(lock, [this]() { return stop_ || !ready_.empty(); });
+      if (stop_) break;
+
+      // Wait a little for more streams, unless the batch is already full.
+      auto deadline = streams_[ready_.front()]->ready_time +
+                      std::chrono::milliseconds(config_.max_wait_ms);
+      cond_.wait_until(lock, deadline, [this]() {
+        return stop_ ||
+               static_cast<int32_t>(ready_.size()) >= config_.max_batch_size;
+      });
+      if (stop_) break;
+
+      std::vector<int64_t> ids;
+      while (!ready_.empty() &&
+             static_cast<int32_t>(ids.size()) < config_.max_batch_size) {
+        int64_t stream_id = ready_.front();
+        ready_.pop_front();
+        auto it = streams_.find(stream_id);
+        std::shared_ptr<Stream> s = it->second;
+        s->queued = false;
+        chunks.push_back(TakeChunk(s.get()));
+        bool final_chunk = s->input_finished && s->num_pending_frames == 0;
+        is_final.push_back(final_chunk);
+        if (final_chunk) streams_.erase(it);
+        ids.push_back(stream_id);
+        streams.push_back(std::move(s));
+      }
+      // Streams with more chunks go to the end of the queue, so that all
+      // ready streams get their turn.
+      for (size_t i = 0; i != ids.size(); ++i) {
+        if (!is_final[i]) MaybeEnqueue(ids[i], streams[i].get());
+      }
+    }
+    DecodeBatch(streams, chunks, is_final);
+  }
+}
+
+void RnntServer::DecodeBatch(
+    const std::vector<std::shared_ptr<Stream>> &streams,
+    const std::vector<torch::Tensor> &chunks,
+    const std::vector<bool> &is_final) {
+  int32_t num_streams = static_cast<int32_t>(streams.size());
+  try {
+    std::vector<std::shared_ptr<rnnt_decoding::RnntDecodingStream>>
+        decoding_streams;
+    std::vector<torch::Tensor> padded;
+    for (int32_t i = 0; i != num_streams; ++i) {
+      decoding_streams.push_back(streams[i]->decoding_stream);
+      // Only the last chunk of a stream can be shorter than chunk_size.
+      int32_t num_frames = chunks[i].size(0);
+      padded.push_back(torch::constant_pad_nd(
+          chunks[i], {0, 0, 0, config_.chunk_size - num_frames}));
+    }
+    rnnt_decoding::RnntDecodingStreams decoding(decoding_streams,
+                                                decoding_config_);
+    DecodeOneChunk(decoding, module_, torch::stack(padded), cache_.get());
+
+    if (std::none_of(is_final.begin(), is_final.end(),
+                     [](bool b) { return b; })) {
+      return;
+    }
+
+    // num_taken_frames is only changed by this thread, so we don't need
+    // to lock mutex_ here.
+    std::vector<int32_t> num_frames(num_streams);
+    for (int32_t i = 0; i != num_streams; ++i)
+      num_frames[i] = streams[i]->num_taken_frames;
+
+    FsaVec ofsa;
+    Array1<int32_t> out_map;
+    decoding.FormatOutput(num_frames, /*allow_partial*/ true, &ofsa,
+                          &out_map);
+    auto arc_map = Ragged<int32_t>(ofsa.shape, out_map).RemoveAxis(1);
+    std::vector<FsaClass> graphs(num_streams, decoding_graph_);
+    FsaClass lattice(ofsa);
+    lattice.CopyAttrs(graphs, arc_map);
+    Ragged<int32_t> ragged_labels = GetBestPathTexts(lattice);
+    auto labels = RaggedToVecVec(ragged_labels);
+
+    for (int32_t i = 0; i != num_streams; ++i) {
+      if (is_final[i]) streams[i]->result.set_value(std::move(labels[i]));
+    }
+  } catch (...) {
+    // The decoding state of all streams in the batch is now undefined, so
+    // they all fail.
+    std::exception_ptr error = std::current_exception();
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (int32_t i = 0; i != num_streams; ++i) {
+      Stream *s = streams[i].get();
+      if (is_final[i]) {
+        // The stream is already removed from streams_ and its future has
+        // been returned by InputFinished().
+        s->result.set_exception(error);
+        continue;
+      }
+      s->error = error;
+      s->pending.clear();
+      s->num_pending_frames = 0;
+    }
+    for (auto it = ready_.begin(); it != ready_.end();) {
+      Stream *s = streams_.at(*it).get();
+      if (s->error) {
+        s->queued = false;
+        it = ready_.erase(it);
+      } else {
+        ++it;
+      }
+    }
+    // Streams whose input is finished but that had chunks left will not see
+    // another call to InputFinished(), so report the error to their futures
+    // now; the others report it from InputFinished().
+    for (auto it = streams_.begin(); it != streams_.end();) {
+      Stream *s = it->second.get();
+      if (s->error && s->input_finished) {
+        s->result.set_exception(s->error);
+        it = streams_.erase(it);
+      } else {
+        ++it;
+      }
+    }
+  }
+}
+
+}  // namespace k2
@@ -0,0 +1,181 @@
+/**
+ * Copyright      2026  Xiaomi Corporation
+ *
+ * See LICENSE for clarification regarding multiple authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef K2_TORCH_CSRC_RNNT_SERVER_H_
+#define K2_TORCH_CSRC_RNNT_SERVER_H_
+
+#include <chrono>              // NOLINT
+#include <condition_variable>  // NOLINT
+#include <deque>
+#include <exception>
+#include <future>  // NOLINT
+#include <map>
+#include <memory>
+#include <mutex>  // NOLINT
+#include <thread>  // NOLINT
+#include <vector>
+
+#include "k2/csrc/rnnt_decode.h"
+#include "k2/torch/csrc/decoder_cache.h"
+#include "k2/torch/csrc/fsa_class.h"
+#include "torch/script.h"
+
+namespace k2 {
+
+struct RnntServerConfig {
+  // Maximum number of streams that are decoded together, i.e., the batch
+  // size of DecodeOneChunk().
+  int32_t max_batch_size = 32;
+
+  // Once a stream has a chunk ready, wait at most this long for other
+  // streams to fill up the batch before decoding it. It bounds the latency
+  // added by the batching.
+  int32_t max_wait_ms = 5;
+
+  // Number of encoder output frames decoded per stream and batch.
+  int32_t chunk_size = 16;
+
+  // If positive, decoder outputs are cached across chunks in a
+  // DecoderOutputCache of this capacity; see DecodeOneChunk().
+  int32_t decoder_cache_capacity = 0;
+};
+
+/** Decodes many concurrent RNN-T streams with continuous batching.
+
+    Clients create a stream, feed it encoder output frames as they become
+    available, and mark the end of its input. A worker thread collects the
+    streams that have a chunk of frames ready into micro-batches of up to
+    `max_batch_size` streams and decodes each batch with one call to
+    DecodeOneChunk(). Streams join and leave the batches independently, and
+    the decoding state of each stream (a RnntDecodingStream) is carried
+    across its chunks.
+
+    All methods are thread safe.
+
+    Example:
+
+      RnntServer server(module, graph, decoding_config);
+      int64_t s = server.CreateStream();
+      server.AcceptEncoderOut(s, encoder_out0);  // (T0, C)
+      server.AcceptEncoderOut(s, encoder_out1);  // (T1, C)
+      std::vector<int32_t> labels = server.InputFinished(s).get();
+ */
+class RnntServer {
+ public:
+  /**
+     @param module  Jit script module containing the "decoder" and "joiner"
+                    submodules; see DecodeOneChunk().
+     @param decoding_graph  The decoding graph shared by all streams, e.g.,
+                    a trivial graph or an LG graph. It must have
+                    `aux_labels`, which are what the streams return.
+     @param decoding_config  The config of the RNN-T decoding streams.
+     @param config  The batching config.
+   */
+  RnntServer(torch::jit::Module module, FsaClass decoding_graph,
+             const rnnt_decoding::RnntDecodingConfig &decoding_config,
+             const RnntServerConfig &config = RnntServerConfig());
+
+  // Stops the worker thread. Results of unfinished streams are not
+  // computed; their futures report a broken promise.
+  ~RnntServer();
+
+  /// Create a new stream and return its ID.
+  int64_t CreateStream();
+
+  /** Append encoder output frames to a stream.
+
+      @param stream_id  A stream returned by CreateStream() for which
+                        InputFinished() has not been called.
+      @param encoder_out  A 2-D tensor of shape (T, C) on the device of the
+                        model. T may be any number of frames; the frames are
+                        decoded in chunks of `chunk_size` frames.
+   */
+  void AcceptEncoderOut(int64_t stream_id, torch::Tensor encoder_out);
+
+  /** Mark the end of the input of a stream.
+
+      @return Return a future that becomes ready when all frames of the
+              stream have been decoded. It holds the labels on the best path,
+              or the exception thrown while decoding the stream. The stream
+              is removed from the server once the future is ready.
+   */
+  std::future<std::vector<int32_t>> InputFinished(int64_t stream_id);
+
+  /// Return the number of streams that have not finished decoding.
+  int32_t NumStreams();
+
+ private:
+  struct Stream {
+    std::shared_ptr<rnnt_decoding::RnntDecodingStream> decoding_stream;
+    // Frames not yet decoded, in order.
+    std::deque<torch::Tensor> pending;
+    int32_t num_pending_frames = 0;
+    // Number of frames taken for decoding so far.
+    int32_t num_taken_frames = 0;
+    bool input_finished = false;
+    // True if the stream is in ready_.
+    bool queued = false;
+    std::chrono::steady_clock::time_point ready_time;
+    std::promise<std::vector<int32_t>> result;
+    // If not null, decoding the stream failed with this error.
+    std::exception_ptr error;
+  };
+
+  // True if the stream has a chunk to decode. A chunk shorter than
+  // chunk_size is only taken once the input is finished, since it is
+  // padded, so we keep at least one frame until then.
+  bool IsReady(const Stream &s) const;
+
+  // Add the stream to ready_ if it is ready and not there. The caller must
+  // hold mutex_.
+  void MaybeEnqueue(int64_t stream_id, Stream *s);
+
+  // Remove up to chunk_size frames from s->pending and return them as a
+  // (n, C) tensor. The caller must hold mutex_.
+  torch::Tensor TakeChunk(Stream *s);
+
+  void Run();
+
+  // Decode one chunk of each stream. is_final[i] is true if chunks[i] is
+  // the last chunk of streams[i].
+  void DecodeBatch(const std::vector<std::shared_ptr<Stream>> &streams,
+                   const std::vector<torch::Tensor> &chunks,
+                   const std::vector<bool> &is_final);
+
+  torch::jit::Module module_;
+  FsaClass decoding_graph_;
+  std::shared_ptr<Fsa> graph_;
+  rnnt_decoding::RnntDecodingConfig decoding_config_;
+  RnntServerConfig config_;
+  std::unique_ptr<DecoderOutputCache> cache_;
+
+  std::mutex mutex_;
+  std::condition_variable cond_;
+  std::map<int64_t, std::shared_ptr<Stream>> streams_;
+  // IDs of the streams that have a chunk ready, in the order they became
+  // ready.
+  std::deque<int64_t> ready_;
+  int64_t next_stream_id_ = 0;
+  bool stop_ = false;
+
+  std::thread worker_;
+};
+
+}  // namespace k2
+
+#endif  // K2_TORCH_CSRC_RNNT_SERVER_H_
@@ -0,0 +1,125 @@
+/**
+ * Copyright      2026  Xiaomi Corporation
+ *
+ * See LICENSE for clarification regarding multiple authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <chrono>  // NOLINT
+#include <exception>
+#include <future>  // NOLINT
+#include <string>
+#include <thread>  // NOLINT
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "k2/torch/csrc/fsa_algo.h"
+#include "k2/torch/csrc/rnnt_server.h"
+
+namespace k2 {
+
+static constexpr int32_t kVocabSize = 5;
+
+// A fake model: the logits are the encoder output, so the decoding follows
+// its argmax.  The joiner fails if an encoder output frame is >= 100.
+static torch::jit::Module FakeModel() {
+  torch::jit::Module decoder("decoder");
+  decoder.define(R"(
+    def forward(self, y: Tensor, need_pad: bool) -> Tensor:
+        return torch.zeros([y.size(0), )" +
+                 std::to_string(kVocabSize) + R"(])
+  )");
+  torch::jit::Module joiner("joiner");
+  joiner.define(R"(
+    def forward(self, encoder_out: Tensor, decoder_out: Tensor) -> Tensor:
+        if bool(encoder_out.max() >= 100):
+            raise RuntimeError("bad encoder output")
+        return encoder_out + decoder_out.unsqueeze(1)
+  )");
+  torch::jit::Module module("model");
+  module.register_module("decoder", decoder);
+  module.register_module("joiner", joiner);
+  return module;
+}
+
+// Returns `num_frames` frames whose argmax is `symbol`.
+static torch::Tensor Frames(int32_t num_frames, int32_t symbol,
+                            float score = 10) {
+  torch::Tensor ans = torch::zeros({num_frames, kVocabSize});
+  ans.select(1, symbol).fill_(score);
+  return ans;
+}
+
+static std::future_status Wait(std::future<std::vector<int32_t>> &f) {
+  return f.wait_for(std::chrono::seconds(10));
+}
+
+TEST(RnntServer, Decode) {
+  rnnt_decoding::RnntDecodingConfig decoding_config(
+      kVocabSize, /*decoder_history_len*/ 2, /*beam*/ 8, /*max_states*/ 64,
+      /*max_contexts*/ 16);
+  RnntServerConfig config;
+  config.chunk_size = 2;
+  RnntServer server(FakeModel(), TrivialGraph(kVocabSize - 1),
+                    decoding_config, config);
+
+  int64_t s1 = server.CreateStream(), s2 = server.CreateStream();
+  server.AcceptEncoderOut(s1, Frames(3, 2));
+  server.AcceptEncoderOut(s2, Frames(1, 0));
+  server.AcceptEncoderOut(s1, Frames(1, 0));
+  auto f1 = server.InputFinished(s1), f2 = server.InputFinished(s2);
+  // No input at all.
+  auto f3 = server.InputFinished(server.CreateStream());
+  ASSERT_EQ(Wait(f1), std::future_status::ready);
+  ASSERT_EQ(Wait(f2), std::future_status::ready);
+  ASSERT_EQ(Wait(f3), std::future_status::ready);
+  EXPECT_FALSE(f1.get().empty());
+  EXPECT_TRUE(f2.get().empty());
+  EXPECT_TRUE(f3.get().empty());
+  EXPECT_EQ(server.NumStreams(), 0);
+}
+
+TEST(RnntServer, DecodeError) {
+  rnnt_decoding::RnntDecodingConfig decoding_config(
+      kVocabSize, /*decoder_history_len*/ 2, /*beam*/ 8, /*max_states*/ 64,
+      /*max_contexts*/ 16);
+  RnntServerConfig config;
+  config.chunk_size = 2;
+  // Long enough for InputFinished() to be called before the first chunk is
+  // decoded.
+  config.max_wait_ms = 500;
+  RnntServer server(FakeModel(), TrivialGraph(kVocabSize - 1),
+                    decoding_config, config);
+
+  // The first chunk fails, while the input is finished and there are
+  // chunks left.
+  int64_t s1 = server.CreateStream();
+  server.AcceptEncoderOut(s1, Frames(2, 1, /*score*/ 100));
+  server.AcceptEncoderOut(s1, Frames(4, 1));
+  auto f1 = server.InputFinished(s1);
+  ASSERT_EQ(Wait(f1), std::future_status::ready);
+  EXPECT_THROW(f1.get(), std::exception);
+  EXPECT_EQ(server.NumStreams(), 0);
+
+  // The stream fails before its input is finished.
+  int64_t s2 = server.CreateStream();
+  server.AcceptEncoderOut(s2, Frames(4, 1, /*score*/ 100));
+  std::this_thread::sleep_for(std::chrono::milliseconds(1000));
+  auto f2 = server.InputFinished(s2);
+  ASSERT_EQ(Wait(f2), std::future_status::ready);
+  EXPECT_THROW(f2.get(), std::exception);
+  EXPECT_EQ(server.NumStreams(), 0);
+}
+
+}  // namespace k2
@@ -16,59 +16,227 @@
  * limitations under the License.
  */
 
-#include <fstream>
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <mutex>  // NOLINT
 #include <sstream>
 
 #include "k2/csrc/log.h"
 #include "k2/torch/csrc/symbol_table.h"
+#include "k2/torch/csrc/utils.h"
 
 namespace k2 {
 
-SymbolTable::SymbolTable(const std::string &filename) {
-  std::ifstream is(filename);
-  std::string sym;
-  int32_t id;
-  while (is >> sym >> id) {
-    if (sym.size() >= 3) {
+namespace {
+
+inline bool IsSpace(char c) {
+  return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\v' ||
+         c == '\f';
+}
+
+// Compare two byte strings, like std::string::compare().
+inline int32_t CompareBytes(const char *a, int32_t a_size, const char *b,
+                            int32_t b_size) {
+  int32_t ans = std::memcmp(a, b, std::min(a_size, b_size));
+  if (ans != 0) return ans;
+  return a_size < b_size ? -1 : (a_size > b_size ? 1 : 0);
+}
+
+}  // namespace
+
+struct SymbolTable::LazySym2Id {
+  std::once_flag once;
+  std::unordered_map<std::string, int32_t> map;
+};
+
+SymbolTable::SymbolTable(const std::string &filename)
+    : sym2id_(std::make_shared<LazySym2Id>()) {
+  torch::Tensor file = MapFile(filename);
+  const char *data = reinterpret_cast<const char *>(file.data_ptr()),
+             *end = data + file.numel();
+
+  // First find the symbols, as offsets into the file, and their IDs.
+  struct Entry {
+    int64_t begin;
+    int32_t size;
+    int32_t id;
+  };
+  std::vector<Entry> entries;
+  const char *p = data;
+  int32_t max_id = -1;
+  while (true) {
+    while (p != end && IsSpace(*p)) ++p;
+    if (p == end) break;
+    const char *sym = p;
+    while (p != end && !IsSpace(*p)) ++p;
+    Entry entry{sym - data, static_cast<int32_t>(p - sym), 0};
+    while (p != end && IsSpace(*p)) ++p;
+    const char *id = p;
+    bool negative = (p != end && *p == '-');
+    if (negative) ++p;
+    int64_t value = 0;
+    for (; p != end && *p >= '0' && *p <= '9'; ++p) {
+      value = value * 10 + (*p - '0');
+      K2_CHECK_LE(value, std::numeric_limits<int32_t>::max())
+          << "ID too large for symbol " << std::string(sym, entry.size);
+    }
+    K2_CHECK(p != id + negative && (p == end || IsSpace(*p)))
+        << "Invalid ID for symbol " << std::string(sym, entry.size)
+        << " in " << filename;
+    K2_CHECK(!negative || value == 0) << "Negative ID: -" << value;
+    entry.id = static_cast<int32_t>(value);
+    max_id = std::max(max_id, entry.id);
+    entries.push_back(entry);
+  }
+
+  // Then lay out the symbols by ID.
+  std::vector<int32_t> entry_of_id(max_id + 1, -1);
+  for (int32_t i = 0; i != static_cast<int32_t>(entries.size()); ++i) {
+    int32_t &e = entry_of_id[entries[i].id];
+    K2_CHECK_EQ(e, -1) << "Duplicated ID: " << entries[i].id;
+    e = i;
+  }
+  offsets_.resize(max_id + 2);
+  offsets_[0] = 0;
+  chars_.reserve(file.numel());
+  sorted_ids_.reserve(entries.size());
+  for (int32_t i = 0; i <= max_id; ++i) {
+    if (entry_of_id[i] != -1) {
+      const Entry &entry = entries[entry_of_id[i]];
+      const char *sym = data + entry.begin;
       // For BPE-based models, we replace ▁ with a space
       // Unicode 9601, hex 0x2581, utf8 0xe29681
-      const uint8_t *p = reinterpret_cast<const uint8_t *>(sym.c_str());
-      if (p[0] == 0xe2 && p[1] == 0x96 && p[2] == 0x81) {
-        sym = sym.replace(0, 3, " ");
+      const uint8_t *u = reinterpret_cast<const uint8_t *>(sym);
+      if (entry.size >= 3 && u[0] == 0xe2 && u[1] == 0x96 && u[2] == 0x81) {
+        chars_.push_back(' ');
+        chars_.append(sym + 3, entry.size - 3);
+      } else {
+        chars_.append(sym, entry.size);
       }
+      sorted_ids_.push_back(i);
     }
+    offsets_[i + 1] = static_cast<int32_t>(chars_.size());
+  }
 
-    K2_CHECK(!sym.empty());
-    K2_CHECK_EQ(sym2id_.count(sym), 0) << "Duplicated symbol: " << sym;
-    K2_CHECK_EQ(id2sym_.count(id), 0) << "Duplicated ID: " << id;
-
-    sym2id_.insert({sym, id});
-    id2sym_.insert({id, sym});
+  const char *chars = chars_.data();
+  const int32_t *offsets = offsets_.data();
+  auto compare = [chars, offsets](int32_t a, int32_t b) -> int32_t {
+    return CompareBytes(chars + offsets[a], offsets[a + 1] - offsets[a],
+                        chars + offsets[b], offsets[b + 1] - offsets[b]);
+  };
+  std::sort(sorted_ids_.begin(), sorted_ids_.end(),
+            [&compare](int32_t a, int32_t b) { return compare(a, b) < 0; });
+  for (size_t i = 1; i < sorted_ids_.size(); ++i) {
+    K2_CHECK_NE(compare(sorted_ids_[i - 1], sorted_ids_[i]), 0)
+        << "Duplicated symbol: " << (*this)[sorted_ids_[i]];
   }
-  K2_CHECK(is.eof());
+}
+
+int32_t SymbolTable::Find(const std::string &sym) const {
+  const char *chars = chars_.data();
+  const int32_t *offsets = offsets_.data();
+  int32_t sym_size = static_cast<int32_t>(sym.size());
+  auto it = std::lower_bound(
+      sorted_ids_.begin(), sorted_ids_.end(), sym,
+      [chars, offsets, sym_size](int32_t id, const std::string &s) {
+        return CompareBytes(chars + offsets[id], offsets[id + 1] - offsets[id],
+                            s.data(), sym_size) < 0;
+      });
+  if (it == sorted_ids_.end() ||
+      CompareBytes(chars + offsets[*it], offsets[*it + 1] - offsets[*it],
+                   sym.data(), sym_size) != 0)
+    return -1;
+  return static_cast<int32_t>(it - sorted_ids_.begin());
 }
 
 std::string SymbolTable::ToString() const {
   std::ostringstream os;
   char sep = ' ';
-  for (const auto &p : sym2id_) {
-    os << p.first << sep << p.second << "\n";
+  int32_t num_ids = static_cast<int32_t>(offsets_.size()) - 1;
+  for (int32_t id = 0; id < num_ids; ++id) {
+    if (contains(id)) os << (*this)[id] << sep << id << "\n";
   }
   return os.str();
 }
 
-const std::string &SymbolTable::operator[](int32_t id) const {
-  return id2sym_.at(id);
+std::string SymbolTable::operator[](int32_t id) const {
+  K2_CHECK(contains(id)) << "Unknown ID: " << id;
+  return chars_.substr(offsets_[id], offsets_[id + 1] - offsets_[id]);
 }
 
 int32_t SymbolTable::operator[](const std::string &sym) const {
-  return sym2id_.at(sym);
+  int32_t i = Find(sym);
+  K2_CHECK_NE(i, -1) << "Unknown symbol: " << sym;
+  return sorted_ids_[i];
 }
 
-bool SymbolTable::contains(int32_t id) const { return id2sym_.count(id) != 0; }
+bool SymbolTable::contains(int32_t id) const {
+  return id >= 0 && id + 1 < static_cast<int32_t>(offsets_.size()) &&
+         offsets_[id] != offsets_[id + 1];
+}
 
 bool SymbolTable::contains(const std::string &sym) const {
-  return sym2id_.count(sym) != 0;
+  return Find(sym) != -1;
+}
+
+const std::unordered_map<std::string, int32_t> &SymbolTable::sym2id() const {
+  std::call_once(sym2id_->once, [this] {
+    std::unordered_map<std::string, int32_t> &map = sym2id_->map;
+    map.reserve(sorted_ids_.size());
+    for (int32_t id : sorted_ids_) map.emplace((*this)[id], id);
+  });
+  return sym2id_->map;
+}
+
+std::vector<std::string> SymbolTable::Decode(Ragged<int32_t> &ids,
+                                             const std::string &sep /*= ""*/,
+                                             bool strip /*= false*/) const {
+  K2_CHECK_EQ(ids.NumAxes(), 2);
+  torch::Tensor host = RaggedToHost(ids);
+  int32_t num_utts = ids.Dim0();
+  int32_t num_ids = static_cast<int32_t>(offsets_.size()) - 1;
+  const int32_t *row_splits = host.data_ptr<int32_t>(),
+                *values = row_splits + num_utts + 1,
+                *offsets = offsets_.data();
+  const char *chars = chars_.data();
+
+  std::vector<std::string> ans(num_utts);
+  for (int32_t u = 0; u != num_utts; ++u) {
+    int32_t begin = row_splits[u], end = row_splits[u + 1];
+    if (begin == end) continue;
+
+    size_t size = sep.size() * (end - begin - 1);
+    for (int32_t i = begin; i != end; ++i) {
+      int32_t id = values[i];
+      K2_CHECK(id >= 0 && id < num_ids && offsets[id] != offsets[id + 1])
+          << "Unknown ID: " << id;
+      size += offsets[id + 1] - offsets[id];
+    }
+
+    std::string &s = ans[u];
+    s.resize(size);
+    char *p = &s[0];
+    for (int32_t i = begin; i != end; ++i) {
+      if (i != begin) {
+        std::memcpy(p, sep.data(), sep.size());
+        p += sep.size();
+      }
+      int32_t id = values[i];
+      std::memcpy(p, chars + offsets[id], offsets[id + 1] - offsets[id]);
+      p += offsets[id + 1] - offsets[id];
+    }
+
+    if (strip) {
+      size_t first = s.find_first_not_of(' ');
+      if (first == std::string::npos) {
+        s.clear();
+      } else {
+        s = s.substr(first, s.find_last_not_of(' ') - first + 1);
+      }
+    }
+  }
+  return ans;
 }
 
 std::ostream &operator<<(std::ostream &os, const SymbolTable &symbol_table) {
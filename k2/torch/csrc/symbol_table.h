@@ -19,12 +19,22 @@
 #ifndef K2_TORCH_CSRC_SYMBOL_TABLE_H_
 #define K2_TORCH_CSRC_SYMBOL_TABLE_H_
 
+#include <memory>
 #include <string>
 #include <unordered_map>
+#include <vector>
+
+#include "k2/csrc/ragged.h"
 
 namespace k2 {
 
 /// It manages mapping between symbols and integer IDs.
+///
+/// The symbols are kept in a flat string pool indexed by ID, plus an array
+/// of IDs sorted by symbol for looking up symbols with a binary search, so
+/// loading a table with millions of entries, e.g. a large words.txt, does
+/// not build any hash map.  A map from symbols to IDs is only built if
+/// sym2id() is called.
 class SymbolTable {
  public:
   /// Construct a symbol table from a file.
@@ -32,14 +42,15 @@ class SymbolTable {
   ///
   ///    sym ID
   ///
-  /// Fields are separated by space(s).
+  /// Fields are separated by space(s).  The file is mapped into memory
+  /// (see MapFile()) and parsed in place.
   explicit SymbolTable(const std::string &filename);
 
   /// Return a string representation of this symbol table
   std::string ToString() const;
 
   /// Return the symbol corresponding to the given ID.
-  const std::string &operator[](int32_t id) const;
+  std::string operator[](int32_t id) const;
   /// Return the ID corresponding to the given symbol.
   int32_t operator[](const std::string &sym) const;
 
@@ -49,9 +60,52 @@ class SymbolTable {
   /// Return true if there is a given symbol in the symbol table.
   bool contains(const std::string &sym) const;
 
+  /// Return the number of symbols.
+  int32_t NumSymbols() const {
+    return static_cast<int32_t>(sorted_ids_.size());
+  }
+
+  /// Return the map from symbols to IDs.  It is built on the first call,
+  /// which is thread safe, and shared by copies of this table.
+  const std::unordered_map<std::string, int32_t> &sym2id() const;
+
+  /** Convert lists of IDs to strings.
+
+      The symbols are looked up in a flattened copy of the table (one char
+      buffer plus an offsets array indexed by ID), and each output string is
+      sized once and filled in a single pass.
+
+      @param ids  A ragged tensor with axes [utt][id], on any device. It is
+                  moved to the host with a single copy.
+      @param sep  The separator inserted between symbols, e.g., " " for
+                  words. Use "" for BPE tokens: the leading `\u2581` of a
+                  token was already replaced with a space on loading, so
+                  concatenating the tokens gives the words.
+      @param strip  If true, remove leading and trailing spaces of each
+                  string, e.g., the leading space of BPE output.
+      @return Return a vector of size ids.Dim0() containing the string of
+              each utterance. It is an error if an ID is not in the table.
+   */
+  std::vector<std::string> Decode(Ragged<int32_t> &ids,
+                                  const std::string &sep = "",
+                                  bool strip = false) const;
+
  private:
-  std::unordered_map<std::string, int32_t> sym2id_;
-  std::unordered_map<int32_t, std::string> id2sym_;
+  // Return the index into sorted_ids_ of `sym`, or -1 if it is not present.
+  int32_t Find(const std::string &sym) const;
+
+  // The symbols of IDs 0, 1, ..., max ID, concatenated. The symbol of ID i
+  // is chars_[offsets_[i]:offsets_[i+1]]; it is empty if there is no
+  // symbol with ID i, since symbols are never empty.
+  std::string chars_;
+  std::vector<int32_t> offsets_;
+
+  // The IDs that have a symbol, sorted by their symbols (compared as
+  // bytes).
+  std::vector<int32_t> sorted_ids_;
+
+  struct LazySym2Id;
+  std::shared_ptr<LazySym2Id> sym2id_;
 };
 
 std::ostream &operator<<(std::ostream &os, const SymbolTable &symbol_table);
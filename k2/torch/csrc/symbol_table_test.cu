@@ -0,0 +1,57 @@
+/**
+ * Copyright      2026  Xiaomi Corporation
+ *
+ * See LICENSE for clarification regarding multiple authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <cstdio>
+#include <fstream>
+#include <string>
+
+#include "gtest/gtest.h"
+#include "k2/torch/csrc/symbol_table.h"
+
+namespace k2 {
+
+TEST(SymbolTable, FromFile) {
+  std::string filename = ::testing::TempDir() + "k2_symbol_table_test.txt";
+  {
+    std::ofstream os(filename);
+    // \xe2\x96\x81 is the BPE word-start symbol, replaced with a space.
+    os << "<eps> 0\n\xe2\x96\x81hi 3\n  b\t1\n\nc 2";
+  }
+  SymbolTable table(filename);
+  std::remove(filename.c_str());
+
+  EXPECT_EQ(table.NumSymbols(), 4);
+  EXPECT_EQ(table[0], "<eps>");
+  EXPECT_EQ(table[3], " hi");
+  EXPECT_EQ(table["c"], 2);
+  EXPECT_EQ(table[" hi"], 3);
+  EXPECT_TRUE(table.contains(1));
+  EXPECT_FALSE(table.contains(4));
+  EXPECT_FALSE(table.contains(-1));
+  EXPECT_TRUE(table.contains("b"));
+  EXPECT_FALSE(table.contains("d"));
+  EXPECT_EQ(table.ToString(), "<eps> 0\nb 1\nc 2\n hi 3\n");
+
+  // The map is built on first use and shared by copies.
+  SymbolTable copy = table;
+  EXPECT_EQ(&copy.sym2id(), &table.sym2id());
+  EXPECT_EQ(table.sym2id().size(), 4);
+  EXPECT_EQ(table.sym2id().at("b"), 1);
+}
+
+}  // namespace k2
@@ -20,7 +20,9 @@
 #include "k2/torch/csrc/decode.h"
 #include "k2/torch/csrc/deserialization.h"
 #include "k2/torch/csrc/fsa_algo.h"
+#include "k2/torch/csrc/native_fsa_io.h"
 #include "k2/torch/csrc/torch_api.h"
+#include "k2/torch/csrc/utils.h"
 
 namespace k2 {
 
@@ -71,9 +73,37 @@ FsaClassPtr GetCtcTopo(int32_t max_token, bool modified, torch::Device device) {
 
 FsaClassPtr LoadFsaClass(const std::string &filename,
                          torch::Device map_location) {
-  return std::make_shared<FsaClass>(LoadFsa(filename, map_location));
+  auto ans = std::make_shared<FsaClass>(LoadFsa(filename, map_location));
+  ans->PrepareForSharing();
+  return ans;
 }
 
+void SaveFsaClass(const FsaClassPtr &fsa, const std::string &filename) {
+  SaveFsaNative(*fsa, filename);
+}
+
+SharedFsaPtr ExportFsaClassShared(const FsaClassPtr &fsa,
+                                  const std::string &name) {
+  return std::make_shared<SharedFsa>(*fsa, name);
+}
+
+FsaClassPtr OpenSharedFsaClass(const std::string &name) {
+  auto ans = std::make_shared<FsaClass>(OpenSharedFsa(name));
+  ans->PrepareForSharing();
+  return ans;
+}
+
+FsaClassPtr LoadFsaClassCached(const std::string &filename,
+                               torch::Device map_location) {
+  return LoadFsaCached(filename, map_location);
+}
+
+int32_t EvictCachedFsaClass(const std::string &filename) {
+  return EvictCachedFsa(filename);
+}
+
+int32_t EvictUnusedCachedFsaClasses() { return EvictUnusedCachedFsas(); }
+
 FsaClassPtr GetLattice(torch::Tensor log_softmax_out,
                           torch::Tensor log_softmax_out_lens,
                           FsaClassPtr decoding_graph,
@@ -102,10 +132,8 @@ FsaClassPtr GetLattice(torch::Tensor log_softmax_out,
 }
 
 std::vector<std::vector<int32_t>> BestPath(const FsaClassPtr &lattice) {
-  FsaClass paths = ShortestPath(*lattice);
-  auto ragged_aux_labels = GetTexts(paths);
-  auto aux_labels_vec = ragged_aux_labels.ToVecVec();
-  return aux_labels_vec;
+  Ragged<int32_t> ragged_aux_labels = GetBestPathTexts(*lattice);
+  return RaggedToVecVec(ragged_aux_labels);
 }
 
 }  // namespace k2
@@ -25,6 +25,17 @@
 
 #include "torch/script.h"
 
+/*
+  Thread safety: the functions below may be called concurrently from
+  different threads, also with the same decoding graph, as long as no thread
+  modifies an FSA that another thread is using.  The FSAs returned by
+  LoadFsaClass() and LoadFsaClassCached() are only read by GetLattice().
+
+  The CUDA work of a call is issued on the current PyTorch stream of the
+  calling thread (see c10::cuda::CUDAStreamGuard), so threads that decode on
+  the same GPU run in parallel if each of them selects its own stream.
+ */
+
 namespace k2 {
 
 class RaggedShape;
@@ -75,6 +86,9 @@ torch::Tensor RowSplits(RaggedShapePtr shape, int32_t axis);
 class FsaClass;
 using FsaClassPtr = std::shared_ptr<FsaClass>;
 
+class SharedFsa;
+using SharedFsaPtr = std::shared_ptr<SharedFsa>;
+
 /* Create a CTC topology.
 
    Note:
@@ -110,6 +124,74 @@ FsaClassPtr GetCtcTopo(int32_t max_token, bool modified = false,
 FsaClassPtr LoadFsaClass(const std::string &filename,
                          torch::Device map_location = torch::kCPU);
 
+/**
+  Save an FSA in k2's native binary format.  LoadFsaClass() and
+  LoadFsaClassCached() accept such files and load them much faster than
+  files written by `torch.save()`, as they are memory-mapped rather than
+  unpickled.
+
+  @param fsa  The FSA to save.
+  @param filename  The file to write.
+ */
+void SaveFsaClass(const FsaClassPtr &fsa, const std::string &filename);
+
+/**
+  Export an FSA to shared memory, so that decoder processes on the same
+  machine can open it with OpenSharedFsaClass() instead of loading their own
+  copy.  For an FSA on CUDA, its data stays in one device buffer that the
+  other processes map with CUDA IPC.  See SharedFsa in native_fsa_io.h.
+
+  @param fsa  The FSA to export.
+  @param name  The name of the shared memory segment, e.g. "/k2-hlg".
+  @return Return the exported FSA; it must be kept alive while other
+          processes use it.
+ */
+SharedFsaPtr ExportFsaClassShared(const FsaClassPtr &fsa,
+                                  const std::string &name);
+
+/**
+  Open an FSA exported by ExportFsaClassShared() in another process.  No
+  data is copied.
+
+  Caution: The returned FSA is shared, so it must not be modified.
+
+  @param name  The name passed to ExportFsaClassShared().
+  @return Return the shared FSA.
+ */
+FsaClassPtr OpenSharedFsaClass(const std::string &name);
+
+/**
+  Like LoadFsaClass(), but uses a process-wide cache keyed by the filename,
+  the modification time of the file and `map_location`, so that decoders
+  loading the same graph on the same device share one copy of it.  If the
+  file has changed since it was cached, it is loaded again.
+
+  Caution: The returned FSA is shared, so it must not be modified.
+
+  @param filename Path to the filename produced in Python by `torch.save()`.
+  @param map_location  The device on which to return the FSA.
+  @return Return the FSA contained in the filename.
+ */
+FsaClassPtr LoadFsaClassCached(const std::string &filename,
+                               torch::Device map_location = torch::kCPU);
+
+/**
+  Remove the cached graphs of `filename` (for all devices) from the cache
+  used by LoadFsaClassCached(); if `filename` is empty, remove all of them.
+  Graphs that are still in use are freed when their last user releases them.
+
+  @return Return the number of cached graphs removed.
+ */
+int32_t EvictCachedFsaClass(const std::string &filename = "");
+
+/**
+  Remove the graphs that are only referenced by the cache used by
+  LoadFsaClassCached(), i.e. that no decoder is using any more.
+
+  @return Return the number of cached graphs removed.
+ */
+int32_t EvictUnusedCachedFsaClasses();
+
 /** Get the lattice of CTC decode.
  * @param log_softmax_out A tensor of shape (N, T, C) containing the output
  *                        from a log_softmax layer.
@@ -16,6 +16,14 @@
  * limitations under the License.
  */
 
+#ifndef _MSC_VER
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <fstream>
 #include <memory>
 #include <string>
 #include <utility>
@@ -159,4 +167,64 @@ torch::Tensor TensorToTorch(Tensor &tensor) {
       [saved_region = tensor.GetRegion()](void *) {}, options);
 }
 
+torch::Tensor RaggedToHost(Ragged<int32_t> &src) {
+  K2_CHECK_EQ(src.NumAxes(), 2);
+  ContextPtr c = src.Context();
+  const Array1<int32_t> *srcs[] = {&src.RowSplits(1), &src.values};
+  Array1<int32_t> packed = Cat(c, 2, srcs);
+  if (c->GetDeviceType() == kCpu) return Array1ToTorch(packed);
+
+  torch::Tensor ans = torch::empty(
+      {packed.Dim()}, torch::dtype(torch::kInt).pinned_memory(true));
+  ans.copy_(Array1ToTorch(packed));
+  return ans;
+}
+
+std::vector<std::vector<int32_t>> RaggedToVecVec(Ragged<int32_t> &src) {
+  torch::Tensor host = RaggedToHost(src);
+  int32_t dim0 = src.Dim0();
+  const int32_t *row_splits_data = host.data_ptr<int32_t>(),
+                *values_data = row_splits_data + dim0 + 1;
+
+  std::vector<std::vector<int32_t>> ans(dim0);
+  for (int32_t i = 0; i != dim0; ++i) {
+    ans[i].assign(values_data + row_splits_data[i],
+                  values_data + row_splits_data[i + 1]);
+  }
+  return ans;
+}
+
+torch::Tensor MapFile(const std::string &filename) {
+#ifndef _MSC_VER
+  int fd = open(filename.c_str(), O_RDONLY);
+  K2_CHECK_GE(fd, 0) << "Failed to open '" << filename << "'";
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    close(fd);
+    K2_LOG(FATAL) << "Failed to stat '" << filename << "'";
+  }
+  size_t size = st.st_size;
+  if (size == 0) {
+    close(fd);
+    return torch::empty({0}, torch::kByte);
+  }
+  void *addr =
+      mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  close(fd);
+  K2_CHECK(addr != MAP_FAILED) << "Failed to mmap '" << filename << "'";
+  return torch::from_blob(
+      addr, {static_cast<int64_t>(size)},
+      [addr, size](void *) { munmap(addr, size); }, torch::kByte);
+#else
+  std::ifstream is(filename, std::ios::binary | std::ios::ate);
+  K2_CHECK(is) << "Failed to open '" << filename << "'";
+  int64_t size = is.tellg();
+  torch::Tensor ans = torch::empty({size}, torch::kByte);
+  is.seekg(0);
+  is.read(reinterpret_cast<char *>(ans.data_ptr()), size);
+  K2_CHECK(is) << "Failed to read '" << filename << "'";
+  return ans;
+#endif
+}
+
 }  // namespace k2
@@ -20,12 +20,14 @@
 #define K2_TORCH_CSRC_UTILS_H_
 
 #include <string>
+#include <vector>
 
 #include "k2/csrc/array.h"
 #include "k2/csrc/array_ops.h"
 #include "k2/csrc/context.h"
 #include "k2/csrc/fsa.h"
 #include "k2/csrc/pytorch_context.h"
+#include "k2/csrc/ragged.h"
 #include "k2/csrc/tensor.h"
 #include "k2/csrc/tensor_ops.h"
 #include "torch/script.h"
@@ -226,6 +228,36 @@ torch::Tensor IndexSelect(torch::Tensor src, torch::Tensor index,
   return TensorToTorch(ans);
 }
 
+/** Copy the row_splits and values of a ragged tensor with 2 axes to the host.
+    If `src` is on a CUDA device, they are packed on the device and moved
+    with a single copy into pinned memory.
+
+    @param src  A ragged tensor with 2 axes, on any device.
+    @return Return a 1-D int32 tensor on CPU containing
+            src.RowSplits(1) (src.Dim0() + 1 elements) followed by
+            src.values.
+ */
+torch::Tensor RaggedToHost(Ragged<int32_t> &src);
+
+/** Convert a ragged tensor with 2 axes to a list-of-list, like
+    Ragged<int32_t>::ToVecVec(), but with a single device-to-host copy;
+    see RaggedToHost().
+
+    @param src  A ragged tensor with 2 axes, on any device.
+    @return Return a vector of size src.Dim0(); ans[i] contains the elements
+            of the i-th sublist of `src`.
+ */
+std::vector<std::vector<int32_t>> RaggedToVecVec(Ragged<int32_t> &src);
+
+/** Return the contents of a file as a 1-D torch.uint8 CPU tensor.  Where
+    mmap is available the tensor points into a private (copy-on-write)
+    mapping of the file, which is unmapped when the tensor's storage is
+    freed, so large files are not copied.
+
+    @param filename  The file to map.
+ */
+torch::Tensor MapFile(const std::string &filename);
+
 }  // namespace k2
 
 #endif  // K2_TORCH_CSRC_UTILS_H_
@@ -16,7 +16,10 @@
  * limitations under the License.
  */
 
+#include <condition_variable>  // NOLINT
+#include <exception>
 #include <fstream>
+#include <mutex>  // NOLINT
 #include <utility>
 #include <vector>
 
@@ -128,12 +131,38 @@ torch::Tensor ReadWave(const std::string &filename,
 }
 
 std::vector<torch::Tensor> ReadWave(const std::vector<std::string> &filenames,
-                                    float expected_sample_rate) {
-  std::vector<torch::Tensor> ans;
-  ans.reserve(filenames.size());
-  for (const auto &path : filenames) {
-    ans.emplace_back(ReadWave(path, expected_sample_rate));
+                                    float expected_sample_rate,
+                                    ThreadPool *pool /*= nullptr*/) {
+  int32_t num_files = static_cast<int32_t>(filenames.size());
+  std::vector<torch::Tensor> ans(num_files);
+  if (pool == nullptr || num_files <= 1) {
+    for (int32_t i = 0; i != num_files; ++i)
+      ans[i] = ReadWave(filenames[i], expected_sample_rate);
+    return ans;
   }
+
+  // We don't use pool->WaitAllTasksFinished() since the pool may be shared
+  // with tasks that have nothing to do with us.
+  std::mutex mutex;
+  std::condition_variable cond;
+  int32_t num_pending = num_files;
+  std::exception_ptr error;
+  for (int32_t i = 0; i != num_files; ++i) {
+    pool->SubmitTask([&, i]() -> void {
+      std::exception_ptr this_error;
+      try {
+        ans[i] = ReadWave(filenames[i], expected_sample_rate);
+      } catch (...) {
+        this_error = std::current_exception();
+      }
+      std::lock_guard<std::mutex> lock(mutex);
+      if (this_error && !error) error = this_error;
+      if (--num_pending == 0) cond.notify_one();
+    });
+  }
+  std::unique_lock<std::mutex> lock(mutex);
+  cond.wait(lock, [&num_pending]() { return num_pending == 0; });
+  if (error) std::rethrow_exception(error);
   return ans;
 }
 
@@ -23,6 +23,7 @@
 #include <string>
 #include <vector>
 
+#include "k2/csrc/thread_pool.h"
 #include "torch/script.h"
 
 namespace k2 {
@@ -72,9 +73,17 @@ class WaveReader {
  */
 torch::Tensor ReadWave(const std::string &filename, float expected_sample_rate);
 
-/// Same `ReadWave` above. It supports reading a list of wave files.
+/** Same `ReadWave` above. It supports reading a list of wave files.
+
+    @param pool  If not null, the files are read in parallel by the threads
+                 of this pool and the function returns when all of them
+                 have been read; other tasks in the pool are not waited for.
+                 If null, the files are read one after another in the calling
+                 thread.
+ */
 std::vector<torch::Tensor> ReadWave(const std::vector<std::string> &filenames,
-                                    float expected_sample_rate);
+                                    float expected_sample_rate,
+                                    ThreadPool *pool = nullptr);
 
 }  // namespace k2
 
@@ -16,6 +16,12 @@
  * limitations under the License.
  */
 
+#include <cassert>
+#include <cstdio>
+#include <fstream>
+#include <string>
+#include <vector>
+
 #include "gtest/gtest.h"
 #include "k2/csrc/log.h"
 #include "k2/torch/csrc/test_wave_data.h"
@@ -34,4 +40,34 @@ TEST(WaveReader, Mono) {
   EXPECT_EQ(reader.SampleRate(), 16000);
 }
 
+TEST(WaveReader, ReadWaveWithThreadPool) {
+  char pattern[] = "/tmp/k2_test.XXXXXX";
+#ifndef _MSC_VER
+  char *dir_name = mkdtemp(pattern);
+#else
+  char *dir_name = "./";
+#endif
+  assert(dir_name != nullptr);
+
+  std::vector<std::string> filenames;
+  for (int32_t i = 0; i != 5; ++i) {
+    filenames.push_back(std::string(dir_name) + "/" + std::to_string(i) +
+                        ".wav");
+    std::ofstream os(filenames.back(), std::ios::binary);
+    os.write(reinterpret_cast<const char *>(kTestWav), sizeof(kTestWav));
+  }
+
+  ThreadPool pool(2);
+  std::vector<torch::Tensor> expected = ReadWave(filenames, 16000);
+  std::vector<torch::Tensor> waves = ReadWave(filenames, 16000, &pool);
+  ASSERT_EQ(waves.size(), filenames.size());
+  for (size_t i = 0; i != waves.size(); ++i)
+    EXPECT_TRUE(waves[i].equal(expected[i]));
+
+  for (const auto &f : filenames) {
+    int32_t ret = remove(f.c_str());
+    assert(ret == 0);
+  }
+}
+
 }  // namespace k2